@@ -16,8 +16,11 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_BATCHING_BATCHING_OPTIONS_H_
 #define TENSORFLOW_SERVING_BATCHING_BATCHING_OPTIONS_H_
 
+#include <string>
 #include <vector>
 
+#include "tensorflow/core/platform/types.h"
+
 namespace tensorflow {
 namespace serving {
 
@@ -75,6 +78,177 @@ struct BatchingOptions {
   // (modulo zeroth dimension) and this option is set to false,
   // then error Status will be returned.
   bool pad_variable_length_inputs = false;
+
+  // A ragged input, fed to Run() as the tensor of its flat values and the
+  // tensors of its row splits, outermost first (as in
+  // tf.RaggedTensor.nested_row_splits).
+  struct RaggedInput {
+    string values;
+    std::vector<string> nested_row_splits;
+  };
+
+  // Inputs that are batched without padding. Instead of being concatenated
+  // along their zeroth dimension, the values of these inputs are concatenated
+  // and their row splits are shifted and concatenated, so that tasks with
+  // rows of different lengths cost no padding. The batch size of a task is
+  // given by its outermost row splits. Padding to 'allowed_batch_sizes'
+  // appends empty rows.
+  //
+  // This is the natural layout of inputs such as the categorical-set features
+  // of decision forest models, which pass each ragged feature as its values
+  // and row splits.
+  //
+  // Each tensor may belong to at most one ragged input. Row splits must be 1-D
+  // DT_INT32 or DT_INT64 tensors. Ragged inputs are not supported with large
+  // batch splitting, and disable 'incremental_input_merge'.
+  std::vector<RaggedInput> ragged_inputs;
+
+  // If set, BatchingSession routes the Run() calls of each signature to
+  // separate batch queues ("buckets") by length, so that short inputs are not
+  // batched with (and padded to the length of) long ones. The length of a call
+  // is the largest size of dimension 'length_bucket_dim' among its input
+  // tensors; tensors without that dimension and ragged inputs are ignored.
+  //
+  // A call of length L goes to the first bucket whose boundary is >= L, and
+  // calls longer than the last boundary go to one more bucket. Each bucket is
+  // a batch queue of its own, obtained from the scheduler creator of the
+  // signature, and batches (and rounds to 'allowed_batch_sizes')
+  // independently.
+  //
+  // For example, with boundaries [16, 128] calls are batched in three buckets:
+  // lengths up to 16, 17 to 128 and above 128.
+  //
+  // IMPORTANT: The entries must be in increasing order.
+  //
+  // If left empty, all the calls of a signature share one batch queue.
+  std::vector<int64> length_bucket_boundaries;
+
+  // See 'length_bucket_boundaries'.
+  int length_bucket_dim = 1;
+
+  // If positive, the maximum number of batches a BatchingSession processes at
+  // once, across all its signatures. When the batch threads are shared with
+  // other sessions (e.g. through a SharedBatchScheduler shared by all the
+  // servables of a server), this keeps one busy model from occupying all of
+  // them. Batches over the limit do not hold a batch thread: they are queued,
+  // and processed by the threads already running batches of the session.
+  //
+  // If zero, the number of batch threads is the only limit.
+  int max_concurrent_batches = 0;
+
+  // If set (and 'allowed_batch_sizes' is set), BatchingSession measures the
+  // processing time of the batches of each allowed batch size. A batch that
+  // would be padded is split at a task boundary into two batches processed
+  // one after the other, if the measurements show that this is faster than
+  // processing it padded. For example, with allowed batch sizes [32, 64] a
+  // batch of size 36 may run as batches of 32 and 4 (padded to 32) if a batch
+  // of 64 takes more than twice as long as one of 32.
+  //
+  // Splits are only considered once all the sizes involved have been
+  // measured.
+  bool split_instead_of_padding = false;
+
+  // If set, BatchingSession splits a Run() call larger than the maximum task
+  // size of its batch scheduler into calls of that size, which are scheduled
+  // separately and processed in parallel by the batch threads, instead of
+  // failing it. The outputs are concatenated back once all of them are done.
+  //
+  // Unlike 'enable_large_batch_splitting' of the batch schedulers, this does
+  // not need the scheduler's cooperation, and covers calls larger than the
+  // input batch size limit. Not supported with 'ragged_inputs'.
+  bool split_large_requests = false;
+
+  // If set to true, the inputs of each task are copied into a batch buffer as
+  // soon as the task joins the batch, instead of being concatenated in one
+  // pass once the batch is closed. The merge then overlaps with the time the
+  // batch stays open.
+  //
+  // This only pays off with batch schedulers that hand batches to the batch
+  // thread while they are still filling up (e.g. StreamingBatchScheduler). With
+  // schedulers that only hand out closed batches, the merge cost is unchanged.
+  // Tasks are admitted one at a time while this is set, and each batch handed
+  // out open takes a short-lived thread to wait for it to close.
+  //
+  // The buffers are preallocated to the last entry of 'allowed_batch_sizes' if
+  // set, and grown as needed otherwise. This option is ignored if
+  // 'pad_variable_length_inputs' is true, since the padded shapes are only
+  // known once the batch is closed. Batches with inputs that cannot be merged
+  // incrementally fall back to the regular merge.
+  bool incremental_input_merge = false;
+
+  // If set to true, BatchingSession gives each signature a second, low-priority
+  // lane for bulk traffic. Run() calls whose
+  // 'RunOptions.experimental.run_handler_pool_options.priority' is below
+  // 'bulk_priority_threshold' go to that lane, and are never batched with
+  // other calls except to fill the padding of their batches (see
+  // 'allowed_batch_sizes'), which costs nothing. The remaining bulk calls are
+  // processed in batches of their own, scheduled through a separate queue of
+  // the batch scheduler. While regular calls are waiting, the bulk lane only
+  // gets one batch for every 'regular_batches_per_bulk_batch' regular batches.
+  //
+  // Bulk calls larger than the maximum batch size go to the regular lane.
+  bool enable_bulk_lane = false;
+
+  // See 'enable_bulk_lane'. With the default value, calls need a negative
+  // priority to be treated as bulk traffic.
+  int64 bulk_priority_threshold = 0;
+
+  // See 'enable_bulk_lane'. The weight of the regular lane relative to the
+  // bulk lane, when both have calls waiting. Must be positive. With 1, the
+  // lanes take turns.
+  int regular_batches_per_bulk_batch = 1;
+
+  // If positive, BatchingSession routes the Run() calls of at least this many
+  // rows (i.e. zeroth dimension size) to a separate batch queue of their
+  // signature, so that a few large calls do not hold up the many small ones
+  // behind them, and the small calls do not fragment the batches of the large
+  // ones. The queue of the large calls is obtained from the
+  // 'large_request_scheduler_creator' of the signature if set (e.g. with a
+  // longer batch timeout, to fill the batches), and from its
+  // 'scheduler_creator' otherwise. With 'split_large_requests', the large calls
+  // that do not fit in a batch are split across the batch threads. Unless the
+  // creators use different schedulers, the batches of both queues run on the
+  // same batch threads, so a large batch still holds one while it runs.
+  //
+  // The length buckets (see 'length_bucket_boundaries') only apply to the
+  // small calls, and the bulk lane (see 'enable_bulk_lane') takes precedence.
+  int64 large_request_min_rows = 0;
+
+  // If set to true, the batch threads only signal the Run() calls of a batch
+  // once it has run, and each call slices its outputs out of the batched ones
+  // on its own thread, instead of the batch thread splitting the outputs of
+  // all the calls (and copying the unaligned slices) before taking the next
+  // batch. Likewise, the outputs of the calls split by 'split_large_requests'
+  // are concatenated on the calling thread rather than on the batch thread of
+  // their last piece. This raises the throughput of the batches of many calls,
+  // at the cost of the batched outputs staying alive until every call has
+  // taken its slices.
+  bool split_outputs_on_requesting_threads = false;
+
+  // If set to true, BatchingSession favors the Run() calls closest to their
+  // deadline, i.e. their enqueue time plus 'RunOptions.timeout_in_ms':
+  //  - the calls of a batch that are past their deadline are failed and removed
+  //    from it before its inputs are merged, instead of being processed along
+  //    with the others;
+  //  - the batches deferred by 'max_concurrent_batches' are processed in order
+  //    of the earliest deadline of their calls, instead of in arrival order;
+  //  - the pending calls of the bulk lanes are taken in order of deadline.
+  // The queues of the batch schedulers themselves keep the arrival order,
+  // which is the deadline order when all the calls have the same timeout.
+  bool earliest_deadline_first = false;
+
+  // If positive, the merged input tensors of the batches are built in buffers
+  // recycled from earlier batches rather than in newly allocated ones, which
+  // keeps large batches off the slow path of the allocator. Up to this many
+  // buffers are kept for each input tensor name; a buffer is reused for a
+  // batch whose merged tensor has its type and shape (i.e. with
+  // 'allowed_batch_sizes', one of a few padded batch sizes), once nothing
+  // references it anymore (e.g. an output forwarded from the input).
+  int num_pooled_input_buffers = 0;
+
+  // The name of the model the session serves. If set, the session records its
+  // batches and the depth of its queues in BatchingStats under that name.
+  string model_name;
 };
 
 }  // namespace serving
@@ -17,12 +17,20 @@ limitations under the License.
 
 #include <stddef.h>
 
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <set>
 
 #include "tensorflow/core/framework/cost_graph.pb.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/framework/tensor_util.h"
+#include "tensorflow/core/framework/types.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/notification.h"
 #include "tensorflow/core/lib/core/status.h"
@@ -30,17 +38,20 @@ limitations under the License.
 #include "tensorflow/core/lib/monitoring/percentile_sampler.h"
 #include "tensorflow/core/lib/monitoring/sampler.h"
 #include "tensorflow/core/lib/strings/str_util.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/macros.h"
 #include "tensorflow/core/platform/threadpool_options.h"
 #include "tensorflow/core/platform/types.h"
 #include "tensorflow/core/profiler/lib/traceme.h"
 #include "tensorflow/core/profiler/lib/traceme_encode.h"
 #include "tensorflow/core/public/session.h"
+#include "tensorflow_serving/batching/batching_stats.h"
 #include "tensorflow_serving/batching/batching_util.h"
 #include "tensorflow_serving/batching/incremental_barrier.h"
 #include "tensorflow_serving/batching/threadsafe_status.h"
 #include "tensorflow_serving/servables/tensorflow/serving_session.h"
 #include "tensorflow_serving/util/hash.h"
+#include "tensorflow_serving/util/trace_context.h"
 
 namespace tensorflow {
 namespace serving {
@@ -54,6 +65,14 @@ auto* queuing_latency = monitoring::Sampler<1>::New(
     // Scale of 100, power of 1.2 with bucket count 52 (~1 second).
     monitoring::Buckets::Exponential(100, 1.2, 52));
 
+auto* batch_stage_latency = monitoring::Sampler<2>::New(
+    {"/tensorflow/serving/batching_session/stage_latency",
+     "Distribution of wall time spent (in microseconds) in each stage of "
+     "processing a batch",
+     "thread_pool_name", "stage"},
+    // Scale of 10, power of 1.8 with bucket count 33 (~20 minutes).
+    monitoring::Buckets::Exponential(10, 1.8, 33));
+
 string TensorSignatureDebugString(const TensorSignature& signature) {
   return strings::StrCat("{input_tensors: <",
                          str_util::Join(signature.input_tensors, ", "),
@@ -119,6 +138,458 @@ std::vector<std::vector<std::pair<string, Tensor>>> GetTaskInputsVector(
   return all_task_inputs;
 }
 
+// Copies 'num_rows' rows (along the 0th dimension) of 'src', starting at row
+// 'src_row', into 'dst', starting at row 'dst_row'. Both tensors must have the
+// same dtype and equal dims except the 0th one.
+Status CopyTensorRows(const Tensor& src, int64 src_row, int64 num_rows,
+                      int64 dst_row, Tensor* dst) {
+  if (num_rows == 0) {
+    return Status::OK();
+  }
+  const int64 row_num_elements = src.NumElements() / src.dim_size(0);
+  if (DataTypeCanUseMemcpy(src.dtype())) {
+    const int64 row_bytes = row_num_elements * DataTypeSize(src.dtype());
+    std::memcpy(
+        const_cast<char*>(dst->tensor_data().data()) + dst_row * row_bytes,
+        src.tensor_data().data() + src_row * row_bytes, num_rows * row_bytes);
+    return Status::OK();
+  }
+  if (src.dtype() == DT_STRING) {
+    const auto src_flat = src.unaligned_flat<tstring>();
+    auto dst_flat = dst->unaligned_flat<tstring>();
+    const int64 src_begin = src_row * row_num_elements;
+    const int64 dst_begin = dst_row * row_num_elements;
+    for (int64 i = 0; i < num_rows * row_num_elements; ++i) {
+      dst_flat(dst_begin + i) = src_flat(src_begin + i);
+    }
+    return Status::OK();
+  }
+  return errors::Unimplemented("Incremental merge of ",
+                               DataTypeString(src.dtype()),
+                               " tensors is not supported");
+}
+
+// Splits the first rows (along the 0th dimension) of 'tensor' into pieces of
+// 'sizes' rows each, ignoring the rows left (i.e. the padding). The pieces are
+// slices sharing the buffer of 'tensor', except the misaligned ones, which are
+// copied since Eigen expects tensor data to be aligned.
+Status SliceTensorRows(const Tensor& tensor, const std::vector<int64>& sizes,
+                       std::vector<Tensor>* pieces) {
+  pieces->clear();
+  pieces->reserve(sizes.size());
+  int64 row = 0;
+  for (const int64 size : sizes) {
+    if (size < 0 || row + size > tensor.dim_size(0)) {
+      return errors::Internal("Cannot slice rows [", row, ", ", row + size,
+                              ") of a tensor of ", tensor.dim_size(0),
+                              " rows");
+    }
+    Tensor piece = tensor.Slice(row, row + size);
+    if (!piece.IsAligned()) {
+      piece = tensor::DeepCopy(piece);
+    }
+    pieces->push_back(std::move(piece));
+    row += size;
+  }
+  return Status::OK();
+}
+
+// Sets 'outputs' to the rows [row, row + num_rows) of the tensors named
+// 'output_tensor_names' among 'batch_outputs', the outputs of a batch of
+// 'signature'. See BatchingSessionOptions::split_outputs_on_requesting_threads.
+Status SliceTaskOutputs(const TensorSignature& signature,
+                        const std::vector<Tensor>& batch_outputs,
+                        const int64 row, const int64 num_rows,
+                        const std::vector<string>& output_tensor_names,
+                        std::vector<Tensor>* outputs) {
+  outputs->reserve(output_tensor_names.size());
+  for (const string& tensor_name : output_tensor_names) {
+    const auto output = signature.output_tensors.find(tensor_name);
+    if (output == signature.output_tensors.end()) {
+      return errors::Internal("Task does not conform to batch signature");
+    }
+    const Tensor& tensor = batch_outputs[std::distance(
+        signature.output_tensors.begin(), output)];
+    if (row + num_rows > tensor.dim_size(0)) {
+      return errors::Internal("Cannot slice rows [", row, ", ", row + num_rows,
+                              ") of a tensor of ", tensor.dim_size(0),
+                              " rows");
+    }
+    Tensor piece = tensor.Slice(row, row + num_rows);
+    if (!piece.IsAligned()) {
+      piece = tensor::DeepCopy(piece);
+    }
+    outputs->push_back(std::move(piece));
+  }
+  return Status::OK();
+}
+
+// Sets 'sliced_inputs' to the rows [row, row + num_rows) of 'merged_inputs',
+// the inputs of a batch merged by BatchingSession. Returns false, leaving
+// 'sliced_inputs' unchanged, if they do not all have that many rows.
+bool SliceMergedInputs(
+    const std::vector<std::pair<string, Tensor>>& merged_inputs,
+    const int64 row, const int64 num_rows,
+    std::vector<std::pair<string, Tensor>>* sliced_inputs) {
+  for (const auto& input : merged_inputs) {
+    if (input.second.dims() == 0 ||
+        row + num_rows > input.second.dim_size(0)) {
+      return false;
+    }
+  }
+  sliced_inputs->reserve(merged_inputs.size());
+  for (const auto& input : merged_inputs) {
+    Tensor piece = input.second.Slice(row, row + num_rows);
+    if (!piece.IsAligned()) {
+      piece = tensor::DeepCopy(piece);
+    }
+    sliced_inputs->emplace_back(input.first, std::move(piece));
+  }
+  return true;
+}
+
+// Merges the inputs of the tasks of a batch, via concatenation of
+// correspondingly-named tensors, one task at a time. Each input is copied once
+// into a batch buffer, which is preallocated to 'expected_num_rows' rows and
+// doubled whenever it runs out of space.
+class IncrementalInputMerger {
+ public:
+  explicit IncrementalInputMerger(int64 expected_num_rows)
+      : expected_num_rows_(expected_num_rows) {}
+
+  // Appends the inputs of 'task' to the batch buffers.
+  Status AddTask(const BatchingSessionTask& task) {
+    for (const auto& entry : GetTaskInput(task)) {
+      const string& tensor_name = entry.first;
+      const Tensor& tensor = entry.second;
+      if (tensor.dims() == 0) {
+        return errors::InvalidArgument("Batching input tensors must have at "
+                                       "least one dimension");
+      }
+      BatchBuffer& buffer = buffers_[tensor_name];
+      if (!buffer.tensor.IsInitialized()) {
+        TensorShape shape = tensor.shape();
+        shape.set_dim(0, 0);
+        buffer.tensor = Tensor(tensor.dtype(), shape);
+      } else if (tensor.dtype() != buffer.tensor.dtype() ||
+                 !AreShapesEqualExceptZeroDim(tensor.shape(),
+                                              buffer.tensor.shape())) {
+        return errors::FailedPrecondition(
+            "Tensors with name '", tensor_name,
+            "' from different tasks have different dtypes or shapes");
+      }
+      const int64 num_rows = tensor.dim_size(0);
+      TF_RETURN_IF_ERROR(Reserve(
+          std::max(expected_num_rows_, buffer.num_rows + num_rows), &buffer));
+      TF_RETURN_IF_ERROR(CopyTensorRows(tensor, /*src_row=*/0, num_rows,
+                                        buffer.num_rows, &buffer.tensor));
+      buffer.num_rows += num_rows;
+    }
+    return Status::OK();
+  }
+
+  // Emits the merged inputs in the order they are in in the signature, after
+  // appending 'padding_size' copies of their first row. 'batch_size' is the
+  // total size of the added tasks.
+  Status Finish(const TensorSignature& signature, int64 batch_size,
+                int64 padding_size,
+                std::vector<std::pair<string, Tensor>>* merged_inputs) {
+    if (buffers_.size() != signature.input_tensors.size()) {
+      return errors::Internal(
+          "One or more tasks does not conform to batch signature");
+    }
+    for (const string& tensor_name : signature.input_tensors) {
+      auto it = buffers_.find(tensor_name);
+      if (it == buffers_.end() || it->second.num_rows != batch_size) {
+        return errors::Internal(
+            "One or more tasks does not conform to batch signature");
+      }
+      BatchBuffer& buffer = it->second;
+      if (padding_size > 0) {
+        if (buffer.num_rows == 0) {
+          return errors::Internal("Cannot pad an empty batch");
+        }
+        TF_RETURN_IF_ERROR(Reserve(buffer.num_rows + padding_size, &buffer));
+        for (int64 i = 0; i < padding_size; ++i) {
+          TF_RETURN_IF_ERROR(CopyTensorRows(buffer.tensor, /*src_row=*/0,
+                                            /*num_rows=*/1, buffer.num_rows,
+                                            &buffer.tensor));
+          ++buffer.num_rows;
+        }
+      }
+      // Slice() avoids a deep copy when the buffer was over-allocated.
+      if (buffer.num_rows == buffer.tensor.dim_size(0)) {
+        merged_inputs->push_back({tensor_name, std::move(buffer.tensor)});
+      } else {
+        merged_inputs->push_back(
+            {tensor_name, buffer.tensor.Slice(0, buffer.num_rows)});
+      }
+    }
+    return Status::OK();
+  }
+
+ private:
+  struct BatchBuffer {
+    // Allocated rows; only the first 'num_rows' ones are populated.
+    Tensor tensor;
+    int64 num_rows = 0;
+  };
+
+  // Makes sure 'buffer' has room for at least 'num_rows' rows.
+  static Status Reserve(int64 num_rows, BatchBuffer* buffer) {
+    const int64 capacity = buffer->tensor.dim_size(0);
+    if (num_rows <= capacity) {
+      return Status::OK();
+    }
+    TensorShape shape = buffer->tensor.shape();
+    shape.set_dim(0, std::max(num_rows, 2 * capacity));
+    Tensor grown(buffer->tensor.dtype(), shape);
+    TF_RETURN_IF_ERROR(CopyTensorRows(buffer->tensor, /*src_row=*/0,
+                                      buffer->num_rows, /*dst_row=*/0,
+                                      &grown));
+    buffer->tensor = std::move(grown);
+    return Status::OK();
+  }
+
+  const int64 expected_num_rows_;
+  std::map<string, BatchBuffer> buffers_;
+};
+
+// The low-priority lane of a signature (see
+// BatchingSessionOptions::enable_bulk_lane). Bulk tasks wait in
+// 'pending_tasks' until they are taken to fill the padding of a batch, or to
+// form a batch of their own. For the latter, each bulk task schedules a ticket
+// (an empty task of size 1) on 'ticket_scheduler', and each batch of tickets
+// processes as many pending tasks. While regular tasks are waiting, the tickets
+// are held, and their tasks processed after the regular batches that have the
+// turn (see BatchingSessionOptions::regular_batches_per_bulk_batch).
+struct BulkLane {
+  absl::Mutex mu;
+  std::deque<std::unique_ptr<BatchingSessionTask>> pending_tasks
+      ABSL_GUARDED_BY(mu);
+  // The number of tickets processed whose tasks were held.
+  int num_held_tickets ABSL_GUARDED_BY(mu) = 0;
+  // The number of regular batches taken since the last bulk batch.
+  int num_regular_batches ABSL_GUARDED_BY(mu) = 0;
+  std::unique_ptr<BatchScheduler<BatchingSessionTask>> ticket_scheduler;
+  // The maximum size of a batch.
+  size_t max_batch_size = 0;
+};
+
+// The deadline of the tasks whose RunOptions have no timeout.
+constexpr uint64 kNoDeadlineMicros = std::numeric_limits<uint64>::max();
+
+// Returns the deadline of 'task', or kNoDeadlineMicros.
+uint64 TaskDeadlineMicros(const BatchingSessionTask& task) {
+  // If the caller doesn't populate RunOptions, the timeout is 0 by default.
+  // Interpret that as "no timeout" i.e. infinity.
+  if (task.run_options.timeout_in_ms() <= 0) {
+    return kNoDeadlineMicros;
+  }
+  return task.enqueue_time_micros + task.run_options.timeout_in_ms() * 1000;
+}
+
+// Returns the earliest deadline of the tasks of 'batch'.
+uint64 EarliestDeadlineMicros(const Batch<BatchingSessionTask>& batch) {
+  uint64 deadline_micros = kNoDeadlineMicros;
+  for (int i = 0; i < batch.num_tasks(); ++i) {
+    deadline_micros =
+        std::min(deadline_micros, TaskDeadlineMicros(batch.task(i)));
+  }
+  return deadline_micros;
+}
+
+// The status of the tasks whose timeout is exceeded before their batch is
+// processed.
+Status QueueTimeoutExceededStatus() {
+  return Status(error::RESOURCE_EXHAUSTED,
+                "Run() timeout exceeded while waiting in batching queue");
+}
+
+// The status of the tasks whose request is cancelled before their batch is
+// processed.
+Status RequestCancelledStatus() {
+  return errors::Cancelled(
+      "Run() request cancelled while waiting in batching queue");
+}
+
+// Whether the request of 'task' is cancelled.
+bool IsTaskCancelled(const BatchingSessionTask& task) {
+  return task.cancellation != nullptr && task.cancellation->IsCancelled();
+}
+
+// Sets the status of 'task' to 'status', and signals that it is done.
+void CompleteTask(const Status& status, BatchingSessionTask* task) {
+  if (task->is_partial) {
+    task->thread_safe_status->Update(status);
+    task->done_callback();
+  } else {
+    *task->status = status;
+    task->done->Notify();
+  }
+}
+
+// Returns a ticket for a bulk lane. Its fields are set so that batch schedulers
+// splitting large tasks can split it like a regular task.
+std::unique_ptr<BatchingSessionTask> CreateBulkLaneTicket() {
+  static const auto* const kNoInputs =
+      new std::vector<std::pair<string, Tensor>>();
+  static const auto* const kNoOutputTensorNames = new std::vector<string>();
+  auto ticket = absl::make_unique<BatchingSessionTask>();
+  ticket->enqueue_time_micros = EnvTime::NowMicros();
+  ticket->zeroth_dim_size = 1;
+  ticket->inputs = kNoInputs;
+  ticket->output_tensor_names = kNoOutputTensorNames;
+  ticket->thread_safe_status = std::make_shared<ThreadSafeStatus>();
+  ticket->shared_outputs =
+      std::make_shared<std::vector<std::vector<Tensor>>>();
+  ticket->split_run_metadatas = absl::make_unique<std::vector<RunMetadata>>();
+  return ticket;
+}
+
+// Moves pending tasks of 'lane' to 'tasks' in FIFO order, skipping the ones
+// that don't fit, until their total size reaches 'max_size' or 'max_num_tasks'
+// tasks are taken.
+void TakeBulkTasks(BulkLane* lane, size_t max_size, int max_num_tasks,
+                   std::vector<std::unique_ptr<BatchingSessionTask>>* tasks)
+    ABSL_EXCLUSIVE_LOCKS_REQUIRED(lane->mu) {
+  size_t size = 0;
+  int num_tasks = 0;
+  for (auto it = lane->pending_tasks.begin();
+       it != lane->pending_tasks.end() && num_tasks < max_num_tasks;) {
+    if (size + (*it)->size() <= max_size) {
+      size += (*it)->size();
+      ++num_tasks;
+      tasks->push_back(std::move(*it));
+      it = lane->pending_tasks.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+// Returns a closed batch with the tasks of 'batch' followed by 'tasks'.
+std::unique_ptr<Batch<BatchingSessionTask>> ExtendBatch(
+    std::unique_ptr<Batch<BatchingSessionTask>> batch,
+    std::vector<std::unique_ptr<BatchingSessionTask>> tasks) {
+  std::vector<std::unique_ptr<BatchingSessionTask>> batch_tasks;
+  while (!batch->empty()) {
+    batch_tasks.push_back(batch->RemoveTask());
+  }
+  auto extended_batch = absl::make_unique<Batch<BatchingSessionTask>>();
+  for (auto it = batch_tasks.rbegin(); it != batch_tasks.rend(); ++it) {
+    extended_batch->AddTask(std::move(*it));
+  }
+  for (auto& task : tasks) {
+    extended_batch->AddTask(std::move(task));
+  }
+  extended_batch->Close();
+  return extended_batch;
+}
+
+// Returns the status of 'task' if it is dropped before its batch is
+// processed, i.e. if its request is cancelled, or, if 'drop_expired', if it is
+// past its deadline at 'now_micros'. OK otherwise.
+Status DroppedTaskStatus(const BatchingSessionTask& task, bool drop_expired,
+                         uint64 now_micros) {
+  if (IsTaskCancelled(task)) {
+    return RequestCancelledStatus();
+  }
+  if (drop_expired && TaskDeadlineMicros(task) <= now_micros) {
+    return QueueTimeoutExceededStatus();
+  }
+  return Status::OK();
+}
+
+// Completes the tasks of the closed 'batch' that are dropped (see
+// DroppedTaskStatus), and returns a closed batch with the others, in order.
+// Returns 'batch' itself if none is.
+std::unique_ptr<Batch<BatchingSessionTask>> RemoveDroppedTasks(
+    std::unique_ptr<Batch<BatchingSessionTask>> batch, bool drop_expired,
+    uint64 now_micros) {
+  std::vector<Status> statuses;
+  bool has_dropped_tasks = false;
+  for (int i = 0; i < batch->num_tasks(); ++i) {
+    statuses.push_back(
+        DroppedTaskStatus(batch->task(i), drop_expired, now_micros));
+    has_dropped_tasks |= !statuses.back().ok();
+  }
+  if (!has_dropped_tasks) {
+    return batch;
+  }
+  std::vector<std::unique_ptr<BatchingSessionTask>> batch_tasks;
+  while (!batch->empty()) {
+    batch_tasks.push_back(batch->RemoveTask());
+  }
+  auto live_batch = absl::make_unique<Batch<BatchingSessionTask>>();
+  for (int i = 0; i < statuses.size(); ++i) {
+    // Note: The tasks are removed from the end of the batch.
+    std::unique_ptr<BatchingSessionTask>& task =
+        batch_tasks[batch_tasks.size() - 1 - i];
+    if (statuses[i].ok()) {
+      live_batch->AddTask(std::move(task));
+      continue;
+    }
+    if (task->queue_span != nullptr) {
+      task->queue_span->End();
+    }
+    CompleteTask(statuses[i], task.get());
+  }
+  live_batch->Close();
+  return live_batch;
+}
+
+// Moving averages of the processing time of batches of each allowed batch
+// size. Thread-safe.
+class BatchCostModel {
+ public:
+  explicit BatchCostModel(const std::vector<int>& allowed_batch_sizes)
+      : allowed_batch_sizes_(allowed_batch_sizes),
+        processing_micros_(allowed_batch_sizes.size(), -1) {}
+
+  // Records the processing time of a batch padded to 'batch_size'.
+  void Record(int batch_size, int64 processing_micros) {
+    const int index = Index(batch_size);
+    if (index < 0) {
+      return;
+    }
+    absl::MutexLock l(&mu_);
+    double& average = processing_micros_[index];
+    average = average < 0 ? processing_micros
+                          : average + kMovingAverageWeight *
+                                          (processing_micros - average);
+  }
+
+  // Returns the estimated processing time of a batch padded to 'batch_size',
+  // or a negative value if there is no measurement yet.
+  double EstimatedMicros(int batch_size) const {
+    const int index = Index(batch_size);
+    if (index < 0) {
+      return -1;
+    }
+    absl::MutexLock l(&mu_);
+    return processing_micros_[index];
+  }
+
+ private:
+  // Weight of the latest measurement in the moving averages.
+  static constexpr double kMovingAverageWeight = 0.2;
+
+  // Returns the index of 'batch_size' in 'allowed_batch_sizes_', or -1.
+  int Index(int batch_size) const {
+    const auto it = std::lower_bound(allowed_batch_sizes_.begin(),
+                                     allowed_batch_sizes_.end(), batch_size);
+    if (it == allowed_batch_sizes_.end() || *it != batch_size) {
+      return -1;
+    }
+    return it - allowed_batch_sizes_.begin();
+  }
+
+  const std::vector<int> allowed_batch_sizes_;
+  mutable absl::Mutex mu_;
+  std::vector<double> processing_micros_ ABSL_GUARDED_BY(mu_);
+};
+
 }  // namespace
 
 TensorSignature TensorSignatureFromSignatureDef(
@@ -171,7 +642,7 @@ class BatchingSession : public ServingSession {
       const std::string& thread_pool_name,
       std::unique_ptr<BatchingSession>* result);
 
-  ~BatchingSession() override = default;
+  ~BatchingSession() override;
 
   Status Run(const std::vector<std::pair<string, Tensor>>& inputs,
              const std::vector<string>& output_tensor_names,
@@ -225,6 +696,11 @@ class BatchingSession : public ServingSession {
       std::vector<Tensor>* outputs, RunMetadata* run_metadata,
       absl::optional<thread::ThreadPoolOptions> thread_pool_options);
 
+  // Returns the length of an input tensor list for length bucketing, i.e. the
+  // largest size of dimension 'options_.length_bucket_dim' among its tensors.
+  int64 ComputeInputLength(
+      const std::vector<std::pair<string, Tensor>>& inputs) const;
+
   // Computes the size of an input tensor list for batching purposes, by
   // analyzing the 0th dimension size of each of the tensors. All tensors in the
   // list must have the same 0th dimension size to be batchable. If the sizes
@@ -241,6 +717,26 @@ class BatchingSession : public ServingSession {
       const TensorSignature& signature, const Batch<BatchingSessionTask>& batch,
       std::vector<std::pair<string, Tensor>>* merged_inputs);
 
+  // Concatenates 'tensors' of input 'tensor_name' along the 0th dimension into
+  // 'merged', built in a buffer of the pool of the input (see
+  // 'options_.num_pooled_input_buffers').
+  Status ConcatIntoPooledBuffer(const string& tensor_name,
+                                const std::vector<Tensor>& tensors,
+                                Tensor* merged);
+
+  // Returns a buffer of 'dtype' and 'shape' for input 'tensor_name', from its
+  // pool if one there is unused, or newly allocated (and pooled if the pool
+  // has room) otherwise.
+  Tensor GetPooledInputBuffer(const string& tensor_name, DataType dtype,
+                              const TensorShape& shape);
+
+  // Same as MergeInputTensors(), but copies the inputs of each task as soon as
+  // it joins 'batch', while the batch is still open. Returns once the batch is
+  // closed and merged. Only used if 'options_.incremental_input_merge' is set.
+  Status IncrementallyMergeInputTensors(
+      const TensorSignature& signature, const Batch<BatchingSessionTask>& batch,
+      std::vector<std::pair<string, Tensor>>* merged_inputs);
+
   // Splits the output of a batched call to 'wrapped_->Run()' into individual
   // task outputs. Assumes the output tensor order matches the signature.
   Status SplitOutputTensors(const TensorSignature& signature,
@@ -252,33 +748,169 @@ class BatchingSession : public ServingSession {
   Status SplitRunMetadata(RunMetadata* batch_metadata,
                           Batch<BatchingSessionTask>* batch);
 
+  // Schedules '*task' with 'batch_scheduler'. With
+  // 'options_.incremental_input_merge', the task is added under
+  // 'admission_mu_', so that IncrementallyMergeInputTensors() never reads an
+  // open batch while a task joins it, and is woken up by the admission.
+  Status ScheduleTask(BatchScheduler<BatchingSessionTask>* batch_scheduler,
+                      std::unique_ptr<BatchingSessionTask>* task);
+
+  // Splits '*task', which is larger than the maximum task size of
+  // 'batch_scheduler', into tasks of that size, and schedules them
+  // separately. The outputs of '*task' are populated, and its 'done'
+  // notified, once all of them are processed.
+  Status ScheduleLargeTask(BatchScheduler<BatchingSessionTask>* batch_scheduler,
+                           std::unique_ptr<BatchingSessionTask>* task);
+
+  // Adds '*task' to the pending tasks of 'bulk_lane', and schedules a ticket
+  // for it.
+  Status ScheduleBulkTask(BulkLane* bulk_lane,
+                          std::unique_ptr<BatchingSessionTask>* task);
+
   // Processes one batch of Run() calls with 'signature'. Called by
-  // 'batch_scheduler_' in a batch thread.
-  void ProcessBatch(const TensorSignature& signature,
+  // 'batch_scheduler_' in a batch thread. If 'bulk_lane' is set, its pending
+  // tasks fill the padding of the batch.
+  //
+  // If 'options_.max_concurrent_batches' batches are already being processed,
+  // defers the batch and returns right away. Deferred batches are processed by
+  // the batch threads already running batches of this session, once they are
+  // done with those.
+  void ProcessBatch(const TensorSignature& signature, BulkLane* bulk_lane,
                     std::unique_ptr<Batch<BatchingSessionTask>> batch);
 
+  // Does the work of ProcessBatch(), regardless of the concurrency limit.
+  void ProcessBatchNow(const TensorSignature& signature, BulkLane* bulk_lane,
+                       std::unique_ptr<Batch<BatchingSessionTask>> batch);
+
+  // Runs the closed, non-empty 'batch' of ProcessBatchNow(), in two smaller
+  // batches if MaybeSplitBatch() splits it. If 'merged_incrementally' is set,
+  // 'merged_inputs' already hold its inputs, padded to the allowed batch size,
+  // and the smaller batches take row slices of them instead of merging their
+  // inputs again.
+  void RunClosedBatch(const TensorSignature& signature,
+                      std::unique_ptr<Batch<BatchingSessionTask>> batch,
+                      std::vector<std::pair<string, Tensor>> merged_inputs,
+                      bool merged_incrementally);
+
+  // If 'cost_model_' estimates that processing the closed 'batch' in two
+  // smaller batches is faster than padding it to the next allowed batch size,
+  // moves its last tasks to a new batch and returns it. Otherwise returns
+  // nullptr and leaves 'batch' unchanged.
+  std::unique_ptr<Batch<BatchingSessionTask>> MaybeSplitBatch(
+      Batch<BatchingSessionTask>* batch) const;
+
+  // Returns the number of tasks enqueued in the batch schedulers.
+  int64 NumEnqueuedTasks();
+
+  // Returns the size of a full batch of 'signature', for BatchingStats.
+  int64 MaxBatchSize(const TensorSignature& signature) const;
+
+  // Processes the pending tasks of 'bulk_lane' for a batch of tickets, or
+  // holds them if the regular lane has the turn. Called by the ticket scheduler
+  // of 'bulk_lane' in a batch thread.
+  void ProcessBulkBatch(const TensorSignature& signature, BulkLane* bulk_lane,
+                        std::unique_ptr<Batch<BatchingSessionTask>> tickets);
+
+  // Processes a batch of the regular lane of 'signature', then the held tasks
+  // of 'bulk_lane' (if set) if they have the turn. Called by the batch
+  // schedulers of 'signature' in a batch thread.
+  void ProcessRegularBatch(const TensorSignature& signature,
+                           BulkLane* bulk_lane,
+                           std::unique_ptr<Batch<BatchingSessionTask>> batch);
+
+  // Processes the tasks of the held tickets of 'bulk_lane' in batches, as long
+  // as no regular task of 'signature' is waiting, or the bulk lane has the
+  // turn.
+  void ProcessHeldBulkTasks(const TensorSignature& signature,
+                            BulkLane* bulk_lane);
+
+  // Whether tasks are waiting in the regular batch schedulers of 'signature'.
+  bool RegularTasksWaiting(const TensorSignature& signature);
+
   const BatchingSessionOptions options_;
+  // The names of all the tensors of 'options_.ragged_inputs', and of those that
+  // do not define the batch dimension (the values and the inner row splits).
+  std::set<string> ragged_tensor_names_;
+  std::set<string> ragged_inner_tensor_names_;
+  // Set iff 'options_.split_instead_of_padding' is set.
+  std::unique_ptr<BatchCostModel> cost_model_;
+
+  // A batch deferred by ProcessBatch().
+  struct DeferredBatch {
+    TensorSignature signature;
+    BulkLane* bulk_lane;
+    std::unique_ptr<Batch<BatchingSessionTask>> batch;
+  };
+  // Enforces 'options_.max_concurrent_batches'. Declared before the batch
+  // schedulers, since their batch threads may process deferred batches until
+  // they are destroyed.
+  absl::Mutex concurrency_mu_;
+  int num_running_batches_ ABSL_GUARDED_BY(concurrency_mu_) = 0;
+  std::deque<DeferredBatch> deferred_batches_ ABSL_GUARDED_BY(concurrency_mu_);
 
   std::unique_ptr<Session> wrapped_;
+  // Set once the session is being destroyed, after which
+  // RegularTasksWaiting() does not read the batch schedulers anymore. Declared
+  // before them, since their batch threads call it until they are destroyed.
+  absl::Mutex destruction_mu_;
+  bool destroying_ ABSL_GUARDED_BY(destruction_mu_) = false;
+  // The bulk lane of each signature, if enabled. Not modified after Create().
+  std::unordered_map<TensorSignature, std::unique_ptr<BulkLane>,
+                     HashTensorSignature, EqTensorSignature>
+      bulk_lanes_;
   std::unordered_map<TensorSignature,
                      std::unique_ptr<BatchScheduler<BatchingSessionTask>>,
                      HashTensorSignature, EqTensorSignature>
       batch_schedulers_;
+  // If 'options_.length_bucket_boundaries' is set, the batch schedulers of the
+  // length buckets of each signature, one per boundary. Calls longer than the
+  // last boundary use 'batch_schedulers_'.
+  std::unordered_map<
+      TensorSignature,
+      std::vector<std::unique_ptr<BatchScheduler<BatchingSessionTask>>>,
+      HashTensorSignature, EqTensorSignature>
+      length_bucket_schedulers_;
+  // If 'options_.large_request_min_rows' is set, the batch scheduler of the
+  // large calls of each signature.
+  std::unordered_map<TensorSignature,
+                     std::unique_ptr<BatchScheduler<BatchingSessionTask>>,
+                     HashTensorSignature, EqTensorSignature>
+      large_request_schedulers_;
   // The name of the thread pool of the underlying batch scheduler. It is used
   // for monitoring purpose, and can be empty if not known.
   const std::string thread_pool_name_;
+  // The cells of 'thread_pool_name_' in the batch metrics.
+  monitoring::SamplerCell* const queuing_latency_cell_;
+  monitoring::SamplerCell* const merge_inputs_latency_cell_;
+  monitoring::SamplerCell* const run_latency_cell_;
+  monitoring::SamplerCell* const split_outputs_latency_cell_;
 
   // If set, default_scheduler_creator_ is used when the input signature does
   // not match any existing signature defined during model load. This helps
   // when the user uses either a combination of signatures or filter certain
   // output tensors.
   absl::optional<BatchingSessionSchedulerCreator> default_scheduler_creator_;
+
+  // The buffers recycled for the merged inputs, by input tensor name. A buffer
+  // is in use while a tensor other than the pooled one references it.
+  absl::Mutex input_buffers_mu_;
+  std::unordered_map<string, std::vector<Tensor>> input_buffers_
+      ABSL_GUARDED_BY(input_buffers_mu_);
+
+  // Held while a task is scheduled, and while the open batches are read, if
+  // 'options_.incremental_input_merge' is set. See ScheduleTask().
+  absl::Mutex admission_mu_;
+
   absl::Mutex mu_;
   std::unordered_map<TensorSignature,
                      std::unique_ptr<BatchScheduler<BatchingSessionTask>>,
                      HashTensorSignature, EqTensorSignature>
       custom_signature_batch_schedulers_ ABSL_GUARDED_BY(mu_);
 
+  // The id of the queue depth source of the session in BatchingStats, if
+  // 'options_.model_name' is set.
+  absl::optional<int64> stats_source_id_;
+
   TF_DISALLOW_COPY_AND_ASSIGN(BatchingSession);
 };
 
@@ -302,6 +934,29 @@ Status BatchingSession::Create(
         signatures_with_scheduler_creators,
     const std::string& thread_pool_name,
     std::unique_ptr<BatchingSession>* result) {
+  for (int i = 1; i < options.length_bucket_boundaries.size(); ++i) {
+    if (options.length_bucket_boundaries[i] <=
+        options.length_bucket_boundaries[i - 1]) {
+      return errors::InvalidArgument(
+          "length_bucket_boundaries entries must be monotonically increasing");
+    }
+  }
+  if (!options.length_bucket_boundaries.empty() &&
+      options.length_bucket_dim < 1) {
+    return errors::InvalidArgument(
+        "length_bucket_dim must be positive; was ", options.length_bucket_dim);
+  }
+  if (options.large_request_min_rows < 0) {
+    return errors::InvalidArgument(
+        "large_request_min_rows must be non-negative; was ",
+        options.large_request_min_rows);
+  }
+  if (options.enable_bulk_lane && options.regular_batches_per_bulk_batch < 1) {
+    return errors::InvalidArgument(
+        "regular_batches_per_bulk_batch must be positive; was ",
+        options.regular_batches_per_bulk_batch);
+  }
+
   auto batching_session = std::unique_ptr<BatchingSession>(
       new BatchingSession(options, thread_pool_name));
   BatchingSession* raw_batching_session = batching_session.get();
@@ -312,14 +967,73 @@ Status BatchingSession::Create(
     const BatchingSessionSchedulerCreator& scheduler_creator =
         entry.scheduler_creator;
 
+    BulkLane* bulk_lane = nullptr;
+    if (options.enable_bulk_lane) {
+      auto& lane = batching_session->bulk_lanes_[signature];
+      lane = absl::make_unique<BulkLane>();
+      bulk_lane = lane.get();
+    }
+
     std::unique_ptr<BatchScheduler<BatchingSessionTask>> batch_scheduler;
     TF_RETURN_IF_ERROR(scheduler_creator(
-        [signature, raw_batching_session](
-            std::unique_ptr<Batch<BatchingSessionTask>> batch) {
-          raw_batching_session->ProcessBatch(signature, std::move(batch));
+        [signature, raw_batching_session,
+         bulk_lane](std::unique_ptr<Batch<BatchingSessionTask>> batch) {
+          raw_batching_session->ProcessRegularBatch(signature, bulk_lane,
+                                                    std::move(batch));
         },
         &batch_scheduler));
+
+    if (bulk_lane != nullptr) {
+      bulk_lane->max_batch_size = options.allowed_batch_sizes.empty()
+                                      ? batch_scheduler->max_task_size()
+                                      : options.allowed_batch_sizes.back();
+      TF_RETURN_IF_ERROR(scheduler_creator(
+          [signature, raw_batching_session,
+           bulk_lane](std::unique_ptr<Batch<BatchingSessionTask>> tickets) {
+            raw_batching_session->ProcessBulkBatch(signature, bulk_lane,
+                                                   std::move(tickets));
+          },
+          &bulk_lane->ticket_scheduler));
+    }
     batching_session->batch_schedulers_[signature] = std::move(batch_scheduler);
+
+    if (!options.length_bucket_boundaries.empty()) {
+      auto& bucket_schedulers =
+          batching_session->length_bucket_schedulers_[signature];
+      for (int i = 0; i < options.length_bucket_boundaries.size(); ++i) {
+        std::unique_ptr<BatchScheduler<BatchingSessionTask>> bucket_scheduler;
+        TF_RETURN_IF_ERROR(scheduler_creator(
+            [signature, raw_batching_session,
+             bulk_lane](std::unique_ptr<Batch<BatchingSessionTask>> batch) {
+              raw_batching_session->ProcessRegularBatch(signature, bulk_lane,
+                                                        std::move(batch));
+            },
+            &bucket_scheduler));
+        bucket_schedulers.push_back(std::move(bucket_scheduler));
+      }
+    }
+
+    if (options.large_request_min_rows > 0) {
+      const BatchingSessionSchedulerCreator& large_request_scheduler_creator =
+          entry.large_request_scheduler_creator
+              ? entry.large_request_scheduler_creator
+              : scheduler_creator;
+      TF_RETURN_IF_ERROR(large_request_scheduler_creator(
+          [signature, raw_batching_session,
+           bulk_lane](std::unique_ptr<Batch<BatchingSessionTask>> batch) {
+            raw_batching_session->ProcessRegularBatch(signature, bulk_lane,
+                                                      std::move(batch));
+          },
+          &batching_session->large_request_schedulers_[signature]));
+    }
+  }
+
+  if (!options.model_name.empty()) {
+    batching_session->stats_source_id_ =
+        BatchingStats::Get()->AddQueueDepthSource(
+            options.model_name, [raw_batching_session] {
+              return raw_batching_session->NumEnqueuedTasks();
+            });
   }
 
   *result = std::move(batching_session);
@@ -375,6 +1089,7 @@ Status BatchingSession::InternalRun(
         "BatchingSessionRun",
         {{"thread_pool_name", thread_pool_name_}, {"_r", 1} /*root_event*/});
   });
+  TraceSpan run_span("BatchingSessionRun", CurrentTraceContext());
   const TensorSignature signature =
       TensorSignatureFromRunArgs(inputs, output_tensor_names);
   auto batch_scheduler_it = batch_schedulers_.find(signature);
@@ -386,7 +1101,7 @@ Status BatchingSession::InternalRun(
         std::unique_ptr<BatchScheduler<BatchingSessionTask>> batch_scheduler;
         TF_RETURN_IF_ERROR(default_scheduler_creator_.value()(
             [&, signature](std::unique_ptr<Batch<BatchingSessionTask>> batch) {
-              ProcessBatch(signature, std::move(batch));
+              ProcessBatch(signature, /*bulk_lane=*/nullptr, std::move(batch));
             },
             &batch_scheduler));
         custom_signature_batch_schedulers_[signature] =
@@ -417,6 +1132,17 @@ Status BatchingSession::InternalRun(
   }
   BatchScheduler<BatchingSessionTask>* batch_scheduler =
       batch_scheduler_it->second.get();
+  auto bucket_schedulers = length_bucket_schedulers_.find(signature);
+  if (bucket_schedulers != length_bucket_schedulers_.end()) {
+    const auto& boundaries = options_.length_bucket_boundaries;
+    const int bucket =
+        std::lower_bound(boundaries.begin(), boundaries.end(),
+                         ComputeInputLength(inputs)) -
+        boundaries.begin();
+    if (bucket < bucket_schedulers->second.size()) {
+      batch_scheduler = bucket_schedulers->second[bucket].get();
+    }
+  }
 
   outputs->clear();
 
@@ -426,6 +1152,13 @@ Status BatchingSession::InternalRun(
   task->enqueue_time_micros = EnvTime::NowMicros();
   task->run_options = run_options;
   TF_RETURN_IF_ERROR(ComputeInputSize(inputs, &task->zeroth_dim_size));
+  if (options_.large_request_min_rows > 0 &&
+      task->size() >= options_.large_request_min_rows) {
+    auto large_request_scheduler = large_request_schedulers_.find(signature);
+    if (large_request_scheduler != large_request_schedulers_.end()) {
+      batch_scheduler = large_request_scheduler->second.get();
+    }
+  }
   task->inputs = &inputs;
   task->output_tensor_names = &output_tensor_names;
   task->done = &done;
@@ -436,33 +1169,231 @@ Status BatchingSession::InternalRun(
   task->thread_safe_status = std::make_shared<ThreadSafeStatus>();
   task->shared_outputs = std::make_shared<std::vector<std::vector<Tensor>>>();
   task->split_run_metadatas = absl::make_unique<std::vector<RunMetadata>>();
-
-  TF_RETURN_IF_ERROR(batch_scheduler->Schedule(&task));
+  const int64 task_size = task->size();
+  std::shared_ptr<const std::vector<Tensor>> batch_outputs;
+  int64 batch_output_row = 0;
+  std::function<void()> merge_split_outputs;
+  if (options_.split_outputs_on_requesting_threads) {
+    task->batch_outputs = &batch_outputs;
+    task->batch_output_row = &batch_output_row;
+    task->merge_split_outputs = &merge_split_outputs;
+  }
+  if (run_span.context() != nullptr) {
+    task->trace_context = *run_span.context();
+    task->queue_span = absl::make_unique<TraceSpan>("BatchingSessionQueue",
+                                                    run_span.context());
+  }
+  task->cancellation = CurrentRequestCancellation();
+  task->flight_record = CurrentFlightRecord();
+
+  auto bulk_lane = bulk_lanes_.find(signature);
+  if (bulk_lane != bulk_lanes_.end() &&
+      run_options.experimental().run_handler_pool_options().priority() <
+          options_.bulk_priority_threshold &&
+      task->size() <= bulk_lane->second->max_batch_size) {
+    TF_RETURN_IF_ERROR(ScheduleBulkTask(bulk_lane->second.get(), &task));
+  } else if (options_.split_large_requests && options_.ragged_inputs.empty() &&
+             task->size() > batch_scheduler->max_task_size()) {
+    TF_RETURN_IF_ERROR(ScheduleLargeTask(batch_scheduler, &task));
+  } else {
+    TF_RETURN_IF_ERROR(ScheduleTask(batch_scheduler, &task));
+  }
   done.WaitForNotification();
+  if (merge_split_outputs) {
+    merge_split_outputs();
+  }
+  if (status.ok() && batch_outputs != nullptr) {
+    status = SliceTaskOutputs(signature, *batch_outputs, batch_output_row,
+                              task_size, output_tensor_names, outputs);
+  }
   return status;
 }
 
+Status BatchingSession::ScheduleTask(
+    BatchScheduler<BatchingSessionTask>* batch_scheduler,
+    std::unique_ptr<BatchingSessionTask>* task) {
+  if (!options_.incremental_input_merge) {
+    return batch_scheduler->Schedule(task);
+  }
+  absl::MutexLock l(&admission_mu_);
+  return batch_scheduler->Schedule(task);
+}
+
+Status BatchingSession::ScheduleLargeTask(
+    BatchScheduler<BatchingSessionTask>* batch_scheduler,
+    std::unique_ptr<BatchingSessionTask>* task) {
+  const int max_task_size = batch_scheduler->max_task_size();
+  std::vector<std::unique_ptr<BatchingSessionTask>> split_tasks;
+  TF_RETURN_IF_ERROR(
+      SplitInputTask(task, max_task_size, max_task_size, &split_tasks));
+  // Each piece fills a batch of its own (but the last one), so the batch
+  // threads process them in parallel.
+  for (auto& split_task : split_tasks) {
+    const Status schedule_status = ScheduleTask(batch_scheduler, &split_task);
+    if (!schedule_status.ok() && split_task != nullptr) {
+      // The other pieces may be scheduled already; fail the task once they
+      // are done.
+      split_task->thread_safe_status->Update(schedule_status);
+      split_task->done_callback();
+    }
+  }
+  return Status::OK();
+}
+
+Status BatchingSession::ScheduleBulkTask(
+    BulkLane* bulk_lane, std::unique_ptr<BatchingSessionTask>* task) {
+  const BatchingSessionTask* const raw_task = task->get();
+  {
+    absl::MutexLock l(&bulk_lane->mu);
+    auto& pending_tasks = bulk_lane->pending_tasks;
+    if (options_.earliest_deadline_first) {
+      // Keeps the pending tasks in order of deadline, and in arrival order
+      // for the same deadline.
+      const uint64 deadline_micros = TaskDeadlineMicros(**task);
+      auto it = std::upper_bound(
+          pending_tasks.begin(), pending_tasks.end(), deadline_micros,
+          [](uint64 deadline_micros,
+             const std::unique_ptr<BatchingSessionTask>& pending_task) {
+            return deadline_micros < TaskDeadlineMicros(*pending_task);
+          });
+      pending_tasks.insert(it, std::move(*task));
+    } else {
+      pending_tasks.push_back(std::move(*task));
+    }
+  }
+  std::unique_ptr<BatchingSessionTask> ticket = CreateBulkLaneTicket();
+  const Status status = bulk_lane->ticket_scheduler->Schedule(&ticket);
+  if (!status.ok()) {
+    // Withdraw the task, unless a batch already took it.
+    absl::MutexLock l(&bulk_lane->mu);
+    auto it = std::find_if(
+        bulk_lane->pending_tasks.begin(), bulk_lane->pending_tasks.end(),
+        [raw_task](const std::unique_ptr<BatchingSessionTask>& pending_task) {
+          return pending_task.get() == raw_task;
+        });
+    if (it != bulk_lane->pending_tasks.end()) {
+      *task = std::move(*it);
+      bulk_lane->pending_tasks.erase(it);
+      return status;
+    }
+  }
+  return Status::OK();
+}
+
 Status BatchingSession::ListDevices(std::vector<DeviceAttributes>* response) {
   return wrapped_->ListDevices(response);
 }
 
 BatchingSession::BatchingSession(const BatchingSessionOptions& options,
                                  const std::string& thread_pool_name)
-    : options_(options), thread_pool_name_(thread_pool_name) {}
+    : options_(options),
+      thread_pool_name_(thread_pool_name),
+      queuing_latency_cell_(queuing_latency->GetCell(thread_pool_name)),
+      merge_inputs_latency_cell_(
+          batch_stage_latency->GetCell(thread_pool_name, "merge_inputs")),
+      run_latency_cell_(batch_stage_latency->GetCell(thread_pool_name, "run")),
+      split_outputs_latency_cell_(
+          batch_stage_latency->GetCell(thread_pool_name, "split_outputs")) {
+  if (options_.split_instead_of_padding &&
+      !options_.allowed_batch_sizes.empty()) {
+    cost_model_ = absl::make_unique<BatchCostModel>(
+        options_.allowed_batch_sizes);
+  }
+  for (const auto& ragged_input : options_.ragged_inputs) {
+    ragged_tensor_names_.insert(ragged_input.values);
+    ragged_inner_tensor_names_.insert(ragged_input.values);
+    for (int i = 0; i < ragged_input.nested_row_splits.size(); ++i) {
+      ragged_tensor_names_.insert(ragged_input.nested_row_splits[i]);
+      if (i > 0) {
+        ragged_inner_tensor_names_.insert(ragged_input.nested_row_splits[i]);
+      }
+    }
+  }
+}
+
+BatchingSession::~BatchingSession() {
+  if (stats_source_id_.has_value()) {
+    BatchingStats::Get()->RemoveQueueDepthSource(*stats_source_id_);
+  }
+  {
+    absl::MutexLock l(&destruction_mu_);
+    destroying_ = true;
+  }
+  // The ticket batches use the bulk lanes and the batch schedulers, so wait for
+  // them first.
+  for (auto& entry : bulk_lanes_) {
+    entry.second->ticket_scheduler.reset();
+  }
+}
+
+int64 BatchingSession::NumEnqueuedTasks() {
+  int64 num_enqueued_tasks = 0;
+  for (const auto& entry : batch_schedulers_) {
+    num_enqueued_tasks += entry.second->NumEnqueuedTasks();
+  }
+  for (const auto& entry : length_bucket_schedulers_) {
+    for (const auto& bucket_scheduler : entry.second) {
+      num_enqueued_tasks += bucket_scheduler->NumEnqueuedTasks();
+    }
+  }
+  for (const auto& entry : large_request_schedulers_) {
+    num_enqueued_tasks += entry.second->NumEnqueuedTasks();
+  }
+  absl::MutexLock l(&mu_);
+  for (const auto& entry : custom_signature_batch_schedulers_) {
+    num_enqueued_tasks += entry.second->NumEnqueuedTasks();
+  }
+  return num_enqueued_tasks;
+}
+
+int64 BatchingSession::MaxBatchSize(const TensorSignature& signature) const {
+  if (!options_.allowed_batch_sizes.empty()) {
+    return options_.allowed_batch_sizes.back();
+  }
+  auto it = batch_schedulers_.find(signature);
+  return it == batch_schedulers_.end() ? 0 : it->second->max_task_size();
+}
+
+int64 BatchingSession::ComputeInputLength(
+    const std::vector<std::pair<string, Tensor>>& inputs) const {
+  int64 length = 0;
+  for (const auto& entry : inputs) {
+    const Tensor& tensor = entry.second;
+    if (tensor.dims() > options_.length_bucket_dim &&
+        ragged_tensor_names_.count(entry.first) == 0) {
+      length = std::max(length, tensor.dim_size(options_.length_bucket_dim));
+    }
+  }
+  return length;
+}
 
 Status BatchingSession::ComputeInputSize(
     const std::vector<std::pair<string, Tensor>>& inputs, size_t* size) const {
+  // The values and inner row splits of ragged inputs are not batched along
+  // their zeroth dimension, and the outermost row splits have one more entry
+  // than rows.
+  std::vector<const std::pair<string, Tensor>*> batched_inputs;
+  for (const auto& entry : inputs) {
+    if (ragged_inner_tensor_names_.count(entry.first) == 0) {
+      batched_inputs.push_back(&entry);
+    }
+  }
+  auto dim_size = [this](const std::pair<std::string, Tensor>* tensor,
+                         size_t dim) -> size_t {
+    const int64 size = tensor->second.shape().dim_size(dim);
+    if (dim == 0 && ragged_tensor_names_.count(tensor->first) > 0) {
+      return std::max<int64>(size - 1, 0);
+    }
+    return size;
+  };
   TF_RETURN_IF_ERROR(::tensorflow::serving::ComputeTensorBatchSize(
-      inputs, size,
-      [](const std::pair<std::string, Tensor>& tensor) {
-        return tensor.second.shape().dims();
+      batched_inputs, size,
+      [](const std::pair<std::string, Tensor>* tensor) {
+        return tensor->second.shape().dims();
       },
-      [](const std::pair<std::string, Tensor>& tensor, size_t dim) {
-        return tensor.second.shape().dim_size(dim);
-      }));
-  for (const auto& entry : inputs) {
-    const Tensor& tensor = entry.second;
-    RecordInputBatchSize<BatchingSessionTask>(tensor.shape().dim_size(0));
+      dim_size));
+  for (const auto* entry : batched_inputs) {
+    RecordInputBatchSize<BatchingSessionTask>(dim_size(entry, 0));
   }
   return Status::OK();
 }
@@ -489,8 +1420,35 @@ Status BatchingSession::MergeInputTensors(
                                          lowest_allowed_batch_size);
   RecordProcessedBatchSize<BatchingSessionTask>(lowest_allowed_batch_size);
 
+  // A single task without padding needs no concatenation: forward its tensors
+  // (which shares their buffers).
+  if (batch.num_tasks() == 1 && padding_size == 0) {
+    const std::vector<std::pair<string, Tensor>>& task_inputs =
+        GetTaskInput(batch.task(0));
+    if (task_inputs.size() != signature.input_tensors.size()) {
+      return errors::Internal(
+          "One or more tasks does not conform to batch signature");
+    }
+    for (const string& tensor_name : signature.input_tensors) {
+      auto input = std::find_if(task_inputs.begin(), task_inputs.end(),
+                                [&tensor_name](const std::pair<string, Tensor>&
+                                                   entry) {
+                                  return entry.first == tensor_name;
+                                });
+      if (input == task_inputs.end()) {
+        return errors::Internal(
+            "One or more tasks does not conform to batch signature");
+      }
+      merged_inputs->push_back(*input);
+    }
+    return Status::OK();
+  }
+
   // For each input tensor name, a vector of tensors from the individual tasks.
   std::map<string, std::vector<Tensor>> tensors_to_merge;
+  // Same as 'tensors_to_merge', for the tensors of ragged inputs (which are
+  // neither padded nor checked for equal shapes).
+  std::map<string, std::vector<Tensor>> ragged_tensors_to_merge;
   // For each input tensor name a vector of maximum dimension sizes
   // among tensors from individual tasks.
   absl::optional<std::map<string, std::vector<int>>> max_dim_sizes;
@@ -507,6 +1465,10 @@ Status BatchingSession::MergeInputTensors(
       const string& tensor_name = entry.first;
       const Tensor& tensor = entry.second;
 
+      if (ragged_tensor_names_.count(tensor_name) > 0) {
+        ragged_tensors_to_merge[tensor_name].push_back(tensor);
+        continue;
+      }
       std::vector<Tensor>& tensor_vec = tensors_to_merge[tensor_name];
       Tensor optionally_padded_tensor;
       if (options_.pad_variable_length_inputs) {
@@ -547,13 +1509,56 @@ Status BatchingSession::MergeInputTensors(
     }
   }
 
+  // Merge the ragged inputs present in the signature.
+  std::map<string, Tensor> merged_ragged_tensors;
+  for (const auto& ragged_input : options_.ragged_inputs) {
+    auto values = ragged_tensors_to_merge.find(ragged_input.values);
+    if (values == ragged_tensors_to_merge.end()) {
+      continue;
+    }
+    if (values->second.size() != batch.num_tasks()) {
+      return errors::Internal(
+          "One or more tasks does not conform to batch signature");
+    }
+    std::vector<std::vector<Tensor>> task_nested_row_splits(batch.num_tasks());
+    for (const string& row_splits_name : ragged_input.nested_row_splits) {
+      auto row_splits = ragged_tensors_to_merge.find(row_splits_name);
+      if (row_splits == ragged_tensors_to_merge.end() ||
+          row_splits->second.size() != batch.num_tasks()) {
+        return errors::Internal(
+            "One or more tasks does not conform to batch signature");
+      }
+      for (int i = 0; i < batch.num_tasks(); ++i) {
+        task_nested_row_splits[i].push_back(row_splits->second[i]);
+      }
+    }
+    std::vector<Tensor> merged_nested_row_splits;
+    Tensor merged_values;
+    TF_RETURN_IF_ERROR(MergeRaggedTensors(task_nested_row_splits,
+                                          values->second, padding_size,
+                                          &merged_nested_row_splits,
+                                          &merged_values));
+    merged_ragged_tensors[ragged_input.values] = std::move(merged_values);
+    for (int i = 0; i < merged_nested_row_splits.size(); ++i) {
+      merged_ragged_tensors[ragged_input.nested_row_splits[i]] =
+          std::move(merged_nested_row_splits[i]);
+    }
+  }
+
   // Merge the tensors.
-  DCHECK_EQ(signature.input_tensors.size(), tensors_to_merge.size());
-  if (tensors_to_merge.size() != signature.input_tensors.size()) {
+  DCHECK_EQ(signature.input_tensors.size(),
+            tensors_to_merge.size() + merged_ragged_tensors.size());
+  if (tensors_to_merge.size() + merged_ragged_tensors.size() !=
+      signature.input_tensors.size()) {
     return errors::Internal(
         "One or more tasks does not conform to batch signature");
   }
   for (const string& tensor_name : signature.input_tensors) {
+    auto ragged_tensor = merged_ragged_tensors.find(tensor_name);
+    if (ragged_tensor != merged_ragged_tensors.end()) {
+      merged_inputs->push_back({tensor_name, std::move(ragged_tensor->second)});
+      continue;
+    }
     auto tensors = tensors_to_merge.find(tensor_name);
     DCHECK(tensors != tensors_to_merge.end());
     if (tensors == tensors_to_merge.end()) {
@@ -561,7 +1566,10 @@ Status BatchingSession::MergeInputTensors(
           "One or more tasks does not conform to batch signature");
     }
     Tensor concated;
-    const Status concat_status = tensor::Concat(tensors->second, &concated);
+    const Status concat_status =
+        options_.num_pooled_input_buffers > 0
+            ? ConcatIntoPooledBuffer(tensor_name, tensors->second, &concated)
+            : tensor::Concat(tensors->second, &concated);
     DCHECK(concat_status.ok()) << concat_status.ToString();
     if (!concat_status.ok()) {
       return errors::Internal("Tensor concat operation failed: ",
@@ -573,6 +1581,147 @@ Status BatchingSession::MergeInputTensors(
   return Status::OK();
 }
 
+Status BatchingSession::ConcatIntoPooledBuffer(
+    const string& tensor_name, const std::vector<Tensor>& tensors,
+    Tensor* merged) {
+  if (tensors.empty()) {
+    return errors::Internal("No tensors to concatenate");
+  }
+  const Tensor& first = tensors[0];
+  if (!DataTypeCanUseMemcpy(first.dtype()) && first.dtype() != DT_STRING) {
+    // CopyTensorRows() does not support the type.
+    return tensor::Concat(tensors, merged);
+  }
+  if (first.dims() == 0) {
+    return errors::InvalidArgument("Cannot concatenate scalars");
+  }
+  int64 num_rows = 0;
+  for (const Tensor& tensor : tensors) {
+    if (tensor.dtype() != first.dtype() ||
+        !AreShapesEqualExceptZeroDim(tensor.shape(), first.shape())) {
+      return errors::InvalidArgument(
+          "Cannot concatenate tensors of different types or shapes");
+    }
+    num_rows += tensor.dim_size(0);
+  }
+  TensorShape shape = first.shape();
+  shape.set_dim(0, num_rows);
+
+  *merged = GetPooledInputBuffer(tensor_name, first.dtype(), shape);
+  int64 row = 0;
+  for (const Tensor& tensor : tensors) {
+    TF_RETURN_IF_ERROR(
+        CopyTensorRows(tensor, 0, tensor.dim_size(0), row, merged));
+    row += tensor.dim_size(0);
+  }
+  return Status::OK();
+}
+
+Tensor BatchingSession::GetPooledInputBuffer(const string& tensor_name,
+                                             const DataType dtype,
+                                             const TensorShape& shape) {
+  absl::MutexLock l(&input_buffers_mu_);
+  std::vector<Tensor>& buffers = input_buffers_[tensor_name];
+  Tensor* unused_buffer = nullptr;
+  for (Tensor& buffer : buffers) {
+    if (!buffer.RefCountIsOne()) {
+      continue;
+    }
+    if (buffer.dtype() == dtype && buffer.shape() == shape) {
+      return buffer;
+    }
+    unused_buffer = &buffer;
+  }
+  Tensor buffer(dtype, shape);
+  if (static_cast<int>(buffers.size()) < options_.num_pooled_input_buffers) {
+    buffers.push_back(buffer);
+  } else if (unused_buffer != nullptr) {
+    // The pool is full, so an unused buffer of another shape makes room.
+    *unused_buffer = buffer;
+  }
+  return buffer;
+}
+
+Status BatchingSession::IncrementallyMergeInputTensors(
+    const TensorSignature& signature, const Batch<BatchingSessionTask>& batch,
+    std::vector<std::pair<string, Tensor>>* merged_inputs) {
+  const int expected_num_rows = options_.allowed_batch_sizes.empty()
+                                    ? 0
+                                    : options_.allowed_batch_sizes.back();
+  IncrementalInputMerger merger(expected_num_rows);
+  if (batch.IsClosed()) {
+    // No task joins a closed batch: merge them all at once.
+    for (int i = 0; i < batch.num_tasks(); ++i) {
+      TF_RETURN_IF_ERROR(merger.AddTask(batch.task(i)));
+    }
+  } else {
+    // The tasks join the open batch in ScheduleTask(), under 'admission_mu_',
+    // which wakes up the loop below. A closure waits for the batch to close,
+    // which the batch scheduler may do on its own (e.g. on timeout).
+    struct MergeState {
+      const Batch<BatchingSessionTask>* batch;
+      int num_seen_tasks = 0;
+      bool closed = false;
+    };
+    MergeState state;
+    state.batch = &batch;
+    Env::Default()->SchedClosure([this, &state] {
+      state.batch->WaitUntilClosed();
+      absl::MutexLock l(&admission_mu_);
+      state.closed = true;
+    });
+    // The closure must be done with 'state' before returning.
+    auto wait_until_closed = gtl::MakeCleanup([this, &state] {
+      absl::MutexLock l(&admission_mu_);
+      admission_mu_.Await(absl::Condition(&state.closed));
+    });
+    std::vector<const BatchingSessionTask*> new_tasks;
+    bool closed = false;
+    while (!closed) {
+      new_tasks.clear();
+      {
+        absl::MutexLock l(&admission_mu_);
+        admission_mu_.Await(absl::Condition(
+            +[](MergeState* state) {
+              return state->closed ||
+                     state->batch->num_tasks() > state->num_seen_tasks;
+            },
+            &state));
+        closed = state.closed;
+        // Batch::task() reads the tasks of the batch without holding its
+        // lock, which is only safe while no task joins it.
+        for (; state.num_seen_tasks < batch.num_tasks();
+             ++state.num_seen_tasks) {
+          new_tasks.push_back(&batch.task(state.num_seen_tasks));
+        }
+      }
+      for (const BatchingSessionTask* task : new_tasks) {
+        TF_RETURN_IF_ERROR(merger.AddTask(*task));
+      }
+    }
+  }
+  if (batch.num_tasks() < 1) {
+    return errors::Internal("Batch size expected to be positive; was ",
+                            batch.num_tasks());
+  }
+
+  const int lowest_allowed_batch_size =
+      RoundToLowestAllowedBatchSize(options_.allowed_batch_sizes, batch.size());
+  const int padding_size = lowest_allowed_batch_size - batch.size();
+  profiler::TraceMe trace_me([lowest_allowed_batch_size, padding_size]() {
+    return profiler::TraceMeEncode(
+        "IncrementallyMergeInputTensors",
+        {{"batch_size_after_padding", lowest_allowed_batch_size},
+         {"padding_amount", padding_size}});
+  });
+  TF_RETURN_IF_ERROR(
+      merger.Finish(signature, batch.size(), padding_size, merged_inputs));
+  RecordPaddingSize<BatchingSessionTask>(padding_size,
+                                         lowest_allowed_batch_size);
+  RecordProcessedBatchSize<BatchingSessionTask>(lowest_allowed_batch_size);
+  return Status::OK();
+}
+
 Status BatchingSession::SplitOutputTensors(
     const TensorSignature& signature,
     const std::vector<Tensor>& combined_outputs,
@@ -583,17 +1732,14 @@ Status BatchingSession::SplitOutputTensors(
                             batch->num_tasks());
   }
 
-  std::vector<int64> task_sizes_plus_optional_padding;
-  task_sizes_plus_optional_padding.reserve(batch->num_tasks());
+  std::vector<int64> task_sizes;
+  task_sizes.reserve(batch->num_tasks());
   for (int i = 0; i < batch->num_tasks(); ++i) {
-    task_sizes_plus_optional_padding.push_back(batch->task(i).zeroth_dim_size);
+    task_sizes.push_back(batch->task(i).zeroth_dim_size);
   }
   const int padding_size = RoundToLowestAllowedBatchSize(
                                options_.allowed_batch_sizes, batch->size()) -
                            batch->size();
-  if (padding_size > 0) {
-    task_sizes_plus_optional_padding.push_back(padding_size);
-  }
 
   // For each output tensor name, a divided-up tensor with one entry per task.
   std::map<string, std::vector<Tensor>> split_tensors;
@@ -603,6 +1749,42 @@ Status BatchingSession::SplitOutputTensors(
   if (combined_outputs.size() != signature.output_tensors.size()) {
     return errors::Internal("Wrong number of batched output tensors");
   }
+
+  // A single task without padding needs no split: forward the batched tensors.
+  if (batch->num_tasks() == 1 && padding_size == 0) {
+    BatchingSessionTask* task = batch->mutable_task(0);
+    for (const string& tensor_name : *task->output_tensor_names) {
+      auto output = signature.output_tensors.find(tensor_name);
+      if (output == signature.output_tensors.end()) {
+        return errors::Internal("Task does not conform to batch signature");
+      }
+      const Tensor& tensor = combined_outputs[std::distance(
+          signature.output_tensors.begin(), output)];
+      if (tensor.shape().dims() == 0) {
+        return errors::FailedPrecondition(
+            "Batched output tensor has 0 dimensions");
+      }
+      if (tensor.shape().dim_size(0) != batch->size()) {
+        return errors::FailedPrecondition(
+            "Batched output tensor's 0th dimension does not equal the sum of "
+            "the 0th dimension sizes of the input tensors");
+      }
+      if (task->is_partial) {
+        (*task->shared_outputs)[task->split_index].push_back(tensor);
+      } else {
+        task->outputs->push_back(tensor);
+      }
+    }
+    return Status::OK();
+  }
+
+  // The tasks which split their outputs on their own threads only need the
+  // batched tensors.
+  bool split_on_batch_thread = false;
+  for (int i = 0; i < batch->num_tasks() && !split_on_batch_thread; ++i) {
+    split_on_batch_thread = batch->task(i).batch_outputs == nullptr;
+  }
+
   const std::vector<string> output_tensors(signature.output_tensors.begin(),
                                            signature.output_tensors.end());
   for (int i = 0; i < output_tensors.size(); ++i) {
@@ -618,27 +1800,38 @@ Status BatchingSession::SplitOutputTensors(
           "Batched output tensor's 0th dimension does not equal the sum of the "
           "0th dimension sizes of the input tensors");
     }
+    if (!split_on_batch_thread) {
+      continue;
+    }
 
+    // The tasks get slices of the batched tensor rather than copies, and the
+    // padding rows are left out.
     std::vector<Tensor> split_tensor;
     const Status split_status =
-        tensor::Split(tensor, task_sizes_plus_optional_padding, &split_tensor);
+        SliceTensorRows(tensor, task_sizes, &split_tensor);
     DCHECK(split_status.ok()) << split_status.ToString();
     if (!split_status.ok()) {
       return errors::Internal("Tensor split operation failed: ",
                               split_status.ToString());
     }
-    DCHECK_EQ(split_tensor.size(), task_sizes_plus_optional_padding.size());
-    if (split_tensor.size() != task_sizes_plus_optional_padding.size()) {
-      return errors::Internal(
-          "Tensor split operation did not work as expected; got ",
-          split_tensor.size(), " splits; expected ",
-          task_sizes_plus_optional_padding.size());
-    }
     split_tensors[tensor_name] = std::move(split_tensor);
   }
 
+  std::shared_ptr<const std::vector<Tensor>> shared_combined_outputs;
+  int64 next_task_row = 0;
   for (int i = 0; i < batch->num_tasks(); ++i) {
     BatchingSessionTask* task = batch->mutable_task(i);
+    const int64 task_row = next_task_row;
+    next_task_row += task_sizes[i];
+    if (task->batch_outputs != nullptr) {
+      if (shared_combined_outputs == nullptr) {
+        shared_combined_outputs =
+            std::make_shared<const std::vector<Tensor>>(combined_outputs);
+      }
+      *task->batch_outputs = shared_combined_outputs;
+      *task->batch_output_row = task_row;
+      continue;
+    }
     for (const string& tensor_name : *task->output_tensor_names) {
       auto split_tensor = split_tensors.find(tensor_name);
       DCHECK(split_tensor != split_tensors.end());
@@ -655,8 +1848,6 @@ Status BatchingSession::SplitOutputTensors(
       }
     }
   }
-  // (Ignore a possible final split_tensors entry containing the padding.)
-
   return Status::OK();
 }
 
@@ -695,34 +1886,239 @@ Status BatchingSession::SplitRunMetadata(RunMetadata* batch_metadata,
   return Status::OK();
 }
 
+void BatchingSession::ProcessBulkBatch(
+    const TensorSignature& signature, BulkLane* bulk_lane,
+    std::unique_ptr<Batch<BatchingSessionTask>> tickets) {
+  tickets->WaitUntilClosed();
+  {
+    absl::MutexLock l(&bulk_lane->mu);
+    bulk_lane->num_held_tickets += tickets->num_tasks();
+  }
+  ProcessHeldBulkTasks(signature, bulk_lane);
+}
+
+void BatchingSession::ProcessRegularBatch(
+    const TensorSignature& signature, BulkLane* bulk_lane,
+    std::unique_ptr<Batch<BatchingSessionTask>> batch) {
+  if (bulk_lane == nullptr) {
+    ProcessBatch(signature, bulk_lane, std::move(batch));
+    return;
+  }
+  {
+    absl::MutexLock l(&bulk_lane->mu);
+    ++bulk_lane->num_regular_batches;
+  }
+  ProcessBatch(signature, bulk_lane, std::move(batch));
+  ProcessHeldBulkTasks(signature, bulk_lane);
+}
+
+void BatchingSession::ProcessHeldBulkTasks(const TensorSignature& signature,
+                                           BulkLane* bulk_lane) {
+  while (true) {
+    // Checked before the tickets are: the regular tasks waiting now are taken
+    // by regular batches, which process the tickets held here after them.
+    const bool regular_tasks_waiting = RegularTasksWaiting(signature);
+    auto batch = absl::make_unique<Batch<BatchingSessionTask>>();
+    {
+      absl::MutexLock l(&bulk_lane->mu);
+      if (bulk_lane->num_held_tickets == 0 ||
+          (regular_tasks_waiting &&
+           bulk_lane->num_regular_batches <
+               options_.regular_batches_per_bulk_batch)) {
+        return;
+      }
+      // Some of the pending tasks may have been taken to fill the padding of
+      // other batches already.
+      std::vector<std::unique_ptr<BatchingSessionTask>> bulk_tasks;
+      TakeBulkTasks(bulk_lane, bulk_lane->max_batch_size,
+                    bulk_lane->num_held_tickets, &bulk_tasks);
+      if (bulk_tasks.empty()) {
+        bulk_lane->num_held_tickets = 0;
+        return;
+      }
+      bulk_lane->num_held_tickets -= bulk_tasks.size();
+      bulk_lane->num_regular_batches = 0;
+      for (auto& task : bulk_tasks) {
+        batch->AddTask(std::move(task));
+      }
+    }
+    batch->Close();
+    ProcessBatch(signature, bulk_lane, std::move(batch));
+  }
+}
+
+bool BatchingSession::RegularTasksWaiting(const TensorSignature& signature) {
+  absl::ReaderMutexLock l(&destruction_mu_);
+  if (destroying_) {
+    return false;
+  }
+  auto batch_scheduler = batch_schedulers_.find(signature);
+  if (batch_scheduler != batch_schedulers_.end() &&
+      batch_scheduler->second->NumEnqueuedTasks() > 0) {
+    return true;
+  }
+  auto bucket_schedulers = length_bucket_schedulers_.find(signature);
+  if (bucket_schedulers != length_bucket_schedulers_.end()) {
+    for (const auto& bucket_scheduler : bucket_schedulers->second) {
+      if (bucket_scheduler->NumEnqueuedTasks() > 0) {
+        return true;
+      }
+    }
+  }
+  auto large_request_scheduler = large_request_schedulers_.find(signature);
+  return large_request_scheduler != large_request_schedulers_.end() &&
+         large_request_scheduler->second->NumEnqueuedTasks() > 0;
+}
+
 void BatchingSession::ProcessBatch(
-    const TensorSignature& signature,
+    const TensorSignature& signature, BulkLane* bulk_lane,
+    std::unique_ptr<Batch<BatchingSessionTask>> batch) {
+  if (options_.max_concurrent_batches <= 0) {
+    ProcessBatchNow(signature, bulk_lane, std::move(batch));
+    return;
+  }
+  {
+    absl::MutexLock l(&concurrency_mu_);
+    if (num_running_batches_ >= options_.max_concurrent_batches) {
+      // Free this batch thread for the batches of other sessions.
+      deferred_batches_.push_back({signature, bulk_lane, std::move(batch)});
+      return;
+    }
+    ++num_running_batches_;
+  }
+  DeferredBatch next = {signature, bulk_lane, std::move(batch)};
+  while (true) {
+    ProcessBatchNow(next.signature, next.bulk_lane, std::move(next.batch));
+    absl::MutexLock l(&concurrency_mu_);
+    if (deferred_batches_.empty()) {
+      --num_running_batches_;
+      return;
+    }
+    auto next_it = deferred_batches_.begin();
+    if (options_.earliest_deadline_first) {
+      next_it = std::min_element(
+          deferred_batches_.begin(), deferred_batches_.end(),
+          [](const DeferredBatch& a, const DeferredBatch& b) {
+            return EarliestDeadlineMicros(*a.batch) <
+                   EarliestDeadlineMicros(*b.batch);
+          });
+    }
+    next = std::move(*next_it);
+    deferred_batches_.erase(next_it);
+  }
+}
+
+void BatchingSession::ProcessBatchNow(
+    const TensorSignature& signature, BulkLane* bulk_lane,
     std::unique_ptr<Batch<BatchingSessionTask>> batch) {
-  // As a possible performance optimization, consider overlapping the tensor
-  // concatenation with waiting for the batch to close (i.e. do the
-  // concatenation incrementally as tasks stream into the batch).
+  // If enabled, the tensor concatenation overlaps with waiting for the batch to
+  // close. Batches it fails on are merged again below, which reports the error
+  // if there is one.
+  std::vector<std::pair<string, Tensor>> merged_inputs;
+  bool merged_incrementally = false;
+  if (options_.incremental_input_merge &&
+      !options_.pad_variable_length_inputs && options_.ragged_inputs.empty()) {
+    merged_incrementally =
+        IncrementallyMergeInputTensors(signature, *batch, &merged_inputs).ok();
+  }
   batch->WaitUntilClosed();
 
+  // The cancelled tasks, and the expired ones with earliest deadline first
+  // scheduling, are not merged, nor counted for the padding.
+  {
+    Batch<BatchingSessionTask>* const closed_batch = batch.get();
+    batch = RemoveDroppedTasks(std::move(batch),
+                               options_.earliest_deadline_first,
+                               EnvTime::NowMicros());
+    if (batch.get() != closed_batch) {
+      merged_incrementally = false;
+    }
+  }
+
   if (batch->empty()) {
     return;
   }
 
+  // Fill the padding of the batch with bulk tasks.
+  if (bulk_lane != nullptr && !options_.allowed_batch_sizes.empty()) {
+    const int padding_size =
+        RoundToLowestAllowedBatchSize(options_.allowed_batch_sizes,
+                                      batch->size()) -
+        batch->size();
+    std::vector<std::unique_ptr<BatchingSessionTask>> bulk_tasks;
+    if (padding_size > 0) {
+      absl::MutexLock l(&bulk_lane->mu);
+      TakeBulkTasks(bulk_lane, padding_size, INT_MAX, &bulk_tasks);
+    }
+    if (!bulk_tasks.empty()) {
+      batch = ExtendBatch(std::move(batch), std::move(bulk_tasks));
+      merged_incrementally = false;
+    }
+  }
+
+  RunClosedBatch(signature, std::move(batch), std::move(merged_inputs),
+                 merged_incrementally);
+}
+
+void BatchingSession::RunClosedBatch(
+    const TensorSignature& signature,
+    std::unique_ptr<Batch<BatchingSessionTask>> batch,
+    std::vector<std::pair<string, Tensor>> merged_inputs,
+    bool merged_incrementally) {
+  if (cost_model_ != nullptr) {
+    std::unique_ptr<Batch<BatchingSessionTask>> tail =
+        MaybeSplitBatch(batch.get());
+    if (tail != nullptr) {
+      // The rows of the head are the first ones of the merged inputs, and
+      // those of the tail follow. The rows after them, tail or padding rows,
+      // are valid entries to pad the head and tail with. The tail is merged
+      // again if its padding runs past the end of the merged inputs.
+      std::vector<std::pair<string, Tensor>> head_inputs;
+      std::vector<std::pair<string, Tensor>> tail_inputs;
+      bool head_merged = false;
+      bool tail_merged = false;
+      if (merged_incrementally) {
+        const auto& allowed_batch_sizes = options_.allowed_batch_sizes;
+        head_merged = SliceMergedInputs(
+            merged_inputs, 0,
+            RoundToLowestAllowedBatchSize(allowed_batch_sizes, batch->size()),
+            &head_inputs);
+        tail_merged = SliceMergedInputs(
+            merged_inputs, batch->size(),
+            RoundToLowestAllowedBatchSize(allowed_batch_sizes, tail->size()),
+            &tail_inputs);
+      }
+      merged_inputs.clear();
+      RunClosedBatch(signature, std::move(batch), std::move(head_inputs),
+                     head_merged);
+      RunClosedBatch(signature, std::move(tail), std::move(tail_inputs),
+                     tail_merged);
+      return;
+    }
+  }
+
   const uint64 dequeue_time_micros = EnvTime::NowMicros();
 
+  // The batch span is the root of its own trace, linked to the traced tasks.
+  std::vector<TraceContext> trace_links;
+  for (int i = 0; i < batch->num_tasks(); ++i) {
+    BatchingSessionTask* task = batch->mutable_task(i);
+    if (task->queue_span != nullptr) {
+      task->queue_span->End();
+    }
+    if (task->trace_context) {
+      trace_links.push_back(*task->trace_context);
+    }
+  }
+  TraceSpan batch_span("BatchingSessionProcessBatch", trace_links);
+
   // Regardless of the outcome, we need to propagate the status to the
   // individual tasks and signal that they are done. We use MakeCleanup() to
   // ensure that this happens no matter how we exit the method below.
   Status status;
   auto finally = gtl::MakeCleanup([&status, &batch] {
     for (int i = 0; i < batch->num_tasks(); ++i) {
-      BatchingSessionTask* task = batch->mutable_task(i);
-      if (task->is_partial) {
-        task->thread_safe_status->Update(status);
-        task->done_callback();
-      } else {
-        *batch->mutable_task(i)->status = status;
-        batch->mutable_task(i)->done->Notify();
-      }
+      CompleteTask(status, batch->mutable_task(i));
     }
   });
 
@@ -731,8 +2127,11 @@ void BatchingSession::ProcessBatch(
   // overall batch.
   bool all_tasks_timeout_exceeded = true;
   uint64 batch_deadline_micros = 0;
+  uint64 first_enqueue_time_micros = dequeue_time_micros;
   for (int i = 0; i < batch->num_tasks(); ++i) {
     const BatchingSessionTask& task = batch->task(i);
+    first_enqueue_time_micros =
+        std::min(first_enqueue_time_micros, task.enqueue_time_micros);
     // If the caller doesn't populate RunOptions, the timeout is 0 by default.
     // Interpret that as "no timeout" i.e. infinity.
     const int64 task_timeout_micros =
@@ -747,12 +2146,10 @@ void BatchingSession::ProcessBatch(
         batch_deadline_micros = task_deadline_micros;
       }
     }
-    queuing_latency->GetCell(thread_pool_name_)
-        ->Add(dequeue_time_micros - task.enqueue_time_micros);
+    queuing_latency_cell_->Add(dequeue_time_micros - task.enqueue_time_micros);
   }
   if (all_tasks_timeout_exceeded) {
-    status = Status(error::RESOURCE_EXHAUSTED,
-                    "Run() timeout exceeded while waiting in batching queue");
+    status = QueueTimeoutExceededStatus();
     return;
   }
 
@@ -764,10 +2161,16 @@ void BatchingSession::ProcessBatch(
         (batch_deadline_micros - dequeue_time_micros) / 1000);
   }
 
-  std::vector<std::pair<string, Tensor>> merged_inputs;
-  status = MergeInputTensors(signature, *batch, &merged_inputs);
-  if (!status.ok()) {
-    return;
+  uint64 merge_micros = 0;
+  if (!merged_incrementally) {
+    merged_inputs.clear();
+    const uint64 merge_start_micros = EnvTime::NowMicros();
+    status = MergeInputTensors(signature, *batch, &merged_inputs);
+    merge_micros = EnvTime::NowMicros() - merge_start_micros;
+    merge_inputs_latency_cell_->Add(merge_micros);
+    if (!status.ok()) {
+      return;
+    }
   }
 
   absl::optional<thread::ThreadPoolOptions> thread_pool_options =
@@ -777,6 +2180,8 @@ void BatchingSession::ProcessBatch(
       signature.output_tensors.begin(), signature.output_tensors.end());
   std::vector<Tensor> combined_outputs;
   RunMetadata run_metadata;
+  const uint64 run_start_micros = EnvTime::NowMicros();
+  ScopedTraceContext run_trace_context(batch_span.context());
   // Because the wrapped session may not provide an implementation for
   // thread_pool_options, we need to invoke different Run() functions depending
   // on whether thread_pool_options is specified.
@@ -789,13 +2194,116 @@ void BatchingSession::ProcessBatch(
                            {} /* target node names */, &combined_outputs,
                            &run_metadata);
   }
+  const uint64 run_micros = EnvTime::NowMicros() - run_start_micros;
+  run_latency_cell_->Add(run_micros);
+  const int64 padding_size =
+      RoundToLowestAllowedBatchSize(options_.allowed_batch_sizes,
+                                    batch->size()) -
+      batch->size();
+  if (!options_.model_name.empty()) {
+    BatchingStats::BatchRecord record;
+    record.batch_size = batch->size();
+    record.padding_size = padding_size;
+    record.max_batch_size =
+        std::max<int64>(MaxBatchSize(signature), batch->size());
+    record.time_to_close_micros =
+        dequeue_time_micros - first_enqueue_time_micros;
+    record.run_micros = run_micros;
+    BatchingStats::Get()->RecordBatch(options_.model_name, record);
+  }
+  for (int i = 0; i < batch->num_tasks(); ++i) {
+    const BatchingSessionTask& task = batch->task(i);
+    if (task.flight_record == nullptr) {
+      continue;
+    }
+    FlightRecord::Batch flight_batch;
+    flight_batch.batch_size = batch->size();
+    flight_batch.padding_size = padding_size;
+    flight_batch.num_tasks = batch->num_tasks();
+    flight_batch.queue_micros = dequeue_time_micros - task.enqueue_time_micros;
+    flight_batch.merge_micros = merge_micros;
+    flight_batch.run_micros = run_micros;
+    task.flight_record->AddBatch(flight_batch);
+  }
+  if (cost_model_ != nullptr && status.ok()) {
+    cost_model_->Record(
+        RoundToLowestAllowedBatchSize(options_.allowed_batch_sizes,
+                                      batch->size()),
+        run_micros);
+  }
   status.Update(SplitRunMetadata(&run_metadata, batch.get()));
 
   if (!status.ok()) {
     return;
   }
 
+  // Note: The Run() of the wrapped session cannot be cancelled, but the
+  // outputs of a batch whose requests were all cancelled meanwhile are not
+  // split.
+  bool all_tasks_cancelled = true;
+  for (int i = 0; i < batch->num_tasks() && all_tasks_cancelled; ++i) {
+    all_tasks_cancelled = IsTaskCancelled(batch->task(i));
+  }
+  if (all_tasks_cancelled) {
+    status = RequestCancelledStatus();
+    return;
+  }
+
+  const uint64 split_start_micros = EnvTime::NowMicros();
   status = SplitOutputTensors(signature, combined_outputs, batch.get());
+  split_outputs_latency_cell_->Add(EnvTime::NowMicros() - split_start_micros);
+}
+
+std::unique_ptr<Batch<BatchingSessionTask>> BatchingSession::MaybeSplitBatch(
+    Batch<BatchingSessionTask>* batch) const {
+  const auto& allowed_batch_sizes = options_.allowed_batch_sizes;
+  const int batch_size = batch->size();
+  const int padded_size =
+      RoundToLowestAllowedBatchSize(allowed_batch_sizes, batch_size);
+  if (padded_size == batch_size || batch->num_tasks() < 2) {
+    return nullptr;
+  }
+
+  // The first batch takes the tasks that fit in the largest allowed batch size
+  // below 'batch_size', and the second one the others.
+  const auto it = std::upper_bound(allowed_batch_sizes.begin(),
+                                   allowed_batch_sizes.end(), batch_size);
+  if (it == allowed_batch_sizes.begin()) {
+    return nullptr;
+  }
+  const int max_head_size = *(it - 1);
+  int head_size = 0;
+  int num_head_tasks = 0;
+  while (num_head_tasks < batch->num_tasks() &&
+         head_size + batch->task(num_head_tasks).size() <= max_head_size) {
+    head_size += batch->task(num_head_tasks).size();
+    ++num_head_tasks;
+  }
+  if (num_head_tasks == 0 || num_head_tasks == batch->num_tasks()) {
+    return nullptr;
+  }
+
+  const double padded_micros = cost_model_->EstimatedMicros(padded_size);
+  const double head_micros = cost_model_->EstimatedMicros(
+      RoundToLowestAllowedBatchSize(allowed_batch_sizes, head_size));
+  const double tail_micros = cost_model_->EstimatedMicros(
+      RoundToLowestAllowedBatchSize(allowed_batch_sizes,
+                                    batch_size - head_size));
+  if (padded_micros < 0 || head_micros < 0 || tail_micros < 0 ||
+      head_micros + tail_micros >= padded_micros) {
+    return nullptr;
+  }
+
+  std::vector<std::unique_ptr<BatchingSessionTask>> tail_tasks;
+  while (batch->num_tasks() > num_head_tasks) {
+    tail_tasks.push_back(batch->RemoveTask());
+  }
+  auto tail = absl::make_unique<Batch<BatchingSessionTask>>();
+  for (auto task = tail_tasks.rbegin(); task != tail_tasks.rend(); ++task) {
+    tail->AddTask(std::move(*task));
+  }
+  tail->Close();
+  return tail;
 }
 
 // TODO(b/158393551):
@@ -811,10 +2319,9 @@ Status SplitInputTask(
 
   DCHECK_GT(input_task_size, open_batch_remaining_slot);
 
-  // `split_task_done_callback` runs only after all split tasks are complete.
-  std::function<void()> split_task_done_callback =
-      [done_notification = input_task.done,
-       shared_outputs = input_task.shared_outputs,
+  // `merge_outputs` runs only after all split tasks are complete.
+  std::function<void()> merge_outputs =
+      [shared_outputs = input_task.shared_outputs,
        shared_status = input_task.thread_safe_status,
        num_output = input_task.output_tensor_names->size(),
        outputs = input_task.outputs, status = input_task.status,
@@ -865,9 +2372,21 @@ Status SplitInputTask(
             graph_cost->set_cost(iter->second);
           }
         }
-
-        done_notification->Notify();
       };
+  std::function<void()> split_task_done_callback;
+  if (input_task.merge_split_outputs != nullptr) {
+    // The requesting thread merges the outputs once notified.
+    *input_task.merge_split_outputs = std::move(merge_outputs);
+    split_task_done_callback = [done_notification = input_task.done]() {
+      done_notification->Notify();
+    };
+  } else {
+    split_task_done_callback = [done_notification = input_task.done,
+                                merge_outputs = std::move(merge_outputs)]() {
+      merge_outputs();
+      done_notification->Notify();
+    };
+  }
   IncrementalBarrier barrier(split_task_done_callback);
 
   std::vector<int64> output_task_sizes;
@@ -898,6 +2417,12 @@ Status SplitInputTask(
     auto task = absl::make_unique<BatchingSessionTask>();
     task->enqueue_time_micros = input_task.enqueue_time_micros;
     task->run_options = input_task.run_options;
+    task->trace_context = input_task.trace_context;
+    task->cancellation = input_task.cancellation;
+    task->flight_record = input_task.flight_record;
+    if (i == 0) {
+      task->queue_span = std::move(input_task.queue_span);
+    }
     task->zeroth_dim_size = output_task_sizes[i];
     // `task->owned_input` will be initialized separately out of this for-loop.
     task->output_tensor_names = input_task.output_tensor_names;
@@ -35,6 +35,9 @@ limitations under the License.
 #include "tensorflow/core/public/session.h"
 #include "tensorflow_serving/batching/batching_options.h"
 #include "tensorflow_serving/batching/threadsafe_status.h"
+#include "tensorflow_serving/util/flight_recorder.h"
+#include "tensorflow_serving/util/request_cancellation.h"
+#include "tensorflow_serving/util/trace_context.h"
 
 namespace tensorflow {
 namespace serving {
@@ -79,6 +82,9 @@ TensorSignature TensorSignatureFromSignatureDefs(
 struct SignatureWithBatchingSessionSchedulerCreator {
   TensorSignature signature;
   BatchingSessionSchedulerCreator scheduler_creator;
+  // If set, creates the batch scheduler of the large Run() calls instead of
+  // 'scheduler_creator' (see BatchingSessionOptions::large_request_min_rows).
+  BatchingSessionSchedulerCreator large_request_scheduler_creator;
 };
 
 // Options for batching tensorflow Sessions; see the Create*() functions below.
@@ -185,6 +191,19 @@ struct BatchingSessionTask : public BatchTask {
   std::vector<Tensor>* outputs;
   RunMetadata* run_metadata;
   absl::optional<thread::ThreadPoolOptions> thread_pool_options;
+  // Trace context of the Run() call, if traced, and the span of the time the
+  // task waits for its batch to be processed. Split tasks share the context of
+  // their input task, and the first one takes its span.
+  absl::optional<TraceContext> trace_context;
+  std::unique_ptr<TraceSpan> queue_span;
+  // Cancellation of the request of the Run() call, if any, which outlives the
+  // task. Shared by the split tasks. The cancelled tasks are dropped before
+  // their batch is merged.
+  const RequestCancellation* cancellation = nullptr;
+  // Flight record of the request of the Run() call, if any, which outlives the
+  // task. Shared by the split tasks, which each add the batch they are
+  // processed in.
+  ScopedFlightRecord* flight_record = nullptr;
 
   // Fields populated when a task is processed (as part of a batch), and
   // substantially used in the intermediate stage if a task is a slice of
@@ -210,6 +229,20 @@ struct BatchingSessionTask : public BatchTask {
   std::shared_ptr<ThreadSafeStatus> thread_safe_status;
   // 'split_run_metadatas' records `run_metadata` of each split.
   std::shared_ptr<std::vector<RunMetadata>> split_run_metadatas;
+
+  // Fields populated when a task is received, if the outputs are split on
+  // the requesting thread (see
+  // BatchingSessionOptions::split_outputs_on_requesting_threads). Unset for
+  // the split tasks.
+  //
+  // The batch thread sets 'batch_outputs' to the outputs of the batch, in the
+  // order of the batch signature, and 'batch_output_row' to the first row of
+  // the task in them, instead of filling 'outputs'.
+  std::shared_ptr<const std::vector<Tensor>>* batch_outputs = nullptr;
+  int64* batch_output_row = nullptr;
+  // If set, SplitInputTask() sets it to the merge of the outputs of the split
+  // tasks, which then runs on the requesting thread once they are done.
+  std::function<void()>* merge_split_outputs = nullptr;
 };
 
 }  // namespace serving
@@ -0,0 +1,235 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Benchmarks of a BatchingSession under concurrent load.
+//
+// Client threads send Run() calls of 1 to 8 rows back to back to a
+// BatchingSession around a CostModelSession, whose Run() takes 200us plus 5us
+// per row. Each iteration sends kRequestsPerClient calls from each client.
+// The arguments are the number of client threads, the max batch size, the
+// batch timeout and the mode:
+//   0: no padding;
+//   1: padding to the powers of two up to the max batch size;
+//   2: like 1, and one call in 8 is twice the max batch size, split by
+//      'split_large_requests'.
+// Reported counters, besides the time and the throughput (calls/s):
+//   latency_p50_us, latency_p99_us: Latency of the Run() calls.
+//   queue_p50_us, queue_p99_us: Time the calls wait for their batch to run.
+//   merge_us, run_us, split_us: Mean time to merge the inputs of a batch, to
+//     run it and to split its outputs.
+//   batch_size, padding: Mean size and padding of the batches.
+//
+// Run with:
+// bazel run -c opt --dynamic_mode=off \
+// tensorflow_serving/batching:batching_session_benchmark -- --benchmarks=.
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/kernels/batching_util/basic_batch_scheduler.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/lib/histogram/histogram.h"
+#include "tensorflow/core/lib/monitoring/collected_metrics.h"
+#include "tensorflow/core/lib/monitoring/collection_registry.h"
+#include "tensorflow/core/platform/blocking_counter.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/init_main.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow_serving/batching/batching_session.h"
+#include "tensorflow_serving/batching/test_util/cost_model_session.h"
+#include "tensorflow_serving/util/flight_recorder.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+constexpr int kRequestsPerClient = 50;
+constexpr int kMaxRequestRows = 8;
+constexpr int kRowSize = 16;
+constexpr int64 kFixedCostMicros = 200;
+constexpr int64 kPerRowCostMicros = 5;
+constexpr char kThreadPoolName[] = "batching_session_benchmark";
+
+// Returns the sum and the count of the samples of the "split_outputs" stage of
+// the batches of the benchmark.
+std::pair<double, double> SplitOutputsSamples() {
+  monitoring::CollectionRegistry::CollectMetricsOptions options;
+  const std::unique_ptr<monitoring::CollectedMetrics> collected_metrics =
+      monitoring::CollectionRegistry::Default()->CollectMetrics(options);
+  const auto point_set = collected_metrics->point_set_map.find(
+      "/tensorflow/serving/batching_session/stage_latency");
+  if (point_set == collected_metrics->point_set_map.end()) {
+    return {0, 0};
+  }
+  for (const auto& point : point_set->second->points) {
+    if (point->labels[0].value == kThreadPoolName &&
+        point->labels[1].value == "split_outputs") {
+      return {point->histogram_value.sum(), point->histogram_value.num()};
+    }
+  }
+  return {0, 0};
+}
+
+// Maintains the batching session and the client threads of a benchmark.
+class BatchingSessionBenchmarkState {
+ public:
+  BatchingSessionBenchmarkState(const int num_clients,
+                                const int max_batch_size,
+                                const int64 batch_timeout_micros,
+                                const int mode)
+      : num_clients_(num_clients),
+        max_batch_size_(max_batch_size),
+        split_large_requests_(mode == 2) {
+    BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+    schedule_options.max_batch_size = max_batch_size;
+    schedule_options.batch_timeout_micros = batch_timeout_micros;
+    schedule_options.num_batch_threads = 4;
+    schedule_options.max_enqueued_batches = 1000;
+    schedule_options.thread_pool_name = kThreadPoolName;
+    BatchingSessionOptions batching_session_options;
+    if (mode >= 1) {
+      for (int size = 1; size < max_batch_size; size *= 2) {
+        batching_session_options.allowed_batch_sizes.push_back(size);
+      }
+      batching_session_options.allowed_batch_sizes.push_back(max_batch_size);
+    }
+    batching_session_options.split_large_requests = split_large_requests_;
+    TF_CHECK_OK(CreateBasicBatchingSession(
+        schedule_options, batching_session_options, {{"x"}, {"y"}},
+        std::unique_ptr<Session>(new test_util::CostModelSession(
+            kFixedCostMicros, kPerRowCostMicros)),
+        &session_));
+    clients_.reset(new thread::ThreadPool(
+        Env::Default(), "BatchingSessionBenchmarkClients", num_clients));
+  }
+
+  int num_requests() const { return num_clients_ * kRequestsPerClient; }
+
+  // Sends kRequestsPerClient calls from each client, recorded by 'recorder'.
+  void SendRequests(FlightRecorder* recorder) {
+    BlockingCounter done(num_clients_);
+    for (int client = 0; client < num_clients_; ++client) {
+      clients_->Schedule([this, recorder, client, &done]() {
+        for (int i = 0; i < kRequestsPerClient; ++i) {
+          const int rows = split_large_requests_ && i % 8 == 7
+                               ? 2 * max_batch_size_
+                               : 1 + (client + i) % kMaxRequestRows;
+          Tensor x(DT_FLOAT, TensorShape({rows, kRowSize}));
+          x.flat<float>().setConstant(1.0f);
+          std::vector<Tensor> outputs;
+          ScopedFlightRecord flight_record("benchmark", recorder);
+          TF_CHECK_OK(session_->Run({{"x", x}}, {"y"}, {}, &outputs));
+        }
+        done.DecrementCount();
+      });
+    }
+    done.Wait();
+  }
+
+ private:
+  const int num_clients_;
+  const int max_batch_size_;
+  const bool split_large_requests_;
+  std::unique_ptr<Session> session_;
+  std::unique_ptr<thread::ThreadPool> clients_;
+};
+
+void BM_BatchingSession(::testing::benchmark::State& state) {
+  BatchingSessionBenchmarkState bm_state(state.range(0), state.range(1),
+                                         state.range(2), state.range(3));
+  // Records all the calls of an iteration, whichever threads send them.
+  FlightRecorder::Options recorder_options;
+  recorder_options.requests_per_thread = bm_state.num_requests();
+
+  histogram::Histogram latencies;
+  histogram::Histogram queue_latencies;
+  double total_merge_micros = 0;
+  double total_run_micros = 0;
+  double total_batch_size = 0;
+  double total_padding = 0;
+  int64 num_batches = 0;
+  const std::pair<double, double> split_before = SplitOutputsSamples();
+  for (auto s : state) {
+    FlightRecorder recorder(recorder_options);
+    bm_state.SendRequests(&recorder);
+    state.PauseTiming();
+    for (const FlightRecord& record : recorder.GetRecentRecords()) {
+      latencies.Add(record.latency_micros);
+      for (const FlightRecord::Batch& batch : record.batches) {
+        queue_latencies.Add(batch.queue_micros);
+        total_merge_micros += batch.merge_micros;
+        total_run_micros += batch.run_micros;
+        total_batch_size += batch.batch_size;
+        total_padding += batch.padding_size;
+        ++num_batches;
+      }
+    }
+    state.ResumeTiming();
+  }
+  const std::pair<double, double> split_after = SplitOutputsSamples();
+
+  state.SetItemsProcessed(state.iterations() * bm_state.num_requests());
+  state.counters["latency_p50_us"] = latencies.Median();
+  state.counters["latency_p99_us"] = latencies.Percentile(99);
+  state.counters["queue_p50_us"] = queue_latencies.Median();
+  state.counters["queue_p99_us"] = queue_latencies.Percentile(99);
+  // The batches are counted once per call they hold.
+  if (num_batches > 0) {
+    state.counters["merge_us"] = total_merge_micros / num_batches;
+    state.counters["run_us"] = total_run_micros / num_batches;
+    state.counters["batch_size"] = total_batch_size / num_batches;
+    state.counters["padding"] = total_padding / num_batches;
+  }
+  const double num_splits = split_after.second - split_before.second;
+  if (num_splits > 0) {
+    state.counters["split_us"] =
+        (split_after.first - split_before.first) / num_splits;
+  }
+}
+
+// 1 to 64 clients, max batch sizes of 16 and 64, batch timeouts of 0 and 1ms,
+// and the three modes.
+void Configurations(::testing::benchmark::internal::Benchmark* benchmark) {
+  for (const int mode : {0, 1, 2}) {
+    for (const int max_batch_size : {16, 64}) {
+      for (const int batch_timeout_micros : {0, 1000}) {
+        for (const int num_clients : {1, 8, 64}) {
+          benchmark->Args(
+              {num_clients, max_batch_size, batch_timeout_micros, mode});
+        }
+      }
+    }
+  }
+}
+
+BENCHMARK(BM_BatchingSession)->Apply(Configurations)->UseRealTime();
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
+
+int main(int argc, char** argv) {
+  tensorflow::port::InitMain(argv[0], &argc, &argv);
+  tensorflow::testing::RunBenchmarks();
+  return 0;
+}
@@ -15,6 +15,10 @@ limitations under the License.
 
 #include "tensorflow_serving/batching/batching_session.h"
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
 #include <memory>
 
 #include <gtest/gtest.h>
@@ -36,13 +40,16 @@ limitations under the License.
 #include "tensorflow/core/platform/types.h"
 #include "tensorflow/core/protobuf/config.pb.h"
 #include "tensorflow/core/public/session_options.h"
+#include "tensorflow_serving/batching/streaming_batch_scheduler.h"
 #include "tensorflow_serving/servables/tensorflow/serving_session.h"
 #include "tensorflow_serving/test_util/test_util.h"
+#include "tensorflow_serving/util/request_cancellation.h"
 
 namespace tensorflow {
 namespace serving {
 namespace {
 
+using ::testing::ElementsAre;
 using ::testing::HasSubstr;
 using ::testing::UnorderedElementsAre;
 
@@ -78,13 +85,30 @@ class BatchSizeCapturingSession : public ServingSession {
              std::vector<Tensor>* outputs, RunMetadata* run_metadata,
              const thread::ThreadPoolOptions& thread_pool_options) override
       TF_LOCKS_EXCLUDED(latest_batch_size_mu_) {
+    int64 delay_micros = 0;
     {
       mutex_lock l(latest_batch_size_mu_);
       latest_batch_size_ = inputs[0].second.shape().dim_size(0);
+      batch_sizes_.push_back(latest_batch_size_);
+      input_data_.push_back(inputs[0].second.tensor_data().data());
+      ++num_running_runs_;
+      max_num_concurrent_runs_ =
+          std::max(max_num_concurrent_runs_, num_running_runs_);
+      auto delay = delay_micros_.find(latest_batch_size_);
+      if (delay != delay_micros_.end()) {
+        delay_micros = delay->second;
+      }
+    }
+    if (delay_micros > 0) {
+      Env::Default()->SleepForMicroseconds(delay_micros);
     }
     Status status = wrapped_->Run(run_options, inputs, output_tensor_names,
                                   target_node_names, outputs, run_metadata,
                                   thread_pool_options);
+    {
+      mutex_lock l(latest_batch_size_mu_);
+      --num_running_runs_;
+    }
     *(run_metadata->mutable_cost_graph()) = cost_graph_;
     return status;
   }
@@ -98,6 +122,34 @@ class BatchSizeCapturingSession : public ServingSession {
     return latest_batch_size_;
   }
 
+  int max_num_concurrent_runs() const
+      TF_LOCKS_EXCLUDED(latest_batch_size_mu_) {
+    mutex_lock l(latest_batch_size_mu_);
+    return max_num_concurrent_runs_;
+  }
+
+  // The sizes of the batches submitted to Run(), in order.
+  std::vector<int> batch_sizes() const
+      TF_LOCKS_EXCLUDED(latest_batch_size_mu_) {
+    mutex_lock l(latest_batch_size_mu_);
+    return batch_sizes_;
+  }
+
+  // The buffers of the first inputs of the batches submitted to Run(), in
+  // order.
+  std::vector<const char*> input_data() const
+      TF_LOCKS_EXCLUDED(latest_batch_size_mu_) {
+    mutex_lock l(latest_batch_size_mu_);
+    return input_data_;
+  }
+
+  // Makes Run() calls with a batch of 'batch_size' take 'delay_micros' longer.
+  void SetDelayMicros(int batch_size, int64 delay_micros)
+      TF_LOCKS_EXCLUDED(latest_batch_size_mu_) {
+    mutex_lock l(latest_batch_size_mu_);
+    delay_micros_[batch_size] = delay_micros;
+  }
+
   CostGraphDef* mutable_cost_graph() { return &cost_graph_; }
 
  private:
@@ -106,6 +158,15 @@ class BatchSizeCapturingSession : public ServingSession {
   mutable mutex latest_batch_size_mu_;
   // The size of the batch most recently submitted to Run().
   int latest_batch_size_ TF_GUARDED_BY(latest_batch_size_mu_) = -1;
+  // See batch_sizes().
+  std::vector<int> batch_sizes_ TF_GUARDED_BY(latest_batch_size_mu_);
+  // See input_data().
+  std::vector<const char*> input_data_ TF_GUARDED_BY(latest_batch_size_mu_);
+  // The number of Run() calls in progress, and its maximum so far.
+  int num_running_runs_ TF_GUARDED_BY(latest_batch_size_mu_) = 0;
+  int max_num_concurrent_runs_ TF_GUARDED_BY(latest_batch_size_mu_) = 0;
+  // See SetDelayMicros().
+  std::map<int, int64> delay_micros_ TF_GUARDED_BY(latest_batch_size_mu_);
 
   // Cost graph associated with the latest call to Run().
   CostGraphDef cost_graph_;
@@ -113,6 +174,113 @@ class BatchSizeCapturingSession : public ServingSession {
   TF_DISALLOW_COPY_AND_ASSIGN(BatchSizeCapturingSession);
 };
 
+// A wrapper around a BatchScheduler that notifies each scheduled task.
+class NotifyingBatchScheduler : public BatchScheduler<BatchingSessionTask> {
+ public:
+  NotifyingBatchScheduler(
+      std::unique_ptr<BatchScheduler<BatchingSessionTask>> wrapped,
+      std::function<void()> task_scheduled)
+      : wrapped_(std::move(wrapped)),
+        task_scheduled_(std::move(task_scheduled)) {}
+  ~NotifyingBatchScheduler() override = default;
+
+  Status Schedule(std::unique_ptr<BatchingSessionTask>* task) override {
+    TF_RETURN_IF_ERROR(wrapped_->Schedule(task));
+    task_scheduled_();
+    return Status::OK();
+  }
+
+  size_t NumEnqueuedTasks() const override {
+    return wrapped_->NumEnqueuedTasks();
+  }
+
+  size_t SchedulingCapacity() const override {
+    return wrapped_->SchedulingCapacity();
+  }
+
+  size_t max_task_size() const override { return wrapped_->max_task_size(); }
+
+ private:
+  std::unique_ptr<BatchScheduler<BatchingSessionTask>> wrapped_;
+  std::function<void()> task_scheduled_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(NotifyingBatchScheduler);
+};
+
+// A session that takes a ragged input, fed as "values" and "row_splits", and
+// outputs the sum of each of its rows as "sums".
+class RaggedRowSumSession : public ServingSession {
+ public:
+  RaggedRowSumSession() = default;
+  ~RaggedRowSumSession() override = default;
+
+  Status Run(const std::vector<std::pair<string, Tensor>>& inputs,
+             const std::vector<string>& output_tensor_names,
+             const std::vector<string>& target_node_names,
+             std::vector<Tensor>* outputs) override {
+    RunMetadata run_metadata;
+    return Run(RunOptions(), inputs, output_tensor_names, target_node_names,
+               outputs, &run_metadata);
+  }
+
+  Status Run(const RunOptions& run_options,
+             const std::vector<std::pair<string, Tensor>>& inputs,
+             const std::vector<string>& output_tensor_names,
+             const std::vector<string>& target_node_names,
+             std::vector<Tensor>* outputs, RunMetadata* run_metadata) override {
+    return Run(run_options, inputs, output_tensor_names, target_node_names,
+               outputs, run_metadata, thread::ThreadPoolOptions());
+  }
+
+  Status Run(const RunOptions& run_options,
+             const std::vector<std::pair<string, Tensor>>& inputs,
+             const std::vector<string>& output_tensor_names,
+             const std::vector<string>& target_node_names,
+             std::vector<Tensor>* outputs, RunMetadata* run_metadata,
+             const thread::ThreadPoolOptions& thread_pool_options) override {
+    Tensor values;
+    Tensor row_splits;
+    for (const auto& input : inputs) {
+      if (input.first == "values") {
+        values = input.second;
+      } else if (input.first == "row_splits") {
+        row_splits = input.second;
+      }
+    }
+    const auto splits = row_splits.flat<int64>();
+    Tensor sums(DT_FLOAT, TensorShape({splits.size() - 1}));
+    for (int row = 0; row + 1 < splits.size(); ++row) {
+      float sum = 0;
+      for (int64 i = splits(row); i < splits(row + 1); ++i) {
+        sum += values.flat<float>()(i);
+      }
+      sums.flat<float>()(row) = sum;
+    }
+    outputs->push_back(sums);
+    {
+      mutex_lock l(latest_batch_size_mu_);
+      latest_batch_size_ = sums.NumElements();
+    }
+    return Status::OK();
+  }
+
+  Status ListDevices(std::vector<DeviceAttributes>* response) override {
+    return errors::Unimplemented("ListDevices");
+  }
+
+  int latest_batch_size() const TF_LOCKS_EXCLUDED(latest_batch_size_mu_) {
+    mutex_lock l(latest_batch_size_mu_);
+    return latest_batch_size_;
+  }
+
+ private:
+  mutable mutex latest_batch_size_mu_;
+  // The number of rows most recently submitted to Run().
+  int latest_batch_size_ TF_GUARDED_BY(latest_batch_size_mu_) = -1;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(RaggedRowSumSession);
+};
+
 // Creates a (non-batching) session with the half-plus-two model loaded.
 std::unique_ptr<Session> CreateHalfPlusTwoSession() {
   tensorflow::SessionOptions session_options;
@@ -335,6 +503,98 @@ TEST_P(BatchingSessionTest, Basic) {
       }));
 }
 
+TEST_P(BatchingSessionTest, SplitOutputsShareTheBatchedBuffer) {
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 32;  // fits two 16-unit tasks
+  schedule_options.batch_timeout_micros = 1 * 1000 * 1000;  // won't trigger
+  schedule_options.num_batch_threads = 1;
+  schedule_options = annotate_options(schedule_options);
+
+  std::unique_ptr<Session> batching_session;
+  BatchingSessionOptions batching_session_options;
+  TF_ASSERT_OK(CreateBasicBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      CreateHalfPlusTwoSession(), &batching_session));
+
+  // Each task has 64 bytes of outputs, so its rows of the batched output are
+  // aligned and can be handed out as is.
+  std::vector<Tensor> outputs[2];
+  std::unique_ptr<Thread> request_threads[2];
+  for (int i = 0; i < 2; ++i) {
+    request_threads[i].reset(Env::Default()->StartThread(
+        ThreadOptions(),
+        i == 0 ? "first_request_thread" : "second_request_thread",
+        [&batching_session, &outputs, i] {
+          const Tensor input = test::AsTensor<float>(
+              std::vector<float>(16, 10.0f * (i + 1)), {16});
+          TF_ASSERT_OK(batching_session->Run({{"x", input}},
+                                             {"y"} /* outputs */,
+                                             {} /* target nodes */,
+                                             &outputs[i]));
+        }));
+  }
+  for (int i = 0; i < 2; ++i) {
+    request_threads[i].reset();
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_EQ(1, outputs[i].size());
+    test::ExpectTensorEqual<float>(
+        test::AsTensor<float>(std::vector<float>(16, 5.0f * (i + 1) + 2),
+                              {16}),
+        outputs[i][0]);
+  }
+  const char* const first_data = outputs[0][0].tensor_data().data();
+  const char* const second_data = outputs[1][0].tensor_data().data();
+  EXPECT_EQ(static_cast<ptrdiff_t>(16 * sizeof(float)),
+            std::max(first_data, second_data) -
+                std::min(first_data, second_data));
+}
+
+TEST_P(BatchingSessionTest, PooledInputBuffers) {
+  std::unique_ptr<BatchSizeCapturingSession> batch_size_capturing_session(
+      new BatchSizeCapturingSession(CreateHalfPlusTwoSession()));
+  auto batch_size_capturing_session_raw = batch_size_capturing_session.get();
+
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 4;  // fits two 2-unit tasks
+  schedule_options.batch_timeout_micros = 1 * 1000 * 1000;  // won't trigger
+  schedule_options.num_batch_threads = 1;
+  schedule_options = annotate_options(schedule_options);
+
+  std::unique_ptr<Session> batching_session;
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.num_pooled_input_buffers = 1;
+  TF_ASSERT_OK(CreateBasicBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      std::move(batch_size_capturing_session), &batching_session));
+
+  // The batches after the first one are merged in its recycled buffer. The
+  // tensors of the size of the merged input held meanwhile would likely take
+  // the memory of the buffer, were it freed.
+  std::vector<Tensor> held_tensors;
+  for (int i = 0; i < 3; ++i) {
+    std::unique_ptr<Thread> first_request_thread(Env::Default()->StartThread(
+        ThreadOptions(), "first_request_thread", [&batching_session, i] {
+          TestSingleRequest(100.0f + i, 42.0f, batching_session.get());
+        }));
+    std::unique_ptr<Thread> second_request_thread(Env::Default()->StartThread(
+        ThreadOptions(), "second_request_thread", [&batching_session, i] {
+          TestSingleRequest(71.5f, 18.3f + i, batching_session.get());
+        }));
+    first_request_thread.reset();
+    second_request_thread.reset();
+    held_tensors.emplace_back(DT_FLOAT, TensorShape({4}));
+  }
+  EXPECT_THAT(batch_size_capturing_session_raw->batch_sizes(),
+              ElementsAre(4, 4, 4));
+  const std::vector<const char*> input_data =
+      batch_size_capturing_session_raw->input_data();
+  ASSERT_EQ(3, input_data.size());
+  EXPECT_EQ(input_data[0], input_data[1]);
+  EXPECT_EQ(input_data[0], input_data[2]);
+}
+
 TEST_P(BatchingSessionTest, BatchingWithPadding) {
   BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
   schedule_options.max_batch_size = 2;
@@ -420,6 +680,68 @@ TEST_P(BatchingSessionTest, BatchingWithLargeBatch) {
   }
 }
 
+TEST_P(BatchingSessionTest, SplitLargeRequests) {
+  std::unique_ptr<BatchSizeCapturingSession> batch_size_capturing_session(
+      new BatchSizeCapturingSession(CreateHalfPlusTwoSession()));
+  auto batch_size_capturing_session_raw = batch_size_capturing_session.get();
+  // Slow enough for the two batch threads to overlap.
+  batch_size_capturing_session_raw->SetDelayMicros(2, 100 * 1000);
+
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 2;
+  schedule_options.batch_timeout_micros = 0;
+  schedule_options.num_batch_threads = 2;
+  schedule_options = annotate_options(schedule_options);
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.split_large_requests = true;
+  std::unique_ptr<Session> batching_session;
+  TF_ASSERT_OK(CreateBasicBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      std::move(batch_size_capturing_session), &batching_session));
+
+  // `max_batch_size` is 2, so the request is processed in batches of 2, 2
+  // and 1, in parallel.
+  TestRequest({1, 2, 3, 4, 5}, {5}, {2.5, 3, 3.5, 4, 4.5}, {5},
+              batching_session.get());
+  EXPECT_THAT(batch_size_capturing_session_raw->batch_sizes(),
+              UnorderedElementsAre(2, 2, 1));
+  EXPECT_EQ(2, batch_size_capturing_session_raw->max_num_concurrent_runs());
+}
+
+TEST_P(BatchingSessionTest, SplitOutputsOnRequestingThreads) {
+  std::unique_ptr<BatchSizeCapturingSession> batch_size_capturing_session(
+      new BatchSizeCapturingSession(CreateHalfPlusTwoSession()));
+  auto batch_size_capturing_session_raw = batch_size_capturing_session.get();
+
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 4;
+  schedule_options.batch_timeout_micros = 1 * 1000 * 1000;
+  schedule_options.num_batch_threads = 2;
+  schedule_options = annotate_options(schedule_options);
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.split_large_requests = true;
+  batching_session_options.split_outputs_on_requesting_threads = true;
+  std::unique_ptr<Session> batching_session;
+  TF_ASSERT_OK(CreateBasicBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      std::move(batch_size_capturing_session), &batching_session));
+
+  // Two requests of 2 rows each form a full batch, and each slices its own
+  // rows out of the outputs of the batch.
+  std::unique_ptr<Thread> first_request_thread(Env::Default()->StartThread(
+      ThreadOptions(), "first_request", [&batching_session] {
+        TestSingleRequest(100.0f, 52.0f, batching_session.get());
+      }));
+  TestSingleRequest(71.5f, 18.3f, batching_session.get());
+  first_request_thread.reset();
+  EXPECT_EQ(4, batch_size_capturing_session_raw->latest_batch_size());
+
+  // A request of 6 rows is split in tasks of 4 and 2 rows, whose outputs are
+  // merged back on the requesting thread.
+  TestRequest({1, 2, 3, 4, 5, 6}, {6}, {2.5, 3, 3.5, 4, 4.5, 5}, {6},
+              batching_session.get());
+}
+
 TEST(BatchingSessionTest, BatchingWithPaddingAndCost) {
   BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
   schedule_options.max_batch_size = 2;
@@ -606,6 +928,113 @@ TEST_P(BatchingSessionTest, UnequalTensorShapesWithPaddingTurnedOff) {
       }));
 }
 
+TEST_P(BatchingSessionTest, LengthBuckets) {
+  std::unique_ptr<BatchSizeCapturingSession> batch_size_capturing_session(
+      new BatchSizeCapturingSession(CreateMatrixHalfPlusTwoSession()));
+  auto batch_size_capturing_session_raw = batch_size_capturing_session.get();
+
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 2;
+  schedule_options.batch_timeout_micros = 100 * 1000;
+  schedule_options.num_batch_threads = 1;
+  schedule_options = annotate_options(schedule_options);
+  std::unique_ptr<Session> batching_session;
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.pad_variable_length_inputs = true;
+  batching_session_options.length_bucket_boundaries = {2};
+  TF_ASSERT_OK(CreateBasicBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      std::move(batch_size_capturing_session), &batching_session));
+  // The two requests go to different buckets, so the first input is not
+  // padded to the [1, 3, 3] shape accepted by the model (unlike in
+  // BatchingWithPadding).
+  std::unique_ptr<Thread> first_request_thread(Env::Default()->StartThread(
+      ThreadOptions(), "first_request", [&batching_session] {
+        std::vector<Tensor> outputs;
+        const Status status = batching_session->Run(
+            {{"x", test::AsTensor<float>({1, 2, 3, 4}, {1, 2, 2})}}, {"y"},
+            {} /* target nodes */, &outputs);
+        EXPECT_EQ(error::INVALID_ARGUMENT, status.code());
+      }));
+  std::unique_ptr<Thread> second_request_thread(Env::Default()->StartThread(
+      ThreadOptions(), "second_request", [&batching_session] {
+        TestRequest({5, 6, 7, 8, 9, 10, 11, 12, 13}, {1, 3, 3},
+                    {4.5, 5, 5.5, 6, 6.5, 7, 7.5, 8, 8.5}, {1, 3, 3},
+                    batching_session.get());
+      }));
+  first_request_thread.reset();
+  second_request_thread.reset();
+  EXPECT_EQ(1, batch_size_capturing_session_raw->latest_batch_size());
+}
+
+TEST_P(BatchingSessionTest, UnsortedLengthBucketBoundariesRejected) {
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 4;
+  schedule_options = annotate_options(schedule_options);
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.length_bucket_boundaries = {16, 8};
+  std::unique_ptr<Session> batching_session;
+  const Status status = CreateBasicBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      CreateHalfPlusTwoSession(), &batching_session);
+  EXPECT_EQ(error::INVALID_ARGUMENT, status.code());
+  EXPECT_EQ(
+      "length_bucket_boundaries entries must be monotonically increasing",
+      status.error_message());
+}
+
+TEST_P(BatchingSessionTest, LargeRequestLane) {
+  std::unique_ptr<BatchSizeCapturingSession> batch_size_capturing_session(
+      new BatchSizeCapturingSession(CreateHalfPlusTwoSession()));
+  auto batch_size_capturing_session_raw = batch_size_capturing_session.get();
+
+  auto create_scheduler =
+      [this](int64 batch_timeout_micros) -> BatchingSessionSchedulerCreator {
+    BasicBatchScheduler<BatchingSessionTask>::Options options;
+    options.max_batch_size = 4;
+    options.batch_timeout_micros = batch_timeout_micros;
+    options.num_batch_threads = 1;
+    options = annotate_options(options);
+    return [options](
+               std::function<void(std::unique_ptr<Batch<BatchingSessionTask>>)>
+                   process_batch_callback,
+               std::unique_ptr<BatchScheduler<BatchingSessionTask>>*
+                   scheduler) {
+      std::unique_ptr<BasicBatchScheduler<BatchingSessionTask>>
+          basic_scheduler;
+      TF_RETURN_IF_ERROR(BasicBatchScheduler<BatchingSessionTask>::Create(
+          options, process_batch_callback, &basic_scheduler));
+      *scheduler = std::move(basic_scheduler);
+      return Status::OK();
+    };
+  };
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.large_request_min_rows = 3;
+  std::unique_ptr<Session> batching_session;
+  TF_ASSERT_OK(CreateBatchingSession(
+      batching_session_options,
+      {{{{"x"}, {"y"}},
+        create_scheduler(10 * 1000 * 1000 /* won't trigger */),
+        create_scheduler(0)}},
+      std::move(batch_size_capturing_session), &batching_session));
+
+  // The large request is processed right away in the queue of the large
+  // requests, while the small one waits in the regular queue.
+  std::unique_ptr<Thread> small_request_thread(Env::Default()->StartThread(
+      ThreadOptions(), "small_request", [&batching_session] {
+        TestSingleRequest(100.0f, 42.0f, batching_session.get());
+      }));
+  const uint64 start_micros = Env::Default()->NowMicros();
+  TestRequest({1, 2, 3}, {3}, {2.5, 3, 3.5}, {3}, batching_session.get());
+  EXPECT_LT(Env::Default()->NowMicros() - start_micros, 5 * 1000 * 1000);
+  EXPECT_EQ(3, batch_size_capturing_session_raw->latest_batch_size());
+
+  // A second small request fills the batch of the first one.
+  TestSingleRequest(71.5f, 18.3f, batching_session.get());
+  small_request_thread.reset();
+  EXPECT_EQ(4, batch_size_capturing_session_raw->latest_batch_size());
+}
+
 TEST_P(BatchingSessionTest, SingletonBatch) {
   BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
   schedule_options.max_batch_size = 4;  // fits two 2-unit tasks
@@ -761,43 +1190,432 @@ TEST_P(BatchingSessionTest, AllowedBatchSizesRequirePadding) {
       "Tracks the batch size distribution on processing.", {}));
 }
 
-TEST_P(BatchingSessionTest, UnsortedAllowedBatchSizesRejected) {
-  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
-  schedule_options.max_batch_size = 4;
-  schedule_options = annotate_options(schedule_options);
-  BatchingSessionOptions batching_session_options;
-  batching_session_options.allowed_batch_sizes = {4, 2};  // Not sorted.
-  std::unique_ptr<Session> batching_session;
-  EXPECT_FALSE(CreateBasicBatchingSession(
-                   schedule_options, batching_session_options, {{"x"}, {"y"}},
-                   CreateHalfPlusTwoSession(), &batching_session)
-                   .ok());
-}
+TEST_P(BatchingSessionTest, SplitInsteadOfPadding) {
+  // Batches of 4 are much slower than batches of 2.
+  std::unique_ptr<BatchSizeCapturingSession> batch_size_capturing_session(
+      new BatchSizeCapturingSession(CreateHalfPlusTwoSession()));
+  auto batch_size_capturing_session_raw = batch_size_capturing_session.get();
+  batch_size_capturing_session_raw->SetDelayMicros(4, 50 * 1000);
 
-TEST_P(BatchingSessionTest,
-       FinalAllowedBatchSizeLargerThanMaxBatchSizeRejected) {
   BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
   schedule_options.max_batch_size = 4;
+  schedule_options.batch_timeout_micros = 100 * 1000;
+  schedule_options.num_batch_threads = 1;
   schedule_options = annotate_options(schedule_options);
   BatchingSessionOptions batching_session_options;
-  batching_session_options.allowed_batch_sizes = {2, 8};  // Final entry != 4.
+  batching_session_options.allowed_batch_sizes = {2, 4};
+  batching_session_options.split_instead_of_padding = true;
   std::unique_ptr<Session> batching_session;
-  EXPECT_FALSE(CreateBasicBatchingSession(
-                   schedule_options, batching_session_options, {{"x"}, {"y"}},
-                   CreateHalfPlusTwoSession(), &batching_session)
-                   .ok());
+  TF_ASSERT_OK(CreateBasicBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      std::move(batch_size_capturing_session), &batching_session));
+
+  // Measure both allowed batch sizes.
+  TestSingleRequest(100.0f, 42.0f, batching_session.get());
+  EXPECT_EQ(2, batch_size_capturing_session_raw->latest_batch_size());
+  TestRequest({1, 2, 3, 4}, {4}, {2.5, 3, 3.5, 4}, {4}, batching_session.get());
+  EXPECT_EQ(4, batch_size_capturing_session_raw->latest_batch_size());
+
+  // A batch of 3 is processed as two batches padded to 2, not one padded to 4.
+  {
+    std::unique_ptr<Thread> first_request_thread(Env::Default()->StartThread(
+        ThreadOptions(), "first_request_thread", [&batching_session] {
+          TestSingleRequest(71.5f, 18.3f, batching_session.get());
+        }));
+    std::unique_ptr<Thread> second_request_thread(Env::Default()->StartThread(
+        ThreadOptions(), "second_request_thread", [&batching_session] {
+          TestRequest({5}, {1}, {4.5}, {1}, batching_session.get());
+        }));
+  }
+  EXPECT_EQ(2, batch_size_capturing_session_raw->latest_batch_size());
 }
 
-TEST_P(BatchingSessionTest, DifferentOrderForInputAndOutputTensors) {
+TEST_P(BatchingSessionTest, SplitIncrementallyMergedInputs) {
+  // Batches of 4 are much slower than batches of 2.
+  std::unique_ptr<BatchSizeCapturingSession> batch_size_capturing_session(
+      new BatchSizeCapturingSession(CreateHalfPlusTwoSession()));
+  auto batch_size_capturing_session_raw = batch_size_capturing_session.get();
+  batch_size_capturing_session_raw->SetDelayMicros(4, 50 * 1000);
+
   BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
-  schedule_options.max_batch_size = 6;  // fits three 2-unit tasks
-  schedule_options.batch_timeout_micros = 1 * 1000 * 1000;  // won't trigger
+  schedule_options.max_batch_size = 4;
+  schedule_options.batch_timeout_micros = 100 * 1000;
   schedule_options.num_batch_threads = 1;
   schedule_options = annotate_options(schedule_options);
   BatchingSessionOptions batching_session_options;
+  batching_session_options.allowed_batch_sizes = {2, 4};
+  batching_session_options.split_instead_of_padding = true;
+  batching_session_options.incremental_input_merge = true;
   std::unique_ptr<Session> batching_session;
   TF_ASSERT_OK(CreateBasicBatchingSession(
-      schedule_options, batching_session_options, {{"x", "x2"}, {"y", "y3"}},
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      std::move(batch_size_capturing_session), &batching_session));
+
+  // Measure both allowed batch sizes.
+  TestSingleRequest(100.0f, 42.0f, batching_session.get());
+  TestRequest({1, 2, 3, 4}, {4}, {2.5, 3, 3.5, 4}, {4}, batching_session.get());
+
+  // The two batches of 2 the batch of 3 is split into take their rows from
+  // its merged inputs, and still get the outputs of their own tasks.
+  {
+    std::unique_ptr<Thread> first_request_thread(Env::Default()->StartThread(
+        ThreadOptions(), "first_request_thread", [&batching_session] {
+          TestSingleRequest(71.5f, 18.3f, batching_session.get());
+        }));
+    std::unique_ptr<Thread> second_request_thread(Env::Default()->StartThread(
+        ThreadOptions(), "second_request_thread", [&batching_session] {
+          TestRequest({5}, {1}, {4.5}, {1}, batching_session.get());
+        }));
+  }
+  EXPECT_THAT(batch_size_capturing_session_raw->batch_sizes(),
+              ElementsAre(2, 4, 2, 2));
+}
+
+TEST_P(BatchingSessionTest, IncrementalInputMerge) {
+  std::unique_ptr<BatchSizeCapturingSession> batch_size_capturing_session(
+      new BatchSizeCapturingSession(CreateHalfPlusTwoSession()));
+  auto batch_size_capturing_session_raw = batch_size_capturing_session.get();
+
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 4;  // fits two 2-unit tasks
+  schedule_options.batch_timeout_micros = 1 * 1000 * 1000;  // won't trigger
+  schedule_options.num_batch_threads = 1;
+  schedule_options = annotate_options(schedule_options);
+
+  std::unique_ptr<Session> batching_session;
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.incremental_input_merge = true;
+  TF_ASSERT_OK(CreateBasicBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      std::move(batch_size_capturing_session), &batching_session));
+
+  // BasicBatchScheduler only hands out closed batches, so the two requests
+  // are merged at once, into a single batch (see
+  // IncrementalInputMergeOfOpenBatches for batches merged while open).
+  {
+    std::unique_ptr<Thread> first_request_thread(Env::Default()->StartThread(
+        ThreadOptions(), "first_request_thread", [&batching_session] {
+          TestSingleRequest(100.0f, 42.0f, batching_session.get());
+        }));
+    std::unique_ptr<Thread> second_request_thread(Env::Default()->StartThread(
+        ThreadOptions(), "second_request_thread", [&batching_session] {
+          TestSingleRequest(71.5f, 18.3f, batching_session.get());
+        }));
+  }
+  EXPECT_THAT(batch_size_capturing_session_raw->batch_sizes(),
+              ElementsAre(4));
+}
+
+TEST_P(BatchingSessionTest, IncrementalInputMergeWithAllowedBatchSizes) {
+  // Arrange to capture the batch size.
+  std::unique_ptr<BatchSizeCapturingSession> batch_size_capturing_session(
+      new BatchSizeCapturingSession(CreateHalfPlusTwoSession()));
+  auto batch_size_capturing_session_raw = batch_size_capturing_session.get();
+
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 4;
+  schedule_options.batch_timeout_micros = 0;
+  schedule_options.num_batch_threads = 1;
+  schedule_options = annotate_options(schedule_options);
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.allowed_batch_sizes = {1, 3, 4};
+  batching_session_options.incremental_input_merge = true;
+  std::unique_ptr<Session> batching_session;
+  TF_ASSERT_OK(CreateBasicBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      std::move(batch_size_capturing_session), &batching_session));
+  TestSingleRequest(100.0f, 42.0f, batching_session.get());
+
+  // It should pad the batch size from 2 to 3.
+  EXPECT_EQ(3, batch_size_capturing_session_raw->latest_batch_size());
+}
+
+TEST_P(BatchingSessionTest, BulkLane) {
+  std::unique_ptr<BatchSizeCapturingSession> batch_size_capturing_session(
+      new BatchSizeCapturingSession(CreateHalfPlusTwoSession()));
+  auto batch_size_capturing_session_raw = batch_size_capturing_session.get();
+
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 4;
+  schedule_options.batch_timeout_micros = 0;
+  schedule_options.num_batch_threads = 1;
+  schedule_options = annotate_options(schedule_options);
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.allowed_batch_sizes = {1, 3, 4};
+  batching_session_options.enable_bulk_lane = true;
+  std::unique_ptr<Session> batching_session;
+  TF_ASSERT_OK(CreateBasicBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      std::move(batch_size_capturing_session), &batching_session));
+
+  // A bulk request is processed in a batch of its own.
+  RunOptions bulk_run_options;
+  bulk_run_options.mutable_experimental()
+      ->mutable_run_handler_pool_options()
+      ->set_priority(-1);
+  TestSingleRequest(bulk_run_options, 100.0f, 42.0f, batching_session.get(),
+                    /*inter_op_threadpool=*/nullptr,
+                    /*intra_op_threadpool=*/nullptr);
+  EXPECT_EQ(3, batch_size_capturing_session_raw->latest_batch_size());
+
+  // So is a regular one.
+  TestSingleRequest(71.5f, 18.3f, batching_session.get());
+  EXPECT_EQ(3, batch_size_capturing_session_raw->latest_batch_size());
+}
+
+TEST_P(BatchingSessionTest, BulkLaneWaitsForRegularBatches) {
+  std::unique_ptr<BatchSizeCapturingSession> batch_size_capturing_session(
+      new BatchSizeCapturingSession(CreateHalfPlusTwoSession()));
+  auto batch_size_capturing_session_raw = batch_size_capturing_session.get();
+  batch_size_capturing_session->SetDelayMicros(2, 50 * 1000);
+
+  // The regular lane is created first, then the ticket queue of the bulk lane.
+  BatchScheduler<BatchingSessionTask>* regular_scheduler = nullptr;
+  auto create_scheduler =
+      [&regular_scheduler, this](
+          std::function<void(std::unique_ptr<Batch<BatchingSessionTask>>)>
+              process_batch_callback,
+          std::unique_ptr<BatchScheduler<BatchingSessionTask>>* new_scheduler) {
+        BasicBatchScheduler<BatchingSessionTask>::Options options;
+        options.max_batch_size = 2;  // fits one request
+        options.batch_timeout_micros = 0;
+        options.num_batch_threads = 1;
+        options = annotate_options(options);
+        std::unique_ptr<BasicBatchScheduler<BatchingSessionTask>>
+            basic_scheduler;
+        TF_RETURN_IF_ERROR(BasicBatchScheduler<BatchingSessionTask>::Create(
+            options, process_batch_callback, &basic_scheduler));
+        if (regular_scheduler == nullptr) {
+          regular_scheduler = basic_scheduler.get();
+        }
+        *new_scheduler = std::move(basic_scheduler);
+        return Status::OK();
+      };
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.enable_bulk_lane = true;
+  batching_session_options.regular_batches_per_bulk_batch = 3;
+  std::unique_ptr<Session> batching_session;
+  TF_ASSERT_OK(CreateBatchingSession(
+      batching_session_options, {{{{"x"}, {"y"}}, create_scheduler}},
+      std::move(batch_size_capturing_session), &batching_session));
+
+  // One regular request is processed while three more wait.
+  mutex mu;
+  int num_regular_requests_done = 0;
+  std::vector<std::unique_ptr<Thread>> request_threads;
+  auto start_regular_request = [&] {
+    request_threads.push_back(
+        std::unique_ptr<Thread>(Env::Default()->StartThread(
+            ThreadOptions(), "regular_request_thread", [&] {
+              TestSingleRequest(100.0f, 42.0f, batching_session.get());
+              mutex_lock l(mu);
+              ++num_regular_requests_done;
+            })));
+  };
+  start_regular_request();
+  while (batch_size_capturing_session_raw->latest_batch_size() != 2) {
+    Env::Default()->SleepForMicroseconds(100);
+  }
+  for (int i = 0; i < 3; ++i) {
+    start_regular_request();
+  }
+  while (regular_scheduler->NumEnqueuedTasks() != 3) {
+    Env::Default()->SleepForMicroseconds(100);
+  }
+
+  // The bulk request is processed after the first three regular requests.
+  RunOptions bulk_run_options;
+  bulk_run_options.mutable_experimental()
+      ->mutable_run_handler_pool_options()
+      ->set_priority(-1);
+  TestSingleRequest(bulk_run_options, 71.5f, 18.3f, batching_session.get(),
+                    /*inter_op_threadpool=*/nullptr,
+                    /*intra_op_threadpool=*/nullptr);
+  {
+    mutex_lock l(mu);
+    EXPECT_EQ(3, num_regular_requests_done);
+  }
+  request_threads.clear();
+}
+
+TEST_P(BatchingSessionTest, NonPositiveRegularBatchesPerBulkBatchRejected) {
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options = annotate_options(schedule_options);
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.enable_bulk_lane = true;
+  batching_session_options.regular_batches_per_bulk_batch = 0;
+  std::unique_ptr<Session> batching_session;
+  EXPECT_FALSE(CreateBasicBatchingSession(schedule_options,
+                                          batching_session_options,
+                                          {{"x"}, {"y"}},
+                                          CreateHalfPlusTwoSession(),
+                                          &batching_session)
+                   .ok());
+}
+
+// Large batch splitting does not support ragged inputs, hence TEST.
+TEST(BatchingSessionTest, RaggedInputs) {
+  std::unique_ptr<RaggedRowSumSession> ragged_row_sum_session(
+      new RaggedRowSumSession());
+  auto ragged_row_sum_session_raw = ragged_row_sum_session.get();
+
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 4;
+  schedule_options.batch_timeout_micros = 1 * 1000 * 1000;
+  schedule_options.num_batch_threads = 1;
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.allowed_batch_sizes = {2, 4};
+  batching_session_options.ragged_inputs = {{"values", {"row_splits"}}};
+  std::unique_ptr<Session> batching_session;
+  TF_ASSERT_OK(CreateBasicBatchingSession(
+      schedule_options, batching_session_options,
+      {{"values", "row_splits"}, {"sums"}}, std::move(ragged_row_sum_session),
+      &batching_session));
+
+  // Two requests with rows of different lengths, batched together (3 rows)
+  // and padded with an empty row.
+  auto run_request = [&batching_session](const std::vector<float>& values,
+                                         const std::vector<int64>& row_splits,
+                                         const std::vector<float>& sums) {
+    std::vector<Tensor> outputs;
+    TF_ASSERT_OK(batching_session->Run(
+        {{"values", test::AsTensor<float>(values)},
+         {"row_splits", test::AsTensor<int64>(row_splits)}},
+        {"sums"}, {} /* target nodes */, &outputs));
+    ASSERT_EQ(1, outputs.size());
+    test::ExpectTensorEqual<float>(test::AsTensor<float>(sums), outputs[0]);
+  };
+  std::unique_ptr<Thread> first_request_thread(
+      Env::Default()->StartThread(ThreadOptions(), "first_request_thread",
+                                  [&run_request] {
+                                    run_request({1, 2, 3}, {0, 2, 3}, {3, 3});
+                                  }));
+  std::unique_ptr<Thread> second_request_thread(Env::Default()->StartThread(
+      ThreadOptions(), "second_request_thread",
+      [&run_request] { run_request({4, 5}, {0, 2}, {9}); }));
+  first_request_thread.reset();
+  second_request_thread.reset();
+  EXPECT_EQ(4, ragged_row_sum_session_raw->latest_batch_size());
+}
+
+TEST_P(BatchingSessionTest, MaxConcurrentBatches) {
+  std::unique_ptr<BatchSizeCapturingSession> batch_size_capturing_session(
+      new BatchSizeCapturingSession(CreateHalfPlusTwoSession()));
+  auto batch_size_capturing_session_raw = batch_size_capturing_session.get();
+
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 2;  // fits one request
+  schedule_options.batch_timeout_micros = 0;
+  schedule_options.num_batch_threads = 4;
+  schedule_options = annotate_options(schedule_options);
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.max_concurrent_batches = 1;
+  std::unique_ptr<Session> batching_session;
+  TF_ASSERT_OK(CreateBasicBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      std::move(batch_size_capturing_session), &batching_session));
+
+  {
+    std::vector<std::unique_ptr<Thread>> request_threads;
+    for (int i = 0; i < 8; ++i) {
+      request_threads.push_back(
+          std::unique_ptr<Thread>(Env::Default()->StartThread(
+              ThreadOptions(), "request_thread", [&batching_session, i] {
+                TestSingleRequest(i, 2 * i, batching_session.get());
+              })));
+    }
+  }
+  EXPECT_EQ(1, batch_size_capturing_session_raw->max_num_concurrent_runs());
+}
+
+TEST_P(BatchingSessionTest, IncrementalInputMergeOfOpenBatches) {
+  std::unique_ptr<BatchSizeCapturingSession> batch_size_capturing_session(
+      new BatchSizeCapturingSession(CreateHalfPlusTwoSession()));
+  auto batch_size_capturing_session_raw = batch_size_capturing_session.get();
+
+  // StreamingBatchScheduler hands the batches to the batch thread while they
+  // are open, so the requests below join the batch while it is being merged.
+  // Each batch closes when full, or on timeout.
+  auto create_scheduler =
+      [](std::function<void(std::unique_ptr<Batch<BatchingSessionTask>>)>
+             process_batch_callback,
+         std::unique_ptr<BatchScheduler<BatchingSessionTask>>* scheduler) {
+        StreamingBatchScheduler<BatchingSessionTask>::Options options;
+        options.max_batch_size = 8;  // fits four requests
+        options.batch_timeout_micros = 10 * 1000;
+        options.num_batch_threads = 8;
+        std::unique_ptr<StreamingBatchScheduler<BatchingSessionTask>>
+            streaming_scheduler;
+        TF_RETURN_IF_ERROR(StreamingBatchScheduler<BatchingSessionTask>::Create(
+            options, process_batch_callback, &streaming_scheduler));
+        *scheduler = std::move(streaming_scheduler);
+        return Status::OK();
+      };
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.incremental_input_merge = true;
+  std::unique_ptr<Session> batching_session;
+  TF_ASSERT_OK(CreateBatchingSession(
+      batching_session_options, {{{{"x"}, {"y"}}, create_scheduler}},
+      std::move(batch_size_capturing_session), &batching_session));
+
+  // A lone request is processed once its batch times out.
+  TestSingleRequest(100.0f, 42.0f, batching_session.get());
+  EXPECT_EQ(2, batch_size_capturing_session_raw->latest_batch_size());
+
+  // Each request gets its own outputs back, however the requests are split
+  // into batches. There are fewer request threads than batch threads, so that
+  // the scheduler never runs out of batch threads.
+  {
+    std::vector<std::unique_ptr<Thread>> request_threads;
+    for (int i = 0; i < 7; ++i) {
+      request_threads.push_back(
+          std::unique_ptr<Thread>(Env::Default()->StartThread(
+              ThreadOptions(), "request_thread", [i, &batching_session] {
+                for (int j = 0; j < 20; ++j) {
+                  TestSingleRequest(i, j, batching_session.get());
+                }
+              })));
+    }
+  }
+}
+
+TEST_P(BatchingSessionTest, UnsortedAllowedBatchSizesRejected) {
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 4;
+  schedule_options = annotate_options(schedule_options);
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.allowed_batch_sizes = {4, 2};  // Not sorted.
+  std::unique_ptr<Session> batching_session;
+  EXPECT_FALSE(CreateBasicBatchingSession(
+                   schedule_options, batching_session_options, {{"x"}, {"y"}},
+                   CreateHalfPlusTwoSession(), &batching_session)
+                   .ok());
+}
+
+TEST_P(BatchingSessionTest,
+       FinalAllowedBatchSizeLargerThanMaxBatchSizeRejected) {
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 4;
+  schedule_options = annotate_options(schedule_options);
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.allowed_batch_sizes = {2, 8};  // Final entry != 4.
+  std::unique_ptr<Session> batching_session;
+  EXPECT_FALSE(CreateBasicBatchingSession(
+                   schedule_options, batching_session_options, {{"x"}, {"y"}},
+                   CreateHalfPlusTwoSession(), &batching_session)
+                   .ok());
+}
+
+TEST_P(BatchingSessionTest, DifferentOrderForInputAndOutputTensors) {
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 6;  // fits three 2-unit tasks
+  schedule_options.batch_timeout_micros = 1 * 1000 * 1000;  // won't trigger
+  schedule_options.num_batch_threads = 1;
+  schedule_options = annotate_options(schedule_options);
+  BatchingSessionOptions batching_session_options;
+  std::unique_ptr<Session> batching_session;
+  TF_ASSERT_OK(CreateBasicBatchingSession(
+      schedule_options, batching_session_options, {{"x", "x2"}, {"y", "y3"}},
       CreateHalfPlusTwoSession(), &batching_session));
 
   const Tensor input0 = test::AsTensor<float>({8.0f, 6.0f}, {2});
@@ -963,6 +1781,242 @@ TEST_P(BatchingSessionTest, EnqueuedLongerThanTimeout) {
   request_returned.WaitForNotification();
 }
 
+TEST_P(BatchingSessionTest, EarliestDeadlineFirstDropsExpiredTasks) {
+  BatchScheduler<BatchingSessionTask>* scheduler = nullptr;
+  auto create_scheduler =
+      [&scheduler, this](
+          std::function<void(std::unique_ptr<Batch<BatchingSessionTask>>)>
+              process_batch_callback,
+          std::unique_ptr<BatchScheduler<BatchingSessionTask>>* new_scheduler) {
+        BasicBatchScheduler<BatchingSessionTask>::Options options;
+        options.max_batch_size = 4;  // fits two 2-unit tasks
+        options.batch_timeout_micros = 1 * 1000 * 1000;  // won't trigger
+        options.num_batch_threads = 1;
+        options = annotate_options(options);
+        std::unique_ptr<BasicBatchScheduler<BatchingSessionTask>>
+            basic_scheduler;
+        TF_RETURN_IF_ERROR(BasicBatchScheduler<BatchingSessionTask>::Create(
+            options, process_batch_callback, &basic_scheduler));
+        scheduler = basic_scheduler.get();
+        *new_scheduler = std::move(basic_scheduler);
+        return Status::OK();
+      };
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.earliest_deadline_first = true;
+  std::unique_ptr<Session> batching_session;
+  TF_CHECK_OK(CreateBatchingSession(
+      batching_session_options, {{{{"x"}, {"y"}}, create_scheduler}},
+      CreateHalfPlusTwoSession(), &batching_session));
+  ASSERT_FALSE(scheduler == nullptr);
+
+  // A request that times out in the queue, batched with one that does not.
+  Notification expired_request_returned;
+  std::unique_ptr<Thread> expired_request_thread(Env::Default()->StartThread(
+      ThreadOptions(), "expired_request_thread", [&] {
+        Tensor input = test::AsTensor<float>({100.0f, 42.0f}, {2});
+        RunOptions run_options;
+        run_options.set_timeout_in_ms(1);
+        std::vector<Tensor> outputs;
+        RunMetadata run_metadata;
+        const Status status = batching_session->Run(
+            run_options, {{"x", input}}, {"y"} /* outputs */,
+            {} /* target nodes */, &outputs, &run_metadata);
+        EXPECT_EQ(error::RESOURCE_EXHAUSTED, status.code());
+        expired_request_returned.Notify();
+      }));
+  while (scheduler->NumEnqueuedTasks() != 1) {
+    Env::Default()->SleepForMicroseconds(100);
+  }
+  Env::Default()->SleepForMicroseconds(10 * 1000);
+  std::unique_ptr<Thread> live_request_thread(Env::Default()->StartThread(
+      ThreadOptions(), "live_request_thread",
+      [&] { TestSingleRequest(100.0f, 42.0f, batching_session.get()); }));
+  // The expired request is dropped from the batch, which still runs.
+  expired_request_returned.WaitForNotification();
+  live_request_thread.reset();
+}
+
+// Runs a request of 'size' zeros with 'timeout_in_ms' and 'priority' on
+// 'session', which runs HalfPlusTwo.
+void TestZerosRequest(int size, int64 timeout_in_ms, int64 priority,
+                      Session* session) {
+  RunOptions run_options;
+  run_options.set_timeout_in_ms(timeout_in_ms);
+  run_options.mutable_experimental()
+      ->mutable_run_handler_pool_options()
+      ->set_priority(priority);
+  Tensor input(DT_FLOAT, TensorShape({size}));
+  input.flat<float>().setZero();
+  std::vector<Tensor> outputs;
+  RunMetadata run_metadata;
+  TF_ASSERT_OK(session->Run(run_options, {{"x", input}}, {"y"},
+                            {} /* target nodes */, &outputs, &run_metadata));
+  ASSERT_EQ(1, outputs.size());
+  Tensor expected_output(DT_FLOAT, TensorShape({size}));
+  expected_output.flat<float>().setConstant(2.0f);
+  test::ExpectTensorEqual<float>(expected_output, outputs[0]);
+}
+
+TEST_P(BatchingSessionTest, EarliestDeadlineFirstDeferredBatches) {
+  std::unique_ptr<BatchSizeCapturingSession> batch_size_capturing_session(
+      new BatchSizeCapturingSession(CreateHalfPlusTwoSession()));
+  auto batch_size_capturing_session_raw = batch_size_capturing_session.get();
+  batch_size_capturing_session->SetDelayMicros(1, 200 * 1000);
+
+  BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
+  schedule_options.max_batch_size = 3;
+  schedule_options.batch_timeout_micros = 0;
+  schedule_options.num_batch_threads = 4;
+  schedule_options = annotate_options(schedule_options);
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.max_concurrent_batches = 1;
+  batching_session_options.earliest_deadline_first = true;
+  std::unique_ptr<Session> batching_session;
+  TF_ASSERT_OK(CreateBasicBatchingSession(
+      schedule_options, batching_session_options, {{"x"}, {"y"}},
+      std::move(batch_size_capturing_session), &batching_session));
+
+  // While the batch of size 1 runs, the batches of size 2 and 3 are deferred.
+  // The latter has the earlier deadline, and runs first.
+  std::vector<std::unique_ptr<Thread>> request_threads;
+  auto start_request = [&](int size, int64 timeout_in_ms) {
+    request_threads.push_back(
+        std::unique_ptr<Thread>(Env::Default()->StartThread(
+            ThreadOptions(), "request_thread", [&, size, timeout_in_ms] {
+              TestZerosRequest(size, timeout_in_ms, /*priority=*/0,
+                               batching_session.get());
+            })));
+  };
+  start_request(1, /*timeout_in_ms=*/0);
+  while (batch_size_capturing_session_raw->latest_batch_size() != 1) {
+    Env::Default()->SleepForMicroseconds(100);
+  }
+  // The two requests do not fit in one batch.
+  start_request(2, /*timeout_in_ms=*/60 * 1000);
+  start_request(3, /*timeout_in_ms=*/30 * 1000);
+  request_threads.clear();
+  EXPECT_THAT(batch_size_capturing_session_raw->batch_sizes(),
+              ElementsAre(1, 3, 2));
+}
+
+TEST_P(BatchingSessionTest, EarliestDeadlineFirstBulkLane) {
+  std::unique_ptr<BatchSizeCapturingSession> batch_size_capturing_session(
+      new BatchSizeCapturingSession(CreateHalfPlusTwoSession()));
+  auto batch_size_capturing_session_raw = batch_size_capturing_session.get();
+  batch_size_capturing_session->SetDelayMicros(1, 200 * 1000);
+
+  // The regular lane is created first, then the ticket queue of the bulk lane.
+  std::vector<BatchScheduler<BatchingSessionTask>*> schedulers;
+  auto create_scheduler =
+      [&schedulers, this](
+          std::function<void(std::unique_ptr<Batch<BatchingSessionTask>>)>
+              process_batch_callback,
+          std::unique_ptr<BatchScheduler<BatchingSessionTask>>* new_scheduler) {
+        BasicBatchScheduler<BatchingSessionTask>::Options options;
+        options.max_batch_size = 3;  // fits one request
+        options.batch_timeout_micros = 0;
+        options.num_batch_threads = 1;
+        options = annotate_options(options);
+        std::unique_ptr<BasicBatchScheduler<BatchingSessionTask>>
+            basic_scheduler;
+        TF_RETURN_IF_ERROR(BasicBatchScheduler<BatchingSessionTask>::Create(
+            options, process_batch_callback, &basic_scheduler));
+        schedulers.push_back(basic_scheduler.get());
+        *new_scheduler = std::move(basic_scheduler);
+        return Status::OK();
+      };
+  BatchingSessionOptions batching_session_options;
+  batching_session_options.enable_bulk_lane = true;
+  batching_session_options.earliest_deadline_first = true;
+  std::unique_ptr<Session> batching_session;
+  TF_ASSERT_OK(CreateBatchingSession(
+      batching_session_options, {{{{"x"}, {"y"}}, create_scheduler}},
+      std::move(batch_size_capturing_session), &batching_session));
+  ASSERT_EQ(2, schedulers.size());
+  BatchScheduler<BatchingSessionTask>* ticket_scheduler = schedulers[1];
+
+  // While the bulk batch of size 1 runs, the bulk requests of size 2 and 3
+  // wait. The latter has the earlier deadline, and is taken first.
+  std::vector<std::unique_ptr<Thread>> request_threads;
+  auto start_bulk_request = [&](int size, int64 timeout_in_ms) {
+    request_threads.push_back(
+        std::unique_ptr<Thread>(Env::Default()->StartThread(
+            ThreadOptions(), "bulk_request_thread", [&, size, timeout_in_ms] {
+              TestZerosRequest(size, timeout_in_ms, /*priority=*/-1,
+                               batching_session.get());
+            })));
+  };
+  start_bulk_request(1, /*timeout_in_ms=*/0);
+  while (batch_size_capturing_session_raw->latest_batch_size() != 1) {
+    Env::Default()->SleepForMicroseconds(100);
+  }
+  start_bulk_request(2, /*timeout_in_ms=*/60 * 1000);
+  start_bulk_request(3, /*timeout_in_ms=*/30 * 1000);
+  while (ticket_scheduler->NumEnqueuedTasks() != 2) {
+    Env::Default()->SleepForMicroseconds(100);
+  }
+  request_threads.clear();
+  EXPECT_THAT(batch_size_capturing_session_raw->batch_sizes(),
+              ElementsAre(1, 3, 2));
+}
+
+TEST_P(BatchingSessionTest, DropsCancelledTasks) {
+  Notification cancelled_request_scheduled;
+  auto create_scheduler =
+      [&cancelled_request_scheduled, this](
+          std::function<void(std::unique_ptr<Batch<BatchingSessionTask>>)>
+              process_batch_callback,
+          std::unique_ptr<BatchScheduler<BatchingSessionTask>>* new_scheduler) {
+        BasicBatchScheduler<BatchingSessionTask>::Options options;
+        options.max_batch_size = 4;  // fits two 2-unit tasks
+        options.batch_timeout_micros = 1 * 1000 * 1000;  // won't trigger
+        options.num_batch_threads = 1;
+        options = annotate_options(options);
+        std::unique_ptr<BasicBatchScheduler<BatchingSessionTask>>
+            basic_scheduler;
+        TF_RETURN_IF_ERROR(BasicBatchScheduler<BatchingSessionTask>::Create(
+            options, process_batch_callback, &basic_scheduler));
+        new_scheduler->reset(new NotifyingBatchScheduler(
+            std::move(basic_scheduler), [&cancelled_request_scheduled] {
+              if (!cancelled_request_scheduled.HasBeenNotified()) {
+                cancelled_request_scheduled.Notify();
+              }
+            }));
+        return Status::OK();
+      };
+  std::unique_ptr<Session> batching_session;
+  TF_CHECK_OK(CreateBatchingSession(
+      BatchingSessionOptions(), {{{{"x"}, {"y"}}, create_scheduler}},
+      CreateHalfPlusTwoSession(), &batching_session));
+
+  // A request cancelled by its client in the queue, batched with one that is
+  // not.
+  std::atomic<bool> client_cancelled(false);
+  Notification cancelled_request_returned;
+  std::unique_ptr<Thread> cancelled_request_thread(Env::Default()->StartThread(
+      ThreadOptions(), "cancelled_request_thread", [&] {
+        RequestCancellation cancellation(
+            [&client_cancelled]() { return client_cancelled.load(); });
+        ScopedRequestCancellation scoped_cancellation(&cancellation);
+        Tensor input = test::AsTensor<float>({100.0f, 42.0f}, {2});
+        std::vector<Tensor> outputs;
+        const Status status = batching_session->Run(
+            {{"x", input}}, {"y"} /* outputs */, {} /* target nodes */,
+            &outputs);
+        EXPECT_EQ(error::CANCELLED, status.code());
+        EXPECT_TRUE(outputs.empty());
+        cancelled_request_returned.Notify();
+      }));
+  cancelled_request_scheduled.WaitForNotification();
+  client_cancelled = true;
+  std::unique_ptr<Thread> live_request_thread(Env::Default()->StartThread(
+      ThreadOptions(), "live_request_thread",
+      [&] { TestSingleRequest(100.0f, 42.0f, batching_session.get()); }));
+  // The cancelled request is dropped from the batch, which still runs.
+  cancelled_request_returned.WaitForNotification();
+  live_request_thread.reset();
+}
+
 TEST_P(BatchingSessionTest, ThreadPoolOptions) {
   BasicBatchScheduler<BatchingSessionTask>::Options schedule_options;
   schedule_options.max_batch_size = 4;  // fits two 2-unit tasks
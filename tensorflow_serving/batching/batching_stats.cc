@@ -0,0 +1,184 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/batching/batching_stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+
+namespace tensorflow {
+namespace serving {
+
+namespace {
+
+// Returns 'numerator' / 'denominator', or 0 if 'denominator' is 0.
+double Ratio(const int64 numerator, const int64 denominator) {
+  return denominator == 0 ? 0.0
+                          : static_cast<double>(numerator) / denominator;
+}
+
+// Returns the smallest of the sorted 'values' that is at least as large as
+// 'fraction' of them, as text.
+string Percentile(const std::vector<int64>& values, const double fraction) {
+  if (values.empty()) {
+    return "-";
+  }
+  const int64 rank =
+      std::max<int64>(0, std::ceil(fraction * values.size()) - 1);
+  return absl::StrCat(values[rank]);
+}
+
+struct BatchSizeStats {
+  int64 num_batches = 0;
+  int64 total_run_micros = 0;
+  int64 max_run_micros = 0;
+};
+
+}  // namespace
+
+const char* const BatchingStats::kBatchingStatsPath = "/monitoring/batching";
+
+BatchingStats* BatchingStats::Get() {
+  static BatchingStats* const stats = new BatchingStats(Options());
+  return stats;
+}
+
+void BatchingStats::RecordBatch(const string& model_name,
+                                const BatchRecord& batch) {
+  const uint64 now_micros = options_.env->NowMicros();
+  mutex_lock l(mu_);
+  auto it = models_.find(model_name);
+  if (it == models_.end()) {
+    return;
+  }
+  ModelStats& stats = it->second;
+  stats.batches.push_back({now_micros, batch});
+  DropOldBatches(&stats);
+}
+
+int64 BatchingStats::AddQueueDepthSource(const string& model_name,
+                                         std::function<int64()> queue_depth) {
+  mutex_lock l(mu_);
+  const int64 id = next_source_id_++;
+  sources_[id] = {model_name, std::move(queue_depth)};
+  ++models_[model_name].num_sources;
+  return id;
+}
+
+void BatchingStats::RemoveQueueDepthSource(const int64 id) {
+  // The sources are called under the lock.
+  mutex_lock l(mu_);
+  auto source_it = sources_.find(id);
+  if (source_it == sources_.end()) {
+    return;
+  }
+  auto model_it = models_.find(source_it->second.first);
+  if (--model_it->second.num_sources == 0) {
+    models_.erase(model_it);
+  }
+  sources_.erase(source_it);
+}
+
+string BatchingStats::GeneratePage(const string& model_name) {
+  mutex_lock l(mu_);
+  string page;
+  for (auto& entry : models_) {
+    if (model_name.empty() || entry.first == model_name) {
+      DropOldBatches(&entry.second);
+      AppendModelPage(entry.first, entry.second, &page);
+    }
+  }
+  return page;
+}
+
+void BatchingStats::DropOldBatches(ModelStats* const stats) const {
+  const uint64 now_micros = options_.env->NowMicros();
+  while (!stats->batches.empty() &&
+         (stats->batches.size() >
+              static_cast<size_t>(options_.max_batches_per_model) ||
+          stats->batches.front().time_micros +
+                  static_cast<uint64>(options_.window_micros) <
+              now_micros)) {
+    stats->batches.pop_front();
+  }
+}
+
+void BatchingStats::AppendModelPage(const string& model_name,
+                                    const ModelStats& stats,
+                                    string* page) const {
+  int64 queue_depth = 0;
+  for (const auto& entry : sources_) {
+    if (entry.second.first == model_name) {
+      queue_depth += entry.second.second();
+    }
+  }
+  int64 total_batch_size = 0;
+  int64 total_padding_size = 0;
+  int64 total_max_batch_size = 0;
+  std::vector<int64> times_to_close;
+  times_to_close.reserve(stats.batches.size());
+  // By padded batch size.
+  std::map<int64, BatchSizeStats> batch_sizes;
+  for (const TimedBatchRecord& record : stats.batches) {
+    const BatchRecord& batch = record.batch;
+    total_batch_size += batch.batch_size;
+    total_padding_size += batch.padding_size;
+    total_max_batch_size += batch.max_batch_size;
+    times_to_close.push_back(batch.time_to_close_micros);
+    BatchSizeStats& batch_size_stats =
+        batch_sizes[batch.batch_size + batch.padding_size];
+    ++batch_size_stats.num_batches;
+    batch_size_stats.total_run_micros += batch.run_micros;
+    batch_size_stats.max_run_micros =
+        std::max(batch_size_stats.max_run_micros, batch.run_micros);
+  }
+  std::sort(times_to_close.begin(), times_to_close.end());
+  const int64 num_batches = stats.batches.size();
+
+  absl::StrAppend(page, "model: ", model_name, "\n");
+  absl::StrAppend(page, "  queue_depth: ", queue_depth, "\n");
+  absl::StrAppend(page, "  window_seconds: ",
+                  options_.window_micros / (1000 * 1000), "\n");
+  absl::StrAppend(page, "  batches: ", num_batches, "\n");
+  absl::StrAppendFormat(page, "  mean_batch_size: %.2f\n",
+                        Ratio(total_batch_size, num_batches));
+  absl::StrAppendFormat(page, "  fill_ratio: %.3f\n",
+                        Ratio(total_batch_size, total_max_batch_size));
+  absl::StrAppendFormat(
+      page, "  padding_waste: %.3f\n",
+      Ratio(total_padding_size, total_batch_size + total_padding_size));
+  absl::StrAppend(page, "  time_to_close_micros: p50=",
+                  Percentile(times_to_close, 0.5),
+                  " p90=", Percentile(times_to_close, 0.9),
+                  " p99=", Percentile(times_to_close, 0.99), "\n");
+  for (const auto& entry : batch_sizes) {
+    const BatchSizeStats& batch_size_stats = entry.second;
+    absl::StrAppendFormat(
+        page,
+        "  batch_size: %d batches: %d mean_run_micros: %.0f "
+        "max_run_micros: %d\n",
+        entry.first, batch_size_stats.num_batches,
+        Ratio(batch_size_stats.total_run_micros, batch_size_stats.num_batches),
+        batch_size_stats.max_run_micros);
+  }
+}
+
+}  // namespace serving
+}  // namespace tensorflow
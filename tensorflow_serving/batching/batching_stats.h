@@ -0,0 +1,139 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_BATCHING_BATCHING_STATS_H_
+#define TENSORFLOW_SERVING_BATCHING_BATCHING_STATS_H_
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <utility>
+
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace serving {
+
+// Live statistics of the batches processed for each model, to tune the
+// batching parameters from: the number of calls waiting in the queues, how
+// full the batches are and how much of them is padding, how long the batches
+// take to close, and how long they take to run for each batch size.
+//
+// The statistics of the batches cover those processed in the last
+// 'window_micros' (and at most the last 'max_batches_per_model' of them), so
+// that they reflect the current traffic and batching parameters.
+//
+// The BatchingSessions whose options name a model report the depth of their
+// queues here, and record their batches. A model is only tracked while it has
+// queue depth sources, i.e. while a session of it is alive.
+//
+// This class is thread-safe.
+class BatchingStats {
+ public:
+  // Default path to expose the statistics.
+  static const char* const kBatchingStatsPath;
+
+  // Returns the statistics of the process.
+  static BatchingStats* Get();
+
+  struct Options {
+    // The period of the batches the statistics cover.
+    int64 window_micros = 60 * 1000 * 1000;
+
+    // The maximum number of batches kept for each model, which bounds the
+    // memory used under heavy traffic.
+    int max_batches_per_model = 10000;
+
+    // The environment to read the time from.
+    Env* env = Env::Default();
+  };
+
+  explicit BatchingStats(const Options& options) : options_(options) {}
+
+  // A processed batch.
+  struct BatchRecord {
+    // The size of the calls in the batch, and the padding added to them.
+    int64 batch_size = 0;
+    int64 padding_size = 0;
+    // The size of a full batch.
+    int64 max_batch_size = 0;
+    // The time from the arrival of the first call of the batch to the start
+    // of its processing.
+    int64 time_to_close_micros = 0;
+    // The time the wrapped session took to run the batch.
+    int64 run_micros = 0;
+  };
+
+  // Records 'batch', processed for 'model_name'. Ignored if 'model_name' has
+  // no queue depth source.
+  void RecordBatch(const string& model_name, const BatchRecord& batch)
+      TF_LOCKS_EXCLUDED(mu_);
+
+  // Adds a source of the number of calls waiting in the queues of
+  // 'model_name', and returns the id to remove it with.
+  int64 AddQueueDepthSource(const string& model_name,
+                            std::function<int64()> queue_depth)
+      TF_LOCKS_EXCLUDED(mu_);
+
+  // Removes a source added by AddQueueDepthSource(). Once this returns, the
+  // source is not called anymore. The statistics of the model are dropped
+  // along with its last source.
+  void RemoveQueueDepthSource(int64 id) TF_LOCKS_EXCLUDED(mu_);
+
+  // Generates the text page of the statistics of 'model_name', or of all the
+  // models if it is empty.
+  string GeneratePage(const string& model_name) TF_LOCKS_EXCLUDED(mu_);
+
+ private:
+  // A recorded batch, with the time it was recorded at.
+  struct TimedBatchRecord {
+    uint64 time_micros;
+    BatchRecord batch;
+  };
+
+  struct ModelStats {
+    // The number of queue depth sources of the model.
+    int num_sources = 0;
+    // The batches in the window, oldest first.
+    std::deque<TimedBatchRecord> batches;
+  };
+
+  // Drops the batches of 'stats' that are out of the window.
+  void DropOldBatches(ModelStats* stats) const TF_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Appends the statistics of 'model_name' to 'page'.
+  void AppendModelPage(const string& model_name, const ModelStats& stats,
+                       string* page) const TF_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  const Options options_;
+
+  mutex mu_;
+  std::map<string, ModelStats> models_ TF_GUARDED_BY(mu_);
+  int64 next_source_id_ TF_GUARDED_BY(mu_) = 0;
+  // The queue depth sources, by id, with their model.
+  std::map<int64, std::pair<string, std::function<int64()>>> sources_
+      TF_GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(BatchingStats);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_BATCHING_BATCHING_STATS_H_
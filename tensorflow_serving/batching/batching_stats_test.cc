@@ -0,0 +1,166 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/batching/batching_stats.h"
+
+#include <memory>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "tensorflow/core/kernels/batching_util/fake_clock_env.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+using ::testing::Eq;
+using ::testing::HasSubstr;
+using ::testing::Not;
+
+BatchingStats::BatchRecord Record(int64 batch_size, int64 padding_size,
+                                  int64 time_to_close_micros,
+                                  int64 run_micros) {
+  BatchingStats::BatchRecord record;
+  record.batch_size = batch_size;
+  record.padding_size = padding_size;
+  record.max_batch_size = 8;
+  record.time_to_close_micros = time_to_close_micros;
+  record.run_micros = run_micros;
+  return record;
+}
+
+class BatchingStatsTest : public ::testing::Test {
+ protected:
+  BatchingStatsTest() : env_(Env::Default()) {}
+
+  std::unique_ptr<BatchingStats> CreateStats(
+      const int max_batches_per_model = 10000) {
+    BatchingStats::Options options;
+    options.window_micros = 10 * 1000 * 1000;
+    options.max_batches_per_model = max_batches_per_model;
+    options.env = &env_;
+    return std::unique_ptr<BatchingStats>(new BatchingStats(options));
+  }
+
+  test_util::FakeClockEnv env_;
+};
+
+TEST_F(BatchingStatsTest, GeneratesThePageOfEachModel) {
+  std::unique_ptr<BatchingStats> stats = CreateStats();
+  const int64 source_id = stats->AddQueueDepthSource("model", [] { return 5; });
+  stats->AddQueueDepthSource("model", [] { return 2; });
+  stats->AddQueueDepthSource("other_model", [] { return 0; });
+  stats->RecordBatch("model", Record(3, 2, 150, 1000));
+  stats->RecordBatch("model", Record(4, 0, 150, 3000));
+  stats->RecordBatch("model", Record(8, 0, 1000, 5000));
+  stats->RecordBatch("other_model", Record(1, 0, 50, 10));
+
+  const string page = stats->GeneratePage("model");
+  EXPECT_THAT(page, HasSubstr("model: model\n"));
+  EXPECT_THAT(page, Not(HasSubstr("other_model")));
+  EXPECT_THAT(page, HasSubstr("  queue_depth: 7\n"));
+  EXPECT_THAT(page, HasSubstr("  window_seconds: 10\n"));
+  EXPECT_THAT(page, HasSubstr("  batches: 3\n"));
+  EXPECT_THAT(page, HasSubstr("  mean_batch_size: 5.00\n"));
+  EXPECT_THAT(page, HasSubstr("  fill_ratio: 0.625\n"));
+  EXPECT_THAT(page, HasSubstr("  padding_waste: 0.118\n"));
+  EXPECT_THAT(page,
+              HasSubstr("  time_to_close_micros: p50=150 p90=1000 "
+                        "p99=1000\n"));
+  EXPECT_THAT(page, HasSubstr("  batch_size: 4 batches: 1 mean_run_micros: "
+                              "3000 max_run_micros: 3000\n"));
+  EXPECT_THAT(page, HasSubstr("  batch_size: 5 batches: 1 mean_run_micros: "
+                              "1000 max_run_micros: 1000\n"));
+  EXPECT_THAT(page, HasSubstr("  batch_size: 8 batches: 1 mean_run_micros: "
+                              "5000 max_run_micros: 5000\n"));
+
+  // The removed sources are not counted anymore.
+  stats->RemoveQueueDepthSource(source_id);
+  EXPECT_THAT(stats->GeneratePage("model"), HasSubstr("  queue_depth: 2\n"));
+
+  const string all_models_page = stats->GeneratePage("");
+  EXPECT_THAT(all_models_page, HasSubstr("model: model\n"));
+  EXPECT_THAT(all_models_page, HasSubstr("model: other_model\n"));
+  EXPECT_THAT(stats->GeneratePage("unknown_model"), Eq(""));
+}
+
+TEST_F(BatchingStatsTest, ModelWithoutBatches) {
+  std::unique_ptr<BatchingStats> stats = CreateStats();
+  stats->AddQueueDepthSource("model", [] { return 1; });
+  const string page = stats->GeneratePage("model");
+  EXPECT_THAT(page, HasSubstr("  queue_depth: 1\n"));
+  EXPECT_THAT(page, HasSubstr("  batches: 0\n"));
+  EXPECT_THAT(page, HasSubstr("  time_to_close_micros: p50=- p90=- p99=-\n"));
+}
+
+TEST_F(BatchingStatsTest, CoversTheBatchesOfTheWindow) {
+  std::unique_ptr<BatchingStats> stats = CreateStats();
+  stats->AddQueueDepthSource("model", [] { return 0; });
+  stats->RecordBatch("model", Record(2, 0, 100, 1000));
+  env_.AdvanceByMicroseconds(6 * 1000 * 1000);
+  stats->RecordBatch("model", Record(8, 0, 300, 2000));
+  EXPECT_THAT(stats->GeneratePage("model"), HasSubstr("  batches: 2\n"));
+
+  // The first batch leaves the window.
+  env_.AdvanceByMicroseconds(6 * 1000 * 1000);
+  string page = stats->GeneratePage("model");
+  EXPECT_THAT(page, HasSubstr("  batches: 1\n"));
+  EXPECT_THAT(page, HasSubstr("  mean_batch_size: 8.00\n"));
+  EXPECT_THAT(page, HasSubstr("  time_to_close_micros: p50=300 p90=300 "
+                              "p99=300\n"));
+  EXPECT_THAT(page, Not(HasSubstr("  batch_size: 2 ")));
+
+  env_.AdvanceByMicroseconds(6 * 1000 * 1000);
+  page = stats->GeneratePage("model");
+  EXPECT_THAT(page, HasSubstr("  batches: 0\n"));
+  EXPECT_THAT(page, HasSubstr("  mean_batch_size: 0.00\n"));
+}
+
+TEST_F(BatchingStatsTest, KeepsTheLastBatchesOfEachModel) {
+  std::unique_ptr<BatchingStats> stats = CreateStats(2);
+  stats->AddQueueDepthSource("model", [] { return 0; });
+  stats->RecordBatch("model", Record(1, 0, 100, 1000));
+  stats->RecordBatch("model", Record(2, 0, 100, 1000));
+  stats->RecordBatch("model", Record(4, 0, 100, 1000));
+  const string page = stats->GeneratePage("model");
+  EXPECT_THAT(page, HasSubstr("  batches: 2\n"));
+  EXPECT_THAT(page, HasSubstr("  mean_batch_size: 3.00\n"));
+}
+
+TEST_F(BatchingStatsTest, DropsTheModelsWithoutSources) {
+  std::unique_ptr<BatchingStats> stats = CreateStats();
+  // Batches of models without sources are ignored.
+  stats->RecordBatch("model", Record(1, 0, 100, 1000));
+  EXPECT_THAT(stats->GeneratePage(""), Eq(""));
+
+  const int64 first_id = stats->AddQueueDepthSource("model", [] { return 0; });
+  const int64 second_id = stats->AddQueueDepthSource("model", [] { return 0; });
+  stats->RecordBatch("model", Record(1, 0, 100, 1000));
+  stats->RemoveQueueDepthSource(first_id);
+  EXPECT_THAT(stats->GeneratePage("model"), HasSubstr("  batches: 1\n"));
+
+  // The statistics go with the last source.
+  stats->RemoveQueueDepthSource(second_id);
+  EXPECT_THAT(stats->GeneratePage(""), Eq(""));
+  stats->RecordBatch("model", Record(1, 0, 100, 1000));
+  EXPECT_THAT(stats->GeneratePage(""), Eq(""));
+
+  stats->AddQueueDepthSource("model", [] { return 0; });
+  EXPECT_THAT(stats->GeneratePage("model"), HasSubstr("  batches: 0\n"));
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
@@ -19,6 +19,7 @@ limitations under the License.
 
 #include "tensorflow/core/framework/register_types.h"
 #include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_util.h"
 #include "tensorflow/core/framework/types.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/platform/env_time.h"
@@ -150,6 +151,149 @@ Status PadTensorOfSpecificType(const Tensor& tensor,
   }
 }
 
+namespace {
+
+// Checks that `row_splits` start with 0, are non-decreasing, and end with
+// `num_inner_rows`, the number of rows of the dimension they split.
+template <typename T>
+Status ValidateRowSplits(const Tensor& row_splits, const int64 num_inner_rows) {
+  const auto splits = row_splits.unaligned_flat<T>();
+  if (splits(0) != 0) {
+    return errors::InvalidArgument("Row splits must start with 0; got ",
+                                   row_splits.DebugString());
+  }
+  for (int64 i = 1; i < splits.size(); ++i) {
+    if (splits(i) < splits(i - 1)) {
+      return errors::InvalidArgument("Row splits must be non-decreasing; got ",
+                                     row_splits.DebugString());
+    }
+  }
+  if (static_cast<int64>(splits(splits.size() - 1)) != num_inner_rows) {
+    return errors::InvalidArgument("Row splits must end with the ",
+                                   num_inner_rows, " rows they split; got ",
+                                   row_splits.DebugString());
+  }
+  return Status::OK();
+}
+
+// Concatenates the row splits of one ragged dimension of several tasks, and
+// appends `padding_size` empty rows. The row splits must be valid.
+template <typename T>
+Status MergeRowSplits(const std::vector<const Tensor*>& task_row_splits,
+                      int padding_size, Tensor* merged_row_splits) {
+  int64 num_rows = 0;
+  for (const Tensor* row_splits : task_row_splits) {
+    num_rows += row_splits->NumElements() - 1;
+  }
+  *merged_row_splits = Tensor(DataTypeToEnum<T>::value,
+                              TensorShape({num_rows + padding_size + 1}));
+  auto merged = merged_row_splits->flat<T>();
+  int64 row = 0;
+  T offset = 0;
+  merged(0) = 0;
+  for (const Tensor* row_splits : task_row_splits) {
+    const auto splits = row_splits->unaligned_flat<T>();
+    for (int64 i = 1; i < splits.size(); ++i) {
+      merged(++row) = offset + splits(i);
+    }
+    offset += splits(splits.size() - 1);
+  }
+  for (int i = 0; i < padding_size; ++i) {
+    merged(++row) = offset;
+  }
+  return Status::OK();
+}
+
+}  // namespace
+
+Status MergeRaggedTensors(
+    const std::vector<std::vector<Tensor>>& task_nested_row_splits,
+    const std::vector<Tensor>& task_values, int padding_size,
+    std::vector<Tensor>* merged_nested_row_splits, Tensor* merged_values) {
+  if (task_values.empty() ||
+      task_values.size() != task_nested_row_splits.size()) {
+    return errors::InvalidArgument(
+        "Ragged tensors must have values and row splits for each task");
+  }
+  const int num_ragged_dims = task_nested_row_splits[0].size();
+  if (num_ragged_dims == 0) {
+    return errors::InvalidArgument("Ragged tensors must have row splits");
+  }
+
+  // The row splits of each task are validated before any is merged: invalid
+  // ones would make the merged row splits index out of the merged values.
+  const DataType row_splits_dtype = task_nested_row_splits[0][0].dtype();
+  for (int task = 0; task < task_values.size(); ++task) {
+    const std::vector<Tensor>& nested_row_splits =
+        task_nested_row_splits[task];
+    if (nested_row_splits.size() != num_ragged_dims) {
+      return errors::InvalidArgument(
+          "Ragged tensors must have the same number of ragged dimensions "
+          "in all tasks");
+    }
+    if (task_values[task].dims() == 0) {
+      return errors::InvalidArgument("Ragged values must not be scalars");
+    }
+    for (int dim = 0; dim < num_ragged_dims; ++dim) {
+      const Tensor& row_splits = nested_row_splits[dim];
+      if (row_splits.dims() != 1 || row_splits.NumElements() == 0 ||
+          row_splits.dtype() != row_splits_dtype) {
+        return errors::InvalidArgument(
+            "Row splits must be non-empty vectors of the same type; got ",
+            row_splits.DebugString());
+      }
+      // The innermost row splits split the values.
+      const int64 num_inner_rows =
+          dim + 1 < num_ragged_dims
+              ? nested_row_splits[dim + 1].NumElements() - 1
+              : task_values[task].dim_size(0);
+      switch (row_splits_dtype) {
+        case DT_INT32:
+          TF_RETURN_IF_ERROR(
+              ValidateRowSplits<int32>(row_splits, num_inner_rows));
+          break;
+        case DT_INT64:
+          TF_RETURN_IF_ERROR(
+              ValidateRowSplits<int64>(row_splits, num_inner_rows));
+          break;
+        default:
+          return errors::InvalidArgument(
+              "Row splits must be DT_INT32 or DT_INT64; got ",
+              DataTypeString(row_splits_dtype));
+      }
+    }
+  }
+
+  merged_nested_row_splits->clear();
+  for (int dim = 0; dim < num_ragged_dims; ++dim) {
+    std::vector<const Tensor*> task_row_splits;
+    for (const std::vector<Tensor>& nested_row_splits :
+         task_nested_row_splits) {
+      task_row_splits.push_back(&nested_row_splits[dim]);
+    }
+
+    // Only the outermost dimension is the batch dimension.
+    const int dim_padding_size = dim == 0 ? padding_size : 0;
+    merged_nested_row_splits->emplace_back();
+    Tensor* merged_row_splits = &merged_nested_row_splits->back();
+    switch (task_row_splits[0]->dtype()) {
+      case DT_INT32:
+        TF_RETURN_IF_ERROR(MergeRowSplits<int32>(
+            task_row_splits, dim_padding_size, merged_row_splits));
+        break;
+      case DT_INT64:
+        TF_RETURN_IF_ERROR(MergeRowSplits<int64>(
+            task_row_splits, dim_padding_size, merged_row_splits));
+        break;
+      default:
+        return errors::InvalidArgument(
+            "Row splits must be DT_INT32 or DT_INT64; got ",
+            DataTypeString(task_row_splits[0]->dtype()));
+    }
+  }
+  return tensor::Concat(task_values, merged_values);
+}
+
 std::map<string, std::vector<int>> CalculateMaxDimSizes(
     const std::vector<std::vector<std::pair<string, Tensor>>>& batch) {
   std::map<string, std::vector<int>> max_dim_sizes;
@@ -78,6 +78,26 @@ int RoundToLowestAllowedBatchSize(absl::Span<const int> allowed_batch_sizes,
 bool AreShapesEqualExceptZeroDim(const TensorShape& shape1,
                                  const TensorShape& shape2);
 
+// Merges the ragged inputs of several tasks into a single ragged tensor,
+// without padding the variable-length dimensions. Each task's input is given
+// by its flat values and its row splits, outermost first (as in
+// tf.RaggedTensor.nested_row_splits). The values are concatenated and the row
+// splits of each task are shifted by the size of the rows merged before it.
+// `padding_size` empty rows are appended to the outermost dimension.
+//
+// For example, merging {values: [a, b, c], row_splits: [0, 2, 3]} and
+// {values: [d], row_splits: [0, 0, 1]} with a padding size of 1 produces
+// {values: [a, b, c, d], row_splits: [0, 2, 3, 3, 4, 4]}.
+//
+// Row splits must be 1-D DT_INT32 or DT_INT64 tensors starting with 0,
+// non-decreasing, and ending with the number of rows of the dimension they
+// split (the next row splits, or the values for the innermost ones).
+// Otherwise, returns an InvalidArgument error without merging.
+Status MergeRaggedTensors(
+    const std::vector<std::vector<Tensor>>& task_nested_row_splits,
+    const std::vector<Tensor>& task_values, int padding_size,
+    std::vector<Tensor>* merged_nested_row_splits, Tensor* merged_values);
+
 // Returns the first dimension size (batching dimension) of each tensor in
 // `inputs`. If their first dimension sizes don't match, returns an error.
 template <typename TensorList, typename DimFunc, typename DimSizeFunc>
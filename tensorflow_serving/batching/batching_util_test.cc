@@ -19,6 +19,8 @@ limitations under the License.
 #include <gtest/gtest.h>
 #include "tensorflow/core/framework/register_types.h"
 #include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/platform/types.h"
 
@@ -92,6 +94,68 @@ TEST(BatchingUtilTest, AddPaddingTensorWithUnsupportedRank) {
                 "Only tensors with rank from 1 to 6 can be padded."),
             AddPadding(tensor, max_dim_sizes, &padded_tensor));
 }
+
+TEST(BatchingUtilTest, MergeRaggedTensors) {
+  // Two tasks with two ragged dimensions: [[[1, 2], [3]]] and [[], [[4]]].
+  const std::vector<std::vector<Tensor>> task_nested_row_splits = {
+      {test::AsTensor<int64>({0, 2}), test::AsTensor<int64>({0, 2, 3})},
+      {test::AsTensor<int64>({0, 0, 1}), test::AsTensor<int64>({0, 1})}};
+  const std::vector<Tensor> task_values = {test::AsTensor<int32>({1, 2, 3}),
+                                           test::AsTensor<int32>({4})};
+  std::vector<Tensor> merged_nested_row_splits;
+  Tensor merged_values;
+  TF_ASSERT_OK(MergeRaggedTensors(task_nested_row_splits, task_values,
+                                  /*padding_size=*/1,
+                                  &merged_nested_row_splits, &merged_values));
+  ASSERT_EQ(2, merged_nested_row_splits.size());
+  test::ExpectTensorEqual<int64>(test::AsTensor<int64>({0, 2, 2, 3, 3}),
+                                 merged_nested_row_splits[0]);
+  test::ExpectTensorEqual<int64>(test::AsTensor<int64>({0, 2, 3, 4}),
+                                 merged_nested_row_splits[1]);
+  test::ExpectTensorEqual<int32>(test::AsTensor<int32>({1, 2, 3, 4}),
+                                 merged_values);
+}
+
+TEST(BatchingUtilTest, MergeRaggedTensorsInvalidRowSplits) {
+  const std::vector<Tensor> task_values = {test::AsTensor<int32>({1, 2})};
+  std::vector<Tensor> merged_nested_row_splits;
+  Tensor merged_values;
+  EXPECT_FALSE(MergeRaggedTensors({{test::AsTensor<int64>({1, 2})}},
+                                  task_values, /*padding_size=*/0,
+                                  &merged_nested_row_splits, &merged_values)
+                   .ok());
+  EXPECT_FALSE(MergeRaggedTensors({{test::AsTensor<float>({0, 2})}},
+                                  task_values, /*padding_size=*/0,
+                                  &merged_nested_row_splits, &merged_values)
+                   .ok());
+  EXPECT_FALSE(MergeRaggedTensors({{}}, task_values, /*padding_size=*/0,
+                                  &merged_nested_row_splits, &merged_values)
+                   .ok());
+  // Decreasing.
+  EXPECT_FALSE(MergeRaggedTensors({{test::AsTensor<int64>({0, 2, 1, 2})}},
+                                  task_values, /*padding_size=*/0,
+                                  &merged_nested_row_splits, &merged_values)
+                   .ok());
+  // Not ending with the number of values.
+  EXPECT_FALSE(MergeRaggedTensors({{test::AsTensor<int64>({0, 5})}},
+                                  task_values, /*padding_size=*/0,
+                                  &merged_nested_row_splits, &merged_values)
+                   .ok());
+  // Not ending with the number of rows of the inner row splits.
+  EXPECT_FALSE(MergeRaggedTensors(
+                   {{test::AsTensor<int64>({0, 2}),
+                     test::AsTensor<int64>({0, 2})}},
+                   task_values, /*padding_size=*/0, &merged_nested_row_splits,
+                   &merged_values)
+                   .ok());
+  // Invalid in the second task only.
+  EXPECT_FALSE(MergeRaggedTensors({{test::AsTensor<int64>({0, 2})},
+                                   {test::AsTensor<int64>({0, 3})}},
+                                  {task_values[0], task_values[0]},
+                                  /*padding_size=*/0, &merged_nested_row_splits,
+                                  &merged_values)
+                   .ok());
+}
 }  // namespace
 }  // namespace serving
 }  // namespace tensorflow
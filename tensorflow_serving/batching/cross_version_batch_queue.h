@@ -0,0 +1,364 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_BATCHING_CROSS_VERSION_BATCH_QUEUE_H_
+#define TENSORFLOW_SERVING_BATCHING_CROSS_VERSION_BATCH_QUEUE_H_
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "tensorflow/core/kernels/batching_util/batch_scheduler.h"
+#include "tensorflow/core/kernels/batching_util/shared_batch_scheduler.h"
+#include "tensorflow/core/lib/core/blocking_counter.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/threadpool.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace serving {
+
+// A batch scheduler queue shared by several members, typically the versions of
+// a model serving at the same time (e.g. a canary and the stable version),
+// each with its own process-batch callback. The tasks of all the members form
+// batches together, so that splitting the traffic does not reduce how full the
+// batches get. Each batch is then dispatched as one sub-batch per member,
+// holding that member's tasks in their order in the batch. The sub-batches of
+// a batch are processed in parallel, the first one on the batch thread and the
+// others on the threads of the queue.
+//
+// The members are BatchScheduler views of the queue, see AddMember(). The
+// queue stays alive while a member does, and destroying a member waits until
+// its tasks are processed.
+template <typename TaskType>
+class CrossVersionBatchQueue {
+ public:
+  using ProcessBatchCallback =
+      std::function<void(std::unique_ptr<Batch<TaskType>>)>;
+  using QueueOptions = typename SharedBatchScheduler<TaskType>::QueueOptions;
+  // Creates the underlying queue from options and a process-batch callback.
+  using QueueCreator = std::function<Status(
+      const QueueOptions&, ProcessBatchCallback,
+      std::unique_ptr<BatchScheduler<TaskType>>*)>;
+
+  // Creates the underlying queue with 'queue_creator' and 'queue_options'.
+  // The 'split_input_task_func' of the options, if any, is wrapped so that the
+  // split tasks stay with the member of their input task. The sub-batches
+  // beyond the first one of each batch are processed by a pool of
+  // 'num_sub_batch_threads' threads, typically as many as the batch threads of
+  // the underlying queue.
+  static Status Create(
+      const QueueOptions& queue_options, const QueueCreator& queue_creator,
+      int num_sub_batch_threads,
+      std::shared_ptr<CrossVersionBatchQueue<TaskType>>* result);
+
+  ~CrossVersionBatchQueue();
+
+  // Adds a member to 'queue', and returns in 'member' the scheduler of its
+  // tasks, whose sub-batches are processed by 'process_batch_callback'. The
+  // capacity reported by the member is that of the whole queue, and the
+  // enqueued tasks its own, so that the members of a queue add up to it.
+  static Status AddMember(
+      std::shared_ptr<CrossVersionBatchQueue<TaskType>> queue,
+      ProcessBatchCallback process_batch_callback,
+      std::unique_ptr<BatchScheduler<TaskType>>* member);
+
+ private:
+  class Member;
+
+  struct MemberState {
+    ProcessBatchCallback process_batch_callback;
+    // The tasks of the member that are enqueued or being processed.
+    int64 num_tasks = 0;
+    // The tasks of the member that are enqueued.
+    int64 num_enqueued_tasks = 0;
+  };
+
+  CrossVersionBatchQueue() = default;
+
+  Status Schedule(int64 member_id, std::unique_ptr<TaskType>* task);
+
+  // Returns the number of tasks of 'member_id' that are enqueued.
+  size_t NumEnqueuedTasks(int64 member_id);
+
+  // Waits until the tasks of 'member_id' are processed, and removes it.
+  void RemoveMember(int64 member_id);
+
+  // Assigns 'output_tasks' to the member of 'input_task', which they replace.
+  void RecordSplit(const TaskType* input_task,
+                   const std::vector<std::unique_ptr<TaskType>>& output_tasks);
+
+  // Processes the sub-batch of each member in 'batch', in parallel.
+  void ProcessBatch(std::unique_ptr<Batch<TaskType>> batch);
+
+  mutex mu_;
+  // Notified when the last task of a member is processed.
+  condition_variable tasks_processed_;
+  int64 next_member_id_ TF_GUARDED_BY(mu_) = 0;
+  std::unordered_map<int64, MemberState> members_ TF_GUARDED_BY(mu_);
+  // The member of each task enqueued or being processed.
+  std::unordered_map<const TaskType*, int64> task_members_ TF_GUARDED_BY(mu_);
+
+  // Set once by Create().
+  std::unique_ptr<thread::ThreadPool> sub_batch_threads_;
+  std::unique_ptr<BatchScheduler<TaskType>> queue_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(CrossVersionBatchQueue);
+};
+
+//////////
+// Implementation details follow. API users need not read.
+
+template <typename TaskType>
+class CrossVersionBatchQueue<TaskType>::Member
+    : public BatchScheduler<TaskType> {
+ public:
+  Member(std::shared_ptr<CrossVersionBatchQueue<TaskType>> queue,
+         int64 member_id)
+      : queue_(std::move(queue)), member_id_(member_id) {}
+
+  ~Member() override { queue_->RemoveMember(member_id_); }
+
+  Status Schedule(std::unique_ptr<TaskType>* task) override {
+    return queue_->Schedule(member_id_, task);
+  }
+  size_t NumEnqueuedTasks() const override {
+    return queue_->NumEnqueuedTasks(member_id_);
+  }
+  size_t SchedulingCapacity() const override {
+    return queue_->queue_->SchedulingCapacity();
+  }
+  size_t max_task_size() const override {
+    return queue_->queue_->max_task_size();
+  }
+
+ private:
+  const std::shared_ptr<CrossVersionBatchQueue<TaskType>> queue_;
+  const int64 member_id_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(Member);
+};
+
+template <typename TaskType>
+Status CrossVersionBatchQueue<TaskType>::Create(
+    const QueueOptions& queue_options, const QueueCreator& queue_creator,
+    const int num_sub_batch_threads,
+    std::shared_ptr<CrossVersionBatchQueue<TaskType>>* result) {
+  if (num_sub_batch_threads < 1) {
+    return errors::InvalidArgument(
+        "num_sub_batch_threads must be positive; was ", num_sub_batch_threads);
+  }
+  std::shared_ptr<CrossVersionBatchQueue<TaskType>> queue(
+      new CrossVersionBatchQueue<TaskType>());
+  queue->sub_batch_threads_.reset(new thread::ThreadPool(
+      Env::Default(), "cross_version_sub_batches", num_sub_batch_threads));
+  CrossVersionBatchQueue<TaskType>* const raw_queue = queue.get();
+  QueueOptions options = queue_options;
+  if (queue_options.split_input_task_func != nullptr) {
+    options.split_input_task_func =
+        [raw_queue, split = queue_options.split_input_task_func](
+            std::unique_ptr<TaskType>* input_task, int first_output_task_size,
+            int input_batch_size_limit,
+            std::vector<std::unique_ptr<TaskType>>* output_tasks) {
+          const TaskType* const raw_input_task = input_task->get();
+          TF_RETURN_IF_ERROR(split(input_task, first_output_task_size,
+                                   input_batch_size_limit, output_tasks));
+          raw_queue->RecordSplit(raw_input_task, *output_tasks);
+          return Status::OK();
+        };
+  }
+  TF_RETURN_IF_ERROR(queue_creator(
+      options,
+      [raw_queue](std::unique_ptr<Batch<TaskType>> batch) {
+        raw_queue->ProcessBatch(std::move(batch));
+      },
+      &queue->queue_));
+  *result = std::move(queue);
+  return Status::OK();
+}
+
+template <typename TaskType>
+CrossVersionBatchQueue<TaskType>::~CrossVersionBatchQueue() {
+  // The members are gone, so the queue is empty, but its batch threads may
+  // still be returning from ProcessBatch().
+  queue_.reset();
+  sub_batch_threads_.reset();
+}
+
+template <typename TaskType>
+Status CrossVersionBatchQueue<TaskType>::AddMember(
+    std::shared_ptr<CrossVersionBatchQueue<TaskType>> queue,
+    ProcessBatchCallback process_batch_callback,
+    std::unique_ptr<BatchScheduler<TaskType>>* member) {
+  if (queue == nullptr) {
+    return errors::Internal("Cross-version batch queue not set");
+  }
+  int64 member_id;
+  {
+    mutex_lock l(queue->mu_);
+    member_id = queue->next_member_id_++;
+    queue->members_[member_id].process_batch_callback =
+        std::move(process_batch_callback);
+  }
+  member->reset(new Member(std::move(queue), member_id));
+  return Status::OK();
+}
+
+template <typename TaskType>
+Status CrossVersionBatchQueue<TaskType>::Schedule(
+    const int64 member_id, std::unique_ptr<TaskType>* task) {
+  // The task is assigned first, as it may be processed (or split) before
+  // Schedule() returns. The lock is not held meanwhile, since splitting takes
+  // it.
+  const TaskType* const raw_task = task->get();
+  {
+    mutex_lock l(mu_);
+    task_members_[raw_task] = member_id;
+    MemberState& member = members_.at(member_id);
+    ++member.num_tasks;
+    ++member.num_enqueued_tasks;
+  }
+  const Status status = queue_->Schedule(task);
+  if (!status.ok() && *task != nullptr) {
+    mutex_lock l(mu_);
+    task_members_.erase(task->get());
+    MemberState& member = members_.at(member_id);
+    --member.num_enqueued_tasks;
+    if (--member.num_tasks == 0) {
+      tasks_processed_.notify_all();
+    }
+  }
+  return status;
+}
+
+template <typename TaskType>
+size_t CrossVersionBatchQueue<TaskType>::NumEnqueuedTasks(
+    const int64 member_id) {
+  mutex_lock l(mu_);
+  return members_.at(member_id).num_enqueued_tasks;
+}
+
+template <typename TaskType>
+void CrossVersionBatchQueue<TaskType>::RemoveMember(const int64 member_id) {
+  mutex_lock l(mu_);
+  while (members_.at(member_id).num_tasks > 0) {
+    tasks_processed_.wait(l);
+  }
+  members_.erase(member_id);
+}
+
+template <typename TaskType>
+void CrossVersionBatchQueue<TaskType>::RecordSplit(
+    const TaskType* input_task,
+    const std::vector<std::unique_ptr<TaskType>>& output_tasks) {
+  mutex_lock l(mu_);
+  auto it = task_members_.find(input_task);
+  if (it == task_members_.end()) {
+    return;
+  }
+  const int64 member_id = it->second;
+  task_members_.erase(it);
+  for (const auto& output_task : output_tasks) {
+    task_members_[output_task.get()] = member_id;
+  }
+  MemberState& member = members_.at(member_id);
+  member.num_tasks += static_cast<int64>(output_tasks.size()) - 1;
+  member.num_enqueued_tasks += static_cast<int64>(output_tasks.size()) - 1;
+}
+
+template <typename TaskType>
+void CrossVersionBatchQueue<TaskType>::ProcessBatch(
+    std::unique_ptr<Batch<TaskType>> batch) {
+  std::vector<std::unique_ptr<TaskType>> tasks;
+  tasks.reserve(batch->num_tasks());
+  while (batch->num_tasks() > 0) {
+    tasks.push_back(batch->RemoveTask());
+  }
+  std::reverse(tasks.begin(), tasks.end());
+
+  // The sub-batches of each member, in the order the members were added.
+  std::map<int64, std::unique_ptr<Batch<TaskType>>> sub_batches;
+  std::map<int64, ProcessBatchCallback> callbacks;
+  {
+    mutex_lock l(mu_);
+    for (std::unique_ptr<TaskType>& task : tasks) {
+      auto it = task_members_.find(task.get());
+      DCHECK(it != task_members_.end());
+      const int64 member_id = it->second;
+      task_members_.erase(it);
+      MemberState& member = members_.at(member_id);
+      --member.num_enqueued_tasks;
+      std::unique_ptr<Batch<TaskType>>& sub_batch = sub_batches[member_id];
+      if (sub_batch == nullptr) {
+        sub_batch.reset(new Batch<TaskType>());
+        callbacks[member_id] = member.process_batch_callback;
+      }
+      sub_batch->AddTask(std::move(task));
+    }
+  }
+
+  if (sub_batches.empty()) {
+    return;
+  }
+  const auto process_sub_batch = [this, &callbacks](
+                                     const int64 member_id,
+                                     std::unique_ptr<Batch<TaskType>> batch) {
+    const int64 num_tasks = batch->num_tasks();
+    batch->Close();
+    callbacks.at(member_id)(std::move(batch));
+
+    mutex_lock l(mu_);
+    MemberState& member = members_.at(member_id);
+    member.num_tasks -= num_tasks;
+    if (member.num_tasks == 0) {
+      tasks_processed_.notify_all();
+    }
+  };
+  // The sub-batches are processed in parallel, so that a batch mixing versions
+  // takes as long as its slowest sub-batch rather than all of them. The first
+  // one is processed on the batch thread.
+  BlockingCounter sub_batches_processed(sub_batches.size() - 1);
+  for (auto it = std::next(sub_batches.begin()); it != sub_batches.end();
+       ++it) {
+    const int64 member_id = it->first;
+    Batch<TaskType>* const sub_batch = it->second.release();
+    sub_batch_threads_->Schedule(
+        [&process_sub_batch, &sub_batches_processed, member_id, sub_batch] {
+          process_sub_batch(member_id,
+                            std::unique_ptr<Batch<TaskType>>(sub_batch));
+          sub_batches_processed.DecrementCount();
+        });
+  }
+  process_sub_batch(sub_batches.begin()->first,
+                    std::move(sub_batches.begin()->second));
+  sub_batches_processed.Wait();
+}
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_BATCHING_CROSS_VERSION_BATCH_QUEUE_H_
@@ -0,0 +1,242 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/batching/cross_version_batch_queue.h"
+
+#include <algorithm>
+#include <chrono>  // NOLINT(build/c++11)
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/blocking_counter.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+class FakeTask : public BatchTask {
+ public:
+  FakeTask(size_t size, int version) : size_(size), version_(version) {}
+
+  ~FakeTask() override = default;
+
+  size_t size() const override { return size_; }
+  int version() const { return version_; }
+
+ private:
+  const size_t size_;
+  const int version_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(FakeTask);
+};
+
+using FakeTaskQueue = CrossVersionBatchQueue<FakeTask>;
+
+// Records the sub-batches processed for each version.
+class SubBatchRecorder {
+ public:
+  FakeTaskQueue::ProcessBatchCallback Callback(const int version) {
+    return [this, version](std::unique_ptr<Batch<FakeTask>> batch) {
+      EXPECT_TRUE(batch->IsClosed());
+      mutex_lock l(mu_);
+      for (int i = 0; i < batch->num_tasks(); ++i) {
+        EXPECT_EQ(version, batch->task(i).version());
+      }
+      sub_batch_sizes_[version].push_back(batch->size());
+    };
+  }
+
+  std::vector<size_t> sub_batch_sizes(const int version) {
+    mutex_lock l(mu_);
+    return sub_batch_sizes_[version];
+  }
+
+ private:
+  mutex mu_;
+  std::map<int, std::vector<size_t>> sub_batch_sizes_ TF_GUARDED_BY(mu_);
+};
+
+FakeTaskQueue::QueueCreator SharedQueueCreator(
+    std::shared_ptr<SharedBatchScheduler<FakeTask>> shared_scheduler) {
+  return [shared_scheduler](
+             const FakeTaskQueue::QueueOptions& queue_options,
+             FakeTaskQueue::ProcessBatchCallback process_batch_callback,
+             std::unique_ptr<BatchScheduler<FakeTask>>* queue) {
+    return shared_scheduler->AddQueue(queue_options,
+                                      std::move(process_batch_callback), queue);
+  };
+}
+
+std::shared_ptr<SharedBatchScheduler<FakeTask>> CreateSharedScheduler() {
+  SharedBatchScheduler<FakeTask>::Options scheduler_options;
+  scheduler_options.num_batch_threads = 1;
+  std::shared_ptr<SharedBatchScheduler<FakeTask>> shared_scheduler;
+  TF_CHECK_OK(SharedBatchScheduler<FakeTask>::Create(scheduler_options,
+                                                      &shared_scheduler));
+  return shared_scheduler;
+}
+
+TEST(CrossVersionBatchQueueTest, VersionsShareBatches) {
+  SubBatchRecorder recorder;
+  {
+    FakeTaskQueue::QueueOptions queue_options;
+    queue_options.input_batch_size_limit = 4;
+    queue_options.batch_timeout_micros = 10 * 1000 * 1000;  // won't trigger
+    std::shared_ptr<FakeTaskQueue> queue;
+    TF_ASSERT_OK(FakeTaskQueue::Create(
+        queue_options, SharedQueueCreator(CreateSharedScheduler()),
+        /*num_sub_batch_threads=*/1, &queue));
+    std::unique_ptr<BatchScheduler<FakeTask>> stable;
+    TF_ASSERT_OK(
+        FakeTaskQueue::AddMember(queue, recorder.Callback(1), &stable));
+    std::unique_ptr<BatchScheduler<FakeTask>> canary;
+    TF_ASSERT_OK(
+        FakeTaskQueue::AddMember(queue, recorder.Callback(2), &canary));
+    queue.reset();  // The members keep it alive.
+    EXPECT_EQ(4, stable->max_task_size());
+
+    // The four tasks fill one batch, split into one sub-batch per version.
+    for (int i = 0; i < 2; ++i) {
+      std::unique_ptr<FakeTask> stable_task(new FakeTask(1, 1));
+      TF_ASSERT_OK(stable->Schedule(&stable_task));
+      std::unique_ptr<FakeTask> canary_task(new FakeTask(1, 2));
+      TF_ASSERT_OK(canary->Schedule(&canary_task));
+    }
+    // Destroying a member waits until its tasks are processed.
+    canary.reset();
+    EXPECT_EQ(std::vector<size_t>({2}), recorder.sub_batch_sizes(2));
+  }
+  EXPECT_EQ(std::vector<size_t>({2}), recorder.sub_batch_sizes(1));
+}
+
+TEST(CrossVersionBatchQueueTest, MembersReportTheirOwnEnqueuedTasks) {
+  SubBatchRecorder recorder;
+  FakeTaskQueue::QueueOptions queue_options;
+  queue_options.input_batch_size_limit = 4;
+  queue_options.batch_timeout_micros = 10 * 1000 * 1000;  // won't trigger
+  std::shared_ptr<FakeTaskQueue> queue;
+  TF_ASSERT_OK(FakeTaskQueue::Create(
+      queue_options, SharedQueueCreator(CreateSharedScheduler()),
+      /*num_sub_batch_threads=*/1, &queue));
+  std::unique_ptr<BatchScheduler<FakeTask>> stable;
+  TF_ASSERT_OK(FakeTaskQueue::AddMember(queue, recorder.Callback(1), &stable));
+  std::unique_ptr<BatchScheduler<FakeTask>> canary;
+  TF_ASSERT_OK(FakeTaskQueue::AddMember(queue, recorder.Callback(2), &canary));
+
+  std::unique_ptr<FakeTask> stable_task(new FakeTask(1, 1));
+  TF_ASSERT_OK(stable->Schedule(&stable_task));
+  for (int i = 0; i < 2; ++i) {
+    std::unique_ptr<FakeTask> canary_task(new FakeTask(1, 2));
+    TF_ASSERT_OK(canary->Schedule(&canary_task));
+  }
+  // The tasks of the queue are not counted once per member.
+  EXPECT_EQ(1, stable->NumEnqueuedTasks());
+  EXPECT_EQ(2, canary->NumEnqueuedTasks());
+  // The capacity is that of the whole queue.
+  EXPECT_EQ(canary->SchedulingCapacity(), stable->SchedulingCapacity());
+
+  // The last task fills the batch, which leaves the queue.
+  stable_task.reset(new FakeTask(1, 1));
+  TF_ASSERT_OK(stable->Schedule(&stable_task));
+  canary.reset();
+  stable.reset();
+  EXPECT_EQ(std::vector<size_t>({2}), recorder.sub_batch_sizes(1));
+  EXPECT_EQ(std::vector<size_t>({2}), recorder.sub_batch_sizes(2));
+}
+
+TEST(CrossVersionBatchQueueTest, SplitTasksStayWithTheirVersion) {
+  SubBatchRecorder recorder;
+  {
+    FakeTaskQueue::QueueOptions queue_options;
+    queue_options.input_batch_size_limit = 8;
+    queue_options.batch_timeout_micros = 1000;
+    queue_options.enable_large_batch_splitting = true;
+    queue_options.max_execution_batch_size = 4;
+    queue_options.split_input_task_func =
+        [](std::unique_ptr<FakeTask>* input_task, int first_output_task_size,
+           int max_batch_size,
+           std::vector<std::unique_ptr<FakeTask>>* output_tasks) {
+          const int version = (*input_task)->version();
+          int remaining = (*input_task)->size();
+          int output_task_size = first_output_task_size;
+          while (remaining > 0) {
+            output_task_size = std::min(output_task_size, remaining);
+            output_tasks->emplace_back(
+                new FakeTask(output_task_size, version));
+            remaining -= output_task_size;
+            output_task_size = max_batch_size;
+          }
+          input_task->reset();
+          return Status::OK();
+        };
+    std::shared_ptr<FakeTaskQueue> queue;
+    TF_ASSERT_OK(FakeTaskQueue::Create(
+        queue_options, SharedQueueCreator(CreateSharedScheduler()),
+        /*num_sub_batch_threads=*/1, &queue));
+    std::unique_ptr<BatchScheduler<FakeTask>> stable;
+    TF_ASSERT_OK(
+        FakeTaskQueue::AddMember(queue, recorder.Callback(1), &stable));
+    std::unique_ptr<BatchScheduler<FakeTask>> canary;
+    TF_ASSERT_OK(
+        FakeTaskQueue::AddMember(queue, recorder.Callback(2), &canary));
+
+    std::unique_ptr<FakeTask> stable_task(new FakeTask(1, 1));
+    TF_ASSERT_OK(stable->Schedule(&stable_task));
+    std::unique_ptr<FakeTask> canary_task(new FakeTask(6, 2));
+    TF_ASSERT_OK(canary->Schedule(&canary_task));
+  }
+  EXPECT_EQ(std::vector<size_t>({1}), recorder.sub_batch_sizes(1));
+  std::vector<size_t> canary_sizes = recorder.sub_batch_sizes(2);
+  std::sort(canary_sizes.begin(), canary_sizes.end());
+  EXPECT_EQ(std::vector<size_t>({3, 3}), canary_sizes);
+}
+
+TEST(CrossVersionBatchQueueTest, SubBatchesRunInParallel) {
+  // Each sub-batch waits for the other one to start, which only happens if
+  // they run in parallel.
+  BlockingCounter sub_batches_started(2);
+  const auto callback = [&sub_batches_started](
+                            std::unique_ptr<Batch<FakeTask>> batch) {
+    sub_batches_started.DecrementCount();
+    EXPECT_TRUE(sub_batches_started.WaitFor(std::chrono::seconds(10)));
+  };
+  {
+    FakeTaskQueue::QueueOptions queue_options;
+    queue_options.input_batch_size_limit = 2;
+    queue_options.batch_timeout_micros = 10 * 1000 * 1000;  // won't trigger
+    std::shared_ptr<FakeTaskQueue> queue;
+    TF_ASSERT_OK(FakeTaskQueue::Create(
+        queue_options, SharedQueueCreator(CreateSharedScheduler()),
+        /*num_sub_batch_threads=*/1, &queue));
+    std::unique_ptr<BatchScheduler<FakeTask>> stable;
+    TF_ASSERT_OK(FakeTaskQueue::AddMember(queue, callback, &stable));
+    std::unique_ptr<BatchScheduler<FakeTask>> canary;
+    TF_ASSERT_OK(FakeTaskQueue::AddMember(queue, callback, &canary));
+
+    std::unique_ptr<FakeTask> stable_task(new FakeTask(1, 1));
+    TF_ASSERT_OK(stable->Schedule(&stable_task));
+    std::unique_ptr<FakeTask> canary_task(new FakeTask(1, 2));
+    TF_ASSERT_OK(canary->Schedule(&canary_task));
+  }
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,194 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/batching/latency_tuned_batch_scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace tensorflow {
+namespace serving {
+namespace internal {
+
+namespace {
+
+// Weight of the latest measurement in the moving averages.
+constexpr double kMovingAverageWeight = 0.2;
+
+// Relative throughput difference under which the candidate with the lowest
+// latency is preferred.
+constexpr double kThroughputTolerance = 0.05;
+
+double UpdateMovingAverage(double average, double value) {
+  return average + kMovingAverageWeight * (value - average);
+}
+
+}  // namespace
+
+Status BatchingLatencyTuner::Create(
+    const Options& options, std::unique_ptr<BatchingLatencyTuner>* result) {
+  if (options.target_latency_micros <= 0) {
+    return errors::InvalidArgument(
+        "target_latency_micros must be positive; was ",
+        options.target_latency_micros);
+  }
+  if (options.max_batch_timeout_micros < 0) {
+    return errors::InvalidArgument(
+        "max_batch_timeout_micros must be non-negative; was ",
+        options.max_batch_timeout_micros);
+  }
+  if (options.num_batch_threads < 1) {
+    return errors::InvalidArgument("num_batch_threads must be positive; was ",
+                                   options.num_batch_threads);
+  }
+  if (options.batch_sizes.empty() || options.batch_sizes.front() < 1) {
+    return errors::InvalidArgument(
+        "batch_sizes must be non-empty and positive");
+  }
+  for (int i = 1; i < options.batch_sizes.size(); ++i) {
+    if (options.batch_sizes[i] <= options.batch_sizes[i - 1]) {
+      return errors::InvalidArgument(
+          "batch_sizes entries must be in increasing order");
+    }
+  }
+  result->reset(new BatchingLatencyTuner(options));
+  return Status::OK();
+}
+
+BatchingLatencyTuner::BatchingLatencyTuner(const Options& options)
+    : options_(options), processing_micros_(options.batch_sizes.size(), -1) {}
+
+void BatchingLatencyTuner::RecordArrival(size_t task_size, uint64 now_micros) {
+  if (!has_window_) {
+    window_begin_micros_ = now_micros;
+    has_window_ = true;
+  }
+  window_arrived_size_ += task_size;
+}
+
+void BatchingLatencyTuner::RecordBatch(size_t batch_size,
+                                       int64 processing_micros) {
+  double& average = processing_micros_[BatchSizeIndex(batch_size)];
+  const double micros = std::max<int64>(processing_micros, 0);
+  average = average < 0 ? micros : UpdateMovingAverage(average, micros);
+  has_processing_micros_ = true;
+}
+
+BatchingLatencyTuner::Decision BatchingLatencyTuner::Tune(uint64 now_micros) {
+  if (has_window_ && now_micros > window_begin_micros_) {
+    const double rate = static_cast<double>(window_arrived_size_) /
+                        (now_micros - window_begin_micros_);
+    arrival_rate_ =
+        has_arrival_rate_ ? UpdateMovingAverage(arrival_rate_, rate) : rate;
+    has_arrival_rate_ = true;
+  }
+  window_begin_micros_ = now_micros;
+  window_arrived_size_ = 0;
+  has_window_ = true;
+
+  const int num_batch_sizes = options_.batch_sizes.size();
+  Decision best = {options_.batch_sizes.back(),
+                   options_.max_batch_timeout_micros};
+  if (!has_processing_micros_) {
+    return best;
+  }
+
+  bool best_meets_target = false;
+  double best_throughput = -1;
+  double best_latency_micros = 0;
+  for (int i = 0; i < num_batch_sizes; ++i) {
+    const int batch_size = options_.batch_sizes[i];
+    const double processing_micros = EstimatedProcessingMicros(i);
+
+    // Time to collect 'batch_size' units of work after the first one.
+    double timeout_micros = options_.max_batch_timeout_micros;
+    if (arrival_rate_ > 0) {
+      timeout_micros =
+          std::min(timeout_micros, (batch_size - 1) / arrival_rate_);
+    }
+    const double latency_budget_micros =
+        options_.target_latency_micros - processing_micros;
+    if (latency_budget_micros >= 0) {
+      timeout_micros = std::min(timeout_micros, latency_budget_micros);
+    }
+
+    // The batches actually formed are smaller if the timeout expires first.
+    const double formed_batch_size =
+        std::min<double>(batch_size, 1 + arrival_rate_ * timeout_micros);
+    const double formed_processing_micros = std::max(
+        EstimatedProcessingMicros(BatchSizeIndex(
+            static_cast<size_t>(std::ceil(formed_batch_size)))),
+        1.0);
+    const double throughput = options_.num_batch_threads * formed_batch_size /
+                              formed_processing_micros;
+    const double latency_micros = timeout_micros + processing_micros;
+    const bool meets_target =
+        latency_budget_micros >= 0 && throughput >= arrival_rate_;
+
+    bool is_better;
+    if (best_throughput < 0 || meets_target != best_meets_target) {
+      is_better = best_throughput < 0 || meets_target;
+    } else if (throughput > best_throughput * (1 + kThroughputTolerance)) {
+      is_better = true;
+    } else {
+      is_better = throughput >= best_throughput * (1 - kThroughputTolerance) &&
+                  latency_micros < best_latency_micros;
+    }
+    if (is_better) {
+      best = {batch_size, static_cast<int64>(timeout_micros)};
+      best_meets_target = meets_target;
+      best_throughput = throughput;
+      best_latency_micros = latency_micros;
+    }
+  }
+  return best;
+}
+
+int BatchingLatencyTuner::BatchSizeIndex(size_t batch_size) const {
+  const auto it = std::lower_bound(options_.batch_sizes.begin(),
+                                   options_.batch_sizes.end(),
+                                   static_cast<int>(batch_size));
+  if (it == options_.batch_sizes.end()) {
+    return options_.batch_sizes.size() - 1;
+  }
+  return it - options_.batch_sizes.begin();
+}
+
+double BatchingLatencyTuner::EstimatedProcessingMicros(int index) const {
+  if (processing_micros_[index] >= 0) {
+    return processing_micros_[index];
+  }
+  // Closest measured size, preferring the smaller one.
+  int closest = -1;
+  for (int distance = 1; closest < 0; ++distance) {
+    if (index - distance >= 0 && processing_micros_[index - distance] >= 0) {
+      closest = index - distance;
+    } else if (index + distance < processing_micros_.size() &&
+               processing_micros_[index + distance] >= 0) {
+      closest = index + distance;
+    }
+  }
+  if (closest > index) {
+    // Assume smaller batches are not faster.
+    return processing_micros_[closest];
+  }
+  // Assume the processing time grows linearly with the batch size.
+  return processing_micros_[closest] * options_.batch_sizes[index] /
+         options_.batch_sizes[closest];
+}
+
+}  // namespace internal
+}  // namespace serving
+}  // namespace tensorflow
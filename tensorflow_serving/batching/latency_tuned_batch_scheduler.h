@@ -0,0 +1,437 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_BATCHING_LATENCY_TUNED_BATCH_SCHEDULER_H_
+#define TENSORFLOW_SERVING_BATCHING_LATENCY_TUNED_BATCH_SCHEDULER_H_
+
+#include <stddef.h>
+
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "tensorflow/core/kernels/batching_util/batch_scheduler.h"
+#include "tensorflow/core/kernels/batching_util/shared_batch_scheduler.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace serving {
+namespace internal {
+
+// Chooses the batch size and batch timeout of a batch scheduler queue from
+// online measurements of the task arrival rate and of the processing time of
+// each batch size.
+//
+// For each candidate batch size B, the timeout is the expected time to collect
+// B units of work after the first one, capped by the latency left after
+// processing a batch of size B. The latency of a task is then bounded by
+// timeout + processing time, which is used as a (conservative) estimate of the
+// 99th percentile latency. Among the candidates that meet the latency target
+// and whose batches are processed faster than the work arrives, the one with
+// the highest throughput is chosen, and the one with the lowest latency among
+// those of similar throughput. If there is none, the candidate with the highest
+// throughput is chosen regardless of the target, since the queue would grow
+// without bound otherwise.
+//
+// Not thread-safe.
+class BatchingLatencyTuner {
+ public:
+  struct Options {
+    // The latency target for the 99th percentile of queuing plus processing
+    // time, in microseconds.
+    int64 target_latency_micros = 0;
+
+    // The batch sizes to choose from, in increasing order.
+    std::vector<int> batch_sizes;
+
+    // The largest batch timeout to choose, in microseconds.
+    int64 max_batch_timeout_micros = 0;
+
+    // The number of batches that can be processed concurrently.
+    int num_batch_threads = 1;
+  };
+
+  // The tuned queue parameters.
+  struct Decision {
+    int batch_size;
+    int64 batch_timeout_micros;
+
+    bool operator==(const Decision& other) const {
+      return batch_size == other.batch_size &&
+             batch_timeout_micros == other.batch_timeout_micros;
+    }
+  };
+
+  static Status Create(const Options& options,
+                       std::unique_ptr<BatchingLatencyTuner>* result);
+
+  // Records the arrival of a task of size 'task_size' at 'now_micros'.
+  void RecordArrival(size_t task_size, uint64 now_micros);
+
+  // Records that processing a batch of size 'batch_size' took
+  // 'processing_micros'.
+  void RecordBatch(size_t batch_size, int64 processing_micros);
+
+  // Returns the best parameters given the measurements so far, and starts a
+  // new arrival rate measurement window. Until at least one batch has been
+  // recorded, returns the largest batch size and timeout.
+  Decision Tune(uint64 now_micros);
+
+ private:
+  explicit BatchingLatencyTuner(const Options& options);
+
+  // Returns the index of the smallest candidate batch size >= 'batch_size',
+  // or of the largest one if there is none.
+  int BatchSizeIndex(size_t batch_size) const;
+
+  // Returns the estimated processing time of a batch of size
+  // 'options_.batch_sizes[index]'. Sizes without measurements are extrapolated
+  // from the closest measured size. Requires at least one measurement.
+  double EstimatedProcessingMicros(int index) const;
+
+  const Options options_;
+
+  // Exponential moving average of the processing time of each candidate batch
+  // size; negative if not measured yet.
+  std::vector<double> processing_micros_;
+  bool has_processing_micros_ = false;
+
+  // Exponential moving average of the arrived work per microsecond, across
+  // measurement windows.
+  double arrival_rate_ = 0;
+  bool has_arrival_rate_ = false;
+
+  // The current arrival rate measurement window, started by the first arrival
+  // or the last tuning.
+  bool has_window_ = false;
+  uint64 window_begin_micros_ = 0;
+  uint64 window_arrived_size_ = 0;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(BatchingLatencyTuner);
+};
+
+}  // namespace internal
+
+// A BatchScheduler backed by a SharedBatchScheduler queue, whose batch timeout
+// (and, with large batch splitting, execution batch size) are tuned online to
+// maximize throughput while meeting a latency target. The queue options given
+// at creation act as upper bounds.
+//
+// The arrival rate is measured in Schedule(), and the processing time of each
+// batch around the process-batch callback. Every 'num_batches_per_tuning'
+// batches, the parameters are re-tuned (see internal::BatchingLatencyTuner).
+// Since the options of a SharedBatchScheduler queue are fixed, new parameters
+// are applied by adding a new queue and retiring the previous one, which
+// finishes processing its tasks in the background. Retired queues are destroyed
+// on a thread of 'Options.env', not on the thread calling Schedule().
+//
+// Without large batch splitting, the input batch size limit is kept as is (a
+// lower limit would reject large tasks), and the tuned batch size is only
+// reached through the timeout.
+template <typename TaskType>
+class LatencyTunedBatchScheduler : public BatchScheduler<TaskType> {
+ public:
+  struct Options {
+    // The latency target for the 99th percentile of queuing plus processing
+    // time, in microseconds. Must be positive.
+    int64 target_latency_micros = 0;
+
+    // The batch sizes to choose from, in increasing order (e.g. the allowed
+    // batch sizes of a BatchingSession). If empty, the powers of two below the
+    // maximum batch size, and the maximum batch size itself.
+    std::vector<int> batch_sizes;
+
+    // The number of batch threads of the shared batch scheduler.
+    int num_batch_threads = 1;
+
+    // The number of processed batches between two tunings.
+    int num_batches_per_tuning = 64;
+
+    // The environment to use for time, and for the threads destroying the
+    // retired queues.
+    Env* env = Env::Default();
+  };
+
+  static Status Create(
+      const Options& options,
+      std::shared_ptr<SharedBatchScheduler<TaskType>> shared_scheduler,
+      const typename SharedBatchScheduler<TaskType>::QueueOptions&
+          queue_options,
+      std::function<void(std::unique_ptr<Batch<TaskType>>)>
+          process_batch_callback,
+      std::unique_ptr<LatencyTunedBatchScheduler<TaskType>>* result);
+
+  ~LatencyTunedBatchScheduler() override;
+
+  Status Schedule(std::unique_ptr<TaskType>* task) override;
+  size_t NumEnqueuedTasks() const override;
+  size_t SchedulingCapacity() const override;
+  size_t max_task_size() const override;
+
+ private:
+  LatencyTunedBatchScheduler(
+      const Options& options,
+      std::shared_ptr<SharedBatchScheduler<TaskType>> shared_scheduler,
+      const typename SharedBatchScheduler<TaskType>::QueueOptions&
+          queue_options,
+      std::function<void(std::unique_ptr<Batch<TaskType>>)>
+          process_batch_callback,
+      std::unique_ptr<internal::BatchingLatencyTuner> tuner);
+
+  // Adds a queue applying 'decision' to 'queue_options_'.
+  Status AddQueue(const internal::BatchingLatencyTuner::Decision& decision,
+                  std::shared_ptr<BatchScheduler<TaskType>>* queue);
+
+  // Processes 'batch', and records its processing time.
+  void ProcessBatch(std::unique_ptr<Batch<TaskType>> batch);
+
+  // Destroys 'queue' in the background.
+  void DestroyQueue(std::shared_ptr<BatchScheduler<TaskType>> queue);
+
+  const Options options_;
+  const std::shared_ptr<SharedBatchScheduler<TaskType>> shared_scheduler_;
+  const typename SharedBatchScheduler<TaskType>::QueueOptions queue_options_;
+  const std::function<void(std::unique_ptr<Batch<TaskType>>)>
+      process_batch_callback_;
+
+  mutable mutex mu_;
+  std::unique_ptr<internal::BatchingLatencyTuner> tuner_ TF_GUARDED_BY(mu_);
+  internal::BatchingLatencyTuner::Decision decision_ TF_GUARDED_BY(mu_);
+  int num_batches_since_tuning_ TF_GUARDED_BY(mu_) = 0;
+
+  // The queue receiving new tasks.
+  std::shared_ptr<BatchScheduler<TaskType>> queue_ TF_GUARDED_BY(mu_);
+
+  // The queue replaced by the last tuning, if any. It is destroyed (which waits
+  // until it is empty) when replaced by the next one, by then long drained.
+  std::shared_ptr<BatchScheduler<TaskType>> retired_queue_ TF_GUARDED_BY(mu_);
+
+  // The number of queues being destroyed by DestroyQueue(). Not guarded by
+  // 'mu_', which the batches of these queues take.
+  mutex destroy_mu_;
+  condition_variable queue_destroyed_;
+  int num_queues_being_destroyed_ TF_GUARDED_BY(destroy_mu_) = 0;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(LatencyTunedBatchScheduler);
+};
+
+//////////
+// Implementation details follow. API users need not read.
+
+template <typename TaskType>
+Status LatencyTunedBatchScheduler<TaskType>::Create(
+    const Options& options,
+    std::shared_ptr<SharedBatchScheduler<TaskType>> shared_scheduler,
+    const typename SharedBatchScheduler<TaskType>::QueueOptions& queue_options,
+    std::function<void(std::unique_ptr<Batch<TaskType>>)>
+        process_batch_callback,
+    std::unique_ptr<LatencyTunedBatchScheduler<TaskType>>* result) {
+  if (options.num_batches_per_tuning < 1) {
+    return errors::InvalidArgument(
+        "num_batches_per_tuning must be positive; was ",
+        options.num_batches_per_tuning);
+  }
+  const int max_batch_size = queue_options.enable_large_batch_splitting
+                                 ? queue_options.max_execution_batch_size
+                                 : queue_options.input_batch_size_limit;
+  internal::BatchingLatencyTuner::Options tuner_options;
+  tuner_options.target_latency_micros = options.target_latency_micros;
+  tuner_options.max_batch_timeout_micros = queue_options.batch_timeout_micros;
+  tuner_options.num_batch_threads = options.num_batch_threads;
+  tuner_options.batch_sizes = options.batch_sizes;
+  if (tuner_options.batch_sizes.empty()) {
+    for (int batch_size = 1; batch_size < max_batch_size; batch_size *= 2) {
+      tuner_options.batch_sizes.push_back(batch_size);
+    }
+    tuner_options.batch_sizes.push_back(max_batch_size);
+  } else if (tuner_options.batch_sizes.back() > max_batch_size) {
+    return errors::InvalidArgument(
+        "The largest batch size to choose from must not exceed the maximum "
+        "batch size of the queue; was ",
+        tuner_options.batch_sizes.back(), "; maximum is ", max_batch_size);
+  }
+  std::unique_ptr<internal::BatchingLatencyTuner> tuner;
+  TF_RETURN_IF_ERROR(
+      internal::BatchingLatencyTuner::Create(tuner_options, &tuner));
+
+  std::unique_ptr<LatencyTunedBatchScheduler<TaskType>> scheduler(
+      new LatencyTunedBatchScheduler<TaskType>(
+          options, std::move(shared_scheduler), queue_options,
+          std::move(process_batch_callback), std::move(tuner)));
+  {
+    mutex_lock l(scheduler->mu_);
+    scheduler->decision_ = {max_batch_size, queue_options.batch_timeout_micros};
+    TF_RETURN_IF_ERROR(
+        scheduler->AddQueue(scheduler->decision_, &scheduler->queue_));
+  }
+  *result = std::move(scheduler);
+  return Status::OK();
+}
+
+template <typename TaskType>
+LatencyTunedBatchScheduler<TaskType>::~LatencyTunedBatchScheduler() {
+  // Wait for the queues to be empty while the members used by ProcessBatch()
+  // are still alive.
+  std::shared_ptr<BatchScheduler<TaskType>> queue;
+  std::shared_ptr<BatchScheduler<TaskType>> retired_queue;
+  {
+    mutex_lock l(mu_);
+    queue = std::move(queue_);
+    retired_queue = std::move(retired_queue_);
+  }
+  queue.reset();
+  retired_queue.reset();
+  mutex_lock l(destroy_mu_);
+  while (num_queues_being_destroyed_ > 0) {
+    queue_destroyed_.wait(l);
+  }
+}
+
+template <typename TaskType>
+Status LatencyTunedBatchScheduler<TaskType>::Schedule(
+    std::unique_ptr<TaskType>* task) {
+  std::shared_ptr<BatchScheduler<TaskType>> queue;
+  std::shared_ptr<BatchScheduler<TaskType>> queue_to_destroy;
+  {
+    mutex_lock l(mu_);
+    tuner_->RecordArrival((*task)->size(), options_.env->NowMicros());
+    if (num_batches_since_tuning_ >= options_.num_batches_per_tuning) {
+      num_batches_since_tuning_ = 0;
+      internal::BatchingLatencyTuner::Decision decision =
+          tuner_->Tune(options_.env->NowMicros());
+      if (!queue_options_.enable_large_batch_splitting) {
+        // Only the timeout can be applied.
+        decision.batch_size = decision_.batch_size;
+      }
+      std::shared_ptr<BatchScheduler<TaskType>> tuned_queue;
+      if (!(decision == decision_) && AddQueue(decision, &tuned_queue).ok()) {
+        VLOG(1) << "Tuned batching to batch size " << decision.batch_size
+                << " and batch timeout " << decision.batch_timeout_micros
+                << " micros";
+        decision_ = decision;
+        queue_to_destroy = std::move(retired_queue_);
+        retired_queue_ = std::move(queue_);
+        queue_ = std::move(tuned_queue);
+      }
+    }
+    queue = queue_;
+  }
+  if (queue_to_destroy != nullptr) {
+    // Destroying a queue waits for the batches it is processing, which record
+    // their processing time under 'mu_'.
+    DestroyQueue(std::move(queue_to_destroy));
+  }
+  return queue->Schedule(task);
+}
+
+template <typename TaskType>
+size_t LatencyTunedBatchScheduler<TaskType>::NumEnqueuedTasks() const {
+  mutex_lock l(mu_);
+  size_t num_enqueued_tasks = queue_->NumEnqueuedTasks();
+  if (retired_queue_ != nullptr) {
+    num_enqueued_tasks += retired_queue_->NumEnqueuedTasks();
+  }
+  return num_enqueued_tasks;
+}
+
+template <typename TaskType>
+size_t LatencyTunedBatchScheduler<TaskType>::SchedulingCapacity() const {
+  mutex_lock l(mu_);
+  return queue_->SchedulingCapacity();
+}
+
+template <typename TaskType>
+size_t LatencyTunedBatchScheduler<TaskType>::max_task_size() const {
+  mutex_lock l(mu_);
+  return queue_->max_task_size();
+}
+
+template <typename TaskType>
+LatencyTunedBatchScheduler<TaskType>::LatencyTunedBatchScheduler(
+    const Options& options,
+    std::shared_ptr<SharedBatchScheduler<TaskType>> shared_scheduler,
+    const typename SharedBatchScheduler<TaskType>::QueueOptions& queue_options,
+    std::function<void(std::unique_ptr<Batch<TaskType>>)>
+        process_batch_callback,
+    std::unique_ptr<internal::BatchingLatencyTuner> tuner)
+    : options_(options),
+      shared_scheduler_(std::move(shared_scheduler)),
+      queue_options_(queue_options),
+      process_batch_callback_(std::move(process_batch_callback)),
+      tuner_(std::move(tuner)) {}
+
+template <typename TaskType>
+Status LatencyTunedBatchScheduler<TaskType>::AddQueue(
+    const internal::BatchingLatencyTuner::Decision& decision,
+    std::shared_ptr<BatchScheduler<TaskType>>* queue) {
+  typename SharedBatchScheduler<TaskType>::QueueOptions queue_options =
+      queue_options_;
+  queue_options.batch_timeout_micros = decision.batch_timeout_micros;
+  if (queue_options.enable_large_batch_splitting) {
+    queue_options.max_execution_batch_size = decision.batch_size;
+  }
+  std::unique_ptr<BatchScheduler<TaskType>> added_queue;
+  TF_RETURN_IF_ERROR(shared_scheduler_->AddQueue(
+      queue_options,
+      [this](std::unique_ptr<Batch<TaskType>> batch) {
+        ProcessBatch(std::move(batch));
+      },
+      &added_queue));
+  *queue = std::move(added_queue);
+  return Status::OK();
+}
+
+template <typename TaskType>
+void LatencyTunedBatchScheduler<TaskType>::ProcessBatch(
+    std::unique_ptr<Batch<TaskType>> batch) {
+  // Batches of a SharedBatchScheduler are closed when handed out, so their
+  // size is final.
+  const size_t batch_size = batch->size();
+  const uint64 start_micros = options_.env->NowMicros();
+  process_batch_callback_(std::move(batch));
+  const uint64 end_micros = options_.env->NowMicros();
+
+  mutex_lock l(mu_);
+  tuner_->RecordBatch(batch_size, end_micros - start_micros);
+  ++num_batches_since_tuning_;
+}
+
+template <typename TaskType>
+void LatencyTunedBatchScheduler<TaskType>::DestroyQueue(
+    std::shared_ptr<BatchScheduler<TaskType>> queue) {
+  {
+    mutex_lock l(destroy_mu_);
+    ++num_queues_being_destroyed_;
+  }
+  options_.env->SchedClosure([this, queue = std::move(queue)]() mutable {
+    queue.reset();
+    mutex_lock l(destroy_mu_);
+    --num_queues_being_destroyed_;
+    queue_destroyed_.notify_all();
+  });
+}
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_BATCHING_LATENCY_TUNED_BATCH_SCHEDULER_H_
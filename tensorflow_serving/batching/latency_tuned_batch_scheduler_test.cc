@@ -0,0 +1,180 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/batching/latency_tuned_batch_scheduler.h"
+
+#include <memory>
+
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+using internal::BatchingLatencyTuner;
+
+class FakeTask : public BatchTask {
+ public:
+  explicit FakeTask(size_t size) : size_(size) {}
+
+  ~FakeTask() override = default;
+
+  size_t size() const override { return size_; }
+
+ private:
+  const size_t size_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(FakeTask);
+};
+
+BatchingLatencyTuner::Options TunerOptions() {
+  BatchingLatencyTuner::Options options;
+  options.target_latency_micros = 10 * 1000;
+  options.batch_sizes = {1, 2, 4, 8};
+  options.max_batch_timeout_micros = 5 * 1000;
+  options.num_batch_threads = 1;
+  return options;
+}
+
+// Records 'num_tasks' tasks of size 1 evenly spread over [0, 10ms), and
+// processing times of 1ms for batches of size 1 and 2ms for batches of size 8.
+std::unique_ptr<BatchingLatencyTuner> CreateMeasuredTuner(int num_tasks) {
+  std::unique_ptr<BatchingLatencyTuner> tuner;
+  TF_CHECK_OK(BatchingLatencyTuner::Create(TunerOptions(), &tuner));
+  for (int i = 0; i < num_tasks; ++i) {
+    tuner->RecordArrival(1, i * 10 * 1000 / num_tasks);
+  }
+  tuner->RecordBatch(1, 1000);
+  tuner->RecordBatch(8, 2000);
+  return tuner;
+}
+
+TEST(BatchingLatencyTunerTest, InvalidOptions) {
+  std::unique_ptr<BatchingLatencyTuner> tuner;
+  BatchingLatencyTuner::Options options = TunerOptions();
+  options.target_latency_micros = 0;
+  EXPECT_FALSE(BatchingLatencyTuner::Create(options, &tuner).ok());
+
+  options = TunerOptions();
+  options.batch_sizes = {};
+  EXPECT_FALSE(BatchingLatencyTuner::Create(options, &tuner).ok());
+
+  options = TunerOptions();
+  options.batch_sizes = {4, 2};  // Not sorted.
+  EXPECT_FALSE(BatchingLatencyTuner::Create(options, &tuner).ok());
+}
+
+TEST(BatchingLatencyTunerTest, NoMeasurements) {
+  std::unique_ptr<BatchingLatencyTuner> tuner;
+  TF_ASSERT_OK(BatchingLatencyTuner::Create(TunerOptions(), &tuner));
+  const BatchingLatencyTuner::Decision decision = tuner->Tune(1000);
+  EXPECT_EQ(8, decision.batch_size);
+  EXPECT_EQ(5 * 1000, decision.batch_timeout_micros);
+}
+
+TEST(BatchingLatencyTunerTest, HighTrafficUsesLargeBatches) {
+  // 20 tasks in 10ms: batches smaller than 4 cannot keep up, and batches of 8
+  // have the highest throughput. They take 3.5ms to fill.
+  std::unique_ptr<BatchingLatencyTuner> tuner = CreateMeasuredTuner(20);
+  const BatchingLatencyTuner::Decision decision = tuner->Tune(10 * 1000);
+  EXPECT_EQ(8, decision.batch_size);
+  EXPECT_EQ(3500, decision.batch_timeout_micros);
+}
+
+TEST(BatchingLatencyTunerTest, LowTrafficDisablesTimeout) {
+  // A single task in 10ms: waiting for more tasks does not pay off.
+  std::unique_ptr<BatchingLatencyTuner> tuner = CreateMeasuredTuner(1);
+  const BatchingLatencyTuner::Decision decision = tuner->Tune(10 * 1000);
+  EXPECT_EQ(1, decision.batch_size);
+  EXPECT_EQ(0, decision.batch_timeout_micros);
+}
+
+TEST(BatchingLatencyTunerTest, LatencyTargetBoundsTimeout) {
+  BatchingLatencyTuner::Options options = TunerOptions();
+  options.target_latency_micros = 3000;
+  std::unique_ptr<BatchingLatencyTuner> tuner;
+  TF_ASSERT_OK(BatchingLatencyTuner::Create(options, &tuner));
+  for (int i = 0; i < 20; ++i) {
+    tuner->RecordArrival(1, i * 500);
+  }
+  tuner->RecordBatch(1, 1000);
+  tuner->RecordBatch(8, 2000);
+  // Batches of 4 would take 1.5ms to fill, but only 1ms is left after
+  // processing them.
+  const BatchingLatencyTuner::Decision decision = tuner->Tune(10 * 1000);
+  EXPECT_EQ(4, decision.batch_size);
+  EXPECT_EQ(1000, decision.batch_timeout_micros);
+}
+
+TEST(LatencyTunedBatchSchedulerTest, ProcessesAllTasks) {
+  mutex mu;
+  int num_processed_tasks = 0;
+  auto callback = [&mu, &num_processed_tasks](
+                      std::unique_ptr<Batch<FakeTask>> batch) {
+    mutex_lock l(mu);
+    num_processed_tasks += batch->num_tasks();
+  };
+
+  {
+    SharedBatchScheduler<FakeTask>::Options scheduler_options;
+    scheduler_options.num_batch_threads = 2;
+    std::shared_ptr<SharedBatchScheduler<FakeTask>> shared_scheduler;
+    TF_ASSERT_OK(SharedBatchScheduler<FakeTask>::Create(scheduler_options,
+                                                         &shared_scheduler));
+
+    SharedBatchScheduler<FakeTask>::QueueOptions queue_options;
+    queue_options.input_batch_size_limit = 4;
+    queue_options.batch_timeout_micros = 1000;
+    LatencyTunedBatchScheduler<FakeTask>::Options options;
+    options.target_latency_micros = 10 * 1000;
+    options.num_batch_threads = 2;
+    // Re-tune (and replace the queue) as often as possible.
+    options.num_batches_per_tuning = 1;
+    std::unique_ptr<LatencyTunedBatchScheduler<FakeTask>> scheduler;
+    TF_ASSERT_OK(LatencyTunedBatchScheduler<FakeTask>::Create(
+        options, shared_scheduler, queue_options, callback, &scheduler));
+    EXPECT_EQ(4, scheduler->max_task_size());
+
+    for (int i = 0; i < 100; ++i) {
+      std::unique_ptr<FakeTask> task(new FakeTask(1));
+      TF_ASSERT_OK(scheduler->Schedule(&task));
+    }
+  }
+  EXPECT_EQ(100, num_processed_tasks);
+}
+
+TEST(LatencyTunedBatchSchedulerTest, BatchSizesAboveMaximumRejected) {
+  SharedBatchScheduler<FakeTask>::Options scheduler_options;
+  std::shared_ptr<SharedBatchScheduler<FakeTask>> shared_scheduler;
+  TF_ASSERT_OK(SharedBatchScheduler<FakeTask>::Create(scheduler_options,
+                                                       &shared_scheduler));
+  SharedBatchScheduler<FakeTask>::QueueOptions queue_options;
+  queue_options.input_batch_size_limit = 4;
+  LatencyTunedBatchScheduler<FakeTask>::Options options;
+  options.target_latency_micros = 10 * 1000;
+  options.batch_sizes = {2, 8};
+  std::unique_ptr<LatencyTunedBatchScheduler<FakeTask>> scheduler;
+  EXPECT_FALSE(LatencyTunedBatchScheduler<FakeTask>::Create(
+                   options, shared_scheduler, queue_options,
+                   [](std::unique_ptr<Batch<FakeTask>> batch) {}, &scheduler)
+                   .ok());
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
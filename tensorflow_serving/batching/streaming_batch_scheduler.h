@@ -18,9 +18,11 @@ limitations under the License.
 
 #include <stddef.h>
 #include <algorithm>
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 
 #include "tensorflow/core/kernels/batching_util/batch_scheduler.h"
@@ -76,6 +78,11 @@ namespace serving {
 // an active thread, or rejected with an UNAVAILABLE error (the client may
 // subsequently retry submitting the task).
 //
+// Tasks are added to the open batch without taking the scheduler's lock: each
+// call of Schedule() reserves room for its task with an atomic update of the
+// open batch's size, so concurrent callers only contend on the lock once per
+// batch, to start the next batch or to arm the timeout of the batch.
+//
 //
 // RECOMMENDED USE-CASES:
 //
@@ -177,9 +184,26 @@ class StreamingBatchScheduler : public BatchScheduler<TaskType> {
                           std::function<void(std::unique_ptr<Batch<TaskType>>)>
                               process_batch_callback);
 
-  // Determines whether it is legal to add 'task' to 'batch'.
-  bool TaskFitsInBatch(const TaskType* task,
-                       const Batch<TaskType>* batch) const;
+  // The layout of 'open_batch_state_': the size of the tasks added (or being
+  // added) to 'open_batch_' in the low bits, the number of Schedule() calls
+  // adding a task to it in the middle bits, and whether it is sealed, i.e.
+  // can't take more tasks, in the high bit.
+  static constexpr uint64 kSizeMask = (uint64{1} << 32) - 1;
+  static constexpr uint64 kOneWriter = uint64{1} << 32;
+  static constexpr uint64 kWritersMask = ((uint64{1} << 31) - 1) << 32;
+  static constexpr uint64 kSealed = uint64{1} << 63;
+
+  // Reserves room for a task of size 'task_size' in 'open_batch_', if it is
+  // open with enough room left. On success, the caller must add the task to
+  // '*batch' then call ReleaseOpenBatch(). '*batch_num' is the sequence number
+  // of the batch, and '*size_before' its size before the task.
+  bool ReserveInOpenBatch(size_t task_size, Batch<TaskType>** batch,
+                          int64* batch_num, size_t* size_before);
+  void ReleaseOpenBatch();
+
+  // Seals 'open_batch_' (unless it equals nullptr), waits for the tasks being
+  // added to it, and closes it. Doesn't replace it.
+  void CloseOpenBatch() TF_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
   // Closes 'open_batch_' (unless it equals nullptr), and replaces it with a
   // fresh open batch. Schedules the new batch on 'batch_threads_'.
@@ -200,22 +224,30 @@ class StreamingBatchScheduler : public BatchScheduler<TaskType> {
   // A pool of 'options_.num_batch_threads' batch threads.
   std::unique_ptr<thread::ThreadPool> batch_threads_;
 
-  // A mutex protecting 'open_batch_' and associated metadata.
+  // A mutex serializing the changes of 'open_batch_'.
   mutable mutex mu_;
 
   // The batch that is currently open and into which new tasks can be added.
   // Not owned here; owned by the batch thread pool.
-  Batch<TaskType>* open_batch_ TF_GUARDED_BY(mu_) = nullptr;
+  //
+  // 'open_batch_' and 'open_batch_num_' only change under 'mu_', while
+  // 'open_batch_state_' is sealed with no writers. They may be read under
+  // 'mu_', or by the writers of 'open_batch_state_'.
+  Batch<TaskType>* open_batch_ = nullptr;
 
   // The sequence number of 'open_batch_'. Incremented each time 'open_batch_'
   // is assigned to a new (non-null) batch object.
-  int64 open_batch_num_ TF_GUARDED_BY(mu_) = 0;
+  int64 open_batch_num_ = 0;
+
+  // The reserved size, writers and sealed bit of 'open_batch_' (see
+  // kSizeMask). Sealed until the first batch is started.
+  std::atomic<uint64> open_batch_state_{kSealed};
 
   // The number of batches "in progress", i.e. batches that have been started
   // but for which the process-batch callback hasn't finished. Note that this
   // counter is somewhat conservative (i.e. might be an overestimate), because
   // it gets decremented after the callback finishes and there could be races.
-  int num_batches_in_progress_ TF_GUARDED_BY(mu_) = 0;
+  std::atomic<int> num_batches_in_progress_{0};
 
   // A background task we use to schedule batches to close when they hit their
   // timeout.
@@ -299,6 +331,15 @@ class SingleTaskScheduler {
 
 }  // namespace internal
 
+template <typename TaskType>
+constexpr uint64 StreamingBatchScheduler<TaskType>::kSizeMask;
+template <typename TaskType>
+constexpr uint64 StreamingBatchScheduler<TaskType>::kOneWriter;
+template <typename TaskType>
+constexpr uint64 StreamingBatchScheduler<TaskType>::kWritersMask;
+template <typename TaskType>
+constexpr uint64 StreamingBatchScheduler<TaskType>::kSealed;
+
 template <typename TaskType>
 Status StreamingBatchScheduler<TaskType>::Create(
     const Options& options,
@@ -309,6 +350,10 @@ Status StreamingBatchScheduler<TaskType>::Create(
     return errors::InvalidArgument("max_batch_size must be positive; was ",
                                    options.max_batch_size);
   }
+  if (options.max_batch_size > kSizeMask) {
+    return errors::InvalidArgument("max_batch_size must be at most ",
+                                   kSizeMask, "; was ", options.max_batch_size);
+  }
   if (options.num_batch_threads <= 0) {
     return errors::InvalidArgument("num_batch_threads must be positive; was ",
                                    options.num_batch_threads);
@@ -323,7 +368,7 @@ StreamingBatchScheduler<TaskType>::~StreamingBatchScheduler() {
   {
     mutex_lock l(mu_);
     if (open_batch_ != nullptr) {
-      open_batch_->Close();
+      CloseOpenBatch();
       open_batch_ = nullptr;
       ++open_batch_num_;
     }
@@ -342,37 +387,52 @@ Status StreamingBatchScheduler<TaskType>::Schedule(
                                    options_.max_batch_size);
   }
 
-  {
+  const size_t task_size = (*task)->size();
+  Batch<TaskType>* batch;
+  int64 batch_num;
+  size_t size_before;
+  // Given N threads, if there are N+1 batches then the N+1st batch is empty
+  // and is waiting to be assigned a thread. In that situation we reject new
+  // tasks with a transient UNAVAILABLE error code.
+  if (num_batches_in_progress_.load(std::memory_order_relaxed) >
+          options_.num_batch_threads ||
+      !ReserveInOpenBatch(task_size, &batch, &batch_num, &size_before)) {
     mutex_lock l(mu_);
-
-    if (open_batch_ == nullptr || !TaskFitsInBatch(task->get(), open_batch_)) {
+    for (;;) {
+      if (num_batches_in_progress_.load(std::memory_order_relaxed) >
+          options_.num_batch_threads) {
+        return errors::Unavailable(
+            "This task would start a fresh batch, but all batch threads are "
+            "busy, so at present there is no processing capacity available "
+            "for this task");
+      }
+      if (ReserveInOpenBatch(task_size, &batch, &batch_num, &size_before)) {
+        break;
+      }
+      // The open batch is full, or there is none yet.
       StartNewBatch();
     }
+  }
 
-    // Given N threads, if there are N+1 batches then the N+1st batch is empty
-    // and is waiting to be assigned a thread. In that situation we reject new
-    // tasks with a transient UNAVAILABLE error code.
-    if (num_batches_in_progress_ > options_.num_batch_threads) {
-      DCHECK(open_batch_->empty());
-      return errors::Unavailable(
-          "This task would start a fresh batch, but all batch threads are "
-          "busy, so at present there is no processing capacity available for "
-          "this task");
-    }
-
-    // If we are about to add the first task to a batch, schedule the batch to
-    // be closed after the timeout.
-    if (options_.batch_timeout_micros > 0 && open_batch_->empty()) {
-      const uint64 batch_deadline =
-          options_.env->NowMicros() + options_.batch_timeout_micros;
-      ScheduleCloseOfCurrentOpenBatch(batch_deadline);
-    }
-
-    open_batch_->AddTask(std::move(*task));
+  batch->AddTask(std::move(*task));
+  ReleaseOpenBatch();
 
-    // If we've exactly reached the target size, we can close this batch now.
-    if (open_batch_->size() == options_.max_batch_size) {
-      StartNewBatch();
+  // If we've exactly reached the target size, we can close this batch now.
+  // Else if we've added the first task to the batch, schedule the batch to be
+  // closed after the timeout. Either is skipped if the batch has been closed
+  // meanwhile.
+  const bool batch_full = size_before + task_size == options_.max_batch_size;
+  if (batch_full ||
+      (options_.batch_timeout_micros > 0 && size_before == 0)) {
+    mutex_lock l(mu_);
+    if (open_batch_num_ == batch_num) {
+      if (batch_full) {
+        StartNewBatch();
+      } else {
+        const uint64 batch_deadline =
+            options_.env->NowMicros() + options_.batch_timeout_micros;
+        ScheduleCloseOfCurrentOpenBatch(batch_deadline);
+      }
     }
   }
 
@@ -381,15 +441,17 @@ Status StreamingBatchScheduler<TaskType>::Schedule(
 
 template <typename TaskType>
 size_t StreamingBatchScheduler<TaskType>::SchedulingCapacity() const {
-  mutex_lock l(mu_);
-  if (num_batches_in_progress_ > options_.num_batch_threads) {
+  const int num_batches_in_progress = num_batches_in_progress_.load();
+  if (num_batches_in_progress > options_.num_batch_threads) {
     return 0;
   }
   const int num_idle_threads =
-      options_.num_batch_threads - num_batches_in_progress_;
+      options_.num_batch_threads - num_batches_in_progress;
+  const uint64 state = open_batch_state_.load();
   const int open_batch_capacity =
-      open_batch_ == nullptr ? 0
-                             : options_.max_batch_size - open_batch_->size();
+      (state & kSealed) != 0
+          ? 0
+          : options_.max_batch_size - (state & kSizeMask);
   return (num_idle_threads * options_.max_batch_size) + open_batch_capacity;
 }
 
@@ -405,30 +467,61 @@ StreamingBatchScheduler<TaskType>::StreamingBatchScheduler(
                                             options_.num_batch_threads)) {}
 
 template <typename TaskType>
-bool StreamingBatchScheduler<TaskType>::TaskFitsInBatch(
-    const TaskType* task, const Batch<TaskType>* batch) const {
-  return batch->size() + task->size() <= options_.max_batch_size;
+bool StreamingBatchScheduler<TaskType>::ReserveInOpenBatch(
+    size_t task_size, Batch<TaskType>** batch, int64* batch_num,
+    size_t* size_before) {
+  uint64 state = open_batch_state_.load(std::memory_order_relaxed);
+  do {
+    if ((state & kSealed) != 0 ||
+        (state & kSizeMask) + task_size > options_.max_batch_size) {
+      return false;
+    }
+  } while (!open_batch_state_.compare_exchange_weak(
+      state, state + kOneWriter + task_size, std::memory_order_acquire,
+      std::memory_order_relaxed));
+
+  // The batch can't be replaced until ReleaseOpenBatch().
+  *batch = open_batch_;
+  *batch_num = open_batch_num_;
+  *size_before = state & kSizeMask;
+  return true;
 }
 
 template <typename TaskType>
-void StreamingBatchScheduler<TaskType>::StartNewBatch() {
+void StreamingBatchScheduler<TaskType>::ReleaseOpenBatch() {
+  open_batch_state_.fetch_sub(kOneWriter, std::memory_order_release);
+}
+
+template <typename TaskType>
+void StreamingBatchScheduler<TaskType>::CloseOpenBatch() {
+  uint64 state =
+      open_batch_state_.fetch_or(kSealed, std::memory_order_acquire);
+  // The writers only hold the batch to add their task to it.
+  while ((state & kWritersMask) != 0) {
+    std::this_thread::yield();
+    state = open_batch_state_.load(std::memory_order_acquire);
+  }
   if (open_batch_ != nullptr) {
     open_batch_->Close();
-    open_batch_ = nullptr;
   }
+}
+
+template <typename TaskType>
+void StreamingBatchScheduler<TaskType>::StartNewBatch() {
+  CloseOpenBatch();
+  open_batch_ = nullptr;
 
   Batch<TaskType>* new_open_batch = new Batch<TaskType>;
   ++num_batches_in_progress_;  // Critically, increment *outside* the callback.
   batch_threads_->Schedule([this, new_open_batch] {
     this->process_batch_callback_(
         std::unique_ptr<Batch<TaskType>>(new_open_batch));
-    {
-      mutex_lock l(this->mu_);
-      --this->num_batches_in_progress_;
-    }
+    --this->num_batches_in_progress_;
   });
   open_batch_ = new_open_batch;
   ++open_batch_num_;
+  // Unseals the new batch, once it is published to the writers.
+  open_batch_state_.store(0, std::memory_order_release);
 }
 
 template <typename TaskType>
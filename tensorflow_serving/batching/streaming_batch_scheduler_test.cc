@@ -261,6 +261,55 @@ TEST(StreamingBatchSchedulerTest, BatchHandedToCallbackWhenFirstCreated) {
   stop_scheduler.WaitForNotification();
 }
 
+TEST(StreamingBatchSchedulerTest, ConcurrentSchedule) {
+  // Set up a callback that sums up the batches' task sizes.
+  mutex mu;
+  size_t total_size = 0;
+  auto callback = [&mu, &total_size](std::unique_ptr<Batch<FakeTask>> batch) {
+    batch->WaitUntilClosed();
+    size_t batch_size = 0;
+    for (int i = 0; i < batch->num_tasks(); ++i) {
+      batch_size += batch->task(i).size();
+    }
+    EXPECT_EQ(batch_size, batch->size());
+    EXPECT_LE(batch_size, 10);
+    mutex_lock l(mu);
+    total_size += batch_size;
+  };
+
+  constexpr int kNumEnqueuers = 8;
+  constexpr int kNumTasksPerEnqueuer = 900;
+  {
+    StreamingBatchScheduler<FakeTask>::Options options;
+    options.max_batch_size = 10;
+    options.batch_timeout_micros = 1000;  // 1 millisecond
+    options.num_batch_threads = 4;
+    std::unique_ptr<StreamingBatchScheduler<FakeTask>> scheduler;
+    TF_ASSERT_OK(StreamingBatchScheduler<FakeTask>::Create(options, callback,
+                                                           &scheduler));
+
+    // Tasks of sizes 1 to 3 are added from several threads at once, retrying
+    // while the batch threads are busy.
+    std::vector<std::unique_ptr<Thread>> enqueuers;
+    for (int i = 0; i < kNumEnqueuers; ++i) {
+      enqueuers.emplace_back(Env::Default()->StartThread(
+          ThreadOptions(), "enqueuer", [&scheduler] {
+            for (int j = 0; j < kNumTasksPerEnqueuer; ++j) {
+              Status status;
+              do {
+                status = ScheduleTask(j % 3 + 1, scheduler.get());
+              } while (status.code() == error::UNAVAILABLE);
+              TF_EXPECT_OK(status);
+            }
+          }));
+    }
+    enqueuers.clear();
+  }
+
+  // Every task has been added to one batch, without overfilling it.
+  EXPECT_EQ(kNumEnqueuers * kNumTasksPerEnqueuer * 2, total_size);
+}
+
 TEST(StreamingBatchSchedulerTest, ConstMethods) {
   for (const int num_threads : {1, 2, 3}) {
     Notification proceed;
@@ -0,0 +1,97 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_BATCHING_TEST_UTIL_COST_MODEL_SESSION_H_
+#define TENSORFLOW_SERVING_BATCHING_TEST_UTIL_COST_MODEL_SESSION_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/threadpool_options.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow/core/protobuf/config.pb.h"
+#include "tensorflow_serving/servables/tensorflow/serving_session.h"
+
+namespace tensorflow {
+namespace serving {
+namespace test_util {
+
+// A Session whose Run() takes the time of a linear cost model of the batch
+// size, i.e. of the zeroth dimension of its first input, and returns that
+// input as each of the requested outputs.
+//
+// This session stands in for a model when the cost of the batching around it
+// is measured, e.g. by wrapping it in a BatchingSession.
+class CostModelSession : public ServingSession {
+ public:
+  CostModelSession(const int64 fixed_cost_micros,
+                   const int64 per_row_cost_micros)
+      : fixed_cost_micros_(fixed_cost_micros),
+        per_row_cost_micros_(per_row_cost_micros) {}
+  ~CostModelSession() override = default;
+
+  Status Run(const std::vector<std::pair<string, Tensor>>& inputs,
+             const std::vector<string>& output_tensor_names,
+             const std::vector<string>& target_node_names,
+             std::vector<Tensor>* outputs) override {
+    RunMetadata run_metadata;
+    return Run(RunOptions(), inputs, output_tensor_names, target_node_names,
+               outputs, &run_metadata);
+  }
+
+  Status Run(const RunOptions& run_options,
+             const std::vector<std::pair<string, Tensor>>& inputs,
+             const std::vector<string>& output_tensor_names,
+             const std::vector<string>& target_node_names,
+             std::vector<Tensor>* outputs, RunMetadata* run_metadata) override {
+    return Run(run_options, inputs, output_tensor_names, target_node_names,
+               outputs, run_metadata, thread::ThreadPoolOptions());
+  }
+
+  Status Run(const RunOptions& run_options,
+             const std::vector<std::pair<string, Tensor>>& inputs,
+             const std::vector<string>& output_tensor_names,
+             const std::vector<string>& target_node_names,
+             std::vector<Tensor>* outputs, RunMetadata* run_metadata,
+             const thread::ThreadPoolOptions& thread_pool_options) override {
+    if (inputs.empty() || inputs[0].second.dims() == 0) {
+      return errors::InvalidArgument(
+          "CostModelSession needs an input with a batch dimension");
+    }
+    const int64 batch_size = inputs[0].second.dim_size(0);
+    Env::Default()->SleepForMicroseconds(fixed_cost_micros_ +
+                                         per_row_cost_micros_ * batch_size);
+    outputs->assign(output_tensor_names.size(), inputs[0].second);
+    return Status::OK();
+  }
+
+  Status ListDevices(std::vector<DeviceAttributes>* response) override {
+    return errors::Unimplemented("ListDevices");
+  }
+
+ private:
+  const int64 fixed_cost_micros_;
+  const int64 per_row_cost_micros_;
+};
+
+}  // namespace test_util
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_BATCHING_TEST_UTIL_COST_MODEL_SESSION_H_
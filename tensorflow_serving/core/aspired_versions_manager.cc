@@ -16,9 +16,11 @@ limitations under the License.
 #include "tensorflow_serving/core/aspired_versions_manager.h"
 
 #include <algorithm>
+#include <chrono>
 #include <iterator>
 #include <map>
 #include <memory>
+#include <set>
 #include <unordered_set>
 #include <utility>
 #include <vector>
@@ -42,8 +44,19 @@ namespace {
 // safety, and cannot be implicitly cast to/from pointers by mistake.
 struct Aspired {
   bool is_aspired;
+  // The load priority and the summed estimated resources of the version, used
+  // to schedule its load if Options::schedule_loads is set.
+  int load_priority = 0;
+  uint64 estimated_resources = 0;
 };
 
+// Returns whether 'state' is one of a version whose load has been started.
+bool IsLoadInProgress(const LoaderHarness::State state) {
+  return state == LoaderHarness::State::kLoadRequested ||
+         state == LoaderHarness::State::kLoadApproved ||
+         state == LoaderHarness::State::kLoading;
+}
+
 // Decides which action amongst the 2 to take. We prefer an unload action over a
 // load action.
 //
@@ -158,45 +171,54 @@ Status AspiredVersionsManager::Create(
   basic_manager_options.max_num_load_retries = options.max_num_load_retries;
   basic_manager_options.load_retry_interval_micros =
       options.load_retry_interval_micros;
+  basic_manager_options.load_retry_backoff_multiplier =
+      options.load_retry_backoff_multiplier;
+  basic_manager_options.max_load_retry_interval_micros =
+      options.max_load_retry_interval_micros;
+  basic_manager_options.load_retry_jitter = options.load_retry_jitter;
+  basic_manager_options.release_load_threads_during_load_retries =
+      options.release_load_threads_during_load_retries;
   basic_manager_options.flush_filesystem_caches =
       options.flush_filesystem_caches;
   basic_manager_options.env = options.env;
   basic_manager_options.servable_event_bus = options.servable_event_bus;
   basic_manager_options.pre_load_hook = std::move(options.pre_load_hook);
+  basic_manager_options.post_unload_hook = std::move(options.post_unload_hook);
+  basic_manager_options.load_throttling = std::move(options.load_throttling);
   std::unique_ptr<BasicManager> basic_manager;
   TF_RETURN_IF_ERROR(
       BasicManager::Create(std::move(basic_manager_options), &basic_manager));
 
   manager->reset(new AspiredVersionsManager(
       options.manage_state_interval_micros, options.env,
-      std::move(options.aspired_version_policy), std::move(basic_manager)));
+      std::move(options.aspired_version_policy), std::move(basic_manager),
+      options.schedule_loads, std::move(options.load_priority)));
   (manager->get())->enable_reload_servables_with_error_ =
       options.enable_reload_servables_with_error;
+  (manager->get())->hot_standby_ = options.hot_standby;
   return Status::OK();
 }
 
 AspiredVersionsManager::AspiredVersionsManager(
     int64 manage_state_interval_micros, Env* env,
     std::unique_ptr<AspiredVersionPolicy> aspired_version_policy,
-    std::unique_ptr<BasicManager> basic_manager)
+    std::unique_ptr<BasicManager> basic_manager, const bool schedule_loads,
+    LoadPriority load_priority)
     : aspired_version_policy_(std::move(aspired_version_policy)),
       target_impl_(new internal::AspiredVersionsManagerTargetImpl(this)),
-      basic_manager_(std::move(basic_manager)) {
+      basic_manager_(std::move(basic_manager)),
+      schedule_loads_(schedule_loads),
+      load_priority_(std::move(load_priority)) {
   set_num_load_threads_observer_.reset(
       new Observer<const uint32>([this](const uint32 num_load_threads) {
         this->SetNumLoadThreads(num_load_threads);
       }));
   if (manage_state_interval_micros > 0) {
-    PeriodicFunction::Options pf_options;
-    pf_options.env = env;
-    pf_options.thread_name_prefix = "AspiredVersionsManager_ManageState_Thread";
-    manage_state_thread_.reset(new PeriodicFunction(
-        [this]() {
-          this->FlushServables();
-          this->HandlePendingAspiredVersionsRequests();
-          this->InvokePolicyAndExecuteAction();
-        },
-        manage_state_interval_micros));
+    manage_state_thread_.reset(env->StartThread(
+        ThreadOptions(), "AspiredVersionsManager_ManageState_Thread",
+        [this, manage_state_interval_micros]() {
+          this->ManageStateLoop(manage_state_interval_micros);
+        }));
   }
 }
 
@@ -205,10 +227,42 @@ AspiredVersionsManager::~AspiredVersionsManager() {
   // tearing down any other manager state.
   target_impl_.reset();
 
+  {
+    mutex_lock l(manage_state_mu_);
+    stop_manage_state_ = true;
+  }
+  manage_state_cv_.notify_all();
   // This will wait till the thread is joined.
   manage_state_thread_.reset();
 }
 
+void AspiredVersionsManager::ManageStateLoop(
+    const int64 manage_state_interval_micros) {
+  while (true) {
+    FlushServables();
+    HandlePendingAspiredVersionsRequests();
+    InvokePolicyAndExecuteAction();
+
+    mutex_lock l(manage_state_mu_);
+    if (!manage_state_requested_ && !stop_manage_state_) {
+      manage_state_cv_.wait_for(
+          l, std::chrono::microseconds(manage_state_interval_micros));
+    }
+    if (stop_manage_state_) {
+      return;
+    }
+    manage_state_requested_ = false;
+  }
+}
+
+void AspiredVersionsManager::RequestManageState() {
+  {
+    mutex_lock l(manage_state_mu_);
+    manage_state_requested_ = true;
+  }
+  manage_state_cv_.notify_all();
+}
+
 std::vector<ServableId> AspiredVersionsManager::ListAvailableServableIds()
     const {
   return basic_manager_->ListAvailableServableIds();
@@ -248,6 +302,7 @@ void AspiredVersionsManager::EnqueueAspiredVersionsRequest(
     pending_aspired_versions_requests_[string(servable_name)] =
         std::move(versions);
   }
+  RequestManageState();
 }
 
 void AspiredVersionsManager::ProcessAspiredVersionsRequest(
@@ -319,9 +374,24 @@ void AspiredVersionsManager::ProcessAspiredVersionsRequest(
 
     // if this aspired version is not already present in the map.
     if (should_add) {
+      std::unique_ptr<Aspired> aspired(new Aspired{true});
+      if (schedule_loads_) {
+        if (load_priority_) {
+          aspired->load_priority = load_priority_(version_id);
+        }
+        // Loaders are expected to memoize their estimate, which is needed
+        // again when the load is approved.
+        ResourceAllocation estimate;
+        if (version.status().ok() &&
+            version.DataOrDie()->EstimateResources(&estimate).ok()) {
+          for (const auto& entry : estimate.resource_quantities()) {
+            aspired->estimated_resources += entry.quantity();
+          }
+        }
+      }
       const Status manage_status =
           basic_manager_->ManageServableWithAdditionalState(
-              std::move(version), std::unique_ptr<Aspired>(new Aspired{true}));
+              std::move(version), std::move(aspired));
       DCHECK(manage_status.ok()) << manage_status.error_message();
       if (!manage_status.ok()) {
         LOG(ERROR) << "Internal error: Unable to transfer servable "
@@ -330,6 +400,10 @@ void AspiredVersionsManager::ProcessAspiredVersionsRequest(
       }
     }
   }
+
+  // E.g. to flip to the standby versions if the served one is not aspired
+  // anymore.
+  UpdateStandbyVersions(string(servable_name));
 }
 
 bool AspiredVersionsManager::ContainsAnyReaspiredVersions(
@@ -377,24 +451,161 @@ AspiredVersionsManager::GetNextAction() {
   return next_action;
 }
 
+std::vector<AspiredVersionPolicy::ServableAction>
+AspiredVersionsManager::GetScheduledActions() {
+  struct ScheduledLoad {
+    AspiredVersionPolicy::ServableAction action;
+    int priority;
+    uint64 estimated_resources;
+  };
+  std::vector<ScheduledLoad> loads;
+  int num_loads_in_progress = 0;
+  for (const string& servable_name :
+       basic_manager_->GetManagedServableNames()) {
+    std::vector<AspiredServableStateSnapshot> aspired_state_snapshots;
+    std::map<int64, Aspired> aspired_states;
+    for (const ServableStateSnapshot<Aspired>& state_snapshot :
+         basic_manager_->GetManagedServableStateSnapshots<Aspired>(
+             servable_name)) {
+      aspired_state_snapshots.push_back(
+          {state_snapshot.id, state_snapshot.state,
+           state_snapshot.additional_state->is_aspired});
+      aspired_states.emplace(state_snapshot.id.version,
+                             *state_snapshot.additional_state);
+      if (IsLoadInProgress(state_snapshot.state)) {
+        ++num_loads_in_progress;
+      }
+    }
+    const absl::optional<AspiredVersionPolicy::ServableAction> action =
+        aspired_version_policy_->GetNextAction(aspired_state_snapshots);
+    if (!action) {
+      continue;
+    }
+    if (action->action == AspiredVersionPolicy::Action::kUnload) {
+      VLOG(1) << "Taking action: " << action->DebugString();
+      return {*action};
+    }
+    const Aspired& aspired = aspired_states[action->id.version];
+    loads.push_back(
+        {*action, aspired.load_priority, aspired.estimated_resources});
+  }
+
+  std::sort(loads.begin(), loads.end(),
+            [](const ScheduledLoad& lhs, const ScheduledLoad& rhs) {
+              if (lhs.priority != rhs.priority) {
+                return lhs.priority > rhs.priority;
+              }
+              if (lhs.estimated_resources != rhs.estimated_resources) {
+                return lhs.estimated_resources < rhs.estimated_resources;
+              }
+              return lhs.action.id < rhs.action.id;
+            });
+  // Loads run inline if there is no load thread, which is one at a time.
+  const int num_load_threads =
+      std::max(1, static_cast<int>(basic_manager_->num_load_threads()));
+  const int num_loads =
+      std::min(static_cast<int>(loads.size()),
+               std::max(0, num_load_threads - num_loads_in_progress));
+  std::vector<AspiredVersionPolicy::ServableAction> actions;
+  for (int i = 0; i < num_loads; ++i) {
+    VLOG(1) << "Taking action: " << loads[i].action.DebugString();
+    actions.push_back(loads[i].action);
+  }
+  return actions;
+}
+
+void AspiredVersionsManager::MaybeLoadInStandby(const ServableId& id) {
+  if (!hot_standby_ || IsExemptFromStandby(id)) {
+    return;
+  }
+  std::set<int64> standby_versions =
+      basic_manager_->GetStandbyVersions(id.name);
+  for (const ServableStateSnapshot<Aspired>& state_snapshot :
+       basic_manager_->GetManagedServableStateSnapshots<Aspired>(id.name)) {
+    if (state_snapshot.id.version < id.version &&
+        state_snapshot.state == LoaderHarness::State::kReady &&
+        state_snapshot.additional_state->is_aspired &&
+        standby_versions.count(state_snapshot.id.version) == 0) {
+      VLOG(1) << "Loading " << id << " in standby of "
+              << state_snapshot.id.version;
+      standby_versions.insert(id.version);
+      basic_manager_->SetStandbyVersions(id.name, standby_versions);
+      return;
+    }
+  }
+}
+
+void AspiredVersionsManager::UpdateStandbyVersions(
+    const string& servable_name) {
+  if (!hot_standby_) {
+    return;
+  }
+  const std::set<int64> standby_versions =
+      basic_manager_->GetStandbyVersions(servable_name);
+  if (standby_versions.empty()) {
+    return;
+  }
+  bool serving_aspired_version = false;
+  std::set<int64> managed_standby_versions;
+  for (const ServableStateSnapshot<Aspired>& state_snapshot :
+       basic_manager_->GetManagedServableStateSnapshots<Aspired>(
+           servable_name)) {
+    const int64 version = state_snapshot.id.version;
+    if (standby_versions.count(version) > 0) {
+      if (!IsExemptFromStandby(state_snapshot.id)) {
+        managed_standby_versions.insert(version);
+      }
+    } else if (state_snapshot.state == LoaderHarness::State::kReady &&
+               state_snapshot.additional_state->is_aspired) {
+      serving_aspired_version = true;
+    }
+  }
+  if (!serving_aspired_version) {
+    LOG(INFO) << "Promoting the standby versions of " << servable_name;
+    managed_standby_versions.clear();
+  }
+  basic_manager_->SetStandbyVersions(servable_name, managed_standby_versions);
+}
+
+void AspiredVersionsManager::SetVersionsExemptFromStandby(
+    const std::map<string, std::set<int64>>& versions) {
+  mutex_lock l(basic_manager_read_modify_write_mu_);
+  versions_exempt_from_standby_ = versions;
+  for (const auto& servable_versions : versions) {
+    UpdateStandbyVersions(servable_versions.first);
+  }
+}
+
+bool AspiredVersionsManager::IsExemptFromStandby(const ServableId& id) const {
+  const auto it = versions_exempt_from_standby_.find(id.name);
+  return it != versions_exempt_from_standby_.end() &&
+         it->second.count(id.version) > 0;
+}
+
 void AspiredVersionsManager::PerformAction(
     const AspiredVersionPolicy::ServableAction action) {
   switch (action.action) {
     case AspiredVersionPolicy::Action::kLoad: {
-      basic_manager_->LoadServable(action.id, [action](const Status& status) {
-        if (!status.ok()) {
-          LOG(ERROR) << "Servable " << action.id.DebugString()
-                     << " cannot be loaded: " << status;
-        }
-      });
+      MaybeLoadInStandby(action.id);
+      basic_manager_->LoadServable(
+          action.id, [this, action](const Status& status) {
+            if (!status.ok()) {
+              LOG(ERROR) << "Servable " << action.id.DebugString()
+                         << " cannot be loaded: " << status;
+            }
+            // E.g. to unload the version this one replaces right away.
+            RequestManageState();
+          });
     } break;
     case AspiredVersionPolicy::Action::kUnload: {
-      basic_manager_->UnloadServable(action.id, [action](const Status& status) {
-        if (!status.ok()) {
-          LOG(ERROR) << "Servable " << action.id.DebugString()
-                     << " cannot be unloaded: " << status;
-        }
-      });
+      basic_manager_->UnloadServable(
+          action.id, [this, action](const Status& status) {
+            if (!status.ok()) {
+              LOG(ERROR) << "Servable " << action.id.DebugString()
+                         << " cannot be unloaded: " << status;
+            }
+            RequestManageState();
+          });
     } break;
   }
 }
@@ -457,6 +668,23 @@ void AspiredVersionsManager::HandlePendingAspiredVersionsRequests() {
 void AspiredVersionsManager::InvokePolicyAndExecuteAction() {
   mutex_lock l(basic_manager_read_modify_write_mu_);
 
+  // E.g. to promote the standby versions of a stream whose served version
+  // failed or was unloaded.
+  if (hot_standby_) {
+    for (const string& servable_name :
+         basic_manager_->GetManagedServableNames()) {
+      UpdateStandbyVersions(servable_name);
+    }
+  }
+
+  if (schedule_loads_) {
+    for (const AspiredVersionPolicy::ServableAction& action :
+         GetScheduledActions()) {
+      PerformAction(action);
+    }
+    return;
+  }
+
   const absl::optional<AspiredVersionPolicy::ServableAction> next_action =
       GetNextAction();
   if (!next_action) {
@@ -16,13 +16,15 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_CORE_ASPIRED_VERSIONS_MANAGER_H_
 #define TENSORFLOW_SERVING_CORE_ASPIRED_VERSIONS_MANAGER_H_
 
+#include <functional>
+#include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 #include "absl/types/optional.h"
-#include "tensorflow/core/kernels/batching_util/periodic_function.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/core/stringpiece.h"
 #include "tensorflow/core/lib/hash/hash.h"
@@ -86,6 +88,11 @@ class AspiredVersionsManager : public Manager,
                                public Target<std::unique_ptr<Loader>> {
  public:
   using PreLoadHook = BasicManager::PreLoadHook;
+  using LoadThrottlingOptions = BasicManager::LoadThrottlingOptions;
+  using PostUnloadHook = BasicManager::PostUnloadHook;
+
+  /// Returns the load priority of a servable version, higher loading first.
+  using LoadPriority = std::function<int(const ServableId&)>;
 
   /// Config options and pluggable objects that will be used by the
   /// AspiredVersionsManager.
@@ -95,8 +102,9 @@ class AspiredVersionsManager : public Manager,
     std::unique_ptr<ResourceTracker> resource_tracker;
 
     /// The periodicity, in microseconds, of the thread which manages the state
-    /// of the servables. Default: 100 milliseconds. If this is set less than or
-    /// equal to 0, we don't run this thread at all.
+    /// of the servables. The thread also runs as soon as aspired versions
+    /// arrive or a load or unload finishes. Default: 100 milliseconds. If this
+    /// is set less than or equal to 0, we don't run this thread at all.
     int64 manage_state_interval_micros = 100 * 1000;
 
     /// EventBus to publish servable state changes. This is optional, if unset,
@@ -127,6 +135,24 @@ class AspiredVersionsManager : public Manager,
     /// Default: 1 minute.
     int64 load_retry_interval_micros = 1LL * 60 * 1000 * 1000;
 
+    /// The factor the load retry interval is multiplied by after each retry. If
+    /// set to 1, the interval is fixed.
+    double load_retry_backoff_multiplier = 1;
+
+    /// The max interval, in microseconds, between two load retries. If set to
+    /// 0, a day.
+    int64 max_load_retry_interval_micros = 0;
+
+    /// The fraction, in [0, 1], of each load retry interval that is
+    /// randomized, so that the servables failing together are not retried
+    /// together.
+    double load_retry_jitter = 0;
+
+    /// If true, a servable whose load failed waits for its retry without
+    /// holding a load thread, which meanwhile loads other servables. Only
+    /// applies if num_load_threads > 0.
+    bool release_load_threads_during_load_retries = false;
+
     // If true, and there are not multiple load threads, filesystem caches will
     // be flushed after each servable is loaded. (Cache flush is skipped when
     // multiple load threads are active, in order to avoid setting back a
@@ -141,9 +167,47 @@ class AspiredVersionsManager : public Manager,
     /// called on the same manager load thread which starts the load.
     PreLoadHook pre_load_hook;
 
+    /// Callback to be called just after a servable is unloaded, on the manager
+    /// unload thread which ran the unload.
+    PostUnloadHook post_unload_hook;
+
     // For servables which end with LoaderHarness::State::kError, enable
     // future attempts at reload to progress.
     bool enable_reload_servables_with_error = false;
+
+    /// If true, each run of the manager's work loop starts as many loads as
+    /// there are idle load threads, instead of taking a single action. Pending
+    /// loads are started in order of load_priority, then of estimated
+    /// resources, smallest first, so that small models are not stuck behind
+    /// large ones. Unloads still take precedence over loads, and the loads are
+    /// still admitted against the ResourceTracker one by one.
+    ///
+    /// The resources of a version are estimated when it is aspired, and their
+    /// quantities are summed over all the resources to rank the versions.
+    bool schedule_loads = false;
+
+    /// Optional load priority of the servable versions, used if
+    /// schedule_loads is true. Versions have priority 0 if unset.
+    LoadPriority load_priority;
+
+    /// Throttling of the loads, so that they yield to serving: the load
+    /// threads can run at a lower OS priority, and the loads can pause while
+    /// the serving latency is high. Disabled by default.
+    LoadThrottlingOptions load_throttling;
+
+    /// If true, the newer aspired versions of a servable stream which already
+    /// serves an aspired version are loaded in standby: once ready, they are
+    /// neither served nor published as available, but as loading. When no
+    /// aspired version is served anymore, e.g. because
+    /// the serving one is no longer aspired, the standby versions are promoted
+    /// at once, by swapping the serving map, and the old version is unloaded
+    /// afterwards. E.g. aspiring {1, 2} serves version 1 and preloads version
+    /// 2, and aspiring {2} then flips to version 2 without waiting for its
+    /// load. The standby loads are admitted against the ResourceTracker like
+    /// any other, so they only use spare capacity. The versions set with
+    /// SetVersionsExemptFromStandby(), e.g. those with a label, are never held
+    /// in standby.
+    bool hot_standby = false;
   };
   static Status Create(Options options,
                        std::unique_ptr<AspiredVersionsManager>* manager);
@@ -220,7 +284,8 @@ class AspiredVersionsManager : public Manager,
   AspiredVersionsManager(
       int64 manage_state_interval_micros, Env* env,
       std::unique_ptr<AspiredVersionPolicy> aspired_version_policy,
-      std::unique_ptr<BasicManager> basic_manager);
+      std::unique_ptr<BasicManager> basic_manager, bool schedule_loads,
+      LoadPriority load_priority);
 
   Status GetUntypedServableHandle(
       const ServableRequest& request,
@@ -251,6 +316,28 @@ class AspiredVersionsManager : public Manager,
       const std::vector<ServableData<std::unique_ptr<Loader>>>& versions) const
       TF_SHARED_LOCKS_REQUIRED(basic_manager_read_modify_write_mu_);
 
+  // If hot_standby_ is set and 'id' is newer than a version of its stream that
+  // is aspired and served, holds 'id' in standby before it is loaded.
+  void MaybeLoadInStandby(const ServableId& id)
+      TF_EXCLUSIVE_LOCKS_REQUIRED(basic_manager_read_modify_write_mu_);
+
+  // If hot_standby_ is set, promotes the standby versions of 'servable_name'
+  // if none of its aspired versions is served, as well as those exempt from
+  // standby, and forgets the standby versions which are not managed anymore.
+  void UpdateStandbyVersions(const string& servable_name)
+      TF_EXCLUSIVE_LOCKS_REQUIRED(basic_manager_read_modify_write_mu_);
+
+  // Returns whether 'id' is in versions_exempt_from_standby_.
+  bool IsExemptFromStandby(const ServableId& id) const
+      TF_SHARED_LOCKS_REQUIRED(basic_manager_read_modify_write_mu_);
+
+  // Sets the versions which are never held in standby, keyed by servable
+  // name, e.g. those with a version label, which must be available, and
+  // promotes those already in standby. Used by ServerCore.
+  void SetVersionsExemptFromStandby(
+      const std::map<string, std::set<int64>>& versions)
+      TF_LOCKS_EXCLUDED(basic_manager_read_modify_write_mu_);
+
   // Performs the action on the harness.
   void PerformAction(const AspiredVersionPolicy::ServableAction action)
       TF_EXCLUSIVE_LOCKS_REQUIRED(basic_manager_read_modify_write_mu_);
@@ -261,6 +348,12 @@ class AspiredVersionsManager : public Manager,
   absl::optional<AspiredVersionPolicy::ServableAction> GetNextAction()
       TF_EXCLUSIVE_LOCKS_REQUIRED(basic_manager_read_modify_write_mu_);
 
+  // Like GetNextAction(), but returns the actions to take if schedule_loads_
+  // is set: the topmost unload if any, or else the topmost loads in scheduling
+  // order, as many as there are load threads not busy with other loads.
+  std::vector<AspiredVersionPolicy::ServableAction> GetScheduledActions()
+      TF_EXCLUSIVE_LOCKS_REQUIRED(basic_manager_read_modify_write_mu_);
+
   // Checks for servables that are not aspired and at some final state and tells
   // 'basic_manager_' to forget about them. This method is intended to be
   // invoked periodically, interleaved with InvokePolicyAndExecuteAction() and
@@ -278,6 +371,16 @@ class AspiredVersionsManager : public Manager,
   void InvokePolicyAndExecuteAction()
       TF_LOCKS_EXCLUDED(basic_manager_read_modify_write_mu_);
 
+  // Runs FlushServables(), HandlePendingAspiredVersionsRequests() and
+  // InvokePolicyAndExecuteAction() every 'manage_state_interval_micros', or
+  // as soon as RequestManageState() is called, until 'stop_manage_state_' is
+  // set.
+  void ManageStateLoop(int64 manage_state_interval_micros)
+      TF_LOCKS_EXCLUDED(manage_state_mu_);
+
+  // Wakes up ManageStateLoop(), if it is running.
+  void RequestManageState() TF_LOCKS_EXCLUDED(manage_state_mu_);
+
   // Sets the number of load threads.
   //
   // We immediately block all new load requests while the current executor is
@@ -305,9 +408,15 @@ class AspiredVersionsManager : public Manager,
   // the set of managed servables and their state (in particular, aspiredness).
   mutable mutex basic_manager_read_modify_write_mu_;
 
-  // Periodically runs HandlePendingAspiredVersionsRequests() and
-  // InvokePolicyAndExecuteAction() in a background thread.
-  std::unique_ptr<PeriodicFunction> manage_state_thread_;
+  // Signals ManageStateLoop(). Declared before 'basic_manager_', whose load
+  // and unload callbacks call RequestManageState().
+  mutex manage_state_mu_;
+  condition_variable manage_state_cv_;
+  bool manage_state_requested_ TF_GUARDED_BY(manage_state_mu_) = false;
+  bool stop_manage_state_ TF_GUARDED_BY(manage_state_mu_) = false;
+
+  // Runs ManageStateLoop() in a background thread.
+  std::unique_ptr<Thread> manage_state_thread_;
 
   // The object that implements the Target API on behalf of this manager.
   std::unique_ptr<TargetBase<std::unique_ptr<Loader>>> target_impl_;
@@ -323,6 +432,17 @@ class AspiredVersionsManager : public Manager,
   // future attempts at reload to progress.
   bool enable_reload_servables_with_error_ = false;
 
+  // See Options::hot_standby.
+  bool hot_standby_ = false;
+
+  // See SetVersionsExemptFromStandby().
+  std::map<string, std::set<int64>> versions_exempt_from_standby_
+      TF_GUARDED_BY(basic_manager_read_modify_write_mu_);
+
+  // See Options::schedule_loads and Options::load_priority.
+  const bool schedule_loads_;
+  const LoadPriority load_priority_;
+
   TF_DISALLOW_COPY_AND_ASSIGN(AspiredVersionsManager);
 };
 
@@ -21,11 +21,13 @@ limitations under the License.
 // e.g.: --benchmark_min_time=60.0
 
 #include <algorithm>
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "absl/container/flat_hash_map.h"
 #include "tensorflow/core/kernels/batching_util/periodic_function.h"
 #include "tensorflow/core/lib/core/notification.h"
 #include "tensorflow/core/lib/core/status.h"
@@ -49,6 +51,7 @@ limitations under the License.
 #include "tensorflow_serving/core/servable_handle.h"
 #include "tensorflow_serving/core/simple_loader.h"
 #include "tensorflow_serving/core/test_util/manager_test_util.h"
+#include "tensorflow_serving/util/fast_read_dynamic_ptr.h"
 
 namespace tensorflow {
 namespace serving {
@@ -386,6 +389,224 @@ void BM_GetServableHandle(::testing::benchmark::State& state) {
 }
 BENCHMARK(BM_GetServableHandle);
 
+// Benchmarks of the handle lookups of many models, as served by a multi-tenant
+// server, while their versions churn.
+//
+// Each of 'num_models' models serves two versions, labeled "stable" and
+// "canary". The readers look up the latest version of a random model 80% of
+// the time, and a label otherwise. Labels are resolved to versions by a
+// model->label->version routing table, shared by the readers through a
+// FastReadDynamicPtr as ServerCore does, and then to handles by the manager.
+//
+// Meanwhile, a churn thread replaces the versions of the models one after the
+// other (loading the next version, moving the labels to the two newest ones
+// and unloading the oldest one), every millisecond, and a config reload thread
+// rebuilds the routing table, every 10 milliseconds.
+//
+// Reported counters, besides the throughput:
+//   label_misses: Label lookups that raced with the unload of their version.
+class MultiModelBenchmarkState {
+ public:
+  explicit MultiModelBenchmarkState(const int num_models)
+      : num_models_(num_models), oldest_versions_(num_models, 0) {
+    AspiredVersionsManager::Options options;
+    // Do policy thread won't be run automatically.
+    options.manage_state_interval_micros = -1;
+    options.aspired_version_policy.reset(new AvailabilityPreservingPolicy());
+    TF_CHECK_OK(AspiredVersionsManager::Create(std::move(options), &manager_));
+    test_util::AspiredVersionsManagerTestAccess access(manager_.get());
+    for (int i = 0; i < num_models_; ++i) {
+      AspireVersions(i, {0, 1});
+      labels_[ModelName(i)] = {{"stable", 0}, {"canary", 1}};
+    }
+    access.HandlePendingAspiredVersionsRequests();
+    for (int i = 0; i < 2 * num_models_; ++i) {
+      access.InvokePolicyAndExecuteAction();
+    }
+    CHECK_EQ(2 * num_models_, manager_->ListAvailableServableIds().size());
+    ReloadConfig();
+
+    random::PhiloxRandom philox(testing::RandomSeed());
+    random::SimplePhilox random(&philox);
+    for (int i = 0; i < kNumLookups; ++i) {
+      Lookup lookup;
+      lookup.model_name = ModelName(random.Uniform(num_models_));
+      if (random.RandFloat() > kLatestRatio) {
+        lookup.label = random.Uniform(2) == 0 ? "stable" : "canary";
+      }
+      lookups_.push_back(std::move(lookup));
+    }
+  }
+
+  // Starts the churn and the config reload threads.
+  void StartUpdates() {
+    PeriodicFunction::Options churn_options;
+    churn_options.thread_name_prefix = "MultiModelBenchmark_Churn_Thread";
+    churn_thread_.reset(new PeriodicFunction([this] { ChurnNextModel(); },
+                                             1000, churn_options));
+    PeriodicFunction::Options reload_options;
+    reload_options.thread_name_prefix = "MultiModelBenchmark_Reload_Thread";
+    reload_thread_.reset(new PeriodicFunction([this] { ReloadConfig(); },
+                                              10000, reload_options));
+  }
+
+  // Stops the threads started by StartUpdates(). Blocks until they exit.
+  void StopUpdates() {
+    churn_thread_.reset();
+    reload_thread_.reset();
+  }
+
+  // Runs 'num_lookups' lookups, from the 'offset'-th one.
+  void RunLookups(const int offset, const int num_lookups) {
+    for (int i = 0; i < num_lookups; ++i) {
+      const Lookup& lookup = lookups_[(offset + i) % kNumLookups];
+      ServableRequest request = ServableRequest::Latest(lookup.model_name);
+      if (!lookup.label.empty()) {
+        const std::shared_ptr<const ModelLabelsToVersions> labels =
+            routing_table_.get();
+        request = ServableRequest::Specific(
+            lookup.model_name, labels->at(lookup.model_name).at(lookup.label));
+      }
+      ServableHandle<int64> handle;
+      const Status status = manager_->GetServableHandle(request, &handle);
+      if (!status.ok()) {
+        CHECK(!lookup.label.empty()) << status;
+        label_misses_.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+      CHECK_GE(*handle, 0);
+    }
+  }
+
+  int64 label_misses() const { return label_misses_.load(); }
+
+ private:
+  // The model->label->version routing table.
+  using ModelLabelsToVersions =
+      absl::flat_hash_map<string, absl::flat_hash_map<string, int64>>;
+
+  struct Lookup {
+    string model_name;
+    // Empty for the latest version.
+    string label;
+  };
+
+  static constexpr int kNumLookups = 4096;
+  // Ratio of lookups of the latest version as opposed to a label.
+  static constexpr float kLatestRatio = 0.8;
+
+  static string ModelName(const int model) {
+    return strings::StrCat(kServableName, model);
+  }
+
+  // Aspires the versions 'versions' of the model 'model'.
+  void AspireVersions(const int model, const std::vector<int64>& versions) {
+    const string name = ModelName(model);
+    std::vector<ServableData<std::unique_ptr<Loader>>> servable_versions;
+    for (const int64 version : versions) {
+      std::unique_ptr<Loader> loader(new SimpleLoader<int64>(
+          [version](std::unique_ptr<int64>* const servable) {
+            servable->reset(new int64);
+            **servable = version;
+            return Status::OK();
+          },
+          SimpleLoader<int64>::EstimateNoResources()));
+      servable_versions.push_back({{name, version}, std::move(loader)});
+    }
+    manager_->GetAspiredVersionsCallback()(name, std::move(servable_versions));
+  }
+
+  // Replaces the oldest version of the next model by a new one.
+  void ChurnNextModel() {
+    const int model = next_churned_model_;
+    next_churned_model_ = (next_churned_model_ + 1) % num_models_;
+    const int64 oldest_version = oldest_versions_[model];
+    test_util::AspiredVersionsManagerTestAccess access(manager_.get());
+    // Loads the new version.
+    AspireVersions(model,
+                   {oldest_version, oldest_version + 1, oldest_version + 2});
+    access.HandlePendingAspiredVersionsRequests();
+    access.InvokePolicyAndExecuteAction();
+    {
+      mutex_lock l(labels_mu_);
+      labels_[ModelName(model)] = {{"stable", oldest_version + 1},
+                                   {"canary", oldest_version + 2}};
+    }
+    ReloadConfig();
+    // Quiesces and deletes the oldest version.
+    AspireVersions(model, {oldest_version + 1, oldest_version + 2});
+    access.HandlePendingAspiredVersionsRequests();
+    access.InvokePolicyAndExecuteAction();
+    access.InvokePolicyAndExecuteAction();
+    oldest_versions_[model] = oldest_version + 1;
+  }
+
+  // Rebuilds the routing table whole, as a config reload does.
+  void ReloadConfig() {
+    mutex_lock l(labels_mu_);
+    routing_table_.Update(std::unique_ptr<ModelLabelsToVersions>(
+        new ModelLabelsToVersions(labels_)));
+  }
+
+  const int num_models_;
+  std::unique_ptr<AspiredVersionsManager> manager_;
+
+  mutex labels_mu_;
+  ModelLabelsToVersions labels_ TF_GUARDED_BY(labels_mu_);
+  FastReadDynamicPtr<ModelLabelsToVersions> routing_table_;
+
+  // Only accessed by the churn thread, once started.
+  std::vector<int64> oldest_versions_;
+  int next_churned_model_ = 0;
+
+  std::vector<Lookup> lookups_;
+  std::atomic<int64> label_misses_{0};
+
+  std::unique_ptr<PeriodicFunction> churn_thread_;
+  std::unique_ptr<PeriodicFunction> reload_thread_;
+};
+
+void BM_MultiModel_Lookups(::testing::benchmark::State& state) {
+  const int num_threads = state.range(0);
+  const int num_models = state.range(1);
+  MultiModelBenchmarkState bm_state(num_models);
+  bm_state.StartUpdates();
+
+  // See BenchmarkState::RunBenchmark().
+  const int kSubIters = 500;
+  for (auto s : state) {
+    // Exclude the scheduling setup time.
+    state.PauseTiming();
+    Notification all_threads_scheduled;
+    std::unique_ptr<thread::ThreadPool> pool(new thread::ThreadPool(
+        Env::Default(), "MultiModelLookupThread", num_threads));
+    for (int thread_index = 0; thread_index < num_threads; ++thread_index) {
+      pool->Schedule([&bm_state, &all_threads_scheduled, thread_index]() {
+        all_threads_scheduled.WaitForNotification();
+        bm_state.RunLookups(thread_index * kSubIters, kSubIters);
+      });
+    }
+    state.ResumeTiming();
+    all_threads_scheduled.Notify();
+    pool.reset();
+  }
+
+  bm_state.StopUpdates();
+  state.SetItemsProcessed(num_threads * kSubIters * state.iterations());
+  state.counters["label_misses"] = bm_state.label_misses();
+}
+
+// 1 to 128 threads, over 100 and 500 models.
+void ThreadsAndModels(::testing::benchmark::internal::Benchmark* benchmark) {
+  for (const int num_models : {100, 500}) {
+    for (const int num_threads : {1, 8, 32, 128}) {
+      benchmark->ArgPair(num_threads, num_models);
+    }
+  }
+}
+
+BENCHMARK(BM_MultiModel_Lookups)->UseRealTime()->Apply(ThreadsAndModels);
+
 }  // namespace
 }  // namespace serving
 }  // namespace tensorflow
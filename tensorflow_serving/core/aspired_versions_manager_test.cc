@@ -42,6 +42,7 @@ namespace {
 using test_util::FakeLoader;
 using test_util::WaitUntilServableManagerStateIsOneOf;
 using ::testing::_;
+using ::testing::ElementsAre;
 using ::testing::Invoke;
 using ::testing::InvokeWithoutArgs;
 using ::testing::NiceMock;
@@ -1285,6 +1286,260 @@ TEST(AspiredVersionsManagerTest, CallPolicyWithAllVersions) {
   EXPECT_EQ(kNumVersionsPerServable, all_versions.size());
 }
 
+// Creates a servable version whose loader estimates 'ram_bytes' of RAM.
+ServableData<std::unique_ptr<Loader>> CreateVersionWithEstimate(
+    const ServableId& id, const uint64 ram_bytes,
+    test_util::MockLoader** loader) {
+  *loader = new NiceMock<test_util::MockLoader>();
+  ON_CALL(**loader, EstimateResources(_))
+      .WillByDefault(Invoke([ram_bytes](ResourceAllocation* estimate) {
+        ResourceAllocation::Entry* entry =
+            estimate->add_resource_quantities();
+        entry->mutable_resource()->set_device("main");
+        entry->mutable_resource()->set_kind("ram");
+        entry->set_quantity(ram_bytes);
+        return Status::OK();
+      }));
+  return {id, std::unique_ptr<Loader>(*loader)};
+}
+
+TEST(AspiredVersionsManagerTest, ScheduleLoadsByPriorityThenSize) {
+  std::unique_ptr<AspiredVersionsManager> manager;
+  AspiredVersionsManager::Options manager_options;
+  // The state manager thread won't be run automatically.
+  manager_options.manage_state_interval_micros = -1;
+  manager_options.aspired_version_policy.reset(
+      new AvailabilityPreservingPolicy());
+  manager_options.schedule_loads = true;
+  manager_options.load_priority = [](const ServableId& id) {
+    return id.name == "critical" ? 1 : 0;
+  };
+  TF_CHECK_OK(
+      AspiredVersionsManager::Create(std::move(manager_options), &manager));
+
+  const ServableId critical = {"critical", 1};
+  const ServableId large = {"large", 1};
+  const ServableId small = {"small", 1};
+  for (const auto& id_and_size : std::vector<std::pair<ServableId, uint64>>(
+           {{large, 5000}, {critical, 2000}, {small, 10}})) {
+    test_util::MockLoader* loader;
+    std::vector<ServableData<std::unique_ptr<Loader>>> aspired_versions;
+    aspired_versions.push_back(CreateVersionWithEstimate(
+        id_and_size.first, id_and_size.second, &loader));
+    manager->GetAspiredVersionsCallback()(id_and_size.first.name,
+                                          std::move(aspired_versions));
+  }
+  test_util::AspiredVersionsManagerTestAccess(manager.get())
+      .HandlePendingAspiredVersionsRequests();
+
+  // Without load threads, one version is loaded per run, in order.
+  std::vector<ServableId> expected_ids;
+  for (const ServableId& id : {critical, small, large}) {
+    test_util::AspiredVersionsManagerTestAccess(manager.get())
+        .InvokePolicyAndExecuteAction();
+    expected_ids.push_back(id);
+    EXPECT_THAT(manager->ListAvailableServableIds(),
+                UnorderedElementsAreArray(expected_ids));
+  }
+}
+
+TEST(AspiredVersionsManagerTest, ScheduleLoadsFillsLoadThreads) {
+  std::unique_ptr<AspiredVersionsManager> manager;
+  AspiredVersionsManager::Options manager_options;
+  // The state manager thread won't be run automatically.
+  manager_options.manage_state_interval_micros = -1;
+  manager_options.aspired_version_policy.reset(
+      new AvailabilityPreservingPolicy());
+  manager_options.num_load_threads = 2;
+  manager_options.schedule_loads = true;
+  TF_CHECK_OK(
+      AspiredVersionsManager::Create(std::move(manager_options), &manager));
+
+  mutex mu;
+  int num_loads_started = 0;
+  Notification loads_continue;
+  const std::vector<ServableId> ids = {{"a", 1}, {"b", 1}, {"c", 1}};
+  for (size_t i = 0; i < ids.size(); ++i) {
+    test_util::MockLoader* loader;
+    std::vector<ServableData<std::unique_ptr<Loader>>> aspired_versions;
+    aspired_versions.push_back(
+        CreateVersionWithEstimate(ids[i], /*ram_bytes=*/i + 1, &loader));
+    ON_CALL(*loader, LoadWithMetadata(_))
+        .WillByDefault(InvokeWithoutArgs([&]() {
+          {
+            mutex_lock l(mu);
+            ++num_loads_started;
+          }
+          loads_continue.WaitForNotification();
+          return Status::OK();
+        }));
+    manager->GetAspiredVersionsCallback()(ids[i].name,
+                                          std::move(aspired_versions));
+  }
+  test_util::AspiredVersionsManagerTestAccess(manager.get())
+      .HandlePendingAspiredVersionsRequests();
+
+  // A single run starts a load on each load thread, and the next run waits
+  // for them to finish.
+  test_util::AspiredVersionsManagerTestAccess(manager.get())
+      .InvokePolicyAndExecuteAction();
+  test_util::AspiredVersionsManagerTestAccess(manager.get())
+      .InvokePolicyAndExecuteAction();
+  const auto get_num_loads_started = [&]() {
+    mutex_lock l(mu);
+    return num_loads_started;
+  };
+  while (get_num_loads_started() < 2) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+  loads_continue.Notify();
+  while (manager->ListAvailableServableIds().size() < 2) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+  EXPECT_THAT(manager->ListAvailableServableIds(),
+              UnorderedElementsAre(ids[0], ids[1]));
+
+  test_util::AspiredVersionsManagerTestAccess(manager.get())
+      .InvokePolicyAndExecuteAction();
+  while (manager->ListAvailableServableIds().size() < 3) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+  EXPECT_EQ(3, get_num_loads_started());
+}
+
+TEST(AspiredVersionsManagerTest, ManageStateOnAspiredVersionsAndLoads) {
+  std::unique_ptr<AspiredVersionsManager> manager;
+  AspiredVersionsManager::Options manager_options;
+  // Long enough for the state manager thread to only run when woken up.
+  manager_options.manage_state_interval_micros = 3600LL * 1000 * 1000;
+  manager_options.aspired_version_policy.reset(
+      new AvailabilityPreservingPolicy());
+  manager_options.num_load_threads = 2;
+  manager_options.num_unload_threads = 2;
+  TF_CHECK_OK(
+      AspiredVersionsManager::Create(std::move(manager_options), &manager));
+
+  const ServableId id_1 = {kServableName, 1};
+  std::vector<ServableData<std::unique_ptr<Loader>>> aspired_versions;
+  aspired_versions.push_back(CreateAspiredVersion(id_1));
+  manager->GetAspiredVersionsCallback()(kServableName,
+                                        std::move(aspired_versions));
+  while (manager->ListAvailableServableIds() != std::vector<ServableId>{id_1}) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+
+  // Version 1 is unloaded once version 2 is loaded.
+  const ServableId id_2 = {kServableName, 2};
+  aspired_versions.clear();
+  aspired_versions.push_back(CreateAspiredVersion(id_2));
+  manager->GetAspiredVersionsCallback()(kServableName,
+                                        std::move(aspired_versions));
+  while (manager->ListAvailableServableIds() != std::vector<ServableId>{id_2}) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+}
+
+// A manager in hot standby mode, with its event bus.
+class HotStandbyTest : public ::testing::Test {
+ protected:
+  HotStandbyTest()
+      : servable_event_bus_(EventBus<ServableState>::CreateEventBus()),
+        servable_state_monitor_(servable_event_bus_.get()) {
+    AspiredVersionsManager::Options manager_options;
+    // The state manager thread won't be run automatically.
+    manager_options.manage_state_interval_micros = -1;
+    manager_options.aspired_version_policy.reset(
+        new AvailabilityPreservingPolicy());
+    manager_options.servable_event_bus = servable_event_bus_.get();
+    manager_options.hot_standby = true;
+    TF_CHECK_OK(
+        AspiredVersionsManager::Create(std::move(manager_options), &manager_));
+    manager_test_access_.reset(
+        new test_util::AspiredVersionsManagerTestAccess(manager_.get()));
+  }
+
+  void SetAspiredVersions(const std::vector<ServableId>& ids) {
+    std::vector<ServableData<std::unique_ptr<Loader>>> aspired_versions;
+    for (const ServableId& id : ids) {
+      aspired_versions.push_back(CreateAspiredVersion(id));
+    }
+    manager_->GetAspiredVersionsCallback()(kServableName,
+                                           std::move(aspired_versions));
+    manager_test_access_->HandlePendingAspiredVersionsRequests();
+  }
+
+  int64 LatestVersion() {
+    ServableHandle<int64> handle;
+    TF_CHECK_OK(manager_->GetServableHandle(
+        ServableRequest::Latest(kServableName), &handle));
+    return *handle;
+  }
+
+  ServableState::ManagerState PublishedState(const ServableId& id) {
+    const absl::optional<ServableState> state =
+        servable_state_monitor_.GetState(id);
+    CHECK(state);
+    return state->manager_state;
+  }
+
+  std::shared_ptr<EventBus<ServableState>> servable_event_bus_;
+  ServableStateMonitor servable_state_monitor_;
+  std::unique_ptr<AspiredVersionsManager> manager_;
+  std::unique_ptr<test_util::AspiredVersionsManagerTestAccess>
+      manager_test_access_;
+};
+
+TEST_F(HotStandbyTest, FlipsToPreloadedVersion) {
+  const ServableId id_1 = {kServableName, 1};
+  const ServableId id_2 = {kServableName, 2};
+  SetAspiredVersions({id_1});
+  manager_test_access_->InvokePolicyAndExecuteAction();
+  EXPECT_THAT(manager_->ListAvailableServableIds(), ElementsAre(id_1));
+
+  // Version 2 is loaded, but neither served nor published as available.
+  SetAspiredVersions({id_1, id_2});
+  manager_test_access_->InvokePolicyAndExecuteAction();
+  EXPECT_THAT(manager_->ListAvailableServableIds(), ElementsAre(id_1));
+  EXPECT_EQ(1, LatestVersion());
+  ServableHandle<int64> handle;
+  EXPECT_FALSE(
+      manager_->GetServableHandle(ServableRequest::FromId(id_2), &handle).ok());
+  EXPECT_EQ(ServableState::ManagerState::kLoading, PublishedState(id_2));
+
+  // Version 2 is served and published as soon as version 1 is not aspired
+  // anymore, and version 1 is unloaded afterwards.
+  SetAspiredVersions({id_2});
+  EXPECT_EQ(2, LatestVersion());
+  EXPECT_EQ(ServableState::ManagerState::kAvailable, PublishedState(id_2));
+  manager_test_access_->InvokePolicyAndExecuteAction();
+  EXPECT_THAT(manager_->ListAvailableServableIds(), ElementsAre(id_2));
+}
+
+TEST_F(HotStandbyTest, NeverHoldsExemptVersions) {
+  const ServableId id_1 = {kServableName, 1};
+  const ServableId id_2 = {kServableName, 2};
+  const ServableId id_3 = {kServableName, 3};
+  SetAspiredVersions({id_1});
+  manager_test_access_->InvokePolicyAndExecuteAction();
+  SetAspiredVersions({id_1, id_2});
+  manager_test_access_->InvokePolicyAndExecuteAction();
+  EXPECT_EQ(ServableState::ManagerState::kLoading, PublishedState(id_2));
+
+  // Exempting version 2, e.g. because it got a label, promotes it.
+  manager_test_access_->SetVersionsExemptFromStandby({{kServableName, {2}}});
+  EXPECT_EQ(ServableState::ManagerState::kAvailable, PublishedState(id_2));
+  EXPECT_THAT(manager_->ListAvailableServableIds(),
+              UnorderedElementsAre(id_1, id_2));
+
+  // And an exempt version is served as soon as it is loaded.
+  manager_test_access_->SetVersionsExemptFromStandby(
+      {{kServableName, {2, 3}}});
+  SetAspiredVersions({id_1, id_2, id_3});
+  manager_test_access_->InvokePolicyAndExecuteAction();
+  EXPECT_EQ(ServableState::ManagerState::kAvailable, PublishedState(id_3));
+  EXPECT_EQ(3, LatestVersion());
+}
+
 }  // namespace
 }  // namespace serving
 }  // namespace tensorflow
@@ -16,6 +16,7 @@ limitations under the License.
 #include "tensorflow_serving/core/basic_manager.h"
 
 #include <algorithm>
+#include <chrono>
 #include <iterator>
 #include <map>
 #include <memory>
@@ -29,7 +30,7 @@ limitations under the License.
 #include "tensorflow/core/platform/macros.h"
 #include "tensorflow_serving/core/servable_handle.h"
 #include "tensorflow_serving/core/source.h"
-#include "tensorflow_serving/util/hash.h"
+#include "tensorflow_serving/util/cpu_affinity.h"
 #include "tensorflow_serving/util/inline_executor.h"
 #include "tensorflow_serving/util/retrier.h"
 #include "tensorflow_serving/util/threadpool_executor.h"
@@ -53,55 +54,6 @@ std::unique_ptr<Executor> CreateExecutor(Env* const env,
 
 }  // namespace
 
-struct BasicManager::ServingMap::EqRequest {
-  bool operator()(const ServableRequest& lhs,
-                  const ServableRequest& rhs) const {
-    if (lhs.version != rhs.version) {
-      return false;
-    }
-    if (lhs.auto_version_policy != rhs.auto_version_policy) {
-      return false;
-    }
-    // Even if there is a small probability that version & policy checking can
-    // eliminate string checking, we should do that since O(string_equality) >>
-    // O(version_equality) + O(policy_equality).
-    if (lhs.name != rhs.name) {
-      return false;
-    }
-    return true;
-  }
-};
-
-struct BasicManager::ServingMap::HashRequest {
-  uint64 operator()(const ServableRequest& request) const {
-    // Hash codes for many common types are remarkably bad, often clustering
-    // around the same values of the low and/or high bits for linear
-    // sequences of inputs such as 1, 2, 3; or addresses of consecutively
-    // allocated objects.  For these cases the default hash function is the
-    // identity function on the bit patterns.
-    //
-    // So we apply a one-to-one mapping to the resulting bit patterns to
-    // make the high bits contain more entropy from the entire hash code.
-    // It's based on Fibonacci hashing from Knuth's Art of Computer
-    // Programming volume 3, section 6.4.
-    const uint64 version_hash = [&]() -> uint64 {
-      if (request.version) {
-        return std::hash<int64>()(request.version.value()) *
-               0x9E3779B97F4A7C13;  // (sqrt(5) - 1)/2 as a binary fraction.
-      } else {
-        switch (request.auto_version_policy) {
-          case ServableRequest::AutoVersionPolicy::kEarliest:
-            return 0x01234CAFFE;
-          case ServableRequest::AutoVersionPolicy::kLatest:
-            return 0xDECAFCAFFE;
-        }
-      }
-    }();
-    // Using version_hash as the seed here to combine the hashes.
-    return HashCombine(version_hash, std::hash<string>()(request.name));
-  }
-};
-
 BasicManager::ServingMap::ServingMap()
     : handles_map_(std::unique_ptr<HandlesMap>(new HandlesMap())) {}
 
@@ -109,14 +61,9 @@ std::vector<ServableId> BasicManager::ServingMap::ListAvailableServableIds()
     const {
   std::vector<ServableId> ids;
   std::shared_ptr<const HandlesMap> handles_map = handles_map_.get();
-  for (auto iter = handles_map->begin(); iter != handles_map->end();) {
-    // We get the iterator where all the values for a particular key ends.
-    const auto key_end = handles_map->equal_range(iter->first).second;
-
-    for (; iter != key_end; ++iter) {
-      if (iter->first.version) {
-        ids.push_back(iter->second->id());
-      }
+  for (const auto& servable : *handles_map) {
+    for (const auto& harness : servable.second.versions) {
+      ids.push_back(harness->id());
     }
   }
   return ids;
@@ -126,19 +73,39 @@ Status BasicManager::ServingMap::GetUntypedServableHandle(
     const ServableRequest& request,
     std::unique_ptr<UntypedServableHandle>* const untyped_handle) {
   std::shared_ptr<const HandlesMap> handles_map = handles_map_.get();
-  const auto found_it = handles_map->find(request);
-  if (found_it == handles_map->end()) {
+  const LoaderHarness* harness = nullptr;
+  const auto found_it = handles_map->find(request.name);
+  if (found_it != handles_map->end()) {
+    const ServableVersions& servable = found_it->second;
+    if (!request.version) {
+      harness = request.auto_version_policy ==
+                        ServableRequest::AutoVersionPolicy::kEarliest
+                    ? servable.earliest.get()
+                    : servable.latest.get();
+    } else {
+      const int64 version = request.version.value();
+      const auto version_it = std::lower_bound(
+          servable.versions.begin(), servable.versions.end(), version,
+          [](const std::shared_ptr<const LoaderHarness>& lhs, int64 rhs) {
+            return lhs->id().version < rhs;
+          });
+      if (version_it != servable.versions.end() &&
+          (*version_it)->id().version == version) {
+        harness = version_it->get();
+      }
+    }
+  }
+  if (harness == nullptr) {
     return errors::NotFound("Servable not found for request: ",
                             request.DebugString());
   }
 
-  const LoaderHarness& harness = *found_it->second;
   // We use the aliasing constructor of shared_ptr here. So even though we are
   // returning a shared_ptr to servable, the ref-counting is happening on the
   // handles_map. This delays the map destruction till the last handle from the
   // previous map is freed, when we are doing handles_map updates.
   untyped_handle->reset(new SharedPtrHandle(
-      harness.id(), std::shared_ptr<Loader>(handles_map, harness.loader())));
+      harness->id(), std::shared_ptr<Loader>(handles_map, harness->loader())));
   return Status::OK();
 }
 
@@ -146,73 +113,44 @@ std::map<ServableId, std::unique_ptr<UntypedServableHandle>>
 BasicManager::ServingMap::GetAvailableUntypedServableHandles() const {
   std::map<ServableId, std::unique_ptr<UntypedServableHandle>> result;
   std::shared_ptr<const HandlesMap> handles_map = handles_map_.get();
-  for (const auto& handle : *handles_map) {
-    const ServableRequest& request = handle.first;
-    // If the entry is one of the auto-versioned request ones, skip it. We would
-    // already get it from the entry which has the specific request.
-    if (!request.version) {
-      continue;
+  for (const auto& servable : *handles_map) {
+    for (const auto& harness : servable.second.versions) {
+      result.emplace(harness->id(),
+                     std::unique_ptr<UntypedServableHandle>(new SharedPtrHandle(
+                         harness->id(), std::shared_ptr<Loader>(
+                                            handles_map, harness->loader()))));
     }
-    const LoaderHarness& harness = *handle.second;
-    result.emplace(harness.id(),
-                   std::unique_ptr<UntypedServableHandle>(new SharedPtrHandle(
-                       harness.id(), std::shared_ptr<Loader>(
-                                         handles_map, harness.loader()))));
   }
   return result;
 }
 
-void BasicManager::ServingMap::Update(const ManagedMap& managed_map) {
-  struct CompareRequests {
-    bool operator()(const ServableRequest& lhs,
-                    const ServableRequest& rhs) const {
-      const int strcmp_result = lhs.name.compare(rhs.name);
-      if (strcmp_result != 0) {
-        return strcmp_result < 0;
-      }
-      DCHECK(lhs.version);
-      DCHECK(rhs.version);
-      return lhs.version.value() < rhs.version.value();
-    }
-  };
-  std::multimap<ServableRequest, std::shared_ptr<const LoaderHarness>,
-                CompareRequests>
-      sorted_available_map;
+void BasicManager::ServingMap::Update(const ManagedMap& managed_map,
+                                     const StandbyMap& standby_versions) {
+  std::unique_ptr<HandlesMap> new_handles_map(new HandlesMap());
   for (const auto& elem : managed_map) {
     std::shared_ptr<const LoaderHarness> harness = elem.second;
-    if (harness->state() == LoaderHarness::State::kReady) {
-      sorted_available_map.emplace(ServableRequest::FromId(harness->id()),
-                                   harness);
-    }
-  }
-
-  std::unique_ptr<HandlesMap> new_handles_map(new HandlesMap());
-  auto prev_iter = sorted_available_map.end();
-  for (auto iter = sorted_available_map.begin();
-       iter != sorted_available_map.end(); ++iter) {
-    std::shared_ptr<const LoaderHarness> harness = iter->second;
-    new_handles_map->emplace(ServableRequest::FromId(harness->id()), harness);
-
-    // If this is the first harness in the stream for a given servable name, add
-    // it again to the handles_map, marking it as the earliest for that stream.
-    if (prev_iter == sorted_available_map.end() ||
-        prev_iter->second->id().name != harness->id().name) {
-      const ServableRequest earliest_request =
-          ServableRequest::Earliest(harness->id().name);
-      new_handles_map->emplace(earliest_request, harness);
+    if (harness->state() != LoaderHarness::State::kReady) {
+      continue;
     }
-
-    // If this is the last harness in the stream for a given servable name, add
-    // it again to the handles_map, marking it as the latest for that stream.
-    const auto next_iter = std::next(iter);
-    if (next_iter == sorted_available_map.end() ||
-        next_iter->second->id().name != harness->id().name) {
-      const ServableRequest latest_request =
-          ServableRequest::Latest(harness->id().name);
-      new_handles_map->emplace(latest_request, harness);
+    const auto standby_it = standby_versions.find(harness->id().name);
+    if (standby_it != standby_versions.end() &&
+        standby_it->second.count(harness->id().version) > 0) {
+      continue;
     }
+    (*new_handles_map)[harness->id().name].versions.push_back(harness);
+  }
 
-    prev_iter = iter;
+  // Sorts the versions of each stream and resolves its earliest and latest
+  // ones, so that requests never need to search for them.
+  for (auto& servable : *new_handles_map) {
+    ServableVersions& versions = servable.second;
+    std::sort(versions.versions.begin(), versions.versions.end(),
+              [](const std::shared_ptr<const LoaderHarness>& lhs,
+                 const std::shared_ptr<const LoaderHarness>& rhs) {
+                return lhs->id().version < rhs->id().version;
+              });
+    versions.earliest = versions.versions.front();
+    versions.latest = versions.versions.back();
   }
 
   // This blocks until the last handle given out by the old handles map is
@@ -225,8 +163,13 @@ Status BasicManager::Create(Options options,
   manager->reset(new BasicManager(
       options.env, options.num_load_threads, options.num_unload_threads,
       options.max_num_load_retries, options.load_retry_interval_micros,
+      options.load_retry_backoff_multiplier,
+      options.max_load_retry_interval_micros, options.load_retry_jitter,
+      options.release_load_threads_during_load_retries,
       options.flush_filesystem_caches, std::move(options.resource_tracker),
-      options.servable_event_bus, std::move(options.pre_load_hook)));
+      options.servable_event_bus, std::move(options.pre_load_hook),
+      std::move(options.post_unload_hook),
+      std::move(options.load_throttling)));
   return Status::OK();
 }
 
@@ -234,17 +177,30 @@ BasicManager::BasicManager(Env* const env, const uint32 num_load_threads,
                            const uint32 num_unload_threads,
                            uint32 max_num_load_retries,
                            int64 load_retry_interval_micros,
+                           double load_retry_backoff_multiplier,
+                           int64 max_load_retry_interval_micros,
+                           double load_retry_jitter,
+                           bool release_load_threads_during_load_retries,
                            bool flush_filesystem_caches,
                            std::unique_ptr<ResourceTracker> resource_tracker,
                            EventBus<ServableState>* servable_event_bus,
-                           std::function<void(const ServableId&)> pre_load_hook)
+                           PreLoadHook pre_load_hook,
+                           PostUnloadHook post_unload_hook,
+                           LoadThrottlingOptions load_throttling)
     : servable_event_bus_(servable_event_bus),
       env_(env),
+      load_throttling_(std::move(load_throttling)),
       num_load_threads_(num_load_threads),
       flush_filesystem_caches_(flush_filesystem_caches),
-      pre_load_hook_(std::move(pre_load_hook)) {
+      pre_load_hook_(std::move(pre_load_hook)),
+      post_unload_hook_(std::move(post_unload_hook)) {
   harness_options_.max_num_load_retries = max_num_load_retries;
   harness_options_.load_retry_interval_micros = load_retry_interval_micros;
+  harness_options_.load_retry_backoff_multiplier =
+      load_retry_backoff_multiplier;
+  harness_options_.max_load_retry_interval_micros =
+      max_load_retry_interval_micros;
+  harness_options_.load_retry_jitter = load_retry_jitter;
   harness_options_.error_callback = [this](const ServableId& id,
                                            const Status& error) {
     PublishOnEventBus({id, ServableState::ManagerState::kEnd, error});
@@ -252,15 +208,33 @@ BasicManager::BasicManager(Env* const env, const uint32 num_load_threads,
 
   {
     mutex_lock l(load_executor_mu_);
-    load_executor_ =
-        CreateExecutor(env_, num_load_threads, "BasicManager_Load_ThreadPool");
+    load_executor_ = CreateExecutor(env_, num_load_threads,
+                                    "BasicManager_Load_ThreadPool");
   }
   unload_executor_ = CreateExecutor(env_, num_unload_threads,
                                     "BasicManager_Unload_ThreadPool");
   resource_tracker_ = std::move(resource_tracker);
+  if (release_load_threads_during_load_retries && num_load_threads > 0 &&
+      max_num_load_retries > 0) {
+    load_retry_thread_.reset(env_->StartThread(
+        {}, "BasicManager_Load_Retries", [this]() { RunLoadRetries(); }));
+  }
 }
 
 BasicManager::~BasicManager() {
+  // Cancel the pending load retries, which are then scheduled right away.
+  if (load_retry_thread_ != nullptr) {
+    {
+      mutex_lock l(load_retries_mu_);
+      stop_load_retries_ = true;
+      for (auto& pending_load_retry : pending_load_retries_) {
+        pending_load_retry.second.harness->set_cancel_load_retry(true);
+      }
+      load_retries_cv_.notify_all();
+    }
+    load_retry_thread_.reset();
+  }
+
   // Reset the executors first to finish all pending loads/unloads.
   {
     mutex_lock l(load_executor_mu_);
@@ -319,7 +293,50 @@ BasicManager::GetAvailableUntypedServableHandles() const {
 void BasicManager::UpdateServingMap() {
   // This blocks until the last handle given out by the old serving map is
   // freed.
-  serving_map_.Update(managed_map_);
+  serving_map_.Update(managed_map_, standby_versions_);
+}
+
+void BasicManager::SetStandbyVersions(const string& servable_name,
+                                      const std::set<int64>& versions) {
+  std::vector<ServableId> promoted_ids;
+  {
+    mutex_lock l(mu_);
+    const auto it = standby_versions_.find(servable_name);
+    const std::set<int64> previous_versions =
+        it != standby_versions_.end() ? it->second : std::set<int64>();
+    if (versions == previous_versions) {
+      return;
+    }
+    for (const int64 version : previous_versions) {
+      if (versions.count(version) > 0) {
+        continue;
+      }
+      const auto harness_it = FindHarnessInMap({servable_name, version});
+      if (harness_it != managed_map_.end() &&
+          harness_it->second->state() == LoaderHarness::State::kReady) {
+        promoted_ids.push_back({servable_name, version});
+      }
+    }
+    if (versions.empty()) {
+      standby_versions_.erase(servable_name);
+    } else {
+      standby_versions_[servable_name] = versions;
+    }
+    UpdateServingMap();
+  }
+  // The standby versions were not published as available when they were
+  // loaded.
+  for (const ServableId& id : promoted_ids) {
+    PublishOnEventBus(
+        {id, ServableState::ManagerState::kAvailable, Status::OK()});
+  }
+}
+
+std::set<int64> BasicManager::GetStandbyVersions(
+    const string& servable_name) const {
+  mutex_lock l(mu_);
+  const auto it = standby_versions_.find(servable_name);
+  return it != standby_versions_.end() ? it->second : std::set<int64>();
 }
 
 BasicManager::ManagedMap::iterator BasicManager::FindHarnessInMap(
@@ -399,6 +416,13 @@ Status BasicManager::StopManagingServable(const ServableId& id) {
         id.DebugString(), " ", LoaderHarness::StateDebugString(state));
   }
   managed_map_.erase(it);
+  const auto standby_it = standby_versions_.find(id.name);
+  if (standby_it != standby_versions_.end()) {
+    standby_it->second.erase(id.version);
+    if (standby_it->second.empty()) {
+      standby_versions_.erase(standby_it);
+    }
+  }
   return Status::OK();
 }
 
@@ -475,21 +499,37 @@ std::vector<string> BasicManager::GetManagedServableNames() const {
   return servable_names;
 }
 
-Status BasicManager::ExecuteLoad(LoaderHarness* harness) {
+void BasicManager::StartLoad(LoaderHarness* const harness) {
   PublishOnEventBus({harness->id(), ServableState::ManagerState::kLoading,
                      harness->status()});
-  // We save the id of the harness so that we can publish it after Load(). (We
-  // can't query harness again after Load() as it may be deleted by another
-  // thread that called StopManagingServable().)
-  const ServableId id = harness->id();
-
   if (pre_load_hook_) {
-    pre_load_hook_(id);
+    pre_load_hook_(harness->id());
   }
+}
 
-  // We don't hold the lock while calling Load() as it may block.
-  const Status status = harness->Load();
+void BasicManager::WaitForLoadThrottling(const ServableId& id) {
+  if (load_throttling_.should_pause_loads == nullptr ||
+      num_load_threads() == 0 || !load_throttling_.should_pause_loads()) {
+    return;
+  }
+  LOG(INFO) << "Pausing the load of servable version " << id
+            << ", which yields to serving";
+  const uint64 start_micros = env_->NowMicros();
+  do {
+    const uint64 paused_micros = env_->NowMicros() - start_micros;
+    if (load_throttling_.max_load_pause_micros > 0 &&
+        paused_micros >= load_throttling_.max_load_pause_micros) {
+      LOG(INFO) << "Resuming the load of servable version " << id
+                << " after the max pause of " << paused_micros << " us";
+      return;
+    }
+    env_->SleepForMicroseconds(load_throttling_.pause_check_interval_micros);
+  } while (load_throttling_.should_pause_loads());
+  LOG(INFO) << "Resuming the load of servable version " << id;
+}
 
+Status BasicManager::FinishLoad(const ServableId& id,
+                                const Status& load_status) {
   // Whether the load succeeded or failed, flush filesystem caches if there is
   // only one load thread.
   if (flush_filesystem_caches_ && num_load_threads() <= 1) {
@@ -499,18 +539,135 @@ Status BasicManager::ExecuteLoad(LoaderHarness* harness) {
     }
   }
 
-  TF_RETURN_IF_ERROR(status);
+  TF_RETURN_IF_ERROR(load_status);
 
+  bool in_standby;
   {
     mutex_lock l(mu_);
     UpdateServingMap();
+    const auto standby_it = standby_versions_.find(id.name);
+    in_standby = standby_it != standby_versions_.end() &&
+                 standby_it->second.count(id.version) > 0;
   }
 
-  PublishOnEventBus(
-      {id, ServableState::ManagerState::kAvailable, Status::OK()});
+  // A standby version is published as available once promoted, by
+  // SetStandbyVersions().
+  if (!in_standby) {
+    PublishOnEventBus(
+        {id, ServableState::ManagerState::kAvailable, Status::OK()});
+  }
   return Status::OK();
 }
 
+Status BasicManager::ExecuteLoad(LoaderHarness* harness) {
+  // We save the id of the harness so that we can publish it after Load(). (We
+  // can't query harness again after Load() as it may be deleted by another
+  // thread that called StopManagingServable().)
+  const ServableId id = harness->id();
+  StartLoad(harness);
+
+  // We don't hold the lock while calling Load() as it may block.
+  Status status;
+  {
+    ScopedThreadCpuAffinity affinity(load_throttling_.load_thread_cpus);
+    ScopedThreadNiceness niceness(load_niceness());
+    status = harness->Load();
+  }
+  return FinishLoad(id, status);
+}
+
+void BasicManager::ExecuteLoadAttempt(LoaderHarness* const harness,
+                                      const DoneCallback done_callback) {
+  // The harness stays in state kLoading until the last attempt, so it is not
+  // deleted in between.
+  const ServableId id = harness->id();
+  bool retry;
+  int64 retry_delay_micros;
+  Status status;
+  {
+    ScopedThreadCpuAffinity affinity(load_throttling_.load_thread_cpus);
+    ScopedThreadNiceness niceness(load_niceness());
+    status = harness->LoadAttempt(&retry, &retry_delay_micros);
+  }
+  if (retry) {
+    // The retry waits out of the execution phase. Its resources stay
+    // reserved, so the loads whose resources cannot be reserved wait for it
+    // as for an execution.
+    {
+      mutex_lock l(mu_);
+      ++num_parked_load_retries_;
+    }
+    EndLoadOrUnloadExecution();
+    ScheduleLoadRetry(harness, retry_delay_micros,
+                      [this, harness, done_callback]() {
+                        ResumeLoadAttempt(harness, done_callback);
+                      });
+    return;
+  }
+  const Status load_status = FinishLoad(id, status);
+  EndLoadOrUnloadExecution();
+  done_callback(load_status);
+}
+
+void BasicManager::ResumeLoadAttempt(LoaderHarness* const harness,
+                                     const DoneCallback done_callback) {
+  WaitForLoadThrottling(harness->id());
+  {
+    mutex_lock decision_lock(load_unload_decision_phase_mu_);
+    mutex_lock l(mu_);
+    --num_parked_load_retries_;
+    ++num_ongoing_load_unload_executions_;
+  }
+  ExecuteLoadAttempt(harness, done_callback);
+}
+
+void BasicManager::ScheduleLoadRetry(LoaderHarness* const harness,
+                                     const int64 delay_micros,
+                                     std::function<void()> retry) {
+  {
+    mutex_lock l(load_retries_mu_);
+    if (!stop_load_retries_) {
+      const uint64 due_micros =
+          env_->NowMicros() + std::max<int64>(delay_micros, 0);
+      pending_load_retries_.emplace(
+          due_micros, PendingLoadRetry{harness, std::move(retry)});
+      load_retries_cv_.notify_all();
+      return;
+    }
+  }
+  harness->set_cancel_load_retry(true);
+  retry();
+}
+
+void BasicManager::RunLoadRetries() {
+  while (true) {
+    std::function<void()> retry;
+    {
+      mutex_lock l(load_retries_mu_);
+      while (retry == nullptr) {
+        if (pending_load_retries_.empty()) {
+          if (stop_load_retries_) {
+            return;
+          }
+          load_retries_cv_.wait(l);
+          continue;
+        }
+        const auto next = pending_load_retries_.begin();
+        const uint64 now_micros = env_->NowMicros();
+        if (!stop_load_retries_ && next->first > now_micros) {
+          load_retries_cv_.wait_for(
+              l, std::chrono::microseconds(next->first - now_micros));
+          continue;
+        }
+        retry = std::move(next->second.retry);
+        pending_load_retries_.erase(next);
+      }
+    }
+    mutex_lock l(load_executor_mu_);
+    load_executor_->Schedule(std::move(retry));
+  }
+}
+
 void BasicManager::LoadServable(const ServableId& id,
                                 const DoneCallback done_callback) {
   VLOG(1) << "Request to load servable " << id;
@@ -528,6 +685,19 @@ void BasicManager::CancelLoadServableRetry(const ServableId& id) {
     return;
   }
   harness->set_cancel_load_retry(true);
+
+  // A retry waiting without a load thread is scheduled right away, to fail.
+  mutex_lock retries_lock(load_retries_mu_);
+  for (auto it = pending_load_retries_.begin();
+       it != pending_load_retries_.end(); ++it) {
+    if (it->second.harness == harness) {
+      PendingLoadRetry pending_load_retry = std::move(it->second);
+      pending_load_retries_.erase(it);
+      pending_load_retries_.emplace(0, std::move(pending_load_retry));
+      load_retries_cv_.notify_all();
+      break;
+    }
+  }
 }
 
 Status BasicManager::ExecuteUnload(LoaderHarness* harness) {
@@ -546,7 +716,13 @@ Status BasicManager::ExecuteUnload(LoaderHarness* harness) {
   }
 
   // We don't hold the lock while calling Unload() as it may block.
-  TF_RETURN_IF_ERROR(harness->Unload());
+  {
+    ScopedThreadCpuAffinity affinity(load_throttling_.load_thread_cpus);
+    TF_RETURN_IF_ERROR(harness->Unload());
+  }
+  if (post_unload_hook_) {
+    post_unload_hook_(id);
+  }
   PublishOnEventBus({id, ServableState::ManagerState::kEnd, Status::OK()});
   return Status::OK();
 }
@@ -571,15 +747,22 @@ Status BasicManager::ExecuteLoadOrUnload(const LoadOrUnloadRequest& request,
       execution_status = ExecuteUnload(harness);
       break;
   }
+  EndLoadOrUnloadExecution();
+  return execution_status;
+}
 
+void BasicManager::EndLoadOrUnloadExecution() {
+  std::vector<PendingLoadRetry> waiting_loads;
   {
     mutex_lock l(mu_);
     --num_ongoing_load_unload_executions_;
     DCHECK_GE(num_ongoing_load_unload_executions_, 0);
     num_ongoing_load_unload_executions_cv_.notify_all();
+    waiting_loads.swap(loads_waiting_for_executions_);
+  }
+  for (PendingLoadRetry& waiting_load : waiting_loads) {
+    ScheduleLoadRetry(waiting_load.harness, 0, std::move(waiting_load.retry));
   }
-
-  return execution_status;
 }
 
 void BasicManager::SetNumLoadThreads(const uint32 num_load_threads) {
@@ -587,8 +770,8 @@ void BasicManager::SetNumLoadThreads(const uint32 num_load_threads) {
 
   load_executor_.reset();
   num_load_threads_.store(num_load_threads);
-  load_executor_ =
-      CreateExecutor(env_, num_load_threads, "BasicManager_Load_ThreadPool");
+  load_executor_ = CreateExecutor(env_, num_load_threads,
+                                  "BasicManager_Load_ThreadPool");
 }
 
 uint32 BasicManager::num_load_threads() const {
@@ -637,35 +820,78 @@ void BasicManager::LoadOrUnloadServable(const LoadOrUnloadRequest& request,
 
 void BasicManager::HandleLoadOrUnloadRequest(const LoadOrUnloadRequest& request,
                                              DoneCallback done_callback) {
+  if (request.kind == LoadOrUnloadRequest::Kind::kLoad) {
+    WaitForLoadThrottling(request.servable_id);
+  }
+
   // Decision phase.
   Status decision_status;
   LoaderHarness* harness;
+  LoadPark park = LoadPark::kNone;
   {
     // We serialize the decision phases of the requests. We will make a decision
     // about the present request before allowing other requests to enter their
     // decision phase. See the .h file for more explanation and rationale.
     mutex_lock l(load_unload_decision_phase_mu_);
-    decision_status = ApproveLoadOrUnload(request, &harness);
+    decision_status =
+        ApproveLoadOrUnload(request, done_callback, &harness,
+                            load_retry_thread_ != nullptr ? &park : nullptr);
   }
   if (!decision_status.ok()) {
     done_callback(decision_status);
     return;
   }
+  switch (park) {
+    case LoadPark::kNone:
+      break;
+    case LoadPark::kUntilExecutionEnds:
+      return;
+    case LoadPark::kForReservationRetry: {
+      LoadOrUnloadRequest retry_request = request;
+      ++retry_request.num_reservation_retries;
+      ScheduleLoadRetry(harness, harness_options_.load_retry_interval_micros,
+                        [this, retry_request, done_callback]() {
+                          HandleLoadOrUnloadRequest(retry_request,
+                                                    done_callback);
+                        });
+      return;
+    }
+  }
 
   // Execution phase.
+  if (request.kind == LoadOrUnloadRequest::Kind::kLoad &&
+      load_retry_thread_ != nullptr) {
+    StartLoad(harness);
+    ExecuteLoadAttempt(harness, done_callback);
+    return;
+  }
   const Status execution_status = ExecuteLoadOrUnload(request, harness);
   done_callback(execution_status);
 }
 
 Status BasicManager::ApproveLoadOrUnload(const LoadOrUnloadRequest& request,
-                                         LoaderHarness** harness) {
+                                         const DoneCallback& done_callback,
+                                         LoaderHarness** harness,
+                                         LoadPark* const park) {
   mutex_lock l(mu_);
 
   TF_RETURN_IF_ERROR(GetHealthyHarness(request.servable_id, harness));
 
   switch (request.kind) {
     case LoadOrUnloadRequest::Kind::kLoad: {
-      TF_RETURN_IF_ERROR(ApproveLoad(*harness, &l));
+      TF_RETURN_IF_ERROR(ApproveLoad(*harness, &l,
+                                     request.num_reservation_retries, park));
+      if (park != nullptr && *park != LoadPark::kNone) {
+        // The parked request stays in state kLoadRequested, so its harness is
+        // not deleted meanwhile.
+        if (*park == LoadPark::kUntilExecutionEnds) {
+          loads_waiting_for_executions_.push_back(PendingLoadRetry{
+              *harness, [this, request, done_callback]() {
+                HandleLoadOrUnloadRequest(request, done_callback);
+              }});
+        }
+        return Status::OK();
+      }
       break;
     }
     case LoadOrUnloadRequest::Kind::kUnload: {
@@ -679,11 +905,13 @@ Status BasicManager::ApproveLoadOrUnload(const LoadOrUnloadRequest& request,
   return Status::OK();
 }
 
-Status BasicManager::ApproveLoad(LoaderHarness* harness, mutex_lock* mu_lock) {
+Status BasicManager::ApproveLoad(LoaderHarness* harness, mutex_lock* mu_lock,
+                                 const uint32 num_reservation_retries,
+                                 LoadPark* const park) {
   if (resource_tracker_ != nullptr) {
     // Attempt to reserve resources for the load.
     const Status resource_reservation_status =
-        ReserveResources(harness, mu_lock);
+        ReserveResources(harness, mu_lock, num_reservation_retries, park);
     if (!resource_reservation_status.ok()) {
       LOG(WARNING) << resource_reservation_status;
       harness->Error(resource_reservation_status);
@@ -691,6 +919,9 @@ Status BasicManager::ApproveLoad(LoaderHarness* harness, mutex_lock* mu_lock) {
                          resource_reservation_status});
       return resource_reservation_status;
     }
+    if (park != nullptr && *park != LoadPark::kNone) {
+      return Status::OK();
+    }
   }
 
   // Transition to state kLoadApproved inside the decision phase. We rely
@@ -710,23 +941,39 @@ Status BasicManager::ApproveUnload(LoaderHarness* harness) {
 }
 
 Status BasicManager::ReserveResources(LoaderHarness* harness,
-                                      mutex_lock* mu_lock) {
+                                      mutex_lock* mu_lock,
+                                      const uint32 num_reservation_retries,
+                                      LoadPark* const park) {
   while (true) {
     TF_RETURN_IF_ERROR(resource_tracker_->RecomputeUsedResources(
         GetLoadersCurrentlyUsingResources()));
     bool resources_reserved;
+    const auto reserve_resources = [&]() TF_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      return resource_tracker_->ReserveResources(*harness->loader(),
+                                                 &resources_reserved);
+    };
     // We retry reserving resources because it may involve transiently failing
-    // operations like file-reads.
-    const Status reserve_resources_status = Retry(
-        strings::StrCat("Reserving resources for servable: ",
-                        harness->id().DebugString()),
-        harness_options_.max_num_load_retries,
-        harness_options_.load_retry_interval_micros,
-        [&]() TF_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
-          return resource_tracker_->ReserveResources(*harness->loader(),
-                                                     &resources_reserved);
-        },
-        [&]() { return harness->cancel_load_retry(); });
+    // operations like file-reads. Parked, the retries do not hold the decision
+    // phase.
+    Status reserve_resources_status;
+    if (park == nullptr) {
+      reserve_resources_status = Retry(
+          strings::StrCat("Reserving resources for servable: ",
+                          harness->id().DebugString()),
+          harness_options_.max_num_load_retries,
+          harness_options_.load_retry_interval_micros, reserve_resources,
+          [&]() { return harness->cancel_load_retry(); });
+    } else {
+      reserve_resources_status = reserve_resources();
+      if (!reserve_resources_status.ok() && !harness->cancel_load_retry() &&
+          num_reservation_retries < harness_options_.max_num_load_retries) {
+        LOG(INFO) << "Reserving resources for servable: "
+                  << harness->id().DebugString() << " failed with "
+                  << reserve_resources_status << ", retrying";
+        *park = LoadPark::kForReservationRetry;
+        return Status::OK();
+      }
+    }
     if (!reserve_resources_status.ok()) {
       return Status(
           reserve_resources_status.code(),
@@ -743,14 +990,20 @@ Status BasicManager::ReserveResources(LoaderHarness* harness,
     }
 
     // We weren't able to reserve the resources. See if there are any
-    // ongoing load/unload executions that may be temporarily tying up
-    // resources.
-    if (num_ongoing_load_unload_executions_ == 0) {
+    // ongoing load/unload executions, or load retries, that may be
+    // temporarily tying up resources.
+    if (num_ongoing_load_unload_executions_ == 0 &&
+        num_parked_load_retries_ == 0) {
       // There are no ongoing load/unloads, so we really are out of
       // resources for this servable.
       return errors::ResourceExhausted(
           "Insufficient resources to load servable ",
           harness->id().DebugString());
+    } else if (park != nullptr) {
+      // Parked until at least one load/unload request finishes.
+      VLOG(1) << "Parking until another load/unload request finishes";
+      *park = LoadPark::kUntilExecutionEnds;
+      return Status::OK();
     } else {
       // Wait until at least one load/unload request finishes, then retry.
       VLOG(1) << "Waiting for another load/unload request to finish";
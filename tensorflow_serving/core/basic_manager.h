@@ -17,7 +17,10 @@ limitations under the License.
 #define TENSORFLOW_SERVING_CORE_BASIC_MANAGER_H_
 
 #include <atomic>
+#include <functional>
+#include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -108,6 +111,41 @@ class BasicManager : public Manager {
   // Type of the callback to be called just before a servable is to be loaded.
   using PreLoadHook = std::function<void(const ServableId&)>;
 
+  // Throttling of the loads, so that they yield to serving, e.g. so that the
+  // serving latency holds during rollouts.
+  struct LoadThrottlingOptions {
+    // If positive, the niceness the loads run at, e.g. 10, so that the OS
+    // schedules the serving threads first when the CPUs are busy. The threads
+    // a load starts, e.g. the thread pools of the servable, get the default
+    // niceness back once it is done, which requires CAP_SYS_NICE or a high
+    // enough RLIMIT_NICE: without them, the loads run at the default niceness.
+    // Only supported on Linux, and only applies if num_load_threads > 0.
+    int load_thread_niceness = 0;
+
+    // If not empty, the CPUs the loads and unloads run on, e.g. to keep them
+    // off the CPUs serving the requests. Like for the niceness, the threads a
+    // load starts get the previous affinity back once it is done, so that the
+    // servable does not serve on these CPUs. Must be valid CPUs, see
+    // ValidateCpus(). Only supported on Linux.
+    std::vector<int> load_thread_cpus;
+
+    // If set, called before each load, before its decision phase. While it
+    // returns true, e.g. because the serving latency is high, the load waits,
+    // checking every 'pause_check_interval_micros'. Only applies if
+    // num_load_threads > 0, so that the thread calling LoadServable() is never
+    // paused.
+    std::function<bool()> should_pause_loads;
+    int64 pause_check_interval_micros = 100 * 1000;
+
+    // The max time, in microseconds, a load waits for 'should_pause_loads',
+    // after which it runs anyway, so that the loads are not paused forever
+    // under a steady high load. If 0, there is no limit.
+    int64 max_load_pause_micros = 60 * 1000 * 1000;
+  };
+
+  // Type of the callback to be called just after a servable is unloaded.
+  using PostUnloadHook = std::function<void(const ServableId&)>;
+
   /// Config options and pluggable objects that will be used by the
   /// BasicManager.
   struct Options {
@@ -140,6 +178,26 @@ class BasicManager : public Manager {
     // Default: 1 minute.
     int64 load_retry_interval_micros = 1LL * 60 * 1000 * 1000;
 
+    // The factor the load retry interval is multiplied by after each retry. If
+    // set to 1, the interval is fixed.
+    double load_retry_backoff_multiplier = 1;
+
+    // The max interval, in microseconds, between two load retries. If set to
+    // 0, a day.
+    int64 max_load_retry_interval_micros = 0;
+
+    // The fraction, in [0, 1], of each load retry interval that is randomized,
+    // so that the servables failing together are not retried together.
+    double load_retry_jitter = 0;
+
+    // If true, a servable whose load failed waits for its retry without
+    // holding a load thread, which meanwhile loads other servables. Likewise
+    // for the retries of its resource reservation, and for the wait of the
+    // reservation for the ongoing loads and unloads to finish, which do not
+    // block the decision phases of the other requests either. Only applies
+    // if num_load_threads > 0.
+    bool release_load_threads_during_load_retries = false;
+
     // If true, and there are not multiple load threads, filesystem caches will
     // be flushed after each servable is loaded. (Cache flush is skipped when
     // multiple load threads are active, in order to avoid setting back a
@@ -152,6 +210,14 @@ class BasicManager : public Manager {
     // Callback to be called just before a servable is to be loaded. This will
     // called on the same manager load thread which starts the load.
     PreLoadHook pre_load_hook;
+
+    // Callback to be called just after a servable is unloaded, before its
+    // kEnd state is published. This will be called on the manager unload
+    // thread which ran the unload, e.g. to release the freed memory.
+    PostUnloadHook post_unload_hook;
+
+    // Throttling of the loads, disabled by default.
+    LoadThrottlingOptions load_throttling;
   };
   static Status Create(Options options, std::unique_ptr<BasicManager>* manager);
 
@@ -270,10 +336,27 @@ class BasicManager : public Manager {
 
   BasicManager(Env* env, uint32 num_load_threads, uint32 num_unload_threads,
                uint32 max_num_load_retries, int64 load_retry_interval_micros,
+               double load_retry_backoff_multiplier,
+               int64 max_load_retry_interval_micros, double load_retry_jitter,
+               bool release_load_threads_during_load_retries,
                bool flush_filesystem_caches,
                std::unique_ptr<ResourceTracker> resource_tracker,
                EventBus<ServableState>* servable_event_bus,
-               PreLoadHook pre_load_hook);
+               PreLoadHook pre_load_hook, PostUnloadHook post_unload_hook,
+               LoadThrottlingOptions load_throttling);
+
+  // Sets the versions of 'servable_name' held in standby: once ready, they are
+  // neither served nor published as available on the event bus (they stay
+  // kLoading) until they leave the set. Updates the serving map if the set
+  // changes, so that promoting a ready version only swaps the map, and then
+  // publishes the promoted versions as available.
+  void SetStandbyVersions(const string& servable_name,
+                          const std::set<int64>& versions)
+      TF_LOCKS_EXCLUDED(mu_);
+
+  // Returns the versions of 'servable_name' held in standby.
+  std::set<int64> GetStandbyVersions(const string& servable_name) const
+      TF_LOCKS_EXCLUDED(mu_);
 
   // Starts managing the servable.
   //
@@ -307,6 +390,22 @@ class BasicManager : public Manager {
     enum class Kind { kLoad, kUnload };
     Kind kind;
     ServableId servable_id;
+    // The number of retries of the resource reservation of a load request
+    // parked by ApproveLoadOrUnload().
+    uint32 num_reservation_retries = 0;
+  };
+
+  // How a load request whose resources cannot be reserved yet waits, without
+  // a load thread and out of the decision phase, with
+  // 'release_load_threads_during_load_retries'.
+  enum class LoadPark {
+    // The request is not parked.
+    kNone,
+    // The request is in 'loads_waiting_for_executions_', until a load or
+    // unload execution, or a parked load retry, ends.
+    kUntilExecutionEnds,
+    // The reservation is to be retried after the load retry interval.
+    kForReservationRetry,
   };
 
   // A unification of LoadServable() and UnloadServable().
@@ -331,8 +430,15 @@ class BasicManager : public Manager {
   // subsequent execution phase of the request because approval of this request
   // precludes concurrent execution of another request that could delete the
   // harness.)
+  //
+  // If 'park' is not null, i.e. with 'release_load_threads_during_load_retries',
+  // a load request whose resources cannot be reserved yet is parked instead of
+  // waiting: returns "ok" with 'park' set, without entering the execution
+  // phase. The request is then rescheduled with 'done_callback'.
   Status ApproveLoadOrUnload(const LoadOrUnloadRequest& request,
-                             LoaderHarness** harness) TF_LOCKS_EXCLUDED(mu_);
+                             const DoneCallback& done_callback,
+                             LoaderHarness** harness, LoadPark* park)
+      TF_LOCKS_EXCLUDED(mu_);
 
   // The decision phase of whether to approve a load request.
   //
@@ -341,8 +447,10 @@ class BasicManager : public Manager {
   // concurrently.
   //
   // Argument 'mu_lock' is a lock held on 'mu_'. It is released temporarily via
-  // 'num_ongoing_load_unload_executions_cv_'.
-  Status ApproveLoad(LoaderHarness* harness, mutex_lock* mu_lock)
+  // 'num_ongoing_load_unload_executions_cv_'. See ReserveResources() for
+  // 'num_reservation_retries' and 'park'.
+  Status ApproveLoad(LoaderHarness* harness, mutex_lock* mu_lock,
+                     uint32 num_reservation_retries, LoadPark* park)
       TF_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
   // The decision phase of whether to approve an unload request. If it succeeds,
@@ -357,7 +465,12 @@ class BasicManager : public Manager {
   //
   // Argument 'mu_lock' is a lock held on 'mu_'. It is released temporarily via
   // 'num_ongoing_load_unload_executions_cv_'.
-  Status ReserveResources(LoaderHarness* harness, mutex_lock* mu_lock)
+  //
+  // If 'park' is not null, makes a single reservation attempt, the
+  // 'num_reservation_retries'-th retry, and instead of retrying it or waiting
+  // for the ongoing executions, sets 'park' and returns "ok".
+  Status ReserveResources(LoaderHarness* harness, mutex_lock* mu_lock,
+                          uint32 num_reservation_retries, LoadPark* park)
       TF_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
   // The execution phase of loading/unloading a servable. Delegates to either
@@ -368,9 +481,55 @@ class BasicManager : public Manager {
   Status ExecuteLoadOrUnload(const LoadOrUnloadRequest& request,
                              LoaderHarness* harness);
 
+  // Signals exit of the execution phase of a load/unload request by
+  // decrementing 'num_ongoing_load_unload_executions_', and reschedules the
+  // loads in 'loads_waiting_for_executions_'.
+  void EndLoadOrUnloadExecution() TF_LOCKS_EXCLUDED(mu_);
+
   // The execution phase of loading a servable.
   Status ExecuteLoad(LoaderHarness* harness) TF_LOCKS_EXCLUDED(mu_);
 
+  // The steps of ExecuteLoad() before and after the load of the servable.
+  // FinishLoad() returns 'load_status' if it is an error.
+  void StartLoad(LoaderHarness* harness) TF_LOCKS_EXCLUDED(mu_);
+
+  // Waits while the load throttling pauses the loads, before the decision
+  // phase of a load request, so that the paused load holds neither resources
+  // nor an execution slot. Does not wait without load threads.
+  void WaitForLoadThrottling(const ServableId& id);
+
+  // Returns the niceness the loads run at, see LoadThrottlingOptions.
+  int load_niceness() const {
+    return num_load_threads() > 0 ? load_throttling_.load_thread_niceness : 0;
+  }
+  Status FinishLoad(const ServableId& id, const Status& load_status)
+      TF_LOCKS_EXCLUDED(mu_);
+
+  // The execution phase of loading a servable when
+  // 'release_load_threads_during_load_retries' is set: makes one load attempt
+  // and, if it is to be retried, leaves the execution phase, schedules the
+  // retry with ScheduleLoadRetry() and returns. Otherwise ends the execution
+  // phase and calls 'done_callback'.
+  void ExecuteLoadAttempt(LoaderHarness* harness, DoneCallback done_callback)
+      TF_LOCKS_EXCLUDED(mu_);
+
+  // Runs a load retry scheduled by ExecuteLoadAttempt(): re-enters the
+  // execution phase through the decision phase, then makes the attempt. The
+  // resources of the servable stay reserved in between.
+  void ResumeLoadAttempt(LoaderHarness* harness, DoneCallback done_callback)
+      TF_LOCKS_EXCLUDED(mu_);
+
+  // Schedules 'retry' on the load executor after 'delay_micros', or runs it
+  // right away with the retries of 'harness' cancelled if the manager is
+  // being destroyed.
+  void ScheduleLoadRetry(LoaderHarness* harness, int64 delay_micros,
+                         std::function<void()> retry)
+      TF_LOCKS_EXCLUDED(load_retries_mu_);
+
+  // The loop of 'load_retry_thread_', which schedules the pending load retries
+  // on the load executor once they are due.
+  void RunLoadRetries() TF_LOCKS_EXCLUDED(load_retries_mu_);
+
   // The execution phase of loading a unservable.
   Status ExecuteUnload(LoaderHarness* harness) TF_LOCKS_EXCLUDED(mu_);
 
@@ -420,6 +579,11 @@ class BasicManager : public Manager {
   // states.
   ManagedMap managed_map_ TF_GUARDED_BY(mu_);
 
+  // The versions held in standby, keyed by servable name. See
+  // SetStandbyVersions().
+  using StandbyMap = std::map<string, std::set<int64>>;
+  StandbyMap standby_versions_ TF_GUARDED_BY(mu_);
+
   // ServingMap contains all the servables which are ready to be served, which
   // is a subset of those in the managed map.
   // This map is updated occasionally from the main manager loop thread while
@@ -446,23 +610,23 @@ class BasicManager : public Manager {
     GetAvailableUntypedServableHandles() const;
 
     // Updates the serving map by copying servables from the managed map, which
-    // are ready to be served.
-    void Update(const ManagedMap& managed_map);
+    // are ready to be served and not in 'standby_versions'.
+    void Update(const ManagedMap& managed_map,
+                const StandbyMap& standby_versions);
 
    private:
-    struct EqRequest;
-    // Hash and equality functors for ServableRequest.
-    // Forward-declared here and defined in the cc file.
-    struct HashRequest;
-
-    // Map from ServableRequest to corresponding harness. For the latest version
-    // of a servable stream, we add an extra entry for it, where key is the
-    // ServableRequest without the version set, so that requests for the latest,
-    // can be directly queried on this map.
-    using HandlesMap =
-        std::unordered_multimap<ServableRequest,
-                                std::shared_ptr<const LoaderHarness>,
-                                HashRequest, EqRequest>;
+    // The harnesses of the available versions of a servable stream. The
+    // earliest and latest ones are resolved when the map is updated, so that
+    // auto-versioned requests take a single lookup by name.
+    struct ServableVersions {
+      std::shared_ptr<const LoaderHarness> earliest;
+      std::shared_ptr<const LoaderHarness> latest;
+      // Sorted by version, in increasing order.
+      std::vector<std::shared_ptr<const LoaderHarness>> versions;
+    };
+
+    // Map from servable name to its available versions.
+    using HandlesMap = std::unordered_map<string, ServableVersions>;
     FastReadDynamicPtr<HandlesMap> handles_map_;
   };
   ServingMap serving_map_;
@@ -482,6 +646,8 @@ class BasicManager : public Manager {
 
   Env* const env_;
 
+  const LoadThrottlingOptions load_throttling_;
+
   // The number of load threads. Can be changed after instantiation of the
   // manager via SetNumLoadThreads().
   std::atomic<uint32> num_load_threads_;
@@ -511,6 +677,31 @@ class BasicManager : public Manager {
 
   PreLoadHook pre_load_hook_;
 
+  PostUnloadHook post_unload_hook_;
+
+  // The load retries waiting without a load thread, by the time, in
+  // microseconds, they are due at. Only used with
+  // 'release_load_threads_during_load_retries'.
+  struct PendingLoadRetry {
+    LoaderHarness* harness;
+    std::function<void()> retry;
+  };
+  mutex load_retries_mu_;
+  condition_variable load_retries_cv_;
+  std::multimap<uint64, PendingLoadRetry> pending_load_retries_
+      TF_GUARDED_BY(load_retries_mu_);
+  // The load requests parked by ApproveLoadOrUnload() until a load or unload
+  // execution ends. Rescheduled by EndLoadOrUnloadExecution().
+  std::vector<PendingLoadRetry> loads_waiting_for_executions_
+      TF_GUARDED_BY(mu_);
+  // The number of load retries waiting out of the execution phase, whose
+  // resources stay reserved. Loads whose resources cannot be reserved wait
+  // for them as for the ongoing executions.
+  int num_parked_load_retries_ TF_GUARDED_BY(mu_) = 0;
+  // Set by the destructor, after which the retries are cancelled.
+  bool stop_load_retries_ TF_GUARDED_BY(load_retries_mu_) = false;
+  std::unique_ptr<Thread> load_retry_thread_;
+
   TF_DISALLOW_COPY_AND_ASSIGN(BasicManager);
 };
 
@@ -16,7 +16,9 @@ limitations under the License.
 #include "tensorflow_serving/core/basic_manager.h"
 
 #include <algorithm>
+#include <atomic>
 #include <functional>
+#include <thread>  // NOLINT(build/c++11)
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -175,6 +177,36 @@ TEST_P(BasicManagerTest, ServableHandleLatest) {
   EXPECT_EQ(kNumVersionsPerServable + 1, *handle);
 }
 
+TEST_P(BasicManagerTest, ServableHandleVersionsLoadedOutOfOrder) {
+  for (const int64 version : {7, 3, 5}) {
+    const ServableId id = {kServableName3, version};
+    TF_ASSERT_OK(basic_manager_->ManageServable(CreateServable(id)));
+    basic_manager_->LoadServable(
+        id, [](const Status& status) { TF_ASSERT_OK(status); });
+    WaitUntilServableManagerStateIsOneOf(
+        servable_state_monitor_, id, {ServableState::ManagerState::kAvailable});
+  }
+
+  for (const int64 version : {3, 5, 7}) {
+    ServableHandle<int64> handle;
+    TF_ASSERT_OK(basic_manager_->GetServableHandle(
+        ServableRequest::Specific(kServableName3, version), &handle));
+    EXPECT_EQ(version, *handle);
+  }
+  ServableHandle<int64> handle;
+  EXPECT_EQ(error::NOT_FOUND,
+            basic_manager_
+                ->GetServableHandle(
+                    ServableRequest::Specific(kServableName3, 4), &handle)
+                .code());
+  TF_ASSERT_OK(basic_manager_->GetServableHandle(
+      ServableRequest::Earliest(kServableName3), &handle));
+  EXPECT_EQ(3, *handle);
+  TF_ASSERT_OK(basic_manager_->GetServableHandle(
+      ServableRequest::Latest(kServableName3), &handle));
+  EXPECT_EQ(7, *handle);
+}
+
 TEST_P(BasicManagerTest, AlreadyManagedError) {
   const ServableId id = {"banana", 42};
   TF_ASSERT_OK(basic_manager_->ManageServable(CreateServable(id)));
@@ -1224,6 +1256,138 @@ TEST(NonParameterizedBasicManagerTest, PreLoadHook) {
                           [](const Status& status) { TF_ASSERT_OK(status); });
 }
 
+TEST(NonParameterizedBasicManagerTest, PostUnloadHook) {
+  BasicManager::Options options;
+  // Single threaded execution.
+  options.num_load_threads = 0;
+  options.num_unload_threads = 0;
+  // No event bus.
+  options.servable_event_bus = nullptr;
+  MockFunction<void(const ServableId&)> mock_post_unload_hook;
+  options.post_unload_hook = mock_post_unload_hook.AsStdFunction();
+  std::unique_ptr<BasicManager> manager;
+  TF_ASSERT_OK(BasicManager::Create(std::move(options), &manager));
+
+  const ServableId id = {kServableName, 7};
+  test_util::MockLoader* loader = new NiceMock<test_util::MockLoader>();
+  TF_ASSERT_OK(manager->ManageServable({id, std::unique_ptr<Loader>(loader)}));
+
+  bool unloaded = false;
+  EXPECT_CALL(*loader, Unload()).WillOnce(InvokeWithoutArgs([&]() {
+    unloaded = true;
+  }));
+  EXPECT_CALL(mock_post_unload_hook, Call(id))
+      .WillOnce(InvokeWithoutArgs([&]() { EXPECT_TRUE(unloaded); }));
+  manager->LoadServable(id, [](const Status& status) { TF_ASSERT_OK(status); });
+  manager->UnloadServable(id,
+                          [](const Status& status) { TF_ASSERT_OK(status); });
+}
+
+TEST(NonParameterizedBasicManagerTest, LoadsPauseWhileThrottled) {
+  BasicManager::Options options;
+  options.num_load_threads = 1;
+  options.num_unload_threads = 0;
+  options.servable_event_bus = nullptr;
+  std::atomic<int> num_pause_checks(0);
+  options.load_throttling.should_pause_loads = [&num_pause_checks]() {
+    return ++num_pause_checks <= 3;
+  };
+  options.load_throttling.pause_check_interval_micros = 1;
+  std::unique_ptr<BasicManager> manager;
+  TF_ASSERT_OK(BasicManager::Create(std::move(options), &manager));
+
+  const ServableId id = {kServableName, 7};
+  TF_ASSERT_OK(manager->ManageServable(CreateServable(id)));
+  Notification load_done;
+  manager->LoadServable(id, [&load_done](const Status& status) {
+    TF_EXPECT_OK(status);
+    load_done.Notify();
+  });
+  load_done.WaitForNotification();
+  EXPECT_EQ(num_pause_checks, 4);
+}
+
+TEST(NonParameterizedBasicManagerTest, LoadsNeverPauseTheCallingThread) {
+  BasicManager::Options options;
+  options.num_load_threads = 0;
+  options.num_unload_threads = 0;
+  options.servable_event_bus = nullptr;
+  int num_pause_checks = 0;
+  options.load_throttling.should_pause_loads = [&num_pause_checks]() {
+    ++num_pause_checks;
+    return true;
+  };
+  std::unique_ptr<BasicManager> manager;
+  TF_ASSERT_OK(BasicManager::Create(std::move(options), &manager));
+
+  const ServableId id = {kServableName, 7};
+  TF_ASSERT_OK(manager->ManageServable(CreateServable(id)));
+  manager->LoadServable(id, [](const Status& status) { TF_ASSERT_OK(status); });
+  EXPECT_EQ(num_pause_checks, 0);
+}
+
+TEST(NonParameterizedBasicManagerTest, LoadsPauseAtMostMaxLoadPauseMicros) {
+  BasicManager::Options options;
+  options.num_load_threads = 1;
+  options.num_unload_threads = 0;
+  options.servable_event_bus = nullptr;
+  options.load_throttling.load_thread_niceness = 10;
+  options.load_throttling.should_pause_loads = []() { return true; };
+  options.load_throttling.pause_check_interval_micros = 100;
+  options.load_throttling.max_load_pause_micros = 1000;
+  std::unique_ptr<BasicManager> manager;
+  TF_ASSERT_OK(BasicManager::Create(std::move(options), &manager));
+
+  const ServableId id = {kServableName, 7};
+  TF_ASSERT_OK(manager->ManageServable(CreateServable(id)));
+  Notification load_done;
+  manager->LoadServable(id, [&load_done](const Status& status) {
+    TF_EXPECT_OK(status);
+    load_done.Notify();
+  });
+  load_done.WaitForNotification();
+}
+
+TEST(NonParameterizedBasicManagerTest, LoadRetriesReleaseTheLoadThread) {
+  BasicManager::Options options;
+  options.num_load_threads = 1;
+  options.servable_event_bus = nullptr;
+  options.max_num_load_retries = 1;
+  options.load_retry_interval_micros = 60LL * 60 * 1000 * 1000;
+  options.release_load_threads_during_load_retries = true;
+  std::unique_ptr<BasicManager> manager;
+  TF_ASSERT_OK(BasicManager::Create(std::move(options), &manager));
+
+  const ServableId failing_id = {kServableName, 7};
+  test_util::MockLoader* failing_loader =
+      new NiceMock<test_util::MockLoader>();
+  TF_ASSERT_OK(manager->ManageServable(
+      {failing_id, std::unique_ptr<Loader>(failing_loader)}));
+  // The retry is cancelled before it is due.
+  EXPECT_CALL(*failing_loader, LoadWithMetadata(Loader::Metadata{failing_id}))
+      .WillOnce(Return(errors::Internal("Load error.")));
+  const ServableId id = {kServableName2, 7};
+  TF_ASSERT_OK(manager->ManageServable(CreateServable(id)));
+
+  Notification failing_load_done;
+  manager->LoadServable(failing_id, [&](const Status& status) {
+    EXPECT_EQ(errors::Internal("Load error."), status);
+    failing_load_done.Notify();
+  });
+  // The only load thread is not held by the failing load waiting for its
+  // retry.
+  Notification load_done;
+  manager->LoadServable(id, [&](const Status& status) {
+    TF_EXPECT_OK(status);
+    load_done.Notify();
+  });
+  load_done.WaitForNotification();
+  EXPECT_FALSE(failing_load_done.HasBeenNotified());
+
+  manager->CancelLoadServableRetry(failing_id);
+  failing_load_done.WaitForNotification();
+}
+
 // Creates a ResourceAllocation proto with 'quantity' units of RAM.
 ResourceAllocation CreateResourceQuantity(const int quantity) {
   ResourceAllocation allocation;
@@ -1618,6 +1782,142 @@ TEST_F(ResourceConstrainedBasicManagerTest, EventBusErrorOnEstimateResources) {
               EqualsServableState(error_state));
 }
 
+TEST(NonParameterizedBasicManagerTest,
+     LoadsWaitingForResourcesReleaseTheDecisionPhase) {
+  BasicManager::Options options;
+  options.resource_tracker = CreateSimpleResourceTracker(10);
+  options.num_load_threads = 2;
+  options.servable_event_bus = nullptr;
+  options.max_num_load_retries = 1;
+  options.load_retry_interval_micros = 0;
+  options.release_load_threads_during_load_retries = true;
+  std::unique_ptr<BasicManager> manager;
+  TF_ASSERT_OK(BasicManager::Create(std::move(options), &manager));
+
+  const auto estimate_all_resources = [](ResourceAllocation* estimate) {
+    *estimate = CreateResourceQuantity(10);
+    return Status::OK();
+  };
+  // A load that holds all the resources until it fails, retry included.
+  const ServableId failing_id = {"failing", 0};
+  test_util::MockLoader* failing_loader = new NiceMock<test_util::MockLoader>;
+  ON_CALL(*failing_loader, EstimateResources(_))
+      .WillByDefault(Invoke(estimate_all_resources));
+  Notification failing_load_started;
+  Notification fail_load;
+  EXPECT_CALL(*failing_loader, LoadWithMetadata(Loader::Metadata{failing_id}))
+      .WillOnce(InvokeWithoutArgs([&]() {
+        failing_load_started.Notify();
+        fail_load.WaitForNotification();
+        return errors::Internal("Load error.");
+      }))
+      .WillOnce(Return(errors::Internal("Load error.")));
+  TF_ASSERT_OK(manager->ManageServable(
+      CreateServableData(failing_id, std::unique_ptr<Loader>(failing_loader))));
+  // A load that waits for the failing load to end to reserve its resources.
+  const ServableId waiting_id = {"waiting", 0};
+  test_util::MockLoader* waiting_loader = new NiceMock<test_util::MockLoader>;
+  ON_CALL(*waiting_loader, EstimateResources(_))
+      .WillByDefault(Invoke(estimate_all_resources));
+  EXPECT_CALL(*waiting_loader, LoadWithMetadata(Loader::Metadata{waiting_id}))
+      .WillOnce(Return(Status::OK()));
+  TF_ASSERT_OK(manager->ManageServable(
+      CreateServableData(waiting_id, std::unique_ptr<Loader>(waiting_loader))));
+  // A load that needs no resources.
+  const ServableId free_id = {"free", 0};
+  TF_ASSERT_OK(manager->ManageServable(CreateServable(free_id)));
+
+  Notification failing_load_done;
+  manager->LoadServable(failing_id, [&](const Status& status) {
+    EXPECT_EQ(errors::Internal("Load error."), status);
+    failing_load_done.Notify();
+  });
+  failing_load_started.WaitForNotification();
+  Notification waiting_load_done;
+  manager->LoadServable(waiting_id, [&](const Status& status) {
+    TF_EXPECT_OK(status);
+    waiting_load_done.Notify();
+  });
+  // Neither the decision phase nor the second load thread are held by the
+  // waiting load.
+  Notification free_load_done;
+  manager->LoadServable(free_id, [&](const Status& status) {
+    TF_EXPECT_OK(status);
+    free_load_done.Notify();
+  });
+  free_load_done.WaitForNotification();
+  EXPECT_FALSE(waiting_load_done.HasBeenNotified());
+
+  // The failing load releases its resources, and wakes up the waiting load.
+  fail_load.Notify();
+  failing_load_done.WaitForNotification();
+  waiting_load_done.WaitForNotification();
+}
+
+TEST(NonParameterizedBasicManagerTest, PausedLoadsHoldNoResources) {
+  BasicManager::Options options;
+  options.resource_tracker = CreateSimpleResourceTracker(10);
+  options.num_load_threads = 2;
+  options.servable_event_bus = nullptr;
+  // Only the first load to check is paused, until 'resume_load'.
+  mutex mu;
+  std::thread::id paused_thread;
+  Notification load_paused;
+  Notification resume_load;
+  options.load_throttling.should_pause_loads = [&]() {
+    mutex_lock l(mu);
+    if (paused_thread == std::thread::id()) {
+      paused_thread = std::this_thread::get_id();
+      load_paused.Notify();
+    }
+    return paused_thread == std::this_thread::get_id() &&
+           !resume_load.HasBeenNotified();
+  };
+  options.load_throttling.pause_check_interval_micros = 100;
+  options.load_throttling.max_load_pause_micros = 0;
+  std::unique_ptr<BasicManager> manager;
+  TF_ASSERT_OK(BasicManager::Create(std::move(options), &manager));
+
+  const auto estimate_all_resources = [](ResourceAllocation* estimate) {
+    *estimate = CreateResourceQuantity(10);
+    return Status::OK();
+  };
+  const ServableId paused_id = {"paused", 0};
+  test_util::MockLoader* paused_loader = new NiceMock<test_util::MockLoader>;
+  ON_CALL(*paused_loader, EstimateResources(_))
+      .WillByDefault(Invoke(estimate_all_resources));
+  EXPECT_CALL(*paused_loader, LoadWithMetadata(_)).Times(0);
+  TF_ASSERT_OK(manager->ManageServable(
+      CreateServableData(paused_id, std::unique_ptr<Loader>(paused_loader))));
+  const ServableId id = {"loaded", 0};
+  test_util::MockLoader* loader = new NiceMock<test_util::MockLoader>;
+  ON_CALL(*loader, EstimateResources(_))
+      .WillByDefault(Invoke(estimate_all_resources));
+  EXPECT_CALL(*loader, LoadWithMetadata(Loader::Metadata{id}))
+      .WillOnce(Return(Status::OK()));
+  TF_ASSERT_OK(manager->ManageServable(
+      CreateServableData(id, std::unique_ptr<Loader>(loader))));
+
+  Notification paused_load_done;
+  manager->LoadServable(paused_id, [&](const Status& status) {
+    EXPECT_EQ(error::RESOURCE_EXHAUSTED, status.code());
+    paused_load_done.Notify();
+  });
+  load_paused.WaitForNotification();
+  // The paused load has neither reserved its resources, nor entered its
+  // execution phase, which the other load would wait for.
+  Notification load_done;
+  manager->LoadServable(id, [&](const Status& status) {
+    TF_EXPECT_OK(status);
+    load_done.Notify();
+  });
+  load_done.WaitForNotification();
+  EXPECT_FALSE(paused_load_done.HasBeenNotified());
+
+  resume_load.Notify();
+  paused_load_done.WaitForNotification();
+}
+
 TEST(EstimateResourcesRetriedTest, Succeeds) {
   std::shared_ptr<EventBus<ServableState>> servable_event_bus =
       EventBus<ServableState>::CreateEventBus();
@@ -15,20 +15,71 @@ limitations under the License.
 
 #include "tensorflow_serving/core/caching_manager.h"
 
+#include <algorithm>
+#include <set>
+#include <tuple>
 #include <utility>
 
 #include "absl/types/optional.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/notification.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/logging.h"
 #include "tensorflow_serving/core/loader.h"
 #include "tensorflow_serving/core/servable_data.h"
 #include "tensorflow_serving/core/servable_handle.h"
 #include "tensorflow_serving/core/servable_id.h"
+#include "tensorflow_serving/resources/resource_values.h"
 
 namespace tensorflow {
 namespace serving {
 
+namespace {
+
+// The hour of the day, UTC, of 'micros' since the epoch.
+int HourOfDay(const uint64 micros) {
+  return (micros / (uint64{3600} * 1000 * 1000)) % 24;
+}
+
+// Counts a co-access in 'co_accessed', holding at most 'max_size' servables:
+// when full, the least co-accessed servable is replaced, and its count
+// carried over, so that the frequent co-accesses are kept.
+void AddCoAccess(const ServableId& servable_id, const int max_size,
+                 std::map<ServableId, uint32>* co_accessed) {
+  auto iter = co_accessed->find(servable_id);
+  if (iter != co_accessed->end()) {
+    ++iter->second;
+    return;
+  }
+  uint32 count = 1;
+  if (co_accessed->size() >= static_cast<size_t>(max_size)) {
+    auto least_co_accessed = std::min_element(
+        co_accessed->begin(), co_accessed->end(),
+        [](const std::pair<const ServableId, uint32>& a,
+           const std::pair<const ServableId, uint32>& b) {
+          return a.second < b.second;
+        });
+    count += least_co_accessed->second;
+    co_accessed->erase(least_co_accessed);
+  }
+  co_accessed->emplace(servable_id, count);
+}
+
+// The main memory of 'resources', bound to a device instance or not.
+uint64 GetRamBytes(const ResourceAllocation& resources) {
+  uint64 ram_bytes = 0;
+  for (const ResourceAllocation::Entry& entry :
+       resources.resource_quantities()) {
+    if (entry.resource().device() == device_types::kMain &&
+        entry.resource().kind() == resource_kinds::kRamBytes) {
+      ram_bytes += entry.quantity();
+    }
+  }
+  return ram_bytes;
+}
+
+}  // namespace
+
 Status CachingManager::Create(
     Options options, std::unique_ptr<LoaderFactory> loader_factory,
     std::unique_ptr<CachingManager>* caching_manager) {
@@ -48,17 +99,43 @@ Status CachingManager::Create(
   TF_RETURN_IF_ERROR(
       BasicManager::Create(std::move(basic_manager_options), &basic_manager));
 
-  caching_manager->reset(
-      new CachingManager(std::move(loader_factory), std::move(basic_manager)));
+  caching_manager->reset(new CachingManager(
+      std::move(loader_factory), std::move(basic_manager), options));
   return Status::OK();
 }
 
 CachingManager::CachingManager(std::unique_ptr<LoaderFactory> loader_factory,
-                               std::unique_ptr<BasicManager> basic_manager)
+                               std::unique_ptr<BasicManager> basic_manager,
+                               const Options& options)
     : loader_factory_(std::move(loader_factory)),
-      basic_manager_(std::move(basic_manager)) {}
+      basic_manager_(std::move(basic_manager)),
+      max_loaded_ram_bytes_(options.max_loaded_ram_bytes),
+      eviction_policy_(options.eviction_policy),
+      env_(options.env),
+      co_access_window_micros_(options.co_access_window_micros),
+      time_of_day_prefetch_interval_micros_(
+          options.time_of_day_prefetch_interval_micros),
+      min_prefetch_count_(options.min_prefetch_count) {
+  if (options.num_prefetch_threads > 0) {
+    prefetch_threads_.reset(new thread::ThreadPool(
+        env_, "CachingManager_prefetch", options.num_prefetch_threads));
+    if (time_of_day_prefetch_interval_micros_ > 0) {
+      PeriodicFunction::Options pf_options;
+      pf_options.thread_name_prefix = "CachingManager_time_of_day_prefetch";
+      pf_options.env = env_;
+      time_of_day_prefetcher_.reset(
+          new PeriodicFunction([this]() { PrefetchForTimeOfDay(); },
+                               time_of_day_prefetch_interval_micros_,
+                               pf_options));
+    }
+  }
+}
 
-CachingManager::~CachingManager() {}
+CachingManager::~CachingManager() {
+  // Stops prefetching before the members used by the prefetches are deleted.
+  time_of_day_prefetcher_.reset();
+  prefetch_threads_.reset();
+}
 
 Status CachingManager::GetUntypedServableHandle(
     const ServableRequest& request,
@@ -84,92 +161,331 @@ Status CachingManager::GetUntypedServableHandleForId(
 
   // If the servable is already managed and loaded by the basic manager, serve
   // it.
-  if (handle_status.ok() || handle_status.code() != error::NOT_FOUND) {
+  if (handle_status.ok()) {
+    RecordUse(servable_id);
+    for (const ServableId& predicted_id : RecordRequest(servable_id)) {
+      Prefetch(predicted_id);
+    }
+    return handle_status;
+  }
+  if (handle_status.code() != error::NOT_FOUND) {
     return handle_status;
   }
-
-  // Build the servable data corresponding to the servable-id.
-  ServableData<std::unique_ptr<Loader>> loader_data =
-      loader_factory_->CreateLoader(servable_id);
 
   // Load the servable corresponding to the servable-id. For multiple concurrent
-  // requests enforces that exactly one thread performs the load operation with
-  // the wrapped basic-manager. All other requests block until the load
-  // completes and then trivially succeed.
-  TF_RETURN_IF_ERROR(LoadServable(std::move(loader_data)));
+  // requests enforces that exactly one thread creates the loader and performs
+  // the load operation with the wrapped basic-manager. All other requests
+  // block until the load completes and then trivially succeed.
+  TF_RETURN_IF_ERROR(LoadServable(servable_id));
 
   // Return the handle using the loaded servable data now.
-  return basic_manager_->GetUntypedServableHandle(
-      ServableRequest::FromId(servable_id), handle);
+  TF_RETURN_IF_ERROR(basic_manager_->GetUntypedServableHandle(
+      ServableRequest::FromId(servable_id), handle));
+  RecordUse(servable_id);
+  // Prefetched once this one is loaded, to not compete with its load.
+  for (const ServableId& predicted_id : RecordRequest(servable_id)) {
+    Prefetch(predicted_id);
+  }
+  return Status::OK();
 }
 
-Status CachingManager::LoadServable(
-    ServableData<std::unique_ptr<Loader>> loader_data) {
-  const ServableId servable_id = loader_data.id();
+std::shared_ptr<mutex> CachingManager::GetLoadMutex(
+    const ServableId& servable_id) {
+  mutex_lock l(load_mutex_map_mu_);
+  auto iter = load_mutex_map_.find(servable_id);
+  if (iter == load_mutex_map_.end()) {
+    iter =
+        load_mutex_map_.emplace(servable_id, std::make_shared<mutex>()).first;
+  }
+  return iter->second;
+}
 
-  std::shared_ptr<mutex> servable_id_mu;
+Status CachingManager::LoadServable(const ServableId& servable_id,
+                                    const bool prefetch) {
+  std::shared_ptr<mutex> servable_id_mu = GetLoadMutex(servable_id);
+  Status status;
   {
-    mutex_lock l(load_mutex_map_mu_);
-    auto iter = load_mutex_map_.find(servable_id);
-    if (iter == load_mutex_map_.end()) {
-      iter =
-          load_mutex_map_.emplace(servable_id, std::make_shared<mutex>()).first;
+    // Ensure only one thread attempts to load the servable at a time.
+    mutex_lock l(*servable_id_mu);
+    status = LoadServableLocked(servable_id, prefetch);
+  }
+  // Note: The entry of the mutex is erased whether the load succeeded or not,
+  // or the failed loads would leak entries.
+  servable_id_mu.reset();
+  MaybeEraseLoadMutexMapEntry(servable_id);
+  return status;
+}
+
+Status CachingManager::LoadServableLocked(const ServableId& servable_id,
+                                          const bool prefetch) {
+  // Retrieve the state of the servable from the wrapped basic-manager. The
+  // servable should already be managed by the basic-manager.
+  const absl::optional<ServableStateSnapshot<>> snapshot =
+      basic_manager_->GetManagedServableStateSnapshot(servable_id);
+  if (snapshot) {
+    // The servable is already being managed by 'basic_manager_'. Hence it
+    // ought to be loaded, based on CachingManager's implementation invariant
+    // of doing manage+load atomically.
+    if (snapshot.value().state != LoaderHarness::State::kReady) {
+      const string error_msg = strings::StrCat(
+          "Servable requested for load is already being managed, but is not "
+          "loaded: ",
+          servable_id.DebugString());
+      DCHECK(false) << error_msg;
+      return errors::Internal(error_msg);
+    }
+  } else {
+    // Load the servable since it has not been loaded yet based on its state.
+    //
+    // Build the servable data corresponding to the servable-id.
+    ServableData<std::unique_ptr<Loader>> loader_data =
+        loader_factory_->CreateLoader(servable_id);
+
+    // Make room for the servable in the memory budget.
+    uint64 ram_bytes = 0;
+    if (max_loaded_ram_bytes_ > 0 && loader_data.status().ok()) {
+      ResourceAllocation resources;
+      if (loader_data.DataOrDie()->EstimateResources(&resources).ok()) {
+        ram_bytes = GetRamBytes(resources);
+      }
+      if (prefetch) {
+        mutex_lock l(cache_mu_);
+        if (loaded_ram_bytes_ + ram_bytes > max_loaded_ram_bytes_) {
+          return errors::ResourceExhausted("No room to prefetch servable ",
+                                           servable_id.DebugString());
+        }
+      } else {
+        EvictServables(servable_id, ram_bytes);
+      }
+    }
+
+    // Then, transfer the servable to the basic manager. The loader_data may
+    // contain an error and the basic manager is equipped to handle that
+    // appropriately. By propagating such errors back to the basic manager,
+    // the functionality of the event-bus and the servable state monitor are
+    // automatically available in the caching-manager as well (via the basic
+    // manager).
+    const Status manage_status =
+        basic_manager_->ManageServable(std::move(loader_data));
+    if (!manage_status.ok()) {
+      const string error_msg = strings::StrCat(
+          "Internal error: unable to transfer servable to 'basic_manager_': ",
+          manage_status.error_message());
+      DCHECK(false) << error_msg;
+      return errors::Internal(error_msg);
+    }
+
+    Notification load_done;
+    Status load_status;
+    basic_manager_->LoadServable(servable_id, [&](const Status& status) {
+      load_status = status;
+      load_done.Notify();
+    });
+    load_done.WaitForNotification();
+    if (!load_status.ok() && prefetch) {
+      // The servable may be loaded again on demand.
+      basic_manager_->StopManagingServable(servable_id).IgnoreError();
+    }
+    TF_RETURN_IF_ERROR(load_status);
+
+    if (max_loaded_ram_bytes_ > 0) {
+      mutex_lock l(cache_mu_);
+      loaded_servables_[servable_id].ram_bytes = ram_bytes;
+      loaded_ram_bytes_ += ram_bytes;
     }
-    servable_id_mu = iter->second;
   }
+  return Status::OK();
+}
 
+void CachingManager::RecordUse(const ServableId& servable_id) {
+  if (max_loaded_ram_bytes_ == 0) {
+    return;
+  }
+  mutex_lock l(cache_mu_);
+  auto iter = loaded_servables_.find(servable_id);
+  if (iter != loaded_servables_.end()) {
+    iter->second.last_use = ++use_clock_;
+    ++iter->second.num_uses;
+  }
+}
+
+std::vector<ServableId> CachingManager::RecordRequest(
+    const ServableId& servable_id) {
+  if (prefetch_threads_ == nullptr) {
+    return {};
+  }
+  const uint64 now = env_->NowMicros();
+  mutex_lock l(prefetch_mu_);
+  AccessPattern& access_pattern = access_patterns_[servable_id];
+  ++access_pattern.hourly_requests[HourOfDay(now)];
+
+  // This request is a co-access of the servables requested recently.
+  std::set<ServableId> co_accessing;
+  for (const auto& recent_request : recent_requests_) {
+    if (recent_request.second != servable_id &&
+        static_cast<int64>(now - recent_request.first) <=
+            co_access_window_micros_ &&
+        co_accessing.insert(recent_request.second).second) {
+      AddCoAccess(servable_id, kMaxCoAccessedServables,
+                  &access_patterns_[recent_request.second].co_accessed);
+    }
+  }
+  recent_requests_.emplace_back(now, servable_id);
+  while (recent_requests_.size() > kMaxRecentRequests ||
+         static_cast<int64>(now - recent_requests_.front().first) >
+             co_access_window_micros_) {
+    recent_requests_.pop_front();
+  }
+
+  // The servables usually co-accessed after this one, most frequent first.
+  std::vector<std::pair<uint32, ServableId>> co_accessed;
+  for (const auto& co_access : access_pattern.co_accessed) {
+    if (co_access.second >= min_prefetch_count_) {
+      co_accessed.emplace_back(co_access.second, co_access.first);
+    }
+  }
+  std::sort(co_accessed.rbegin(), co_accessed.rend());
+  std::vector<ServableId> predicted_ids;
+  for (const auto& co_access : co_accessed) {
+    predicted_ids.push_back(co_access.second);
+  }
+  return predicted_ids;
+}
+
+void CachingManager::Prefetch(const ServableId& servable_id) {
+  if (basic_manager_->GetManagedServableStateSnapshot(servable_id)) {
+    return;
+  }
   {
-    // Ensure only one thread attempts to load the servable at a time.
-    mutex_lock l(*servable_id_mu);
+    mutex_lock l(prefetch_mu_);
+    if (!pending_prefetches_.insert(servable_id).second) {
+      return;
+    }
+  }
+  prefetch_threads_->Schedule([this, servable_id]() {
+    const Status status = LoadServable(servable_id, /*prefetch=*/true);
+    VLOG(1) << "Prefetched servable " << servable_id.DebugString() << ": "
+            << status;
+    mutex_lock l(prefetch_mu_);
+    pending_prefetches_.erase(servable_id);
+    prefetches_done_.notify_all();
+  });
+}
+
+void CachingManager::PrefetchForTimeOfDay() {
+  const int hour =
+      HourOfDay(env_->NowMicros() + time_of_day_prefetch_interval_micros_);
+  // The servables usually requested at that hour, most frequent first.
+  std::vector<std::pair<uint32, ServableId>> requested;
+  {
+    mutex_lock l(prefetch_mu_);
+    for (const auto& access_pattern : access_patterns_) {
+      const uint32 num_requests = access_pattern.second.hourly_requests[hour];
+      if (num_requests >= min_prefetch_count_) {
+        requested.emplace_back(num_requests, access_pattern.first);
+      }
+    }
+  }
+  std::sort(requested.rbegin(), requested.rend());
+  for (const auto& request : requested) {
+    Prefetch(request.second);
+  }
+}
 
-    // Retrieve the state of the servable from the wrapped basic-manager. The
-    // servable should already be managed by the basic-manager.
-    const absl::optional<ServableStateSnapshot<>> snapshot =
-        basic_manager_->GetManagedServableStateSnapshot(servable_id);
-    if (snapshot) {
-      // The servable is already being managed by 'basic_manager_'. Hence it
-      // ought to be loaded, based on CachingManager's implementation invariant
-      // of doing manage+load atomically.
-      if (snapshot.value().state != LoaderHarness::State::kReady) {
-        const string error_msg = strings::StrCat(
-            "Servable requested for load is already being managed, but is not "
-            "loaded: ",
-            servable_id.DebugString());
-        DCHECK(false) << error_msg;
-        return errors::Internal(error_msg);
+void CachingManager::WaitForPrefetches() {
+  mutex_lock l(prefetch_mu_);
+  while (!pending_prefetches_.empty()) {
+    prefetches_done_.wait(l);
+  }
+}
+
+void CachingManager::EvictServables(const ServableId& servable_id,
+                                    const uint64 ram_bytes) {
+  // The servables to unload, first to last.
+  std::vector<std::tuple<uint64, uint64, ServableId>> candidates;
+  {
+    mutex_lock l(cache_mu_);
+    if (loaded_ram_bytes_ + ram_bytes <= max_loaded_ram_bytes_) {
+      return;
+    }
+    for (const auto& loaded_servable : loaded_servables_) {
+      if (loaded_servable.first == servable_id) {
+        continue;
       }
-    } else {
-      // Load the servable since it has not been loaded yet based on its state.
-      //
-      // First, transfer the servable to the basic manager. The loader_data may
-      // contain an error and the basic manager is equipped to handle that
-      // appropriately. By propagating such errors back to the basic manager,
-      // the functionality of the event-bus and the servable state monitor are
-      // automatically available in the caching-manager as well (via the basic
-      // manager).
-      const Status manage_status =
-          basic_manager_->ManageServable(std::move(loader_data));
-      if (!manage_status.ok()) {
-        const string error_msg = strings::StrCat(
-            "Internal error: unable to transfer servable to 'basic_manager_': ",
-            manage_status.error_message());
-        DCHECK(false) << error_msg;
-        return errors::Internal(error_msg);
+      const LoadedServable& use = loaded_servable.second;
+      switch (eviction_policy_) {
+        case EvictionPolicy::kLeastRecentlyUsed:
+          candidates.emplace_back(use.last_use, 0, loaded_servable.first);
+          break;
+        case EvictionPolicy::kLeastFrequentlyUsed:
+          candidates.emplace_back(use.num_uses, use.last_use,
+                                  loaded_servable.first);
+          break;
       }
+    }
+  }
+  std::sort(candidates.begin(), candidates.end());
 
-      Notification load_done;
-      Status load_status;
-      basic_manager_->LoadServable(servable_id, [&](const Status& status) {
-        load_status = status;
-        load_done.Notify();
+  for (const auto& candidate : candidates) {
+    {
+      mutex_lock l(cache_mu_);
+      if (loaded_ram_bytes_ + ram_bytes <= max_loaded_ram_bytes_) {
+        return;
+      }
+    }
+    EvictServable(std::get<2>(candidate));
+  }
+  mutex_lock l(cache_mu_);
+  if (loaded_ram_bytes_ + ram_bytes > max_loaded_ram_bytes_) {
+    LOG(WARNING) << "Loading servable " << servable_id.DebugString()
+                 << " exceeds the memory budget of the caching manager: "
+                 << loaded_ram_bytes_ + ram_bytes << " bytes for "
+                 << max_loaded_ram_bytes_;
+  }
+}
+
+void CachingManager::EvictServable(const ServableId& servable_id) {
+  std::shared_ptr<mutex> servable_id_mu = GetLoadMutex(servable_id);
+  // Skips the servables another thread is loading or evicting, rather than
+  // wait for them, which could deadlock two threads evicting each other's
+  // servable.
+  if (servable_id_mu->try_lock()) {
+    bool loaded;
+    {
+      mutex_lock l(cache_mu_);
+      loaded = loaded_servables_.count(servable_id) > 0;
+    }
+    if (loaded) {
+      VLOG(1) << "Evicting servable " << servable_id.DebugString();
+      // Waits for the handles of the servable to be released.
+      Notification unload_done;
+      Status unload_status;
+      basic_manager_->UnloadServable(servable_id, [&](const Status& status) {
+        unload_status = status;
+        unload_done.Notify();
       });
-      load_done.WaitForNotification();
-      TF_RETURN_IF_ERROR(load_status);
+      unload_done.WaitForNotification();
+      if (!unload_status.ok()) {
+        LOG(ERROR) << "Failed to evict servable " << servable_id.DebugString()
+                   << ": " << unload_status;
+      }
+      // The servable is either unloaded or in error, and is loaded again on
+      // the next request.
+      const Status stop_status =
+          basic_manager_->StopManagingServable(servable_id);
+      if (!stop_status.ok()) {
+        LOG(ERROR) << "Failed to stop managing evicted servable "
+                   << servable_id.DebugString() << ": " << stop_status;
+      }
+      mutex_lock l(cache_mu_);
+      auto iter = loaded_servables_.find(servable_id);
+      loaded_ram_bytes_ -= iter->second.ram_bytes;
+      loaded_servables_.erase(iter);
     }
+    servable_id_mu->unlock();
   }
   servable_id_mu.reset();
   MaybeEraseLoadMutexMapEntry(servable_id);
-  return Status::OK();
 }
 
 void CachingManager::MaybeEraseLoadMutexMapEntry(
@@ -16,11 +16,18 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_CORE_CACHING_MANAGER_H_
 #define TENSORFLOW_SERVING_CORE_CACHING_MANAGER_H_
 
+#include <array>
+#include <deque>
 #include <map>
 #include <memory>
+#include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "tensorflow/core/kernels/batching_util/periodic_function.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/mutex.h"
 #include "tensorflow_serving/core/basic_manager.h"
 #include "tensorflow_serving/core/manager.h"
 #include "tensorflow_serving/core/source_adapter.h"
@@ -38,12 +45,32 @@ class CachingManagerTestAccess;
 /// operation and then serves the request.
 ///
 /// The manager blocks on the load operation and returns the handle when the
-/// servable has been loaded, or upon error.
-//
-// TODO(b/25449742): Add support for evictions of loaded servables from the
-// caching-manager.
+/// servable has been loaded, or upon error. Concurrent requests for a servable
+/// not loaded yet wait for a single load.
+///
+/// With a memory budget (see Options::max_loaded_ram_bytes), the manager
+/// unloads the servables used the least when loading another one would exceed
+/// the budget, and reloads them on demand. This suits many servables of which
+/// few are used at any time.
+///
+/// With prefetch threads (see Options::num_prefetch_threads), the manager
+/// also loads the servables it predicts will be requested soon, from the
+/// previous requests, so that their first request does not wait for their
+/// load:
+///  - The servables requested shortly after a servable, when it is requested.
+///  - The servables requested at the coming time of the day, periodically.
+/// Prefetching never unloads servables, i.e. a servable is only prefetched if
+/// it fits in the memory budget.
 class CachingManager : public Manager {
  public:
+  /// The servables unloaded first when the memory budget is exceeded.
+  enum class EvictionPolicy {
+    /// The least recently used.
+    kLeastRecentlyUsed,
+    /// The least frequently used, then the least recently used.
+    kLeastFrequentlyUsed,
+  };
+
   /// Config options and pluggable objects that will be used by the
   /// CachingManager.
   struct Options {
@@ -76,6 +103,40 @@ class CachingManager : public Manager {
 
     // The environment to use for starting threads in the thread-pool.
     Env* env = Env::Default();
+
+    // Memory budget, in bytes, of the loaded servables, as estimated by their
+    // loaders before load. When loading a servable would exceed the budget,
+    // other servables are unloaded first, in the order of 'eviction_policy'.
+    // The servables being loaded or unloaded are not unloaded, and the budget
+    // is exceeded if no other servable can be unloaded.
+    //
+    // If set to 0, the servables are never unloaded.
+    uint64 max_loaded_ram_bytes = 0;
+
+    // The servables unloaded first when over 'max_loaded_ram_bytes'.
+    EvictionPolicy eviction_policy = EvictionPolicy::kLeastRecentlyUsed;
+
+    // The number of threads prefetching servables, i.e. loading them ahead of
+    // their predicted requests.
+    //
+    // If set to 0, servables are only loaded when requested.
+    uint32 num_prefetch_threads = 0;
+
+    // A servable requested within this interval, in microseconds, after
+    // another one is co-accessed with it. When a servable is requested, the
+    // servables co-accessed with it at least 'min_prefetch_count' times are
+    // prefetched.
+    int64 co_access_window_micros = 1000 * 1000;
+
+    // The interval, in microseconds, between the prefetches of the servables
+    // requested at least 'min_prefetch_count' times at the coming hour of the
+    // day (UTC), over the previous days.
+    //
+    // If set to 0, prefetches only follow the co-accesses.
+    int64 time_of_day_prefetch_interval_micros = 0;
+
+    // See 'co_access_window_micros' and 'time_of_day_prefetch_interval_micros'.
+    uint32 min_prefetch_count = 3;
   };
 
   /// An abstraction for a loader-factory to map from a servable request to the
@@ -112,7 +173,30 @@ class CachingManager : public Manager {
   friend class test_util::CachingManagerTestAccess;
 
   CachingManager(std::unique_ptr<LoaderFactory> loader_factory,
-                 std::unique_ptr<BasicManager> basic_manager);
+                 std::unique_ptr<BasicManager> basic_manager,
+                 const Options& options);
+
+  // The use of a loaded servable, to pick the servables to unload.
+  struct LoadedServable {
+    uint64 ram_bytes = 0;
+    // Value of 'use_clock_' at the last use.
+    uint64 last_use = 0;
+    uint64 num_uses = 0;
+  };
+
+  // The requests of a servable, to predict its next requests.
+  struct AccessPattern {
+    // Number of requests at each hour of the day, UTC.
+    std::array<uint32, 24> hourly_requests{};
+    // Number of requests of the other servables co-accessed after this one.
+    // Holds at most kMaxCoAccessedServables servables.
+    std::map<ServableId, uint32> co_accessed;
+  };
+
+  // Maximum number of servables tracked in AccessPattern::co_accessed.
+  static constexpr int kMaxCoAccessedServables = 8;
+  // Maximum number of requests kept in 'recent_requests_'.
+  static constexpr int kMaxRecentRequests = 16;
 
   // Returns the untyped handle for the servable request.
   //
@@ -129,14 +213,56 @@ class CachingManager : public Manager {
       const ServableId& servable_id,
       std::unique_ptr<UntypedServableHandle>* handle);
 
-  // Transfer the given servable to 'basic_manager_', and ask it to load it. For
-  // multiple concurrent requests for the same servable-id, enforces that
-  // exactly one thread performs the load operation using the wrapped
-  // basic-manager. All other requests block until the load completes and then
-  // trivially succeed.
-  Status LoadServable(ServableData<std::unique_ptr<Loader>> loader_data)
+  // Creates the loader of the servable with the loader-factory, transfers it
+  // to 'basic_manager_', and asks it to load it. For multiple concurrent
+  // requests for the same servable-id, enforces that exactly one thread creates
+  // the loader and performs the load operation using the wrapped basic-manager.
+  // All other requests block until the load completes and then trivially
+  // succeed.
+  //
+  // If 'prefetch' is true, the servable is only loaded if it fits in the memory
+  // budget, and it is not managed anymore if its load fails, so that it may be
+  // loaded again on demand.
+  Status LoadServable(const ServableId& servable_id, bool prefetch = false)
+      TF_LOCKS_EXCLUDED(load_mutex_map_mu_, cache_mu_);
+
+  // Does the work of LoadServable(), under the load mutex of 'servable_id'.
+  Status LoadServableLocked(const ServableId& servable_id, bool prefetch)
+      TF_LOCKS_EXCLUDED(load_mutex_map_mu_, cache_mu_);
+
+  // Records a request of the servable to predict the next requests, and
+  // returns the servables co-accessed with it to prefetch.
+  std::vector<ServableId> RecordRequest(const ServableId& servable_id)
+      TF_LOCKS_EXCLUDED(prefetch_mu_);
+
+  // Loads the servable on the prefetch threads, unless it is already managed
+  // or being prefetched.
+  void Prefetch(const ServableId& servable_id) TF_LOCKS_EXCLUDED(prefetch_mu_);
+
+  // Prefetches the servables requested at the coming hour of the day.
+  void PrefetchForTimeOfDay() TF_LOCKS_EXCLUDED(prefetch_mu_);
+
+  // Waits for the prefetches in progress.
+  void WaitForPrefetches() TF_LOCKS_EXCLUDED(prefetch_mu_);
+
+  // Returns the mutex of 'load_mutex_map_' for 'servable_id', adding it if
+  // needed.
+  std::shared_ptr<mutex> GetLoadMutex(const ServableId& servable_id)
       TF_LOCKS_EXCLUDED(load_mutex_map_mu_);
 
+  // Records a use of the servable, if the servables may be unloaded.
+  void RecordUse(const ServableId& servable_id) TF_LOCKS_EXCLUDED(cache_mu_);
+
+  // Unloads loaded servables other than 'servable_id', following the eviction
+  // policy, until 'ram_bytes' more fit in the memory budget.
+  void EvictServables(const ServableId& servable_id, uint64 ram_bytes)
+      TF_LOCKS_EXCLUDED(cache_mu_);
+
+  // Unloads the servable and stops managing it, unless another thread is
+  // loading or unloading it.
+  void EvictServable(const ServableId& servable_id)
+      TF_LOCKS_EXCLUDED(cache_mu_);
+
   // Returns the size of the load_mutex_map_.
   int64 GetLoadMutexMapSize() const TF_LOCKS_EXCLUDED(load_mutex_map_mu_);
 
@@ -158,6 +284,47 @@ class CachingManager : public Manager {
   std::map<ServableId, std::shared_ptr<mutex>> load_mutex_map_
       TF_GUARDED_BY(load_mutex_map_mu_);
 
+  // See Options.
+  const uint64 max_loaded_ram_bytes_;
+  const EvictionPolicy eviction_policy_;
+
+  // Used to protect access to the uses of the loaded servables.
+  mutable mutex cache_mu_;
+
+  // The servables loaded by the manager, if they may be unloaded.
+  std::map<ServableId, LoadedServable> loaded_servables_
+      TF_GUARDED_BY(cache_mu_);
+
+  // The memory estimated for 'loaded_servables_'.
+  uint64 loaded_ram_bytes_ TF_GUARDED_BY(cache_mu_) = 0;
+
+  // Incremented at each use of a servable.
+  uint64 use_clock_ TF_GUARDED_BY(cache_mu_) = 0;
+
+  // See Options.
+  Env* const env_;
+  const int64 co_access_window_micros_;
+  const int64 time_of_day_prefetch_interval_micros_;
+  const uint32 min_prefetch_count_;
+
+  // Used to protect access to the access patterns and the prefetches.
+  mutable mutex prefetch_mu_;
+
+  std::map<ServableId, AccessPattern> access_patterns_
+      TF_GUARDED_BY(prefetch_mu_);
+
+  // The time and servable of the last requests, least recent first.
+  std::deque<std::pair<uint64, ServableId>> recent_requests_
+      TF_GUARDED_BY(prefetch_mu_);
+
+  // The servables being prefetched.
+  std::set<ServableId> pending_prefetches_ TF_GUARDED_BY(prefetch_mu_);
+  condition_variable prefetches_done_;
+
+  // Null if the servables are not prefetched.
+  std::unique_ptr<thread::ThreadPool> prefetch_threads_;
+  std::unique_ptr<PeriodicFunction> time_of_day_prefetcher_;
+
   TF_DISALLOW_COPY_AND_ASSIGN(CachingManager);
 };
 
@@ -15,10 +15,13 @@ limitations under the License.
 
 #include "tensorflow_serving/core/caching_manager.h"
 
+#include <algorithm>
 #include <utility>
+#include <vector>
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include "tensorflow/core/kernels/batching_util/fake_clock_env.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
@@ -32,6 +35,7 @@ limitations under the License.
 #include "tensorflow_serving/core/simple_loader.h"
 #include "tensorflow_serving/core/test_util/fake_loader_source_adapter.h"
 #include "tensorflow_serving/core/test_util/manager_test_util.h"
+#include "tensorflow_serving/resources/resource_values.h"
 #include "tensorflow_serving/util/event_bus.h"
 #include "tensorflow_serving/util/threadpool_executor.h"
 
@@ -54,9 +58,11 @@ class StringLoaderFactory : public CachingManager::LoaderFactory {
   ServableData<std::unique_ptr<Loader>> CreateLoader(
       const ServableId& id) override {
     // Update state to indicate a new loader was created.
+    uint64 ram_bytes;
     {
       mutex_lock l(mu_);
       num_loaders_dispensed_++;
+      ram_bytes = ram_bytes_;
     }
 
     auto servable_creator = [&](std::unique_ptr<string>* servable) {
@@ -64,9 +70,19 @@ class StringLoaderFactory : public CachingManager::LoaderFactory {
       **servable = strings::StrCat(id.name, "-", id.version);
       return Status::OK();
     };
+    auto resource_estimator = [ram_bytes](ResourceAllocation* estimate) {
+      estimate->Clear();
+      if (ram_bytes > 0) {
+        ResourceAllocation::Entry* entry = estimate->add_resource_quantities();
+        entry->mutable_resource()->set_device(device_types::kMain);
+        entry->mutable_resource()->set_kind(resource_kinds::kRamBytes);
+        entry->set_quantity(ram_bytes);
+      }
+      return Status::OK();
+    };
     std::unique_ptr<Loader> loader;
-    loader.reset(new SimpleLoader<string>(
-        servable_creator, SimpleLoader<string>::EstimateNoResources()));
+    loader.reset(
+        new SimpleLoader<string>(servable_creator, resource_estimator));
     return ServableData<std::unique_ptr<Loader>>(id, std::move(loader));
   }
 
@@ -101,6 +117,12 @@ class StringLoaderFactory : public CachingManager::LoaderFactory {
     return num_loaders_dispensed_;
   }
 
+  // Update the estimated memory of the servables.
+  void set_ram_bytes(uint64 ram_bytes) {
+    mutex_lock l(mu_);
+    ram_bytes_ = ram_bytes;
+  }
+
  private:
   // Used to protect updates to 'earliest_version_' and 'latest_version_'.
   mutable mutex mu_;
@@ -114,6 +136,9 @@ class StringLoaderFactory : public CachingManager::LoaderFactory {
   // Tracks the number of loaders dispensed by the loader-factory.
   int64 num_loaders_dispensed_ TF_GUARDED_BY(mu_) = 0;
 
+  // The estimated memory of the servables.
+  uint64 ram_bytes_ TF_GUARDED_BY(mu_) = 0;
+
   TF_DISALLOW_COPY_AND_ASSIGN(StringLoaderFactory);
 };
 
@@ -200,6 +225,63 @@ class CachingManagerTest : public ::testing::TestWithParam<ThreadPoolSizes> {
     return error_manager;
   }
 
+  // Creates a manager with a memory budget of 'max_loaded_ram_bytes', for
+  // servables of 'ram_bytes' each from 'string_loader_factory'.
+  std::unique_ptr<CachingManager> CreateManagerWithMemoryBudget(
+      const uint64 max_loaded_ram_bytes, const uint64 ram_bytes,
+      const CachingManager::EvictionPolicy eviction_policy,
+      StringLoaderFactory** string_loader_factory) {
+    CachingManager::Options options;
+    options.env = Env::Default();
+    options.servable_event_bus = servable_event_bus_.get();
+    options.num_load_threads = GetParam().num_load_threads;
+    options.num_unload_threads = GetParam().num_unload_threads;
+    options.max_num_load_retries = 1;
+    options.load_retry_interval_micros = 0;
+    options.max_loaded_ram_bytes = max_loaded_ram_bytes;
+    options.eviction_policy = eviction_policy;
+
+    std::unique_ptr<StringLoaderFactory> loader_factory(
+        new StringLoaderFactory(0));
+    loader_factory->set_ram_bytes(ram_bytes);
+    *string_loader_factory = loader_factory.get();
+
+    std::unique_ptr<CachingManager> budget_manager;
+    TF_CHECK_OK(CachingManager::Create(
+        std::move(options), std::move(loader_factory), &budget_manager));
+    return budget_manager;
+  }
+
+  // Creates a manager prefetching the servables requested at least once with
+  // 'min_prefetch_count', with the clock of 'env' and the memory budget of
+  // CreateManagerWithMemoryBudget().
+  std::unique_ptr<CachingManager> CreateManagerWithPrefetch(
+      Env* env, const uint64 max_loaded_ram_bytes, const uint64 ram_bytes,
+      const uint32 min_prefetch_count,
+      StringLoaderFactory** string_loader_factory) {
+    CachingManager::Options options;
+    options.env = env;
+    options.servable_event_bus = servable_event_bus_.get();
+    options.num_load_threads = GetParam().num_load_threads;
+    options.num_unload_threads = GetParam().num_unload_threads;
+    options.max_num_load_retries = 1;
+    options.load_retry_interval_micros = 0;
+    options.max_loaded_ram_bytes = max_loaded_ram_bytes;
+    options.num_prefetch_threads = 1;
+    options.co_access_window_micros = 1000 * 1000;
+    options.min_prefetch_count = min_prefetch_count;
+
+    std::unique_ptr<StringLoaderFactory> loader_factory(
+        new StringLoaderFactory(0));
+    loader_factory->set_ram_bytes(ram_bytes);
+    *string_loader_factory = loader_factory.get();
+
+    std::unique_ptr<CachingManager> prefetch_manager;
+    TF_CHECK_OK(CachingManager::Create(
+        std::move(options), std::move(loader_factory), &prefetch_manager));
+    return prefetch_manager;
+  }
+
   // Helper function to return the size of the load-mutex map from the
   // caching-manager.
   int64 GetLoadMutexMapSize() {
@@ -577,6 +659,187 @@ TEST_P(CachingManagerTest, ConcurrentIntersectingRequests) {
   EXPECT_EQ(0, GetLoadMutexMapSize());
 }
 
+TEST_P(CachingManagerTest, ConcurrentFirstRequestsCreateOneLoader) {
+  {
+    ThreadPoolExecutor request_executor(Env::Default(), "GetHandles",
+                                        kNumThreads);
+    for (int i = 0; i < 8; i++) {
+      request_executor.Schedule([this]() {
+        ServableHandle<string> handle;
+        TF_EXPECT_OK(manager_->GetServableHandle(
+            ServableRequest::Specific(kServableName, 30), &handle));
+      });
+    }
+  }
+  EXPECT_EQ(1, string_loader_factory_->num_loaders_dispensed());
+  EXPECT_EQ(0, GetLoadMutexMapSize());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Evictions.
+
+// Requests the servables of 'versions', in order, and releases their handles.
+void RequestVersions(CachingManager* manager,
+                     const std::vector<int>& versions) {
+  for (const int version : versions) {
+    ServableHandle<string> handle;
+    TF_ASSERT_OK(manager->GetServableHandle(
+        ServableRequest::Specific(kServableName, version), &handle));
+    EXPECT_EQ(strings::StrCat("kServableName-", version), *handle);
+  }
+}
+
+std::vector<int> AvailableVersions(const CachingManager& manager) {
+  std::vector<int> versions;
+  for (const ServableId& id : manager.ListAvailableServableIds()) {
+    versions.push_back(id.version);
+  }
+  std::sort(versions.begin(), versions.end());
+  return versions;
+}
+
+TEST_P(CachingManagerTest, EvictLeastRecentlyUsed) {
+  StringLoaderFactory* loader_factory;
+  std::unique_ptr<CachingManager> manager = CreateManagerWithMemoryBudget(
+      250, 100, CachingManager::EvictionPolicy::kLeastRecentlyUsed,
+      &loader_factory);
+  RequestVersions(manager.get(), {1, 2, 1});
+  EXPECT_EQ(AvailableVersions(*manager), std::vector<int>({1, 2}));
+  // Version 2 is the least recently used.
+  RequestVersions(manager.get(), {3});
+  EXPECT_EQ(AvailableVersions(*manager), std::vector<int>({1, 3}));
+  EXPECT_EQ(3, loader_factory->num_loaders_dispensed());
+  // The evicted servable is reloaded on demand.
+  RequestVersions(manager.get(), {2});
+  EXPECT_EQ(AvailableVersions(*manager), std::vector<int>({2, 3}));
+  EXPECT_EQ(4, loader_factory->num_loaders_dispensed());
+}
+
+TEST_P(CachingManagerTest, EvictLeastFrequentlyUsed) {
+  StringLoaderFactory* loader_factory;
+  std::unique_ptr<CachingManager> manager = CreateManagerWithMemoryBudget(
+      250, 100, CachingManager::EvictionPolicy::kLeastFrequentlyUsed,
+      &loader_factory);
+  RequestVersions(manager.get(), {1, 1, 1, 2, 2});
+  // Version 2 is the least frequently used, though the most recently used.
+  RequestVersions(manager.get(), {3});
+  EXPECT_EQ(AvailableVersions(*manager), std::vector<int>({1, 3}));
+}
+
+TEST_P(CachingManagerTest, NoEvictionWithinBudget) {
+  StringLoaderFactory* loader_factory;
+  std::unique_ptr<CachingManager> manager = CreateManagerWithMemoryBudget(
+      300, 100, CachingManager::EvictionPolicy::kLeastRecentlyUsed,
+      &loader_factory);
+  RequestVersions(manager.get(), {1, 2, 3, 1, 2, 3});
+  EXPECT_EQ(AvailableVersions(*manager), std::vector<int>({1, 2, 3}));
+  EXPECT_EQ(3, loader_factory->num_loaders_dispensed());
+}
+
+TEST_P(CachingManagerTest, EvictionOverBudget) {
+  StringLoaderFactory* loader_factory;
+  std::unique_ptr<CachingManager> manager = CreateManagerWithMemoryBudget(
+      150, 100, CachingManager::EvictionPolicy::kLeastRecentlyUsed,
+      &loader_factory);
+  RequestVersions(manager.get(), {1});
+  // Over the budget, version 1 is unloaded once its handle is released.
+  RequestVersions(manager.get(), {2});
+  EXPECT_EQ(AvailableVersions(*manager), std::vector<int>({2}));
+  // A single servable larger than the budget is still loaded.
+  loader_factory->set_ram_bytes(200);
+  RequestVersions(manager.get(), {3});
+  EXPECT_EQ(AvailableVersions(*manager), std::vector<int>({3}));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Prefetches.
+
+void AdvanceByHours(const int hours, test_util::FakeClockEnv* env) {
+  // By half hours, to fit in the int argument.
+  for (int i = 0; i < 2 * hours; ++i) {
+    env->AdvanceByMicroseconds(1800 * 1000 * 1000);
+  }
+}
+
+TEST_P(CachingManagerTest, PrefetchCoAccessed) {
+  test_util::FakeClockEnv env(Env::Default());
+  StringLoaderFactory* loader_factory;
+  std::unique_ptr<CachingManager> manager =
+      CreateManagerWithPrefetch(&env, 200, 100, 1, &loader_factory);
+  test_util::CachingManagerTestAccess manager_access(manager.get());
+
+  // Version 2 is requested right after version 1.
+  RequestVersions(manager.get(), {1});
+  env.AdvanceByMicroseconds(500 * 1000);
+  RequestVersions(manager.get(), {2});
+
+  // Version 3 evicts both.
+  env.AdvanceByMicroseconds(10 * 1000 * 1000);
+  loader_factory->set_ram_bytes(200);
+  RequestVersions(manager.get(), {3});
+  manager_access.WaitForPrefetches();
+  EXPECT_EQ(AvailableVersions(*manager), std::vector<int>({3}));
+
+  // Requesting version 1 again prefetches version 2.
+  env.AdvanceByMicroseconds(10 * 1000 * 1000);
+  loader_factory->set_ram_bytes(100);
+  RequestVersions(manager.get(), {1});
+  manager_access.WaitForPrefetches();
+  EXPECT_EQ(AvailableVersions(*manager), std::vector<int>({1, 2}));
+  EXPECT_EQ(5, loader_factory->num_loaders_dispensed());
+}
+
+TEST_P(CachingManagerTest, PrefetchDoesNotEvict) {
+  test_util::FakeClockEnv env(Env::Default());
+  StringLoaderFactory* loader_factory;
+  std::unique_ptr<CachingManager> manager =
+      CreateManagerWithPrefetch(&env, 100, 100, 1, &loader_factory);
+  test_util::CachingManagerTestAccess manager_access(manager.get());
+
+  RequestVersions(manager.get(), {1});
+  env.AdvanceByMicroseconds(500 * 1000);
+  RequestVersions(manager.get(), {2});
+  env.AdvanceByMicroseconds(10 * 1000 * 1000);
+  // Version 2 does not fit with version 1, and is not prefetched.
+  RequestVersions(manager.get(), {1});
+  manager_access.WaitForPrefetches();
+  EXPECT_EQ(AvailableVersions(*manager), std::vector<int>({1}));
+  // The load mutex of the rejected prefetch is released.
+  EXPECT_EQ(0, manager_access.GetLoadMutexMapSize());
+}
+
+TEST_P(CachingManagerTest, PrefetchForTimeOfDay) {
+  test_util::FakeClockEnv env(Env::Default());
+  StringLoaderFactory* loader_factory;
+  std::unique_ptr<CachingManager> manager =
+      CreateManagerWithPrefetch(&env, 200, 100, 2, &loader_factory);
+  test_util::CachingManagerTestAccess manager_access(manager.get());
+
+  // Version 1 is requested twice at midnight, versions 2 and 3 once at 1am,
+  // evicting version 1.
+  RequestVersions(manager.get(), {1, 1});
+  AdvanceByHours(1, &env);
+  loader_factory->set_ram_bytes(200);
+  RequestVersions(manager.get(), {2});
+  env.AdvanceByMicroseconds(10 * 1000 * 1000);
+  loader_factory->set_ram_bytes(150);
+  RequestVersions(manager.get(), {3});
+  EXPECT_EQ(AvailableVersions(*manager), std::vector<int>({3}));
+
+  // Nothing is requested at noon.
+  loader_factory->set_ram_bytes(50);
+  AdvanceByHours(11, &env);
+  manager_access.PrefetchForTimeOfDay();
+  manager_access.WaitForPrefetches();
+  EXPECT_EQ(AvailableVersions(*manager), std::vector<int>({3}));
+
+  // Version 1 is prefetched at midnight, the next day.
+  AdvanceByHours(12, &env);
+  manager_access.PrefetchForTimeOfDay();
+  manager_access.WaitForPrefetches();
+  EXPECT_EQ(AvailableVersions(*manager), std::vector<int>({1, 3}));
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 TEST(PathPrefixLoaderFactoryTest, Basic) {
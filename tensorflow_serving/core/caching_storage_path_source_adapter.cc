@@ -0,0 +1,346 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/core/caching_storage_path_source_adapter.h"
+
+#include <string>
+
+#include "tensorflow/core/lib/core/blocking_counter.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/hash/hash.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/strings/numbers.h"
+#include "tensorflow/core/lib/strings/str_util.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/mutex.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+// Suffix of the directories that versions are copied into before being
+// renamed into place.
+constexpr char kPartialSuffix[] = ".partial";
+
+// Returns true if 'path' has no URI scheme, i.e. is on the local file system.
+bool IsLocalPath(const string& path) {
+  StringPiece scheme, host, relative_path;
+  io::ParseURI(path, &scheme, &host, &relative_path);
+  return scheme.empty();
+}
+
+// Adds the directories and files that are descendants of 'root'/'relative_dir'
+// to 'dirs' and 'files', relative to 'root'.
+Status ListDescendants(Env* const env, const string& root,
+                       const string& relative_dir, std::set<string>* dirs,
+                       std::set<string>* files) {
+  std::vector<string> children;
+  TF_RETURN_IF_ERROR(
+      env->GetChildren(io::JoinPath(root, relative_dir), &children));
+  for (const string& child : children) {
+    const string relative_path = io::JoinPath(relative_dir, child);
+    if (env->IsDirectory(io::JoinPath(root, relative_path)).ok()) {
+      if (dirs->insert(relative_path).second) {
+        TF_RETURN_IF_ERROR(
+            ListDescendants(env, root, relative_path, dirs, files));
+      }
+    } else {
+      // On file systems whose GetChildren() returns all descendants, e.g.
+      // GCS, files of subdirectories are listed more than once.
+      files->insert(relative_path);
+    }
+  }
+  return Status::OK();
+}
+
+}  // namespace
+
+Status CachingStoragePathSourceAdapter::Create(
+    const Options& options,
+    std::unique_ptr<CachingStoragePathSourceAdapter>* adapter) {
+  if (options.cache_dir.empty()) {
+    return errors::InvalidArgument("The cache directory must be set");
+  }
+  if (options.num_download_threads < 1) {
+    return errors::InvalidArgument(
+        "The number of download threads must be positive, got ",
+        options.num_download_threads);
+  }
+  if (options.servable_event_bus == nullptr) {
+    return errors::InvalidArgument("The servable event bus must be set");
+  }
+  TF_RETURN_IF_ERROR(options.env->RecursivelyCreateDir(options.cache_dir));
+  adapter->reset(new CachingStoragePathSourceAdapter(options));
+  return Status::OK();
+}
+
+CachingStoragePathSourceAdapter::CachingStoragePathSourceAdapter(
+    const Options& options)
+    : options_(options),
+      download_threads_(new thread::ThreadPool(
+          options.env, "CachingStoragePathSourceAdapter_download_threads",
+          options.num_download_threads)),
+      cache_thread_(new thread::ThreadPool(
+          options.env, "CachingStoragePathSourceAdapter_cache_thread", 1)) {
+  servable_state_subscription_ = options_.servable_event_bus->Subscribe(
+      [this](const EventBus<ServableState>::EventAndTime& state_and_time) {
+        HandleServableStateEvent(state_and_time.event);
+      });
+}
+
+CachingStoragePathSourceAdapter::~CachingStoragePathSourceAdapter() {
+  Detach();
+  servable_state_subscription_.reset();
+  {
+    mutex_lock l(mu_);
+    stopped_ = true;
+  }
+  // Waits for the copies in progress.
+  cache_thread_.reset();
+  download_threads_.reset();
+}
+
+std::vector<ServableData<StoragePath>> CachingStoragePathSourceAdapter::Adapt(
+    const StringPiece servable_name,
+    std::vector<ServableData<StoragePath>> versions) {
+  const string name(servable_name);
+  std::vector<ServableData<StoragePath>> adapted_versions;
+  // The cached versions emitted.
+  std::vector<ServableData<StoragePath>> cached_versions;
+  bool copying = false;
+  mutex_lock l(mu_);
+  aspired_versions_[name] = versions;
+  for (const ServableData<StoragePath>& version : versions) {
+    if (!version.status().ok() || IsLocalPath(version.DataOrDie())) {
+      adapted_versions.push_back(version);
+      continue;
+    }
+    const string cached_path =
+        GetCachedPath(version.id(), version.DataOrDie());
+    const auto error = download_errors_.find(cached_path);
+    if (error != download_errors_.end()) {
+      // The copy is attempted again the next time the version is aspired.
+      adapted_versions.emplace_back(version.id(), error->second);
+      download_errors_.erase(error);
+    } else if (downloading_paths_.count(cached_path) > 0) {
+      copying = true;
+    } else if (options_.env->IsDirectory(cached_path).ok()) {
+      VLOG(1) << "Using the cached copy of " << version.id().DebugString()
+              << " at " << cached_path;
+      cached_versions.emplace_back(version.id(), cached_path);
+    } else {
+      copying = true;
+      downloading_paths_.insert(cached_path);
+      const ServableId id = version.id();
+      const string remote_path = version.DataOrDie();
+      cache_thread_->Schedule([this, id, remote_path, cached_path]() {
+        CopyToCache(id, remote_path, cached_path);
+      });
+    }
+  }
+  if (copying) {
+    // Keeps the versions emitted before until the copies are done.
+    std::set<ServableId> ids;
+    for (const ServableData<StoragePath>& version : adapted_versions) {
+      ids.insert(version.id());
+    }
+    for (const ServableData<StoragePath>& version : cached_versions) {
+      ids.insert(version.id());
+    }
+    for (const ServableData<StoragePath>& version : emitted_versions_[name]) {
+      if (ids.insert(version.id()).second) {
+        cached_versions.push_back(version);
+      }
+    }
+  }
+  for (const ServableData<StoragePath>& version : cached_versions) {
+    live_versions_.insert(version.id());
+    adapted_versions.push_back(version);
+  }
+  emitted_versions_[name] = std::move(cached_versions);
+  Evict(servable_name);
+  return adapted_versions;
+}
+
+string CachingStoragePathSourceAdapter::GetCachedPath(
+    const ServableId& id, const string& remote_path) const {
+  // The hash tells apart versions whose remote path changed, e.g. when the
+  // base path of the servable was reconfigured.
+  return io::JoinPath(
+      options_.cache_dir, id.name,
+      strings::StrCat(id.version, "-",
+                      strings::Hex(Hash64(remote_path), strings::kZeroPad16)));
+}
+
+void CachingStoragePathSourceAdapter::CopyToCache(const ServableId& id,
+                                                  const string& remote_path,
+                                                  const string& cached_path) {
+  {
+    mutex_lock l(mu_);
+    if (stopped_) {
+      return;
+    }
+  }
+  const string partial_path = strings::StrCat(cached_path, kPartialSuffix);
+  Status status;
+  if (options_.env->FileExists(partial_path).ok()) {
+    int64 undeleted_files, undeleted_dirs;
+    status = options_.env->DeleteRecursively(partial_path, &undeleted_files,
+                                             &undeleted_dirs);
+  }
+  LOG(INFO) << "Copying " << id.DebugString() << " from " << remote_path
+            << " to " << cached_path;
+  const uint64 start_micros = options_.env->NowMicros();
+  if (status.ok()) {
+    status = Download(remote_path, partial_path);
+  }
+  if (status.ok()) {
+    status = options_.env->RenameFile(partial_path, cached_path);
+  }
+  if (status.ok()) {
+    LOG(INFO) << "Copied " << id.DebugString() << " in "
+              << (options_.env->NowMicros() - start_micros) / 1000 << " ms";
+  } else {
+    int64 undeleted_files, undeleted_dirs;
+    options_.env
+        ->DeleteRecursively(partial_path, &undeleted_files, &undeleted_dirs)
+        .IgnoreError();
+    status = errors::Unavailable("Could not copy ", id.DebugString(),
+                                 " from ", remote_path,
+                                 " to the cache: ", status.error_message());
+    LOG(ERROR) << status;
+  }
+
+  std::vector<ServableData<StoragePath>> versions;
+  {
+    mutex_lock l(mu_);
+    downloading_paths_.erase(cached_path);
+    if (!status.ok()) {
+      download_errors_[cached_path] = status;
+    }
+    if (stopped_) {
+      return;
+    }
+    versions = aspired_versions_[id.name];
+  }
+  // Emits the version now that it is cached. A version list aspired by the
+  // source in the meantime is emitted by the source itself.
+  SetAspiredVersions(id.name, std::move(versions));
+}
+
+Status CachingStoragePathSourceAdapter::Download(const string& remote_path,
+                                                 const string& local_path) {
+  std::set<string> dirs, files;
+  TF_RETURN_IF_ERROR(
+      ListDescendants(options_.env, remote_path, "", &dirs, &files));
+  TF_RETURN_IF_ERROR(options_.env->RecursivelyCreateDir(local_path));
+  for (const string& dir : dirs) {
+    TF_RETURN_IF_ERROR(
+        options_.env->RecursivelyCreateDir(io::JoinPath(local_path, dir)));
+  }
+  for (const string& file : files) {
+    // Needed if the file system didn't list the parent directory itself.
+    TF_RETURN_IF_ERROR(options_.env->RecursivelyCreateDir(
+        string(io::Dirname(io::JoinPath(local_path, file)))));
+  }
+
+  mutex mu;
+  Status status;
+  BlockingCounter pending(files.size());
+  for (const string& file : files) {
+    download_threads_->Schedule([&, this]() {
+      const string source = io::JoinPath(remote_path, file);
+      const string target = io::JoinPath(local_path, file);
+      Status copy_status = options_.env->CopyFile(source, target);
+      // Guards against truncated copies.
+      uint64 source_size, target_size;
+      if (copy_status.ok()) {
+        copy_status = options_.env->GetFileSize(source, &source_size);
+      }
+      if (copy_status.ok()) {
+        copy_status = options_.env->GetFileSize(target, &target_size);
+      }
+      if (copy_status.ok() && source_size != target_size) {
+        copy_status = errors::DataLoss("Copied ", target_size, " bytes of ",
+                                       source, " instead of ", source_size);
+      }
+      {
+        mutex_lock l(mu);
+        status.Update(copy_status);
+      }
+      pending.DecrementCount();
+    });
+  }
+  pending.Wait();
+  return status;
+}
+
+void CachingStoragePathSourceAdapter::Evict(const StringPiece servable_name) {
+  const string servable_dir = io::JoinPath(options_.cache_dir, servable_name);
+  std::vector<string> children;
+  if (!options_.env->GetChildren(servable_dir, &children).ok()) {
+    return;
+  }
+  std::set<string> kept_paths = downloading_paths_;
+  for (const ServableData<StoragePath>& version :
+       emitted_versions_[string(servable_name)]) {
+    kept_paths.insert(version.DataOrDie());
+  }
+  for (const string& child : children) {
+    const string path = io::JoinPath(servable_dir, child);
+    // Partial copies are deleted along with their version.
+    StringPiece cached_path = path;
+    str_util::ConsumeSuffix(&cached_path, kPartialSuffix);
+    if (kept_paths.count(string(cached_path)) > 0) {
+      continue;
+    }
+    int64 version;
+    const std::vector<string> version_and_hash = str_util::Split(child, '-');
+    if (strings::safe_strto64(version_and_hash[0], &version) &&
+        live_versions_.count({string(servable_name), version}) > 0) {
+      // May still be loaded.
+      continue;
+    }
+    LOG(INFO) << "Deleting " << path << " from the cache";
+    int64 undeleted_files, undeleted_dirs;
+    const Status status = options_.env->DeleteRecursively(
+        path, &undeleted_files, &undeleted_dirs);
+    if (!status.ok()) {
+      LOG(WARNING) << "Could not delete " << path
+                   << " from the cache: " << status;
+    }
+  }
+}
+
+void CachingStoragePathSourceAdapter::HandleServableStateEvent(
+    const ServableState& state) {
+  if (state.manager_state != ServableState::ManagerState::kEnd) {
+    return;
+  }
+  mutex_lock l(mu_);
+  if (live_versions_.erase(state.id) == 0 || stopped_) {
+    return;
+  }
+  // Evicted off the thread of the event bus.
+  const string servable_name = state.id.name;
+  cache_thread_->Schedule([this, servable_name]() {
+    mutex_lock l(mu_);
+    Evict(servable_name);
+  });
+}
+
+}  // namespace serving
+}  // namespace tensorflow
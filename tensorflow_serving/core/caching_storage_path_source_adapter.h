@@ -0,0 +1,140 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_CORE_CACHING_STORAGE_PATH_SOURCE_ADAPTER_H_
+#define TENSORFLOW_SERVING_CORE_CACHING_STORAGE_PATH_SOURCE_ADAPTER_H_
+
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow_serving/core/servable_data.h"
+#include "tensorflow_serving/core/servable_id.h"
+#include "tensorflow_serving/core/servable_state.h"
+#include "tensorflow_serving/core/source_adapter.h"
+#include "tensorflow_serving/core/storage_path.h"
+#include "tensorflow_serving/util/event_bus.h"
+
+namespace tensorflow {
+namespace serving {
+
+// A SourceAdapter that copies servable versions stored on remote file systems
+// (e.g. gs://) to a local cache directory, and emits the local paths instead.
+// Versions already in the cache, e.g. from before a restart, are not copied
+// again. Paths without a URI scheme are local, and passed through unchanged.
+//
+// The copies are made in the background, so that the source is not held up
+// by them. A version is only emitted once its copy is complete, after which
+// the last aspired versions of its servable are emitted again. Until then, the
+// cached versions emitted before stay aspired, so that a new version does not
+// unload the old ones before it can be loaded.
+//
+// The files of a version are copied in parallel into a temporary directory,
+// checked to have the sizes of the remote files, and the directory is then
+// renamed to <cache_dir>/<servable name>/<version>-<hash of the remote path>.
+// Hence the cache only holds complete versions. Cached versions are deleted
+// once they are no longer aspired, and no longer loaded, as per the servable
+// state events.
+class CachingStoragePathSourceAdapter final
+    : public SourceAdapter<StoragePath, StoragePath> {
+ public:
+  struct Options {
+    // The local directory to cache the versions in. Must be set.
+    string cache_dir;
+
+    // The number of files of a version that are copied concurrently.
+    int num_download_threads = 8;
+
+    // The bus of the states of the servables, which tells when the versions
+    // emitted are unloaded. Must be set, and outlive the adapter.
+    EventBus<ServableState>* servable_event_bus = nullptr;
+
+    Env* env = Env::Default();
+  };
+
+  static Status Create(
+      const Options& options,
+      std::unique_ptr<CachingStoragePathSourceAdapter>* adapter);
+
+  ~CachingStoragePathSourceAdapter() override;
+
+ private:
+  explicit CachingStoragePathSourceAdapter(const Options& options);
+
+  std::vector<ServableData<StoragePath>> Adapt(
+      StringPiece servable_name,
+      std::vector<ServableData<StoragePath>> versions) final;
+
+  // Returns the path of the cached copy of version 'id' stored at
+  // 'remote_path'.
+  string GetCachedPath(const ServableId& id, const string& remote_path) const;
+
+  // Copies version 'id' from 'remote_path' to 'cached_path', then emits the
+  // aspired versions of its servable again.
+  void CopyToCache(const ServableId& id, const string& remote_path,
+                   const string& cached_path);
+
+  // Copies the directory 'remote_path' and all its descendants to
+  // 'local_path', which must not exist.
+  Status Download(const string& remote_path, const string& local_path);
+
+  // Deletes the cached versions of 'servable_name' that are neither aspired,
+  // being copied nor loaded.
+  void Evict(StringPiece servable_name) TF_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Tracks the versions that are loaded, and evicts them once unloaded.
+  void HandleServableStateEvent(const ServableState& state);
+
+  const Options options_;
+
+  mutex mu_;
+  // Set by the destructor, to stop emitting versions.
+  bool stopped_ TF_GUARDED_BY(mu_) = false;
+  // The versions last aspired by the source, by servable name.
+  std::map<string, std::vector<ServableData<StoragePath>>> aspired_versions_
+      TF_GUARDED_BY(mu_);
+  // The cached versions last emitted, by servable name.
+  std::map<string, std::vector<ServableData<StoragePath>>> emitted_versions_
+      TF_GUARDED_BY(mu_);
+  // The cached paths of the versions being copied.
+  std::set<string> downloading_paths_ TF_GUARDED_BY(mu_);
+  // The errors of the copies that failed, by cached path, to be emitted once.
+  std::map<string, Status> download_errors_ TF_GUARDED_BY(mu_);
+  // The versions emitted that have not reached kEnd yet, whose cached copies
+  // may be in use.
+  std::set<ServableId> live_versions_ TF_GUARDED_BY(mu_);
+
+  std::unique_ptr<EventBus<ServableState>::Subscription>
+      servable_state_subscription_;
+
+  // Copies the files of a version.
+  std::unique_ptr<thread::ThreadPool> download_threads_;
+  // Copies the versions one at a time, and evicts the unloaded ones.
+  std::unique_ptr<thread::ThreadPool> cache_thread_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(CachingStoragePathSourceAdapter);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_CORE_CACHING_STORAGE_PATH_SOURCE_ADAPTER_H_
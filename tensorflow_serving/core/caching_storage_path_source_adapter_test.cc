@@ -0,0 +1,235 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/core/caching_storage_path_source_adapter.h"
+
+#include <algorithm>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/strings/str_util.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow_serving/core/servable_data.h"
+#include "tensorflow_serving/core/servable_state.h"
+#include "tensorflow_serving/core/storage_path.h"
+#include "tensorflow_serving/util/event_bus.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+class CachingStoragePathSourceAdapterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    const string test_dir = io::JoinPath(
+        testing::TmpDir(),
+        ::testing::UnitTest::GetInstance()->current_test_info()->name());
+    remote_dir_ = io::JoinPath(test_dir, "remote");
+    // The "remote" files are read through their file:// URIs.
+    remote_uri_ = io::CreateURI("file", "", remote_dir_);
+    cache_dir_ = io::JoinPath(test_dir, "cache");
+    servable_event_bus_ = EventBus<ServableState>::CreateEventBus();
+
+    CachingStoragePathSourceAdapter::Options options;
+    options.cache_dir = cache_dir_;
+    options.num_download_threads = 2;
+    options.servable_event_bus = servable_event_bus_.get();
+    TF_ASSERT_OK(CachingStoragePathSourceAdapter::Create(options, &adapter_));
+    adapter_->SetAspiredVersionsCallback(
+        [this](const StringPiece servable_name,
+               std::vector<ServableData<StoragePath>> versions) {
+          mutex_lock l(mu_);
+          emitted_versions_.push_back(std::move(versions));
+          emitted_cv_.notify_all();
+        });
+  }
+
+  // Writes a version with nested and empty directories to the remote dir.
+  void WriteVersion(const string& version, const string& contents) {
+    const string version_dir = io::JoinPath(remote_dir_, version);
+    TF_ASSERT_OK(Env::Default()->RecursivelyCreateDir(
+        io::JoinPath(version_dir, "variables")));
+    TF_ASSERT_OK(Env::Default()->RecursivelyCreateDir(
+        io::JoinPath(version_dir, "assets")));
+    TF_ASSERT_OK(WriteStringToFile(
+        Env::Default(), io::JoinPath(version_dir, "saved_model.pb"), contents));
+    TF_ASSERT_OK(WriteStringToFile(
+        Env::Default(), io::JoinPath(version_dir, "variables", "data"),
+        contents + contents));
+  }
+
+  // Aspires the remote paths of 'versions' of "servable".
+  void AspireRemoteVersions(const std::vector<int64>& versions) {
+    std::vector<ServableData<StoragePath>> aspired_versions;
+    for (const int64 version : versions) {
+      aspired_versions.emplace_back(
+          ServableId{"servable", version},
+          io::JoinPath(remote_uri_, strings::StrCat(version)));
+    }
+    adapter_->SetAspiredVersions("servable", std::move(aspired_versions));
+  }
+
+  // Returns the versions last emitted by the adapter.
+  std::vector<ServableData<StoragePath>> LastEmittedVersions() {
+    mutex_lock l(mu_);
+    return emitted_versions_.empty() ? std::vector<ServableData<StoragePath>>()
+                                     : emitted_versions_.back();
+  }
+
+  // Waits until the adapter emits exactly 'versions', and returns them.
+  std::vector<ServableData<StoragePath>> WaitForEmittedVersions(
+      const std::vector<int64>& versions) {
+    mutex_lock l(mu_);
+    while (true) {
+      if (!emitted_versions_.empty()) {
+        std::vector<int64> emitted;
+        for (const ServableData<StoragePath>& version :
+             emitted_versions_.back()) {
+          emitted.push_back(version.id().version);
+        }
+        std::sort(emitted.begin(), emitted.end());
+        if (emitted == versions) {
+          return emitted_versions_.back();
+        }
+      }
+      emitted_cv_.wait(l);
+    }
+  }
+
+  // Waits until 'path' is deleted.
+  void WaitUntilDeleted(const string& path) {
+    while (Env::Default()->FileExists(path).ok()) {
+      Env::Default()->SleepForMicroseconds(1000);
+    }
+  }
+
+  string remote_dir_;
+  string remote_uri_;
+  string cache_dir_;
+  std::shared_ptr<EventBus<ServableState>> servable_event_bus_;
+  std::unique_ptr<CachingStoragePathSourceAdapter> adapter_;
+  mutex mu_;
+  condition_variable emitted_cv_;
+  std::vector<std::vector<ServableData<StoragePath>>> emitted_versions_
+      TF_GUARDED_BY(mu_);
+};
+
+TEST_F(CachingStoragePathSourceAdapterTest, CopiesRemoteVersions) {
+  WriteVersion("1", "foo");
+  // The version is copied in the background, and emitted once cached.
+  AspireRemoteVersions({1});
+  std::vector<ServableData<StoragePath>> emitted = WaitForEmittedVersions({1});
+  TF_ASSERT_OK(emitted[0].status());
+  const string cached_path = emitted[0].DataOrDie();
+  EXPECT_TRUE(str_util::StartsWith(cached_path, cache_dir_));
+
+  string contents;
+  TF_ASSERT_OK(ReadFileToString(
+      Env::Default(), io::JoinPath(cached_path, "saved_model.pb"), &contents));
+  EXPECT_EQ("foo", contents);
+  TF_ASSERT_OK(ReadFileToString(
+      Env::Default(), io::JoinPath(cached_path, "variables", "data"),
+      &contents));
+  EXPECT_EQ("foofoo", contents);
+  TF_EXPECT_OK(
+      Env::Default()->IsDirectory(io::JoinPath(cached_path, "assets")));
+
+  // Cached versions are not copied again, and are emitted right away.
+  WriteVersion("1", "bar");
+  AspireRemoteVersions({1});
+  emitted = LastEmittedVersions();
+  ASSERT_EQ(1, emitted.size());
+  TF_ASSERT_OK(emitted[0].status());
+  EXPECT_EQ(cached_path, emitted[0].DataOrDie());
+  TF_ASSERT_OK(ReadFileToString(
+      Env::Default(), io::JoinPath(cached_path, "saved_model.pb"), &contents));
+  EXPECT_EQ("foo", contents);
+}
+
+TEST_F(CachingStoragePathSourceAdapterTest, KeepsVersionsUntilUnloaded) {
+  WriteVersion("1", "foo");
+  WriteVersion("2", "bar");
+  AspireRemoteVersions({1});
+  const string cached_path_1 = WaitForEmittedVersions({1})[0].DataOrDie();
+
+  // Version 1 stays aspired while version 2 is copied.
+  AspireRemoteVersions({2});
+  std::vector<ServableData<StoragePath>> emitted = LastEmittedVersions();
+  ASSERT_EQ(1, emitted.size());
+  EXPECT_EQ(cached_path_1, emitted[0].DataOrDie());
+  emitted = WaitForEmittedVersions({2});
+  TF_ASSERT_OK(emitted[0].status());
+  EXPECT_NE(cached_path_1, emitted[0].DataOrDie());
+
+  // Version 1 is no longer aspired, but is only deleted once unloaded.
+  AspireRemoteVersions({2});
+  TF_EXPECT_OK(Env::Default()->IsDirectory(cached_path_1));
+  servable_event_bus_->Publish({{"servable", 1},
+                                ServableState::ManagerState::kEnd,
+                                Status::OK()});
+  WaitUntilDeleted(cached_path_1);
+  TF_EXPECT_OK(Env::Default()->IsDirectory(emitted[0].DataOrDie()));
+}
+
+TEST_F(CachingStoragePathSourceAdapterTest, DeletesVersionsNeverEmitted) {
+  // E.g. a version cached before a restart.
+  const string stale_path = io::JoinPath(cache_dir_, "servable", "7-0");
+  TF_ASSERT_OK(Env::Default()->RecursivelyCreateDir(stale_path));
+  WriteVersion("1", "foo");
+  AspireRemoteVersions({1});
+  WaitForEmittedVersions({1});
+  EXPECT_FALSE(Env::Default()->FileExists(stale_path).ok());
+}
+
+TEST_F(CachingStoragePathSourceAdapterTest, PassesThroughLocalPaths) {
+  const string local_path = io::JoinPath(remote_dir_, "1");
+  ServableData<StoragePath> output = adapter_->AdaptOneVersion(
+      ServableData<StoragePath>({"servable", 1}, local_path));
+  TF_ASSERT_OK(output.status());
+  EXPECT_EQ(local_path, output.DataOrDie());
+}
+
+TEST_F(CachingStoragePathSourceAdapterTest, MissingRemoteVersion) {
+  AspireRemoteVersions({1});
+  const std::vector<ServableData<StoragePath>> emitted =
+      WaitForEmittedVersions({1});
+  EXPECT_FALSE(emitted[0].status().ok());
+  std::vector<string> children;
+  TF_ASSERT_OK(Env::Default()->GetChildren(cache_dir_, &children));
+  EXPECT_TRUE(children.empty());
+}
+
+TEST(CachingStoragePathSourceAdapterCreateTest, InvalidOptions) {
+  std::unique_ptr<CachingStoragePathSourceAdapter> adapter;
+  std::shared_ptr<EventBus<ServableState>> servable_event_bus =
+      EventBus<ServableState>::CreateEventBus();
+  CachingStoragePathSourceAdapter::Options options;
+  options.servable_event_bus = servable_event_bus.get();
+  EXPECT_FALSE(CachingStoragePathSourceAdapter::Create(options, &adapter).ok());
+  options.cache_dir = io::JoinPath(testing::TmpDir(), "InvalidOptions");
+  options.num_download_threads = 0;
+  EXPECT_FALSE(CachingStoragePathSourceAdapter::Create(options, &adapter).ok());
+  options.num_download_threads = 1;
+  options.servable_event_bus = nullptr;
+  EXPECT_FALSE(CachingStoragePathSourceAdapter::Create(options, &adapter).ok());
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
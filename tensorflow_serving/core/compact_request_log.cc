@@ -0,0 +1,316 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/core/compact_request_log.h"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "tensorflow/core/example/example.pb.h"
+#include "tensorflow/core/example/feature.pb.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor.pb.h"
+#include "tensorflow/core/framework/types.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/strings/proto_serialization.h"
+#include "tensorflow/core/platform/fingerprint.h"
+#include "tensorflow_serving/apis/classification.pb.h"
+#include "tensorflow_serving/apis/input.pb.h"
+#include "tensorflow_serving/apis/model.pb.h"
+#include "tensorflow_serving/apis/predict.pb.h"
+#include "tensorflow_serving/apis/regression.pb.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+// Appends the values of 'feature' to 'column', and returns their number.
+uint32 AppendFeature(const Feature& feature, LogColumn* column) {
+  switch (feature.kind_case()) {
+    case Feature::kFloatList:
+      column->mutable_float_values()->MergeFrom(feature.float_list().value());
+      return feature.float_list().value_size();
+    case Feature::kInt64List:
+      column->mutable_int64_values()->MergeFrom(feature.int64_list().value());
+      return feature.int64_list().value_size();
+    case Feature::kBytesList:
+      column->mutable_bytes_values()->MergeFrom(feature.bytes_list().value());
+      return feature.bytes_list().value_size();
+    default:
+      return 0;
+  }
+}
+
+// Sets the lengths of 'column', unless they are all the same.
+void SetLengths(const std::vector<uint32>& lengths, LogColumn* column) {
+  if (std::adjacent_find(lengths.begin(), lengths.end(),
+                         std::not_equal_to<uint32>()) != lengths.end()) {
+    column->mutable_lengths()->Reserve(lengths.size());
+    for (const uint32 length : lengths) {
+      column->add_lengths(length);
+    }
+  }
+}
+
+// Adds the columns of the features of 'config' from the examples of 'input'.
+// The features of the context apply to all the examples, unless they have
+// their own.
+Status AddExampleColumns(const CompactLoggingConfig& config,
+                         const Input& input, CompactLog* log) {
+  const google::protobuf::RepeatedPtrField<Example>* examples;
+  const Example* context = nullptr;
+  switch (input.kind_case()) {
+    case Input::kExampleList:
+      examples = &input.example_list().examples();
+      break;
+    case Input::kExampleListWithContext:
+      examples = &input.example_list_with_context().examples();
+      context = &input.example_list_with_context().context();
+      break;
+    default:
+      return errors::InvalidArgument("Input is empty");
+  }
+  log->set_num_examples(examples->size());
+
+  std::vector<uint32> lengths;
+  for (const string& name : config.input_features()) {
+    const Feature* context_feature = nullptr;
+    if (context != nullptr) {
+      const auto it = context->features().feature().find(name);
+      if (it != context->features().feature().end()) {
+        context_feature = &it->second;
+      }
+    }
+    LogColumn* const column = log->add_inputs();
+    lengths.clear();
+    for (const Example& example : *examples) {
+      const auto it = example.features().feature().find(name);
+      const Feature* const feature =
+          it != example.features().feature().end() ? &it->second
+                                                   : context_feature;
+      lengths.push_back(feature == nullptr ? 0
+                                           : AppendFeature(*feature, column));
+    }
+    SetLengths(lengths, column);
+  }
+  return Status::OK();
+}
+
+// Appends the values of 'tensor', of type T, to 'values'.
+template <typename T, typename Values>
+void AppendValues(const Tensor& tensor, Values* values) {
+  const auto flat = tensor.flat<T>();
+  values->Reserve(values->size() + flat.size());
+  for (int64 i = 0; i < flat.size(); ++i) {
+    values->Add(static_cast<typename Values::value_type>(flat(i)));
+  }
+}
+
+// Appends the values of 'tensor_proto' to 'column'. The batched tensors of
+// the examples all have the same shape, so the lengths are left empty.
+Status AppendTensor(const TensorProto& tensor_proto, LogColumn* column) {
+  Tensor tensor;
+  if (!tensor.FromProto(tensor_proto)) {
+    return errors::InvalidArgument("Cannot parse a tensor of type ",
+                                   DataTypeString(tensor_proto.dtype()));
+  }
+  switch (tensor.dtype()) {
+    case DT_FLOAT:
+      AppendValues<float>(tensor, column->mutable_float_values());
+      break;
+    case DT_DOUBLE:
+      AppendValues<double>(tensor, column->mutable_float_values());
+      break;
+    case DT_HALF:
+      AppendValues<Eigen::half>(tensor, column->mutable_float_values());
+      break;
+    case DT_BFLOAT16:
+      AppendValues<bfloat16>(tensor, column->mutable_float_values());
+      break;
+    case DT_INT32:
+      AppendValues<int32>(tensor, column->mutable_int64_values());
+      break;
+    case DT_INT64:
+      AppendValues<int64>(tensor, column->mutable_int64_values());
+      break;
+    case DT_BOOL:
+      AppendValues<bool>(tensor, column->mutable_int64_values());
+      break;
+    case DT_STRING: {
+      const auto values = tensor.flat<tstring>();
+      column->mutable_bytes_values()->Reserve(values.size());
+      for (int64 i = 0; i < values.size(); ++i) {
+        column->add_bytes_values(values(i).data(), values(i).size());
+      }
+      break;
+    }
+    default:
+      return errors::Unimplemented("Cannot log a tensor of type ",
+                                   DataTypeString(tensor.dtype()));
+  }
+  return Status::OK();
+}
+
+// Returns the size of the first dimension of the first request input by
+// name, as the inputs of a batch all have the same. 1 for scalars.
+int32 PredictBatchSize(const PredictRequest& request) {
+  const TensorProto* first_input = nullptr;
+  const string* first_name = nullptr;
+  for (const auto& input : request.inputs()) {
+    if (first_name == nullptr || input.first < *first_name) {
+      first_name = &input.first;
+      first_input = &input.second;
+    }
+  }
+  if (first_input == nullptr) {
+    return 0;
+  }
+  return first_input->tensor_shape().dim().empty()
+             ? 1
+             : first_input->tensor_shape().dim(0).size();
+}
+
+Status AddPredictColumns(const CompactLoggingConfig& config,
+                         const PredictRequest& request,
+                         const PredictResponse& response, CompactLog* log) {
+  log->set_num_examples(PredictBatchSize(request));
+  // The columns of the missing inputs or outputs are left empty.
+  for (const string& name : config.input_features()) {
+    LogColumn* const column = log->add_inputs();
+    const auto it = request.inputs().find(name);
+    if (it != request.inputs().end()) {
+      TF_RETURN_IF_ERROR(AppendTensor(it->second, column));
+    }
+  }
+  if (config.predict_outputs().empty()) {
+    // The outputs are sorted, as the iteration order of the map is not
+    // deterministic. Their names are recorded, as the columns shift when the
+    // outputs of the model change.
+    std::map<string, const TensorProto*> outputs;
+    for (const auto& output : response.outputs()) {
+      outputs[output.first] = &output.second;
+    }
+    for (const auto& output : outputs) {
+      log->add_output_names(output.first);
+      TF_RETURN_IF_ERROR(AppendTensor(*output.second, log->add_outputs()));
+    }
+    return Status::OK();
+  }
+  for (const string& name : config.predict_outputs()) {
+    LogColumn* const column = log->add_outputs();
+    const auto it = response.outputs().find(name);
+    if (it != response.outputs().end()) {
+      TF_RETURN_IF_ERROR(AppendTensor(it->second, column));
+    }
+  }
+  return Status::OK();
+}
+
+// Adds the classes of the examples of 'result' as one column. The labels are
+// left out if the classifier has none.
+void AddClassificationColumn(const ClassificationResult& result,
+                             CompactLog* log) {
+  LogColumn* const column = log->add_outputs();
+  std::vector<uint32> lengths;
+  lengths.reserve(result.classifications_size());
+  bool has_labels = false;
+  for (const Classifications& classifications : result.classifications()) {
+    lengths.push_back(classifications.classes_size());
+    for (const Class& output_class : classifications.classes()) {
+      *column->add_bytes_values() = output_class.label();
+      column->add_float_values(output_class.score());
+      has_labels |= !output_class.label().empty();
+    }
+  }
+  if (!has_labels) {
+    column->clear_bytes_values();
+  }
+  SetLengths(lengths, column);
+}
+
+void AddRegressionColumn(const RegressionResult& result, CompactLog* log) {
+  LogColumn* const column = log->add_outputs();
+  column->mutable_float_values()->Reserve(result.regressions_size());
+  for (const Regression& regression : result.regressions()) {
+    column->add_float_values(regression.value());
+  }
+}
+
+}  // namespace
+
+Status CreateCompactLog(const CompactLoggingConfig& config,
+                        const google::protobuf::Message& request,
+                        const google::protobuf::Message& response,
+                        const LogMetadata& log_metadata,
+                        std::unique_ptr<google::protobuf::Message>* log) {
+  auto prediction_log = absl::make_unique<PredictionLog>();
+  CompactLog* const compact_log = prediction_log->mutable_compact_log();
+
+  const ModelSpec* response_model_spec;
+  const auto* const request_descriptor = request.GetDescriptor();
+  const auto* const response_descriptor = response.GetDescriptor();
+  if (request_descriptor == ClassificationRequest::descriptor() &&
+      response_descriptor == ClassificationResponse::descriptor()) {
+    const auto& classification_response =
+        static_cast<const ClassificationResponse&>(response);
+    TF_RETURN_IF_ERROR(AddExampleColumns(
+        config, static_cast<const ClassificationRequest&>(request).input(),
+        compact_log));
+    AddClassificationColumn(classification_response.result(), compact_log);
+    response_model_spec = &classification_response.model_spec();
+  } else if (request_descriptor == RegressionRequest::descriptor() &&
+             response_descriptor == RegressionResponse::descriptor()) {
+    const auto& regression_response =
+        static_cast<const RegressionResponse&>(response);
+    TF_RETURN_IF_ERROR(AddExampleColumns(
+        config, static_cast<const RegressionRequest&>(request).input(),
+        compact_log));
+    AddRegressionColumn(regression_response.result(), compact_log);
+    response_model_spec = &regression_response.model_spec();
+  } else if (request_descriptor == PredictRequest::descriptor() &&
+             response_descriptor == PredictResponse::descriptor()) {
+    const auto& predict_response =
+        static_cast<const PredictResponse&>(response);
+    TF_RETURN_IF_ERROR(AddPredictColumns(
+        config, static_cast<const PredictRequest&>(request), predict_response,
+        compact_log));
+    response_model_spec = &predict_response.model_spec();
+  } else {
+    return errors::Unimplemented("Cannot create a compact log of a ",
+                                 request_descriptor->full_name());
+  }
+
+  string serialized_request;
+  if (!SerializeToStringDeterministic(request, &serialized_request)) {
+    return errors::InvalidArgument("Cannot serialize the request");
+  }
+  compact_log->set_request_fingerprint(Fingerprint64(serialized_request));
+
+  *prediction_log->mutable_log_metadata() = log_metadata;
+  if (response_model_spec->has_version()) {
+    *prediction_log->mutable_log_metadata()
+         ->mutable_model_spec()
+         ->mutable_version() = response_model_spec->version();
+  }
+  *log = std::move(prediction_log);
+  return Status::OK();
+}
+
+}  // namespace serving
+}  // namespace tensorflow
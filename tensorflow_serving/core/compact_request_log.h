@@ -0,0 +1,46 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_CORE_COMPACT_REQUEST_LOG_H_
+#define TENSORFLOW_SERVING_CORE_COMPACT_REQUEST_LOG_H_
+
+#include <memory>
+
+#include "google/protobuf/message.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow_serving/apis/logging.pb.h"
+#include "tensorflow_serving/apis/prediction_log.pb.h"
+#include "tensorflow_serving/config/logging_config.pb.h"
+
+namespace tensorflow {
+namespace serving {
+
+// Creates the PredictionLog of a Classify, Regress or Predict request and its
+// response as a CompactLog: the fingerprint of the request, the columns of
+// 'config', and the outputs. The version of the model serving the request is
+// added to the model spec of 'log_metadata'.
+//
+// Returns an error for the other requests, or for Predict tensors of a type
+// without a LogColumn field (e.g. complex numbers).
+Status CreateCompactLog(const CompactLoggingConfig& config,
+                        const google::protobuf::Message& request,
+                        const google::protobuf::Message& response,
+                        const LogMetadata& log_metadata,
+                        std::unique_ptr<google::protobuf::Message>* log);
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_CORE_COMPACT_REQUEST_LOG_H_
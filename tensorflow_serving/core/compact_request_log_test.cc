@@ -0,0 +1,226 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/core/compact_request_log.h"
+
+#include <memory>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/protobuf/error_codes.pb.h"
+#include "tensorflow_serving/apis/classification.pb.h"
+#include "tensorflow_serving/apis/predict.pb.h"
+#include "tensorflow_serving/apis/prediction_log.pb.h"
+#include "tensorflow_serving/apis/regression.pb.h"
+#include "tensorflow_serving/test_util/test_util.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+using test_util::CreateProto;
+using test_util::EqualsProto;
+
+// Returns the CompactLog of 'request' and 'response', with the fingerprint
+// cleared.
+template <typename Request, typename Response>
+PredictionLog CreateLog(const CompactLoggingConfig& config,
+                        const Request& request, const Response& response) {
+  LogMetadata log_metadata;
+  log_metadata.mutable_model_spec()->set_name("model");
+  std::unique_ptr<google::protobuf::Message> log;
+  TF_CHECK_OK(CreateCompactLog(config, request, response, log_metadata, &log));
+  PredictionLog prediction_log = static_cast<const PredictionLog&>(*log);
+  EXPECT_NE(0, prediction_log.compact_log().request_fingerprint());
+  prediction_log.mutable_compact_log()->clear_request_fingerprint();
+  return prediction_log;
+}
+
+TEST(CompactRequestLogTest, Classification) {
+  const auto config = CreateProto<CompactLoggingConfig>(
+      "input_features: 'age' "
+      "input_features: 'tags' "
+      "input_features: 'country' ");
+  const auto request = CreateProto<ClassificationRequest>(R"(
+    input {
+      example_list_with_context {
+        examples {
+          features {
+            feature { key: 'age' value { int64_list { value: 31 } } }
+            feature { key: 'tags' value { bytes_list { value: ['a', 'b'] } } }
+            feature { key: 'ignored' value { float_list { value: 1 } } }
+          }
+        }
+        examples {
+          features {
+            feature { key: 'age' value { int64_list { value: 45 } } }
+            feature { key: 'country' value { bytes_list { value: 'ch' } } }
+          }
+        }
+        context {
+          features {
+            feature { key: 'country' value { bytes_list { value: 'fr' } } }
+          }
+        }
+      }
+    })");
+  const auto response = CreateProto<ClassificationResponse>(R"(
+    model_spec { name: 'model' version { value: 3 } }
+    result {
+      classifications {
+        classes { label: 'yes' score: 0.75 }
+        classes { label: 'no' score: 0.25 }
+      }
+      classifications {
+        classes { label: 'yes' score: 0.5 }
+        classes { label: 'no' score: 0.5 }
+      }
+    })");
+
+  EXPECT_THAT(CreateLog(config, request, response), EqualsProto(R"(
+    log_metadata { model_spec { name: 'model' version { value: 3 } } }
+    compact_log {
+      num_examples: 2
+      inputs { int64_values: [31, 45] }
+      inputs { lengths: [2, 0] bytes_values: ['a', 'b'] }
+      inputs { bytes_values: ['fr', 'ch'] }
+      outputs {
+        bytes_values: ['yes', 'no', 'yes', 'no']
+        float_values: [0.75, 0.25, 0.5, 0.5]
+      }
+    })"));
+}
+
+TEST(CompactRequestLogTest, Regression) {
+  const auto config =
+      CreateProto<CompactLoggingConfig>("input_features: 'age'");
+  const auto request = CreateProto<RegressionRequest>(R"(
+    input {
+      example_list {
+        examples {
+          features {
+            feature { key: 'age' value { float_list { value: 31 } } }
+          }
+        }
+      }
+    })");
+  const auto response = CreateProto<RegressionResponse>(
+      "result { regressions { value: 1.5 } }");
+
+  EXPECT_THAT(CreateLog(config, request, response), EqualsProto(R"(
+    log_metadata { model_spec { name: 'model' } }
+    compact_log {
+      num_examples: 1
+      inputs { float_values: 31 }
+      outputs { float_values: 1.5 }
+    })"));
+}
+
+TEST(CompactRequestLogTest, Predict) {
+  PredictRequest request;
+  test::AsTensor<int32>({1, 2, 3, 4}, {2, 2})
+      .AsProtoField(&(*request.mutable_inputs())["ids"]);
+  test::AsTensor<tstring>({"a", "b"}, {2})
+      .AsProtoField(&(*request.mutable_inputs())["names"]);
+  PredictResponse response;
+  response.mutable_model_spec()->mutable_version()->set_value(7);
+  test::AsTensor<float>({0.5, 1.5}, {2})
+      .AsProtoTensorContent(&(*response.mutable_outputs())["scores"]);
+  test::AsTensor<int64>({0, 1}, {2})
+      .AsProtoField(&(*response.mutable_outputs())["classes"]);
+
+  // All the outputs are logged by default, ordered by name.
+  auto config = CreateProto<CompactLoggingConfig>(
+      "input_features: 'names' "
+      "input_features: 'ids' "
+      "input_features: 'missing' ");
+  EXPECT_THAT(CreateLog(config, request, response), EqualsProto(R"(
+    log_metadata { model_spec { name: 'model' version { value: 7 } } }
+    compact_log {
+      num_examples: 2
+      inputs { bytes_values: ['a', 'b'] }
+      inputs { int64_values: [1, 2, 3, 4] }
+      inputs {}
+      outputs { int64_values: [0, 1] }
+      outputs { float_values: [0.5, 1.5] }
+      output_names: ['classes', 'scores']
+    })"));
+
+  config.add_predict_outputs("scores");
+  const CompactLog log = CreateLog(config, request, response).compact_log();
+  EXPECT_THAT(log.outputs(),
+              ::testing::ElementsAre(EqualsProto("float_values: [0.5, 1.5]")));
+  EXPECT_TRUE(log.output_names().empty());
+}
+
+TEST(CompactRequestLogTest, Fingerprint) {
+  const CompactLoggingConfig config;
+  PredictRequest request;
+  test::AsTensor<float>({1}, {1})
+      .AsProtoField(&(*request.mutable_inputs())["a"]);
+  test::AsTensor<float>({2}, {1})
+      .AsProtoField(&(*request.mutable_inputs())["b"]);
+  const PredictResponse response;
+
+  const auto fingerprint = [&](const PredictRequest& actual_request) {
+    std::unique_ptr<google::protobuf::Message> log;
+    TF_CHECK_OK(CreateCompactLog(config, actual_request, response,
+                                 LogMetadata(), &log));
+    return static_cast<const PredictionLog&>(*log)
+        .compact_log()
+        .request_fingerprint();
+  };
+  // The same requests have the same fingerprint, regardless of the order of
+  // their map entries.
+  PredictRequest same_request;
+  (*same_request.mutable_inputs())["b"] = request.inputs().at("b");
+  (*same_request.mutable_inputs())["a"] = request.inputs().at("a");
+  EXPECT_EQ(fingerprint(request), fingerprint(same_request));
+
+  PredictRequest other_request = request;
+  other_request.mutable_model_spec()->set_name("other");
+  EXPECT_NE(fingerprint(request), fingerprint(other_request));
+}
+
+TEST(CompactRequestLogTest, UnsupportedRequests) {
+  const CompactLoggingConfig config;
+  std::unique_ptr<google::protobuf::Message> log;
+  EXPECT_EQ(error::UNIMPLEMENTED,
+            CreateCompactLog(config, LogMetadata(), LogMetadata(),
+                             LogMetadata(), &log)
+                .code());
+
+  PredictRequest request;
+  Tensor complex_tensor(DT_COMPLEX64, TensorShape({1}));
+  complex_tensor.AsProtoField(&(*request.mutable_inputs())["x"]);
+  EXPECT_EQ(error::UNIMPLEMENTED,
+            CreateCompactLog(
+                CreateProto<CompactLoggingConfig>("input_features: 'x'"),
+                request, PredictResponse(), LogMetadata(), &log)
+                .code());
+
+  // Classify requests need examples.
+  EXPECT_EQ(error::INVALID_ARGUMENT,
+            CreateCompactLog(config, ClassificationRequest(),
+                             ClassificationResponse(), LogMetadata(), &log)
+                .code());
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
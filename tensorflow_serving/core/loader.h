@@ -75,6 +75,10 @@ class Loader {
   //      include: (a) replace conservative estimate with actual measurement
   //      once loaded in memory; (b) load process consumes extra transient
   //      memory that is not used in steady-state after the load completes.
+  //      As an exception, an estimate found too low once the servable is
+  //      loaded may be replaced by its measured usage: the resources used by
+  //      the loaded servables are recomputed from their current estimates
+  //      before each load, so the correction only delays the later loads.
   ///
   /// @return an estimate of the resources the servable will consume once
   /// loaded. If the servable has already been loaded, returns an estimate of
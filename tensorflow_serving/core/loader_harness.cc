@@ -25,6 +25,21 @@ limitations under the License.
 namespace tensorflow {
 namespace serving {
 
+namespace {
+
+RetryOptions LoadRetryOptions(const LoaderHarness::Options& options) {
+  RetryOptions retry_options;
+  retry_options.max_num_retries = options.max_num_load_retries;
+  retry_options.retry_interval_micros = options.load_retry_interval_micros;
+  retry_options.backoff_multiplier = options.load_retry_backoff_multiplier;
+  retry_options.max_retry_interval_micros =
+      options.max_load_retry_interval_micros;
+  retry_options.jitter = options.load_retry_jitter;
+  return retry_options;
+}
+
+}  // namespace
+
 LoaderHarness::LoaderHarness(const ServableId& id,
                              std::unique_ptr<Loader> loader,
                              const Options& options)
@@ -76,7 +91,7 @@ Status LoaderHarness::Load() {
 
   const Status status = Retry(
       strings::StrCat("Loading servable: ", id_.DebugString()),
-      options_.max_num_load_retries, options_.load_retry_interval_micros,
+      LoadRetryOptions(options_),
       [&]() { return loader_->LoadWithMetadata({id_}); },
       [&]() { return cancel_load_retry(); });
 
@@ -93,6 +108,52 @@ Status LoaderHarness::Load() {
   return status;
 }
 
+Status LoaderHarness::LoadAttempt(bool* const retry,
+                                  int64* const retry_delay_micros) {
+  *retry = false;
+  *retry_delay_micros = 0;
+  uint32 num_retries;
+  {
+    mutex_lock l(mu_);
+    if (num_load_attempts_ == 0) {
+      TF_RETURN_IF_ERROR(
+          TransitionState(State::kLoadApproved, State::kLoading));
+      LOG(INFO) << "Loading servable version " << id_;
+    } else {
+      TF_RETURN_IF_ERROR(TransitionState(State::kLoading, State::kLoading));
+      if (cancel_load_retry_) {
+        LOG(INFO) << "Retrying of loading servable version " << id_
+                  << " was cancelled.";
+        ErrorInternal(last_load_attempt_status_);
+        return last_load_attempt_status_;
+      }
+      LOG(INFO) << "Retrying of loading servable version " << id_
+                << " retry: " << num_load_attempts_;
+    }
+    num_retries = num_load_attempts_++;
+  }
+
+  // We don't hold the lock while calling Load() as it may block.
+  const Status status = loader_->LoadWithMetadata({id_});
+
+  mutex_lock l(mu_);
+  if (status.ok()) {
+    TF_RETURN_IF_ERROR(TransitionState(State::kLoading, State::kReady));
+    LOG(INFO) << "Successfully loaded servable version " << id_;
+    return Status::OK();
+  }
+  LOG(ERROR) << "Loading servable version " << id_ << " failed: " << status;
+  if (!cancel_load_retry_ && num_retries < options_.max_num_load_retries) {
+    last_load_attempt_status_ = status;
+    *retry = true;
+    *retry_delay_micros =
+        RetryDelayMicros(LoadRetryOptions(options_), num_retries + 1);
+    return status;
+  }
+  ErrorInternal(status);
+  return status;
+}
+
 Status LoaderHarness::UnloadRequested() {
   mutex_lock l(mu_);
   if (state_ != State::kReady) {
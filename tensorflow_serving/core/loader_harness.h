@@ -100,9 +100,20 @@ class LoaderHarness final {
     /// failure, before we give up.
     uint32 max_num_load_retries = 0;
 
-    /// The interval, in microseconds, between each servable load retry.
+    /// The interval, in microseconds, before the first servable load retry.
     uint64 load_retry_interval_micros = 0;
 
+    /// The factor the interval is multiplied by after each load retry. 1 keeps
+    /// a fixed interval.
+    double load_retry_backoff_multiplier = 1;
+
+    /// The max interval, in microseconds, between two load retries. 0 means a
+    /// day.
+    int64 max_load_retry_interval_micros = 0;
+
+    /// The fraction, in [0, 1], of each load retry interval that is randomized.
+    double load_retry_jitter = 0;
+
     /// An (optional) function to call upon transitioning to state kError.
     std::function<void(const ServableId& id, const Status& error)>
         error_callback;
@@ -163,6 +174,20 @@ class LoaderHarness final {
   /// transitions to state kError and invokes 'options_.error_callback'.
   Status Load() TF_LOCKS_EXCLUDED(mu_);
 
+  /// Like Load(), but makes a single attempt of Servable::Load(), so that the
+  /// caller can wait for the retries without holding its thread. The first call
+  /// transitions to kLoading. If the attempt fails while retries remain and
+  /// are not cancelled, the state stays kLoading, '*retry' is set to true and
+  /// '*retry_delay_micros' to the delay before the next call. Otherwise
+  /// '*retry' is set to false and the state is kReady or kError, as after
+  /// Load().
+  ///
+  /// REQUIRES: State is kLoadApproved when first called, then kLoading.
+  /// Otherwise DCHECK-fails, transitions to state kError and invokes
+  /// 'options_.error_callback'.
+  Status LoadAttempt(bool* retry, int64* retry_delay_micros)
+      TF_LOCKS_EXCLUDED(mu_);
+
   /// Transitions the state of the harness to kUnloadRequested iff its current
   /// state is kReady. The test-and-change is done transactionally, so this
   /// method can be used to ensure that at most one Load() request can proceed.
@@ -241,6 +266,10 @@ class LoaderHarness final {
   // If set to true, we don't try to retry the load of the servable, if not
   // loaded by the first attempt.
   bool cancel_load_retry_ TF_GUARDED_BY(mu_) = false;
+  // The number of LoadAttempt() calls which tried Servable::Load(), and the
+  // status of the last one.
+  uint32 num_load_attempts_ TF_GUARDED_BY(mu_) = 0;
+  Status last_load_attempt_status_ TF_GUARDED_BY(mu_);
 
   TF_DISALLOW_COPY_AND_ASSIGN(LoaderHarness);
 };
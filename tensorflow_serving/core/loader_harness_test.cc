@@ -325,6 +325,59 @@ TEST(LoaderHarnessTest, RetryOnLoadErrorCancelledLoad) {
       }));
 }
 
+TEST(LoaderHarnessTest, LoadAttemptsWithBackoff) {
+  test_util::MockLoader* loader = new NiceMock<test_util::MockLoader>;
+  LoaderHarness::Options options;
+  options.max_num_load_retries = 2;
+  options.load_retry_interval_micros = 100;
+  options.load_retry_backoff_multiplier = 10;
+  const ServableId servable_id = {"test", 0};
+  LoaderHarness harness(servable_id, std::unique_ptr<Loader>(loader), options);
+
+  EXPECT_CALL(*loader, LoadWithMetadata(Loader::Metadata{servable_id}))
+      .Times(3)
+      .WillRepeatedly(InvokeWithoutArgs(
+          []() { return errors::Unknown("test load error"); }));
+  TF_ASSERT_OK(harness.LoadRequested());
+  TF_ASSERT_OK(harness.LoadApproved());
+  bool retry;
+  int64 retry_delay_micros;
+  EXPECT_FALSE(harness.LoadAttempt(&retry, &retry_delay_micros).ok());
+  EXPECT_TRUE(retry);
+  EXPECT_EQ(100, retry_delay_micros);
+  EXPECT_EQ(LoaderHarness::State::kLoading, harness.state());
+  EXPECT_FALSE(harness.LoadAttempt(&retry, &retry_delay_micros).ok());
+  EXPECT_TRUE(retry);
+  EXPECT_EQ(1000, retry_delay_micros);
+  const Status status = harness.LoadAttempt(&retry, &retry_delay_micros);
+  EXPECT_THAT(status.error_message(), HasSubstr("test load error"));
+  EXPECT_FALSE(retry);
+  EXPECT_EQ(LoaderHarness::State::kError, harness.state());
+}
+
+TEST(LoaderHarnessTest, LoadAttemptsCancelled) {
+  test_util::MockLoader* loader = new NiceMock<test_util::MockLoader>;
+  LoaderHarness::Options options;
+  options.max_num_load_retries = 10;
+  const ServableId servable_id = {"test", 0};
+  LoaderHarness harness(servable_id, std::unique_ptr<Loader>(loader), options);
+
+  EXPECT_CALL(*loader, LoadWithMetadata(Loader::Metadata{servable_id}))
+      .WillOnce(InvokeWithoutArgs(
+          []() { return errors::Unknown("test load error"); }));
+  TF_ASSERT_OK(harness.LoadRequested());
+  TF_ASSERT_OK(harness.LoadApproved());
+  bool retry;
+  int64 retry_delay_micros;
+  EXPECT_FALSE(harness.LoadAttempt(&retry, &retry_delay_micros).ok());
+  EXPECT_TRUE(retry);
+  harness.set_cancel_load_retry(true);
+  const Status status = harness.LoadAttempt(&retry, &retry_delay_micros);
+  EXPECT_THAT(status.error_message(), HasSubstr("test load error"));
+  EXPECT_FALSE(retry);
+  EXPECT_EQ(LoaderHarness::State::kError, harness.state());
+}
+
 }  // namespace
 }  // namespace serving
 }  // namespace tensorflow
@@ -15,14 +15,17 @@ limitations under the License.
 
 #include "tensorflow_serving/core/request_logger.h"
 
-#include <random>
+#include <utility>
 #include <vector>
 
 #include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/hash/hash.h"
 #include "tensorflow/core/lib/monitoring/counter.h"
 #include "tensorflow/core/lib/random/random.h"
+#include "tensorflow/core/platform/logging.h"
 #include "tensorflow/core/protobuf/error_codes.pb.h"
 #include "tensorflow_serving/apis/model.pb.h"
+#include "tensorflow_serving/core/compact_request_log.h"
 
 namespace tensorflow {
 namespace serving {
@@ -33,6 +36,37 @@ auto* request_log_count = monitoring::Counter<2>::New(
     "The total number of requests logged from the model server sliced "
     "down by model_name and status code.",
     "model_name", "status_code");
+
+// Returns a double uniformly distributed in [0, 1) from the 53 high bits of
+// 'bits'.
+double ToUnitInterval(const uint64 bits) {
+  return (bits >> 11) * (1.0 / (uint64{1} << 53));
+}
+
+// Returns the next value of the xorshift64* generator of the calling thread.
+uint64 NextThreadRandom() {
+  thread_local uint64 state = [] {
+    uint64 seed = random::New64();
+    return seed == 0 ? 1 : seed;
+  }();
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return state * 0x2545F4914F6CDD1DULL;
+}
+
+void RecordRequestLog(const string& model_name, const Status& status) {
+  request_log_count->GetCell(model_name, error::Code_Name(status.code()))
+      ->IncrementBy(1);
+}
+
+}  // namespace
+
+bool RequestLogger::UniformSampler::Sample(const double rate,
+                                           const string& request_id) const {
+  const uint64 bits =
+      request_id.empty() ? NextThreadRandom() : Hash64(request_id);
+  return ToUnitInterval(bits) < rate;
 }
 
 RequestLogger::RequestLogger(const LoggingConfig& logging_config,
@@ -41,13 +75,32 @@ RequestLogger::RequestLogger(const LoggingConfig& logging_config,
     : logging_config_(logging_config),
       saved_model_tags_(saved_model_tags),
       log_collector_(std::move(log_collector)),
-      uniform_sampler_() {}
+      uniform_sampler_() {
+  if (logging_config_.async_collection_queue_size() > 0) {
+    collection_thread_.reset(Env::Default()->StartThread(
+        ThreadOptions(), "request_log_collection",
+        [this]() { CollectPendingLogs(); }));
+  }
+}
+
+RequestLogger::~RequestLogger() {
+  {
+    mutex_lock l(mu_);
+    stopping_ = true;
+  }
+  pending_logs_cv_.notify_one();
+  // Joins the thread, once the pending logs are collected.
+  collection_thread_.reset();
+}
 
 Status RequestLogger::Log(const google::protobuf::Message& request,
                           const google::protobuf::Message& response,
                           const LogMetadata& log_metadata) {
   const double sampling_rate =
       logging_config_.sampling_config().sampling_rate();
+  if (!uniform_sampler_.Sample(sampling_rate, log_metadata.request_id())) {
+    return Status::OK();
+  }
   LogMetadata log_metadata_with_config = log_metadata;
   *log_metadata_with_config.mutable_sampling_config() =
       logging_config_.sampling_config();
@@ -55,20 +108,75 @@ Status RequestLogger::Log(const google::protobuf::Message& request,
     *log_metadata_with_config.mutable_saved_model_tags() = {
         saved_model_tags_.begin(), saved_model_tags_.end()};
   }
-  if (uniform_sampler_.Sample(sampling_rate)) {
-    const auto status = [&]() {
-      std::unique_ptr<google::protobuf::Message> log;
-      TF_RETURN_IF_ERROR(
-          CreateLogMessage(request, response, log_metadata_with_config, &log));
-      return log_collector_->CollectMessage(*log);
-    }();
-    request_log_count
-        ->GetCell(log_metadata.model_spec().name(),
-                  error::Code_Name(status.code()))
-        ->IncrementBy(1);
-    return status;
+  std::unique_ptr<google::protobuf::Message> log;
+  Status status =
+      logging_config_.has_compact_logging_config()
+          ? CreateCompactLog(logging_config_.compact_logging_config(), request,
+                             response, log_metadata_with_config, &log)
+          : CreateLogMessage(request, response, log_metadata_with_config,
+                             &log);
+  if (status.ok() && collection_thread_ != nullptr) {
+    bool queued = false;
+    {
+      mutex_lock l(mu_);
+      if (pending_logs_.size() <
+          logging_config_.async_collection_queue_size()) {
+        pending_logs_.push_back(
+            {std::move(log), log_metadata.model_spec().name()});
+        queued = true;
+      }
+    }
+    if (queued) {
+      pending_logs_cv_.notify_one();
+    } else {
+      // The queue is full, the log is dropped without failing the request.
+      RecordRequestLog(log_metadata.model_spec().name(),
+                       errors::ResourceExhausted("Request log queue is full"));
+    }
+    return Status::OK();
+  }
+  if (status.ok()) {
+    status = log_collector_->CollectMessage(*log);
+  }
+  RecordRequestLog(log_metadata.model_spec().name(), status);
+  return status;
+}
+
+Status RequestLogger::Flush() {
+  if (collection_thread_ != nullptr) {
+    mutex_lock l(mu_);
+    while (!pending_logs_.empty() || collecting_) {
+      collected_cv_.wait(l);
+    }
+  }
+  return log_collector_->Flush();
+}
+
+void RequestLogger::CollectPendingLogs() {
+  while (true) {
+    PendingLog pending_log;
+    {
+      mutex_lock l(mu_);
+      collecting_ = false;
+      if (pending_logs_.empty()) {
+        collected_cv_.notify_all();
+      }
+      while (pending_logs_.empty() && !stopping_) {
+        pending_logs_cv_.wait(l);
+      }
+      if (pending_logs_.empty()) {
+        return;
+      }
+      pending_log = std::move(pending_logs_.front());
+      pending_logs_.pop_front();
+      collecting_ = true;
+    }
+    const Status status = log_collector_->CollectMessage(*pending_log.log);
+    if (!status.ok()) {
+      VLOG(1) << "Cannot collect the request log: " << status;
+    }
+    RecordRequestLog(pending_log.model_name, status);
   }
-  return Status::OK();
 }
 
 }  // namespace serving
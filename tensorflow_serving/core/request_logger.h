@@ -16,11 +16,15 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_CORE_REQUEST_LOGGER_H_
 #define TENSORFLOW_SERVING_CORE_REQUEST_LOGGER_H_
 
-#include <random>
+#include <deque>
+#include <memory>
 #include <vector>
 
 #include "google/protobuf/message.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
 #include "tensorflow_serving/apis/logging.pb.h"
 #include "tensorflow_serving/config/logging_config.pb.h"
 #include "tensorflow_serving/core/log_collector.h"
@@ -30,19 +34,31 @@ namespace serving {
 
 // Abstraction to log requests and responses hitting a server. The log storage
 // is handled by the log-collector. We sample requests based on the config.
+//
+// With a compact_logging_config, the logs are CompactLogs created by the
+// logger itself instead of CreateLogMessage().
+//
+// With a non-zero async_collection_queue_size in the config, the logs are
+// collected by a background thread, and the logs still queued are collected
+// on destruction.
 class RequestLogger {
  public:
   RequestLogger(const LoggingConfig& logging_config,
                 const std::vector<string>& saved_model_tags,
                 std::unique_ptr<LogCollector> log_collector);
 
-  virtual ~RequestLogger() = default;
+  virtual ~RequestLogger();
 
   // Writes the log for the particular request, respone and metadata, if we
-  // decide to sample it.
+  // decide to sample it. When collecting in the background, only errors
+  // creating the log are returned, and the log is dropped if the queue is
+  // full.
   Status Log(const google::protobuf::Message& request, const google::protobuf::Message& response,
              const LogMetadata& log_metadata);
 
+  // Collects the logs queued so far, and flushes the log-collector.
+  Status Flush();
+
   const LoggingConfig& logging_config() const { return logging_config_; }
 
  private:
@@ -54,25 +70,41 @@ class RequestLogger {
                                   const LogMetadata& log_metadata,
                                   std::unique_ptr<google::protobuf::Message>* log) = 0;
 
-  // A sampler which samples uniformly at random.
+  // A sampler which samples uniformly at random. It is lock-free, each thread
+  // drawing from its own random state.
   class UniformSampler {
    public:
-    UniformSampler() : rd_(), gen_(rd_()), dist_(0, 1) {}
-
     // Returns true if the sampler decides to sample it with a probability
-    // 'rate'.
-    bool Sample(const double rate) { return dist_(gen_) < rate; }
+    // 'rate'. If 'request_id' is not empty, the decision only depends on it and
+    // 'rate', so that the logs of a request are sampled by all the servers
+    // handling it, or by none.
+    bool Sample(double rate, const string& request_id) const;
+  };
 
-   private:
-    std::random_device rd_;
-    std::mt19937 gen_;
-    std::uniform_real_distribution<double> dist_;
+  // A log waiting to be collected in the background.
+  struct PendingLog {
+    std::unique_ptr<google::protobuf::Message> log;
+    string model_name;
   };
 
+  // Collects the queued logs until the logger is destroyed.
+  void CollectPendingLogs();
+
   const LoggingConfig logging_config_;
   const std::vector<string> saved_model_tags_;
   std::unique_ptr<LogCollector> log_collector_;
   UniformSampler uniform_sampler_;
+
+  mutex mu_;
+  condition_variable pending_logs_cv_;
+  // Notified when the queued logs are all collected.
+  condition_variable collected_cv_;
+  std::deque<PendingLog> pending_logs_ TF_GUARDED_BY(mu_);
+  // Whether a log popped from 'pending_logs_' is being collected.
+  bool collecting_ TF_GUARDED_BY(mu_) = false;
+  bool stopping_ TF_GUARDED_BY(mu_) = false;
+  // Collects the pending logs, null unless collecting in the background.
+  std::unique_ptr<Thread> collection_thread_;
 };
 
 }  // namespace serving
@@ -15,6 +15,7 @@ limitations under the License.
 
 #include "tensorflow_serving/core/request_logger.h"
 
+#include <atomic>
 #include <memory>
 
 #include "google/protobuf/any.pb.h"
@@ -25,11 +26,15 @@ limitations under the License.
 #include "tensorflow/cc/saved_model/tag_constants.h"
 #include "tensorflow/core/framework/tensor.pb.h"
 #include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/notification.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow_serving/apis/logging.pb.h"
 #include "tensorflow_serving/apis/model.pb.h"
 #include "tensorflow_serving/apis/predict.pb.h"
+#include "tensorflow_serving/apis/prediction_log.pb.h"
 #include "tensorflow_serving/config/logging_config.pb.h"
 #include "tensorflow_serving/core/log_collector.h"
 #include "tensorflow_serving/core/test_util/mock_log_collector.h"
@@ -128,6 +133,151 @@ TEST_F(RequestLoggerTest, ErroringCollectMessage) {
   EXPECT_THAT(error_status.error_message(), HasSubstr("Error"));
 }
 
+TEST(RequestLoggerCompactTest, LogsCompactLogs) {
+  LoggingConfig logging_config;
+  logging_config.mutable_sampling_config()->set_sampling_rate(1.0);
+  logging_config.mutable_compact_logging_config()->add_predict_outputs("y");
+  auto* log_collector = new NiceMock<MockLogCollector>();
+  auto request_logger = std::unique_ptr<NiceMock<MockRequestLogger>>(
+      new NiceMock<MockRequestLogger>(logging_config, std::vector<string>(),
+                                      log_collector));
+
+  PredictResponse response;
+  (*response.mutable_outputs())["y"].set_dtype(DT_FLOAT);
+  (*response.mutable_outputs())["y"].add_float_val(0.5);
+  LogMetadata log_metadata;
+  log_metadata.mutable_model_spec()->set_name("model");
+
+  // The logger creates the log itself.
+  EXPECT_CALL(*request_logger, CreateLogMessage(_, _, _, _)).Times(0);
+  EXPECT_CALL(*log_collector, CollectMessage(_))
+      .WillOnce(Invoke([](const google::protobuf::Message& message) {
+        const auto& log = static_cast<const PredictionLog&>(message);
+        EXPECT_EQ("model", log.log_metadata().model_spec().name());
+        EXPECT_EQ(1.0, log.log_metadata().sampling_config().sampling_rate());
+        EXPECT_THAT(log.compact_log().outputs(),
+                    ::testing::ElementsAre(
+                        test_util::EqualsProto("float_values: 0.5")));
+        return Status::OK();
+      }));
+  TF_ASSERT_OK(request_logger->Log(PredictRequest(), response, log_metadata));
+}
+
+TEST(RequestLoggerSamplingTest, SamplesByRequestId) {
+  LoggingConfig logging_config;
+  logging_config.mutable_sampling_config()->set_sampling_rate(0.5);
+  auto* log_collector = new NiceMock<MockLogCollector>();
+  auto request_logger = std::unique_ptr<NiceMock<MockRequestLogger>>(
+      new NiceMock<MockRequestLogger>(logging_config, std::vector<string>(),
+                                      log_collector));
+  int num_logs = 0;
+  ON_CALL(*request_logger, CreateLogMessage(_, _, _, _))
+      .WillByDefault(Invoke([&](const google::protobuf::Message& actual_request,
+                                const google::protobuf::Message& actual_response,
+                                const LogMetadata& actual_log_metadata,
+                                std::unique_ptr<google::protobuf::Message>* log) {
+        ++num_logs;
+        *log =
+            std::unique_ptr<google::protobuf::Any>(new google::protobuf::Any());
+        return Status::OK();
+      }));
+
+  // Each request is either always or never logged.
+  int num_logged_requests = 0;
+  for (int i = 0; i < 100; ++i) {
+    LogMetadata log_metadata;
+    log_metadata.set_request_id(strings::StrCat("request-", i));
+    num_logs = 0;
+    for (int j = 0; j < 10; ++j) {
+      TF_ASSERT_OK(request_logger->Log(PredictRequest(), PredictResponse(),
+                                       log_metadata));
+    }
+    EXPECT_TRUE(num_logs == 0 || num_logs == 10);
+    if (num_logs == 10) {
+      ++num_logged_requests;
+    }
+  }
+  EXPECT_GT(num_logged_requests, 20);
+  EXPECT_LT(num_logged_requests, 80);
+}
+
+TEST(RequestLoggerAsyncTest, CollectsInTheBackground) {
+  LoggingConfig logging_config;
+  logging_config.mutable_sampling_config()->set_sampling_rate(1.0);
+  logging_config.set_async_collection_queue_size(1);
+  auto* log_collector = new NiceMock<MockLogCollector>();
+  auto request_logger = std::unique_ptr<NiceMock<MockRequestLogger>>(
+      new NiceMock<MockRequestLogger>(logging_config, std::vector<string>(),
+                                      log_collector));
+  EXPECT_CALL(*request_logger, CreateLogMessage(_, _, _, _))
+      .WillRepeatedly(Invoke([&](const google::protobuf::Message& actual_request,
+                                 const google::protobuf::Message& actual_response,
+                                 const LogMetadata& actual_log_metadata,
+                                 std::unique_ptr<google::protobuf::Message>* log) {
+        *log =
+            std::unique_ptr<google::protobuf::Any>(new google::protobuf::Any());
+        return Status::OK();
+      }));
+
+  // The first log blocks the collection, the second one waits in the queue,
+  // and the third one is dropped.
+  Notification collecting, unblock;
+  EXPECT_CALL(*log_collector, CollectMessage(_))
+      .WillOnce(Invoke([&](const google::protobuf::Message& message) {
+        collecting.Notify();
+        unblock.WaitForNotification();
+        return errors::Internal("Error");
+      }))
+      .WillOnce(Return(Status::OK()));
+  TF_ASSERT_OK(
+      request_logger->Log(PredictRequest(), PredictResponse(), LogMetadata()));
+  collecting.WaitForNotification();
+  TF_ASSERT_OK(
+      request_logger->Log(PredictRequest(), PredictResponse(), LogMetadata()));
+  TF_ASSERT_OK(
+      request_logger->Log(PredictRequest(), PredictResponse(), LogMetadata()));
+  unblock.Notify();
+  // The queued log is collected on destruction at the latest.
+  request_logger.reset();
+}
+
+TEST(RequestLoggerAsyncTest, FlushCollectsTheQueuedLogs) {
+  LoggingConfig logging_config;
+  logging_config.mutable_sampling_config()->set_sampling_rate(1.0);
+  logging_config.set_async_collection_queue_size(10);
+  auto* log_collector = new NiceMock<MockLogCollector>();
+  auto request_logger = std::unique_ptr<NiceMock<MockRequestLogger>>(
+      new NiceMock<MockRequestLogger>(logging_config, std::vector<string>(),
+                                      log_collector));
+  EXPECT_CALL(*request_logger, CreateLogMessage(_, _, _, _))
+      .WillRepeatedly(Invoke([&](const google::protobuf::Message& actual_request,
+                                 const google::protobuf::Message& actual_response,
+                                 const LogMetadata& actual_log_metadata,
+                                 std::unique_ptr<google::protobuf::Message>* log) {
+        *log =
+            std::unique_ptr<google::protobuf::Any>(new google::protobuf::Any());
+        return Status::OK();
+      }));
+
+  std::atomic<int> num_collected{0};
+  EXPECT_CALL(*log_collector, CollectMessage(_))
+      .Times(3)
+      .WillRepeatedly(Invoke([&](const google::protobuf::Message& message) {
+        Env::Default()->SleepForMicroseconds(10 * 1000);
+        ++num_collected;
+        return Status::OK();
+      }));
+  EXPECT_CALL(*log_collector, Flush()).WillOnce(Invoke([&]() {
+    EXPECT_EQ(num_collected, 3);
+    return Status::OK();
+  }));
+  for (int i = 0; i < 3; ++i) {
+    TF_ASSERT_OK(request_logger->Log(PredictRequest(), PredictResponse(),
+                                     LogMetadata()));
+  }
+  TF_ASSERT_OK(request_logger->Flush());
+}
+
 }  // namespace
 }  // namespace serving
 }  // namespace tensorflow
@@ -15,6 +15,7 @@ limitations under the License.
 
 #include "tensorflow_serving/core/servable_state_monitor.h"
 
+#include "absl/memory/memory.h"
 #include "tensorflow/core/lib/core/notification.h"
 #include "tensorflow/core/lib/gtl/cleanup.h"
 #include "tensorflow_serving/core/servable_state.h"
@@ -105,7 +106,8 @@ string ServableStateMonitor::ServableStateAndTime::DebugString() const {
 
 ServableStateMonitor::ServableStateMonitor(EventBus<ServableState>* bus,
                                            const Options& options)
-    : options_(options) {
+    : options_(options),
+      states_snapshot_(absl::make_unique<StatesSnapshot>()) {
   // Important: We must allow the state members ('states_', 'live_states_' and
   // so on) to be initialized *before* we start the bus subscription, in case an
   // event comes in while we are initializing.
@@ -138,8 +140,17 @@ ServableStateMonitor::GetStateAndTimeInternal(
 
 absl::optional<ServableStateMonitor::ServableStateAndTime>
 ServableStateMonitor::GetStateAndTime(const ServableId& servable_id) const {
-  mutex_lock l(mu_);
-  return GetStateAndTimeInternal(servable_id);
+  const auto snapshot = states_snapshot_.get();
+  auto it = snapshot->states.find(servable_id.name);
+  if (it == snapshot->states.end()) {
+    return absl::nullopt;
+  }
+  const VersionMap& versions = it->second;
+  auto it2 = versions.find(servable_id.version);
+  if (it2 == versions.end()) {
+    return absl::nullopt;
+  }
+  return it2->second;
 }
 
 absl::optional<ServableState> ServableStateMonitor::GetState(
@@ -154,9 +165,9 @@ absl::optional<ServableState> ServableStateMonitor::GetState(
 
 ServableStateMonitor::VersionMap ServableStateMonitor::GetVersionStates(
     const string& servable_name) const {
-  mutex_lock l(mu_);
-  auto it = states_.find(servable_name);
-  if (it == states_.end()) {
+  const auto snapshot = states_snapshot_.get();
+  auto it = snapshot->states.find(servable_name);
+  if (it == snapshot->states.end()) {
     return {};
   }
   return it->second;
@@ -164,14 +175,12 @@ ServableStateMonitor::VersionMap ServableStateMonitor::GetVersionStates(
 
 ServableStateMonitor::ServableMap ServableStateMonitor::GetAllServableStates()
     const {
-  mutex_lock l(mu_);
-  return states_;
+  return states_snapshot_.get()->states;
 }
 
 ServableStateMonitor::ServableMap ServableStateMonitor::GetLiveServableStates()
     const {
-  mutex_lock l(mu_);
-  return live_states_;
+  return states_snapshot_.get()->live_states;
 }
 
 void ServableStateMonitor::ForgetUnloadedServableStates() {
@@ -190,13 +199,14 @@ void ServableStateMonitor::ForgetUnloadedServableStates() {
       version_map.erase(version);
     }
   }
+  UpdateStatesSnapshot();
 }
 
 ServableStateMonitor::ServableSet
 ServableStateMonitor::GetAvailableServableStates() const {
   ServableSet available_servable_set;
-  mutex_lock l(mu_);
-  for (const auto& live_state : live_states_) {
+  const auto snapshot = states_snapshot_.get();
+  for (const auto& live_state : snapshot->live_states) {
     const string& servable_name = live_state.first;
     const auto& version_map = live_state.second;
     for (const auto& version : version_map) {
@@ -211,8 +221,30 @@ ServableStateMonitor::GetAvailableServableStates() const {
 }
 
 ServableStateMonitor::BoundedLog ServableStateMonitor::GetBoundedLog() const {
-  mutex_lock l(mu_);
-  return log_;
+  mutex_lock l(log_mu_);
+  BoundedLog log;
+  for (size_t i = 0; i < log_.size(); ++i) {
+    log.push_back(log_[(log_begin_ + i) % log_.size()]);
+  }
+  return log;
+}
+
+void ServableStateMonitor::AppendToLog(
+    const ServableStateAndTime& state_and_time) {
+  mutex_lock l(log_mu_);
+  if (log_.size() < options_.max_count_log_events) {
+    log_.push_back(state_and_time);
+    return;
+  }
+  log_[log_begin_] = state_and_time;
+  log_begin_ = (log_begin_ + 1) % log_.size();
+}
+
+void ServableStateMonitor::UpdateStatesSnapshot() {
+  auto snapshot = absl::make_unique<StatesSnapshot>();
+  snapshot->states = states_;
+  snapshot->live_states = live_states_;
+  states_snapshot_.Update(std::move(snapshot));
 }
 
 void ServableStateMonitor::NotifyWhenServablesReachState(
@@ -267,15 +299,15 @@ void ServableStateMonitor::HandleEvent(
   states_[state_and_time.state.id.name][state_and_time.state.id.version] =
       state_and_time;
   UpdateLiveStates(state_and_time, &live_states_);
+  // Note: The snapshot is updated before the notifications, so that the
+  // notified callers observe the new state.
+  UpdateStatesSnapshot();
   MaybeSendStateReachedNotifications();
 
   if (options_.max_count_log_events == 0) {
     return;
   }
-  while (log_.size() >= options_.max_count_log_events) {
-    log_.pop_front();
-  }
-  log_.emplace_back(state_and_time.state, state_and_time.event_time_micros);
+  AppendToLog(state_and_time);
 }
 
 absl::optional<
@@ -19,6 +19,7 @@ limitations under the License.
 #include <deque>
 #include <functional>
 #include <map>
+#include <vector>
 
 #include "absl/types/optional.h"
 #include "tensorflow/core/platform/env.h"
@@ -29,6 +30,7 @@ limitations under the License.
 #include "tensorflow_serving/core/servable_id.h"
 #include "tensorflow_serving/core/servable_state.h"
 #include "tensorflow_serving/util/event_bus.h"
+#include "tensorflow_serving/util/fast_read_dynamic_ptr.h"
 
 namespace tensorflow {
 namespace serving {
@@ -40,6 +42,11 @@ namespace serving {
 /// Offers an interface for querying the servable states. It may be useful as
 /// the basis for dashboards, as well as for testing a manager.
 ///
+/// The queries of the states read a snapshot of the states, updated on each
+/// event, and the bounded log has its own lock: frequent queries, e.g. of
+/// health checkers, neither contend with each other nor delay the handling of
+/// the events.
+///
 /// IMPORTANT: You must create this monitor before arranging for events to be
 /// published on the event bus, e.g. giving the event bus to a Manager.
 class ServableStateMonitor {
@@ -171,6 +178,19 @@ class ServableStateMonitor {
   GetStateAndTimeInternal(const ServableId& servable_id) const
       TF_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
+  // Copy of 'states_' and 'live_states_' read by the state queries.
+  struct StatesSnapshot {
+    ServableMap states;
+    ServableMap live_states;
+  };
+
+  // Publishes the current 'states_' and 'live_states_' to the state queries.
+  void UpdateStatesSnapshot() TF_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Appends an event to the bounded log.
+  void AppendToLog(const ServableStateAndTime& state_and_time)
+      TF_LOCKS_EXCLUDED(log_mu_);
+
   // Request to send notification, setup using
   // NotifyWhenServablesReachState(...).
   struct ServableStateNotificationRequest {
@@ -222,10 +242,19 @@ class ServableStateMonitor {
   // state ServableState::ManagerState::kEnd.
   ServableMap live_states_ TF_GUARDED_BY(mu_);
 
-  // Deque of pairs of timestamp and ServableState, corresponding to the most
-  // recent servable state events handled by the monitor. The size of this deque
-  // is upper bounded by max_count_log_events in Options.
-  BoundedLog log_ TF_GUARDED_BY(mu_);
+  // The last published copy of 'states_' and 'live_states_'. Only updated
+  // with 'mu_' held.
+  FastReadDynamicPtr<StatesSnapshot> states_snapshot_;
+
+  // Separate mutex to protect the bounded log, so that reading the log does
+  // not wait for the handling of an event.
+  mutable mutex log_mu_;
+
+  // Ring buffer of the most recent servable state events handled by the
+  // monitor, of at most max_count_log_events in Options events. Once full,
+  // 'log_begin_' is the index of the oldest event, overwritten by the next one.
+  std::vector<ServableStateAndTime> log_ TF_GUARDED_BY(log_mu_);
+  size_t log_begin_ TF_GUARDED_BY(log_mu_) = 0;
 
   std::vector<ServableStateNotificationRequest>
       servable_state_notification_requests_ TF_GUARDED_BY(mu_);
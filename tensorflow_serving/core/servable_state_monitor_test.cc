@@ -15,6 +15,10 @@ limitations under the License.
 
 #include "tensorflow_serving/core/servable_state_monitor.h"
 
+#include <atomic>
+#include <memory>
+#include <vector>
+
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include "tensorflow/core/kernels/batching_util/fake_clock_env.h"
@@ -213,6 +217,64 @@ TEST(ServableStateMonitorTest, DisableBoundedLogging) {
   EXPECT_TRUE(monitor.GetBoundedLog().empty());
 }
 
+TEST(ServableStateMonitorTest, BoundedLogWrapsAround) {
+  test_util::FakeClockEnv env(Env::Default());
+  EventBus<ServableState>::Options bus_options;
+  bus_options.env = &env;
+  auto bus = EventBus<ServableState>::CreateEventBus(bus_options);
+
+  ServableStateMonitor::Options monitor_options;
+  monitor_options.max_count_log_events = 3;
+  ServableStateMonitor monitor(bus.get(), monitor_options);
+
+  std::vector<ServableStateAndTime> states_and_times;
+  for (int version = 0; version < 8; ++version) {
+    const ServableState state = {ServableId{"foo", version},
+                                 ServableState::ManagerState::kStart,
+                                 Status::OK()};
+    env.AdvanceByMicroseconds(1);
+    states_and_times.push_back({state, env.NowMicros()});
+    bus->Publish(state);
+  }
+  EXPECT_THAT(monitor.GetBoundedLog(),
+              ElementsAre(states_and_times[5], states_and_times[6],
+                          states_and_times[7]));
+}
+
+TEST(ServableStateMonitorTest, ConcurrentQueriesAndEvents) {
+  auto bus = EventBus<ServableState>::CreateEventBus();
+  ServableStateMonitor::Options monitor_options;
+  monitor_options.max_count_log_events = 16;
+  ServableStateMonitor monitor(bus.get(), monitor_options);
+
+  constexpr int kNumVersions = 200;
+  std::atomic<bool> done{false};
+  std::vector<std::unique_ptr<Thread>> readers;
+  for (int i = 0; i < 4; ++i) {
+    readers.emplace_back(Env::Default()->StartThread({}, "reader", [&]() {
+      while (!done) {
+        const ServableStateMonitor::VersionMap versions =
+            monitor.GetVersionStates("foo");
+        for (const auto& version_and_state : versions) {
+          ASSERT_EQ(version_and_state.first,
+                    version_and_state.second.state.id.version);
+        }
+        EXPECT_LE(monitor.GetBoundedLog().size(), 16);
+        monitor.GetLiveServableStates();
+      }
+    }));
+  }
+  for (int version = 0; version < kNumVersions; ++version) {
+    bus->Publish({ServableId{"foo", version},
+                  ServableState::ManagerState::kAvailable, Status::OK()});
+  }
+  done = true;
+  readers.clear();
+
+  EXPECT_EQ(kNumVersions, monitor.GetVersionStates("foo").size());
+  EXPECT_EQ(16, monitor.GetBoundedLog().size());
+}
+
 TEST(ServableStateMonitorTest, GetLiveServableStates) {
   test_util::FakeClockEnv env(Env::Default());
   EventBus<ServableState>::Options bus_options;
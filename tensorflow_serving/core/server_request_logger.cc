@@ -130,5 +130,14 @@ Status ServerRequestLogger::Log(const google::protobuf::Message& request,
   return status;
 }
 
+Status ServerRequestLogger::Flush() {
+  mutex_lock l(update_mu_);
+  Status status;
+  for (const auto& config_and_logger : config_to_logger_map_) {
+    status.Update(config_and_logger.second->Flush());
+  }
+  return status;
+}
+
 }  // namespace serving
 }  // namespace tensorflow
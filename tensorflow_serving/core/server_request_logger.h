@@ -68,6 +68,10 @@ class ServerRequestLogger {
                      const google::protobuf::Message& response,
                      const LogMetadata& log_metadata);
 
+  // Flushes all the loggers (see RequestLogger::Flush()), e.g. before the
+  // server exits. Returns the first error.
+  virtual Status Flush();
+
  protected:
   explicit ServerRequestLogger(LoggerCreator request_logger_creator);
 
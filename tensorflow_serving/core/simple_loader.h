@@ -166,8 +166,9 @@ class SimpleLoader : public Loader {
 // version items one at a time, giving a simpler interface but less flexibility.
 //
 //  - Like SimpleLoader, the servable's estimated resource footprint is static,
-//    and the emitted loaders' Unload() implementation calls ServableType's
-//    destructor and releases the memory to the OS.
+//    except for an optional post-load estimate computed once the servable is
+//    loaded, and the emitted loaders' Unload() implementation calls
+//    ServableType's destructor and releases the memory to the OS.
 //
 // For more complex behaviors, SimpleLoaderSourceAdapter is inapplicable. You
 // must instead create a SourceAdapter and Loader. That said, you may still be
@@ -193,6 +194,14 @@ class SimpleLoaderSourceAdapter
   using ResourceEstimator =
       std::function<Status(const DataType&, ResourceAllocation*)>;
 
+  // A callback for estimating a servable's resource usage once it is loaded,
+  // e.g. from its measured footprint. It takes the DataType object and the
+  // loaded servable as input. The estimate replaces the ResourceEstimator one.
+  // It may exceed it only to correct an under-estimate with a measurement (see
+  // Loader::EstimateResources()).
+  using PostLoadResourceEstimator = std::function<Status(
+      const DataType&, const ServableType&, ResourceAllocation*)>;
+
   // Returns a dummy resource-estimation callback that estimates the servable's
   // resource footprint at zero. Useful in best-effort or test environments that
   // do not track resource usage.
@@ -207,11 +216,17 @@ class SimpleLoaderSourceAdapter
   SimpleLoaderSourceAdapter(Creator creator,
                             ResourceEstimator resource_estimator);
 
+  // Same as above, with an estimate of the resources of the loaded servables.
+  SimpleLoaderSourceAdapter(
+      Creator creator, ResourceEstimator resource_estimator,
+      PostLoadResourceEstimator post_load_resource_estimator);
+
   Status Convert(const DataType& data, std::unique_ptr<Loader>* loader) final;
 
  private:
   Creator creator_;
   ResourceEstimator resource_estimator_;
+  PostLoadResourceEstimator post_load_resource_estimator_;
 
   TF_DISALLOW_COPY_AND_ASSIGN(SimpleLoaderSourceAdapter);
 };
@@ -386,6 +401,14 @@ SimpleLoaderSourceAdapter<DataType, ServableType>::SimpleLoaderSourceAdapter(
     Creator creator, ResourceEstimator resource_estimator)
     : creator_(creator), resource_estimator_(resource_estimator) {}
 
+template <typename DataType, typename ServableType>
+SimpleLoaderSourceAdapter<DataType, ServableType>::SimpleLoaderSourceAdapter(
+    Creator creator, ResourceEstimator resource_estimator,
+    PostLoadResourceEstimator post_load_resource_estimator)
+    : creator_(creator),
+      resource_estimator_(resource_estimator),
+      post_load_resource_estimator_(post_load_resource_estimator) {}
+
 template <typename DataType, typename ServableType>
 Status SimpleLoaderSourceAdapter<DataType, ServableType>::Convert(
     const DataType& data, std::unique_ptr<Loader>* loader) {
@@ -394,6 +417,33 @@ Status SimpleLoaderSourceAdapter<DataType, ServableType>::Convert(
   // the adapter is deleted before the loader.
   const auto creator = creator_;
   const auto resource_estimator = resource_estimator_;
+  if (post_load_resource_estimator_) {
+    const auto post_load_resource_estimator = post_load_resource_estimator_;
+    // The servable of the loader, for the post-load estimate. SimpleLoader
+    // computes that estimate in Load(), right after creating the servable.
+    auto loaded_servable = std::make_shared<const ServableType*>(nullptr);
+    loader->reset(new SimpleLoader<ServableType>(
+        [creator, data,
+         loaded_servable](std::unique_ptr<ServableType>* servable) {
+          *loaded_servable = nullptr;
+          TF_RETURN_IF_ERROR(creator(data, servable));
+          *loaded_servable = servable->get();
+          return Status::OK();
+        },
+        [resource_estimator, data](ResourceAllocation* estimate) {
+          return resource_estimator(data, estimate);
+        },
+        [post_load_resource_estimator, data,
+         loaded_servable](ResourceAllocation* estimate) {
+          if (*loaded_servable == nullptr) {
+            return errors::FailedPrecondition(
+                "Post-load resource estimate of a servable not loaded");
+          }
+          return post_load_resource_estimator(data, **loaded_servable,
+                                              estimate);
+        }));
+    return Status::OK();
+  }
   loader->reset(new SimpleLoader<ServableType>(
       [creator, data](std::unique_ptr<ServableType>* servable) {
         return creator(data, servable);
@@ -255,6 +255,15 @@ class SimpleLoaderSourceAdapterImpl final
           DataType, ServableType>::ResourceEstimator resource_estimator)
       : SimpleLoaderSourceAdapter<DataType, ServableType>(creator,
                                                           resource_estimator) {}
+  SimpleLoaderSourceAdapterImpl(
+      typename SimpleLoaderSourceAdapter<DataType, ServableType>::Creator
+          creator,
+      typename SimpleLoaderSourceAdapter<
+          DataType, ServableType>::ResourceEstimator resource_estimator,
+      typename SimpleLoaderSourceAdapter<DataType, ServableType>::
+          PostLoadResourceEstimator post_load_resource_estimator)
+      : SimpleLoaderSourceAdapter<DataType, ServableType>(
+            creator, resource_estimator, post_load_resource_estimator) {}
   ~SimpleLoaderSourceAdapterImpl() override { TargetBase<DataType>::Detach(); }
 };
 
@@ -301,6 +310,49 @@ TEST(SimpleLoaderSourceAdapterTest, Basic) {
   EXPECT_TRUE(callback_called);
 }
 
+TEST(SimpleLoaderSourceAdapterTest, PostLoadResourceEstimate) {
+  SimpleLoaderSourceAdapterImpl<string, string> adapter(
+      [](const string& data, std::unique_ptr<string>* servable) {
+        servable->reset(new string(data));
+        return Status::OK();
+      },
+      [](const string& data, ResourceAllocation* output) {
+        output->Clear();
+        output->add_resource_quantities()->set_quantity(42);
+        return Status::OK();
+      },
+      [](const string& data, const string& servable,
+         ResourceAllocation* output) {
+        // The estimate is computed from the loaded servable.
+        output->Clear();
+        output->add_resource_quantities()->set_quantity(servable.size());
+        return Status::OK();
+      });
+
+  std::unique_ptr<Loader> loader;
+  adapter.SetAspiredVersionsCallback(
+      [&](const StringPiece servable_name,
+          std::vector<ServableData<std::unique_ptr<Loader>>> versions) {
+        ASSERT_EQ(1, versions.size());
+        TF_ASSERT_OK(versions[0].status());
+        loader = versions[0].ConsumeDataOrDie();
+      });
+  adapter.SetAspiredVersions(
+      "test_servable_name",
+      {ServableData<string>({"test_servable_name", 0}, "test_data")});
+  ASSERT_NE(loader, nullptr);
+
+  ResourceAllocation estimate;
+  TF_ASSERT_OK(loader->EstimateResources(&estimate));
+  EXPECT_THAT(estimate, EqualsProto(CreateProto<ResourceAllocation>(
+                            "resource_quantities { quantity: 42 }")));
+  TF_ASSERT_OK(loader->Load());
+  TF_ASSERT_OK(loader->EstimateResources(&estimate));
+  EXPECT_THAT(estimate, EqualsProto(CreateProto<ResourceAllocation>(
+                            "resource_quantities { quantity: 9 }")));
+  loader->Unload();
+}
+
 // This test verifies that deleting a SimpleLoaderSourceAdapter doesn't affect
 // the loaders it has emitted. This is a regression test for b/30189916.
 TEST(SimpleLoaderSourceAdapterTest, OkayToDeleteAdapter) {
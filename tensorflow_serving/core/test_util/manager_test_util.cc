@@ -44,6 +44,11 @@ uint32 AspiredVersionsManagerTestAccess::num_load_threads() const {
   return manager_->num_load_threads();
 }
 
+void AspiredVersionsManagerTestAccess::SetVersionsExemptFromStandby(
+    const std::map<string, std::set<int64>>& versions) {
+  manager_->SetVersionsExemptFromStandby(versions);
+}
+
 BasicManagerTestAccess::BasicManagerTestAccess(BasicManager* manager)
     : manager_(manager) {}
 
@@ -62,6 +67,14 @@ int64 CachingManagerTestAccess::GetLoadMutexMapSize() const {
   return manager_->GetLoadMutexMapSize();
 }
 
+void CachingManagerTestAccess::PrefetchForTimeOfDay() {
+  manager_->PrefetchForTimeOfDay();
+}
+
+void CachingManagerTestAccess::WaitForPrefetches() {
+  manager_->WaitForPrefetches();
+}
+
 }  // namespace test_util
 }  // namespace serving
 }  // namespace tensorflow
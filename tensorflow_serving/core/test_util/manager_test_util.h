@@ -16,6 +16,9 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_CORE_TEST_UTIL_MANAGER_TEST_UTIL_H_
 #define TENSORFLOW_SERVING_CORE_TEST_UTIL_MANAGER_TEST_UTIL_H_
 
+#include <map>
+#include <set>
+
 #include "tensorflow_serving/core/aspired_versions_manager.h"
 #include "tensorflow_serving/core/caching_manager.h"
 
@@ -42,6 +45,10 @@ class AspiredVersionsManagerTestAccess {
 
   uint32 num_load_threads() const;
 
+  // Invokes SetVersionsExemptFromStandby() on the manager.
+  void SetVersionsExemptFromStandby(
+      const std::map<string, std::set<int64>>& versions);
+
  private:
   AspiredVersionsManager* const manager_;
 
@@ -72,6 +79,12 @@ class CachingManagerTestAccess {
   // servable-id requested for load.
   int64 GetLoadMutexMapSize() const;
 
+  // Prefetches the servables requested at the coming hour of the day.
+  void PrefetchForTimeOfDay();
+
+  // Waits for the prefetches in progress.
+  void WaitForPrefetches();
+
  private:
   CachingManager* const manager_;
 
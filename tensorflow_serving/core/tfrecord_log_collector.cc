@@ -0,0 +1,129 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/core/tfrecord_log_collector.h"
+
+#include <utility>
+
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/io/compression.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/lib/strings/stringprintf.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace tensorflow {
+namespace serving {
+
+Status TfRecordLogCollector::Create(
+    const LogCollectorConfig& config, const uint32 id,
+    std::unique_ptr<LogCollector>* log_collector) {
+  if (config.filename_prefix().empty()) {
+    return errors::InvalidArgument(
+        "filename_prefix must be set for the tfrecord LogCollector");
+  }
+  const string& compression_type = config.tfrecord_config().compression_type();
+  if (compression_type != io::compression::kNone &&
+      compression_type != io::compression::kZlib &&
+      compression_type != io::compression::kGzip) {
+    return errors::InvalidArgument("Unsupported compression type: ",
+                                   compression_type);
+  }
+  std::unique_ptr<TfRecordLogCollector> collector(
+      new TfRecordLogCollector(config, id));
+  {
+    mutex_lock l(collector->mu_);
+    TF_RETURN_IF_ERROR(collector->StartFile());
+  }
+  *log_collector = std::move(collector);
+  return Status::OK();
+}
+
+TfRecordLogCollector::TfRecordLogCollector(const LogCollectorConfig& config,
+                                           const uint32 id)
+    : config_(config), id_(id) {}
+
+TfRecordLogCollector::~TfRecordLogCollector() {
+  mutex_lock l(mu_);
+  const Status status = CloseFile();
+  if (!status.ok()) {
+    LOG(ERROR) << "Cannot close the request log file: " << status;
+  }
+}
+
+Status TfRecordLogCollector::CollectMessage(
+    const google::protobuf::Message& message) {
+  string record;
+  if (!message.SerializeToString(&record)) {
+    return errors::Internal("Cannot serialize the log message");
+  }
+  mutex_lock l(mu_);
+  const TfRecordLogCollectorConfig& tfrecord_config = config_.tfrecord_config();
+  if ((tfrecord_config.max_file_bytes() > 0 &&
+       file_bytes_ >= tfrecord_config.max_file_bytes()) ||
+      (tfrecord_config.max_file_age_seconds() > 0 &&
+       Env::Default()->NowSeconds() - file_start_seconds_ >=
+           tfrecord_config.max_file_age_seconds())) {
+    TF_RETURN_IF_ERROR(StartFile());
+  }
+  if (writer_ == nullptr) {
+    return errors::FailedPrecondition("No request log file is open");
+  }
+  TF_RETURN_IF_ERROR(writer_->WriteRecord(record));
+  file_bytes_ += record.size();
+  return Status::OK();
+}
+
+Status TfRecordLogCollector::Flush() {
+  mutex_lock l(mu_);
+  if (writer_ == nullptr) {
+    return Status::OK();
+  }
+  return writer_->Flush();
+}
+
+Status TfRecordLogCollector::StartFile() {
+  TF_RETURN_IF_ERROR(CloseFile());
+  ++file_number_;
+  const string filename =
+      strings::StrCat(config_.filename_prefix(), "-", id_, "-",
+                      strings::Printf("%05d", file_number_), ".tfrecord");
+  TF_RETURN_IF_ERROR(Env::Default()->NewWritableFile(filename, &file_));
+  writer_.reset(new io::RecordWriter(
+      file_.get(), io::RecordWriterOptions::CreateRecordWriterOptions(
+                       config_.tfrecord_config().compression_type())));
+  file_bytes_ = 0;
+  file_start_seconds_ = Env::Default()->NowSeconds();
+  return Status::OK();
+}
+
+Status TfRecordLogCollector::CloseFile() {
+  if (writer_ == nullptr) {
+    return Status::OK();
+  }
+  // The writer and the file are dropped even if closing fails, so that the
+  // next file can be started.
+  const Status writer_status = writer_->Close();
+  writer_.reset();
+  const Status file_status = file_->Close();
+  file_.reset();
+  TF_RETURN_IF_ERROR(writer_status);
+  return file_status;
+}
+
+REGISTER_LOG_COLLECTOR("tfrecord", TfRecordLogCollector::Create);
+
+}  // namespace serving
+}  // namespace tensorflow
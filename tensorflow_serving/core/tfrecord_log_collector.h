@@ -0,0 +1,79 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_CORE_TFRECORD_LOG_COLLECTOR_H_
+#define TENSORFLOW_SERVING_CORE_TFRECORD_LOG_COLLECTOR_H_
+
+#include <memory>
+
+#include "google/protobuf/message.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/io/record_writer.h"
+#include "tensorflow/core/platform/file_system.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow_serving/config/log_collector_config.pb.h"
+#include "tensorflow_serving/core/log_collector.h"
+
+namespace tensorflow {
+namespace serving {
+
+// A LogCollector writing the logs as TFRecords, registered for the "tfrecord"
+// type. The records are buffered, and compressed if configured, before being
+// written in large chunks, and the files are rotated by size and age, see
+// TfRecordLogCollectorConfig.
+//
+// This class is thread-safe.
+class TfRecordLogCollector : public LogCollector {
+ public:
+  static Status Create(const LogCollectorConfig& config, uint32 id,
+                       std::unique_ptr<LogCollector>* log_collector);
+
+  // Closes the current file.
+  ~TfRecordLogCollector() override;
+
+  Status CollectMessage(const google::protobuf::Message& message) override;
+
+  Status Flush() override;
+
+ private:
+  TfRecordLogCollector(const LogCollectorConfig& config, uint32 id);
+
+  // Closes the current file, if any, and starts the next one.
+  Status StartFile() TF_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Closes the current file, if any.
+  Status CloseFile() TF_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  const LogCollectorConfig config_;
+  const uint32 id_;
+
+  mutex mu_;
+  // Sequence number of the current file.
+  int file_number_ TF_GUARDED_BY(mu_) = -1;
+  std::unique_ptr<WritableFile> file_ TF_GUARDED_BY(mu_);
+  std::unique_ptr<io::RecordWriter> writer_ TF_GUARDED_BY(mu_);
+  // Bytes of the records written to the current file, and its creation time.
+  uint64 file_bytes_ TF_GUARDED_BY(mu_) = 0;
+  uint64 file_start_seconds_ TF_GUARDED_BY(mu_) = 0;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(TfRecordLogCollector);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_CORE_TFRECORD_LOG_COLLECTOR_H_
@@ -0,0 +1,117 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/core/tfrecord_log_collector.h"
+
+#include <memory>
+#include <vector>
+
+#include "google/protobuf/wrappers.pb.h"
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/io/record_reader.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+LogCollectorConfig CreateConfig(const string& test_name,
+                                const string& compression_type,
+                                const uint64 max_file_bytes) {
+  const string dir = io::JoinPath(testing::TmpDir(), test_name);
+  TF_CHECK_OK(Env::Default()->RecursivelyCreateDir(dir));
+  LogCollectorConfig config;
+  config.set_type("tfrecord");
+  config.set_filename_prefix(io::JoinPath(dir, "log"));
+  config.mutable_tfrecord_config()->set_compression_type(compression_type);
+  config.mutable_tfrecord_config()->set_max_file_bytes(max_file_bytes);
+  return config;
+}
+
+// Returns the values of the StringValue records of 'filename'.
+std::vector<string> ReadLogs(const string& filename,
+                             const string& compression_type) {
+  std::unique_ptr<RandomAccessFile> file;
+  TF_CHECK_OK(Env::Default()->NewRandomAccessFile(filename, &file));
+  io::SequentialRecordReader reader(
+      file.get(),
+      io::RecordReaderOptions::CreateRecordReaderOptions(compression_type));
+  std::vector<string> values;
+  tstring record;
+  while (reader.ReadRecord(&record).ok()) {
+    google::protobuf::StringValue value;
+    CHECK(value.ParseFromString(string(record)));
+    values.push_back(value.value());
+  }
+  return values;
+}
+
+google::protobuf::StringValue MakeLog(const string& value) {
+  google::protobuf::StringValue log;
+  log.set_value(value);
+  return log;
+}
+
+TEST(TfRecordLogCollectorTest, WritesCompressedRecords) {
+  const LogCollectorConfig config =
+      CreateConfig("WritesCompressedRecords", "ZLIB", 0);
+  std::unique_ptr<LogCollector> log_collector;
+  TF_ASSERT_OK(LogCollector::Create(config, /*id=*/7, &log_collector));
+  TF_ASSERT_OK(log_collector->CollectMessage(MakeLog("first")));
+  TF_ASSERT_OK(log_collector->CollectMessage(MakeLog("second")));
+  TF_ASSERT_OK(log_collector->Flush());
+  log_collector.reset();
+
+  EXPECT_EQ(std::vector<string>({"first", "second"}),
+            ReadLogs(config.filename_prefix() + "-7-00000.tfrecord", "ZLIB"));
+}
+
+TEST(TfRecordLogCollectorTest, RotatesFiles) {
+  const LogCollectorConfig config =
+      CreateConfig("RotatesFiles", "", /*max_file_bytes=*/10);
+  std::unique_ptr<LogCollector> log_collector;
+  TF_ASSERT_OK(LogCollector::Create(config, /*id=*/0, &log_collector));
+  TF_ASSERT_OK(log_collector->CollectMessage(MakeLog("first log")));
+  TF_ASSERT_OK(log_collector->CollectMessage(MakeLog("second log")));
+  TF_ASSERT_OK(log_collector->CollectMessage(MakeLog("third")));
+  log_collector.reset();
+
+  const string prefix = config.filename_prefix();
+  EXPECT_EQ(std::vector<string>({"first log"}),
+            ReadLogs(prefix + "-0-00000.tfrecord", ""));
+  EXPECT_EQ(std::vector<string>({"second log"}),
+            ReadLogs(prefix + "-0-00001.tfrecord", ""));
+  EXPECT_EQ(std::vector<string>({"third"}),
+            ReadLogs(prefix + "-0-00002.tfrecord", ""));
+}
+
+TEST(TfRecordLogCollectorTest, InvalidConfig) {
+  LogCollectorConfig config = CreateConfig("InvalidConfig", "ZSTD", 0);
+  std::unique_ptr<LogCollector> log_collector;
+  EXPECT_TRUE(errors::IsInvalidArgument(
+      LogCollector::Create(config, /*id=*/0, &log_collector)));
+
+  config.mutable_tfrecord_config()->clear_compression_type();
+  config.clear_filename_prefix();
+  EXPECT_TRUE(errors::IsInvalidArgument(
+      LogCollector::Create(config, /*id=*/0, &log_collector)));
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
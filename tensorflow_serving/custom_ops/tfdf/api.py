@@ -183,6 +183,7 @@ from tensorflow.python.training.tracking import tracking
 from tensorflow_decision_forests.tensorflow.ops.inference import op
 from yggdrasil_decision_forests.dataset import data_spec_pb2
 from yggdrasil_decision_forests.model import abstract_model_pb2
+from yggdrasil_decision_forests.model.gradient_boosted_trees import gradient_boosted_trees_pb2
 
 from tensorflow.python.framework import load_library
 from tensorflow.python.platform import resource_loader
@@ -208,6 +209,43 @@ ModelOutput = collections.namedtuple(
         "dense_col_representation",
     ])
 
+# Wrapper around the outputs values of the inference op with feature
+# contributions.
+ModelOutputWithFeatureContributions = collections.namedtuple(
+    "ModelOutputWithFeatureContributions",
+    [
+        # Same as in "ModelOutput".
+        "dense_predictions",
+        "dense_col_representation",
+
+        # Contributions of the input features to the predictions. See the
+        # documentation of "feature_contributions" in
+        # "SimpleMLInferenceOpWithFeatureContributions" for the format details.
+        "feature_contributions",
+
+        # Names of the rows of "feature_contributions" i.e. the names of the
+        # input features in order, followed by FEATURE_CONTRIBUTIONS_BIAS.
+        "feature_contribution_names",
+    ])
+
+# Wrapper around the outputs values of the inference op with leaves.
+ModelOutputWithLeaves = collections.namedtuple(
+    "ModelOutputWithLeaves",
+    [
+        # Same as in "ModelOutput".
+        "dense_predictions",
+        "dense_col_representation",
+
+        # Index of the leaf reached by each example in each tree. See the
+        # documentation of "leaves" in "SimpleMLInferenceOpWithLeaves" for the
+        # format details.
+        "leaves",
+    ])
+
+# Name of the last row of the feature contributions, the expected value of the
+# model.
+FEATURE_CONTRIBUTIONS_BIAS = "__BIAS__"
+
 # Magic value used to indicate of a missing value for categorical stored as
 # ints, but that should not be interpreted as integer directly.
 #
@@ -227,7 +265,21 @@ class Model(object):
   def __init__(self,
                model_path: Text,
                tensor_model_path: Optional[Tensor] = None,
-               verbose: Optional[bool] = True):
+               verbose: Optional[bool] = True,
+               inference_engine: Optional[Text] = "auto",
+               categorical_strings: Optional[bool] = False,
+               pack_features_in_op: Optional[bool] = False,
+               prediction_cache_size: Optional[int] = 0,
+               num_inference_threads: Optional[int] = 0,
+               inference_threads_numa_node: Optional[int] = -1,
+               use_huge_pages: Optional[bool] = False,
+               prefault_model_data: Optional[bool] = False,
+               flat_forest_cache_dir: Optional[Text] = "",
+               release_unused_flat_forests: Optional[bool] = False,
+               num_tree_shards: Optional[int] = 1,
+               tree_shard_index: Optional[int] = 0,
+               autotune_batch_sizes: Optional[List[int]] = None,
+               rf_leaf_top_k: Optional[int] = 0):
     """Initialize the model.
 
     The Yggdrasil model should be available at the "model_path" location both at
@@ -240,9 +292,64 @@ class Model(object):
         from SavedModel assets.
       verbose: If true, prints information about the model and its integration
         in tensorflow.
+      inference_engine: Engine used to run the model. One of "auto",
+        "autotune", "fast", "flat", "flat_mapped", "flat_quantized" and "slow".
+        See the "inference_engine" attribute of the "SimpleMLLoadModelFromPath"
+        op.
+      categorical_strings: If true, the categorical features with a dictionary
+        are fed to the inference op as strings, and resolved with the
+        dictionaries of the model in the op, instead of with one lookup table
+        op per feature.
+      pack_features_in_op: If true, the features are fed to the inference op
+        one tensor per feature, and packed by the op, instead of being stacked
+        and cast by graph ops. Not compatible with "categorical_strings".
+      prediction_cache_size: If positive, the predictions of up to this number
+        of examples are cached, and the examples scored again are not
+        evaluated. See the "prediction_cache_size" attribute of the
+        "SimpleMLLoadModelFromPath" op.
+      num_inference_threads: If positive, the model has its own pool of
+        inference threads. See the "num_inference_threads" attribute of the
+        "SimpleMLLoadModelFromPath" op.
+      inference_threads_numa_node: If not -1, NUMA node the inference threads
+        of the model are bound to.
+      use_huge_pages: If true, the nodes of the "flat" and "flat_mapped"
+        engines are stored in huge pages. See the "use_huge_pages" attribute of
+        the "SimpleMLLoadModelFromPath" op.
+      prefault_model_data: If true, the memory mapped forest of the
+        "flat_mapped" engine is read when the model is loaded. See the
+        "prefault_model_data" attribute of the "SimpleMLLoadModelFromPath" op.
+      flat_forest_cache_dir: If set, directory of the flat forests of the
+        "flat" and "flat_mapped" engines, reused across restarts and servers.
+        See the "flat_forest_cache_dir" attribute of the
+        "SimpleMLLoadModelFromPath" op.
+      release_unused_flat_forests: If true, the files of
+        "flat_forest_cache_dir" are deleted when the last process using them
+        unloads its model. See the "release_unused_flat_forests" attribute of
+        the "SimpleMLLoadModelFromPath" op.
+      num_tree_shards: If more than 1, only the "tree_shard_index"-th shard of
+        the trees is loaded, and "apply" returns the partial predictions of the
+        shard, to be reduced with "reduce_tree_shards". The whole model is
+        still parsed to build the shard, unless the shard was saved in
+        "flat_forest_cache_dir". See the "num_tree_shards" attribute of the
+        "SimpleMLLoadModelFromPath" op.
+      tree_shard_index: Index of the tree shard, if "num_tree_shards" is more
+        than 1.
+      autotune_batch_sizes: Sizes of the batches the "autotune" engine measures
+        the engines on. If None, uses the default of the
+        "SimpleMLLoadModelFromPath" op.
+      rf_leaf_top_k: If positive, the leaves of the Random Forest classifiers
+        of the "flat" and "flat_mapped" engines only keep this number of class
+        probabilities. See the "rf_leaf_top_k" attribute of the
+        "SimpleMLLoadModelFromPath" op.
     """
 
+    if categorical_strings and pack_features_in_op:
+      raise ValueError(
+          "categorical_strings and pack_features_in_op are not compatible.")
+
     self._verbose: Optional[bool] = verbose
+    self._categorical_strings = categorical_strings
+    self._pack_features_in_op = pack_features_in_op
 
     if self._verbose:
       logging.info("Create inference model for %s", model_path)
@@ -253,12 +360,27 @@ class Model(object):
 
     self.input_builder = _InferenceArgsBuilder(verbose)
     self.input_builder.build_from_model_path(model_path)
+    if num_tree_shards > 1:
+      self.input_builder.use_partial_predictions()
 
     # Model loading and initialization op.
     if tensor_model_path is None:
       tensor_model_path = model_path
     load_model_op = op.SimpleMLLoadModelFromPath(
-        model_identifier=self.model_identifier, path=tensor_model_path)
+        model_identifier=self.model_identifier,
+        path=tensor_model_path,
+        inference_engine=inference_engine,
+        prediction_cache_size=prediction_cache_size,
+        num_inference_threads=num_inference_threads,
+        inference_threads_numa_node=inference_threads_numa_node,
+        use_huge_pages=use_huge_pages,
+        prefault_model_data=prefault_model_data,
+        flat_forest_cache_dir=flat_forest_cache_dir,
+        release_unused_flat_forests=release_unused_flat_forests,
+        num_tree_shards=num_tree_shards,
+        tree_shard_index=tree_shard_index,
+        autotune_batch_sizes=autotune_batch_sizes,
+        rf_leaf_top_k=rf_leaf_top_k)
 
     self._init_op = tf.group(self.input_builder.init_op(), load_model_op)
 
@@ -273,13 +395,23 @@ class Model(object):
     """
     return self._init_op
 
-  def apply(self, features: Dict[Text, Tensor]) -> ModelOutput:
+  def apply(self,
+            features: Dict[Text, Tensor],
+            max_num_trees: Optional[int] = 0,
+            early_exit_margin: Optional[float] = 0.0) -> ModelOutput:
     """Applies the model.
 
     Args:
       features: Dictionary of input features of the model. All the input
         features of the model should be available. Features not used by the
         model are ignored.
+      max_num_trees: If positive, only the first trees of the model are
+        evaluated. See the "max_num_trees" attribute of the
+        "SimpleMLInferenceOp" op.
+      early_exit_margin: If positive, the evaluation of the binary
+        classification gradient boosted trees stops early once the predicted
+        classes are decided. See the "early_exit_margin" attribute of the
+        "SimpleMLInferenceOp" op.
 
     Returns:
       Predictions of the model.
@@ -288,9 +420,208 @@ class Model(object):
     if self._verbose:
       logging.info("Create inference op")
 
+    if self._pack_features_in_op:
+      inference_args = self.input_builder.build_feature_list_op_args(features)
+      dense_predictions, dense_col_representation = (
+          op.SimpleMLInferenceOpWithFeatureList(
+              model_identifier=self.model_identifier,
+              max_num_trees=max_num_trees,
+              early_exit_margin=early_exit_margin,
+              **inference_args))
+    elif self._categorical_strings:
+      inference_args = self.input_builder.build_inference_op_args(
+          features, categorical_strings=True)
+      dense_predictions, dense_col_representation = (
+          op.SimpleMLInferenceOpWithCategoricalStrings(
+              model_identifier=self.model_identifier,
+              max_num_trees=max_num_trees,
+              early_exit_margin=early_exit_margin,
+              **inference_args))
+    else:
+      inference_args = self.input_builder.build_inference_op_args(features)
+      dense_predictions, dense_col_representation = op.SimpleMLInferenceOp(
+          model_identifier=self.model_identifier,
+          max_num_trees=max_num_trees,
+          early_exit_margin=early_exit_margin,
+          **inference_args)
+
+    return ModelOutput(
+        dense_predictions=dense_predictions,
+        dense_col_representation=dense_col_representation)
+
+  def apply_with_feature_contributions(
+      self,
+      features: Dict[Text, Tensor]) -> ModelOutputWithFeatureContributions:
+    """Applies the model, and computes the contributions of its input features.
+
+    The contributions are TreeSHAP values computed by the inference op. Only
+    supported by the flat forest inference engines, and for models with the
+    number of training examples of their nodes.
+
+    Args:
+      features: Dictionary of input features of the model. All the input
+        features of the model should be available. Features not used by the
+        model are ignored.
+
+    Returns:
+      Predictions of the model, and contributions of its input features.
+    """
+
+    if self._verbose:
+      logging.info("Create inference op with feature contributions")
+
     inference_args = self.input_builder.build_inference_op_args(features)
-    dense_predictions, dense_col_representation = op.SimpleMLInferenceOp(
-        model_identifier=self.model_identifier, **inference_args)
+    (dense_predictions, dense_col_representation,
+     feature_contributions) = op.SimpleMLInferenceOpWithFeatureContributions(
+         model_identifier=self.model_identifier, **inference_args)
+
+    return ModelOutputWithFeatureContributions(
+        dense_predictions=dense_predictions,
+        dense_col_representation=dense_col_representation,
+        feature_contributions=feature_contributions,
+        feature_contribution_names=(
+            self.input_builder.feature_contribution_names()))
+
+
+  def apply_with_sparse_numerical_features(
+      self, features: Dict[Text, Tensor],
+      numerical_features: tf.SparseTensor) -> ModelOutput:
+    """Applies the model, with the numerical features fed as a sparse tensor.
+
+    For wide models where only a few of the numerical features are set per
+    example: only the present values are fed to the inference op, and the
+    absent values are missing.
+
+    Args:
+      features: Dictionary of the non-numerical input features of the model.
+        All these features should be available. Features not used by the model
+        are ignored.
+      numerical_features: Sparse tensor of shape [batch, num_numerical_features]
+        and of a float or int type. The columns are the numerical features of
+        the model, in the order of "input_builder.numerical_feature_names()".
+
+    Returns:
+      Predictions of the model.
+    """
+
+    if self._verbose:
+      logging.info("Create inference op with sparse numerical features")
+
+    inference_args = self.input_builder.build_inference_op_args(
+        features, sparse_numerical_features=numerical_features)
+    dense_predictions, dense_col_representation = (
+        op.SimpleMLInferenceOpWithSparseNumericalFeatures(
+            model_identifier=self.model_identifier, **inference_args))
+
+    return ModelOutput(
+        dense_predictions=dense_predictions,
+        dense_col_representation=dense_col_representation)
+
+  def apply_get_leaves(
+      self,
+      features: Dict[Text, Tensor],
+      max_num_trees: Optional[int] = 0,
+      early_exit_margin: Optional[float] = 0.0) -> ModelOutputWithLeaves:
+    """Applies the model, and returns the leaves reached by the examples.
+
+    The leaves are collected by the inference op while traversing the trees for
+    the predictions, e.g. to feed the leaf indices to an embedding model. Only
+    supported by the "flat" and "flat_mapped" inference engines.
+
+    Args:
+      features: Dictionary of input features of the model. All the input
+        features of the model should be available. Features not used by the
+        model are ignored.
+      max_num_trees: See "apply". The trees not evaluated have a leaf index of
+        -1.
+      early_exit_margin: See "apply". The trees not evaluated have a leaf index
+        of -1.
+
+    Returns:
+      Predictions of the model, and index of the leaf reached by each example
+      in each tree.
+    """
+
+    if self._verbose:
+      logging.info("Create inference op with leaves")
+
+    inference_args = self.input_builder.build_inference_op_args(features)
+    dense_predictions, dense_col_representation, leaves = (
+        op.SimpleMLInferenceOpWithLeaves(
+            model_identifier=self.model_identifier,
+            max_num_trees=max_num_trees,
+            early_exit_margin=early_exit_margin,
+            **inference_args))
+
+    return ModelOutputWithLeaves(
+        dense_predictions=dense_predictions,
+        dense_col_representation=dense_col_representation,
+        leaves=leaves)
+
+
+class ModelBank(object):
+  """Applies a bank of Yggdrasil models on batches mixing their examples.
+
+  For TensorFlow V1 and tensorflow V2.
+
+  The trees of all the models are packed together, and a batch is evaluated in
+  one pass. All the models should have the same task, input features and label,
+  and be compatible with the "flat" inference engine.
+  """
+
+  def __init__(self,
+               model_paths: List[Text],
+               verbose: Optional[bool] = True):
+    """Initialize the model bank.
+
+    Args:
+      model_paths: Paths to the Yggdrasil models. The model "model_paths[i]" has
+        the model id "i".
+      verbose: If true, prints information about the models and their
+        integration in tensorflow.
+    """
+
+    if not model_paths:
+      raise ValueError("A model bank requires at least one model.")
+
+    self._verbose: Optional[bool] = verbose
+
+    if self._verbose:
+      logging.info("Create inference model bank for %s", model_paths)
+
+    self.model_identifier = _create_model_identifier()
+
+    # Note: All the models have the same input features.
+    self.input_builder = _InferenceArgsBuilder(verbose)
+    self.input_builder.build_from_model_path(model_paths[0])
+
+    load_model_op = op.SimpleMLLoadModelBankFromPaths(
+        model_identifier=self.model_identifier, paths=model_paths)
+
+    self._init_op = tf.group(self.input_builder.init_op(), load_model_op)
+
+  def init_op(self) -> InitOp:
+    """Get the model bank "init_op"."""
+    return self._init_op
+
+  def apply(self, features: Dict[Text, Tensor],
+            model_ids: Tensor) -> ModelOutput:
+    """Applies the model bank.
+
+    Args:
+      features: Dictionary of input features of the models.
+      model_ids: Int32 tensor of shape [batch]. Model id of each example.
+
+    Returns:
+      Predictions of the models.
+    """
+
+    inference_args = self.input_builder.build_inference_op_args(features)
+    dense_predictions, dense_col_representation = (
+        op.SimpleMLInferenceOpWithModelBank(
+            model_identifier=self.model_identifier,
+            model_ids=tf.cast(model_ids, tf.int32),
+            **inference_args))
 
     return ModelOutput(
         dense_predictions=dense_predictions,
@@ -344,6 +675,72 @@ class ModelV2(tracking.AutoTrackable):
         dense_col_representation=dense_col_representation)
 
 
+def generate_compiled_flat_forest_source(model_path: Text,
+                                         output_path: Text) -> tf.Operation:
+  """Generates the C++ source of the compiled flat forest of a model.
+
+  Once built as a shared library (e.g. "c++ -O2 -shared -fPIC") and copied as
+  "flat_forest_compiled.so" in the model directory, the compiled forest is used
+  by the "flat" inference engine.
+
+  Args:
+    model_path: Path to the Yggdrasil model.
+    output_path: Path to the generated C++ source file.
+
+  Returns:
+    The generation op. In eager mode, the source is generated when this
+    function is called.
+  """
+
+  return op.SimpleMLGenerateCompiledFlatForestSource(
+      path=model_path, output_path=output_path)
+
+
+def tree_shard_finalization(model_path: Text) -> Text:
+  """Gets the finalization of the tree shards of a model.
+
+  Args:
+    model_path: Path to the Yggdrasil model.
+
+  Returns:
+    The "finalization" argument of "reduce_tree_shards" for the model.
+  """
+
+  header = abstract_model_pb2.AbstractModel()
+  with tf.io.gfile.GFile(os.path.join(model_path, "header.pb"), "rb") as f:
+    header.ParseFromString(f.read())
+  if header.name != "GRADIENT_BOOSTED_TREES":
+    return "identity"
+
+  gbt_header = gradient_boosted_trees_pb2.Header()
+  with tf.io.gfile.GFile(
+      os.path.join(model_path, "gradient_boosted_trees_header.pb"), "rb") as f:
+    gbt_header.ParseFromString(f.read())
+  if gbt_header.loss == gradient_boosted_trees_pb2.BINOMIAL_LOG_LIKELIHOOD:
+    return "sigmoid_binary"
+  if gbt_header.loss == gradient_boosted_trees_pb2.MULTINOMIAL_LOG_LIKELIHOOD:
+    return "softmax"
+  return "identity"
+
+
+def reduce_tree_shards(partial_predictions: List[Tensor],
+                       finalization: Text) -> Tensor:
+  """Reduces the partial predictions of the tree shards of a model.
+
+  Args:
+    partial_predictions: The "dense_predictions" of the models loaded with
+      "num_tree_shards", one per shard, e.g. returned by "RemotePredict" calls
+      to the servers of the shards.
+    finalization: Finalization of the model. See "tree_shard_finalization".
+
+  Returns:
+    The dense predictions of the model.
+  """
+
+  return op.SimpleMLReduceTreeShards(
+      partial_predictions=partial_predictions, finalization=finalization)
+
+
 def _create_model_identifier() -> Text:
   """Creates a unique identifier for the model.
 
@@ -413,6 +810,17 @@ class _InferenceArgsBuilder(tracking.AutoTrackable):
 
     self._create_str_to_int_tables()
 
+  def use_partial_predictions(self):
+    """Uses the dimension of the partial predictions of the tree shards.
+
+    The partial predictions of a binary classification GBT are the logits.
+    """
+
+    if (self._header.name == "GRADIENT_BOOSTED_TREES" and
+        self._header.task == Task.CLASSIFICATION and
+        self._dense_output_dim == 2):
+      self._dense_output_dim = 1
+
   def init_op(self) -> Tensor:
     """Op initializing the processing of the input features."""
 
@@ -421,14 +829,26 @@ class _InferenceArgsBuilder(tracking.AutoTrackable):
     else:
       return tf.no_op()
 
-  def build_inference_op_args(self, features: Dict[Text,
-                                                   Tensor]) -> Dict[Text, Any]:
+  def build_inference_op_args(
+      self,
+      features: Dict[Text, Tensor],
+      categorical_strings: Optional[bool] = False,
+      sparse_numerical_features: Optional[tf.SparseTensor] = None
+  ) -> Dict[Text, Any]:
     """Creates the arguments of the SimpleMLInferenceOp.
 
     Args:
       features: Dictionary of input features of the model. All the input
         features of the model should be available. Features not used by the
         model are ignored.
+      categorical_strings: If true, creates the arguments of the
+        SimpleMLInferenceOpWithCategoricalStrings instead: the categorical
+        features with a dictionary are not converted to integers, and are
+        packed in the "categorical_string_features" argument.
+      sparse_numerical_features: If set, creates the arguments of the
+        SimpleMLInferenceOpWithSparseNumericalFeatures instead: the numerical
+        features are the columns of this sparse tensor (see
+        "numerical_feature_names"), and are not expected in "features".
 
     Returns:
       Op constructor arguments.
@@ -445,14 +865,26 @@ class _InferenceArgsBuilder(tracking.AutoTrackable):
         categorical_set_int_features={})
 
     for feature_name, feature_tensor in features.items():
-      self._register_input_feature(feature_name, feature_tensor, feature_maps)
+      self._register_input_feature(feature_name, feature_tensor, feature_maps,
+                                   categorical_strings)
+
+    if sparse_numerical_features is not None:
+      if feature_maps.numerical_features:
+        raise Exception(
+            "The numerical features should only be fed in "
+            "sparse_numerical_features.")
+      for feature_name in self.numerical_feature_names():
+        feature_maps.numerical_features[
+            self._feature_name_to_idx[feature_name]] = None
 
     self._check_all_input_features_are_provided(feature_maps)
 
     # Pack the input features by type.
 
     # Numerical features.
-    if feature_maps.numerical_features:
+    if sparse_numerical_features is not None:
+      numerical_features = None
+    elif feature_maps.numerical_features:
       numerical_features = tf.stack(
           self._dict_to_list_sorted_by_key(feature_maps.numerical_features),
           axis=1)
@@ -468,15 +900,166 @@ class _InferenceArgsBuilder(tracking.AutoTrackable):
       boolean_features = tf.constant(0, dtype=tf.float32, shape=(0, 0))
 
     # Categorical features.
+    categorical_string_features = tf.constant(
+        "", dtype=tf.string, shape=(0, 0))
     if feature_maps.categorical_int_features:
-      categorical_int_features = tf.stack(
-          self._dict_to_list_sorted_by_key(
-              feature_maps.categorical_int_features),
-          axis=1)
+      categorical_values = self._dict_to_list_sorted_by_key(
+          feature_maps.categorical_int_features)
+      if categorical_strings:
+        # The string and integer values are packed in separate tensors, with
+        # placeholder values for the features of the other type.
+        string_values = [v for v in categorical_values if v.dtype == tf.string]
+        int_values = [v for v in categorical_values if v.dtype != tf.string]
+        if string_values:
+          packed_values = [
+              v if v.dtype == tf.string else tf.fill(tf.shape(v), "")
+              for v in categorical_values
+          ]
+          categorical_string_features = tf.stack(packed_values, axis=1)
+        if int_values:
+          packed_values = [
+              v if v.dtype != tf.string else tf.zeros(tf.shape(v), tf.int32)
+              for v in categorical_values
+          ]
+          categorical_int_features = tf.stack(packed_values, axis=1)
+        else:
+          categorical_int_features = tf.constant(
+              0, dtype=tf.int32, shape=(0, 0))
+      else:
+        categorical_int_features = tf.stack(categorical_values, axis=1)
     else:
       categorical_int_features = tf.constant(0, dtype=tf.int32, shape=(0, 0))
 
-    # Categorical Set features.
+    args = {
+        "numerical_features": numerical_features,
+        "boolean_features": boolean_features,
+        "categorical_int_features": categorical_int_features,
+        "dense_output_dim": self._dense_output_dim,
+    }
+    args.update(self._pack_categorical_set_features(feature_maps))
+    if categorical_strings:
+      args["categorical_string_features"] = categorical_string_features
+    if sparse_numerical_features is not None:
+      del args["numerical_features"]
+      args.update(
+          self._pack_sparse_numerical_features(sparse_numerical_features))
+
+    if self._verbose:
+      logging.info("Inference op arguments:\n%s", args)
+
+    return args
+
+  def build_feature_list_op_args(
+      self, features: Dict[Text, Tensor]) -> Dict[Text, Any]:
+    """Creates the arguments of the SimpleMLInferenceOpWithFeatureList.
+
+    Unlike "build_inference_op_args", the numerical, boolean and categorical
+    features are neither stacked nor cast: the op packs them itself.
+
+    Args:
+      features: Dictionary of input features of the model. All the input
+        features of the model should be available. Features not used by the
+        model are ignored.
+
+    Returns:
+      Op constructor arguments.
+    """
+
+    feature_maps = FeatureMaps(
+        numerical_features={},
+        boolean_features={},
+        categorical_int_features={},
+        categorical_set_int_features={})
+
+    for feature_name, feature_tensor in features.items():
+      self._register_input_feature(
+          feature_name, feature_tensor, feature_maps, pack_in_op=True)
+
+    self._check_all_input_features_are_provided(feature_maps)
+
+    args = {
+        "numerical_feature_values":
+            self._dict_to_list_sorted_by_key(feature_maps.numerical_features),
+        "boolean_feature_values":
+            self._dict_to_list_sorted_by_key(feature_maps.boolean_features),
+        "categorical_int_feature_values":
+            self._dict_to_list_sorted_by_key(
+                feature_maps.categorical_int_features),
+        "dense_output_dim":
+            self._dense_output_dim,
+    }
+    args.update(self._pack_categorical_set_features(feature_maps))
+
+    if self._verbose:
+      logging.info("Inference op arguments:\n%s", args)
+
+    return args
+
+  def feature_contribution_names(self) -> List[Text]:
+    """Names of the rows of the feature contributions of the inference op.
+
+    The numerical, then boolean, then categorical features, each in the order of
+    their columns in the feature banks, followed by FEATURE_CONTRIBUTIONS_BIAS.
+
+    Returns:
+      List of feature names.
+    """
+
+    feature_idxs = sorted(self._feature_name_to_idx.values())
+    names = []
+    for column_type in [
+        ColumnType.NUMERICAL, ColumnType.BOOLEAN, ColumnType.CATEGORICAL
+    ]:
+      for feature_idx in feature_idxs:
+        feature_spec = self._data_spec.columns[feature_idx]
+        if feature_spec.type == column_type:
+          names.append(feature_spec.name)
+    names.append(FEATURE_CONTRIBUTIONS_BIAS)
+    return names
+
+  def numerical_feature_names(self) -> List[Text]:
+    """Names of the numerical features, in the order of their bank columns."""
+
+    return [
+        self._data_spec.columns[feature_idx].name
+        for feature_idx in sorted(self._feature_name_to_idx.values())
+        if self._data_spec.columns[feature_idx].type == ColumnType.NUMERICAL
+    ]
+
+  def _pack_sparse_numerical_features(
+      self, numerical_features: tf.SparseTensor) -> Dict[Text, Tensor]:
+    """Packs the sparse numerical features in the CSR inference op arguments."""
+
+    num_features = len(self.numerical_feature_names())
+    if (numerical_features.shape.rank != 2 or
+        numerical_features.shape[1] not in [None, num_features]):
+      raise Exception(
+          "The sparse numerical features are expected to have shape [batch, "
+          "{}]. Got {}.".format(num_features, numerical_features.shape))
+    if numerical_features.dtype not in [
+        tf.float32, tf.int32, tf.int64, tf.float64
+    ]:
+      raise Exception(
+          "The sparse numerical features are expected to have type "
+          "float{{32,64}} or int{{32,64}}. Got {}.".format(
+              numerical_features.dtype))
+
+    # The row splits require the values in row-major order.
+    numerical_features = tf.sparse.reorder(numerical_features)
+    ragged = tf.RaggedTensor.from_sparse(numerical_features)
+    return {
+        "numerical_features_indices":
+            tf.cast(numerical_features.indices[:, 1], tf.int32),
+        "numerical_features_values":
+            tf.cast(ragged.values, tf.float32),
+        "numerical_features_row_splits":
+            ragged.row_splits,
+    }
+
+  def _pack_categorical_set_features(
+      self, feature_maps: FeatureMaps) -> Dict[Text, Tensor]:
+    """Packs the categorical set features in the inference op arguments."""
+
     if feature_maps.categorical_set_int_features:
       categorical_set_int_features = tf.stack(
           self._dict_to_list_sorted_by_key(
@@ -488,36 +1071,32 @@ class _InferenceArgsBuilder(tracking.AutoTrackable):
                                                         dtype=tf.int32,
                                                         ragged_rank=2)
 
-    args = {
-        "numerical_features":
-            numerical_features,
-        "boolean_features":
-            boolean_features,
-        "categorical_int_features":
-            categorical_int_features,
+    return {
         "categorical_set_int_features_values":
             categorical_set_int_features.values.values,
         "categorical_set_int_features_row_splits_dim_1":
             categorical_set_int_features.values.row_splits,
         "categorical_set_int_features_row_splits_dim_2":
             categorical_set_int_features.row_splits,
-        "dense_output_dim":
-            self._dense_output_dim,
     }
 
-    if self._verbose:
-      logging.info("Inference op arguments:\n%s", args)
-
-    return args
-
-  def _register_input_feature(self, name: Text, value: Tensor,
-                              feature_maps: FeatureMaps) -> None:
+  def _register_input_feature(
+      self,
+      name: Text,
+      value: Tensor,
+      feature_maps: FeatureMaps,
+      categorical_strings: Optional[bool] = False,
+      pack_in_op: Optional[bool] = False) -> None:
     """Indexes, and optionally pre-computes, the input feature tensors.
 
     Args:
       name: Name of the input feature.
       value: Tensor value of the input feature.
       feature_maps: Output index of input features.
+      categorical_strings: If true, the categorical features with a dictionary
+        are indexed as strings.
+      pack_in_op: If true, the numerical, boolean and categorical features are
+        indexed without casting nor reshaping them.
 
     Raises:
       Exception: Is the feature is already registered, or with the wrong format.
@@ -533,16 +1112,17 @@ class _InferenceArgsBuilder(tracking.AutoTrackable):
 
     feature_spec = self._data_spec.columns[feature_idx]
     if feature_spec.type == ColumnType.NUMERICAL:
-      value = self._prepare_and_check_numerical_feature(name, value)
+      value = self._prepare_and_check_numerical_feature(name, value,
+                                                        pack_in_op)
       feature_maps.numerical_features[feature_idx] = value
 
     elif feature_spec.type == ColumnType.BOOLEAN:
-      value = self._prepare_and_check_boolean_feature(name, value)
+      value = self._prepare_and_check_boolean_feature(name, value, pack_in_op)
       feature_maps.boolean_features[feature_idx] = value
 
     elif feature_spec.type == ColumnType.CATEGORICAL:
       value = self._prepare_and_check_categorical_feature(
-          name, value, feature_spec)
+          name, value, feature_spec, categorical_strings, pack_in_op)
       feature_maps.categorical_int_features[feature_idx] = value
 
     elif feature_spec.type == ColumnType.CATEGORICAL_SET:
@@ -641,8 +1221,14 @@ class _InferenceArgsBuilder(tracking.AutoTrackable):
       raise Exception("Non supported task {}.".format(
           Task.Name(self._header.task)))
 
-  def _prepare_and_check_numerical_feature(self, name: Text, value: Tensor):
-    """Checks and optionally pre-processes a numerical feature."""
+  def _prepare_and_check_numerical_feature(self,
+                                         name: Text,
+                                         value: Tensor,
+                                         pack_in_op: Optional[bool] = False):
+    """Checks and optionally pre-processes a numerical feature.
+
+    If "pack_in_op", the feature is neither cast nor reshaped.
+    """
 
     extended_name = "Numerical feature \"{}\"".format(name)
     if value.dtype not in [tf.float32, tf.int32, tf.int64, tf.float64]:
@@ -650,7 +1236,7 @@ class _InferenceArgsBuilder(tracking.AutoTrackable):
           "{} is expected to have type float{{32,64}} or int{{32,64}}. Got {} "
           "instead".format(extended_name, value.dtype))
 
-    if value.dtype != tf.float32:
+    if value.dtype != tf.float32 and not pack_in_op:
       value = tf.cast(value, tf.float32)
 
     if len(value.shape) == 2:
@@ -658,7 +1244,8 @@ class _InferenceArgsBuilder(tracking.AutoTrackable):
         raise Exception(
             "{} is expected to have shape [None] or [None, 1]. Got {}  instead."
             .format(extended_name, len(value.shape)))
-      value = value[:, 0]
+      if not pack_in_op:
+        value = value[:, 0]
 
     elif len(value.shape) != 1:
       raise Exception(
@@ -666,8 +1253,14 @@ class _InferenceArgsBuilder(tracking.AutoTrackable):
           .format(extended_name, len(value.shape)))
     return value
 
-  def _prepare_and_check_boolean_feature(self, name: Text, value: Tensor):
-    """Checks and optionally pre-processes a boolean feature."""
+  def _prepare_and_check_boolean_feature(self,
+                                       name: Text,
+                                       value: Tensor,
+                                       pack_in_op: Optional[bool] = False):
+    """Checks and optionally pre-processes a boolean feature.
+
+    If "pack_in_op", the feature is neither cast nor reshaped.
+    """
 
     extended_name = "Boolean feature \"{}\"".format(name)
     if value.dtype not in [tf.float32, tf.int32, tf.int64, tf.float64]:
@@ -675,7 +1268,7 @@ class _InferenceArgsBuilder(tracking.AutoTrackable):
           "{} is expected to have type float{{32,64}} or int{{32,64}}. Got {} "
           "instead".format(extended_name, value.dtype))
 
-    if value.dtype != tf.float32:
+    if value.dtype != tf.float32 and not pack_in_op:
       value = tf.cast(value, tf.float32)
 
     if len(value.shape) == 2:
@@ -683,7 +1276,8 @@ class _InferenceArgsBuilder(tracking.AutoTrackable):
         raise Exception(
             "{} is expected to have shape [None] or [None, 1]. Got {}  instead."
             .format(extended_name, len(value.shape)))
-      value = value[:, 0]
+      if not pack_in_op:
+        value = value[:, 0]
 
     elif len(value.shape) != 1:
       raise Exception(
@@ -692,8 +1286,12 @@ class _InferenceArgsBuilder(tracking.AutoTrackable):
     return value
 
   def _prepare_and_check_categorical_feature(
-      self, name: Text, value: Tensor,
-      feature_spec: data_spec_pb2.Column) -> Tensor:
+      self,
+      name: Text,
+      value: Tensor,
+      feature_spec: data_spec_pb2.Column,
+      keep_strings: Optional[bool] = False,
+      pack_in_op: Optional[bool] = False) -> Tensor:
     """Checks and optionally pre-processes a categorical feature.
 
     Args:
@@ -701,6 +1299,10 @@ class _InferenceArgsBuilder(tracking.AutoTrackable):
       value: Tensor value of the feature.
       feature_spec: Feature spec (e.g. type, dictionary, statistics) of the
         feature.
+      keep_strings: If true, and if the feature is not already integerized,
+        returns the value as a string tensor instead of converting it to
+        integers.
+      pack_in_op: If true, the integer value is neither cast nor reshaped.
 
     Returns:
       The feature value ready to be consumed by the inference op.
@@ -715,10 +1317,11 @@ class _InferenceArgsBuilder(tracking.AutoTrackable):
       # Native format.
       if not feature_spec.categorical.is_already_integerized:
         # A categorical feature, stored as integer, but not already integerized.
-        value = self.categorical_str_to_int_hashmaps[name].lookup(
-            tf.strings.as_string(value))
+        value = tf.strings.as_string(value)
+        if not keep_strings:
+          value = self.categorical_str_to_int_hashmaps[name].lookup(value)
 
-      if value.dtype != tf.int32:
+      if value.dtype not in [tf.int32, tf.string] and not pack_in_op:
         value = tf.cast(value, tf.int32)
 
     elif value.dtype == tf.string:
@@ -727,7 +1330,8 @@ class _InferenceArgsBuilder(tracking.AutoTrackable):
             "{} was feed as {}. Expecting int32 tensor instead.".format(
                 extended_name, value))
 
-      value = self.categorical_str_to_int_hashmaps[name].lookup(value)
+      if not keep_strings:
+        value = self.categorical_str_to_int_hashmaps[name].lookup(value)
 
     else:
       raise Exception(
@@ -739,7 +1343,8 @@ class _InferenceArgsBuilder(tracking.AutoTrackable):
         raise Exception(
             "{} is expected to have shape [None] or [None, 1]. Got {}  instead."
             .format(extended_name, len(value.shape)))
-      value = value[:, 0]
+      if not pack_in_op:
+        value = value[:, 0]
     elif len(value.shape) != 1:
       raise Exception("{} is expected to have rank 1. Got {}  instead.".format(
           extended_name, len(value.shape)))
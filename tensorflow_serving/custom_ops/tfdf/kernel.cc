@@ -43,19 +43,75 @@
 // as string) or (2) a model_handle (stored as a resource handle).
 //
 #include <algorithm>
+#include <array>
+#include <chrono>  // NOLINT
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <type_traits>
+#include <unordered_map>
 
 #include "absl/status/status.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
 #include "absl/strings/substitute.h"
 #include "tensorflow/core/framework/op_kernel.h"
 #include "tensorflow/core/framework/resource_mgr.h"
+#include "tensorflow/core/framework/tensor_util.h"
+#include "tensorflow/core/lib/monitoring/counter.h"
+#include "tensorflow/core/lib/monitoring/gauge.h"
+#include "tensorflow/core/lib/monitoring/sampler.h"
+#include "tensorflow/core/platform/blocking_counter.h"
+#include "tensorflow/core/platform/cpu_info.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/file_system.h"
+#include "tensorflow/core/platform/fingerprint.h"
+#include "tensorflow/core/platform/hash.h"
+#include "tensorflow/core/platform/mem.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/notification.h"
+#include "tensorflow/core/platform/numa.h"
+#include "tensorflow/core/platform/path.h"
+#include "tensorflow/core/platform/threadpool.h"
 #include "yggdrasil_decision_forests/dataset/data_spec.pb.h"
 #include "yggdrasil_decision_forests/model/abstract_model.h"
+#include "yggdrasil_decision_forests/model/decision_tree/decision_tree.h"
+#include "yggdrasil_decision_forests/model/gradient_boosted_trees/gradient_boosted_trees.h"
 #include "yggdrasil_decision_forests/model/model_library.h"
+#include "yggdrasil_decision_forests/model/random_forest/random_forest.h"
 #include "yggdrasil_decision_forests/utils/compatibility.h"
 #include "yggdrasil_decision_forests/utils/distribution.pb.h"
 #include "yggdrasil_decision_forests/utils/status_macros.h"
 #include "yggdrasil_decision_forests/utils/tensorflow.h"
 
+// The AVX2 tree traversal is compiled with a function-level target attribute
+// and selected at runtime. Therefore, the kernel does not need to be compiled
+// with "-mavx2". Define TFDF_DISABLE_SIMD_TRAVERSAL to remove it.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) && \
+    !defined(TFDF_DISABLE_SIMD_TRAVERSAL)
+#define TFDF_HAS_AVX2_TRAVERSAL 1
+#include <immintrin.h>
+#endif
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace tensorflow_decision_forests {
 namespace ops {
 
@@ -71,6 +127,7 @@ using StatusOr = ::yggdrasil_decision_forests::utils::StatusOr<T>;
 using Task = model::proto::Task;
 
 using OpKernel = tf::OpKernel;
+using AsyncOpKernel = tf::AsyncOpKernel;
 using OpKernelConstruction = tf::OpKernelConstruction;
 using OpKernelContext = tf::OpKernelContext;
 using TensorShape = tf::TensorShape;
@@ -82,6 +139,65 @@ constexpr char kModelContainer[] = "simple_ml_model_serving";
 // Key of the attributes, inputs and outputs the OPs.
 constexpr char kAttributeModelIdentifier[] = "model_identifier";
 constexpr char kAttributeDenseOutputDim[] = "dense_output_dim";
+constexpr char kAttributeTraceStages[] = "trace_stages";
+constexpr char kAttributeMaxNumInferenceShards[] = "max_num_inference_shards";
+constexpr char kAttributeMaxNumTrees[] = "max_num_trees";
+constexpr char kAttributeEarlyExitMargin[] = "early_exit_margin";
+constexpr char kAttributeInferenceEngine[] = "inference_engine";
+constexpr char kAttributeMaxBatchSize[] = "max_batch_size";
+constexpr char kAttributeBatchTimeoutMicros[] = "batch_timeout_micros";
+constexpr char kAttributePredictionCacheSize[] = "prediction_cache_size";
+constexpr char kAttributeNumInferenceThreads[] = "num_inference_threads";
+constexpr char kAttributeInferenceThreadsNumaNode[] =
+    "inference_threads_numa_node";
+constexpr char kAttributeUseHugePages[] = "use_huge_pages";
+constexpr char kAttributePrefaultModelData[] = "prefault_model_data";
+constexpr char kAttributeFlatForestCacheDir[] = "flat_forest_cache_dir";
+constexpr char kAttributeReleaseUnusedFlatForests[] =
+    "release_unused_flat_forests";
+constexpr char kAttributeNumTreeShards[] = "num_tree_shards";
+constexpr char kAttributeTreeShardIndex[] = "tree_shard_index";
+constexpr char kAttributeFinalization[] = "finalization";
+constexpr char kAttributeAutotuneBatchSizes[] = "autotune_batch_sizes";
+constexpr char kAttributeRfLeafTopK[] = "rf_leaf_top_k";
+
+// Values of the "finalization" attribute.
+constexpr char kFinalizationSigmoidBinary[] = "sigmoid_binary";
+constexpr char kFinalizationSoftmax[] = "softmax";
+
+// Possible values of the "inference_engine" attribute.
+constexpr char kInferenceEngineAuto[] = "auto";
+constexpr char kInferenceEngineFast[] = "fast";
+constexpr char kInferenceEngineFlat[] = "flat";
+constexpr char kInferenceEngineFlatMapped[] = "flat_mapped";
+constexpr char kInferenceEngineFlatQuantized[] = "flat_quantized";
+constexpr char kInferenceEngineSlow[] = "slow";
+constexpr char kInferenceEngineAutotune[] = "autotune";
+
+// Engines benchmarked by the "autotune" engine, in order of preference for
+// equal latencies.
+constexpr const char* kAutotunedInferenceEngines[] = {
+    kInferenceEngineFlat, kInferenceEngineFlatQuantized, kInferenceEngineFast};
+
+// Name of the flat forest file, in the model directory, used by the
+// "flat_mapped" engine.
+constexpr char kFlatForestFilename[] = "flat_forest.tfdf";
+
+// Extension of the flat forest files in the "flat_forest_cache_dir" directory.
+// The files are named after the hash of the content of their model.
+constexpr char kFlatForestCacheExtension[] = ".tfdf";
+
+// Extension of the file, next to the flat forest file of a model, recording
+// the engine chosen by the "autotune" engine.
+constexpr char kAutotunedEngineExtension[] = ".autotune";
+
+// Shared library, in the model directory, containing the compiled code of the
+// flat forest of the model (see "FlatForest::GenerateCompiledSource").
+constexpr char kCompiledFlatForestFilename[] = "flat_forest_compiled.so";
+constexpr char kCompiledFlatForestFingerprintSymbol[] =
+    "TfdfCompiledFlatForestFingerprint";
+constexpr char kCompiledFlatForestAccumulateSymbol[] =
+    "TfdfCompiledFlatForestAccumulate";
 
 constexpr char kInputPath[] = "path";
 constexpr char kInputNumericalFeatures[] = "numerical_features";
@@ -94,9 +210,26 @@ constexpr char kInputCategoricalSetIntFeaturesRowSplitsDim1[] =
 constexpr char kInputCategoricalSetIntFeaturesRowSplitsDim2[] =
     "categorical_set_int_features_row_splits_dim_2";
 constexpr char kInputModelHandle[] = "model_handle";
+constexpr char kInputPaths[] = "paths";
+constexpr char kInputOutputPath[] = "output_path";
+constexpr char kInputModelIds[] = "model_ids";
+constexpr char kInputCategoricalStringFeatures[] =
+    "categorical_string_features";
+constexpr char kInputNumericalFeatureValues[] = "numerical_feature_values";
+constexpr char kInputBooleanFeatureValues[] = "boolean_feature_values";
+constexpr char kInputCategoricalIntFeatureValues[] =
+    "categorical_int_feature_values";
+constexpr char kInputPartialPredictions[] = "partial_predictions";
+constexpr char kInputNumericalFeaturesIndices[] = "numerical_features_indices";
+constexpr char kInputNumericalFeaturesValues[] = "numerical_features_values";
+constexpr char kInputNumericalFeaturesRowSplits[] =
+    "numerical_features_row_splits";
 
 constexpr char kOutputDensePredictions[] = "dense_predictions";
 constexpr char kOutputDenseColRepresentation[] = "dense_col_representation";
+constexpr int kOutputDenseColRepresentationIdx = 1;
+constexpr char kOutputFeatureContributions[] = "feature_contributions";
+constexpr char kOutputLeaves[] = "leaves";
 
 // Input tensor values of the model. Does not own the data.
 struct InputTensors {
@@ -133,20 +266,26 @@ struct InputTensors {
   // This value is computed after the struct constructor. The value "-1" is a
   // holding value until the value is computed.
   int batch_size = -1;
+
+  // Index, in a model bank, of the model of each example. Only set by the
+  // model bank inference op. Does not own the data.
+  const int32_t* model_ids = nullptr;
 };
 
 // Output tensor values of the model. Does not own the data.
 struct OutputTensors {
-  OutputTensors(Tensor* dense_predictions_tensor,
-                Tensor* dense_col_representation_tensor, const int output_dim)
+  OutputTensors(Tensor* dense_predictions_tensor, const int output_dim)
       : dense_predictions(dense_predictions_tensor->matrix<float>()),
-        dense_col_representation(
-            dense_col_representation_tensor->flat<tf::tstring>()),
         output_dim(output_dim) {}
 
   tf::TTypes<float>::Matrix dense_predictions;
-  tf::TTypes<tf::tstring>::Flat dense_col_representation;
   const int output_dim;
+
+  // If not null, "batch x num_trees" row-major matrix of the index of the leaf
+  // reached by each example in each tree, or -1 for the trees that are not
+  // evaluated. Only set for the engines supporting it (see
+  // "AbstractInferenceEngine::supports_leaf_outputs").
+  tf::int32* leaves = nullptr;
 };
 
 // Mapping between feature idx (the index used by simpleML to index features),
@@ -216,10 +355,179 @@ class FeatureIndex {
   std::vector<int> categorical_set_int_features_;
 };
 
-// Extracts a categorical-set-int value (i.e. a set of ints) from the tensors
-// into a std::vector<int> representation.
+// Returns the smallest power of two greater or equal to "value" (and at least
+// 1).
+int RoundUpToPowerOfTwo(const int value) {
+  int result = 1;
+  while (result < value) {
+    result <<= 1;
+  }
+  return result;
+}
+
+// String value of the missing non-integerized categorical values stored as
+// int. Aligned with "MISSING_NON_INTEGERIZED_CATEGORICAL_STORED_AS_INT" in
+// :tf_op_py.
+constexpr char kMissingNonIntegerizedCategoricalStoredAsInt[] = "2147483645";
+
+// Dictionaries of the categorical features which are not already integerized,
+// to resolve their string values in the inference op (see
+// "SimpleMLInferenceOpWithCategoricalStrings") instead of with one lookup table
+// op per feature.
+//
+// The dictionaries of all the features are packed in a single open addressing
+// table with linear probing, built when the model is loaded. The table is at
+// most half full, and each slot stores the high bits of the hash of its key:
+// a lookup usually compares a single key.
+class CategoricalDictionaries {
+ public:
+  tf::Status Initialize(const FeatureIndex& feature_index,
+                        const dataset::proto::DataSpecification& data_spec) {
+    const auto& features = feature_index.categorical_int_features();
+    has_dictionary_.assign(features.size(), false);
+    keys_.clear();
+    slots_.clear();
+
+    int num_keys = 0;
+    for (int column_idx = 0; column_idx < features.size(); column_idx++) {
+      const auto& categorical = data_spec.columns(features[column_idx])
+                                    .categorical();
+      if (!categorical.is_already_integerized()) {
+        has_dictionary_[column_idx] = true;
+        // The two representations of the missing value.
+        num_keys += categorical.items_size() + 2;
+      }
+    }
+    if (num_keys == 0) {
+      return tf::Status::OK();
+    }
+    slots_.resize(RoundUpToPowerOfTwo(2 * num_keys));
+    slot_mask_ = slots_.size() - 1;
+
+    for (int column_idx = 0; column_idx < features.size(); column_idx++) {
+      if (!has_dictionary_[column_idx]) {
+        continue;
+      }
+      for (const auto& item :
+           data_spec.columns(features[column_idx]).categorical().items()) {
+        // Note: The item with index "0" is the "out of vocabulary", returned
+        // for all the unknown keys.
+        if (item.second.index() != 0) {
+          TF_RETURN_IF_ERROR(
+              Insert(column_idx, item.first, item.second.index()));
+        }
+      }
+      for (const absl::string_view missing_key :
+           {absl::string_view(""),
+            absl::string_view(kMissingNonIntegerizedCategoricalStoredAsInt)}) {
+        if (Lookup(column_idx, missing_key) == 0) {
+          TF_RETURN_IF_ERROR(Insert(column_idx, missing_key, -1));
+        }
+      }
+    }
+    return tf::Status::OK();
+  }
+
+  // Tests if the "column_idx-th" categorical int feature (in "FeatureIndex")
+  // has a dictionary.
+  bool has_dictionary(const int column_idx) const {
+    return has_dictionary_[column_idx];
+  }
+
+  // Index of "key" in the dictionary of the "column_idx-th" categorical int
+  // feature. 0 (out of vocabulary) if the key is not in the dictionary, and -1
+  // for the missing value (empty string).
+  int32_t Lookup(const int column_idx, const absl::string_view key) const {
+    if (slots_.empty()) {
+      return 0;
+    }
+    const uint64_t hash = Hash(column_idx, key);
+    const uint32_t hash_tag = hash >> 32;
+    for (uint64_t slot_idx = hash & slot_mask_;;
+         slot_idx = (slot_idx + 1) & slot_mask_) {
+      const Slot& slot = slots_[slot_idx];
+      if (slot.column_idx < 0) {
+        return 0;
+      }
+      if (slot.hash_tag == hash_tag && slot.column_idx == column_idx &&
+          absl::string_view(keys_.data() + slot.key_offset, slot.key_size) ==
+              key) {
+        return slot.value;
+      }
+    }
+  }
+
+ private:
+  // A key of the table. Empty if "column_idx" is negative.
+  struct Slot {
+    uint32_t hash_tag = 0;
+    int32_t column_idx = -1;
+    int32_t value = 0;
+    uint32_t key_offset = 0;
+    uint32_t key_size = 0;
+  };
+
+  static uint64_t Hash(const int column_idx, const absl::string_view key) {
+    return tf::Hash64(key.data(), key.size(), column_idx);
+  }
+
+  // Adds a key not in the table yet.
+  tf::Status Insert(const int column_idx, const absl::string_view key,
+                    const int32_t value) {
+    if (keys_.size() + key.size() > std::numeric_limits<uint32_t>::max()) {
+      return tf::errors::InvalidArgument(
+          "The categorical dictionaries of the model are too large.");
+    }
+    const uint64_t hash = Hash(column_idx, key);
+    uint64_t slot_idx = hash & slot_mask_;
+    while (slots_[slot_idx].column_idx >= 0) {
+      slot_idx = (slot_idx + 1) & slot_mask_;
+    }
+    Slot& slot = slots_[slot_idx];
+    slot.hash_tag = hash >> 32;
+    slot.column_idx = column_idx;
+    slot.value = value;
+    slot.key_offset = keys_.size();
+    slot.key_size = key.size();
+    keys_.append(key.data(), key.size());
+    return tf::Status::OK();
+  }
+
+  // "has_dictionary_[i]" tells if the "i-th" categorical int feature has a
+  // dictionary.
+  std::vector<bool> has_dictionary_;
+  // Concatenated keys of all the dictionaries.
+  std::string keys_;
+  // Open addressing table. Its size is a power of two.
+  std::vector<Slot> slots_;
+  uint64_t slot_mask_ = 0;
+};
+
+// Categorical-set-int values (i.e. sets of ints) of one feature for a range of
+// examples, in a compressed sparse row layout: The items of the "i-th" example
+// of the range are "items[row_splits[i]:row_splits[i+1]]".
 //
-// By convention, a meeting value is represented as [-1].
+// By convention, a missing value is represented as [-1].
+struct CategoricalSetIntColumn {
+  int num_examples() const { return row_splits.size() - 1; }
+  const int32_t* begin(const int example_idx) const {
+    return items.data() + row_splits[example_idx];
+  }
+  const int32_t* end(const int example_idx) const {
+    return items.data() + row_splits[example_idx + 1];
+  }
+  bool IsMissing(const int example_idx) const {
+    return row_splits[example_idx] != row_splits[example_idx + 1] &&
+           items[row_splits[example_idx]] < 0;
+  }
+
+  std::vector<int32_t> items;
+  std::vector<int64_t> row_splits;
+};
+
+// Extracts the categorical-set-int values of the examples [begin, end) (i.e.
+// sets of ints) from the ragged input tensors into "column". The allocated
+// memory of "column" is re-used in between calls.
 //
 // Args:
 //   - inputs: All the input tensors.
@@ -228,46 +536,297 @@ class FeatureIndex {
 //   - tensor_col_idx: Column, in "inputs", containing the feature.
 //   - max_value: Maximum value of the items. Items above or equal to this value
 //     will be considered out-of-vocabulary.
-tf::Status ExtractCategoricalSetInt(const InputTensors& inputs,
-                                    const FeatureIndex& feature_index,
-                                    const int tensor_col_idx,
-                                    const int max_value, const int example_idx,
-                                    std::vector<int32_t>* values) {
-  if (inputs.categorical_set_int_features_row_splits_dim_2(example_idx) !=
-      example_idx * feature_index.categorical_set_int_features().size()) {
+tf::Status ExtractCategoricalSetIntColumn(const InputTensors& inputs,
+                                          const FeatureIndex& feature_index,
+                                          const int tensor_col_idx,
+                                          const int max_value, const int begin,
+                                          const int end,
+                                          CategoricalSetIntColumn* column) {
+  // Note: The categorical-set values are stored in a "two levels" ragged
+  // tensor i.e. a ragged tensor inside of another one, shaped
+  // "[batch_size, num_features, set_size]", where "set_size" is the only
+  // ragged dimension.
+  const int64_t num_features =
+      feature_index.categorical_set_int_features().size();
+  const auto& row_splits_dim_1 =
+      inputs.categorical_set_int_features_row_splits_dim_1;
+  const auto& row_splits_dim_2 =
+      inputs.categorical_set_int_features_row_splits_dim_2;
+  if (end > row_splits_dim_2.size() ||
+      (end - 1) * num_features + tensor_col_idx + 1 >=
+          row_splits_dim_1.size()) {
     return tf::Status(tf::error::INTERNAL,
-                      "Unexpected features_row_splits_dim_2 size.");
+                      "Unexpected features_row_splits size.");
   }
 
-  const int d1_cell =
-      example_idx * feature_index.categorical_set_int_features().size() +
-      tensor_col_idx;
-  if (d1_cell + 1 >=
-      inputs.categorical_set_int_features_row_splits_dim_1.size()) {
-    return tf::Status(tf::error::INTERNAL,
-                      "Unexpected features_row_splits_dim_1 size.");
+  // Compute the row splits of the range.
+  auto& row_splits = column->row_splits;
+  row_splits.resize(end - begin + 1);
+  row_splits[0] = 0;
+  for (int example_idx = begin; example_idx < end; example_idx++) {
+    if (row_splits_dim_2(example_idx) != example_idx * num_features) {
+      return tf::Status(tf::error::INTERNAL,
+                        "Unexpected features_row_splits_dim_2 size.");
+    }
+    const int64_t d1_cell = example_idx * num_features + tensor_col_idx;
+    row_splits[example_idx - begin + 1] =
+        row_splits[example_idx - begin] + row_splits_dim_1(d1_cell + 1) -
+        row_splits_dim_1(d1_cell);
+  }
+
+  // Copy the items. The items of the range are contiguous for each example.
+  auto& items = column->items;
+  items.resize(row_splits.back());
+  const int32_t* const values =
+      inputs.categorical_set_int_features_values.data();
+  for (int example_idx = begin; example_idx < end; example_idx++) {
+    const int32_t* src =
+        values + row_splits_dim_1(example_idx * num_features + tensor_col_idx);
+    int32_t* dst = items.data() + row_splits[example_idx - begin];
+    const int64_t num_items = row_splits[example_idx - begin + 1] -
+                              row_splits[example_idx - begin];
+    for (int64_t item_idx = 0; item_idx < num_items; item_idx++) {
+      const int32_t value = src[item_idx];
+      // Note: -1 (missing) is preserved.
+      dst[item_idx] = (value >= -1 && value < max_value) ? value : 0;
+    }
+  }
+  return tf::Status::OK();
+}
+
+// Checks that the row splits of the categorical-set-int values of "inputs" are
+// consistent with "num_features" features and the batch size, so that the
+// items of any example and feature can be read without further checks.
+tf::Status CheckCategoricalSetRowSplits(const InputTensors& inputs,
+                                        const int num_features) {
+  if (num_features == 0 || inputs.batch_size == 0) {
+    return tf::Status::OK();
+  }
+  const auto& row_splits_dim_1 =
+      inputs.categorical_set_int_features_row_splits_dim_1;
+  const auto& row_splits_dim_2 =
+      inputs.categorical_set_int_features_row_splits_dim_2;
+  if (row_splits_dim_2.size() != inputs.batch_size + 1 ||
+      row_splits_dim_1.size() !=
+          int64_t{inputs.batch_size} * num_features + 1) {
+    return tf::errors::InvalidArgument(
+        "Unexpected size of the categorical set features row splits.");
+  }
+  for (int example_idx = 0; example_idx <= inputs.batch_size; example_idx++) {
+    if (row_splits_dim_2(example_idx) != int64_t{example_idx} * num_features) {
+      return tf::errors::InvalidArgument(
+          "Unexpected categorical_set_int_features_row_splits_dim_2 values.");
+    }
+  }
+  for (int64_t cell = 0; cell + 1 < row_splits_dim_1.size(); cell++) {
+    if (row_splits_dim_1(cell) > row_splits_dim_1(cell + 1)) {
+      return tf::errors::InvalidArgument(
+          "The categorical_set_int_features_row_splits_dim_1 are not sorted.");
+    }
+  }
+  if (row_splits_dim_1(0) < 0 ||
+      row_splits_dim_1(row_splits_dim_1.size() - 1) >
+          inputs.categorical_set_int_features_values.size()) {
+    return tf::errors::InvalidArgument(
+        "The categorical_set_int_features_row_splits_dim_1 are outside of the "
+        "categorical_set_int_features_values.");
   }
+  return tf::Status::OK();
+}
+
+// Options of a call to "AbstractInferenceEngine::RunInference".
+struct InferenceOptions {
+  // Minimum number of examples in a shard. Smaller batches are not sharded.
+  static constexpr int kMinNumExamplesPerShard = 256;
+
+  // Maximum number of shards of a batch. The shards are run in parallel on
+  // "thread_pool". Engines that don't support sharding ignore this value.
+  int max_num_shards = 1;
 
-  const int begin_idx =
-      inputs.categorical_set_int_features_row_splits_dim_1(d1_cell);
-  const int end_idx =
-      inputs.categorical_set_int_features_row_splits_dim_1(d1_cell + 1);
+  // Thread pool used to run the shards. Does not own the pool. Can be null if
+  // "max_num_shards" is 1.
+  tf::thread::ThreadPool* thread_pool = nullptr;
 
-  // Note: The items of the "example_idx"-th example and "col_idx"-th
-  // categorical-set feature are "values[begin_idx:end_idx]".
-  const int num_items = end_idx - begin_idx;
-  values->resize(num_items);
-  for (int item_idx = 0; item_idx < num_items; item_idx++) {
-    auto value =
-        inputs.categorical_set_int_features_values(item_idx + begin_idx);
-    if (value < -1 || value >= max_value) {
-      value = 0;
+  // Maximum number of trees evaluated for each example. 0 evaluates all the
+  // trees. Only supported by the flat forest engines.
+  int max_num_trees = 0;
+
+  // If positive, the evaluation of the examples of a binary classification
+  // gradient boosted trees model stops once the absolute logit exceeds this
+  // value, or once the remaining trees cannot change the predicted class. Only
+  // supported by the flat forest engines.
+  float early_exit_margin = 0.f;
+
+  // Tests if the options request to evaluate only part of the forest.
+  bool UsesPartialEvaluation() const {
+    return max_num_trees > 0 || early_exit_margin > 0.f;
+  }
+
+  // Number of shards to use for a batch.
+  int NumShards(const int batch_size) const {
+    if (thread_pool == nullptr) {
+      return 1;
     }
-    (*values)[item_idx] = value;
+    return std::max(
+        1, std::min(max_num_shards, batch_size / kMinNumExamplesPerShard));
+  }
+};
+
+// Returns an error if "options" request a partial evaluation of the forest.
+// Used by the engines that always evaluate the full model.
+tf::Status CheckFullEvaluation(const InferenceOptions& options) {
+  if (options.UsesPartialEvaluation()) {
+    return tf::Status(
+        tf::error::INVALID_ARGUMENT,
+        "\"max_num_trees\" and \"early_exit_margin\" are only supported by "
+        "the flat forest engines.");
+  }
+  return tf::Status::OK();
+}
+
+// Splits the examples [0, batch_size) into "num_shards" contiguous shards of
+// (almost) equal size, and calls "run_shard(shard_idx, begin, end)" on each
+// shard in parallel on "thread_pool". The first shard runs on the calling
+// thread. Returns the first error, if any.
+tf::Status RunShardsInParallel(
+    tf::thread::ThreadPool* thread_pool, const int num_shards,
+    const int batch_size,
+    const std::function<tf::Status(int shard_idx, int begin, int end)>&
+        run_shard) {
+  const int num_examples_per_shard = (batch_size + num_shards - 1) / num_shards;
+  std::vector<tf::Status> shard_status(num_shards);
+  const auto run_shard_idx = [&](const int shard_idx) {
+    // With more shards than examples to spare, the last shards are empty.
+    const int begin = std::min(batch_size, shard_idx * num_examples_per_shard);
+    const int end = std::min(batch_size, begin + num_examples_per_shard);
+    shard_status[shard_idx] = run_shard(shard_idx, begin, end);
+  };
+
+  tf::BlockingCounter pending_shards(num_shards - 1);
+  for (int shard_idx = 1; shard_idx < num_shards; shard_idx++) {
+    thread_pool->Schedule([&, shard_idx]() {
+      run_shard_idx(shard_idx);
+      pending_shards.DecrementCount();
+    });
+  }
+  run_shard_idx(0);
+  pending_shards.Wait();
+
+  for (const auto& status : shard_status) {
+    TF_RETURN_IF_ERROR(status);
   }
   return tf::Status::OK();
 }
 
+// Stage tracing can be removed at compile time with
+// "--copt=-DTFDF_DISABLE_STAGE_TRACING".
+#ifdef TFDF_DISABLE_STAGE_TRACING
+constexpr bool kStageTracingCompiledIn = false;
+#else
+constexpr bool kStageTracingCompiledIn = true;
+#endif
+
+auto* inference_stage_latency = tf::monitoring::Sampler<2>::New(
+    {
+        "/tensorflow/serving/tfdf/inference_stage_latency",
+        "Distribution of wall time (in microseconds) of the stages of the "
+        "TF-DF inference op. Only recorded for the inference ops with stage "
+        "tracing enabled.",
+        "model",
+        "stage",
+    },  // Scale of 1, power of 1.8 with bucket count 30 (~40 seconds).
+    tf::monitoring::Buckets::Exponential(1, 1.8, 30));
+
+auto* prediction_cache_lookups = tf::monitoring::Counter<2>::New(
+    "/tensorflow/serving/tfdf/prediction_cache_lookups",
+    "Number of examples looked up in the prediction cache of a model by the "
+    "TF-DF inference op. Only the misses are evaluated.",
+    "model", "result");
+
+// Stages of a call to the inference op.
+enum class InferenceStage {
+  kLinkInputs = 0,
+  kSetExamples,
+  kPredict,
+  kExportOutputs,
+  kNumStages,
+};
+
+// Name of the stages used as "stage" label in "inference_stage_latency".
+constexpr const char* kInferenceStageNames[] = {
+    "link_inputs",
+    "set_examples",
+    "predict",
+    "export_outputs",
+};
+
+// Measures the wall time of the stages of a single call to the inference op.
+// All the methods are no-op if the timer is disabled, so the timer can stay on
+// the hot path.
+//
+// Not thread safe.
+class StageTimer {
+ public:
+  // Resets the past measures, and enables or disables the timer.
+  void Reset(const bool enabled) {
+    enabled_ = kStageTracingCompiledIn && enabled;
+    if (!enabled_) {
+      return;
+    }
+    std::fill(std::begin(durations_us_), std::end(durations_us_), 0);
+    current_stage_ = InferenceStage::kNumStages;
+  }
+
+  // Ends the current stage (if any) and starts "stage".
+  void Start(const InferenceStage stage) {
+    if (!enabled_) {
+      return;
+    }
+    const auto now_us = tf::Env::Default()->NowMicros();
+    CloseCurrentStage(now_us);
+    current_stage_ = stage;
+    stage_begin_us_ = now_us;
+  }
+
+  // Ends the current stage (if any).
+  void Stop() {
+    if (!enabled_) {
+      return;
+    }
+    CloseCurrentStage(tf::Env::Default()->NowMicros());
+    current_stage_ = InferenceStage::kNumStages;
+  }
+
+  // Records the measured stages in the "inference_stage_latency" histogram.
+  void Export(const std::string& model) const {
+    if (!enabled_) {
+      return;
+    }
+    for (int stage_idx = 0;
+         stage_idx < static_cast<int>(InferenceStage::kNumStages);
+         stage_idx++) {
+      inference_stage_latency
+          ->GetCell(model, kInferenceStageNames[stage_idx])
+          ->Add(durations_us_[stage_idx]);
+    }
+  }
+
+ private:
+  void CloseCurrentStage(const tf::uint64 now_us) {
+    if (current_stage_ != InferenceStage::kNumStages) {
+      durations_us_[static_cast<int>(current_stage_)] +=
+          now_us - stage_begin_us_;
+    }
+  }
+
+  bool enabled_ = false;
+  InferenceStage current_stage_ = InferenceStage::kNumStages;
+  tf::uint64 stage_begin_us_ = 0;
+  tf::uint64 durations_us_[static_cast<int>(InferenceStage::kNumStages)] = {};
+};
+
+class FlatForest;
+
 // Wrapping around an inference engine able to run a model.
 class AbstractInferenceEngine {
  public:
@@ -280,6 +839,12 @@ class AbstractInferenceEngine {
   class AbstractCache {
    public:
     virtual ~AbstractCache() = default;
+
+    // Timer of the stages of the inference call currently using this cache.
+    StageTimer* stage_timer() { return &stage_timer_; }
+
+   private:
+    StageTimer stage_timer_;
   };
 
   // Creates a cache: one per inference op instance.
@@ -288,8 +853,17 @@ class AbstractInferenceEngine {
   // Run the inference of the model. The output tensors are already allocated.
   virtual tf::Status RunInference(const InputTensors& inputs,
                                   const FeatureIndex& feature_index,
+                                  const InferenceOptions& options,
                                   OutputTensors* outputs,
                                   AbstractCache* cache) const = 0;
+
+  // Forest evaluated by the engine, if the engine evaluates a "FlatForest".
+  // Null otherwise.
+  virtual const FlatForest* flat_forest() const { return nullptr; }
+
+  // Tests if "RunInference" sets the "leaves" of the outputs, in the same
+  // traversal of the trees as the predictions.
+  virtual bool supports_leaf_outputs() const { return false; }
 };
 
 // The generic engine uses the generic serving API
@@ -304,6 +878,14 @@ class GenericInferenceEngine : public AbstractInferenceEngine {
    private:
     dataset::VerticalDataset dataset_;
 
+    // Number of rows allocated in the fixed-size columns of "dataset_" i.e.
+    // the largest batch size seen so far. The columns are only resized when
+    // a larger batch is received.
+    int num_rows_in_columns_ = 0;
+
+    // Buffer of the categorical-set features.
+    CategoricalSetIntColumn categorical_set_buffer_;
+
     friend GenericInferenceEngine;
   };
 
@@ -316,17 +898,24 @@ class GenericInferenceEngine : public AbstractInferenceEngine {
 
   tf::Status RunInference(const InputTensors& inputs,
                           const FeatureIndex& feature_index,
+                          const InferenceOptions& options,
                           OutputTensors* outputs,
                           AbstractCache* abstract_cache) const override {
+    TF_RETURN_IF_ERROR(CheckFullEvaluation(options));
+
     // Update the vertical dataset with the input tensors.
-    LOG(INFO) << "-----GenericInferenceEngine";
     auto* cache = dynamic_cast<Cache*>(abstract_cache);
     if (cache == nullptr) {
       return tf::Status(tf::error::INTERNAL, "Unexpected cache type.");
     }
+    cache->stage_timer()->Start(InferenceStage::kSetExamples);
     TF_RETURN_IF_ERROR(SetVerticalDataset(inputs, feature_index, cache));
 
     // Run the model.
+    //
+    // Note: The prediction and the export of the predictions are interleaved,
+    // and accounted as the "predict" stage.
+    cache->stage_timer()->Start(InferenceStage::kPredict);
     model::proto::Prediction prediction;
     for (int example_idx = 0; example_idx < inputs.batch_size; example_idx++) {
       model_->Predict(cache->dataset_, example_idx, &prediction);
@@ -334,22 +923,21 @@ class GenericInferenceEngine : public AbstractInferenceEngine {
       // Copy the predictions to the output tensor.
       switch (model_->task()) {
         case Task::CLASSIFICATION: {
-          const auto& pred = prediction.classification();
-          // Note: "pred" contains a probability for each possible classes.
-          // Because the label is categorical, the first label value (i.e. index
-          // 0) is reserved for the Out-of-vocabulary value. As simpleML models
-          // are not expected to output such value, we skip it (see the ".. - 1"
-          // and ".. + 1" in the next part of the code).
+          const auto& distribution = prediction.classification().distribution();
+          // Note: "distribution" contains a probability for each possible
+          // classes. Because the label is categorical, the first label value
+          // (i.e. index 0) is reserved for the Out-of-vocabulary value. As
+          // simpleML models are not expected to output such value, we skip it
+          // (see the ".. - 1" and ".. + 1" in the next part of the code).
           DCHECK_EQ(outputs->dense_predictions.dimension(1),
                     outputs->output_dim);
           DCHECK_EQ(outputs->dense_predictions.dimension(1),
-                    pred.distribution().counts().size() - 1);
+                    distribution.counts().size() - 1);
+          const float inv_sum = 1.f / distribution.sum();
           for (int class_idx = 0; class_idx < outputs->output_dim;
                class_idx++) {
             const float probability =
-                prediction.classification().distribution().counts(class_idx +
-                                                                  1) /
-                prediction.classification().distribution().sum();
+                distribution.counts(class_idx + 1) * inv_sum;
             outputs->dense_predictions(example_idx, class_idx) =
                 utils::clamp(probability, 0.f, 1.f);
           }
@@ -376,6 +964,10 @@ class GenericInferenceEngine : public AbstractInferenceEngine {
   tf::Status SetVerticalDataset(const InputTensors& inputs,
                                 const FeatureIndex& feature_index,
                                 Cache* cache) const {
+    // The fixed-size columns are kept at the largest batch size seen so far
+    // (high-water mark), and only the first "batch_size" rows are set and
+    // used. This avoids re-sizing (and re-initializing) them at each call.
+    const bool grow_columns = inputs.batch_size > cache->num_rows_in_columns_;
     cache->dataset_.set_nrow(inputs.batch_size);
     // Numerical features.
     for (int col_idx = 0; col_idx < feature_index.numerical_features().size();
@@ -386,7 +978,9 @@ class GenericInferenceEngine : public AbstractInferenceEngine {
       if (col == nullptr) {
         return tf::Status(tf::error::INTERNAL, "Unexpected column type.");
       }
-      col->Resize(inputs.batch_size);
+      if (grow_columns) {
+        col->Resize(inputs.batch_size);
+      }
       auto& dst = *col->mutable_values();
       for (int example_idx = 0; example_idx < inputs.batch_size;
            example_idx++) {
@@ -404,7 +998,9 @@ class GenericInferenceEngine : public AbstractInferenceEngine {
       if (col == nullptr) {
         return tf::Status(tf::error::INTERNAL, "Unexpected column type.");
       }
-      col->Resize(inputs.batch_size);
+      if (grow_columns) {
+        col->Resize(inputs.batch_size);
+      }
       auto& dst = *col->mutable_values();
       for (int example_idx = 0; example_idx < inputs.batch_size;
            example_idx++) {
@@ -430,7 +1026,9 @@ class GenericInferenceEngine : public AbstractInferenceEngine {
       if (col == nullptr) {
         return tf::Status(tf::error::INTERNAL, "Unexpected column type.");
       }
-      col->Resize(inputs.batch_size);
+      if (grow_columns) {
+        col->Resize(inputs.batch_size);
+      }
       const int max_value = cache->dataset_.data_spec()
                                 .columns(feature_idx)
                                 .categorical()
@@ -447,14 +1045,7 @@ class GenericInferenceEngine : public AbstractInferenceEngine {
     }
 
     // Categorical set int features.
-    //
-    // Note: The categorical-set values are stored in a "two levels" ragged
-    // tensor i.e. a ragged tensor inside of another one, shaped
-    // "[batch_size, num_features, set_size]", where "set_size" is the only
-    // ragged dimension.
-    // In other words, "value[i,j,k]" is the "k-th" item, of the "j-th" feature,
-    // of the "i-th" example.
-    std::vector<int> tmp_values;
+    auto& buffer = cache->categorical_set_buffer_;
     for (int col_idx = 0;
          col_idx < feature_index.categorical_set_int_features().size();
          col_idx++) {
@@ -465,30 +1056,32 @@ class GenericInferenceEngine : public AbstractInferenceEngine {
       if (col == nullptr) {
         return tf::Status(tf::error::INTERNAL, "Unexpected column type.");
       }
+      // Note: Categorical-set values are stored in a variable-size item bank
+      // and are re-set for each example. This column is always re-sized.
       col->Resize(inputs.batch_size);
 
       const int max_value = cache->dataset_.data_spec()
                                 .columns(feature_idx)
                                 .categorical()
                                 .number_of_unique_values();
+      TF_RETURN_IF_ERROR(ExtractCategoricalSetIntColumn(
+          inputs, feature_index, col_idx, max_value, 0, inputs.batch_size,
+          &buffer));
 
       for (int example_idx = 0; example_idx < inputs.batch_size;
            example_idx++) {
-        const auto status =
-            ExtractCategoricalSetInt(inputs, feature_index, col_idx, max_value,
-                                     example_idx, &tmp_values);
-        if (!status.ok()) {
-          return status;
-        }
-
-        if (!tmp_values.empty() && tmp_values.front() < 0) {
+        if (buffer.IsMissing(example_idx)) {
           col->SetNA(example_idx);
         } else {
-          col->SetIter(example_idx, tmp_values.begin(), tmp_values.end());
+          col->SetIter(example_idx, buffer.begin(example_idx),
+                       buffer.end(example_idx));
         }
       }
     }
 
+    if (grow_columns) {
+      cache->num_rows_in_columns_ = inputs.batch_size;
+    }
     return tf::Status::OK();
   }
 
@@ -500,6 +1093,13 @@ class GenericInferenceEngine : public AbstractInferenceEngine {
 // significantly (e.g. up to 20x) faster than "GenericInferenceEngine".
 class SemiFastGenericInferenceEngine : public AbstractInferenceEngine {
  public:
+  // Number of inference calls in between two checks of the example cache size.
+  static constexpr int kExampleCacheShrinkWindow = 64;
+
+  // The example cache is shrunk if it is larger than this ratio times the
+  // high-water mark of the last window.
+  static constexpr int kExampleCacheShrinkRatio = 4;
+
   static StatusOr<std::unique_ptr<SemiFastGenericInferenceEngine>> Create(
       std::unique_ptr<serving::FastEngine> engine,
       const model::AbstractModel& model, const FeatureIndex& feature_index) {
@@ -511,79 +1111,77 @@ class SemiFastGenericInferenceEngine : public AbstractInferenceEngine {
 
   class Cache : public AbstractCache {
    private:
+    // Buffers used to run the inference on a contiguous range of examples.
+    struct Shard {
+      // Cache of pre-allocated predictions.
+      std::vector<float> predictions_;
+
+      // Cache of pre-allocated examples.
+      std::unique_ptr<serving::AbstractExampleSet> examples_;
+
+      // Number of examples allocated in "examples_". Always a power of two.
+      int num_examples_in_cache_ = -1;
+
+      // High-water mark of the number of examples in the current window of
+      // calls (see "ReserveExamples").
+      int window_max_num_examples_ = 0;
+      int num_calls_in_window_ = 0;
 
-    // Cache of pre-allocated predictions.
-    std::vector<float> predictions_;
+      // Buffer of the categorical int features.
+      std::vector<int32_t> categorical_int_buffer_;
 
-    // Cache of pre-allocated examples.
-    std::unique_ptr<serving::AbstractExampleSet> examples_;
+      // Buffer of the categorical-set features.
+      CategoricalSetIntColumn categorical_set_buffer_;
+    };
 
-    // Number of examples allocated in "examples_".
-    int num_examples_in_cache_ = -1;
+    // Buffers of each shard. Contains at least one shard (used when the batch
+    // is not sharded).
+    std::vector<Shard> shards_;
 
     friend SemiFastGenericInferenceEngine;
   };
 
   StatusOr<std::unique_ptr<AbstractCache>> CreateCache() const override {
     auto cache = absl::make_unique<SemiFastGenericInferenceEngine::Cache>();
-    cache->examples_ = engine_->AllocateExamples(1);
-    cache->num_examples_in_cache_ = 1;
+    cache->shards_.resize(1);
+    cache->shards_.front().examples_ = engine_->AllocateExamples(1);
+    cache->shards_.front().num_examples_in_cache_ = 1;
     return cache;
   }
 
   tf::Status RunInference(const InputTensors& inputs,
                           const FeatureIndex& feature_index,
+                          const InferenceOptions& options,
                           OutputTensors* outputs,
                           AbstractCache* abstract_cache) const override {
-    // Update the vertical dataset with the input tensors.
-    LOG(INFO) << "-----Before Cache";
+    TF_RETURN_IF_ERROR(CheckFullEvaluation(options));
     auto* cache = dynamic_cast<Cache*>(abstract_cache);
     if (cache == nullptr) {
       return tf::Status(tf::error::INTERNAL, "Unexpected cache type.");
     }
-    LOG(INFO) << "-----step1";
-    // Allocate a cache of examples.
-    if (cache->num_examples_in_cache_ < inputs.batch_size) {
-      cache->examples_ = engine_->AllocateExamples(inputs.batch_size);
-      cache->num_examples_in_cache_ = inputs.batch_size;
-    }
-    LOG(INFO) << "-----step2";
 
-    // Copy the example data in the format expected by the engine.
-    TF_RETURN_IF_ERROR(
-        SetExamples(inputs, feature_index, cache->examples_.get()));
-LOG(INFO) << "-----step3";
-    // Run the model.
-    engine_->Predict(*cache->examples_, inputs.batch_size,
-                     &cache->predictions_);
-LOG(INFO) << "-----step4";
-    // Export the predictions.
-    if (decompact_probability_) {
-      DCHECK_EQ(outputs->output_dim, 2);
-      DCHECK_EQ(engine_->NumPredictionDimension(), 1);
-      for (int example_idx = 0; example_idx < inputs.batch_size;
-           example_idx++) {
-	LOG(INFO) << "-----step5";
-        const float proba =
-            utils::clamp(cache->predictions_[example_idx], 0.f, 1.f);
-        outputs->dense_predictions(example_idx, 0) = 1.f - proba;
-        outputs->dense_predictions(example_idx, 1) = proba;
-      }
+    const int num_shards = options.NumShards(inputs.batch_size);
+    if (num_shards <= 1) {
+      return RunInferenceOnRange(inputs, feature_index, 0, inputs.batch_size,
+                                 outputs, cache->stage_timer(),
+                                 &cache->shards_.front());
+    }
 
-    } else {
-	    LOG(INFO) << "-----step6";
-      DCHECK_EQ(outputs->output_dim, engine_->NumPredictionDimension());
-      for (int example_idx = 0; example_idx < inputs.batch_size;
-           example_idx++) {
-        for (int class_idx = 0; class_idx < outputs->output_dim; class_idx++) {
-          const float value =
-              cache
-                  ->predictions_[example_idx * outputs->output_dim + class_idx];
-          outputs->dense_predictions(example_idx, class_idx) = value;
-        }
-      }
+    // Run the shards in parallel. The first shard runs on the calling thread.
+    //
+    // Note: The stages are not measured individually in the shards.
+    cache->stage_timer()->Start(InferenceStage::kPredict);
+    if (cache->shards_.size() < num_shards) {
+      cache->shards_.resize(num_shards);
     }
-    return tf::Status::OK();
+    return RunShardsInParallel(
+        options.thread_pool, num_shards, inputs.batch_size,
+        [&](const int shard_idx, const int begin, const int end) {
+          StageTimer disabled_stage_timer;
+          return RunInferenceOnRange(inputs, feature_index, begin, end,
+                                     outputs, &disabled_stage_timer,
+                                     &cache->shards_[shard_idx]);
+        });
   }
 
  private:
@@ -597,7 +1195,6 @@ LOG(INFO) << "-----step4";
 
   absl::Status Initialize(FeatureIndex feature_index) {
     // Register numerical features.
-    LOG(INFO) << "-----SemiFast initialise";
     for (int tensor_col = 0;
          tensor_col < feature_index.numerical_features().size(); tensor_col++) {
       const auto dataspec_idx = feature_index.numerical_features()[tensor_col];
@@ -609,7 +1206,8 @@ LOG(INFO) << "-----step4";
       }
       numerical_features_.push_back({/*.tensor_col =*/tensor_col,
                                      /*.dataspec_idx = */ dataspec_idx,
-                                     /*.example_set_id =*/feature_id.value()});
+                                     /*.example_set_id =*/feature_id.value(),
+                                     /*.max_value =*/0});
     }
 
     // Register categorical int features.
@@ -627,7 +1225,8 @@ LOG(INFO) << "-----step4";
       categorical_int_features_.push_back(
           {/*.tensor_col =*/tensor_col,
            /*.dataspec_idx =*/dataspec_idx,
-           /*.example_set_id =*/feature_id.value()});
+           /*.example_set_id =*/feature_id.value(),
+           /*.max_value =*/NumberOfUniqueValues(dataspec_idx)});
     }
 
     // Register categorical set int features.
@@ -645,7 +1244,8 @@ LOG(INFO) << "-----step4";
       categorical_set_int_features_.push_back(
           {/*.tensor_col =*/tensor_col,
            /*.dataspec_idx =*/dataspec_idx,
-           /*.example_set_id =*/feature_id.value()});
+           /*.example_set_id =*/feature_id.value(),
+           /*.max_value =*/NumberOfUniqueValues(dataspec_idx)});
     }
 
     if (!feature_index.boolean_features().empty()) {
@@ -655,77 +1255,172 @@ LOG(INFO) << "-----step4";
     return absl::OkStatus();
   }
 
-  // Copy the content of "inputs" into "examples".
-  // "examples" is allocated with at least "inputs.batch_size" examples.
-  tf::Status SetExamples(const InputTensors& inputs,
-                         const FeatureIndex& feature_index,
-                         serving::AbstractExampleSet* examples) const {
+  // Number of unique values of a categorical feature.
+  int NumberOfUniqueValues(const int dataspec_idx) const {
+    return engine_->features()
+        .data_spec()
+        .columns(dataspec_idx)
+        .categorical()
+        .number_of_unique_values();
+  }
+
+  // Runs the inference on the examples [begin, end) of "inputs", and exports
+  // the predictions in the same rows of "outputs".
+  tf::Status RunInferenceOnRange(const InputTensors& inputs,
+                                 const FeatureIndex& feature_index,
+                                 const int begin, const int end,
+                                 OutputTensors* outputs,
+                                 StageTimer* stage_timer,
+                                 Cache::Shard* shard) const {
+    const int num_examples = end - begin;
+
+    // Allocate a cache of examples.
+    ReserveExamples(num_examples, shard);
+
+    // Copy the example data in the format expected by the engine.
+    stage_timer->Start(InferenceStage::kSetExamples);
+    TF_RETURN_IF_ERROR(SetExamples(inputs, feature_index, begin, end,
+                                   shard->examples_.get(),
+                                   &shard->categorical_int_buffer_,
+                                   &shard->categorical_set_buffer_));
+
+    // Run the model.
+    stage_timer->Start(InferenceStage::kPredict);
+    engine_->Predict(*shard->examples_, num_examples, &shard->predictions_);
+
+    // Export the predictions.
+    stage_timer->Start(InferenceStage::kExportOutputs);
+    if (decompact_probability_) {
+      DCHECK_EQ(outputs->output_dim, 2);
+      DCHECK_EQ(engine_->NumPredictionDimension(), 1);
+      for (int example_idx = 0; example_idx < num_examples; example_idx++) {
+        const float proba =
+            utils::clamp(shard->predictions_[example_idx], 0.f, 1.f);
+        outputs->dense_predictions(begin + example_idx, 0) = 1.f - proba;
+        outputs->dense_predictions(begin + example_idx, 1) = proba;
+      }
+
+    } else {
+      DCHECK_EQ(outputs->output_dim, engine_->NumPredictionDimension());
+      // Note: The engine predictions and the rows of the output tensor have the
+      // same (example-major) layout.
+      const int output_dim = outputs->output_dim;
+      std::copy(shard->predictions_.begin(),
+                shard->predictions_.begin() + num_examples * output_dim,
+                outputs->dense_predictions.data() + begin * output_dim);
+    }
+    return tf::Status::OK();
+  }
+
+  // Makes sure "shard" can hold at least "num_examples" examples.
+  //
+  // The example sets are allocated with power-of-two sizes. The high-water mark
+  // of the number of examples is tracked over windows of
+  // "kExampleCacheShrinkWindow" calls: At the end of a window, if the allocated
+  // capacity is more than "kExampleCacheShrinkRatio" times the (rounded)
+  // high-water mark of the window, the buffers are re-allocated at the
+  // high-water mark. Therefore, a rare large batch does not pin its memory for
+  // the life of the cache, while batches of usual sizes never allocate.
+  void ReserveExamples(const int num_examples, Cache::Shard* shard) const {
+    shard->window_max_num_examples_ =
+        std::max(shard->window_max_num_examples_, num_examples);
+    if (++shard->num_calls_in_window_ >= kExampleCacheShrinkWindow) {
+      const int target = RoundUpToPowerOfTwo(shard->window_max_num_examples_);
+      if (shard->num_examples_in_cache_ > kExampleCacheShrinkRatio * target) {
+        shard->examples_ = engine_->AllocateExamples(target);
+        shard->num_examples_in_cache_ = target;
+        shard->predictions_.clear();
+        shard->predictions_.shrink_to_fit();
+      }
+      shard->window_max_num_examples_ = 0;
+      shard->num_calls_in_window_ = 0;
+    }
+
+    if (shard->num_examples_in_cache_ < num_examples) {
+      const int capacity = RoundUpToPowerOfTwo(num_examples);
+      shard->examples_ = engine_->AllocateExamples(capacity);
+      shard->num_examples_in_cache_ = capacity;
+    }
+  }
+
+  // Copy the content of the examples [begin, end) of "inputs" into
+  // "examples". "examples" is allocated with at least "end - begin" examples.
+  // The "begin"-th input example is the first example of "examples".
+  //
+  // "categorical_int_buffer" and "categorical_set_buffer" are scratch buffers
+  // kept across calls.
+  //
+  // Note: "FillMissing" marks all the values as missing. Therefore, missing
+  // values don't need to be set individually.
+  tf::Status SetExamples(
+      const InputTensors& inputs, const FeatureIndex& feature_index,
+      const int begin, const int end, serving::AbstractExampleSet* examples,
+      std::vector<int32_t>* categorical_int_buffer,
+      CategoricalSetIntColumn* categorical_set_buffer) const {
     const auto& features = engine_->features();
     examples->FillMissing(engine_->features());
 
     // Numerical features.
+    //
+    // Note: The input feature banks are dense row-major matrices.
+    const float* const numerical_values = inputs.numerical_features.data();
+    const int numerical_stride = inputs.numerical_features.dimension(1);
     for (const auto& feature : numerical_features_) {
-      for (int example_idx = 0; example_idx < inputs.batch_size;
-           example_idx++) {
-        const float value =
-            inputs.numerical_features(example_idx, feature.tensor_col);
+      const float* src =
+          numerical_values + begin * numerical_stride + feature.tensor_col;
+      for (int example_idx = 0; example_idx < end - begin;
+           example_idx++, src += numerical_stride) {
+        const float value = *src;
         if (!std::isnan(value)) {
           examples->SetNumerical(example_idx, feature.example_set_id, value,
                                  features);
-        } else {
-          examples->SetMissingNumerical(example_idx, feature.example_set_id,
-                                        features);
         }
       }
     }
 
     // Categorical int features.
+    //
+    // The values of each column are first gathered and clamped in a
+    // contiguous buffer with a branch-less (and vectorizable) loop.
+    const int32_t* const categorical_values =
+        inputs.categorical_int_features.data();
+    const int categorical_stride = inputs.categorical_int_features.dimension(1);
+    if (!categorical_int_features_.empty() &&
+        categorical_int_buffer->size() < static_cast<size_t>(end - begin)) {
+      categorical_int_buffer->resize(end - begin);
+    }
+    int32_t* const column = categorical_int_buffer->data();
     for (const auto& feature : categorical_int_features_) {
-      const int max_value = engine_->features()
-                                .data_spec()
-                                .columns(feature.dataspec_idx)
-                                .categorical()
-                                .number_of_unique_values();
-      for (int example_idx = 0; example_idx < inputs.batch_size;
-           example_idx++) {
-        int value =
-            inputs.categorical_int_features(example_idx, feature.tensor_col);
-        if (value == -1) {
-          examples->SetMissingCategorical(example_idx, feature.example_set_id,
-                                          features);
-        } else {
-          if (value < -1 || value >= max_value) {
-            value = 0;
-          }
-          examples->SetCategorical(example_idx, feature.example_set_id, value,
-                                   features);
+      const int32_t* src =
+          categorical_values + begin * categorical_stride + feature.tensor_col;
+      for (int example_idx = 0; example_idx < end - begin; example_idx++) {
+        column[example_idx] = src[example_idx * categorical_stride];
+      }
+      const int32_t max_value = feature.max_value;
+      for (int example_idx = 0; example_idx < end - begin; example_idx++) {
+        const int32_t value = column[example_idx];
+        // Note: -1 (missing) is preserved.
+        column[example_idx] = (value >= -1 && value < max_value) ? value : 0;
+      }
+      for (int example_idx = 0; example_idx < end - begin; example_idx++) {
+        if (column[example_idx] != -1) {
+          examples->SetCategorical(example_idx, feature.example_set_id,
+                                   column[example_idx], features);
         }
       }
     }
 
     // Categorical set int features.
-    std::vector<int> tmp_values;
     for (const auto& feature : categorical_set_int_features_) {
-      const int max_value = engine_->features()
-                                .data_spec()
-                                .columns(feature.dataspec_idx)
-                                .categorical()
-                                .number_of_unique_values();
-      for (int example_idx = 0; example_idx < inputs.batch_size;
-           example_idx++) {
-        const auto status =
-            ExtractCategoricalSetInt(inputs, feature_index, feature.tensor_col,
-                                     max_value, example_idx, &tmp_values);
-        if (!status.ok()) {
-          return status;
-        }
-
-        if (!tmp_values.empty() && tmp_values.front() < 0) {
-          examples->SetMissingCategoricalSet(example_idx,
-                                             feature.example_set_id, features);
-        } else {
-          examples->SetCategoricalSet(example_idx, feature.example_set_id,
-                                      tmp_values, features);
+      TF_RETURN_IF_ERROR(ExtractCategoricalSetIntColumn(
+          inputs, feature_index, feature.tensor_col, feature.max_value, begin,
+          end, categorical_set_buffer));
+      for (int example_idx = 0; example_idx < end - begin; example_idx++) {
+        if (!categorical_set_buffer->IsMissing(example_idx)) {
+          examples->SetCategoricalSet(
+              example_idx, feature.example_set_id,
+              categorical_set_buffer->begin(example_idx),
+              categorical_set_buffer->end(example_idx), features);
         }
       }
     }
@@ -746,6 +1441,9 @@ LOG(INFO) << "-----step4";
     const int tensor_col;
     const int dataspec_idx;
     const FeaturesDefinitionId example_set_id;
+    // Number of possible values of categorical features. Values outside of
+    // [-1, max_value) are treated as out-of-vocabulary.
+    const int max_value;
   };
 
   // Features used by the model.
@@ -757,100 +1455,4801 @@ LOG(INFO) << "-----step4";
       categorical_set_int_features_;
 };
 
-// TF resource containing the Yggdrasil model in memory.
-class YggdrasilModelResource : public tf::ResourceBase {
+// Contiguous array of trivially copyable values. The values are either owned by
+// the array (while the array is being built), or owned by an external buffer
+// (e.g. a memory mapped file) that outlives the array (see "Map").
+template <typename T>
+class FlatArray {
  public:
-  std::string DebugString() const override { return "YggdrasilModelResource"; }
-
-  // Loads the model from disk.
-  tf::Status LoadModelFromDisk(const absl::string_view model_path) {
-    LOG(INFO) << "------YggdrasilModelResource";
-    std::unique_ptr<model::AbstractModel> model;
-    TF_RETURN_IF_ERROR(utils::FromUtilStatus(LoadModel(model_path, &model)));
-    task_ = model->task();
-    TF_RETURN_IF_ERROR(
-        feature_index_.Initialize(model->input_features(), model->data_spec()));
-    TF_RETURN_IF_ERROR(ComputeDenseColRepresentation(model.get()));
-
-    // WARNING: After this function, the "model" might not be available anymore.
-    TF_RETURN_IF_ERROR(CreateInferenceEngine(std::move(model)));
-    return tf::Status::OK();
+  static_assert(std::is_trivially_copyable<T>::value,
+                "FlatArray values are copied as raw bytes.");
+
+  using value_type = T;
+
+  FlatArray() = default;
+  FlatArray(const FlatArray&) = delete;
+  FlatArray& operator=(const FlatArray&) = delete;
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const T* data() const { return data_; }
+  const T* begin() const { return data_; }
+  const T* end() const { return data_ + size_; }
+  const T& back() const { return data_[size_ - 1]; }
+  const T& operator[](const size_t idx) const { return data_[idx]; }
+
+  // Raw bytes of the values.
+  absl::string_view bytes() const {
+    return absl::string_view(reinterpret_cast<const char*>(data_),
+                             size_ * sizeof(T));
   }
 
-  const AbstractInferenceEngine* engine() const {
-    return inference_engine_.get();
+  // Mutation functions. Only valid for arrays owning their values.
+  T& operator[](const size_t idx) {
+    DCHECK(owns_values());
+    return values_[idx];
+  }
+  void push_back(const T& value) {
+    DCHECK(owns_values());
+    values_.push_back(value);
+    Sync();
+  }
+  void resize(const size_t size, const T& value = T()) {
+    DCHECK(owns_values());
+    values_.resize(size, value);
+    Sync();
+  }
+  void clear() {
+    values_.clear();
+    Sync();
   }
 
-  const FeatureIndex& feature_index() const { return feature_index_; }
+  // Makes the array a view of the "size" values in "data". "data" should
+  // outlive the array.
+  void Map(const T* data, const size_t size) {
+    values_.clear();
+    values_.shrink_to_fit();
+    data_ = data;
+    size_ = size;
+  }
 
-  Task task() const { return task_; }
+ private:
+  bool owns_values() const { return data_ == values_.data(); }
 
-  const std::vector<tf::tstring>& dense_col_representation() const {
-    return dense_col_representation_;
+  void Sync() {
+    data_ = values_.data();
+    size_ = values_.size();
   }
 
- private:
-  // Creates an inference engine compatible with the model. The inference engine
-  // can take ownership of the abstract model data.
-  tf::Status CreateInferenceEngine(
-      std::unique_ptr<model::AbstractModel> model) {
-    auto semi_fast_engine = model->BuildFastEngine();
-    if (semi_fast_engine.ok()) {
-      // Semi-fast generic engine.
-      auto inference_engine_or_status = SemiFastGenericInferenceEngine::Create(
-          std::move(semi_fast_engine.value()), *model, feature_index());
-      TF_RETURN_IF_ERROR(
-          utils::FromUtilStatus(inference_engine_or_status.status()));
-      inference_engine_ = std::move(inference_engine_or_status.value());
-      LOG(INFO) << "Use fast generic engine test";
-      return tf::Status::OK();
-    } else {
-      // Slow generic engine.
-      LOG(INFO) << "Use slow generic engine";
-      inference_engine_ =
-          absl::make_unique<GenericInferenceEngine>(std::move(model));
-      return tf::Status::OK();
+  std::vector<T> values_;
+  const T* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Tests if any of the items [begin, end) is in "bitmap", a bitmap of
+// "max_value" bits. The items outside of [0, max_value) are out-of-vocabulary
+// i.e. 0.
+//
+// The items are tested against the bitmap by blocks of 8 without branches, so
+// the compiler can vectorize the block loop (e.g. with AVX2 gathers), and the
+// test stops at the first block containing an item of the bitmap. The cost is
+// linear in the size of the set, and independent of the number of possible
+// values.
+inline bool ContainsAny(const uint64_t* bitmap, const int32_t max_value,
+                        const int32_t* begin, const int32_t* const end) {
+  constexpr int kBlockSize = 8;
+  while (begin != end) {
+    const int32_t* const block_end =
+        begin + std::min<std::ptrdiff_t>(end - begin, kBlockSize);
+    uint64_t found = 0;
+    for (; begin != block_end; ++begin) {
+      const int32_t value = (*begin >= 0 && *begin < max_value) ? *begin : 0;
+      found |= bitmap[value / 64] >> (value % 64);
+    }
+    if (found & 1) {
+      return true;
     }
   }
+  return false;
+}
+
+// Subset of the trees of a forest, evaluated by one of the "num_shards"
+// servers of a distributed model (see "SimpleMLReduceTreeShards"). The shards
+// are contiguous ranges of iterations (i.e. of trees for the Random Forests).
+// The predictions of a shard are its partial, non-finalized, contribution to
+// the accumulator: the sum of its leaf values (averaged over all the trees of
+// the forest for the Random Forests), plus the initial accumulator for the
+// shard 0. The accumulator of the forest is the sum of the shard predictions.
+struct TreeShard {
+  int index = 0;
+  int num_shards = 1;
+};
+
+// Decision forest converted into contiguous, breadth-first arrays of nodes
+// (struct-of-arrays) that are evaluated directly on the input tensors.
+//
+// Unlike the Yggdrasil node objects (one heap allocation per node, accessed
+// through pointers), the nodes of all the trees are stored in a few flat
+// arrays. In each tree, the two children of a node are stored next to each
+// other (negative child first), so a node only stores the index of its
+// negative child, and the next node index is computed without branching as
+// "child + condition_value".
+//
+// Only supports the conditions evaluated directly on the numerical, boolean
+// and categorical int input banks ("higher", "true value", "contains" and
+// "is NA" conditions) and on the categorical set inputs ("contains"
+// conditions, see "ContainsAny"), and the Gradient Boosted Trees (regression,
+// binary and multi-class classification) and Random Forest (regression and
+// classification) models.
+//
+// If the forest only contains "higher" conditions and the CPU supports AVX2,
+// the trees are traversed by groups of 8 examples using gather instructions
+// (see "UsesSimdTraversal"). Otherwise, or for the last examples of a batch,
+// the examples are traversed one at a time.
+//
+// The leaves of Random Forest classifiers with many classes can be sparse (see
+// "HasSparseLeaves"): each leaf then only stores its largest class
+// probabilities.
+class FlatForest {
+ public:
+  // How the node evaluates the example.
+  enum class NodeType : uint8_t {
+    kLeaf = 0,
+    // numerical_features[feature] >= threshold.
+    kHigher,
+    // boolean_features[feature] is true.
+    kTrueValue,
+    // categorical_int_features[feature] is in the bitmap "offset".
+    kContains,
+    // The feature value is missing.
+    kNumericalIsNa,
+    kBooleanIsNa,
+    kCategoricalIsNa,
+    // One of the items of categorical_set_int_features[feature] is in the
+    // bitmap "offset".
+    kContainsAny,
+  };
+
+  // How the accumulated leaf values are converted into predictions.
+  enum class Finalization : uint8_t {
+    // dense_predictions = accumulator.
+    kIdentity,
+    // dense_predictions = accumulator / num_trees.
+    kAverage,
+    // p = sigmoid(accumulator); dense_predictions = [1-p, p].
+    kSigmoidBinary,
+    // dense_predictions = softmax(accumulator).
+    kSoftmax,
+  };
+
+  // Type-specific value of a node.
+  union NodeValue {
+    // Threshold of "kHigher" conditions.
+    float threshold;
+    // Offset in "bitmaps_" of "kContains" and "kContainsAny" conditions, or
+    // offset in "leaf_values_" of leaves.
+    uint32_t offset;
+  };
+
+  // Information about the model, other than the forest, needed to run the
+  // forest in the inference op. Saved next to the forest by "Save".
+  struct Metadata {
+    Task task{};
+    int label_col_idx = -1;
+    std::vector<int> input_features;
+    dataset::proto::DataSpecification data_spec;
+    // Fingerprint of the model the forest was built from, in the flat forest
+    // cache (see "flat_forest_cache_dir"). Zero otherwise.
+    tf::Fprint128 content_fingerprint{0, 0};
+  };
+
+  // Converts a Yggdrasil model, or the "tree_shard" subset of its trees.
+  // Returns an error if the model is not supported. If "leaf_top_k" is
+  // positive and less than the number of classes of a Random Forest
+  // classifier, the leaves only keep their "leaf_top_k" largest probabilities
+  // (see "HasSparseLeaves").
+  static StatusOr<std::unique_ptr<FlatForest>> Create(
+      const model::AbstractModel& model, const FeatureIndex& feature_index,
+      const TreeShard& tree_shard = {}, int leaf_top_k = 0);
+
+  // Opens a forest written by "Save". When supported by the file system, the
+  // file is memory mapped and the node arrays are used in place i.e. without
+  // parsing or copy. Multiple processes opening the same file share the same
+  // pages.
+  static tf::Status Map(const std::string& path,
+                        std::unique_ptr<FlatForest>* forest,
+                        Metadata* metadata);
+
+  // Packs the trees of "forests", in order, into a single forest (i.e. a single
+  // node arena). The forests should have the same output representation and
+  // categorical features. The initial accumulator of the result is the one of
+  // the first forest.
+  static StatusOr<std::unique_ptr<FlatForest>> Concatenate(
+      const std::vector<const FlatForest*>& forests);
+
+  // Writes the forest and "metadata" to "path". The file is first written to
+  // a temporary file and then renamed, so concurrent readers never see a
+  // partial file.
+  tf::Status Save(const Metadata& metadata, const std::string& path) const;
+
+  // Copies the node arrays into a single buffer backed by transparent huge
+  // pages (see "HugePageRegion"). The traversal of a large forest accesses its
+  // nodes randomly, and with 4KB pages, most of these accesses miss the TLB.
+  // Should be called before the forest is shared. If the forest was opened
+  // with "Map", the file is not used anymore.
+  tf::Status MoveToHugePages();
+
+  // Reads the whole forest, so that the pages of a memory mapped file are
+  // faulted in before the first inferences instead of during them. The CPU
+  // caches are not warmed: the inferences run on other cores than the loading
+  // thread.
+  void Prefault() const;
+
+  // Hash of the content of the forest. Two forests with the same content have
+  // the same fingerprint.
+  uint64_t Fingerprint() const;
+
+  // Generates the C++ source of a shared library evaluating the forest with
+  // one if/else block per tree. The library exports the C functions:
+  //
+  //   // Fingerprint of the forest (see "Fingerprint").
+  //   uint64_t TfdfCompiledFlatForestFingerprint();
+  //   // Adds the leaf values of all the trees, for the example with the
+  //   // given rows of the numerical, boolean and categorical int feature
+  //   // banks, to "accumulator" (of size "accumulator_dim()").
+  //   void TfdfCompiledFlatForestAccumulate(const float* numerical,
+  //       const float* boolean, const int32_t* categorical,
+  //       float* accumulator);
+  std::string GenerateCompiledSource() const;
+
+  // Tests if two forests have the same content i.e. make the same predictions.
+  bool Equals(const FlatForest& other) const;
+
+  // Hash of the structure of the forest i.e. of its content other than the
+  // leaf values and the initial accumulator. The versions of a model whose
+  // leaves are re-calibrated without re-training the trees have the same
+  // structure.
+  uint64_t StructureFingerprint() const;
+
+  // Tests if two forests have the same structure (see "StructureFingerprint").
+  bool SameStructure(const FlatForest& other) const;
+
+  // Makes the node arrays of the forest views of the node arrays of
+  // "structure", a forest with the same structure, which is kept alive by the
+  // forest. The forest then only owns its leaf values, and the memory of its
+  // other arrays (or of its memory mapped file) is released. Should be called
+  // before the forest is shared.
+  void ShareStructure(std::shared_ptr<const FlatForest> structure);
+
+  int num_trees() const { return tree_roots_.size(); }
+  int num_nodes() const { return node_types_.size(); }
+
+  // Dimension of the accumulator of an example.
+  int accumulator_dim() const { return initial_accumulator_.size(); }
+
+  // Dimension of the predictions of an example.
+  int output_dim() const {
+    return finalization_ == Finalization::kSigmoidBinary ? 2
+                                                         : accumulator_dim();
+  }
+
+  // Tree-major evaluation of the examples [begin, end) of "inputs", and export
+  // of the predictions in the same rows of "outputs". "accumulator" is a
+  // buffer re-used in between calls. The partial evaluation fields of
+  // "options" (i.e. "max_num_trees" and "early_exit_margin") are applied. If
+  // requested, the leaves reached by the examples are exported in the
+  // "leaves" of "outputs" (see "LeafIndex").
+  tf::Status Predict(const InputTensors& inputs, int begin, int end,
+                     const InferenceOptions& options,
+                     std::vector<float>* accumulator,
+                     OutputTensors* outputs) const;
+
+  // Adds the leaf values of the trees [tree_begin, tree_end) to the
+  // accumulators of the examples [begin, end) of "inputs". "accumulator" points
+  // to the accumulator of the "begin"-th example. Unlike "Predict", the
+  // accumulators are neither initialized nor finalized, so the trees of the
+  // forest can be split in between threads.
+  void AccumulateTrees(const InputTensors& inputs, int begin, int end,
+                       int tree_begin, int tree_end, float* accumulator) const;
+
+  // Number of bytes of the node attributes and leaf values read by the
+  // evaluation of the trees.
+  size_t NodeMemoryUsage() const;
+
+  // Number of trees evaluated with "max_num_trees" (see "InferenceOptions").
+  // For the models with one tree per output dimension and iteration, the
+  // number of trees is rounded down to full iterations.
+  int NumEvaluatedTrees(int max_num_trees) const;
+
+  // Index of the leaf reached by the "example_idx"-th example of "inputs" in
+  // the tree starting at node "root".
+  inline int GetLeaf(const InputTensors& inputs, int example_idx,
+                     int root) const;
+
+  // Evaluates the condition of a non-leaf node.
+  inline bool EvalCondition(const InputTensors& inputs, int example_idx,
+                            int node_idx) const;
+
+  // Index, among the leaves of the "tree_idx"-th tree, of the leaf "leaf". The
+  // leaves of a tree are numbered from 0 in breadth-first order, so the
+  // indices of a tree are less than its number of leaves.
+  int LeafIndex(const int tree_idx, const int leaf) const {
+    return node_values_[leaf].offset / leaf_value_dim_ -
+           tree_leaf_begins_[tree_idx];
+  }
+
+  // Raw accessors for the other forest engines.
+  const FlatArray<int32_t>& tree_roots() const { return tree_roots_; }
+  const FlatArray<NodeType>& node_types() const { return node_types_; }
+  const FlatArray<uint8_t>& node_na_values() const { return node_na_values_; }
+  const FlatArray<int32_t>& node_features() const { return node_features_; }
+  const FlatArray<int32_t>& node_children() const { return node_children_; }
+  const FlatArray<NodeValue>& node_values() const { return node_values_; }
+  const FlatArray<float>& leaf_values() const { return leaf_values_; }
+  const FlatArray<uint16_t>& leaf_classes() const { return leaf_classes_; }
+  int leaf_value_dim() const { return leaf_value_dim_; }
+  const std::vector<float>& initial_accumulator() const {
+    return initial_accumulator_;
+  }
+  Finalization finalization() const { return finalization_; }
+
+  // Tests if the leaves are sparse: each leaf only holds the "leaf_value_dim()"
+  // largest values of its class distribution, added to the accumulator at the
+  // indices "leaf_classes()". The trees then accumulate far fewer values per
+  // example, and the leaves take far less memory, at the cost of the dropped
+  // probabilities (logged when the forest is created).
+  bool HasSparseLeaves() const { return !leaf_classes_.empty(); }
+
+  // Index, in the accumulator, of the first output of the "tree_idx"-th tree.
+  int TreeAccumulatorOffset(const int tree_idx) const {
+    return leaf_value_dim_ == accumulator_dim() || HasSparseLeaves()
+               ? 0
+               : tree_idx % accumulator_dim();
+  }
+
+  // Converts the accumulated values of an example, over the first
+  // "num_evaluated_trees" trees, into predictions. "accumulator" and
+  // "predictions" can be the same buffer if the accumulator and output
+  // dimensions are equal (see "AccumulatesInOutputs").
+  void Finalize(const float* accumulator, int num_evaluated_trees,
+                float* predictions) const;
+
+  // Tests if the trees can be accumulated directly in the output tensor, and
+  // the predictions finalized in place.
+  bool AccumulatesInOutputs() const {
+    return accumulator_dim() == output_dim();
+  }
+
+  // Tests if the forest contains the (weighted) number of training examples
+  // of its nodes, needed by "FeatureContributions". This is not the case for
+  // models trained without these statistics, or for forests opened from files
+  // of version 1.
+  bool HasNodeCovers() const { return !node_covers_.empty(); }
+
+  // Tests if the forest contains conditions on categorical set features. These
+  // conditions are neither supported by "FeatureContributions" nor by
+  // "GenerateCompiledSource".
+  bool HasCategoricalSetConditions() const;
+
+  // Number of features of the contributions of "FeatureContributions" i.e. the
+  // total number of columns of the numerical, boolean and categorical int
+  // feature banks of "inputs".
+  static int NumContributionFeatures(const InputTensors& inputs);
+
+  // Computes the contributions of the input features to the accumulator of the
+  // examples [begin, end) of "inputs", over the first "num_evaluated_trees"
+  // trees, with the path-dependent TreeSHAP algorithm (Lundberg et al.,
+  // "Consistent Individualized Feature Attribution for Tree Ensembles").
+  //
+  // The contributions of an example are "NumContributionFeatures(inputs) + 1"
+  // rows of "accumulator_dim()" values: one row per column of the numerical,
+  // then boolean, then categorical int feature banks, and a last row with the
+  // expected value of the accumulator (the bias). The rows of an example sum to
+  // the accumulator before finalization e.g. the logit of a binary
+  // classification GBT, or the averaged leaf values of a RF. "contributions"
+  // points to the contributions of the "begin"-th example. Requires
+  // "HasNodeCovers".
+  void FeatureContributions(const InputTensors& inputs, int begin, int end,
+                            int num_evaluated_trees,
+                            float* contributions) const;
+
+  // Number of examples traversed simultaneously by the SIMD traversal.
+  static constexpr int kNumSimdLanes = 8;
+
+  // Tests if "Predict" traverses the trees "kNumSimdLanes" examples at a time
+  // i.e. if the forest only contains "kHigher" conditions and if the CPU
+  // supports it.
+  bool UsesSimdTraversal() const;
+
+ private:
+  FlatForest() = default;
+
+  // Checks that the arrays of a forest opened by "Map" only reference values
+  // within the forest, and features within the banks of "feature_index", so
+  // that a corrupted file cannot make the inference read out of bounds.
+  tf::Status Validate(const FeatureIndex& feature_index) const;
+
+  // Builds the "simd_*" node arrays if the forest is compatible with the SIMD
+  // traversal.
+  void InitializeSimdTraversal();
+
+  // Builds "remaining_leaf_bounds_".
+  void InitializeEarlyExitBounds();
+
+  // Builds "tree_leaf_begins_".
+  void InitializeLeafIndices();
+
+  // Makes the leaves sparse, keeping the "top_k" largest values of each leaf
+  // (see "HasSparseLeaves"). Returns the largest sum of the values dropped
+  // from a leaf.
+  float SparsifyLeaves(int top_k);
+
+  // Builds "tree_expected_values_" and "max_tree_depth_". Clears
+  // "node_covers_" if they are not usable i.e. if a non-leaf node has no
+  // training examples.
+  void InitializeFeatureContributions();
+
+  // Element of the path of unique features followed by the TreeSHAP
+  // recursion.
+  struct ShapPathElement {
+    // Index of the feature in the contributions, or -1 for the root.
+    int feature;
+    // Fraction of the paths going through the node when the feature is
+    // missing (i.e. following the covers), and when the feature is set (i.e.
+    // following the example).
+    float zero_fraction;
+    float one_fraction;
+    // Weight of the subsets of features of the same size as the element index.
+    float weight;
+  };
+
+  // The three operations of TreeSHAP on the "depth + 1" elements of "path":
+  // "ExtendShapPath" adds the feature of a split, "UnwindShapPath" removes the
+  // "path_idx"-th element, and "UnwoundShapPathSum" is the total weight of the
+  // path with the "path_idx"-th element removed.
+  static void ExtendShapPath(ShapPathElement* path, int depth,
+                             float zero_fraction, float one_fraction,
+                             int feature);
+  static void UnwindShapPath(ShapPathElement* path, int depth, int path_idx);
+  static float UnwoundShapPathSum(const ShapPathElement* path, int depth,
+                                  int path_idx);
+
+  // Index, in the contributions, of the feature of the condition of the
+  // "node_idx"-th node. "bank_offsets" are the indices of the first
+  // numerical, boolean and categorical int features.
+  int ContributionFeature(int node_idx, const int* bank_offsets) const;
+
+  // Adds the contributions of the sub-tree of node "node_idx", reached at the
+  // unique feature depth "depth", to "contributions" (offset by the output
+  // offset of the tree). The path of the node is built from the path of its
+  // parent "parent_path", extended with "feature" and its fractions. The
+  // sub-trees followed by none of the paths (i.e. both fractions are zero) do
+  // not contribute.
+  void AddTreeContributions(const InputTensors& inputs, int example_idx,
+                            int node_idx, int depth,
+                            ShapPathElement* parent_path,
+                            float zero_fraction, float one_fraction,
+                            int feature, const int* bank_offsets,
+                            float* contributions) const;
+
+  // Number of examples, and number of trees, evaluated in between two checks
+  // of the early exit condition.
+  static constexpr int kEarlyExitNumExamples = 16;
+  static constexpr int kEarlyExitNumTrees = 8;
+
+  // Accumulates the first "num_evaluated_trees" trees of a binary
+  // classification forest on the examples [begin, end), and stops the
+  // evaluation of a group of "kEarlyExitNumExamples" examples once all of them
+  // satisfy the early exit condition.
+  void AccumulateTreesWithEarlyExit(const InputTensors& inputs, int begin,
+                                    int end, int num_evaluated_trees,
+                                    float early_exit_margin,
+                                    float* accumulator,
+                                    tf::int32* leaves) const;
+
+  // Accumulates the leaf values of the examples [begin, end) of "inputs" in
+  // the "tree_idx"-th tree. "accumulator" points to the accumulator of the
+  // "begin"-th example, offset by the output offset of the tree. If not null,
+  // the index of the leaves (see "LeafIndex") are set in "leaves", a
+  // "batch x num_trees" row-major matrix.
+  void AccumulateTree(const InputTensors& inputs, int begin, int end,
+                      int tree_idx, float* accumulator,
+                      tf::int32* leaves) const;
+
+  // Appends the tree to the node arrays.
+  absl::Status AddTree(const model::decision_tree::DecisionTree& tree,
+                       const FeatureIndex& feature_index,
+                       const dataset::proto::DataSpecification& data_spec,
+                       const std::function<absl::Status(
+                           const model::decision_tree::proto::Node&, float*)>&
+                           set_leaf_value);
+
+  // Sets the condition of the "node_idx"-th node.
+  absl::Status SetCondition(
+      const model::decision_tree::proto::NodeCondition& condition,
+      const FeatureIndex& feature_index,
+      const dataset::proto::DataSpecification& data_spec, int node_idx);
+
+  // Memory mapped file containing the arrays of the forest, if the forest was
+  // opened with "Map", or huge pages containing them (see "MoveToHugePages").
+  std::unique_ptr<tf::ReadOnlyMemoryRegion> mapped_region_;
+
+  // Forest containing the node arrays of the forest, if set by
+  // "ShareStructure".
+  std::shared_ptr<const FlatForest> shared_structure_;
+
+  // Index of the first node of each tree.
+  FlatArray<int32_t> tree_roots_;
+
+  // Node attributes (struct-of-arrays) indexed by node index.
+  FlatArray<NodeType> node_types_;
+  // Value of the condition when the feature value is missing.
+  FlatArray<uint8_t> node_na_values_;
+  // Column of the feature in its input bank.
+  FlatArray<int32_t> node_features_;
+  // Index of the negative child. The positive child is "node_children_ + 1".
+  FlatArray<int32_t> node_children_;
+  FlatArray<NodeValue> node_values_;
+
+  // Bitmaps of the "kContains" conditions. Each bitmap has enough 64 bits
+  // words to contain all the possible values of the feature.
+  FlatArray<uint64_t> bitmaps_;
+
+  // Number of possible values of each column of the categorical int feature
+  // bank. Values outside of [-1, max_value) are treated as out-of-vocabulary.
+  std::vector<int32_t> categorical_max_values_;
+  // Same as "categorical_max_values_", for the categorical set features.
+  std::vector<int32_t> categorical_set_max_values_;
+
+  // Values of the leaves. Each leaf has "leaf_value_dim_" values.
+  FlatArray<float> leaf_values_;
+  int leaf_value_dim_ = 1;
+
+  // Index, in the accumulator, of each value of "leaf_values_" if the leaves
+  // are sparse. Empty otherwise.
+  FlatArray<uint16_t> leaf_classes_;
+
+  // Initial value of the accumulator of each example.
+  std::vector<float> initial_accumulator_;
+
+  Finalization finalization_ = Finalization::kIdentity;
+
+  // Node attributes of the SIMD traversal, in the 32 bits format expected by
+  // the gather instructions. Empty if the forest is not compatible with the
+  // SIMD traversal. "simd_node_features_" is -1 for the leaves.
+  FlatArray<int32_t> simd_node_features_;
+  FlatArray<float> simd_node_thresholds_;
+  FlatArray<int32_t> simd_node_na_values_;
+
+  // "remaining_leaf_bounds_[i]" is the sum, over the trees [i, num_trees), of
+  // the maximum absolute leaf value of the tree. Only computed for binary
+  // classification (see "AccumulateTreesWithEarlyExit"). Not saved by "Save".
+  std::vector<float> remaining_leaf_bounds_;
+
+  // Weighted number of training examples reaching each node. Empty if not
+  // available (see "HasNodeCovers").
+  FlatArray<float> node_covers_;
+
+  // Expected leaf value (following the covers) of each tree. Each tree has
+  // "leaf_value_dim_" values. Not saved by "Save".
+  std::vector<float> tree_expected_values_;
+
+  // Maximum depth of the trees. A tree with a single leaf has a depth of 0.
+  int max_tree_depth_ = 0;
+
+  // Index, among all the leaves of the forest, of the first leaf of each tree.
+  // The leaves of a tree are contiguous in "leaf_values_". Not saved by
+  // "Save".
+  std::vector<int32_t> tree_leaf_begins_;
+};
+
+StatusOr<std::unique_ptr<FlatForest>> FlatForest::Create(
+    const model::AbstractModel& model, const FeatureIndex& feature_index,
+    const TreeShard& tree_shard, const int leaf_top_k) {
+  namespace decision_tree = model::decision_tree;
+  namespace gbt = model::gradient_boosted_trees;
+  namespace rf = model::random_forest;
+
+  auto forest = absl::WrapUnique(new FlatForest());
+  const auto& data_spec = model.data_spec();
+  for (const int feature_idx : feature_index.categorical_int_features()) {
+    forest->categorical_max_values_.push_back(
+        data_spec.columns(feature_idx).categorical().number_of_unique_values());
+  }
+  for (const int feature_idx : feature_index.categorical_set_int_features()) {
+    forest->categorical_set_max_values_.push_back(
+        data_spec.columns(feature_idx).categorical().number_of_unique_values());
+  }
+
+  const std::vector<std::unique_ptr<decision_tree::DecisionTree>>* trees;
+  std::function<absl::Status(const decision_tree::proto::Node&, float*)>
+      set_leaf_value;
+  // Only the leaves of the Random Forest classifiers can be sparse.
+  bool sparse_leaves = false;
+
+  if (const auto* gbt_model =
+          dynamic_cast<const gbt::GradientBoostedTreesModel*>(&model)) {
+    trees = &gbt_model->decision_trees();
+    forest->initial_accumulator_ = gbt_model->initial_predictions();
+    forest->leaf_value_dim_ = 1;
+    switch (gbt_model->loss()) {
+      case gbt::proto::Loss::SQUARED_ERROR:
+        forest->finalization_ = Finalization::kIdentity;
+        break;
+      case gbt::proto::Loss::BINOMIAL_LOG_LIKELIHOOD:
+        forest->finalization_ = Finalization::kSigmoidBinary;
+        break;
+      case gbt::proto::Loss::MULTINOMIAL_LOG_LIKELIHOOD:
+        forest->finalization_ = Finalization::kSoftmax;
+        break;
+      default:
+        return absl::InvalidArgumentError(absl::StrCat(
+            "Non supported GBT loss: ",
+            gbt::proto::Loss_Name(gbt_model->loss())));
+    }
+    if (forest->initial_accumulator_.size() !=
+        gbt_model->num_trees_per_iter()) {
+      return absl::InvalidArgumentError("Unexpected number of trees per iter");
+    }
+    set_leaf_value = [](const decision_tree::proto::Node& node,
+                        float* value) -> absl::Status {
+      if (!node.has_regressor()) {
+        return absl::InvalidArgumentError("GBT leaf without regressor output");
+      }
+      *value = node.regressor().top_value();
+      return absl::OkStatus();
+    };
+
+  } else if (const auto* rf_model =
+                 dynamic_cast<const rf::RandomForestModel*>(&model)) {
+    trees = &rf_model->decision_trees();
+    forest->finalization_ = Finalization::kAverage;
+    switch (model.task()) {
+      case Task::REGRESSION:
+        forest->leaf_value_dim_ = 1;
+        set_leaf_value = [](const decision_tree::proto::Node& node,
+                            float* value) -> absl::Status {
+          if (!node.has_regressor()) {
+            return absl::InvalidArgumentError(
+                "RF leaf without regressor output");
+          }
+          *value = node.regressor().top_value();
+          return absl::OkStatus();
+        };
+        break;
+      case Task::CLASSIFICATION: {
+        // Note: The OOV class (index 0) is not reported.
+        const int num_classes = data_spec.columns(model.label_col_idx())
+                                    .categorical()
+                                    .number_of_unique_values() -
+                                1;
+        const bool winner_take_all = rf_model->winner_take_all_inference();
+        forest->leaf_value_dim_ = num_classes;
+        sparse_leaves = leaf_top_k > 0 && leaf_top_k < num_classes;
+        if (sparse_leaves &&
+            num_classes > std::numeric_limits<uint16_t>::max()) {
+          return absl::InvalidArgumentError(absl::StrCat(
+              "Too many classes (", num_classes, ") for sparse leaves"));
+        }
+        set_leaf_value = [num_classes, winner_take_all](
+                             const decision_tree::proto::Node& node,
+                             float* value) -> absl::Status {
+          if (!node.has_classifier()) {
+            return absl::InvalidArgumentError(
+                "RF leaf without classifier output");
+          }
+          const auto& classifier = node.classifier();
+          std::fill(value, value + num_classes, 0.f);
+          if (winner_take_all) {
+            const int top_class = classifier.top_value() - 1;
+            if (top_class >= 0 && top_class < num_classes) {
+              value[top_class] = 1.f;
+            }
+          } else {
+            const auto& distribution = classifier.distribution();
+            if (distribution.counts_size() != num_classes + 1) {
+              return absl::InvalidArgumentError(
+                  "Unexpected RF leaf distribution size");
+            }
+            const float inv_sum =
+                distribution.sum() > 0 ? 1.f / distribution.sum() : 0.f;
+            for (int class_idx = 0; class_idx < num_classes; class_idx++) {
+              value[class_idx] = distribution.counts(class_idx + 1) * inv_sum;
+            }
+          }
+          return absl::OkStatus();
+        };
+      } break;
+      default:
+        return absl::InvalidArgumentError(
+            absl::StrCat("Non supported RF task: ", Task_Name(model.task())));
+    }
+    forest->initial_accumulator_.assign(forest->leaf_value_dim_, 0.f);
+
+  } else {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Non supported model: ", model.name()));
+  }
+
+  int tree_begin = 0;
+  int tree_end = trees->size();
+  if (tree_shard.num_shards > 1) {
+    // Note: The GBT shards contain whole iterations, so the accumulator
+    // offsets of their trees are the same as in the forest.
+    const int num_trees_per_iter =
+        forest->leaf_value_dim_ == forest->accumulator_dim()
+            ? 1
+            : forest->accumulator_dim();
+    const int num_iters = trees->size() / num_trees_per_iter;
+    tree_begin = num_iters * tree_shard.index / tree_shard.num_shards *
+                 num_trees_per_iter;
+    tree_end = num_iters * (tree_shard.index + 1) / tree_shard.num_shards *
+               num_trees_per_iter;
+    if (tree_begin == tree_end) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "The tree shard ", tree_shard.index, " of ", tree_shard.num_shards,
+          " has no trees. The model has ", num_iters, " iterations."));
+    }
+    if (forest->finalization_ == Finalization::kAverage) {
+      const float inv_num_trees = 1.f / trees->size();
+      const int dim = forest->leaf_value_dim_;
+      set_leaf_value = [set_leaf_value, inv_num_trees, dim](
+                           const decision_tree::proto::Node& node,
+                           float* value) -> absl::Status {
+        RETURN_IF_ERROR(set_leaf_value(node, value));
+        for (int i = 0; i < dim; i++) {
+          value[i] *= inv_num_trees;
+        }
+        return absl::OkStatus();
+      };
+    }
+    if (tree_shard.index != 0) {
+      std::fill(forest->initial_accumulator_.begin(),
+                forest->initial_accumulator_.end(), 0.f);
+    }
+    forest->finalization_ = Finalization::kIdentity;
+  }
+
+  for (int tree_idx = tree_begin; tree_idx < tree_end; tree_idx++) {
+    RETURN_IF_ERROR(forest->AddTree(*(*trees)[tree_idx], feature_index,
+                                    data_spec, set_leaf_value));
+  }
+  if (tree_shard.num_shards > 1) {
+    // Note: The whole Yggdrasil model was loaded to build the shard (see the
+    // "num_tree_shards" attribute).
+    LOG(INFO) << "The tree shard " << tree_shard.index << " of "
+              << tree_shard.num_shards << " keeps the trees [" << tree_begin
+              << ", " << tree_end << ") of the " << trees->size()
+              << " trees of the model, in " << forest->NodeMemoryUsage()
+              << " bytes";
+  }
+  if (sparse_leaves) {
+    const int num_classes = forest->leaf_value_dim_;
+    const float max_dropped_value = forest->SparsifyLeaves(leaf_top_k);
+    LOG(INFO) << "The leaves of the flat forest keep their " << leaf_top_k
+              << " largest probabilities out of " << num_classes
+              << ". At most " << max_dropped_value
+              << " is dropped from a leaf.";
+  }
+  forest->InitializeSimdTraversal();
+  forest->InitializeEarlyExitBounds();
+  forest->InitializeFeatureContributions();
+  forest->InitializeLeafIndices();
+  return forest;
+}
+
+StatusOr<std::unique_ptr<FlatForest>> FlatForest::Concatenate(
+    const std::vector<const FlatForest*>& forests) {
+  if (forests.empty()) {
+    return absl::InvalidArgumentError("No forest to concatenate.");
+  }
+  const FlatForest& first = *forests.front();
+  auto packed = absl::WrapUnique(new FlatForest());
+  packed->categorical_max_values_ = first.categorical_max_values_;
+  packed->categorical_set_max_values_ = first.categorical_set_max_values_;
+  packed->leaf_value_dim_ = first.leaf_value_dim_;
+  packed->initial_accumulator_ = first.initial_accumulator_;
+  packed->finalization_ = first.finalization_;
+  // The covers are only kept if all the forests have them.
+  const bool has_node_covers =
+      std::all_of(forests.begin(), forests.end(),
+                  [](const FlatForest* forest) {
+                    return forest->HasNodeCovers();
+                  });
+
+  for (const FlatForest* forest : forests) {
+    if (forest->leaf_value_dim_ != first.leaf_value_dim_ ||
+        forest->accumulator_dim() != first.accumulator_dim() ||
+        forest->finalization_ != first.finalization_ ||
+        forest->categorical_max_values_ != first.categorical_max_values_ ||
+        forest->categorical_set_max_values_ !=
+            first.categorical_set_max_values_ ||
+        forest->HasSparseLeaves() != first.HasSparseLeaves()) {
+      return absl::InvalidArgumentError(
+          "The forests to concatenate have different output representations "
+          "or categorical features.");
+    }
+
+    // Offsets of the nodes, bitmaps and leaf values of "forest" in "packed".
+    const int32_t node_offset = packed->num_nodes();
+    const uint32_t bitmap_offset = packed->bitmaps_.size();
+    const uint32_t leaf_value_offset = packed->leaf_values_.size();
+    for (const int32_t root : forest->tree_roots_) {
+      packed->tree_roots_.push_back(root + node_offset);
+    }
+    for (int node_idx = 0; node_idx < forest->num_nodes(); node_idx++) {
+      const NodeType type = forest->node_types_[node_idx];
+      NodeValue value = forest->node_values_[node_idx];
+      if (type == NodeType::kLeaf) {
+        value.offset += leaf_value_offset;
+      } else if (type == NodeType::kContains ||
+                 type == NodeType::kContainsAny) {
+        value.offset += bitmap_offset;
+      }
+      packed->node_types_.push_back(type);
+      packed->node_na_values_.push_back(forest->node_na_values_[node_idx]);
+      packed->node_features_.push_back(forest->node_features_[node_idx]);
+      packed->node_children_.push_back(
+          type == NodeType::kLeaf
+              ? 0
+              : forest->node_children_[node_idx] + node_offset);
+      packed->node_values_.push_back(value);
+    }
+    for (const uint64_t word : forest->bitmaps_) {
+      packed->bitmaps_.push_back(word);
+    }
+    for (const float leaf_value : forest->leaf_values_) {
+      packed->leaf_values_.push_back(leaf_value);
+    }
+    for (const uint16_t leaf_class : forest->leaf_classes_) {
+      packed->leaf_classes_.push_back(leaf_class);
+    }
+    if (has_node_covers) {
+      for (const float cover : forest->node_covers_) {
+        packed->node_covers_.push_back(cover);
+      }
+    }
+  }
+  packed->InitializeSimdTraversal();
+  packed->InitializeEarlyExitBounds();
+  packed->InitializeFeatureContributions();
+  packed->InitializeLeafIndices();
+  return packed;
+}
+
+void FlatForest::InitializeEarlyExitBounds() {
+  remaining_leaf_bounds_.clear();
+  if (finalization_ != Finalization::kSigmoidBinary) {
+    return;
+  }
+  remaining_leaf_bounds_.assign(num_trees() + 1, 0.f);
+  for (int tree_idx = num_trees() - 1; tree_idx >= 0; tree_idx--) {
+    const int node_end =
+        tree_idx + 1 < num_trees() ? tree_roots_[tree_idx + 1] : num_nodes();
+    float max_abs_leaf = 0.f;
+    for (int node_idx = tree_roots_[tree_idx]; node_idx < node_end;
+         node_idx++) {
+      if (node_types_[node_idx] == NodeType::kLeaf) {
+        const float leaf_value = leaf_values_[node_values_[node_idx].offset];
+        max_abs_leaf = std::max(max_abs_leaf, std::abs(leaf_value));
+      }
+    }
+    remaining_leaf_bounds_[tree_idx] =
+        remaining_leaf_bounds_[tree_idx + 1] + max_abs_leaf;
+  }
+}
+
+void FlatForest::InitializeLeafIndices() {
+  tree_leaf_begins_.assign(num_trees(), 0);
+  for (int tree_idx = 0; tree_idx < num_trees(); tree_idx++) {
+    const int node_end =
+        tree_idx + 1 < num_trees() ? tree_roots_[tree_idx + 1] : num_nodes();
+    int32_t leaf_begin = std::numeric_limits<int32_t>::max();
+    for (int node_idx = tree_roots_[tree_idx]; node_idx < node_end;
+         node_idx++) {
+      if (node_types_[node_idx] == NodeType::kLeaf) {
+        leaf_begin = std::min<int32_t>(
+            leaf_begin, node_values_[node_idx].offset / leaf_value_dim_);
+      }
+    }
+    tree_leaf_begins_[tree_idx] = leaf_begin;
+  }
+}
+
+float FlatForest::SparsifyLeaves(const int top_k) {
+  DCHECK_LT(top_k, leaf_value_dim_);
+  const std::vector<float> dense_values(leaf_values_.begin(),
+                                        leaf_values_.end());
+  leaf_values_.clear();
+  leaf_classes_.clear();
+  std::vector<uint16_t> classes(leaf_value_dim_);
+  float max_dropped_value = 0.f;
+  // Note: The leaves keep their order, so the leaves of a tree stay contiguous.
+  for (int node_idx = 0; node_idx < num_nodes(); node_idx++) {
+    if (node_types_[node_idx] != NodeType::kLeaf) {
+      continue;
+    }
+    const float* dense = &dense_values[node_values_[node_idx].offset];
+    std::iota(classes.begin(), classes.end(), 0);
+    std::partial_sort(classes.begin(), classes.begin() + top_k, classes.end(),
+                      [dense](const uint16_t a, const uint16_t b) {
+                        return dense[a] > dense[b] ||
+                               (dense[a] == dense[b] && a < b);
+                      });
+    float dropped_value = 0.f;
+    for (int i = top_k; i < leaf_value_dim_; i++) {
+      dropped_value += std::abs(dense[classes[i]]);
+    }
+    max_dropped_value = std::max(max_dropped_value, dropped_value);
+    // The values of a leaf are added in class order, i.e. to increasing
+    // addresses of the accumulator.
+    std::sort(classes.begin(), classes.begin() + top_k);
+    node_values_[node_idx].offset = leaf_values_.size();
+    for (int i = 0; i < top_k; i++) {
+      leaf_values_.push_back(dense[classes[i]]);
+      leaf_classes_.push_back(classes[i]);
+    }
+  }
+  leaf_value_dim_ = top_k;
+  return max_dropped_value;
+}
+
+void FlatForest::InitializeFeatureContributions() {
+  tree_expected_values_.clear();
+  max_tree_depth_ = 0;
+  // Note: The contributions of sparse leaves are not supported.
+  if (node_covers_.size() != static_cast<size_t>(num_nodes()) ||
+      HasSparseLeaves()) {
+    node_covers_.clear();
+    return;
+  }
+  // Note: The arrays can be memory mapped, and are only read.
+  const FlatArray<float>& covers = node_covers_;
+  const FlatArray<float>& leaf_values = leaf_values_;
+  for (int node_idx = 0; node_idx < num_nodes(); node_idx++) {
+    if (node_types_[node_idx] != NodeType::kLeaf &&
+        !(covers[node_idx] > 0.f)) {
+      node_covers_.clear();
+      return;
+    }
+  }
+
+  tree_expected_values_.assign(num_trees() * leaf_value_dim_, 0.f);
+  // Depth of the nodes of the current tree, indexed from the root.
+  std::vector<int> depths;
+  for (int tree_idx = 0; tree_idx < num_trees(); tree_idx++) {
+    const int root = tree_roots_[tree_idx];
+    const int node_end =
+        tree_idx + 1 < num_trees() ? tree_roots_[tree_idx + 1] : num_nodes();
+    const float root_cover = covers[root];
+    float* expected_value = &tree_expected_values_[tree_idx * leaf_value_dim_];
+    // Note: The parents are stored before their children.
+    depths.assign(node_end - root, 0);
+    for (int node_idx = root; node_idx < node_end; node_idx++) {
+      const int depth = depths[node_idx - root];
+      max_tree_depth_ = std::max(max_tree_depth_, depth);
+      if (node_types_[node_idx] != NodeType::kLeaf) {
+        const int neg_child = node_children_[node_idx];
+        depths[neg_child - root] = depths[neg_child + 1 - root] = depth + 1;
+        continue;
+      }
+      const float weight =
+          root_cover > 0.f ? covers[node_idx] / root_cover : 1.f;
+      const float* leaf = &leaf_values[node_values_[node_idx].offset];
+      for (int dim = 0; dim < leaf_value_dim_; dim++) {
+        expected_value[dim] += weight * leaf[dim];
+      }
+    }
+  }
+}
+
+void FlatForest::InitializeSimdTraversal() {
+  simd_node_features_.clear();
+  simd_node_thresholds_.clear();
+  simd_node_na_values_.clear();
+  for (const auto type : node_types_) {
+    if (type != NodeType::kLeaf && type != NodeType::kHigher) {
+      return;
+    }
+  }
+  const int num_nodes = node_types_.size();
+  simd_node_features_.resize(num_nodes);
+  simd_node_thresholds_.resize(num_nodes);
+  simd_node_na_values_.resize(num_nodes);
+  for (int node_idx = 0; node_idx < num_nodes; node_idx++) {
+    const bool is_leaf = node_types_[node_idx] == NodeType::kLeaf;
+    simd_node_features_[node_idx] = is_leaf ? -1 : node_features_[node_idx];
+    simd_node_thresholds_[node_idx] =
+        is_leaf ? 0.f : node_values_[node_idx].threshold;
+    simd_node_na_values_[node_idx] = node_na_values_[node_idx];
+  }
+}
+
+namespace {
+
+// Format of the files written by "FlatForest::Save":
+//   - The header "FlatForestFileHeader".
+//   - A sequence of sections. Each section is a 64 bits size (in bytes)
+//     followed by the raw content of the section.
+// Each header, section size and section content starts on a
+// "kFlatForestFileAlignment" bytes boundary so the arrays can be used in place
+// from a memory mapped file.
+constexpr char kFlatForestFileMagic[8] = {'T', 'F', 'D', 'F',
+                                          'F', 'L', 'A', 'T'};
+//
+// Version 2 adds the node covers. Files of version 1 are still opened, without
+// node covers. Version 3 adds the number of values of the categorical set
+// features, for the "kContainsAny" conditions. Version 4 adds the classes of
+// the sparse leaves. Version 5 adds the fingerprint of the model content the
+// forest was built from.
+constexpr uint32_t kFlatForestFileVersion = 5;
+constexpr uint32_t kFlatForestFileByteOrderMark = 0x01020304;
+constexpr uint64_t kFlatForestFileAlignment = 64;
+
+struct FlatForestFileHeader {
+  char magic[8];
+  uint32_t version;
+  // Detects files written on a host with a different byte order.
+  uint32_t byte_order_mark;
+  int32_t task;
+  int32_t label_col_idx;
+  int32_t leaf_value_dim;
+  int32_t finalization;
+  // See "FlatForest::Metadata::content_fingerprint". Zero before version 5.
+  uint64_t content_fingerprint_low64;
+  uint64_t content_fingerprint_high64;
+};
+// Note: The header of the files of the previous versions, shorter, is padded
+// to the same alignment.
+static_assert(sizeof(FlatForestFileHeader) <= kFlatForestFileAlignment,
+              "The flat forest file header should fit in one alignment block");
+
+uint64_t RoundUpToAlignment(const uint64_t num_bytes) {
+  return (num_bytes + kFlatForestFileAlignment - 1) /
+         kFlatForestFileAlignment * kFlatForestFileAlignment;
+}
+
+class FlatForestFileWriter {
+ public:
+  explicit FlatForestFileWriter(tf::WritableFile* file) : file_(file) {}
+
+  // Appends "num_bytes" bytes followed by the alignment padding.
+  tf::Status AppendAligned(const void* data, const uint64_t num_bytes) {
+    TF_RETURN_IF_ERROR(file_->Append(
+        absl::string_view(static_cast<const char*>(data), num_bytes)));
+    const uint64_t num_padding_bytes =
+        RoundUpToAlignment(num_bytes) - num_bytes;
+    if (num_padding_bytes > 0) {
+      const std::string padding(num_padding_bytes, '\0');
+      TF_RETURN_IF_ERROR(file_->Append(padding));
+    }
+    return tf::Status::OK();
+  }
+
+  tf::Status AppendSection(const void* data, uint64_t num_bytes) {
+    TF_RETURN_IF_ERROR(AppendAligned(&num_bytes, sizeof(num_bytes)));
+    return AppendAligned(data, num_bytes);
+  }
+
+  // Appends the values of a "std::vector" or a "FlatArray".
+  template <typename Array>
+  tf::Status AppendArray(const Array& values) {
+    return AppendSection(values.data(),
+                         values.size() * sizeof(*values.data()));
+  }
+
+ private:
+  tf::WritableFile* file_;
+};
+
+class FlatForestFileReader {
+ public:
+  FlatForestFileReader(const char* data, const uint64_t num_bytes)
+      : data_(data), num_bytes_(num_bytes) {}
+
+  // Reads "num_bytes" bytes followed by the alignment padding.
+  tf::Status ReadAligned(const uint64_t num_bytes, const char** data) {
+    if (num_bytes > num_bytes_ - offset_) {
+      return tf::errors::DataLoss("Truncated flat forest file");
+    }
+    *data = data_ + offset_;
+    offset_ = std::min(num_bytes_, offset_ + RoundUpToAlignment(num_bytes));
+    return tf::Status::OK();
+  }
+
+  tf::Status ReadSection(const char** data, uint64_t* num_bytes) {
+    const char* raw_num_bytes;
+    TF_RETURN_IF_ERROR(ReadAligned(sizeof(*num_bytes), &raw_num_bytes));
+    std::memcpy(num_bytes, raw_num_bytes, sizeof(*num_bytes));
+    return ReadAligned(*num_bytes, data);
+  }
+
+  // Makes "values" a view of the next section.
+  template <typename T>
+  tf::Status MapArray(FlatArray<T>* values) {
+    const char* data;
+    uint64_t num_bytes;
+    TF_RETURN_IF_ERROR(ReadSection(&data, &num_bytes));
+    if (num_bytes % sizeof(T) != 0) {
+      return tf::errors::DataLoss("Invalid flat forest section size");
+    }
+    values->Map(reinterpret_cast<const T*>(data), num_bytes / sizeof(T));
+    return tf::Status::OK();
+  }
+
+  // Copies the next section into "values".
+  template <typename T>
+  tf::Status CopyArray(std::vector<T>* values) {
+    const char* data;
+    uint64_t num_bytes;
+    TF_RETURN_IF_ERROR(ReadSection(&data, &num_bytes));
+    if (num_bytes % sizeof(T) != 0) {
+      return tf::errors::DataLoss("Invalid flat forest section size");
+    }
+    values->resize(num_bytes / sizeof(T));
+    std::memcpy(values->data(), data, num_bytes);
+    return tf::Status::OK();
+  }
+
+ private:
+  const char* const data_;
+  const uint64_t num_bytes_;
+  uint64_t offset_ = 0;
+};
+
+// Content of a file read in memory. Used when the file system does not support
+// memory mapping.
+class InMemoryRegion : public tf::ReadOnlyMemoryRegion {
+ public:
+  static tf::Status Read(const std::string& path,
+                         std::unique_ptr<tf::ReadOnlyMemoryRegion>* region) {
+    auto* env = tf::Env::Default();
+    tf::uint64 num_bytes;
+    TF_RETURN_IF_ERROR(env->GetFileSize(path, &num_bytes));
+    std::unique_ptr<tf::RandomAccessFile> file;
+    TF_RETURN_IF_ERROR(env->NewRandomAccessFile(path, &file));
+    auto in_memory = absl::WrapUnique(new InMemoryRegion(num_bytes));
+    char* buffer = reinterpret_cast<char*>(in_memory->buffer_.data());
+    absl::string_view result;
+    TF_RETURN_IF_ERROR(file->Read(0, num_bytes, &result, buffer));
+    if (result.size() != num_bytes) {
+      return tf::errors::DataLoss("Truncated read of ", path);
+    }
+    if (result.data() != buffer) {
+      std::memcpy(buffer, result.data(), num_bytes);
+    }
+    *region = std::move(in_memory);
+    return tf::Status::OK();
+  }
+
+  const void* data() override { return buffer_.data(); }
+  tf::uint64 length() override { return num_bytes_; }
+
+ private:
+  explicit InMemoryRegion(const uint64_t num_bytes)
+      : num_bytes_(num_bytes),
+        // Note: "uint64_t" words to align the sections.
+        buffer_((num_bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t)) {}
+
+  const uint64_t num_bytes_;
+  std::vector<uint64_t> buffer_;
+};
+
+// Anonymous memory aligned on, and backed when possible by, 2MB transparent
+// huge pages. On Linux, the kernel is asked to back the region with huge pages
+// with "madvise" (which is a no-op if transparent huge pages are disabled). On
+// the other platforms, the region is regular aligned memory.
+class HugePageRegion : public tf::ReadOnlyMemoryRegion {
+ public:
+  static constexpr uint64_t kHugePageSize = 2 << 20;
+
+  static tf::Status Allocate(const uint64_t num_bytes,
+                             std::unique_ptr<HugePageRegion>* region) {
+    const uint64_t num_allocated_bytes =
+        (num_bytes + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+#if defined(__linux__)
+    // Over-allocates by a huge page, and unmaps the unaligned head and tail.
+    void* const mapping =
+        mmap(nullptr, num_allocated_bytes + kHugePageSize,
+             PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+      return tf::errors::ResourceExhausted("Cannot map ", num_allocated_bytes,
+                                           " bytes of huge pages");
+    }
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(mapping);
+    const uintptr_t aligned_begin =
+        (begin + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+    if (aligned_begin > begin) {
+      munmap(mapping, aligned_begin - begin);
+    }
+    const uintptr_t end = begin + num_allocated_bytes + kHugePageSize;
+    const uintptr_t aligned_end = aligned_begin + num_allocated_bytes;
+    if (end > aligned_end) {
+      munmap(reinterpret_cast<void*>(aligned_end), end - aligned_end);
+    }
+    char* const data = reinterpret_cast<char*>(aligned_begin);
+    if (madvise(data, num_allocated_bytes, MADV_HUGEPAGE) != 0) {
+      VLOG(1) << "Transparent huge pages are not available";
+    }
+#else
+    char* const data = static_cast<char*>(
+        tf::port::AlignedMalloc(num_allocated_bytes, kFlatForestFileAlignment));
+    if (data == nullptr) {
+      return tf::errors::ResourceExhausted("Cannot allocate ",
+                                           num_allocated_bytes, " bytes");
+    }
+#endif
+    region->reset(new HugePageRegion(data, num_bytes, num_allocated_bytes));
+    return tf::Status::OK();
+  }
+
+  ~HugePageRegion() override {
+#if defined(__linux__)
+    munmap(data_, num_allocated_bytes_);
+#else
+    tf::port::AlignedFree(data_);
+#endif
+  }
+
+  const void* data() override { return data_; }
+  tf::uint64 length() override { return num_bytes_; }
+  char* mutable_data() { return data_; }
+
+ private:
+  HugePageRegion(char* const data, const uint64_t num_bytes,
+                 const uint64_t num_allocated_bytes)
+      : data_(data),
+        num_bytes_(num_bytes),
+        num_allocated_bytes_(num_allocated_bytes) {}
+
+  char* const data_;
+  const uint64_t num_bytes_;
+  const uint64_t num_allocated_bytes_;
+};
+
+// Shared lock ("flock") on a flat forest file, held by each process while it
+// uses the file, so that the processes of a host mapping the same file (e.g.
+// in a "flat_forest_cache_dir" in shared memory) count its users. When the
+// lock is released, the file is deleted if no other process holds a lock on
+// it. Deleting the file does not affect the processes still mapping it: its
+// memory is released when the last mapping is.
+//
+// The file must be mapped from "locked_path()", i.e. from the locked file
+// descriptor: the file at "path" can be deleted, or replaced by another
+// process saving it, once locked.
+class FlatForestFileLock {
+ public:
+  static tf::Status Acquire(const std::string& path,
+                            std::unique_ptr<FlatForestFileLock>* lock) {
+#if defined(__linux__)
+    // Note: A process can delete the file between its opening and its locking
+    // by this process. The lock is then retried on the file at "path", if any.
+    constexpr int kMaxAttempts = 3;
+    for (int attempt = 0; attempt < kMaxAttempts; attempt++) {
+      const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+        return tf::errors::NotFound("Cannot open ", path, ": ",
+                                    std::strerror(errno));
+      }
+      if (flock(fd, LOCK_SH) != 0) {
+        const int error = errno;
+        close(fd);
+        return tf::errors::Internal("Cannot lock ", path, ": ",
+                                    std::strerror(error));
+      }
+      struct stat locked_stat;
+      struct stat path_stat;
+      if (fstat(fd, &locked_stat) == 0 && stat(path.c_str(), &path_stat) == 0 &&
+          locked_stat.st_dev == path_stat.st_dev &&
+          locked_stat.st_ino == path_stat.st_ino) {
+        lock->reset(new FlatForestFileLock(path, fd));
+        return tf::Status::OK();
+      }
+      close(fd);
+    }
+    return tf::errors::Unavailable("Cannot lock ", path,
+                                   ": The file keeps being replaced");
+#else
+    return tf::errors::Unimplemented(
+        "The flat forest files are only locked on Linux");
+#endif
+  }
+
+  // Path of the locked file, valid while the lock is held.
+  std::string locked_path() const {
+    return absl::StrCat("/proc/self/fd/", fd_);
+  }
+
+  ~FlatForestFileLock() {
+#if defined(__linux__)
+    // Note: Only succeeds if no other process holds a lock on the file.
+    if (flock(fd_, LOCK_EX | LOCK_NB) == 0) {
+      VLOG(1) << "Delete the unused flat forest " << path_;
+      unlink(path_.c_str());
+    }
+    close(fd_);
+#endif
+  }
+
+ private:
+  FlatForestFileLock(const std::string& path, const int fd)
+      : path_(path), fd_(fd) {}
+
+  const std::string path_;
+  const int fd_;
+};
+
+}  // namespace
+
+tf::Status FlatForest::Save(const Metadata& metadata,
+                            const std::string& path) const {
+  auto* env = tf::Env::Default();
+  const std::string tmp_path = absl::StrCat(path, ".tmp-", env->NowMicros());
+  const auto write = [&]() -> tf::Status {
+    std::unique_ptr<tf::WritableFile> file;
+    TF_RETURN_IF_ERROR(env->NewWritableFile(tmp_path, &file));
+    FlatForestFileWriter writer(file.get());
+
+    FlatForestFileHeader header{};
+    std::memcpy(header.magic, kFlatForestFileMagic, sizeof(header.magic));
+    header.version = kFlatForestFileVersion;
+    header.byte_order_mark = kFlatForestFileByteOrderMark;
+    header.task = metadata.task;
+    header.label_col_idx = metadata.label_col_idx;
+    header.leaf_value_dim = leaf_value_dim_;
+    header.finalization = static_cast<int32_t>(finalization_);
+    header.content_fingerprint_low64 = metadata.content_fingerprint.low64;
+    header.content_fingerprint_high64 = metadata.content_fingerprint.high64;
+    TF_RETURN_IF_ERROR(writer.AppendAligned(&header, sizeof(header)));
+
+    std::string serialized_data_spec;
+    if (!metadata.data_spec.SerializeToString(&serialized_data_spec)) {
+      return tf::errors::Internal("Cannot serialize the dataspec");
+    }
+    TF_RETURN_IF_ERROR(writer.AppendSection(serialized_data_spec.data(),
+                                            serialized_data_spec.size()));
+    TF_RETURN_IF_ERROR(writer.AppendArray(metadata.input_features));
+    TF_RETURN_IF_ERROR(writer.AppendArray(initial_accumulator_));
+    TF_RETURN_IF_ERROR(writer.AppendArray(categorical_max_values_));
+    TF_RETURN_IF_ERROR(writer.AppendArray(tree_roots_));
+    TF_RETURN_IF_ERROR(writer.AppendArray(node_types_));
+    TF_RETURN_IF_ERROR(writer.AppendArray(node_na_values_));
+    TF_RETURN_IF_ERROR(writer.AppendArray(node_features_));
+    TF_RETURN_IF_ERROR(writer.AppendArray(node_children_));
+    TF_RETURN_IF_ERROR(writer.AppendArray(node_values_));
+    TF_RETURN_IF_ERROR(writer.AppendArray(bitmaps_));
+    TF_RETURN_IF_ERROR(writer.AppendArray(leaf_values_));
+    TF_RETURN_IF_ERROR(writer.AppendArray(simd_node_features_));
+    TF_RETURN_IF_ERROR(writer.AppendArray(simd_node_thresholds_));
+    TF_RETURN_IF_ERROR(writer.AppendArray(simd_node_na_values_));
+    TF_RETURN_IF_ERROR(writer.AppendArray(node_covers_));
+    TF_RETURN_IF_ERROR(writer.AppendArray(categorical_set_max_values_));
+    TF_RETURN_IF_ERROR(writer.AppendArray(leaf_classes_));
+    TF_RETURN_IF_ERROR(file->Close());
+    return env->RenameFile(tmp_path, path);
+  };
+  const auto status = write();
+  if (!status.ok()) {
+    env->DeleteFile(tmp_path).IgnoreError();
+  }
+  return status;
+}
+
+tf::Status FlatForest::Map(const std::string& path,
+                           std::unique_ptr<FlatForest>* forest,
+                           Metadata* metadata) {
+  auto flat_forest = absl::WrapUnique(new FlatForest());
+  auto& region = flat_forest->mapped_region_;
+  auto* env = tf::Env::Default();
+  if (!env->NewReadOnlyMemoryRegionFromFile(path, &region).ok()) {
+    TF_RETURN_IF_ERROR(InMemoryRegion::Read(path, &region));
+  }
+  FlatForestFileReader reader(static_cast<const char*>(region->data()),
+                              region->length());
+
+  const char* raw_header;
+  TF_RETURN_IF_ERROR(
+      reader.ReadAligned(sizeof(FlatForestFileHeader), &raw_header));
+  FlatForestFileHeader header;
+  std::memcpy(&header, raw_header, sizeof(header));
+  if (std::memcmp(header.magic, kFlatForestFileMagic, sizeof(header.magic)) !=
+          0 ||
+      header.byte_order_mark != kFlatForestFileByteOrderMark) {
+    return tf::errors::DataLoss(path, " is not a flat forest file");
+  }
+  if (header.version < 1 || header.version > kFlatForestFileVersion) {
+    return tf::errors::FailedPrecondition(
+        "Non supported flat forest file version ", header.version, " in ",
+        path);
+  }
+  metadata->task = static_cast<Task>(header.task);
+  metadata->label_col_idx = header.label_col_idx;
+  if (header.version >= 5) {
+    metadata->content_fingerprint.low64 = header.content_fingerprint_low64;
+    metadata->content_fingerprint.high64 = header.content_fingerprint_high64;
+  }
+  flat_forest->leaf_value_dim_ = header.leaf_value_dim;
+  if (header.finalization < 0 ||
+      header.finalization > static_cast<int32_t>(Finalization::kSoftmax)) {
+    return tf::errors::DataLoss("Unknown finalization ", header.finalization,
+                                " in ", path);
+  }
+  flat_forest->finalization_ = static_cast<Finalization>(header.finalization);
+
+  const char* serialized_data_spec;
+  uint64_t serialized_data_spec_size;
+  TF_RETURN_IF_ERROR(
+      reader.ReadSection(&serialized_data_spec, &serialized_data_spec_size));
+  if (!metadata->data_spec.ParseFromArray(serialized_data_spec,
+                                          serialized_data_spec_size)) {
+    return tf::errors::DataLoss("Cannot parse the dataspec of ", path);
+  }
+  TF_RETURN_IF_ERROR(reader.CopyArray(&metadata->input_features));
+  TF_RETURN_IF_ERROR(reader.CopyArray(&flat_forest->initial_accumulator_));
+  TF_RETURN_IF_ERROR(reader.CopyArray(&flat_forest->categorical_max_values_));
+  TF_RETURN_IF_ERROR(reader.MapArray(&flat_forest->tree_roots_));
+  TF_RETURN_IF_ERROR(reader.MapArray(&flat_forest->node_types_));
+  TF_RETURN_IF_ERROR(reader.MapArray(&flat_forest->node_na_values_));
+  TF_RETURN_IF_ERROR(reader.MapArray(&flat_forest->node_features_));
+  TF_RETURN_IF_ERROR(reader.MapArray(&flat_forest->node_children_));
+  TF_RETURN_IF_ERROR(reader.MapArray(&flat_forest->node_values_));
+  TF_RETURN_IF_ERROR(reader.MapArray(&flat_forest->bitmaps_));
+  TF_RETURN_IF_ERROR(reader.MapArray(&flat_forest->leaf_values_));
+  TF_RETURN_IF_ERROR(reader.MapArray(&flat_forest->simd_node_features_));
+  TF_RETURN_IF_ERROR(reader.MapArray(&flat_forest->simd_node_thresholds_));
+  TF_RETURN_IF_ERROR(reader.MapArray(&flat_forest->simd_node_na_values_));
+  if (header.version >= 2) {
+    TF_RETURN_IF_ERROR(reader.MapArray(&flat_forest->node_covers_));
+  }
+  if (header.version >= 3) {
+    TF_RETURN_IF_ERROR(
+        reader.CopyArray(&flat_forest->categorical_set_max_values_));
+  }
+  if (header.version >= 4) {
+    TF_RETURN_IF_ERROR(reader.MapArray(&flat_forest->leaf_classes_));
+  }
+
+  const size_t num_nodes = flat_forest->node_types_.size();
+  if (flat_forest->node_na_values_.size() != num_nodes ||
+      flat_forest->node_features_.size() != num_nodes ||
+      flat_forest->node_children_.size() != num_nodes ||
+      flat_forest->node_values_.size() != num_nodes ||
+      (!flat_forest->node_covers_.empty() &&
+       flat_forest->node_covers_.size() != num_nodes) ||
+      (flat_forest->HasSparseLeaves() &&
+       flat_forest->leaf_classes_.size() !=
+           flat_forest->leaf_values_.size())) {
+    return tf::errors::DataLoss("Inconsistent node arrays in ", path);
+  }
+  FeatureIndex feature_index;
+  TF_RETURN_IF_ERROR(
+      feature_index.Initialize(metadata->input_features, metadata->data_spec));
+  const auto status = flat_forest->Validate(feature_index);
+  if (!status.ok()) {
+    return tf::errors::DataLoss("Invalid flat forest ", path, ": ",
+                                status.error_message());
+  }
+  flat_forest->InitializeEarlyExitBounds();
+  flat_forest->InitializeFeatureContributions();
+  flat_forest->InitializeLeafIndices();
+  *forest = std::move(flat_forest);
+  return tf::Status::OK();
+}
+
+tf::Status FlatForest::Validate(const FeatureIndex& feature_index) const {
+  if (leaf_value_dim_ < 1 || leaf_value_dim_ > accumulator_dim()) {
+    return tf::errors::InvalidArgument("Leaf value dimension ",
+                                       leaf_value_dim_,
+                                       " out of the accumulator dimension ",
+                                       accumulator_dim());
+  }
+  if (finalization_ == Finalization::kSigmoidBinary && accumulator_dim() != 1) {
+    return tf::errors::InvalidArgument(
+        "The sigmoid binary finalization expects an accumulator dimension of "
+        "1, got ",
+        accumulator_dim());
+  }
+  for (const uint16_t leaf_class : leaf_classes_) {
+    if (leaf_class >= accumulator_dim()) {
+      return tf::errors::InvalidArgument("Leaf class ", leaf_class,
+                                         " out of the accumulator dimension ",
+                                         accumulator_dim());
+    }
+  }
+  if (categorical_max_values_.size() !=
+      feature_index.categorical_int_features().size()) {
+    return tf::errors::InvalidArgument(
+        "Number of categorical features does not match the model");
+  }
+  if (!simd_node_features_.empty() &&
+      (simd_node_features_.size() != node_types_.size() ||
+       simd_node_thresholds_.size() != node_types_.size() ||
+       simd_node_na_values_.size() != node_types_.size())) {
+    return tf::errors::InvalidArgument("Inconsistent SIMD node arrays");
+  }
+
+  // Note: The nodes of a tree are stored after its root, and the children
+  // after their parent, so the traversals end.
+  for (int tree_idx = 0; tree_idx < num_trees(); tree_idx++) {
+    const int root = tree_roots_[tree_idx];
+    const int node_end =
+        tree_idx + 1 < num_trees() ? tree_roots_[tree_idx + 1] : num_nodes();
+    if ((tree_idx == 0 && root != 0) || root >= node_end ||
+        node_end > num_nodes()) {
+      return tf::errors::InvalidArgument("Invalid root of tree ", tree_idx);
+    }
+    for (int node_idx = root; node_idx < node_end; node_idx++) {
+      const NodeType type = node_types_[node_idx];
+      const int32_t feature = node_features_[node_idx];
+      int num_features;
+      switch (type) {
+        case NodeType::kLeaf: {
+          const uint32_t offset = node_values_[node_idx].offset;
+          if (offset > leaf_values_.size() ||
+              leaf_values_.size() - offset <
+                  static_cast<size_t>(leaf_value_dim_)) {
+            return tf::errors::InvalidArgument("Leaf values of node ",
+                                               node_idx, " out of bounds");
+          }
+          if (!simd_node_features_.empty() &&
+              simd_node_features_[node_idx] != -1) {
+            return tf::errors::InvalidArgument("Invalid SIMD leaf ",
+                                               node_idx);
+          }
+          continue;
+        }
+        case NodeType::kHigher:
+        case NodeType::kNumericalIsNa:
+          num_features = feature_index.numerical_features().size();
+          break;
+        case NodeType::kTrueValue:
+        case NodeType::kBooleanIsNa:
+          num_features = feature_index.boolean_features().size();
+          break;
+        case NodeType::kContains:
+        case NodeType::kCategoricalIsNa:
+          num_features = categorical_max_values_.size();
+          break;
+        case NodeType::kContainsAny:
+          // Note: The rows of the categorical set features are indexed with
+          // the number of features of the forest.
+          if (categorical_set_max_values_.size() !=
+              feature_index.categorical_set_int_features().size()) {
+            return tf::errors::InvalidArgument(
+                "Number of categorical set features does not match the "
+                "model");
+          }
+          num_features = categorical_set_max_values_.size();
+          break;
+        default:
+          return tf::errors::InvalidArgument("Invalid type of node ",
+                                             node_idx);
+      }
+      if (feature < 0 || feature >= num_features) {
+        return tf::errors::InvalidArgument("Feature of node ", node_idx,
+                                           " out of bounds");
+      }
+      if (type == NodeType::kContains || type == NodeType::kContainsAny) {
+        // The values outside of [0, max_value) read the bit 0.
+        const int32_t max_value = type == NodeType::kContains
+                                      ? categorical_max_values_[feature]
+                                      : categorical_set_max_values_[feature];
+        const uint32_t offset = node_values_[node_idx].offset;
+        const size_t num_words = (std::max(max_value, 1) + 63) / 64;
+        if (offset > bitmaps_.size() ||
+            bitmaps_.size() - offset < num_words) {
+          return tf::errors::InvalidArgument("Bitmap of node ", node_idx,
+                                             " out of bounds");
+        }
+      }
+      const int32_t neg_child = node_children_[node_idx];
+      if (neg_child <= node_idx || neg_child >= node_end - 1) {
+        return tf::errors::InvalidArgument("Children of node ", node_idx,
+                                           " out of its tree");
+      }
+      if (!simd_node_features_.empty() &&
+          (type != NodeType::kHigher ||
+           simd_node_features_[node_idx] != feature)) {
+        return tf::errors::InvalidArgument("Invalid SIMD node ", node_idx);
+      }
+    }
+  }
+  return tf::Status::OK();
+}
+
+tf::Status FlatForest::MoveToHugePages() {
+  const auto for_each_array = [this](const auto& function) {
+    function(&tree_roots_);
+    function(&node_types_);
+    function(&node_na_values_);
+    function(&node_features_);
+    function(&node_children_);
+    function(&node_values_);
+    function(&bitmaps_);
+    function(&leaf_values_);
+    function(&leaf_classes_);
+    function(&simd_node_features_);
+    function(&simd_node_thresholds_);
+    function(&simd_node_na_values_);
+    function(&node_covers_);
+  };
+
+  // Each array starts on a "kFlatForestFileAlignment" bytes boundary, as in
+  // the flat forest files.
+  uint64_t num_bytes = 0;
+  for_each_array([&](const auto* array) {
+    num_bytes += RoundUpToAlignment(array->bytes().size());
+  });
+  if (num_bytes == 0) {
+    return tf::Status::OK();
+  }
+  std::unique_ptr<HugePageRegion> region;
+  TF_RETURN_IF_ERROR(HugePageRegion::Allocate(num_bytes, &region));
+  char* next = region->mutable_data();
+  for_each_array([&](auto* array) {
+    using T = typename std::remove_pointer<decltype(array)>::type::value_type;
+    const auto bytes = array->bytes();
+    std::memcpy(next, bytes.data(), bytes.size());
+    array->Map(reinterpret_cast<const T*>(next), array->size());
+    next += RoundUpToAlignment(bytes.size());
+  });
+  // Note: Releases the previous region, if any, after the arrays are moved
+  // out of it.
+  mapped_region_ = std::move(region);
+  return tf::Status::OK();
+}
+
+void FlatForest::Prefault() const {
+  if (mapped_region_ == nullptr) {
+    return;
+  }
+  const char* const data = static_cast<const char*>(mapped_region_->data());
+  const uint64_t num_bytes = mapped_region_->length();
+#if defined(__linux__)
+  // Starts the read-ahead of the whole file. Fails on unaligned regions
+  // (e.g. "InMemoryRegion"), which are already in memory.
+  madvise(const_cast<char*>(data), num_bytes, MADV_WILLNEED);
+#endif
+  // Note: The reads are volatile so they are not optimized out.
+  constexpr uint64_t kPageSize = 4096;
+  const volatile char* const volatile_data = data;
+  for (uint64_t offset = 0; offset < num_bytes; offset += kPageSize) {
+    volatile_data[offset];
+  }
+  VLOG(2) << "Prefaulted flat forest (" << num_bytes << " bytes)";
+}
+
+namespace {
+
+// Raw bytes of a "std::vector".
+template <typename T>
+absl::string_view VectorBytes(const std::vector<T>& values) {
+  return absl::string_view(reinterpret_cast<const char*>(values.data()),
+                           values.size() * sizeof(T));
+}
+
+}  // namespace
+
+uint64_t FlatForest::Fingerprint() const {
+  uint64_t fingerprint = tf::Hash64Combine(
+      leaf_value_dim_, static_cast<uint64_t>(finalization_));
+  for (const auto bytes :
+       {VectorBytes(initial_accumulator_), VectorBytes(categorical_max_values_),
+        tree_roots_.bytes(), node_types_.bytes(), node_na_values_.bytes(),
+        node_features_.bytes(), node_children_.bytes(), node_values_.bytes(),
+        bitmaps_.bytes(), leaf_values_.bytes()}) {
+    fingerprint = tf::Hash64Combine(
+        fingerprint, tf::Hash64(bytes.data(), bytes.size(), bytes.size()));
+  }
+  // Note: Only hashed if set, so the fingerprint of the forests without
+  // categorical set features or sparse leaves (e.g. of existing compiled
+  // forests) is unchanged.
+  for (const auto bytes :
+       {VectorBytes(categorical_set_max_values_), leaf_classes_.bytes()}) {
+    if (!bytes.empty()) {
+      fingerprint = tf::Hash64Combine(
+          fingerprint, tf::Hash64(bytes.data(), bytes.size(), bytes.size()));
+    }
+  }
+  return fingerprint;
+}
+
+bool FlatForest::Equals(const FlatForest& other) const {
+  // Note: The "simd_*" arrays are derived from the other node arrays.
+  return leaf_value_dim_ == other.leaf_value_dim_ &&
+         finalization_ == other.finalization_ &&
+         VectorBytes(initial_accumulator_) ==
+             VectorBytes(other.initial_accumulator_) &&
+         VectorBytes(categorical_max_values_) ==
+             VectorBytes(other.categorical_max_values_) &&
+         VectorBytes(categorical_set_max_values_) ==
+             VectorBytes(other.categorical_set_max_values_) &&
+         tree_roots_.bytes() == other.tree_roots_.bytes() &&
+         node_types_.bytes() == other.node_types_.bytes() &&
+         node_na_values_.bytes() == other.node_na_values_.bytes() &&
+         node_features_.bytes() == other.node_features_.bytes() &&
+         node_children_.bytes() == other.node_children_.bytes() &&
+         node_values_.bytes() == other.node_values_.bytes() &&
+         bitmaps_.bytes() == other.bitmaps_.bytes() &&
+         leaf_values_.bytes() == other.leaf_values_.bytes() &&
+         leaf_classes_.bytes() == other.leaf_classes_.bytes() &&
+         node_covers_.bytes() == other.node_covers_.bytes();
+}
+
+uint64_t FlatForest::StructureFingerprint() const {
+  uint64_t fingerprint = tf::Hash64Combine(
+      leaf_value_dim_, static_cast<uint64_t>(finalization_));
+  for (const auto bytes :
+       {VectorBytes(categorical_max_values_),
+        VectorBytes(categorical_set_max_values_), tree_roots_.bytes(),
+        node_types_.bytes(), node_na_values_.bytes(), node_features_.bytes(),
+        node_children_.bytes(), node_values_.bytes(), bitmaps_.bytes(),
+        node_covers_.bytes()}) {
+    fingerprint = tf::Hash64Combine(
+        fingerprint, tf::Hash64(bytes.data(), bytes.size(), bytes.size()));
+  }
+  fingerprint = tf::Hash64Combine(fingerprint, leaf_values_.size());
+  return tf::Hash64Combine(fingerprint, leaf_classes_.size());
+}
+
+bool FlatForest::SameStructure(const FlatForest& other) const {
+  return leaf_value_dim_ == other.leaf_value_dim_ &&
+         finalization_ == other.finalization_ &&
+         VectorBytes(categorical_max_values_) ==
+             VectorBytes(other.categorical_max_values_) &&
+         VectorBytes(categorical_set_max_values_) ==
+             VectorBytes(other.categorical_set_max_values_) &&
+         tree_roots_.bytes() == other.tree_roots_.bytes() &&
+         node_types_.bytes() == other.node_types_.bytes() &&
+         node_na_values_.bytes() == other.node_na_values_.bytes() &&
+         node_features_.bytes() == other.node_features_.bytes() &&
+         node_children_.bytes() == other.node_children_.bytes() &&
+         node_values_.bytes() == other.node_values_.bytes() &&
+         bitmaps_.bytes() == other.bitmaps_.bytes() &&
+         node_covers_.bytes() == other.node_covers_.bytes() &&
+         leaf_values_.size() == other.leaf_values_.size() &&
+         leaf_classes_.size() == other.leaf_classes_.size();
+}
+
+void FlatForest::ShareStructure(std::shared_ptr<const FlatForest> structure) {
+  DCHECK(SameStructure(*structure));
+  // The leaves might be in the memory region released below.
+  if (mapped_region_) {
+    const auto own = [](auto* array) {
+      using T = typename std::remove_pointer<decltype(array)>::type::value_type;
+      const std::vector<T> values(array->begin(), array->end());
+      array->clear();
+      array->resize(values.size());
+      for (size_t value_idx = 0; value_idx < values.size(); value_idx++) {
+        (*array)[value_idx] = values[value_idx];
+      }
+    };
+    own(&leaf_values_);
+    own(&leaf_classes_);
+  }
+
+  const auto share = [](const auto& source, auto* array) {
+    array->Map(source.data(), source.size());
+  };
+  share(structure->tree_roots_, &tree_roots_);
+  share(structure->node_types_, &node_types_);
+  share(structure->node_na_values_, &node_na_values_);
+  share(structure->node_features_, &node_features_);
+  share(structure->node_children_, &node_children_);
+  share(structure->node_values_, &node_values_);
+  share(structure->bitmaps_, &bitmaps_);
+  share(structure->node_covers_, &node_covers_);
+  share(structure->simd_node_features_, &simd_node_features_);
+  share(structure->simd_node_thresholds_, &simd_node_thresholds_);
+  share(structure->simd_node_na_values_, &simd_node_na_values_);
+  mapped_region_.reset();
+  shared_structure_ = std::move(structure);
+}
+
+// Process-wide set of the forests used by the flat forest engines. Engines
+// with identical forests share a single copy of the forest. This is the case
+// when a new version of a model is loaded while the previous version is still
+// serving, but the forest did not change (e.g. only the signature or the
+// assets were updated), or when the same model is loaded in multiple sessions.
+//
+// Forests that only differ by their leaf values (e.g. a new version of a
+// model whose leaves were re-calibrated) share their node arrays (see
+// "FlatForest::ShareStructure"): loading such a version only adds the memory
+// of its leaf values, and the previous version is not modified, so it keeps
+// serving with its own leaves until it is unloaded.
+//
+// Forests are released when the last engine using them is destroyed, and
+// unregistered along with them.
+class SharedFlatForests {
+ public:
+  static SharedFlatForests* Global() {
+    static auto* shared_forests = new SharedFlatForests();
+    return shared_forests;
+  }
+
+  // Returns a forest equal to "forest". Takes ownership of "forest" if no
+  // such forest is already shared.
+  std::shared_ptr<const FlatForest> Intern(std::unique_ptr<FlatForest> forest) {
+    const uint64_t fingerprint = forest->Fingerprint();
+    const uint64_t structure_fingerprint = forest->StructureFingerprint();
+    // Note: The candidates are released after the mutex, since releasing the
+    // last reference to a forest unregisters it.
+    std::vector<std::shared_ptr<const FlatForest>> candidates_in_use;
+    tf::mutex_lock lock(mutex_);
+    auto& candidates = forests_[fingerprint];
+    for (auto it = candidates.begin(); it != candidates.end();) {
+      auto candidate = it->lock();
+      if (candidate == nullptr) {
+        it = candidates.erase(it);
+        continue;
+      }
+      candidates_in_use.push_back(candidate);
+      if (candidate->Equals(*forest)) {
+        VLOG(1) << "Share an existing flat forest with " << forest->num_trees()
+                << " trees";
+        return candidate;
+      }
+      ++it;
+    }
+
+    // Only the forests owning their node arrays are registered in
+    // "structures_", so a forest never shares the arrays of a forest sharing
+    // them.
+    bool owns_structure = true;
+    // Note: A forest released but not unregistered yet (its deleter waits for
+    // the mutex) may leave the bucket empty.
+    EraseReleasedForests(structure_fingerprint, &structures_);
+    const auto structures = structures_.find(structure_fingerprint);
+    if (structures != structures_.end()) {
+      for (const auto& structure : structures->second) {
+        auto candidate = structure.lock();
+        if (candidate == nullptr) {
+          continue;
+        }
+        candidates_in_use.push_back(candidate);
+        if (candidate->SameStructure(*forest)) {
+          VLOG(1) << "Share the nodes of an existing flat forest with "
+                  << forest->num_trees() << " trees";
+          forest->ShareStructure(std::move(candidate));
+          owns_structure = false;
+          break;
+        }
+      }
+    }
+
+    std::shared_ptr<const FlatForest> shared_forest(
+        forest.release(),
+        [this, fingerprint, structure_fingerprint](const FlatForest* forest) {
+          Unregister(fingerprint, structure_fingerprint);
+          delete forest;
+        });
+    candidates.push_back(shared_forest);
+    if (owns_structure) {
+      structures_[structure_fingerprint].push_back(shared_forest);
+    }
+    return shared_forest;
+  }
+
+ private:
+  using ForestMap =
+      std::unordered_map<uint64_t,
+                         std::vector<std::weak_ptr<const FlatForest>>>;
+
+  // Removes the released forests of the buckets of a released forest, and
+  // the buckets left empty.
+  void Unregister(const uint64_t fingerprint,
+                  const uint64_t structure_fingerprint) {
+    tf::mutex_lock lock(mutex_);
+    EraseReleasedForests(fingerprint, &forests_);
+    EraseReleasedForests(structure_fingerprint, &structures_);
+  }
+
+  static void EraseReleasedForests(const uint64_t key, ForestMap* map) {
+    const auto bucket = map->find(key);
+    if (bucket == map->end()) {
+      return;
+    }
+    auto& forests = bucket->second;
+    forests.erase(std::remove_if(forests.begin(), forests.end(),
+                                 [](const std::weak_ptr<const FlatForest>& f) {
+                                   return f.expired();
+                                 }),
+                  forests.end());
+    if (forests.empty()) {
+      map->erase(bucket);
+    }
+  }
+
+  tf::mutex mutex_;
+  // Forests indexed by fingerprint.
+  ForestMap forests_ TF_GUARDED_BY(mutex_);
+  // Forests owning their node arrays, indexed by structure fingerprint.
+  ForestMap structures_ TF_GUARDED_BY(mutex_);
+};
+
+#ifdef TFDF_HAS_AVX2_TRAVERSAL
+namespace {
+
+bool CpuSupportsAvx2() {
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+}
+
+// Computes the leaves reached by 8 consecutive examples (rows of "numerical"
+// with a stride of "stride" values) in the tree starting at "root". Only
+// supports "higher" conditions. The 8 examples are moved down the tree
+// simultaneously until they all reach a leaf.
+__attribute__((target("avx2"))) void GetLeavesAvx2(
+    const int32_t* features, const float* thresholds, const int32_t* na_values,
+    const int32_t* children, const float* numerical, const int stride,
+    const int root, int32_t* leaves) {
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i minus_one = _mm256_set1_epi32(-1);
+  const __m256i row_offsets = _mm256_mullo_epi32(
+      _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+  __m256i node = _mm256_set1_epi32(root);
+  while (true) {
+    const __m256i feature = _mm256_i32gather_epi32(features, node, 4);
+    // Lanes that have not reached a leaf yet.
+    const __m256i active = _mm256_cmpgt_epi32(feature, minus_one);
+    if (_mm256_testz_si256(active, active)) {
+      break;
+    }
+    const __m256 value = _mm256_mask_i32gather_ps(
+        _mm256_setzero_ps(), numerical, _mm256_add_epi32(row_offsets, feature),
+        _mm256_castsi256_ps(active), 4);
+    const __m256 threshold = _mm256_i32gather_ps(thresholds, node, 4);
+    // Note: The ordered comparison is false for NaNs.
+    const __m256i higher = _mm256_and_si256(
+        _mm256_castps_si256(_mm256_cmp_ps(value, threshold, _CMP_GE_OQ)), one);
+    const __m256i is_na =
+        _mm256_castps_si256(_mm256_cmp_ps(value, value, _CMP_UNORD_Q));
+    const __m256i na_value = _mm256_i32gather_epi32(na_values, node, 4);
+    const __m256i positive = _mm256_blendv_epi8(higher, na_value, is_na);
+    const __m256i child = _mm256_i32gather_epi32(children, node, 4);
+    node = _mm256_blendv_epi8(node, _mm256_add_epi32(child, positive), active);
+  }
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(leaves), node);
+}
+
+}  // namespace
+#endif
+
+bool FlatForest::UsesSimdTraversal() const {
+#ifdef TFDF_HAS_AVX2_TRAVERSAL
+  return !simd_node_features_.empty() && CpuSupportsAvx2();
+#else
+  return false;
+#endif
+}
+
+absl::Status FlatForest::AddTree(
+    const model::decision_tree::DecisionTree& tree,
+    const FeatureIndex& feature_index,
+    const dataset::proto::DataSpecification& data_spec,
+    const std::function<absl::Status(const model::decision_tree::proto::Node&,
+                                     float*)>& set_leaf_value) {
+  using NodeWithChildren = model::decision_tree::NodeWithChildren;
+
+  // Breadth first traversal. The index of a node is allocated when its parent
+  // is visited so that siblings are contiguous.
+  const auto allocate_node = [this]() -> int {
+    node_types_.push_back(NodeType::kLeaf);
+    node_na_values_.push_back(0);
+    node_features_.push_back(0);
+    node_children_.push_back(0);
+    node_values_.push_back({/*.threshold =*/0.f});
+    node_covers_.push_back(0.f);
+    return node_types_.size() - 1;
+  };
+
+  std::deque<std::pair<const NodeWithChildren*, int>> pending_nodes;
+  tree_roots_.push_back(allocate_node());
+  pending_nodes.push_back({&tree.root(), tree_roots_.back()});
+  while (!pending_nodes.empty()) {
+    const auto* node = pending_nodes.front().first;
+    const int node_idx = pending_nodes.front().second;
+    pending_nodes.pop_front();
+
+    if (node->IsLeaf()) {
+      node_types_[node_idx] = NodeType::kLeaf;
+      node_values_[node_idx].offset = leaf_values_.size();
+      leaf_values_.resize(leaf_values_.size() + leaf_value_dim_);
+      RETURN_IF_ERROR(set_leaf_value(
+          node->node(), &leaf_values_[node_values_[node_idx].offset]));
+      continue;
+    }
+
+    const auto& condition = node->node().condition();
+    RETURN_IF_ERROR(
+        SetCondition(condition, feature_index, data_spec, node_idx));
+    const int neg_child_idx = allocate_node();
+    const int pos_child_idx = allocate_node();
+    DCHECK_EQ(neg_child_idx + 1, pos_child_idx);
+    node_children_[node_idx] = neg_child_idx;
+    // Note: The covers of the leaves are only known from their parent.
+    const float cover = condition.num_training_examples_with_weight();
+    const float pos_cover = condition.num_pos_training_examples_with_weight();
+    node_covers_[node_idx] = cover;
+    node_covers_[neg_child_idx] = cover - pos_cover;
+    node_covers_[pos_child_idx] = pos_cover;
+    pending_nodes.push_back({node->neg_child(), neg_child_idx});
+    pending_nodes.push_back({node->pos_child(), pos_child_idx});
+  }
+  return absl::OkStatus();
+}
+
+absl::Status FlatForest::SetCondition(
+    const model::decision_tree::proto::NodeCondition& condition,
+    const FeatureIndex& feature_index,
+    const dataset::proto::DataSpecification& data_spec, const int node_idx) {
+  using Condition = model::decision_tree::proto::Condition;
+
+  // Column of the attribute in the bank "bank".
+  const auto find_column = [&](const std::vector<int>& bank) -> int {
+    const auto it =
+        std::find(bank.begin(), bank.end(), condition.attribute());
+    return it == bank.end() ? -1 : std::distance(bank.begin(), it);
+  };
+  const int numerical_col = find_column(feature_index.numerical_features());
+  const int boolean_col = find_column(feature_index.boolean_features());
+  const int categorical_col =
+      find_column(feature_index.categorical_int_features());
+  const int categorical_set_col =
+      find_column(feature_index.categorical_set_int_features());
+
+  node_na_values_[node_idx] = condition.na_value();
+  const auto& cond = condition.condition();
+  switch (cond.type_case()) {
+    case Condition::kHigherCondition:
+      if (numerical_col < 0) {
+        break;
+      }
+      node_types_[node_idx] = NodeType::kHigher;
+      node_features_[node_idx] = numerical_col;
+      node_values_[node_idx].threshold = cond.higher_condition().threshold();
+      return absl::OkStatus();
+
+    case Condition::kTrueValueCondition:
+      if (boolean_col < 0) {
+        break;
+      }
+      node_types_[node_idx] = NodeType::kTrueValue;
+      node_features_[node_idx] = boolean_col;
+      return absl::OkStatus();
+
+    case Condition::kContainsCondition:
+    case Condition::kContainsBitmapCondition: {
+      // On a categorical set feature, the condition is true if any of the
+      // items of the set is in the bitmap.
+      const bool is_set = categorical_col < 0 && categorical_set_col >= 0;
+      if (categorical_col < 0 && !is_set) {
+        break;
+      }
+      const int column = is_set ? categorical_set_col : categorical_col;
+      const int num_values = is_set ? categorical_set_max_values_[column]
+                                    : categorical_max_values_[column];
+      const int offset = bitmaps_.size();
+      bitmaps_.resize(offset + (num_values + 63) / 64, 0);
+      const auto set_bit = [&](const int value) {
+        if (value >= 0 && value < num_values) {
+          bitmaps_[offset + value / 64] |= uint64_t{1} << (value % 64);
+        }
+      };
+      if (cond.type_case() == Condition::kContainsCondition) {
+        for (const int value : cond.contains_condition().elements()) {
+          set_bit(value);
+        }
+      } else {
+        const auto& bitmap = cond.contains_bitmap_condition().elements_bitmap();
+        for (int value = 0; value < num_values; value++) {
+          if (value / 8 < bitmap.size() &&
+              (bitmap[value / 8] >> (value % 8)) & 1) {
+            set_bit(value);
+          }
+        }
+      }
+      node_types_[node_idx] =
+          is_set ? NodeType::kContainsAny : NodeType::kContains;
+      node_features_[node_idx] = column;
+      node_values_[node_idx].offset = offset;
+      return absl::OkStatus();
+    }
+
+    case Condition::kNaCondition:
+      if (numerical_col >= 0) {
+        node_types_[node_idx] = NodeType::kNumericalIsNa;
+        node_features_[node_idx] = numerical_col;
+      } else if (boolean_col >= 0) {
+        node_types_[node_idx] = NodeType::kBooleanIsNa;
+        node_features_[node_idx] = boolean_col;
+      } else if (categorical_col >= 0) {
+        node_types_[node_idx] = NodeType::kCategoricalIsNa;
+        node_features_[node_idx] = categorical_col;
+      } else {
+        break;
+      }
+      return absl::OkStatus();
+
+    default:
+      break;
+  }
+  return absl::InvalidArgumentError(absl::Substitute(
+      "Non supported condition on feature \"$0\": $1",
+      data_spec.columns(condition.attribute()).name(), cond.DebugString()));
+}
+
+inline bool FlatForest::EvalCondition(const InputTensors& inputs,
+                                      const int example_idx,
+                                      const int node_idx) const {
+  const int feature = node_features_[node_idx];
+  switch (node_types_[node_idx]) {
+    case NodeType::kHigher: {
+      const float value = inputs.numerical_features(example_idx, feature);
+      return std::isnan(value) ? node_na_values_[node_idx]
+                               : value >= node_values_[node_idx].threshold;
+    }
+    case NodeType::kTrueValue: {
+      const float value = inputs.boolean_features(example_idx, feature);
+      return std::isnan(value) ? node_na_values_[node_idx] : value >= 0.5f;
+    }
+    case NodeType::kContains: {
+      int32_t value = inputs.categorical_int_features(example_idx, feature);
+      if (value == -1) {
+        return node_na_values_[node_idx];
+      }
+      if (value < -1 || value >= categorical_max_values_[feature]) {
+        value = 0;
+      }
+      return (bitmaps_[node_values_[node_idx].offset + value / 64] >>
+              (value % 64)) &
+             1;
+    }
+    case NodeType::kNumericalIsNa:
+      return std::isnan(inputs.numerical_features(example_idx, feature));
+    case NodeType::kBooleanIsNa:
+      return std::isnan(inputs.boolean_features(example_idx, feature));
+    case NodeType::kCategoricalIsNa:
+      return inputs.categorical_int_features(example_idx, feature) == -1;
+    case NodeType::kContainsAny: {
+      // Note: The row splits are checked by the inference op (see
+      // "CheckCategoricalSetRowSplits").
+      const auto& row_splits =
+          inputs.categorical_set_int_features_row_splits_dim_1;
+      const int64_t cell =
+          int64_t{example_idx} * categorical_set_max_values_.size() + feature;
+      const int32_t* const values =
+          inputs.categorical_set_int_features_values.data();
+      const int32_t* const begin = values + row_splits(cell);
+      const int32_t* const end = values + row_splits(cell + 1);
+      // By convention, a missing value is [-1].
+      if (begin != end && *begin == -1) {
+        return node_na_values_[node_idx];
+      }
+      return ContainsAny(&bitmaps_[node_values_[node_idx].offset],
+                         categorical_set_max_values_[feature], begin, end);
+    }
+    case NodeType::kLeaf:
+      break;
+  }
+  return false;
+}
+
+bool FlatForest::HasCategoricalSetConditions() const {
+  for (int node_idx = 0; node_idx < num_nodes(); node_idx++) {
+    if (node_types_[node_idx] == NodeType::kContainsAny) {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline int FlatForest::GetLeaf(const InputTensors& inputs,
+                               const int example_idx, int node_idx) const {
+  while (node_types_[node_idx] != NodeType::kLeaf) {
+    node_idx = node_children_[node_idx] +
+               EvalCondition(inputs, example_idx, node_idx);
+  }
+  return node_idx;
+}
+
+int FlatForest::NumContributionFeatures(const InputTensors& inputs) {
+  return inputs.numerical_features.dimension(1) +
+         inputs.boolean_features.dimension(1) +
+         inputs.categorical_int_features.dimension(1);
+}
+
+void FlatForest::FeatureContributions(const InputTensors& inputs,
+                                      const int begin, const int end,
+                                      const int num_evaluated_trees,
+                                      float* contributions) const {
+  DCHECK(HasNodeCovers());
+  const int bank_offsets[] = {
+      0, static_cast<int>(inputs.numerical_features.dimension(1)),
+      static_cast<int>(inputs.numerical_features.dimension(1) +
+                       inputs.boolean_features.dimension(1))};
+  const int num_features = NumContributionFeatures(inputs);
+  const int dim = accumulator_dim();
+  const int example_size = (num_features + 1) * dim;
+  std::fill(contributions, contributions + (end - begin) * example_size, 0.f);
+
+  // Each level of the recursion works on a copy of the path of its parent,
+  // stored after it.
+  std::vector<ShapPathElement> paths((max_tree_depth_ + 2) *
+                                     (max_tree_depth_ + 3) / 2);
+  for (int example_idx = begin; example_idx < end; example_idx++) {
+    float* example_contributions =
+        contributions + (example_idx - begin) * example_size;
+    float* bias = example_contributions + num_features * dim;
+    std::copy(initial_accumulator_.begin(), initial_accumulator_.end(), bias);
+    for (int tree_idx = 0; tree_idx < num_evaluated_trees; tree_idx++) {
+      const int output_offset = TreeAccumulatorOffset(tree_idx);
+      for (int value_idx = 0; value_idx < leaf_value_dim_; value_idx++) {
+        bias[output_offset + value_idx] +=
+            tree_expected_values_[tree_idx * leaf_value_dim_ + value_idx];
+      }
+      AddTreeContributions(inputs, example_idx, tree_roots_[tree_idx],
+                           /*depth=*/0, paths.data(), /*zero_fraction=*/1.f,
+                           /*one_fraction=*/1.f, /*feature=*/-1, bank_offsets,
+                           example_contributions + output_offset);
+    }
+    if (finalization_ == Finalization::kAverage && num_evaluated_trees > 0) {
+      const float scale = 1.f / num_evaluated_trees;
+      for (int value_idx = 0; value_idx < example_size; value_idx++) {
+        example_contributions[value_idx] *= scale;
+      }
+    }
+  }
+}
+
+int FlatForest::ContributionFeature(const int node_idx,
+                                    const int* bank_offsets) const {
+  switch (node_types_[node_idx]) {
+    case NodeType::kTrueValue:
+    case NodeType::kBooleanIsNa:
+      return bank_offsets[1] + node_features_[node_idx];
+    case NodeType::kContains:
+    case NodeType::kCategoricalIsNa:
+      return bank_offsets[2] + node_features_[node_idx];
+    default:
+      return bank_offsets[0] + node_features_[node_idx];
+  }
+}
+
+void FlatForest::AddTreeContributions(
+    const InputTensors& inputs, const int example_idx, const int node_idx,
+    int depth, ShapPathElement* parent_path, const float zero_fraction,
+    const float one_fraction, const int feature, const int* bank_offsets,
+    float* contributions) const {
+  if (zero_fraction == 0.f && one_fraction == 0.f) {
+    return;
+  }
+  ShapPathElement* path = parent_path + depth + 1;
+  std::copy(parent_path, parent_path + depth + 1, path);
+  ExtendShapPath(path, depth, zero_fraction, one_fraction, feature);
+
+  if (node_types_[node_idx] == NodeType::kLeaf) {
+    const float* leaf = &leaf_values_[node_values_[node_idx].offset];
+    const int dim = accumulator_dim();
+    for (int path_idx = 1; path_idx <= depth; path_idx++) {
+      const auto& element = path[path_idx];
+      const float scale = UnwoundShapPathSum(path, depth, path_idx) *
+                          (element.one_fraction - element.zero_fraction);
+      float* dst = contributions + element.feature * dim;
+      for (int value_idx = 0; value_idx < leaf_value_dim_; value_idx++) {
+        dst[value_idx] += scale * leaf[value_idx];
+      }
+    }
+    return;
+  }
+
+  const int split_feature = ContributionFeature(node_idx, bank_offsets);
+  const int neg_child = node_children_[node_idx];
+  const int hot_child =
+      neg_child + EvalCondition(inputs, example_idx, node_idx);
+  const int cold_child = hot_child == neg_child ? neg_child + 1 : neg_child;
+  const float cover = node_covers_[node_idx];
+
+  // If the feature was already split on, its previous split is undone and
+  // its fractions carried over.
+  float incoming_zero_fraction = 1.f;
+  float incoming_one_fraction = 1.f;
+  for (int path_idx = 1; path_idx <= depth; path_idx++) {
+    if (path[path_idx].feature == split_feature) {
+      incoming_zero_fraction = path[path_idx].zero_fraction;
+      incoming_one_fraction = path[path_idx].one_fraction;
+      UnwindShapPath(path, depth, path_idx);
+      depth--;
+      break;
+    }
+  }
+
+  AddTreeContributions(
+      inputs, example_idx, hot_child, depth + 1, path,
+      node_covers_[hot_child] / cover * incoming_zero_fraction,
+      incoming_one_fraction, split_feature, bank_offsets, contributions);
+  // Note: The cold child is never followed by the example, and only
+  // contributes through its covers.
+  AddTreeContributions(
+      inputs, example_idx, cold_child, depth + 1, path,
+      node_covers_[cold_child] / cover * incoming_zero_fraction,
+      /*one_fraction=*/0.f, split_feature, bank_offsets, contributions);
+}
+
+void FlatForest::ExtendShapPath(ShapPathElement* path, const int depth,
+                                const float zero_fraction,
+                                const float one_fraction, const int feature) {
+  path[depth] = {feature, zero_fraction, one_fraction,
+                 depth == 0 ? 1.f : 0.f};
+  for (int i = depth - 1; i >= 0; i--) {
+    path[i + 1].weight +=
+        one_fraction * path[i].weight * (i + 1) / static_cast<float>(depth + 1);
+    path[i].weight =
+        zero_fraction * path[i].weight * (depth - i) /
+        static_cast<float>(depth + 1);
+  }
+}
+
+void FlatForest::UnwindShapPath(ShapPathElement* path, const int depth,
+                                const int path_idx) {
+  const float one_fraction = path[path_idx].one_fraction;
+  const float zero_fraction = path[path_idx].zero_fraction;
+  float next_one_portion = path[depth].weight;
+  for (int i = depth - 1; i >= 0; i--) {
+    if (one_fraction != 0.f) {
+      const float weight = path[i].weight;
+      path[i].weight = next_one_portion * (depth + 1) /
+                       static_cast<float>((i + 1) * one_fraction);
+      next_one_portion = weight - path[i].weight * zero_fraction *
+                                      (depth - i) /
+                                      static_cast<float>(depth + 1);
+    } else {
+      path[i].weight = path[i].weight * (depth + 1) /
+                       static_cast<float>(zero_fraction * (depth - i));
+    }
+  }
+  for (int i = path_idx; i < depth; i++) {
+    path[i].feature = path[i + 1].feature;
+    path[i].zero_fraction = path[i + 1].zero_fraction;
+    path[i].one_fraction = path[i + 1].one_fraction;
+  }
+}
+
+float FlatForest::UnwoundShapPathSum(const ShapPathElement* path,
+                                     const int depth, const int path_idx) {
+  const float one_fraction = path[path_idx].one_fraction;
+  const float zero_fraction = path[path_idx].zero_fraction;
+  float next_one_portion = path[depth].weight;
+  float total = 0.f;
+  for (int i = depth - 1; i >= 0; i--) {
+    if (one_fraction != 0.f) {
+      const float weight = next_one_portion * (depth + 1) /
+                           static_cast<float>((i + 1) * one_fraction);
+      total += weight;
+      next_one_portion = path[i].weight - weight * zero_fraction *
+                                              (depth - i) /
+                                              static_cast<float>(depth + 1);
+    } else if (zero_fraction != 0.f) {
+      total += path[i].weight / zero_fraction /
+               ((depth - i) / static_cast<float>(depth + 1));
+    }
+  }
+  return total;
+}
+
+int FlatForest::NumEvaluatedTrees(const int max_num_trees) const {
+  if (max_num_trees <= 0 || max_num_trees >= num_trees()) {
+    return num_trees();
+  }
+  if (leaf_value_dim_ == accumulator_dim() || HasSparseLeaves()) {
+    return max_num_trees;
+  }
+  const int dim = accumulator_dim();
+  return std::max(dim, max_num_trees - max_num_trees % dim);
+}
+
+void FlatForest::Finalize(const float* accumulator,
+                          const int num_evaluated_trees,
+                          float* predictions) const {
+  const int dim = accumulator_dim();
+  switch (finalization_) {
+    case Finalization::kIdentity:
+      if (accumulator != predictions) {
+        std::copy(accumulator, accumulator + dim, predictions);
+      }
+      break;
+    case Finalization::kAverage: {
+      const float inv_num_trees =
+          num_evaluated_trees > 0 ? 1.f / num_evaluated_trees : 0.f;
+      for (int i = 0; i < dim; i++) {
+        predictions[i] = accumulator[i] * inv_num_trees;
+      }
+    } break;
+    case Finalization::kSigmoidBinary: {
+      const float proba = 1.f / (1.f + std::exp(-accumulator[0]));
+      predictions[0] = 1.f - proba;
+      predictions[1] = proba;
+    } break;
+    case Finalization::kSoftmax: {
+      const float max_value = *std::max_element(accumulator, accumulator + dim);
+      float sum = 0.f;
+      for (int i = 0; i < dim; i++) {
+        predictions[i] = std::exp(accumulator[i] - max_value);
+        sum += predictions[i];
+      }
+      for (int i = 0; i < dim; i++) {
+        predictions[i] /= sum;
+      }
+    } break;
+  }
+}
+
+void FlatForest::AccumulateTree(const InputTensors& inputs, const int begin,
+                                const int end, const int tree_idx,
+                                float* accumulator,
+                                tf::int32* leaves) const {
+  const int root = tree_roots_[tree_idx];
+  const int dim = accumulator_dim();
+  const bool sparse_leaves = HasSparseLeaves();
+  const auto add_leaf = [&](const int example_idx, const int leaf) {
+    const uint32_t offset = node_values_[leaf].offset;
+    const float* leaf_value = &leaf_values_[offset];
+    float* dst = accumulator + (example_idx - begin) * dim;
+    if (sparse_leaves) {
+      const uint16_t* leaf_class = &leaf_classes_[offset];
+      for (int i = 0; i < leaf_value_dim_; i++) {
+        dst[leaf_class[i]] += leaf_value[i];
+      }
+    } else {
+      for (int i = 0; i < leaf_value_dim_; i++) {
+        dst[i] += leaf_value[i];
+      }
+    }
+    if (leaves != nullptr) {
+      leaves[static_cast<int64_t>(example_idx) * num_trees() + tree_idx] =
+          LeafIndex(tree_idx, leaf);
+    }
+  };
+
+  int example_idx = begin;
+#ifdef TFDF_HAS_AVX2_TRAVERSAL
+  if (UsesSimdTraversal()) {
+    const float* const numerical = inputs.numerical_features.data();
+    const int stride = inputs.numerical_features.dimension(1);
+    int32_t lane_leaves[kNumSimdLanes];
+    for (; example_idx + kNumSimdLanes <= end; example_idx += kNumSimdLanes) {
+      GetLeavesAvx2(simd_node_features_.data(), simd_node_thresholds_.data(),
+                    simd_node_na_values_.data(), node_children_.data(),
+                    numerical + static_cast<int64_t>(example_idx) * stride,
+                    stride, root, lane_leaves);
+      for (int lane = 0; lane < kNumSimdLanes; lane++) {
+        add_leaf(example_idx + lane, lane_leaves[lane]);
+      }
+    }
+  }
+#endif
+  // Scalar traversal of the remaining examples.
+  for (; example_idx < end; example_idx++) {
+    add_leaf(example_idx, GetLeaf(inputs, example_idx, root));
+  }
+}
+
+tf::Status FlatForest::Predict(const InputTensors& inputs, const int begin,
+                               const int end, const InferenceOptions& options,
+                               std::vector<float>* accumulator,
+                               OutputTensors* outputs) const {
+  if (outputs->output_dim != output_dim()) {
+    return tf::Status(
+        tf::error::INVALID_ARGUMENT,
+        absl::StrCat("The model output dimension (", output_dim(),
+                     ") does not match the op dense_output_dim (",
+                     outputs->output_dim, ")."));
+  }
+
+  const int num_examples = end - begin;
+  const int dim = accumulator_dim();
+  // Note: The rows of the output tensor are contiguous. When possible, the
+  // trees are accumulated directly in the output rows of the examples.
+  float* const outputs_data =
+      outputs->dense_predictions.data() + begin * outputs->output_dim;
+  float* accumulator_data;
+  if (AccumulatesInOutputs()) {
+    accumulator_data = outputs_data;
+  } else {
+    accumulator->resize(num_examples * dim);
+    accumulator_data = accumulator->data();
+  }
+  for (int example_idx = 0; example_idx < num_examples; example_idx++) {
+    std::copy(initial_accumulator_.begin(), initial_accumulator_.end(),
+              accumulator_data + example_idx * dim);
+  }
+
+  // Note: The leaves of the trees that are not evaluated are -1.
+  tf::int32* const leaves = outputs->leaves;
+  if (leaves != nullptr) {
+    std::fill(leaves + static_cast<int64_t>(begin) * num_trees(),
+              leaves + static_cast<int64_t>(end) * num_trees(), -1);
+  }
+
+  const int num_evaluated_trees = NumEvaluatedTrees(options.max_num_trees);
+  if (options.early_exit_margin > 0.f && !remaining_leaf_bounds_.empty()) {
+    AccumulateTreesWithEarlyExit(inputs, begin, end, num_evaluated_trees,
+                                 options.early_exit_margin, accumulator_data,
+                                 leaves);
+  } else {
+    // Tree-major evaluation: The nodes of a tree stay in cache while all the
+    // examples are evaluated.
+    for (int tree_idx = 0; tree_idx < num_evaluated_trees; tree_idx++) {
+      AccumulateTree(inputs, begin, end, tree_idx,
+                     accumulator_data + TreeAccumulatorOffset(tree_idx),
+                     leaves);
+    }
+  }
+
+  const int output_dim = outputs->output_dim;
+  for (int example_idx = 0; example_idx < num_examples; example_idx++) {
+    Finalize(accumulator_data + example_idx * dim, num_evaluated_trees,
+             outputs_data + example_idx * output_dim);
+  }
+  return tf::Status::OK();
+}
+
+void FlatForest::AccumulateTrees(const InputTensors& inputs, const int begin,
+                                 const int end, const int tree_begin,
+                                 const int tree_end,
+                                 float* accumulator) const {
+  for (int tree_idx = tree_begin; tree_idx < tree_end; tree_idx++) {
+    AccumulateTree(inputs, begin, end, tree_idx,
+                   accumulator + TreeAccumulatorOffset(tree_idx),
+                   /*leaves=*/nullptr);
+  }
+}
+
+size_t FlatForest::NodeMemoryUsage() const {
+  return node_types_.size() * sizeof(NodeType) +
+         node_na_values_.size() * sizeof(uint8_t) +
+         node_features_.size() * sizeof(int32_t) +
+         node_children_.size() * sizeof(int32_t) +
+         node_values_.size() * sizeof(NodeValue) +
+         bitmaps_.size() * sizeof(uint64_t) +
+         leaf_values_.size() * sizeof(float) +
+         leaf_classes_.size() * sizeof(uint16_t);
+}
+
+void FlatForest::AccumulateTreesWithEarlyExit(
+    const InputTensors& inputs, const int begin, const int end,
+    const int num_evaluated_trees, const float early_exit_margin,
+    float* accumulator, tf::int32* leaves) const {
+  DCHECK_EQ(accumulator_dim(), 1);
+  const float bound_end = remaining_leaf_bounds_[num_evaluated_trees];
+  for (int group_begin = begin; group_begin < end;
+       group_begin += kEarlyExitNumExamples) {
+    const int group_end = std::min(end, group_begin + kEarlyExitNumExamples);
+    float* group_accumulator = accumulator + (group_begin - begin);
+    int tree_idx = 0;
+    while (tree_idx < num_evaluated_trees) {
+      const int block_end =
+          std::min(num_evaluated_trees, tree_idx + kEarlyExitNumTrees);
+      for (; tree_idx < block_end; tree_idx++) {
+        AccumulateTree(inputs, group_begin, group_end, tree_idx,
+                       group_accumulator, leaves);
+      }
+      // The predicted class of an example cannot change if its logit is
+      // further from the 0 decision threshold than the sum of the largest
+      // leaf values of the remaining trees.
+      const float exit_margin = std::min(
+          early_exit_margin, remaining_leaf_bounds_[tree_idx] - bound_end);
+      bool all_decided = true;
+      for (int example_idx = 0; example_idx < group_end - group_begin;
+           example_idx++) {
+        if (std::abs(group_accumulator[example_idx]) < exit_margin) {
+          all_decided = false;
+          break;
+        }
+      }
+      if (all_decided) {
+        break;
+      }
+    }
+  }
+}
+
+namespace {
+
+// C++ literal of a float value that is parsed back to the same value.
+std::string FloatLiteral(const float value) {
+  if (std::isnan(value)) {
+    return "NAN";
+  }
+  if (std::isinf(value)) {
+    return value > 0 ? "INFINITY" : "-INFINITY";
+  }
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+  std::string literal = buffer;
+  if (literal.find_first_of(".e") == std::string::npos) {
+    literal += ".";
+  }
+  return literal + "f";
+}
+
+}  // namespace
+
+std::string FlatForest::GenerateCompiledSource() const {
+  std::string source = absl::StrCat(
+      "// Compiled flat forest generated by "
+      "\"SimpleMLGenerateCompiledFlatForestSource\".\n"
+      "// Build with e.g. \"c++ -O2 -shared -fPIC\" into ",
+      kCompiledFlatForestFilename,
+      " in the model directory.\n"
+      "#include <cmath>\n"
+      "#include <cstdint>\n\n"
+      "namespace {\n\n"
+      "inline bool Contains(const uint64_t* bitmap, const int32_t max_value,\n"
+      "                     const bool na_value, int32_t value) {\n"
+      "  if (value == -1) return na_value;\n"
+      "  if (value < -1 || value >= max_value) value = 0;\n"
+      "  return (bitmap[value / 64] >> (value % 64)) & 1;\n"
+      "}\n\n");
+
+  // Bitmaps of the "kContains" conditions.
+  for (int node_idx = 0; node_idx < num_nodes(); node_idx++) {
+    if (node_types_[node_idx] != NodeType::kContains) {
+      continue;
+    }
+    const int feature = node_features_[node_idx];
+    const int num_words = (categorical_max_values_[feature] + 63) / 64;
+    absl::StrAppend(&source, "constexpr uint64_t kBitmap", node_idx, "[] = {");
+    for (int word_idx = 0; word_idx < num_words; word_idx++) {
+      absl::StrAppend(&source, word_idx > 0 ? ", " : "",
+                      bitmaps_[node_values_[node_idx].offset + word_idx],
+                      "ull");
+    }
+    absl::StrAppend(&source, "};\n");
+  }
+
+  // Source of the condition of a non-leaf node. "n", "b" and "c" are the
+  // numerical, boolean and categorical int feature rows.
+  const auto condition = [&](const int node_idx) -> std::string {
+    const int feature = node_features_[node_idx];
+    const bool na_value = node_na_values_[node_idx];
+    switch (node_types_[node_idx]) {
+      case NodeType::kHigher: {
+        // Note: Comparisons with NaN are false.
+        const std::string threshold =
+            FloatLiteral(node_values_[node_idx].threshold);
+        return na_value ? absl::StrCat("!(n[", feature, "] < ", threshold, ")")
+                        : absl::StrCat("n[", feature, "] >= ", threshold);
+      }
+      case NodeType::kTrueValue:
+        return na_value ? absl::StrCat("!(b[", feature, "] < 0.5f)")
+                        : absl::StrCat("b[", feature, "] >= 0.5f");
+      case NodeType::kContains:
+        return absl::StrCat("Contains(kBitmap", node_idx, ", ",
+                            categorical_max_values_[feature], ", ",
+                            na_value ? "true" : "false", ", c[", feature,
+                            "])");
+      case NodeType::kNumericalIsNa:
+        return absl::StrCat("std::isnan(n[", feature, "])");
+      case NodeType::kBooleanIsNa:
+        return absl::StrCat("std::isnan(b[", feature, "])");
+      case NodeType::kCategoricalIsNa:
+        return absl::StrCat("c[", feature, "] == -1");
+      // Note: Not supported (see "HasCategoricalSetConditions").
+      case NodeType::kContainsAny:
+      case NodeType::kLeaf:
+        break;
+    }
+    return "false";
+  };
+
+  // Source of the sub-tree starting at "node_idx".
+  std::function<void(int, int, int)> add_node = [&](const int node_idx,
+                                                    const int output_offset,
+                                                    const int depth) {
+    const std::string indent(2 * depth, ' ');
+    if (node_types_[node_idx] == NodeType::kLeaf) {
+      const uint32_t offset = node_values_[node_idx].offset;
+      for (int i = 0; i < leaf_value_dim_; i++) {
+        const int output =
+            HasSparseLeaves() ? leaf_classes_[offset + i] : output_offset + i;
+        absl::StrAppend(&source, indent, "a[", output,
+                        "] += ", FloatLiteral(leaf_values_[offset + i]),
+                        ";\n");
+      }
+      return;
+    }
+    absl::StrAppend(&source, indent, "if (", condition(node_idx), ") {\n");
+    add_node(node_children_[node_idx] + 1, output_offset, depth + 1);
+    absl::StrAppend(&source, indent, "} else {\n");
+    add_node(node_children_[node_idx], output_offset, depth + 1);
+    absl::StrAppend(&source, indent, "}\n");
+  };
+
+  const std::string signature =
+      "(const float* n, const float* b, const int32_t* c, float* a)";
+  for (int tree_idx = 0; tree_idx < num_trees(); tree_idx++) {
+    absl::StrAppend(&source, "\nvoid Tree", tree_idx, signature, " {\n");
+    add_node(tree_roots_[tree_idx], TreeAccumulatorOffset(tree_idx), 1);
+    absl::StrAppend(&source, "}\n");
+  }
+
+  absl::StrAppend(&source, "\n}  // namespace\n\nextern \"C\" {\n\nuint64_t ",
+                  kCompiledFlatForestFingerprintSymbol, "() { return ",
+                  Fingerprint(), "ull; }\n\nvoid ",
+                  kCompiledFlatForestAccumulateSymbol, signature, " {\n");
+  for (int tree_idx = 0; tree_idx < num_trees(); tree_idx++) {
+    absl::StrAppend(&source, "  Tree", tree_idx, "(n, b, c, a);\n");
+  }
+  absl::StrAppend(&source, "}\n\n}  // extern \"C\"\n");
+  return source;
+}
+
+// The flat forest engine runs the model with a "FlatForest" i.e. without
+// Yggdrasil serving engine. Supports a subset of the models supported by the
+// semi-fast engine (see "FlatForest"), as well as a some models not supported
+// by it.
+class FlatForestInferenceEngine : public AbstractInferenceEngine {
+ public:
+  static StatusOr<std::unique_ptr<FlatForestInferenceEngine>> Create(
+      const model::AbstractModel& model, const FeatureIndex& feature_index) {
+    auto forest_or = FlatForest::Create(model, feature_index);
+    RETURN_IF_ERROR(forest_or.status());
+    return Create(std::move(forest_or).value());
+  }
+
+  // Note: Engines with identical forests share the same forest (see
+  // "SharedFlatForests").
+  static std::unique_ptr<FlatForestInferenceEngine> Create(
+      std::unique_ptr<FlatForest> forest) {
+    return FromSharedForest(
+        SharedFlatForests::Global()->Intern(std::move(forest)));
+  }
+
+  static std::unique_ptr<FlatForestInferenceEngine> FromSharedForest(
+      std::shared_ptr<const FlatForest> forest) {
+    return absl::WrapUnique(new FlatForestInferenceEngine(std::move(forest)));
+  }
+
+  // Maximum size of the nodes of a block of trees (see "NumTreeBlocks"),
+  // about the size of the L2 cache of a core.
+  static constexpr size_t kMaxTreeBlockMemoryUsage = 256 << 10;
+
+  class Cache : public AbstractCache {
+   private:
+    // Accumulator of each shard.
+    std::vector<std::vector<float>> accumulators_;
+    // Partial accumulator of each (example shard, tree block) task of
+    // "RunTreeBlocks".
+    std::vector<std::vector<float>> tree_block_accumulators_;
+
+    friend FlatForestInferenceEngine;
+  };
+
+  StatusOr<std::unique_ptr<AbstractCache>> CreateCache() const override {
+    auto cache = absl::make_unique<FlatForestInferenceEngine::Cache>();
+    cache->accumulators_.resize(1);
+    return cache;
+  }
+
+  tf::Status RunInference(const InputTensors& inputs,
+                          const FeatureIndex& feature_index,
+                          const InferenceOptions& options,
+                          OutputTensors* outputs,
+                          AbstractCache* abstract_cache) const override {
+    auto* cache = dynamic_cast<Cache*>(abstract_cache);
+    if (cache == nullptr) {
+      return tf::Status(tf::error::INTERNAL, "Unexpected cache type.");
+    }
+
+    // Note: The flat forest reads the input tensors directly. There is no
+    // example staging.
+    cache->stage_timer()->Start(InferenceStage::kPredict);
+    const int num_shards = options.NumShards(inputs.batch_size);
+    if (num_shards <= 1) {
+      return forest_->Predict(inputs, 0, inputs.batch_size, options,
+                              &cache->accumulators_.front(), outputs);
+    }
+    if (cache->accumulators_.size() < num_shards) {
+      cache->accumulators_.resize(num_shards);
+    }
+    const int num_tree_blocks = NumTreeBlocks(options, num_shards, *outputs);
+    if (num_tree_blocks > 1) {
+      return RunTreeBlocks(inputs, options, num_shards / num_tree_blocks,
+                           num_tree_blocks, outputs, cache);
+    }
+    return RunShardsInParallel(
+        options.thread_pool, num_shards, inputs.batch_size,
+        [&](const int shard_idx, const int begin, const int end) {
+          return forest_->Predict(inputs, begin, end, options,
+                                  &cache->accumulators_[shard_idx], outputs);
+        });
+  }
+
+  const FlatForest* flat_forest() const override { return forest_.get(); }
+
+  bool supports_leaf_outputs() const override { return true; }
+
+  bool uses_simd_traversal() const { return forest_->UsesSimdTraversal(); }
+
+ private:
+  explicit FlatForestInferenceEngine(std::shared_ptr<const FlatForest> forest)
+      : forest_(std::move(forest)) {}
+
+  // Number of blocks the trees are split in, in between the "num_shards"
+  // shards of a batch. Forests whose nodes don't fit in the cache of a core
+  // are split in blocks of trees that do: each shard then evaluates a block of
+  // trees on a range of examples, instead of all the trees. Returns 1 if the
+  // trees are not split.
+  int NumTreeBlocks(const InferenceOptions& options, const int num_shards,
+                    const OutputTensors& outputs) const {
+    // Note: The partial evaluations and the leaf outputs are only supported
+    // by "FlatForest::Predict".
+    if (options.UsesPartialEvaluation() || outputs.leaves != nullptr ||
+        outputs.output_dim != forest_->output_dim()) {
+      return 1;
+    }
+    const size_t num_blocks =
+        (forest_->NodeMemoryUsage() + kMaxTreeBlockMemoryUsage - 1) /
+        kMaxTreeBlockMemoryUsage;
+    return std::max<int>(
+        1, std::min<size_t>({num_blocks, static_cast<size_t>(num_shards),
+                             static_cast<size_t>(forest_->num_trees())}));
+  }
+
+  // Evaluates the "num_tree_blocks" blocks of trees on the
+  // "num_example_shards" shards of the batch in parallel, and then sums and
+  // finalizes the partial accumulators of each example.
+  tf::Status RunTreeBlocks(const InputTensors& inputs,
+                           const InferenceOptions& options,
+                           const int num_example_shards,
+                           const int num_tree_blocks, OutputTensors* outputs,
+                           Cache* cache) const {
+    const int batch_size = inputs.batch_size;
+    const int num_trees = forest_->num_trees();
+    const int dim = forest_->accumulator_dim();
+    const int num_examples_per_shard =
+        (batch_size + num_example_shards - 1) / num_example_shards;
+    const int num_tasks = num_example_shards * num_tree_blocks;
+    if (cache->tree_block_accumulators_.size() < num_tasks) {
+      cache->tree_block_accumulators_.resize(num_tasks);
+    }
+
+    // Note: Each "shard" of the batch [0, num_tasks) is a single task.
+    TF_RETURN_IF_ERROR(RunShardsInParallel(
+        options.thread_pool, num_tasks, num_tasks,
+        [&](const int task_idx, int, int) {
+          const int shard_idx = task_idx / num_tree_blocks;
+          const int block_idx = task_idx % num_tree_blocks;
+          const int begin =
+              std::min(batch_size, shard_idx * num_examples_per_shard);
+          const int end = std::min(batch_size, begin + num_examples_per_shard);
+          const int tree_begin =
+              static_cast<int64_t>(block_idx) * num_trees / num_tree_blocks;
+          const int tree_end =
+              static_cast<int64_t>(block_idx + 1) * num_trees / num_tree_blocks;
+          auto& accumulator = cache->tree_block_accumulators_[task_idx];
+          accumulator.assign(std::max(0, end - begin) * dim, 0.f);
+          forest_->AccumulateTrees(inputs, begin, end, tree_begin, tree_end,
+                                   accumulator.data());
+          return tf::Status::OK();
+        }));
+
+    const std::vector<float>& initial_accumulator =
+        forest_->initial_accumulator();
+    const int output_dim = outputs->output_dim;
+    return RunShardsInParallel(
+        options.thread_pool, num_example_shards, batch_size,
+        [&](const int shard_idx, const int begin, const int end) {
+          auto& accumulator = cache->accumulators_[shard_idx];
+          accumulator.resize(dim);
+          for (int example_idx = begin; example_idx < end; example_idx++) {
+            const int offset = (example_idx - begin) * dim;
+            std::copy(initial_accumulator.begin(), initial_accumulator.end(),
+                      accumulator.begin());
+            for (int block_idx = 0; block_idx < num_tree_blocks; block_idx++) {
+              const float* partial =
+                  cache->tree_block_accumulators_[shard_idx * num_tree_blocks +
+                                                  block_idx]
+                      .data() +
+                  offset;
+              for (int i = 0; i < dim; i++) {
+                accumulator[i] += partial[i];
+              }
+            }
+            forest_->Finalize(
+                accumulator.data(), num_trees,
+                outputs->dense_predictions.data() + example_idx * output_dim);
+          }
+          return tf::Status::OK();
+        });
+  }
+
+  std::shared_ptr<const FlatForest> forest_;
+};
+
+// Runs a flat forest with the compiled code generated by
+// "FlatForest::GenerateCompiledSource". The forest is only used for the
+// finalization of the predictions.
+class CompiledFlatForestInferenceEngine : public AbstractInferenceEngine {
+ public:
+  using FingerprintFn = uint64_t (*)();
+  using AccumulateFn = void (*)(const float*, const float*, const int32_t*,
+                                float*);
+
+  // Loads the compiled forest "library_path". Returns an error if the library
+  // cannot be loaded, or was generated for a different forest.
+  static tf::Status Create(
+      std::shared_ptr<const FlatForest> forest, const std::string& library_path,
+      std::unique_ptr<CompiledFlatForestInferenceEngine>* engine) {
+    auto* env = tf::Env::Default();
+    void* library;
+    TF_RETURN_IF_ERROR(env->LoadDynamicLibrary(library_path.c_str(), &library));
+    void* fingerprint_symbol;
+    TF_RETURN_IF_ERROR(env->GetSymbolFromLibrary(
+        library, kCompiledFlatForestFingerprintSymbol, &fingerprint_symbol));
+    void* accumulate_symbol;
+    TF_RETURN_IF_ERROR(env->GetSymbolFromLibrary(
+        library, kCompiledFlatForestAccumulateSymbol, &accumulate_symbol));
+
+    const uint64_t fingerprint =
+        reinterpret_cast<FingerprintFn>(fingerprint_symbol)();
+    if (fingerprint != forest->Fingerprint()) {
+      return tf::errors::FailedPrecondition("The compiled forest ",
+                                            library_path,
+                                            " was generated for a different "
+                                            "model.");
+    }
+    *engine = absl::WrapUnique(new CompiledFlatForestInferenceEngine(
+        std::move(forest), reinterpret_cast<AccumulateFn>(accumulate_symbol)));
+    return tf::Status::OK();
+  }
+
+  class Cache : public AbstractCache {
+   private:
+    // Accumulator of each shard.
+    std::vector<std::vector<float>> accumulators_;
+
+    friend CompiledFlatForestInferenceEngine;
+  };
+
+  StatusOr<std::unique_ptr<AbstractCache>> CreateCache() const override {
+    auto cache = absl::make_unique<CompiledFlatForestInferenceEngine::Cache>();
+    cache->accumulators_.resize(1);
+    return cache;
+  }
+
+  tf::Status RunInference(const InputTensors& inputs,
+                          const FeatureIndex& feature_index,
+                          const InferenceOptions& options,
+                          OutputTensors* outputs,
+                          AbstractCache* abstract_cache) const override {
+    TF_RETURN_IF_ERROR(CheckFullEvaluation(options));
+    auto* cache = dynamic_cast<Cache*>(abstract_cache);
+    if (cache == nullptr) {
+      return tf::Status(tf::error::INTERNAL, "Unexpected cache type.");
+    }
+    if (outputs->output_dim != forest_->output_dim()) {
+      return tf::Status(
+          tf::error::INVALID_ARGUMENT,
+          absl::StrCat("The model output dimension (", forest_->output_dim(),
+                       ") does not match the op dense_output_dim (",
+                       outputs->output_dim, ")."));
+    }
+
+    cache->stage_timer()->Start(InferenceStage::kPredict);
+    const int num_shards = options.NumShards(inputs.batch_size);
+    if (num_shards <= 1) {
+      PredictRange(inputs, 0, inputs.batch_size, &cache->accumulators_.front(),
+                   outputs);
+      return tf::Status::OK();
+    }
+    if (cache->accumulators_.size() < num_shards) {
+      cache->accumulators_.resize(num_shards);
+    }
+    return RunShardsInParallel(
+        options.thread_pool, num_shards, inputs.batch_size,
+        [&](const int shard_idx, const int begin, const int end) {
+          PredictRange(inputs, begin, end, &cache->accumulators_[shard_idx],
+                       outputs);
+          return tf::Status::OK();
+        });
+  }
+
+  const FlatForest* flat_forest() const override { return forest_.get(); }
+
+ private:
+  CompiledFlatForestInferenceEngine(std::shared_ptr<const FlatForest> forest,
+                                    AccumulateFn accumulate)
+      : forest_(std::move(forest)), accumulate_(accumulate) {}
+
+  // Evaluates the examples [begin, end) one after the other.
+  void PredictRange(const InputTensors& inputs, const int begin, const int end,
+                    std::vector<float>* accumulator,
+                    OutputTensors* outputs) const {
+    const auto& initial_accumulator = forest_->initial_accumulator();
+    const int numerical_dim = inputs.numerical_features.dimension(1);
+    const int boolean_dim = inputs.boolean_features.dimension(1);
+    const int categorical_dim = inputs.categorical_int_features.dimension(1);
+    const int output_dim = outputs->output_dim;
+    for (int example_idx = begin; example_idx < end; example_idx++) {
+      accumulator->assign(initial_accumulator.begin(),
+                          initial_accumulator.end());
+      accumulate_(
+          inputs.numerical_features.data() + example_idx * numerical_dim,
+          inputs.boolean_features.data() + example_idx * boolean_dim,
+          inputs.categorical_int_features.data() +
+              example_idx * categorical_dim,
+          accumulator->data());
+      forest_->Finalize(
+          accumulator->data(), forest_->num_trees(),
+          outputs->dense_predictions.data() + example_idx * output_dim);
+    }
+  }
+
+  std::shared_ptr<const FlatForest> forest_;
+
+  // Entry point of the compiled library. The library is never unloaded.
+  AccumulateFn accumulate_;
+};
+
+// Flat forest where the thresholds of the "kHigher" conditions are replaced by
+// 16 bits bin indices. The numerical features are binned once per example
+// (using the sorted unique thresholds of the feature in the model as bin
+// boundaries), and the trees are traversed with integer comparisons over 8
+// bytes nodes (instead of the 14 bytes of the flat forest node arrays). Since
+// the bin boundaries are exactly the thresholds of the model, the quantization
+// does not change the predictions.
+//
+// The other conditions, the leaf values and the finalization are read from the
+// underlying flat forest.
+class QuantizedFlatForest {
+ public:
+  struct Node {
+    // Bits 0-14: Index of the binned feature tested by a "kHigher" condition,
+    // or "kLeafFeature" / "kOtherConditionFeature". Bit 15: Value of the
+    // condition when the feature is missing.
+    uint16_t feature;
+    // Bin index of the threshold. The condition is "bin > threshold".
+    uint16_t threshold;
+    // Index of the negative child (the positive child is the next node) of a
+    // condition, or offset in the leaf values of a leaf.
+    uint32_t target;
+  };
+
+  static constexpr uint16_t kFeatureMask = 0x7FFF;
+  static constexpr uint16_t kNaValueBit = 0x8000;
+  static constexpr uint16_t kLeafFeature = 0x7FFF;
+  // The condition is evaluated by the flat forest.
+  static constexpr uint16_t kOtherConditionFeature = 0x7FFE;
+  // Bin of the missing values.
+  static constexpr uint16_t kMissingBin = 0xFFFF;
+
+  // Buffers re-used in between calls.
+  struct Buffers {
+    // Bins of the examples. Example-major.
+    std::vector<uint16_t> bins;
+    std::vector<float> accumulator;
+  };
+
+  // Quantizes a flat forest. Returns an error if the forest has more binned
+  // features or unique thresholds per feature than supported by the 16 bits
+  // representation.
+  static StatusOr<std::unique_ptr<QuantizedFlatForest>> Create(
+      std::shared_ptr<const FlatForest> forest);
+
+  const FlatForest& forest() const { return *forest_; }
+  int num_binned_features() const { return feature_columns_.size(); }
+  size_t NodeMemoryUsage() const { return nodes_.size() * sizeof(Node); }
+
+  // Same as "FlatForest::Predict". "early_exit_margin" is not supported.
+  tf::Status Predict(const InputTensors& inputs, int begin, int end,
+                     const InferenceOptions& options, Buffers* buffers,
+                     OutputTensors* outputs) const;
+
+ private:
+  explicit QuantizedFlatForest(std::shared_ptr<const FlatForest> forest)
+      : forest_(std::move(forest)) {}
+
+  // Computes the bins of the examples [begin, end) of "inputs".
+  void BinExamples(const InputTensors& inputs, int begin, int end,
+                   std::vector<uint16_t>* bins) const;
+
+  // Index of the leaf reached by the "example_idx"-th example, with bins
+  // "bins", in the tree starting at node "node_idx".
+  inline int GetLeaf(const InputTensors& inputs, int example_idx,
+                     const uint16_t* bins, int node_idx) const;
+
+  std::shared_ptr<const FlatForest> forest_;
+
+  // Nodes, in the same order as the flat forest nodes.
+  std::vector<Node> nodes_;
+
+  // Column, in the numerical feature bank, of each binned feature. The binned
+  // features are sorted by decreasing number of conditions.
+  std::vector<int> feature_columns_;
+
+  // Sorted unique thresholds of each binned feature. The bin of a value is the
+  // number of thresholds lower or equal to the value.
+  std::vector<std::vector<float>> bin_boundaries_;
+};
+
+StatusOr<std::unique_ptr<QuantizedFlatForest>> QuantizedFlatForest::Create(
+    std::shared_ptr<const FlatForest> forest) {
+  using NodeType = FlatForest::NodeType;
+  auto quantized = absl::WrapUnique(new QuantizedFlatForest(std::move(forest)));
+  const FlatForest& flat = *quantized->forest_;
+  if (flat.HasSparseLeaves()) {
+    return absl::InvalidArgumentError(
+        "The quantized flat forest does not support sparse leaves.");
+  }
+
+  // Thresholds of each numerical column.
+  std::map<int, std::vector<float>> thresholds;
+  for (int node_idx = 0; node_idx < flat.num_nodes(); node_idx++) {
+    if (flat.node_types()[node_idx] == NodeType::kHigher) {
+      thresholds[flat.node_features()[node_idx]].push_back(
+          flat.node_values()[node_idx].threshold);
+    }
+  }
+  if (thresholds.size() >= kOtherConditionFeature) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Too many numerical features (", thresholds.size(),
+                     ") for the quantized flat forest."));
+  }
+
+  // Layout of the bins of an example: The features are sorted by decreasing
+  // number of conditions testing them (i.e. "thresholds[column].size()" before
+  // de-duplication) so the most used features share the same cache lines.
+  std::vector<std::pair<int, std::vector<float>>> columns_and_thresholds(
+      std::make_move_iterator(thresholds.begin()),
+      std::make_move_iterator(thresholds.end()));
+  std::stable_sort(columns_and_thresholds.begin(), columns_and_thresholds.end(),
+                   [](const auto& a, const auto& b) {
+                     return a.second.size() > b.second.size();
+                   });
+
+  std::unordered_map<int, int> binned_feature_idxs;
+  for (auto& column_and_thresholds : columns_and_thresholds) {
+    auto& boundaries = column_and_thresholds.second;
+    std::sort(boundaries.begin(), boundaries.end());
+    boundaries.erase(std::unique(boundaries.begin(), boundaries.end()),
+                     boundaries.end());
+    if (boundaries.size() >= kMissingBin) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Too many unique thresholds (", boundaries.size(),
+          ") on a numerical feature for the quantized flat forest."));
+    }
+    binned_feature_idxs[column_and_thresholds.first] =
+        quantized->feature_columns_.size();
+    quantized->feature_columns_.push_back(column_and_thresholds.first);
+    quantized->bin_boundaries_.push_back(std::move(boundaries));
+  }
+
+  quantized->nodes_.resize(flat.num_nodes());
+  for (int node_idx = 0; node_idx < flat.num_nodes(); node_idx++) {
+    Node& node = quantized->nodes_[node_idx];
+    switch (flat.node_types()[node_idx]) {
+      case NodeType::kLeaf:
+        node.feature = kLeafFeature;
+        node.threshold = 0;
+        node.target = flat.node_values()[node_idx].offset;
+        break;
+      case NodeType::kHigher: {
+        const int binned_feature_idx =
+            binned_feature_idxs.at(flat.node_features()[node_idx]);
+        const auto& boundaries =
+            quantized->bin_boundaries_[binned_feature_idx];
+        const auto threshold_it =
+            std::lower_bound(boundaries.begin(), boundaries.end(),
+                             flat.node_values()[node_idx].threshold);
+        node.feature = binned_feature_idx |
+                       (flat.node_na_values()[node_idx] ? kNaValueBit : 0);
+        node.threshold = threshold_it - boundaries.begin();
+        node.target = flat.node_children()[node_idx];
+      } break;
+      default:
+        node.feature = kOtherConditionFeature;
+        node.threshold = 0;
+        node.target = flat.node_children()[node_idx];
+        break;
+    }
+  }
+  return quantized;
+}
+
+void QuantizedFlatForest::BinExamples(const InputTensors& inputs,
+                                      const int begin, const int end,
+                                      std::vector<uint16_t>* bins) const {
+  const int num_features = num_binned_features();
+  bins->resize((end - begin) * num_features);
+  uint16_t* dst = bins->data();
+  for (int example_idx = begin; example_idx < end; example_idx++) {
+    for (int feature_idx = 0; feature_idx < num_features; feature_idx++) {
+      const float value =
+          inputs.numerical_features(example_idx, feature_columns_[feature_idx]);
+      if (std::isnan(value)) {
+        *dst++ = kMissingBin;
+      } else {
+        const auto& boundaries = bin_boundaries_[feature_idx];
+        *dst++ = std::upper_bound(boundaries.begin(), boundaries.end(), value) -
+                 boundaries.begin();
+      }
+    }
+  }
+}
+
+inline int QuantizedFlatForest::GetLeaf(const InputTensors& inputs,
+                                        const int example_idx,
+                                        const uint16_t* bins,
+                                        int node_idx) const {
+  while (true) {
+    const Node& node = nodes_[node_idx];
+    const uint16_t feature = node.feature & kFeatureMask;
+    if (feature == kLeafFeature) {
+      return node_idx;
+    }
+    bool condition;
+    if (feature == kOtherConditionFeature) {
+      condition = forest_->EvalCondition(inputs, example_idx, node_idx);
+    } else {
+      const uint16_t bin = bins[feature];
+      condition = bin == kMissingBin ? (node.feature & kNaValueBit) != 0
+                                     : bin > node.threshold;
+    }
+    node_idx = node.target + condition;
+  }
+}
+
+tf::Status QuantizedFlatForest::Predict(const InputTensors& inputs,
+                                        const int begin, const int end,
+                                        const InferenceOptions& options,
+                                        Buffers* buffers,
+                                        OutputTensors* outputs) const {
+  const FlatForest& flat = *forest_;
+  if (outputs->output_dim != flat.output_dim()) {
+    return tf::Status(
+        tf::error::INVALID_ARGUMENT,
+        absl::StrCat("The model output dimension (", flat.output_dim(),
+                     ") does not match the op dense_output_dim (",
+                     outputs->output_dim, ")."));
+  }
+  if (options.early_exit_margin > 0.f) {
+    return tf::Status(tf::error::INVALID_ARGUMENT,
+                      "\"early_exit_margin\" is not supported by the quantized "
+                      "flat forest engine.");
+  }
+
+  BinExamples(inputs, begin, end, &buffers->bins);
+  const int num_features = num_binned_features();
+
+  const int num_examples = end - begin;
+  const int dim = flat.accumulator_dim();
+  float* const outputs_data =
+      outputs->dense_predictions.data() + begin * outputs->output_dim;
+  float* accumulator_data;
+  if (flat.AccumulatesInOutputs()) {
+    accumulator_data = outputs_data;
+  } else {
+    buffers->accumulator.resize(num_examples * dim);
+    accumulator_data = buffers->accumulator.data();
+  }
+  const auto& initial_accumulator = flat.initial_accumulator();
+  for (int example_idx = 0; example_idx < num_examples; example_idx++) {
+    std::copy(initial_accumulator.begin(), initial_accumulator.end(),
+              accumulator_data + example_idx * dim);
+  }
+
+  const int num_evaluated_trees = flat.NumEvaluatedTrees(options.max_num_trees);
+  const int leaf_value_dim = flat.leaf_value_dim();
+  const float* const leaf_values = flat.leaf_values().data();
+  for (int tree_idx = 0; tree_idx < num_evaluated_trees; tree_idx++) {
+    const int root = flat.tree_roots()[tree_idx];
+    float* tree_accumulator =
+        accumulator_data + flat.TreeAccumulatorOffset(tree_idx);
+    for (int example_idx = 0; example_idx < num_examples; example_idx++) {
+      const int leaf =
+          GetLeaf(inputs, begin + example_idx,
+                  buffers->bins.data() + example_idx * num_features, root);
+      const float* leaf_value = leaf_values + nodes_[leaf].target;
+      float* dst = tree_accumulator + example_idx * dim;
+      for (int i = 0; i < leaf_value_dim; i++) {
+        dst[i] += leaf_value[i];
+      }
+    }
+  }
+
+  const int output_dim = outputs->output_dim;
+  for (int example_idx = 0; example_idx < num_examples; example_idx++) {
+    flat.Finalize(accumulator_data + example_idx * dim, num_evaluated_trees,
+                  outputs_data + example_idx * output_dim);
+  }
+  return tf::Status::OK();
+}
+
+// Runs the model with a "QuantizedFlatForest". Supports the same models as the
+// flat forest engine.
+class QuantizedFlatForestInferenceEngine : public AbstractInferenceEngine {
+ public:
+  static StatusOr<std::unique_ptr<QuantizedFlatForestInferenceEngine>> Create(
+      const model::AbstractModel& model, const FeatureIndex& feature_index,
+      const TreeShard& tree_shard = {}) {
+    auto forest_or = FlatForest::Create(model, feature_index, tree_shard);
+    RETURN_IF_ERROR(forest_or.status());
+    auto quantized_or = QuantizedFlatForest::Create(
+        SharedFlatForests::Global()->Intern(std::move(forest_or).value()));
+    RETURN_IF_ERROR(quantized_or.status());
+    return absl::WrapUnique(new QuantizedFlatForestInferenceEngine(
+        std::move(quantized_or).value()));
+  }
+
+  class Cache : public AbstractCache {
+   private:
+    // Buffers of each shard.
+    std::vector<QuantizedFlatForest::Buffers> buffers_;
+
+    friend QuantizedFlatForestInferenceEngine;
+  };
+
+  StatusOr<std::unique_ptr<AbstractCache>> CreateCache() const override {
+    auto cache = absl::make_unique<QuantizedFlatForestInferenceEngine::Cache>();
+    cache->buffers_.resize(1);
+    return cache;
+  }
+
+  tf::Status RunInference(const InputTensors& inputs,
+                          const FeatureIndex& feature_index,
+                          const InferenceOptions& options,
+                          OutputTensors* outputs,
+                          AbstractCache* abstract_cache) const override {
+    auto* cache = dynamic_cast<Cache*>(abstract_cache);
+    if (cache == nullptr) {
+      return tf::Status(tf::error::INTERNAL, "Unexpected cache type.");
+    }
+
+    cache->stage_timer()->Start(InferenceStage::kPredict);
+    const int num_shards = options.NumShards(inputs.batch_size);
+    if (num_shards <= 1) {
+      return forest_->Predict(inputs, 0, inputs.batch_size, options,
+                              &cache->buffers_.front(), outputs);
+    }
+    if (cache->buffers_.size() < num_shards) {
+      cache->buffers_.resize(num_shards);
+    }
+    return RunShardsInParallel(
+        options.thread_pool, num_shards, inputs.batch_size,
+        [&](const int shard_idx, const int begin, const int end) {
+          return forest_->Predict(inputs, begin, end, options,
+                                  &cache->buffers_[shard_idx], outputs);
+        });
+  }
+
+  const QuantizedFlatForest& forest() const { return *forest_; }
+
+ private:
+  explicit QuantizedFlatForestInferenceEngine(
+      std::unique_ptr<QuantizedFlatForest> forest)
+      : forest_(std::move(forest)) {}
+
+  std::unique_ptr<QuantizedFlatForest> forest_;
+};
+
+// Forests of several models with the same input features, packed in a single
+// flat forest (i.e. a single node arena) where the trees of each model are
+// contiguous. A batch mixing examples of the different models is evaluated in
+// one pass: The examples are grouped by model, and each tree is applied on the
+// examples of its model.
+class FlatForestBank {
+ public:
+  // Buffers re-used in between calls.
+  struct Buffers {
+    // Examples of the shard, grouped by model.
+    std::vector<int> example_idxs;
+    // "example_idxs[model_begins[i]:model_begins[i+1]]" are the examples of the
+    // "i-th" model.
+    std::vector<int> model_begins;
+    // Next free position of each model in "example_idxs".
+    std::vector<int> cursors;
+    std::vector<float> accumulator;
+  };
+
+  // Packs the forests. The "i-th" forest is the model with id "i".
+  static StatusOr<std::unique_ptr<FlatForestBank>> Create(
+      const std::vector<std::unique_ptr<FlatForest>>& forests);
+
+  int num_models() const { return initial_accumulators_.size(); }
+  const FlatForest& forest() const { return *packed_; }
+
+  // Evaluates the examples [begin, end) of "inputs" with the models
+  // "inputs.model_ids".
+  tf::Status Predict(const InputTensors& inputs, int begin, int end,
+                     Buffers* buffers, OutputTensors* outputs) const;
+
+ private:
+  FlatForestBank() = default;
+
+  std::unique_ptr<FlatForest> packed_;
+
+  // The trees of the "i-th" model are the trees [tree_begins_[i],
+  // tree_begins_[i+1]) of "packed_".
+  std::vector<int> tree_begins_;
+
+  // Initial accumulator of each model.
+  std::vector<std::vector<float>> initial_accumulators_;
+};
+
+StatusOr<std::unique_ptr<FlatForestBank>> FlatForestBank::Create(
+    const std::vector<std::unique_ptr<FlatForest>>& forests) {
+  auto bank = absl::WrapUnique(new FlatForestBank());
+  std::vector<const FlatForest*> forest_ptrs;
+  bank->tree_begins_.push_back(0);
+  for (const auto& forest : forests) {
+    if (forest->HasSparseLeaves()) {
+      return absl::InvalidArgumentError(
+          "The flat forest bank does not support sparse leaves.");
+    }
+    forest_ptrs.push_back(forest.get());
+    bank->tree_begins_.push_back(bank->tree_begins_.back() +
+                                 forest->num_trees());
+    bank->initial_accumulators_.push_back(forest->initial_accumulator());
+  }
+  auto packed_or = FlatForest::Concatenate(forest_ptrs);
+  RETURN_IF_ERROR(packed_or.status());
+  bank->packed_ = std::move(packed_or).value();
+  return bank;
+}
+
+tf::Status FlatForestBank::Predict(const InputTensors& inputs, const int begin,
+                                   const int end, Buffers* buffers,
+                                   OutputTensors* outputs) const {
+  const FlatForest& forest = *packed_;
+  if (outputs->output_dim != forest.output_dim()) {
+    return tf::Status(
+        tf::error::INVALID_ARGUMENT,
+        absl::StrCat("The model output dimension (", forest.output_dim(),
+                     ") does not match the op dense_output_dim (",
+                     outputs->output_dim, ")."));
+  }
+
+  // Group the examples by model (counting sort).
+  auto& model_begins = buffers->model_begins;
+  model_begins.assign(num_models() + 1, 0);
+  for (int example_idx = begin; example_idx < end; example_idx++) {
+    const int model_id = inputs.model_ids[example_idx];
+    if (model_id < 0 || model_id >= num_models()) {
+      return tf::Status(
+          tf::error::INVALID_ARGUMENT,
+          absl::StrCat("Invalid model id ", model_id, " for a bank of ",
+                       num_models(), " models."));
+    }
+    model_begins[model_id + 1]++;
+  }
+  for (int model_id = 0; model_id < num_models(); model_id++) {
+    model_begins[model_id + 1] += model_begins[model_id];
+  }
+  auto& example_idxs = buffers->example_idxs;
+  example_idxs.resize(end - begin);
+  auto& cursors = buffers->cursors;
+  cursors.assign(model_begins.begin(), model_begins.end() - 1);
+  for (int example_idx = begin; example_idx < end; example_idx++) {
+    example_idxs[cursors[inputs.model_ids[example_idx]]++] = example_idx;
+  }
+
+  // Note: The accumulator is indexed by example i.e. "example_idx - begin".
+  const int dim = forest.accumulator_dim();
+  auto& accumulator = buffers->accumulator;
+  accumulator.resize((end - begin) * dim);
+  for (int example_idx = begin; example_idx < end; example_idx++) {
+    const auto& initial_accumulator =
+        initial_accumulators_[inputs.model_ids[example_idx]];
+    std::copy(initial_accumulator.begin(), initial_accumulator.end(),
+              accumulator.begin() + (example_idx - begin) * dim);
+  }
+
+  const int leaf_value_dim = forest.leaf_value_dim();
+  const float* const leaf_values = forest.leaf_values().data();
+  for (int model_id = 0; model_id < num_models(); model_id++) {
+    const int* const model_examples =
+        example_idxs.data() + model_begins[model_id];
+    const int num_model_examples =
+        model_begins[model_id + 1] - model_begins[model_id];
+    if (num_model_examples == 0) {
+      continue;
+    }
+    for (int tree_idx = tree_begins_[model_id];
+         tree_idx < tree_begins_[model_id + 1]; tree_idx++) {
+      const int root = forest.tree_roots()[tree_idx];
+      const int output_offset =
+          forest.TreeAccumulatorOffset(tree_idx - tree_begins_[model_id]);
+      for (int i = 0; i < num_model_examples; i++) {
+        const int example_idx = model_examples[i];
+        const int leaf = forest.GetLeaf(inputs, example_idx, root);
+        const float* leaf_value =
+            leaf_values + forest.node_values()[leaf].offset;
+        float* dst = &accumulator[(example_idx - begin) * dim + output_offset];
+        for (int j = 0; j < leaf_value_dim; j++) {
+          dst[j] += leaf_value[j];
+        }
+      }
+    }
+  }
+
+  const int output_dim = outputs->output_dim;
+  float* const outputs_data = outputs->dense_predictions.data();
+  for (int example_idx = begin; example_idx < end; example_idx++) {
+    const int model_id = inputs.model_ids[example_idx];
+    forest.Finalize(&accumulator[(example_idx - begin) * dim],
+                    tree_begins_[model_id + 1] - tree_begins_[model_id],
+                    outputs_data + example_idx * output_dim);
+  }
+  return tf::Status::OK();
+}
+
+// Runs a "FlatForestBank" on the examples of the model bank inference op.
+class FlatForestBankInferenceEngine : public AbstractInferenceEngine {
+ public:
+  explicit FlatForestBankInferenceEngine(std::unique_ptr<FlatForestBank> bank)
+      : bank_(std::move(bank)) {}
+
+  class Cache : public AbstractCache {
+   private:
+    // Buffers of each shard.
+    std::vector<FlatForestBank::Buffers> buffers_;
+
+    friend FlatForestBankInferenceEngine;
+  };
+
+  StatusOr<std::unique_ptr<AbstractCache>> CreateCache() const override {
+    auto cache = absl::make_unique<FlatForestBankInferenceEngine::Cache>();
+    cache->buffers_.resize(1);
+    return cache;
+  }
+
+  tf::Status RunInference(const InputTensors& inputs,
+                          const FeatureIndex& feature_index,
+                          const InferenceOptions& options,
+                          OutputTensors* outputs,
+                          AbstractCache* abstract_cache) const override {
+    TF_RETURN_IF_ERROR(CheckFullEvaluation(options));
+    if (inputs.model_ids == nullptr) {
+      return tf::Status(tf::error::INVALID_ARGUMENT,
+                        "A model bank requires the model ids of the examples "
+                        "i.e. the \"SimpleMLInferenceOpWithModelBank\" op.");
+    }
+    auto* cache = dynamic_cast<Cache*>(abstract_cache);
+    if (cache == nullptr) {
+      return tf::Status(tf::error::INTERNAL, "Unexpected cache type.");
+    }
+
+    cache->stage_timer()->Start(InferenceStage::kPredict);
+    const int num_shards = options.NumShards(inputs.batch_size);
+    if (num_shards <= 1) {
+      return bank_->Predict(inputs, 0, inputs.batch_size,
+                            &cache->buffers_.front(), outputs);
+    }
+    if (cache->buffers_.size() < num_shards) {
+      cache->buffers_.resize(num_shards);
+    }
+    return RunShardsInParallel(
+        options.thread_pool, num_shards, inputs.batch_size,
+        [&](const int shard_idx, const int begin, const int end) {
+          return bank_->Predict(inputs, begin, end,
+                                &cache->buffers_[shard_idx], outputs);
+        });
+  }
+
+ private:
+  std::unique_ptr<FlatForestBank> bank_;
+};
+
+// A bounded cache of the predictions of examples, keyed by a hash of their
+// features (see "HashExample"), to skip the evaluation of the examples scored
+// repeatedly.
+//
+// The cache is split in shards, each a least recently used list with its own
+// mutex, so that the concurrent inference calls rarely contend.
+class PredictionCache {
+ public:
+  // Two independent hashes of the features of an example: a false hit
+  // requires both to collide.
+  struct Key {
+    uint64_t hash;
+    uint64_t check;
+  };
+
+  // "capacity" is the maximum number of cached predictions.
+  explicit PredictionCache(const int capacity)
+      : shard_capacity_((capacity + kNumShards - 1) / kNumShards) {}
+
+  // Copies the "output_dim" values of the prediction of "key" in "prediction",
+  // and marks it as recently used. Returns false if "key" is not cached.
+  bool Lookup(const Key& key, const int output_dim, float* prediction) {
+    Shard& shard = shards_[key.hash % kNumShards];
+    tf::mutex_lock lock(shard.mutex);
+    const auto it = shard.index.find(key.hash);
+    if (it == shard.index.end() || it->second->check != key.check ||
+        it->second->prediction.size() != static_cast<size_t>(output_dim)) {
+      return false;
+    }
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    std::copy(it->second->prediction.begin(), it->second->prediction.end(),
+              prediction);
+    return true;
+  }
+
+  // Caches the "output_dim" values of "prediction" for "key", evicting the
+  // least recently used prediction of the shard if it is full.
+  void Insert(const Key& key, const int output_dim, const float* prediction) {
+    Shard& shard = shards_[key.hash % kNumShards];
+    tf::mutex_lock lock(shard.mutex);
+    const auto it = shard.index.find(key.hash);
+    if (it != shard.index.end()) {
+      shard.entries.erase(it->second);
+      shard.index.erase(it);
+    } else if (shard.index.size() >= shard_capacity_) {
+      shard.index.erase(shard.entries.back().hash);
+      shard.entries.pop_back();
+    }
+    shard.entries.push_front(
+        {key.hash, key.check,
+         std::vector<float>(prediction, prediction + output_dim)});
+    shard.index[key.hash] = shard.entries.begin();
+  }
+
+ private:
+  static constexpr int kNumShards = 16;
+
+  struct Entry {
+    uint64_t hash;
+    uint64_t check;
+    std::vector<float> prediction;
+  };
+
+  struct Shard {
+    tf::mutex mutex;
+    // Most recently used first.
+    std::list<Entry> entries TF_GUARDED_BY(mutex);
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index
+        TF_GUARDED_BY(mutex);
+  };
+
+  const size_t shard_capacity_;
+  std::array<Shard, kNumShards> shards_;
+};
+
+// Hash, with "seed", of the features of the "example_idx-th" example of
+// "inputs".
+uint64_t HashExample(const InputTensors& inputs, const int example_idx,
+                     const uint64_t seed) {
+  uint64_t hash = seed;
+  const auto hash_row = [&](const auto& bank) {
+    if (bank.dimension(0) > 0 && bank.dimension(1) > 0) {
+      hash = tf::Hash64(
+          reinterpret_cast<const char*>(bank.data() +
+                                        example_idx * bank.dimension(1)),
+          bank.dimension(1) * sizeof(*bank.data()), hash);
+    }
+  };
+  hash_row(inputs.numerical_features);
+  hash_row(inputs.boolean_features);
+  hash_row(inputs.categorical_int_features);
+
+  // The items of each categorical set feature, and their number.
+  const auto& dim_1 = inputs.categorical_set_int_features_row_splits_dim_1;
+  const auto& dim_2 = inputs.categorical_set_int_features_row_splits_dim_2;
+  if (dim_2.size() > example_idx + 1) {
+    for (int64_t row = dim_2(example_idx); row < dim_2(example_idx + 1);
+         row++) {
+      const int64_t num_items = dim_1(row + 1) - dim_1(row);
+      hash = tf::Hash64Combine(hash, num_items);
+      hash = tf::Hash64(
+          reinterpret_cast<const char*>(
+              inputs.categorical_set_int_features_values.data() + dim_1(row)),
+          num_items * sizeof(int32_t), hash);
+    }
+  }
+  return hash;
+}
+
+// Copies the rows "rows" of "src" in the new tensor "dst". An empty "src" (i.e.
+// unused feature bank) is copied as an empty tensor.
+template <typename T>
+tf::Status GatherRows(OpKernelContext* ctx,
+                      const typename tf::TTypes<const T>::Matrix& src,
+                      const std::vector<int>& rows, Tensor* dst) {
+  const int num_rows = src.dimension(0) == 0 ? 0 : rows.size();
+  const int num_cols = src.dimension(1);
+  TF_RETURN_IF_ERROR(ctx->allocate_temp(
+      tf::DataTypeToEnum<T>::v(), TensorShape({num_rows, num_cols}), dst));
+  T* dst_data = dst->matrix<T>().data();
+  for (int row_idx = 0; row_idx < num_rows; row_idx++) {
+    std::copy_n(src.data() + rows[row_idx] * num_cols, num_cols,
+                dst_data + row_idx * num_cols);
+  }
+  return tf::Status::OK();
+}
+
+// Copies the examples "example_idxs" of "src" in the new tensors "dst", in the
+// order of the op inputs (see "InputTensors").
+tf::Status GatherExamples(OpKernelContext* ctx, const InputTensors& src,
+                          const std::vector<int>& example_idxs,
+                          std::array<Tensor, 6>* dst) {
+  TF_RETURN_IF_ERROR(GatherRows<float>(ctx, src.numerical_features,
+                                       example_idxs, &(*dst)[0]));
+  TF_RETURN_IF_ERROR(
+      GatherRows<float>(ctx, src.boolean_features, example_idxs, &(*dst)[1]));
+  TF_RETURN_IF_ERROR(GatherRows<int32_t>(ctx, src.categorical_int_features,
+                                         example_idxs, &(*dst)[2]));
+
+  // Categorical set features.
+  const auto& values = src.categorical_set_int_features_values;
+  const auto& dim_1 = src.categorical_set_int_features_row_splits_dim_1;
+  const auto& dim_2 = src.categorical_set_int_features_row_splits_dim_2;
+  std::vector<int32_t> gathered_values;
+  std::vector<int64_t> gathered_dim_1 = {0};
+  std::vector<int64_t> gathered_dim_2 = {0};
+  if (dim_2.size() > 1) {
+    for (const int example_idx : example_idxs) {
+      for (int64_t row = dim_2(example_idx); row < dim_2(example_idx + 1);
+           row++) {
+        gathered_values.insert(gathered_values.end(),
+                               values.data() + dim_1(row),
+                               values.data() + dim_1(row + 1));
+        gathered_dim_1.push_back(gathered_values.size());
+      }
+      gathered_dim_2.push_back(gathered_dim_1.size() - 1);
+    }
+  }
+  TF_RETURN_IF_ERROR(ctx->allocate_temp(
+      tf::DT_INT32, TensorShape({static_cast<int64_t>(gathered_values.size())}),
+      &(*dst)[3]));
+  std::copy(gathered_values.begin(), gathered_values.end(),
+            (*dst)[3].flat<int32_t>().data());
+  for (const auto& split : {std::make_pair(&gathered_dim_1, &(*dst)[4]),
+                            std::make_pair(&gathered_dim_2, &(*dst)[5])}) {
+    TF_RETURN_IF_ERROR(ctx->allocate_temp(
+        tf::DT_INT64,
+        TensorShape({static_cast<int64_t>(split.first->size())}),
+        split.second));
+    std::copy(split.first->begin(), split.first->end(),
+              split.second->flat<tf::int64>().data());
+  }
+  return tf::Status::OK();
+}
+
+auto* autotuned_inference_engine = tf::monitoring::Gauge<std::string, 1>::New(
+    "/tensorflow/serving/tfdf/autotuned_inference_engine",
+    "Inference engine chosen by the \"autotune\" engine for a model.",
+    "model_path");
+
+// Number of the loaded models recording their engine in
+// "autotuned_inference_engine", by model path.
+tf::mutex* autotuned_inference_engine_mutex = new tf::mutex();
+auto* autotuned_inference_engine_users =
+    new std::unordered_map<std::string, int>();
+
+// Records "engine" in the "autotuned_inference_engine" cell of "model_path",
+// on behalf of one more loaded model.
+void AddAutotunedEngineMetric(const std::string& model_path,
+                              const std::string& engine) {
+  tf::mutex_lock l(*autotuned_inference_engine_mutex);
+  (*autotuned_inference_engine_users)[model_path]++;
+  autotuned_inference_engine->GetCell(model_path)->Set(engine);
+}
+
+// Releases a model recorded by "AddAutotunedEngineMetric". The cells of a
+// gauge cannot be removed, so the cell of the path is cleared once its last
+// model is released, and only the loaded models report an engine.
+void RemoveAutotunedEngineMetric(const std::string& model_path) {
+  tf::mutex_lock l(*autotuned_inference_engine_mutex);
+  const auto it = autotuned_inference_engine_users->find(model_path);
+  if (it == autotuned_inference_engine_users->end() || --it->second > 0) {
+    return;
+  }
+  autotuned_inference_engine_users->erase(it);
+  autotuned_inference_engine->GetCell(model_path)->Set("");
+}
+
+// Batch of random examples, on which the "autotune" engine benchmarks the
+// engines compatible with a model. The feature values are drawn uniformly in
+// the range of values of their column in the dataspec.
+class SyntheticBatch {
+ public:
+  SyntheticBatch(const FeatureIndex& feature_index,
+                 const dataset::proto::DataSpecification& data_spec,
+                 const int batch_size, std::mt19937* rng)
+      : batch_size_(batch_size) {
+    // Note: The categorical value 0 is the out-of-vocabulary item.
+    const auto categorical_value = [&](const int col_idx) {
+      const int num_values =
+          data_spec.columns(col_idx).categorical().number_of_unique_values();
+      const int max_value = std::max(0, num_values - 1);
+      return std::uniform_int_distribution<int32_t>(std::min(1, max_value),
+                                                    max_value)(*rng);
+    };
+
+    const auto& numerical_cols = feature_index.numerical_features();
+    const int64_t num_numerical = numerical_cols.size();
+    numerical_features_ =
+        Tensor(tf::DT_FLOAT, TensorShape({batch_size, num_numerical}));
+    auto numerical = numerical_features_.matrix<float>();
+    for (int col = 0; col < num_numerical; col++) {
+      const auto& spec = data_spec.columns(numerical_cols[col]).numerical();
+      std::uniform_real_distribution<float> distribution(
+          spec.min_value(), std::max(spec.min_value(), spec.max_value()));
+      for (int example_idx = 0; example_idx < batch_size; example_idx++) {
+        numerical(example_idx, col) = distribution(*rng);
+      }
+    }
+
+    const int64_t num_boolean = feature_index.boolean_features().size();
+    boolean_features_ =
+        Tensor(tf::DT_FLOAT, TensorShape({batch_size, num_boolean}));
+    auto boolean = boolean_features_.matrix<float>();
+    std::bernoulli_distribution boolean_distribution;
+    for (int col = 0; col < num_boolean; col++) {
+      for (int example_idx = 0; example_idx < batch_size; example_idx++) {
+        boolean(example_idx, col) = boolean_distribution(*rng);
+      }
+    }
+
+    const auto& categorical_cols = feature_index.categorical_int_features();
+    const int64_t num_categorical = categorical_cols.size();
+    categorical_int_features_ =
+        Tensor(tf::DT_INT32, TensorShape({batch_size, num_categorical}));
+    auto categorical = categorical_int_features_.matrix<int32_t>();
+    for (int col = 0; col < num_categorical; col++) {
+      for (int example_idx = 0; example_idx < batch_size; example_idx++) {
+        categorical(example_idx, col) =
+            categorical_value(categorical_cols[col]);
+      }
+    }
+
+    // A single item per example and categorical-set feature.
+    const auto& set_cols = feature_index.categorical_set_int_features();
+    const int64_t num_sets = int64_t{batch_size} * set_cols.size();
+    categorical_set_values_ = Tensor(tf::DT_INT32, TensorShape({num_sets}));
+    categorical_set_row_splits_dim_1_ =
+        Tensor(tf::DT_INT64, TensorShape({num_sets + 1}));
+    categorical_set_row_splits_dim_2_ =
+        Tensor(tf::DT_INT64, TensorShape({batch_size + 1}));
+    auto set_values = categorical_set_values_.vec<int32_t>();
+    auto row_splits_dim_1 = categorical_set_row_splits_dim_1_.vec<int64_t>();
+    auto row_splits_dim_2 = categorical_set_row_splits_dim_2_.vec<int64_t>();
+    for (int64_t set_idx = 0; set_idx < num_sets; set_idx++) {
+      set_values(set_idx) =
+          categorical_value(set_cols[set_idx % set_cols.size()]);
+      row_splits_dim_1(set_idx) = set_idx;
+    }
+    row_splits_dim_1(num_sets) = num_sets;
+    for (int example_idx = 0; example_idx <= batch_size; example_idx++) {
+      row_splits_dim_2(example_idx) = int64_t{example_idx} * set_cols.size();
+    }
+  }
+
+  InputTensors inputs() const {
+    InputTensors inputs(
+        &numerical_features_, &boolean_features_, &categorical_int_features_,
+        &categorical_set_values_, &categorical_set_row_splits_dim_1_,
+        &categorical_set_row_splits_dim_2_);
+    inputs.batch_size = batch_size_;
+    return inputs;
+  }
+
+ private:
+  const int batch_size_;
+  Tensor numerical_features_;
+  Tensor boolean_features_;
+  Tensor categorical_int_features_;
+  Tensor categorical_set_values_;
+  Tensor categorical_set_row_splits_dim_1_;
+  Tensor categorical_set_row_splits_dim_2_;
+};
+
+// Options of the loading of a model. Copy of the attributes of the same name
+// of the model loading ops.
+struct ModelLoadOptions {
+  // If positive, the predictions of up to this number of examples are cached
+  // (see "YggdrasilModelResource::prediction_cache").
+  int prediction_cache_size = 0;
+
+  // If positive, the model has its own pool of this number of threads to run
+  // the shards of the inference calls (see
+  // "YggdrasilModelResource::inference_threads").
+  int num_inference_threads = 0;
+
+  // NUMA node the inference threads are bound to, or -1 (i.e.
+  // "tf::port::kNUMANoAffinity") for no binding.
+  int inference_threads_numa_node = tf::port::kNUMANoAffinity;
+
+  // If true, the nodes of the flat forest engines are stored in huge pages
+  // (see "FlatForest::MoveToHugePages").
+  bool use_huge_pages = false;
+
+  // If true, the memory mapped flat forest is read before the model is used
+  // (see "FlatForest::Prefault").
+  bool prefault_model_data = false;
+
+  // If set, the flat forests of the "flat" and "flat_mapped" engines are read
+  // from, or saved to, this directory instead of being built from the model
+  // (see "YggdrasilModelResource::LoadFlatForestFromDisk").
+  std::string flat_forest_cache_dir;
+
+  // If true, the files of "flat_forest_cache_dir" mapped by the "flat_mapped"
+  // engine are deleted when the last process using them unloads its model
+  // (see "FlatForestFileLock").
+  bool release_unused_flat_forests = false;
+
+  // Subset of the trees loaded by the "flat", "flat_mapped" and
+  // "flat_quantized" engines (see "TreeShard").
+  TreeShard tree_shard;
+
+  // Sizes of the batches the "autotune" engine benchmarks the engines on.
+  std::vector<int> autotune_batch_sizes;
+
+  // If positive, the leaves of the Random Forest classifiers of the "flat" and
+  // "flat_mapped" engines keep this number of class probabilities (see
+  // "FlatForest::HasSparseLeaves").
+  int rf_leaf_top_k = 0;
+
+  // Reads the options from the attributes of a model loading op.
+  tf::Status ReadAttributes(OpKernelConstruction* ctx) {
+    TF_RETURN_IF_ERROR(
+        ctx->GetAttr(kAttributePredictionCacheSize, &prediction_cache_size));
+    TF_RETURN_IF_ERROR(
+        ctx->GetAttr(kAttributeNumInferenceThreads, &num_inference_threads));
+    TF_RETURN_IF_ERROR(ctx->GetAttr(kAttributeInferenceThreadsNumaNode,
+                                    &inference_threads_numa_node));
+    TF_RETURN_IF_ERROR(ctx->GetAttr(kAttributeUseHugePages, &use_huge_pages));
+    TF_RETURN_IF_ERROR(
+        ctx->GetAttr(kAttributePrefaultModelData, &prefault_model_data));
+    TF_RETURN_IF_ERROR(
+        ctx->GetAttr(kAttributeFlatForestCacheDir, &flat_forest_cache_dir));
+    TF_RETURN_IF_ERROR(ctx->GetAttr(kAttributeReleaseUnusedFlatForests,
+                                    &release_unused_flat_forests));
+    TF_RETURN_IF_ERROR(
+        ctx->GetAttr(kAttributeNumTreeShards, &tree_shard.num_shards));
+    TF_RETURN_IF_ERROR(
+        ctx->GetAttr(kAttributeTreeShardIndex, &tree_shard.index));
+    if (tree_shard.index >= tree_shard.num_shards) {
+      return tf::errors::InvalidArgument(
+          "\"tree_shard_index\" should be less than \"num_tree_shards\".");
+    }
+    TF_RETURN_IF_ERROR(
+        ctx->GetAttr(kAttributeAutotuneBatchSizes, &autotune_batch_sizes));
+    for (const int batch_size : autotune_batch_sizes) {
+      if (batch_size <= 0) {
+        return tf::errors::InvalidArgument(
+            "The \"autotune_batch_sizes\" should be positive.");
+      }
+    }
+    TF_RETURN_IF_ERROR(ctx->GetAttr(kAttributeRfLeafTopK, &rf_leaf_top_k));
+    return tf::Status::OK();
+  }
+};
+
+// TF resource containing the Yggdrasil model in memory.
+class YggdrasilModelResource : public tf::ResourceBase {
+ public:
+  // Releases the model on a thread of its own, as the loading does (see
+  // "ScheduleModelLoading"). Freeing or unmapping the forest of a large model
+  // and joining its inference threads can take a while, and the last
+  // reference to the resource is released by a thread of the session, e.g.
+  // the one closing it while the model server unloads the servable.
+  ~YggdrasilModelResource() override {
+    if (!autotuned_model_path_.empty()) {
+      RemoveAutotunedEngineMetric(autotuned_model_path_);
+    }
+    // Note: The file is unmapped before its lock is released (see
+    // "flat_forest_file_lock_").
+    tf::Env::Default()->SchedClosure(
+        [inference_threads = inference_threads_.release(),
+         prediction_cache = prediction_cache_.release(),
+         inference_engine = inference_engine_.release(),
+         flat_forest_file_lock = flat_forest_file_lock_.release()]() {
+          delete inference_threads;
+          delete prediction_cache;
+          delete inference_engine;
+          delete flat_forest_file_lock;
+        });
+  }
+
+  std::string DebugString() const override { return "YggdrasilModelResource"; }
+
+  // Loads the model from disk. "inference_engine" is the engine requested by
+  // the user (see "kInferenceEngine*"). The prediction cache and the inference
+  // threads of a previously loaded model are discarded.
+  tf::Status LoadModelFromDisk(const absl::string_view model_path,
+                               const std::string& inference_engine,
+                               const ModelLoadOptions& options = {}) {
+    prediction_cache_.reset();
+    if (options.prediction_cache_size > 0) {
+      prediction_cache_ =
+          absl::make_unique<PredictionCache>(options.prediction_cache_size);
+    }
+    inference_threads_.reset();
+    // Note: The file is unmapped before its lock is released (see
+    // "flat_forest_file_lock_").
+    inference_engine_.reset();
+    flat_forest_file_lock_.reset();
+    if (options.num_inference_threads > 0) {
+      tf::ThreadOptions thread_options;
+      thread_options.numa_node = options.inference_threads_numa_node;
+      inference_threads_ = absl::make_unique<tf::thread::ThreadPool>(
+          tf::Env::Default(), thread_options, "tfdf_inference",
+          options.num_inference_threads, /*low_latency_hint=*/true);
+    }
+    if (options.tree_shard.num_shards > 1 &&
+        inference_engine != kInferenceEngineFlat &&
+        inference_engine != kInferenceEngineFlatMapped &&
+        inference_engine != kInferenceEngineFlatQuantized) {
+      return tf::errors::InvalidArgument(
+          "The tree shards are only supported by the \"flat\", "
+          "\"flat_mapped\" and \"flat_quantized\" engines.");
+    }
+    if (inference_engine == kInferenceEngineAutotune) {
+      // Reuse the engine chosen by a previous autotuning of the model.
+      std::string autotuned_engine;
+      if (ReadAutotunedEngine(model_path, options, &autotuned_engine)) {
+        LOG(INFO) << "Use the autotuned \"" << autotuned_engine << "\" engine";
+        RecordAutotunedEngine(model_path, autotuned_engine);
+        return LoadModelFromDisk(model_path, autotuned_engine, options);
+      }
+    }
+    if (inference_engine == kInferenceEngineFlatMapped ||
+        (inference_engine == kInferenceEngineFlat &&
+         !options.flat_forest_cache_dir.empty())) {
+      return LoadFlatForestFromDisk(model_path, inference_engine, options);
+    }
+
+    std::unique_ptr<model::AbstractModel> model;
+    TF_RETURN_IF_ERROR(utils::FromUtilStatus(LoadModel(model_path, &model)));
+    task_ = model->task();
+    TF_RETURN_IF_ERROR(
+        feature_index_.Initialize(model->input_features(), model->data_spec()));
+    TF_RETURN_IF_ERROR(categorical_dictionaries_.Initialize(
+        feature_index_, model->data_spec()));
+    TF_RETURN_IF_ERROR(ComputeDenseColRepresentation(model->data_spec(),
+                                                     model->label_col_idx()));
+
+    // WARNING: After this function, the "model" might not be available anymore.
+    TF_RETURN_IF_ERROR(CreateInferenceEngine(std::move(model), inference_engine,
+                                             model_path, options));
+    return tf::Status::OK();
+  }
+
+  // Loads the models in "model_paths" into a model bank (see
+  // "FlatForestBank"). The "i-th" model has the model id "i". All the models
+  // should have the same input features and labels.
+  tf::Status LoadModelBankFromDisk(
+      const std::vector<std::string>& model_paths) {
+    if (model_paths.empty()) {
+      return tf::errors::InvalidArgument("A model bank requires one model.");
+    }
+    std::vector<std::unique_ptr<FlatForest>> forests;
+    std::unique_ptr<model::AbstractModel> first_model;
+    for (const auto& model_path : model_paths) {
+      std::unique_ptr<model::AbstractModel> model;
+      TF_RETURN_IF_ERROR(utils::FromUtilStatus(LoadModel(model_path, &model)));
+      if (!first_model) {
+        task_ = model->task();
+        TF_RETURN_IF_ERROR(feature_index_.Initialize(model->input_features(),
+                                                     model->data_spec()));
+        TF_RETURN_IF_ERROR(categorical_dictionaries_.Initialize(
+            feature_index_, model->data_spec()));
+        TF_RETURN_IF_ERROR(ComputeDenseColRepresentation(
+            model->data_spec(), model->label_col_idx()));
+      } else {
+        const auto status = CheckSameInputsAndLabel(*first_model, *model);
+        if (!status.ok()) {
+          return tf::errors::InvalidArgument(status.error_message(),
+                                             " Model: ", model_path);
+        }
+      }
+      auto forest_or = FlatForest::Create(*model, feature_index_);
+      TF_RETURN_IF_ERROR(utils::FromUtilStatus(forest_or.status()));
+      forests.push_back(std::move(forest_or).value());
+      if (!first_model) {
+        first_model = std::move(model);
+      }
+    }
+
+    auto bank_or = FlatForestBank::Create(forests);
+    TF_RETURN_IF_ERROR(utils::FromUtilStatus(bank_or.status()));
+    LOG(INFO) << "Use flat forest bank engine with " << model_paths.size()
+              << " models and " << bank_or.value()->forest().num_nodes()
+              << " nodes";
+    inference_engine_ = absl::make_unique<FlatForestBankInferenceEngine>(
+        std::move(bank_or).value());
+    return tf::Status::OK();
+  }
+
+  const AbstractInferenceEngine* engine() const {
+    return inference_engine_.get();
+  }
+
+  const FeatureIndex& feature_index() const { return feature_index_; }
+
+  const CategoricalDictionaries& categorical_dictionaries() const {
+    return categorical_dictionaries_;
+  }
+
+  // Cache of the predictions of the model. Null if the predictions are not
+  // cached.
+  PredictionCache* prediction_cache() const { return prediction_cache_.get(); }
+
+  // Threads dedicated to the inference of the model, if requested when it was
+  // loaded. Null otherwise. The shards of the inference calls run on these
+  // threads instead of the worker threads of the device, so the nodes of the
+  // model stay in the caches of the cores running them.
+  tf::thread::ThreadPool* inference_threads() const {
+    return inference_threads_.get();
+  }
+
+  Task task() const { return task_; }
+
+  // Values of the "dense_col_representation" output of the inference OPs.
+  // Tensor of shape [output_dim] and type string.
+  const Tensor& dense_col_representation() const {
+    return dense_col_representation_;
+  }
+
+ private:
+  // Creates an inference engine compatible with the model. The inference engine
+  // can take ownership of the abstract model data.
+  //
+  // With "kInferenceEngineAuto", uses the fast engine if compatible, and the
+  // slow generic engine otherwise. With "kInferenceEngineAutotune", uses the
+  // fastest compatible engine (see "AutotuneInferenceEngine"). Otherwise, fails
+  // if the requested engine is not compatible with the model.
+  //
+  // The "flat" engine uses the compiled forest in "model_path" (see
+  // "FlatForest::GenerateCompiledSource"), if it exists and matches the model.
+  tf::Status CreateInferenceEngine(std::unique_ptr<model::AbstractModel> model,
+                                   const std::string& inference_engine,
+                                   const absl::string_view model_path,
+                                   const ModelLoadOptions& options) {
+    if (inference_engine == kInferenceEngineAutotune) {
+      return AutotuneInferenceEngine(std::move(model), model_path, options);
+    }
+    if (inference_engine == kInferenceEngineAuto) {
+      if (CreateModelEngine(*model, kInferenceEngineFast, model_path, options)
+              .ok()) {
+        return tf::Status::OK();
+      }
+    } else if (inference_engine != kInferenceEngineSlow) {
+      return CreateModelEngine(*model, inference_engine, model_path, options);
+    }
+
+    // Slow generic engine.
+    LOG(INFO) << "Use slow generic engine";
+    inference_engine_ =
+        absl::make_unique<GenericInferenceEngine>(std::move(model));
+    return tf::Status::OK();
+  }
+
+  // Sets the "fast", "flat" or "flat_quantized" engine of "model". Unlike the
+  // slow generic engine, these engines do not keep the model.
+  tf::Status CreateModelEngine(const model::AbstractModel& model,
+                               const std::string& inference_engine,
+                               const absl::string_view model_path,
+                               const ModelLoadOptions& options) {
+    if (inference_engine == kInferenceEngineFast) {
+      auto semi_fast_engine = model.BuildFastEngine();
+      TF_RETURN_IF_ERROR(utils::FromUtilStatus(semi_fast_engine.status()));
+      // Semi-fast generic engine.
+      auto inference_engine_or_status = SemiFastGenericInferenceEngine::Create(
+          std::move(semi_fast_engine.value()), model, feature_index());
+      TF_RETURN_IF_ERROR(
+          utils::FromUtilStatus(inference_engine_or_status.status()));
+      inference_engine_ = std::move(inference_engine_or_status.value());
+      LOG(INFO) << "Use fast generic engine";
+      return tf::Status::OK();
+    }
+
+    if (inference_engine == kInferenceEngineFlat) {
+      auto forest_or = FlatForest::Create(model, feature_index(),
+                                          options.tree_shard,
+                                          options.rf_leaf_top_k);
+      TF_RETURN_IF_ERROR(utils::FromUtilStatus(forest_or.status()));
+      return CreateFlatForestEngine(std::move(forest_or).value(), model_path,
+                                    options);
+    }
+
+    if (inference_engine == kInferenceEngineFlatQuantized) {
+      auto inference_engine_or_status =
+          QuantizedFlatForestInferenceEngine::Create(model, feature_index(),
+                                                     options.tree_shard);
+      TF_RETURN_IF_ERROR(
+          utils::FromUtilStatus(inference_engine_or_status.status()));
+      const auto& forest = inference_engine_or_status.value()->forest();
+      LOG(INFO) << "Use quantized flat forest engine with "
+                << forest.num_binned_features() << " binned features and "
+                << forest.NodeMemoryUsage() << " bytes of nodes";
+      inference_engine_ = std::move(inference_engine_or_status.value());
+      return tf::Status::OK();
+    }
+
+    return tf::errors::InvalidArgument(
+        absl::Substitute("Unknown inference engine \"$0\".", inference_engine));
+  }
+
+  // Minimum wall time, and maximum number of runs, of the benchmark of an
+  // engine on one of the batches of "AutotuneInferenceEngine".
+  static constexpr tf::uint64 kAutotuneMinDurationMicros = 20 * 1000;
+  static constexpr int kAutotuneMaxNumRuns = 1000;
+
+  // Creates each engine of "kAutotunedInferenceEngines" compatible with the
+  // model, measures its latency on synthetic batches of the
+  // "autotune_batch_sizes" sizes, and keeps the fastest. The slow generic
+  // engine is only used if none of these engines is compatible.
+  //
+  // The choice is recorded in the "autotuned_inference_engine" metric, and
+  // saved for the next loads of the model on the same CPU model (see
+  // "GetAutotunedEnginePath").
+  tf::Status AutotuneInferenceEngine(
+      std::unique_ptr<model::AbstractModel> model,
+      const absl::string_view model_path, const ModelLoadOptions& options) {
+    // Note: The examples are the same for all the engines.
+    std::mt19937 rng(/*seed=*/1234);
+    std::vector<std::unique_ptr<SyntheticBatch>> batches;
+    for (const int batch_size : options.autotune_batch_sizes) {
+      batches.push_back(absl::make_unique<SyntheticBatch>(
+          feature_index(), model->data_spec(), batch_size, &rng));
+    }
+
+    std::string best_engine_name = kInferenceEngineSlow;
+    std::unique_ptr<AbstractInferenceEngine> best_engine;
+    double best_latency_us = std::numeric_limits<double>::infinity();
+    for (const char* engine_name : kAutotunedInferenceEngines) {
+      inference_engine_.reset();
+      const auto status =
+          CreateModelEngine(*model, engine_name, model_path, options);
+      if (!status.ok()) {
+        LOG(INFO) << "The \"" << engine_name
+                  << "\" engine is not compatible with the model: " << status;
+        continue;
+      }
+      double latency_us;
+      const auto benchmark_status =
+          BenchmarkInferenceEngine(*inference_engine_, batches, &latency_us);
+      if (!benchmark_status.ok()) {
+        LOG(WARNING) << "The \"" << engine_name
+                     << "\" engine failed on the synthetic examples: "
+                     << benchmark_status;
+        continue;
+      }
+      LOG(INFO) << "The \"" << engine_name << "\" engine runs in "
+                << latency_us << " us per example";
+      if (latency_us < best_latency_us) {
+        best_latency_us = latency_us;
+        best_engine_name = engine_name;
+        best_engine = std::move(inference_engine_);
+      }
+    }
+
+    LOG(INFO) << "Autotuning chose the \"" << best_engine_name << "\" engine";
+    RecordAutotunedEngine(model_path, best_engine_name);
+    const auto status =
+        WriteAutotunedEngine(model_path, options, best_engine_name);
+    if (!status.ok()) {
+      LOG(WARNING) << "Cannot save the autotuned engine of the model: "
+                   << status;
+    }
+    if (!best_engine) {
+      return CreateInferenceEngine(std::move(model), kInferenceEngineSlow,
+                                   model_path, options);
+    }
+    inference_engine_ = std::move(best_engine);
+    return tf::Status::OK();
+  }
+
+  // Records the engine chosen by the autotuning of the model at "model_path"
+  // in the "autotuned_inference_engine" metric, until the model is released.
+  void RecordAutotunedEngine(const absl::string_view model_path,
+                             const std::string& engine) {
+    if (autotuned_model_path_ == model_path) {
+      autotuned_inference_engine->GetCell(autotuned_model_path_)->Set(engine);
+      return;
+    }
+    if (!autotuned_model_path_.empty()) {
+      RemoveAutotunedEngineMetric(autotuned_model_path_);
+    }
+    autotuned_model_path_ = std::string(model_path);
+    AddAutotunedEngineMetric(autotuned_model_path_, engine);
+  }
+
+  // Average wall time, in microseconds per example, of the inference of
+  // "engine" on "batches". The batches are not sharded.
+  tf::Status BenchmarkInferenceEngine(
+      const AbstractInferenceEngine& engine,
+      const std::vector<std::unique_ptr<SyntheticBatch>>& batches,
+      double* latency_us) const {
+    auto cache_or = engine.CreateCache();
+    TF_RETURN_IF_ERROR(utils::FromUtilStatus(cache_or.status()));
+    const auto cache = std::move(cache_or).value();
+    const int output_dim = dense_col_representation_.NumElements();
+    const InferenceOptions inference_options;
+    auto* env = tf::Env::Default();
+    double sum_latency_us = 0;
+    for (const auto& batch : batches) {
+      const InputTensors inputs = batch->inputs();
+      Tensor predictions(tf::DT_FLOAT,
+                         TensorShape({inputs.batch_size, output_dim}));
+      OutputTensors outputs(&predictions, output_dim);
+      const auto run = [&]() {
+        return engine.RunInference(inputs, feature_index_, inference_options,
+                                   &outputs, cache.get());
+      };
+      // The first run warms up the caches.
+      TF_RETURN_IF_ERROR(run());
+      const tf::uint64 begin_us = env->NowMicros();
+      tf::uint64 duration_us = 0;
+      int num_runs = 0;
+      do {
+        TF_RETURN_IF_ERROR(run());
+        num_runs++;
+        duration_us = env->NowMicros() - begin_us;
+      } while (duration_us < kAutotuneMinDurationMicros &&
+               num_runs < kAutotuneMaxNumRuns);
+      sum_latency_us +=
+          static_cast<double>(duration_us) / num_runs / inputs.batch_size;
+    }
+    *latency_us = batches.empty() ? 0 : sum_latency_us / batches.size();
+    return tf::Status::OK();
+  }
+
+  // Path of the file recording the engine chosen by the autotuning of the
+  // model: the path of its flat forest file (see "GetFlatForestPath") with
+  // the "kAutotunedEngineExtension" extension.
+  static tf::Status GetAutotunedEnginePath(const absl::string_view model_path,
+                                           const ModelLoadOptions& options,
+                                           std::string* path) {
+    TF_RETURN_IF_ERROR(GetFlatForestPath(model_path, options, path));
+    absl::StrAppend(path, kAutotunedEngineExtension);
+    return tf::Status::OK();
+  }
+
+  // Conditions of an autotuning. A saved choice is only reused for the same
+  // CPU model and batch sizes.
+  static std::string AutotuneKey(const ModelLoadOptions& options) {
+    return absl::StrCat(tf::port::CPUVendorIDString(), " family ",
+                        tf::port::CPUFamily(), " model ",
+                        tf::port::CPUModelNum(), " batch sizes ",
+                        absl::StrJoin(options.autotune_batch_sizes, ","));
+  }
+
+  // Reads the engine chosen by a previous autotuning of the model. Returns
+  // false if the model was not autotuned, or was autotuned in other conditions
+  // (see "AutotuneKey").
+  static bool ReadAutotunedEngine(const absl::string_view model_path,
+                                  const ModelLoadOptions& options,
+                                  std::string* inference_engine) {
+    std::string path;
+    std::string content;
+    if (!GetAutotunedEnginePath(model_path, options, &path).ok() ||
+        !tf::ReadFileToString(tf::Env::Default(), path, &content).ok()) {
+      return false;
+    }
+    const auto separator = content.rfind('\n');
+    if (separator == std::string::npos ||
+        content.substr(0, separator) != AutotuneKey(options)) {
+      return false;
+    }
+    *inference_engine = content.substr(separator + 1);
+    return *inference_engine == kInferenceEngineSlow ||
+           std::find(std::begin(kAutotunedInferenceEngines),
+                     std::end(kAutotunedInferenceEngines),
+                     *inference_engine) != std::end(kAutotunedInferenceEngines);
+  }
+
+  // Saves the engine chosen by the autotuning of the model. The file is
+  // written atomically, so concurrent loads are safe.
+  static tf::Status WriteAutotunedEngine(const absl::string_view model_path,
+                                         const ModelLoadOptions& options,
+                                         const std::string& inference_engine) {
+    auto* env = tf::Env::Default();
+    std::string path;
+    TF_RETURN_IF_ERROR(GetAutotunedEnginePath(model_path, options, &path));
+    if (!options.flat_forest_cache_dir.empty()) {
+      env->RecursivelyCreateDir(options.flat_forest_cache_dir).IgnoreError();
+    }
+    const std::string tmp_path = absl::StrCat(path, ".tmp-", env->NowMicros());
+    auto status = tf::WriteStringToFile(
+        env, tmp_path,
+        absl::StrCat(AutotuneKey(options), "\n", inference_engine));
+    if (status.ok()) {
+      status = env->RenameFile(tmp_path, path);
+    }
+    if (!status.ok()) {
+      env->DeleteFile(tmp_path).IgnoreError();
+    }
+    return status;
+  }
+
+  // Sets the "flat" engine of "forest". The engine uses the compiled forest in
+  // "model_path" (see "FlatForest::GenerateCompiledSource"), if it exists and
+  // matches the forest.
+  tf::Status CreateFlatForestEngine(std::unique_ptr<FlatForest> forest,
+                                    const absl::string_view model_path,
+                                    const ModelLoadOptions& options) {
+    if (options.use_huge_pages) {
+      TF_RETURN_IF_ERROR(forest->MoveToHugePages());
+    }
+    auto shared_forest = SharedFlatForests::Global()->Intern(std::move(forest));
+
+    // Use the compiled forest of the model, if available.
+    const std::string library_path =
+        tf::io::JoinPath(model_path, kCompiledFlatForestFilename);
+    if (tf::Env::Default()->FileExists(library_path).ok()) {
+      std::unique_ptr<CompiledFlatForestInferenceEngine> compiled_engine;
+      const auto status = CompiledFlatForestInferenceEngine::Create(
+          shared_forest, library_path, &compiled_engine);
+      if (status.ok()) {
+        LOG(INFO) << "Use compiled flat forest engine";
+        inference_engine_ = std::move(compiled_engine);
+        return tf::Status::OK();
+      }
+      LOG(WARNING) << "Cannot use the compiled forest " << library_path
+                   << ": " << status << ". Using the flat forest engine.";
+    }
+
+    auto engine = FlatForestInferenceEngine::FromSharedForest(shared_forest);
+    LOG(INFO) << "Use flat forest engine"
+              << (engine->uses_simd_traversal() ? " with SIMD traversal" : "");
+    inference_engine_ = std::move(engine);
+    return tf::Status::OK();
+  }
+
+  // Checks that two models of a model bank can share the same input tensors and
+  // output representation i.e. they have the same task, the same input
+  // features (with the same categorical dictionaries), and the same label
+  // dictionary.
+  static tf::Status CheckSameInputsAndLabel(const model::AbstractModel& a,
+                                            const model::AbstractModel& b) {
+    const auto same_column = [&](const int col_a, const int col_b) {
+      const auto& spec_a = a.data_spec().columns(col_a);
+      const auto& spec_b = b.data_spec().columns(col_b);
+      if (spec_a.name() != spec_b.name() || spec_a.type() != spec_b.type()) {
+        return false;
+      }
+      if (!spec_a.has_categorical()) {
+        return true;
+      }
+      const auto& cat_a = spec_a.categorical();
+      const auto& cat_b = spec_b.categorical();
+      if (cat_a.number_of_unique_values() != cat_b.number_of_unique_values() ||
+          cat_a.is_already_integerized() != cat_b.is_already_integerized() ||
+          cat_a.items_size() != cat_b.items_size()) {
+        return false;
+      }
+      for (const auto& item : cat_a.items()) {
+        const auto it = cat_b.items().find(item.first);
+        if (it == cat_b.items().end() ||
+            it->second.index() != item.second.index()) {
+          return false;
+        }
+      }
+      return true;
+    };
+
+    if (a.task() != b.task() ||
+        a.input_features().size() != b.input_features().size() ||
+        !same_column(a.label_col_idx(), b.label_col_idx())) {
+      return tf::errors::InvalidArgument(
+          "The models of a model bank should have the same task and label.");
+    }
+    for (int feature_idx = 0; feature_idx < a.input_features().size();
+         feature_idx++) {
+      if (a.input_features()[feature_idx] != b.input_features()[feature_idx] ||
+          !same_column(a.input_features()[feature_idx],
+                       b.input_features()[feature_idx])) {
+        return tf::errors::InvalidArgument(
+            "The models of a model bank should have the same input features.");
+      }
+    }
+    return tf::Status::OK();
+  }
+
+  // Fingerprint of the content of the model in "model_path", i.e. of the name
+  // and content of its files, other than the flat forest and compiled forest
+  // files derived from it. Also covers the version of the flat forest files,
+  // so a new format does not open the files of the previous one.
+  //
+  // The files are only read on the first call for a model directory in the
+  // process. The fingerprint is then reused as long as the names, sizes and
+  // modification times of the files are unchanged.
+  static tf::Status ModelContentFingerprint(const absl::string_view model_path,
+                                            tf::Fprint128* fingerprint) {
+    // Up to this many model directories are remembered. Beyond, the
+    // fingerprints are forgotten and computed again.
+    constexpr size_t kMaxNumCachedFingerprints = 1024;
+    static auto* mutex = new tf::mutex();
+    // Signature of the files and fingerprint of the content, by model path.
+    static auto* cached_fingerprints =
+        new std::unordered_map<std::string,
+                               std::pair<std::string, tf::Fprint128>>();
+
+    auto* env = tf::Env::Default();
+    const std::string path(model_path);
+    std::vector<std::string> filenames;
+    TF_RETURN_IF_ERROR(env->GetChildren(path, &filenames));
+    std::sort(filenames.begin(), filenames.end());
+    std::vector<std::string> content_filenames;
+    std::string signature;
+    for (const auto& filename : filenames) {
+      if (filename == kFlatForestFilename ||
+          filename == kCompiledFlatForestFilename ||
+          absl::StartsWith(filename, absl::StrCat(kFlatForestFilename, "."))) {
+        continue;
+      }
+      tf::FileStatistics stat;
+      TF_RETURN_IF_ERROR(env->Stat(tf::io::JoinPath(path, filename), &stat));
+      if (stat.is_directory) {
+        continue;
+      }
+      absl::StrAppend(&signature, filename, " ", stat.length, " ",
+                      stat.mtime_nsec, "\n");
+      content_filenames.push_back(filename);
+    }
+    {
+      tf::mutex_lock l(*mutex);
+      const auto it = cached_fingerprints->find(path);
+      if (it != cached_fingerprints->end() && it->second.first == signature) {
+        *fingerprint = it->second.second;
+        return tf::Status::OK();
+      }
+    }
+
+    *fingerprint = tf::Fingerprint128(
+        absl::StrCat("flat forest version ", kFlatForestFileVersion));
+    std::string content;
+    for (const auto& filename : content_filenames) {
+      TF_RETURN_IF_ERROR(tf::ReadFileToString(
+          env, tf::io::JoinPath(path, filename), &content));
+      *fingerprint =
+          tf::FingerprintCat128(*fingerprint, tf::Fingerprint128(filename));
+      *fingerprint =
+          tf::FingerprintCat128(*fingerprint, tf::Fingerprint128(content));
+    }
+    tf::mutex_lock l(*mutex);
+    if (cached_fingerprints->size() >= kMaxNumCachedFingerprints) {
+      cached_fingerprints->clear();
+    }
+    (*cached_fingerprints)[path] = {std::move(signature), *fingerprint};
+    return tf::Status::OK();
+  }
+
+  // Path of the flat forest file of the model. In "flat_forest_cache_dir",
+  // named after the content of the model (see "ModelContentFingerprint"), if
+  // set. Otherwise, in the model directory. The tree shards, and the forests
+  // with sparse leaves, have their own files.
+  //
+  // If set, "content_fingerprint" is the fingerprint the file is named after
+  // in the cache, or zero.
+  static tf::Status GetFlatForestPath(
+      const absl::string_view model_path, const ModelLoadOptions& options,
+      std::string* path, tf::Fprint128* content_fingerprint = nullptr) {
+    const auto& tree_shard = options.tree_shard;
+    if (options.flat_forest_cache_dir.empty()) {
+      *path = tf::io::JoinPath(model_path, kFlatForestFilename);
+      if (tree_shard.num_shards > 1) {
+        absl::StrAppend(path, ".shard-", tree_shard.index, "-of-",
+                        tree_shard.num_shards);
+      }
+      if (options.rf_leaf_top_k > 0) {
+        absl::StrAppend(path, ".top-", options.rf_leaf_top_k);
+      }
+      if (content_fingerprint != nullptr) {
+        *content_fingerprint = {0, 0};
+      }
+      return tf::Status::OK();
+    }
+    tf::Fprint128 fingerprint;
+    TF_RETURN_IF_ERROR(ModelContentFingerprint(model_path, &fingerprint));
+    if (tree_shard.num_shards > 1) {
+      fingerprint = tf::FingerprintCat128(
+          tf::FingerprintCat128(fingerprint, tree_shard.index),
+          tree_shard.num_shards);
+    }
+    if (options.rf_leaf_top_k > 0) {
+      fingerprint = tf::FingerprintCat128(fingerprint, options.rf_leaf_top_k);
+    }
+    *path = tf::io::JoinPath(
+        options.flat_forest_cache_dir,
+        absl::StrCat(absl::Hex(fingerprint.high64, absl::kZeroPad16),
+                     absl::Hex(fingerprint.low64, absl::kZeroPad16),
+                     kFlatForestCacheExtension));
+    if (content_fingerprint != nullptr) {
+      *content_fingerprint = fingerprint;
+    }
+    return tf::Status::OK();
+  }
+
+  // Opens the flat forest file of the model (see "GetFlatForestPath"), or
+  // creates it from the Yggdrasil model if it does not exist yet, and sets the
+  // "inference_engine" engine ("flat" or "flat_mapped") of the forest.
+  //
+  // With "flat_forest_cache_dir", the file is shared by all the processes and
+  // hosts reading the same cache directory, and survives the restarts: only
+  // the first load of a model builds its forest. The files are written
+  // atomically (see "FlatForest::Save"), so concurrent loads are safe. A
+  // cached file records the fingerprint of the model it was built from, and is
+  // only used for a model with the same fingerprint.
+  tf::Status LoadFlatForestFromDisk(const absl::string_view model_path,
+                                    const std::string& inference_engine,
+                                    const ModelLoadOptions& options) {
+    auto* env = tf::Env::Default();
+    std::string flat_forest_path;
+    tf::Fprint128 content_fingerprint;
+    TF_RETURN_IF_ERROR(GetFlatForestPath(model_path, options,
+                                         &flat_forest_path,
+                                         &content_fingerprint));
+    if (!options.flat_forest_cache_dir.empty()) {
+      const auto status =
+          env->RecursivelyCreateDir(options.flat_forest_cache_dir);
+      if (!status.ok() && status.code() != tf::error::ALREADY_EXISTS) {
+        LOG(WARNING) << "Cannot create the flat forest cache directory "
+                     << options.flat_forest_cache_dir << ": " << status;
+      }
+    }
+    // Note: The file is locked before being opened, so that it is not deleted
+    // in between by another process.
+    std::unique_ptr<FlatForestFileLock> file_lock;
+    const bool lock_file = options.release_unused_flat_forests &&
+                           !options.flat_forest_cache_dir.empty() &&
+                           inference_engine == kInferenceEngineFlatMapped;
+    if (lock_file) {
+      FlatForestFileLock::Acquire(flat_forest_path, &file_lock).IgnoreError();
+    }
+    std::unique_ptr<FlatForest> forest;
+    FlatForest::Metadata metadata;
+
+    if (file_lock) {
+      VLOG(1) << "Opening flat forest " << flat_forest_path;
+      TF_RETURN_IF_ERROR(
+          FlatForest::Map(file_lock->locked_path(), &forest, &metadata));
+    } else if (env->FileExists(flat_forest_path).ok()) {
+      VLOG(1) << "Opening flat forest " << flat_forest_path;
+      TF_RETURN_IF_ERROR(FlatForest::Map(flat_forest_path, &forest, &metadata));
+    }
+    // Note: Without "flat_forest_cache_dir", the forest is kept in memory:
+    // the model directory belongs to the model (e.g. a read-only or synced
+    // export), and is not written.
+    bool save_forest = !options.flat_forest_cache_dir.empty();
+    if (forest && save_forest &&
+        !(metadata.content_fingerprint == content_fingerprint)) {
+      LOG(WARNING) << "The cached flat forest " << flat_forest_path
+                   << " was built from another model than " << model_path
+                   << ". The flat forest is built and kept in memory.";
+      forest.reset();
+      file_lock.reset();
+      metadata = FlatForest::Metadata();
+      save_forest = false;
+    }
+
+    if (!forest) {
+      std::unique_ptr<model::AbstractModel> model;
+      TF_RETURN_IF_ERROR(utils::FromUtilStatus(LoadModel(model_path, &model)));
+      metadata.task = model->task();
+      metadata.label_col_idx = model->label_col_idx();
+      metadata.input_features = model->input_features();
+      metadata.data_spec = model->data_spec();
+      metadata.content_fingerprint = content_fingerprint;
+      FeatureIndex feature_index;
+      TF_RETURN_IF_ERROR(feature_index.Initialize(metadata.input_features,
+                                                  metadata.data_spec));
+      auto forest_or = FlatForest::Create(*model, feature_index,
+                                          options.tree_shard,
+                                          options.rf_leaf_top_k);
+      TF_RETURN_IF_ERROR(utils::FromUtilStatus(forest_or.status()));
+      forest = std::move(forest_or).value();
+      model.reset();
+
+      if (save_forest) {
+        // Re-open the saved forest so its memory is backed by the file.
+        FlatForest::Metadata mapped_metadata;
+        auto status = forest->Save(metadata, flat_forest_path);
+        if (status.ok() && lock_file) {
+          const auto lock_status =
+              FlatForestFileLock::Acquire(flat_forest_path, &file_lock);
+          if (!lock_status.ok()) {
+            LOG(WARNING) << "The unused flat forest " << flat_forest_path
+                         << " will not be released: " << lock_status;
+          }
+        }
+        if (status.ok()) {
+          status = FlatForest::Map(
+              file_lock ? file_lock->locked_path() : flat_forest_path,
+              &forest, &mapped_metadata);
+        }
+        if (!status.ok()) {
+          LOG(WARNING) << "Cannot save and open the flat forest "
+                       << flat_forest_path << ": " << status
+                       << ". The flat forest is kept in memory.";
+        }
+      }
+    }
+    task_ = metadata.task;
+    TF_RETURN_IF_ERROR(
+        feature_index_.Initialize(metadata.input_features, metadata.data_spec));
+    TF_RETURN_IF_ERROR(categorical_dictionaries_.Initialize(
+        feature_index_, metadata.data_spec));
+    TF_RETURN_IF_ERROR(ComputeDenseColRepresentation(metadata.data_spec,
+                                                     metadata.label_col_idx));
+    if (inference_engine == kInferenceEngineFlat) {
+      return CreateFlatForestEngine(std::move(forest), model_path, options);
+    }
+
+    if (options.use_huge_pages) {
+      TF_RETURN_IF_ERROR(forest->MoveToHugePages());
+    } else if (options.prefault_model_data) {
+      forest->Prefault();
+    }
+    inference_engine_ = FlatForestInferenceEngine::Create(std::move(forest));
+    flat_forest_file_lock_ = std::move(file_lock);
+    LOG(INFO) << "Use memory mapped flat forest engine";
+    return tf::Status::OK();
+  }
 
   // Pre-compute the values returned in the "dense_col_representation" output of
   // the inference OPs.
   tf::Status ComputeDenseColRepresentation(
-      const model::AbstractModel* const model) {
+      const dataset::proto::DataSpecification& data_spec,
+      const int label_col_idx) {
     if (task_ == Task::CLASSIFICATION) {
-      const auto& label_spec =
-          model->data_spec().columns(model->label_col_idx());
+      const auto& label_spec = data_spec.columns(label_col_idx);
       // Note: We don't report the "OOV" class value.
       const int num_classes =
           label_spec.categorical().number_of_unique_values() - 1;
-      dense_col_representation_.resize(num_classes);
+      dense_col_representation_ =
+          Tensor(tf::DT_STRING, TensorShape({num_classes}));
+      auto reps = dense_col_representation_.flat<tf::tstring>();
       for (int class_idx = 0; class_idx < num_classes; class_idx++) {
-        dense_col_representation_[class_idx] =
+        reps(class_idx) =
             dataset::CategoricalIdxToRepresentation(label_spec, class_idx + 1);
       }
     } else {
-      dense_col_representation_.resize(1);
+      dense_col_representation_ = Tensor(tf::DT_STRING, TensorShape({1}));
     }
     return tf::Status::OK();
   }
 
+  // Lock on the flat forest file mapped by "inference_engine_", if requested
+  // (see "ModelLoadOptions::release_unused_flat_forests"). Declared before the
+  // engine, so that the file is unmapped before the lock is released.
+  std::unique_ptr<FlatForestFileLock> flat_forest_file_lock_;
+
   // The engine responsible to run the model.
   std::unique_ptr<AbstractInferenceEngine> inference_engine_;
 
+  // Path of the model whose autotuned engine is recorded in the
+  // "autotuned_inference_engine" metric, if any.
+  std::string autotuned_model_path_;
+
   // Index of the input features and the input tensors.
   FeatureIndex feature_index_;
 
+  // Dictionaries of the categorical features of "feature_index_".
+  CategoricalDictionaries categorical_dictionaries_;
+
+  // Cache of the predictions of the model, if enabled when it was loaded.
+  std::unique_ptr<PredictionCache> prediction_cache_;
+
+  // Threads of the inference of the model, if enabled when it was loaded.
+  std::unique_ptr<tf::thread::ThreadPool> inference_threads_;
+
   // Task solved by the model.
   Task task_;
 
   // Pre-computed values to send in the "dense_col_representation" output
-  // tensor.
-  std::vector<tf::tstring> dense_col_representation_;
+  // tensor. The tensor buffer is shared (i.e. not copied) by all the inference
+  // calls.
+  Tensor dense_col_representation_;
 };
 
 tf::Status GetModel(OpKernelContext* ctx,
                     YggdrasilModelResource** model_resource) {
-  LOG(INFO) << "----- Get model";
   const Tensor* handle_tensor;
   TF_RETURN_IF_ERROR(ctx->input(kInputModelHandle, &handle_tensor));
   const tf::ResourceHandle& handle =
@@ -873,16 +6272,36 @@ tf::Status GetModelPath(OpKernelContext* ctx, std::string* model_path) {
   return tf::Status::OK();
 }
 
+// Runs "load" outside of the TF executor threads and calls "done" when the
+// loading is completed.
+//
+// Loading a model (reading the shards, building the feature index and the
+// inference engine) can take minutes for large models on remote file systems.
+// Running it on a dedicated thread avoids blocking one of the inter-op threads
+// used by the other ops of the session during all this time.
+void ScheduleModelLoading(OpKernelContext* ctx,
+                          std::function<tf::Status()> load,
+                          AsyncOpKernel::DoneCallback done) {
+  ctx->env()->SchedClosure(
+      [ctx, load = std::move(load), done = std::move(done)]() {
+        ctx->SetStatus(load());
+        done();
+      });
+}
+
 // Load the model from disk into a resource specified as resource name.
-class SimpleMLLoadModelFromPath : public OpKernel {
+class SimpleMLLoadModelFromPath : public AsyncOpKernel {
  public:
   explicit SimpleMLLoadModelFromPath(OpKernelConstruction* ctx)
-      : OpKernel(ctx) {
+      : AsyncOpKernel(ctx) {
     OP_REQUIRES_OK(ctx,
                    ctx->GetAttr(kAttributeModelIdentifier, &model_identifier_));
+    OP_REQUIRES_OK(ctx,
+                   ctx->GetAttr(kAttributeInferenceEngine, &inference_engine_));
+    OP_REQUIRES_OK(ctx, load_options_.ReadAttributes(ctx));
   }
 
-  void Compute(OpKernelContext* ctx) override {
+  void ComputeAsync(OpKernelContext* ctx, DoneCallback done) override {
     {
       // Skip loading the model if a model with the target identifier is already
       // loaded in the session's resource set.
@@ -892,57 +6311,364 @@ class SimpleMLLoadModelFromPath : public OpKernel {
               .ok()) {
         maybe_resource->Unref();
         LOG(WARNING) << "Model " << model_identifier_ << " already loaded";
+        done();
+        return;
+      }
+    }
+
+    std::string model_path;
+    OP_REQUIRES_OK_ASYNC(ctx, GetModelPath(ctx, &model_path), done);
+    ScheduleModelLoading(
+        ctx, [this, ctx, model_path]() { return Load(ctx, model_path); },
+        std::move(done));
+  }
+
+ private:
+  tf::Status Load(OpKernelContext* ctx, const std::string& model_path) const {
+    auto* model_container = new YggdrasilModelResource();
+    const auto load_status = model_container->LoadModelFromDisk(
+        model_path, inference_engine_, load_options_);
+    if (!load_status.ok()) {
+      model_container->Unref();  // Call delete on "model_container".
+      return load_status;
+    }
+
+    // Note: "Create" takes ownership of "model_container".
+    return ctx->resource_manager()->Create(kModelContainer, model_identifier_,
+                                           model_container);
+  }
+
+  // Identifier of the model. Copy of the "model_identifier" attribute.
+  std::string model_identifier_;
+
+  // Copy of the "inference_engine" attribute.
+  std::string inference_engine_;
+
+  // Copy of the model loading option attributes.
+  ModelLoadOptions load_options_;
+};
+
+REGISTER_KERNEL_BUILDER(
+    Name("SimpleMLLoadModelFromPath").Device(tf::DEVICE_CPU),
+    SimpleMLLoadModelFromPath);
+
+// Load several models from disk into a model bank resource specified as
+// resource name.
+class SimpleMLLoadModelBankFromPaths : public AsyncOpKernel {
+ public:
+  explicit SimpleMLLoadModelBankFromPaths(OpKernelConstruction* ctx)
+      : AsyncOpKernel(ctx) {
+    OP_REQUIRES_OK(ctx,
+                   ctx->GetAttr(kAttributeModelIdentifier, &model_identifier_));
+  }
+
+  void ComputeAsync(OpKernelContext* ctx, DoneCallback done) override {
+    {
+      // Skip loading the bank if a model with the target identifier is already
+      // loaded in the session's resource set.
+      YggdrasilModelResource* maybe_resource;
+      if (ctx->resource_manager()
+              ->Lookup(kModelContainer, model_identifier_, &maybe_resource)
+              .ok()) {
+        maybe_resource->Unref();
+        LOG(WARNING) << "Model " << model_identifier_ << " already loaded";
+        done();
         return;
       }
     }
 
-    std::string model_path;
-    OP_REQUIRES_OK(ctx, GetModelPath(ctx, &model_path));
-    LOG(INFO) << "-----SimpleMLLoadModelFromPath";
-    auto* model_container = new YggdrasilModelResource();
-    const auto load_status = model_container->LoadModelFromDisk(model_path);
-    if (!load_status.ok()) {
-      model_container->Unref();  // Call delete on "model_container".
-      OP_REQUIRES_OK(ctx, load_status);
+    const Tensor* model_paths_tensor;
+    OP_REQUIRES_OK_ASYNC(ctx, ctx->input(kInputPaths, &model_paths_tensor),
+                         done);
+    std::vector<std::string> model_paths;
+    const auto model_paths_values = model_paths_tensor->flat<tf::tstring>();
+    for (int path_idx = 0; path_idx < model_paths_values.size(); path_idx++) {
+      model_paths.push_back(model_paths_values(path_idx));
+    }
+    ScheduleModelLoading(
+        ctx, [this, ctx, model_paths]() { return Load(ctx, model_paths); },
+        std::move(done));
+  }
+
+ private:
+  tf::Status Load(OpKernelContext* ctx,
+                  const std::vector<std::string>& model_paths) const {
+    auto* model_container = new YggdrasilModelResource();
+    const auto load_status =
+        model_container->LoadModelBankFromDisk(model_paths);
+    if (!load_status.ok()) {
+      model_container->Unref();  // Call delete on "model_container".
+      return load_status;
+    }
+
+    // Note: "Create" takes ownership of "model_container".
+    return ctx->resource_manager()->Create(kModelContainer, model_identifier_,
+                                           model_container);
+  }
+
+  // Identifier of the model bank. Copy of the "model_identifier" attribute.
+  std::string model_identifier_;
+};
+
+REGISTER_KERNEL_BUILDER(
+    Name("SimpleMLLoadModelBankFromPaths").Device(tf::DEVICE_CPU),
+    SimpleMLLoadModelBankFromPaths);
+
+// Load the model from disk into a resource specified as a resource handle.
+class SimpleMLLoadModelFromPathWithHandle : public AsyncOpKernel {
+ public:
+  explicit SimpleMLLoadModelFromPathWithHandle(OpKernelConstruction* ctx)
+      : AsyncOpKernel(ctx) {
+    OP_REQUIRES_OK(ctx,
+                   ctx->GetAttr(kAttributeInferenceEngine, &inference_engine_));
+    OP_REQUIRES_OK(ctx, load_options_.ReadAttributes(ctx));
+  }
+
+  void ComputeAsync(OpKernelContext* ctx, DoneCallback done) override {
+    std::string model_path;
+    OP_REQUIRES_OK_ASYNC(ctx, GetModelPath(ctx, &model_path), done);
+
+    YggdrasilModelResource* model_container;
+    OP_REQUIRES_OK_ASYNC(ctx, GetModel(ctx, &model_container), done);
+
+    ScheduleModelLoading(
+        ctx,
+        [this, model_container, model_path]() {
+          tf::core::ScopedUnref unref_me(model_container);
+          VLOG(1) << "Loading model from path " << model_path;
+          return model_container->LoadModelFromDisk(
+              model_path, inference_engine_, load_options_);
+        },
+        std::move(done));
+  }
+
+ private:
+  // Copy of the "inference_engine" attribute.
+  std::string inference_engine_;
+
+  // Copy of the model loading option attributes.
+  ModelLoadOptions load_options_;
+};
+
+REGISTER_KERNEL_BUILDER(
+    Name("SimpleMLLoadModelFromPathWithHandle").Device(tf::DEVICE_CPU),
+    SimpleMLLoadModelFromPathWithHandle);
+
+// Coalesces concurrent calls of an inference op into a single evaluation of
+// the model.
+//
+// The first call of a batch (the "leader") waits for other calls for up to
+// "batch_timeout_micros", or until the batch contains at least
+// "max_batch_size" examples. The leader then evaluates the merged inputs of
+// all the calls of the batch, and hands its part of the predictions to each
+// of the other calls (which wait in the meantime).
+class InferenceCallBatcher {
+ public:
+  // Number of input feature tensors, in the order of the op inputs (see
+  // "InputTensors").
+  static constexpr int kNumInputs = 6;
+  using Inputs = std::array<const Tensor*, kNumInputs>;
+
+  // A call to the inference op.
+  struct Call {
+    Inputs inputs;
+    int batch_size;
+
+    // Set before "done" is notified.
+    Tensor predictions;
+    tf::Status status;
+    tf::Notification done;
+  };
+
+  // Evaluates the model on "batch_size" examples, and sets "predictions" to a
+  // [batch_size, dense_output_dim] tensor.
+  using RunBatch = std::function<tf::Status(
+      const Inputs& inputs, int batch_size, Tensor* predictions)>;
+
+  InferenceCallBatcher(const int max_batch_size,
+                       const int64_t batch_timeout_micros)
+      : max_batch_size_(max_batch_size),
+        batch_timeout_micros_(batch_timeout_micros) {}
+
+  int max_batch_size() const { return max_batch_size_; }
+
+  // Evaluates "call", possibly merged with concurrent calls. "run_batch" is
+  // only used if "call" leads its batch. Returns once "call->predictions" and
+  // "call->status" are set.
+  void Run(Call* call, const RunBatch& run_batch) {
+    std::vector<Call*> calls;
+    {
+      tf::mutex_lock lock(mutex_);
+      pending_calls_.push_back(call);
+      pending_batch_size_ += call->batch_size;
+      if (has_leader_) {
+        if (pending_batch_size_ >= max_batch_size_) {
+          batch_full_.notify_one();
+        }
+      } else {
+        has_leader_ = true;
+        const tf::uint64 deadline_micros =
+            tf::Env::Default()->NowMicros() + batch_timeout_micros_;
+        while (pending_batch_size_ < max_batch_size_) {
+          const tf::uint64 now_micros = tf::Env::Default()->NowMicros();
+          if (now_micros >= deadline_micros) {
+            break;
+          }
+          batch_full_.wait_for(
+              lock, std::chrono::microseconds(deadline_micros - now_micros));
+        }
+        calls.swap(pending_calls_);
+        pending_batch_size_ = 0;
+        has_leader_ = false;
+      }
+    }
+
+    if (calls.empty()) {
+      // Another call leads the batch.
+      call->done.WaitForNotification();
+      return;
+    }
+
+    int batch_size = 0;
+    for (const Call* batched_call : calls) {
+      batch_size += batched_call->batch_size;
+    }
+
+    Tensor predictions;
+    tf::Status status;
+    if (calls.size() == 1) {
+      status = run_batch(call->inputs, batch_size, &predictions);
+    } else {
+      std::array<Tensor, kNumInputs> merged_inputs;
+      status = MergeInputs(calls, batch_size, &merged_inputs);
+      if (status.ok()) {
+        Inputs merged_input_ptrs;
+        for (int input_idx = 0; input_idx < kNumInputs; input_idx++) {
+          merged_input_ptrs[input_idx] = &merged_inputs[input_idx];
+        }
+        status = run_batch(merged_input_ptrs, batch_size, &predictions);
+      }
+    }
+
+    int begin = 0;
+    for (Call* batched_call : calls) {
+      batched_call->status = status;
+      if (status.ok()) {
+        batched_call->predictions =
+            predictions.Slice(begin, begin + batched_call->batch_size);
+        // The slices of the calls after the first one generally do not start
+        // on an aligned address, which the consumers of the op outputs (e.g.
+        // Eigen) expect.
+        if (!batched_call->predictions.IsAligned()) {
+          batched_call->predictions =
+              tf::tensor::DeepCopy(batched_call->predictions);
+        }
+      }
+      begin += batched_call->batch_size;
+      if (batched_call != call) {
+        batched_call->done.Notify();
+      }
     }
-
-    // Note: "Create" takes ownership of "model_container".
-    OP_REQUIRES_OK(
-        ctx, ctx->resource_manager()->Create(kModelContainer, model_identifier_,
-                                             model_container));
   }
 
  private:
-  // Identifier of the model. Copy of the "model_identifier" attribute.
-  std::string model_identifier_;
-};
-
-REGISTER_KERNEL_BUILDER(
-    Name("SimpleMLLoadModelFromPath").Device(tf::DEVICE_CPU),
-    SimpleMLLoadModelFromPath);
-
-// Load the model from disk into a resource specified as a resource handle.
-class SimpleMLLoadModelFromPathWithHandle : public OpKernel {
- public:
-  explicit SimpleMLLoadModelFromPathWithHandle(OpKernelConstruction* ctx)
-      : OpKernel(ctx) {}
-
-  void Compute(OpKernelContext* ctx) override {
-    std::string model_path;
-    OP_REQUIRES_OK(ctx, GetModelPath(ctx, &model_path));
+  // Merges the input feature tensors of "calls", in order.
+  static tf::Status MergeInputs(const std::vector<Call*>& calls,
+                                const int batch_size,
+                                std::array<Tensor, kNumInputs>* merged) {
+    // Dense features.
+    TF_RETURN_IF_ERROR(ConcatRows<float>(calls, 0, &(*merged)[0]));
+    TF_RETURN_IF_ERROR(ConcatRows<float>(calls, 1, &(*merged)[1]));
+    TF_RETURN_IF_ERROR(ConcatRows<int32_t>(calls, 2, &(*merged)[2]));
+    for (int input_idx = 0; input_idx < 3; input_idx++) {
+      const int64_t num_rows = (*merged)[input_idx].dim_size(0);
+      if (num_rows != 0 && num_rows != batch_size) {
+        return tf::Status(
+            tf::error::INVALID_ARGUMENT,
+            "Batched calls must all use, or all not use, each input.");
+      }
+    }
+    // Categorical-set features.
+    TF_RETURN_IF_ERROR(ConcatRows<int32_t>(calls, 3, &(*merged)[3]));
+    TF_RETURN_IF_ERROR(MergeRowSplits(calls, 4, &(*merged)[4]));
+    TF_RETURN_IF_ERROR(MergeRowSplits(calls, 5, &(*merged)[5]));
+    return tf::Status::OK();
+  }
 
-    YggdrasilModelResource* model_container;
-    OP_REQUIRES_OK(ctx, GetModel(ctx, &model_container));
-    tf::core::ScopedUnref unref_me(model_container);
+  // Concatenates the "input_idx"-th input of "calls" along the first
+  // dimension.
+  template <typename T>
+  static tf::Status ConcatRows(const std::vector<Call*>& calls,
+                               const int input_idx, Tensor* merged) {
+    TensorShape shape = calls.front()->inputs[input_idx]->shape();
+    int64_t num_rows = 0;
+    for (const Call* call : calls) {
+      const Tensor& input = *call->inputs[input_idx];
+      if (input.dims() != shape.dims()) {
+        return tf::Status(tf::error::INVALID_ARGUMENT,
+                          "Inconsistent input ranks in batched calls.");
+      }
+      for (int dim_idx = 1; dim_idx < shape.dims(); dim_idx++) {
+        if (input.dim_size(dim_idx) != shape.dim_size(dim_idx)) {
+          return tf::Status(tf::error::INVALID_ARGUMENT,
+                            "Inconsistent input shapes in batched calls.");
+        }
+      }
+      num_rows += input.dim_size(0);
+    }
+    shape.set_dim(0, num_rows);
+    *merged = Tensor(tf::DataTypeToEnum<T>::v(), shape);
+    T* dst = merged->flat<T>().data();
+    for (const Call* call : calls) {
+      const auto src = call->inputs[input_idx]->flat<T>();
+      std::copy(src.data(), src.data() + src.size(), dst);
+      dst += src.size();
+    }
+    return tf::Status::OK();
+  }
 
-    LOG(INFO) << "Loading model from path";
-    OP_REQUIRES_OK(ctx, model_container->LoadModelFromDisk(model_path));
+  // Merges the "input_idx"-th input of "calls", a row split tensor. The row
+  // splits of each call are shifted by the number of items of the previous
+  // calls.
+  static tf::Status MergeRowSplits(const std::vector<Call*>& calls,
+                                   const int input_idx, Tensor* merged) {
+    int64_t num_splits = 1;
+    for (const Call* call : calls) {
+      const auto splits = call->inputs[input_idx]->vec<int64_t>();
+      if (splits.size() == 0 || splits(0) != 0) {
+        return tf::Status(tf::error::INVALID_ARGUMENT,
+                          "Row splits of batched calls must start with 0.");
+      }
+      num_splits += splits.size() - 1;
+    }
+    *merged = Tensor(tf::DT_INT64, TensorShape({num_splits}));
+    auto dst = merged->vec<int64_t>();
+    dst(0) = 0;
+    int64_t dst_idx = 1;
+    int64_t offset = 0;
+    for (const Call* call : calls) {
+      const auto splits = call->inputs[input_idx]->vec<int64_t>();
+      for (int64_t split_idx = 1; split_idx < splits.size(); split_idx++) {
+        dst(dst_idx++) = offset + splits(split_idx);
+      }
+      offset += splits(splits.size() - 1);
+    }
+    return tf::Status::OK();
   }
-};
 
-REGISTER_KERNEL_BUILDER(
-    Name("SimpleMLLoadModelFromPathWithHandle").Device(tf::DEVICE_CPU),
-    SimpleMLLoadModelFromPathWithHandle);
+  const int max_batch_size_;
+  const int64_t batch_timeout_micros_;
+
+  tf::mutex mutex_;
+  // Signaled when the pending calls contain at least "max_batch_size_"
+  // examples.
+  tf::condition_variable batch_full_;
+  // Calls waiting for the leader of their batch, and their number of examples.
+  std::vector<Call*> pending_calls_ TF_GUARDED_BY(mutex_);
+  int pending_batch_size_ TF_GUARDED_BY(mutex_) = 0;
+  // True while a leader collects "pending_calls_".
+  bool has_leader_ TF_GUARDED_BY(mutex_) = false;
+};
 
 // Runs the inference of the model on packed tensors.
 // The input model is specified as a resource string name.
@@ -958,6 +6684,38 @@ class SimpleMLInferenceOp : public OpKernel {
 
     OP_REQUIRES_OK(ctx,
                    ctx->GetAttr(kAttributeDenseOutputDim, &dense_output_dim_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr(kAttributeTraceStages, &trace_stages_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr(kAttributeMaxNumInferenceShards,
+                                     &inference_options_.max_num_shards));
+    // Note: The partial evaluation attributes are not defined on the model
+    // bank inference op.
+    if (ctx->HasAttr(kAttributeMaxNumTrees)) {
+      OP_REQUIRES_OK(ctx, ctx->GetAttr(kAttributeMaxNumTrees,
+                                       &inference_options_.max_num_trees));
+    }
+    if (ctx->HasAttr(kAttributeEarlyExitMargin)) {
+      OP_REQUIRES_OK(ctx, ctx->GetAttr(kAttributeEarlyExitMargin,
+                                       &inference_options_.early_exit_margin));
+    }
+    // Note: The batching attributes are not defined on the model bank
+    // inference op.
+    if (ctx->HasAttr(kAttributeMaxBatchSize)) {
+      int max_batch_size;
+      tf::int64 batch_timeout_micros;
+      OP_REQUIRES_OK(ctx,
+                     ctx->GetAttr(kAttributeMaxBatchSize, &max_batch_size));
+      OP_REQUIRES_OK(ctx, ctx->GetAttr(kAttributeBatchTimeoutMicros,
+                                       &batch_timeout_micros));
+      if (max_batch_size > 0) {
+        call_batcher_ = absl::make_unique<InferenceCallBatcher>(
+            max_batch_size, batch_timeout_micros);
+      }
+    }
+    trace_label_ = model_identifier_.empty() ? name() : model_identifier_;
+    prediction_cache_hits_ =
+        prediction_cache_lookups->GetCell(trace_label_, "hit");
+    prediction_cache_misses_ =
+        prediction_cache_lookups->GetCell(trace_label_, "miss");
   }
 
   ~SimpleMLInferenceOp() override {
@@ -967,51 +6725,129 @@ class SimpleMLInferenceOp : public OpKernel {
     }
   }
   void Compute(OpKernelContext* ctx) override {
-    // Make sure the model is available.
-    LOG(INFO) << "-----InferneceOP Compute";
-    if (!model_container_) {
-      OP_REQUIRES_OK(ctx, LinkModelResource(ctx));
-    }
+    // Make sure the model is available, and check-out an engine cache.
+    std::unique_ptr<AbstractInferenceEngine::AbstractCache> engine_cache;
+    OP_REQUIRES_OK(ctx, AcquireEngineCache(ctx, &engine_cache));
+    StageTimer* stage_timer = engine_cache->stage_timer();
+    stage_timer->Reset(trace_stages_ || VLOG_IS_ON(2));
 
     // Collect the input signals.
-    LOG(INFO) << "CALL 971" ; 
+    stage_timer->Start(InferenceStage::kLinkInputs);
+    FeatureBanks banks;
+    OP_REQUIRES_OK(ctx, LinkFeatureBanks(ctx, &banks));
     tf::Status io_status;
-    const auto input_tensors =
-        LinkInputTensors(ctx, model_container_->feature_index(), &io_status);
+    auto input_tensors = LinkInputTensors(
+        ctx, model_container_->feature_index(), banks, &io_status);
     OP_REQUIRES_OK(ctx, io_status);
+    OP_REQUIRES_OK(ctx, LinkExtraInputTensors(ctx, &input_tensors));
 
-    // Allocate the output predictions memory.
-    LOG(INFO) << "CALL 977 prediction memory" ;
-    auto output_tensors =
-        LinkOutputTensors(ctx, input_tensors.batch_size, &io_status);
-    OP_REQUIRES_OK(ctx, io_status);
-
-    // Set the output representation.
-    const auto& reps = model_container_->dense_col_representation();
-    for (int rep_idx = 0; rep_idx < reps.size(); rep_idx++) {
-      output_tensors.dense_col_representation(rep_idx) = reps[rep_idx];
+    // Set the output representation. The output is only produced if it is
+    // consumed.
+    if (ctx->output_required(kOutputDenseColRepresentationIdx)) {
+      OP_REQUIRES_OK(ctx, SetDenseColRepresentation(ctx));
     }
 
     // Run the model.
-    LOG(INFO) << "Call line 988" ;
-    tf::mutex_lock lock_engine_mutex(engine_mutex_);
-    OP_REQUIRES_OK(ctx, model_container_->engine()->RunInference(
-                            input_tensors, model_container_->feature_index(),
-                            &output_tensors, engine_cache_.get()));
+    //
+    // Note: The engine is read-only and shared by all the concurrent calls.
+    // Only the cache is specific to this call.
+    InferenceOptions inference_options = inference_options_;
+    if (auto* inference_threads = model_container_->inference_threads()) {
+      // The batches are sharded on the threads of the model.
+      inference_options.thread_pool = inference_threads;
+      inference_options.max_num_shards = std::max(
+          inference_options.max_num_shards, inference_threads->NumThreads());
+    } else if (inference_options.max_num_shards > 1) {
+      inference_options.thread_pool =
+          ctx->device()->tensorflow_cpu_worker_threads()->workers;
+    }
+    tf::Status inference_status;
+    if (HasExtraOutputTensors()) {
+      // The extra outputs are only produced by a direct evaluation.
+      inference_status = RunInference(ctx, input_tensors, inference_options,
+                                      engine_cache.get());
+    } else if (model_container_->prediction_cache() != nullptr &&
+               input_tensors.model_ids == nullptr) {
+      // The cached examples are not evaluated, and the others are evaluated
+      // alone.
+      inference_status = RunCachedInference(
+          ctx, input_tensors, inference_options, engine_cache.get());
+    } else if (call_batcher_ != nullptr &&
+               input_tensors.model_ids == nullptr &&
+               input_tensors.batch_size > 0 &&
+               input_tensors.batch_size < call_batcher_->max_batch_size()) {
+      // The predictions are produced by the leader of the batched calls.
+      inference_status =
+          RunBatchedInference(ctx, input_tensors.batch_size, banks,
+                              inference_options, engine_cache.get());
+    } else {
+      inference_status = RunInference(ctx, input_tensors, inference_options,
+                                      engine_cache.get());
+    }
+    if (inference_status.ok()) {
+      inference_status =
+          ComputeExtraOutputs(ctx, input_tensors, inference_options);
+    }
+    stage_timer->Stop();
+    stage_timer->Export(trace_label_);
+    ReleaseEngineCache(std::move(engine_cache));
+    OP_REQUIRES_OK(ctx, inference_status);
   }
 
  protected:
+  // The numerical, boolean and categorical int feature banks of a call. The
+  // banks are either inputs of the op, or computed by the op in the
+  // "*_storage" tensors.
+  struct FeatureBanks {
+    const Tensor* numerical_features = nullptr;
+    const Tensor* boolean_features = nullptr;
+    const Tensor* categorical_int_features = nullptr;
+
+    Tensor numerical_features_storage;
+    Tensor boolean_features_storage;
+    Tensor categorical_int_features_storage;
+  };
+
+  // Links the model (if not already done), and checks-out an engine cache from
+  // the pool of free caches. A new cache is created if the pool is empty, i.e.
+  // the pool grows to the maximum number of concurrent calls to the op.
+  tf::Status AcquireEngineCache(
+      OpKernelContext* ctx,
+      std::unique_ptr<AbstractInferenceEngine::AbstractCache>* cache) {
+    {
+      tf::mutex_lock lock(engine_cache_mutex_);
+      if (!model_container_) {
+        TF_RETURN_IF_ERROR(LinkModelResource(ctx));
+      }
+      if (!free_engine_caches_.empty()) {
+        *cache = std::move(free_engine_caches_.back());
+        free_engine_caches_.pop_back();
+        return tf::Status::OK();
+      }
+    }
+    // Note: "model_container_" is never modified once set.
+    return CreateEngineCache(cache);
+  }
+
+  // Returns a cache checked-out with "AcquireEngineCache" to the pool.
+  void ReleaseEngineCache(
+      std::unique_ptr<AbstractInferenceEngine::AbstractCache> cache) {
+    tf::mutex_lock lock(engine_cache_mutex_);
+    free_engine_caches_.push_back(std::move(cache));
+  }
+
   // Creates a cache for the engine in model_container_.
-  tf::Status CreateEngineCache() {
-    LOG(INFO) << "-----Create Cache";
+  tf::Status CreateEngineCache(
+      std::unique_ptr<AbstractInferenceEngine::AbstractCache>* cache) {
     auto cache_or_status = model_container_->engine()->CreateCache();
     TF_RETURN_IF_ERROR(utils::FromUtilStatus(cache_or_status.status()));
-    engine_cache_ = std::move(cache_or_status).value();
+    *cache = std::move(cache_or_status).value();
     return tf::Status::OK();
   }
 
   // Links the model and set "model_container_" accordingly.
-  virtual tf::Status LinkModelResource(OpKernelContext* ctx) {
+  virtual tf::Status LinkModelResource(OpKernelContext* ctx)
+      TF_EXCLUSIVE_LOCKS_REQUIRED(engine_cache_mutex_) {
     const auto lookup_status = ctx->resource_manager()->Lookup(
         kModelContainer, model_identifier_, &model_container_);
     if (!lookup_status.ok()) {
@@ -1022,8 +6858,54 @@ class SimpleMLInferenceOp : public OpKernel {
                        "available for inference. This error is likely due to "
                        "the \"LoadModel*\" not having been run before."));
     }
+    return tf::Status::OK();
+  }
+
+  // Links the op specific inputs, other than the feature tensors, in
+  // "input_tensors".
+  virtual tf::Status LinkExtraInputTensors(OpKernelContext* ctx,
+                                           InputTensors* input_tensors) {
+    return tf::Status::OK();
+  }
+
+  // Tests if the op has outputs set by the engine along with the predictions
+  // (see "LinkExtraOutputTensors"). The calls of such ops are neither batched
+  // nor cached.
+  virtual bool HasExtraOutputTensors() const { return false; }
 
-    return CreateEngineCache();
+  // Allocates the op specific outputs set by the engine in "output_tensors".
+  virtual tf::Status LinkExtraOutputTensors(OpKernelContext* ctx,
+                                            const int batch_size,
+                                            OutputTensors* output_tensors) {
+    return tf::Status::OK();
+  }
+
+  // Computes the op specific outputs, other than the predictions, once the
+  // predictions are computed.
+  virtual tf::Status ComputeExtraOutputs(
+      OpKernelContext* ctx, const InputTensors& input_tensors,
+      const InferenceOptions& inference_options) {
+    return tf::Status::OK();
+  }
+
+  // Sets the feature banks of the call.
+  virtual tf::Status LinkFeatureBanks(OpKernelContext* ctx,
+                                      FeatureBanks* banks) {
+    TF_RETURN_IF_ERROR(
+        ctx->input(kInputNumericalFeatures, &banks->numerical_features));
+    TF_RETURN_IF_ERROR(
+        ctx->input(kInputBooleanFeatures, &banks->boolean_features));
+    return LinkCategoricalIntFeatures(ctx,
+                                      &banks->categorical_int_features_storage,
+                                      &banks->categorical_int_features);
+  }
+
+  // Sets "tensor" to the categorical int features of the call. The tensor is
+  // either an input, or computed by the op in "storage".
+  virtual tf::Status LinkCategoricalIntFeatures(OpKernelContext* ctx,
+                                                Tensor* storage,
+                                                const Tensor** tensor) {
+    return ctx->input(kInputCategoricalIntFeatures, tensor);
   }
 
   // Computes the batch size from the input feature tensors. Returns an error if
@@ -1033,7 +6915,6 @@ class SimpleMLInferenceOp : public OpKernel {
   // (unused) or equal to the batch size.
   tf::Status ComputeBatchSize(const InputTensors& input_tensors,
                               int* batch_size) {
-    LOG(INFO) << "-----Computing Batch Size";
     int max_size = 0;
     for (const int size :
          {input_tensors.numerical_features.dimension(0),
@@ -1060,12 +6941,10 @@ class SimpleMLInferenceOp : public OpKernel {
 
   // Gets the c++ references on all the input tensor values of the inference op.
   // In other words, get the input tensor and cast them to the expected type.
+  // The feature banks are "banks" (see "LinkFeatureBanks").
   InputTensors LinkInputTensors(OpKernelContext* ctx,
                                 const FeatureIndex& feature_index,
-                                tf::Status* status) {
-    const Tensor* numerical_features_tensor = nullptr;
-    const Tensor* boolean_features_tensor = nullptr;
-    const Tensor* categorical_int_features_tensor = nullptr;
+                                const FeatureBanks& banks, tf::Status* status) {
     const Tensor* categorical_set_int_features_values_tensor = nullptr;
     const Tensor* categorical_set_int_features_row_splits_dim_1_tensor =
         nullptr;
@@ -1073,9 +6952,9 @@ class SimpleMLInferenceOp : public OpKernel {
         nullptr;
 
     auto build_return = [&]() -> InputTensors {
-      return {numerical_features_tensor,
-              boolean_features_tensor,
-              categorical_int_features_tensor,
+      return {banks.numerical_features,
+              banks.boolean_features,
+              banks.categorical_int_features,
               categorical_set_int_features_values_tensor,
               categorical_set_int_features_row_splits_dim_1_tensor,
               categorical_set_int_features_row_splits_dim_2_tensor};
@@ -1083,12 +6962,6 @@ class SimpleMLInferenceOp : public OpKernel {
 
     for (const auto& tensor_def :
          std::vector<std::pair<const char*, const Tensor**>>{
-             {kInputNumericalFeatures, &numerical_features_tensor},
-
-             {kInputBooleanFeatures, &boolean_features_tensor},
-
-             {kInputCategoricalIntFeatures, &categorical_int_features_tensor},
-
              {kInputCategoricalSetIntFeaturesValues,
               &categorical_set_int_features_values_tensor},
 
@@ -1132,32 +7005,176 @@ class SimpleMLInferenceOp : public OpKernel {
       return build_return();
     }
 
+    if (status->ok()) {
+      *status = CheckCategoricalSetRowSplits(
+          tensors, feature_index.categorical_set_int_features().size());
+    }
     return tensors;
   }
 
+  // Evaluates the call directly with the engine, and sets the
+  // "dense_predictions" output and the extra outputs of the op.
+  tf::Status RunInference(
+      OpKernelContext* ctx, const InputTensors& input_tensors,
+      const InferenceOptions& inference_options,
+      AbstractInferenceEngine::AbstractCache* engine_cache) {
+    tf::Status status;
+    auto output_tensors =
+        LinkOutputTensors(ctx, input_tensors.batch_size, &status);
+    TF_RETURN_IF_ERROR(status);
+    TF_RETURN_IF_ERROR(LinkExtraOutputTensors(ctx, input_tensors.batch_size,
+                                              &output_tensors));
+    return model_container_->engine()->RunInference(
+        input_tensors, model_container_->feature_index(), inference_options,
+        &output_tensors, engine_cache);
+  }
+
+  // Evaluates the call through "call_batcher_", i.e. possibly merged with
+  // concurrent calls, and sets the "dense_predictions" output.
+  tf::Status RunBatchedInference(
+      OpKernelContext* ctx, const int batch_size, const FeatureBanks& banks,
+      const InferenceOptions& inference_options,
+      AbstractInferenceEngine::AbstractCache* engine_cache) {
+    InferenceCallBatcher::Call call;
+    call.batch_size = batch_size;
+    call.inputs[0] = banks.numerical_features;
+    call.inputs[1] = banks.boolean_features;
+    call.inputs[2] = banks.categorical_int_features;
+    int input_idx = 3;
+    for (const char* input_name :
+         {kInputCategoricalSetIntFeaturesValues,
+          kInputCategoricalSetIntFeaturesRowSplitsDim1,
+          kInputCategoricalSetIntFeaturesRowSplitsDim2}) {
+      TF_RETURN_IF_ERROR(ctx->input(input_name, &call.inputs[input_idx++]));
+    }
+
+    call_batcher_->Run(
+        &call, [&](const InferenceCallBatcher::Inputs& inputs,
+                   const int merged_batch_size, Tensor* predictions) {
+          InputTensors input_tensors(inputs[0], inputs[1], inputs[2],
+                                     inputs[3], inputs[4], inputs[5]);
+          input_tensors.batch_size = merged_batch_size;
+          *predictions =
+              Tensor(tf::DT_FLOAT,
+                     TensorShape({merged_batch_size, dense_output_dim_}));
+          OutputTensors output_tensors(predictions, dense_output_dim_);
+          return model_container_->engine()->RunInference(
+              input_tensors, model_container_->feature_index(),
+              inference_options, &output_tensors, engine_cache);
+        });
+    TF_RETURN_IF_ERROR(call.status);
+    return ctx->set_output(kOutputDensePredictions, call.predictions);
+  }
+
+  // Evaluates the call with the prediction cache of the model: the predictions
+  // of the cached examples are copied, the other examples are evaluated and
+  // their predictions cached. Sets the "dense_predictions" output.
+  tf::Status RunCachedInference(
+      OpKernelContext* ctx, const InputTensors& input_tensors,
+      const InferenceOptions& inference_options,
+      AbstractInferenceEngine::AbstractCache* engine_cache) {
+    PredictionCache* cache = model_container_->prediction_cache();
+    tf::Status status;
+    auto output_tensors =
+        LinkOutputTensors(ctx, input_tensors.batch_size, &status);
+    TF_RETURN_IF_ERROR(status);
+    float* predictions = output_tensors.dense_predictions.data();
+
+    // The options changing the predictions are part of the keys.
+    uint32_t early_exit_margin_bits;
+    std::memcpy(&early_exit_margin_bits, &inference_options.early_exit_margin,
+                sizeof(early_exit_margin_bits));
+    const uint64_t seed = tf::Hash64Combine(
+        tf::Hash64Combine(inference_options.max_num_trees, dense_output_dim_),
+        early_exit_margin_bits);
+
+    std::vector<PredictionCache::Key> keys(input_tensors.batch_size);
+    std::vector<int> missed_example_idxs;
+    for (int example_idx = 0; example_idx < input_tensors.batch_size;
+         example_idx++) {
+      keys[example_idx] = {HashExample(input_tensors, example_idx, seed),
+                           HashExample(input_tensors, example_idx, ~seed)};
+      if (!cache->Lookup(keys[example_idx], dense_output_dim_,
+                         predictions + example_idx * dense_output_dim_)) {
+        missed_example_idxs.push_back(example_idx);
+      }
+    }
+    prediction_cache_hits_->IncrementBy(input_tensors.batch_size -
+                                        missed_example_idxs.size());
+    prediction_cache_misses_->IncrementBy(missed_example_idxs.size());
+    if (missed_example_idxs.empty()) {
+      return tf::Status::OK();
+    }
+
+    if (missed_example_idxs.size() == input_tensors.batch_size) {
+      TF_RETURN_IF_ERROR(model_container_->engine()->RunInference(
+          input_tensors, model_container_->feature_index(), inference_options,
+          &output_tensors, engine_cache));
+    } else {
+      // Evaluate the missed examples only.
+      std::array<Tensor, InferenceCallBatcher::kNumInputs> missed_inputs;
+      TF_RETURN_IF_ERROR(GatherExamples(ctx, input_tensors,
+                                        missed_example_idxs, &missed_inputs));
+      InputTensors missed_input_tensors(
+          &missed_inputs[0], &missed_inputs[1], &missed_inputs[2],
+          &missed_inputs[3], &missed_inputs[4], &missed_inputs[5]);
+      missed_input_tensors.batch_size = missed_example_idxs.size();
+      Tensor missed_predictions;
+      TF_RETURN_IF_ERROR(ctx->allocate_temp(
+          tf::DT_FLOAT,
+          TensorShape({missed_input_tensors.batch_size, dense_output_dim_}),
+          &missed_predictions));
+      OutputTensors missed_output_tensors(&missed_predictions,
+                                          dense_output_dim_);
+      TF_RETURN_IF_ERROR(model_container_->engine()->RunInference(
+          missed_input_tensors, model_container_->feature_index(),
+          inference_options, &missed_output_tensors, engine_cache));
+      const float* missed_values = missed_predictions.flat<float>().data();
+      for (int missed_idx = 0; missed_idx < missed_example_idxs.size();
+           missed_idx++) {
+        std::copy_n(missed_values + missed_idx * dense_output_dim_,
+                    dense_output_dim_,
+                    predictions +
+                        missed_example_idxs[missed_idx] * dense_output_dim_);
+      }
+    }
+
+    for (const int example_idx : missed_example_idxs) {
+      cache->Insert(keys[example_idx], dense_output_dim_,
+                    predictions + example_idx * dense_output_dim_);
+    }
+    return tf::Status::OK();
+  }
+
   // Allocates and gets the c++ references to all the output tensor values of
   // the inference op.
   OutputTensors LinkOutputTensors(OpKernelContext* ctx, const int batch_size,
                                   tf::Status* status) {
     Tensor* dense_predictions_tensor = nullptr;
-    Tensor* dense_col_representation_tensor = nullptr;
-
     *status = ctx->allocate_output(kOutputDensePredictions,
                                    TensorShape({batch_size, dense_output_dim_}),
                                    &dense_predictions_tensor);
-    if (!status->ok()) {
-      return {dense_predictions_tensor, dense_col_representation_tensor,
-              dense_output_dim_};  // Eigen maps cannot be empty.
+    return {dense_predictions_tensor, dense_output_dim_};
+  }
+
+  // Sets the "dense_col_representation" output. The pre-computed tensor of the
+  // model is forwarded if its shape matches the "dense_output_dim" attribute.
+  tf::Status SetDenseColRepresentation(OpKernelContext* ctx) {
+    const Tensor& reps = model_container_->dense_col_representation();
+    if (reps.NumElements() == dense_output_dim_) {
+      return ctx->set_output(kOutputDenseColRepresentation, reps);
     }
-    *status = ctx->allocate_output(kOutputDenseColRepresentation,
-                                   TensorShape({dense_output_dim_}),
-                                   &dense_col_representation_tensor);
-    if (!status->ok()) {
-      return {dense_predictions_tensor, dense_col_representation_tensor,
-              dense_output_dim_};  // Eigen maps cannot be empty.
+    Tensor* dense_col_representation_tensor = nullptr;
+    TF_RETURN_IF_ERROR(ctx->allocate_output(kOutputDenseColRepresentation,
+                                            TensorShape({dense_output_dim_}),
+                                            &dense_col_representation_tensor));
+    auto dst = dense_col_representation_tensor->flat<tf::tstring>();
+    const auto src = reps.flat<tf::tstring>();
+    for (int rep_idx = 0; rep_idx < std::min<int64_t>(src.size(), dst.size());
+         rep_idx++) {
+      dst(rep_idx) = src(rep_idx);
     }
-    return {dense_predictions_tensor, dense_col_representation_tensor,
-            dense_output_dim_};
+    return tf::Status::OK();
   }
 
   // Identifier of the model. Copy of the "model_identifier" attribute.
@@ -1167,14 +7184,34 @@ class SimpleMLInferenceOp : public OpKernel {
   // call to the OP.
   YggdrasilModelResource* model_container_ = nullptr;
 
-  // Cache data to re-use in between inference calls.
-  std::unique_ptr<AbstractInferenceEngine::AbstractCache> engine_cache_;
+  // Cache data to re-use in between inference calls. Each concurrent
+  // inference call checks-out its own cache, so the engine inference itself
+  // runs without lock.
+  std::vector<std::unique_ptr<AbstractInferenceEngine::AbstractCache>>
+      free_engine_caches_ TF_GUARDED_BY(engine_cache_mutex_);
 
-  // Protects calls to the engine inference.
-  tensorflow::mutex engine_mutex_;
+  // Protects the linking of the model and the pool of free engine caches.
+  tensorflow::mutex engine_cache_mutex_;
 
   // Copy of the attributes of the same name.
   int dense_output_dim_;
+  bool trace_stages_;
+
+  // Inference options set from the attributes. The thread pool is set at
+  // execution time.
+  InferenceOptions inference_options_;
+
+  // Coalesces the concurrent calls. Null if the "max_batch_size" attribute is
+  // not positive.
+  std::unique_ptr<InferenceCallBatcher> call_batcher_;
+
+  // Value of the "model" label of the stage latency metric. The model
+  // identifier if available, or the name of the op otherwise.
+  std::string trace_label_;
+
+  // Cells of the "prediction_cache_lookups" metric of the op.
+  tf::monitoring::CounterCell* prediction_cache_hits_;
+  tf::monitoring::CounterCell* prediction_cache_misses_;
 };
 
 REGISTER_KERNEL_BUILDER(Name("SimpleMLInferenceOp").Device(tf::DEVICE_CPU),
@@ -1187,10 +7224,10 @@ class SimpleMLInferenceOpWithHandle : public SimpleMLInferenceOp {
 
   ~SimpleMLInferenceOpWithHandle() override {}
 
-  tf::Status LinkModelResource(OpKernelContext* ctx) override {
+  tf::Status LinkModelResource(OpKernelContext* ctx) override
+      TF_EXCLUSIVE_LOCKS_REQUIRED(engine_cache_mutex_) {
     TF_RETURN_IF_ERROR(GetModel(ctx, &model_container_));
-    LOG(INFO) << "------SIMPLEMLInferenceOpWithHandle";
-    return CreateEngineCache();
+    return tf::Status::OK();
   }
 };
 
@@ -1198,6 +7235,543 @@ REGISTER_KERNEL_BUILDER(
     Name("SimpleMLInferenceOpWithHandle").Device(tf::DEVICE_CPU),
     SimpleMLInferenceOpWithHandle);
 
+// Runs the inference of a model bank (loaded by
+// "SimpleMLLoadModelBankFromPaths") on packed tensors, where each example is
+// evaluated by the model of the same index in "model_ids".
+class SimpleMLInferenceOpWithModelBank : public SimpleMLInferenceOp {
+ public:
+  explicit SimpleMLInferenceOpWithModelBank(OpKernelConstruction* ctx)
+      : SimpleMLInferenceOp(ctx) {}
+
+  ~SimpleMLInferenceOpWithModelBank() override {}
+
+  tf::Status LinkExtraInputTensors(OpKernelContext* ctx,
+                                   InputTensors* input_tensors) override {
+    const Tensor* model_ids_tensor;
+    TF_RETURN_IF_ERROR(ctx->input(kInputModelIds, &model_ids_tensor));
+    if (model_ids_tensor->NumElements() != input_tensors->batch_size) {
+      return tf::Status(
+          tf::error::INVALID_ARGUMENT,
+          absl::StrCat("The model_ids size (", model_ids_tensor->NumElements(),
+                       ") does not match the batch size (",
+                       input_tensors->batch_size, ")."));
+    }
+    input_tensors->model_ids = model_ids_tensor->flat<int32_t>().data();
+    return tf::Status::OK();
+  }
+};
+
+REGISTER_KERNEL_BUILDER(
+    Name("SimpleMLInferenceOpWithModelBank").Device(tf::DEVICE_CPU),
+    SimpleMLInferenceOpWithModelBank);
+
+// Runs the inference of a model on packed tensors, where the categorical
+// features with a dictionary are fed as strings, and resolved with the
+// "CategoricalDictionaries" of the model.
+class SimpleMLInferenceOpWithCategoricalStrings : public SimpleMLInferenceOp {
+ public:
+  explicit SimpleMLInferenceOpWithCategoricalStrings(OpKernelConstruction* ctx)
+      : SimpleMLInferenceOp(ctx) {}
+
+  ~SimpleMLInferenceOpWithCategoricalStrings() override {}
+
+  tf::Status LinkCategoricalIntFeatures(OpKernelContext* ctx, Tensor* storage,
+                                        const Tensor** tensor) override {
+    const Tensor* int_values;
+    const Tensor* string_values;
+    TF_RETURN_IF_ERROR(ctx->input(kInputCategoricalIntFeatures, &int_values));
+    TF_RETURN_IF_ERROR(
+        ctx->input(kInputCategoricalStringFeatures, &string_values));
+    if (string_values->dims() != 2 || int_values->dims() != 2) {
+      return tf::errors::InvalidArgument(
+          "The categorical features should be matrices.");
+    }
+    // Without string values, the int values are used as is.
+    if (string_values->dim_size(0) == 0) {
+      *tensor = int_values;
+      return tf::Status::OK();
+    }
+
+    const auto& dictionaries = model_container_->categorical_dictionaries();
+    const int num_features =
+        model_container_->feature_index().categorical_int_features().size();
+    const int batch_size = string_values->dim_size(0);
+    const bool has_int_values = int_values->dim_size(0) > 0;
+    if (string_values->dim_size(1) != num_features ||
+        (has_int_values && (int_values->dim_size(0) != batch_size ||
+                            int_values->dim_size(1) != num_features))) {
+      return tf::errors::InvalidArgument(absl::StrCat(
+          "Unexpected shape of categorical_string_features (",
+          string_values->shape().DebugString(),
+          ") or categorical_int_features (",
+          int_values->shape().DebugString(), ")."));
+    }
+    for (int column_idx = 0; column_idx < num_features; column_idx++) {
+      if (!has_int_values && !dictionaries.has_dictionary(column_idx)) {
+        return tf::errors::InvalidArgument(
+            "The already integerized categorical features should be fed in "
+            "categorical_int_features.");
+      }
+    }
+
+    TF_RETURN_IF_ERROR(ctx->allocate_temp(
+        tf::DT_INT32, TensorShape({batch_size, num_features}), storage));
+    auto dst = storage->matrix<int32_t>();
+    const auto strings = string_values->matrix<tf::tstring>();
+    const auto ints = int_values->matrix<int32_t>();
+    for (int example_idx = 0; example_idx < batch_size; example_idx++) {
+      for (int column_idx = 0; column_idx < num_features; column_idx++) {
+        if (dictionaries.has_dictionary(column_idx)) {
+          const tf::tstring& value = strings(example_idx, column_idx);
+          dst(example_idx, column_idx) = dictionaries.Lookup(
+              column_idx, absl::string_view(value.data(), value.size()));
+        } else {
+          dst(example_idx, column_idx) = ints(example_idx, column_idx);
+        }
+      }
+    }
+    *tensor = storage;
+    return tf::Status::OK();
+  }
+};
+
+REGISTER_KERNEL_BUILDER(
+    Name("SimpleMLInferenceOpWithCategoricalStrings").Device(tf::DEVICE_CPU),
+    SimpleMLInferenceOpWithCategoricalStrings);
+
+// Copies the "batch_size" values of "src" in the "column_idx-th" column of
+// "dst".
+template <typename Src, typename Dst>
+void CopyFeatureColumn(const Tensor& src, const int column_idx,
+                       typename tf::TTypes<Dst>::Matrix* dst) {
+  const Src* values = src.flat<Src>().data();
+  for (int example_idx = 0; example_idx < dst->dimension(0); example_idx++) {
+    (*dst)(example_idx, column_idx) = static_cast<Dst>(values[example_idx]);
+  }
+}
+
+// Packs the feature tensors of the list input "input_name", each of
+// "batch_size" values, as the columns of the new "bank" tensor of type "Dst".
+template <typename Dst>
+tf::Status PackFeatureBank(OpKernelContext* ctx, const char* input_name,
+                           const int batch_size, Tensor* bank) {
+  tf::OpInputList values;
+  TF_RETURN_IF_ERROR(ctx->input_list(input_name, &values));
+  TF_RETURN_IF_ERROR(ctx->allocate_temp(
+      tf::DataTypeToEnum<Dst>::v(), TensorShape({batch_size, values.size()}),
+      bank));
+  auto dst = bank->matrix<Dst>();
+  for (int column_idx = 0; column_idx < values.size(); column_idx++) {
+    const Tensor& src = values[column_idx];
+    if (src.NumElements() != batch_size) {
+      return tf::errors::InvalidArgument(absl::StrCat(
+          "The feature ", column_idx, " of ", input_name, " has ",
+          src.NumElements(), " values instead of ", batch_size, "."));
+    }
+    switch (src.dtype()) {
+      case tf::DT_FLOAT:
+        CopyFeatureColumn<float, Dst>(src, column_idx, &dst);
+        break;
+      case tf::DT_DOUBLE:
+        CopyFeatureColumn<double, Dst>(src, column_idx, &dst);
+        break;
+      case tf::DT_INT32:
+        CopyFeatureColumn<int32_t, Dst>(src, column_idx, &dst);
+        break;
+      case tf::DT_INT64:
+        CopyFeatureColumn<tf::int64, Dst>(src, column_idx, &dst);
+        break;
+      default:
+        return tf::errors::InvalidArgument(
+            absl::StrCat("Unsupported type ", tf::DataTypeString(src.dtype()),
+                         " in ", input_name, "."));
+    }
+  }
+  return tf::Status::OK();
+}
+
+// Runs the inference of a model on a list of feature tensors, one per
+// feature and of any numerical type, instead of pre-packed feature banks. The
+// op packs the features in the banks itself, casting them on the way: the
+// graph does not need a stack and a cast op per feature bank.
+class SimpleMLInferenceOpWithFeatureList : public SimpleMLInferenceOp {
+ public:
+  explicit SimpleMLInferenceOpWithFeatureList(OpKernelConstruction* ctx)
+      : SimpleMLInferenceOp(ctx) {}
+
+  ~SimpleMLInferenceOpWithFeatureList() override {}
+
+  tf::Status LinkFeatureBanks(OpKernelContext* ctx,
+                              FeatureBanks* banks) override {
+    // The batch size is the size of any of the features.
+    int batch_size = 0;
+    for (const char* input_name :
+         {kInputNumericalFeatureValues, kInputBooleanFeatureValues,
+          kInputCategoricalIntFeatureValues}) {
+      tf::OpInputList values;
+      TF_RETURN_IF_ERROR(ctx->input_list(input_name, &values));
+      if (values.size() > 0) {
+        batch_size = values[0].NumElements();
+        break;
+      }
+    }
+
+    TF_RETURN_IF_ERROR(PackFeatureBank<float>(
+        ctx, kInputNumericalFeatureValues, batch_size,
+        &banks->numerical_features_storage));
+    TF_RETURN_IF_ERROR(PackFeatureBank<float>(
+        ctx, kInputBooleanFeatureValues, batch_size,
+        &banks->boolean_features_storage));
+    TF_RETURN_IF_ERROR(PackFeatureBank<int32_t>(
+        ctx, kInputCategoricalIntFeatureValues, batch_size,
+        &banks->categorical_int_features_storage));
+    banks->numerical_features = &banks->numerical_features_storage;
+    banks->boolean_features = &banks->boolean_features_storage;
+    banks->categorical_int_features = &banks->categorical_int_features_storage;
+    return tf::Status::OK();
+  }
+};
+
+REGISTER_KERNEL_BUILDER(
+    Name("SimpleMLInferenceOpWithFeatureList").Device(tf::DEVICE_CPU),
+    SimpleMLInferenceOpWithFeatureList);
+
+// Runs the inference of a model where the numerical features are fed as a
+// sparse (CSR) matrix of the present values, instead of as a dense bank. Wide
+// models often have only a few of their numerical features set per example:
+// the size of the requests and the cost of parsing them scale with the number
+// of present values. The absent values are missing.
+class SimpleMLInferenceOpWithSparseNumericalFeatures
+    : public SimpleMLInferenceOp {
+ public:
+  explicit SimpleMLInferenceOpWithSparseNumericalFeatures(
+      OpKernelConstruction* ctx)
+      : SimpleMLInferenceOp(ctx) {}
+
+  ~SimpleMLInferenceOpWithSparseNumericalFeatures() override {}
+
+  tf::Status LinkFeatureBanks(OpKernelContext* ctx,
+                              FeatureBanks* banks) override {
+    const Tensor* indices_tensor;
+    const Tensor* values_tensor;
+    const Tensor* row_splits_tensor;
+    TF_RETURN_IF_ERROR(
+        ctx->input(kInputNumericalFeaturesIndices, &indices_tensor));
+    TF_RETURN_IF_ERROR(
+        ctx->input(kInputNumericalFeaturesValues, &values_tensor));
+    TF_RETURN_IF_ERROR(
+        ctx->input(kInputNumericalFeaturesRowSplits, &row_splits_tensor));
+    if (indices_tensor->dims() != 1 || values_tensor->dims() != 1 ||
+        row_splits_tensor->dims() != 1 ||
+        indices_tensor->NumElements() != values_tensor->NumElements()) {
+      return tf::errors::InvalidArgument(absl::StrCat(
+          "The sparse numerical features should be vectors, with as many "
+          "indices as values. Got indices of shape ",
+          indices_tensor->shape().DebugString(), " and values of shape ",
+          values_tensor->shape().DebugString(), "."));
+    }
+
+    // Without row splits, the bank is empty (for models without numerical
+    // features), as in "SimpleMLInferenceOp".
+    const bool has_row_splits = row_splits_tensor->NumElements() > 0;
+    const int batch_size =
+        has_row_splits ? row_splits_tensor->NumElements() - 1 : 0;
+    const int num_features =
+        has_row_splits
+            ? model_container_->feature_index().numerical_features().size()
+            : 0;
+    const auto indices = indices_tensor->vec<int32_t>();
+    const auto values = values_tensor->vec<float>();
+    const auto row_splits = row_splits_tensor->vec<int64_t>();
+    if (batch_size > 0 &&
+        (row_splits(0) != 0 || row_splits(batch_size) != values.size())) {
+      return tf::errors::InvalidArgument(absl::StrCat(
+          "The numerical_features_row_splits should start at 0 and end at the "
+          "number of values (",
+          values.size(), ")."));
+    }
+    // Note: Checked before any value is read, so that the rows are within
+    // the values.
+    for (int example_idx = 0; example_idx < batch_size; example_idx++) {
+      if (row_splits(example_idx) > row_splits(example_idx + 1)) {
+        return tf::errors::InvalidArgument(
+            "The numerical_features_row_splits should be sorted.");
+      }
+    }
+
+    // The absent values are missing, i.e. NaN.
+    TF_RETURN_IF_ERROR(ctx->allocate_temp(
+        tf::DT_FLOAT, TensorShape({batch_size, num_features}),
+        &banks->numerical_features_storage));
+    auto dst = banks->numerical_features_storage.matrix<float>();
+    dst.setConstant(std::numeric_limits<float>::quiet_NaN());
+    for (int example_idx = 0; example_idx < batch_size; example_idx++) {
+      const int64_t begin = row_splits(example_idx);
+      const int64_t end = row_splits(example_idx + 1);
+      for (int64_t value_idx = begin; value_idx < end; value_idx++) {
+        const int32_t column_idx = indices(value_idx);
+        if (column_idx < 0 || column_idx >= num_features) {
+          return tf::errors::InvalidArgument(absl::StrCat(
+              "Numerical feature index ", column_idx, " of example ",
+              example_idx, " is outside of [0, ", num_features, ")."));
+        }
+        dst(example_idx, column_idx) = values(value_idx);
+      }
+    }
+    banks->numerical_features = &banks->numerical_features_storage;
+
+    TF_RETURN_IF_ERROR(
+        ctx->input(kInputBooleanFeatures, &banks->boolean_features));
+    return LinkCategoricalIntFeatures(ctx,
+                                      &banks->categorical_int_features_storage,
+                                      &banks->categorical_int_features);
+  }
+};
+
+REGISTER_KERNEL_BUILDER(
+    Name("SimpleMLInferenceOpWithSparseNumericalFeatures")
+        .Device(tf::DEVICE_CPU),
+    SimpleMLInferenceOpWithSparseNumericalFeatures);
+
+// Runs the inference of a model, and computes the contributions of the input
+// features to its predictions (see "FlatForest::FeatureContributions") in the
+// "feature_contributions" output. Only supported by the flat forest engines.
+class SimpleMLInferenceOpWithFeatureContributions : public SimpleMLInferenceOp {
+ public:
+  explicit SimpleMLInferenceOpWithFeatureContributions(
+      OpKernelConstruction* ctx)
+      : SimpleMLInferenceOp(ctx) {}
+
+  ~SimpleMLInferenceOpWithFeatureContributions() override {}
+
+  tf::Status ComputeExtraOutputs(
+      OpKernelContext* ctx, const InputTensors& input_tensors,
+      const InferenceOptions& inference_options) override {
+    const FlatForest* forest = model_container_->engine()->flat_forest();
+    if (forest == nullptr) {
+      return tf::errors::InvalidArgument(
+          "The feature contributions are only supported by the flat forest "
+          "engines.");
+    }
+    if (!forest->HasNodeCovers()) {
+      return tf::errors::FailedPrecondition(
+          "The feature contributions require the number of training examples "
+          "of the nodes of the model.");
+    }
+    if (forest->HasCategoricalSetConditions()) {
+      return tf::errors::InvalidArgument(
+          "The feature contributions are not supported on categorical set "
+          "features.");
+    }
+
+    const int batch_size = input_tensors.batch_size;
+    const int num_features = FlatForest::NumContributionFeatures(input_tensors);
+    Tensor* contributions_tensor = nullptr;
+    TF_RETURN_IF_ERROR(ctx->allocate_output(
+        kOutputFeatureContributions,
+        TensorShape({batch_size, num_features + 1, forest->accumulator_dim()}),
+        &contributions_tensor));
+    float* contributions = contributions_tensor->flat<float>().data();
+    const int example_size = (num_features + 1) * forest->accumulator_dim();
+    const int num_evaluated_trees =
+        forest->NumEvaluatedTrees(inference_options.max_num_trees);
+
+    // Note: The contributions are a lot more expensive than the predictions,
+    // so smaller batches are sharded.
+    int num_shards = 1;
+    if (inference_options.thread_pool != nullptr) {
+      num_shards = std::max(
+          1, std::min(inference_options.max_num_shards,
+                      batch_size / kMinNumExamplesPerContributionShard));
+    }
+    if (num_shards <= 1) {
+      forest->FeatureContributions(input_tensors, 0, batch_size,
+                                   num_evaluated_trees, contributions);
+      return tf::Status::OK();
+    }
+    return RunShardsInParallel(
+        inference_options.thread_pool, num_shards, batch_size,
+        [&](const int shard_idx, const int begin, const int end) {
+          forest->FeatureContributions(input_tensors, begin, end,
+                                       num_evaluated_trees,
+                                       contributions + begin * example_size);
+          return tf::Status::OK();
+        });
+  }
+
+ private:
+  // Minimum number of examples in a shard of the contributions.
+  static constexpr int kMinNumExamplesPerContributionShard = 16;
+};
+
+REGISTER_KERNEL_BUILDER(
+    Name("SimpleMLInferenceOpWithFeatureContributions")
+        .Device(tf::DEVICE_CPU),
+    SimpleMLInferenceOpWithFeatureContributions);
+
+// Runs the inference of a model, and returns the index of the leaf reached by
+// each example in each tree (see "FlatForest::LeafIndex") in the "leaves"
+// output. The leaves are collected during the traversal of the trees for the
+// predictions. Only supported by the "flat" and "flat_mapped" engines.
+class SimpleMLInferenceOpWithLeaves : public SimpleMLInferenceOp {
+ public:
+  explicit SimpleMLInferenceOpWithLeaves(OpKernelConstruction* ctx)
+      : SimpleMLInferenceOp(ctx) {}
+
+  ~SimpleMLInferenceOpWithLeaves() override {}
+
+  bool HasExtraOutputTensors() const override { return true; }
+
+  tf::Status LinkExtraOutputTensors(OpKernelContext* ctx, const int batch_size,
+                                    OutputTensors* output_tensors) override {
+    const AbstractInferenceEngine* engine = model_container_->engine();
+    if (!engine->supports_leaf_outputs()) {
+      return tf::errors::InvalidArgument(
+          "The leaves are only supported by the \"flat\" and \"flat_mapped\" "
+          "inference engines.");
+    }
+    Tensor* leaves_tensor = nullptr;
+    TF_RETURN_IF_ERROR(ctx->allocate_output(
+        kOutputLeaves,
+        TensorShape({batch_size, engine->flat_forest()->num_trees()}),
+        &leaves_tensor));
+    output_tensors->leaves = leaves_tensor->flat<tf::int32>().data();
+    return tf::Status::OK();
+  }
+};
+
+REGISTER_KERNEL_BUILDER(
+    Name("SimpleMLInferenceOpWithLeaves").Device(tf::DEVICE_CPU),
+    SimpleMLInferenceOpWithLeaves);
+
+// Generates the source of the compiled flat forest of a model (see
+// "FlatForest::GenerateCompiledSource").
+class SimpleMLGenerateCompiledFlatForestSource : public OpKernel {
+ public:
+  explicit SimpleMLGenerateCompiledFlatForestSource(OpKernelConstruction* ctx)
+      : OpKernel(ctx) {}
+
+  void Compute(OpKernelContext* ctx) override {
+    std::string model_path;
+    OP_REQUIRES_OK(ctx, GetModelPath(ctx, &model_path));
+    const Tensor* output_path_tensor;
+    OP_REQUIRES_OK(ctx, ctx->input(kInputOutputPath, &output_path_tensor));
+    OP_REQUIRES(ctx, output_path_tensor->NumElements() == 1,
+                tf::errors::InvalidArgument(
+                    "The \"output_path\" input is expected to contain "
+                    "exactly one entry."));
+    const std::string output_path =
+        output_path_tensor->flat<tf::tstring>()(0);
+
+    std::unique_ptr<model::AbstractModel> model;
+    OP_REQUIRES_OK(ctx,
+                   utils::FromUtilStatus(LoadModel(model_path, &model)));
+    FeatureIndex feature_index;
+    OP_REQUIRES_OK(ctx, feature_index.Initialize(model->input_features(),
+                                                 model->data_spec()));
+    auto forest_or = FlatForest::Create(*model, feature_index);
+    OP_REQUIRES_OK(ctx, utils::FromUtilStatus(forest_or.status()));
+    OP_REQUIRES(ctx, !forest_or.value()->HasCategoricalSetConditions(),
+                tf::errors::InvalidArgument(
+                    "The compiled flat forests do not support the conditions "
+                    "on categorical set features."));
+    OP_REQUIRES_OK(ctx, tf::WriteStringToFile(
+                            ctx->env(), output_path,
+                            forest_or.value()->GenerateCompiledSource()));
+  }
+};
+
+REGISTER_KERNEL_BUILDER(
+    Name("SimpleMLGenerateCompiledFlatForestSource").Device(tf::DEVICE_CPU),
+    SimpleMLGenerateCompiledFlatForestSource);
+
+// Coordinator of a model distributed over tree shards (see "TreeShard"): sums
+// the "partial_predictions" of the shards, e.g. returned by "RemotePredict"
+// calls to the servers of the shards, and finalizes them into the predictions
+// of the model.
+class SimpleMLReduceTreeShards : public OpKernel {
+ public:
+  explicit SimpleMLReduceTreeShards(OpKernelConstruction* ctx)
+      : OpKernel(ctx) {
+    OP_REQUIRES_OK(ctx, ctx->GetAttr(kAttributeFinalization, &finalization_));
+  }
+
+  void Compute(OpKernelContext* ctx) override {
+    tf::OpInputList partial_predictions;
+    OP_REQUIRES_OK(
+        ctx, ctx->input_list(kInputPartialPredictions, &partial_predictions));
+    const TensorShape& shape = partial_predictions[0].shape();
+    OP_REQUIRES(ctx, shape.dims() == 2,
+                tf::errors::InvalidArgument(
+                    "The partial predictions should be of rank 2. Got shape ",
+                    shape.DebugString()));
+    for (const Tensor& shard_predictions : partial_predictions) {
+      OP_REQUIRES(ctx, shard_predictions.shape() == shape,
+                  tf::errors::InvalidArgument(
+                      "The partial predictions of the shards have different "
+                      "shapes: ",
+                      shape.DebugString(), " and ",
+                      shard_predictions.shape().DebugString()));
+    }
+    const int batch_size = shape.dim_size(0);
+    const int dim = shape.dim_size(1);
+    OP_REQUIRES(ctx, finalization_ != kFinalizationSigmoidBinary || dim == 1,
+                tf::errors::InvalidArgument(
+                    "The \"sigmoid_binary\" finalization expects one partial "
+                    "prediction per example. Got ",
+                    dim));
+
+    const int output_dim =
+        finalization_ == kFinalizationSigmoidBinary ? 2 : dim;
+    Tensor* predictions_tensor = nullptr;
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(
+                            kOutputDensePredictions,
+                            TensorShape({batch_size, output_dim}),
+                            &predictions_tensor));
+    auto predictions = predictions_tensor->matrix<float>();
+
+    std::vector<float> accumulator(dim);
+    for (int example_idx = 0; example_idx < batch_size; example_idx++) {
+      std::fill(accumulator.begin(), accumulator.end(), 0.f);
+      for (const Tensor& shard_predictions : partial_predictions) {
+        const auto values = shard_predictions.matrix<float>();
+        for (int i = 0; i < dim; i++) {
+          accumulator[i] += values(example_idx, i);
+        }
+      }
+      // Note: Same as "FlatForest::Finalize".
+      if (finalization_ == kFinalizationSigmoidBinary) {
+        const float proba = 1.f / (1.f + std::exp(-accumulator[0]));
+        predictions(example_idx, 0) = 1.f - proba;
+        predictions(example_idx, 1) = proba;
+      } else if (finalization_ == kFinalizationSoftmax) {
+        const float max_value =
+            *std::max_element(accumulator.begin(), accumulator.end());
+        float sum = 0.f;
+        for (int i = 0; i < dim; i++) {
+          accumulator[i] = std::exp(accumulator[i] - max_value);
+          sum += accumulator[i];
+        }
+        for (int i = 0; i < dim; i++) {
+          predictions(example_idx, i) = accumulator[i] / sum;
+        }
+      } else {
+        for (int i = 0; i < dim; i++) {
+          predictions(example_idx, i) = accumulator[i];
+        }
+      }
+    }
+  }
+
+ private:
+  // Copy of the "finalization" attribute.
+  std::string finalization_;
+};
+
+REGISTER_KERNEL_BUILDER(
+    Name("SimpleMLReduceTreeShards").Device(tf::DEVICE_CPU),
+    SimpleMLReduceTreeShards);
+
 // Implementation inspired from "LookupTableOp" in:
 // google3/third_party/tensorflow/core/kernels/lookup_table_op.h
 class SimpleMLCreateModelResource : public OpKernel {
@@ -1227,7 +7801,6 @@ class SimpleMLCreateModelResource : public OpKernel {
     if (!model_handle_set_) {
       OP_REQUIRES_OK(ctx, cinfo_.Init(ctx->resource_manager(), def(), false));
     }
-    LOG(INFO) << "-----SimpleMLCreateModelResource";
     auto creator =
         [ctx, this](YggdrasilModelResource** ret)
             TF_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
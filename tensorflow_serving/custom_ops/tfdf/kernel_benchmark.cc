@@ -0,0 +1,318 @@
+/*
+ * Copyright 2021 Google LLC.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmarks of the inference engines of the "SimpleMLInferenceOp" op.
+//
+// Gradient boosted trees models of varying number of trees and depth are
+// trained on a synthetic dataset, and evaluated with the "slow" (generic),
+// "fast" (semi-fast generic) and "flat" engines on batches of 1 to 4096
+// examples.
+// Besides the total time of a call, the "link_inputs", "set_examples",
+// "predict" and "export_outputs" counters report the average wall time (in
+// microseconds) of the stages of the op (see "InferenceStage" in kernel.cc).
+//
+// Run with:
+// bazel run -c opt --dynamic_mode=off \
+// tensorflow_serving/custom_ops/tfdf:kernel_benchmark --
+// --benchmarks=.
+// Single engines or models can be selected with e.g.
+// --benchmarks=BM_Inference/.*fast.*
+
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "tensorflow/core/framework/graph.pb.h"
+#include "tensorflow/core/framework/node_def_builder.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/lib/monitoring/collected_metrics.h"
+#include "tensorflow/core/lib/monitoring/collection_registry.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/init_main.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/path.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+#include "tensorflow/core/public/session.h"
+#include "yggdrasil_decision_forests/dataset/data_spec.h"
+#include "yggdrasil_decision_forests/dataset/data_spec.pb.h"
+#include "yggdrasil_decision_forests/dataset/example.pb.h"
+#include "yggdrasil_decision_forests/dataset/vertical_dataset.h"
+#include "yggdrasil_decision_forests/learner/abstract_learner.pb.h"
+#include "yggdrasil_decision_forests/learner/gradient_boosted_trees/gradient_boosted_trees.pb.h"
+#include "yggdrasil_decision_forests/learner/learner_library.h"
+#include "yggdrasil_decision_forests/model/model_library.h"
+
+namespace tensorflow_decision_forests {
+namespace ops {
+namespace {
+
+namespace tf = ::tensorflow;
+namespace model = ::yggdrasil_decision_forests::model;
+namespace dataset = ::yggdrasil_decision_forests::dataset;
+namespace gbt = ::yggdrasil_decision_forests::model::gradient_boosted_trees;
+
+constexpr int kNumFeatures = 20;
+constexpr int kNumTrainingExamples = 5000;
+
+// Benchmarked engines, indexed by the first argument of the benchmarks.
+constexpr const char* kEngines[] = {"slow", "fast", "flat"};
+
+// Stages recorded by the op, see "kInferenceStageNames" in kernel.cc.
+constexpr const char* kStages[] = {"link_inputs", "set_examples", "predict",
+                                   "export_outputs"};
+constexpr char kStageLatencyMetric[] =
+    "/tensorflow/serving/tfdf/inference_stage_latency";
+
+// Returns a binary classification dataset of "kNumFeatures" numerical
+// features, whose label depends on all the features.
+dataset::VerticalDataset CreateDataset() {
+  dataset::proto::DataSpecification data_spec;
+  for (int feature_idx = 0; feature_idx < kNumFeatures; feature_idx++) {
+    auto* column = dataset::AddColumn(absl::StrCat("f", feature_idx),
+                                      dataset::proto::ColumnType::NUMERICAL,
+                                      &data_spec);
+    column->mutable_numerical()->set_mean(0.5);
+  }
+  auto* label = dataset::AddColumn(
+      "label", dataset::proto::ColumnType::CATEGORICAL, &data_spec);
+  label->mutable_categorical()->set_is_already_integerized(true);
+  // The out-of-vocabulary value, and the two classes.
+  label->mutable_categorical()->set_number_of_unique_values(3);
+
+  dataset::VerticalDataset data;
+  data.set_data_spec(data_spec);
+  CHECK(data.CreateColumnsFromDataspec().ok());
+  std::mt19937 random(1234);
+  std::uniform_real_distribution<float> uniform(0.f, 1.f);
+  for (int example_idx = 0; example_idx < kNumTrainingExamples;
+       example_idx++) {
+    dataset::proto::Example example;
+    float sum = 0.f;
+    for (int feature_idx = 0; feature_idx < kNumFeatures; feature_idx++) {
+      const float value = uniform(random);
+      example.add_attributes()->set_numerical(value);
+      sum += (feature_idx % 2 == 0 ? 1.f : -0.5f) * value * value;
+    }
+    const bool positive = sum + 0.2f * (uniform(random) - 0.5f) > 2.5f;
+    example.add_attributes()->set_categorical(positive ? 2 : 1);
+    data.AppendExample(example);
+  }
+  return data;
+}
+
+// Returns the directory of a model of "num_trees" trees of depth "max_depth".
+// The models are trained once.
+std::string GetModelPath(const int num_trees, const int max_depth) {
+  static tf::mutex mu(tf::LINKER_INITIALIZED);
+  static auto* model_paths = new std::map<std::pair<int, int>, std::string>();
+  tf::mutex_lock l(mu);
+  auto it = model_paths->find({num_trees, max_depth});
+  if (it != model_paths->end()) {
+    return it->second;
+  }
+
+  static const auto* const data =
+      new dataset::VerticalDataset(CreateDataset());
+  model::proto::TrainingConfig train_config;
+  train_config.set_learner("GRADIENT_BOOSTED_TREES");
+  train_config.set_task(model::proto::Task::CLASSIFICATION);
+  train_config.set_label("label");
+  auto* gbt_config =
+      train_config.MutableExtension(gbt::proto::gradient_boosted_trees_config);
+  gbt_config->set_num_trees(num_trees);
+  gbt_config->set_validation_set_ratio(0.f);
+  gbt_config->set_early_stopping(
+      gbt::proto::GradientBoostedTreesTrainingConfig::NONE);
+  gbt_config->mutable_decision_tree()->set_max_depth(max_depth);
+  // Grows full trees, down to single examples.
+  gbt_config->mutable_decision_tree()->set_min_examples(1);
+
+  std::unique_ptr<model::AbstractLearner> learner;
+  CHECK(model::GetLearner(train_config, &learner).ok());
+  auto trained_model = learner->TrainWithStatus(*data);
+  CHECK(trained_model.ok()) << trained_model.status();
+
+  const std::string path =
+      tf::io::JoinPath(tf::testing::TmpDir(),
+                       absl::StrCat("model_", num_trees, "_", max_depth));
+  CHECK(model::SaveModel(path, trained_model.value().get()).ok());
+  (*model_paths)[{num_trees, max_depth}] = path;
+  return path;
+}
+
+// Returns the graph loading a model with "engine", and evaluating it with the
+// "infer" node.
+tf::GraphDef CreateGraph(const std::string& model_identifier,
+                         const std::string& engine) {
+  tf::GraphDef graph;
+  auto add_placeholder = [&graph](const std::string& name,
+                                  const tf::DataType dtype) {
+    TF_CHECK_OK(tf::NodeDefBuilder(name, "Placeholder")
+                    .Attr("dtype", dtype)
+                    .Finalize(graph.add_node()));
+  };
+  add_placeholder("path", tf::DT_STRING);
+  add_placeholder("numerical_features", tf::DT_FLOAT);
+  add_placeholder("boolean_features", tf::DT_FLOAT);
+  add_placeholder("categorical_int_features", tf::DT_INT32);
+  add_placeholder("categorical_set_values", tf::DT_INT32);
+  add_placeholder("categorical_set_row_splits_dim_1", tf::DT_INT64);
+  add_placeholder("categorical_set_row_splits_dim_2", tf::DT_INT64);
+
+  TF_CHECK_OK(tf::NodeDefBuilder("load", "SimpleMLLoadModelFromPath")
+                  .Attr("model_identifier", model_identifier)
+                  .Attr("inference_engine", engine)
+                  .Input("path", 0, tf::DT_STRING)
+                  .Finalize(graph.add_node()));
+  TF_CHECK_OK(tf::NodeDefBuilder("infer", "SimpleMLInferenceOp")
+                  .Attr("model_identifier", model_identifier)
+                  .Attr("dense_output_dim", 2)
+                  .Attr("trace_stages", true)
+                  .Input("numerical_features", 0, tf::DT_FLOAT)
+                  .Input("boolean_features", 0, tf::DT_FLOAT)
+                  .Input("categorical_int_features", 0, tf::DT_INT32)
+                  .Input("categorical_set_values", 0, tf::DT_INT32)
+                  .Input("categorical_set_row_splits_dim_1", 0, tf::DT_INT64)
+                  .Input("categorical_set_row_splits_dim_2", 0, tf::DT_INT64)
+                  .Finalize(graph.add_node()));
+  return graph;
+}
+
+// Returns the input tensors of "batch_size" random examples.
+std::vector<std::pair<std::string, tf::Tensor>> CreateInputs(
+    const int batch_size) {
+  tf::Tensor numerical_features(tf::DT_FLOAT,
+                                tf::TensorShape({batch_size, kNumFeatures}));
+  std::mt19937 random(5678);
+  std::uniform_real_distribution<float> uniform(0.f, 1.f);
+  auto values = numerical_features.flat<float>();
+  for (int i = 0; i < values.size(); i++) {
+    values(i) = uniform(random);
+  }
+  // The categorical set features are unused.
+  tf::Tensor row_splits_dim_1(tf::DT_INT64, tf::TensorShape({1}));
+  row_splits_dim_1.vec<tf::int64>()(0) = 0;
+  tf::Tensor row_splits_dim_2(tf::DT_INT64, tf::TensorShape({1}));
+  row_splits_dim_2.vec<tf::int64>()(0) = 0;
+  return {
+      {"numerical_features", numerical_features},
+      {"boolean_features", tf::Tensor(tf::DT_FLOAT, tf::TensorShape({0, 0}))},
+      {"categorical_int_features",
+       tf::Tensor(tf::DT_INT32, tf::TensorShape({0, 0}))},
+      {"categorical_set_values",
+       tf::Tensor(tf::DT_INT32, tf::TensorShape({0}))},
+      {"categorical_set_row_splits_dim_1", row_splits_dim_1},
+      {"categorical_set_row_splits_dim_2", row_splits_dim_2},
+  };
+}
+
+// Returns the total recorded wall time, in microseconds, of each stage of the
+// model "model_identifier".
+std::map<std::string, double> GetStageLatencySums(
+    const std::string& model_identifier) {
+  std::map<std::string, double> sums;
+  const auto metrics =
+      tf::monitoring::CollectionRegistry::Default()->CollectMetrics({});
+  const auto it = metrics->point_set_map.find(kStageLatencyMetric);
+  if (it == metrics->point_set_map.end()) {
+    return sums;
+  }
+  for (const auto& point : it->second->points) {
+    std::string model, stage;
+    for (const auto& label : point->labels) {
+      if (label.name == "model") {
+        model = label.value;
+      } else if (label.name == "stage") {
+        stage = label.value;
+      }
+    }
+    if (model == model_identifier) {
+      sums[stage] = point->histogram_value.sum();
+    }
+  }
+  return sums;
+}
+
+// Arguments: engine index in "kEngines", number of trees, maximum tree depth,
+// batch size.
+void BM_Inference(::testing::benchmark::State& state) {
+  const std::string engine = kEngines[state.range(0)];
+  const int num_trees = state.range(1);
+  const int max_depth = state.range(2);
+  const int batch_size = state.range(3);
+  const std::string model_identifier =
+      absl::StrCat("benchmark_", engine, "_", num_trees, "_", max_depth, "_",
+                   batch_size);
+
+  std::unique_ptr<tf::Session> session(tf::NewSession(tf::SessionOptions()));
+  TF_CHECK_OK(session->Create(CreateGraph(model_identifier, engine)));
+  tf::Tensor path(tf::DT_STRING, tf::TensorShape({}));
+  path.scalar<tf::tstring>()() = GetModelPath(num_trees, max_depth);
+  TF_CHECK_OK(session->Run({{"path", path}}, {}, {"load"}, nullptr));
+
+  const auto inputs = CreateInputs(batch_size);
+  std::vector<tf::Tensor> outputs;
+  // Warms up the per-op caches of the engine.
+  TF_CHECK_OK(session->Run(inputs, {"infer:0"}, {}, &outputs));
+
+  const auto start_sums = GetStageLatencySums(model_identifier);
+  for (auto s : state) {
+    TF_CHECK_OK(session->Run(inputs, {"infer:0"}, {}, &outputs));
+  }
+  const auto end_sums = GetStageLatencySums(model_identifier);
+
+  for (const char* stage : kStages) {
+    const auto start_it = start_sums.find(stage);
+    const auto end_it = end_sums.find(stage);
+    const double start_sum =
+        start_it == start_sums.end() ? 0. : start_it->second;
+    const double end_sum = end_it == end_sums.end() ? 0. : end_it->second;
+    state.counters[stage] = (end_sum - start_sum) / state.iterations();
+  }
+  state.SetItemsProcessed(state.iterations() * batch_size);
+  state.SetLabel(absl::StrCat(engine, " trees:", num_trees,
+                              " depth:", max_depth, " batch:", batch_size));
+}
+
+// Engines x models x batch sizes of 1 to 4096.
+void InferenceArgs(::testing::benchmark::internal::Benchmark* benchmark) {
+  for (int engine_idx = 0; engine_idx < TF_ARRAYSIZE(kEngines); engine_idx++) {
+    for (const int num_trees : {10, 100, 500}) {
+      for (const int max_depth : {4, 8}) {
+        for (int batch_size = 1; batch_size <= 4096; batch_size *= 4) {
+          benchmark->Args({engine_idx, num_trees, max_depth, batch_size});
+        }
+      }
+    }
+  }
+}
+
+BENCHMARK(BM_Inference)->Apply(InferenceArgs);
+
+}  // namespace
+}  // namespace ops
+}  // namespace tensorflow_decision_forests
+
+int main(int argc, char** argv) {
+  tensorflow::port::InitMain(argv[0], &argc, &argv);
+  tensorflow::testing::RunBenchmarks();
+  return 0;
+}
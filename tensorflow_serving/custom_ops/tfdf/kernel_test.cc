@@ -0,0 +1,247 @@
+/*
+ * Copyright 2021 Google LLC.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Tests of the "SimpleMLInferenceOp" op that check what the op does, and not
+// only its outputs, e.g. through its metrics. The outputs are tested in
+// tf1_test.py.
+
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include "absl/strings/str_cat.h"
+#include "tensorflow/core/framework/graph.pb.h"
+#include "tensorflow/core/framework/node_def_builder.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/monitoring/collected_metrics.h"
+#include "tensorflow/core/lib/monitoring/collection_registry.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/path.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/public/session.h"
+#include "yggdrasil_decision_forests/dataset/data_spec.h"
+#include "yggdrasil_decision_forests/dataset/data_spec.pb.h"
+#include "yggdrasil_decision_forests/dataset/example.pb.h"
+#include "yggdrasil_decision_forests/dataset/vertical_dataset.h"
+#include "yggdrasil_decision_forests/learner/abstract_learner.pb.h"
+#include "yggdrasil_decision_forests/learner/gradient_boosted_trees/gradient_boosted_trees.pb.h"
+#include "yggdrasil_decision_forests/learner/learner_library.h"
+#include "yggdrasil_decision_forests/model/model_library.h"
+
+namespace tensorflow_decision_forests {
+namespace ops {
+namespace {
+
+namespace tf = ::tensorflow;
+namespace model = ::yggdrasil_decision_forests::model;
+namespace dataset = ::yggdrasil_decision_forests::dataset;
+namespace gbt = ::yggdrasil_decision_forests::model::gradient_boosted_trees;
+
+constexpr int kNumFeatures = 4;
+constexpr char kPredictionCacheLookupsMetric[] =
+    "/tensorflow/serving/tfdf/prediction_cache_lookups";
+
+// Returns the directory of a small binary classification model on
+// "kNumFeatures" numerical features.
+std::string TrainModel() {
+  dataset::proto::DataSpecification data_spec;
+  for (int feature_idx = 0; feature_idx < kNumFeatures; feature_idx++) {
+    auto* column = dataset::AddColumn(absl::StrCat("f", feature_idx),
+                                      dataset::proto::ColumnType::NUMERICAL,
+                                      &data_spec);
+    column->mutable_numerical()->set_mean(0.5);
+  }
+  auto* label = dataset::AddColumn(
+      "label", dataset::proto::ColumnType::CATEGORICAL, &data_spec);
+  label->mutable_categorical()->set_is_already_integerized(true);
+  // The out-of-vocabulary value, and the two classes.
+  label->mutable_categorical()->set_number_of_unique_values(3);
+
+  dataset::VerticalDataset data;
+  data.set_data_spec(data_spec);
+  CHECK(data.CreateColumnsFromDataspec().ok());
+  std::mt19937 random(1234);
+  std::uniform_real_distribution<float> uniform(0.f, 1.f);
+  for (int example_idx = 0; example_idx < 500; example_idx++) {
+    dataset::proto::Example example;
+    float sum = 0.f;
+    for (int feature_idx = 0; feature_idx < kNumFeatures; feature_idx++) {
+      const float value = uniform(random);
+      example.add_attributes()->set_numerical(value);
+      sum += value;
+    }
+    example.add_attributes()->set_categorical(sum > kNumFeatures / 2 ? 2 : 1);
+    data.AppendExample(example);
+  }
+
+  model::proto::TrainingConfig train_config;
+  train_config.set_learner("GRADIENT_BOOSTED_TREES");
+  train_config.set_task(model::proto::Task::CLASSIFICATION);
+  train_config.set_label("label");
+  auto* gbt_config =
+      train_config.MutableExtension(gbt::proto::gradient_boosted_trees_config);
+  gbt_config->set_num_trees(10);
+  gbt_config->set_validation_set_ratio(0.f);
+  gbt_config->set_early_stopping(
+      gbt::proto::GradientBoostedTreesTrainingConfig::NONE);
+
+  std::unique_ptr<model::AbstractLearner> learner;
+  CHECK(model::GetLearner(train_config, &learner).ok());
+  auto trained_model = learner->TrainWithStatus(data);
+  CHECK(trained_model.ok()) << trained_model.status();
+  const std::string path = tf::io::JoinPath(tf::testing::TmpDir(), "model");
+  CHECK(model::SaveModel(path, trained_model.value().get()).ok());
+  return path;
+}
+
+// Returns the graph loading the model "model_identifier" with a prediction
+// cache, and evaluating it with the "infer" node.
+tf::GraphDef CreateGraph(const std::string& model_identifier) {
+  tf::GraphDef graph;
+  auto add_placeholder = [&graph](const std::string& name,
+                                  const tf::DataType dtype) {
+    TF_CHECK_OK(tf::NodeDefBuilder(name, "Placeholder")
+                    .Attr("dtype", dtype)
+                    .Finalize(graph.add_node()));
+  };
+  add_placeholder("path", tf::DT_STRING);
+  add_placeholder("numerical_features", tf::DT_FLOAT);
+  add_placeholder("boolean_features", tf::DT_FLOAT);
+  add_placeholder("categorical_int_features", tf::DT_INT32);
+  add_placeholder("categorical_set_values", tf::DT_INT32);
+  add_placeholder("categorical_set_row_splits_dim_1", tf::DT_INT64);
+  add_placeholder("categorical_set_row_splits_dim_2", tf::DT_INT64);
+
+  TF_CHECK_OK(tf::NodeDefBuilder("load", "SimpleMLLoadModelFromPath")
+                  .Attr("model_identifier", model_identifier)
+                  .Attr("inference_engine", "flat")
+                  .Attr("prediction_cache_size", 64)
+                  .Input("path", 0, tf::DT_STRING)
+                  .Finalize(graph.add_node()));
+  TF_CHECK_OK(tf::NodeDefBuilder("infer", "SimpleMLInferenceOp")
+                  .Attr("model_identifier", model_identifier)
+                  .Attr("dense_output_dim", 2)
+                  .Input("numerical_features", 0, tf::DT_FLOAT)
+                  .Input("boolean_features", 0, tf::DT_FLOAT)
+                  .Input("categorical_int_features", 0, tf::DT_INT32)
+                  .Input("categorical_set_values", 0, tf::DT_INT32)
+                  .Input("categorical_set_row_splits_dim_1", 0, tf::DT_INT64)
+                  .Input("categorical_set_row_splits_dim_2", 0, tf::DT_INT64)
+                  .Finalize(graph.add_node()));
+  return graph;
+}
+
+// Returns the input tensors of the examples of "numerical_features", of
+// shape [batch_size, kNumFeatures].
+std::vector<std::pair<std::string, tf::Tensor>> CreateInputs(
+    const tf::Tensor& numerical_features) {
+  // The categorical set features are unused.
+  tf::Tensor row_splits_dim_1(tf::DT_INT64, tf::TensorShape({1}));
+  row_splits_dim_1.vec<tf::int64>()(0) = 0;
+  tf::Tensor row_splits_dim_2(tf::DT_INT64, tf::TensorShape({1}));
+  row_splits_dim_2.vec<tf::int64>()(0) = 0;
+  return {
+      {"numerical_features", numerical_features},
+      {"boolean_features", tf::Tensor(tf::DT_FLOAT, tf::TensorShape({0, 0}))},
+      {"categorical_int_features",
+       tf::Tensor(tf::DT_INT32, tf::TensorShape({0, 0}))},
+      {"categorical_set_values",
+       tf::Tensor(tf::DT_INT32, tf::TensorShape({0}))},
+      {"categorical_set_row_splits_dim_1", row_splits_dim_1},
+      {"categorical_set_row_splits_dim_2", row_splits_dim_2},
+  };
+}
+
+// Returns the number of examples looked up in the prediction cache of the
+// model "model_identifier", by result ("hit" or "miss").
+std::map<std::string, tf::int64> GetPredictionCacheLookups(
+    const std::string& model_identifier) {
+  std::map<std::string, tf::int64> lookups;
+  const auto metrics =
+      tf::monitoring::CollectionRegistry::Default()->CollectMetrics({});
+  const auto it = metrics->point_set_map.find(kPredictionCacheLookupsMetric);
+  if (it == metrics->point_set_map.end()) {
+    return lookups;
+  }
+  for (const auto& point : it->second->points) {
+    std::string model, result;
+    for (const auto& label : point->labels) {
+      if (label.name == "model") {
+        model = label.value;
+      } else if (label.name == "result") {
+        result = label.value;
+      }
+    }
+    if (model == model_identifier) {
+      lookups[result] = point->int64_value;
+    }
+  }
+  return lookups;
+}
+
+TEST(SimpleMLInferenceOpTest, PredictionCacheHitsAreNotEvaluated) {
+  const std::string model_identifier = "prediction_cache";
+  std::unique_ptr<tf::Session> session(tf::NewSession(tf::SessionOptions()));
+  TF_ASSERT_OK(session->Create(CreateGraph(model_identifier)));
+  tf::Tensor path(tf::DT_STRING, tf::TensorShape({}));
+  path.scalar<tf::tstring>()() = TrainModel();
+  TF_ASSERT_OK(session->Run({{"path", path}}, {}, {"load"}, nullptr));
+
+  const tf::Tensor first_examples = tf::test::AsTensor<float>(
+      {0.1f, 0.2f, 0.3f, 0.4f, 0.9f, 0.8f, 0.7f, 0.6f}, {2, kNumFeatures});
+  const tf::Tensor all_examples = tf::test::AsTensor<float>(
+      {0.1f, 0.2f, 0.3f, 0.4f, 0.9f, 0.8f, 0.7f, 0.6f,  //
+       0.5f, 0.5f, 0.5f, 0.5f, 0.0f, 1.0f, 0.0f, 1.0f},
+      {4, kNumFeatures});
+
+  // The first call evaluates its examples, and caches their predictions.
+  std::vector<tf::Tensor> first_outputs;
+  TF_ASSERT_OK(session->Run(CreateInputs(first_examples), {"infer:0"}, {},
+                            &first_outputs));
+  auto lookups = GetPredictionCacheLookups(model_identifier);
+  EXPECT_EQ(lookups["hit"], 0);
+  EXPECT_EQ(lookups["miss"], 2);
+
+  // The second call only evaluates its two new examples.
+  std::vector<tf::Tensor> all_outputs;
+  TF_ASSERT_OK(
+      session->Run(CreateInputs(all_examples), {"infer:0"}, {}, &all_outputs));
+  lookups = GetPredictionCacheLookups(model_identifier);
+  EXPECT_EQ(lookups["hit"], 2);
+  EXPECT_EQ(lookups["miss"], 4);
+
+  // The third call evaluates nothing.
+  std::vector<tf::Tensor> cached_outputs;
+  TF_ASSERT_OK(session->Run(CreateInputs(all_examples), {"infer:0"}, {},
+                            &cached_outputs));
+  lookups = GetPredictionCacheLookups(model_identifier);
+  EXPECT_EQ(lookups["hit"], 6);
+  EXPECT_EQ(lookups["miss"], 4);
+
+  // The cached predictions are the evaluated ones.
+  tf::test::ExpectTensorEqual<float>(all_outputs[0], cached_outputs[0]);
+  tf::test::ExpectTensorEqual<float>(first_outputs[0],
+                                     all_outputs[0].Slice(0, 2));
+}
+
+}  // namespace
+}  // namespace ops
+}  // namespace tensorflow_decision_forests
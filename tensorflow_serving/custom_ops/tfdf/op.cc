@@ -27,6 +27,11 @@
 // contains a utility class able to build the input arguments of the
 // "InferenceOp*", as the signature of this OP is non trivial.
 
+#include <initializer_list>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "tensorflow/core/framework/op.h"
 
 #include "tensorflow/core/framework/common_shape_fns.h"
@@ -36,6 +41,20 @@ namespace tensorflow {
 REGISTER_OP("SimpleMLLoadModelFromPath")
     .SetIsStateful()
     .Attr("model_identifier: string")
+    .Attr(
+        "inference_engine: {'auto', 'autotune', 'fast', 'flat', "
+        "'flat_mapped', 'flat_quantized', 'slow'} = 'auto'")
+    .Attr("prediction_cache_size: int >= 0 = 0")
+    .Attr("num_inference_threads: int >= 0 = 0")
+    .Attr("inference_threads_numa_node: int >= -1 = -1")
+    .Attr("use_huge_pages: bool = false")
+    .Attr("prefault_model_data: bool = false")
+    .Attr("flat_forest_cache_dir: string = ''")
+    .Attr("release_unused_flat_forests: bool = false")
+    .Attr("num_tree_shards: int >= 1 = 1")
+    .Attr("tree_shard_index: int >= 0 = 0")
+    .Attr("autotune_batch_sizes: list(int) = [1, 32, 256]")
+    .Attr("rf_leaf_top_k: int >= 0 = 0")
     .Input("path: string")
     .Doc(R"(
 Loads (and possibly compiles/optimizes) an Yggdrasil model in memory.
@@ -51,11 +70,129 @@ model_identifier: Unique identifier of the model. Used to create the name of
 path: Path to the Yggdrasil model. Note: a Yggdrasil model directory should
   contains a "header.pb" file.
 
+inference_engine: Engine used to run the model. "auto" uses the fast engine
+  if the model is compatible, and the slow generic engine otherwise. "fast",
+  "flat" and "slow" force the fast engine, the flat forest engine (contiguous
+  breadth-first node arrays evaluated directly on the input tensors), and the
+  slow generic engine respectively, and fail if the model is not compatible.
+  The "flat" engine uses the compiled forest "flat_forest_compiled.so" in the
+  model directory if it exists (see "SimpleMLGenerateCompiledFlatForestSource").
+  "flat_mapped" is the flat forest engine, with the forest memory mapped from
+  the "flat_forest.tfdf" file in the model directory, if it exists. Otherwise,
+  the forest is built from the Yggdrasil model and kept in memory: the model
+  directory is never written (see "flat_forest_cache_dir" to save the built
+  forests). Loading an existing file does not parse the Yggdrasil model, and
+  processes on the same host share its pages.
+  "flat_quantized" is the flat forest engine, with the numerical thresholds and
+  feature values quantized to 16 bits bins. The bins are the unique thresholds
+  of the model, so the predictions are the same as with the "flat" engine.
+  "autotune" creates each of the "flat", "flat_quantized" and "fast" engines
+  compatible with the model, measures their latency on batches of random
+  examples of the "autotune_batch_sizes" sizes, and uses the fastest one (or the
+  slow generic engine if none is compatible). The choice is saved next to the
+  flat forest file of the model (i.e. as "flat_forest.tfdf.autotune" in the
+  model directory, or as "<hash>.tfdf.autotune" in "flat_forest_cache_dir"), and
+  reused by the next loads of the model on the same CPU model, which then
+  behave as if the chosen engine was requested (e.g. "flat" reads the flat
+  forest from "flat_forest_cache_dir").
+
+prediction_cache_size: If positive, the inference ops cache the predictions of
+  up to this number of examples, keyed by a hash of their features, and do not
+  evaluate the examples whose prediction is cached. The cache is discarded
+  when the model is reloaded. Not used by the model bank inference op.
+
+num_inference_threads: If positive, the model has its own pool of
+  "num_inference_threads" threads. The batches of the inference ops are sharded
+  on these threads, into up to max("max_num_inference_shards",
+  "num_inference_threads") shards, instead of on the worker threads of the
+  device. Since the threads only run this model, its nodes stay in the caches of
+  their cores instead of competing with the other models sharing the worker
+  threads.
+
+inference_threads_numa_node: If not -1, the threads of "num_inference_threads"
+  are bound to this NUMA node. Should be the node the model memory is allocated
+  on.
+
+use_huge_pages: If true, the node arrays of the "flat" and "flat_mapped" engines
+  are copied into memory backed by 2MB transparent huge pages (when supported by
+  the kernel), which reduces the TLB misses of the traversal of large forests.
+  With "flat_mapped", the pages of the file are then not shared with the other
+  processes anymore.
+
+prefault_model_data: If true, the "flat_mapped" engine reads the whole forest
+  file while the model is loaded, so that the first inferences do not wait for
+  the pages of the file to be read.
+
+flat_forest_cache_dir: If set, the "flat" and "flat_mapped" engines read the
+  flat forest of the model from the "<hash>.tfdf" file in this directory, where
+  <hash> is the hash of the content of the model directory, instead of building
+  it from the Yggdrasil model. If this file does not exist, it is created. The
+  directory can be shared by the restarts of a server, and by the servers
+  mounting the same volume, so that only the first load of a model builds its
+  forest. Does not affect the other engines.
+
+  Since the "flat_mapped" engine maps the file, a "flat_forest_cache_dir" in
+  shared memory (e.g. "/dev/shm/tfdf") is a host-wide store of the forests:
+  all the model server processes of the host map the same copy of each forest.
+
+release_unused_flat_forests: If true, the "flat_mapped" engine with a
+  "flat_forest_cache_dir" holds a shared lock on its forest file, and the last
+  process of the host using the file deletes it when it unloads the model (e.g.
+  its previous version). Otherwise, the files of the cache are never deleted.
+
+num_tree_shards: If more than 1, the model is distributed over
+  "num_tree_shards" servers, and this op only loads the "tree_shard_index"-th
+  contiguous range of its iterations (i.e. of its trees for a Random Forest).
+  The inference ops then return the partial, non-finalized, predictions of the
+  shard, to be reduced with "SimpleMLReduceTreeShards": the leaf value sums of
+  the shard (the logit for a binary classification GBT, averaged over all the
+  trees for a Random Forest), plus the initial predictions for the shard 0. Only
+  supported by the "flat", "flat_mapped" and "flat_quantized" engines.
+
+  Note: The forest of a shard is built from the whole Yggdrasil model, so the
+  peak memory of the load is that of the whole model, and only the trees of the
+  shard are kept. With "flat_forest_cache_dir", the "flat" and "flat_mapped"
+  engines save the forest of the shard, and the next loads of the shard (e.g.
+  by the other servers of a shared cache directory) read it without parsing the
+  Yggdrasil model. Likewise, the "flat_mapped" engine maps the
+  "flat_forest.tfdf.shard-<index>-of-<num_tree_shards>" file of the model
+  directory if it exists.
+
+tree_shard_index: Index of the tree shard loaded, if "num_tree_shards" is more
+  than 1. Should be less than "num_tree_shards".
+
+autotune_batch_sizes: Sizes of the batches the "autotune" engine measures the
+  engines on. The latency of an engine is its average time per example over
+  these batches, so they should match the sizes of the expected inference
+  calls.
+
+rf_leaf_top_k: If positive and less than the number of classes of a Random
+  Forest classifier, each leaf of the "flat" and "flat_mapped" engines only
+  keeps its "rf_leaf_top_k" largest class probabilities, and the others are
+  dropped. Speeds up the inference, and shrinks the leaves, of the models with
+  many classes, at the cost of slightly different predictions (the largest
+  probability dropped from a leaf is logged). Not supported by the
+  "flat_quantized" engine, nor by the model banks.
+
 Returns a type-less OP that loads the model when called.
 )");
 
 REGISTER_OP("SimpleMLLoadModelFromPathWithHandle")
     .SetIsStateful()
+    .Attr(
+        "inference_engine: {'auto', 'autotune', 'fast', 'flat', "
+        "'flat_mapped', 'flat_quantized', 'slow'} = 'auto'")
+    .Attr("prediction_cache_size: int >= 0 = 0")
+    .Attr("num_inference_threads: int >= 0 = 0")
+    .Attr("inference_threads_numa_node: int >= -1 = -1")
+    .Attr("use_huge_pages: bool = false")
+    .Attr("prefault_model_data: bool = false")
+    .Attr("flat_forest_cache_dir: string = ''")
+    .Attr("release_unused_flat_forests: bool = false")
+    .Attr("num_tree_shards: int >= 1 = 1")
+    .Attr("tree_shard_index: int >= 0 = 0")
+    .Attr("autotune_batch_sizes: list(int) = [1, 32, 256]")
+    .Attr("rf_leaf_top_k: int >= 0 = 0")
     .Input("model_handle: resource")
     .Input("path: string")
     .Doc(R"(
@@ -65,7 +202,88 @@ Similar to "SimpleMLLoadModelFromPath", but takes a resource handle instead of
 a resource name.
 )");
 
-Status SimpleMLInferenceOpSetShape(shape_inference::InferenceContext* c) {
+REGISTER_OP("SimpleMLLoadModelBankFromPaths")
+    .SetIsStateful()
+    .Attr("model_identifier: string")
+    .Input("paths: string")
+    .Doc(R"(
+Loads several Yggdrasil models in memory as a single model bank.
+
+The trees of all the models are packed in a single flat forest, and the bank is
+evaluated with "SimpleMLInferenceOpWithModelBank": a batch can mix examples
+of all the models, and is evaluated in one pass. The models should be decision
+forests compatible with the "flat" inference engine, and have the same task,
+input features, and label.
+
+The bank is accessible in the "kModelContainer/{model_identifier}" TF resource.
+If a model with the same "model_identifier" exists when this OP is called, the
+bank is not loaded.
+
+model_identifier: Unique identifier of the model bank.
+
+paths: Vector of paths to the Yggdrasil models. The model loaded from
+  "paths[i]" has the model id "i".
+)");
+
+REGISTER_OP("SimpleMLGenerateCompiledFlatForestSource")
+    .SetIsStateful()
+    .Input("path: string")
+    .Input("output_path: string")
+    .Doc(R"(
+Generates the C++ source of a compiled version of the flat forest of a model.
+
+Each tree is generated as nested if/else blocks. Once built as a shared library,
+e.g. with "c++ -O2 -shared -fPIC", and copied as "flat_forest_compiled.so" in
+the model directory, the library is used by the "flat" inference engine instead
+of the flat forest traversal. The library contains the fingerprint of the
+forest, and is ignored (with a warning) if it does not match the model.
+
+path: Path to the Yggdrasil model.
+
+output_path: Path to the generated C++ source file.
+)");
+
+REGISTER_OP("SimpleMLReduceTreeShards")
+    .Attr("N: int >= 1")
+    .Attr("finalization: {'identity', 'sigmoid_binary', 'softmax'}")
+    .Input("partial_predictions: N * float")
+    .Output("dense_predictions: float")
+    .SetShapeFn([](shape_inference::InferenceContext* c) {
+      ::tensorflow::shape_inference::ShapeHandle partial_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 2, &partial_shape));
+      std::string finalization;
+      TF_RETURN_IF_ERROR(c->GetAttr("finalization", &finalization));
+      c->set_output(
+          0, c->Matrix(c->Dim(partial_shape, 0),
+                       finalization == "sigmoid_binary"
+                           ? c->MakeDim(2)
+                           : c->Dim(partial_shape, 1)));
+      return Status::OK();
+    })
+    .Doc(R"(
+Reduces the partial predictions of the tree shards of a distributed model.
+
+Each server of a distributed model loads a shard of its trees (see the
+"num_tree_shards" attribute of "SimpleMLLoadModelFromPath"), and returns partial
+predictions. A coordinator, e.g. a graph calling the servers with
+"RemotePredict", sums them and finalizes the sum with this op.
+
+partial_predictions: The [batch_size, dim] partial predictions of all the
+  shards.
+
+finalization: How the summed partial predictions are finalized. "identity" for
+  the regressions and the Random Forests, "sigmoid_binary" for the binary
+  classification GBTs (the output is then [batch_size, 2]), and "softmax" for
+  the multi-class classification GBTs.
+
+dense_predictions: The predictions of the model, as returned by the inference
+  op of the whole model.
+)");
+
+// Sets the output shapes of an inference op. The batch size is read from the
+// first dimension of the inputs "batch_input_idxs".
+Status SetInferenceOpShape(shape_inference::InferenceContext* c,
+                           const std::initializer_list<int> batch_input_idxs) {
   // Check the rank of the input features.
   ::tensorflow::shape_inference::ShapeHandle tmp_shape;
   TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 2, &tmp_shape));
@@ -84,7 +302,7 @@ Status SimpleMLInferenceOpSetShape(shape_inference::InferenceContext* c) {
   // (at graph construction time), it is consistent in between the input
   // features.
   int known_batch_size = -1;
-  for (const auto input_idx : {0, 1, 2, 5}) {
+  for (const auto input_idx : batch_input_idxs) {
     auto candidate = c->Dim(c->input(input_idx), 0);
     if (c->ValueKnown(candidate)) {
       auto value = c->Value(candidate);
@@ -122,10 +340,27 @@ Status SimpleMLInferenceOpSetShape(shape_inference::InferenceContext* c) {
   return Status::OK();
 }
 
+Status SimpleMLInferenceOpSetShape(shape_inference::InferenceContext* c) {
+  return SetInferenceOpShape(c, {0, 1, 2, 5});
+}
+
+Status SimpleMLInferenceOpWithCategoricalStringsSetShape(
+    shape_inference::InferenceContext* c) {
+  ::tensorflow::shape_inference::ShapeHandle tmp_shape;
+  TF_RETURN_IF_ERROR(c->WithRank(c->input(6), 2, &tmp_shape));
+  return SetInferenceOpShape(c, {0, 1, 2, 5, 6});
+}
+
 REGISTER_OP("SimpleMLInferenceOp")
     .SetIsStateful()
     .Attr("model_identifier: string")
     .Attr("dense_output_dim: int >= 1")
+    .Attr("trace_stages: bool = false")
+    .Attr("max_num_inference_shards: int >= 1 = 1")
+    .Attr("max_num_trees: int >= 0 = 0")
+    .Attr("early_exit_margin: float = 0.0")
+    .Attr("max_batch_size: int >= 0 = 0")
+    .Attr("batch_timeout_micros: int >= 0 = 0")
     .Input("numerical_features: float")
     .Input("boolean_features: float")
     .Input("categorical_int_features: int32")
@@ -170,6 +405,37 @@ dense_output_dim: Dimension of the model output. For regression,
   dense_output_dim is the output dimension (e.g. 1 for uni-dimensional
   regression). For classification, dense_output_dim is the number of classes.
 
+trace_stages: If true, the wall time of the stages of the inference (input
+  linking, example staging, prediction, output export) is recorded in the
+  "/tensorflow/serving/tfdf/inference_stage_latency" histogram. The stages are
+  also recorded, for all the models, when running with "--v=2".
+
+max_num_inference_shards: Maximum number of shards a batch is split into. The
+  shards are evaluated in parallel on the CPU device worker threads. Batches are
+  only split in shards of at least 256 examples. Only supported by the fast
+  engines.
+
+max_num_trees: If positive, only the first "max_num_trees" trees of the model
+  are evaluated. For gradient boosted trees models with one tree per class and
+  iteration, the number of trees is rounded down to complete iterations. Only
+  supported by the flat forest engines.
+
+early_exit_margin: If positive, and for binary classification gradient boosted
+  trees models, the evaluation of a group of examples stops once the absolute
+  logit of all the examples exceeds "early_exit_margin", or once the remaining
+  trees cannot change their predicted class (at the 0.5 threshold). The
+  predicted probabilities are approximate. Only supported by the flat forest
+  engines.
+
+max_batch_size: If positive, concurrent calls of the op (i.e. of the same graph
+  node) are coalesced into a single evaluation of the model. A call waits for
+  other calls for up to "batch_timeout_micros", or until the coalesced calls
+  contain at least "max_batch_size" examples. Calls of "max_batch_size" examples
+  or more are evaluated alone.
+
+batch_timeout_micros: Maximum time, in microseconds, a call waits for other
+  calls to coalesce with. Only used if "max_batch_size" is positive.
+
 dense_predictions: Tensor of shape [batch x dense_output_dim] of type float32.
   Contains a probability for classification, and a value for regression and
   ranking.
@@ -177,7 +443,8 @@ dense_predictions: Tensor of shape [batch x dense_output_dim] of type float32.
 dense_col_representation: Tensor of shape [dense_output_dim] of type bytes.
   Contains the representation of the columns of the predictions output. For
   classification with string label, contains the name of the labels. For all
-  the other cases, contains empty strings.
+  the other cases, contains empty strings. This output is only produced if it is
+  consumed, and does not copy the pre-computed representation of the model.
 )");
 
 // Similar to "SimpleMLInferenceOp", but takes a resource handle instead of a
@@ -185,6 +452,12 @@ dense_col_representation: Tensor of shape [dense_output_dim] of type bytes.
 REGISTER_OP("SimpleMLInferenceOpWithHandle")
     .SetIsStateful()
     .Attr("dense_output_dim: int >= 1")
+    .Attr("trace_stages: bool = false")
+    .Attr("max_num_inference_shards: int >= 1 = 1")
+    .Attr("max_num_trees: int >= 0 = 0")
+    .Attr("early_exit_margin: float = 0.0")
+    .Attr("max_batch_size: int >= 0 = 0")
+    .Attr("batch_timeout_micros: int >= 0 = 0")
     .Input("numerical_features: float")
     .Input("boolean_features: float")
     .Input("categorical_int_features: int32")
@@ -196,6 +469,316 @@ REGISTER_OP("SimpleMLInferenceOpWithHandle")
     .Output("dense_col_representation: string")
     .SetShapeFn(SimpleMLInferenceOpSetShape);
 
+REGISTER_OP("SimpleMLInferenceOpWithModelBank")
+    .SetIsStateful()
+    .Attr("model_identifier: string")
+    .Attr("dense_output_dim: int >= 1")
+    .Attr("trace_stages: bool = false")
+    .Attr("max_num_inference_shards: int >= 1 = 1")
+    .Input("numerical_features: float")
+    .Input("boolean_features: float")
+    .Input("categorical_int_features: int32")
+    .Input("categorical_set_int_features_values: int32")
+    .Input("categorical_set_int_features_row_splits_dim_1: int64")
+    .Input("categorical_set_int_features_row_splits_dim_2: int64")
+    .Input("model_ids: int32")
+    .Output("dense_predictions: float")
+    .Output("dense_col_representation: string")
+    .SetShapeFn(SimpleMLInferenceOpSetShape)
+    .Doc(R"(
+Applies a model bank and returns its predictions.
+
+Similar to "SimpleMLInferenceOp", but for a model bank loaded with
+"SimpleMLLoadModelBankFromPaths". The "i-th" example is evaluated by the model
+with id "model_ids[i]".
+
+model_ids: Tensor of shape [batch] and type int32. Model id of each example.
+)");
+
+Status SimpleMLInferenceOpWithFeatureContributionsSetShape(
+    shape_inference::InferenceContext* c) {
+  TF_RETURN_IF_ERROR(SetInferenceOpShape(c, {0, 1, 2, 5}));
+  // The number of features and the accumulator dimension are only known from
+  // the model.
+  return c->set_output(
+      "feature_contributions",
+      {c->MakeShape({c->Dim(c->output(0), 0), c->UnknownDim(),
+                     c->UnknownDim()})});
+}
+
+Status SimpleMLInferenceOpWithLeavesSetShape(
+    shape_inference::InferenceContext* c) {
+  TF_RETURN_IF_ERROR(SetInferenceOpShape(c, {0, 1, 2, 5}));
+  // The number of trees is only known from the model.
+  return c->set_output(
+      "leaves", {c->Matrix(c->Dim(c->output(0), 0), c->UnknownDim())});
+}
+
+Status SimpleMLInferenceOpWithFeatureListSetShape(
+    shape_inference::InferenceContext* c) {
+  // The categorical set features are the last three inputs.
+  ::tensorflow::shape_inference::ShapeHandle tmp_shape;
+  for (int input_idx = c->num_inputs() - 3; input_idx < c->num_inputs();
+       input_idx++) {
+    TF_RETURN_IF_ERROR(c->WithRank(c->input(input_idx), 1, &tmp_shape));
+  }
+
+  // Each feature is a vector, or a matrix with a single column, of "batch"
+  // values.
+  shape_inference::DimensionHandle batch_size = c->UnknownDim();
+  for (const char* input_name :
+       {"numerical_feature_values", "boolean_feature_values",
+        "categorical_int_feature_values"}) {
+    std::vector<shape_inference::ShapeHandle> shapes;
+    TF_RETURN_IF_ERROR(c->input(input_name, &shapes));
+    for (const auto& shape : shapes) {
+      TF_RETURN_IF_ERROR(c->WithRankAtLeast(shape, 1, &tmp_shape));
+      TF_RETURN_IF_ERROR(c->WithRankAtMost(shape, 2, &tmp_shape));
+      TF_RETURN_IF_ERROR(c->Merge(batch_size, c->Dim(shape, 0), &batch_size));
+    }
+  }
+
+  int dense_output_dim;
+  TF_RETURN_IF_ERROR(c->GetAttr("dense_output_dim", &dense_output_dim));
+  TF_RETURN_IF_ERROR(c->set_output("dense_predictions",
+                                   {c->Matrix(batch_size, dense_output_dim)}));
+  TF_RETURN_IF_ERROR(
+      c->set_output("dense_col_representation", {c->Vector(dense_output_dim)}));
+  return Status::OK();
+}
+
+REGISTER_OP("SimpleMLInferenceOpWithFeatureList")
+    .SetIsStateful()
+    .Attr("model_identifier: string")
+    .Attr("dense_output_dim: int >= 1")
+    .Attr("trace_stages: bool = false")
+    .Attr("max_num_inference_shards: int >= 1 = 1")
+    .Attr("max_num_trees: int >= 0 = 0")
+    .Attr("early_exit_margin: float = 0.0")
+    .Attr("max_batch_size: int >= 0 = 0")
+    .Attr("batch_timeout_micros: int >= 0 = 0")
+    .Attr("Tnumerical: list({float, double, int32, int64}) >= 0")
+    .Attr("Tboolean: list({float, double, int32, int64}) >= 0")
+    .Attr("Tcategorical_int: list({int32, int64}) >= 0")
+    .Input("numerical_feature_values: Tnumerical")
+    .Input("boolean_feature_values: Tboolean")
+    .Input("categorical_int_feature_values: Tcategorical_int")
+    .Input("categorical_set_int_features_values: int32")
+    .Input("categorical_set_int_features_row_splits_dim_1: int64")
+    .Input("categorical_set_int_features_row_splits_dim_2: int64")
+    .Output("dense_predictions: float")
+    .Output("dense_col_representation: string")
+    .SetShapeFn(SimpleMLInferenceOpWithFeatureListSetShape)
+    .Doc(R"(
+Applies a model and returns its predictions.
+
+Similar to "SimpleMLInferenceOp", but the numerical, boolean and categorical int
+features are fed as one tensor per feature, in the order of their columns in
+the feature banks of "SimpleMLInferenceOp", instead of as pre-packed banks. The
+op packs and casts the features itself.
+
+numerical_feature_values: The numerical features. Each is a tensor of shape
+  [batch] or [batch, 1].
+
+boolean_feature_values: The boolean features. Each is a tensor of shape [batch]
+  or [batch, 1].
+
+categorical_int_feature_values: The categorical features, already converted to
+  integers. Each is a tensor of shape [batch] or [batch, 1].
+)");
+
+Status SimpleMLInferenceOpWithSparseNumericalFeaturesSetShape(
+    shape_inference::InferenceContext* c) {
+  ::tensorflow::shape_inference::ShapeHandle tmp_shape;
+  for (const int input_idx : {0, 1, 2, 5, 6, 7}) {
+    TF_RETURN_IF_ERROR(c->WithRank(c->input(input_idx), 1, &tmp_shape));
+  }
+  TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 2, &tmp_shape));
+  TF_RETURN_IF_ERROR(c->WithRank(c->input(4), 2, &tmp_shape));
+
+  // The row splits (inputs 2 and 7) have one more value than the batch size.
+  // The empty features are ignored.
+  shape_inference::DimensionHandle batch_size = c->UnknownDim();
+  for (const auto& input_idx_and_offset :
+       std::vector<std::pair<int, int>>{{2, 1}, {3, 0}, {4, 0}, {7, 1}}) {
+    const auto dim = c->Dim(c->input(input_idx_and_offset.first), 0);
+    if (!c->ValueKnown(dim)) {
+      continue;
+    }
+    const int64 value = c->Value(dim) - input_idx_and_offset.second;
+    if (value <= 0) {
+      continue;
+    }
+    TF_RETURN_IF_ERROR(c->Merge(batch_size, c->MakeDim(value), &batch_size));
+  }
+
+  int dense_output_dim;
+  TF_RETURN_IF_ERROR(c->GetAttr("dense_output_dim", &dense_output_dim));
+  TF_RETURN_IF_ERROR(c->set_output("dense_predictions",
+                                   {c->Matrix(batch_size, dense_output_dim)}));
+  TF_RETURN_IF_ERROR(
+      c->set_output("dense_col_representation", {c->Vector(dense_output_dim)}));
+  return Status::OK();
+}
+
+REGISTER_OP("SimpleMLInferenceOpWithSparseNumericalFeatures")
+    .SetIsStateful()
+    .Attr("model_identifier: string")
+    .Attr("dense_output_dim: int >= 1")
+    .Attr("trace_stages: bool = false")
+    .Attr("max_num_inference_shards: int >= 1 = 1")
+    .Attr("max_num_trees: int >= 0 = 0")
+    .Attr("early_exit_margin: float = 0.0")
+    .Attr("max_batch_size: int >= 0 = 0")
+    .Attr("batch_timeout_micros: int >= 0 = 0")
+    .Input("numerical_features_indices: int32")
+    .Input("numerical_features_values: float")
+    .Input("numerical_features_row_splits: int64")
+    .Input("boolean_features: float")
+    .Input("categorical_int_features: int32")
+    .Input("categorical_set_int_features_values: int32")
+    .Input("categorical_set_int_features_row_splits_dim_1: int64")
+    .Input("categorical_set_int_features_row_splits_dim_2: int64")
+    .Output("dense_predictions: float")
+    .Output("dense_col_representation: string")
+    .SetShapeFn(SimpleMLInferenceOpWithSparseNumericalFeaturesSetShape)
+    .Doc(R"(
+Applies a model and returns its predictions.
+
+Similar to "SimpleMLInferenceOp", but the numerical features are fed as a
+sparse matrix of shape "batch x numerical_features_dim" in the compressed sparse
+row (CSR) format, instead of as a dense bank. Only the present values are fed:
+the absent values are missing. For wide models with few numerical features set
+per example, the size of the inputs scales with the number of present values.
+
+numerical_features_indices: Tensor of shape [num_values] and type int32. The
+  column, in the dense numerical bank of "SimpleMLInferenceOp", of each value.
+
+numerical_features_values: Tensor of shape [num_values] and type float32. The
+  present values, example by example. A "Quiet Nan" value is also missing.
+
+numerical_features_row_splits: Tensor of shape [batch + 1] and type int64. The
+  values of the "i-th" example are "numerical_features_values[row_splits[i]:
+  row_splits[i+1]]", i.e. the "row_splits" of a ragged tensor. Can be empty if
+  the model has no numerical features.
+)");
+
+REGISTER_OP("SimpleMLInferenceOpWithFeatureContributions")
+    .SetIsStateful()
+    .Attr("model_identifier: string")
+    .Attr("dense_output_dim: int >= 1")
+    .Attr("trace_stages: bool = false")
+    .Attr("max_num_inference_shards: int >= 1 = 1")
+    .Attr("max_num_trees: int >= 0 = 0")
+    .Attr("early_exit_margin: float = 0.0")
+    .Attr("max_batch_size: int >= 0 = 0")
+    .Attr("batch_timeout_micros: int >= 0 = 0")
+    .Input("numerical_features: float")
+    .Input("boolean_features: float")
+    .Input("categorical_int_features: int32")
+    .Input("categorical_set_int_features_values: int32")
+    .Input("categorical_set_int_features_row_splits_dim_1: int64")
+    .Input("categorical_set_int_features_row_splits_dim_2: int64")
+    .Output("dense_predictions: float")
+    .Output("dense_col_representation: string")
+    .Output("feature_contributions: float")
+    .SetShapeFn(SimpleMLInferenceOpWithFeatureContributionsSetShape)
+    .Doc(R"(
+Applies a model and returns its predictions, and the contributions of the input
+features to the predictions.
+
+Similar to "SimpleMLInferenceOp", with the additional "feature_contributions"
+output. Only supported by the flat forest engines ("flat", "flat_mapped" and
+the compiled flat forests), and for models with the number of training examples
+of their nodes.
+
+feature_contributions: TreeSHAP values of the input features. Tensor of shape
+  "batch x (num_features + 1) x accumulator_dim" and type float32. The features
+  are the columns of "numerical_features", then "boolean_features", then
+  "categorical_int_features". The last row is the expected value of the model
+  (the bias). The rows of an example sum to the raw output of the model before
+  its activation, e.g. the logit of a binary classification gradient boosted
+  trees model ("accumulator_dim" is 1), or the averaged leaf values of a random
+  forest ("accumulator_dim" is the number of classes). The contributions are
+  computed on the first "max_num_trees" trees, and ignore "early_exit_margin".
+  The evaluation is sharded as the predictions (see "max_num_inference_shards"),
+  with shards of at least 16 examples.
+)");
+
+REGISTER_OP("SimpleMLInferenceOpWithLeaves")
+    .SetIsStateful()
+    .Attr("model_identifier: string")
+    .Attr("dense_output_dim: int >= 1")
+    .Attr("trace_stages: bool = false")
+    .Attr("max_num_inference_shards: int >= 1 = 1")
+    .Attr("max_num_trees: int >= 0 = 0")
+    .Attr("early_exit_margin: float = 0.0")
+    .Input("numerical_features: float")
+    .Input("boolean_features: float")
+    .Input("categorical_int_features: int32")
+    .Input("categorical_set_int_features_values: int32")
+    .Input("categorical_set_int_features_row_splits_dim_1: int64")
+    .Input("categorical_set_int_features_row_splits_dim_2: int64")
+    .Output("dense_predictions: float")
+    .Output("dense_col_representation: string")
+    .Output("leaves: int32")
+    .SetShapeFn(SimpleMLInferenceOpWithLeavesSetShape)
+    .Doc(R"(
+Applies a model and returns its predictions, and the leaves reached by the
+examples.
+
+Similar to "SimpleMLInferenceOp", with the additional "leaves" output. The
+leaves are collected while the trees are traversed for the predictions. Only
+supported by the "flat" and "flat_mapped" engines. The calls are neither
+coalesced nor cached.
+
+leaves: Index of the leaf reached by each example in each tree. Tensor of shape
+  "batch x num_trees" and type int32. The leaves of a tree are numbered from 0
+  in breadth-first order, i.e. the indices of a tree are less than its number of
+  leaves. The trees not evaluated because of "max_num_trees" or
+  "early_exit_margin" have a leaf index of -1.
+)");
+
+REGISTER_OP("SimpleMLInferenceOpWithCategoricalStrings")
+    .SetIsStateful()
+    .Attr("model_identifier: string")
+    .Attr("dense_output_dim: int >= 1")
+    .Attr("trace_stages: bool = false")
+    .Attr("max_num_inference_shards: int >= 1 = 1")
+    .Attr("max_num_trees: int >= 0 = 0")
+    .Attr("early_exit_margin: float = 0.0")
+    .Attr("max_batch_size: int >= 0 = 0")
+    .Attr("batch_timeout_micros: int >= 0 = 0")
+    .Input("numerical_features: float")
+    .Input("boolean_features: float")
+    .Input("categorical_int_features: int32")
+    .Input("categorical_set_int_features_values: int32")
+    .Input("categorical_set_int_features_row_splits_dim_1: int64")
+    .Input("categorical_set_int_features_row_splits_dim_2: int64")
+    .Input("categorical_string_features: string")
+    .Output("dense_predictions: float")
+    .Output("dense_col_representation: string")
+    .SetShapeFn(SimpleMLInferenceOpWithCategoricalStringsSetShape)
+    .Doc(R"(
+Applies a model and returns its predictions.
+
+Similar to "SimpleMLInferenceOp", but the categorical features which are not
+already integerized are fed as strings, and resolved with the dictionaries of
+the model, instead of with one lookup table op per feature.
+
+categorical_int_features: Tensor of shape "batch x
+  categorical_int_features_dim" and type int32, or of shape [0, 0] if all the
+  categorical features have a dictionary. The values of the features with a
+  dictionary are ignored.
+
+categorical_string_features: Tensor of shape "batch x
+  categorical_int_features_dim" and type string, or of shape [0, 0] if no
+  feature is fed as string. The values of the features with a dictionary. An
+  empty string represents a missing value, and strings outside of the
+  dictionary are "out of vocabulary". The values of the already integerized
+  features are ignored.
+)");
+
 Status ScalarOutput(shape_inference::InferenceContext* c) {
   c->set_output(0, c->Scalar());
   return Status::OK();
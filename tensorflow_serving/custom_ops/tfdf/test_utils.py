@@ -253,8 +253,23 @@ def build_toy_random_forest(path,
         output_file.write(node.SerializeToString())
 
 
-def build_toy_gbdt(path, num_classes):
-  """Creates a toy GBDT model compatible with _build_toy_data_spec."""
+def build_toy_gbdt(path,
+                   num_classes,
+                   with_node_covers=False,
+                   leaf_offset=0.0,
+                   num_iters=2):
+  """Creates a toy GBDT model compatible with _build_toy_data_spec.
+
+  Args:
+    path: Directory of the model.
+    num_classes: Number of classes of the label.
+    with_node_covers: If true, the conditions contain their number of training
+      examples: 4 examples, 3 of them with a > 1.
+    leaf_offset: Value added to all the leaf values e.g. to create models with
+      the same structure and different leaves.
+    num_iters: Number of iterations. The leaf values are scaled by
+      2 / num_iters, so that the predictions do not depend on it.
+  """
 
   logging.info("Create toy model in %s", path)
 
@@ -275,7 +290,7 @@ def build_toy_gbdt(path, num_classes):
   with tf.io.gfile.GFile(os.path.join(path, "header.pb"), "w") as f:
     f.write(header.SerializeToString())
 
-  num_iters = 2
+  leaf_scale = 2.0 / num_iters
   num_trees_per_iter = 1 if num_classes == 2 else num_classes
 
   rf_header = gradient_boosted_trees_pb2.Header(
@@ -325,18 +340,25 @@ def build_toy_gbdt(path, num_classes):
                     higher_condition=decision_tree_pb2.Condition.Higher(
                         threshold=1.0)),
             ))
+        if with_node_covers:
+          node.condition.num_training_examples_without_weight = 4
+          node.condition.num_training_examples_with_weight = 4.0
+          node.condition.num_pos_training_examples_without_weight = 3
+          node.condition.num_pos_training_examples_with_weight = 3.0
         output_file.write(node.SerializeToString())
 
         # Node 1
         node = decision_tree_pb2.Node(
-            regressor=decision_tree_pb2.NodeRegressorOutput(top_value=1.0 +
-                                                            tree_in_iter_idx))
+            regressor=decision_tree_pb2.NodeRegressorOutput(
+                top_value=(1.0 + tree_in_iter_idx + leaf_offset) *
+                leaf_scale))
         output_file.write(node.SerializeToString())
 
         # Node 2
         node = decision_tree_pb2.Node(
             regressor=decision_tree_pb2.NodeRegressorOutput(
-                top_value=5.0 + tree_in_iter_idx * tree_in_iter_idx))
+                top_value=(5.0 + tree_in_iter_idx * tree_in_iter_idx +
+                           leaf_offset) * leaf_scale))
         output_file.write(node.SerializeToString())
 
 
@@ -16,9 +16,15 @@ from __future__ import absolute_import
 from __future__ import division
 from __future__ import print_function
 
+import gc
 import os
+import shutil
+import subprocess
 import tempfile
+import threading
+import time
 
+import numpy as np
 import tensorflow.compat.v1 as tf
 
 from tensorflow_decision_forests.tensorflow.ops.inference import api as inference
@@ -211,6 +217,1132 @@ class TfOpTest(parameterized.TestCase, tf.test.TestCase):
         self.assertAllEqual(dense_col_representation_values, expected_classes)
         self.assertAllClose(dense_predictions_values, expected_proba)
 
+  @parameterized.named_parameters(
+      ("rf_wta", "rf_wta", "flat"),
+      ("rf_weighted", "rf_weighted", "flat"),
+      ("gbdt_binary", "gbdt_binary", "flat"),
+      ("gbdt_multiclass", "gbdt_multiclass", "flat"),
+      ("rf_wta_quantized", "rf_wta", "flat_quantized"),
+      ("rf_weighted_quantized", "rf_weighted", "flat_quantized"),
+      ("gbdt_binary_quantized", "gbdt_binary", "flat_quantized"),
+      ("gbdt_multiclass_quantized", "gbdt_multiclass", "flat_quantized"),
+  )
+  def test_toy_flat_engine(self, toy_model, inference_engine):
+
+    with tf.Graph().as_default():
+      # Create toy model.
+      model_path = os.path.join(
+          tempfile.mkdtemp(dir=self.get_temp_dir()), "test_flat_" + toy_model)
+      if toy_model == "rf_wta":
+        test_utils.build_toy_random_forest(
+            model_path, winner_take_all_inference=True)
+        expected_proba, expected_classes = (
+            test_utils.expected_toy_predictions_rf_wta())
+      elif toy_model == "rf_weighted":
+        test_utils.build_toy_random_forest(
+            model_path, winner_take_all_inference=False)
+        expected_proba, expected_classes = (
+            test_utils.expected_toy_predictions_rf_weighted())
+      elif toy_model == "gbdt_binary":
+        test_utils.build_toy_gbdt(model_path, num_classes=2)
+        expected_proba, expected_classes = (
+            test_utils.expected_toy_predictions_gbdt_binary())
+      else:
+        test_utils.build_toy_gbdt(model_path, num_classes=3)
+        expected_proba, expected_classes = (
+            test_utils.expected_toy_predictions_gbdt_multiclass())
+      features = test_utils.build_toy_input_features()
+
+      # Prepare model.
+      model = inference.Model(model_path, inference_engine=inference_engine)
+      predictions = model.apply(features)
+
+      # Run model on toy dataset.
+      with self.session() as sess:
+        sess.run(model.init_op())
+
+        dense_predictions_values, dense_col_representation_values = sess.run([
+            predictions.dense_predictions, predictions.dense_col_representation
+        ], test_utils.build_toy_input_feature_values(features))
+        logging.info("dense_predictions_values: %s", dense_predictions_values)
+
+        self.assertAllEqual(dense_col_representation_values, expected_classes)
+        self.assertAllClose(dense_predictions_values, expected_proba)
+
+  def test_toy_flat_engine_simd_traversal(self):
+
+    with tf.Graph().as_default():
+      # The conditions of the model are all numerical "higher" conditions, so
+      # the groups of 8 examples are traversed with SIMD instructions (if the
+      # CPU supports them), and the examples left over with scalar ones.
+      model_path = os.path.join(
+          tempfile.mkdtemp(dir=self.get_temp_dir()), "test_simd_traversal")
+      test_utils.build_toy_gbdt(model_path, num_classes=2)
+      expected_proba, _ = test_utils.expected_toy_predictions_gbdt_binary()
+      positive_proba, negative_proba = expected_proba[0], expected_proba[2]
+      features = test_utils.build_toy_input_features()
+
+      model = inference.Model(model_path, inference_engine="flat")
+      predictions = model.apply(features)
+
+      # Values on both sides of the threshold (1.0) of the condition, and
+      # missing values, which are negative.
+      values = [
+          0.5, 1.0, 2.0, float("nan"), -float("inf"), float("inf"), 0.99999994,
+          1.0000001, -1.0, 0.0
+      ]
+      # 20 examples: Two groups of 8, and 4 more.
+      a_values = values * 2
+      expected_values = [
+          positive_proba if value >= 1.0 else negative_proba
+          for value in a_values
+      ]
+
+      def feature_values(a):
+        return {
+            features["a"]: a,
+            features["b"]: ["x"] * len(a),
+            features["c"]: [1] * len(a),
+            features["bool_feature"]: [1] * len(a)
+        }
+
+      with self.session() as sess:
+        sess.run(model.init_op())
+
+        batch_values = sess.run(predictions.dense_predictions,
+                                feature_values(a_values))
+        self.assertAllClose(batch_values, expected_values)
+
+        # The examples evaluated one at a time only use the scalar traversal.
+        for example_idx, value in enumerate(a_values):
+          example_values = sess.run(predictions.dense_predictions,
+                                    feature_values([value]))
+          self.assertAllEqual(example_values[0], batch_values[example_idx])
+
+  @parameterized.named_parameters(("flat", "flat"),
+                                  ("flat_quantized", "flat_quantized"))
+  def test_toy_flat_engine_categorical_set(self, inference_engine):
+
+    with tf.Graph().as_default():
+      # The "contains" conditions on the categorical set features are
+      # evaluated with the bitmaps of the flat forest.
+      model_path = os.path.join(
+          tempfile.mkdtemp(dir=self.get_temp_dir()), "test_flat_catset")
+      test_utils.build_toy_random_forest(
+          model_path, winner_take_all_inference=True, has_catset=True)
+      expected_proba, expected_classes = (
+          test_utils.expected_toy_predictions_rf_wta(has_catset=True))
+      features = test_utils.build_toy_input_features(has_catset=True)
+
+      model = inference.Model(model_path, inference_engine=inference_engine)
+      predictions = model.apply(features)
+
+      with self.session() as sess:
+        sess.run(model.init_op())
+
+        dense_predictions_values, dense_col_representation_values = sess.run(
+            [
+                predictions.dense_predictions,
+                predictions.dense_col_representation
+            ],
+            test_utils.build_toy_input_feature_values(
+                features, has_catset=True))
+
+        self.assertAllEqual(dense_col_representation_values, expected_classes)
+        self.assertAllClose(dense_predictions_values, expected_proba)
+
+  @parameterized.named_parameters(("flat", "flat"),
+                                  ("flat_mapped", "flat_mapped"))
+  def test_toy_rf_leaf_top_k(self, inference_engine):
+
+    with tf.Graph().as_default():
+      # The winner-take-all leaves have a single non-zero probability, so the
+      # sparse leaves with the largest probability give the same predictions.
+      model_path = os.path.join(
+          tempfile.mkdtemp(dir=self.get_temp_dir()), "test_rf_leaf_top_k")
+      test_utils.build_toy_random_forest(
+          model_path, winner_take_all_inference=True)
+      expected_proba, expected_classes = (
+          test_utils.expected_toy_predictions_rf_wta())
+      features = test_utils.build_toy_input_features()
+
+      model = inference.Model(
+          model_path, inference_engine=inference_engine, rf_leaf_top_k=1)
+      predictions = model.apply(features)
+
+      with self.session() as sess:
+        sess.run(model.init_op())
+
+        dense_predictions_values, dense_col_representation_values = sess.run([
+            predictions.dense_predictions, predictions.dense_col_representation
+        ], test_utils.build_toy_input_feature_values(features))
+
+        self.assertAllEqual(dense_col_representation_values, expected_classes)
+        self.assertAllClose(dense_predictions_values, expected_proba)
+
+  @parameterized.named_parameters(("flat", "flat"),
+                                  ("flat_mapped", "flat_mapped"))
+  def test_toy_rf_leaf_top_k_weighted(self, inference_engine):
+
+    with tf.Graph().as_default():
+      # The leaves keep their two largest probabilities (the lowest class on
+      # ties), and the third one is dropped from the predictions.
+      model_path = os.path.join(
+          tempfile.mkdtemp(dir=self.get_temp_dir()),
+          "test_rf_leaf_top_k_weighted")
+      test_utils.build_toy_random_forest(
+          model_path, winner_take_all_inference=False)
+      expected_proba = [[0.0, 0.5, 0.5], [0.5, 0.5, 0.0], [0.1, 0.8, 0.0],
+                        [0.8, 0.1, 0.0]]
+      features = test_utils.build_toy_input_features()
+
+      model = inference.Model(
+          model_path, inference_engine=inference_engine, rf_leaf_top_k=2)
+      predictions = model.apply(features)
+
+      with self.session() as sess:
+        sess.run(model.init_op())
+
+        dense_predictions_values = sess.run(
+            predictions.dense_predictions,
+            test_utils.build_toy_input_feature_values(features))
+
+        self.assertAllClose(dense_predictions_values, expected_proba)
+
+  @parameterized.named_parameters(("default", False), ("prefault", True))
+  def test_toy_flat_mapped_engine(self, prefault_model_data):
+
+    model_path = os.path.join(
+        tempfile.mkdtemp(dir=self.get_temp_dir()), "test_flat_mapped")
+    test_utils.build_toy_gbdt(model_path, num_classes=2)
+    expected_proba, expected_classes = (
+        test_utils.expected_toy_predictions_gbdt_binary())
+
+    # The model directory is not written: both loads build the forest.
+    for _ in range(2):
+      with tf.Graph().as_default():
+        features = test_utils.build_toy_input_features()
+        model = inference.Model(
+            model_path,
+            inference_engine="flat_mapped",
+            prefault_model_data=prefault_model_data)
+        predictions = model.apply(features)
+
+        with self.session() as sess:
+          sess.run(model.init_op())
+
+          dense_predictions_values, dense_col_representation_values = sess.run(
+              [
+                  predictions.dense_predictions,
+                  predictions.dense_col_representation
+              ], test_utils.build_toy_input_feature_values(features))
+
+          self.assertAllEqual(dense_col_representation_values,
+                              expected_classes)
+          self.assertAllClose(dense_predictions_values, expected_proba)
+
+      self.assertFalse(
+          os.path.exists(os.path.join(model_path, "flat_forest.tfdf")))
+
+  @parameterized.named_parameters(("rf_wta", "rf_wta"),
+                                  ("gbdt_binary", "gbdt_binary"),
+                                  ("gbdt_multiclass", "gbdt_multiclass"))
+  def test_toy_autotune_engine(self, toy_model):
+
+    model_path = os.path.join(
+        tempfile.mkdtemp(dir=self.get_temp_dir()), "test_autotune_" + toy_model)
+    if toy_model == "rf_wta":
+      test_utils.build_toy_random_forest(
+          model_path, winner_take_all_inference=True)
+      expected_proba, expected_classes = (
+          test_utils.expected_toy_predictions_rf_wta())
+    elif toy_model == "gbdt_binary":
+      test_utils.build_toy_gbdt(model_path, num_classes=2)
+      expected_proba, expected_classes = (
+          test_utils.expected_toy_predictions_gbdt_binary())
+    else:
+      test_utils.build_toy_gbdt(model_path, num_classes=3)
+      expected_proba, expected_classes = (
+          test_utils.expected_toy_predictions_gbdt_multiclass())
+    autotune_path = os.path.join(model_path, "flat_forest.tfdf.autotune")
+
+    # The first load autotunes the engine, and the second load reuses it.
+    for _ in range(2):
+      with tf.Graph().as_default():
+        features = test_utils.build_toy_input_features()
+        model = inference.Model(
+            model_path,
+            inference_engine="autotune",
+            autotune_batch_sizes=[1, 4])
+        predictions = model.apply(features)
+
+        with self.session() as sess:
+          sess.run(model.init_op())
+
+          dense_predictions_values, dense_col_representation_values = sess.run(
+              [
+                  predictions.dense_predictions,
+                  predictions.dense_col_representation
+              ], test_utils.build_toy_input_feature_values(features))
+
+          self.assertAllEqual(dense_col_representation_values,
+                              expected_classes)
+          self.assertAllClose(dense_predictions_values, expected_proba)
+
+      with open(autotune_path) as autotune_file:
+        autotuned_engine = autotune_file.read().split("\n")[-1]
+      self.assertIn(autotuned_engine, ["flat", "flat_quantized", "fast"])
+
+  @parameterized.named_parameters(("flat", "flat", False),
+                                  ("flat_mapped", "flat_mapped", False),
+                                  ("flat_mapped_release", "flat_mapped", True))
+  def test_toy_flat_forest_cache(self, inference_engine,
+                                 release_unused_flat_forests):
+
+    temp_dir = tempfile.mkdtemp(dir=self.get_temp_dir())
+    cache_dir = os.path.join(temp_dir, "cache")
+    expected_proba, expected_classes = (
+        test_utils.expected_toy_predictions_gbdt_binary())
+
+    # Two copies of the same model share the same cached flat forest.
+    cached_file_stat = None
+    for copy_idx in range(2):
+      model_path = os.path.join(temp_dir, "model_{}".format(copy_idx))
+      test_utils.build_toy_gbdt(model_path, num_classes=2)
+      with tf.Graph().as_default():
+        features = test_utils.build_toy_input_features()
+        model = inference.Model(
+            model_path,
+            inference_engine=inference_engine,
+            flat_forest_cache_dir=cache_dir,
+            release_unused_flat_forests=release_unused_flat_forests)
+        predictions = model.apply(features)
+
+        with self.session() as sess:
+          sess.run(model.init_op())
+
+          dense_predictions_values, dense_col_representation_values = sess.run(
+              [
+                  predictions.dense_predictions,
+                  predictions.dense_col_representation
+              ], test_utils.build_toy_input_feature_values(features))
+
+          self.assertAllEqual(dense_col_representation_values,
+                              expected_classes)
+          self.assertAllClose(dense_predictions_values, expected_proba)
+
+          # Note: With "release_unused_flat_forests", the file is only
+          # guaranteed to exist while the model is loaded.
+          cached_files = os.listdir(cache_dir)
+          self.assertLen(cached_files, 1)
+          self.assertTrue(cached_files[0].endswith(".tfdf"))
+
+          # The second copy opens the file written by the first one, instead
+          # of writing it again.
+          if not release_unused_flat_forests:
+            stat = os.stat(os.path.join(cache_dir, cached_files[0]))
+            if cached_file_stat is None:
+              cached_file_stat = stat
+            else:
+              self.assertEqual(stat.st_ino, cached_file_stat.st_ino)
+              self.assertEqual(stat.st_mtime_ns, cached_file_stat.st_mtime_ns)
+
+      self.assertFalse(
+          os.path.exists(os.path.join(model_path, "flat_forest.tfdf")))
+
+  def test_toy_flat_forest_cache_of_another_model(self):
+
+    temp_dir = tempfile.mkdtemp(dir=self.get_temp_dir())
+    cache_dir = os.path.join(temp_dir, "cache")
+    binary_model_path = os.path.join(temp_dir, "binary_model")
+    multiclass_model_path = os.path.join(temp_dir, "multiclass_model")
+    test_utils.build_toy_gbdt(binary_model_path, num_classes=2)
+    test_utils.build_toy_gbdt(multiclass_model_path, num_classes=3)
+
+    def predict(model_path):
+      with tf.Graph().as_default():
+        features = test_utils.build_toy_input_features()
+        model = inference.Model(
+            model_path,
+            inference_engine="flat_mapped",
+            flat_forest_cache_dir=cache_dir)
+        predictions = model.apply(features)
+        with self.session() as sess:
+          sess.run(model.init_op())
+          return sess.run([
+              predictions.dense_predictions,
+              predictions.dense_col_representation
+          ], test_utils.build_toy_input_feature_values(features))
+
+    predict(binary_model_path)
+    (binary_file,) = os.listdir(cache_dir)
+    predict(multiclass_model_path)
+    (multiclass_file,) = set(os.listdir(cache_dir)) - {binary_file}
+
+    # Simulates a collision of the names of the cached files: the file of the
+    # multiclass model is replaced with the one of the binary model, which is
+    # detected and neither used nor overwritten.
+    with open(os.path.join(cache_dir, binary_file), "rb") as f:
+      binary_file_content = f.read()
+    os.replace(
+        os.path.join(cache_dir, binary_file),
+        os.path.join(cache_dir, multiclass_file))
+    dense_predictions_values, dense_col_representation_values = predict(
+        multiclass_model_path)
+    expected_proba, expected_classes = (
+        test_utils.expected_toy_predictions_gbdt_multiclass())
+    self.assertAllEqual(dense_col_representation_values, expected_classes)
+    self.assertAllClose(dense_predictions_values, expected_proba)
+    with open(os.path.join(cache_dir, multiclass_file), "rb") as f:
+      self.assertEqual(f.read(), binary_file_content)
+
+  def test_toy_release_unused_flat_forests(self):
+
+    temp_dir = tempfile.mkdtemp(dir=self.get_temp_dir())
+    cache_dir = os.path.join(temp_dir, "cache")
+    model_path = os.path.join(temp_dir, "model")
+    test_utils.build_toy_gbdt(model_path, num_classes=2)
+
+    def load_model():
+      graph = tf.Graph()
+      with graph.as_default():
+        model = inference.Model(
+            model_path,
+            inference_engine="flat_mapped",
+            flat_forest_cache_dir=cache_dir,
+            release_unused_flat_forests=True)
+        init_op = model.init_op()
+      sess = tf.Session(graph=graph)
+      sess.run(init_op)
+      return sess
+
+    # Both sessions, e.g. of two processes, map and lock the same file.
+    first_sess = load_model()
+    second_sess = load_model()
+    self.assertLen(os.listdir(cache_dir), 1)
+
+    # The file is deleted when the last session using it unloads its model.
+    # Note: The model is deleted with its session, and released in the
+    # background.
+    first_sess.close()
+    del first_sess
+    gc.collect()
+    self.assertLen(os.listdir(cache_dir), 1)
+    second_sess.close()
+    del second_sess
+    gc.collect()
+    deadline = time.time() + 10
+    while os.listdir(cache_dir) and time.time() < deadline:
+      time.sleep(0.01)
+    self.assertEmpty(os.listdir(cache_dir))
+
+  @parameterized.named_parameters(("binary", 2, "flat"),
+                                  ("multiclass", 3, "flat"),
+                                  ("binary_quantized", 2, "flat_quantized"))
+  def test_toy_gbdt_tree_shards(self, num_classes, inference_engine):
+
+    with tf.Graph().as_default():
+      model_path = os.path.join(
+          tempfile.mkdtemp(dir=self.get_temp_dir()), "test_tree_shards")
+      test_utils.build_toy_gbdt(model_path, num_classes=num_classes)
+      if num_classes == 2:
+        expected_proba, _ = test_utils.expected_toy_predictions_gbdt_binary()
+      else:
+        expected_proba, _ = (
+            test_utils.expected_toy_predictions_gbdt_multiclass())
+      features = test_utils.build_toy_input_features()
+
+      # Each shard contains one of the two iterations of the model.
+      num_tree_shards = 2
+      shard_models = [
+          inference.Model(
+              model_path,
+              inference_engine=inference_engine,
+              num_tree_shards=num_tree_shards,
+              tree_shard_index=shard_idx)
+          for shard_idx in range(num_tree_shards)
+      ]
+      partial_predictions = [
+          model.apply(features).dense_predictions for model in shard_models
+      ]
+      predictions = inference.reduce_tree_shards(
+          partial_predictions, inference.tree_shard_finalization(model_path))
+
+      with self.session() as sess:
+        sess.run([model.init_op() for model in shard_models])
+        predictions_values = sess.run(
+            predictions, test_utils.build_toy_input_feature_values(features))
+        self.assertAllClose(predictions_values, expected_proba)
+
+  def test_toy_flat_engine_shared_structure(self):
+
+    # Two versions of a model with the same trees and different leaves. The
+    # second version shares the nodes of the first one, and keeps its leaves.
+    temp_dir = tempfile.mkdtemp(dir=self.get_temp_dir())
+    v1_path = os.path.join(temp_dir, "v1")
+    v2_path = os.path.join(temp_dir, "v2")
+    test_utils.build_toy_gbdt(v1_path, num_classes=2)
+    test_utils.build_toy_gbdt(v2_path, num_classes=2, leaf_offset=-1.0)
+    v1_expected_proba, expected_classes = (
+        test_utils.expected_toy_predictions_gbdt_binary())
+    # logit = 1.0 + (5.0 - 1.0) * 2 = 9.0 if a > 1, and 1.0 otherwise.
+    v2_expected_proba = [[1.234e-04, 0.9998766], [1.234e-04, 0.9998766],
+                         [0.2689414, 0.7310586], [0.2689414, 0.7310586]]
+
+    with tf.Graph().as_default():
+      features = test_utils.build_toy_input_features()
+      v1_model = inference.Model(v1_path, inference_engine="flat")
+      v2_model = inference.Model(v2_path, inference_engine="flat")
+      v1_predictions = v1_model.apply(features)
+      v2_predictions = v2_model.apply(features)
+
+      with self.session() as sess:
+        sess.run([v1_model.init_op(), v2_model.init_op()])
+
+        (v1_proba_values, v2_proba_values,
+         dense_col_representation_values) = sess.run(
+             [
+                 v1_predictions.dense_predictions,
+                 v2_predictions.dense_predictions,
+                 v2_predictions.dense_col_representation
+             ], test_utils.build_toy_input_feature_values(features))
+
+        self.assertAllEqual(dense_col_representation_values, expected_classes)
+        self.assertAllClose(v1_proba_values, v1_expected_proba)
+        self.assertAllClose(v2_proba_values, v2_expected_proba)
+
+  @parameterized.named_parameters(("flat", "flat"),
+                                  ("flat_mapped", "flat_mapped"))
+  def test_toy_huge_pages(self, inference_engine):
+
+    with tf.Graph().as_default():
+      model_path = os.path.join(
+          tempfile.mkdtemp(dir=self.get_temp_dir()), "test_huge_pages")
+      test_utils.build_toy_gbdt(model_path, num_classes=2)
+      expected_proba, expected_classes = (
+          test_utils.expected_toy_predictions_gbdt_binary())
+      features = test_utils.build_toy_input_features()
+
+      model = inference.Model(
+          model_path, inference_engine=inference_engine, use_huge_pages=True)
+      predictions = model.apply(features)
+
+      with self.session() as sess:
+        sess.run(model.init_op())
+
+        dense_predictions_values, dense_col_representation_values = sess.run([
+            predictions.dense_predictions, predictions.dense_col_representation
+        ], test_utils.build_toy_input_feature_values(features))
+
+        self.assertAllEqual(dense_col_representation_values, expected_classes)
+        self.assertAllClose(dense_predictions_values, expected_proba)
+
+  @parameterized.named_parameters(("auto", "auto"), ("flat", "flat"))
+  def test_toy_categorical_strings(self, inference_engine):
+
+    with tf.Graph().as_default():
+      model_path = os.path.join(
+          tempfile.mkdtemp(dir=self.get_temp_dir()), "test_categorical_strings")
+      test_utils.build_toy_random_forest(
+          model_path, winner_take_all_inference=True)
+      expected_proba, expected_classes = (
+          test_utils.expected_toy_predictions_rf_wta())
+      features = test_utils.build_toy_input_features()
+
+      # The string feature "b" is resolved by the inference op.
+      model = inference.Model(
+          model_path,
+          inference_engine=inference_engine,
+          categorical_strings=True)
+      predictions = model.apply(features)
+
+      with self.session() as sess:
+        sess.run(model.init_op())
+
+        dense_predictions_values, dense_col_representation_values = sess.run([
+            predictions.dense_predictions, predictions.dense_col_representation
+        ], test_utils.build_toy_input_feature_values(features))
+
+        self.assertAllEqual(dense_col_representation_values, expected_classes)
+        self.assertAllClose(dense_predictions_values, expected_proba)
+
+  @parameterized.named_parameters(
+      ("rf_wta", "rf_wta", "auto"),
+      ("gbdt_binary", "gbdt_binary", "auto"),
+      ("gbdt_binary_flat", "gbdt_binary", "flat"),
+  )
+  def test_toy_pack_features_in_op(self, toy_model, inference_engine):
+
+    with tf.Graph().as_default():
+      model_path = os.path.join(
+          tempfile.mkdtemp(dir=self.get_temp_dir()), "test_pack_" + toy_model)
+      if toy_model == "rf_wta":
+        test_utils.build_toy_random_forest(
+            model_path, winner_take_all_inference=True)
+        expected_proba, expected_classes = (
+            test_utils.expected_toy_predictions_rf_wta())
+      else:
+        test_utils.build_toy_gbdt(model_path, num_classes=2)
+        expected_proba, expected_classes = (
+            test_utils.expected_toy_predictions_gbdt_binary())
+      # The int64 feature "c" is cast by the inference op.
+      features = test_utils.build_toy_input_features(use_rank_two=True)
+
+      model = inference.Model(
+          model_path,
+          inference_engine=inference_engine,
+          pack_features_in_op=True)
+      predictions = model.apply(features)
+
+      with self.session() as sess:
+        sess.run(model.init_op())
+
+        dense_predictions_values, dense_col_representation_values = sess.run(
+            [
+                predictions.dense_predictions,
+                predictions.dense_col_representation
+            ],
+            test_utils.build_toy_input_feature_values(
+                features, use_rank_two=True))
+
+        self.assertAllEqual(dense_col_representation_values, expected_classes)
+        self.assertAllClose(dense_predictions_values, expected_proba)
+
+  @parameterized.named_parameters(("auto", "auto"), ("flat", "flat"))
+  def test_toy_sparse_numerical_features(self, inference_engine):
+
+    with tf.Graph().as_default():
+      model_path = os.path.join(
+          tempfile.mkdtemp(dir=self.get_temp_dir()), "test_sparse_numerical")
+      test_utils.build_toy_random_forest(
+          model_path, winner_take_all_inference=True)
+      features = test_utils.build_toy_input_features()
+
+      model = inference.Model(model_path, inference_engine=inference_engine)
+      self.assertEqual(model.input_builder.numerical_feature_names(), ["a"])
+      dense_predictions = model.apply(features)
+
+      # "a" is only present in the first two examples.
+      numerical_features = tf.SparseTensor(
+          indices=[[1, 0], [0, 0]], values=[2.0, 2.0], dense_shape=[4, 1])
+      sparse_features = {k: v for k, v in features.items() if k != "a"}
+      sparse_predictions = model.apply_with_sparse_numerical_features(
+          sparse_features, numerical_features)
+
+      with self.session() as sess:
+        sess.run(model.init_op())
+
+        feature_values = test_utils.build_toy_input_feature_values(features)
+        feature_values[features["a"]] = [2, 2, float("nan"), float("nan")]
+        expected_proba, sparse_proba, sparse_classes = sess.run([
+            dense_predictions.dense_predictions,
+            sparse_predictions.dense_predictions,
+            sparse_predictions.dense_col_representation
+        ], feature_values)
+
+        self.assertAllEqual(sparse_classes, [b"v1", b"v2", b"v3"])
+        self.assertAllClose(sparse_proba, expected_proba)
+
+  @parameterized.named_parameters(("auto", "auto"), ("flat", "flat"))
+  def test_toy_prediction_cache(self, inference_engine):
+
+    with tf.Graph().as_default():
+      model_path = os.path.join(
+          tempfile.mkdtemp(dir=self.get_temp_dir()), "test_prediction_cache")
+      test_utils.build_toy_gbdt(model_path, num_classes=2)
+      expected_proba, expected_classes = (
+          test_utils.expected_toy_predictions_gbdt_binary())
+      features = test_utils.build_toy_input_features()
+
+      model = inference.Model(
+          model_path,
+          inference_engine=inference_engine,
+          prediction_cache_size=16)
+      predictions = model.apply(features)
+
+      with self.session() as sess:
+        sess.run(model.init_op())
+
+        # The first call caches the predictions of the first two examples. The
+        # second call mixes cached and new examples.
+        feature_values = test_utils.build_toy_input_feature_values(features)
+        first_values = {
+            feature: values[:2] for feature, values in feature_values.items()
+        }
+        for values, expected in [(first_values, expected_proba[:2]),
+                                 (feature_values, expected_proba),
+                                 (feature_values, expected_proba)]:
+          dense_predictions_values, dense_col_representation_values = (
+              sess.run([
+                  predictions.dense_predictions,
+                  predictions.dense_col_representation
+              ], values))
+          self.assertAllEqual(dense_col_representation_values,
+                              expected_classes)
+          self.assertAllClose(dense_predictions_values, expected)
+
+  @parameterized.named_parameters(("auto", "auto"), ("flat", "flat"))
+  def test_toy_batched_calls(self, inference_engine):
+
+    with tf.Graph().as_default():
+      model_path = os.path.join(
+          tempfile.mkdtemp(dir=self.get_temp_dir()), "test_batched_calls")
+      test_utils.build_toy_gbdt(model_path, num_classes=2)
+      expected_proba, _ = test_utils.expected_toy_predictions_gbdt_binary()
+      features = test_utils.build_toy_input_features()
+
+      model = inference.Model(model_path, inference_engine=inference_engine)
+      # The leader of a batch waits for all the calls, so that the calls of
+      # the examples 1 to 3 get unaligned slices of the batch predictions.
+      dense_predictions, _ = inference.op.SimpleMLInferenceOp(
+          model_identifier=model.model_identifier,
+          max_batch_size=4,
+          batch_timeout_micros=60 * 1000 * 1000,
+          **model.input_builder.build_inference_op_args(features))
+
+      with self.session() as sess:
+        sess.run(model.init_op())
+
+        feature_values = test_utils.build_toy_input_feature_values(features)
+        results = [None] * 4
+
+        def run_example(example_idx):
+          values = {
+              feature: values[example_idx:example_idx + 1]
+              for feature, values in feature_values.items()
+          }
+          results[example_idx] = sess.run(dense_predictions, values)
+
+        threads = [
+            threading.Thread(target=run_example, args=(example_idx,))
+            for example_idx in range(4)
+        ]
+        for thread in threads:
+          thread.start()
+        for thread in threads:
+          thread.join()
+
+        for example_idx in range(4):
+          self.assertAllClose(results[example_idx],
+                              expected_proba[example_idx:example_idx + 1])
+
+  @parameterized.named_parameters(("flat", "flat"),
+                                  ("flat_mapped", "flat_mapped"))
+  def test_toy_feature_contributions(self, inference_engine):
+
+    with tf.Graph().as_default():
+      model_path = os.path.join(
+          tempfile.mkdtemp(dir=self.get_temp_dir()),
+          "test_feature_contributions")
+      test_utils.build_toy_gbdt(model_path, num_classes=2,
+                                with_node_covers=True)
+      expected_proba, expected_classes = (
+          test_utils.expected_toy_predictions_gbdt_binary())
+      features = test_utils.build_toy_input_features()
+
+      model = inference.Model(model_path, inference_engine=inference_engine)
+      predictions = model.apply_with_feature_contributions(features)
+      self.assertEqual(predictions.feature_contribution_names,
+                       ["a", "b", "c", inference.FEATURE_CONTRIBUTIONS_BIAS])
+
+      with self.session() as sess:
+        sess.run(model.init_op())
+
+        (dense_predictions_values, dense_col_representation_values,
+         feature_contributions_values) = sess.run([
+             predictions.dense_predictions,
+             predictions.dense_col_representation,
+             predictions.feature_contributions
+         ], test_utils.build_toy_input_feature_values(features))
+
+        self.assertAllEqual(dense_col_representation_values, expected_classes)
+        self.assertAllClose(dense_predictions_values, expected_proba)
+
+        # Each of the two trees has an expected leaf value of
+        # (1 * 1.0 + 3 * 5.0) / 4 = 4.0. The examples with a > 1 reach the leaf
+        # 5.0 (contribution of 1.0 per tree), and the others the leaf 1.0
+        # (contribution of -3.0 per tree). The bias is 1.0 + 2 * 4.0.
+        self.assertAllClose(
+            feature_contributions_values,
+            [[[2.0], [0.0], [0.0], [9.0]], [[2.0], [0.0], [0.0], [9.0]],
+             [[-6.0], [0.0], [0.0], [9.0]], [[-6.0], [0.0], [0.0], [9.0]]])
+
+  @parameterized.named_parameters(("flat", "flat", 2, 0.0),
+                                  ("flat_mapped", "flat_mapped", 2, 0.0),
+                                  ("more_trees", "flat", 5, 0.0),
+                                  ("negative_logits", "flat", 3, -3.0))
+  def test_toy_feature_contributions_sum_to_logits(self, inference_engine,
+                                                   num_iters, leaf_offset):
+
+    with tf.Graph().as_default():
+      model_path = os.path.join(
+          tempfile.mkdtemp(dir=self.get_temp_dir()),
+          "test_feature_contributions_sum_to_logits")
+      test_utils.build_toy_gbdt(
+          model_path,
+          num_classes=2,
+          with_node_covers=True,
+          leaf_offset=leaf_offset,
+          num_iters=num_iters)
+      features = test_utils.build_toy_input_features()
+
+      model = inference.Model(model_path, inference_engine=inference_engine)
+      predictions = model.apply_with_feature_contributions(features)
+
+      with self.session() as sess:
+        sess.run(model.init_op())
+
+        dense_predictions_values, feature_contributions_values = sess.run(
+            [predictions.dense_predictions, predictions.feature_contributions],
+            test_utils.build_toy_input_feature_values(features))
+
+        # The contributions of the features and the bias add up to the logit
+        # of the positive class.
+        logits = (np.log(dense_predictions_values[:, 1]) -
+                  np.log(dense_predictions_values[:, 0]))
+        self.assertAllClose(
+            np.sum(feature_contributions_values[:, :, 0], axis=1),
+            logits,
+            atol=1e-3)
+
+  @parameterized.named_parameters(("flat", "flat"),
+                                  ("flat_mapped", "flat_mapped"))
+  def test_toy_leaves(self, inference_engine):
+
+    with tf.Graph().as_default():
+      model_path = os.path.join(
+          tempfile.mkdtemp(dir=self.get_temp_dir()), "test_leaves")
+      test_utils.build_toy_gbdt(model_path, num_classes=2)
+      expected_proba, expected_classes = (
+          test_utils.expected_toy_predictions_gbdt_binary())
+      features = test_utils.build_toy_input_features()
+
+      model = inference.Model(model_path, inference_engine=inference_engine)
+      predictions = model.apply_get_leaves(features)
+
+      with self.session() as sess:
+        sess.run(model.init_op())
+
+        (dense_predictions_values, dense_col_representation_values,
+         leaves_values) = sess.run([
+             predictions.dense_predictions,
+             predictions.dense_col_representation, predictions.leaves
+         ], test_utils.build_toy_input_feature_values(features))
+
+        self.assertAllEqual(dense_col_representation_values, expected_classes)
+        self.assertAllClose(dense_predictions_values, expected_proba)
+        # In both trees, the examples with a > 1 reach the second leaf.
+        self.assertAllEqual(leaves_values, [[1, 1], [1, 1], [0, 0], [0, 0]])
+
+  @parameterized.named_parameters(("flat", "flat"),
+                                  ("flat_mapped", "flat_mapped"))
+  def test_toy_max_num_trees(self, inference_engine):
+
+    with tf.Graph().as_default():
+      binary_model_path = os.path.join(
+          tempfile.mkdtemp(dir=self.get_temp_dir()), "test_max_num_trees_2")
+      test_utils.build_toy_gbdt(binary_model_path, num_classes=2)
+      multiclass_model_path = os.path.join(
+          tempfile.mkdtemp(dir=self.get_temp_dir()), "test_max_num_trees_3")
+      test_utils.build_toy_gbdt(multiclass_model_path, num_classes=3)
+      features = test_utils.build_toy_input_features()
+
+      binary_model = inference.Model(
+          binary_model_path, inference_engine=inference_engine)
+      binary_predictions = binary_model.apply_get_leaves(
+          features, max_num_trees=1)
+      multiclass_model = inference.Model(
+          multiclass_model_path, inference_engine=inference_engine)
+      # The 4 trees are rounded down to the 3 trees of the first iteration.
+      multiclass_predictions = multiclass_model.apply(
+          features, max_num_trees=4)
+
+      with self.session() as sess:
+        sess.run([binary_model.init_op(), multiclass_model.init_op()])
+
+        (binary_values, leaves_values, multiclass_values) = sess.run([
+            binary_predictions.dense_predictions, binary_predictions.leaves,
+            multiclass_predictions.dense_predictions
+        ], test_utils.build_toy_input_feature_values(features))
+
+        # The logits of the first tree are 1 + 5 = 6 for a > 1, and 1 + 1 = 2
+        # otherwise.
+        self.assertAllClose(binary_values,
+                            [[0.0024726, 0.9975274], [0.0024726, 0.9975274],
+                             [0.1192029, 0.8807971], [0.1192029, 0.8807971]])
+        # The second tree is not evaluated.
+        self.assertAllEqual(leaves_values, [[1, -1], [1, -1], [0, -1], [0, -1]])
+        # The logits of the first iteration are [5, 6, 9] for a > 1, and
+        # [1, 2, 3] otherwise.
+        self.assertAllClose(multiclass_values,
+                            [[0.0171478, 0.0466126, 0.9362396],
+                             [0.0171478, 0.0466126, 0.9362396],
+                             [0.0900306, 0.2447285, 0.6652410],
+                             [0.0900306, 0.2447285, 0.6652410]])
+
+  @parameterized.named_parameters(
+      # After the first 8 trees, all the logits exceed the margin.
+      ("margin", 1.0, 8, [0.8581489, 0.9933071]),
+      # After the first 16 trees, the 4 remaining trees cannot change the
+      # predicted classes.
+      ("remaining_trees", 100.0, 16, [0.9308616, 0.9998766]))
+  def test_toy_early_exit(self, early_exit_margin, num_evaluated_trees,
+                          expected_proba):
+
+    with tf.Graph().as_default():
+      model_path = os.path.join(
+          tempfile.mkdtemp(dir=self.get_temp_dir()), "test_early_exit")
+      # The leaves of the 20 trees are 0.1 for a <= 1, and 0.5 for a > 1. The
+      # trees are evaluated 8 at a time.
+      test_utils.build_toy_gbdt(model_path, num_classes=2, num_iters=20)
+      features = test_utils.build_toy_input_features()
+
+      model = inference.Model(model_path, inference_engine="flat")
+      predictions = model.apply_get_leaves(
+          features, early_exit_margin=early_exit_margin)
+
+      with self.session() as sess:
+        sess.run(model.init_op())
+
+        dense_predictions_values, leaves_values = sess.run(
+            [predictions.dense_predictions, predictions.leaves],
+            test_utils.build_toy_input_feature_values(features))
+
+        # The probabilities of the positive class, for a <= 1 and a > 1. The
+        # examples with a > 1 come first.
+        negative_proba, positive_proba = expected_proba
+        self.assertAllClose(dense_predictions_values[:, 1],
+                            [positive_proba, positive_proba,
+                             negative_proba, negative_proba])
+        num_skipped_trees = 20 - num_evaluated_trees
+        positive_leaves = [1] * num_evaluated_trees + [-1] * num_skipped_trees
+        negative_leaves = [0] * num_evaluated_trees + [-1] * num_skipped_trees
+        self.assertAllEqual(leaves_values, [
+            positive_leaves, positive_leaves, negative_leaves, negative_leaves
+        ])
+
+  def test_toy_partial_evaluation_unsupported_engine(self):
+
+    with tf.Graph().as_default():
+      model_path = os.path.join(
+          tempfile.mkdtemp(dir=self.get_temp_dir()), "test_partial_slow")
+      test_utils.build_toy_gbdt(model_path, num_classes=2)
+      features = test_utils.build_toy_input_features()
+
+      model = inference.Model(model_path, inference_engine="slow")
+      predictions = model.apply(features, max_num_trees=1)
+
+      with self.session() as sess:
+        sess.run(model.init_op())
+        with self.assertRaisesRegex(tf.errors.InvalidArgumentError,
+                                    "max_num_trees"):
+          sess.run(predictions.dense_predictions,
+                   test_utils.build_toy_input_feature_values(features))
+
+  @parameterized.named_parameters(("auto", "auto"), ("flat", "flat"))
+  def test_toy_inference_threads(self, inference_engine):
+
+    with tf.Graph().as_default():
+      model_path = os.path.join(
+          tempfile.mkdtemp(dir=self.get_temp_dir()), "test_inference_threads")
+      test_utils.build_toy_gbdt(model_path, num_classes=2)
+      expected_proba, expected_classes = (
+          test_utils.expected_toy_predictions_gbdt_binary())
+      features = test_utils.build_toy_input_features()
+
+      model = inference.Model(
+          model_path,
+          inference_engine=inference_engine,
+          num_inference_threads=4)
+      predictions = model.apply(features)
+
+      with self.session() as sess:
+        sess.run(model.init_op())
+
+        # Enough examples for the batch to be sharded on the threads of the
+        # model.
+        num_repetitions = 256
+        feature_values = {
+            feature: values * num_repetitions for feature, values in
+            test_utils.build_toy_input_feature_values(features).items()
+        }
+        dense_predictions_values, dense_col_representation_values = sess.run(
+            [
+                predictions.dense_predictions,
+                predictions.dense_col_representation
+            ], feature_values)
+
+        self.assertAllEqual(dense_col_representation_values, expected_classes)
+        self.assertAllClose(dense_predictions_values,
+                            expected_proba * num_repetitions)
+
+  def test_toy_inference_tree_blocks(self):
+
+    with tf.Graph().as_default():
+      model_path = os.path.join(
+          tempfile.mkdtemp(dir=self.get_temp_dir()), "test_tree_blocks")
+      # The nodes of the trees take a few times the size of a block of trees
+      # (see "kMaxTreeBlockMemoryUsage"), so the sharded batches are evaluated
+      # by blocks of trees.
+      test_utils.build_toy_gbdt(model_path, num_classes=2, num_iters=12000)
+      expected_proba, expected_classes = (
+          test_utils.expected_toy_predictions_gbdt_binary())
+      features = test_utils.build_toy_input_features()
+
+      # Evaluates all the trees of each example, on one shard.
+      per_tree_model = inference.Model(model_path, inference_engine="flat")
+      tree_blocks_model = inference.Model(
+          model_path, inference_engine="flat", num_inference_threads=8)
+      per_tree_predictions = per_tree_model.apply(features)
+      tree_blocks_predictions = tree_blocks_model.apply(features)
+
+      with self.session() as sess:
+        sess.run([per_tree_model.init_op(), tree_blocks_model.init_op()])
+
+        # Enough examples for the batch to be sharded on the 8 threads.
+        num_repetitions = 512
+        feature_values = {
+            feature: values * num_repetitions for feature, values in
+            test_utils.build_toy_input_feature_values(features).items()
+        }
+        (per_tree_values, tree_blocks_values,
+         dense_col_representation_values) = sess.run([
+             per_tree_predictions.dense_predictions,
+             tree_blocks_predictions.dense_predictions,
+             tree_blocks_predictions.dense_col_representation
+         ], feature_values)
+
+        self.assertAllEqual(dense_col_representation_values, expected_classes)
+        # Note: The trees are summed in a different order.
+        self.assertAllClose(tree_blocks_values, per_tree_values, atol=1e-5)
+        self.assertAllClose(
+            tree_blocks_values, expected_proba * num_repetitions, atol=1e-4)
+
+  def test_toy_model_bank(self):
+
+    with tf.Graph().as_default():
+      # Two toy models with different leaves. The logits of the examples with
+      # a > 1 and a <= 1 are 11 and 3 for the first model, and 5 and -3 for
+      # the second.
+      model_paths = []
+      for model_idx, leaf_offset in enumerate([0.0, -3.0]):
+        model_path = os.path.join(
+            tempfile.mkdtemp(dir=self.get_temp_dir()),
+            "test_model_bank_%d" % model_idx)
+        test_utils.build_toy_gbdt(
+            model_path, num_classes=2, leaf_offset=leaf_offset)
+        model_paths.append(model_path)
+      _, expected_classes = test_utils.expected_toy_predictions_gbdt_binary()
+      logits_by_model = [[11.0, 11.0, 3.0, 3.0], [5.0, 5.0, -3.0, -3.0]]
+      features = test_utils.build_toy_input_features()
+
+      # Prepare model bank. The examples alternate between the two models.
+      model_bank = inference.ModelBank(model_paths)
+      model_ids = tf.placeholder(tf.int32, [None])
+      predictions = model_bank.apply(features, model_ids)
+
+      with self.session() as sess:
+        sess.run(model_bank.init_op())
+
+        for example_model_ids in [[0, 1, 0, 1], [1, 0, 1, 0]]:
+          feed_dict = test_utils.build_toy_input_feature_values(features)
+          feed_dict[model_ids] = example_model_ids
+          dense_predictions_values, dense_col_representation_values = (
+              sess.run([
+                  predictions.dense_predictions,
+                  predictions.dense_col_representation
+              ], feed_dict))
+
+          # Each example is evaluated by its own model.
+          logits = np.array([
+              logits_by_model[model_id][example_idx]
+              for example_idx, model_id in enumerate(example_model_ids)
+          ])
+          positive_proba = 1.0 / (1.0 + np.exp(-logits))
+          self.assertAllEqual(dense_col_representation_values,
+                              expected_classes)
+          self.assertAllClose(
+              dense_predictions_values,
+              np.stack([1.0 - positive_proba, positive_proba], axis=1))
+
+  def test_generate_compiled_flat_forest_source(self):
+
+    model_path = os.path.join(
+        tempfile.mkdtemp(dir=self.get_temp_dir()), "test_compiled")
+    test_utils.build_toy_gbdt(model_path, num_classes=2)
+    source_path = os.path.join(self.get_temp_dir(), "compiled_forest.cc")
+
+    with tf.Graph().as_default():
+      generate_op = inference.generate_compiled_flat_forest_source(
+          model_path, source_path)
+      with self.session() as sess:
+        sess.run(generate_op)
+
+    with open(source_path, "r") as f:
+      source = f.read()
+    self.assertIn("TfdfCompiledFlatForestFingerprint", source)
+    self.assertIn("TfdfCompiledFlatForestAccumulate", source)
+
+  @parameterized.named_parameters(
+      # The compiled forest of the model is used.
+      ("same_model", 0.0, False, 4.0),
+      # The compiled forest of another model is ignored.
+      ("other_model", 1.0, False, 0.0),
+      # The compiled forest is exact.
+      ("exact", 0.0, True, 0.0))
+  def test_compiled_flat_forest(self, leaf_offset, exact, logit_shift):
+    compiler = shutil.which("c++")
+    if compiler is None:
+      self.skipTest("No C++ compiler to build the compiled forest")
+
+    temp_dir = tempfile.mkdtemp(dir=self.get_temp_dir())
+    model_path = os.path.join(temp_dir, "model")
+    test_utils.build_toy_gbdt(model_path, num_classes=2)
+    compiled_model_path = os.path.join(temp_dir, "compiled_model")
+    test_utils.build_toy_gbdt(
+        compiled_model_path, num_classes=2, leaf_offset=leaf_offset)
+    source_path = os.path.join(temp_dir, "compiled_forest.cc")
+
+    with tf.Graph().as_default():
+      generate_op = inference.generate_compiled_flat_forest_source(
+          compiled_model_path, source_path)
+      with self.session() as sess:
+        sess.run(generate_op)
+
+    # Unless "exact", the library shifts the logits by 4: its predictions are
+    # told apart from the ones of the interpreted flat forest.
+    if not exact:
+      with open(source_path, "r") as f:
+        source = f.read()
+      first_tree_call = "  Tree0(n, b, c, a);\n"
+      self.assertIn(first_tree_call, source)
+      source = source.replace(first_tree_call,
+                              first_tree_call + "  a[0] += 4.0f;\n")
+      with open(source_path, "w") as f:
+        f.write(source)
+    subprocess.check_call([
+        compiler, "-O2", "-shared", "-fPIC", "-o",
+        os.path.join(model_path, "flat_forest_compiled.so"), source_path
+    ])
+
+    with tf.Graph().as_default():
+      features = test_utils.build_toy_input_features()
+      model = inference.Model(model_path, inference_engine="flat")
+      predictions = model.apply(features)
+
+      with self.session() as sess:
+        sess.run(model.init_op())
+        dense_predictions_values = sess.run(
+            predictions.dense_predictions,
+            test_utils.build_toy_input_feature_values(features))
+
+    # The logits of the toy model are 11 for a > 1, and 3 otherwise.
+    logits = np.array([11.0, 11.0, 3.0, 3.0]) + logit_shift
+    positive_proba = 1.0 / (1.0 + np.exp(-logits))
+    self.assertAllClose(
+        dense_predictions_values,
+        np.stack([1.0 - positive_proba, positive_proba], axis=1))
+
   def test_real_rf(self):
     """Loads a real Random Forest model."""
 
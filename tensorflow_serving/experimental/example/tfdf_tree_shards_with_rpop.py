@@ -0,0 +1,162 @@
+# Copyright 2021 Google Inc. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+r"""Exports the coordinator of a TF-DF model distributed over tree shards.
+
+Each shard server serves the model loaded with "num_tree_shards" and its own
+"tree_shard_index" (see the TF-DF "Model" API), with a signature taking the
+input features by name and returning the partial predictions of the shard as
+"dense_predictions".
+
+The exported coordinator takes the same input features, sends them to all the
+shard servers in parallel with RemotePredictOp, and reduces the partial
+predictions of the shards into the predictions of the model:
+
+  tfdf_tree_shards_with_rpop --model_path=/models/my_forest \
+    --shard_addresses=shard-0:8500,shard-1:8500 \
+    --remote_model_name=my_forest_shard \
+    --output_dir=/tmp/my_forest_coordinator/1/
+
+The categorical set features are not supported.
+"""
+
+import tensorflow.compat.v1 as tf
+
+from tensorflow_decision_forests.tensorflow.ops.inference import api as inference
+from tensorflow_serving.experimental.tensorflow.ops.remote_predict.python.ops import remote_predict_ops
+from yggdrasil_decision_forests.dataset import data_spec_pb2
+from yggdrasil_decision_forests.model import abstract_model_pb2
+
+tf.app.flags.DEFINE_string("output_dir", "/tmp/tfdf_tree_shards_with_rpop/1/",
+                           "Savedmodel export path")
+tf.app.flags.DEFINE_string("model_path", "",
+                           "Path to the Yggdrasil model distributed over the "
+                           "shard servers.")
+tf.app.flags.DEFINE_string("shard_addresses", "",
+                           "Comma separated target addresses of the shard "
+                           "servers, by shard index.")
+tf.app.flags.DEFINE_string("remote_model_name", "",
+                           "Model name of the shards on the shard servers.")
+tf.app.flags.DEFINE_integer("max_rpc_deadline_millis", 3000,
+                            "Deadline of the calls to the shard servers.")
+
+FLAGS = tf.app.flags.FLAGS
+
+
+def _read_input_features(model_path):
+  """Returns the (name, dtype) of the input features of the model."""
+  header = abstract_model_pb2.AbstractModel()
+  with tf.io.gfile.GFile(tf.io.gfile.join(model_path, "header.pb"), "rb") as f:
+    header.ParseFromString(f.read())
+  data_spec = data_spec_pb2.DataSpecification()
+  with tf.io.gfile.GFile(tf.io.gfile.join(model_path, "data_spec.pb"),
+                         "rb") as f:
+    data_spec.ParseFromString(f.read())
+
+  input_features = []
+  for feature_idx in header.input_features:
+    column = data_spec.columns[feature_idx]
+    if column.type in (data_spec_pb2.NUMERICAL, data_spec_pb2.BOOLEAN):
+      dtype = tf.float32
+    elif column.type == data_spec_pb2.CATEGORICAL:
+      dtype = (
+          tf.int32 if column.categorical.is_already_integerized else tf.string)
+    else:
+      raise ValueError("Non supported feature type {} for \"{}\".".format(
+          data_spec_pb2.ColumnType.Name(column.type), column.name))
+    input_features.append((column.name, dtype))
+  return input_features
+
+
+def _generate_coordinator_saved_model(export_dir, model_path, shard_addresses,
+                                      remote_model_name,
+                                      max_rpc_deadline_millis):
+  """Generates the SavedModel of the coordinator of the tree shards.
+
+  Args:
+    export_dir: The directory to which the SavedModel should be written.
+    model_path: The path to the distributed Yggdrasil model.
+    shard_addresses: The target addresses of the shard servers.
+    remote_model_name: The model name of the shards on the shard servers.
+    max_rpc_deadline_millis: The deadline of the calls to the shard servers.
+  """
+  builder = tf.saved_model.builder.SavedModelBuilder(export_dir)
+
+  with tf.Session(graph=tf.Graph()) as sess:
+    features = {
+        name: tf.placeholder(dtype, shape=[None], name=name)
+        for name, dtype in _read_input_features(model_path)
+    }
+    input_tensor_aliases = tf.constant(list(features.keys()))
+    input_tensors = list(features.values())
+    output_tensor_aliases = tf.constant(["dense_predictions"])
+
+    partial_predictions = []
+    for shard_idx, shard_address in enumerate(shard_addresses):
+      results = remote_predict_ops.run(
+          input_tensor_aliases,
+          input_tensors,
+          output_tensor_aliases,
+          target_address=shard_address,
+          model_name=remote_model_name,
+          max_rpc_deadline_millis=max_rpc_deadline_millis,
+          output_types=[tf.float32],
+          name="remote_predict_shard_{}".format(shard_idx))
+      partial_predictions.append(results.output_tensors[0])
+
+    dense_predictions = tf.identity(
+        inference.reduce_tree_shards(
+            partial_predictions, inference.tree_shard_finalization(model_path)),
+        name="dense_predictions")
+
+    predict_signature_def = (
+        tf.saved_model.signature_def_utils.build_signature_def(
+            inputs={
+                name: tf.saved_model.utils.build_tensor_info(tensor)
+                for name, tensor in features.items()
+            },
+            outputs={
+                "dense_predictions":
+                    tf.saved_model.utils.build_tensor_info(dense_predictions)
+            },
+            method_name=tf.saved_model.signature_constants.PREDICT_METHOD_NAME))
+
+    signature_def_map = {
+        tf.saved_model.signature_constants.DEFAULT_SERVING_SIGNATURE_DEF_KEY:
+            predict_signature_def
+    }
+    builder.add_meta_graph_and_variables(
+        sess, [tf.saved_model.tag_constants.SERVING],
+        signature_def_map=signature_def_map,
+        strip_default_attrs=True)
+  builder.save(False)
+
+
+def main(_):
+  if not FLAGS.model_path or not FLAGS.shard_addresses:
+    raise ValueError("--model_path and --shard_addresses are required.")
+  if not FLAGS.remote_model_name:
+    raise ValueError("--remote_model_name is required.")
+  shard_addresses = FLAGS.shard_addresses.split(",")
+  _generate_coordinator_saved_model(FLAGS.output_dir, FLAGS.model_path,
+                                    shard_addresses, FLAGS.remote_model_name,
+                                    FLAGS.max_rpc_deadline_millis)
+  print("SavedModel generated at: %(dir)s with %(num_shards)d tree shards" % {
+      "dir": FLAGS.output_dir,
+      "num_shards": len(shard_addresses)
+  })
+
+
+if __name__ == "__main__":
+  tf.app.run()
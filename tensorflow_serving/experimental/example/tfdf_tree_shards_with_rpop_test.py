@@ -0,0 +1,81 @@
+# Copyright 2021 Google Inc. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+"""Tests for tfdf_tree_shards_with_rpop."""
+
+import os
+import tempfile
+
+import tensorflow.compat.v1 as tf
+
+from tensorflow_decision_forests.tensorflow.ops.inference import test_utils
+from tensorflow_serving.experimental.example import tfdf_tree_shards_with_rpop
+
+
+class TfdfTreeShardsWithRpopTest(tf.test.TestCase):
+
+  def _build_toy_model(self):
+    model_path = os.path.join(
+        tempfile.mkdtemp(dir=self.get_temp_dir()), "toy_gbdt")
+    test_utils.build_toy_gbdt(model_path, num_classes=2)
+    return model_path
+
+  def test_read_input_features(self):
+    input_features = tfdf_tree_shards_with_rpop._read_input_features(
+        self._build_toy_model())
+    self.assertEqual(input_features, [("a", tf.float32), ("b", tf.string),
+                                      ("c", tf.int32)])
+
+  def test_generate_coordinator_saved_model(self):
+    model_path = self._build_toy_model()
+    export_dir = os.path.join(tempfile.mkdtemp(dir=self.get_temp_dir()), "1")
+    shard_addresses = ["shard-0:8500", "shard-1:8500"]
+    tfdf_tree_shards_with_rpop._generate_coordinator_saved_model(
+        export_dir,
+        model_path,
+        shard_addresses,
+        remote_model_name="toy_gbdt_shard",
+        max_rpc_deadline_millis=100)
+
+    with tf.Session(graph=tf.Graph()) as sess:
+      meta_graph_def = tf.saved_model.loader.load(
+          sess, [tf.saved_model.tag_constants.SERVING], export_dir)
+      signature_def = meta_graph_def.signature_def[
+          tf.saved_model.signature_constants.DEFAULT_SERVING_SIGNATURE_DEF_KEY]
+      self.assertCountEqual(signature_def.inputs.keys(), ["a", "b", "c"])
+      self.assertCountEqual(signature_def.outputs.keys(),
+                            ["dense_predictions"])
+
+      # One call per shard server, reduced with the finalization of the
+      # model.
+      remote_predicts = [
+          node for node in meta_graph_def.graph_def.node
+          if node.op == "TfServingRemotePredict"
+      ]
+      self.assertCountEqual(
+          [node.attr["target_address"].s.decode() for node in remote_predicts],
+          shard_addresses)
+      for node in remote_predicts:
+        self.assertEqual(node.attr["model_name"].s, b"toy_gbdt_shard")
+      reduce_nodes = [
+          node for node in meta_graph_def.graph_def.node
+          if node.op == "SimpleMLReduceTreeShards"
+      ]
+      self.assertLen(reduce_nodes, 1)
+      self.assertEqual(reduce_nodes[0].attr["finalization"].s,
+                       b"sigmoid_binary")
+
+
+if __name__ == "__main__":
+  tf.test.main()
@@ -16,7 +16,12 @@ limitations under the License.
 
 #include "grpcpp/create_channel.h"
 #include "grpcpp/security/credentials.h"
+#include "grpcpp/support/channel_arguments.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
 #include "absl/time/clock.h"
+#include "tensorflow/core/platform/random.h"
+#include "tensorflow_serving/util/trace_context.h"
 
 using namespace tensorflow;  // NOLINT(build/namespaces)
 namespace tensorflow {
@@ -33,12 +38,49 @@ absl::Status FromGrpcStatus(const ::grpc::Status& s) {
 
 }  // namespace
 
-PredictionServiceGrpc::PredictionServiceGrpc(
-    const std::string& target_address) {
-  // TODO(b/159739577): Set security channel from incoming rpc request.
-  auto channel = ::grpc::CreateChannel(target_address,
-                                       ::grpc::InsecureChannelCredentials());
-  stub_ = tensorflow::serving::PredictionService::NewStub(channel);
+absl::Status PredictionServiceGrpc::Create(
+    const std::string& target_address, const int num_channels_per_target,
+    std::unique_ptr<PredictionServiceGrpc>* service) {
+  if (num_channels_per_target <= 0) {
+    return absl::InvalidArgumentError(
+        "num_channels_per_target must be positive");
+  }
+  std::unique_ptr<PredictionServiceGrpc> new_service(
+      new PredictionServiceGrpc());
+  for (const absl::string_view address :
+       absl::StrSplit(target_address, ',', absl::SkipWhitespace())) {
+    for (int i = 0; i < num_channels_per_target; ++i) {
+      // The channels with the same arguments share their connection: a
+      // distinct argument gives each channel of the pool its own.
+      ::grpc::ChannelArguments arguments;
+      arguments.SetInt("tensorflow_serving.remote_predict_channel", i);
+      // TODO(b/159739577): Set security channel from incoming rpc request.
+      auto channel = ::grpc::CreateCustomChannel(
+          std::string(address), ::grpc::InsecureChannelCredentials(),
+          arguments);
+      new_service->channels_.emplace_back(new Channel());
+      new_service->channels_.back()->stub =
+          tensorflow::serving::PredictionService::NewStub(channel);
+    }
+  }
+  if (new_service->channels_.empty()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("No address in target_address: ", target_address));
+  }
+  *service = std::move(new_service);
+  return ::absl::OkStatus();
+}
+
+PredictionServiceGrpc::Channel* PredictionServiceGrpc::PickChannel() {
+  if (channels_.size() == 1) {
+    return channels_[0].get();
+  }
+  Channel* first = channels_[random::New64() % channels_.size()].get();
+  Channel* second = channels_[random::New64() % channels_.size()].get();
+  return first->num_rpcs_in_flight.load(std::memory_order_relaxed) <=
+                 second->num_rpcs_in_flight.load(std::memory_order_relaxed)
+             ? first
+             : second;
 }
 
 ::grpc::ClientContext* PredictionServiceGrpc::CreateRpc(
@@ -48,6 +90,9 @@ PredictionServiceGrpc::PredictionServiceGrpc(
   // the incoming rpc deadline and max_rpc_deadline_millis.
   rpc->set_deadline(std::chrono::system_clock::now() +
                     absl::ToChronoSeconds(max_rpc_deadline));
+  if (const TraceContext* trace_context = CurrentTraceContext()) {
+    rpc->AddMetadata(kTraceparentHeader, trace_context->ToTraceparent());
+  }
   return rpc;
 }
 
@@ -55,11 +100,16 @@ void PredictionServiceGrpc::Predict(
     ::grpc::ClientContext* rpc, PredictRequest* request,
     PredictResponse* response,
     std::function<void(absl::Status status)> callback) {
+  Channel* channel = PickChannel();
+  channel->num_rpcs_in_flight.fetch_add(1, std::memory_order_relaxed);
   std::function<void(::grpc::Status)> wrapped_callback =
-      [callback](::grpc::Status status) { callback(FromGrpcStatus(status)); };
+      [channel, callback](::grpc::Status status) {
+        channel->num_rpcs_in_flight.fetch_sub(1, std::memory_order_relaxed);
+        callback(FromGrpcStatus(status));
+      };
 
-  stub_->experimental_async()->Predict(rpc, request, response,
-                                       wrapped_callback);
+  channel->stub->experimental_async()->Predict(rpc, request, response,
+                                               wrapped_callback);
 }
 
 }  // namespace serving
@@ -14,7 +14,9 @@ limitations under the License.
 ==============================================================================*/
 #ifndef THIRD_PARTY_TENSORFLOW_SERVING_EXPERIMENTAL_TENSORFLOW_OPS_REMOTE_PREDICT_KERNELS_PREDICTION_SERVICE_GRPC_H_
 #define THIRD_PARTY_TENSORFLOW_SERVING_EXPERIMENTAL_TENSORFLOW_OPS_REMOTE_PREDICT_KERNELS_PREDICTION_SERVICE_GRPC_H_
+#include <atomic>
 #include <string>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "absl/time/time.h"
@@ -24,24 +26,48 @@ namespace tensorflow {
 namespace serving {
 
 // gRPC based communication point with PredictionService.
+//
+// The RPCs are balanced across a pool of channels: 'num_channels_per_target'
+// channels (i.e. TCP connections) to each address of 'target_address'. Each
+// RPC is sent on the least loaded of two channels picked at random, by number
+// of RPCs in flight.
 class PredictionServiceGrpc {
  public:
-  // Creates a new instance. Returns an error if the creation fails.
+  // Creates a new instance. 'target_address' is a comma separated list of
+  // addresses, e.g. "host1:8500,host2:8500". Returns an error if the creation
+  // fails.
+  static absl::Status Create(const std::string& target_address,
+                             int num_channels_per_target,
+                             std::unique_ptr<PredictionServiceGrpc>* service);
   static absl::Status Create(const std::string& target_address,
                              std::unique_ptr<PredictionServiceGrpc>* service) {
-    service->reset(new PredictionServiceGrpc(target_address));
-    return ::absl::OkStatus();
+    return Create(target_address, 1, service);
   }
 
+  // Creates the context of an RPC. The trace context of the current thread, if
+  // any, is propagated in the "traceparent" metadata.
   ::grpc::ClientContext* CreateRpc(absl::Duration max_rpc_deadline);
 
   void Predict(::grpc::ClientContext* rpc, PredictRequest* request,
                PredictResponse* response,
                std::function<void(absl::Status status)> callback);
 
+  // Cancels 'rpc', possibly before it is sent. Its callback is still called,
+  // with a CANCELLED status unless the RPC already completed.
+  void CancelRpc(::grpc::ClientContext* rpc) { rpc->TryCancel(); }
+
  private:
-  PredictionServiceGrpc(const std::string& target_address);
-  std::unique_ptr<tensorflow::serving::PredictionService::Stub> stub_;
+  struct Channel {
+    std::unique_ptr<tensorflow::serving::PredictionService::Stub> stub;
+    std::atomic<int> num_rpcs_in_flight{0};
+  };
+
+  PredictionServiceGrpc() = default;
+
+  // Returns the channel to send the next RPC on.
+  Channel* PickChannel();
+
+  std::vector<std::unique_ptr<Channel>> channels_;
 };
 
 }  // namespace serving
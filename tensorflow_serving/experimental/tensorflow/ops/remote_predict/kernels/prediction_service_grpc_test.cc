@@ -43,6 +43,23 @@ TEST_F(PredictionServiceGrpcTest, TestSetDeadline) {
               10);
 }
 
+TEST(PredictionServiceGrpcCreateTest, TestMultipleTargets) {
+  std::unique_ptr<PredictionServiceGrpc> grpc_stub;
+  EXPECT_TRUE(PredictionServiceGrpc::Create("host1:8500, host2:8500",
+                                            /*num_channels_per_target=*/2,
+                                            &grpc_stub)
+                  .ok());
+  EXPECT_NE(nullptr, grpc_stub);
+}
+
+TEST(PredictionServiceGrpcCreateTest, TestInvalidPool) {
+  std::unique_ptr<PredictionServiceGrpc> grpc_stub;
+  EXPECT_FALSE(PredictionServiceGrpc::Create("", &grpc_stub).ok());
+  EXPECT_FALSE(PredictionServiceGrpc::Create(
+                   "target_address", /*num_channels_per_target=*/0, &grpc_stub)
+                   .ok());
+}
+
 }  // namespace
 }  // namespace serving
 }  // namespace tensorflow
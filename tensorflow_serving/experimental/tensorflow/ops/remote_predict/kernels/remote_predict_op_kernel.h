@@ -15,10 +15,19 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_EXPERIMENTAL_TENSORFLOW_OPS_REMOTE_PREDICT_KERNELS_REMOTE_PREDICT_OP_KERNEL_H_
 #define TENSORFLOW_SERVING_EXPERIMENTAL_TENSORFLOW_OPS_REMOTE_PREDICT_KERNELS_REMOTE_PREDICT_OP_KERNEL_H_
 
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
 #include "google/protobuf/wrappers.pb.h"
 #include "google/protobuf/map.h"
+#include "grpcpp/alarm.h"
 #include "absl/status/status.h"
 #include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "tensorflow/core/framework/cancellation.h"
 #include "tensorflow/core/framework/common_shape_fns.h"
 #include "tensorflow/core/framework/op_kernel.h"
 #include "tensorflow/core/framework/register_types.h"
@@ -26,23 +35,109 @@ limitations under the License.
 #include "tensorflow/core/framework/shape_inference.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor.pb.h"
+#include "tensorflow/core/framework/tensor_util.h"
+#include "tensorflow/core/kernels/batching_util/basic_batch_scheduler.h"
 #include "tensorflow/core/kernels/ops_util.h"
 #include "tensorflow/core/lib/core/threadpool.h"
 #include "tensorflow/core/lib/gtl/cleanup.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
 #include "tensorflow/core/protobuf/named_tensor.pb.h"
 #include "tensorflow_serving/apis/model.pb.h"
 #include "tensorflow_serving/apis/predict.pb.h"
+#include "tensorflow_serving/util/trace_context.h"
 
 namespace tensorflow {
 namespace serving {
 
 typedef google::protobuf::Map<tensorflow::string, tensorflow::TensorProto> AliasTensorMap;
 
+// An execution of the Remote Predict Op, waiting to be batched with the
+// concurrent executions of the same op.
+struct RemotePredictTask : public BatchTask {
+  size_t size() const override { return batch_size; }
+
+  OpKernelContext* context;
+  AsyncOpKernel::DoneCallback done;
+  std::vector<string> input_tensor_aliases;
+  // In the order of 'input_tensor_aliases'.
+  std::vector<Tensor> input_tensors;
+  std::vector<string> output_tensor_aliases;
+  // The size of the 0th dimension of the input tensors.
+  int64 batch_size = 0;
+};
+
+// Tracks a percentile of the latencies of the recent RPCs of an op.
+class RpcLatencyTracker {
+ public:
+  explicit RpcLatencyTracker(const double percentile)
+      : percentile_(percentile) {}
+
+  void Record(const absl::Duration latency) {
+    mutex_lock l(mu_);
+    if (latencies_.size() < kWindowSize) {
+      latencies_.push_back(latency);
+    } else {
+      latencies_[next_] = latency;
+      next_ = (next_ + 1) % kWindowSize;
+    }
+    if (++num_recorded_since_update_ == kUpdatePeriod) {
+      num_recorded_since_update_ = 0;
+      std::vector<absl::Duration> sorted = latencies_;
+      auto nth = sorted.begin() + static_cast<int>(percentile_ *
+                                                   (sorted.size() - 1));
+      std::nth_element(sorted.begin(), nth, sorted.end());
+      value_ = *nth;
+    }
+  }
+
+  // Returns the percentile of the recent latencies, or nullopt until enough
+  // are recorded.
+  absl::optional<absl::Duration> Percentile() const {
+    mutex_lock l(mu_);
+    return value_;
+  }
+
+ private:
+  // The percentile is computed over the last kWindowSize latencies, every
+  // kUpdatePeriod latencies.
+  static constexpr int kWindowSize = 1000;
+  static constexpr int kUpdatePeriod = 100;
+
+  const double percentile_;
+  mutable mutex mu_;
+  std::vector<absl::Duration> latencies_ GUARDED_BY(mu_);
+  int next_ GUARDED_BY(mu_) = 0;
+  int num_recorded_since_update_ GUARDED_BY(mu_) = 0;
+  absl::optional<absl::Duration> value_ GUARDED_BY(mu_);
+};
+
 // Remote Predict Op kernel implementation class templated on different
 // PredictionServiceStubTypes.
+//
+// If 'hedge_delay_millis' is set, an RPC still pending after that delay (or
+// after the 95th percentile of the recent latencies, for -1) is hedged: sent
+// again, to the channel the stub picks then, and the first successful reply
+// is taken. The RPCs are cancelled with the step running the op, which bounds
+// them by the RunOptions deadline.
+//
+// If 'max_batch_size' is positive, the concurrent executions of the op are
+// batched into a single RPC: their inputs are concatenated along the 0th
+// dimension, and the outputs of the RPC are split back along it. The
+// executions whose inputs do not have a common 0th dimension, or one larger
+// than 'max_batch_size', are sent alone.
 template <typename PredictionServiceStubType>
 class RemotePredictOp : public AsyncOpKernel {
  public:
+  // The context of an RPC, created by the stub.
+  using Rpc = typename std::remove_pointer<decltype(
+      std::declval<PredictionServiceStubType&>().CreateRpc(
+          absl::Duration()))>::type;
+
+  // The percentile of the latencies after which the RPCs are hedged, with
+  // hedge_delay_millis = -1.
+  static constexpr double kHedgeLatencyPercentile = 0.95;
+
   explicit RemotePredictOp(OpKernelConstruction* context)
       : AsyncOpKernel(context) {
     string target_address;
@@ -56,12 +151,39 @@ class RemotePredictOp : public AsyncOpKernel {
                                              &fail_op_on_rpc_error_));
     OP_REQUIRES_OK(context,
                    context->GetAttr("signature_name", &signature_name_));
-    absl::Status prediction_service_status =
-        PredictionServiceStubType::Create(target_address, &prediction_service_);
+    int64 num_channels_per_target;
+    OP_REQUIRES_OK(context, context->GetAttr("num_channels_per_target",
+                                             &num_channels_per_target));
+    OP_REQUIRES_OK(context,
+                   context->GetAttr("max_batch_size", &max_batch_size_));
+    int64 batch_timeout_micros;
+    OP_REQUIRES_OK(context, context->GetAttr("batch_timeout_micros",
+                                             &batch_timeout_micros));
+    OP_REQUIRES_OK(context, context->GetAttr("hedge_delay_millis",
+                                             &hedge_delay_millis_));
+    std::unique_ptr<PredictionServiceStubType> prediction_service;
+    absl::Status prediction_service_status = PredictionServiceStubType::Create(
+        target_address, num_channels_per_target, &prediction_service);
     OP_REQUIRES(context, prediction_service_status.ok(),
                 tensorflow::Status(static_cast<tensorflow::error::Code>(
                                        prediction_service_status.code()),
                                    prediction_service_status.message()));
+    prediction_service_ = std::move(prediction_service);
+    if (max_batch_size_ > 0) {
+      // Forming a batch only sends its RPC, hence a single batch thread.
+      BasicBatchScheduler<RemotePredictTask>::Options options;
+      options.max_batch_size = max_batch_size_;
+      options.batch_timeout_micros = batch_timeout_micros;
+      options.num_batch_threads = 1;
+      options.thread_pool_name = "remote_predict_batch_threads";
+      options.max_enqueued_batches = 1000;
+      OP_REQUIRES_OK(context,
+                     BasicBatchScheduler<RemotePredictTask>::Create(
+                         options,
+                         [this](std::unique_ptr<Batch<RemotePredictTask>>
+                                    batch) { ProcessBatch(std::move(batch)); },
+                         &batch_scheduler_));
+    }
   }
 
   void ComputeAsync(OpKernelContext* context, DoneCallback done) override {
@@ -78,53 +200,366 @@ class RemotePredictOp : public AsyncOpKernel {
     auto output_tensor_aliases =
         context->input(1 + input_tensors.size()).flat<tstring>();
 
-    // Build the PredictRequest.
-    PredictRequest* request = new PredictRequest();
+    std::unique_ptr<RemotePredictTask> task(new RemotePredictTask());
+    task->context = context;
+    task->done = std::move(done);
+    for (int i = 0; i < input_tensor_aliases.size(); ++i) {
+      task->input_tensor_aliases.emplace_back(input_tensor_aliases(i));
+      task->input_tensors.push_back(input_tensors[i]);
+    }
+    for (int i = 0; i < output_tensor_aliases.size(); ++i) {
+      task->output_tensor_aliases.emplace_back(output_tensor_aliases(i));
+    }
 
-    request->mutable_model_spec()->set_name(model_name_);
+    if (batch_scheduler_ != nullptr && SetBatchSize(task.get())) {
+      // On error, e.g. if the queue is full, the task is left to us.
+      if (batch_scheduler_->Schedule(&task).ok()) {
+        return;
+      }
+    }
+    std::shared_ptr<RemotePredictTask> owned_task(task.release());
+    SendTask(owned_task.get(), owned_task);
+  }
 
-    request->mutable_model_spec()->set_signature_name(signature_name_);
+  void PostProcessResponse(OpKernelContext* context, PredictResponse* response,
+                           const absl::Status& rpc_status,
+                           bool fail_op_on_rpc_error,
+                           const std::vector<string>& output_tensor_aliases,
+                           DoneCallback rpc_done) {
+    std::vector<Tensor> output_tensors;
+    Status outputs_status =
+        rpc_status.ok()
+            ? ParseOutputs(output_tensor_aliases, response, &output_tensors)
+            : Status::OK();
+    SetOutputs(context, rpc_status, fail_op_on_rpc_error, outputs_status,
+               output_tensors, std::move(rpc_done));
+  }
 
+ private:
+  // Sets 'task->batch_size' if the task can be batched.
+  bool SetBatchSize(RemotePredictTask* task) const {
+    if (task->input_tensors.empty() || task->input_tensors[0].dims() == 0) {
+      return false;
+    }
+    const int64 batch_size = task->input_tensors[0].dim_size(0);
+    for (const Tensor& tensor : task->input_tensors) {
+      if (tensor.dims() == 0 || tensor.dim_size(0) != batch_size) {
+        return false;
+      }
+    }
+    if (batch_size == 0 || batch_size > max_batch_size_) {
+      return false;
+    }
+    task->batch_size = batch_size;
+    return true;
+  }
+
+  // Returns a new request without inputs.
+  PredictRequest* NewRequest(const std::vector<string>& output_tensor_aliases) {
+    PredictRequest* request = new PredictRequest();
+    request->mutable_model_spec()->set_name(model_name_);
+    request->mutable_model_spec()->set_signature_name(signature_name_);
     if (model_version_ >= 0) {
       request->mutable_model_spec()->mutable_version()->set_value(
           model_version_);
     }
+    for (const string& alias : output_tensor_aliases) {
+      request->add_output_filter(alias);
+    }
+    return request;
+  }
 
-    AliasTensorMap& inputs = *request->mutable_inputs();
-    for (int i = 0; i < input_tensor_aliases.size(); ++i) {
-      tensorflow::TensorProto proto;
-      input_tensors[i].AsProtoField(&proto);
-      inputs[input_tensor_aliases(i)] = proto;
+  // Adds 'tensor' to the inputs of 'request'. The content of the tensor is
+  // copied in bulk into 'tensor_content', instead of value by value into the
+  // typed fields.
+  static void AddInput(const string& alias, const Tensor& tensor,
+                       PredictRequest* request) {
+    tensor.AsProtoTensorContent(&(*request->mutable_inputs())[alias]);
+  }
+
+  // The Predict RPC of a request: its first attempt and, if hedged, a second
+  // one. Destroyed once all its attempts complete.
+  struct Call {
+    mutex mu;
+    std::shared_ptr<PredictionServiceStubType> prediction_service;
+    std::unique_ptr<PredictRequest> request;
+    std::function<void(const absl::Status&, PredictResponse*)> done;
+    // The RPC is a child span of the request running the op, if traced. The
+    // stub propagates the current trace context to the remote model server.
+    std::unique_ptr<TraceSpan> span;
+    absl::Time start;
+    absl::Time deadline;
+    // Valid until 'done' is called.
+    RpcLatencyTracker* latency_tracker = nullptr;
+    CancellationManager* cancellation_manager = nullptr;
+    CancellationToken cancellation_token;
+    ::grpc::Alarm hedge_alarm;
+    static constexpr int kMaxAttempts = 2;
+    std::unique_ptr<Rpc> rpcs[kMaxAttempts] GUARDED_BY(mu);
+    PredictResponse responses[kMaxAttempts];
+    int num_attempts GUARDED_BY(mu) = 0;
+    int num_pending_attempts GUARDED_BY(mu) = 0;
+    bool finished GUARDED_BY(mu) = false;
+    bool cancelled GUARDED_BY(mu) = false;
+  };
+
+  // Sends 'request', taking its ownership, and calls 'done' with the status
+  // and response of the RPC. If 'cancellation_manager' is set, the RPC is
+  // cancelled with the step, e.g. when the RunOptions deadline expires.
+  void SendRequest(
+      PredictRequest* request, CancellationManager* cancellation_manager,
+      std::function<void(const absl::Status&, PredictResponse*)> done) {
+    auto call = std::make_shared<Call>();
+    call->prediction_service = prediction_service_;
+    call->request.reset(request);
+    call->done = std::move(done);
+    call->span.reset(new TraceSpan("RemotePredict", CurrentTraceContext()));
+    call->start = absl::Now();
+    call->deadline =
+        call->start + absl::Milliseconds(max_rpc_deadline_millis_);
+    call->latency_tracker = &latency_tracker_;
+    if (cancellation_manager != nullptr) {
+      call->cancellation_token = cancellation_manager->get_cancellation_token();
+      if (!cancellation_manager->RegisterCallback(
+              call->cancellation_token, [call]() { CancelCall(call.get()); })) {
+        call->span->End();
+        call->done(absl::CancelledError("The step was cancelled"),
+                   &call->responses[0]);
+        return;
+      }
+      call->cancellation_manager = cancellation_manager;
     }
 
-    for (int i = 0; i < output_tensor_aliases.size(); ++i) {
-      request->add_output_filter(tensorflow::string(output_tensor_aliases(i)));
+    absl::optional<absl::Duration> hedge_delay;
+    if (hedge_delay_millis_ > 0) {
+      hedge_delay = absl::Milliseconds(hedge_delay_millis_);
+    } else if (hedge_delay_millis_ < 0) {
+      hedge_delay = latency_tracker_.Percentile();
     }
+    if (hedge_delay.has_value()) {
+      // The alarm may fire once the call is done and destroyed.
+      std::weak_ptr<Call> weak_call = call;
+      call->hedge_alarm.experimental().Set(
+          absl::ToChronoTime(call->start + *hedge_delay),
+          [weak_call](bool ok) {
+            std::shared_ptr<Call> call = weak_call.lock();
+            if (ok && call != nullptr) {
+              StartAttempt(call);
+            }
+          });
+    }
+    StartAttempt(call);
+  }
+
+  // Sends an attempt of 'call', unless it is finished or out of attempts.
+  static void StartAttempt(const std::shared_ptr<Call>& call) {
+    Rpc* rpc;
+    PredictResponse* response;
+    int attempt;
+    bool cancelled;
+    {
+      mutex_lock l(call->mu);
+      const absl::Duration remaining = call->deadline - absl::Now();
+      if (call->finished || call->num_attempts == Call::kMaxAttempts ||
+          (call->num_attempts > 0 && remaining <= absl::ZeroDuration())) {
+        return;
+      }
+      attempt = call->num_attempts++;
+      ++call->num_pending_attempts;
+      {
+        ScopedTraceContext trace_context(call->span->context());
+        call->rpcs[attempt].reset(
+            call->prediction_service->CreateRpc(remaining));
+      }
+      rpc = call->rpcs[attempt].get();
+      response = &call->responses[attempt];
+      cancelled = call->cancelled;
+    }
+    if (cancelled) {
+      call->prediction_service->CancelRpc(rpc);
+    }
+    // The stub may call back synchronously, hence outside of the lock, as
+    // for the cancellations.
+    call->prediction_service->Predict(
+        rpc, call->request.get(), response,
+        [call, attempt](const absl::Status& status) {
+          FinishAttempt(call, attempt, status);
+        });
+  }
+
+  // Completes 'call' with the first successful attempt, or with the last
+  // failed one if no other attempt is pending. The other attempts are
+  // cancelled.
+  static void FinishAttempt(const std::shared_ptr<Call>& call,
+                            const int attempt, const absl::Status& status) {
+    std::vector<Rpc*> to_cancel;
+    {
+      mutex_lock l(call->mu);
+      --call->num_pending_attempts;
+      if (call->finished ||
+          (!status.ok() && call->num_pending_attempts > 0)) {
+        return;
+      }
+      call->finished = true;
+      for (int i = 0; i < call->num_attempts; ++i) {
+        if (i != attempt) {
+          to_cancel.push_back(call->rpcs[i].get());
+        }
+      }
+    }
+    for (Rpc* rpc : to_cancel) {
+      call->prediction_service->CancelRpc(rpc);
+    }
+    call->hedge_alarm.Cancel();
+    if (call->cancellation_manager != nullptr) {
+      // Does not wait for CancelCall(), which may be calling back.
+      call->cancellation_manager->TryDeregisterCallback(
+          call->cancellation_token);
+    }
+    if (status.ok()) {
+      call->latency_tracker->Record(absl::Now() - call->start);
+    }
+    call->span->End();
+    call->done(status, &call->responses[attempt]);
+  }
+
+  // Cancels the attempts of 'call', as its step is cancelled.
+  static void CancelCall(Call* call) {
+    std::vector<Rpc*> to_cancel;
+    {
+      mutex_lock l(call->mu);
+      call->cancelled = true;
+      for (int i = 0; i < call->num_attempts; ++i) {
+        to_cancel.push_back(call->rpcs[i].get());
+      }
+    }
+    for (Rpc* rpc : to_cancel) {
+      call->prediction_service->CancelRpc(rpc);
+    }
+  }
+
+  // Sends the RPC of 'task' alone. 'owner' keeps the task alive until done.
+  void SendTask(RemotePredictTask* task, std::shared_ptr<void> owner) {
+    PredictRequest* request = NewRequest(task->output_tensor_aliases);
+    for (int i = 0; i < task->input_tensor_aliases.size(); ++i) {
+      AddInput(task->input_tensor_aliases[i], task->input_tensors[i], request);
+    }
+    SendRequest(request, task->context->cancellation_manager(),
+                [this, task, owner](const absl::Status& status,
+                                    PredictResponse* response) {
+                  PostProcessResponse(task->context, response, status,
+                                      fail_op_on_rpc_error_,
+                                      task->output_tensor_aliases, task->done);
+                });
+  }
 
-    PredictResponse* response = new PredictResponse();
+  // Sends the tasks of 'unique_batch' in a single RPC.
+  void ProcessBatch(std::unique_ptr<Batch<RemotePredictTask>> unique_batch) {
+    std::shared_ptr<Batch<RemotePredictTask>> batch(std::move(unique_batch));
+    batch->WaitUntilClosed();
+    if (batch->empty()) {
+      return;
+    }
+    // The tasks with other aliases than the first one, e.g. if the aliases
+    // are computed, are sent alone.
+    const RemotePredictTask& first = batch->task(0);
+    std::vector<RemotePredictTask*> tasks;
+    for (int i = 0; i < batch->num_tasks(); ++i) {
+      RemotePredictTask* task = batch->mutable_task(i);
+      if (task->input_tensor_aliases == first.input_tensor_aliases &&
+          task->output_tensor_aliases == first.output_tensor_aliases) {
+        tasks.push_back(task);
+      } else {
+        SendTask(task, batch);
+      }
+    }
+    if (tasks.size() == 1) {
+      SendTask(tasks[0], batch);
+      return;
+    }
 
-    auto rpc = prediction_service_->CreateRpc(
-        absl::Milliseconds(max_rpc_deadline_millis_));
+    PredictRequest* request = NewRequest(first.output_tensor_aliases);
+    for (int i = 0; i < first.input_tensor_aliases.size(); ++i) {
+      std::vector<Tensor> to_concatenate;
+      to_concatenate.reserve(tasks.size());
+      for (const RemotePredictTask* task : tasks) {
+        to_concatenate.push_back(task->input_tensors[i]);
+      }
+      Tensor concatenated;
+      if (!tensor::Concat(to_concatenate, &concatenated).ok()) {
+        // The inputs differ in type or in their other dimensions.
+        delete request;
+        for (RemotePredictTask* task : tasks) {
+          SendTask(task, batch);
+        }
+        return;
+      }
+      AddInput(first.input_tensor_aliases[i], concatenated, request);
+    }
 
-    auto callback = [this, context, rpc, request, response,
-                     output_tensor_aliases, done](const absl::Status& status) {
-      PostProcessResponse(context, response, status, fail_op_on_rpc_error_,
-                          output_tensor_aliases, [&]() {
-                            delete rpc;
-                            delete request;
-                            delete response;
-                            done();
-                          });
+    auto done = [this, batch, tasks](const absl::Status& status,
+                                     PredictResponse* response) {
+      const std::vector<string>& output_tensor_aliases =
+          tasks[0]->output_tensor_aliases;
+      std::vector<std::vector<Tensor>> task_outputs(tasks.size());
+      Status outputs_status;
+      if (status.ok()) {
+        std::vector<Tensor> output_tensors;
+        outputs_status =
+            ParseOutputs(output_tensor_aliases, response, &output_tensors);
+        std::vector<int64> batch_sizes;
+        for (const RemotePredictTask* task : tasks) {
+          batch_sizes.push_back(task->batch_size);
+        }
+        for (int i = 0; outputs_status.ok() && i < output_tensors.size();
+             ++i) {
+          std::vector<Tensor> split;
+          outputs_status =
+              tensor::Split(output_tensors[i], batch_sizes, &split);
+          if (!outputs_status.ok()) {
+            outputs_status = errors::Internal(
+                "Response tensor: ", output_tensor_aliases[i],
+                " cannot be split back into the batched requests: ",
+                outputs_status.error_message());
+            break;
+          }
+          for (int j = 0; j < tasks.size(); ++j) {
+            task_outputs[j].push_back(std::move(split[j]));
+          }
+        }
+      }
+      for (int j = 0; j < tasks.size(); ++j) {
+        SetOutputs(tasks[j]->context, status, fail_op_on_rpc_error_,
+                   outputs_status, task_outputs[j], tasks[j]->done);
+      }
     };
-    // Make the RPC call.
-    prediction_service_->Predict(rpc, request, response, callback);
+    // The RPC serves several steps, so is not cancelled with one of them.
+    SendRequest(request, /*cancellation_manager=*/nullptr, std::move(done));
   }
 
-  void PostProcessResponse(OpKernelContext* context, PredictResponse* response,
-                           const absl::Status& rpc_status,
-                           bool fail_op_on_rpc_error,
-                           TTypes<const tstring>::Flat output_tensor_aliases,
-                           DoneCallback rpc_done) {
+  // Converts the outputs of 'response' back to tensors, in the order of
+  // 'output_tensor_aliases'.
+  static Status ParseOutputs(const std::vector<string>& output_tensor_aliases,
+                             PredictResponse* response,
+                             std::vector<Tensor>* output_tensors) {
+    AliasTensorMap& outputs = *response->mutable_outputs();
+    for (const string& alias : output_tensor_aliases) {
+      Tensor output_tensor;
+      if (!output_tensor.FromProto(outputs[alias])) {
+        return errors::Internal("Response tensor proto: ", alias,
+                                " cannot be converted back to a tensor.");
+      }
+      output_tensors->push_back(std::move(output_tensor));
+    }
+    return Status::OK();
+  }
+
+  // Sets the outputs of the op: the status of the RPC, and 'output_tensors'
+  // if both 'rpc_status' and 'outputs_status' are OK.
+  void SetOutputs(OpKernelContext* context, const absl::Status& rpc_status,
+                  bool fail_op_on_rpc_error, const Status& outputs_status,
+                  const std::vector<Tensor>& output_tensors,
+                  DoneCallback rpc_done) {
     auto rpc_cleaner = gtl::MakeCleanup([&] { rpc_done(); });
     Tensor* status_code;
     OP_REQUIRES_OK_ASYNC(
@@ -162,33 +597,32 @@ class RemotePredictOp : public AsyncOpKernel {
         return;
       }
     }
+    OP_REQUIRES_OK_ASYNC(context, outputs_status, rpc_cleaner.release());
     OP_REQUIRES_ASYNC(
-        context, output_tensors_list.size() == output_tensor_aliases.size(),
+        context, output_tensors_list.size() == output_tensors.size(),
         errors::Internal(
             "Response doesn't have the right number of outputs; actual: ",
-            output_tensors_list.size(),
-            " expected: ", output_tensor_aliases.size()),
+            output_tensors_list.size(), " expected: ", output_tensors.size()),
         rpc_cleaner.release());
-    AliasTensorMap& outputs = *response->mutable_outputs();
-    for (int i = 0; i < output_tensor_aliases.size(); i++) {
-      Tensor output_tensor;
-      OP_REQUIRES_ASYNC(
-          context, output_tensor.FromProto(outputs[output_tensor_aliases(i)]),
-          errors::Internal("Response tensor proto: ",
-                           tensorflow::string(output_tensor_aliases(i)),
-                           " cannot be converted back to a tensor."),
-          rpc_cleaner.release());
-      output_tensors_list.set(i, output_tensor);
+    for (int i = 0; i < output_tensors.size(); i++) {
+      output_tensors_list.set(i, output_tensors[i]);
     }
   }
 
- private:
   string model_name_;
   int64 model_version_;
   bool fail_op_on_rpc_error_;
   int64 max_rpc_deadline_millis_;
   string signature_name_;
-  std::unique_ptr<PredictionServiceStubType> prediction_service_;
+  int64 max_batch_size_;
+  int64 hedge_delay_millis_;
+  // Shared with the calls, whose hedged attempts may start after the op is
+  // done with them.
+  std::shared_ptr<PredictionServiceStubType> prediction_service_;
+  RpcLatencyTracker latency_tracker_{kHedgeLatencyPercentile};
+  // Batches the executions of the op, if 'max_batch_size_' is positive.
+  // Destroyed first, as it waits for the batches being processed.
+  std::unique_ptr<BasicBatchScheduler<RemotePredictTask>> batch_scheduler_;
 };
 
 }  // namespace serving
@@ -14,12 +14,20 @@ limitations under the License.
 ==============================================================================*/
 #include "tensorflow_serving/experimental/tensorflow/ops/remote_predict/kernels/remote_predict_op_kernel.h"
 
+#include <atomic>
+#include <map>
+#include <memory>
+#include <vector>
+
 #include "absl/status/status.h"
 #include "absl/time/time.h"
 #include "tensorflow/cc/client/client_session.h"
 #include "tensorflow/cc/ops/const_op.h"
 #include "tensorflow/core/framework/tensor_testutil.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/protobuf/config.pb.h"
 #include "tensorflow_serving/apis/prediction_service.grpc.pb.h"
 #include "tensorflow_serving/experimental/tensorflow/ops/remote_predict/cc/ops/remote_predict_op.h"
 
@@ -34,6 +42,7 @@ class MockRpc {};
 class MockPredictionService {
  public:
   static absl::Status Create(const string& target_address,
+                             int num_channels_per_target,
                              std::unique_ptr<MockPredictionService>* service) {
     service->reset(new MockPredictionService(target_address));
     return ::absl::OkStatus();
@@ -45,15 +54,34 @@ class MockPredictionService {
   void Predict(MockRpc* rpc, PredictRequest* request, PredictResponse* response,
                std::function<void(absl::Status status)> callback);
 
+  // Calls back the RPCs held by Predict() with a CANCELLED status.
+  void CancelRpc(MockRpc* rpc);
+
+  // Number of calls of Predict().
+  static std::atomic<int> num_predict_calls;
+
   static constexpr char kGoodModel[] = "good_model";
   static constexpr char kBadModel[] = "bad_model";
+  // Never replies, until cancelled.
+  static constexpr char kHangingModel[] = "hanging_model";
+  // Never replies to its first RPC, until cancelled, and replies to the
+  // others as kGoodModel.
+  static constexpr char kSlowReplicaModel[] = "slow_replica_model";
 
  private:
   MockPredictionService(const string& target_address);
+
+  mutex mu_;
+  std::map<MockRpc*, std::function<void(absl::Status status)>> held_rpcs_
+      GUARDED_BY(mu_);
+  bool slow_replica_called_ GUARDED_BY(mu_) = false;
 };
 
+std::atomic<int> MockPredictionService::num_predict_calls{0};
 constexpr char MockPredictionService::kGoodModel[];
 constexpr char MockPredictionService::kBadModel[];
+constexpr char MockPredictionService::kHangingModel[];
+constexpr char MockPredictionService::kSlowReplicaModel[];
 
 typedef google::protobuf::Map<tensorflow::string, tensorflow::TensorProto> AliasTensorMap;
 
@@ -62,8 +90,23 @@ MockPredictionService::MockPredictionService(const string& target_address) {}
 void MockPredictionService::Predict(
     MockRpc* rpc, PredictRequest* request, PredictResponse* response,
     std::function<void(absl::Status status)> callback) {
+  ++num_predict_calls;
   // Use model name to specify the behavior of each test.
   std::string model_name = request->model_spec().name();
+  if (model_name == kHangingModel) {
+    mutex_lock l(mu_);
+    held_rpcs_[rpc] = callback;
+    return;
+  }
+  if (model_name == kSlowReplicaModel) {
+    mutex_lock l(mu_);
+    if (!slow_replica_called_) {
+      slow_replica_called_ = true;
+      held_rpcs_[rpc] = callback;
+      return;
+    }
+    model_name = kGoodModel;
+  }
   if (model_name == kGoodModel) {
     *(response->mutable_model_spec()) = request->model_spec();
     AliasTensorMap& inputs = *request->mutable_inputs();
@@ -78,6 +121,20 @@ void MockPredictionService::Predict(
   }
 }
 
+void MockPredictionService::CancelRpc(MockRpc* rpc) {
+  std::function<void(absl::Status status)> callback;
+  {
+    mutex_lock l(mu_);
+    auto it = held_rpcs_.find(rpc);
+    if (it == held_rpcs_.end()) {
+      return;
+    }
+    callback = std::move(it->second);
+    held_rpcs_.erase(it);
+  }
+  callback(absl::CancelledError("Cancelled"));
+}
+
 REGISTER_KERNEL_BUILDER(Name("TfServingRemotePredict").Device(DEVICE_CPU),
                         RemotePredictOp<MockPredictionService>);
 
@@ -164,6 +221,134 @@ TEST(RemotePredictTest, TestRpcErrorReturnStatus) {
   EXPECT_EQ("Aborted", outputs[1].scalar<tensorflow::tstring>()());
 }
 
+TEST(RemotePredictTest, TestBatchedConcurrentExecutions) {
+  const Scope scope = Scope::DisabledShapeInferenceScope();
+  auto input_tensor_aliases = ops::Const(
+      scope.WithOpName("input_tensor_aliases"), {"input0", "input1"});
+  auto input_tensors0 = ops::Const(scope.WithOpName("input_tensors0"), {1, 2});
+  auto input_tensors1 = ops::Const(scope.WithOpName("input_tensors1"), {3, 4});
+  auto output_tensor_aliases = ops::Const(
+      scope.WithOpName("output_tensor_aliases"), {"output0", "output1"});
+  // The batch fills up with 4 executions of 2 elements each.
+  auto remote_predict = RemotePredict(
+      scope, input_tensor_aliases, {input_tensors0, input_tensors1},
+      output_tensor_aliases, {DT_INT32, DT_INT32},
+      RemotePredict::Attrs()
+          .ModelName(MockPredictionService::kGoodModel)
+          .MaxBatchSize(8)
+          .BatchTimeoutMicros(60 * 1000 * 1000));
+  TF_ASSERT_OK(scope.status());
+  const std::vector<Output> fetch_outputs = {
+      remote_predict.status_code, remote_predict.output_tensors[0],
+      remote_predict.output_tensors[1]};
+
+  ClientSession session(scope);
+  constexpr int kNumExecutions = 4;
+  std::vector<Status> statuses(kNumExecutions);
+  std::vector<std::vector<Tensor>> outputs(kNumExecutions);
+  const int num_predict_calls = MockPredictionService::num_predict_calls;
+  {
+    std::vector<std::unique_ptr<Thread>> threads;
+    for (int i = 0; i < kNumExecutions; ++i) {
+      threads.emplace_back(Env::Default()->StartThread({}, "execution", [&, i] {
+        statuses[i] = session.Run(fetch_outputs, &outputs[i]);
+      }));
+    }
+  }
+  EXPECT_EQ(num_predict_calls + 1, MockPredictionService::num_predict_calls);
+  for (int i = 0; i < kNumExecutions; ++i) {
+    TF_ASSERT_OK(statuses[i]);
+    ASSERT_EQ(3, outputs[i].size());
+    EXPECT_EQ(0, outputs[i][0].scalar<int>()());
+    test::ExpectTensorEqual<int>(outputs[i][1], test::AsTensor<int>({1, 2}));
+    test::ExpectTensorEqual<int>(outputs[i][2], test::AsTensor<int>({3, 4}));
+  }
+}
+
+TEST(RemotePredictTest, TestLargerThanMaxBatchSize) {
+  const Scope scope = Scope::DisabledShapeInferenceScope();
+  auto input_tensor_aliases = ops::Const(
+      scope.WithOpName("input_tensor_aliases"), {"input0", "input1"});
+  auto input_tensors0 = ops::Const(scope.WithOpName("input_tensors0"), {1, 2});
+  auto input_tensors1 = ops::Const(scope.WithOpName("input_tensors1"), {3, 4});
+  auto output_tensor_aliases = ops::Const(
+      scope.WithOpName("output_tensor_aliases"), {"output0", "output1"});
+  // Sent alone, without waiting for the batch timeout.
+  auto remote_predict = RemotePredict(
+      scope, input_tensor_aliases, {input_tensors0, input_tensors1},
+      output_tensor_aliases, {DT_INT32, DT_INT32},
+      RemotePredict::Attrs()
+          .ModelName(MockPredictionService::kGoodModel)
+          .MaxBatchSize(1)
+          .BatchTimeoutMicros(60 * 1000 * 1000));
+  TF_ASSERT_OK(scope.status());
+
+  ClientSession session(scope);
+  std::vector<Tensor> outputs;
+  TF_ASSERT_OK(session.Run({remote_predict.status_code,
+                            remote_predict.output_tensors[0],
+                            remote_predict.output_tensors[1]},
+                           &outputs));
+  EXPECT_EQ(0, outputs[0].scalar<int>()());
+  test::ExpectTensorEqual<int>(outputs[1], test::AsTensor<int>({1, 2}));
+  test::ExpectTensorEqual<int>(outputs[2], test::AsTensor<int>({3, 4}));
+}
+
+TEST(RemotePredictTest, TestHedgedRequest) {
+  const int num_predict_calls = MockPredictionService::num_predict_calls;
+  const Scope scope = Scope::DisabledShapeInferenceScope();
+  auto input_tensor_aliases = ops::Const(
+      scope.WithOpName("input_tensor_aliases"), {"input0", "input1"});
+  auto input_tensors0 = ops::Const(scope.WithOpName("input_tensors0"), {1, 2});
+  auto input_tensors1 = ops::Const(scope.WithOpName("input_tensors1"), {3, 4});
+  auto output_tensor_aliases = ops::Const(
+      scope.WithOpName("output_tensor_aliases"), {"output0", "output1"});
+  // The first RPC never replies: the hedged one does.
+  auto remote_predict = RemotePredict(
+      scope, input_tensor_aliases, {input_tensors0, input_tensors1},
+      output_tensor_aliases, {DT_INT32, DT_INT32},
+      RemotePredict::Attrs()
+          .ModelName(MockPredictionService::kSlowReplicaModel)
+          .HedgeDelayMillis(10));
+  TF_ASSERT_OK(scope.status());
+
+  ClientSession session(scope);
+  std::vector<Tensor> outputs;
+  TF_ASSERT_OK(session.Run({remote_predict.status_code,
+                            remote_predict.output_tensors[0],
+                            remote_predict.output_tensors[1]},
+                           &outputs));
+  EXPECT_EQ(num_predict_calls + 2, MockPredictionService::num_predict_calls);
+  EXPECT_EQ(0, outputs[0].scalar<int>()());
+  test::ExpectTensorEqual<int>(outputs[1], test::AsTensor<int>({1, 2}));
+  test::ExpectTensorEqual<int>(outputs[2], test::AsTensor<int>({3, 4}));
+}
+
+TEST(RemotePredictTest, TestRunOptionsDeadline) {
+  const Scope scope = Scope::DisabledShapeInferenceScope();
+  auto input_tensor_aliases = ops::Const(
+      scope.WithOpName("input_tensor_aliases"), {"input0", "input1"});
+  auto input_tensors0 = ops::Const(scope.WithOpName("input_tensors0"), {1, 2});
+  auto input_tensors1 = ops::Const(scope.WithOpName("input_tensors1"), {3, 4});
+  auto output_tensor_aliases = ops::Const(
+      scope.WithOpName("output_tensor_aliases"), {"output0", "output1"});
+  auto remote_predict = RemotePredict(
+      scope, input_tensor_aliases, {input_tensors0, input_tensors1},
+      output_tensor_aliases, {DT_INT32, DT_INT32},
+      RemotePredict::Attrs().ModelName(MockPredictionService::kHangingModel));
+  TF_ASSERT_OK(scope.status());
+
+  // The RPC is cancelled with the step when its deadline expires, instead of
+  // after max_rpc_deadline_millis.
+  ClientSession session(scope);
+  RunOptions run_options;
+  run_options.set_timeout_in_ms(100);
+  std::vector<Tensor> outputs;
+  const auto status = session.Run(run_options, {}, {remote_predict.status_code},
+                                  {}, &outputs, nullptr);
+  EXPECT_EQ(error::Code::DEADLINE_EXCEEDED, status.code());
+}
+
 }  // namespace
 }  // namespace serving
 }  // namespace tensorflow
@@ -26,6 +26,10 @@ REGISTER_OP("TfServingRemotePredict")
     .Attr("fail_op_on_rpc_error: bool = true")
     .Attr("max_rpc_deadline_millis: int = 30000")
     .Attr("signature_name: string = 'serving_default'")
+    .Attr("num_channels_per_target: int = 1")
+    .Attr("max_batch_size: int = 0")
+    .Attr("batch_timeout_micros: int = 0")
+    .Attr("hedge_delay_millis: int = 0")
     .Input("input_tensor_aliases: string")
     .Input("input_tensors: T")
     .Input("output_tensor_aliases: string")
@@ -84,10 +88,26 @@ fail_op_on_rpc_error: If set true, the Op fails if the rpc fails, and returns
   Op returns the status of the rpc call, along with the output tensors, if any.
   Set true by default.
 max_rpc_deadline_millis: The rpc deadline for remote predict. The actual
-deadline is min(incoming_rpc_deadline, max_rpc_deadline_millis).
+deadline is min(incoming_rpc_deadline, max_rpc_deadline_millis). The rpc is also
+  cancelled with the step running the op, e.g. when the RunOptions deadline
+  expires.
+hedge_delay_millis: If positive, an rpc still pending after this delay is sent
+  again, possibly to another channel, and the first successful reply is taken.
+  If -1, the delay is the 95th percentile of the latencies of the recent rpcs
+  of the op. Set 0 (no hedging) by default.
 signature_name: the signature def for remote graph inference, defaulting to 
 "serving_default".
-target_address: Address of the server hosting the remote graph.
+target_address: Address of the server hosting the remote graph, or a comma
+  separated list of addresses of the servers to balance the rpcs across.
+num_channels_per_target: The number of channels, i.e. connections, to open to
+  each address. The rpcs are sent on the least loaded of two channels picked at
+  random.
+max_batch_size: If positive, the concurrent executions of the op are batched
+  into a single rpc of up to max_batch_size along the 0th dimension of the
+  input tensors, and the output tensors are split back along it. Executions
+  whose input tensors do not have a common 0th dimension are sent alone.
+batch_timeout_micros: The maximum time an execution waits for others to be
+  batched with, when max_batch_size is positive.
 model_name: Model name of the remote TF graph.
 model_version: the target version for the Predict call. When unset, the
   default value (-1) implies the latest available version should be used.
@@ -42,7 +42,11 @@ def run(input_tensor_alias,
         max_rpc_deadline_millis=3000,
         output_types=None,
         name=None,
-        signature_name='serving_default'):
+        signature_name='serving_default',
+        num_channels_per_target=1,
+        max_batch_size=0,
+        batch_timeout_micros=0,
+        hedge_delay_millis=0):
   """Runs a predict in remote process through rpc.
 
   Args:
@@ -57,6 +61,13 @@ def run(input_tensor_alias,
     output_types: output types for Predict
     name: name for the op in the graph
     signature_name: the signature def for remote graph inference
+    num_channels_per_target: number of connections to each of the comma
+      separated addresses of target_address, to balance the rpcs across
+    max_batch_size: if positive, the concurrent runs of the op are batched into
+      rpcs of up to max_batch_size along the 0th dimension of the inputs
+    batch_timeout_micros: maximum time a run waits for others to batch with
+    hedge_delay_millis: if positive, delay after which a pending rpc is sent
+      again and the first reply taken; -1 for the p95 of the recent latencies
 
   Returns:
     output_tensors as a result of the Predict.
@@ -75,6 +86,10 @@ def run(input_tensor_alias,
       fail_op_on_rpc_error=True,
       max_rpc_deadline_millis=max_rpc_deadline_millis,
       signature_name=signature_name,
+      num_channels_per_target=num_channels_per_target,
+      max_batch_size=max_batch_size,
+      batch_timeout_micros=batch_timeout_micros,
+      hedge_delay_millis=hedge_delay_millis,
       output_types=output_types,
       name=name))[2]
 
@@ -88,7 +103,11 @@ def run_returning_status(input_tensor_alias,
                          max_rpc_deadline_millis=3000,
                          output_types=None,
                          name=None,
-                         signature_name='serving_default'):
+                         signature_name='serving_default',
+                         num_channels_per_target=1,
+                         max_batch_size=0,
+                         batch_timeout_micros=0,
+        hedge_delay_millis=0):
   """Runs a predict in remote process through rpc.
 
   Args:
@@ -103,6 +122,13 @@ def run_returning_status(input_tensor_alias,
     output_types: output types for Predict
     name: name for the op in the graph
     signature_name: the signature def for remote graph inference
+    num_channels_per_target: number of connections to each of the comma
+      separated addresses of target_address, to balance the rpcs across
+    max_batch_size: if positive, the concurrent runs of the op are batched into
+      rpcs of up to max_batch_size along the 0th dimension of the inputs
+    batch_timeout_micros: maximum time a run waits for others to batch with
+    hedge_delay_millis: if positive, delay after which a pending rpc is sent
+      again and the first reply taken; -1 for the p95 of the recent latencies
 
   Returns:
     status_code, status_error_message and output_tensors.
@@ -121,5 +147,9 @@ def run_returning_status(input_tensor_alias,
       fail_op_on_rpc_error=False,
       max_rpc_deadline_millis=max_rpc_deadline_millis,
       signature_name=signature_name,
+      num_channels_per_target=num_channels_per_target,
+      max_batch_size=max_batch_size,
+      batch_timeout_micros=batch_timeout_micros,
+      hedge_delay_millis=hedge_delay_millis,
       output_types=output_types,
       name=name))
@@ -0,0 +1,263 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/model_servers/admission_controller.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <list>
+
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/monitoring/counter.h"
+#include "tensorflow/core/platform/fingerprint.h"
+
+namespace tensorflow {
+namespace serving {
+
+namespace {
+
+auto* admission_rejected_count = monitoring::Counter<2>::New(
+    "/tensorflow/serving/admission_rejected_count",
+    "The number of requests rejected by the admission control.",
+    "model_name", "reason");
+
+constexpr uint64 kNoLatency = std::numeric_limits<uint64>::max();
+
+// Tokens refilled at 'rate' per second, up to 'capacity'.
+struct TokenBucket {
+  double tokens = -1;
+  uint64 refill_micros = 0;
+
+  // Refills the bucket up to 'now_micros'. Returns whether it is full.
+  bool Refill(const double rate, const double capacity,
+              const uint64 now_micros) {
+    if (tokens < 0) {
+      // A new bucket.
+      tokens = capacity;
+    } else if (now_micros > refill_micros) {
+      const double elapsed_seconds = (now_micros - refill_micros) / 1e6;
+      tokens = std::min(capacity, tokens + elapsed_seconds * rate);
+    }
+    refill_micros = now_micros;
+    return tokens >= capacity;
+  }
+};
+
+// The size of the token buckets at 'rate'.
+double BucketCapacity(const AdmissionController::Options& options,
+                      const double rate) {
+  return std::max(1.0, rate * options.burst_seconds);
+}
+
+}  // namespace
+
+class AdmissionController::ModelState {
+ public:
+  mutex mu;
+  // The number of admitted requests not completed yet.
+  int num_in_flight TF_GUARDED_BY(mu) = 0;
+  // End of the current interval.
+  uint64 interval_end_micros TF_GUARDED_BY(mu) = 0;
+  // The shortest latency of the requests completed during the current
+  // interval, or kNoLatency.
+  uint64 min_latency_micros TF_GUARDED_BY(mu) = kNoLatency;
+  // Whether the shortest latency exceeded the target during the last interval.
+  bool overloaded TF_GUARDED_BY(mu) = false;
+  // The number of requests rejected since the model is overloaded, and the
+  // time of the next rejection.
+  int64 num_shed TF_GUARDED_BY(mu) = 0;
+  uint64 next_shed_micros TF_GUARDED_BY(mu) = 0;
+  // The requests admitted under 'max_requests_per_second_per_model'.
+  TokenBucket bucket TF_GUARDED_BY(mu);
+  // The requests admitted under 'max_requests_per_second_per_client', by
+  // fingerprint of the client id, most recently used first. The ids are
+  // supplied by the clients, so only their fingerprints are kept, and at most
+  // 'max_clients_per_model' of them.
+  struct ClientBucket {
+    uint64 client_fingerprint;
+    TokenBucket bucket;
+  };
+  std::list<ClientBucket> client_buckets TF_GUARDED_BY(mu);
+  std::unordered_map<uint64, std::list<ClientBucket>::iterator>
+      client_bucket_index TF_GUARDED_BY(mu);
+
+  // Returns the bucket of the client with fingerprint 'client_fingerprint',
+  // marked as the most recently used. A new bucket replaces the least recently
+  // used one if there are 'max_clients' of them already.
+  TokenBucket* GetClientBucket(const uint64 client_fingerprint,
+                               const size_t max_clients)
+      TF_EXCLUSIVE_LOCKS_REQUIRED(mu) {
+    const auto it = client_bucket_index.find(client_fingerprint);
+    if (it != client_bucket_index.end()) {
+      client_buckets.splice(client_buckets.begin(), client_buckets,
+                            it->second);
+      return &it->second->bucket;
+    }
+    if (!client_buckets.empty() && client_buckets.size() >= max_clients) {
+      client_bucket_index.erase(client_buckets.back().client_fingerprint);
+      client_buckets.pop_back();
+    }
+    client_buckets.push_front({client_fingerprint, TokenBucket()});
+    client_bucket_index[client_fingerprint] = client_buckets.begin();
+    return &client_buckets.front().bucket;
+  }
+
+  // Starts a new interval if the current one ended at 'now_micros'.
+  void MaybeEndInterval(const Options& options, const uint64 now_micros)
+      TF_EXCLUSIVE_LOCKS_REQUIRED(mu) {
+    if (now_micros < interval_end_micros) {
+      return;
+    }
+    if (min_latency_micros != kNoLatency) {
+      overloaded = min_latency_micros > options.target_latency_micros;
+    } else {
+      // No request completed during the interval: the model is still
+      // overloaded if its requests are stuck.
+      overloaded = overloaded && num_in_flight > 0;
+    }
+    if (!overloaded) {
+      num_shed = 0;
+      next_shed_micros = 0;
+    }
+    min_latency_micros = kNoLatency;
+    interval_end_micros = now_micros + options.interval_micros;
+  }
+};
+
+AdmissionController::Ticket::Ticket(AdmissionController* const controller,
+                                    ModelState* const model_state,
+                                    const uint64 start_micros)
+    : controller_(controller),
+      model_state_(model_state),
+      start_micros_(start_micros) {}
+
+AdmissionController::Ticket::~Ticket() {
+  controller_->Complete(model_state_, start_micros_);
+}
+
+AdmissionController::AdmissionController(const Options& options)
+    : options_(options) {}
+
+AdmissionController::~AdmissionController() = default;
+
+AdmissionController::ModelState* AdmissionController::GetModelState(
+    const string& model_name) {
+  {
+    tf_shared_lock l(mu_);
+    const auto it = model_states_.find(model_name);
+    if (it != model_states_.end()) {
+      return it->second.get();
+    }
+  }
+  mutex_lock l(mu_);
+  std::unique_ptr<ModelState>& model_state = model_states_[model_name];
+  if (model_state == nullptr) {
+    model_state.reset(new ModelState());
+  }
+  return model_state.get();
+}
+
+Status AdmissionController::Admit(const string& model_name,
+                                  const string& client_id,
+                                  std::unique_ptr<Ticket>* const ticket) {
+  ticket->reset();
+  if (!enabled()) {
+    return Status::OK();
+  }
+  ModelState* const model_state = GetModelState(model_name);
+  const uint64 now_micros = options_.env->NowMicros();
+  mutex_lock l(model_state->mu);
+  if (options_.max_concurrent_requests_per_model > 0 &&
+      model_state->num_in_flight >=
+          options_.max_concurrent_requests_per_model) {
+    admission_rejected_count->GetCell(model_name, "concurrency")
+        ->IncrementBy(1);
+    return errors::Unavailable(
+        "Model ", model_name, " is already processing ",
+        options_.max_concurrent_requests_per_model,
+        " requests. Retry later.");
+  }
+  if (options_.target_latency_micros > 0) {
+    model_state->MaybeEndInterval(options_, now_micros);
+    if (model_state->overloaded &&
+        now_micros >= model_state->next_shed_micros) {
+      ++model_state->num_shed;
+      model_state->next_shed_micros =
+          now_micros + options_.interval_micros /
+                           std::sqrt(static_cast<double>(
+                               model_state->num_shed));
+      admission_rejected_count->GetCell(model_name, "latency")
+          ->IncrementBy(1);
+      return errors::Unavailable(
+          "Model ", model_name, " is overloaded: its requests took more than ",
+          options_.target_latency_micros, " microseconds. Retry later.");
+    }
+  }
+  // Both buckets are checked before a token is taken from one of them.
+  const double model_rate = options_.max_requests_per_second_per_model;
+  if (model_rate > 0) {
+    model_state->bucket.Refill(
+        model_rate, BucketCapacity(options_, model_rate), now_micros);
+    if (model_state->bucket.tokens < 1) {
+      admission_rejected_count->GetCell(model_name, "model_rate")
+          ->IncrementBy(1);
+      return errors::ResourceExhausted("Model ", model_name,
+                                       " is limited to ", model_rate,
+                                       " requests per second.");
+    }
+  }
+  const double client_rate = options_.max_requests_per_second_per_client;
+  TokenBucket* client_bucket = nullptr;
+  if (client_rate > 0) {
+    client_bucket = model_state->GetClientBucket(
+        Fingerprint64(client_id),
+        std::max(options_.max_clients_per_model, 1));
+    client_bucket->Refill(client_rate, BucketCapacity(options_, client_rate),
+                          now_micros);
+    if (client_bucket->tokens < 1) {
+      admission_rejected_count->GetCell(model_name, "client_rate")
+          ->IncrementBy(1);
+      return errors::ResourceExhausted(
+          "Client \"", client_id, "\" of model ", model_name,
+          " is limited to ", client_rate, " requests per second.");
+    }
+  }
+  if (model_rate > 0) {
+    model_state->bucket.tokens -= 1;
+  }
+  if (client_bucket != nullptr) {
+    client_bucket->tokens -= 1;
+  }
+  ++model_state->num_in_flight;
+  ticket->reset(new Ticket(this, model_state, now_micros));
+  return Status::OK();
+}
+
+void AdmissionController::Complete(ModelState* const model_state,
+                                   const uint64 start_micros) {
+  const uint64 now_micros = options_.env->NowMicros();
+  mutex_lock l(model_state->mu);
+  --model_state->num_in_flight;
+  if (options_.target_latency_micros > 0) {
+    model_state->min_latency_micros =
+        std::min(model_state->min_latency_micros,
+                 now_micros - std::min(now_micros, start_micros));
+    model_state->MaybeEndInterval(options_, now_micros);
+  }
+}
+
+}  // namespace serving
+}  // namespace tensorflow
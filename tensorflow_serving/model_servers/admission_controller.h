@@ -0,0 +1,165 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_MODEL_SERVERS_ADMISSION_CONTROLLER_H_
+#define TENSORFLOW_SERVING_MODEL_SERVERS_ADMISSION_CONTROLLER_H_
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace serving {
+
+// Rejects the inference requests of overloaded models before they are
+// processed, with a retryable UNAVAILABLE error, instead of letting them wait
+// in the batching queues until they time out.
+//
+// A model is overloaded if either:
+//   o It is processing 'max_concurrent_requests_per_model' requests.
+//   o A queue is standing in front of it, as detected by CoDel (Nichols and
+//     Jacobson, "Controlling Queue Delay"): the shortest latency of the
+//     requests of the model completed during an interval of
+//     'interval_micros' exceeds 'target_latency_micros'. While this holds,
+//     requests are rejected at an increasing rate: the n-th rejection comes
+//     interval_micros / sqrt(n) after the previous one. The queue then drains,
+//     so that the admitted requests complete within their deadline and the
+//     goodput stays at the capacity of the model.
+//
+// The target latency should be above the latency of the model when it is not
+// overloaded, e.g. a few times its batch timeout.
+//
+// Independently of the load, the rate of the requests of each model, and of
+// each client of each model, can be limited with token buckets: requests over
+// the rate, after a burst of 'burst_seconds' worth of requests, are rejected
+// with a RESOURCE_EXHAUSTED error. This keeps one caller of one model from
+// taking the capacity (e.g. the shared batch threads) of the other callers and
+// models. The clients are identified by the 'client_id_metadata_key' gRPC
+// metadata or HTTP header of their requests.
+//
+// This class is thread-safe.
+class AdmissionController {
+ public:
+  struct Options {
+    // The max number of requests of a model processed at once. 0 means no
+    // limit.
+    int max_concurrent_requests_per_model = 0;
+    // The CoDel target latency. 0 disables the latency based shedding.
+    int64 target_latency_micros = 0;
+    // The CoDel interval, at least the latency of the requests when a queue
+    // forms.
+    int64 interval_micros = 100 * 1000;
+    // The max rate of the requests of each model, in requests per second. 0
+    // means no limit.
+    double max_requests_per_second_per_model = 0;
+    // The max rate of the requests of each client to each model, in requests
+    // per second. 0 means no limit.
+    double max_requests_per_second_per_client = 0;
+    // The max number of clients whose rate is tracked for each model. Past
+    // this number, the least recently seen client of the model is forgotten,
+    // and its next request starts from a full bucket.
+    int max_clients_per_model = 10000;
+    // The size of the token buckets, in seconds of requests at the max rate.
+    // A bucket holds at least one request.
+    double burst_seconds = 1;
+    // The gRPC metadata key, or HTTP header, carrying the id of the client of
+    // a request. The requests without it are from the same client "".
+    string client_id_metadata_key = "x-client-id";
+    // The environment to use for time.
+    Env* env = Env::Default();
+  };
+
+  class ModelState;
+
+  // An admitted request. Destroying the ticket marks the request as completed.
+  class Ticket {
+   public:
+    ~Ticket();
+
+   private:
+    friend class AdmissionController;
+
+    Ticket(AdmissionController* controller, ModelState* model_state,
+           uint64 start_micros);
+
+    AdmissionController* const controller_;
+    ModelState* const model_state_;
+    const uint64 start_micros_;
+
+    TF_DISALLOW_COPY_AND_ASSIGN(Ticket);
+  };
+
+  explicit AdmissionController(const Options& options);
+  ~AdmissionController();
+
+  // Tests if any limit is set. If not, all the requests are admitted.
+  bool enabled() const {
+    return options_.max_concurrent_requests_per_model > 0 ||
+           options_.target_latency_micros > 0 ||
+           options_.max_requests_per_second_per_model > 0 ||
+           options_.max_requests_per_second_per_client > 0;
+  }
+
+  // See Options::client_id_metadata_key.
+  const string& client_id_metadata_key() const {
+    return options_.client_id_metadata_key;
+  }
+
+  // Admits a request of 'client_id' to 'model_name' and sets 'ticket', to be
+  // destroyed once the request completes. Returns an UNAVAILABLE error if the
+  // model is overloaded, or a RESOURCE_EXHAUSTED error if the model or the
+  // client exceeds its rate. 'ticket' is null if the controller is not
+  // enabled.
+  //
+  // The state of a model is kept from its first request on, so callers should
+  // only admit the requests to models that are served (i.e. whose version
+  // resolves).
+  Status Admit(const string& model_name, const string& client_id,
+               std::unique_ptr<Ticket>* ticket) TF_LOCKS_EXCLUDED(mu_);
+
+  // Admits a request of the client "".
+  Status Admit(const string& model_name, std::unique_ptr<Ticket>* ticket)
+      TF_LOCKS_EXCLUDED(mu_) {
+    return Admit(model_name, "", ticket);
+  }
+
+ private:
+  // Returns the state of 'model_name', created on first use.
+  ModelState* GetModelState(const string& model_name) TF_LOCKS_EXCLUDED(mu_);
+
+  // Called by ~Ticket().
+  void Complete(ModelState* model_state, uint64 start_micros);
+
+  const Options options_;
+
+  mutable mutex mu_;
+  // Note: The states are never removed, so that the tickets can point to them.
+  std::unordered_map<string, std::unique_ptr<ModelState>> model_states_
+      TF_GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(AdmissionController);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_MODEL_SERVERS_ADMISSION_CONTROLLER_H_
@@ -0,0 +1,164 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/model_servers/admission_controller.h"
+
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include "tensorflow/core/kernels/batching_util/fake_clock_env.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+using Ticket = AdmissionController::Ticket;
+
+TEST(AdmissionControllerTest, DisabledAdmitsEverything) {
+  AdmissionController controller({});
+  EXPECT_FALSE(controller.enabled());
+  std::vector<std::unique_ptr<Ticket>> tickets(100);
+  for (auto& ticket : tickets) {
+    TF_ASSERT_OK(controller.Admit("model", &ticket));
+    EXPECT_EQ(ticket, nullptr);
+  }
+}
+
+TEST(AdmissionControllerTest, LimitsTheConcurrentRequestsOfEachModel) {
+  AdmissionController::Options options;
+  options.max_concurrent_requests_per_model = 2;
+  AdmissionController controller(options);
+
+  std::unique_ptr<Ticket> ticket_1, ticket_2, ticket_3, other_model_ticket;
+  TF_ASSERT_OK(controller.Admit("model", &ticket_1));
+  TF_ASSERT_OK(controller.Admit("model", &ticket_2));
+  EXPECT_EQ(controller.Admit("model", &ticket_3).code(), error::UNAVAILABLE);
+  EXPECT_EQ(ticket_3, nullptr);
+  // The limit is per model.
+  TF_ASSERT_OK(controller.Admit("other_model", &other_model_ticket));
+
+  // Completing a request frees its slot.
+  ticket_1.reset();
+  TF_ASSERT_OK(controller.Admit("model", &ticket_3));
+}
+
+TEST(AdmissionControllerTest, ShedsWhileTheLatencyExceedsTheTarget) {
+  test_util::FakeClockEnv env(Env::Default());
+  AdmissionController::Options options;
+  options.target_latency_micros = 10;
+  options.interval_micros = 100;
+  options.env = &env;
+  AdmissionController controller(options);
+
+  // A request completing within the target does not trigger the shedding.
+  std::unique_ptr<Ticket> ticket;
+  TF_ASSERT_OK(controller.Admit("model", &ticket));
+  env.AdvanceByMicroseconds(5);
+  ticket.reset();
+  env.AdvanceByMicroseconds(100);
+  TF_ASSERT_OK(controller.Admit("model", &ticket));
+
+  // All the requests of the next interval are slow.
+  env.AdvanceByMicroseconds(50);
+  ticket.reset();
+  env.AdvanceByMicroseconds(100);
+  EXPECT_EQ(controller.Admit("model", &ticket).code(), error::UNAVAILABLE);
+  // The next rejection is 100 / sqrt(1) microseconds later.
+  TF_ASSERT_OK(controller.Admit("model", &ticket));
+  env.AdvanceByMicroseconds(20);
+  ticket.reset();
+  env.AdvanceByMicroseconds(80);
+  EXPECT_EQ(controller.Admit("model", &ticket).code(), error::UNAVAILABLE);
+
+  // Once a request completes within the target over an interval, the
+  // requests are admitted again.
+  TF_ASSERT_OK(controller.Admit("model", &ticket));
+  env.AdvanceByMicroseconds(1);
+  ticket.reset();
+  env.AdvanceByMicroseconds(200);
+  for (int i = 0; i < 10; ++i) {
+    std::unique_ptr<Ticket> fast_ticket;
+    TF_ASSERT_OK(controller.Admit("model", &fast_ticket));
+  }
+}
+
+TEST(AdmissionControllerTest, LimitsTheRateOfEachModel) {
+  test_util::FakeClockEnv env(Env::Default());
+  AdmissionController::Options options;
+  options.max_requests_per_second_per_model = 1000;
+  options.burst_seconds = 0.0025;
+  options.env = &env;
+  AdmissionController controller(options);
+
+  // A burst of 2 requests, then 1 request per millisecond.
+  std::unique_ptr<Ticket> ticket;
+  TF_ASSERT_OK(controller.Admit("model", &ticket));
+  TF_ASSERT_OK(controller.Admit("model", &ticket));
+  EXPECT_EQ(controller.Admit("model", &ticket).code(),
+            error::RESOURCE_EXHAUSTED);
+  TF_ASSERT_OK(controller.Admit("other_model", &ticket));
+  env.AdvanceByMicroseconds(1000);
+  TF_ASSERT_OK(controller.Admit("model", &ticket));
+  EXPECT_EQ(controller.Admit("model", &ticket).code(),
+            error::RESOURCE_EXHAUSTED);
+}
+
+TEST(AdmissionControllerTest, LimitsTheRateOfEachClient) {
+  test_util::FakeClockEnv env(Env::Default());
+  AdmissionController::Options options;
+  options.max_requests_per_second_per_client = 1000;
+  options.env = &env;
+  AdmissionController controller(options);
+
+  // The buckets hold one second of requests.
+  std::unique_ptr<Ticket> ticket;
+  for (int i = 0; i < 1000; ++i) {
+    TF_ASSERT_OK(controller.Admit("model", "abusive", &ticket));
+  }
+  EXPECT_EQ(controller.Admit("model", "abusive", &ticket).code(),
+            error::RESOURCE_EXHAUSTED);
+  // The other clients, and the other models of the client, are not limited.
+  TF_ASSERT_OK(controller.Admit("model", "other", &ticket));
+  TF_ASSERT_OK(controller.Admit("model", &ticket));
+  TF_ASSERT_OK(controller.Admit("other_model", "abusive", &ticket));
+  env.AdvanceByMicroseconds(1000);
+  TF_ASSERT_OK(controller.Admit("model", "abusive", &ticket));
+}
+
+TEST(AdmissionControllerTest, ForgetsTheLeastRecentlySeenClients) {
+  test_util::FakeClockEnv env(Env::Default());
+  AdmissionController::Options options;
+  options.max_requests_per_second_per_client = 1;
+  options.max_clients_per_model = 2;
+  options.env = &env;
+  AdmissionController controller(options);
+
+  std::unique_ptr<Ticket> ticket;
+  TF_ASSERT_OK(controller.Admit("model", "first", &ticket));
+  TF_ASSERT_OK(controller.Admit("model", "second", &ticket));
+  EXPECT_EQ(controller.Admit("model", "first", &ticket).code(),
+            error::RESOURCE_EXHAUSTED);
+  // "second" is the least recently seen client, and is forgotten for "third".
+  TF_ASSERT_OK(controller.Admit("model", "third", &ticket));
+  EXPECT_EQ(controller.Admit("model", "first", &ticket).code(),
+            error::RESOURCE_EXHAUSTED);
+  TF_ASSERT_OK(controller.Admit("model", "second", &ticket));
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,254 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/model_servers/async_prediction_service.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>  // NOLINT(build/c++11)
+#include <functional>
+
+#include "absl/strings/str_cat.h"
+#include "grpcpp/server_context.h"
+#include "grpcpp/support/async_unary_call.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace tensorflow {
+namespace serving {
+
+// The request threads, and the number of calls waiting for one of them.
+struct AsyncPredictionService::RequestQueue {
+  RequestQueue(const int num_threads, const int max_queued_calls)
+      : max_queued_calls(max_queued_calls),
+        threads(Env::Default(), "async_prediction_service", num_threads) {}
+
+  const int max_queued_calls;
+  std::atomic<int> num_queued_calls{0};
+  // Note: Destroyed first, so that the calls it waits for can still update
+  // 'num_queued_calls'.
+  thread::ThreadPool threads;
+};
+
+namespace {
+
+using GrpcService = AsyncPredictionService::GrpcService;
+using RequestQueue = AsyncPredictionService::RequestQueue;
+
+// A call of the service, from its acceptance to its response. The calls are
+// the tags of the operations on the completion queues.
+class Call {
+ public:
+  virtual ~Call() = default;
+
+  // Proceeds with the call once its pending operation completed. 'ok' is
+  // false if the operation failed, e.g. as the server shuts down.
+  virtual void Proceed(bool ok) = 0;
+};
+
+// A call of the unary method 'RequestT' -> 'ResponseT'.
+template <typename RequestT, typename ResponseT>
+class UnaryCall final : public Call {
+ public:
+  // Requests a call of the method from the service, e.g.
+  // GrpcService::RequestPredict.
+  using RequestMethod = void (GrpcService::*)(
+      ::grpc::ServerContext*, RequestT*,
+      ::grpc::ServerAsyncResponseWriter<ResponseT>*, ::grpc::CompletionQueue*,
+      ::grpc::ServerCompletionQueue*, void*);
+  // Processes a call, e.g. PredictionServiceImpl::Predict.
+  using Handler = std::function<::grpc::Status(
+      ::grpc::ServerContext*, const RequestT*, ResponseT*)>;
+
+  // Accepts the next call of the method on 'queue'.
+  static void Accept(GrpcService* service, const RequestMethod request_method,
+                     const Handler* handler,
+                     ::grpc::ServerCompletionQueue* queue,
+                     RequestQueue* request_queue) {
+    new UnaryCall(service, request_method, handler, queue, request_queue);
+  }
+
+  void Proceed(const bool ok) override {
+    if (!ok || responded_) {
+      delete this;
+      return;
+    }
+    // Accept the next call while this one is processed.
+    Accept(service_, request_method_, handler_, queue_, request_queue_);
+    if (request_queue_->num_queued_calls.fetch_add(1) >=
+        request_queue_->max_queued_calls) {
+      request_queue_->num_queued_calls.fetch_sub(1);
+      responded_ = true;
+      responder_.FinishWithError(
+          ::grpc::Status(::grpc::StatusCode::RESOURCE_EXHAUSTED,
+                         "Too many calls waiting to be processed"),
+          this);
+      return;
+    }
+    request_queue_->threads.Schedule([this]() {
+      request_queue_->num_queued_calls.fetch_sub(1);
+      responded_ = true;
+      // The client gave up on the calls that waited past their deadline.
+      if (context_.deadline() <= std::chrono::system_clock::now()) {
+        responder_.FinishWithError(
+            ::grpc::Status(::grpc::StatusCode::DEADLINE_EXCEEDED,
+                           "Deadline exceeded before the call was processed"),
+            this);
+        return;
+      }
+      const ::grpc::Status status =
+          (*handler_)(&context_, &request_, &response_);
+      responder_.Finish(response_, status, this);
+    });
+  }
+
+ private:
+  UnaryCall(GrpcService* service, const RequestMethod request_method,
+            const Handler* handler, ::grpc::ServerCompletionQueue* queue,
+            RequestQueue* request_queue)
+      : service_(service),
+        request_method_(request_method),
+        handler_(handler),
+        queue_(queue),
+        request_queue_(request_queue),
+        responder_(&context_) {
+    (service_->*request_method_)(&context_, &request_, &responder_, queue_,
+                                 queue_, this);
+  }
+
+  GrpcService* const service_;
+  const RequestMethod request_method_;
+  const Handler* const handler_;
+  ::grpc::ServerCompletionQueue* const queue_;
+  RequestQueue* const request_queue_;
+
+  ::grpc::ServerContext context_;
+  RequestT request_;
+  ResponseT response_;
+  ::grpc::ServerAsyncResponseWriter<ResponseT> responder_;
+  // Whether the response is being sent, i.e. the pending operation is the
+  // last one.
+  bool responded_ = false;
+};
+
+}  // namespace
+
+// The handlers of the methods, shared by all the calls.
+struct AsyncPredictionService::Handlers {
+  explicit Handlers(PredictionServiceImpl* impl)
+      : predict([impl](::grpc::ServerContext* context,
+                       const PredictRequest* request,
+                       PredictResponse* response) {
+          return impl->Predict(context, request, response);
+        }),
+        get_model_metadata([impl](::grpc::ServerContext* context,
+                                  const GetModelMetadataRequest* request,
+                                  GetModelMetadataResponse* response) {
+          return impl->GetModelMetadata(context, request, response);
+        }),
+        classify([impl](::grpc::ServerContext* context,
+                        const ClassificationRequest* request,
+                        ClassificationResponse* response) {
+          return impl->Classify(context, request, response);
+        }),
+        regress([impl](::grpc::ServerContext* context,
+                       const RegressionRequest* request,
+                       RegressionResponse* response) {
+          return impl->Regress(context, request, response);
+        }),
+        multi_inference([impl](::grpc::ServerContext* context,
+                               const MultiInferenceRequest* request,
+                               MultiInferenceResponse* response) {
+          return impl->MultiInference(context, request, response);
+        }) {}
+
+  const UnaryCall<PredictRequest, PredictResponse>::Handler predict;
+  const UnaryCall<GetModelMetadataRequest, GetModelMetadataResponse>::Handler
+      get_model_metadata;
+  const UnaryCall<ClassificationRequest, ClassificationResponse>::Handler
+      classify;
+  const UnaryCall<RegressionRequest, RegressionResponse>::Handler regress;
+  const UnaryCall<MultiInferenceRequest, MultiInferenceResponse>::Handler
+      multi_inference;
+};
+
+void AsyncPredictionService::PollCompletionQueue(
+    ::grpc::ServerCompletionQueue* queue) {
+  GrpcService* const service = &grpc_service_;
+  const Handlers* const handlers = handlers_.get();
+  RequestQueue* const request_queue = request_queue_.get();
+  UnaryCall<PredictRequest, PredictResponse>::Accept(
+      service, &GrpcService::RequestPredict, &handlers->predict, queue,
+      request_queue);
+  UnaryCall<GetModelMetadataRequest, GetModelMetadataResponse>::Accept(
+      service, &GrpcService::RequestGetModelMetadata,
+      &handlers->get_model_metadata, queue, request_queue);
+  UnaryCall<ClassificationRequest, ClassificationResponse>::Accept(
+      service, &GrpcService::RequestClassify, &handlers->classify, queue,
+      request_queue);
+  UnaryCall<RegressionRequest, RegressionResponse>::Accept(
+      service, &GrpcService::RequestRegress, &handlers->regress, queue,
+      request_queue);
+  UnaryCall<MultiInferenceRequest, MultiInferenceResponse>::Accept(
+      service, &GrpcService::RequestMultiInference,
+      &handlers->multi_inference, queue, request_queue);
+
+  void* tag;
+  bool ok;
+  while (queue->Next(&tag, &ok)) {
+    static_cast<Call*>(tag)->Proceed(ok);
+  }
+}
+
+AsyncPredictionService::AsyncPredictionService(const Options& options)
+    : options_(options),
+      handlers_(new Handlers(options.prediction_service)) {
+  grpc_service_.set_prediction_service(options.prediction_service);
+}
+
+AsyncPredictionService::~AsyncPredictionService() {
+  // The calls being processed respond before the queues shut down.
+  request_queue_.reset();
+  for (const auto& queue : completion_queues_) {
+    queue->Shutdown();
+  }
+  // Waits for the queues to be drained.
+  completion_queue_threads_.clear();
+}
+
+void AsyncPredictionService::AddCompletionQueues(
+    ::grpc::ServerBuilder* builder) {
+  for (int i = 0; i < std::max(options_.num_completion_queues, 1); ++i) {
+    completion_queues_.push_back(builder->AddCompletionQueue());
+  }
+}
+
+void AsyncPredictionService::Start() {
+  request_queue_.reset(
+      new RequestQueue(std::max(options_.num_request_threads, 1),
+                       std::max(options_.max_queued_calls, 1)));
+  for (int i = 0; i < completion_queues_.size(); ++i) {
+    ::grpc::ServerCompletionQueue* queue = completion_queues_[i].get();
+    completion_queue_threads_.emplace_back(Env::Default()->StartThread(
+        {}, absl::StrCat("async_prediction_service_cq_", i),
+        [this, queue]() { PollCompletionQueue(queue); }));
+  }
+  LOG(INFO) << "Serving PredictionService asynchronously with "
+            << completion_queues_.size() << " completion queues and "
+            << std::max(options_.num_request_threads, 1)
+            << " request threads";
+}
+
+}  // namespace serving
+}  // namespace tensorflow
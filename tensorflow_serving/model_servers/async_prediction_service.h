@@ -0,0 +1,138 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_MODEL_SERVERS_ASYNC_PREDICTION_SERVICE_H_
+#define TENSORFLOW_SERVING_MODEL_SERVERS_ASYNC_PREDICTION_SERVICE_H_
+
+#include <memory>
+#include <vector>
+
+#include "grpcpp/completion_queue.h"
+#include "grpcpp/server_builder.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow_serving/apis/prediction_service.grpc.pb.h"
+#include "tensorflow_serving/model_servers/prediction_service_impl.h"
+
+namespace tensorflow {
+namespace serving {
+
+// Serves the PredictionService with the gRPC asynchronous (completion queue)
+// API, instead of one synchronous gRPC thread per call.
+//
+// The streaming PredictStream method is served synchronously.
+//
+// A few threads poll the completion queues: they accept the calls and send
+// the responses. The calls are processed by PredictionServiceImpl, on a
+// separate pool of request threads. While all the request threads are busy,
+// the accepted calls wait in the queue of the pool without holding a thread,
+// so that the number of outstanding calls is not bounded by the number of
+// threads. Past 'max_queued_calls' waiting calls, the new calls fail at once
+// with RESOURCE_EXHAUSTED, and the calls whose deadline expired while they
+// waited fail with DEADLINE_EXCEEDED instead of being processed.
+//
+// Session::Run() is synchronous, so a call holds its request thread while it
+// waits in a batching queue: the request threads bound the size of the
+// batches formed, and should be at least the maximum batch size times the
+// number of concurrent batches.
+//
+// Usage:
+//   AsyncPredictionService service(options);
+//   builder.RegisterService(service.service());
+//   service.AddCompletionQueues(&builder);
+//   server = builder.BuildAndStart();
+//   service.Start();
+// The server must be shut down before the service is destroyed.
+class AsyncPredictionService {
+ public:
+  struct Options {
+    // Processes the calls. Not owned.
+    PredictionServiceImpl* prediction_service = nullptr;
+    // Number of completion queues, each polled by a thread.
+    int num_completion_queues = 1;
+    // Number of threads processing the calls.
+    int num_request_threads = 1;
+    // The max number of calls waiting for a request thread.
+    int max_queued_calls = 10000;
+  };
+
+  // Serves PredictStream synchronously, with PredictionServiceImpl.
+  class StreamService : public PredictionService::Service {
+   public:
+    void set_prediction_service(PredictionServiceImpl* prediction_service) {
+      prediction_service_ = prediction_service;
+    }
+
+    ::grpc::Status PredictStream(
+        ::grpc::ServerContext* context,
+        ::grpc::ServerReaderWriter<PredictResponse, PredictRequest>* stream)
+        override {
+      return prediction_service_->PredictStream(context, stream);
+    }
+
+   private:
+    PredictionServiceImpl* prediction_service_ = nullptr;
+  };
+
+  // The gRPC service, with the unary methods asynchronous.
+  using GrpcService = PredictionService::WithAsyncMethod_Classify<
+      PredictionService::WithAsyncMethod_Regress<
+          PredictionService::WithAsyncMethod_Predict<
+              PredictionService::WithAsyncMethod_MultiInference<
+                  PredictionService::WithAsyncMethod_GetModelMetadata<
+                      StreamService>>>>>;
+
+  // The request threads, and the calls waiting for them.
+  struct RequestQueue;
+
+  explicit AsyncPredictionService(const Options& options);
+
+  // Waits for the calls being processed, and stops polling the completion
+  // queues.
+  ~AsyncPredictionService();
+
+  // The service to register in the server.
+  ::grpc::Service* service() { return &grpc_service_; }
+
+  // Adds the completion queues of the service to 'builder'. Must be called
+  // once, before the server is built.
+  void AddCompletionQueues(::grpc::ServerBuilder* builder);
+
+  // Starts accepting calls. Must be called once, after the server is started.
+  void Start();
+
+ private:
+  struct Handlers;
+
+  // Accepts the calls of all the methods on 'queue', and proceeds with them
+  // until the queue is shut down.
+  void PollCompletionQueue(::grpc::ServerCompletionQueue* queue);
+
+  const Options options_;
+  const std::unique_ptr<const Handlers> handlers_;
+  GrpcService grpc_service_;
+  std::vector<std::unique_ptr<::grpc::ServerCompletionQueue>>
+      completion_queues_;
+  std::unique_ptr<RequestQueue> request_queue_;
+  std::vector<std::unique_ptr<Thread>> completion_queue_threads_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(AsyncPredictionService);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_MODEL_SERVERS_ASYNC_PREDICTION_SERVICE_H_
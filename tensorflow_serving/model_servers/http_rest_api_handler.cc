@@ -15,12 +15,20 @@ limitations under the License.
 
 #include "tensorflow_serving/model_servers/http_rest_api_handler.h"
 
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <memory>
 #include <string>
+#include <unordered_map>
 
 #include "google/protobuf/any.pb.h"
 #include "google/protobuf/arena.h"
 #include "google/protobuf/util/json_util.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/ascii.h"
 #include "absl/strings/escaping.h"
+#include "absl/strings/match.h"
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_replace.h"
@@ -28,20 +36,39 @@ limitations under the License.
 #include "absl/time/time.h"
 #include "tensorflow/cc/saved_model/loader.h"
 #include "tensorflow/cc/saved_model/signature_constants.h"
+#include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/cpu_info.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/errors.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/notification.h"
 #include "tensorflow/core/platform/threadpool_options.h"
 #include "tensorflow_serving/apis/model.pb.h"
 #include "tensorflow_serving/apis/predict.pb.h"
 #include "tensorflow_serving/core/servable_handle.h"
+#include "tensorflow_serving/core/servable_state.h"
+#include "tensorflow_serving/core/servable_state_monitor.h"
 #include "tensorflow_serving/model_servers/get_model_status_impl.h"
 #include "tensorflow_serving/model_servers/http_rest_api_util.h"
+#include "tensorflow_serving/model_servers/model_platform_types.h"
 #include "tensorflow_serving/model_servers/server_core.h"
+#include "tensorflow_serving/servables/hashmap/flat_hashmap.h"
+#include "tensorflow_serving/servables/hashmap/flat_hashmap_predict.h"
 #include "tensorflow_serving/servables/tensorflow/classification_service.h"
 #include "tensorflow_serving/servables/tensorflow/get_model_metadata_impl.h"
 #include "tensorflow_serving/servables/tensorflow/predict_impl.h"
 #include "tensorflow_serving/servables/tensorflow/regression_service.h"
+#include "tensorflow_serving/servables/tensorflow/util.h"
+#include "tensorflow_serving/servables/tfdf/tfdf_servable.h"
 #include "tensorflow_serving/util/json_tensor.h"
+#include "tensorflow_serving/util/model_cpu_profiler.h"
+#include "tensorflow_serving/util/flight_recorder.h"
+#include "tensorflow_serving/util/request_cancellation.h"
+#include "tensorflow_serving/util/request_memory.h"
+#include "tensorflow_serving/util/reusable_memory_block.h"
+#include "tensorflow_serving/util/trace_context.h"
 
 namespace tensorflow {
 namespace serving {
@@ -52,37 +79,313 @@ using tensorflow::serving::ServerCore;
 using tensorflow::serving::TensorflowPredictor;
 
 const char* const HttpRestApiHandler::kPathRegex = kHTTPRestApiHandlerPathRegex;
+const char* const HttpRestApiHandler::kProtobufContentType =
+    "application/x-protobuf";
+const size_t HttpRestApiHandler::kOutputChunkSize = 64 << 10;
+const int HttpRestApiHandler::kPredictStreamChunkSize = 1024;
+const int HttpRestApiHandler::kPredictStreamMaxInFlightChunks = 4;
+
+namespace {
+
+auto* parse_request_stage = new RequestStage("Predict", "parse_request");
+auto* write_json_response_stage = new RequestStage("Predict",
+                                                   "write_json_response");
+
+// Returns true if a Content-Type header value (e.g.
+// "application/x-protobuf; charset=binary") designates a serialized proto.
+bool IsProtobufContentType(const absl::string_view content_type) {
+  const absl::string_view media_type = absl::StripAsciiWhitespace(
+      content_type.substr(0, content_type.find(';')));
+  return absl::EqualsIgnoreCase(media_type,
+                                HttpRestApiHandler::kProtobufContentType);
+}
+
+// Returns the memory block the protobuf arenas of the calling thread start
+// from.
+ReusableMemoryBlock* ThreadArenaBlock() {
+  static thread_local ReusableMemoryBlock block;
+  return &block;
+}
+
+// A protobuf arena whose first block is ThreadArenaBlock(), so that requests
+// and responses of a usual size are allocated without heap allocations.
+class RequestArena {
+ public:
+  RequestArena() : lease_(ThreadArenaBlock()), arena_(MakeOptions(lease_)) {}
+
+  ~RequestArena() { lease_.set_used_size(arena_.SpaceUsed()); }
+
+  ::google::protobuf::Arena* get() { return &arena_; }
+
+ private:
+  static ::google::protobuf::ArenaOptions MakeOptions(
+      const ReusableMemoryBlock::Lease& lease) {
+    ::google::protobuf::ArenaOptions options;
+    options.initial_block = lease.data();
+    options.initial_block_size = lease.size();
+    return options;
+  }
+
+  ReusableMemoryBlock::Lease lease_;
+  ::google::protobuf::Arena arena_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(RequestArena);
+};
+
+// Content type of the responses of the predictStream calls.
+constexpr char kNdjsonContentType[] = "application/x-ndjson";
+
+// A predict request of a predictStream call, and its response.
+struct PredictStreamChunk {
+  string request_body;
+  int num_instances = 0;
+  string output;
+  Status status;
+  // The memory allocated by the thread running the chunk.
+  RequestMemoryStats memory_stats;
+  Notification done;
+};
+
+// Writes the JSON predict response, streamed to `write_output_chunk` if set.
+Status MakePredictResponseJson(
+    const ::google::protobuf::Map<string, TensorProto>& outputs,
+    const JsonPredictRequestFormat format,
+    const HttpRestApiHandler::OutputChunkWriter& write_output_chunk,
+    string* output) {
+  if (!write_output_chunk) {
+    return MakeJsonFromTensors(outputs, format, output);
+  }
+  return MakeJsonFromTensors(outputs, format,
+                             HttpRestApiHandler::kOutputChunkSize,
+                             write_output_chunk, output);
+}
+
+// Returns the version a request for 'model_name' is served with, to tag the
+// CPU time of the request. Empty if the CPU profiler is not running, or if the
+// version does not resolve (the request then fails on its own).
+string ServedVersion(
+    ServerCore* core, const absl::string_view model_name,
+    const absl::optional<int64>& model_version,
+    const absl::optional<absl::string_view>& model_version_label) {
+  if (!ModelCpuProfiler::Get()->running()) {
+    return "";
+  }
+  ModelSpec model_spec;
+  int64 version;
+  if (!FillModelSpecWithNameVersionAndLabel(model_name, model_version,
+                                            model_version_label, &model_spec)
+           .ok() ||
+      !core->GetServedModelVersion(model_spec, &version).ok()) {
+    return "";
+  }
+  return absl::StrCat(version);
+}
+
+}  // namespace
+
+// Caches the input maps of signatures, keyed by model name, then by version
+// (or label) and signature name as given in requests. The entries of a model
+// are dropped whenever the state of one of its versions changes, as they may
+// then resolve to another version.
+class HttpRestApiHandler::SignatureInputsCache {
+ public:
+  using InputMap = ::google::protobuf::Map<string, tensorflow::TensorInfo>;
+
+  // Returns the key of `signature_name` of `model_spec` within its model.
+  static string Key(const ModelSpec& model_spec,
+                    const string& signature_name) {
+    if (model_spec.has_version()) {
+      return absl::StrCat("v", model_spec.version().value(), "/",
+                          signature_name);
+    }
+    if (!model_spec.version_label().empty()) {
+      return absl::StrCat("l", model_spec.version_label(), "/",
+                          signature_name);
+    }
+    return absl::StrCat("/", signature_name);
+  }
+
+  // Returns the cached map, or nullptr and the generation to pass to Insert().
+  std::shared_ptr<const InputMap> Lookup(const string& model_name,
+                                         const string& key,
+                                         uint64* generation) {
+    mutex_lock l(mu_);
+    *generation = generation_;
+    auto model_it = models_.find(model_name);
+    if (model_it == models_.end()) {
+      return nullptr;
+    }
+    auto it = model_it->second.find(key);
+    return it == model_it->second.end() ? nullptr : it->second;
+  }
+
+  // Inserts a map looked up after Lookup() returned `generation`, unless the
+  // cache was invalidated since.
+  void Insert(const string& model_name, const string& key,
+              const uint64 generation, std::shared_ptr<const InputMap> map) {
+    mutex_lock l(mu_);
+    if (generation == generation_) {
+      models_[model_name][key] = std::move(map);
+    }
+  }
+
+  void Invalidate(const string& model_name) {
+    mutex_lock l(mu_);
+    ++generation_;
+    models_.erase(model_name);
+  }
+
+ private:
+  // Cached maps of a model, by Key().
+  using ModelEntries =
+      std::unordered_map<string, std::shared_ptr<const InputMap>>;
+
+  mutex mu_;
+  // Incremented by every invalidation.
+  uint64 generation_ TF_GUARDED_BY(mu_) = 0;
+  std::unordered_map<string, ModelEntries> models_ TF_GUARDED_BY(mu_);
+};
 
 HttpRestApiHandler::HttpRestApiHandler(const RunOptions& run_options,
                                        ServerCore* core)
     : run_options_(run_options),
       core_(core),
-      predictor_(new TensorflowPredictor()) {}
+      predictor_(new TensorflowPredictor()),
+      serve_tfdf_servables_(
+          core->platform_config_map().platform_configs().count(
+              kTfdfModelPlatform) > 0),
+      serve_hashmap_servables_(
+          core->platform_config_map().platform_configs().count(
+              kHashmapModelPlatform) > 0),
+      signature_inputs_cache_(std::make_shared<SignatureInputsCache>()),
+      model_metadata_cache_(ModelMetadataCache::Create(core)) {
+  std::weak_ptr<SignatureInputsCache> weak_cache = signature_inputs_cache_;
+  core->servable_state_monitor()->Notify(
+      [weak_cache](const ServableState& state) {
+        std::shared_ptr<SignatureInputsCache> cache = weak_cache.lock();
+        if (cache != nullptr) {
+          cache->Invalidate(state.id.name);
+        }
+      });
+}
 
 HttpRestApiHandler::~HttpRestApiHandler() {}
 
+thread::ThreadPool* HttpRestApiHandler::predict_stream_threads() {
+  mutex_lock l(predict_stream_threads_mu_);
+  if (predict_stream_threads_ == nullptr) {
+    predict_stream_threads_.reset(new thread::ThreadPool(
+        Env::Default(), "HttpRestApi_PredictStream", port::MaxParallelism()));
+  }
+  return predict_stream_threads_.get();
+}
+
 Status HttpRestApiHandler::ProcessRequest(
     const absl::string_view http_method, const absl::string_view request_path,
     const absl::string_view request_body,
     std::vector<std::pair<string, string>>* headers, string* model_name,
     string* method, string* output) {
-  headers->clear();
+  return ProcessRequest(http_method, request_path, request_body,
+                        /*request_content_type=*/"", headers, model_name,
+                        method, output);
+}
+
+Status HttpRestApiHandler::ProcessRequest(
+    const absl::string_view http_method, const absl::string_view request_path,
+    const absl::string_view request_body,
+    const absl::string_view request_content_type,
+    std::vector<std::pair<string, string>>* headers, string* model_name,
+    string* method, string* output) {
+  return ProcessRequest(http_method, request_path, request_body,
+                        request_content_type,
+                        /*write_output_chunk=*/nullptr, headers, model_name,
+                        method, output);
+}
+
+Status HttpRestApiHandler::ProcessRequest(
+    const absl::string_view http_method, const absl::string_view request_path,
+    const absl::string_view request_body,
+    const absl::string_view request_content_type,
+    const OutputChunkWriter& write_output_chunk,
+    std::vector<std::pair<string, string>>* headers, string* model_name,
+    string* method, string* output) {
+  return ProcessRequest(http_method, request_path, request_body,
+                        request_content_type, /*client_id=*/"",
+                        write_output_chunk, headers, model_name, method,
+                        output);
+}
+
+Status HttpRestApiHandler::ProcessRequest(
+    const absl::string_view http_method, const absl::string_view request_path,
+    const absl::string_view request_body,
+    const absl::string_view request_content_type,
+    const absl::string_view client_id,
+    const OutputChunkWriter& write_output_chunk,
+    std::vector<std::pair<string, string>>* headers, string* model_name,
+    string* method, string* output) {
   output->clear();
-  AddHeaders(headers);
-  string model_subresource;
-  Status status = errors::InvalidArgument("Malformed request: ", http_method,
-                                          " ", request_path);
+  SetJsonHeaders(headers);
+  // The path is parsed in place, and only the escaped parts are copied.
+  ModelPathInfo path_info;
+  const bool parse_successful =
+      ParseModelPath(http_method, request_path, &path_info);
   absl::optional<int64> model_version;
-  absl::optional<string> model_version_label;
-  bool parse_successful;
-
-  TF_RETURN_IF_ERROR(ParseModelInfo(
-      http_method, request_path, model_name, &model_version,
-      &model_version_label, method, &model_subresource, &parse_successful));
+  absl::optional<absl::string_view> model_version_label;
+  string decoded_label;
+  if (parse_successful) {
+    PercentDecode(path_info.model_name, model_name);
+    method->assign(path_info.method.data(), path_info.method.size());
+    TF_RETURN_IF_ERROR(ParseModelVersion(path_info, &model_version));
+    if (!path_info.model_version_label.empty()) {
+      PercentDecode(path_info.model_version_label, &decoded_label);
+      model_version_label = decoded_label;
+    }
+  }
+  const absl::string_view model_subresource = path_info.model_subresource;
+  Status status;
 
   // Dispatch request to appropriate processor
   if (http_method == "POST" && parse_successful) {
-    if (*method == "classify") {
+    ScopedModelCpuTag cpu_tag(*model_name,
+                              ServedVersion(core_, *model_name, model_version,
+                                            model_version_label));
+    TraceSpan span(absl::StrCat("HttpRestApiHandler::", *method),
+                   CurrentTraceContext());
+    ScopedTraceContext trace_context(span.context());
+    // The path identifies the model, its version and the method. Streamed
+    // and binary responses are not cached.
+    ResponseCache* const response_cache = core_->response_cache();
+    ResponseCache::Key cache_key;
+    const bool cache_response = !write_output_chunk &&
+                                !IsProtobufContentType(request_content_type) &&
+                                *method != "predictStream" &&
+                                response_cache->enabled(*model_name);
+    if (cache_response &&
+        response_cache->Lookup(*model_name, request_path, request_body,
+                               output, &cache_key)) {
+      return Status::OK();
+    }
+    // As for the gRPC API, the version is resolved before the request is
+    // admitted. Rejected requests are counted by the HTTP server, with the
+    // status of the other failed requests.
+    std::unique_ptr<AdmissionController::Ticket> admission_ticket;
+    Status admission_status;
+    if (core_->admission_controller()->enabled()) {
+      ModelSpec model_spec;
+      int64 version;
+      admission_status = FillModelSpecWithNameVersionAndLabel(
+          *model_name, model_version, model_version_label, &model_spec);
+      if (admission_status.ok()) {
+        admission_status = core_->GetServedModelVersion(model_spec, &version);
+      }
+      if (admission_status.ok()) {
+        admission_status = core_->admission_controller()->Admit(
+            *model_name, string(client_id), &admission_ticket);
+      }
+    }
+    if (!admission_status.ok()) {
+      status = admission_status;
+    } else if (*method == "classify") {
       status =
           ProcessClassifyRequest(*model_name, model_version,
                                  model_version_label, request_body, output);
@@ -90,17 +393,39 @@ Status HttpRestApiHandler::ProcessRequest(
       status = ProcessRegressRequest(*model_name, model_version,
                                      model_version_label, request_body, output);
     } else if (*method == "predict") {
-      status = ProcessPredictRequest(*model_name, model_version,
-                                     model_version_label, request_body, output);
+      if (IsProtobufContentType(request_content_type)) {
+        status = ProcessProtobufPredictRequest(*model_name, model_version,
+                                               model_version_label,
+                                               request_body, output);
+        if (status.ok()) {
+          *headers = {{"Content-Type", kProtobufContentType}};
+          return status;
+        }
+        output->clear();
+      } else {
+        status = ProcessPredictRequest(*model_name, model_version,
+                                       model_version_label, request_body,
+                                       write_output_chunk, output);
+      }
+    } else if (*method == "predictStream") {
+      status = ProcessPredictStreamRequest(
+          *model_name, model_version, model_version_label, request_body,
+          write_output_chunk, headers, output);
+    }
+    if (cache_response && status.ok()) {
+      response_cache->Insert(cache_key, *output);
     }
   } else if (http_method == "GET" && parse_successful) {
-    if (!model_subresource.empty() && model_subresource == "metadata") {
+    if (model_subresource == "metadata") {
       status = ProcessModelMetadataRequest(*model_name, model_version,
                                            model_version_label, output);
     } else {
       status = ProcessModelStatusRequest(*model_name, model_version,
                                          model_version_label, output);
     }
+  } else {
+    status = errors::InvalidArgument("Malformed request: ", http_method, " ",
+                                     request_path);
   }
 
   MakeJsonFromStatus(status, output);
@@ -112,18 +437,25 @@ Status HttpRestApiHandler::ProcessClassifyRequest(
     const absl::optional<int64>& model_version,
     const absl::optional<absl::string_view>& model_version_label,
     const absl::string_view request_body, string* output) {
-  ::google::protobuf::Arena arena;
+  RequestArena arena;
 
-  auto* request = ::google::protobuf::Arena::CreateMessage<ClassificationRequest>(&arena);
+  auto* request = ::google::protobuf::Arena::CreateMessage<ClassificationRequest>(arena.get());
   TF_RETURN_IF_ERROR(FillModelSpecWithNameVersionAndLabel(
       model_name, model_version, model_version_label,
       request->mutable_model_spec()));
   TF_RETURN_IF_ERROR(FillClassificationRequestFromJson(request_body, request));
 
   auto* response =
-      ::google::protobuf::Arena::CreateMessage<ClassificationResponse>(&arena);
-  TF_RETURN_IF_ERROR(TensorflowClassificationServiceImpl::Classify(
-      run_options_, core_, thread::ThreadPoolOptions(), *request, response));
+      ::google::protobuf::Arena::CreateMessage<ClassificationResponse>(arena.get());
+  ServableHandle<TfdfServable> tfdf_servable;
+  if (serve_tfdf_servables_ &&
+      core_->GetServableHandle(request->model_spec(), &tfdf_servable).ok()) {
+    // The examples are decoded natively, without ParseExample.
+    TF_RETURN_IF_ERROR(tfdf_servable->Classify(*request, response));
+  } else {
+    TF_RETURN_IF_ERROR(TensorflowClassificationServiceImpl::Classify(
+        run_options_, core_, thread::ThreadPoolOptions(), *request, response));
+  }
   TF_RETURN_IF_ERROR(
       MakeJsonFromClassificationResult(response->result(), output));
   return Status::OK();
@@ -134,17 +466,23 @@ Status HttpRestApiHandler::ProcessRegressRequest(
     const absl::optional<int64>& model_version,
     const absl::optional<absl::string_view>& model_version_label,
     const absl::string_view request_body, string* output) {
-  ::google::protobuf::Arena arena;
+  RequestArena arena;
 
-  auto* request = ::google::protobuf::Arena::CreateMessage<RegressionRequest>(&arena);
+  auto* request = ::google::protobuf::Arena::CreateMessage<RegressionRequest>(arena.get());
   TF_RETURN_IF_ERROR(FillModelSpecWithNameVersionAndLabel(
       model_name, model_version, model_version_label,
       request->mutable_model_spec()));
   TF_RETURN_IF_ERROR(FillRegressionRequestFromJson(request_body, request));
 
-  auto* response = ::google::protobuf::Arena::CreateMessage<RegressionResponse>(&arena);
-  TF_RETURN_IF_ERROR(TensorflowRegressionServiceImpl::Regress(
-      run_options_, core_, thread::ThreadPoolOptions(), *request, response));
+  auto* response = ::google::protobuf::Arena::CreateMessage<RegressionResponse>(arena.get());
+  ServableHandle<TfdfServable> tfdf_servable;
+  if (serve_tfdf_servables_ &&
+      core_->GetServableHandle(request->model_spec(), &tfdf_servable).ok()) {
+    TF_RETURN_IF_ERROR(tfdf_servable->Regress(*request, response));
+  } else {
+    TF_RETURN_IF_ERROR(TensorflowRegressionServiceImpl::Regress(
+        run_options_, core_, thread::ThreadPoolOptions(), *request, response));
+  }
   TF_RETURN_IF_ERROR(MakeJsonFromRegressionResult(response->result(), output));
   return Status::OK();
 }
@@ -153,27 +491,301 @@ Status HttpRestApiHandler::ProcessPredictRequest(
     const absl::string_view model_name,
     const absl::optional<int64>& model_version,
     const absl::optional<absl::string_view>& model_version_label,
-    const absl::string_view request_body, string* output) {
-  ::google::protobuf::Arena arena;
+    const absl::string_view request_body,
+    const OutputChunkWriter& write_output_chunk, string* output) {
+  RequestArena arena;
 
-  auto* request = ::google::protobuf::Arena::CreateMessage<PredictRequest>(&arena);
+  auto* request = ::google::protobuf::Arena::CreateMessage<PredictRequest>(arena.get());
   TF_RETURN_IF_ERROR(FillModelSpecWithNameVersionAndLabel(
       model_name, model_version, model_version_label,
       request->mutable_model_spec()));
 
+  if (serve_tfdf_servables_) {
+    ServableHandle<TfdfServable> tfdf_servable;
+    if (core_->GetServableHandle(request->model_spec(), &tfdf_servable).ok()) {
+      return ProcessTfdfPredictRequest(tfdf_servable, request_body, request,
+                                       arena.get(), write_output_chunk, output);
+    }
+  }
+  if (serve_hashmap_servables_) {
+    ServableHandle<FlatHashmap> hashmap;
+    if (core_->GetServableHandle(request->model_spec(), &hashmap).ok()) {
+      return ProcessHashmapPredictRequest(hashmap, request_body, request,
+                                          arena.get(), write_output_chunk,
+                                          output);
+    }
+  }
+
+  // The inputs are decoded directly into tensors, which are fed to the
+  // session without a round-trip through the TensorProtos of the request.
   JsonPredictRequestFormat format;
-  TF_RETURN_IF_ERROR(FillPredictRequestFromJson(
-      request_body,
-      [this, request](const string& sig,
-                      ::google::protobuf::Map<string, TensorInfo>* map) {
-        return this->GetInfoMap(request->model_spec(), sig, map);
-      },
-      request, &format));
+  std::map<string, Tensor> input_tensors;
+  std::shared_ptr<const ::google::protobuf::Map<string, TensorInfo>> infomap;
+  {
+    ScopedRequestStageLatency stage_latency(parse_request_stage,
+                                            request->model_spec().name());
+    TF_RETURN_IF_ERROR(FillPredictInputTensorsFromJson(
+        request_body,
+        TensorInfoMapLookup(
+            [this, request, &infomap](
+                const string& sig,
+                const ::google::protobuf::Map<string, TensorInfo>** map) {
+              TF_RETURN_IF_ERROR(
+                  this->GetInfoMap(request->model_spec(), sig, &infomap));
+              *map = infomap.get();
+              return Status::OK();
+            }),
+        request, &input_tensors, &format));
+  }
 
-  auto* response = ::google::protobuf::Arena::CreateMessage<PredictResponse>(&arena);
-  TF_RETURN_IF_ERROR(
-      predictor_->Predict(run_options_, core_, *request, response));
-  TF_RETURN_IF_ERROR(MakeJsonFromTensors(response->outputs(), format, output));
+  auto* response = ::google::protobuf::Arena::CreateMessage<PredictResponse>(arena.get());
+  TF_RETURN_IF_ERROR(predictor_->PredictWithInputTensors(
+      run_options_, core_, *request, input_tensors, response));
+  ScopedRequestStageLatency stage_latency(write_json_response_stage,
+                                          request->model_spec().name());
+  TF_RETURN_IF_ERROR(MakePredictResponseJson(response->outputs(), format,
+                                             write_output_chunk, output));
+  return Status::OK();
+}
+
+Status HttpRestApiHandler::ProcessPredictStreamRequest(
+    const absl::string_view model_name,
+    const absl::optional<int64>& model_version,
+    const absl::optional<absl::string_view>& model_version_label,
+    const absl::string_view request_body,
+    const OutputChunkWriter& write_output_chunk,
+    std::vector<std::pair<string, string>>* headers, string* output) {
+  // The chunks being predicted, oldest first. They all complete before this
+  // returns, as they refer to the arguments.
+  std::deque<std::unique_ptr<PredictStreamChunk>> chunks;
+  int num_chunks = 0;
+  bool output_started = false;
+  Status status;
+  // The thread-local state of the request, installed on the threads running
+  // its chunks. It outlives them.
+  const RequestCancellation* const cancellation = CurrentRequestCancellation();
+  const TraceContext* const trace_context = CurrentTraceContext();
+  ScopedFlightRecord* const flight_record = CurrentFlightRecord();
+  const string model_version_tag =
+      ServedVersion(core_, model_name, model_version, model_version_label);
+  thread::ThreadPool* const threads = predict_stream_threads();
+  const auto write_oldest_chunk = [&]() {
+    std::unique_ptr<PredictStreamChunk> chunk = std::move(chunks.front());
+    chunks.pop_front();
+    chunk->done.WaitForNotification();
+    AddRequestMemory(chunk->memory_stats);
+    if (!status.ok()) {
+      return;
+    }
+    if (!chunk->status.ok()) {
+      status = chunk->status;
+      return;
+    }
+    // The response is pretty-printed, and JSON strings escape their newlines,
+    // so the remaining ones are whitespace.
+    chunk->output.erase(
+        std::remove(chunk->output.begin(), chunk->output.end(), '\n'),
+        chunk->output.end());
+    chunk->output.push_back('\n');
+    if (!write_output_chunk) {
+      output->append(chunk->output);
+      return;
+    }
+    if (!output_started) {
+      *headers = {{"Content-Type", kNdjsonContentType}};
+      output_started = true;
+    }
+    write_output_chunk(chunk->output);
+  };
+  const auto predict_chunk = [&](std::unique_ptr<PredictStreamChunk> chunk) {
+    if (static_cast<int>(chunks.size()) >= kPredictStreamMaxInFlightChunks) {
+      write_oldest_chunk();
+    }
+    if (status.ok() && cancellation != nullptr &&
+        cancellation->IsCancelled()) {
+      status = errors::Cancelled("The predictStream request was cancelled");
+    }
+    if (!status.ok()) {
+      return;
+    }
+    chunk->request_body.append("]}");
+    PredictStreamChunk* const scheduled = chunk.get();
+    chunks.push_back(std::move(chunk));
+    ++num_chunks;
+    threads->Schedule([&, scheduled]() {
+      {
+        ScopedRequestMemory request_memory;
+        ScopedRequestCancellation scoped_cancellation(cancellation);
+        ScopedTraceContext scoped_trace_context(trace_context);
+        ScopedCurrentFlightRecord scoped_flight_record(flight_record);
+        ScopedModelCpuTag cpu_tag(string(model_name), model_version_tag);
+        if (cancellation != nullptr && cancellation->IsCancelled()) {
+          scheduled->status =
+              errors::Cancelled("The predictStream request was cancelled");
+        } else {
+          scheduled->status = ProcessPredictRequest(
+              model_name, model_version, model_version_label,
+              scheduled->request_body, /*write_output_chunk=*/nullptr,
+              &scheduled->output);
+        }
+        scheduled->memory_stats = request_memory.stats();
+      }
+      scheduled->done.Notify();
+    });
+  };
+
+  // Each non-empty line is an instance of a row format request.
+  std::unique_ptr<PredictStreamChunk> chunk;
+  absl::string_view rest = request_body;
+  while (!rest.empty() && status.ok()) {
+    const size_t line_size = std::min(rest.find('\n'), rest.size());
+    const absl::string_view line =
+        absl::StripAsciiWhitespace(rest.substr(0, line_size));
+    rest.remove_prefix(std::min(line_size + 1, rest.size()));
+    if (line.empty()) {
+      continue;
+    }
+    if (chunk == nullptr) {
+      chunk = absl::make_unique<PredictStreamChunk>();
+      chunk->request_body.assign("{\"instances\": [");
+    } else {
+      chunk->request_body.push_back(',');
+    }
+    chunk->request_body.append(line.data(), line.size());
+    if (++chunk->num_instances == kPredictStreamChunkSize) {
+      predict_chunk(std::move(chunk));
+    }
+  }
+  if (chunk != nullptr && status.ok()) {
+    predict_chunk(std::move(chunk));
+  }
+  while (!chunks.empty()) {
+    write_oldest_chunk();
+  }
+
+  if (status.ok() && num_chunks == 0) {
+    status = errors::InvalidArgument(
+        "The predictStream request has no instances, expected one JSON "
+        "instance per line");
+  }
+  if (!status.ok()) {
+    if (!output_started) {
+      output->clear();
+    }
+    return status;
+  }
+  if (!output_started) {
+    *headers = {{"Content-Type", kNdjsonContentType}};
+  }
+  return Status::OK();
+}
+
+Status HttpRestApiHandler::ProcessTfdfPredictRequest(
+    const ServableHandle<TfdfServable>& servable,
+    const absl::string_view request_body, PredictRequest* request,
+    ::google::protobuf::Arena* arena,
+    const OutputChunkWriter& write_output_chunk, string* output) {
+  // Note: The inputs of a TfdfServable do not depend on the signature.
+  JsonPredictRequestFormat format;
+  {
+    ScopedRequestStageLatency stage_latency(parse_request_stage,
+                                            servable.id().name);
+    TF_RETURN_IF_ERROR(FillPredictRequestFromJson(
+        request_body,
+        TensorInfoMapLookup(
+            [&servable](
+                const string& sig,
+                const ::google::protobuf::Map<string, TensorInfo>** map) {
+              *map = &servable->inputs();
+              return Status::OK();
+            }),
+        request, &format));
+  }
+
+  auto* response = ::google::protobuf::Arena::CreateMessage<PredictResponse>(arena);
+  TF_RETURN_IF_ERROR(servable->Predict(*request, response));
+  response->mutable_model_spec()->set_name(servable.id().name);
+  response->mutable_model_spec()->mutable_version()->set_value(
+      servable.id().version);
+  ScopedRequestStageLatency stage_latency(write_json_response_stage,
+                                          servable.id().name);
+  TF_RETURN_IF_ERROR(MakePredictResponseJson(response->outputs(), format,
+                                             write_output_chunk, output));
+  return Status::OK();
+}
+
+Status HttpRestApiHandler::ProcessHashmapPredictRequest(
+    const ServableHandle<FlatHashmap>& servable,
+    const absl::string_view request_body, PredictRequest* request,
+    ::google::protobuf::Arena* arena,
+    const OutputChunkWriter& write_output_chunk, string* output) {
+  JsonPredictRequestFormat format;
+  {
+    ScopedRequestStageLatency stage_latency(parse_request_stage,
+                                            servable.id().name);
+    TF_RETURN_IF_ERROR(FillPredictRequestFromJson(
+        request_body,
+        TensorInfoMapLookup(
+            [](const string& sig,
+               const ::google::protobuf::Map<string, TensorInfo>** map) {
+              *map = &FlatHashmapPredictInputs();
+              return Status::OK();
+            }),
+        request, &format));
+  }
+
+  auto* response = ::google::protobuf::Arena::CreateMessage<PredictResponse>(arena);
+  TF_RETURN_IF_ERROR(FlatHashmapPredict(*servable, *request, response));
+  response->mutable_model_spec()->set_name(servable.id().name);
+  response->mutable_model_spec()->mutable_version()->set_value(
+      servable.id().version);
+  ScopedRequestStageLatency stage_latency(write_json_response_stage,
+                                          servable.id().name);
+  TF_RETURN_IF_ERROR(MakePredictResponseJson(response->outputs(), format,
+                                             write_output_chunk, output));
+  return Status::OK();
+}
+
+Status HttpRestApiHandler::ProcessProtobufPredictRequest(
+    const absl::string_view model_name,
+    const absl::optional<int64>& model_version,
+    const absl::optional<absl::string_view>& model_version_label,
+    const absl::string_view request_body, string* output) {
+  RequestArena arena;
+
+  auto* request = ::google::protobuf::Arena::CreateMessage<PredictRequest>(arena.get());
+  if (!request->ParseFromArray(request_body.data(), request_body.size())) {
+    return errors::InvalidArgument(
+        "Failed to parse the request body as a serialized PredictRequest");
+  }
+  // The model is identified by the request path, as for JSON requests. The
+  // signature name of the request proto is kept.
+  TF_RETURN_IF_ERROR(FillModelSpecWithNameVersionAndLabel(
+      model_name, model_version, model_version_label,
+      request->mutable_model_spec()));
+
+  auto* response = ::google::protobuf::Arena::CreateMessage<PredictResponse>(arena.get());
+  ServableHandle<TfdfServable> tfdf_servable;
+  ServableHandle<FlatHashmap> hashmap;
+  if (serve_tfdf_servables_ &&
+      core_->GetServableHandle(request->model_spec(), &tfdf_servable).ok()) {
+    TF_RETURN_IF_ERROR(tfdf_servable->Predict(*request, response));
+    response->mutable_model_spec()->set_name(tfdf_servable.id().name);
+    response->mutable_model_spec()->mutable_version()->set_value(
+        tfdf_servable.id().version);
+  } else if (serve_hashmap_servables_ &&
+             core_->GetServableHandle(request->model_spec(), &hashmap).ok()) {
+    TF_RETURN_IF_ERROR(FlatHashmapPredict(*hashmap, *request, response));
+    response->mutable_model_spec()->set_name(hashmap.id().name);
+    response->mutable_model_spec()->mutable_version()->set_value(
+        hashmap.id().version);
+  } else {
+    TF_RETURN_IF_ERROR(
+        predictor_->Predict(run_options_, core_, *request, response));
+  }
+  if (!response->SerializeToString(output)) {
+    return errors::Internal("Failed to serialize the PredictResponse");
+  }
   return Status::OK();
 }
 
@@ -188,15 +800,15 @@ Status HttpRestApiHandler::ProcessModelStatusRequest(
     return errors::InvalidArgument("Missing model name in request.");
   }
 
-  ::google::protobuf::Arena arena;
+  RequestArena arena;
 
-  auto* request = ::google::protobuf::Arena::CreateMessage<GetModelStatusRequest>(&arena);
+  auto* request = ::google::protobuf::Arena::CreateMessage<GetModelStatusRequest>(arena.get());
   TF_RETURN_IF_ERROR(FillModelSpecWithNameVersionAndLabel(
       model_name, model_version, model_version_label,
       request->mutable_model_spec()));
 
   auto* response =
-      ::google::protobuf::Arena::CreateMessage<GetModelStatusResponse>(&arena);
+      ::google::protobuf::Arena::CreateMessage<GetModelStatusResponse>(arena.get());
   TF_RETURN_IF_ERROR(
       GetModelStatusImpl::GetModelStatus(core_, *request, response));
   return ToJsonString(*response, output);
@@ -211,36 +823,50 @@ Status HttpRestApiHandler::ProcessModelMetadataRequest(
     return errors::InvalidArgument("Missing model name in request.");
   }
 
-  ::google::protobuf::Arena arena;
+  RequestArena arena;
 
   auto* request =
-      ::google::protobuf::Arena::CreateMessage<GetModelMetadataRequest>(&arena);
+      ::google::protobuf::Arena::CreateMessage<GetModelMetadataRequest>(arena.get());
   // We currently only support the kSignatureDef metadata field
   request->add_metadata_field(GetModelMetadataImpl::kSignatureDef);
   TF_RETURN_IF_ERROR(FillModelSpecWithNameVersionAndLabel(
       model_name, model_version, model_version_label,
       request->mutable_model_spec()));
 
-  auto* response =
-      ::google::protobuf::Arena::CreateMessage<GetModelMetadataResponse>(&arena);
-  TF_RETURN_IF_ERROR(
-      GetModelMetadataImpl::GetModelMetadata(core_, *request, response));
-  return ToJsonString(*response, output);
+  std::shared_ptr<const ModelMetadataCache::Entry> metadata;
+  TF_RETURN_IF_ERROR(GetModelMetadataImpl::GetCachedModelMetadata(
+      core_, *request, model_metadata_cache_.get(), &metadata));
+  return metadata->GetJson(
+      [](const GetModelMetadataResponse& response, string* json) {
+        return ToJsonString(response, json);
+      },
+      output);
 }
 
 Status HttpRestApiHandler::GetInfoMap(
     const ModelSpec& model_spec, const string& signature_name,
-    ::google::protobuf::Map<string, tensorflow::TensorInfo>* infomap) {
-  ServableHandle<SavedModelBundle> bundle;
-  TF_RETURN_IF_ERROR(core_->GetServableHandle(model_spec, &bundle));
+    std::shared_ptr<const ::google::protobuf::Map<string, tensorflow::TensorInfo>>*
+        infomap) {
   const string& signame =
       signature_name.empty() ? kDefaultServingSignatureDefKey : signature_name;
+  const string key = SignatureInputsCache::Key(model_spec, signame);
+  uint64 generation;
+  *infomap =
+      signature_inputs_cache_->Lookup(model_spec.name(), key, &generation);
+  if (*infomap != nullptr) {
+    return Status::OK();
+  }
+
+  ServableHandle<SavedModelBundle> bundle;
+  TF_RETURN_IF_ERROR(core_->GetServableHandle(model_spec, &bundle));
   auto iter = bundle->meta_graph_def.signature_def().find(signame);
   if (iter == bundle->meta_graph_def.signature_def().end()) {
     return errors::InvalidArgument("Serving signature name: \"", signame,
                                    "\" not found in signature def");
   }
-  *infomap = iter->second.inputs();
+  *infomap = std::make_shared<const ::google::protobuf::Map<string, TensorInfo>>(
+      iter->second.inputs());
+  signature_inputs_cache_->Insert(model_spec.name(), key, generation, *infomap);
   return Status::OK();
 }
 
@@ -15,17 +15,23 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_MODEL_SERVERS_HTTP_REST_API_HANDLER_H_
 #define TENSORFLOW_SERVING_MODEL_SERVERS_HTTP_REST_API_HANDLER_H_
 
+#include <functional>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "google/protobuf/arena.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
 #include "re2/re2.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
 #include "tensorflow/core/protobuf/config.pb.h"
 #include "tensorflow/core/protobuf/meta_graph.pb.h"
+#include "tensorflow_serving/core/servable_handle.h"
 
 namespace tensorflow {
 
@@ -33,9 +39,13 @@ class SignatureDef;
 
 namespace serving {
 
+class FlatHashmap;
+class ModelMetadataCache;
 class ServerCore;
 class TensorflowPredictor;
+class TfdfServable;
 class ModelSpec;
+class PredictRequest;
 
 // HttpRestApiHandler handles HTTP/REST APIs of TF serving.
 //
@@ -46,6 +56,18 @@ class ModelSpec;
 //   POST /v1/models/<model_name>:(classify|regress|predict)
 //   POST /v1/models/<model_name>/versions/<ver>:(classify|regress|predict)
 //
+//   Predict requests with a "Content-Type: application/x-protobuf" header
+//   carry a serialized PredictRequest proto, and are answered with a
+//   serialized PredictResponse proto (see kProtobufContentType).
+//
+// o Streamed inference - Predict on newline-delimited JSON instances
+//
+//   POST /v1/models/<model_name>[/versions/<ver>]:predictStream
+//
+//   The instances are predicted kPredictStreamChunkSize at a time, several
+//   chunks in parallel, and the predictions of each chunk are written as soon
+//   as those of the chunks before it, one JSON line per chunk.
+//
 // o Model status
 //
 //   GET /v1/models/<model_name> (status of all versions)
@@ -67,6 +89,23 @@ class HttpRestApiHandler {
   // HTTP server, so incoming requests can be forwarded to this handler.
   static const char* const kPathRegex;
 
+  // Content type of predict requests and responses whose body is a binary
+  // serialized PredictRequest or PredictResponse proto, instead of JSON.
+  static const char* const kProtobufContentType;
+
+  // Size of the pieces JSON predict responses are streamed in (see
+  // ProcessRequest() below).
+  static const size_t kOutputChunkSize;
+
+  // Number of instances per predict request of a predictStream call, and
+  // number of those requests processed in parallel for a call.
+  static const int kPredictStreamChunkSize;
+  static const int kPredictStreamMaxInFlightChunks;
+
+  // Receives a piece of the response body that is ready to be sent to the
+  // client, before ProcessRequest() returns.
+  using OutputChunkWriter = std::function<void(absl::string_view chunk)>;
+
   // API calls are configured to timeout after `run_optons.timeout_in_ms`.
   // `core` is not owned and is expected to outlive HttpRestApiHandler
   // instance.
@@ -84,6 +123,41 @@ class HttpRestApiHandler {
                         std::vector<std::pair<string, string>>* headers,
                         string* model_name, string* method, string* output);
 
+  // Like above, but `request_content_type` (the value of the Content-Type
+  // request header) selects the encoding of predict requests. Errors are
+  // always returned as JSON.
+  Status ProcessRequest(const absl::string_view http_method,
+                        const absl::string_view request_path,
+                        const absl::string_view request_body,
+                        const absl::string_view request_content_type,
+                        std::vector<std::pair<string, string>>* headers,
+                        string* model_name, string* method, string* output);
+
+  // Like above, but JSON predict responses are passed to `write_output_chunk`
+  // kOutputChunkSize bytes at a time while they are written, and `output` only
+  // holds the end of the response body. The `headers` are final when
+  // `write_output_chunk` is first called. If an error is returned after that,
+  // the response body passed to `write_output_chunk` is incomplete.
+  Status ProcessRequest(const absl::string_view http_method,
+                        const absl::string_view request_path,
+                        const absl::string_view request_body,
+                        const absl::string_view request_content_type,
+                        const OutputChunkWriter& write_output_chunk,
+                        std::vector<std::pair<string, string>>* headers,
+                        string* model_name, string* method, string* output);
+
+  // Like above, but the request is admitted as a request of `client_id` (the
+  // value of the AdmissionController::client_id_metadata_key() request
+  // header).
+  Status ProcessRequest(const absl::string_view http_method,
+                        const absl::string_view request_path,
+                        const absl::string_view request_body,
+                        const absl::string_view request_content_type,
+                        const absl::string_view client_id,
+                        const OutputChunkWriter& write_output_chunk,
+                        std::vector<std::pair<string, string>>* headers,
+                        string* model_name, string* method, string* output);
+
  private:
   Status ProcessClassifyRequest(
       const absl::string_view model_name,
@@ -96,6 +170,27 @@ class HttpRestApiHandler {
       const absl::optional<absl::string_view>& model_version_label,
       const absl::string_view request_body, string* output);
   Status ProcessPredictRequest(
+      const absl::string_view model_name,
+      const absl::optional<int64>& model_version,
+      const absl::optional<absl::string_view>& model_version_label,
+      const absl::string_view request_body,
+      const OutputChunkWriter& write_output_chunk, string* output);
+  // Runs the newline-delimited JSON instances of `request_body` as row format
+  // predict requests of kPredictStreamChunkSize instances, on
+  // predict_stream_threads(), and writes their responses in order, one line
+  // each. The chunks run with the cancellation, the trace context, the flight
+  // record and the CPU tag of the request, and their memory is accounted to
+  // it. Once the request is cancelled, no chunk starts.
+  Status ProcessPredictStreamRequest(
+      const absl::string_view model_name,
+      const absl::optional<int64>& model_version,
+      const absl::optional<absl::string_view>& model_version_label,
+      const absl::string_view request_body,
+      const OutputChunkWriter& write_output_chunk,
+      std::vector<std::pair<string, string>>* headers, string* output);
+  // Runs a predict request given as a serialized PredictRequest proto, and
+  // sets `output` to the serialized PredictResponse proto.
+  Status ProcessProtobufPredictRequest(
       const absl::string_view model_name,
       const absl::optional<int64>& model_version,
       const absl::optional<absl::string_view>& model_version_label,
@@ -110,12 +205,51 @@ class HttpRestApiHandler {
       const absl::optional<int64>& model_version,
       const absl::optional<absl::string_view>& model_version_label,
       string* output);
-  Status GetInfoMap(const ModelSpec& model_spec, const string& signature_name,
-                    ::google::protobuf::Map<string, tensorflow::TensorInfo>* infomap);
+  // Runs a predict request on a TensorFlow Decision Forests model served
+  // without TensorFlow graph (see TfdfServable).
+  Status ProcessTfdfPredictRequest(const ServableHandle<TfdfServable>& servable,
+                                   const absl::string_view request_body,
+                                   PredictRequest* request,
+                                   google::protobuf::Arena* arena,
+                                   const OutputChunkWriter& write_output_chunk,
+                                   string* output);
+  // Runs a predict request, i.e. a batch of lookups, on a hashmap (see
+  // FlatHashmapPredict()).
+  Status ProcessHashmapPredictRequest(
+      const ServableHandle<FlatHashmap>& servable,
+      const absl::string_view request_body, PredictRequest* request,
+      google::protobuf::Arena* arena,
+      const OutputChunkWriter& write_output_chunk, string* output);
+  // Returns predict_stream_threads_, created on the first call.
+  thread::ThreadPool* predict_stream_threads()
+      TF_LOCKS_EXCLUDED(predict_stream_threads_mu_);
+
+  // Sets `infomap` to the input map of the signature of the model, from
+  // signature_inputs_cache_ if possible.
+  Status GetInfoMap(
+      const ModelSpec& model_spec, const string& signature_name,
+      std::shared_ptr<const ::google::protobuf::Map<string, tensorflow::TensorInfo>>*
+          infomap);
+
+  class SignatureInputsCache;
 
   const RunOptions run_options_;
   ServerCore* core_;
   std::unique_ptr<TensorflowPredictor> predictor_;
+  // If true, predict, classify and regress requests are first matched against
+  // TfdfServables.
+  const bool serve_tfdf_servables_;
+  // If true, predict requests are first matched against FlatHashmaps.
+  const bool serve_hashmap_servables_;
+  // Shared with the ServableStateMonitor callback that invalidates it, which
+  // may outlive this handler.
+  const std::shared_ptr<SignatureInputsCache> signature_inputs_cache_;
+  // The metadata of the servable versions, and their JSON.
+  const std::shared_ptr<ModelMetadataCache> model_metadata_cache_;
+  // Runs the chunks of the predictStream calls. Created on the first one.
+  mutex predict_stream_threads_mu_;
+  std::unique_ptr<thread::ThreadPool> predict_stream_threads_
+      TF_GUARDED_BY(predict_stream_threads_mu_);
 };
 
 }  // namespace serving
@@ -26,13 +26,16 @@ limitations under the License.
 #include <gtest/gtest.h>
 #include "absl/strings/escaping.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
 #include "absl/time/clock.h"
 #include "re2/re2.h"
 #include "tensorflow/cc/saved_model/loader.h"
 #include "tensorflow/cc/saved_model/signature_constants.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
 #include "tensorflow/core/platform/env.h"
+#include "tensorflow_serving/apis/predict.pb.h"
 #include "tensorflow_serving/core/availability_preserving_policy.h"
 #include "tensorflow_serving/model_servers/model_platform_types.h"
 #include "tensorflow_serving/model_servers/platform_config_util.h"
@@ -40,6 +43,7 @@ limitations under the License.
 #include "tensorflow_serving/servables/tensorflow/saved_model_bundle_source_adapter.pb.h"
 #include "tensorflow_serving/servables/tensorflow/session_bundle_config.pb.h"
 #include "tensorflow_serving/test_util/test_util.h"
+#include "tensorflow_serving/util/request_cancellation.h"
 
 namespace tensorflow {
 namespace serving {
@@ -379,6 +383,146 @@ TEST_F(HttpRestApiHandlerTest, Predict) {
                            (HeaderList){{"Content-Type", "application/json"}}));
 }
 
+TEST_F(HttpRestApiHandlerTest, StreamedPredict) {
+  HeaderList headers;
+  string model_name, method, output;
+  const string req_path =
+      absl::StrCat("/v1/models/", kTestModelName, ":predict");
+  // Large enough for the response to be streamed in several chunks.
+  std::vector<string> instances(20000, "1.0");
+  const string request_body = absl::StrCat(
+      "{\"instances\": [", absl::StrJoin(instances, ","), "]}");
+
+  string expected_output;
+  TF_ASSERT_OK(handler_.ProcessRequest("POST", req_path, request_body,
+                                       &headers, &model_name, &method,
+                                       &expected_output));
+
+  std::vector<string> chunks;
+  TF_EXPECT_OK(handler_.ProcessRequest(
+      "POST", req_path, request_body, /*request_content_type=*/"",
+      [&chunks](absl::string_view chunk) { chunks.emplace_back(chunk); },
+      &headers, &model_name, &method, &output));
+  EXPECT_GT(chunks.size(), 1);
+  for (const string& chunk : chunks) {
+    EXPECT_EQ(chunk.size(), HttpRestApiHandler::kOutputChunkSize);
+  }
+  EXPECT_EQ(absl::StrCat(absl::StrJoin(chunks, ""), output), expected_output);
+  EXPECT_THAT(headers, UnorderedElementsAreArray(
+                           (HeaderList){{"Content-Type", "application/json"}}));
+}
+
+TEST_F(HttpRestApiHandlerTest, PredictStream) {
+  HeaderList headers;
+  string model_name, method, output;
+  const string req_path =
+      absl::StrCat("/v1/models/", kTestModelName, ":predictStream");
+  // Two full chunks and a partial one.
+  const int num_instances = 2 * HttpRestApiHandler::kPredictStreamChunkSize + 3;
+  string request_body;
+  std::vector<std::vector<string>> expected_predictions(3);
+  for (int i = 0; i < num_instances; ++i) {
+    absl::StrAppend(&request_body, i % 10, ".0\n");
+    expected_predictions[i / HttpRestApiHandler::kPredictStreamChunkSize]
+        .push_back(absl::StrCat((i % 10) * 0.5 + 2));
+  }
+
+  std::vector<string> chunks;
+  TF_EXPECT_OK(handler_.ProcessRequest(
+      "POST", req_path, request_body, /*request_content_type=*/"",
+      [&chunks](absl::string_view chunk) { chunks.emplace_back(chunk); },
+      &headers, &model_name, &method, &output));
+  EXPECT_EQ(output, "");
+  EXPECT_EQ(method, "predictStream");
+  EXPECT_THAT(headers,
+              UnorderedElementsAreArray(
+                  (HeaderList){{"Content-Type", "application/x-ndjson"}}));
+  ASSERT_EQ(chunks.size(), 3);
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    // One line per chunk of instances, in order.
+    EXPECT_EQ(chunks[i].find('\n'), chunks[i].size() - 1);
+    TF_EXPECT_OK(CompareJson(
+        chunks[i], absl::StrCat("{\"predictions\": [",
+                                absl::StrJoin(expected_predictions[i], ","),
+                                "]}")));
+  }
+
+  // Without a writer, the lines are in the output.
+  TF_EXPECT_OK(handler_.ProcessRequest("POST", req_path, request_body,
+                                       &headers, &model_name, &method,
+                                       &output));
+  EXPECT_EQ(output, absl::StrJoin(chunks, ""));
+
+  const Status status = handler_.ProcessRequest(
+      "POST", req_path, "\n\n", &headers, &model_name, &method, &output);
+  EXPECT_TRUE(errors::IsInvalidArgument(status));
+  EXPECT_THAT(headers, UnorderedElementsAreArray(
+                           (HeaderList){{"Content-Type", "application/json"}}));
+  EXPECT_THAT(output, HasSubstr("no instances"));
+}
+
+TEST_F(HttpRestApiHandlerTest, CancelledPredictStream) {
+  HeaderList headers;
+  string model_name, method, output;
+  const string req_path =
+      absl::StrCat("/v1/models/", kTestModelName, ":predictStream");
+  string request_body;
+  for (int i = 0; i < 4 * HttpRestApiHandler::kPredictStreamChunkSize; ++i) {
+    absl::StrAppend(&request_body, "1.0\n");
+  }
+
+  // The chunks see the cancellation of the request, so none runs.
+  RequestCancellation cancellation([]() { return true; });
+  ScopedRequestCancellation scoped_cancellation(&cancellation);
+  std::vector<string> chunks;
+  const Status status = handler_.ProcessRequest(
+      "POST", req_path, request_body, /*request_content_type=*/"",
+      [&chunks](absl::string_view chunk) { chunks.emplace_back(chunk); },
+      &headers, &model_name, &method, &output);
+  EXPECT_TRUE(errors::IsCancelled(status)) << status;
+  EXPECT_TRUE(chunks.empty());
+}
+
+TEST_F(HttpRestApiHandlerTest, ProtobufPredict) {
+  HeaderList headers;
+  string model_name, method, output;
+  const string req_path =
+      absl::StrCat("/v1/models/", kTestModelName, ":predict");
+
+  PredictRequest request;
+  TensorProto* input = &(*request.mutable_inputs())["x"];
+  input->set_dtype(DT_FLOAT);
+  input->mutable_tensor_shape()->add_dim()->set_size(2);
+  input->add_float_val(1.0);
+  input->add_float_val(2.0);
+  string request_body;
+  ASSERT_TRUE(request.SerializeToString(&request_body));
+
+  TF_EXPECT_OK(handler_.ProcessRequest(
+      "POST", req_path, request_body, "application/x-protobuf", &headers,
+      &model_name, &method, &output));
+  EXPECT_THAT(headers,
+              UnorderedElementsAreArray((HeaderList){
+                  {"Content-Type", HttpRestApiHandler::kProtobufContentType}}));
+  PredictResponse response;
+  ASSERT_TRUE(response.ParseFromString(output));
+  EXPECT_EQ(response.model_spec().name(), kTestModelName);
+  Tensor predictions;
+  ASSERT_TRUE(predictions.FromProto(response.outputs().at("y")));
+  test::ExpectTensorEqual<float>(
+      predictions, test::AsTensor<float>({2.5, 3.0}, TensorShape({2})));
+
+  // Errors are returned as JSON.
+  const Status status = handler_.ProcessRequest(
+      "POST", req_path, "not a proto", "Application/X-Protobuf; charset=binary",
+      &headers, &model_name, &method, &output);
+  EXPECT_TRUE(errors::IsInvalidArgument(status));
+  EXPECT_THAT(GetJsonErrorMsg(output),
+              HasSubstr("Failed to parse the request body"));
+  EXPECT_THAT(headers, UnorderedElementsAreArray(
+                           (HeaderList){{"Content-Type", "application/json"}}));
+}
+
 TEST_F(HttpRestApiHandlerTest, Regress) {
   HeaderList headers;
   string model_name, method, output;
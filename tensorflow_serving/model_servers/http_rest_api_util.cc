@@ -15,9 +15,12 @@ limitations under the License.
 
 #include "tensorflow_serving/model_servers/http_rest_api_util.h"
 
+#include <algorithm>
+
 #include "google/protobuf/util/json_util.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
 #include "absl/strings/numbers.h"
-#include <curl/curl.h>
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/platform/errors.h"
 #include "tensorflow_serving/servables/tensorflow/get_model_metadata_impl.h"
@@ -25,15 +28,159 @@ limitations under the License.
 namespace tensorflow {
 namespace serving {
 
-const char* const kPredictionApiGegex =
-    R"((?i)/v1/models/([^/:]+)(?:(?:/versions/(\d+))|(?:/labels/([^/:]+)))?:(classify|regress|predict))";
-const char* const kModelStatusApiRegex =
-    R"((?i)/v1/models(?:/([^/:]+))?(?:(?:/versions/(\d+))|(?:/labels/([^/:]+)))?(?:\/(metadata))?)";
+namespace {
+
+// The request paths are parsed as if matched by these regexes, where the
+// literals are case-insensitive:
+//   POST: /v1/models/([^/:]+)(?:(?:/versions/(\d+))|(?:/labels/([^/:]+)))?
+//         :(classify|regress|predict|predictStream)
+//   GET:  /v1/models(?:/([^/:]+))?(?:(?:/versions/(\d+))|(?:/labels/([^/:]+)))?
+//         (?:/(metadata))?
+
+// Removes 'prefix' from the front of 'path', ignoring the case.
+bool ConsumePrefix(const absl::string_view prefix, absl::string_view* path) {
+  if (path->size() < prefix.size() ||
+      !absl::EqualsIgnoreCase(path->substr(0, prefix.size()), prefix)) {
+    return false;
+  }
+  path->remove_prefix(prefix.size());
+  return true;
+}
+
+// Removes the longest prefix of 'path' without '/' nor ':', i.e. [^/:]+, into
+// 'segment'.
+bool ConsumeSegment(absl::string_view* path, absl::string_view* segment) {
+  const size_t size = std::min(path->find_first_of("/:"), path->size());
+  if (size == 0) {
+    return false;
+  }
+  *segment = path->substr(0, size);
+  path->remove_prefix(size);
+  return true;
+}
+
+// Removes the optional "/versions/(\d+)" or "/labels/([^/:]+)" of 'path'.
+// Returns false if they are malformed, in which case the path cannot match.
+bool ConsumeVersionOrLabel(absl::string_view* path, ModelPathInfo* info) {
+  if (ConsumePrefix("/versions/", path)) {
+    size_t size = 0;
+    while (size < path->size() && absl::ascii_isdigit((*path)[size])) {
+      ++size;
+    }
+    if (size == 0) {
+      return false;
+    }
+    info->model_version = path->substr(0, size);
+    path->remove_prefix(size);
+    return true;
+  }
+  if (ConsumePrefix("/labels/", path)) {
+    return ConsumeSegment(path, &info->model_version_label);
+  }
+  return true;
+}
+
+// Parses the end of a GET path, after its model name if any.
+bool ParseModelStatusPathTail(absl::string_view path, ModelPathInfo* info) {
+  if (!ConsumeVersionOrLabel(&path, info)) {
+    return false;
+  }
+  const absl::string_view tail = path;
+  if (ConsumePrefix("/metadata", &path)) {
+    // As written, "/" excluded.
+    info->model_subresource = tail.substr(1, tail.size() - path.size() - 1);
+  }
+  return path.empty();
+}
+
+int HexDigitValue(const char c) {
+  return absl::ascii_isdigit(c) ? c - '0' : absl::ascii_tolower(c) - 'a' + 10;
+}
+
+}  // namespace
+
+bool ParseModelPath(const absl::string_view http_method,
+                    const absl::string_view request_path,
+                    ModelPathInfo* info) {
+  *info = ModelPathInfo();
+  absl::string_view path = request_path;
+  if (http_method == "POST") {
+    if (!ConsumePrefix("/v1/models/", &path) ||
+        !ConsumeSegment(&path, &info->model_name) ||
+        !ConsumeVersionOrLabel(&path, info) || !ConsumePrefix(":", &path)) {
+      return false;
+    }
+    for (const absl::string_view method :
+         {"classify", "regress", "predict", "predictStream"}) {
+      if (absl::EqualsIgnoreCase(path, method)) {
+        // The literal, so that the handler dispatches any case.
+        info->method = method;
+        return true;
+      }
+    }
+    return false;
+  }
+  if (http_method == "GET") {
+    if (!ConsumePrefix("/v1/models", &path)) {
+      return false;
+    }
+    // The model name is optional, but taken if the rest of the path matches,
+    // e.g. "/v1/models/versions/1" is the version 1 of no model.
+    ModelPathInfo named_info;
+    absl::string_view named_path = path;
+    if (ConsumePrefix("/", &named_path) &&
+        ConsumeSegment(&named_path, &named_info.model_name) &&
+        ParseModelStatusPathTail(named_path, &named_info)) {
+      *info = named_info;
+      return true;
+    }
+    return ParseModelStatusPathTail(path, info);
+  }
+  return false;
+}
+
+void PercentDecode(const absl::string_view arg, string* decoded) {
+  decoded->clear();
+  decoded->reserve(arg.size());
+  for (size_t i = 0; i < arg.size(); ++i) {
+    // Malformed escapes are kept as is.
+    if (arg[i] == '%' && i + 2 < arg.size() &&
+        absl::ascii_isxdigit(arg[i + 1]) && absl::ascii_isxdigit(arg[i + 2])) {
+      decoded->push_back(static_cast<char>(HexDigitValue(arg[i + 1]) * 16 +
+                                           HexDigitValue(arg[i + 2])));
+      i += 2;
+    } else {
+      decoded->push_back(arg[i]);
+    }
+  }
+}
+
+Status ParseModelVersion(const ModelPathInfo& info,
+                         absl::optional<int64>* model_version) {
+  if (info.model_version.empty()) {
+    model_version->reset();
+    return Status::OK();
+  }
+  int64 version;
+  if (!absl::SimpleAtoi(info.model_version, &version)) {
+    return errors::InvalidArgument("Failed to convert version: ",
+                                   info.model_version, " to numeric.");
+  }
+  *model_version = version;
+  return Status::OK();
+}
 
 void AddHeaders(std::vector<std::pair<string, string>>* headers) {
   headers->push_back({"Content-Type", "application/json"});
 }
 
+void SetJsonHeaders(std::vector<std::pair<string, string>>* headers) {
+  // Assigned in place, so that the storage of a reused vector is too.
+  headers->resize(1);
+  (*headers)[0].first.assign("Content-Type");
+  (*headers)[0].second.assign("application/json");
+}
+
 void AddCORSHeaders(std::vector<std::pair<string, string>>* headers) {
   headers->push_back({"Access-Control-Allow-Origin", "*"});
   headers->push_back({"Access-Control-Allow-Methods", "POST, GET"});
@@ -63,65 +210,28 @@ Status FillModelSpecWithNameVersionAndLabel(
   return Status::OK();
 }
 
-bool DecodeArg(string* arg) {
-  static const bool run_once ABSL_ATTRIBUTE_UNUSED = [&]() {
-    curl_global_init(CURL_GLOBAL_ALL);
-    return true;
-  }();
-  CURL* curl = curl_easy_init();
-  if (curl != nullptr) {
-    int outlength;
-    char* cres =
-        curl_easy_unescape(curl, arg->c_str(), arg->size(), &outlength);
-    if (cres == nullptr) {
-      return false;
-    }
-    arg->assign(cres, outlength);
-    curl_free(cres);
-    curl_easy_cleanup(curl);
-    return true;
-  }
-  return false;
-}
-
 Status ParseModelInfo(const absl::string_view http_method,
                       const absl::string_view request_path, string* model_name,
                       absl::optional<int64>* model_version,
                       absl::optional<string>* model_version_label,
                       string* method, string* model_subresource,
                       bool* parse_successful) {
-  string model_version_str;
-  string model_version_label_str;
-  // Parse request parameters
-  if (http_method == "POST") {
-    *parse_successful =
-        RE2::FullMatch(string(request_path), kPredictionApiGegex, model_name,
-                       &model_version_str, &model_version_label_str, method);
-  } else if (http_method == "GET") {
-    *parse_successful = RE2::FullMatch(
-        string(request_path), kModelStatusApiRegex, model_name,
-        &model_version_str, &model_version_label_str, model_subresource);
-  }
-  if (!model_name->empty()) {
-    if (!DecodeArg(model_name)) {
-      return errors::InvalidArgument("Failed to decode model name:",
-                                     *model_name);
-    }
+  ModelPathInfo info;
+  *parse_successful = ParseModelPath(http_method, request_path, &info);
+  if (!*parse_successful) {
+    return Status::OK();
   }
-  if (!model_version_str.empty()) {
-    int64 version;
-    if (!absl::SimpleAtoi(model_version_str, &version)) {
-      return errors::InvalidArgument(
-          "Failed to convert version: ", model_version_str, " to numeric.");
-    }
-    *model_version = version;
+  PercentDecode(info.model_name, model_name);
+  method->assign(info.method.data(), info.method.size());
+  model_subresource->assign(info.model_subresource.data(),
+                            info.model_subresource.size());
+  if (!info.model_version.empty()) {
+    TF_RETURN_IF_ERROR(ParseModelVersion(info, model_version));
   }
-  if (!model_version_label_str.empty()) {
-    if (!DecodeArg(&model_version_label_str)) {
-      return errors::InvalidArgument("Failed to decode model version label:",
-                                     model_version_label_str);
-    }
-    *model_version_label = model_version_label_str;
+  if (!info.model_version_label.empty()) {
+    string label;
+    PercentDecode(info.model_version_label, &label);
+    *model_version_label = std::move(label);
   }
   return Status::OK();
 }
@@ -34,6 +34,10 @@ const char* const kHTTPRestApiHandlerPathRegex = "(?i)/v1/.*";
 
 void AddHeaders(std::vector<std::pair<string, string>>* headers);
 
+// Replaces 'headers' by those of the JSON responses, without allocating if
+// 'headers' already had the capacity.
+void SetJsonHeaders(std::vector<std::pair<string, string>>* headers);
+
 void AddCORSHeaders(std::vector<std::pair<string, string>>* headers);
 
 Status FillModelSpecWithNameVersionAndLabel(
@@ -42,6 +46,33 @@ Status FillModelSpecWithNameVersionAndLabel(
     const absl::optional<absl::string_view> model_version_label,
     ::tensorflow::serving::ModelSpec* model_spec);
 
+// The model information of the path of a REST API request, e.g.
+// "/v1/models/<name>/versions/<version>:predict". The fields point into the
+// path, and are percent-encoded as in the path.
+struct ModelPathInfo {
+  absl::string_view model_name;
+  // The digits of the version, if any.
+  absl::string_view model_version;
+  absl::string_view model_version_label;
+  // The method of a POST request, e.g. "predict".
+  absl::string_view method;
+  // The subresource of a GET request, e.g. "metadata".
+  absl::string_view model_subresource;
+};
+
+// Parses the path of a POST (classify, regress or predict) or GET (model
+// status or metadata) request, without copying it. Returns false if the path
+// is not one of those.
+bool ParseModelPath(absl::string_view http_method,
+                    absl::string_view request_path, ModelPathInfo* info);
+
+// Sets 'decoded' to 'arg' with its %XX escapes decoded.
+void PercentDecode(absl::string_view arg, string* decoded);
+
+// Converts the version of 'info' if any, else resets 'model_version'.
+Status ParseModelVersion(const ModelPathInfo& info,
+                         absl::optional<int64>* model_version);
+
 // Parse model information from the request.
 Status ParseModelInfo(const absl::string_view http_method,
                       const absl::string_view request_path, string* model_name,
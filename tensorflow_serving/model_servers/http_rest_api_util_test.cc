@@ -219,6 +219,64 @@ TEST_F(HttpRestApiUtilTest, TestParseModelInfoForPost) {
       &model_subresource, &parse_successful));
   EXPECT_FALSE(parse_successful);
 }
+
+TEST_F(HttpRestApiUtilTest, TestParseModelPath) {
+  ModelPathInfo info;
+  const string request_path = "/v1/models/foo%2Fbar/versions/50:Predict";
+  ASSERT_TRUE(ParseModelPath("POST", request_path, &info));
+  EXPECT_EQ(info.model_name, "foo%2Fbar");
+  EXPECT_EQ(info.model_version, "50");
+  EXPECT_EQ(info.model_version_label, "");
+  EXPECT_EQ(info.method, "predict");
+  // The fields point into the path.
+  EXPECT_EQ(info.model_name.data(), request_path.data() + 11);
+
+  ASSERT_TRUE(ParseModelPath("GET", "/v1/models/foo/labels/canary/metadata",
+                             &info));
+  EXPECT_EQ(info.model_name, "foo");
+  EXPECT_EQ(info.model_version, "");
+  EXPECT_EQ(info.model_version_label, "canary");
+  EXPECT_EQ(info.model_subresource, "metadata");
+
+  ASSERT_TRUE(ParseModelPath("GET", "/v1/models/foo", &info));
+  EXPECT_EQ(info.model_name, "foo");
+  EXPECT_EQ(info.model_version_label, "");
+  EXPECT_EQ(info.model_subresource, "");
+
+  EXPECT_FALSE(ParseModelPath("POST", "/v1/models/foo:explain", &info));
+  EXPECT_FALSE(ParseModelPath("POST", "/v1/models/foo/labels/:predict", &info));
+  EXPECT_FALSE(ParseModelPath("GET", "/v1/models/foo/versions/x", &info));
+  EXPECT_FALSE(ParseModelPath("PUT", "/v1/models/foo", &info));
+
+  absl::optional<int64> model_version;
+  ASSERT_TRUE(ParseModelPath("POST", "/v1/models/foo/versions/7:regress",
+                             &info));
+  TF_EXPECT_OK(ParseModelVersion(info, &model_version));
+  EXPECT_EQ(model_version.value(), 7);
+  ASSERT_TRUE(ParseModelPath("POST", "/v1/models/foo:regress", &info));
+  TF_EXPECT_OK(ParseModelVersion(info, &model_version));
+  EXPECT_FALSE(model_version.has_value());
+}
+
+TEST_F(HttpRestApiUtilTest, TestPercentDecode) {
+  string decoded;
+  PercentDecode("a%2Fb%3a", &decoded);
+  EXPECT_EQ(decoded, "a/b:");
+  PercentDecode("plain", &decoded);
+  EXPECT_EQ(decoded, "plain");
+  // The malformed escapes are kept as is.
+  PercentDecode("50%%zz%4", &decoded);
+  EXPECT_EQ(decoded, "50%%zz%4");
+}
+
+TEST_F(HttpRestApiUtilTest, TestSetJsonHeaders) {
+  std::vector<std::pair<string, string>> headers = {{"Content-Type", "x"},
+                                                    {"Other", "y"}};
+  SetJsonHeaders(&headers);
+  ASSERT_EQ(headers.size(), 1);
+  EXPECT_EQ(headers[0].first, "Content-Type");
+  EXPECT_EQ(headers[0].second, "application/json");
+}
 }  // namespace
 }  // namespace serving
 }  // namespace tensorflow
@@ -15,24 +15,37 @@ limitations under the License.
 
 #include "tensorflow_serving/model_servers/http_server.h"
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
 
 #include "absl/strings/str_cat.h"
+#include "absl/strings/match.h"
 #include "absl/strings/str_format.h"
 #include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
 #include "re2/re2.h"
+#include "tensorflow/core/lib/monitoring/counter.h"
+#include "tensorflow/core/lib/monitoring/gauge.h"
+#include "tensorflow/core/lib/monitoring/sampler.h"
 #include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/logging.h"
+#include "tensorflow_serving/batching/batching_stats.h"
 #include "tensorflow_serving/model_servers/http_rest_api_handler.h"
 #include "tensorflow_serving/model_servers/http_rest_api_util.h"
 #include "tensorflow_serving/model_servers/server_core.h"
 #include "tensorflow_serving/servables/tensorflow/util.h"
+#include "tensorflow_serving/util/flight_recorder.h"
+#include "tensorflow_serving/util/model_cpu_profiler.h"
 #include "tensorflow_serving/util/net_http/server/public/httpserver.h"
 #include "tensorflow_serving/util/net_http/server/public/response_code_enum.h"
 #include "tensorflow_serving/util/net_http/server/public/server_request_interface.h"
 #include "tensorflow_serving/util/prometheus_exporter.h"
+#include "tensorflow_serving/util/request_cancellation.h"
+#include "tensorflow_serving/util/request_memory.h"
 #include "tensorflow_serving/util/threadpool_executor.h"
+#include "tensorflow_serving/util/trace_context.h"
 
 namespace tensorflow {
 namespace serving {
@@ -113,15 +126,127 @@ void ProcessPrometheusRequest(PrometheusExporter* exporter, const string& path,
   req->ReplyWithStatus(http_status);
 }
 
+void ProcessCpuProfileRequest(const string& path,
+                              net_http::ServerRequestInterface* req) {
+  req->OverwriteResponseHeader("Content-Type", "text/plain");
+  if (req->uri_path() != path) {
+    req->WriteResponseString(absl::StrFormat(
+        "Unexpected path: %s. Should be %s", req->uri_path(), path));
+    req->ReplyWithStatus(net_http::HTTPStatusCode::BAD_REQUEST);
+    return;
+  }
+  req->WriteResponseString(ModelCpuProfiler::Get()->GeneratePage());
+  req->ReplyWithStatus(net_http::HTTPStatusCode::OK);
+}
+
+// Serves the captured requests at 'path', and the recent ones at
+// 'path'/recent.
+void ProcessFlightRecorderRequest(const string& path,
+                                  net_http::ServerRequestInterface* req) {
+  req->OverwriteResponseHeader("Content-Type", "text/plain");
+  const absl::string_view uri_path = req->uri_path();
+  const string recent_path = absl::StrCat(path, "/recent");
+  if (uri_path != path && uri_path != recent_path) {
+    req->WriteResponseString(absl::StrFormat(
+        "Unexpected path: %s. Should be %s[/recent]", uri_path, path));
+    req->ReplyWithStatus(net_http::HTTPStatusCode::BAD_REQUEST);
+    return;
+  }
+  req->WriteResponseString(
+      FlightRecorder::Get()->GeneratePage(uri_path == recent_path));
+  req->ReplyWithStatus(net_http::HTTPStatusCode::OK);
+}
+
+// Serves the batching statistics of all the models at 'path', and of one
+// model at 'path'/<model name>.
+void ProcessBatchingStatsRequest(const string& path,
+                                 net_http::ServerRequestInterface* req) {
+  req->OverwriteResponseHeader("Content-Type", "text/plain");
+  const absl::string_view uri_path = req->uri_path();
+  string model_name;
+  if (uri_path != path) {
+    const string prefix = absl::StrCat(path, "/");
+    if (!absl::StartsWith(uri_path, prefix) || uri_path == prefix) {
+      req->WriteResponseString(absl::StrFormat(
+          "Unexpected path: %s. Should be %s[/<model name>]", uri_path, path));
+      req->ReplyWithStatus(net_http::HTTPStatusCode::BAD_REQUEST);
+      return;
+    }
+    model_name = string(uri_path.substr(prefix.size()));
+  }
+  req->WriteResponseString(BatchingStats::Get()->GeneratePage(model_name));
+  req->ReplyWithStatus(net_http::HTTPStatusCode::OK);
+}
+
+auto* http_executor_queue_latency = monitoring::Sampler<0>::New(
+    {"/tensorflow/serving/http/executor_queue_latency",
+     "Distribution of the time (in microseconds) HTTP/REST API work waits in "
+     "the executor queue before it runs."},
+    // Scale of 10, power of 1.8 with bucket count 33 (~20 minutes).
+    monitoring::Buckets::Exponential(10, 1.8, 33));
+
+auto* http_accepted_connections = monitoring::Counter<0>::New(
+    "/tensorflow/serving/http/accepted_connections",
+    "The total number of HTTP/REST API connections that sent requests.");
+
+auto* http_open_connections = monitoring::Gauge<int64, 0>::New(
+    "/tensorflow/serving/http/open_connections",
+    "The number of open HTTP/REST API connections that sent requests.");
+
+// The priorities of the request handlers. The monitoring endpoints run first,
+// so that the scrapes do not time out behind the inference requests in bursts.
+constexpr int kInferencePriority = 0;
+constexpr int kMonitoringPriority = 1;
+
+// The inference requests waiting that long run before the monitoring ones.
+constexpr int64 kMaxQueueDelayMicros = 100 * 1000;
+
+PriorityThreadPoolExecutor::Options RequestExecutorOptions() {
+  PriorityThreadPoolExecutor::Options options;
+  options.num_priorities = kMonitoringPriority + 1;
+  options.max_queue_delay_micros = kMaxQueueDelayMicros;
+  return options;
+}
+
 class RequestExecutor final : public net_http::EventExecutor {
  public:
   explicit RequestExecutor(int num_threads)
-      : executor_(Env::Default(), "httprestserver", num_threads) {}
+      : executor_(Env::Default(), "httprestserver", num_threads,
+                  RequestExecutorOptions()) {}
+
+  void Schedule(std::function<void()> fn) override {
+    ScheduleWithPriority(std::move(fn), kInferencePriority);
+  }
 
-  void Schedule(std::function<void()> fn) override { executor_.Schedule(fn); }
+  void ScheduleWithPriority(std::function<void()> fn, int priority) override {
+    const uint64 enqueue_micros = Env::Default()->NowMicros();
+    executor_.Schedule(
+        [enqueue_micros, fn = std::move(fn)]() {
+          http_executor_queue_latency->GetCell()->Add(
+              Env::Default()->NowMicros() - enqueue_micros);
+          fn();
+        },
+        priority);
+  }
 
  private:
-  ThreadPoolExecutor executor_;
+  PriorityThreadPoolExecutor executor_;
+};
+
+// Exports the connection metrics of the HTTP server.
+class ConnectionMetrics final : public net_http::ConnectionObserver {
+ public:
+  void OnConnectionOpened() override {
+    http_accepted_connections->GetCell()->IncrementBy(1);
+    http_open_connections->GetCell()->Set(++num_open_connections_);
+  }
+
+  void OnConnectionClosed() override {
+    http_open_connections->GetCell()->Set(--num_open_connections_);
+  }
+
+ private:
+  std::atomic<int64> num_open_connections_{0};
 };
 
 class RestApiRequestDispatcher {
@@ -144,24 +269,69 @@ class RestApiRequestDispatcher {
     return nullptr;
   }
 
+  // Only dispatches model status and metadata requests, which just read the
+  // state of the server and so are quick enough to run inline.
+  net_http::RequestHandler DispatchStatusRequest(
+      net_http::ServerRequestInterface* req) {
+    if (req->http_method() == "GET" &&
+        RE2::FullMatch(string(req->uri_path()), regex_)) {
+      return [this](net_http::ServerRequestInterface* req) {
+        this->ProcessRequest(req);
+      };
+    }
+    return nullptr;
+  }
+
  private:
   void ProcessRequest(net_http::ServerRequestInterface* req) {
     const uint64 start = Env::Default()->NowMicros();
-    string body;
-    int64_t num_bytes = 0;
-    auto request_chunk = req->ReadRequestBytes(&num_bytes);
-    while (request_chunk != nullptr) {
-      absl::StrAppend(&body, absl::string_view(request_chunk.get(), num_bytes));
-      request_chunk = req->ReadRequestBytes(&num_bytes);
+    // The body is parsed in place when the request supports it.
+    absl::string_view body;
+    string body_copy;
+    if (!req->GetRequestBody(&body)) {
+      int64_t num_bytes = 0;
+      auto request_chunk = req->ReadRequestBytes(&num_bytes);
+      while (request_chunk != nullptr) {
+        absl::StrAppend(&body_copy,
+                        absl::string_view(request_chunk.get(), num_bytes));
+        request_chunk = req->ReadRequestBytes(&num_bytes);
+      }
+      body = body_copy;
     }
+    ScopedRequestMemory request_memory;
+    ScopedFlightRecord flight_record("REST");
+    flight_record.set_payload(body);
 
-    std::vector<std::pair<string, string>> headers;
+    // The handler assigns the headers in place, so that the strings of the
+    // previous request of this thread are reused.
+    static thread_local std::vector<std::pair<string, string>> thread_headers;
+    std::vector<std::pair<string, string>>& headers = thread_headers;
     string model_name;
     string method;
     string output;
     VLOG(1) << "Processing HTTP request: " << req->http_method() << " "
             << req->uri_path() << " body: " << body.size() << " bytes.";
 
+    // Large responses are sent in chunks while the handler writes them.
+    bool reply_started = false;
+    const auto write_output_chunk = [this, req, &headers,
+                                     &reply_started](absl::string_view chunk) {
+      if (chunk.empty()) {
+        return;
+      }
+      if (!reply_started) {
+        if (core_->enable_cors_support()) {
+          AddCORSHeaders(&headers);
+        }
+        for (const auto& kv : headers) {
+          req->OverwriteResponseHeader(kv.first, kv.second);
+        }
+        reply_started = true;
+      }
+      req->WriteResponseString(chunk);
+      req->PartialReply();
+    };
+
     Status status;
     if (req->http_method() == "OPTIONS") {
       absl::string_view origin_header = req->GetRequestHeader("Origin");
@@ -172,9 +342,30 @@ class RestApiRequestDispatcher {
             "Origin header is missing in CORS preflight");
       }
     } else {
-      status =
-          handler_->ProcessRequest(req->http_method(), req->uri_path(), body,
-                                   &headers, &model_name, &method, &output);
+      const absl::optional<TraceContext> trace_context =
+          TraceContext::FromTraceparent(
+              req->GetRequestHeader(kTraceparentHeader));
+      ScopedTraceContext scoped_trace_context(
+          trace_context ? &*trace_context : nullptr);
+      // The batching drops the request if the client goes away meanwhile.
+      RequestCancellation cancellation([req]() {
+        return req->response_body_status() ==
+               net_http::ServerRequestInterface::BodyStatus::FAILED;
+      });
+      ScopedRequestCancellation scoped_cancellation(&cancellation);
+      status = handler_->ProcessRequest(
+          req->http_method(), req->uri_path(), body,
+          req->GetRequestHeader("Content-Type"),
+          req->GetRequestHeader(
+              core_->admission_controller()->client_id_metadata_key()),
+          write_output_chunk, &headers, &model_name, &method, &output);
+    }
+    request_memory.set_request(model_name, method);
+    flight_record.set_request(model_name, method);
+    flight_record.set_status(status);
+    if (reply_started) {
+      FinishStreamedReply(req, status, start, model_name, method, output);
+      return;
     }
     if (core_->enable_cors_support()) {
       AddCORSHeaders(&headers);
@@ -198,6 +389,25 @@ class RestApiRequestDispatcher {
     req->ReplyWithStatus(http_status);
   }
 
+  // Completes a response whose first chunks have been sent. The status code
+  // has been sent with them, so errors abort the response.
+  void FinishStreamedReply(net_http::ServerRequestInterface* req,
+                           const Status& status, const uint64 start,
+                           const string& model_name, const string& method,
+                           const string& output) {
+    RecordModelRequestCount(model_name, status);
+    if (!status.ok()) {
+      VLOG(1) << "Error Processing HTTP/REST request: " << req->http_method()
+              << " " << req->uri_path() << " Error: " << status.ToString();
+      req->Abort();
+      return;
+    }
+    req->WriteResponseString(output);
+    RecordRequestLatency(model_name, /*api=*/method, /*entrypoint=*/"REST",
+                         Env::Default()->NowMicros() - start);
+    req->Reply();
+  }
+
   const RE2 regex_;
   std::unique_ptr<HttpRestApiHandler> handler_;
   ServerCore* core_;
@@ -206,11 +416,34 @@ class RestApiRequestDispatcher {
 }  // namespace
 
 std::unique_ptr<net_http::HTTPServerInterface> CreateAndStartHttpServer(
-    int port, int num_threads, int timeout_in_ms,
+    int port, const std::string& socket_path, int num_threads,
+    int num_event_loops, bool run_inline, int timeout_in_ms,
+    const HttpConnectionLimits& connection_limits,
     const MonitoringConfig& monitoring_config, ServerCore* core) {
   auto options = absl::make_unique<net_http::ServerOptions>();
-  options->AddPort(static_cast<uint32_t>(port));
-  options->SetExecutor(absl::make_unique<RequestExecutor>(num_threads));
+  if (port != 0) {
+    options->AddPort(static_cast<uint32_t>(port));
+  }
+  if (!socket_path.empty()) {
+    options->SetUnixSocketPath(socket_path);
+  }
+  options->SetNumEventLoops(num_event_loops);
+  // Each event loop runs in a thread of the executor. The first one has always
+  // been counted in `num_threads`, the others are added to it.
+  options->SetExecutor(
+      absl::make_unique<RequestExecutor>(num_threads + num_event_loops - 1));
+  if (connection_limits.keepalive_timeout_in_ms > 0) {
+    options->SetConnectionTimeout(
+        absl::Milliseconds(connection_limits.keepalive_timeout_in_ms));
+  }
+  options->SetMaxConnections(connection_limits.max_connections);
+  options->SetMaxRequestsPerConnection(
+      connection_limits.max_requests_per_connection);
+  options->SetReusePort(connection_limits.reuse_port);
+  if (connection_limits.http2_port != 0) {
+    options->SetHttp2Port(connection_limits.http2_port);
+  }
+  options->SetConnectionObserver(absl::make_unique<ConnectionMetrics>());
 
   auto server = net_http::CreateEvHTTPServer(std::move(options));
   if (server == nullptr) {
@@ -222,6 +455,8 @@ std::unique_ptr<net_http::HTTPServerInterface> CreateAndStartHttpServer(
     std::shared_ptr<PrometheusExporter> exporter =
         std::make_shared<PrometheusExporter>();
     net_http::RequestHandlerOptions prometheus_request_options;
+    prometheus_request_options.set_auto_compress_output(true);
+    prometheus_request_options.set_priority(kMonitoringPriority);
     PrometheusConfig prometheus_config = monitoring_config.prometheus_config();
     auto path = prometheus_config.path().empty()
                     ? PrometheusExporter::kPrometheusPath
@@ -234,9 +469,115 @@ std::unique_ptr<net_http::HTTPServerInterface> CreateAndStartHttpServer(
         prometheus_request_options);
   }
 
+  // Start the per-model CPU profiler and register handler for its endpoint.
+  if (monitoring_config.cpu_profiler_config().enable()) {
+    const CpuProfilerConfig& cpu_profiler_config =
+        monitoring_config.cpu_profiler_config();
+    const int sampling_hz = cpu_profiler_config.sampling_hz() > 0
+                                ? cpu_profiler_config.sampling_hz()
+                                : 100;
+    const Status status = ModelCpuProfiler::Get()->Start(sampling_hz);
+    if (!status.ok()) {
+      LOG(ERROR) << "Failed to start the CPU profiler: " << status;
+    } else {
+      const string path = cpu_profiler_config.path().empty()
+                              ? ModelCpuProfiler::kCpuProfilePath
+                              : cpu_profiler_config.path();
+      net_http::RequestHandlerOptions cpu_profile_request_options;
+      cpu_profile_request_options.set_auto_compress_output(true);
+      cpu_profile_request_options.set_priority(kMonitoringPriority);
+      server->RegisterRequestHandler(
+          path,
+          [path](net_http::ServerRequestInterface* req) {
+            ProcessCpuProfileRequest(path, req);
+          },
+          cpu_profile_request_options);
+    }
+  }
+
+  // Start the flight recorder and register handlers for its endpoints.
+  if (monitoring_config.flight_recorder_config().enable()) {
+    const FlightRecorderConfig& flight_recorder_config =
+        monitoring_config.flight_recorder_config();
+    FlightRecorder::Options flight_recorder_options;
+    if (flight_recorder_config.requests_per_thread() > 0) {
+      flight_recorder_options.requests_per_thread =
+          flight_recorder_config.requests_per_thread();
+    }
+    flight_recorder_options.latency_threshold_micros =
+        flight_recorder_config.latency_threshold_micros();
+    if (flight_recorder_config.max_captured_requests() > 0) {
+      flight_recorder_options.max_captured_requests =
+          flight_recorder_config.max_captured_requests();
+    }
+    flight_recorder_options.capture_payloads =
+        flight_recorder_config.capture_payloads();
+    const Status status = FlightRecorder::Start(flight_recorder_options);
+    if (!status.ok()) {
+      LOG(ERROR) << "Failed to start the flight recorder: " << status;
+    } else {
+      const string path = flight_recorder_config.path().empty()
+                              ? FlightRecorder::kFlightRecorderPath
+                              : flight_recorder_config.path();
+      net_http::RequestHandlerOptions flight_recorder_request_options;
+      flight_recorder_request_options.set_auto_compress_output(true);
+      flight_recorder_request_options.set_priority(kMonitoringPriority);
+      const net_http::RequestHandler flight_recorder_handler =
+          [path](net_http::ServerRequestInterface* req) {
+            ProcessFlightRecorderRequest(path, req);
+          };
+      server->RegisterRequestHandler(path, flight_recorder_handler,
+                                     flight_recorder_request_options);
+      server->RegisterRequestHandler(absl::StrCat(path, "/recent"),
+                                     flight_recorder_handler,
+                                     flight_recorder_request_options);
+    }
+  }
+
+  // Register handlers for the batching statistics endpoints.
+  if (monitoring_config.batching_stats_config().enable()) {
+    const BatchingStatsConfig& batching_stats_config =
+        monitoring_config.batching_stats_config();
+    const string path = batching_stats_config.path().empty()
+                            ? BatchingStats::kBatchingStatsPath
+                            : batching_stats_config.path();
+    net_http::RequestHandlerOptions batching_stats_request_options;
+    batching_stats_request_options.set_auto_compress_output(true);
+    batching_stats_request_options.set_priority(kMonitoringPriority);
+    const net_http::RequestHandler batching_stats_handler =
+        [path](net_http::ServerRequestInterface* req) {
+          ProcessBatchingStatsRequest(path, req);
+        };
+    server->RegisterRequestHandler(path, batching_stats_handler,
+                                   batching_stats_request_options);
+    // The pages of the models.
+    server->RegisterRequestDispatcher(
+        [path, batching_stats_handler](
+            net_http::ServerRequestInterface* req) -> net_http::RequestHandler {
+          if (!absl::StartsWith(req->uri_path(), absl::StrCat(path, "/"))) {
+            return nullptr;
+          }
+          return batching_stats_handler;
+        },
+        batching_stats_request_options);
+  }
+
   std::shared_ptr<RestApiRequestDispatcher> dispatcher =
       std::make_shared<RestApiRequestDispatcher>(timeout_in_ms, core);
   net_http::RequestHandlerOptions handler_options;
+  handler_options.set_auto_compress_output(true);
+  handler_options.set_priority(kInferencePriority);
+  net_http::RequestHandlerOptions inline_handler_options = handler_options;
+  inline_handler_options.set_run_inline(true);
+  if (run_inline) {
+    handler_options = inline_handler_options;
+  } else {
+    server->RegisterRequestDispatcher(
+        [dispatcher](net_http::ServerRequestInterface* req) {
+          return dispatcher->DispatchStatusRequest(req);
+        },
+        inline_handler_options);
+  }
   server->RegisterRequestDispatcher(
       [dispatcher](net_http::ServerRequestInterface* req) {
         return dispatcher->Dispatch(req);
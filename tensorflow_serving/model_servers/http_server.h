@@ -16,6 +16,7 @@ limitations under the License.
 #define TENSORFLOW_SERVING_MODEL_SERVERS_HTTP_SERVER_H_
 
 #include <memory>
+#include <string>
 
 #include "tensorflow_serving/config/monitoring_config.pb.h"
 #include "tensorflow_serving/util/net_http/server/public/httpserver_interface.h"
@@ -25,13 +26,38 @@ namespace serving {
 
 class ServerCore;
 
+// Limits and options of the connections of the HTTP server, where 0 means no
+// limit (or the default timeout).
+struct HttpConnectionLimits {
+  // How long idle keep-alive connections are kept open.
+  int keepalive_timeout_in_ms = 0;
+  // The max number of connections open at the same time.
+  int max_connections = 0;
+  // The max number of (possibly pipelined) requests served on a connection.
+  int max_requests_per_connection = 0;
+  // Whether the port is bound with SO_REUSEPORT, so that a replacement server
+  // can listen on it while this one drains.
+  bool reuse_port = false;
+  // If non-zero, the HTTP/REST API is also served over HTTP/2 (cleartext,
+  // with prior knowledge) on this port.
+  int http2_port = 0;
+};
+
 // Returns a HTTP Server that has following endpoints:
 //
 //   o HTTP/REST API (under /v1/models/...)
 //
-// The returned server is in a state of accepting new requests.
+// The returned server is in a state of accepting new requests. Requests are
+// processed by `num_threads` threads, and their connections are handled by
+// `num_event_loops` event loops sharing the port, within `connection_limits`.
+// The server listens on `port` unless it is 0, and on the UNIX socket at
+// `socket_path` unless it is empty.
+// Model status and metadata requests are processed on the event loops; so are
+// all the requests if `run_inline`.
 std::unique_ptr<net_http::HTTPServerInterface> CreateAndStartHttpServer(
-    int port, int num_threads, int timeout_in_ms,
+    int port, const std::string& socket_path, int num_threads,
+    int num_event_loops, bool run_inline, int timeout_in_ms,
+    const HttpConnectionLimits& connection_limits,
     const MonitoringConfig& monitoring_config, ServerCore* core);
 
 }  // namespace serving
@@ -0,0 +1,217 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/model_servers/load_generator.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/env_time.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow_serving/util/json_tensor.h"
+
+namespace tensorflow {
+namespace serving {
+
+namespace {
+
+// The delay after which a request counts as sent late.
+constexpr int64 kMaxSendDelayMicros = 1000;
+
+// Returns the latency under which 'fraction' of the sorted 'latencies_micros'
+// are.
+int64 LatencyPercentile(const std::vector<int64>& latencies_micros,
+                        const double fraction) {
+  if (latencies_micros.empty()) {
+    return 0;
+  }
+  const int index = std::max(
+      0, static_cast<int>(std::ceil(fraction * latencies_micros.size())) - 1);
+  return latencies_micros[index];
+}
+
+// Returns 'value' as a JSON string, i.e. quoted and escaped.
+string JsonString(const string& value) {
+  rapidjson::StringBuffer buffer;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+  writer.String(value.data(), value.size());
+  return string(buffer.GetString(), buffer.GetSize());
+}
+
+}  // namespace
+
+Status ScheduleRequests(const std::vector<PredictionLog>& request_logs,
+                        const LoadGeneratorOptions& options,
+                        std::vector<ScheduledRequest>* const schedule) {
+  schedule->clear();
+  if (request_logs.empty()) {
+    return errors::InvalidArgument("No request to replay");
+  }
+  const int num_logs = request_logs.size();
+  if (options.qps > 0) {
+    const int num_requests =
+        options.num_requests > 0 ? options.num_requests : num_logs;
+    for (int i = 0; i < num_requests; ++i) {
+      ScheduledRequest request;
+      request.send_time_micros = static_cast<int64>(i * 1e6 / options.qps);
+      request.log_index = i % num_logs;
+      schedule->push_back(request);
+    }
+    return Status::OK();
+  }
+
+  if (options.speedup <= 0) {
+    return errors::InvalidArgument("The speedup must be positive");
+  }
+  for (int i = 0; i < num_logs; ++i) {
+    if (request_logs[i].log_metadata().log_time_micros() == 0) {
+      return errors::InvalidArgument(
+          "Request log ", i,
+          " has no log time, replay it at a fixed rate instead");
+    }
+  }
+  std::vector<int> log_indices(num_logs);
+  for (int i = 0; i < num_logs; ++i) {
+    log_indices[i] = i;
+  }
+  std::stable_sort(log_indices.begin(), log_indices.end(),
+                   [&request_logs](const int a, const int b) {
+                     return request_logs[a].log_metadata().log_time_micros() <
+                            request_logs[b].log_metadata().log_time_micros();
+                   });
+  const int64 first_log_time_micros =
+      request_logs[log_indices[0]].log_metadata().log_time_micros();
+  for (const int log_index : log_indices) {
+    ScheduledRequest request;
+    request.send_time_micros = static_cast<int64>(
+        (request_logs[log_index].log_metadata().log_time_micros() -
+         first_log_time_micros) /
+        options.speedup);
+    request.log_index = log_index;
+    schedule->push_back(request);
+  }
+  return Status::OK();
+}
+
+void ReplayRequests(const std::vector<PredictionLog>& request_logs,
+                    const std::vector<ScheduledRequest>& schedule,
+                    const LoadGeneratorOptions& options,
+                    const RequestSender& sender, LoadReport* const report) {
+  *report = LoadReport();
+  const int max_in_flight_requests =
+      std::max(1, options.max_in_flight_requests);
+  mutex mu;
+  const uint64 start_micros = EnvTime::NowMicros();
+  {
+    thread::ThreadPool senders(Env::Default(), "load_generator",
+                               max_in_flight_requests);
+    for (const ScheduledRequest& scheduled_request : schedule) {
+      // Note: The requests are scheduled on time even when the senders are
+      // all busy, and then wait for one in the queue of the pool.
+      const uint64 send_time_micros =
+          start_micros + scheduled_request.send_time_micros;
+      const uint64 now_micros = EnvTime::NowMicros();
+      if (now_micros < send_time_micros) {
+        Env::Default()->SleepForMicroseconds(send_time_micros - now_micros);
+      }
+      const PredictionLog* const request_log =
+          &request_logs[scheduled_request.log_index];
+      senders.Schedule([&, request_log, send_time_micros]() {
+        const uint64 request_start_micros = EnvTime::NowMicros();
+        const Status status = sender(*request_log);
+        // The latency counts from the scheduled send time, so that the
+        // requests held up by the slow ones are not measured as fast.
+        const int64 latency_micros = EnvTime::NowMicros() - send_time_micros;
+        mutex_lock l(mu);
+        if (request_start_micros > send_time_micros + kMaxSendDelayMicros) {
+          ++report->num_late_requests;
+        }
+        if (status.ok()) {
+          report->latencies_micros.push_back(latency_micros);
+        } else {
+          LOG_FIRST_N(WARNING, 10) << "Request failed: " << status;
+          ++report->num_errors;
+        }
+      });
+    }
+  }
+  report->num_requests = schedule.size();
+  report->elapsed_micros = EnvTime::NowMicros() - start_micros;
+  std::sort(report->latencies_micros.begin(), report->latencies_micros.end());
+}
+
+string FormatLoadReport(const LoadReport& report) {
+  const std::vector<int64>& latencies = report.latencies_micros;
+  return absl::StrCat(
+      "requests: ", report.num_requests, " errors: ", report.num_errors,
+      " late: ", report.num_late_requests, "\n",
+      absl::StrFormat("qps: %.1f\n",
+                      report.num_requests * 1e6 /
+                          std::max<int64>(report.elapsed_micros, 1)),
+      "latency_micros: p50: ", LatencyPercentile(latencies, 0.5),
+      " p90: ", LatencyPercentile(latencies, 0.9),
+      " p99: ", LatencyPercentile(latencies, 0.99),
+      " p999: ", LatencyPercentile(latencies, 0.999),
+      " max: ", latencies.empty() ? 0 : latencies.back(), "\n");
+}
+
+Status MakeRestPredictRequest(const PredictRequest& request,
+                              string* const uri_path, string* const body) {
+  const ModelSpec& model_spec = request.model_spec();
+  if (model_spec.name().empty()) {
+    return errors::InvalidArgument("The request has no model name");
+  }
+  *uri_path = absl::StrCat("/v1/models/", model_spec.name());
+  if (model_spec.has_version()) {
+    absl::StrAppend(uri_path, "/versions/", model_spec.version().value());
+  } else if (!model_spec.version_label().empty()) {
+    absl::StrAppend(uri_path, "/labels/", model_spec.version_label());
+  }
+  absl::StrAppend(uri_path, ":predict");
+
+  TF_RETURN_IF_ERROR(MakeJsonFromTensors(
+      request.inputs(), JsonPredictRequestFormat::kColumnar, body));
+  // The columnar JSON is an object whose only key is the key of the
+  // responses, "outputs", where the requests have "inputs".
+  constexpr char kOutputsKey[] = "\"outputs\"";
+  constexpr char kWhitespace[] = " \t\r\n";
+  const size_t object_position = body->find_first_not_of(kWhitespace);
+  const size_t key_position =
+      object_position == string::npos
+          ? string::npos
+          : body->find_first_not_of(kWhitespace, object_position + 1);
+  if (key_position == string::npos || (*body)[object_position] != '{' ||
+      body->compare(key_position, sizeof(kOutputsKey) - 1, kOutputsKey) != 0) {
+    return errors::Internal("Unexpected JSON of the request inputs");
+  }
+  body->replace(key_position, sizeof(kOutputsKey) - 1, "\"inputs\"");
+  if (!model_spec.signature_name().empty()) {
+    body->insert(key_position,
+                 absl::StrCat("\"signature_name\": ",
+                              JsonString(model_spec.signature_name()), ", "));
+  }
+  return Status::OK();
+}
+
+}  // namespace serving
+}  // namespace tensorflow
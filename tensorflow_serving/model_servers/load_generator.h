@@ -0,0 +1,103 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_MODEL_SERVERS_LOAD_GENERATOR_H_
+#define TENSORFLOW_SERVING_MODEL_SERVERS_LOAD_GENERATOR_H_
+
+#include <functional>
+#include <vector>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow_serving/apis/predict.pb.h"
+#include "tensorflow_serving/apis/prediction_log.pb.h"
+
+namespace tensorflow {
+namespace serving {
+
+// Replays logged requests (PredictionLogs, e.g. from the request logs or the
+// warmup files) against a model server, open-loop: the requests are sent at
+// scheduled times whether or not the previous ones returned, so that the
+// latencies are measured under a realistic load.
+
+struct LoadGeneratorOptions {
+  // If more than 0, the requests are sent at this fixed rate, cycling through
+  // the logs. Otherwise, each log is sent once, at the interval from the first
+  // log of their LogMetadata.log_time_micros, i.e. with the original timing.
+  float qps = 0;
+  // The number of requests sent at a fixed rate. If 0, one per log.
+  int num_requests = 0;
+  // The original intervals are divided by this factor, e.g. 2 replays the
+  // logged traffic twice as fast.
+  float speedup = 1;
+  // The max number of requests in flight. The requests scheduled while that
+  // many are in flight are still dispatched on time, but wait for one of them
+  // to return and are sent late.
+  int max_in_flight_requests = 64;
+};
+
+// A request to send, 'send_time_micros' after the start of the replay.
+struct ScheduledRequest {
+  int64 send_time_micros = 0;
+  // The index of the request in the replayed logs.
+  int log_index = 0;
+};
+
+// Returns in 'schedule' the requests to send for 'request_logs', by
+// increasing send time, as described by 'options'. Fails if the original
+// timing is asked for and a log has no log time.
+Status ScheduleRequests(const std::vector<PredictionLog>& request_logs,
+                        const LoadGeneratorOptions& options,
+                        std::vector<ScheduledRequest>* schedule);
+
+// Sends a logged request, and returns once its response is received.
+using RequestSender = std::function<Status(const PredictionLog&)>;
+
+// The results of a replay.
+struct LoadReport {
+  int64 num_requests = 0;
+  int64 num_errors = 0;
+  // The requests sent more than a millisecond after their scheduled time,
+  // e.g. while 'max_in_flight_requests' were in flight.
+  int64 num_late_requests = 0;
+  int64 elapsed_micros = 0;
+  // The latencies of the successful requests, sorted. They count from the
+  // scheduled send time of the requests rather than their actual one, so
+  // that they include the time the late requests waited to be sent.
+  std::vector<int64> latencies_micros;
+};
+
+// Sends the requests of 'schedule', replaying 'request_logs', with 'sender'
+// called concurrently from up to 'options.max_in_flight_requests' threads,
+// and fills in 'report'. The requests are dispatched at their scheduled time
+// regardless of the requests in flight (i.e. open-loop).
+void ReplayRequests(const std::vector<PredictionLog>& request_logs,
+                    const std::vector<ScheduledRequest>& schedule,
+                    const LoadGeneratorOptions& options,
+                    const RequestSender& sender, LoadReport* report);
+
+// Returns the text summary of 'report': the counts, the achieved rate and
+// the latency percentiles.
+string FormatLoadReport(const LoadReport& report);
+
+// Returns in 'uri_path' and 'body' the REST API call of 'request', in the
+// columnar ("inputs") format.
+Status MakeRestPredictRequest(const PredictRequest& request, string* uri_path,
+                              string* body);
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_MODEL_SERVERS_LOAD_GENERATOR_H_
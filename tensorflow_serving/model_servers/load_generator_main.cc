@@ -0,0 +1,279 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Load generator replaying logged requests against a model server over gRPC
+// or REST, e.g. to compare the latencies of two releases under the same
+// realistic traffic. The requests are read from TFRecord files of
+// PredictionLogs, as written by the request logs or in the warmup files, and
+// sent with their original timing or at a fixed rate.
+//
+// Usage:
+//   load_generator --server=localhost:8500 --protocol=grpc \
+//     --request_log_file_pattern=/logs/my_model/requests-* --qps=200
+//
+// Only the predict requests can be sent over REST.
+
+#include <algorithm>
+#include <chrono>  // NOLINT(build/c++11)
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "grpcpp/create_channel.h"
+#include "grpcpp/security/credentials.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/init_main.h"
+#include "tensorflow/core/util/command_line_flags.h"
+#include "tensorflow_serving/apis/prediction_service.grpc.pb.h"
+#include "tensorflow_serving/model_servers/load_generator.h"
+#include "tensorflow_serving/servables/tensorflow/request_log_reader.h"
+#include "tensorflow_serving/util/net_http/client/public/httpclient.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+// Sends the logged requests to the PredictionService of a server.
+class GrpcRequestSender {
+ public:
+  GrpcRequestSender(const string& server, const int64 timeout_ms)
+      : stub_(PredictionService::NewStub(::grpc::CreateChannel(
+            server, ::grpc::InsecureChannelCredentials()))),
+        timeout_ms_(timeout_ms) {}
+
+  Status Send(const PredictionLog& prediction_log) {
+    ::grpc::ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() +
+                         std::chrono::milliseconds(timeout_ms_));
+    ::grpc::Status status;
+    switch (prediction_log.log_type_case()) {
+      case PredictionLog::kRegressLog: {
+        RegressionResponse response;
+        status = stub_->Regress(
+            &context, prediction_log.regress_log().request(), &response);
+      } break;
+      case PredictionLog::kClassifyLog: {
+        ClassificationResponse response;
+        status = stub_->Classify(
+            &context, prediction_log.classify_log().request(), &response);
+      } break;
+      case PredictionLog::kPredictLog: {
+        PredictResponse response;
+        status = stub_->Predict(
+            &context, prediction_log.predict_log().request(), &response);
+      } break;
+      case PredictionLog::kMultiInferenceLog: {
+        MultiInferenceResponse response;
+        status = stub_->MultiInference(
+            &context, prediction_log.multi_inference_log().request(),
+            &response);
+      } break;
+      default:
+        return errors::Unimplemented("Unsupported log type: ",
+                                     prediction_log.log_type_case());
+    }
+    if (!status.ok()) {
+      return Status(static_cast<error::Code>(status.error_code()),
+                    status.error_message());
+    }
+    return Status::OK();
+  }
+
+ private:
+  const std::unique_ptr<PredictionService::Stub> stub_;
+  const int64 timeout_ms_;
+};
+
+// Runs the event loop of the HTTP connections.
+class EventLoopExecutor final : public net_http::EventExecutor {
+ public:
+  EventLoopExecutor() : thread_pool_(Env::Default(), "http_event_loop", 1) {}
+
+  void Schedule(std::function<void()> fn) override {
+    thread_pool_.Schedule(fn);
+  }
+
+ private:
+  thread::ThreadPool thread_pool_;
+};
+
+// Sends the logged predict requests to the REST API of a server.
+class RestRequestSender {
+ public:
+  // Returns nullptr if 'server' is not a valid host:port.
+  static std::unique_ptr<RestRequestSender> Create(const string& server,
+                                                   const int num_connections,
+                                                   const int64 timeout_ms) {
+    const std::vector<string> host_port = absl::StrSplit(server, ':');
+    int port;
+    if (host_port.size() != 2 || !absl::SimpleAtoi(host_port[1], &port)) {
+      return nullptr;
+    }
+    net_http::EvHTTPConnectionPool::Options options;
+    options.num_connections = num_connections;
+    options.timeout_secs = std::max<int64>(1, (timeout_ms + 999) / 1000);
+    std::unique_ptr<net_http::HTTPClientInterface> connections =
+        net_http::CreateEvHTTPConnectionPool(
+            host_port[0], port, options,
+            std::unique_ptr<net_http::EventExecutor>(new EventLoopExecutor()));
+    if (connections == nullptr) {
+      return nullptr;
+    }
+    return std::unique_ptr<RestRequestSender>(
+        new RestRequestSender(std::move(connections)));
+  }
+
+  ~RestRequestSender() { connections_->Terminate(); }
+
+  Status Send(const PredictionLog& prediction_log) {
+    if (prediction_log.log_type_case() != PredictionLog::kPredictLog) {
+      return errors::Unimplemented("Only predict requests are sent over REST");
+    }
+    string uri_path;
+    string body;
+    TF_RETURN_IF_ERROR(MakeRestPredictRequest(
+        prediction_log.predict_log().request(), &uri_path, &body));
+    net_http::ClientRequest request = {
+        uri_path, "POST", {{"Content-Type", "application/json"}}, body};
+    net_http::ClientResponse response;
+    if (!connections_->BlockingSendRequest(request, &response)) {
+      return errors::Unavailable("Failed to send the request to ", uri_path);
+    }
+    if (response.status != net_http::HTTPStatusCode::OK) {
+      return errors::Unknown("HTTP status ", static_cast<int>(response.status),
+                             ": ", response.body);
+    }
+    return Status::OK();
+  }
+
+ private:
+  explicit RestRequestSender(
+      std::unique_ptr<net_http::HTTPClientInterface> connections)
+      : connections_(std::move(connections)) {}
+
+  const std::unique_ptr<net_http::HTTPClientInterface> connections_;
+};
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
+
+int main(int argc, char** argv) {
+  tensorflow::string server = "localhost:8500";
+  tensorflow::string protocol = "grpc";
+  tensorflow::string request_log_file_pattern;
+  tensorflow::string request_log_compression_type;
+  tensorflow::string model_name;
+  int max_num_request_logs = 100000;
+  tensorflow::int64 timeout_ms = 10000;
+  tensorflow::serving::LoadGeneratorOptions options;
+  std::vector<tensorflow::Flag> flag_list = {
+      tensorflow::Flag("server", &server,
+                       "The host:port of the server, its gRPC port with "
+                       "--protocol=grpc, or its REST API port with "
+                       "--protocol=rest."),
+      tensorflow::Flag("protocol", &protocol,
+                       "The API to send the requests to: \"grpc\" or "
+                       "\"rest\". Only the predict requests are sent over "
+                       "REST."),
+      tensorflow::Flag("request_log_file_pattern", &request_log_file_pattern,
+                       "Pattern of the TFRecord files of PredictionLogs to "
+                       "replay, e.g. request logs or warmup files."),
+      tensorflow::Flag("request_log_compression_type",
+                       &request_log_compression_type,
+                       "The compression of the request logs: \"\", \"ZLIB\" "
+                       "or \"GZIP\"."),
+      tensorflow::Flag("model_name", &model_name,
+                       "If non-empty, only the logged requests of this model "
+                       "are replayed."),
+      tensorflow::Flag("max_num_request_logs", &max_num_request_logs,
+                       "The max number of logged requests read."),
+      tensorflow::Flag("qps", &options.qps,
+                       "If more than 0, the requests are sent at this fixed "
+                       "rate. Otherwise, with the original timing of their "
+                       "logs."),
+      tensorflow::Flag("num_requests", &options.num_requests,
+                       "The number of requests sent at a fixed rate, cycling "
+                       "through the logs. If 0, one per log."),
+      tensorflow::Flag("speedup", &options.speedup,
+                       "The factor the original timing is sped up by."),
+      tensorflow::Flag("max_in_flight_requests",
+                       &options.max_in_flight_requests,
+                       "The max number of requests in flight. The requests "
+                       "due while that many are in flight are sent late, "
+                       "and their latency counts from their due time."),
+      tensorflow::Flag("timeout_ms", &timeout_ms,
+                       "The timeout of each request.")};
+
+  const auto& usage = tensorflow::Flags::Usage(argv[0], flag_list);
+  if (!tensorflow::Flags::Parse(&argc, argv, flag_list) ||
+      request_log_file_pattern.empty() ||
+      (protocol != "grpc" && protocol != "rest")) {
+    std::cerr << usage;
+    return 1;
+  }
+  tensorflow::port::InitMain(argv[0], &argc, &argv);
+
+  std::vector<tensorflow::serving::PredictionLog> request_logs;
+  tensorflow::Status status = tensorflow::serving::ReadRequestLogs(
+      request_log_file_pattern, request_log_compression_type,
+      max_num_request_logs, model_name, &request_logs);
+  std::vector<tensorflow::serving::ScheduledRequest> schedule;
+  if (status.ok()) {
+    status = tensorflow::serving::ScheduleRequests(request_logs, options,
+                                                   &schedule);
+  }
+  if (!status.ok()) {
+    std::cerr << "ERROR: " << status << "\n";
+    return 1;
+  }
+
+  std::unique_ptr<tensorflow::serving::GrpcRequestSender> grpc_sender;
+  std::unique_ptr<tensorflow::serving::RestRequestSender> rest_sender;
+  tensorflow::serving::RequestSender sender;
+  if (protocol == "grpc") {
+    grpc_sender.reset(
+        new tensorflow::serving::GrpcRequestSender(server, timeout_ms));
+    sender = [&grpc_sender](
+                 const tensorflow::serving::PredictionLog& prediction_log) {
+      return grpc_sender->Send(prediction_log);
+    };
+  } else {
+    rest_sender = tensorflow::serving::RestRequestSender::Create(
+        server, options.max_in_flight_requests, timeout_ms);
+    if (rest_sender == nullptr) {
+      std::cerr << "ERROR: Failed to connect to " << server << "\n";
+      return 1;
+    }
+    sender = [&rest_sender](
+                 const tensorflow::serving::PredictionLog& prediction_log) {
+      return rest_sender->Send(prediction_log);
+    };
+  }
+
+  std::cerr << "Replaying " << schedule.size() << " requests of "
+            << request_logs.size() << " logs to " << server << "\n";
+  tensorflow::serving::LoadReport report;
+  tensorflow::serving::ReplayRequests(request_logs, schedule, options, sender,
+                                      &report);
+  std::cout << tensorflow::serving::FormatLoadReport(report);
+  return report.num_errors == 0 ? 0 : 2;
+}
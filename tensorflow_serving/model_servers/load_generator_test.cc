@@ -0,0 +1,169 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/model_servers/load_generator.h"
+
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+using ::testing::HasSubstr;
+using ::testing::Not;
+
+PredictionLog LogAt(const int64 log_time_micros, const string& model_name) {
+  PredictionLog prediction_log;
+  prediction_log.mutable_log_metadata()->set_log_time_micros(log_time_micros);
+  prediction_log.mutable_predict_log()
+      ->mutable_request()
+      ->mutable_model_spec()
+      ->set_name(model_name);
+  return prediction_log;
+}
+
+TEST(LoadGeneratorTest, ScheduleRequestsAtFixedRate) {
+  LoadGeneratorOptions options;
+  options.qps = 100;
+  options.num_requests = 3;
+  std::vector<ScheduledRequest> schedule;
+  TF_ASSERT_OK(ScheduleRequests({LogAt(0, "a"), LogAt(0, "b")}, options,
+                                &schedule));
+  ASSERT_EQ(3, schedule.size());
+  EXPECT_EQ(0, schedule[0].send_time_micros);
+  EXPECT_EQ(10000, schedule[1].send_time_micros);
+  EXPECT_EQ(20000, schedule[2].send_time_micros);
+  EXPECT_EQ(0, schedule[2].log_index);
+}
+
+TEST(LoadGeneratorTest, ScheduleRequestsWithOriginalTiming) {
+  LoadGeneratorOptions options;
+  options.speedup = 2;
+  std::vector<ScheduledRequest> schedule;
+  TF_ASSERT_OK(ScheduleRequests(
+      {LogAt(5000, "a"), LogAt(1000, "b"), LogAt(2000, "c")}, options,
+      &schedule));
+  ASSERT_EQ(3, schedule.size());
+  EXPECT_EQ(1, schedule[0].log_index);
+  EXPECT_EQ(0, schedule[0].send_time_micros);
+  EXPECT_EQ(2, schedule[1].log_index);
+  EXPECT_EQ(500, schedule[1].send_time_micros);
+  EXPECT_EQ(0, schedule[2].log_index);
+  EXPECT_EQ(2000, schedule[2].send_time_micros);
+
+  // The logs without log time can only be replayed at a fixed rate.
+  EXPECT_FALSE(
+      ScheduleRequests({LogAt(1000, "a"), LogAt(0, "b")}, options, &schedule)
+          .ok());
+  EXPECT_FALSE(ScheduleRequests({}, options, &schedule).ok());
+}
+
+TEST(LoadGeneratorTest, ReplayRequests) {
+  const std::vector<PredictionLog> request_logs = {LogAt(0, "good"),
+                                                   LogAt(0, "bad")};
+  LoadGeneratorOptions options;
+  options.qps = 1000;
+  options.num_requests = 10;
+  options.max_in_flight_requests = 2;
+  std::vector<ScheduledRequest> schedule;
+  TF_ASSERT_OK(ScheduleRequests(request_logs, options, &schedule));
+
+  LoadReport report;
+  ReplayRequests(
+      request_logs, schedule, options,
+      [](const PredictionLog& prediction_log) {
+        if (prediction_log.predict_log().request().model_spec().name() ==
+            "bad") {
+          return errors::Unavailable("bad model");
+        }
+        return Status::OK();
+      },
+      &report);
+  EXPECT_EQ(10, report.num_requests);
+  EXPECT_EQ(5, report.num_errors);
+  EXPECT_EQ(5, report.latencies_micros.size());
+  // The ten requests take at least the nine intervals between them.
+  EXPECT_GE(report.elapsed_micros, 9000);
+
+  const string text = FormatLoadReport(report);
+  EXPECT_THAT(text, HasSubstr("requests: 10 errors: 5 "));
+  EXPECT_THAT(text, HasSubstr("latency_micros: p50: "));
+}
+
+TEST(LoadGeneratorTest, ReplayRequestsMeasuresLatencyFromScheduledTime) {
+  const std::vector<PredictionLog> request_logs = {LogAt(0, "slow")};
+  LoadGeneratorOptions options;
+  options.qps = 1000;
+  options.num_requests = 5;
+  options.max_in_flight_requests = 1;
+  std::vector<ScheduledRequest> schedule;
+  TF_ASSERT_OK(ScheduleRequests(request_logs, options, &schedule));
+
+  // The requests take 20ms each, one at a time, so the last one, scheduled
+  // at 4ms, returns after 100ms.
+  LoadReport report;
+  ReplayRequests(
+      request_logs, schedule, options,
+      [](const PredictionLog& prediction_log) {
+        Env::Default()->SleepForMicroseconds(20 * 1000);
+        return Status::OK();
+      },
+      &report);
+  EXPECT_EQ(0, report.num_errors);
+  ASSERT_EQ(5, report.latencies_micros.size());
+  EXPECT_GE(report.latencies_micros.back(), 90 * 1000);
+  EXPECT_GE(report.num_late_requests, 4);
+}
+
+TEST(LoadGeneratorTest, MakeRestPredictRequest) {
+  PredictRequest request;
+  request.mutable_model_spec()->set_name("model");
+  request.mutable_model_spec()->mutable_version()->set_value(3);
+  request.mutable_model_spec()->set_signature_name("serving \"default\"");
+  TensorProto& x = (*request.mutable_inputs())["x"];
+  x.set_dtype(DT_FLOAT);
+  x.mutable_tensor_shape()->add_dim()->set_size(2);
+  x.add_float_val(1.5);
+  x.add_float_val(2.5);
+
+  string uri_path;
+  string body;
+  TF_ASSERT_OK(MakeRestPredictRequest(request, &uri_path, &body));
+  EXPECT_EQ("/v1/models/model/versions/3:predict", uri_path);
+  // The signature name is escaped.
+  EXPECT_THAT(body,
+              HasSubstr("\"signature_name\": \"serving \\\"default\\\"\", "
+                        "\"inputs\""));
+  EXPECT_THAT(body, HasSubstr("1.5"));
+  EXPECT_THAT(body, Not(HasSubstr("outputs")));
+
+  request.mutable_model_spec()->clear_version();
+  request.mutable_model_spec()->set_version_label("stable");
+  TF_ASSERT_OK(MakeRestPredictRequest(request, &uri_path, &body));
+  EXPECT_EQ("/v1/models/model/labels/stable:predict", uri_path);
+
+  request.mutable_model_spec()->clear_name();
+  EXPECT_FALSE(MakeRestPredictRequest(request, &uri_path, &body).ok());
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
@@ -43,13 +43,19 @@ limitations under the License.
 // To enable batching (default disabled): --enable_batching
 // To override the default batching parameters: --batching_parameters_file
 
+#include <signal.h>
+#include <unistd.h>
+
 #include <iostream>
+#include <memory>
 #include <vector>
 
 #include "tensorflow/c/c_api.h"
 #include "tensorflow/compiler/jit/flags.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/init_main.h"
+#include "tensorflow/core/platform/logging.h"
 #include "tensorflow/core/util/command_line_flags.h"
 #include "tensorflow_serving/model_servers/server.h"
 #include "tensorflow_serving/model_servers/version.h"
@@ -70,14 +76,139 @@ int main(int argc, char** argv) {
                        "Port to listen on for HTTP/REST API. If set to zero "
                        "HTTP/REST API will not be exported. This port must be "
                        "different than the one specified in --port."),
+      tensorflow::Flag("rest_api_socket_path", &options.http_socket_path,
+                       "If non-empty, listen to a UNIX socket for HTTP/REST "
+                       "API on the given path, in addition to "
+                       "--rest_api_port if set, so that local clients skip "
+                       "the TCP/IP stack."),
+      tensorflow::Flag("rest_api_http2_port", &options.http2_port,
+                       "If non-zero, also serve the HTTP/REST API over "
+                       "HTTP/2 on this port, in cleartext with prior "
+                       "knowledge (h2c, e.g. `curl --http2-prior-knowledge`). "
+                       "Clients may then multiplex their requests on a few "
+                       "connections. Must be different than --port and "
+                       "--rest_api_port."),
       tensorflow::Flag("rest_api_num_threads", &options.http_num_threads,
                        "Number of threads for HTTP/REST API processing. If not "
                        "set, will be auto set based on number of CPUs."),
+      tensorflow::Flag("rest_api_num_event_loops",
+                       &options.http_num_event_loops,
+                       "Number of event loops accepting HTTP/REST API "
+                       "connections and doing their I/O, each with its own "
+                       "listening socket (using SO_REUSEPORT). Increase it "
+                       "when a single loop cannot keep up with the request "
+                       "rate."),
+      tensorflow::Flag("rest_api_run_inline", &options.http_run_inline,
+                       "Process all HTTP/REST API requests on the event loops "
+                       "instead of the --rest_api_num_threads threads. This "
+                       "saves a thread hop for models with sub-millisecond "
+                       "latency, but a slow request delays all the others of "
+                       "its event loop (see --rest_api_num_event_loops)."),
       tensorflow::Flag("rest_api_timeout_in_ms", &options.http_timeout_in_ms,
                        "Timeout for HTTP/REST API calls."),
+      tensorflow::Flag("rest_api_keepalive_timeout_in_ms",
+                       &options.http_keepalive_timeout_in_ms,
+                       "How long idle HTTP/REST API connections are kept "
+                       "open. If not set, libevent's default of 50 seconds "
+                       "is used."),
+      tensorflow::Flag("rest_api_max_connections",
+                       &options.http_max_connections,
+                       "Max number of HTTP/REST API connections open at the "
+                       "same time. Further connections wait in the listen "
+                       "backlog. 0 means no limit."),
+      tensorflow::Flag("rest_api_max_requests_per_connection",
+                       &options.http_max_requests_per_connection,
+                       "Max number of (possibly pipelined) requests served on "
+                       "an HTTP/REST API connection before it is closed. 0 "
+                       "means no limit."),
       tensorflow::Flag("rest_api_enable_cors_support",
                        &options.enable_cors_support,
                        "Enable CORS headers in response"),
+      tensorflow::Flag("max_concurrent_requests_per_model",
+                       &options.max_concurrent_requests_per_model,
+                       "Max number of inference requests (gRPC and HTTP/REST) "
+                       "of a model processed at the same time. Further "
+                       "requests are rejected with a retryable UNAVAILABLE "
+                       "error (HTTP 503). 0 means no limit."),
+      tensorflow::Flag("admission_target_latency_micros",
+                       &options.admission_target_latency_micros,
+                       "If positive, once the shortest latency of the "
+                       "inference requests of a model exceeds this target "
+                       "over an admission_interval_micros interval, i.e. a "
+                       "queue is standing in front of the model, its requests "
+                       "are rejected at an increasing rate (CoDel) with a "
+                       "retryable UNAVAILABLE error until the latency is back "
+                       "under the target. Should be above the latency of the "
+                       "models when they are not overloaded."),
+      tensorflow::Flag("admission_interval_micros",
+                       &options.admission_interval_micros,
+                       "The interval over which the latency of the requests "
+                       "is compared to admission_target_latency_micros."),
+      tensorflow::Flag("max_requests_per_second_per_model",
+                       &options.max_requests_per_second_per_model,
+                       "If positive, the max rate of the inference requests "
+                       "(gRPC and HTTP/REST) of each model. Further requests "
+                       "are rejected with a RESOURCE_EXHAUSTED error (HTTP "
+                       "429)."),
+      tensorflow::Flag("max_requests_per_second_per_client",
+                       &options.max_requests_per_second_per_client,
+                       "If positive, the max rate of the inference requests "
+                       "of each client to each model, so that one client "
+                       "cannot take the capacity of the others. The clients "
+                       "are identified by the client_id_metadata_key gRPC "
+                       "metadata or HTTP header of their requests."),
+      tensorflow::Flag("rate_limit_burst_seconds",
+                       &options.rate_limit_burst_seconds,
+                       "The requests of a model or client over the max rates "
+                       "above are admitted up to this many seconds worth of "
+                       "requests at once."),
+      tensorflow::Flag("client_id_metadata_key",
+                       &options.client_id_metadata_key,
+                       "The gRPC metadata key, or HTTP header, identifying "
+                       "the client of a request for "
+                       "max_requests_per_second_per_client."),
+      tensorflow::Flag("response_cache_max_bytes_per_model",
+                       &options.response_cache_max_bytes_per_model,
+                       "If positive, the responses of the inference requests "
+                       "(gRPC Predict and JSON HTTP/REST) of each model are "
+                       "cached, up to this many bytes per model, so that "
+                       "repeated requests skip the inference. The responses "
+                       "of a model are dropped whenever one of its versions "
+                       "is loaded or unloaded. Only enable it for "
+                       "deterministic models."),
+      tensorflow::Flag("response_cache_ttl_micros",
+                       &options.response_cache_ttl_micros,
+                       "How long a response stays cached. 0 means until it "
+                       "is evicted or its model changes."),
+      tensorflow::Flag("response_cache_model_names",
+                       &options.response_cache_model_names,
+                       "Comma separated names of the models whose responses "
+                       "are cached. Empty means all the models."),
+      tensorflow::Flag("model_placement_members",
+                       &options.model_placement_members,
+                       "Comma separated members (e.g. host:port) of a fleet "
+                       "of servers sharing the models of --model_config_file "
+                       "by consistent hashing: each server only loads the "
+                       "models placed on it, and fails the requests to the "
+                       "other models with NOT_FOUND naming the members "
+                       "serving them. Empty loads all the models."),
+      tensorflow::Flag("model_placement_self", &options.model_placement_self,
+                       "This server among --model_placement_members."),
+      tensorflow::Flag("model_placement_replication_factor",
+                       &options.model_placement_replication_factor,
+                       "The number of members of the fleet each model is "
+                       "placed on."),
+      tensorflow::Flag("reuse_port", &options.reuse_port,
+                       "If true, the gRPC and HTTP/REST ports are bound with "
+                       "SO_REUSEPORT, so that a replacement server can be "
+                       "started on the same ports, and load its models, "
+                       "before this one is drained."),
+      tensorflow::Flag("drain_timeout_seconds",
+                       &options.drain_timeout_seconds,
+                       "If positive, SIGTERM and SIGINT drain the server "
+                       "before it exits: it stops accepting connections, "
+                       "waits up to this many seconds for the requests in "
+                       "flight to complete, and flushes the request logs."),
       tensorflow::Flag("enable_batching", &options.enable_batching,
                        "enable batching"),
       tensorflow::Flag(
@@ -85,6 +216,14 @@ int main(int argc, char** argv) {
           &options.allow_version_labels_for_unavailable_models,
           "If true, allows assigning unused version labels to models that are "
           "not available yet."),
+      tensorflow::Flag(
+          "predict_response_tensor_content",
+          &options.predict_response_tensor_content,
+          "If true, the output tensors of Predict responses are serialized "
+          "in tensor_content, copied at once from the tensors, rather than "
+          "value by value in the typed fields. Clients must read "
+          "tensor_content, e.g. with tf.make_ndarray(). REST JSON responses "
+          "are not affected."),
       tensorflow::Flag("batching_parameters_file",
                        &options.batching_parameters_file,
                        "If non-empty, read an ascii BatchingParameters "
@@ -116,12 +255,49 @@ int main(int argc, char** argv) {
                        "and servable loads are performed serially in the "
                        "manager's main work loop, may casue the Serving "
                        "request to be delayed. Default: 0"),
+      tensorflow::Flag("load_thread_niceness", &options.load_thread_niceness,
+                       "If positive, the niceness the loads run at, e.g. 10, "
+                       "so that the serving threads run first when the CPUs "
+                       "are busy. Only supported on Linux, with "
+                       "--num_load_threads > 0, and CAP_SYS_NICE or a high "
+                       "enough RLIMIT_NICE for the threads started by the "
+                       "loads to get the default niceness back."),
+      tensorflow::Flag("pause_loads_above_p99_latency_micros",
+                       &options.pause_loads_above_p99_latency_micros,
+                       "If positive, the model loads pause while the p99 "
+                       "latency of the recent requests is above this, in "
+                       "microseconds, so that rollouts yield to serving."),
+      tensorflow::Flag("max_load_pause_micros",
+                       &options.max_load_pause_micros,
+                       "The max time, in microseconds, each load pauses for "
+                       "--pause_loads_above_p99_latency_micros. If 0, there "
+                       "is no limit."),
       tensorflow::Flag("num_unload_threads", &options.num_unload_threads,
                        "The number of threads in the thread-pool used to "
                        "unload servables. If set as 0, we don't use a "
                        "thread-pool, and servable loads are performed serially "
                        "in the manager's main work loop, may casue the Serving "
                        "request to be delayed. Default: 0"),
+      tensorflow::Flag("schedule_model_loads", &options.schedule_model_loads,
+                       "If true, models are loaded on all the load threads "
+                       "at once, in order of their estimated resources, "
+                       "smallest first, so that small models are not queued "
+                       "behind large ones."),
+      tensorflow::Flag("hot_standby_model_versions",
+                       &options.hot_standby_model_versions,
+                       "If true, the newer versions of a model which already "
+                       "serves a version are loaded in standby, without "
+                       "serving, e.g. those added to the specific versions of "
+                       "the model config. Once the served version is removed "
+                       "from the config, they serve at once, without waiting "
+                       "for a load."),
+      tensorflow::Flag("numa_aware_model_placement",
+                       &options.numa_aware_model_placement,
+                       "If true, and the machine has several NUMA nodes, "
+                       "the models supporting it (e.g. on the tfdf platform) "
+                       "are placed on one NUMA node each, with their memory "
+                       "and inference threads, and the model memory is "
+                       "accounted per node."),
       tensorflow::Flag("max_num_load_retries", &options.max_num_load_retries,
                        "maximum number of times it retries loading a model "
                        "after the first failure, before giving up. "
@@ -132,6 +308,25 @@ int main(int argc, char** argv) {
                        "The interval, in microseconds, between each servable "
                        "load retry. If set negative, it doesn't wait. "
                        "Default: 1 minute"),
+      tensorflow::Flag("load_retry_backoff_multiplier",
+                       &options.load_retry_backoff_multiplier,
+                       "The factor the load retry interval is multiplied by "
+                       "after each retry, for an exponential backoff. "
+                       "Default: 1, i.e. a fixed interval"),
+      tensorflow::Flag("max_load_retry_interval_micros",
+                       &options.max_load_retry_interval_micros,
+                       "The max interval, in microseconds, between two load "
+                       "retries. If set to 0, a day."),
+      tensorflow::Flag("load_retry_jitter", &options.load_retry_jitter,
+                       "The fraction, in [0, 1], of each load retry interval "
+                       "that is randomized, so that the models failing "
+                       "together are not retried together."),
+      tensorflow::Flag("release_load_threads_during_load_retries",
+                       &options.release_load_threads_during_load_retries,
+                       "If true, a model whose load failed waits for its "
+                       "retry without holding a load thread, so that a "
+                       "flaky model does not hold back the loads of the "
+                       "other models."),
       tensorflow::Flag("file_system_poll_wait_seconds",
                        &options.file_system_poll_wait_seconds,
                        "Interval in seconds between each poll of the "
@@ -141,6 +336,35 @@ int main(int argc, char** argv) {
                        "entirely causing ModelServer to indefinitely wait for "
                        "a new model at startup. Negative values are reserved "
                        "for testing purposes only."),
+      tensorflow::Flag("watch_file_system", &options.watch_file_system,
+                       "If true, local model base paths are also polled as "
+                       "soon as model versions are moved in or out, e.g. "
+                       "renamed into place once complete, instead of only "
+                       "every file_system_poll_wait_seconds. Only supported "
+                       "on Linux."),
+      tensorflow::Flag("num_file_system_polling_threads",
+                       &options.num_file_system_polling_threads,
+                       "The number of threads polling the base paths of the "
+                       "models in parallel, so that the startup with many "
+                       "models on a remote file system is not dominated by "
+                       "their listing one after the other."),
+      tensorflow::Flag("model_cache_dir", &options.model_cache_dir,
+                       "If non-empty, model versions on remote file systems "
+                       "(e.g. gs://) are copied to this local directory, and "
+                       "loaded from there. Versions already in it, e.g. from "
+                       "before a restart, are not copied again."),
+      tensorflow::Flag("num_model_cache_download_threads",
+                       &options.num_model_cache_download_threads,
+                       "The number of files of a model version copied to "
+                       "model_cache_dir concurrently."),
+      tensorflow::Flag("num_servable_event_callback_threads",
+                       &options.num_servable_event_callback_threads,
+                       "If positive, the servable state events are delivered "
+                       "to their subscribers (e.g. the servable state monitor "
+                       "and its metrics and logging) on this many threads, "
+                       "so that slow subscribers do not delay the model load "
+                       "and unload transitions. If 0 (the default), they are "
+                       "delivered synchronously."),
       tensorflow::Flag("flush_filesystem_caches",
                        &options.flush_filesystem_caches,
                        "If true (the default), filesystem caches will be "
@@ -150,6 +374,13 @@ int main(int argc, char** argv) {
                        "consumption of the model server, at the potential cost "
                        "of cache misses if model files are accessed after "
                        "servables are loaded."),
+      tensorflow::Flag("release_memory_after_unload",
+                       &options.release_memory_after_unload,
+                       "If true, the free memory of the allocator (tcmalloc "
+                       "or glibc malloc) is returned to the OS after each "
+                       "model version is unloaded, so that the resident "
+                       "memory of the server drops before the next version "
+                       "loads."),
       tensorflow::Flag("tensorflow_session_parallelism",
                        &options.tensorflow_session_parallelism,
                        "Number of threads to use for running a "
@@ -196,10 +427,64 @@ int main(int argc, char** argv) {
                        "grpc.max_connection_age_ms=2000)"),
       tensorflow::Flag("grpc_max_threads", &options.grpc_max_threads,
                        "Max grpc server threads to handle grpc messages."),
+      tensorflow::Flag(
+          "grpc_async_num_completion_queues",
+          &options.grpc_async_num_completion_queues,
+          "If > 0, the PredictionService is served with the asynchronous "
+          "gRPC API, with that many completion queues each polled by a "
+          "thread. The calls then wait for a request thread (see "
+          "--grpc_async_num_request_threads) without holding a gRPC thread, "
+          "and --grpc_max_threads does not apply to them."),
+      tensorflow::Flag("grpc_async_num_request_threads",
+                       &options.grpc_async_num_request_threads,
+                       "Number of threads processing the calls of the "
+                       "asynchronous PredictionService. As Session::Run() is "
+                       "synchronous, it bounds the size of the batches "
+                       "formed by the batching queues."),
+      tensorflow::Flag("grpc_async_max_queued_calls",
+                       &options.grpc_async_max_queued_calls,
+                       "The max number of calls of the asynchronous "
+                       "PredictionService waiting for a request thread. The "
+                       "calls over it fail with RESOURCE_EXHAUSTED."),
+      tensorflow::Flag("grpc_predict_stream_num_threads",
+                       &options.grpc_predict_stream_num_threads,
+                       "Number of threads processing the requests of the "
+                       "PredictStream calls, so that the requests of a "
+                       "stream are batched together. If 0, the requests of "
+                       "a stream are processed one at a time."),
+      tensorflow::Flag("grpc_coalesce_identical_predict_requests",
+                       &options.grpc_coalesce_identical_predict_requests,
+                       "If true, a gRPC Predict request identical to one "
+                       "being processed (same model spec, inputs and output "
+                       "filter) waits for it and gets a copy of its "
+                       "response, instead of running the model again."),
+      tensorflow::Flag("grpc_enable_shared_memory_tensors",
+                       &options.grpc_enable_shared_memory_tensors,
+                       "If true, the Predict requests received on "
+                       "--grpc_socket_path may pass their input and output "
+                       "tensors in shared memory regions of the host "
+                       "(/dev/shm/<name> or memfds), instead of serializing "
+                       "them."),
+      tensorflow::Flag("grpc_response_compression",
+                       &options.grpc_response_compression,
+                       "If non-empty, the gRPC responses of at least "
+                       "--grpc_min_compressed_response_bytes are compressed "
+                       "with this algorithm (gzip or deflate) when the "
+                       "client accepts it, and the smaller ones are sent "
+                       "uncompressed."),
+      tensorflow::Flag("grpc_min_compressed_response_bytes",
+                       &options.grpc_min_compressed_response_bytes,
+                       "The size from which the gRPC responses are "
+                       "compressed with --grpc_response_compression."),
       tensorflow::Flag("enable_model_warmup", &options.enable_model_warmup,
                        "Enables model warmup, which triggers lazy "
                        "initializations (such as TF optimizations) at load "
                        "time, to reduce first request latency."),
+      tensorflow::Flag("num_model_warmup_threads",
+                       &options.num_model_warmup_threads,
+                       "The number of threads replaying the warmup requests "
+                       "of a model concurrently. If not positive, the "
+                       "requests are replayed one by one."),
       tensorflow::Flag("version", &display_version, "Display version"),
       tensorflow::Flag(
           "monitoring_config_file", &options.monitoring_config_file,
@@ -230,11 +515,41 @@ int main(int argc, char** argv) {
           "in an interpreter pool of TfLiteSession. Typically there is one "
           "TfLiteSession for each TF Lite model that is loaded. If not "
           "set, will be 1."),
+      tensorflow::Flag(
+          "num_tflite_interpreter_threads",
+          &options.num_tflite_interpreter_threads,
+          "EXPERIMENTAL; CAN BE REMOVED ANYTIME! Number of threads each TFLite "
+          "interpreter runs its ops with. If not set, will be 1."),
+      tensorflow::Flag("use_tflite_xnnpack", &options.use_tflite_xnnpack,
+                       "EXPERIMENTAL; CAN BE REMOVED ANYTIME! Delegate the "
+                       "ops of TFLite models supported by XNNPACK to it."),
+      tensorflow::Flag(
+          "enable_session_callable_cache",
+          &options.enable_session_callable_cache,
+          "EXPERIMENTAL; CAN BE REMOVED ANYTIME! Run the sessions of models "
+          "that are not batched through callables made once for each set of "
+          "inputs and outputs, instead of resolving those on every request. "
+          "gRPC requests with deadlines, which are run with per-request "
+          "timeouts, do not benefit."),
+      tensorflow::Flag(
+          "num_variable_read_streams", &options.num_variable_read_streams,
+          "EXPERIMENTAL; CAN BE REMOVED ANYTIME! If greater than 1, the "
+          "variable files of SavedModels are read with that many concurrent "
+          "streams before being restored. Models on remote file systems, "
+          "e.g. gs://, are then copied to a local temporary directory and "
+          "loaded from there."),
       tensorflow::Flag(
           "enable_signature_method_name_check",
           &options.enable_signature_method_name_check,
           "Enable method_name check for SignatureDef. Disable this if serving "
           "native TF2 regression/classification models."),
+      tensorflow::Flag(
+          "enable_multi_inference_shared_example_parsing",
+          &options.enable_multi_inference_shared_example_parsing,
+          "Parse the examples of a MultiInference request once, and feed the "
+          "parsed features to every task whose input is parsed the same way. "
+          "Helps models whose heads each parse their own copy of the "
+          "examples, at the cost of an extra Session::Run per request."),
       tensorflow::Flag(
           "xla_cpu_compilation_enabled", &xla_cpu_compilation_enabled,
           "EXPERIMENTAL; CAN BE REMOVED ANYTIME! "
@@ -246,7 +561,14 @@ int main(int argc, char** argv) {
       tensorflow::Flag("thread_pool_factory_config_file",
                        &options.thread_pool_factory_config_file,
                        "If non-empty, read an ascii ThreadPoolConfig protobuf "
-                       "from the supplied file name.")};
+                       "from the supplied file name."),
+      tensorflow::Flag("thread_affinity_config_file",
+                       &options.thread_affinity_config_file,
+                       "If non-empty, read an ascii ThreadAffinityConfig "
+                       "protobuf from the supplied file name, which pins the "
+                       "thread groups of the server (gRPC, HTTP, batch, load "
+                       "and session threads) to sets of CPUs, e.g. to keep "
+                       "the model loads off the serving CPUs.")};
 
   const auto& usage = tensorflow::Flags::Usage(argv[0], flag_list);
   if (!tensorflow::Flags::Parse(&argc, argv, flag_list)) {
@@ -269,12 +591,39 @@ int main(int argc, char** argv) {
     tensorflow::DisableXlaCompilation();
   }
 
+  // The termination signals are blocked before any thread is started, so
+  // that only the drain thread receives them.
+  sigset_t drain_signals;
+  sigemptyset(&drain_signals);
+  if (options.drain_timeout_seconds > 0) {
+    sigaddset(&drain_signals, SIGTERM);
+    sigaddset(&drain_signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &drain_signals, nullptr);
+  }
+
   tensorflow::serving::main::Server server;
   const auto& status = server.BuildAndStart(options);
   if (!status.ok()) {
     std::cout << "Failed to start server. Error: " << status << "\n";
     return -1;
   }
+  std::unique_ptr<tensorflow::Thread> drain_thread;
+  if (options.drain_timeout_seconds > 0) {
+    drain_thread.reset(tensorflow::Env::Default()->StartThread(
+        {}, "drain", [&server, &drain_signals, &options]() {
+          int signal_number = 0;
+          sigwait(&drain_signals, &signal_number);
+          LOG(INFO) << "Received signal " << signal_number;
+          if (!server.Drain(options.drain_timeout_seconds)) {
+            // The requests still in flight are abandoned, rather than holding
+            // up the exit past the drain timeout.
+            LOG(WARNING) << "Exiting with requests in flight";
+            _exit(0);
+          }
+        }));
+  }
   server.WaitForTermination();
+  // Joins the drain thread, once the request logs are flushed.
+  drain_thread.reset();
   return 0;
 }
@@ -0,0 +1,105 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/model_servers/model_placement.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+#include "absl/strings/str_cat.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/fingerprint.h"
+
+namespace tensorflow {
+namespace serving {
+
+Status ModelPlacement::Create(const Options& options,
+                              std::unique_ptr<ModelPlacement>* placement) {
+  if (options.members.empty()) {
+    return errors::InvalidArgument("The model placement has no members");
+  }
+  if (std::find(options.members.begin(), options.members.end(),
+                options.self) == options.members.end()) {
+    return errors::InvalidArgument("The model placement self '", options.self,
+                                   "' is not one of its members");
+  }
+  if (std::unordered_set<string>(options.members.begin(),
+                                 options.members.end())
+          .size() != options.members.size()) {
+    return errors::InvalidArgument(
+        "The model placement members are not distinct");
+  }
+  if (options.replication_factor < 1 || options.num_virtual_nodes < 1) {
+    return errors::InvalidArgument(
+        "The model placement replication factor and number of virtual nodes "
+        "must be positive");
+  }
+  placement->reset(new ModelPlacement(options));
+  return Status::OK();
+}
+
+ModelPlacement::ModelPlacement(const Options& options) : options_(options) {
+  const int num_members = options_.members.size();
+  ring_.reserve(num_members * options_.num_virtual_nodes);
+  for (int member_idx = 0; member_idx < num_members; ++member_idx) {
+    for (int node_idx = 0; node_idx < options_.num_virtual_nodes; ++node_idx) {
+      ring_.emplace_back(
+          Fingerprint64(absl::StrCat(options_.members[member_idx], "#",
+                                     node_idx)),
+          member_idx);
+    }
+  }
+  std::sort(ring_.begin(), ring_.end());
+}
+
+std::vector<string> ModelPlacement::Owners(const string& model_name) const {
+  const int num_owners =
+      std::min<int>(options_.replication_factor, options_.members.size());
+  std::vector<string> owners;
+  std::vector<bool> is_owner(options_.members.size(), false);
+  auto it = std::lower_bound(ring_.begin(), ring_.end(),
+                             std::make_pair(Fingerprint64(model_name), 0));
+  while (static_cast<int>(owners.size()) < num_owners) {
+    if (it == ring_.end()) {
+      it = ring_.begin();
+    }
+    if (!is_owner[it->second]) {
+      is_owner[it->second] = true;
+      owners.push_back(options_.members[it->second]);
+    }
+    ++it;
+  }
+  return owners;
+}
+
+bool ModelPlacement::IsPlacedOnSelf(const string& model_name) const {
+  const std::vector<string> owners = Owners(model_name);
+  return std::find(owners.begin(), owners.end(), options_.self) !=
+         owners.end();
+}
+
+ModelConfigList ModelPlacement::PlacedModels(
+    const ModelConfigList& config) const {
+  ModelConfigList placed_config;
+  for (const ModelConfig& model_config : config.config()) {
+    if (IsPlacedOnSelf(model_config.name())) {
+      *placed_config.add_config() = model_config;
+    }
+  }
+  return placed_config;
+}
+
+}  // namespace serving
+}  // namespace tensorflow
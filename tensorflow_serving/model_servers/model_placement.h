@@ -0,0 +1,86 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_MODEL_SERVERS_MODEL_PLACEMENT_H_
+#define TENSORFLOW_SERVING_MODEL_SERVERS_MODEL_PLACEMENT_H_
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow_serving/config/model_server_config.pb.h"
+
+namespace tensorflow {
+namespace serving {
+
+// Places the models of a fleet of servers by consistent hashing, so that each
+// server only loads a subset of the models, e.g. when there are too many
+// models for every server to load all of them.
+//
+// Each member of the fleet has 'num_virtual_nodes' points on a hash ring, and
+// a model is placed on the 'replication_factor' distinct members following
+// the hash of its name on the ring. Adding or removing a member only moves
+// the models of the ring arcs it gains or loses, about 1/N of them.
+//
+// The placement only depends on the options, so that all the servers, and
+// the clients routing the requests, compute the same one.
+//
+// This class is immutable and thread-safe.
+class ModelPlacement {
+ public:
+  struct Options {
+    // The members of the fleet, e.g. the host:port of their gRPC API.
+    std::vector<string> members;
+    // This server. Must be one of 'members'.
+    string self;
+    // The number of members each model is placed on. If the fleet has fewer
+    // members, the models are placed on all of them.
+    int replication_factor = 1;
+    // The number of points of each member on the hash ring. More points
+    // balance the models more evenly.
+    int num_virtual_nodes = 128;
+  };
+
+  static Status Create(const Options& options,
+                       std::unique_ptr<ModelPlacement>* placement);
+
+  // Returns the members 'model_name' is placed on, by preference order.
+  std::vector<string> Owners(const string& model_name) const;
+
+  // Whether 'model_name' is placed on this server.
+  bool IsPlacedOnSelf(const string& model_name) const;
+
+  // Returns the models of 'config' placed on this server.
+  ModelConfigList PlacedModels(const ModelConfigList& config) const;
+
+ private:
+  explicit ModelPlacement(const Options& options);
+
+  const Options options_;
+
+  // The points of the members on the ring: their hash and the index of their
+  // member, by increasing hash.
+  std::vector<std::pair<uint64, int>> ring_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ModelPlacement);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_MODEL_SERVERS_MODEL_PLACEMENT_H_
@@ -0,0 +1,157 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/model_servers/model_placement.h"
+
+#include <map>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "absl/strings/str_cat.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+using ::testing::ElementsAreArray;
+using ::testing::UnorderedElementsAreArray;
+
+std::unique_ptr<ModelPlacement> CreatePlacement(
+    const std::vector<string>& members, const string& self,
+    const int replication_factor) {
+  ModelPlacement::Options options;
+  options.members = members;
+  options.self = self;
+  options.replication_factor = replication_factor;
+  std::unique_ptr<ModelPlacement> placement;
+  TF_CHECK_OK(ModelPlacement::Create(options, &placement));
+  return placement;
+}
+
+TEST(ModelPlacementTest, InvalidOptions) {
+  std::unique_ptr<ModelPlacement> placement;
+  ModelPlacement::Options options;
+  EXPECT_FALSE(ModelPlacement::Create(options, &placement).ok());
+  options.members = {"a:8500", "b:8500"};
+  options.self = "c:8500";
+  EXPECT_FALSE(ModelPlacement::Create(options, &placement).ok());
+  options.members = {"a:8500", "a:8500"};
+  options.self = "a:8500";
+  EXPECT_FALSE(ModelPlacement::Create(options, &placement).ok());
+  options.members = {"a:8500", "b:8500"};
+  options.replication_factor = 0;
+  EXPECT_FALSE(ModelPlacement::Create(options, &placement).ok());
+}
+
+TEST(ModelPlacementTest, PlacesEachModelOnDistinctOwners) {
+  const std::vector<string> members = {"a:8500", "b:8500", "c:8500",
+                                       "d:8500"};
+  const auto placement = CreatePlacement(members, "a:8500", 2);
+  for (int model_idx = 0; model_idx < 100; ++model_idx) {
+    const std::vector<string> owners =
+        placement->Owners(absl::StrCat("model_", model_idx));
+    ASSERT_EQ(owners.size(), 2);
+    EXPECT_NE(owners[0], owners[1]);
+  }
+}
+
+TEST(ModelPlacementTest, AllTheMembersAgree) {
+  const std::vector<string> members = {"a:8500", "b:8500", "c:8500"};
+  std::vector<std::unique_ptr<ModelPlacement>> placements;
+  for (const string& member : members) {
+    placements.push_back(CreatePlacement(members, member, 2));
+  }
+  for (int model_idx = 0; model_idx < 100; ++model_idx) {
+    const string model_name = absl::StrCat("model_", model_idx);
+    const std::vector<string> owners = placements[0]->Owners(model_name);
+    int num_placed = 0;
+    for (const auto& placement : placements) {
+      EXPECT_THAT(placement->Owners(model_name), ElementsAreArray(owners));
+      num_placed += placement->IsPlacedOnSelf(model_name);
+    }
+    EXPECT_EQ(num_placed, 2);
+  }
+}
+
+TEST(ModelPlacementTest, ReplicatesOnAllTheMembersOfASmallFleet) {
+  const auto placement = CreatePlacement({"a:8500", "b:8500"}, "b:8500", 3);
+  EXPECT_THAT(placement->Owners("model"),
+              UnorderedElementsAreArray({"a:8500", "b:8500"}));
+  EXPECT_TRUE(placement->IsPlacedOnSelf("model"));
+}
+
+TEST(ModelPlacementTest, BalancesTheModels) {
+  const std::vector<string> members = {"a:8500", "b:8500", "c:8500",
+                                       "d:8500"};
+  const auto placement = CreatePlacement(members, "a:8500", 1);
+  std::map<string, int> num_models;
+  const int kNumModels = 4000;
+  for (int model_idx = 0; model_idx < kNumModels; ++model_idx) {
+    ++num_models[placement->Owners(absl::StrCat("model_", model_idx))[0]];
+  }
+  for (const string& member : members) {
+    EXPECT_GT(num_models[member], kNumModels / members.size() / 2) << member;
+  }
+}
+
+TEST(ModelPlacementTest, AddingAMemberMovesFewModels) {
+  const auto placement =
+      CreatePlacement({"a:8500", "b:8500", "c:8500"}, "a:8500", 1);
+  const auto grown_placement =
+      CreatePlacement({"a:8500", "b:8500", "c:8500", "d:8500"}, "a:8500", 1);
+  const int kNumModels = 1000;
+  int num_moved = 0;
+  for (int model_idx = 0; model_idx < kNumModels; ++model_idx) {
+    const string model_name = absl::StrCat("model_", model_idx);
+    const string new_owner = grown_placement->Owners(model_name)[0];
+    if (new_owner != placement->Owners(model_name)[0]) {
+      // Only the models of the new member move.
+      EXPECT_EQ(new_owner, "d:8500");
+      ++num_moved;
+    }
+  }
+  EXPECT_LT(num_moved, kNumModels / 2);
+}
+
+TEST(ModelPlacementTest, PlacedModels) {
+  const std::vector<string> members = {"a:8500", "b:8500", "c:8500"};
+  const auto placement = CreatePlacement(members, "c:8500", 1);
+  ModelConfigList config;
+  std::vector<string> expected_models;
+  for (int model_idx = 0; model_idx < 30; ++model_idx) {
+    const string model_name = absl::StrCat("model_", model_idx);
+    ModelConfig* model_config = config.add_config();
+    model_config->set_name(model_name);
+    model_config->set_base_path(absl::StrCat("/models/", model_name));
+    if (placement->IsPlacedOnSelf(model_name)) {
+      expected_models.push_back(model_name);
+    }
+  }
+  ASSERT_FALSE(expected_models.empty());
+
+  const ModelConfigList placed_config = placement->PlacedModels(config);
+  std::vector<string> placed_models;
+  for (const ModelConfig& model_config : placed_config.config()) {
+    placed_models.push_back(model_config.name());
+    EXPECT_EQ(model_config.base_path(),
+              absl::StrCat("/models/", model_config.name()));
+  }
+  EXPECT_THAT(placed_models, ElementsAreArray(expected_models));
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
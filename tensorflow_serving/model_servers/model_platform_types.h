@@ -21,6 +21,14 @@ namespace serving {
 
 constexpr char kTensorFlowModelPlatform[] = "tensorflow";
 
+// TensorFlow Decision Forests models served without TensorFlow graph (see
+// TfdfServable).
+constexpr char kTfdfModelPlatform[] = "tfdf";
+
+// Memory-mapped string-string hashmaps, served through the Predict API (see
+// FlatHashmapPredict()), e.g. to look up features next to the models.
+constexpr char kHashmapModelPlatform[] = "hashmap";
+
 }  // namespace serving
 }  // namespace tensorflow
 
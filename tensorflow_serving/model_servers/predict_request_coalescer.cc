@@ -0,0 +1,163 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/model_servers/predict_request_coalescer.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "tensorflow/core/lib/monitoring/counter.h"
+#include "tensorflow/core/lib/strings/proto_serialization.h"
+#include "tensorflow/core/platform/fingerprint.h"
+#include "tensorflow/core/platform/notification.h"
+#include "tensorflow_serving/util/request_cancellation.h"
+
+namespace tensorflow {
+namespace serving {
+
+namespace {
+
+auto* coalesced_request_count = monitoring::Counter<1>::New(
+    "/tensorflow/serving/coalesced_predict_request_count",
+    "The number of predict requests answered with the response of an "
+    "identical request being run.",
+    "model_name");
+
+}  // namespace
+
+struct PredictRequestCoalescer::InFlightRequest {
+  // The deterministic serialization of the request.
+  string serialized_request;
+  // Notified once 'status' and 'response' are set.
+  Notification done;
+  Status status;
+  PredictResponse response;
+  // The number of identical requests waiting for this one. Guarded by the
+  // mutex of the coalescer.
+  int num_waiters = 0;
+
+  // The cancellations of the request and of the identical ones waiting for it.
+  // Null for the requests that cannot be cancelled.
+  mutex cancellations_mu;
+  std::vector<const RequestCancellation*> cancellations
+      TF_GUARDED_BY(cancellations_mu);
+  // Whether all of them were found cancelled, after which no more requests
+  // attach to this one.
+  bool cancelled TF_GUARDED_BY(cancellations_mu) = false;
+
+  // Adds a waiting request, unless the run is cancelled.
+  bool Attach(const RequestCancellation* cancellation) {
+    mutex_lock l(cancellations_mu);
+    if (cancelled) {
+      return false;
+    }
+    cancellations.push_back(cancellation);
+    return true;
+  }
+
+  // Whether all the requests are cancelled.
+  bool IsCancelled() {
+    mutex_lock l(cancellations_mu);
+    if (!cancelled) {
+      cancelled = std::all_of(cancellations.begin(), cancellations.end(),
+                              [](const RequestCancellation* cancellation) {
+                                return cancellation != nullptr &&
+                                       cancellation->IsCancelled();
+                              });
+    }
+    return cancelled;
+  }
+};
+
+Status PredictRequestCoalescer::Run(const PredictRequest& request,
+                                    PredictResponse* const response,
+                                    const RunFn& run) {
+  string serialized_request;
+  if (!SerializeToStringDeterministic(request, &serialized_request)) {
+    return run(response);
+  }
+  const uint64 fingerprint = Fingerprint64(serialized_request);
+
+  const RequestCancellation* const cancellation = CurrentRequestCancellation();
+  std::shared_ptr<InFlightRequest> in_flight_request;
+  bool is_leader = false;
+  {
+    mutex_lock l(mu_);
+    std::vector<std::shared_ptr<InFlightRequest>>& candidates =
+        in_flight_requests_[fingerprint];
+    for (const auto& candidate : candidates) {
+      if (candidate->serialized_request == serialized_request &&
+          candidate->Attach(cancellation)) {
+        in_flight_request = candidate;
+        ++in_flight_request->num_waiters;
+        if (waiter_attached_notifier_) {
+          waiter_attached_notifier_();
+        }
+        break;
+      }
+    }
+    if (in_flight_request == nullptr) {
+      is_leader = true;
+      in_flight_request = std::make_shared<InFlightRequest>();
+      in_flight_request->serialized_request = std::move(serialized_request);
+      in_flight_request->Attach(cancellation);
+      candidates.push_back(in_flight_request);
+    }
+  }
+
+  if (!is_leader) {
+    coalesced_request_count->GetCell(request.model_spec().name())
+        ->IncrementBy(1);
+    in_flight_request->done.WaitForNotification();
+    // Note: The deadline of the run is the one of the first request, and this
+    // one may have more time left.
+    if (in_flight_request->status.code() == error::DEADLINE_EXCEEDED) {
+      return run(response);
+    }
+    *response = in_flight_request->response;
+    return in_flight_request->status;
+  }
+
+  Status status;
+  {
+    RequestCancellation run_cancellation(
+        [&in_flight_request]() { return in_flight_request->IsCancelled(); });
+    ScopedRequestCancellation scoped_cancellation(&run_cancellation);
+    status = run(response);
+  }
+  // Once removed, no more requests attach to this one: the response is only
+  // copied if some are waiting.
+  int num_waiters;
+  {
+    mutex_lock l(mu_);
+    num_waiters = in_flight_request->num_waiters;
+    auto it = in_flight_requests_.find(fingerprint);
+    std::vector<std::shared_ptr<InFlightRequest>>& candidates = it->second;
+    candidates.erase(
+        std::find(candidates.begin(), candidates.end(), in_flight_request));
+    if (candidates.empty()) {
+      in_flight_requests_.erase(it);
+    }
+  }
+  if (num_waiters > 0) {
+    in_flight_request->status = status;
+    in_flight_request->response = *response;
+  }
+  in_flight_request->done.Notify();
+  return status;
+}
+
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,91 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_MODEL_SERVERS_PREDICT_REQUEST_COALESCER_H_
+#define TENSORFLOW_SERVING_MODEL_SERVERS_PREDICT_REQUEST_COALESCER_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow_serving/apis/predict.pb.h"
+
+namespace tensorflow {
+namespace serving {
+
+namespace internal {
+class PredictRequestCoalescerTestAccess;
+}  // namespace internal
+
+// Runs identical concurrent predict requests once: a request identical to one
+// being run (same model spec, inputs and output filter) waits for the running
+// one, and gets a copy of its response and status, instead of running the
+// model a second time. Requests that arrive after the running one completed
+// are run again: there is no caching of the responses. Since the run has the
+// deadline of the first request, the waiting requests are run on their own
+// if it exceeds it.
+//
+// Two requests are identical if their deterministic serializations are equal.
+// The serializations are indexed by their fingerprint.
+//
+// The request is run with a cancellation (see CurrentRequestCancellation())
+// cancelled once all the identical requests waiting for it are, so that the
+// client of the first one giving up does not fail the others. A request does
+// not wait for a run cancelled meanwhile, but is run again.
+//
+// This class is thread-safe.
+class PredictRequestCoalescer {
+ public:
+  // Runs a request, and fills its response.
+  using RunFn = std::function<Status(PredictResponse* response)>;
+
+  PredictRequestCoalescer() = default;
+
+  // Answers 'request' with 'run', or with the response of an identical request
+  // being run.
+  Status Run(const PredictRequest& request, PredictResponse* response,
+             const RunFn& run) TF_LOCKS_EXCLUDED(mu_);
+
+ private:
+  friend class internal::PredictRequestCoalescerTestAccess;
+
+  struct InFlightRequest;
+
+  // For testing.
+  void SetWaiterAttachedNotifier(std::function<void()> fn) {
+    mutex_lock l(mu_);
+    waiter_attached_notifier_ = std::move(fn);
+  }
+
+  mutex mu_;
+  // The requests being run, by fingerprint of their serialization.
+  std::unordered_map<uint64, std::vector<std::shared_ptr<InFlightRequest>>>
+      in_flight_requests_ TF_GUARDED_BY(mu_);
+  std::function<void()> waiter_attached_notifier_ TF_GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(PredictRequestCoalescer);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_MODEL_SERVERS_PREDICT_REQUEST_COALESCER_H_
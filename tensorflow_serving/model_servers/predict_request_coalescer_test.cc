@@ -0,0 +1,250 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/model_servers/predict_request_coalescer.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <utility>
+
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/notification.h"
+#include "tensorflow_serving/util/request_cancellation.h"
+
+namespace tensorflow {
+namespace serving {
+
+namespace internal {
+
+class PredictRequestCoalescerTestAccess {
+ public:
+  explicit PredictRequestCoalescerTestAccess(
+      PredictRequestCoalescer* coalescer)
+      : coalescer_(coalescer) {}
+
+  void SetWaiterAttachedNotifier(std::function<void()> fn) {
+    coalescer_->SetWaiterAttachedNotifier(std::move(fn));
+  }
+
+ private:
+  PredictRequestCoalescer* const coalescer_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(PredictRequestCoalescerTestAccess);
+};
+
+}  // namespace internal
+
+namespace {
+
+PredictRequest MakeRequest(const string& model_name) {
+  PredictRequest request;
+  request.mutable_model_spec()->set_name(model_name);
+  request.add_output_filter("output");
+  return request;
+}
+
+// Runs 'request' on another thread, while a request is blocked in 'run'.
+class BlockedRequestTest : public ::testing::Test {
+ protected:
+  BlockedRequestTest() {
+    internal::PredictRequestCoalescerTestAccess(&coalescer_)
+        .SetWaiterAttachedNotifier([this]() { follower_attached_.Notify(); });
+  }
+
+  // Starts running 'request' with a 'run' that blocks until Unblock().
+  void StartBlockedRequest(const PredictRequest& request,
+                           const Status& status) {
+    thread_.reset(Env::Default()->StartThread({}, "leader", [=]() {
+      leader_status_ = coalescer_.Run(
+          request, &leader_response_, [&](PredictResponse* response) {
+            ++num_runs_;
+            leader_running_.Notify();
+            unblock_.WaitForNotification();
+            response->mutable_model_spec()->set_name("leader");
+            return status;
+          });
+    }));
+    leader_running_.WaitForNotification();
+  }
+
+  void Unblock() {
+    unblock_.Notify();
+    thread_.reset();
+  }
+
+  PredictRequestCoalescer coalescer_;
+  std::atomic<int> num_runs_{0};
+  Notification leader_running_;
+  Notification follower_attached_;
+  Notification unblock_;
+  std::unique_ptr<Thread> thread_;
+  Status leader_status_;
+  PredictResponse leader_response_;
+};
+
+TEST_F(BlockedRequestTest, IdenticalRequestsAreRunOnce) {
+  StartBlockedRequest(MakeRequest("model"), Status::OK());
+
+  Status follower_status;
+  PredictResponse follower_response;
+  std::unique_ptr<Thread> follower(
+      Env::Default()->StartThread({}, "follower", [&]() {
+        follower_status = coalescer_.Run(MakeRequest("model"),
+                                         &follower_response,
+                                         [&](PredictResponse* response) {
+                                           ++num_runs_;
+                                           return Status::OK();
+                                         });
+      }));
+  follower_attached_.WaitForNotification();
+  Unblock();
+  follower.reset();
+
+  EXPECT_EQ(num_runs_, 1);
+  TF_EXPECT_OK(leader_status_);
+  TF_EXPECT_OK(follower_status);
+  EXPECT_EQ(follower_response.model_spec().name(), "leader");
+}
+
+TEST_F(BlockedRequestTest, TheStatusIsShared) {
+  StartBlockedRequest(MakeRequest("model"), errors::Internal("failed"));
+
+  Status follower_status;
+  PredictResponse follower_response;
+  std::unique_ptr<Thread> follower(
+      Env::Default()->StartThread({}, "follower", [&]() {
+        follower_status = coalescer_.Run(
+            MakeRequest("model"), &follower_response,
+            [&](PredictResponse* response) { return Status::OK(); });
+      }));
+  follower_attached_.WaitForNotification();
+  Unblock();
+  follower.reset();
+
+  EXPECT_EQ(leader_status_.code(), error::INTERNAL);
+  EXPECT_EQ(follower_status.code(), error::INTERNAL);
+}
+
+TEST_F(BlockedRequestTest, TheDeadlineErrorIsNotShared) {
+  StartBlockedRequest(MakeRequest("model"),
+                      errors::DeadlineExceeded("leader deadline"));
+
+  Status follower_status;
+  PredictResponse follower_response;
+  std::unique_ptr<Thread> follower(
+      Env::Default()->StartThread({}, "follower", [&]() {
+        follower_status = coalescer_.Run(MakeRequest("model"),
+                                         &follower_response,
+                                         [&](PredictResponse* response) {
+                                           ++num_runs_;
+                                           response->mutable_model_spec()
+                                               ->set_name("follower");
+                                           return Status::OK();
+                                         });
+      }));
+  follower_attached_.WaitForNotification();
+  Unblock();
+  follower.reset();
+
+  // The follower, with its own deadline, is run again.
+  EXPECT_EQ(num_runs_, 2);
+  EXPECT_EQ(leader_status_.code(), error::DEADLINE_EXCEEDED);
+  TF_EXPECT_OK(follower_status);
+  EXPECT_EQ(follower_response.model_spec().name(), "follower");
+}
+
+TEST_F(BlockedRequestTest, DifferentRequestsAreRunSeparately) {
+  StartBlockedRequest(MakeRequest("model"), Status::OK());
+
+  PredictResponse other_response;
+  TF_ASSERT_OK(coalescer_.Run(MakeRequest("other_model"), &other_response,
+                              [&](PredictResponse* response) {
+                                ++num_runs_;
+                                response->mutable_model_spec()->set_name(
+                                    "other");
+                                return Status::OK();
+                              }));
+  EXPECT_EQ(other_response.model_spec().name(), "other");
+  Unblock();
+  EXPECT_EQ(num_runs_, 2);
+}
+
+TEST(PredictRequestCoalescerTest, TheRunIsCancelledOnceAllRequestsAre) {
+  PredictRequestCoalescer coalescer;
+  Notification follower_attached;
+  internal::PredictRequestCoalescerTestAccess(&coalescer)
+      .SetWaiterAttachedNotifier([&]() { follower_attached.Notify(); });
+  std::atomic<bool> leader_cancelled(false);
+  std::atomic<bool> follower_cancelled(false);
+  Notification leader_running;
+  bool cancelled_with_leader = true;
+  bool cancelled_with_all = false;
+  std::unique_ptr<Thread> leader(
+      Env::Default()->StartThread({}, "leader", [&]() {
+        RequestCancellation cancellation(
+            [&]() { return leader_cancelled.load(); });
+        ScopedRequestCancellation scoped_cancellation(&cancellation);
+        PredictResponse response;
+        TF_EXPECT_OK(coalescer.Run(
+            MakeRequest("model"), &response, [&](PredictResponse* response) {
+              leader_running.Notify();
+              follower_attached.WaitForNotification();
+              // The follower still waits for the response.
+              leader_cancelled = true;
+              cancelled_with_leader =
+                  CurrentRequestCancellation()->IsCancelled();
+              follower_cancelled = true;
+              cancelled_with_all =
+                  CurrentRequestCancellation()->IsCancelled();
+              return Status::OK();
+            }));
+      }));
+  leader_running.WaitForNotification();
+
+  RequestCancellation cancellation(
+      [&]() { return follower_cancelled.load(); });
+  ScopedRequestCancellation scoped_cancellation(&cancellation);
+  PredictResponse response;
+  TF_EXPECT_OK(coalescer.Run(MakeRequest("model"), &response,
+                             [&](PredictResponse* response) {
+                               ADD_FAILURE() << "Not coalesced";
+                               return Status::OK();
+                             }));
+  leader.reset();
+  EXPECT_FALSE(cancelled_with_leader);
+  EXPECT_TRUE(cancelled_with_all);
+}
+
+TEST(PredictRequestCoalescerTest, CompletedRequestsAreRunAgain) {
+  PredictRequestCoalescer coalescer;
+  int num_runs = 0;
+  for (int i = 0; i < 3; ++i) {
+    PredictResponse response;
+    TF_ASSERT_OK(coalescer.Run(MakeRequest("model"), &response,
+                               [&](PredictResponse* response) {
+                                 ++num_runs;
+                                 return Status::OK();
+                               }));
+  }
+  EXPECT_EQ(num_runs, 3);
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
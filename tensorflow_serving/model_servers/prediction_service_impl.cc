@@ -15,7 +15,20 @@ limitations under the License.
 
 #include "tensorflow_serving/model_servers/prediction_service_impl.h"
 
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <memory>
+#include <utility>
+
 #include "grpc/grpc.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/strings/proto_serialization.h"
 #include "tensorflow/core/platform/threadpool_options.h"
 #include "tensorflow_serving/model_servers/grpc_status_util.h"
 #include "tensorflow_serving/servables/tensorflow/classification_service.h"
@@ -23,6 +36,11 @@ limitations under the License.
 #include "tensorflow_serving/servables/tensorflow/multi_inference_helper.h"
 #include "tensorflow_serving/servables/tensorflow/regression_service.h"
 #include "tensorflow_serving/servables/tensorflow/util.h"
+#include "tensorflow_serving/util/flight_recorder.h"
+#include "tensorflow_serving/util/model_cpu_profiler.h"
+#include "tensorflow_serving/util/request_cancellation.h"
+#include "tensorflow_serving/util/request_memory.h"
+#include "tensorflow_serving/util/trace_context.h"
 
 namespace tensorflow {
 namespace serving {
@@ -36,52 +54,409 @@ int DeadlineToTimeoutMillis(const gpr_timespec deadline) {
 }
 
 thread::ThreadPoolOptions GetThreadPoolOptions(
-    ThreadPoolFactory *thread_pool_factory) {
+    ThreadPoolFactory *thread_pool_factory, const string &model_name) {
   thread::ThreadPoolOptions thread_pool_options;
   if (thread_pool_factory != nullptr) {
     thread_pool_options.inter_op_threadpool =
-        thread_pool_factory->GetInterOpThreadPool();
+        thread_pool_factory->GetInterOpThreadPoolForModel(model_name);
     thread_pool_options.intra_op_threadpool =
-        thread_pool_factory->GetIntraOpThreadPool();
+        thread_pool_factory->GetIntraOpThreadPoolForModel(model_name);
   }
   return thread_pool_options;
 }
 
+// Returns the version 'model_spec' is served with, to tag the CPU time of the
+// request. Empty if the CPU profiler is not running, or if the version does not
+// resolve (the request then fails on its own).
+string ServedVersion(ServerCore *core, const ModelSpec &model_spec) {
+  int64 version;
+  if (!ModelCpuProfiler::Get()->running() ||
+      !core->GetServedModelVersion(model_spec, &version).ok()) {
+    return "";
+  }
+  return absl::StrCat(version);
+}
+
+// Admits a request to 'model_spec' (see AdmissionController), from the client
+// identified by the metadata of 'context'. The version (or label) of the spec
+// is resolved first, so that requests to models that are not served fail
+// without being admitted. Rejected requests are counted as failed requests of
+// the model.
+Status AdmitRequest(ServerCore *core, const ::grpc::ServerContext &context,
+                    const ModelSpec &model_spec,
+                    std::unique_ptr<AdmissionController::Ticket> *ticket) {
+  ticket->reset();
+  AdmissionController *const admission_controller =
+      core->admission_controller();
+  if (!admission_controller->enabled()) {
+    return Status::OK();
+  }
+  const string &model_name = model_spec.name();
+  int64 version;
+  Status status = core->GetServedModelVersion(model_spec, &version);
+  if (status.ok()) {
+    string client_id;
+    const auto &metadata = context.client_metadata();
+    const auto it =
+        metadata.find(admission_controller->client_id_metadata_key());
+    if (it != metadata.end()) {
+      client_id.assign(it->second.data(), it->second.size());
+    }
+    status = admission_controller->Admit(model_name, client_id, ticket);
+  }
+  if (!status.ok()) {
+    VLOG(1) << "Request rejected: " << status.error_message();
+    RecordModelRequestCount(model_name, status);
+  }
+  return status;
+}
+
+// Traces a request, for the lifetime of this object, if its metadata carries
+// a trace context.
+class ScopedRequestSpan {
+ public:
+  ScopedRequestSpan(const absl::string_view name,
+                    const ::grpc::ServerContext &context)
+      : parent_(GetTraceContext(context)),
+        span_(name, parent_ ? &*parent_ : nullptr),
+        trace_context_(span_.context()) {}
+
+ private:
+  static absl::optional<TraceContext> GetTraceContext(
+      const ::grpc::ServerContext &context) {
+    const auto &metadata = context.client_metadata();
+    const auto it = metadata.find(kTraceparentHeader);
+    if (it == metadata.end()) {
+      return absl::nullopt;
+    }
+    return TraceContext::FromTraceparent(
+        absl::string_view(it->second.data(), it->second.size()));
+  }
+
+  const absl::optional<TraceContext> parent_;
+  TraceSpan span_;
+  ScopedTraceContext trace_context_;
+};
+
+// The write options of a response of a PredictStream call: the responses
+// smaller than 'min_compressed_bytes' are not compressed.
+::grpc::WriteOptions StreamWriteOptions(const PredictResponse &response,
+                                        const int64 min_compressed_bytes) {
+  ::grpc::WriteOptions options;
+  if (response.ByteSizeLong() < min_compressed_bytes) {
+    options.set_no_compression();
+  }
+  return options;
+}
+
+// The requests of a PredictStream call being processed. Their responses are
+// written in the order of the requests, by the thread completing the oldest
+// request.
+class PredictStreamPipeline {
+ public:
+  struct Request {
+    PredictRequest request;
+    PredictResponse response;
+    ::grpc::Status status;
+    bool done = false;
+  };
+
+  PredictStreamPipeline(
+      ::grpc::ServerReaderWriter<PredictResponse, PredictRequest> *stream,
+      const int max_in_flight_requests, const int64 min_compressed_bytes)
+      : stream_(stream),
+        max_in_flight_requests_(std::max(max_in_flight_requests, 1)),
+        min_compressed_bytes_(min_compressed_bytes) {}
+
+  // Adds a request read from the stream, once there is room for it. Returns
+  // null if the stream has failed.
+  Request *Add(std::unique_ptr<Request> request) {
+    absl::MutexLock l(&mu_);
+    mu_.Await(absl::Condition(
+        +[](PredictStreamPipeline *pipeline) {
+          pipeline->mu_.AssertHeld();
+          return !pipeline->status_.ok() ||
+                 pipeline->requests_.size() <
+                     pipeline->max_in_flight_requests_;
+        },
+        this));
+    if (!status_.ok()) {
+      return nullptr;
+    }
+    requests_.push_back(std::move(request));
+    return requests_.back().get();
+  }
+
+  // Completes 'request', and writes the responses of the oldest completed
+  // requests unless another thread is writing them.
+  void Done(Request *request, const ::grpc::Status &status) {
+    absl::MutexLock l(&mu_);
+    request->status = status;
+    request->done = true;
+    if (writing_) {
+      return;
+    }
+    writing_ = true;
+    while (!requests_.empty() && requests_.front()->done) {
+      std::unique_ptr<Request> oldest = std::move(requests_.front());
+      requests_.pop_front();
+      if (!status_.ok()) {
+        continue;
+      }
+      if (!oldest->status.ok()) {
+        status_ = oldest->status;
+        continue;
+      }
+      mu_.Unlock();
+      const bool written = stream_->Write(
+          oldest->response,
+          StreamWriteOptions(oldest->response, min_compressed_bytes_));
+      mu_.Lock();
+      if (!written && status_.ok()) {
+        status_ = ::grpc::Status(::grpc::StatusCode::CANCELLED,
+                                 "The PredictStream call is closed");
+      }
+    }
+    writing_ = false;
+  }
+
+  // Waits for the requests being processed, and returns the status of the
+  // stream.
+  ::grpc::Status Finish() {
+    absl::MutexLock l(&mu_);
+    mu_.Await(absl::Condition(
+        +[](PredictStreamPipeline *pipeline) {
+          pipeline->mu_.AssertHeld();
+          return pipeline->requests_.empty() && !pipeline->writing_;
+        },
+        this));
+    return status_;
+  }
+
+ private:
+  ::grpc::ServerReaderWriter<PredictResponse, PredictRequest> *const stream_;
+  const int max_in_flight_requests_;
+  const int64 min_compressed_bytes_;
+
+  absl::Mutex mu_;
+  // The requests being processed or whose response is waiting for the ones of
+  // older requests, oldest first.
+  std::deque<std::unique_ptr<Request>> requests_ ABSL_GUARDED_BY(mu_);
+  bool writing_ ABSL_GUARDED_BY(mu_) = false;
+  // The first error of the stream.
+  ::grpc::Status status_ ABSL_GUARDED_BY(mu_);
+};
+
 }  // namespace
 
 ::grpc::Status PredictionServiceImpl::Predict(::grpc::ServerContext *context,
                                               const PredictRequest *request,
                                               PredictResponse *response) {
+  const ::grpc::Status status = RunPredict(context, request, response);
+  if (status.ok()) {
+    CompressResponse(context, *response);
+  }
+  return status;
+}
+
+void PredictionServiceImpl::CompressResponse(
+    ::grpc::ServerContext *context,
+    const google::protobuf::Message &response) const {
+  if (response_compression_algorithm_ != GRPC_COMPRESS_NONE &&
+      response.ByteSizeLong() >= min_compressed_response_bytes_) {
+    context->set_compression_algorithm(response_compression_algorithm_);
+  }
+}
+
+::grpc::Status PredictionServiceImpl::RunPredict(
+    ::grpc::ServerContext *context, const PredictRequest *request,
+    PredictResponse *response) {
+  ScopedRequestSpan span("PredictionService::Predict", *context);
   const uint64 start = Env::Default()->NowMicros();
+  ScopedModelCpuTag cpu_tag(request->model_spec().name(),
+                            ServedVersion(core_, request->model_spec()));
+  ScopedRequestMemory request_memory;
+  request_memory.set_request(request->model_spec().name(), "Predict");
+  ScopedFlightRecord flight_record("GRPC");
+  flight_record.set_request(request->model_spec().name(), "Predict");
+  flight_record.set_payload(request);
+
+  // The regions of the tensors in shared memory are files of the host, which
+  // only the local clients can exchange.
+  const bool uses_shared_memory =
+      SharedMemoryTensors::UsesSharedMemory(*request);
+  SharedMemoryTensors::Peer peer;
+  if (uses_shared_memory) {
+    if (shared_memory_tensors_ == nullptr) {
+      return ToGRPCStatus(errors::FailedPrecondition(
+          "Shared memory tensors are not enabled"));
+    }
+    UnixSocketAcceptor::Credentials credentials;
+    if (!shared_memory_acceptor_->GetPeerCredentials(context->peer(),
+                                                     &credentials)) {
+      return ToGRPCStatus(errors::PermissionDenied(
+          "Shared memory tensors are only accepted on the Unix socket"));
+    }
+    peer.pid = credentials.pid;
+    peer.uid = credentials.uid;
+  }
+
+  // A cached response skips the admission and the inference. The requests
+  // with tensors in shared memory are not cached, as the tensors are not part
+  // of the request.
+  ResponseCache *const response_cache = core_->response_cache();
+  ResponseCache::Key cache_key;
+  string serialized_request;
+  const bool cache_response =
+      !uses_shared_memory &&
+      response_cache->enabled(request->model_spec().name()) &&
+      SerializeToStringDeterministic(*request, &serialized_request);
+  if (cache_response) {
+    string cached_response;
+    if (response_cache->Lookup(request->model_spec().name(), "Predict",
+                               serialized_request, &cached_response,
+                               &cache_key) &&
+        response->ParseFromString(cached_response)) {
+      RecordRequestLatency(request->model_spec().name(), /*api=*/"Predict",
+                           /*entrypoint=*/"GRPC",
+                           Env::Default()->NowMicros() - start);
+      RecordModelRequestCount(request->model_spec().name(),
+                              ::tensorflow::Status::OK());
+      return ::grpc::Status::OK;
+    }
+  }
+
+  std::unique_ptr<AdmissionController::Ticket> admission_ticket;
+  const ::tensorflow::Status admission_status = AdmitRequest(
+      core_, *context, request->model_spec(), &admission_ticket);
+  if (!admission_status.ok()) {
+    return ToGRPCStatus(admission_status);
+  }
   tensorflow::RunOptions run_options = tensorflow::RunOptions();
   if (enforce_session_run_timeout_) {
     run_options.set_timeout_in_ms(
         DeadlineToTimeoutMillis(context->raw_deadline()));
   }
-//VLOG(1) << "Predict started ! "
-  
+  RequestCancellation cancellation(
+      [context]() { return context->IsCancelled(); });
+  ScopedRequestCancellation scoped_cancellation(&cancellation);
+
   const ::tensorflow::Status tf_status =
-      predictor_->Predict(run_options, core_, *request, response);
+      uses_shared_memory
+          ? PredictWithSharedMemory(run_options, peer, *request, response)
+      : predict_request_coalescer_ == nullptr
+          ? predictor_->Predict(run_options, core_, *request, response)
+          : predict_request_coalescer_->Run(
+                *request, response, [&](PredictResponse *leader_response) {
+                  return predictor_->Predict(run_options, core_, *request,
+                                             leader_response);
+                });
   const ::grpc::Status status = ToGRPCStatus(tf_status);
 
   if (status.ok()) {
+    string serialized_response;
+    if (cache_response && response->SerializeToString(&serialized_response)) {
+      response_cache->Insert(cache_key, std::move(serialized_response));
+    }
     RecordRequestLatency(request->model_spec().name(), /*api=*/"Predict",
                          /*entrypoint=*/"GRPC",
                          Env::Default()->NowMicros() - start);
   } else {
     VLOG(1) << "Predict failed: " << status.error_message();
   }
+  flight_record.set_status(tf_status);
   RecordModelRequestCount(request->model_spec().name(), tf_status);
 
   return status;
 }
 
+::tensorflow::Status PredictionServiceImpl::PredictWithSharedMemory(
+    const RunOptions &run_options, const SharedMemoryTensors::Peer &peer,
+    const PredictRequest &request, PredictResponse *response) {
+  std::map<string, Tensor> input_tensors;
+  TF_RETURN_IF_ERROR(
+      shared_memory_tensors_->GetInputTensors(request, peer, &input_tensors));
+  std::map<string, Tensor> output_tensors;
+  TF_RETURN_IF_ERROR(predictor_->PredictWithTensors(
+      run_options, core_, request, input_tensors, &output_tensors, response));
+  return shared_memory_tensors_->WriteOutputTensors(
+      request, peer, output_tensors, response);
+}
+
+thread::ThreadPool *PredictionServiceImpl::predict_stream_threads() {
+  absl::call_once(predict_stream_threads_once_, [this]() {
+    if (num_predict_stream_threads_ > 0) {
+      predict_stream_threads_.reset(new thread::ThreadPool(
+          Env::Default(), "predict_stream", num_predict_stream_threads_));
+    }
+  });
+  return predict_stream_threads_.get();
+}
+
+::grpc::Status PredictionServiceImpl::PredictStream(
+    ::grpc::ServerContext *context,
+    ::grpc::ServerReaderWriter<PredictResponse, PredictRequest> *stream) {
+  // The algorithm applies to all the responses of the stream, and the small
+  // ones opt out of it.
+  if (response_compression_algorithm_ != GRPC_COMPRESS_NONE) {
+    context->set_compression_algorithm(response_compression_algorithm_);
+  }
+  thread::ThreadPool *const predict_stream_threads = predict_stream_threads();
+  if (predict_stream_threads == nullptr) {
+    PredictRequest request;
+    PredictResponse response;
+    while (stream->Read(&request)) {
+      response.Clear();
+      const ::grpc::Status status = RunPredict(context, &request, &response);
+      if (!status.ok()) {
+        return status;
+      }
+      if (!stream->Write(response, StreamWriteOptions(
+                                       response,
+                                       min_compressed_response_bytes_))) {
+        break;
+      }
+    }
+    return ::grpc::Status::OK;
+  }
+
+  // Shared with the request threads, which may still use it after Finish()
+  // returns.
+  auto pipeline = std::make_shared<PredictStreamPipeline>(
+      stream, max_predict_stream_in_flight_requests_,
+      min_compressed_response_bytes_);
+  while (true) {
+    auto request = absl::make_unique<PredictStreamPipeline::Request>();
+    if (!stream->Read(&request->request)) {
+      break;
+    }
+    PredictStreamPipeline::Request *const added =
+        pipeline->Add(std::move(request));
+    if (added == nullptr) {
+      break;
+    }
+    predict_stream_threads->Schedule([this, context, pipeline, added]() {
+      pipeline->Done(added, RunPredict(context, &added->request,
+                                       &added->response));
+    });
+  }
+  return pipeline->Finish();
+}
+
 ::grpc::Status PredictionServiceImpl::GetModelMetadata(
     ::grpc::ServerContext *context, const GetModelMetadataRequest *request,
     GetModelMetadataResponse *response) {
-  const ::grpc::Status status = ToGRPCStatus(
-      GetModelMetadataImpl::GetModelMetadata(core_, *request, response));
-  if (!status.ok()) {
+  std::shared_ptr<const ModelMetadataCache::Entry> metadata;
+  const ::grpc::Status status =
+      ToGRPCStatus(GetModelMetadataImpl::GetCachedModelMetadata(
+          core_, *request, model_metadata_cache_.get(), &metadata));
+  if (metadata != nullptr) {
+    // The signatures are copied as serialized in the cached Any.
+    *response = metadata->response();
+  }
+  if (status.ok()) {
+    CompressResponse(context, *response);
+  } else {
     VLOG(1) << "GetModelMetadata failed: " << status.error_message();
   }
   return status;
@@ -90,27 +465,48 @@ thread::ThreadPoolOptions GetThreadPoolOptions(
 ::grpc::Status PredictionServiceImpl::Classify(
     ::grpc::ServerContext *context, const ClassificationRequest *request,
     ClassificationResponse *response) {
+  ScopedRequestSpan span("PredictionService::Classify", *context);
   const uint64 start = Env::Default()->NowMicros();
+  ScopedModelCpuTag cpu_tag(request->model_spec().name(),
+                            ServedVersion(core_, request->model_spec()));
+  ScopedRequestMemory request_memory;
+  request_memory.set_request(request->model_spec().name(), "Classify");
+  ScopedFlightRecord flight_record("GRPC");
+  flight_record.set_request(request->model_spec().name(), "Classify");
+  flight_record.set_payload(request);
+  std::unique_ptr<AdmissionController::Ticket> admission_ticket;
+  const ::tensorflow::Status admission_status = AdmitRequest(
+      core_, *context, request->model_spec(), &admission_ticket);
+  if (!admission_status.ok()) {
+    return ToGRPCStatus(admission_status);
+  }
   tensorflow::RunOptions run_options = tensorflow::RunOptions();
   // By default, this is infinite which is the same default as RunOptions.
   if (enforce_session_run_timeout_) {
     run_options.set_timeout_in_ms(
         DeadlineToTimeoutMillis(context->raw_deadline()));
   }
+  RequestCancellation cancellation(
+      [context]() { return context->IsCancelled(); });
+  ScopedRequestCancellation scoped_cancellation(&cancellation);
 
   const ::tensorflow::Status tf_status =
       TensorflowClassificationServiceImpl::Classify(
-          run_options, core_, GetThreadPoolOptions(thread_pool_factory_),
+          run_options, core_,
+          GetThreadPoolOptions(thread_pool_factory_,
+                               request->model_spec().name()),
           *request, response);
   const ::grpc::Status status = ToGRPCStatus(tf_status);
 
   if (status.ok()) {
+    CompressResponse(context, *response);
     RecordRequestLatency(request->model_spec().name(), /*api=*/"Classify",
                          /*entrypoint=*/"GRPC",
                          Env::Default()->NowMicros() - start);
   } else {
     VLOG(1) << "Classify request failed: " << status.error_message();
   }
+  flight_record.set_status(tf_status);
   RecordModelRequestCount(request->model_spec().name(), tf_status);
 
   return status;
@@ -119,27 +515,48 @@ thread::ThreadPoolOptions GetThreadPoolOptions(
 ::grpc::Status PredictionServiceImpl::Regress(::grpc::ServerContext *context,
                                               const RegressionRequest *request,
                                               RegressionResponse *response) {
+  ScopedRequestSpan span("PredictionService::Regress", *context);
   const uint64 start = Env::Default()->NowMicros();
+  ScopedModelCpuTag cpu_tag(request->model_spec().name(),
+                            ServedVersion(core_, request->model_spec()));
+  ScopedRequestMemory request_memory;
+  request_memory.set_request(request->model_spec().name(), "Regress");
+  ScopedFlightRecord flight_record("GRPC");
+  flight_record.set_request(request->model_spec().name(), "Regress");
+  flight_record.set_payload(request);
+  std::unique_ptr<AdmissionController::Ticket> admission_ticket;
+  const ::tensorflow::Status admission_status = AdmitRequest(
+      core_, *context, request->model_spec(), &admission_ticket);
+  if (!admission_status.ok()) {
+    return ToGRPCStatus(admission_status);
+  }
   tensorflow::RunOptions run_options = tensorflow::RunOptions();
   // By default, this is infinite which is the same default as RunOptions.
   if (enforce_session_run_timeout_) {
     run_options.set_timeout_in_ms(
         DeadlineToTimeoutMillis(context->raw_deadline()));
   }
+  RequestCancellation cancellation(
+      [context]() { return context->IsCancelled(); });
+  ScopedRequestCancellation scoped_cancellation(&cancellation);
 
   const ::tensorflow::Status tf_status =
       TensorflowRegressionServiceImpl::Regress(
-          run_options, core_, GetThreadPoolOptions(thread_pool_factory_),
+          run_options, core_,
+          GetThreadPoolOptions(thread_pool_factory_,
+                               request->model_spec().name()),
           *request, response);
   const ::grpc::Status status = ToGRPCStatus(tf_status);
 
   if (status.ok()) {
+    CompressResponse(context, *response);
     RecordRequestLatency(request->model_spec().name(), /*api=*/"Regress",
                          /*entrypoint=*/"GRPC",
                          Env::Default()->NowMicros() - start);
   } else {
     VLOG(1) << "Regress request failed: " << status.error_message();
   }
+  flight_record.set_status(tf_status);
   RecordModelRequestCount(request->model_spec().name(), tf_status);
 
   return status;
@@ -148,16 +565,39 @@ thread::ThreadPoolOptions GetThreadPoolOptions(
 ::grpc::Status PredictionServiceImpl::MultiInference(
     ::grpc::ServerContext *context, const MultiInferenceRequest *request,
     MultiInferenceResponse *response) {
+  ScopedRequestSpan span("PredictionService::MultiInference", *context);
   tensorflow::RunOptions run_options = tensorflow::RunOptions();
   // By default, this is infinite which is the same default as RunOptions.
   if (enforce_session_run_timeout_) {
     run_options.set_timeout_in_ms(
         DeadlineToTimeoutMillis(context->raw_deadline()));
   }
+  RequestCancellation cancellation(
+      [context]() { return context->IsCancelled(); });
+  ScopedRequestCancellation scoped_cancellation(&cancellation);
+  // All the tasks of a request are to the same model.
+  const string model_name = request->tasks().empty()
+                                ? ""
+                                : request->tasks(0).model_spec().name();
+  ScopedModelCpuTag cpu_tag(
+      model_name, request->tasks().empty()
+                      ? ""
+                      : ServedVersion(core_, request->tasks(0).model_spec()));
+  std::unique_ptr<AdmissionController::Ticket> admission_ticket;
+  const ::tensorflow::Status admission_status = AdmitRequest(
+      core_, *context,
+      request->tasks().empty() ? ModelSpec() : request->tasks(0).model_spec(),
+      &admission_ticket);
+  if (!admission_status.ok()) {
+    return ToGRPCStatus(admission_status);
+  }
   const ::grpc::Status status = ToGRPCStatus(RunMultiInferenceWithServerCore(
-      run_options, core_, GetThreadPoolOptions(thread_pool_factory_), *request,
-      response));
-  if (!status.ok()) {
+      run_options, core_,
+      GetThreadPoolOptions(thread_pool_factory_, model_name), *request,
+      response, example_parsing_index_cache_.get()));
+  if (status.ok()) {
+    CompressResponse(context, *response);
+  } else {
     VLOG(1) << "MultiInference request failed: " << status.error_message();
   }
   return status;
@@ -16,8 +16,20 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_MODEL_SERVERS_PREDICTION_SERVICE_IMPL_H_
 #define TENSORFLOW_SERVING_MODEL_SERVERS_PREDICTION_SERVICE_IMPL_H_
 
+#include <memory>
+
+#include "grpc/compression.h"
+#include "absl/base/call_once.h"
+#include "grpcpp/support/sync_stream.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow_serving/apis/prediction_service.grpc.pb.h"
+#include "tensorflow_serving/model_servers/predict_request_coalescer.h"
 #include "tensorflow_serving/model_servers/server_core.h"
+#include "tensorflow_serving/model_servers/shared_memory_tensors.h"
+#include "tensorflow_serving/model_servers/unix_socket_acceptor.h"
+#include "tensorflow_serving/servables/tensorflow/get_model_metadata_impl.h"
+#include "tensorflow_serving/servables/tensorflow/multi_inference_helper.h"
 #include "tensorflow_serving/servables/tensorflow/predict_impl.h"
 #include "tensorflow_serving/servables/tensorflow/thread_pool_factory.h"
 
@@ -31,18 +43,60 @@ class PredictionServiceImpl final : public PredictionService::Service {
     ServerCore* server_core;
     bool enforce_session_run_timeout;
     ThreadPoolFactory* thread_pool_factory = nullptr;
+    // Number of threads processing the requests of the PredictStream calls.
+    // If 0, the requests of a stream are processed one at a time, on the
+    // thread of the call.
+    int num_predict_stream_threads = 0;
+    // Maximum number of requests of a stream being processed at once.
+    int max_predict_stream_in_flight_requests = 128;
+    // If true, identical concurrent Predict requests are run once (see
+    // PredictRequestCoalescer).
+    bool coalesce_identical_predict_requests = false;
+    // If set, the Predict requests received on the connections it accepted
+    // may pass tensors in shared memory (see SharedMemoryTensors). Not owned.
+    const UnixSocketAcceptor* shared_memory_acceptor = nullptr;
+    // The responses of at least 'min_compressed_response_bytes' are
+    // compressed with this algorithm, if the client accepts it, and the
+    // smaller ones are sent uncompressed. Not compressed by default.
+    grpc_compression_algorithm response_compression_algorithm =
+        GRPC_COMPRESS_NONE;
+    int64 min_compressed_response_bytes = 1024;
   };
 
   explicit PredictionServiceImpl(const Options& options)
       : core_(options.server_core),
         predictor_(new TensorflowPredictor(options.thread_pool_factory)),
         enforce_session_run_timeout_(options.enforce_session_run_timeout),
-        thread_pool_factory_(options.thread_pool_factory) {}
+        thread_pool_factory_(options.thread_pool_factory),
+        num_predict_stream_threads_(options.num_predict_stream_threads),
+        max_predict_stream_in_flight_requests_(
+            options.max_predict_stream_in_flight_requests),
+        response_compression_algorithm_(
+            options.response_compression_algorithm),
+        min_compressed_response_bytes_(options.min_compressed_response_bytes),
+        shared_memory_acceptor_(options.shared_memory_acceptor),
+        model_metadata_cache_(ModelMetadataCache::Create(core_)),
+        example_parsing_index_cache_(ExampleParsingIndexCache::Create(core_)) {
+    if (options.coalesce_identical_predict_requests) {
+      predict_request_coalescer_.reset(new PredictRequestCoalescer());
+    }
+    if (options.shared_memory_acceptor != nullptr) {
+      shared_memory_tensors_.reset(
+          new SharedMemoryTensors(SharedMemoryTensors::Options()));
+    }
+  }
 
   ::grpc::Status Predict(::grpc::ServerContext* context,
                          const PredictRequest* request,
                          PredictResponse* response) override;
 
+  // Processes the requests of the stream concurrently (see Options), so that
+  // they can be batched together, and writes their responses in order.
+  ::grpc::Status PredictStream(
+      ::grpc::ServerContext* context,
+      ::grpc::ServerReaderWriter<PredictResponse, PredictRequest>* stream)
+      override;
+
   ::grpc::Status GetModelMetadata(::grpc::ServerContext* context,
                                   const GetModelMetadataRequest* request,
                                   GetModelMetadataResponse* response) override;
@@ -60,10 +114,43 @@ class PredictionServiceImpl final : public PredictionService::Service {
                                 MultiInferenceResponse* response) override;
 
  private:
+  // Predict(), except for the compression of the response, which is set per
+  // call rather than per response of a PredictStream call.
+  ::grpc::Status RunPredict(::grpc::ServerContext* context,
+                            const PredictRequest* request,
+                            PredictResponse* response);
+
+  // Returns the threads processing the requests of the PredictStream calls,
+  // created by the first call, or null if they are processed on the thread
+  // of the call.
+  thread::ThreadPool* predict_stream_threads();
+
+  // Compresses the response of a unary call if it is large enough.
+  void CompressResponse(::grpc::ServerContext* context,
+                        const google::protobuf::Message& response) const;
+
+  // Runs 'request' of 'peer', whose tensors are in shared memory.
+  ::tensorflow::Status PredictWithSharedMemory(
+      const RunOptions& run_options, const SharedMemoryTensors::Peer& peer,
+      const PredictRequest& request, PredictResponse* response);
+
   ServerCore* core_;
   std::unique_ptr<TensorflowPredictor> predictor_;
   const bool enforce_session_run_timeout_;
   ThreadPoolFactory* thread_pool_factory_;
+  const int num_predict_stream_threads_;
+  const int max_predict_stream_in_flight_requests_;
+  const grpc_compression_algorithm response_compression_algorithm_;
+  const int64 min_compressed_response_bytes_;
+  absl::once_flag predict_stream_threads_once_;
+  std::unique_ptr<thread::ThreadPool> predict_stream_threads_;
+  // Null if the Predict requests are not coalesced.
+  std::unique_ptr<PredictRequestCoalescer> predict_request_coalescer_;
+  // Null if the requests cannot pass tensors in shared memory.
+  const UnixSocketAcceptor* const shared_memory_acceptor_;
+  std::unique_ptr<SharedMemoryTensors> shared_memory_tensors_;
+  const std::shared_ptr<ModelMetadataCache> model_metadata_cache_;
+  const std::shared_ptr<ExampleParsingIndexCache> example_parsing_index_cache_;
 };
 
 }  // namespace serving
@@ -0,0 +1,155 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/model_servers/response_cache.h"
+
+#include <iterator>
+#include <utility>
+
+#include "tensorflow/core/lib/monitoring/counter.h"
+
+namespace tensorflow {
+namespace serving {
+
+namespace {
+
+auto* response_cache_lookup_count = monitoring::Counter<2>::New(
+    "/tensorflow/serving/response_cache_lookup_count",
+    "The number of lookups of the inference responses cache.", "model_name",
+    "result");
+
+// The memory used by an entry besides its response.
+constexpr int64 kEntryOverheadBytes = 64;
+
+}  // namespace
+
+class ResponseCache::ModelCache {
+ public:
+  struct Entry {
+    Fprint128 fingerprint;
+    string response;
+    uint64 insert_micros;
+  };
+
+  mutex mu;
+  // Incremented by every invalidation.
+  uint64 generation TF_GUARDED_BY(mu) = 0;
+  // The entries, from the most to the least recently used.
+  std::list<Entry> entries TF_GUARDED_BY(mu);
+  std::unordered_map<Fprint128, std::list<Entry>::iterator, Fprint128Hasher>
+      index TF_GUARDED_BY(mu);
+  int64 num_bytes TF_GUARDED_BY(mu) = 0;
+
+  void Erase(const std::list<Entry>::iterator it)
+      TF_EXCLUSIVE_LOCKS_REQUIRED(mu) {
+    num_bytes -= it->response.size() + kEntryOverheadBytes;
+    index.erase(it->fingerprint);
+    entries.erase(it);
+  }
+};
+
+ResponseCache::ResponseCache(const Options& options) : options_(options) {}
+
+ResponseCache::~ResponseCache() = default;
+
+ResponseCache::ModelCache* ResponseCache::GetModelCache(
+    const string& model_name) {
+  {
+    tf_shared_lock l(mu_);
+    const auto it = model_caches_.find(model_name);
+    if (it != model_caches_.end()) {
+      return it->second.get();
+    }
+  }
+  mutex_lock l(mu_);
+  std::unique_ptr<ModelCache>& model_cache = model_caches_[model_name];
+  if (model_cache == nullptr) {
+    model_cache.reset(new ModelCache());
+  }
+  return model_cache.get();
+}
+
+bool ResponseCache::Lookup(const string& model_name,
+                           const absl::string_view method,
+                           const absl::string_view request,
+                           string* const response, Key* const key) {
+  Fprint128 fingerprint = Fingerprint128(request);
+  fingerprint.low64 =
+      FingerprintCat64(fingerprint.low64, Fingerprint64(method));
+  ModelCache* const model_cache = GetModelCache(model_name);
+  {
+    mutex_lock l(model_cache->mu);
+    const auto it = model_cache->index.find(fingerprint);
+    if (it != model_cache->index.end()) {
+      const auto entry = it->second;
+      if (options_.ttl_micros > 0 &&
+          options_.env->NowMicros() - entry->insert_micros >=
+              options_.ttl_micros) {
+        model_cache->Erase(entry);
+      } else {
+        model_cache->entries.splice(model_cache->entries.begin(),
+                                    model_cache->entries, entry);
+        *response = entry->response;
+        response_cache_lookup_count->GetCell(model_name, "hit")
+            ->IncrementBy(1);
+        return true;
+      }
+    }
+    key->generation = model_cache->generation;
+  }
+  key->model_name = model_name;
+  key->fingerprint = fingerprint;
+  response_cache_lookup_count->GetCell(model_name, "miss")->IncrementBy(1);
+  return false;
+}
+
+void ResponseCache::Insert(const Key& key, string response) {
+  const int64 entry_bytes = response.size() + kEntryOverheadBytes;
+  if (entry_bytes > options_.max_bytes_per_model) {
+    return;
+  }
+  const uint64 now_micros = options_.env->NowMicros();
+  ModelCache* const model_cache = GetModelCache(key.model_name);
+  mutex_lock l(model_cache->mu);
+  if (key.generation != model_cache->generation) {
+    return;
+  }
+  const auto it = model_cache->index.find(key.fingerprint);
+  if (it != model_cache->index.end()) {
+    model_cache->Erase(it->second);
+  }
+  while (model_cache->num_bytes + entry_bytes > options_.max_bytes_per_model) {
+    model_cache->Erase(std::prev(model_cache->entries.end()));
+  }
+  model_cache->entries.push_front(
+      {key.fingerprint, std::move(response), now_micros});
+  model_cache->index[key.fingerprint] = model_cache->entries.begin();
+  model_cache->num_bytes += entry_bytes;
+}
+
+void ResponseCache::Invalidate(const string& model_name) {
+  if (!enabled(model_name)) {
+    return;
+  }
+  ModelCache* const model_cache = GetModelCache(model_name);
+  mutex_lock l(model_cache->mu);
+  ++model_cache->generation;
+  model_cache->entries.clear();
+  model_cache->index.clear();
+  model_cache->num_bytes = 0;
+}
+
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,119 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_MODEL_SERVERS_RESPONSE_CACHE_H_
+#define TENSORFLOW_SERVING_MODEL_SERVERS_RESPONSE_CACHE_H_
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "absl/strings/string_view.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/fingerprint.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace serving {
+
+// Caches the serialized responses of the inference requests, by model and by
+// fingerprint of the requests, so that a repeated request is answered without
+// parsing it, batching it or running the model.
+//
+// The responses of a model are dropped whenever the state of one of its
+// versions changes (see Invalidate()), as its requests may then resolve to
+// another version. A response computed before an invalidation is not
+// inserted after it (see Key::generation).
+//
+// Each model has its own cache of at most 'max_bytes_per_model' bytes of
+// responses, from which the least recently used ones are evicted. Only
+// deterministic models should be cached.
+//
+// This class is thread-safe.
+class ResponseCache {
+ public:
+  struct Options {
+    // The max size of the cached responses of each model. 0 disables the
+    // cache.
+    int64 max_bytes_per_model = 0;
+    // How long a response stays cached. 0 means until it is evicted or
+    // invalidated.
+    int64 ttl_micros = 0;
+    // The models whose responses are cached. Empty means all of them.
+    std::unordered_set<string> model_names;
+    // The environment to use for time.
+    Env* env = Env::Default();
+  };
+
+  // A request looked up in the cache, to Insert() its response once computed.
+  struct Key {
+    string model_name;
+    Fprint128 fingerprint = {0, 0};
+    // The number of invalidations of the model at the lookup.
+    uint64 generation = 0;
+  };
+
+  explicit ResponseCache(const Options& options);
+  ~ResponseCache();
+
+  // Whether the responses of 'model_name' are cached.
+  bool enabled(const string& model_name) const {
+    return options_.max_bytes_per_model > 0 &&
+           (options_.model_names.empty() ||
+            options_.model_names.count(model_name) > 0);
+  }
+
+  // Whether the responses of some models are cached.
+  bool enabled() const { return options_.max_bytes_per_model > 0; }
+
+  // Looks up the response of 'request' to 'method' of 'model_name'. Returns
+  // true and sets 'response' if it is cached. Otherwise sets 'key', to insert
+  // the response once computed.
+  bool Lookup(const string& model_name, absl::string_view method,
+              absl::string_view request, string* response, Key* key)
+      TF_LOCKS_EXCLUDED(mu_);
+
+  // Inserts the response of a request missed by Lookup(), unless the model was
+  // invalidated since.
+  void Insert(const Key& key, string response) TF_LOCKS_EXCLUDED(mu_);
+
+  // Drops the cached responses of 'model_name'.
+  void Invalidate(const string& model_name) TF_LOCKS_EXCLUDED(mu_);
+
+ private:
+  class ModelCache;
+
+  // Returns the cache of 'model_name', created if needed.
+  ModelCache* GetModelCache(const string& model_name) TF_LOCKS_EXCLUDED(mu_);
+
+  const Options options_;
+
+  mutable mutex mu_;
+  // The caches are never deleted, so that they can be used out of 'mu_'.
+  std::unordered_map<string, std::unique_ptr<ModelCache>> model_caches_
+      TF_GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ResponseCache);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_MODEL_SERVERS_RESPONSE_CACHE_H_
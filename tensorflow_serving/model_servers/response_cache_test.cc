@@ -0,0 +1,123 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/model_servers/response_cache.h"
+
+#include <gtest/gtest.h>
+#include "tensorflow/core/kernels/batching_util/fake_clock_env.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+ResponseCache::Options CacheOptions(const int64 max_bytes_per_model) {
+  ResponseCache::Options options;
+  options.max_bytes_per_model = max_bytes_per_model;
+  return options;
+}
+
+// Looks up 'request' and inserts 'response' on a miss. Returns whether the
+// lookup hit.
+bool LookupOrInsert(ResponseCache* cache, const string& model_name,
+                    const string& request, const string& response) {
+  ResponseCache::Key key;
+  string cached_response;
+  if (cache->Lookup(model_name, "Predict", request, &cached_response, &key)) {
+    EXPECT_EQ(cached_response, response);
+    return true;
+  }
+  cache->Insert(key, response);
+  return false;
+}
+
+TEST(ResponseCacheTest, Disabled) {
+  ResponseCache cache({});
+  EXPECT_FALSE(cache.enabled());
+  EXPECT_FALSE(cache.enabled("model"));
+}
+
+TEST(ResponseCacheTest, OnlyTheSelectedModelsAreCached) {
+  ResponseCache::Options options = CacheOptions(1024);
+  options.model_names = {"model"};
+  ResponseCache cache(options);
+  EXPECT_TRUE(cache.enabled("model"));
+  EXPECT_FALSE(cache.enabled("other_model"));
+}
+
+TEST(ResponseCacheTest, CachesByModelMethodAndRequest) {
+  ResponseCache cache(CacheOptions(1024));
+  EXPECT_FALSE(LookupOrInsert(&cache, "model", "request", "response"));
+  EXPECT_TRUE(LookupOrInsert(&cache, "model", "request", "response"));
+  EXPECT_FALSE(LookupOrInsert(&cache, "model", "other", "other_response"));
+  EXPECT_FALSE(LookupOrInsert(&cache, "other_model", "request", "response"));
+
+  ResponseCache::Key key;
+  string response;
+  EXPECT_FALSE(cache.Lookup("model", "Classify", "request", &response, &key));
+}
+
+TEST(ResponseCacheTest, InvalidationDropsTheResponsesOfTheModel) {
+  ResponseCache cache(CacheOptions(1024));
+  LookupOrInsert(&cache, "model", "request", "response");
+  LookupOrInsert(&cache, "other_model", "request", "response");
+
+  // A response computed before the invalidation is not inserted.
+  ResponseCache::Key key;
+  string response;
+  ASSERT_FALSE(cache.Lookup("model", "Predict", "late", &response, &key));
+
+  cache.Invalidate("model");
+  cache.Insert(key, "stale_response");
+  EXPECT_FALSE(cache.Lookup("model", "Predict", "late", &response, &key));
+  EXPECT_FALSE(LookupOrInsert(&cache, "model", "request", "response"));
+  EXPECT_TRUE(LookupOrInsert(&cache, "other_model", "request", "response"));
+}
+
+TEST(ResponseCacheTest, EvictsTheLeastRecentlyUsedResponses) {
+  // Room for two entries of 10 bytes responses.
+  ResponseCache cache(CacheOptions(2 * (10 + 64)));
+  const string response(10, 'r');
+  LookupOrInsert(&cache, "model", "a", response);
+  LookupOrInsert(&cache, "model", "b", response);
+  // "a" becomes the most recently used, so that "b" is evicted by "c".
+  EXPECT_TRUE(LookupOrInsert(&cache, "model", "a", response));
+  EXPECT_FALSE(LookupOrInsert(&cache, "model", "c", response));
+  EXPECT_TRUE(LookupOrInsert(&cache, "model", "a", response));
+  EXPECT_TRUE(LookupOrInsert(&cache, "model", "c", response));
+  EXPECT_FALSE(LookupOrInsert(&cache, "model", "b", response));
+
+  // A response larger than the cache is not cached.
+  const string large_response(1000, 'r');
+  EXPECT_FALSE(LookupOrInsert(&cache, "model", "d", large_response));
+  EXPECT_FALSE(LookupOrInsert(&cache, "model", "d", large_response));
+}
+
+TEST(ResponseCacheTest, ResponsesExpire) {
+  test_util::FakeClockEnv env(Env::Default());
+  ResponseCache::Options options = CacheOptions(1024);
+  options.ttl_micros = 100;
+  options.env = &env;
+  ResponseCache cache(options);
+
+  LookupOrInsert(&cache, "model", "request", "response");
+  env.AdvanceByMicroseconds(99);
+  EXPECT_TRUE(LookupOrInsert(&cache, "model", "request", "response"));
+  env.AdvanceByMicroseconds(1);
+  EXPECT_FALSE(LookupOrInsert(&cache, "model", "request", "response"));
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
@@ -17,12 +17,15 @@ limitations under the License.
 
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>  // NOLINT(build/c++11)
 #include <iostream>
 #include <memory>
 #include <utility>
 #include <vector>
 
 #include "google/protobuf/wrappers.pb.h"
+#include "grpc/compression.h"
 #include "grpc/grpc.h"
 #include "grpcpp/resource_quota.h"
 #include "grpcpp/security/server_credentials.h"
@@ -30,6 +33,8 @@ limitations under the License.
 #include "grpcpp/server_context.h"
 #include "grpcpp/support/status.h"
 #include "absl/memory/memory.h"
+#include "absl/strings/ascii.h"
+#include "absl/time/time.h"
 #include "tensorflow/c/c_api.h"
 #include "tensorflow/cc/saved_model/tag_constants.h"
 #include "tensorflow/core/lib/core/errors.h"
@@ -37,6 +42,7 @@ limitations under the License.
 #include "tensorflow/core/lib/strings/numbers.h"
 #include "tensorflow/core/lib/strings/str_util.h"
 #include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/host_info.h"
 #include "tensorflow/core/platform/protobuf.h"
 #include "tensorflow/core/profiler/rpc/profiler_service_impl.h"
 #include "tensorflow/core/protobuf/config.pb.h"
@@ -44,14 +50,21 @@ limitations under the License.
 #include "tensorflow_serving/config/monitoring_config.pb.h"
 #include "tensorflow_serving/config/platform_config.pb.h"
 #include "tensorflow_serving/config/ssl_config.pb.h"
+#include "tensorflow_serving/config/thread_affinity_config.pb.h"
 #include "tensorflow_serving/core/availability_preserving_policy.h"
 #include "tensorflow_serving/model_servers/grpc_status_util.h"
+#include "tensorflow_serving/model_servers/model_placement.h"
 #include "tensorflow_serving/model_servers/model_platform_types.h"
 #include "tensorflow_serving/model_servers/platform_config_util.h"
 #include "tensorflow_serving/model_servers/server_core.h"
+#include "tensorflow_serving/model_servers/unix_socket_acceptor.h"
+#include "tensorflow_serving/servables/tensorflow/per_model_thread_pool_factory.h"
 #include "tensorflow_serving/servables/tensorflow/session_bundle_config.pb.h"
 #include "tensorflow_serving/servables/tensorflow/thread_pool_factory_config.pb.h"
 #include "tensorflow_serving/servables/tensorflow/util.h"
+#include "tensorflow_serving/util/cpu_affinity.h"
+#include "tensorflow_serving/util/otlp_exporter.h"
+#include "tensorflow_serving/util/request_memory.h"
 
 namespace tensorflow {
 namespace serving {
@@ -59,6 +72,11 @@ namespace main {
 
 namespace {
 
+// Returns the CPUs of 'cpu_set'.
+std::vector<int> GetCpus(const CpuSet& cpu_set) {
+  return std::vector<int>(cpu_set.cpus().begin(), cpu_set.cpus().end());
+}
+
 template <typename ProtoType>
 tensorflow::Status ParseProtoTextFile(const string& file, ProtoType* proto) {
   std::unique_ptr<tensorflow::ReadOnlyMemoryRegion> file_data;
@@ -157,6 +175,23 @@ std::shared_ptr<::grpc::ServerCredentials> BuildServerCredentials(
   return ::grpc::SslServerCredentials(ssl_ops);
 }
 
+// Parses the name of a gRPC compression algorithm, as in the grpc-encoding
+// header. Empty means no compression.
+Status ParseCompressionAlgorithm(const string& name,
+                                 grpc_compression_algorithm* algorithm) {
+  if (name.empty() || name == "identity") {
+    *algorithm = GRPC_COMPRESS_NONE;
+  } else if (name == "gzip") {
+    *algorithm = GRPC_COMPRESS_GZIP;
+  } else if (name == "deflate") {
+    *algorithm = GRPC_COMPRESS_DEFLATE;
+  } else {
+    return errors::InvalidArgument("Unsupported gRPC compression algorithm: ",
+                                   name, ". Use gzip or deflate.");
+  }
+  return Status::OK();
+}
+
 }  // namespace
 
 Server::Options::Options()
@@ -169,6 +204,10 @@ Server::~Server() {
   // until the thread has terminated.
   fs_config_polling_thread_.reset();
   WaitForTermination();
+  // The accepted connections are added to the gRPC server until then.
+  if (unix_socket_acceptor_ != nullptr) {
+    unix_socket_acceptor_->Stop();
+  }
 }
 
 void Server::PollFilesystemAndReloadConfig(const string& config_file_path) {
@@ -196,6 +235,20 @@ Status Server::BuildAndStart(const Options& server_options) {
       "server_options.grpc_socket_path must be set.");
   }
 
+  if (server_options.grpc_enable_shared_memory_tensors &&
+      server_options.grpc_socket_path.empty()) {
+    return errors::InvalidArgument(
+        "server_options.grpc_enable_shared_memory_tensors requires "
+        "server_options.grpc_socket_path.");
+  }
+  if (server_options.grpc_enable_shared_memory_tensors &&
+      (server_options.use_alts_credentials ||
+       !server_options.ssl_config_file.empty())) {
+    return errors::InvalidArgument(
+        "server_options.grpc_enable_shared_memory_tensors serves the UNIX "
+        "socket without credentials, and cannot be used with ALTS or SSL.");
+  }
+
   if (server_options.use_alts_credentials &&
       !server_options.ssl_config_file.empty()) {
     return errors::InvalidArgument(
@@ -203,6 +256,18 @@ Status Server::BuildAndStart(const Options& server_options) {
         "ssl_config_file must be empty.");
   }
 
+  if (server_options.http_num_event_loops < 1) {
+    return errors::InvalidArgument(
+        "server_options.http_num_event_loops must be at least 1.");
+  }
+
+  if (server_options.http_keepalive_timeout_in_ms < 0 ||
+      server_options.http_max_connections < 0 ||
+      server_options.http_max_requests_per_connection < 0) {
+    return errors::InvalidArgument(
+        "HTTP connection limits in server_options must not be negative.");
+  }
+
   if (server_options.model_base_path.empty() &&
       server_options.model_config_file.empty()) {
     return errors::InvalidArgument(
@@ -210,8 +275,31 @@ Status Server::BuildAndStart(const Options& server_options) {
         "server_options.model_config_file are empty!");
   }
 
+  ThreadAffinityConfig thread_affinity_config;
+  if (!server_options.thread_affinity_config_file.empty()) {
+    TF_RETURN_IF_ERROR(ParseProtoTextFile<ThreadAffinityConfig>(
+        server_options.thread_affinity_config_file, &thread_affinity_config));
+  }
+  const std::vector<int> grpc_thread_cpus =
+      GetCpus(thread_affinity_config.grpc_threads());
+  const std::vector<int> http_thread_cpus =
+      GetCpus(thread_affinity_config.http_threads());
+  const std::vector<int> session_thread_cpus =
+      GetCpus(thread_affinity_config.session_threads());
+  TF_RETURN_IF_ERROR(ValidateCpus(grpc_thread_cpus, "gRPC threads"));
+  TF_RETURN_IF_ERROR(ValidateCpus(http_thread_cpus, "HTTP threads"));
+  TF_RETURN_IF_ERROR(ValidateCpus(session_thread_cpus, "session threads"));
+  if (!session_thread_cpus.empty() &&
+      !server_options.thread_pool_factory_config_file.empty()) {
+    return errors::InvalidArgument(
+        "Either set the session_threads of the thread affinity config or "
+        "server_options.thread_pool_factory_config_file.");
+  }
+
   SetSignatureMethodNameCheckFeature(
       server_options.enable_signature_method_name_check);
+  SetMultiInferenceSharedExampleParsingFeature(
+      server_options.enable_multi_inference_shared_example_parsing);
 
   // For ServerCore Options, we leave servable_state_monitor_creator unspecified
   // so the default servable_state_monitor_creator will be used.
@@ -239,6 +327,10 @@ Status Server::BuildAndStart(const Options& server_options) {
         TF_RETURN_IF_ERROR(ParseProtoTextFile<BatchingParameters>(
             server_options.batching_parameters_file, batching_parameters));
       }
+      if (thread_affinity_config.has_batch_threads()) {
+        *batching_parameters->mutable_batch_thread_cpus() =
+            thread_affinity_config.batch_threads().cpus();
+      }
     } else if (!server_options.batching_parameters_file.empty()) {
       return errors::InvalidArgument(
           "server_options.batching_parameters_file is set without setting "
@@ -287,6 +379,11 @@ Status Server::BuildAndStart(const Options& server_options) {
           ->mutable_num_request_iterations()
           ->set_value(server_options.num_request_iterations_for_warmup);
     }
+    if (server_options.num_model_warmup_threads > 0) {
+      session_bundle_config.mutable_model_warmup_options()
+          ->mutable_num_model_warmup_threads()
+          ->set_value(server_options.num_model_warmup_threads);
+    }
     session_bundle_config.set_remove_unused_fields_from_bundle_metagraph(
         server_options.remove_unused_fields_from_bundle_metagraph);
     session_bundle_config.set_prefer_tflite_model(
@@ -294,9 +391,23 @@ Status Server::BuildAndStart(const Options& server_options) {
     session_bundle_config.set_num_tflite_interpreters_per_pool(
         server_options.num_tflite_interpreters_per_pool);
     session_bundle_config.set_num_tflite_pools(server_options.num_tflite_pools);
+    session_bundle_config.mutable_tflite_interpreter_options()->set_num_threads(
+        server_options.num_tflite_interpreter_threads);
+    session_bundle_config.mutable_tflite_interpreter_options()->set_use_xnnpack(
+        server_options.use_tflite_xnnpack);
+    session_bundle_config.set_enable_session_callable_cache(
+        server_options.enable_session_callable_cache);
+    session_bundle_config.set_num_variable_read_streams(
+        server_options.num_variable_read_streams);
     options.platform_config_map =
         CreateTensorFlowPlatformConfigMap(session_bundle_config);
   } else {
+    if (thread_affinity_config.has_batch_threads()) {
+      return errors::InvalidArgument(
+          "The batch_threads of the thread affinity config are set with "
+          "server_options.platform_config_file, whose batching parameters "
+          "can set batch_thread_cpus instead.");
+    }
     TF_RETURN_IF_ERROR(ParseProtoTextFile<PlatformConfigMap>(
         server_options.platform_config_file, &options.platform_config_map));
   }
@@ -306,15 +417,81 @@ Status Server::BuildAndStart(const Options& server_options) {
       std::unique_ptr<AspiredVersionPolicy>(new AvailabilityPreservingPolicy);
   options.num_load_threads = server_options.num_load_threads;
   options.num_unload_threads = server_options.num_unload_threads;
+  options.load_thread_cpus = GetCpus(thread_affinity_config.load_threads());
+  options.load_thread_niceness = server_options.load_thread_niceness;
+  options.pause_loads_above_p99_latency_micros =
+      server_options.pause_loads_above_p99_latency_micros;
+  options.max_load_pause_micros = server_options.max_load_pause_micros;
+  options.schedule_model_loads = server_options.schedule_model_loads;
+  options.hot_standby_model_versions =
+      server_options.hot_standby_model_versions;
+  options.numa_aware_model_placement =
+      server_options.numa_aware_model_placement;
   options.max_num_load_retries = server_options.max_num_load_retries;
   options.load_retry_interval_micros =
       server_options.load_retry_interval_micros;
+  options.load_retry_backoff_multiplier =
+      server_options.load_retry_backoff_multiplier;
+  options.max_load_retry_interval_micros =
+      server_options.max_load_retry_interval_micros;
+  options.load_retry_jitter = server_options.load_retry_jitter;
+  options.release_load_threads_during_load_retries =
+      server_options.release_load_threads_during_load_retries;
   options.file_system_poll_wait_seconds =
       server_options.file_system_poll_wait_seconds;
+  options.watch_file_system = server_options.watch_file_system;
+  options.num_file_system_polling_threads =
+      server_options.num_file_system_polling_threads;
+  options.model_cache_dir = server_options.model_cache_dir;
+  options.num_model_cache_download_threads =
+      server_options.num_model_cache_download_threads;
+  options.num_servable_event_callback_threads =
+      server_options.num_servable_event_callback_threads;
   options.flush_filesystem_caches = server_options.flush_filesystem_caches;
+  options.release_memory_after_unload =
+      server_options.release_memory_after_unload;
   options.allow_version_labels_for_unavailable_models =
       server_options.allow_version_labels_for_unavailable_models;
+  if (server_options.predict_response_tensor_content) {
+    options.predict_response_tensor_serialization_option =
+        internal::PredictResponseTensorSerializationOption::kAsProtoContent;
+  }
   options.enable_cors_support = server_options.enable_cors_support;
+  options.admission_control_options.max_concurrent_requests_per_model =
+      server_options.max_concurrent_requests_per_model;
+  options.admission_control_options.target_latency_micros =
+      server_options.admission_target_latency_micros;
+  options.admission_control_options.interval_micros =
+      server_options.admission_interval_micros;
+  options.admission_control_options.max_requests_per_second_per_model =
+      server_options.max_requests_per_second_per_model;
+  options.admission_control_options.max_requests_per_second_per_client =
+      server_options.max_requests_per_second_per_client;
+  options.admission_control_options.burst_seconds =
+      server_options.rate_limit_burst_seconds;
+  options.admission_control_options.client_id_metadata_key =
+      server_options.client_id_metadata_key;
+  options.response_cache_options.max_bytes_per_model =
+      server_options.response_cache_max_bytes_per_model;
+  options.response_cache_options.ttl_micros =
+      server_options.response_cache_ttl_micros;
+  for (const string& model_name : tensorflow::str_util::Split(
+           server_options.response_cache_model_names, ",",
+           tensorflow::str_util::SkipEmpty())) {
+    options.response_cache_options.model_names.insert(model_name);
+  }
+  if (!server_options.model_placement_members.empty()) {
+    ModelPlacement::Options placement_options;
+    placement_options.members = tensorflow::str_util::Split(
+        server_options.model_placement_members, ",",
+        tensorflow::str_util::SkipEmpty());
+    placement_options.self = server_options.model_placement_self;
+    placement_options.replication_factor =
+        server_options.model_placement_replication_factor;
+    std::unique_ptr<ModelPlacement> placement;
+    TF_RETURN_IF_ERROR(ModelPlacement::Create(placement_options, &placement));
+    options.model_placement = std::move(placement);
+  }
 
   TF_RETURN_IF_ERROR(ServerCore::Create(std::move(options), &server_core_));
 
@@ -353,8 +530,31 @@ Status Server::BuildAndStart(const Options& server_options) {
     TF_RETURN_IF_ERROR(ThreadPoolFactoryRegistry::CreateFromAny(
         thread_pool_factory_config.thread_pool_factory_config(),
         &thread_pool_factory_));
+  } else if (!session_thread_cpus.empty()) {
+    PerModelThreadPoolFactoryConfig thread_pool_factory_config;
+    *thread_pool_factory_config.mutable_default_thread_pools()
+         ->mutable_cpus() = thread_affinity_config.session_threads().cpus();
+    TF_RETURN_IF_ERROR(PerModelThreadPoolFactory::Create(
+        thread_pool_factory_config, &thread_pool_factory_));
   }
   predict_server_options.thread_pool_factory = thread_pool_factory_.get();
+  predict_server_options.num_predict_stream_threads =
+      server_options.grpc_predict_stream_num_threads;
+  predict_server_options.coalesce_identical_predict_requests =
+      server_options.grpc_coalesce_identical_predict_requests;
+  if (server_options.grpc_enable_shared_memory_tensors) {
+    // The Unix socket is served through the acceptor, which knows the client
+    // processes.
+    TF_RETURN_IF_ERROR(UnixSocketAcceptor::Create(
+        server_options.grpc_socket_path, &unix_socket_acceptor_));
+    predict_server_options.shared_memory_acceptor =
+        unix_socket_acceptor_.get();
+  }
+  TF_RETURN_IF_ERROR(ParseCompressionAlgorithm(
+      server_options.grpc_response_compression,
+      &predict_server_options.response_compression_algorithm));
+  predict_server_options.min_compressed_response_bytes =
+      server_options.grpc_min_compressed_response_bytes;
   prediction_service_ =
       absl::make_unique<PredictionServiceImpl>(predict_server_options);
 
@@ -368,7 +568,8 @@ Status Server::BuildAndStart(const Options& server_options) {
                                server_options.ssl_config_file));
   }
   // If defined, listen to a UNIX socket for gRPC.
-  if (!server_options.grpc_socket_path.empty()) {
+  if (!server_options.grpc_socket_path.empty() &&
+      unix_socket_acceptor_ == nullptr) {
     const string grpc_socket_uri = "unix:" + server_options.grpc_socket_path;
     builder.AddListeningPort(
         grpc_socket_uri,
@@ -376,13 +577,45 @@ Status Server::BuildAndStart(const Options& server_options) {
                                server_options.ssl_config_file));
   }
   builder.RegisterService(model_service_.get());
-  builder.RegisterService(prediction_service_.get());
+  if (server_options.grpc_async_num_completion_queues > 0) {
+    AsyncPredictionService::Options async_options;
+    async_options.prediction_service = prediction_service_.get();
+    async_options.num_completion_queues =
+        server_options.grpc_async_num_completion_queues;
+    async_options.num_request_threads =
+        server_options.grpc_async_num_request_threads;
+    async_options.max_queued_calls =
+        server_options.grpc_async_max_queued_calls;
+    async_prediction_service_ =
+        absl::make_unique<AsyncPredictionService>(async_options);
+    builder.RegisterService(async_prediction_service_->service());
+    async_prediction_service_->AddCompletionQueues(&builder);
+  } else {
+    builder.RegisterService(prediction_service_.get());
+  }
   if (server_options.enable_profiler) {
     profiler_service_ = tensorflow::profiler::CreateProfilerService();
     builder.RegisterService(profiler_service_.get());
     LOG(INFO) << "Profiler service is enabled";
   }
   builder.SetMaxMessageSize(tensorflow::kint32max);
+  if (server_options.reuse_port) {
+    builder.AddChannelArgument(GRPC_ARG_ALLOW_REUSEPORT, 1);
+    // The gRPC listener is closed without accepting the connections queued on
+    // it, and the HTTP/REST ones may race with new connections as they close.
+    // Only net.ipv4.tcp_migrate_req (Linux 5.14+) hands those over to the
+    // other listeners of the port rather than resetting them.
+    string migrate_req;
+    if (!tensorflow::ReadFileToString(tensorflow::Env::Default(),
+                                      "/proc/sys/net/ipv4/tcp_migrate_req",
+                                      &migrate_req)
+             .ok() ||
+        absl::StripAsciiWhitespace(migrate_req) != "1") {
+      LOG(WARNING) << "net.ipv4.tcp_migrate_req is not set: the connections "
+                      "queued on the ports when this server is drained are "
+                      "reset rather than handed over to its replacement";
+    }
+  }
   const std::vector<GrpcChannelArgument> channel_arguments =
       parseGrpcChannelArgs(server_options.grpc_channel_arguments);
   for (const GrpcChannelArgument& channel_argument : channel_arguments) {
@@ -401,9 +634,19 @@ Status Server::BuildAndStart(const Options& server_options) {
   res_quota.SetMaxThreads(server_options.grpc_max_threads);
   builder.SetResourceQuota(res_quota);
 
-  grpc_server_ = builder.BuildAndStart();
-  if (grpc_server_ == nullptr) {
-    return errors::InvalidArgument("Failed to BuildAndStart gRPC server");
+  {
+    // The gRPC threads are started by the server, and by its threads.
+    ScopedCpuAffinity grpc_thread_affinity(grpc_thread_cpus);
+    grpc_server_ = builder.BuildAndStart();
+    if (grpc_server_ == nullptr) {
+      return errors::InvalidArgument("Failed to BuildAndStart gRPC server");
+    }
+    if (async_prediction_service_ != nullptr) {
+      async_prediction_service_->Start();
+    }
+    if (unix_socket_acceptor_ != nullptr) {
+      unix_socket_acceptor_->Start(grpc_server_.get());
+    }
   }
   if (server_options.grpc_port != 0) {
     LOG(INFO) << "Running gRPC ModelServer at " << server_address << " ...";
@@ -413,19 +656,77 @@ Status Server::BuildAndStart(const Options& server_options) {
               << server_options.grpc_socket_path << " ...";
   }
 
-  if (server_options.http_port != 0) {
-    if (server_options.http_port != server_options.grpc_port) {
-      const string server_address =
-          "localhost:" + std::to_string(server_options.http_port);
-      MonitoringConfig monitoring_config;
-      if (!server_options.monitoring_config_file.empty()) {
-        TF_RETURN_IF_ERROR(ParseProtoTextFile<MonitoringConfig>(
-            server_options.monitoring_config_file, &monitoring_config));
+  MonitoringConfig monitoring_config;
+  if (!server_options.monitoring_config_file.empty()) {
+    TF_RETURN_IF_ERROR(ParseProtoTextFile<MonitoringConfig>(
+        server_options.monitoring_config_file, &monitoring_config));
+  }
+  if (monitoring_config.request_memory_config().enable()) {
+    TF_RETURN_IF_ERROR(EnableRequestMemoryMetrics());
+  }
+  const OtlpConfig& otlp_config = monitoring_config.otlp_config();
+  if (otlp_config.enable()) {
+    OtlpExporter::Options otlp_options;
+    if (!otlp_config.endpoint().empty()) {
+      otlp_options.endpoint = otlp_config.endpoint();
+    }
+    if (!otlp_config.path().empty()) {
+      otlp_options.path = otlp_config.path();
+    }
+    if (otlp_config.push_interval_seconds() > 0) {
+      otlp_options.push_interval_micros =
+          otlp_config.push_interval_seconds() *
+          tensorflow::EnvTime::kSecondsToMicros;
+    }
+    otlp_options.resource_attributes = {
+        {"service.name", otlp_config.service_name().empty()
+                             ? "tensorflow_serving"
+                             : otlp_config.service_name()},
+        {"host.name", tensorflow::port::Hostname()}};
+    otlp_exporter_ = absl::make_unique<OtlpExporter>(otlp_options);
+    TF_RETURN_IF_ERROR(otlp_exporter_->Start());
+  }
+
+  if (server_options.http2_port != 0 &&
+      (server_options.http2_port == server_options.grpc_port ||
+       server_options.http2_port == server_options.http_port)) {
+    return errors::InvalidArgument(
+        "server_options.http2_port cannot be same as grpc_port or http_port");
+  }
+  if (server_options.http_port != 0 ||
+      !server_options.http_socket_path.empty() ||
+      server_options.http2_port != 0) {
+    if (server_options.http_port == 0 ||
+        server_options.http_port != server_options.grpc_port) {
+      string server_address =
+          server_options.http_port == 0
+              ? "UNIX socket " + server_options.http_socket_path
+              : "localhost:" + std::to_string(server_options.http_port);
+      if (server_options.http2_port != 0) {
+        server_address = server_options.http_port == 0 &&
+                                 server_options.http_socket_path.empty()
+                             ? ""
+                             : server_address + " and ";
+        server_address += "HTTP/2 localhost:" +
+                          std::to_string(server_options.http2_port);
+      }
+      HttpConnectionLimits connection_limits;
+      connection_limits.keepalive_timeout_in_ms =
+          server_options.http_keepalive_timeout_in_ms;
+      connection_limits.max_connections = server_options.http_max_connections;
+      connection_limits.max_requests_per_connection =
+          server_options.http_max_requests_per_connection;
+      connection_limits.reuse_port = server_options.reuse_port;
+      connection_limits.http2_port = server_options.http2_port;
+      {
+        ScopedCpuAffinity http_thread_affinity(http_thread_cpus);
+        http_server_ = CreateAndStartHttpServer(
+            server_options.http_port, server_options.http_socket_path,
+            server_options.http_num_threads,
+            server_options.http_num_event_loops,
+            server_options.http_run_inline, server_options.http_timeout_in_ms,
+            connection_limits, monitoring_config, server_core_.get());
       }
-      http_server_ = CreateAndStartHttpServer(
-          server_options.http_port, server_options.http_num_threads,
-          server_options.http_timeout_in_ms, monitoring_config,
-          server_core_.get());
       if (http_server_ != nullptr) {
         LOG(INFO) << "Exporting HTTP/REST API at:" << server_address << " ...";
       } else {
@@ -449,6 +750,45 @@ void Server::WaitForTermination() {
   }
 }
 
+bool Server::Drain(const tensorflow::int32 timeout_seconds) {
+  LOG(INFO) << "Draining the server for up to " << timeout_seconds
+            << " seconds ...";
+  // No model is reloaded while draining.
+  fs_config_polling_thread_.reset();
+  bool drained = true;
+  const std::chrono::system_clock::time_point deadline =
+      std::chrono::system_clock::now() + std::chrono::seconds(timeout_seconds);
+  // Both servers stop listening first, so that the new connections go to a
+  // replacement server at once.
+  if (http_server_ != nullptr) {
+    http_server_->Terminate();
+  }
+  if (unix_socket_acceptor_ != nullptr) {
+    unix_socket_acceptor_->Stop();
+  }
+  if (grpc_server_ != nullptr) {
+    // Cancels the calls still in flight at the deadline.
+    grpc_server_->Shutdown(deadline);
+  }
+  if (http_server_ != nullptr) {
+    const tensorflow::int64 remaining_micros =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            deadline - std::chrono::system_clock::now())
+            .count();
+    if (!http_server_->WaitForTerminationWithTimeout(absl::Microseconds(
+            std::max<tensorflow::int64>(remaining_micros, 0)))) {
+      LOG(WARNING) << "HTTP/REST requests still in flight after draining";
+      drained = false;
+    }
+  }
+  const Status flush_status = server_core_->FlushLogs();
+  if (!flush_status.ok()) {
+    LOG(ERROR) << "Failed to flush the request logs: " << flush_status;
+  }
+  LOG(INFO) << "Drained the server";
+  return drained;
+}
+
 }  // namespace main
 }  // namespace serving
 }  // namespace tensorflow
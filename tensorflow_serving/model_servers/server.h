@@ -24,11 +24,14 @@ limitations under the License.
 #include "tensorflow/core/platform/cpu_info.h"
 #include "tensorflow/core/platform/types.h"
 #include "tensorflow/core/profiler/rpc/profiler_service_impl.h"
+#include "tensorflow_serving/model_servers/async_prediction_service.h"
 #include "tensorflow_serving/model_servers/http_server.h"
 #include "tensorflow_serving/model_servers/model_service_impl.h"
 #include "tensorflow_serving/model_servers/prediction_service_impl.h"
 #include "tensorflow_serving/model_servers/server_core.h"
+#include "tensorflow_serving/model_servers/unix_socket_acceptor.h"
 #include "tensorflow_serving/servables/tensorflow/thread_pool_factory.h"
+#include "tensorflow_serving/util/otlp_exporter.h"
 
 namespace tensorflow {
 namespace serving {
@@ -44,29 +47,100 @@ class Server {
     tensorflow::string grpc_channel_arguments;
     tensorflow::string grpc_socket_path;
     tensorflow::int32 grpc_max_threads = 4.0 * port::NumSchedulableCPUs();
+    // If > 0, the PredictionService is served asynchronously, with that many
+    // completion queues (see AsyncPredictionService).
+    tensorflow::int32 grpc_async_num_completion_queues = 0;
+    tensorflow::int32 grpc_async_num_request_threads =
+        4.0 * port::NumSchedulableCPUs();
+    // The max number of asynchronous calls waiting for a request thread.
+    tensorflow::int32 grpc_async_max_queued_calls = 10000;
+    // Number of threads processing the requests of the PredictStream calls.
+    tensorflow::int32 grpc_predict_stream_num_threads =
+        4.0 * port::NumSchedulableCPUs();
+    // Whether identical concurrent gRPC Predict requests are run once.
+    bool grpc_coalesce_identical_predict_requests = false;
+    // Whether the Predict requests received on grpc_socket_path may pass
+    // tensors in shared memory.
+    bool grpc_enable_shared_memory_tensors = false;
+    // Compression of the gRPC responses of at least the given size, e.g.
+    // "gzip". None if empty.
+    tensorflow::string grpc_response_compression;
+    tensorflow::int64 grpc_min_compressed_response_bytes = 1024;
 
     //
     // HTTP Server options.
     //
     tensorflow::int32 http_port = 0;
+    // If non-empty, the HTTP/REST API also listens on a UNIX socket there.
+    tensorflow::string http_socket_path;
+    // If non-zero, the HTTP/REST API is also served over HTTP/2 (h2c) on
+    // this port.
+    tensorflow::int32 http2_port = 0;
     tensorflow::int32 http_num_threads = 4.0 * port::NumSchedulableCPUs();
+    tensorflow::int32 http_num_event_loops = 1;
+    bool http_run_inline = false;
     tensorflow::int32 http_timeout_in_ms = 30000;  // 30 seconds.
+    // 0 means the default timeout, or no limit.
+    tensorflow::int32 http_keepalive_timeout_in_ms = 0;
+    tensorflow::int32 http_max_connections = 0;
+    tensorflow::int32 http_max_requests_per_connection = 0;
+    // Binds the gRPC and HTTP/REST ports with SO_REUSEPORT, so that a
+    // replacement server can listen on them while this one drains.
+    bool reuse_port = false;
+    // If positive, SIGTERM and SIGINT drain the server (see Drain()) for up
+    // to this many seconds before it exits.
+    tensorflow::int32 drain_timeout_seconds = 0;
     bool enable_cors_support = false;
+    // Admission control of the inference requests of both APIs. 0 means no
+    // limit.
+    tensorflow::int32 max_concurrent_requests_per_model = 0;
+    tensorflow::int64 admission_target_latency_micros = 0;
+    tensorflow::int64 admission_interval_micros = 100 * 1000;
+    float max_requests_per_second_per_model = 0;
+    float max_requests_per_second_per_client = 0;
+    float rate_limit_burst_seconds = 1;
+    tensorflow::string client_id_metadata_key = "x-client-id";
+    // Caching of the inference responses of both APIs. 0 disables the cache.
+    tensorflow::int64 response_cache_max_bytes_per_model = 0;
+    tensorflow::int64 response_cache_ttl_micros = 0;
+    tensorflow::string response_cache_model_names;
+    // Placement of the models over a fleet of servers. Empty members loads
+    // all the models.
+    tensorflow::string model_placement_members;
+    tensorflow::string model_placement_self;
+    tensorflow::int32 model_placement_replication_factor = 1;
 
     //
     // Model Server options.
     //
     bool enable_batching = false;
     bool allow_version_labels_for_unavailable_models = false;
+    bool predict_response_tensor_content = false;
     float per_process_gpu_memory_fraction = 0;
     tensorflow::string batching_parameters_file;
     tensorflow::string model_name;
     tensorflow::int32 num_load_threads = 0;
+    tensorflow::int32 load_thread_niceness = 0;
+    tensorflow::int64 pause_loads_above_p99_latency_micros = 0;
+    tensorflow::int64 max_load_pause_micros = 60 * 1000 * 1000;
     tensorflow::int32 num_unload_threads = 0;
+    bool schedule_model_loads = false;
+    bool hot_standby_model_versions = false;
+    bool numa_aware_model_placement = false;
     tensorflow::int32 max_num_load_retries = 5;
     tensorflow::int64 load_retry_interval_micros = 1LL * 60 * 1000 * 1000;
+    float load_retry_backoff_multiplier = 1;
+    tensorflow::int64 max_load_retry_interval_micros = 0;
+    float load_retry_jitter = 0;
+    bool release_load_threads_during_load_retries = false;
     tensorflow::int32 file_system_poll_wait_seconds = 1;
+    bool watch_file_system = false;
+    tensorflow::int32 num_file_system_polling_threads = 16;
+    tensorflow::string model_cache_dir;
+    tensorflow::int32 num_model_cache_download_threads = 8;
+    tensorflow::int32 num_servable_event_callback_threads = 0;
     bool flush_filesystem_caches = true;
+    bool release_memory_after_unload = false;
     tensorflow::string model_base_path;
     tensorflow::string saved_model_tags;
     // Tensorflow session parallelism of zero means that both inter and intra op
@@ -87,6 +161,8 @@ class Server {
     bool enable_model_warmup = true;
     // This value is used only if > 0.
     tensorflow::int32 num_request_iterations_for_warmup = 0;
+    // This value is used only if > 0.
+    tensorflow::int32 num_model_warmup_threads = 0;
     tensorflow::string monitoring_config_file;
     // Tensorflow session run options.
     bool enforce_session_run_timeout = true;
@@ -94,8 +170,14 @@ class Server {
     bool prefer_tflite_model = false;
     tensorflow::int32 num_tflite_pools = port::NumSchedulableCPUs();
     tensorflow::int32 num_tflite_interpreters_per_pool = 1;
+    tensorflow::int32 num_tflite_interpreter_threads = 1;
+    bool use_tflite_xnnpack = false;
+    bool enable_session_callable_cache = false;
+    tensorflow::int32 num_variable_read_streams = 1;
     tensorflow::string thread_pool_factory_config_file;
+    tensorflow::string thread_affinity_config_file;
     bool enable_signature_method_name_check = false;
+    bool enable_multi_inference_shared_example_parsing = false;
     bool enable_profiler = true;
 
     Options();
@@ -113,14 +195,28 @@ class Server {
   // This will block the current thread until termination is successful.
   void WaitForTermination();
 
+  // Drains the servers started in BuildAndStart(): stops accepting new
+  // connections, waits up to 'timeout_seconds' for the requests in flight
+  // (including the ones waiting in batches) to complete, cancels the others,
+  // and flushes the request logs. Returns false if HTTP/REST requests, which
+  // cannot be cancelled, are still in flight: WaitForTermination() then waits
+  // for them. Otherwise WaitForTermination() returns.
+  bool Drain(tensorflow::int32 timeout_seconds);
+
  private:
   // Polls the filesystem, parses config at specified path, and calls
   // ServerCore::ReloadConfig with the captured model config.
   void PollFilesystemAndReloadConfig(const string& config_file_path);
 
   std::unique_ptr<ServerCore> server_core_;
+  // Serves the UNIX socket if shared memory tensors are enabled. Declared
+  // before 'prediction_service_', which uses it until 'grpc_server_' is shut
+  // down.
+  std::unique_ptr<UnixSocketAcceptor> unix_socket_acceptor_;
   std::unique_ptr<ModelServiceImpl> model_service_;
   std::unique_ptr<PredictionServiceImpl> prediction_service_;
+  // Declared before 'grpc_server_', which must be shut down first.
+  std::unique_ptr<AsyncPredictionService> async_prediction_service_;
   std::unique_ptr<tensorflow::grpc::ProfilerService::Service> profiler_service_;
   std::unique_ptr<::grpc::Server> grpc_server_;
   std::unique_ptr<net_http::HTTPServerInterface> http_server_;
@@ -128,6 +224,8 @@ class Server {
   // fs_model_config_poll_wait_seconds > 0.
   std::unique_ptr<PeriodicFunction> fs_config_polling_thread_;
   std::unique_ptr<ThreadPoolFactory> thread_pool_factory_;
+  // Pushes the metrics if the monitoring config enables OTLP.
+  std::unique_ptr<OtlpExporter> otlp_exporter_;
 };
 
 }  // namespace main
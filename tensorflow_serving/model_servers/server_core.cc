@@ -15,21 +15,32 @@ limitations under the License.
 
 #include "tensorflow_serving/model_servers/server_core.h"
 
+#include <map>
+#include <memory>
+#include <set>
 #include <utility>
 #include <vector>
 
 #include "google/protobuf/any.pb.h"
 #include "google/protobuf/wrappers.pb.h"
+#include "absl/strings/str_join.h"
 #include "tensorflow/core/lib/core/stringpiece.h"
 #include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/monitoring/counter.h"
 #include "tensorflow/core/lib/strings/strcat.h"
 #include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/protobuf.h"
 #include "tensorflow_serving/config/file_system_storage_path_source.pb.h"
 #include "tensorflow_serving/core/load_servables_fast.h"
 #include "tensorflow_serving/model_servers/model_platform_types.h"
+#include "tensorflow_serving/resources/numa_placement.h"
 #include "tensorflow_serving/resources/resource_values.h"
 #include "tensorflow_serving/servables/tensorflow/saved_model_bundle_source_adapter.h"
+#include "tensorflow_serving/servables/tensorflow/util.h"
 #include "tensorflow_serving/sources/storage_path/file_system_storage_path_source.h"
+#include "tensorflow_serving/util/cpu_affinity.h"
+#include "tensorflow_serving/util/memory_release.h"
+#include "tensorflow_serving/util/trace_context.h"
 
 namespace tensorflow {
 namespace serving {
@@ -40,6 +51,20 @@ namespace serving {
 
 namespace {
 
+auto* memory_released_after_unload_bytes = monitoring::Counter<1>::New(
+    "/tensorflow/serving/memory_released_after_unload_bytes",
+    "The number of bytes of resident memory returned to the OS after the "
+    "unload of the versions of a model.",
+    "model_name");
+
+// Returns the memory freed by the unload of 'id' to the OS.
+void ReleaseMemoryAfterUnload(const ServableId& id) {
+  const int64 released_bytes = ReleaseFreeMemoryToSystem();
+  VLOG(1) << "Released " << released_bytes << " bytes after unloading " << id;
+  memory_released_after_unload_bytes->GetCell(id.name)->IncrementBy(
+      released_bytes);
+}
+
 // Gets the platform associated with a model.
 Status GetPlatform(const ModelConfig& model_config, string* platform) {
   if (model_config.model_type() != ModelType::MODEL_TYPE_UNSPECIFIED) {
@@ -185,6 +210,48 @@ std::set<string> NewModelNamesInSourceConfig(
   return new_models;
 }
 
+// Returns the names of the models that are added or removed, or are configured
+// differently, in 'new_config_list' compared to 'old_config_list'.
+std::set<string> ChangedModelNames(const ModelConfigList& old_config_list,
+                                   const ModelConfigList& new_config_list) {
+  std::map<string, string> old_serialized_configs;
+  for (const ModelConfig& config : old_config_list.config()) {
+    SerializeToStringDeterministic(config,
+                                   &old_serialized_configs[config.name()]);
+  }
+  std::set<string> changed_models;
+  for (const ModelConfig& config : new_config_list.config()) {
+    auto old_it = old_serialized_configs.find(config.name());
+    string serialized_config;
+    if (old_it == old_serialized_configs.end() ||
+        !SerializeToStringDeterministic(config, &serialized_config) ||
+        serialized_config != old_it->second) {
+      changed_models.insert(config.name());
+    }
+    if (old_it != old_serialized_configs.end()) {
+      old_serialized_configs.erase(old_it);
+    }
+  }
+  for (const auto& removed : old_serialized_configs) {
+    changed_models.insert(removed.first);
+  }
+  return changed_models;
+}
+
+// Returns true if the two models have the same version labels.
+bool SameVersionLabels(const ModelConfig& a, const ModelConfig& b) {
+  if (a.version_labels().size() != b.version_labels().size()) {
+    return false;
+  }
+  for (const auto& a_entry : a.version_labels()) {
+    auto b_it = b.version_labels().find(a_entry.first);
+    if (b_it == b.version_labels().end() || b_it->second != a_entry.second) {
+      return false;
+    }
+  }
+  return true;
+}
+
 // Updates the base_path fields in each ModelConfig, prepending an
 // absolute model_config_list_root_dir.
 // It is assumed that initially, all the base_path fields are relative.
@@ -253,7 +320,12 @@ Status ServerCore::Create(Options options,
 
 ServerCore::ServerCore(Options options)
     : options_(std::move(options)),
-      servable_event_bus_(EventBus<ServableState>::CreateEventBus()) {
+      admission_controller_(options_.admission_control_options),
+      response_cache_(
+          std::make_shared<ResponseCache>(options_.response_cache_options)),
+      servable_event_bus_(EventBus<ServableState>::CreateEventBus(
+          {Env::Default(), options_.num_servable_event_callback_threads})),
+      model_placement_(options_.model_placement) {
   // Number the platforms. (The proto map iteration order is nondeterministic,
   // but we don't care since the numbering is arbitrary.)
   int port_num = 0;
@@ -273,6 +345,17 @@ Status ServerCore::Initialize(std::unique_ptr<AspiredVersionPolicy> policy) {
   }
 
   servable_state_monitor_ = std::move(servable_state_monitor);
+  if (response_cache_->enabled()) {
+    // The responses of a model may come from another version once the state
+    // of one of its versions changed.
+    std::weak_ptr<ResponseCache> weak_cache = response_cache_;
+    servable_state_monitor_->Notify([weak_cache](const ServableState& state) {
+      std::shared_ptr<ResponseCache> cache = weak_cache.lock();
+      if (cache != nullptr) {
+        cache->Invalidate(state.id.name);
+      }
+    });
+  }
 
   std::unique_ptr<AspiredVersionsManager> aspired_versions_manager;
   TF_RETURN_IF_ERROR(CreateAspiredVersionsManager(std::move(policy),
@@ -320,8 +403,13 @@ Status ServerCore::WaitUntilModelsAvailable(const std::set<string>& models,
   return Status::OK();
 }
 
-Status ServerCore::AddModelsViaModelConfigList() {
+Status ServerCore::AddModelsViaModelConfigList(
+    const std::set<string>& changed_models) {
   const bool is_first_config = storage_path_source_and_router_ == absl::nullopt;
+  if (!is_first_config && changed_models.empty()) {
+    LOG(INFO) << "No models were added, removed or modified.";
+    return Status::OK();
+  }
 
   // Create/reload the source, source router and source adapters.
   const FileSystemStoragePathSourceConfig source_config =
@@ -340,8 +428,10 @@ Status ServerCore::AddModelsViaModelConfigList() {
     TF_RETURN_IF_ERROR(CreateRouter(routes, &adapters, &router));
     std::unique_ptr<FileSystemStoragePathSource> source;
     std::unique_ptr<PrefixStoragePathSourceAdapter> prefix_source_adapter;
-    TF_RETURN_IF_ERROR(CreateStoragePathSource(
-        source_config, router.get(), &source, &prefix_source_adapter));
+    std::unique_ptr<CachingStoragePathSourceAdapter> caching_source_adapter;
+    TF_RETURN_IF_ERROR(CreateStoragePathSource(source_config, router.get(),
+                                               &source, &prefix_source_adapter,
+                                               &caching_source_adapter));
 
     // Connect the adapters to the manager, and wait for the models to load.
     TF_RETURN_IF_ERROR(ConnectAdaptersToManagerAndAwaitModelLoads(&adapters));
@@ -352,6 +442,9 @@ Status ServerCore::AddModelsViaModelConfigList() {
     if (prefix_source_adapter != nullptr) {
       manager_.AddDependency(std::move(prefix_source_adapter));
     }
+    if (caching_source_adapter != nullptr) {
+      manager_.AddDependency(std::move(caching_source_adapter));
+    }
     manager_.AddDependency(std::move(router));
     for (auto& entry : adapters.platform_adapters) {
       auto& adapter = entry.second;
@@ -371,24 +464,32 @@ Status ServerCore::AddModelsViaModelConfigList() {
     // Now we're ready to start reconfiguring the elements of the Source->
     // Manager pipeline ...
 
+    // The routes only change if models are added or removed.
+    const DynamicSourceRouter<StoragePath>::Routes old_routes =
+        storage_path_source_and_router_->router->GetRoutes();
+    const bool routes_changed = old_routes != routes;
+
     // First, add the new routes without removing the old ones.
-    DynamicSourceRouter<StoragePath>::Routes old_and_new_routes;
-    const Status union_status =
-        UnionRoutes(storage_path_source_and_router_->router->GetRoutes(),
-                    routes, &old_and_new_routes);
-    if (!union_status.ok()) {
-      // ValidateNoModelsChangePlatforms() should have detected any conflict.
-      DCHECK(false);
-      return errors::Internal("Old and new routes conflict.");
+    if (routes_changed) {
+      DynamicSourceRouter<StoragePath>::Routes old_and_new_routes;
+      const Status union_status =
+          UnionRoutes(old_routes, routes, &old_and_new_routes);
+      if (!union_status.ok()) {
+        // ValidateNoModelsChangePlatforms() should have detected any conflict.
+        DCHECK(false);
+        return errors::Internal("Old and new routes conflict.");
+      }
+      TF_RETURN_IF_ERROR(ReloadRoutes(old_and_new_routes));
     }
-    TF_RETURN_IF_ERROR(ReloadRoutes(old_and_new_routes));
 
     // Change the source config. Among other things this will cause it to emit
     // tear-downs of any models that aren't present in the new config.
     TF_RETURN_IF_ERROR(ReloadStoragePathSourceConfig(source_config));
 
     // Now that any old models are out of the picture, remove the old routes.
-    TF_RETURN_IF_ERROR(ReloadRoutes(routes));
+    if (routes_changed) {
+      TF_RETURN_IF_ERROR(ReloadRoutes(routes));
+    }
 
     // Wait for any new models to get loaded and become available.
     TF_RETURN_IF_ERROR(
@@ -430,7 +531,10 @@ Status ServerCore::MaybeUpdateServerRequestLogger(
 
 Status ServerCore::ReloadConfig(const ModelServerConfig& new_config) {
   mutex_lock l(config_mu_);
+  return ReloadConfigLocked(new_config);
+}
 
+Status ServerCore::ReloadConfigLocked(const ModelServerConfig& new_config) {
   // Determine whether to accept this config transition.
   const bool is_first_config =
       config_.config_case() == ModelServerConfig::CONFIG_NOT_SET;
@@ -458,19 +562,61 @@ Status ServerCore::ReloadConfig(const ModelServerConfig& new_config) {
     TF_RETURN_IF_ERROR(ValidateNoModelsChangePlatforms(
         config_.model_config_list(), new_config.model_config_list()));
   }
+  unplaced_config_ = new_config;
+  {
+    mutex_lock l(placement_mu_);
+    configured_model_names_.clear();
+    for (const ModelConfig& model_config :
+         new_config.model_config_list().config()) {
+      configured_model_names_.insert(model_config.name());
+    }
+  }
+  ModelServerConfig old_config = std::move(config_);
   config_ = new_config;
+  if (config_.config_case() == ModelServerConfig::kModelConfigList) {
+    *config_.mutable_model_config_list() =
+        PlacedModels(new_config.model_config_list());
+    if (config_.model_config_list().config_size() !=
+        new_config.model_config_list().config_size()) {
+      LOG(INFO) << "Placed " << config_.model_config_list().config_size()
+                << " of the " << new_config.model_config_list().config_size()
+                << " models on this server.";
+    }
+  }
 
-  TF_RETURN_IF_ERROR(UpdateModelVersionLabelMap());
+  Status prepare_status;
+  if (config_.config_case() == ModelServerConfig::kModelConfigList &&
+      options_.model_config_list_root_dir) {
+    prepare_status = UpdateModelConfigListRelativePaths(
+        *options_.model_config_list_root_dir,
+        config_.mutable_model_config_list());
+  }
+  if (prepare_status.ok()) {
+    prepare_status = UpdateModelVersionLabelMap(old_config.model_config_list());
+  }
+  if (!prepare_status.ok()) {
+    // Nothing was applied: lets the next config be compared against the
+    // models actually loaded.
+    config_ = std::move(old_config);
+    return prepare_status;
+  }
 
   LOG(INFO) << "Adding/updating models.";
   switch (config_.config_case()) {
     case ModelServerConfig::kModelConfigList: {
-      if (options_.model_config_list_root_dir) {
-        TF_RETURN_IF_ERROR(UpdateModelConfigListRelativePaths(
-            *options_.model_config_list_root_dir,
-            config_.mutable_model_config_list()));
+      std::set<string> changed_models = ChangedModelNames(
+          old_config.model_config_list(), config_.model_config_list());
+      changed_models.insert(models_to_reapply_.begin(),
+                            models_to_reapply_.end());
+      const Status add_status = AddModelsViaModelConfigList(changed_models);
+      if (!add_status.ok()) {
+        // Some of the changes may have been applied, so 'config_' is kept, and
+        // the next config reapplies all the models changed by this one even if
+        // it configures them the same.
+        models_to_reapply_ = std::move(changed_models);
+        return add_status;
       }
-      TF_RETURN_IF_ERROR(AddModelsViaModelConfigList());
+      models_to_reapply_.clear();
       break;
     }
     case ModelServerConfig::kCustomModelConfig: {
@@ -495,10 +641,138 @@ Status ServerCore::ReloadConfig(const ModelServerConfig& new_config) {
   return Status::OK();
 }
 
-Status ServerCore::UpdateModelVersionLabelMap() {
-  std::unique_ptr<std::map<string, std::map<string, int64>>> new_label_map(
-      new std::map<string, std::map<string, int64>>);
+Status ServerCore::UpdateModelPlacement(
+    std::shared_ptr<const ModelPlacement> placement) {
+  mutex_lock update_lock(placement_update_mu_);
+  // The models placed on this server by either placement are loaded first,
+  // so that the models moving to other servers are still served while these
+  // load them.
+  {
+    mutex_lock l(config_mu_);
+    if (unplaced_config_.config_case() !=
+        ModelServerConfig::kModelConfigList) {
+      return errors::FailedPrecondition(
+          "The models can only be placed with a ModelConfigList");
+    }
+    {
+      mutex_lock placement_lock(placement_mu_);
+      previous_model_placement_ = std::move(model_placement_);
+      model_placement_ = std::move(placement);
+      placement_handoff_ = true;
+    }
+    const ModelServerConfig config = unplaced_config_;
+    const Status status = ReloadConfigLocked(config);
+    if (!status.ok()) {
+      mutex_lock placement_lock(placement_mu_);
+      placement_handoff_ = false;
+      previous_model_placement_.reset();
+      return status;
+    }
+  }
+  if (options_.model_placement_handoff_micros > 0) {
+    LOG(INFO) << "Handing off the models placed on other servers for "
+              << options_.model_placement_handoff_micros / 1000 << " ms";
+    Env::Default()->SleepForMicroseconds(
+        options_.model_placement_handoff_micros);
+  }
+  // Then the models no longer placed on this server are unloaded. Note: The
+  // config may have been reloaded in the meantime.
+  mutex_lock l(config_mu_);
+  {
+    mutex_lock placement_lock(placement_mu_);
+    placement_handoff_ = false;
+    previous_model_placement_.reset();
+  }
+  const ModelServerConfig config = unplaced_config_;
+  return ReloadConfigLocked(config);
+}
+
+std::shared_ptr<const ModelPlacement> ServerCore::model_placement() const {
+  mutex_lock l(placement_mu_);
+  return model_placement_;
+}
+
+ModelConfigList ServerCore::PlacedModels(
+    const ModelConfigList& models) const {
+  std::shared_ptr<const ModelPlacement> placement;
+  std::shared_ptr<const ModelPlacement> previous_placement;
+  bool handoff;
+  {
+    mutex_lock l(placement_mu_);
+    placement = model_placement_;
+    previous_placement = previous_model_placement_;
+    handoff = placement_handoff_;
+  }
+  // A null placement places all the models on this server.
+  if (placement == nullptr || (handoff && previous_placement == nullptr)) {
+    return models;
+  }
+  ModelConfigList placed_models;
+  for (const ModelConfig& model_config : models.config()) {
+    if (placement->IsPlacedOnSelf(model_config.name()) ||
+        (handoff && previous_placement->IsPlacedOnSelf(model_config.name()))) {
+      *placed_models.add_config() = model_config;
+    }
+  }
+  return placed_models;
+}
+
+Status ServerCore::PlacementStatus(const string& model_name,
+                                   const Status& status) const {
+  std::shared_ptr<const ModelPlacement> placement;
+  {
+    mutex_lock l(placement_mu_);
+    if (configured_model_names_.count(model_name) == 0) {
+      // An unknown model is not served by other servers either.
+      return status;
+    }
+    placement = model_placement_;
+  }
+  if (placement == nullptr || placement->IsPlacedOnSelf(model_name)) {
+    return status;
+  }
+  return errors::NotFound("Model ", model_name,
+                          " is not placed on this server. It is served by: ",
+                          absl::StrJoin(placement->Owners(model_name), ","));
+}
+
+Status ServerCore::UpdateModelVersionLabelMap(
+    const ModelConfigList& old_config_list) {
+  std::map<string, const ModelConfig*> old_model_configs;
+  for (const ModelConfig& model_config : old_config_list.config()) {
+    old_model_configs[model_config.name()] = &model_config;
+  }
+  std::shared_ptr<const ModelLabelsToVersions> old_label_map =
+      model_labels_to_versions_.get();
+
+  // A labeled version must be available, so it is never held in hot standby.
+  // This promotes the labeled versions which are ready in standby before they
+  // are validated below.
+  if (options_.hot_standby_model_versions) {
+    std::map<string, std::set<int64>> labeled_versions;
+    for (const ModelConfig& model_config :
+         config_.model_config_list().config()) {
+      for (const auto& entry : model_config.version_labels()) {
+        labeled_versions[model_config.name()].insert(entry.second);
+      }
+    }
+    manager_->SetVersionsExemptFromStandby(labeled_versions);
+  }
+
+  std::unique_ptr<ModelLabelsToVersions> new_label_map(
+      new ModelLabelsToVersions);
   for (const ModelConfig& model_config : config_.model_config_list().config()) {
+    // Unchanged labels were validated when they were set.
+    auto old_it = old_model_configs.find(model_config.name());
+    if (old_label_map != nullptr && old_it != old_model_configs.end() &&
+        SameVersionLabels(*old_it->second, model_config)) {
+      auto old_labels_it = old_label_map->find(model_config.name());
+      if (old_labels_it != old_label_map->end()) {
+        (*new_label_map)[model_config.name()] = old_labels_it->second;
+      }
+      continue;
+    }
+
     ServableStateMonitor::VersionMap serving_states =
         servable_state_monitor_->GetVersionStates(model_config.name());
 
@@ -553,8 +827,13 @@ Status ServerCore::UpdateModelVersionLabelMap() {
     }
   }
 
-  mutex_lock l(model_labels_to_versions_mu_);
-  model_labels_to_versions_.swap(new_label_map);
+  if (old_label_map != nullptr && *old_label_map == *new_label_map) {
+    return Status::OK();
+  }
+  old_label_map.reset();
+
+  // This blocks until the readers of the previous map are done with it.
+  model_labels_to_versions_.Update(std::move(new_label_map));
 
   return Status::OK();
 }
@@ -583,6 +862,9 @@ FileSystemStoragePathSourceConfig ServerCore::CreateStoragePathSourceConfig(
   FileSystemStoragePathSourceConfig source_config;
   source_config.set_file_system_poll_wait_seconds(
       options_.file_system_poll_wait_seconds);
+  source_config.set_watch_file_system(options_.watch_file_system);
+  source_config.set_num_polling_threads(
+      options_.num_file_system_polling_threads);
   source_config.set_fail_if_zero_versions_at_startup(
       options_.fail_if_no_model_versions_found);
   source_config.set_servable_versions_always_present(
@@ -620,21 +902,36 @@ Status ServerCore::CreateStoragePathSource(
     const FileSystemStoragePathSourceConfig& config,
     Target<StoragePath>* target,
     std::unique_ptr<FileSystemStoragePathSource>* source,
-    std::unique_ptr<PrefixStoragePathSourceAdapter>* prefix_source_adapter) {
+    std::unique_ptr<PrefixStoragePathSourceAdapter>* prefix_source_adapter,
+    std::unique_ptr<CachingStoragePathSourceAdapter>* caching_source_adapter) {
   const Status status = FileSystemStoragePathSource::Create(config, source);
   if (!status.ok()) {
     VLOG(1) << "Unable to create FileSystemStoragePathSource due to: "
             << status;
     return status;
   }
-  if (options_.storage_path_prefix.empty()) {
-    ConnectSourceToTarget(source->get(), target);
-  } else {
+  if (!options_.model_cache_dir.empty()) {
+    CachingStoragePathSourceAdapter::Options caching_options;
+    caching_options.cache_dir = options_.model_cache_dir;
+    caching_options.num_download_threads =
+        options_.num_model_cache_download_threads;
+    caching_options.servable_event_bus = servable_event_bus_.get();
+    TF_RETURN_IF_ERROR(CachingStoragePathSourceAdapter::Create(
+        caching_options, caching_source_adapter));
+  }
+  // Source -> [PrefixAdapter ->] [CachingAdapter ->] target.
+  Source<StoragePath>* last_source = source->get();
+  if (!options_.storage_path_prefix.empty()) {
     *prefix_source_adapter = absl::make_unique<PrefixStoragePathSourceAdapter>(
         options_.storage_path_prefix);
-    ConnectSourceToTarget(source->get(), prefix_source_adapter->get());
-    ConnectSourceToTarget(prefix_source_adapter->get(), target);
+    ConnectSourceToTarget(last_source, prefix_source_adapter->get());
+    last_source = prefix_source_adapter->get();
+  }
+  if (*caching_source_adapter != nullptr) {
+    ConnectSourceToTarget(last_source, caching_source_adapter->get());
+    last_source = caching_source_adapter->get();
   }
+  ConnectSourceToTarget(last_source, target);
   return Status::OK();
 }
 
@@ -737,12 +1034,39 @@ Status ServerCore::CreateAspiredVersionsManager(
   manager_options.resource_tracker = std::move(resource_tracker);
   manager_options.servable_event_bus = servable_event_bus_.get();
   manager_options.aspired_version_policy = std::move(aspired_version_policy);
+  TF_RETURN_IF_ERROR(ValidateCpus(options_.load_thread_cpus, "load threads"));
+  manager_options.load_throttling.load_thread_cpus = options_.load_thread_cpus;
+  manager_options.load_throttling.load_thread_niceness =
+      options_.load_thread_niceness;
+  if (options_.pause_loads_above_p99_latency_micros > 0) {
+    const int64 max_p99_latency_micros =
+        options_.pause_loads_above_p99_latency_micros;
+    manager_options.load_throttling.should_pause_loads =
+        [max_p99_latency_micros]() {
+          return GetRecentRequestLatencies()->Percentile(99) >
+                 max_p99_latency_micros;
+        };
+    manager_options.load_throttling.max_load_pause_micros =
+        options_.max_load_pause_micros;
+  }
   manager_options.num_load_threads = options_.num_load_threads;
   manager_options.num_unload_threads = options_.num_unload_threads;
+  manager_options.schedule_loads = options_.schedule_model_loads;
+  manager_options.hot_standby = options_.hot_standby_model_versions;
   manager_options.max_num_load_retries = options_.max_num_load_retries;
   manager_options.load_retry_interval_micros =
       options_.load_retry_interval_micros;
+  manager_options.load_retry_backoff_multiplier =
+      options_.load_retry_backoff_multiplier;
+  manager_options.max_load_retry_interval_micros =
+      options_.max_load_retry_interval_micros;
+  manager_options.load_retry_jitter = options_.load_retry_jitter;
+  manager_options.release_load_threads_during_load_retries =
+      options_.release_load_threads_during_load_retries;
   manager_options.pre_load_hook = std::move(options_.pre_load_hook);
+  if (options_.release_memory_after_unload) {
+    manager_options.post_unload_hook = ReleaseMemoryAfterUnload;
+  }
   manager_options.flush_filesystem_caches = options_.flush_filesystem_caches;
   manager_options.enable_reload_servables_with_error =
       options_.enable_reload_servables_with_error;
@@ -756,15 +1080,24 @@ Status ServerCore::CreateAspiredVersionsManager(
 
 Status ServerCore::CreateResourceTracker(
     std::unique_ptr<ResourceTracker>* resource_tracker) {
+  if (options_.numa_aware_model_placement) {
+    NumaPlacement::Get()->Enable();
+  }
+  // One instance of the main memory per NUMA node the servables are placed
+  // on.
+  const int num_main_devices = NumaPlacement::Get()->num_nodes();
   ResourceUtil::Options resource_util_options;
-  resource_util_options.devices[device_types::kMain] = 1;
+  resource_util_options.devices[device_types::kMain] = num_main_devices;
   auto resource_util =
       std::unique_ptr<ResourceUtil>(new ResourceUtil(resource_util_options));
   ResourceAllocation total_resources;
-  resource_util->SetQuantity(
-      resource_util->CreateBoundResource(device_types::kMain,
-                                         resource_kinds::kRamBytes),
-      options_.total_model_memory_limit_bytes, &total_resources);
+  for (int instance = 0; instance < num_main_devices; ++instance) {
+    resource_util->SetQuantity(
+        resource_util->CreateBoundResource(device_types::kMain,
+                                           resource_kinds::kRamBytes, instance),
+        options_.total_model_memory_limit_bytes / num_main_devices,
+        &total_resources);
+  }
   const tensorflow::Status status = ResourceTracker::Create(
       total_resources, std::move(resource_util), resource_tracker);
   if (!status.ok()) {
@@ -809,17 +1142,54 @@ Status ServerCore::ServableRequestFromModelSpec(
   return Status::OK();
 }
 
-Status ServerCore::GetModelVersionForLabel(const string& model_name,
-                                           const string& label,
+Status ServerCore::Log(const google::protobuf::Message& request,
+                       const google::protobuf::Message& response,
+                       const LogMetadata& log_metadata) {
+  const TraceContext* const trace_context =
+      log_metadata.request_id().empty() ? CurrentTraceContext() : nullptr;
+  if (log_metadata.log_time_micros() != 0 && trace_context == nullptr) {
+    return options_.server_request_logger->Log(request, response, log_metadata);
+  }
+  LogMetadata completed_log_metadata = log_metadata;
+  if (completed_log_metadata.log_time_micros() == 0) {
+    completed_log_metadata.set_log_time_micros(EnvTime::NowMicros());
+  }
+  if (trace_context != nullptr) {
+    // The trace id identifies the request across the services handling it,
+    // so that their logs can be joined.
+    completed_log_metadata.set_request_id(trace_context->TraceIdHex());
+  }
+  return options_.server_request_logger->Log(request, response,
+                                             completed_log_metadata);
+}
+
+Status ServerCore::GetServedModelVersion(const ModelSpec& model_spec,
+                                         int64* version) {
+  ServableRequest servable_request;
+  TF_RETURN_IF_ERROR(
+      ServableRequestFromModelSpec(model_spec, &servable_request));
+  if (servable_request.version) {
+    *version = *servable_request.version;
+    return Status::OK();
+  }
+  std::unique_ptr<UntypedServableHandle> handle;
+  TF_RETURN_IF_ERROR(GetUntypedServableHandle(servable_request, &handle));
+  *version = handle->id().version;
+  return Status::OK();
+}
+
+Status ServerCore::GetModelVersionForLabel(const absl::string_view model_name,
+                                           const absl::string_view label,
                                            int64* version) const {
-  mutex_lock l(model_labels_to_versions_mu_);
-  if (model_labels_to_versions_ == nullptr) {
+  const std::shared_ptr<const ModelLabelsToVersions> model_labels_to_versions =
+      model_labels_to_versions_.get();
+  if (model_labels_to_versions == nullptr) {
     return errors::Unavailable(
         strings::StrCat("Model labels does not init yet.", label));
   }
-  auto version_map_it = model_labels_to_versions_->find(model_name);
-  if (version_map_it != model_labels_to_versions_->end()) {
-    const std::map<string, int64>& version_map = version_map_it->second;
+  auto version_map_it = model_labels_to_versions->find(model_name);
+  if (version_map_it != model_labels_to_versions->end()) {
+    const VersionLabels& version_map = version_map_it->second;
     auto version_it = version_map.find(label);
     if (version_it != version_map.end()) {
       *version = version_it->second;
@@ -19,14 +19,19 @@ limitations under the License.
 #include <limits>
 #include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "google/protobuf/any.pb.h"
 #include "absl/base/macros.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/platform/cpu_info.h"
+#include "tensorflow/core/platform/env_time.h"
 #include "tensorflow/core/platform/macros.h"
 #include "tensorflow/core/platform/mutex.h"
 #include "tensorflow/core/platform/types.h"
@@ -35,6 +40,7 @@ limitations under the License.
 #include "tensorflow_serving/config/model_server_config.pb.h"
 #include "tensorflow_serving/config/platform_config.pb.h"
 #include "tensorflow_serving/core/aspired_versions_manager.h"
+#include "tensorflow_serving/core/caching_storage_path_source_adapter.h"
 #include "tensorflow_serving/core/dynamic_source_router.h"
 #include "tensorflow_serving/core/prefix_storage_path_source_adapter.h"
 #include "tensorflow_serving/core/servable_state_monitor.h"
@@ -42,9 +48,13 @@ limitations under the License.
 #include "tensorflow_serving/core/source.h"
 #include "tensorflow_serving/core/source_adapter.h"
 #include "tensorflow_serving/core/storage_path.h"
+#include "tensorflow_serving/model_servers/admission_controller.h"
+#include "tensorflow_serving/model_servers/model_placement.h"
+#include "tensorflow_serving/model_servers/response_cache.h"
 #include "tensorflow_serving/servables/tensorflow/predict_util.h"
 #include "tensorflow_serving/sources/storage_path/file_system_storage_path_source.h"
 #include "tensorflow_serving/util/event_bus.h"
+#include "tensorflow_serving/util/fast_read_dynamic_ptr.h"
 #include "tensorflow_serving/util/unique_ptr_with_deps.h"
 
 namespace tensorflow {
@@ -111,9 +121,43 @@ class ServerCore : public Manager {
     // pool is used and unloads are performed serially in the manager thread.
     int32 num_unload_threads = 0;
 
+    // CPUs the models are loaded and unloaded on, but not served on: the
+    // threads started by the loads are not pinned to them. Only supported on
+    // Linux. If empty, the loads are not pinned.
+    std::vector<int> load_thread_cpus;
+
+    // If positive, the niceness the loads run at, e.g. 10, so that the serving
+    // threads run first when the CPUs are busy. Requires CAP_SYS_NICE or a
+    // high enough RLIMIT_NICE, so that the threads started by the loads get
+    // the default niceness back. Only supported on Linux.
+    int load_thread_niceness = 0;
+
+    // If positive, the loads pause while the p99 latency of the recent
+    // requests to the server is above this, in microseconds, up to
+    // 'max_load_pause_micros' each, so that rollouts yield to serving.
+    int64 pause_loads_above_p99_latency_micros = 0;
+    int64 max_load_pause_micros = 60 * 1000 * 1000;
+
+    // If true, the manager keeps all its load threads busy, loading the
+    // models with the smallest estimated resources first. See
+    // AspiredVersionsManager::Options::schedule_loads.
+    bool schedule_model_loads = false;
+
+    // If true, the newer aspired versions of a model which already serves one
+    // are preloaded in standby, and served as soon as the served version is
+    // not aspired anymore. The versions with a label are never held in
+    // standby. See AspiredVersionsManager::Options::hot_standby.
+    bool hot_standby_model_versions = false;
+
     // Total model size limit, in terms of main memory, in bytes.
     uint64 total_model_memory_limit_bytes = std::numeric_limits<uint64>::max();
 
+    // If true, and the machine has several NUMA nodes, the main memory is
+    // tracked per NUMA node, each node getting an equal share of
+    // 'total_model_memory_limit_bytes', and the servables supporting it are
+    // placed on one node each (see NumaPlacement).
+    bool numa_aware_model_placement = false;
+
     // Maximum number of times we retry loading a model, after the first
     // failure, before we give up.
     //
@@ -125,9 +169,28 @@ class ServerCore : public Manager {
     // Default: 1 minute.
     int64 load_retry_interval_micros = 1LL * 60 * 1000 * 1000;
 
+    // The factor the load retry interval is multiplied by after each retry, and
+    // the max interval, in microseconds, between two retries (if 0, a day).
+    double load_retry_backoff_multiplier = 1;
+    int64 max_load_retry_interval_micros = 0;
+
+    // The fraction, in [0, 1], of each load retry interval that is randomized.
+    double load_retry_jitter = 0;
+
+    // If true, a model whose load failed waits for its retry without holding a
+    // load thread, so that it does not hold back the loads of other models.
+    bool release_load_threads_during_load_retries = false;
+
     // Time interval between file-system polls, in seconds.
     int32 file_system_poll_wait_seconds = 30;
 
+    // If true, local model base paths are also polled as soon as they change.
+    // See FileSystemStoragePathSourceConfig::watch_file_system.
+    bool watch_file_system = false;
+
+    // See FileSystemStoragePathSourceConfig::num_polling_threads.
+    int32 num_file_system_polling_threads = 1;
+
     // If true, filesystem caches are flushed in the following cases:
     //
     // 1) After the initial models are loaded.
@@ -181,6 +244,13 @@ class ServerCore : public Manager {
     // called on the same manager load thread which starts the load.
     PreLoadHook pre_load_hook;
 
+    // If true, the free memory of the allocator is returned to the OS after
+    // each servable unload, so that the memory of an unloaded version is
+    // available to the next one (e.g. with the resource preserving policy).
+    // The released bytes are reported by the
+    // "/tensorflow/serving/memory_released_after_unload_bytes" metric.
+    bool release_memory_after_unload = false;
+
     // Whether to allow assigning unused version labels to models that are not
     // available yet.
     bool allow_version_labels_for_unavailable_models = false;
@@ -195,7 +265,43 @@ class ServerCore : public Manager {
     // The prefix to append to the file system storage paths.
     std::string storage_path_prefix;
 
+    // If set, model versions on remote file systems (e.g. gs://) are copied to
+    // this local directory, and loaded from there. See
+    // CachingStoragePathSourceAdapter.
+    std::string model_cache_dir;
+
+    // The number of files of a model version copied to 'model_cache_dir'
+    // concurrently.
+    int32 num_model_cache_download_threads = 8;
+
+    // If positive, the servable state events (e.g. the load and unload
+    // transitions of the manager) are delivered to their subscribers, such as
+    // the ServableStateMonitor, on this many threads instead of the publishing
+    // thread. A slow subscriber then doesn't delay the transitions. See
+    // EventBus::Options::num_callback_threads.
+    int32 num_servable_event_callback_threads = 0;
+
     bool enable_cors_support = false;
+
+    // Limits of the admission of the inference requests of the gRPC and
+    // HTTP/REST APIs. See AdmissionController. No limit by default.
+    AdmissionController::Options admission_control_options;
+
+    // Caching of the responses of the inference requests of the gRPC and
+    // HTTP/REST APIs. See ResponseCache. Disabled by default.
+    ResponseCache::Options response_cache_options;
+
+    // If set, only the models of the ModelConfigList placed on this server
+    // are loaded, and the requests to the other models fail with the members
+    // they are placed on (see ModelPlacement). Can be changed with
+    // UpdateModelPlacement(), e.g. when the fleet changes. All the models by
+    // default.
+    std::shared_ptr<const ModelPlacement> model_placement;
+
+    // When UpdateModelPlacement() moves models to other servers, how long
+    // they keep being served here after the models moved to this server are
+    // loaded, for the servers they move to to load them.
+    int64 model_placement_handoff_micros = 0;
   };
 
   virtual ~ServerCore() = default;
@@ -224,6 +330,14 @@ class ServerCore : public Manager {
   virtual Status ReloadConfig(const ModelServerConfig& config)
       TF_LOCKS_EXCLUDED(config_mu_);
 
+  /// Replaces the model placement (see 'model_placement'), and reloads the
+  /// most recent config with it. The models now placed on this server are
+  /// loaded first, and the ones no longer placed on it are only unloaded
+  /// 'model_placement_handoff_micros' later, before returning. Null places
+  /// all the models on this server. Only legal with ModelConfigList.
+  Status UpdateModelPlacement(std::shared_ptr<const ModelPlacement> placement)
+      TF_LOCKS_EXCLUDED(placement_update_mu_, config_mu_);
+
   /// Returns ServableStateMonitor that can be used to query servable states.
   virtual ServableStateMonitor* servable_state_monitor() const {
     return servable_state_monitor_.get();
@@ -253,19 +367,22 @@ class ServerCore : public Manager {
     status = manager_->GetServableHandle(servable_request, handle);
     if (!status.ok()) {
       VLOG(1) << "Unable to get servable handle due to: " << status;
-      return status;
+      return PlacementStatus(model_spec.name(), status);
     }
     return Status::OK();
   }
 
   /// Writes the log for the particular request, response and metadata, if we
   /// decide to sample it and if request-logging was configured for the
-  /// particular model.
+  /// particular model. The log time of the metadata is set to the current
+  /// time if unset, and the request id to the trace id of the request if
+  /// unset and the request is traced (see CurrentTraceContext()).
   virtual Status Log(const google::protobuf::Message& request,
                      const google::protobuf::Message& response,
-                     const LogMetadata& log_metadata) {
-    return options_.server_request_logger->Log(request, response, log_metadata);
-  }
+                     const LogMetadata& log_metadata);
+
+  /// Flushes the request logs, e.g. before the server exits.
+  Status FlushLogs() { return options_.server_request_logger->Flush(); }
 
   internal::PredictResponseTensorSerializationOption
   predict_response_tensor_serialization_option() const {
@@ -274,12 +391,46 @@ class ServerCore : public Manager {
 
   bool enable_cors_support() const { return options_.enable_cors_support; }
 
+  // Admits the inference requests to the models (see
+  // 'admission_control_options').
+  AdmissionController* admission_controller() { return &admission_controller_; }
+
+  // Caches the responses of the inference requests (see
+  // 'response_cache_options').
+  ResponseCache* response_cache() { return response_cache_.get(); }
+
+  // Configuration of the supported platforms.
+  const PlatformConfigMap& platform_config_map() const {
+    return options_.platform_config_map;
+  }
+
+  // The current model placement (see 'model_placement'). Null if all the
+  // models are placed on this server.
+  std::shared_ptr<const ModelPlacement> model_placement() const
+      TF_LOCKS_EXCLUDED(placement_mu_);
+
  protected:
   ServerCore(Options options);
 
  private:
   friend class test_util::ServerCoreTestAccess;
 
+  // Returns the status of a request to 'model_name' that failed with
+  // 'status': if the model is in the config and placed on other servers, a
+  // NotFound error naming them, so that the client can retry there.
+  // Otherwise 'status'.
+  Status PlacementStatus(const string& model_name, const Status& status) const
+      TF_LOCKS_EXCLUDED(placement_mu_);
+
+  // Implements ReloadConfig().
+  Status ReloadConfigLocked(const ModelServerConfig& config)
+      TF_EXCLUSIVE_LOCKS_REQUIRED(config_mu_);
+
+  // Returns the models of 'models' to load on this server: the ones placed
+  // on it, and during a placement handoff, the ones previously placed on it.
+  ModelConfigList PlacedModels(const ModelConfigList& models) const
+      TF_LOCKS_EXCLUDED(placement_mu_);
+
   // ************************************************************************
   // Server Setup and Initialization.
   // ************************************************************************
@@ -319,13 +470,15 @@ class ServerCore : public Manager {
   Status WaitUntilModelsAvailable(const std::set<string>& models,
                                   ServableStateMonitor* monitor);
 
-  // Creates a FileSystemStoragePathSource and an optional
-  // PrefixStoragePathSourceAdapter, and connects them to the supplied target.
+  // Creates a FileSystemStoragePathSource, an optional
+  // PrefixStoragePathSourceAdapter and an optional
+  // CachingStoragePathSourceAdapter, and connects them to the supplied target.
   Status CreateStoragePathSource(
       const FileSystemStoragePathSourceConfig& config,
       Target<StoragePath>* target,
       std::unique_ptr<FileSystemStoragePathSource>* source,
-      std::unique_ptr<PrefixStoragePathSourceAdapter>* prefix_source_adapter)
+      std::unique_ptr<PrefixStoragePathSourceAdapter>* prefix_source_adapter,
+      std::unique_ptr<CachingStoragePathSourceAdapter>* caching_source_adapter)
       TF_EXCLUSIVE_LOCKS_REQUIRED(config_mu_);
 
   // The source adapters to deploy, to handle the configured platforms as well
@@ -366,8 +519,11 @@ class ServerCore : public Manager {
   Status ReloadRoutes(const DynamicSourceRouter<StoragePath>::Routes& routes)
       TF_EXCLUSIVE_LOCKS_REQUIRED(config_mu_);
 
-  // Adds/reloads models through ModelConfigList of 'config_'.
-  Status AddModelsViaModelConfigList() TF_EXCLUSIVE_LOCKS_REQUIRED(config_mu_);
+  // Adds/reloads models through ModelConfigList of 'config_'. Unless this is
+  // the first config, does nothing if 'changed_models', the names of the
+  // models added, removed or modified since the previous config, is empty.
+  Status AddModelsViaModelConfigList(const std::set<string>& changed_models)
+      TF_EXCLUSIVE_LOCKS_REQUIRED(config_mu_);
 
   // Adds/reloads models through custom model config of 'config_'.
   Status AddModelsViaCustomModelConfig()
@@ -382,9 +538,10 @@ class ServerCore : public Manager {
   // requesting to assign an existing label to a version not in state
   // kAvailable. For a new version label, it can be assigned to a version that
   // is not in state kAvailable yet if
-  // allow_version_labels_for_unavailable_models is true.
-  Status UpdateModelVersionLabelMap() TF_EXCLUSIVE_LOCKS_REQUIRED(config_mu_)
-      TF_LOCKS_EXCLUDED(model_labels_to_versions_mu_);
+  // allow_version_labels_for_unavailable_models is true. The labels of models
+  // whose labels are unchanged since 'old_config_list' are kept as is.
+  Status UpdateModelVersionLabelMap(const ModelConfigList& old_config_list)
+      TF_EXCLUSIVE_LOCKS_REQUIRED(config_mu_);
 
   // ************************************************************************
   // Request Processing.
@@ -395,9 +552,13 @@ class ServerCore : public Manager {
                                       ServableRequest* servable_request) const;
 
   // Gets the version associated with 'label', for the given model name.
-  Status GetModelVersionForLabel(const string& model_name, const string& label,
-                                 int64* version) const
-      TF_LOCKS_EXCLUDED(model_labels_to_versions_mu_);
+  Status GetModelVersionForLabel(absl::string_view model_name,
+                                 absl::string_view label,
+                                 int64* version) const;
+
+  // Gets the version a request for 'model_spec' is served with at this time:
+  // the requested one, the one its label maps to, or the latest available one.
+  Status GetServedModelVersion(const ModelSpec& model_spec, int64* version);
 
   Status GetUntypedServableHandle(
       const ServableRequest& request,
@@ -418,16 +579,35 @@ class ServerCore : public Manager {
   // Used to deterministically associate a platform with a source adapter.
   std::map<string, int> platform_to_router_port_;
 
+  AdmissionController admission_controller_;
+  std::shared_ptr<ResponseCache> response_cache_;
+
   std::shared_ptr<EventBus<ServableState>> servable_event_bus_;
   std::shared_ptr<ServableStateMonitor> servable_state_monitor_;
   UniquePtrWithDeps<AspiredVersionsManager> manager_;
 
-  // The most recent config supplied to ReloadConfig().
+  // The most recent config supplied to ReloadConfig(), restricted to the
+  // models placed on this server.
   ModelServerConfig config_ TF_GUARDED_BY(config_mu_);
 
-  // A model_name->label->version# map.
-  std::unique_ptr<std::map<string, std::map<string, int64>>>
-      model_labels_to_versions_ TF_GUARDED_BY(model_labels_to_versions_mu_);
+  // The most recent config supplied to ReloadConfig(), with all the models,
+  // to place them again on UpdateModelPlacement().
+  ModelServerConfig unplaced_config_ TF_GUARDED_BY(config_mu_);
+
+  // The names of the models changed by a config that failed to load. They are
+  // reapplied with the next config, whether or not it changes them.
+  std::set<string> models_to_reapply_ TF_GUARDED_BY(config_mu_);
+
+  // A model_name->label->version# routing table. It is built whole on each
+  // config change, then immutable, and read for each request that specifies a
+  // version label, so it uses the per-CPU sharded read pointers of
+  // FastReadDynamicPtr rather than a mutex. Its hash maps are looked up with
+  // the names of the ModelSpec, without copying them. The versions are then
+  // resolved to handles by the serving map of the manager. Null until the
+  // first config load.
+  using VersionLabels = absl::flat_hash_map<string, int64>;
+  using ModelLabelsToVersions = absl::flat_hash_map<string, VersionLabels>;
+  FastReadDynamicPtr<ModelLabelsToVersions> model_labels_to_versions_;
 
   struct StoragePathSourceAndRouter {
     FileSystemStoragePathSource* source;
@@ -443,9 +623,21 @@ class ServerCore : public Manager {
   // A mutex for reconfiguration, used by ReloadConfig().
   mutable mutex config_mu_;
 
-  // A mutex for swapping the model version label map. Should only be held for
-  // a short time (i.e. pointer swap) to avoid holding up inference requests.
-  mutable mutex model_labels_to_versions_mu_;
+  // Serializes UpdateModelPlacement(), which releases 'config_mu_' during
+  // its handoff. Acquired before 'config_mu_'.
+  mutex placement_update_mu_;
+
+  // The current model placement. Read on the failed requests only.
+  mutable mutex placement_mu_;
+  std::shared_ptr<const ModelPlacement> model_placement_
+      TF_GUARDED_BY(placement_mu_);
+  // During the handoff of UpdateModelPlacement(), the previous placement,
+  // whose models are still loaded.
+  bool placement_handoff_ TF_GUARDED_BY(placement_mu_) = false;
+  std::shared_ptr<const ModelPlacement> previous_model_placement_
+      TF_GUARDED_BY(placement_mu_);
+  // The names of the models of 'unplaced_config_'.
+  std::set<string> configured_model_names_ TF_GUARDED_BY(placement_mu_);
 };
 
 }  // namespace serving
@@ -18,11 +18,13 @@ limitations under the License.
 #include "google/protobuf/any.pb.h"
 #include "absl/strings/strip.h"
 #include "tensorflow/cc/saved_model/tag_constants.h"
+#include "tensorflow/core/lib/core/notification.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
 #include "tensorflow/core/lib/io/path.h"
 #include "tensorflow/core/lib/random/random.h"
 #include "tensorflow/core/lib/strings/stringprintf.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/path.h"
 #include "tensorflow/core/protobuf/error_codes.pb.h"
 #include "tensorflow_serving/apis/model.pb.h"
@@ -33,12 +35,14 @@ limitations under the License.
 #include "tensorflow_serving/core/test_util/fake_loader_source_adapter.pb.h"
 #include "tensorflow_serving/core/test_util/fake_log_collector.h"
 #include "tensorflow_serving/core/test_util/mock_request_logger.h"
+#include "tensorflow_serving/model_servers/model_placement.h"
 #include "tensorflow_serving/model_servers/model_platform_types.h"
 #include "tensorflow_serving/model_servers/test_util/server_core_test_util.h"
 #include "tensorflow_serving/model_servers/test_util/storage_path_error_injecting_source_adapter.h"
 #include "tensorflow_serving/model_servers/test_util/storage_path_error_injecting_source_adapter.pb.h"
 #include "tensorflow_serving/test_util/test_util.h"
 #include "tensorflow_serving/util/oss_or_google.h"
+#include "tensorflow_serving/util/trace_context.h"
 
 namespace tensorflow {
 namespace serving {
@@ -147,6 +151,98 @@ TEST_P(ServerCoreTest, ReloadConfigHandlesLoadingAPreviouslyUnloadedModel) {
   EXPECT_EQ(available_servables.at(0), expected_id);
 }
 
+TEST_P(ServerCoreTest, LoadsOnlyThePlacedModels) {
+  // Places the test model on the other member of the fleet.
+  ModelPlacement::Options placement_options;
+  placement_options.members = {"a:8500", "b:8500"};
+  placement_options.self = "a:8500";
+  std::unique_ptr<ModelPlacement> placement;
+  TF_ASSERT_OK(ModelPlacement::Create(placement_options, &placement));
+  if (placement->IsPlacedOnSelf(test_util::kTestModelName)) {
+    placement_options.self = "b:8500";
+    TF_ASSERT_OK(ModelPlacement::Create(placement_options, &placement));
+  }
+  const string owner = placement->Owners(test_util::kTestModelName)[0];
+  const std::shared_ptr<const ModelPlacement> other_placement(
+      std::move(placement));
+
+  ServerCore::Options options = GetDefaultOptions();
+  options.model_placement = other_placement;
+  std::unique_ptr<ServerCore> server_core;
+  TF_ASSERT_OK(CreateServerCore(GetTestModelServerConfigForFakePlatform(),
+                                std::move(options), &server_core));
+  EXPECT_TRUE(server_core->ListAvailableServableIds().empty());
+
+  ModelSpec model_spec;
+  model_spec.set_name(test_util::kTestModelName);
+  model_spec.mutable_version()->set_value(test_util::kTestModelVersion);
+  ServableHandle<string> servable_handle;
+  const Status status =
+      server_core->GetServableHandle<string>(model_spec, &servable_handle);
+  EXPECT_EQ(status.code(), error::NOT_FOUND);
+  EXPECT_THAT(status.error_message(), ::testing::HasSubstr(owner));
+
+  // Places all the models on this server.
+  TF_ASSERT_OK(server_core->UpdateModelPlacement(nullptr));
+  const std::vector<ServableId> available_servables =
+      server_core->ListAvailableServableIds();
+  ASSERT_EQ(available_servables.size(), 1);
+  const ServableId expected_id = {test_util::kTestModelName,
+                                  test_util::kTestModelVersion};
+  EXPECT_EQ(available_servables.at(0), expected_id);
+  TF_ASSERT_OK(
+      server_core->GetServableHandle<string>(model_spec, &servable_handle));
+
+  // The requests to the models missing from the config keep their status.
+  TF_ASSERT_OK(server_core->UpdateModelPlacement(other_placement));
+  model_spec.set_name("unknown_model");
+  const Status unknown_status =
+      server_core->GetServableHandle<string>(model_spec, &servable_handle);
+  EXPECT_FALSE(unknown_status.ok());
+  EXPECT_THAT(unknown_status.error_message(),
+              ::testing::Not(::testing::HasSubstr("not placed")));
+}
+
+TEST_P(ServerCoreTest, UpdateModelPlacementHandsOffTheMovedModels) {
+  ModelPlacement::Options placement_options;
+  placement_options.members = {"a:8500", "b:8500"};
+  placement_options.self = "a:8500";
+  std::unique_ptr<ModelPlacement> placement;
+  TF_ASSERT_OK(ModelPlacement::Create(placement_options, &placement));
+  if (placement->IsPlacedOnSelf(test_util::kTestModelName)) {
+    placement_options.self = "b:8500";
+    TF_ASSERT_OK(ModelPlacement::Create(placement_options, &placement));
+  }
+  std::shared_ptr<const ModelPlacement> other_placement(std::move(placement));
+
+  ServerCore::Options options = GetDefaultOptions();
+  options.model_placement_handoff_micros = 2 * 1000 * 1000;
+  std::unique_ptr<ServerCore> server_core;
+  TF_ASSERT_OK(CreateServerCore(GetTestModelServerConfigForFakePlatform(),
+                                std::move(options), &server_core));
+  const ServableId servable_id = {test_util::kTestModelName,
+                                  test_util::kTestModelVersion};
+  ASSERT_EQ(server_core->ListAvailableServableIds().size(), 1);
+
+  // The model moves to the other member, and is still served during the
+  // handoff.
+  Notification placement_updated;
+  std::unique_ptr<Thread> update_thread(Env::Default()->StartThread(
+      {}, "update_placement", [&]() {
+        TF_EXPECT_OK(server_core->UpdateModelPlacement(other_placement));
+        placement_updated.Notify();
+      }));
+  Env::Default()->SleepForMicroseconds(500 * 1000);
+  EXPECT_FALSE(placement_updated.HasBeenNotified());
+  EXPECT_EQ(server_core->ListAvailableServableIds().size(), 1);
+
+  // Then it is unloaded.
+  update_thread.reset();
+  test_util::WaitUntilServableManagerStateIsOneOf(
+      *server_core->servable_state_monitor(), servable_id,
+      {ServableState::ManagerState::kEnd});
+}
+
 TEST_P(ServerCoreTest, ReloadConfigChangeModelBasePath) {
   // Create two configs that differ only in the model's base path. One base path
   // has a single version test_util::kTestModelVersion, and one has two versions
@@ -301,6 +397,58 @@ TEST_P(ServerCoreTest, ErroringModel) {
               ::testing::HasSubstr("1 servable(s) did not become available"));
 }
 
+TEST_P(ServerCoreTest, ReloadConfigWithUnchangedConfigKeepsModels) {
+  const ModelServerConfig config = GetTestModelServerConfigForFakePlatform();
+  std::unique_ptr<ServerCore> server_core;
+  TF_ASSERT_OK(CreateServerCore(config, &server_core));
+
+  TF_ASSERT_OK(server_core->ReloadConfig(config));
+  const std::vector<ServableId> available_servables =
+      server_core->ListAvailableServableIds();
+  ASSERT_EQ(available_servables.size(), 1);
+  const ServableId expected_id = {test_util::kTestModelName,
+                                  test_util::kTestModelVersion};
+  EXPECT_EQ(available_servables.at(0), expected_id);
+}
+
+TEST_P(ServerCoreTest, ReloadConfigReappliesModelsOfAFailedReload) {
+  ServerCore::Options options = GetDefaultOptions();
+  test_util::StoragePathErrorInjectingSourceAdapterConfig source_adapter_config;
+  source_adapter_config.set_error_message("injected error");
+  ::google::protobuf::Any source_adapter_config_any;
+  source_adapter_config_any.PackFrom(source_adapter_config);
+  (*(*options.platform_config_map
+          .mutable_platform_configs())["erroring_platform"]
+        .mutable_source_adapter_config()) = source_adapter_config_any;
+  const ModelServerConfig config = GetTestModelServerConfigForFakePlatform();
+  const ServableId servable_id = {test_util::kTestModelName,
+                                  test_util::kTestModelVersion};
+  std::unique_ptr<ServerCore> server_core;
+  TF_ASSERT_OK(CreateServerCore(config, std::move(options), &server_core));
+
+  // Replaces the test model with one that fails to load. The test model is
+  // unloaded before the failure is reported.
+  ModelServerConfig failing_config = config;
+  ModelConfig* erroring_model =
+      failing_config.mutable_model_config_list()->mutable_config(0);
+  erroring_model->set_name("erroring_model");
+  erroring_model->set_model_platform("erroring_platform");
+  const Status status = server_core->ReloadConfig(failing_config);
+  ASSERT_FALSE(status.ok());
+  EXPECT_THAT(status.ToString(),
+              ::testing::HasSubstr("1 servable(s) did not become available"));
+  test_util::WaitUntilServableManagerStateIsOneOf(
+      *server_core->servable_state_monitor(), servable_id,
+      {ServableState::ManagerState::kEnd});
+
+  // The config that was loaded before the failure is applied again.
+  TF_ASSERT_OK(server_core->ReloadConfig(config));
+  const std::vector<ServableId> available_servables =
+      server_core->ListAvailableServableIds();
+  ASSERT_EQ(available_servables.size(), 1);
+  EXPECT_EQ(available_servables.at(0), servable_id);
+}
+
 TEST_P(ServerCoreTest, IllegalReconfigurationToCustomConfig) {
   // Create a ServerCore with ModelConfigList config.
   std::unique_ptr<ServerCore> server_core;
@@ -587,6 +735,7 @@ TEST_P(ServerCoreTest, RequestLoggingOff) {
 
 TEST_P(ServerCoreTest, RequestLoggingOn) {
   std::unordered_map<string, FakeLogCollector*> log_collector_map;
+  std::vector<string> logged_request_ids;
   ServerCore::Options options = GetDefaultOptions();
   TF_CHECK_OK(ServerRequestLogger::Create(
       [&](const LoggingConfig& logging_config,
@@ -603,6 +752,7 @@ TEST_P(ServerCoreTest, RequestLoggingOn) {
                                       const google::protobuf::Message& actual_response,
                                       const LogMetadata& actual_log_metadata,
                                       std::unique_ptr<google::protobuf::Message>* log) {
+              logged_request_ids.push_back(actual_log_metadata.request_id());
               *log = std::unique_ptr<google::protobuf::Any>(
                   new google::protobuf::Any());
               return Status::OK();
@@ -638,6 +788,24 @@ TEST_P(ServerCoreTest, RequestLoggingOn) {
       server_core->Log(PredictRequest(), PredictResponse(), log_metadata0));
   ASSERT_EQ(1, log_collector_map.size());
   EXPECT_EQ(1, log_collector_map[test_util::kTestModelName]->collect_count());
+
+  // The logs of a traced request carry its trace id, unless the request id is
+  // set.
+  const absl::optional<TraceContext> trace_context =
+      TraceContext::FromTraceparent(
+          "00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01");
+  ASSERT_TRUE(trace_context.has_value());
+  {
+    ScopedTraceContext scoped_trace_context(&*trace_context);
+    TF_ASSERT_OK(
+        server_core->Log(PredictRequest(), PredictResponse(), log_metadata0));
+    log_metadata0.set_request_id("request");
+    TF_ASSERT_OK(
+        server_core->Log(PredictRequest(), PredictResponse(), log_metadata0));
+  }
+  EXPECT_THAT(logged_request_ids,
+              ::testing::ElementsAre("", "0af7651916cd43dd8448eb211c80319c",
+                                     "request"));
 }
 
 TEST_P(ServerCoreTest, ModelSpecMultipleVersionsAvailable) {
@@ -732,6 +900,20 @@ TEST_P(ServerCoreTest, ModelSpecMultipleVersionsAvailable) {
     EXPECT_THAT(status.ToString(),
                 ::testing::HasSubstr("Unrecognized servable version label"));
   }
+
+  // The versions the requests are served with.
+  {
+    ModelSpec model_spec;
+    model_spec.set_name(test_util::kTestModelName);
+    int64 version;
+    TF_ASSERT_OK(server_core->GetServedModelVersion(model_spec, &version));
+    EXPECT_EQ(test_util::kTestModelLargerVersion, version);
+    model_spec.set_version_label("A");
+    TF_ASSERT_OK(server_core->GetServedModelVersion(model_spec, &version));
+    EXPECT_EQ(test_util::kTestModelVersion, version);
+    model_spec.set_version_label("nonexistent label");
+    EXPECT_FALSE(server_core->GetServedModelVersion(model_spec, &version).ok());
+  }
 }
 
 TEST_P(ServerCoreTest, AssignLabelToUnavailableVersion) {
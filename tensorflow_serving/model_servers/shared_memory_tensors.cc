@@ -0,0 +1,445 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/model_servers/shared_memory_tensors.h"
+
+#include <fcntl.h>
+#include <linux/magic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "tensorflow/core/framework/allocation_description.pb.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/framework/types.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow_serving/servables/tensorflow/predict_util.h"
+
+// The seals of the memfds, missing from the headers of older C libraries.
+#ifndef F_GET_SEALS
+#define F_GET_SEALS 1034
+#endif
+#ifndef F_SEAL_SHRINK
+#define F_SEAL_SHRINK 0x0002
+#endif
+
+namespace tensorflow {
+namespace serving {
+
+namespace {
+
+bool IsNumber(absl::string_view s) {
+  return !s.empty() && std::all_of(s.begin(), s.end(), absl::ascii_isdigit);
+}
+
+// The kinds of files accepted as regions.
+enum class RegionKind {
+  kInvalid,
+  // "/dev/shm/<name>", a POSIX shared memory object.
+  kPosixSharedMemory,
+  // "/proc/<pid>/fd/<fd>", a memfd of process <pid>.
+  kMemfd,
+};
+
+// Returns the kind of region at 'path' for a request of 'peer'. The memfds
+// must be those of 'peer', and never of the server itself, so that the
+// requests cannot read or write the files of the server or of other
+// processes.
+RegionKind GetRegionKind(absl::string_view path,
+                         const SharedMemoryTensors::Peer& peer) {
+  if (absl::ConsumePrefix(&path, "/dev/shm/")) {
+    return !path.empty() && !absl::StrContains(path, '/') && path != "." &&
+                   path != ".."
+               ? RegionKind::kPosixSharedMemory
+               : RegionKind::kInvalid;
+  }
+  if (absl::ConsumePrefix(&path, "/proc/")) {
+    const std::vector<absl::string_view> parts = absl::StrSplit(path, '/');
+    return parts.size() == 3 && IsNumber(parts[0]) &&
+                   parts[0] == std::to_string(peer.pid) &&
+                   peer.pid != getpid() && parts[1] == "fd" &&
+                   IsNumber(parts[2])
+               ? RegionKind::kMemfd
+               : RegionKind::kInvalid;
+  }
+  return RegionKind::kInvalid;
+}
+
+// Returns the first offset from 'offset' aligned for Eigen. The regions are
+// mapped at page boundaries, so the aligned offsets are aligned addresses.
+uint64 AlignOffset(const uint64 offset) {
+  return (offset + EIGEN_MAX_ALIGN_BYTES - 1) / EIGEN_MAX_ALIGN_BYTES *
+         EIGEN_MAX_ALIGN_BYTES;
+}
+
+// Opens the region at 'path' of kind 'kind' for 'peer', and checks that it is
+// a file of the shared memory of the host that 'peer' may use. Returns the
+// file descriptor in 'fd', and whether it is open for writing in 'writable'.
+Status OpenRegion(const string& path, const RegionKind kind,
+                  const SharedMemoryTensors::Peer& peer, int* fd,
+                  bool* writable, struct stat* st) {
+  // The links of /proc/<pid>/fd are not symbolic links to follow, but the
+  // files themselves. O_NONBLOCK keeps a FIFO from blocking the open.
+  const int flags = O_CLOEXEC | O_NONBLOCK |
+                    (kind == RegionKind::kPosixSharedMemory ? O_NOFOLLOW : 0);
+  *writable = true;
+  *fd = open(path.c_str(), O_RDWR | flags);
+  if (*fd < 0 && errno == EACCES) {
+    *writable = false;
+    *fd = open(path.c_str(), O_RDONLY | flags);
+  }
+  if (*fd < 0) {
+    if (errno == ENOENT) {
+      return errors::NotFound("Shared memory region ", path,
+                              " not found: ", strerror(errno));
+    }
+    return errors::PermissionDenied("Failed to open shared memory region ",
+                                    path, ": ", strerror(errno));
+  }
+  struct statfs fs;
+  Status status;
+  if (fstat(*fd, st) != 0 || fstatfs(*fd, &fs) != 0) {
+    status = errors::Internal("Failed to stat shared memory region ", path,
+                              ": ", strerror(errno));
+  } else if (!S_ISREG(st->st_mode) ||
+             (fs.f_type != TMPFS_MAGIC && fs.f_type != HUGETLBFS_MAGIC)) {
+    status = errors::InvalidArgument("Shared memory region ", path,
+                                     " is not a file of the shared memory");
+  } else if (kind == RegionKind::kPosixSharedMemory && st->st_uid != peer.uid) {
+    status = errors::PermissionDenied("Shared memory region ", path,
+                                      " does not belong to the client");
+  }
+  if (!status.ok()) {
+    close(*fd);
+    *fd = -1;
+  }
+  return status;
+}
+
+}  // namespace
+
+class SharedMemoryTensors::Region {
+ public:
+  ~Region() {
+    if (data_ != nullptr) {
+      munmap(data_, size_);
+    }
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
+  // Creates the region of the file open as 'fd' at 'path', whose status is
+  // 'st', and takes ownership of 'fd'. The file is mapped if it is sealed
+  // against shrinking, and kept open otherwise.
+  static Status Create(const string& path, const int fd, const bool writable,
+                       const struct stat& st, std::shared_ptr<Region>* region) {
+    const size_t size = static_cast<size_t>(st.st_size);
+    const int seals = fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || (seals & F_SEAL_SHRINK) == 0 || size == 0) {
+      region->reset(new Region(st, fd, nullptr, size, writable));
+      return Status::OK();
+    }
+    bool mapped_writable = writable;
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      // The file may be sealed against writes, or open read-only.
+      mapped_writable = false;
+      data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    const int mmap_errno = errno;
+    close(fd);
+    if (data == MAP_FAILED) {
+      return errors::Internal("Failed to map shared memory region ", path,
+                              ": ", strerror(mmap_errno));
+    }
+    region->reset(new Region(st, -1, static_cast<char*>(data), size,
+                             mapped_writable));
+    return Status::OK();
+  }
+
+  // Returns whether this is the region of the file whose status is 'st'.
+  bool Is(const struct stat& st) const {
+    return st.st_dev == dev_ && st.st_ino == ino_ &&
+           static_cast<size_t>(st.st_size) == size_;
+  }
+
+  // The bytes of the region if it is mapped, or null.
+  char* data() const { return data_; }
+  bool writable() const { return writable_; }
+
+  // Copies the 'size' bytes at 'offset' to 'dst'.
+  Status Read(const uint64 offset, const size_t size, char* dst) const {
+    if (data_ != nullptr) {
+      std::memcpy(dst, data_ + offset, size);
+      return Status::OK();
+    }
+    for (size_t done = 0; done < size;) {
+      const ssize_t n = pread(fd_, dst + done, size - done, offset + done);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return errors::InvalidArgument(
+            "Failed to read shared memory region, which may have shrunk: ",
+            n < 0 ? strerror(errno) : "end of file");
+      }
+      done += n;
+    }
+    return Status::OK();
+  }
+
+  // Copies the 'size' bytes of 'src' at 'offset'.
+  Status Write(const uint64 offset, const char* src, const size_t size) {
+    if (data_ != nullptr) {
+      std::memcpy(data_ + offset, src, size);
+      return Status::OK();
+    }
+    for (size_t done = 0; done < size;) {
+      const ssize_t n = pwrite(fd_, src + done, size - done, offset + done);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return errors::Internal("Failed to write shared memory region: ",
+                                n < 0 ? strerror(errno) : "no bytes written");
+      }
+      done += n;
+    }
+    return Status::OK();
+  }
+
+ private:
+  Region(const struct stat& st, int fd, char* data, size_t size,
+         bool writable)
+      : dev_(st.st_dev),
+        ino_(st.st_ino),
+        fd_(fd),
+        data_(data),
+        size_(size),
+        writable_(writable) {}
+
+  const dev_t dev_;
+  const ino_t ino_;
+  // The file, if it is not mapped.
+  const int fd_;
+  char* const data_;
+  const size_t size_;
+  const bool writable_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(Region);
+};
+
+namespace {
+
+// A TensorBuffer pointing at the bytes of a tensor in a mapped region, which
+// it keeps mapped.
+class SharedMemoryBuffer : public TensorBuffer {
+ public:
+  SharedMemoryBuffer(std::shared_ptr<const void> region, char* data,
+                     size_t size)
+      : TensorBuffer(data), region_(std::move(region)), size_(size) {}
+
+  size_t size() const override { return size_; }
+  TensorBuffer* root_buffer() override { return this; }
+  void FillAllocationDescription(AllocationDescription* proto) const override {
+    proto->set_requested_bytes(size_);
+    proto->set_allocator_name("SharedMemoryBuffer");
+  }
+  // The bytes belong to the client, so they are never forwarded to, and
+  // overwritten by, the outputs of an op.
+  bool OwnsMemory() const override { return false; }
+
+ private:
+  const std::shared_ptr<const void> region_;
+  const size_t size_;
+};
+
+}  // namespace
+
+SharedMemoryTensors::SharedMemoryTensors(const Options& options)
+    : options_(options) {}
+
+SharedMemoryTensors::~SharedMemoryTensors() = default;
+
+bool SharedMemoryTensors::UsesSharedMemory(const PredictRequest& request) {
+  return !request.shared_memory_inputs().empty() ||
+         request.has_shared_memory_output_region();
+}
+
+Status SharedMemoryTensors::GetRegion(const SharedMemoryTensor& tensor,
+                                      const Peer& peer,
+                                      std::shared_ptr<Region>* region) {
+  const string& path = tensor.region_path();
+  const RegionKind kind = GetRegionKind(path, peer);
+  if (kind == RegionKind::kInvalid) {
+    return errors::InvalidArgument(
+        "Shared memory region must be /dev/shm/<name> or /proc/<pid>/fd/<fd> "
+        "of the client, was: ",
+        path);
+  }
+  int fd;
+  bool writable;
+  struct stat st;
+  TF_RETURN_IF_ERROR(OpenRegion(path, kind, peer, &fd, &writable, &st));
+  const uint64 size = static_cast<uint64>(st.st_size);
+  if (tensor.offset() > size || tensor.byte_size() > size - tensor.offset()) {
+    close(fd);
+    return errors::InvalidArgument(
+        "Bytes [", tensor.offset(), ", ", tensor.offset() + tensor.byte_size(),
+        ") are out of shared memory region ", path, " of ", size, " bytes");
+  }
+
+  {
+    mutex_lock l(mu_);
+    auto it = regions_.find(path);
+    if (it != regions_.end() && it->second->Is(st) &&
+        (it->second->writable() || !writable)) {
+      close(fd);
+      *region = it->second;
+      return Status::OK();
+    }
+  }
+  // The region is new, or its file was replaced or resized.
+  TF_RETURN_IF_ERROR(Region::Create(path, fd, writable, st, region));
+  mutex_lock l(mu_);
+  if (regions_.size() >= options_.max_num_mapped_regions) {
+    // The regions of the requests in progress stay mapped until they finish.
+    regions_.clear();
+  }
+  regions_[path] = *region;
+  return Status::OK();
+}
+
+Status SharedMemoryTensors::GetInputTensors(
+    const PredictRequest& request, const Peer& peer,
+    std::map<string, Tensor>* input_tensors) {
+  for (const auto& input : request.inputs()) {
+    Tensor tensor;
+    if (!internal::TensorFromProtoAliasingContent(input.second, &tensor)) {
+      return errors::InvalidArgument("tensor parsing error: ", input.first);
+    }
+    (*input_tensors)[input.first] = std::move(tensor);
+  }
+
+  for (const auto& input : request.shared_memory_inputs()) {
+    const string& alias = input.first;
+    const SharedMemoryTensor& descriptor = input.second;
+    if (input_tensors->count(alias) > 0) {
+      return errors::InvalidArgument(
+          "Input ", alias, " is both in inputs and in shared_memory_inputs");
+    }
+    if (!DataTypeCanUseMemcpy(descriptor.dtype())) {
+      return errors::InvalidArgument(
+          "Input ", alias, " of type ", DataTypeString(descriptor.dtype()),
+          " cannot be read from shared memory");
+    }
+    if (!TensorShape::IsValid(descriptor.tensor_shape())) {
+      return errors::InvalidArgument("Input ", alias,
+                                     " has an invalid shape");
+    }
+    const TensorShape shape(descriptor.tensor_shape());
+    if (shape.num_elements() * DataTypeSize(descriptor.dtype()) !=
+        descriptor.byte_size()) {
+      return errors::InvalidArgument(
+          "Input ", alias, " of shape ", shape.DebugString(), " and type ",
+          DataTypeString(descriptor.dtype()), " does not have ",
+          descriptor.byte_size(), " bytes");
+    }
+
+    std::shared_ptr<Region> region;
+    TF_RETURN_IF_ERROR(GetRegion(descriptor, peer, &region));
+    char* const data = region->data() == nullptr
+                           ? nullptr
+                           : region->data() + descriptor.offset();
+    Tensor tensor;
+    if (data != nullptr &&
+        reinterpret_cast<uintptr_t>(data) % EIGEN_MAX_ALIGN_BYTES == 0) {
+      SharedMemoryBuffer* buffer = new SharedMemoryBuffer(
+          std::move(region), data, descriptor.byte_size());
+      tensor = Tensor(descriptor.dtype(), shape, buffer);
+      buffer->Unref();
+    } else {
+      // Eigen expects tensor data to be aligned.
+      tensor = Tensor(descriptor.dtype(), shape);
+      TF_RETURN_IF_ERROR(
+          region->Read(descriptor.offset(), descriptor.byte_size(),
+                       const_cast<char*>(tensor.tensor_data().data())));
+    }
+    (*input_tensors)[alias] = std::move(tensor);
+  }
+  return Status::OK();
+}
+
+Status SharedMemoryTensors::WriteOutputTensors(
+    const PredictRequest& request, const Peer& peer,
+    const std::map<string, Tensor>& output_tensors,
+    PredictResponse* response) {
+  std::shared_ptr<Region> region;
+  const SharedMemoryTensor& output_region =
+      request.shared_memory_output_region();
+  if (request.has_shared_memory_output_region()) {
+    TF_RETURN_IF_ERROR(GetRegion(output_region, peer, &region));
+    if (!region->writable()) {
+      return errors::PermissionDenied("Shared memory region ",
+                                      output_region.region_path(),
+                                      " cannot be written");
+    }
+  }
+
+  const uint64 end = output_region.offset() + output_region.byte_size();
+  uint64 offset = output_region.offset();
+  for (const auto& output : output_tensors) {
+    const Tensor& tensor = output.second;
+    if (region == nullptr || !DataTypeCanUseMemcpy(tensor.dtype())) {
+      tensor.AsProtoField(&(*response->mutable_outputs())[output.first]);
+      continue;
+    }
+    offset = AlignOffset(offset);
+    const uint64 byte_size = tensor.TotalBytes();
+    if (offset > end || byte_size > end - offset) {
+      return errors::ResourceExhausted(
+          "The outputs do not fit in the ", output_region.byte_size(),
+          " bytes of the shared memory output region");
+    }
+    TF_RETURN_IF_ERROR(
+        region->Write(offset, tensor.tensor_data().data(), byte_size));
+
+    SharedMemoryTensor& descriptor =
+        (*response->mutable_shared_memory_outputs())[output.first];
+    descriptor.set_region_path(output_region.region_path());
+    descriptor.set_offset(offset);
+    descriptor.set_byte_size(byte_size);
+    descriptor.set_dtype(tensor.dtype());
+    tensor.shape().AsProto(descriptor.mutable_tensor_shape());
+    offset += byte_size;
+  }
+  return Status::OK();
+}
+
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,105 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_MODEL_SERVERS_SHARED_MEMORY_TENSORS_H_
+#define TENSORFLOW_SERVING_MODEL_SERVERS_SHARED_MEMORY_TENSORS_H_
+
+#include <sys/types.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow_serving/apis/predict.pb.h"
+
+namespace tensorflow {
+namespace serving {
+
+// Reads the input tensors of the Predict requests from shared memory, and
+// writes their output tensors to it (see SharedMemoryTensor in predict.proto),
+// for the clients on the same host as the server.
+//
+// A region must be a file of the client: a memfd of its process, or a POSIX
+// shared memory object it owns, which the server opens without following
+// symbolic links. The regions sealed against shrinking (F_SEAL_SHRINK) are
+// mapped once and kept mapped while their file is unchanged, and their
+// suitably aligned inputs are used in place, without being copied. The other
+// regions are read and written with pread() and pwrite(), as a client could
+// shrink a mapped file under the server.
+//
+// This class is thread-safe.
+class SharedMemoryTensors {
+ public:
+  struct Options {
+    // The maximum number of regions kept mapped or open.
+    int max_num_mapped_regions = 256;
+  };
+
+  // The credentials of the client process of a request.
+  struct Peer {
+    pid_t pid = -1;
+    uid_t uid = static_cast<uid_t>(-1);
+  };
+
+  explicit SharedMemoryTensors(const Options& options);
+  ~SharedMemoryTensors();
+
+  // Returns whether 'request' has tensors in shared memory.
+  static bool UsesSharedMemory(const PredictRequest& request);
+
+  // Returns the tensors of 'request.shared_memory_inputs' and of
+  // 'request.inputs', keyed by input alias, in 'input_tensors'. The tensors
+  // may point at the memory of 'request'. 'peer' is the client sending
+  // 'request'.
+  Status GetInputTensors(const PredictRequest& request, const Peer& peer,
+                         std::map<string, Tensor>* input_tensors);
+
+  // Writes 'output_tensors' to 'request.shared_memory_output_region', one
+  // after the other, and returns them in 'response->shared_memory_outputs'.
+  // The tensors that cannot be written as raw bytes are returned in
+  // 'response->outputs'. Without an output region, all of them are.
+  Status WriteOutputTensors(const PredictRequest& request, const Peer& peer,
+                            const std::map<string, Tensor>& output_tensors,
+                            PredictResponse* response);
+
+ private:
+  // The file of a region, mapped or open.
+  class Region;
+
+  // Returns the region of 'tensor', a file of 'peer' which must hold its
+  // bytes.
+  Status GetRegion(const SharedMemoryTensor& tensor, const Peer& peer,
+                   std::shared_ptr<Region>* region);
+
+  const Options options_;
+
+  mutex mu_;
+  // The mapped or open regions, by path.
+  std::unordered_map<string, std::shared_ptr<Region>> regions_
+      TF_GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(SharedMemoryTensors);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_MODEL_SERVERS_SHARED_MEMORY_TENSORS_H_
@@ -0,0 +1,361 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/model_servers/shared_memory_tensors.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include "tensorflow/core/framework/tensor_testutil.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+constexpr uint64 kAlign = EIGEN_MAX_ALIGN_BYTES;
+
+class SharedMemoryTensorsTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    peer_.pid = getpid();
+    peer_.uid = getuid();
+  }
+
+  void TearDown() override {
+    for (const string& path : paths_) {
+      Env::Default()->DeleteFile(path).IgnoreError();
+    }
+    for (const pid_t child : children_) {
+      kill(child, SIGKILL);
+      waitpid(child, nullptr, 0);
+    }
+  }
+
+  // Returns the path of a new region of the host holding 'content'.
+  string CreateRegion(const string& name, const string& content) {
+    const string path = strings::StrCat(
+        "/dev/shm/shared_memory_tensors_test_", getpid(), "_", name);
+    TF_CHECK_OK(WriteStringToFile(Env::Default(), path, content));
+    paths_.push_back(path);
+    return path;
+  }
+
+  // Returns the path of a memfd holding 'content', sealed against shrinking
+  // if 'seal', as seen in a child process, which becomes the peer.
+  string CreateMemfd(const string& content, const bool seal, int* fd) {
+    *fd = memfd_create("shared_memory_tensors_test", MFD_ALLOW_SEALING);
+    CHECK_GE(*fd, 0);
+    CHECK_EQ(write(*fd, content.data(), content.size()),
+             static_cast<ssize_t>(content.size()));
+    if (seal) {
+      CHECK_EQ(fcntl(*fd, F_ADD_SEALS, F_SEAL_SHRINK), 0);
+    }
+    // The memfds of the server itself are never accepted, so the child holds
+    // the memfd for the client.
+    const pid_t child = fork();
+    CHECK_GE(child, 0);
+    if (child == 0) {
+      pause();
+      _exit(0);
+    }
+    children_.push_back(child);
+    peer_.pid = child;
+    return strings::StrCat("/proc/", child, "/fd/", *fd);
+  }
+
+  Status GetInputTensors(const PredictRequest& request,
+                         std::map<string, Tensor>* input_tensors) {
+    return shared_memory_tensors_.GetInputTensors(request, peer_,
+                                                  input_tensors);
+  }
+
+  static SharedMemoryTensor Descriptor(const string& path, uint64 offset,
+                                       const Tensor& tensor) {
+    SharedMemoryTensor descriptor;
+    descriptor.set_region_path(path);
+    descriptor.set_offset(offset);
+    descriptor.set_byte_size(tensor.TotalBytes());
+    descriptor.set_dtype(tensor.dtype());
+    tensor.shape().AsProto(descriptor.mutable_tensor_shape());
+    return descriptor;
+  }
+
+  SharedMemoryTensors shared_memory_tensors_{SharedMemoryTensors::Options()};
+  SharedMemoryTensors::Peer peer_;
+  std::vector<string> paths_;
+  std::vector<pid_t> children_;
+};
+
+TEST_F(SharedMemoryTensorsTest, UsesSharedMemory) {
+  PredictRequest request;
+  EXPECT_FALSE(SharedMemoryTensors::UsesSharedMemory(request));
+  (*request.mutable_inputs())["x"];
+  EXPECT_FALSE(SharedMemoryTensors::UsesSharedMemory(request));
+  request.mutable_shared_memory_output_region();
+  EXPECT_TRUE(SharedMemoryTensors::UsesSharedMemory(request));
+}
+
+TEST_F(SharedMemoryTensorsTest, ReadsTheInputs) {
+  const Tensor x = test::AsTensor<float>({1, 2, 3, 4}, {2, 2});
+  const Tensor y = test::AsTensor<int32>({5, 6}, {2});
+  // 'x' is aligned and used in place, 'y' is not and is copied.
+  string content(kAlign, '\0');
+  content.append(x.tensor_data().data(), x.TotalBytes());
+  content.push_back('\0');
+  content.append(y.tensor_data().data(), y.TotalBytes());
+  const string path = CreateRegion("inputs", content);
+
+  PredictRequest request;
+  (*request.mutable_shared_memory_inputs())["x"] =
+      Descriptor(path, kAlign, x);
+  (*request.mutable_shared_memory_inputs())["y"] =
+      Descriptor(path, kAlign + x.TotalBytes() + 1, y);
+  const Tensor z = test::AsTensor<int64>({7});
+  z.AsProtoTensorContent(&(*request.mutable_inputs())["z"]);
+
+  std::map<string, Tensor> input_tensors;
+  TF_ASSERT_OK(GetInputTensors(request, &input_tensors));
+  ASSERT_EQ(input_tensors.size(), 3);
+  test::ExpectTensorEqual<float>(input_tensors["x"], x);
+  test::ExpectTensorEqual<int32>(input_tensors["y"], y);
+  test::ExpectTensorEqual<int64>(input_tensors["z"], z);
+}
+
+TEST_F(SharedMemoryTensorsTest, InvalidInputs) {
+  const Tensor x = test::AsTensor<float>({1, 2});
+  const string path = CreateRegion(
+      "invalid_inputs", string(x.tensor_data().data(), x.TotalBytes()));
+  std::map<string, Tensor> input_tensors;
+
+  // Only the shared memory of the host is accepted.
+  PredictRequest request;
+  (*request.mutable_shared_memory_inputs())["x"] =
+      Descriptor("/etc/passwd", 0, x);
+  EXPECT_EQ(GetInputTensors(request, &input_tensors).code(),
+            error::INVALID_ARGUMENT);
+  (*request.mutable_shared_memory_inputs())["x"] =
+      Descriptor("/dev/shm/../../etc/passwd", 0, x);
+  EXPECT_EQ(GetInputTensors(request, &input_tensors).code(),
+            error::INVALID_ARGUMENT);
+  (*request.mutable_shared_memory_inputs())["x"] = Descriptor(
+      strings::StrCat("/proc/", getpid(), "/fd/0"), 0, x);
+  EXPECT_EQ(GetInputTensors(request, &input_tensors).code(),
+            error::INVALID_ARGUMENT);
+
+  // The bytes must be in the region.
+  (*request.mutable_shared_memory_inputs())["x"] = Descriptor(path, 4, x);
+  EXPECT_EQ(GetInputTensors(request, &input_tensors).code(),
+            error::INVALID_ARGUMENT);
+
+  // The bytes must match the shape and type.
+  SharedMemoryTensor descriptor = Descriptor(path, 0, x);
+  descriptor.set_byte_size(4);
+  (*request.mutable_shared_memory_inputs())["x"] = descriptor;
+  EXPECT_EQ(GetInputTensors(request, &input_tensors).code(),
+            error::INVALID_ARGUMENT);
+
+  // An input is passed once.
+  (*request.mutable_shared_memory_inputs())["x"] = Descriptor(path, 0, x);
+  x.AsProtoTensorContent(&(*request.mutable_inputs())["x"]);
+  EXPECT_EQ(GetInputTensors(request, &input_tensors).code(),
+            error::INVALID_ARGUMENT);
+}
+
+TEST_F(SharedMemoryTensorsTest, RemapsTheReplacedRegions) {
+  const Tensor x = test::AsTensor<float>({1, 2});
+  const Tensor new_x = test::AsTensor<float>({3, 4, 5});
+  const string path =
+      CreateRegion("replaced", string(x.tensor_data().data(), x.TotalBytes()));
+  PredictRequest request;
+  (*request.mutable_shared_memory_inputs())["x"] = Descriptor(path, 0, x);
+  std::map<string, Tensor> input_tensors;
+  TF_ASSERT_OK(GetInputTensors(request, &input_tensors));
+  test::ExpectTensorEqual<float>(input_tensors["x"], x);
+
+  TF_ASSERT_OK(WriteStringToFile(
+      Env::Default(), path,
+      string(new_x.tensor_data().data(), new_x.TotalBytes())));
+  (*request.mutable_shared_memory_inputs())["x"] = Descriptor(path, 0, new_x);
+  TF_ASSERT_OK(GetInputTensors(request, &input_tensors));
+  test::ExpectTensorEqual<float>(input_tensors["x"], new_x);
+}
+
+TEST_F(SharedMemoryTensorsTest, WritesTheOutputs) {
+  const string path = CreateRegion("outputs", string(4 * kAlign, '\0'));
+  PredictRequest request;
+  SharedMemoryTensor* output_region =
+      request.mutable_shared_memory_output_region();
+  output_region->set_region_path(path);
+  output_region->set_offset(8);
+  output_region->set_byte_size(4 * kAlign - 8);
+
+  const Tensor a = test::AsTensor<float>({1, 2, 3});
+  const Tensor b = test::AsTensor<int64>({4, 5}, {1, 2});
+  const Tensor c = test::AsTensor<tstring>({"c"});
+  PredictResponse response;
+  TF_ASSERT_OK(shared_memory_tensors_.WriteOutputTensors(
+      request, peer_, {{"a", a}, {"b", b}, {"c", c}}, &response));
+
+  // The outputs are aligned, one after the other.
+  ASSERT_EQ(response.shared_memory_outputs().size(), 2);
+  const SharedMemoryTensor& a_descriptor =
+      response.shared_memory_outputs().at("a");
+  EXPECT_EQ(a_descriptor.region_path(), path);
+  EXPECT_EQ(a_descriptor.offset(), kAlign);
+  EXPECT_EQ(a_descriptor.byte_size(), a.TotalBytes());
+  EXPECT_EQ(a_descriptor.dtype(), DT_FLOAT);
+  const SharedMemoryTensor& b_descriptor =
+      response.shared_memory_outputs().at("b");
+  EXPECT_EQ(b_descriptor.offset(), 2 * kAlign);
+  EXPECT_EQ(TensorShape(b_descriptor.tensor_shape()), TensorShape({1, 2}));
+  // The strings are returned as TensorProtos.
+  ASSERT_EQ(response.outputs().size(), 1);
+  Tensor c_output;
+  ASSERT_TRUE(c_output.FromProto(response.outputs().at("c")));
+  test::ExpectTensorEqual<tstring>(c_output, c);
+
+  string content;
+  TF_ASSERT_OK(ReadFileToString(Env::Default(), path, &content));
+  EXPECT_EQ(content.substr(kAlign, a.TotalBytes()), a.tensor_data());
+  EXPECT_EQ(content.substr(2 * kAlign, b.TotalBytes()), b.tensor_data());
+}
+
+TEST_F(SharedMemoryTensorsTest, OutputsMustFitTheRegion) {
+  const string path =
+      CreateRegion("small_outputs", string(2 * kAlign, '\0'));
+  PredictRequest request;
+  SharedMemoryTensor* output_region =
+      request.mutable_shared_memory_output_region();
+  output_region->set_region_path(path);
+  output_region->set_byte_size(kAlign + 2);
+
+  // The second output does not fit once aligned.
+  const Tensor a = test::AsTensor<float>({1});
+  const Tensor b = test::AsTensor<float>({2});
+  PredictResponse response;
+  EXPECT_EQ(shared_memory_tensors_
+                .WriteOutputTensors(request, peer_, {{"a", a}, {"b", b}},
+                                    &response)
+                .code(),
+            error::RESOURCE_EXHAUSTED);
+}
+
+TEST_F(SharedMemoryTensorsTest, OutputsWithoutRegion) {
+  const Tensor a = test::AsTensor<float>({1});
+  PredictResponse response;
+  TF_ASSERT_OK(shared_memory_tensors_.WriteOutputTensors(
+      PredictRequest(), peer_, {{"a", a}}, &response));
+  EXPECT_TRUE(response.shared_memory_outputs().empty());
+  EXPECT_EQ(response.outputs().size(), 1);
+}
+
+TEST_F(SharedMemoryTensorsTest, SymbolicLinksAreNotFollowed) {
+  const Tensor x = test::AsTensor<float>({1, 2});
+  const string path = CreateRegion(
+      "link_target", string(x.tensor_data().data(), x.TotalBytes()));
+  const string link_path = strings::StrCat(
+      "/dev/shm/shared_memory_tensors_test_", getpid(), "_link");
+  ASSERT_EQ(symlink(path.c_str(), link_path.c_str()), 0);
+  paths_.push_back(link_path);
+
+  PredictRequest request;
+  (*request.mutable_shared_memory_inputs())["x"] =
+      Descriptor(link_path, 0, x);
+  std::map<string, Tensor> input_tensors;
+  EXPECT_EQ(GetInputTensors(request, &input_tensors).code(),
+            error::PERMISSION_DENIED);
+}
+
+TEST_F(SharedMemoryTensorsTest, RegionsOfOtherUsersAreRejected) {
+  const Tensor x = test::AsTensor<float>({1, 2});
+  const string path = CreateRegion(
+      "other_user", string(x.tensor_data().data(), x.TotalBytes()));
+  PredictRequest request;
+  (*request.mutable_shared_memory_inputs())["x"] = Descriptor(path, 0, x);
+  std::map<string, Tensor> input_tensors;
+  peer_.uid = getuid() + 1;
+  EXPECT_EQ(GetInputTensors(request, &input_tensors).code(),
+            error::PERMISSION_DENIED);
+}
+
+TEST_F(SharedMemoryTensorsTest, MapsTheSealedMemfdsOfThePeer) {
+  const Tensor x = test::AsTensor<float>({1, 2});
+  int fd;
+  const string path = CreateMemfd(
+      string(x.tensor_data().data(), x.TotalBytes()), /*seal=*/true, &fd);
+  PredictRequest request;
+  (*request.mutable_shared_memory_inputs())["x"] = Descriptor(path, 0, x);
+  std::map<string, Tensor> input_tensors;
+  TF_ASSERT_OK(GetInputTensors(request, &input_tensors));
+  test::ExpectTensorEqual<float>(input_tensors["x"], x);
+
+  // The input is used in place, so it sees the writes of the client.
+  const float new_value = 3;
+  ASSERT_EQ(pwrite(fd, &new_value, sizeof(new_value), 0),
+            static_cast<ssize_t>(sizeof(new_value)));
+  EXPECT_EQ(input_tensors["x"].flat<float>()(0), new_value);
+  close(fd);
+}
+
+TEST_F(SharedMemoryTensorsTest, CopiesTheUnsealedMemfdsOfThePeer) {
+  const Tensor x = test::AsTensor<float>({1, 2});
+  int fd;
+  const string path = CreateMemfd(
+      string(x.tensor_data().data(), x.TotalBytes()), /*seal=*/false, &fd);
+  PredictRequest request;
+  (*request.mutable_shared_memory_inputs())["x"] = Descriptor(path, 0, x);
+  std::map<string, Tensor> input_tensors;
+  TF_ASSERT_OK(GetInputTensors(request, &input_tensors));
+  test::ExpectTensorEqual<float>(input_tensors["x"], x);
+
+  // The client may shrink the file, which is not mapped.
+  ASSERT_EQ(ftruncate(fd, 0), 0);
+  test::ExpectTensorEqual<float>(input_tensors["x"], x);
+  EXPECT_EQ(GetInputTensors(request, &input_tensors).code(),
+            error::INVALID_ARGUMENT);
+  close(fd);
+}
+
+TEST_F(SharedMemoryTensorsTest, MemfdsOfOtherProcessesAreRejected) {
+  const Tensor x = test::AsTensor<float>({1, 2});
+  int fd;
+  const string path = CreateMemfd(
+      string(x.tensor_data().data(), x.TotalBytes()), /*seal=*/true, &fd);
+  PredictRequest request;
+  (*request.mutable_shared_memory_inputs())["x"] = Descriptor(path, 0, x);
+  std::map<string, Tensor> input_tensors;
+  // The peer is not the process holding the memfd.
+  peer_.pid = getpid();
+  EXPECT_EQ(GetInputTensors(request, &input_tensors).code(),
+            error::INVALID_ARGUMENT);
+  close(fd);
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
@@ -21,6 +21,7 @@ from __future__ import print_function
 
 import json
 import os
+import signal
 import subprocess
 import time
 
@@ -30,6 +31,7 @@ import grpc
 from six.moves import range
 import tensorflow.compat.v1 as tf
 
+from tensorflow.core.framework import types_pb2
 from tensorflow.python.platform import flags
 from tensorflow.python.profiler import profiler_client
 from tensorflow.python.saved_model import signature_constants
@@ -38,6 +40,7 @@ from tensorflow_serving.apis import get_model_metadata_pb2
 from tensorflow_serving.apis import get_model_status_pb2
 from tensorflow_serving.apis import inference_pb2
 from tensorflow_serving.apis import model_service_pb2_grpc
+from tensorflow_serving.apis import predict_pb2
 from tensorflow_serving.apis import prediction_service_pb2_grpc
 from tensorflow_serving.apis import regression_pb2
 from tensorflow_serving.model_servers.test_util import tensorflow_model_server_test_base
@@ -425,6 +428,48 @@ class TensorflowModelServerTest(
         expected_version=self._GetModelVersion(
             self._GetSavedModelHalfPlusThreePath()))
 
+  def testPredictAsyncGrpc(self):
+    """Test PredictionService.Predict served asynchronously."""
+    model_server_address = TensorflowModelServerTest.RunServer(
+        'default',
+        self._GetSavedModelBundlePath(),
+        grpc_async_num_completion_queues=2)[1]
+    self.VerifyPredictRequest(
+        model_server_address,
+        expected_output=3.0,
+        specify_output=False,
+        expected_version=self._GetModelVersion(
+            self._GetSavedModelHalfPlusThreePath()))
+
+  def testPredictStream(self):
+    """Test PredictionService.PredictStream implementation."""
+    model_path = self._GetSavedModelBundlePath()
+    model_server_address = TensorflowModelServerTest.RunServer(
+        'default', model_path)[1]
+
+    def Requests():
+      for x in range(8):
+        request = predict_pb2.PredictRequest()
+        request.model_spec.name = 'default'
+        request.inputs['x'].dtype = types_pb2.DT_FLOAT
+        request.inputs['x'].float_val.append(x)
+        request.inputs['x'].tensor_shape.dim.add().size = 1
+        yield request
+
+    print('Sending PredictStream requests...')
+    channel = grpc.insecure_channel(model_server_address)
+    stub = prediction_service_pb2_grpc.PredictionServiceStub(channel)
+    responses = list(stub.PredictStream(Requests(), RPC_TIMEOUT))
+
+    # The responses are in the order of the requests.
+    self.assertEqual(8, len(responses))
+    for x, response in enumerate(responses):
+      self.assertEqual(x / 2.0 + 2.0, response.outputs['y'].float_val[0])
+      self._VerifyModelSpec(
+          response.model_spec, 'default',
+          signature_constants.DEFAULT_SERVING_SIGNATURE_DEF_KEY,
+          self._GetModelVersion(model_path))
+
   def testClassifyREST(self):
     """Test Classify implementation over REST API."""
     model_path = self._GetSavedModelBundlePath()
@@ -486,6 +531,24 @@ class TensorflowModelServerTest(
     self.assertEqual(
         json.loads(resp_data.decode()), {'predictions': [3.0, 3.5, 4.0]})
 
+  def testDrainOnSigterm(self):
+    """Test that SIGTERM drains the server, which then exits."""
+    model_path = self._GetSavedModelBundlePath()
+    proc, _, rest_addr = TensorflowModelServerTest.RunServer(
+        'default', model_path, drain_timeout_seconds=5, reuse_port=True)
+    host, port = rest_addr.split(':')
+    url = 'http://{}:{}/v1/models/default:predict'.format(host, port)
+    json_req = {'instances': [2.0, 3.0, 4.0]}
+    resp_data = tensorflow_model_server_test_base.CallREST(url, json_req)
+    self.assertEqual(
+        json.loads(resp_data.decode()), {'predictions': [3.0, 3.5, 4.0]})
+
+    proc.send_signal(signal.SIGTERM)
+    # The server exits within the drain timeout, plus the flush of the logs.
+    self.assertEqual(0, proc.wait(timeout=30))
+    with self.assertRaises(Exception):
+      tensorflow_model_server_test_base.CallREST(url, json_req, max_attempts=1)
+
   def testPredictColumnarREST(self):
     """Test Predict implementation over REST API with columnar inputs."""
     model_path = self._GetSavedModelBundlePath()
@@ -590,6 +653,34 @@ class TensorflowModelServerTest(
     self.assertIn('# TYPE',
                   resp_data.decode('utf-8') if resp_data is not None else None)
 
+  def testBatchingStatsEndpoint(self):
+    """Test the batching statistics of a model over REST API."""
+    model_path = self._GetSavedModelBundlePath()
+    _, model_server_address, rest_address = TensorflowModelServerTest.RunServer(
+        'default',
+        model_path,
+        batching_parameters_file=self._GetBatchingParametersFile(),
+        monitoring_config_file=self._GetMonitoringConfigFile())
+    host, port = rest_address.split(':')
+    self.VerifyPredictRequest(
+        model_server_address,
+        expected_output=3.0,
+        expected_version=self._GetModelVersion(model_path))
+
+    # Send request
+    url = 'http://{}:{}/monitoring/batching/default'.format(host, port)
+    resp_data = None
+    try:
+      resp_data = tensorflow_model_server_test_base.CallREST(url, None)
+    except Exception as e:  # pylint: disable=broad-except
+      self.fail('Request failed with error: {}'.format(e))
+
+    # Verify that the batch of the request was recorded.
+    page = resp_data.decode('utf-8')
+    self.assertIn('model: default\n', page)
+    self.assertIn('  batches: 1\n', page)
+    self.assertIn('  mean_batch_size: 1.00\n', page)
+
   def testPredictUDS(self):
     """Test saved model prediction over a Unix domain socket."""
     _ = TensorflowModelServerTest.RunServer('default',
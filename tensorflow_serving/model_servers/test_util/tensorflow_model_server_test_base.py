@@ -154,7 +154,10 @@ class TensorflowModelServerTestBase(tf.test.TestCase):
                 grpc_channel_arguments='',
                 wait_for_server_ready=True,
                 pipe=None,
-                model_config_file_poll_period=None):
+                model_config_file_poll_period=None,
+                grpc_async_num_completion_queues=0,
+                drain_timeout_seconds=0,
+                reuse_port=False):
     """Run tensorflow_model_server using test config.
 
     A unique instance of server is started for each set of arguments.
@@ -173,6 +176,11 @@ class TensorflowModelServerTestBase(tf.test.TestCase):
       pipe: subpipe.PIPE object to read stderr from server.
       model_config_file_poll_period: Period for polling the
       filesystem to discover new model configs.
+      grpc_async_num_completion_queues: If > 0, serve the PredictionService
+      asynchronously with that many completion queues.
+      drain_timeout_seconds: If > 0, SIGTERM drains the server for up to that
+      many seconds before it exits.
+      reuse_port: Bind the ports with SO_REUSEPORT.
 
     Returns:
       3-tuple (<Popen object>, <grpc host:port>, <rest host:port>).
@@ -219,6 +227,13 @@ class TensorflowModelServerTestBase(tf.test.TestCase):
       command += ' --batching_parameters_file=' + batching_parameters_file
     if grpc_channel_arguments:
       command += ' --grpc_channel_arguments=' + grpc_channel_arguments
+    if grpc_async_num_completion_queues:
+      command += ' --grpc_async_num_completion_queues=' + str(
+          grpc_async_num_completion_queues)
+    if drain_timeout_seconds:
+      command += ' --drain_timeout_seconds=' + str(drain_timeout_seconds)
+    if reuse_port:
+      command += ' --reuse_port'
     print(command)
     proc = subprocess.Popen(shlex.split(command), stderr=pipe)
     atexit.register(proc.kill)
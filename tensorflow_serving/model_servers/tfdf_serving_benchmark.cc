@@ -0,0 +1,442 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// End-to-end benchmark of serving a TF-DF model with ServerCore.
+//
+// Loads a Yggdrasil model as a "tfdf" platform servable, and drives the REST
+// API handler and the servable with Predict and Classify requests, at fixed
+// concurrency and (optionally) QPS levels. Reports latency percentiles,
+// throughput and heap allocations per request.
+//
+// Run with:
+// bazel run -c opt --dynamic_mode=off \
+// tensorflow_serving/model_servers:tfdf_serving_benchmark -- \
+// --concurrency=1,4,16 --qps=0,1000 --duration_seconds=10
+// A QPS of 0 sends the requests back to back.
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/any.pb.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/env_time.h"
+#include "tensorflow/core/platform/init_main.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/util/command_line_flags.h"
+#include "tensorflow_serving/apis/classification.pb.h"
+#include "tensorflow_serving/apis/predict.pb.h"
+#include "tensorflow_serving/config/model_server_config.pb.h"
+#include "tensorflow_serving/config/platform_config.pb.h"
+#include "tensorflow_serving/core/availability_preserving_policy.h"
+#include "tensorflow_serving/model_servers/http_rest_api_handler.h"
+#include "tensorflow_serving/model_servers/model_platform_types.h"
+#include "tensorflow_serving/model_servers/server_core.h"
+#include "tensorflow_serving/servables/tfdf/tfdf_servable.h"
+#include "tensorflow_serving/servables/tfdf/tfdf_source_adapter.pb.h"
+
+namespace {
+
+// Number of heap allocations, of all the threads of the process.
+std::atomic<int64_t> num_allocations(0);
+
+}  // namespace
+
+// Counts the allocations. The array and sized variants of the operators
+// default to these, and the aligned ones to the overloads below.
+void* operator new(size_t size) {
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    abort();
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+
+void* operator new(size_t size, std::align_val_t alignment) {
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  // posix_memalign() expects at least the alignment of a pointer.
+  const size_t ptr_alignment =
+      std::max(static_cast<size_t>(alignment), sizeof(void*));
+  void* ptr = nullptr;
+  if (posix_memalign(&ptr, ptr_alignment, size == 0 ? 1 : size) != 0) {
+    abort();
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept { free(ptr); }
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+constexpr char kModelName[] = "tfdf_model";
+
+// A few examples of the adult dataset, used by the default test model.
+struct AdultExample {
+  float age;
+  const char* workclass;
+  const char* education;
+  float hours_per_week;
+};
+
+const AdultExample kExamples[] = {
+    {39.f, "State-gov", "Bachelors", 40.f},
+    {52.f, "Self-emp-inc", "HS-grad", 60.f},
+    {28.f, "Private", "Masters", 45.f},
+};
+
+const AdultExample& GetExample(const int i) {
+  return kExamples[i % TF_ARRAYSIZE(kExamples)];
+}
+
+string DefaultModelPath() {
+  const char* srcdir = getenv("TEST_SRCDIR");
+  return io::JoinPath(srcdir == nullptr ? "" : srcdir,
+                      "tf_serving/external/ydf/yggdrasil_decision_forests/"
+                      "test_data/model/adult_binary_class_gbdt");
+}
+
+// Copies the Yggdrasil model in 'model_path' as version 1 of a servable in a
+// temporary directory, and returns the base path of the servable.
+Status CreateServableBasePath(const string& model_path, string* base_path) {
+  Env* env = Env::Default();
+  string tmp_dir;
+  if (!env->LocalTempFilename(&tmp_dir)) {
+    return errors::Internal("Cannot create a temporary directory");
+  }
+  const string version_path = io::JoinPath(tmp_dir, "1");
+  TF_RETURN_IF_ERROR(env->RecursivelyCreateDir(version_path));
+  std::vector<string> children;
+  TF_RETURN_IF_ERROR(env->GetChildren(model_path, &children));
+  for (const string& child : children) {
+    TF_RETURN_IF_ERROR(env->CopyFile(io::JoinPath(model_path, child),
+                                     io::JoinPath(version_path, child)));
+  }
+  *base_path = tmp_dir;
+  return Status::OK();
+}
+
+Status CreateServerCore(const string& base_path,
+                        std::unique_ptr<ServerCore>* server_core) {
+  ModelServerConfig config;
+  auto* model_config = config.mutable_model_config_list()->add_config();
+  model_config->set_name(kModelName);
+  model_config->set_base_path(base_path);
+  model_config->set_model_platform(kTfdfModelPlatform);
+
+  ServerCore::Options options;
+  options.model_server_config = config;
+  ::google::protobuf::Any source_adapter_config;
+  source_adapter_config.PackFrom(TfdfSourceAdapterConfig());
+  *(*options.platform_config_map.mutable_platform_configs())[kTfdfModelPlatform]
+       .mutable_source_adapter_config() = source_adapter_config;
+  options.aspired_version_policy =
+      std::unique_ptr<AspiredVersionPolicy>(new AvailabilityPreservingPolicy);
+  TF_RETURN_IF_ERROR(ServerCore::Create(std::move(options), server_core));
+
+  while ((*server_core)->ListAvailableServableIds().empty()) {
+    Env::Default()->SleepForMicroseconds(100 * 1000);
+  }
+  return Status::OK();
+}
+
+// Returns the JSON list of 'batch_size' examples.
+string MakeJsonExamples(const int batch_size) {
+  string examples = "[";
+  for (int i = 0; i < batch_size; ++i) {
+    const AdultExample& example = GetExample(i);
+    absl::StrAppend(&examples, i > 0 ? "," : "",
+                    absl::StrFormat(R"({"age": %g, "workclass": "%s", )"
+                                    R"("education": "%s", )"
+                                    R"("hours_per_week": %g})",
+                                    example.age, example.workclass,
+                                    example.education,
+                                    example.hours_per_week));
+  }
+  absl::StrAppend(&examples, "]");
+  return examples;
+}
+
+// Returns the PredictRequest of 'batch_size' examples.
+PredictRequest MakePredictRequest(const int batch_size) {
+  PredictRequest request;
+  request.mutable_model_spec()->set_name(kModelName);
+  auto& inputs = *request.mutable_inputs();
+  for (const char* name : {"age", "workclass", "education", "hours_per_week"}) {
+    TensorProto& input = inputs[name];
+    const bool categorical =
+        name == string("workclass") || name == string("education");
+    input.set_dtype(categorical ? DT_STRING : DT_FLOAT);
+    input.mutable_tensor_shape()->add_dim()->set_size(batch_size);
+  }
+  for (int i = 0; i < batch_size; ++i) {
+    const AdultExample& example = GetExample(i);
+    inputs["age"].add_float_val(example.age);
+    inputs["workclass"].add_string_val(example.workclass);
+    inputs["education"].add_string_val(example.education);
+    inputs["hours_per_week"].add_float_val(example.hours_per_week);
+  }
+  return request;
+}
+
+// Returns the ClassificationRequest of 'batch_size' examples.
+ClassificationRequest MakeClassificationRequest(const int batch_size) {
+  ClassificationRequest request;
+  request.mutable_model_spec()->set_name(kModelName);
+  auto* examples =
+      request.mutable_input()->mutable_example_list()->mutable_examples();
+  for (int i = 0; i < batch_size; ++i) {
+    const AdultExample& example = GetExample(i);
+    auto& features = *examples->Add()->mutable_features()->mutable_feature();
+    features["age"].mutable_float_list()->add_value(example.age);
+    features["workclass"].mutable_bytes_list()->add_value(example.workclass);
+    features["education"].mutable_bytes_list()->add_value(example.education);
+    features["hours_per_week"].mutable_float_list()->add_value(
+        example.hours_per_week);
+  }
+  return request;
+}
+
+// A request issued by the benchmark. Must be thread-safe.
+using RequestFn = std::function<Status()>;
+
+// Returns the requests of the benchmarked 'api', one of:
+//   rest_predict: Predict through the REST API handler, in the row format.
+//   rest_classify: Classify through the REST API handler.
+//   predict: PredictRequest protos, sent to the servable.
+//   classify: ClassificationRequest protos, sent to the servable.
+// The gRPC API does not serve TF-DF servables, "predict" and "classify" run
+// what it would, after decoding the requests.
+Status MakeRequestFn(const string& api, const int batch_size, ServerCore* core,
+                     HttpRestApiHandler* handler, RequestFn* request_fn) {
+  if (api == "rest_predict" || api == "rest_classify") {
+    const bool predict = api == "rest_predict";
+    const string path = absl::StrCat("/v1/models/", kModelName,
+                                     predict ? ":predict" : ":classify");
+    const string body =
+        absl::StrCat(predict ? R"({"instances": )" : R"({"examples": )",
+                     MakeJsonExamples(batch_size), "}");
+    *request_fn = [handler, path, body]() {
+      std::vector<std::pair<string, string>> headers;
+      string model_name, method, output;
+      return handler->ProcessRequest("POST", path, body, &headers, &model_name,
+                                     &method, &output);
+    };
+  } else if (api == "predict") {
+    const PredictRequest request = MakePredictRequest(batch_size);
+    *request_fn = [core, request]() {
+      ServableHandle<TfdfServable> servable;
+      TF_RETURN_IF_ERROR(
+          core->GetServableHandle(request.model_spec(), &servable));
+      PredictResponse response;
+      return servable->Predict(request, &response);
+    };
+  } else if (api == "classify") {
+    const ClassificationRequest request = MakeClassificationRequest(batch_size);
+    *request_fn = [core, request]() {
+      ServableHandle<TfdfServable> servable;
+      TF_RETURN_IF_ERROR(
+          core->GetServableHandle(request.model_spec(), &servable));
+      ClassificationResponse response;
+      return servable->Classify(request, &response);
+    };
+  } else {
+    return errors::InvalidArgument("Unknown API: ", api);
+  }
+  // Checks the requests once, before they are benchmarked.
+  return (*request_fn)();
+}
+
+struct BenchmarkResult {
+  int64 num_requests = 0;
+  int64 num_errors = 0;
+  double seconds = 0;
+  int64 num_allocations = 0;
+  // Sorted latencies of the requests, in microseconds.
+  std::vector<uint64> latencies_micros;
+};
+
+// Sends requests from 'concurrency' threads for 'duration_seconds'. If 'qps'
+// is positive, the requests are paced to send 'qps' requests per second in
+// total, otherwise each thread sends them back to back.
+BenchmarkResult RunBenchmark(const RequestFn& request_fn, const int concurrency,
+                             const int qps, const int duration_seconds) {
+  const uint64 interval_micros =
+      qps > 0 ? static_cast<uint64>(1e6 * concurrency / qps) : 0;
+  const uint64 start_micros = EnvTime::NowMicros();
+  const uint64 end_micros = start_micros + duration_seconds * 1000000ULL;
+  const int64 start_allocations = num_allocations.load();
+
+  std::vector<std::vector<uint64>> thread_latencies(concurrency);
+  std::atomic<int64> num_errors(0);
+  {
+    std::vector<std::unique_ptr<Thread>> threads;
+    for (int i = 0; i < concurrency; ++i) {
+      std::vector<uint64>* latencies = &thread_latencies[i];
+      threads.emplace_back(Env::Default()->StartThread(
+          ThreadOptions(), absl::StrCat("benchmark_", i), [&, latencies, i]() {
+            // Staggers the threads over the interval.
+            uint64 next_micros =
+                start_micros + interval_micros * i / concurrency;
+            while (true) {
+              const uint64 now_micros = EnvTime::NowMicros();
+              if (now_micros >= end_micros) {
+                break;
+              }
+              if (next_micros > now_micros) {
+                Env::Default()->SleepForMicroseconds(next_micros - now_micros);
+              }
+              // Latencies are measured from the scheduled send time, so that
+              // a server falling behind the QPS shows in the percentiles.
+              const uint64 send_micros =
+                  interval_micros > 0 ? next_micros : EnvTime::NowMicros();
+              if (!request_fn().ok()) {
+                num_errors.fetch_add(1);
+              }
+              latencies->push_back(EnvTime::NowMicros() - send_micros);
+              next_micros += interval_micros;
+            }
+          }));
+    }
+  }
+
+  BenchmarkResult result;
+  result.seconds = (EnvTime::NowMicros() - start_micros) / 1e6;
+  result.num_allocations = num_allocations.load() - start_allocations;
+  for (auto& latencies : thread_latencies) {
+    result.latencies_micros.insert(result.latencies_micros.end(),
+                                   latencies.begin(), latencies.end());
+  }
+  std::sort(result.latencies_micros.begin(), result.latencies_micros.end());
+  result.num_requests = result.latencies_micros.size();
+  result.num_errors = num_errors.load();
+  return result;
+}
+
+uint64 Percentile(const std::vector<uint64>& sorted_values,
+                  const double percentile) {
+  if (sorted_values.empty()) {
+    return 0;
+  }
+  const size_t index = std::min<size_t>(
+      sorted_values.size() - 1,
+      static_cast<size_t>(percentile / 100 * sorted_values.size()));
+  return sorted_values[index];
+}
+
+std::vector<int> ParseIntList(const string& list) {
+  std::vector<int> values;
+  for (const absl::string_view value : absl::StrSplit(list, ',')) {
+    int parsed;
+    CHECK(absl::SimpleAtoi(value, &parsed)) << "Invalid integer: " << value;
+    values.push_back(parsed);
+  }
+  return values;
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
+
+int main(int argc, char** argv) {
+  using tensorflow::serving::BenchmarkResult;
+
+  tensorflow::string model_path = tensorflow::serving::DefaultModelPath();
+  tensorflow::string apis = "rest_predict,rest_classify,predict,classify";
+  tensorflow::string concurrency = "1,4,16";
+  tensorflow::string qps = "0";
+  tensorflow::int32 batch_size = 1;
+  tensorflow::int32 duration_seconds = 10;
+  std::vector<tensorflow::Flag> flag_list = {
+      tensorflow::Flag("model_path", &model_path,
+                       "Directory of the Yggdrasil model to serve."),
+      tensorflow::Flag("apis", &apis,
+                       "Comma separated APIs to benchmark, among "
+                       "rest_predict, rest_classify, predict and classify."),
+      tensorflow::Flag("concurrency", &concurrency,
+                       "Comma separated numbers of concurrent clients."),
+      tensorflow::Flag("qps", &qps,
+                       "Comma separated total QPS to send the requests at. "
+                       "0 sends the requests back to back."),
+      tensorflow::Flag("batch_size", &batch_size,
+                       "Number of examples per request."),
+      tensorflow::Flag("duration_seconds", &duration_seconds,
+                       "Duration of each benchmark.")};
+  const tensorflow::string usage =
+      tensorflow::Flags::Usage(argv[0], flag_list);
+  if (!tensorflow::Flags::Parse(&argc, argv, flag_list)) {
+    std::cout << usage;
+    return -1;
+  }
+  tensorflow::port::InitMain(argv[0], &argc, &argv);
+
+  tensorflow::string base_path;
+  TF_CHECK_OK(
+      tensorflow::serving::CreateServableBasePath(model_path, &base_path));
+  std::unique_ptr<tensorflow::serving::ServerCore> core;
+  TF_CHECK_OK(tensorflow::serving::CreateServerCore(base_path, &core));
+  tensorflow::serving::HttpRestApiHandler handler(tensorflow::RunOptions(),
+                                                  core.get());
+
+  std::cout << absl::StrFormat(
+      "%-14s %6s %6s %10s %10s %10s %10s %10s %10s %8s\n", "api", "conc",
+      "qps", "req/s", "p50(us)", "p90(us)", "p99(us)", "p99.9(us)",
+      "allocs/req", "errors");
+  for (const absl::string_view api : absl::StrSplit(apis, ',')) {
+    tensorflow::serving::RequestFn request_fn;
+    TF_CHECK_OK(tensorflow::serving::MakeRequestFn(
+        tensorflow::string(api), batch_size, core.get(), &handler,
+        &request_fn));
+    for (const int num_clients :
+         tensorflow::serving::ParseIntList(concurrency)) {
+      for (const int target_qps : tensorflow::serving::ParseIntList(qps)) {
+        const BenchmarkResult result = tensorflow::serving::RunBenchmark(
+            request_fn, num_clients, target_qps, duration_seconds);
+        const auto& latencies = result.latencies_micros;
+        std::cout << absl::StrFormat(
+            "%-14s %6d %6d %10.1f %10d %10d %10d %10d %10.1f %8d\n", api,
+            num_clients, target_qps, result.num_requests / result.seconds,
+            tensorflow::serving::Percentile(latencies, 50),
+            tensorflow::serving::Percentile(latencies, 90),
+            tensorflow::serving::Percentile(latencies, 99),
+            tensorflow::serving::Percentile(latencies, 99.9),
+            result.num_requests == 0
+                ? 0.0
+                : static_cast<double>(result.num_allocations) /
+                      result.num_requests,
+            result.num_errors);
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,147 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/model_servers/unix_socket_acceptor.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "grpcpp/server_posix.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace tensorflow {
+namespace serving {
+
+Status UnixSocketAcceptor::Create(
+    const string& path, std::unique_ptr<UnixSocketAcceptor>* acceptor) {
+  struct sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+    return errors::InvalidArgument("Invalid Unix socket path: ", path);
+  }
+  std::memcpy(address.sun_path, path.data(), path.size());
+
+  const int socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (socket_fd < 0) {
+    return errors::Internal("Failed to create a Unix socket: ",
+                            strerror(errno));
+  }
+  // As gRPC does, the socket of a previous server is replaced.
+  unlink(path.c_str());
+  if (bind(socket_fd, reinterpret_cast<const struct sockaddr*>(&address),
+           sizeof(address)) != 0 ||
+      listen(socket_fd, SOMAXCONN) != 0) {
+    const int bind_errno = errno;
+    close(socket_fd);
+    return errors::Internal("Failed to listen on Unix socket ", path, ": ",
+                            strerror(bind_errno));
+  }
+  acceptor->reset(new UnixSocketAcceptor(path, socket_fd));
+  return Status::OK();
+}
+
+UnixSocketAcceptor::UnixSocketAcceptor(const string& path, const int socket_fd)
+    : path_(path), socket_fd_(socket_fd) {}
+
+UnixSocketAcceptor::~UnixSocketAcceptor() { Stop(); }
+
+void UnixSocketAcceptor::Start(::grpc::Server* server) {
+  mutex_lock l(mu_);
+  if (stopped_) {
+    return;
+  }
+  accept_thread_.reset(Env::Default()->StartThread(
+      {}, "unix_socket_acceptor",
+      [this, server]() { AcceptConnections(server); }));
+}
+
+void UnixSocketAcceptor::Stop() {
+  std::unique_ptr<Thread> accept_thread;
+  {
+    mutex_lock l(mu_);
+    if (stopped_) {
+      return;
+    }
+    stopped_ = true;
+    accept_thread = std::move(accept_thread_);
+  }
+  // Wakes up the accept() of the thread.
+  shutdown(socket_fd_, SHUT_RDWR);
+  accept_thread.reset();
+  close(socket_fd_);
+}
+
+void UnixSocketAcceptor::AcceptConnections(::grpc::Server* server) {
+  while (true) {
+    const int fd = accept4(socket_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      mutex_lock l(mu_);
+      if (!stopped_) {
+        LOG(ERROR) << "Stopped accepting connections on Unix socket " << path_
+                   << ": " << strerror(errno);
+      }
+      return;
+    }
+    struct ucred ucred;
+    socklen_t ucred_size = sizeof(ucred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &ucred, &ucred_size) != 0) {
+      LOG(WARNING) << "Failed to get the credentials of a peer of Unix socket "
+                   << path_ << ": " << strerror(errno);
+      close(fd);
+      continue;
+    }
+    {
+      mutex_lock l(mu_);
+      if (stopped_) {
+        close(fd);
+        return;
+      }
+      Credentials& credentials = peers_[fd];
+      credentials.pid = ucred.pid;
+      credentials.uid = ucred.uid;
+    }
+    ::grpc::AddInsecureChannelFromFd(server, fd);
+  }
+}
+
+bool UnixSocketAcceptor::GetPeerCredentials(absl::string_view peer,
+                                            Credentials* credentials) const {
+  int fd;
+  if (!absl::ConsumePrefix(&peer, "fd:") || !absl::SimpleAtoi(peer, &fd)) {
+    return false;
+  }
+  mutex_lock l(mu_);
+  const auto it = peers_.find(fd);
+  if (it == peers_.end()) {
+    return false;
+  }
+  *credentials = it->second;
+  return true;
+}
+
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,105 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_MODEL_SERVERS_UNIX_SOCKET_ACCEPTOR_H_
+#define TENSORFLOW_SERVING_MODEL_SERVERS_UNIX_SOCKET_ACCEPTOR_H_
+
+#include <sys/types.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "absl/strings/string_view.h"
+#include "grpcpp/server.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace serving {
+
+// Accepts the connections of a Unix socket for a gRPC server, and records the
+// credentials of the process at the other end of each (SO_PEERCRED), which
+// gRPC does not expose.
+//
+// The connections are handed to the server with
+// ::grpc::AddInsecureChannelFromFd(), so that the peer of their calls, i.e.
+// ServerContext::peer(), is "fd:<fd>", by which GetPeerCredentials() finds
+// them.
+//
+// Usage:
+//   std::unique_ptr<UnixSocketAcceptor> acceptor;
+//   TF_RETURN_IF_ERROR(UnixSocketAcceptor::Create(path, &acceptor));
+//   server = builder.BuildAndStart();
+//   acceptor->Start(server.get());
+//   ...
+//   acceptor->Stop();
+//   server->Shutdown();
+class UnixSocketAcceptor {
+ public:
+  // The credentials of a peer process.
+  struct Credentials {
+    pid_t pid = -1;
+    uid_t uid = static_cast<uid_t>(-1);
+  };
+
+  // Listens on the Unix socket at 'path', replacing the file there if any.
+  static Status Create(const string& path,
+                       std::unique_ptr<UnixSocketAcceptor>* acceptor);
+
+  // Stops accepting connections.
+  ~UnixSocketAcceptor();
+
+  // Starts accepting the connections for 'server', which must outlive the
+  // acceptor or Stop(). Must be called once.
+  void Start(::grpc::Server* server);
+
+  // Stops accepting connections, and closes the socket. The credentials of
+  // the connections already accepted are kept. Idempotent.
+  void Stop();
+
+  // Returns the credentials of the process at the other end of the
+  // connection of a call, whose peer is 'peer', or false if the connection
+  // was not accepted by this acceptor.
+  bool GetPeerCredentials(absl::string_view peer,
+                          Credentials* credentials) const;
+
+ private:
+  UnixSocketAcceptor(const string& path, int socket_fd);
+
+  // Accepts the connections until Stop().
+  void AcceptConnections(::grpc::Server* server);
+
+  const string path_;
+  const int socket_fd_;
+
+  mutable mutex mu_;
+  bool stopped_ TF_GUARDED_BY(mu_) = false;
+  std::unique_ptr<Thread> accept_thread_ TF_GUARDED_BY(mu_);
+  // The credentials of the peers, by file descriptor of their connection. An
+  // entry is replaced when its file descriptor is reused by a new connection.
+  std::unordered_map<int, Credentials> peers_ TF_GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(UnixSocketAcceptor);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_MODEL_SERVERS_UNIX_SOCKET_ACCEPTOR_H_
@@ -0,0 +1,99 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/resources/numa_placement.h"
+
+#include <algorithm>
+
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow_serving/util/cpu_affinity.h"
+
+namespace tensorflow {
+namespace serving {
+
+NumaPlacement* NumaPlacement::Get() {
+  static NumaPlacement* placement = new NumaPlacement();
+  return placement;
+}
+
+void NumaPlacement::Enable() {
+  const int num_nodes = port::NUMAEnabled() ? port::NUMANumNodes() : 1;
+  if (num_nodes <= 1) {
+    LOG(WARNING) << "NUMA-aware placement of the models requested, but the "
+                    "machine has a single NUMA node or TensorFlow is built "
+                    "without NUMA support";
+    return;
+  }
+  mutex_lock l(mu_);
+  if (placed_ram_bytes_.empty()) {
+    LOG(INFO) << "Placing the models on " << num_nodes << " NUMA nodes";
+    placed_ram_bytes_.assign(num_nodes, 0);
+  }
+}
+
+bool NumaPlacement::enabled() const {
+  mutex_lock l(mu_);
+  return !placed_ram_bytes_.empty();
+}
+
+int NumaPlacement::num_nodes() const {
+  mutex_lock l(mu_);
+  return std::max<int>(placed_ram_bytes_.size(), 1);
+}
+
+int NumaPlacement::Place(const uint64 ram_bytes) {
+  mutex_lock l(mu_);
+  if (placed_ram_bytes_.empty()) {
+    return port::kNUMANoAffinity;
+  }
+  const int node =
+      std::min_element(placed_ram_bytes_.begin(), placed_ram_bytes_.end()) -
+      placed_ram_bytes_.begin();
+  placed_ram_bytes_[node] += ram_bytes;
+  return node;
+}
+
+void NumaPlacement::Remove(const int node, const uint64 ram_bytes) {
+  mutex_lock l(mu_);
+  if (node < 0 || node >= placed_ram_bytes_.size()) {
+    return;
+  }
+  placed_ram_bytes_[node] -= std::min(placed_ram_bytes_[node], ram_bytes);
+}
+
+ScopedNumaNodeAffinity::ScopedNumaNodeAffinity(const int node) {
+  if (node == port::kNUMANoAffinity) {
+    return;
+  }
+  // Note: The exact CPUs are restored. The previous node, if any, would not
+  // restore the affinity of a thread pinned to CPUs of several nodes (e.g.
+  // not pinned at all), and port::NUMASetThreadNodeAffinity() cannot unpin.
+  previous_cpus_ = GetCurrentThreadCpus();
+  if (previous_cpus_.empty()) {
+    LOG(WARNING) << "Not binding the thread to NUMA node " << node
+                 << ": its CPU affinity could not be restored";
+    return;
+  }
+  port::NUMASetThreadNodeAffinity(node);
+}
+
+ScopedNumaNodeAffinity::~ScopedNumaNodeAffinity() {
+  if (!previous_cpus_.empty()) {
+    PinCurrentThread(previous_cpus_);
+  }
+}
+
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,97 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_RESOURCES_NUMA_PLACEMENT_H_
+#define TENSORFLOW_SERVING_RESOURCES_NUMA_PLACEMENT_H_
+
+#include <vector>
+
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/numa.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace serving {
+
+// Places the servables of the process on the NUMA nodes of the machine, so
+// that each servable keeps its memory, and the threads reading it, on one
+// node.
+//
+// The placement is disabled unless enabled with Enable(), e.g. by ServerCore
+// (see ServerCore::Options::numa_aware_model_placement), or if the machine
+// has a single NUMA node or TensorFlow is built without NUMA support. The
+// main memory is then tracked as one instance of the "main" device per node,
+// and the servables placed on a node bind their memory estimate to that
+// instance once loaded.
+//
+// A servable is placed on the node with the least memory placed on it, when
+// it starts loading. Its memory is allocated on that node by the thread
+// loading it, within a ScopedNumaNodeAffinity.
+//
+// This class is thread safe.
+class NumaPlacement {
+ public:
+  // The placement of the process.
+  static NumaPlacement* Get();
+
+  // Enables the placement, if the machine has several NUMA nodes. Must be
+  // called before the first servable is placed.
+  void Enable();
+
+  // Whether the servables are placed on NUMA nodes.
+  bool enabled() const;
+
+  // Number of NUMA nodes the servables are placed on, 1 if disabled.
+  int num_nodes() const;
+
+  // Places a servable using about 'ram_bytes' of memory, and returns its node,
+  // or port::kNUMANoAffinity if disabled.
+  int Place(uint64 ram_bytes);
+
+  // Removes a servable placed by Place() on 'node'.
+  void Remove(int node, uint64 ram_bytes);
+
+ private:
+  NumaPlacement() = default;
+
+  mutable mutex mu_;
+  // The memory placed on each node, empty if disabled.
+  std::vector<uint64> placed_ram_bytes_ TF_GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(NumaPlacement);
+};
+
+// Binds the calling thread to a NUMA node for its scope, so that the memory
+// it allocates and first touches lives on that node, then restores its CPU
+// affinity. Does nothing for port::kNUMANoAffinity, and on the platforms
+// where the CPU affinity cannot be restored (see GetCurrentThreadCpus()).
+class ScopedNumaNodeAffinity {
+ public:
+  explicit ScopedNumaNodeAffinity(int node);
+  ~ScopedNumaNodeAffinity();
+
+ private:
+  // The CPUs restored by the destructor, empty if not bound.
+  std::vector<int> previous_cpus_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ScopedNumaNodeAffinity);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_RESOURCES_NUMA_PLACEMENT_H_
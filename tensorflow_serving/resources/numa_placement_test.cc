@@ -0,0 +1,72 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/resources/numa_placement.h"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+#include "tensorflow/core/platform/numa.h"
+#include "tensorflow_serving/util/cpu_affinity.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+// Runs before NumaPlacementTest.Enabled, as the placement is per process.
+TEST(NumaPlacementTest, Disabled) {
+  NumaPlacement* placement = NumaPlacement::Get();
+  EXPECT_FALSE(placement->enabled());
+  EXPECT_EQ(placement->num_nodes(), 1);
+  EXPECT_EQ(placement->Place(1024), port::kNUMANoAffinity);
+  placement->Remove(port::kNUMANoAffinity, 1024);
+}
+
+TEST(NumaPlacementTest, Enabled) {
+  NumaPlacement* placement = NumaPlacement::Get();
+  placement->Enable();
+  if (!placement->enabled()) {
+    // Single node machine, or no NUMA support.
+    EXPECT_EQ(placement->num_nodes(), 1);
+    return;
+  }
+  ASSERT_GT(placement->num_nodes(), 1);
+  // The servables are spread on the nodes with the least memory.
+  const int first_node = placement->Place(1000);
+  const int second_node = placement->Place(10);
+  EXPECT_NE(first_node, second_node);
+  EXPECT_NE(placement->Place(10), first_node);
+  placement->Remove(first_node, 1000);
+  EXPECT_EQ(placement->Place(1), first_node);
+}
+
+TEST(ScopedNumaNodeAffinityTest, NoAffinity) {
+  const int node = port::NUMAGetThreadNodeAffinity();
+  {
+    ScopedNumaNodeAffinity affinity(port::kNUMANoAffinity);
+    EXPECT_EQ(port::NUMAGetThreadNodeAffinity(), node);
+  }
+  EXPECT_EQ(port::NUMAGetThreadNodeAffinity(), node);
+}
+
+TEST(ScopedNumaNodeAffinityTest, RestoresTheCpuAffinity) {
+  const std::vector<int> cpus = GetCurrentThreadCpus();
+  { ScopedNumaNodeAffinity affinity(0); }
+  EXPECT_EQ(GetCurrentThreadCpus(), cpus);
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
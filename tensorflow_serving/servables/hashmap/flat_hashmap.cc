@@ -0,0 +1,258 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/servables/hashmap/flat_hashmap.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_set>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include "tensorflow/core/lib/core/coding.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/hash.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/prefetch.h"
+
+namespace tensorflow {
+namespace serving {
+
+namespace {
+
+constexpr char kMagic[] = "TFSFHMAP";
+constexpr int kMagicSize = 8;
+constexpr int kHeaderSize = kMagicSize + 3 * sizeof(uint64);
+constexpr int kBucketSize = sizeof(uint64);
+constexpr int kOffsetBits = 40;
+constexpr uint64 kOffsetMask = (uint64{1} << kOffsetBits) - 1;
+constexpr uint64 kSeed = 0xdecafcaffe;
+
+// The bucket a key of hash 'hash' is first probed at.
+uint64 FirstBucket(const uint64 hash, const uint64 num_buckets) {
+  // Maps the low 32 bits onto [0, num_buckets) without a division.
+  return ((hash & 0xffffffff) * num_buckets) >> 32;
+}
+
+// The bits of the hash stored in the buckets, to skip most of the entries of
+// other keys without reading them.
+uint64 HashTag(const uint64 hash) { return hash >> kOffsetBits; }
+
+}  // namespace
+
+Status FlatHashmap::Load(const string& path,
+                         std::unique_ptr<FlatHashmap>* map) {
+  std::unique_ptr<FlatHashmap> new_map(new FlatHashmap());
+  TF_RETURN_IF_ERROR(
+      Env::Default()->NewReadOnlyMemoryRegionFromFile(path, &new_map->region_));
+  new_map->data_ = static_cast<const char*>(new_map->region_->data());
+  new_map->data_size_ = new_map->region_->length();
+  TF_RETURN_IF_ERROR(new_map->ParseHeader(path));
+  *map = std::move(new_map);
+  return Status::OK();
+}
+
+Status FlatHashmap::Read(const string& path,
+                         std::unique_ptr<FlatHashmap>* map) {
+  std::unique_ptr<FlatHashmap> new_map(new FlatHashmap());
+  uint64 file_size;
+  TF_RETURN_IF_ERROR(Env::Default()->GetFileSize(path, &file_size));
+  std::unique_ptr<RandomAccessFile> file;
+  TF_RETURN_IF_ERROR(Env::Default()->NewRandomAccessFile(path, &file));
+  // Sized for the table alone, which is a block of its own.
+  new_map->arena_.reset(new ServableArena(/*block_size=*/0));
+  char* const data =
+      static_cast<char*>(new_map->arena_->Allocate(file_size));
+  if (data == nullptr) {
+    return errors::ResourceExhausted("Failed to allocate ", file_size,
+                                     " bytes to read the flat hashmap ", path);
+  }
+  StringPiece result;
+  TF_RETURN_IF_ERROR(file->Read(0, file_size, &result, data));
+  if (result.data() != data) {
+    memcpy(data, result.data(), result.size());
+  }
+  new_map->data_ = data;
+  new_map->data_size_ = result.size();
+  TF_RETURN_IF_ERROR(new_map->ParseHeader(path));
+  *map = std::move(new_map);
+  return Status::OK();
+}
+
+Status FlatHashmap::ParseHeader(const string& path) {
+  if (data_size_ < kHeaderSize || memcmp(data_, kMagic, kMagicSize) != 0) {
+    return errors::DataLoss("Not a flat hashmap file: ", path);
+  }
+  const char* header = data_ + kMagicSize;
+  num_entries_ = core::DecodeFixed64(header);
+  num_buckets_ = core::DecodeFixed64(header + sizeof(uint64));
+  seed_ = core::DecodeFixed64(header + 2 * sizeof(uint64));
+  if (num_buckets_ == 0 || num_buckets_ > 0xffffffff ||
+      num_entries_ >= num_buckets_ ||
+      num_buckets_ > (data_size_ - kHeaderSize) / kBucketSize) {
+    return errors::DataLoss("Corrupted flat hashmap header in file: ", path);
+  }
+  buckets_ = data_ + kHeaderSize;
+  return Status::OK();
+}
+
+void FlatHashmap::Prefault() const {
+#if defined(__linux__)
+  // Starts the read-ahead of the whole file.
+  madvise(const_cast<char*>(data_), data_size_, MADV_WILLNEED);
+#endif
+  // Note: The reads are volatile so they are not optimized out.
+  constexpr uint64 kPageSize = 4096;
+  const volatile char* const data = data_;
+  for (uint64 offset = 0; offset < data_size_; offset += kPageSize) {
+    data[offset];
+  }
+  VLOG(2) << "Prefaulted flat hashmap (" << data_size_ << " bytes)";
+}
+
+bool FlatHashmap::Find(const StringPiece key, StringPiece* value) const {
+  return FindWithHash(key, Hash64(key.data(), key.size(), seed_), value);
+}
+
+bool FlatHashmap::FindWithHash(const StringPiece key, const uint64 hash,
+                               StringPiece* value) const {
+  const uint64 tag = HashTag(hash);
+  uint64 bucket = FirstBucket(hash, num_buckets_);
+  // The table always has an empty bucket to end the probing.
+  for (uint64 i = 0; i < num_buckets_; ++i) {
+    const uint64 entry = core::DecodeFixed64(buckets_ + bucket * kBucketSize);
+    if (entry == 0) {
+      return false;
+    }
+    if ((entry >> kOffsetBits) == tag) {
+      const uint64 offset = entry & kOffsetMask;
+      if (offset >= data_size_) {
+        return false;
+      }
+      const char* const limit = data_ + data_size_;
+      uint32 key_size;
+      uint32 value_size;
+      const char* p = core::GetVarint32Ptr(data_ + offset, limit, &key_size);
+      if (p != nullptr) {
+        p = core::GetVarint32Ptr(p, limit, &value_size);
+      }
+      if (p == nullptr ||
+          static_cast<uint64>(limit - p) <
+              static_cast<uint64>(key_size) + value_size) {
+        return false;
+      }
+      if (StringPiece(p, key_size) == key) {
+        *value = StringPiece(p + key_size, value_size);
+        return true;
+      }
+    }
+    bucket = bucket + 1 == num_buckets_ ? 0 : bucket + 1;
+  }
+  return false;
+}
+
+const char* FlatHashmap::FirstCandidate(const uint64 hash) const {
+  const uint64 entry = core::DecodeFixed64(
+      buckets_ + FirstBucket(hash, num_buckets_) * kBucketSize);
+  if (entry == 0 || (entry >> kOffsetBits) != HashTag(hash) ||
+      (entry & kOffsetMask) >= data_size_) {
+    return nullptr;
+  }
+  return data_ + (entry & kOffsetMask);
+}
+
+void FlatHashmap::FindBatch(const gtl::ArraySlice<StringPiece> keys,
+                            StringPiece* values, bool* found) const {
+  // Enough lookups in flight to cover the memory latency, few enough for
+  // their cache lines to stay in L1.
+  constexpr int kGroupSize = 16;
+  uint64 hashes[kGroupSize];
+  for (size_t begin = 0; begin < keys.size(); begin += kGroupSize) {
+    const int group_size = std::min<size_t>(kGroupSize, keys.size() - begin);
+    // The hashes do not depend on each other, nor on the table.
+    for (int i = 0; i < group_size; ++i) {
+      const StringPiece key = keys[begin + i];
+      hashes[i] = Hash64(key.data(), key.size(), seed_);
+      port::prefetch<port::PREFETCH_HINT_T0>(
+          buckets_ + FirstBucket(hashes[i], num_buckets_) * kBucketSize);
+    }
+    for (int i = 0; i < group_size; ++i) {
+      if (const char* entry = FirstCandidate(hashes[i])) {
+        port::prefetch<port::PREFETCH_HINT_T0>(entry);
+      }
+    }
+    for (int i = 0; i < group_size; ++i) {
+      const size_t k = begin + i;
+      found[k] = FindWithHash(keys[k], hashes[i], &values[k]);
+    }
+  }
+}
+
+Status WriteFlatHashmap(const std::vector<std::pair<string, string>>& entries,
+                        const string& path) {
+  // A load factor of at most 0.75 keeps the probe sequences short.
+  const uint64 num_buckets = entries.size() + entries.size() / 3 + 1;
+  if (num_buckets > 0xffffffff) {
+    return errors::InvalidArgument("Too many entries for a flat hashmap: ",
+                                   entries.size());
+  }
+  const uint64 data_offset = kHeaderSize + num_buckets * kBucketSize;
+  std::vector<uint64> buckets(num_buckets, 0);
+  string data;
+  std::unordered_set<StringPiece, StringPieceHasher> keys;
+  for (const auto& entry : entries) {
+    const string& key = entry.first;
+    if (!keys.insert(key).second) {
+      continue;
+    }
+    const uint64 offset = data_offset + data.size();
+    if (offset > kOffsetMask) {
+      return errors::InvalidArgument(
+          "The entries are too large for a flat hashmap");
+    }
+    const uint64 hash = Hash64(key.data(), key.size(), kSeed);
+    uint64 bucket = FirstBucket(hash, num_buckets);
+    while (buckets[bucket] != 0) {
+      bucket = bucket + 1 == num_buckets ? 0 : bucket + 1;
+    }
+    buckets[bucket] = (HashTag(hash) << kOffsetBits) | offset;
+    core::PutVarint32(&data, key.size());
+    core::PutVarint32(&data, entry.second.size());
+    data.append(key);
+    data.append(entry.second);
+  }
+
+  string header(kMagic, kMagicSize);
+  core::PutFixed64(&header, keys.size());
+  core::PutFixed64(&header, num_buckets);
+  core::PutFixed64(&header, kSeed);
+  string encoded_buckets;
+  encoded_buckets.reserve(num_buckets * kBucketSize);
+  for (const uint64 bucket : buckets) {
+    core::PutFixed64(&encoded_buckets, bucket);
+  }
+
+  std::unique_ptr<WritableFile> file;
+  TF_RETURN_IF_ERROR(Env::Default()->NewWritableFile(path, &file));
+  TF_RETURN_IF_ERROR(file->Append(header));
+  TF_RETURN_IF_ERROR(file->Append(encoded_buckets));
+  TF_RETURN_IF_ERROR(file->Append(data));
+  return file->Close();
+}
+
+}  // namespace serving
+}  // namespace tensorflow
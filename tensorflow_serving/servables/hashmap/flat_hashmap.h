@@ -0,0 +1,122 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_SERVABLES_HASHMAP_FLAT_HASHMAP_H_
+#define TENSORFLOW_SERVING_SERVABLES_HASHMAP_FLAT_HASHMAP_H_
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/stringpiece.h"
+#include "tensorflow/core/lib/gtl/array_slice.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow_serving/util/servable_arena.h"
+
+namespace tensorflow {
+namespace serving {
+
+// A read-only string-string hashmap served from a memory-mapped file, without
+// parsing it nor allocating per entry: loading a table maps its file, and the
+// pages are read on demand, shared between processes, and reclaimable by the
+// kernel.
+//
+// The file is an open addressing hash table with linear probing, at a load
+// factor of at most 0.75. All integers are little endian:
+//   header:  "TFSFHMAP" magic, then uint64 num_entries, num_buckets, seed.
+//   buckets: num_buckets uint64, each 0 if empty, else the offset of its entry
+//            in the file (low 40 bits) and the high 24 bits of the hash of the
+//            key.
+//   entries: varint32 key size, varint32 value size, key bytes, value bytes.
+// The hash of a key is Hash64(key, seed). A lookup reads its 8 bytes bucket,
+// usually followed by the neighbouring ones in the same cache line, and the
+// entry of the matching hash: one or two cache misses.
+//
+// Files are written with WriteFlatHashmap().
+class FlatHashmap {
+ public:
+  // Maps the table of the file 'path'. Only the header and the bounds of the
+  // tables are checked, the entries are checked as they are looked up.
+  static Status Load(const string& path, std::unique_ptr<FlatHashmap>* map);
+
+  // Same as Load(), but reads the file into the arena of the map instead of
+  // mapping it: the entries stay resident, and their memory is all freed at
+  // once with the map.
+  static Status Read(const string& path, std::unique_ptr<FlatHashmap>* map);
+
+  ~FlatHashmap() = default;
+
+  // Looks up 'key'. On success, sets 'value' to the value, which points into
+  // the mapped file and is valid as long as this object.
+  bool Find(StringPiece key, StringPiece* value) const;
+
+  // Looks up 'keys' as Find(), setting 'values[i]' and 'found[i]' for each
+  // 'keys[i]'. The lookups are interleaved: the keys are hashed, then their
+  // buckets and entries are prefetched, a group at a time, so that the cache
+  // misses of the keys of a group overlap instead of adding up.
+  void FindBatch(gtl::ArraySlice<StringPiece> keys, StringPiece* values,
+                 bool* found) const;
+
+  // Number of entries.
+  uint64 size() const { return num_entries_; }
+
+  // The heap memory of a map created with Read(), else 0.
+  uint64 heap_bytes() const {
+    return arena_ == nullptr ? 0 : arena_->allocated_bytes();
+  }
+
+  // Reads the whole file, so that its pages are faulted in. The CPU caches are
+  // not warmed: the lookups run on other cores than the loading thread.
+  void Prefault() const;
+
+ private:
+  FlatHashmap() = default;
+
+  // Checks the header of the table of 'data_', read from 'path'.
+  Status ParseHeader(const string& path);
+
+  // Looks up 'key' of hash 'hash' from its first bucket.
+  bool FindWithHash(StringPiece key, uint64 hash, StringPiece* value) const;
+
+  // Returns the address of the entry of the first bucket probed for a key of
+  // hash 'hash' if its tag matches, else null.
+  const char* FirstCandidate(uint64 hash) const;
+
+  // One of them holds the table.
+  std::unique_ptr<ReadOnlyMemoryRegion> region_;
+  std::unique_ptr<ServableArena> arena_;
+  const char* data_ = nullptr;
+  uint64 data_size_ = 0;
+  uint64 num_entries_ = 0;
+  uint64 num_buckets_ = 0;
+  uint64 seed_ = 0;
+  const char* buckets_ = nullptr;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(FlatHashmap);
+};
+
+// Writes 'entries' to a FlatHashmap file at 'path'. For duplicate keys, the
+// first entry is kept.
+Status WriteFlatHashmap(const std::vector<std::pair<string, string>>& entries,
+                        const string& path);
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_SERVABLES_HASHMAP_FLAT_HASHMAP_H_
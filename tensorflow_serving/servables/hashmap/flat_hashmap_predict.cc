@@ -0,0 +1,100 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/servables/hashmap/flat_hashmap_predict.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/lib/core/errors.h"
+
+namespace tensorflow {
+namespace serving {
+
+const google::protobuf::Map<string, TensorInfo>& FlatHashmapPredictInputs() {
+  static const auto* const inputs = []() {
+    auto* inputs = new google::protobuf::Map<string, TensorInfo>();
+    TensorInfo& keys = (*inputs)[kFlatHashmapKeysInput];
+    keys.set_name(kFlatHashmapKeysInput);
+    keys.set_dtype(DT_STRING);
+    keys.mutable_tensor_shape()->set_unknown_rank(true);
+    return inputs;
+  }();
+  return *inputs;
+}
+
+Status FlatHashmapPredict(const FlatHashmap& hashmap,
+                          const PredictRequest& request,
+                          PredictResponse* response) {
+  bool output_values = request.output_filter().empty();
+  bool output_found = request.output_filter().empty();
+  for (const string& output : request.output_filter()) {
+    if (output == kFlatHashmapValuesOutput) {
+      output_values = true;
+    } else if (output == kFlatHashmapFoundOutput) {
+      output_found = true;
+    } else {
+      return errors::InvalidArgument("Unknown output \"", output,
+                                     "\". The hashmap outputs are \"",
+                                     kFlatHashmapValuesOutput, "\" and \"",
+                                     kFlatHashmapFoundOutput, "\"");
+    }
+  }
+  if (request.inputs().size() != 1 ||
+      request.inputs().count(kFlatHashmapKeysInput) == 0) {
+    return errors::InvalidArgument("The request should have a single input \"",
+                                   kFlatHashmapKeysInput, "\"");
+  }
+  Tensor keys;
+  if (!keys.FromProto(request.inputs().at(kFlatHashmapKeysInput)) ||
+      keys.dtype() != DT_STRING) {
+    return errors::InvalidArgument("The input \"", kFlatHashmapKeysInput,
+                                   "\" should be a string tensor");
+  }
+
+  const auto flat_keys = keys.flat<tstring>();
+  const int64 num_keys = flat_keys.size();
+  std::vector<StringPiece> key_pieces;
+  key_pieces.reserve(num_keys);
+  for (int64 i = 0; i < num_keys; ++i) {
+    key_pieces.emplace_back(flat_keys(i));
+  }
+  std::vector<StringPiece> values(num_keys);
+  std::unique_ptr<bool[]> found(new bool[num_keys]);
+  hashmap.FindBatch(key_pieces, values.data(), found.get());
+
+  if (output_values) {
+    Tensor values_tensor(DT_STRING, keys.shape());
+    auto flat_values = values_tensor.flat<tstring>();
+    for (int64 i = 0; i < num_keys; ++i) {
+      flat_values(i).assign(values[i].data(), values[i].size());
+    }
+    values_tensor.AsProtoField(
+        &(*response->mutable_outputs())[kFlatHashmapValuesOutput]);
+  }
+  if (output_found) {
+    Tensor found_tensor(DT_BOOL, keys.shape());
+    std::copy(found.get(), found.get() + num_keys,
+              found_tensor.flat<bool>().data());
+    found_tensor.AsProtoTensorContent(
+        &(*response->mutable_outputs())[kFlatHashmapFoundOutput]);
+  }
+  return Status::OK();
+}
+
+}  // namespace serving
+}  // namespace tensorflow
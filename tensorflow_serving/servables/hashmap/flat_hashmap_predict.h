@@ -0,0 +1,52 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_SERVABLES_HASHMAP_FLAT_HASHMAP_PREDICT_H_
+#define TENSORFLOW_SERVING_SERVABLES_HASHMAP_FLAT_HASHMAP_PREDICT_H_
+
+#include "google/protobuf/map.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/protobuf/meta_graph.pb.h"
+#include "tensorflow_serving/apis/predict.pb.h"
+#include "tensorflow_serving/servables/hashmap/flat_hashmap.h"
+
+namespace tensorflow {
+namespace serving {
+
+// The Predict API of the FlatHashmap servables, to look up features next to
+// the models that use them instead of in a separate key-value service.
+//
+// The request has a single string input, kFlatHashmapKeysInput, of any shape.
+// The response has two outputs of the same shape: kFlatHashmapValuesOutput,
+// the string values of the keys (empty for missing keys), and
+// kFlatHashmapFoundOutput, a bool tensor telling which keys were found. The
+// output filter of the request, if any, selects among them.
+constexpr char kFlatHashmapKeysInput[] = "keys";
+constexpr char kFlatHashmapValuesOutput[] = "values";
+constexpr char kFlatHashmapFoundOutput[] = "found";
+
+// Description of the inputs of FlatHashmapPredict(), e.g. to parse JSON
+// requests.
+const google::protobuf::Map<string, TensorInfo>& FlatHashmapPredictInputs();
+
+// Looks up the keys of 'request' in 'hashmap', with FindBatch().
+Status FlatHashmapPredict(const FlatHashmap& hashmap,
+                          const PredictRequest& request,
+                          PredictResponse* response);
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_SERVABLES_HASHMAP_FLAT_HASHMAP_PREDICT_H_
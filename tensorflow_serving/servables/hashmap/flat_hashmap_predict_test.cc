@@ -0,0 +1,99 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/servables/hashmap/flat_hashmap_predict.h"
+
+#include <memory>
+
+#include <gtest/gtest.h>
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+class FlatHashmapPredictTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    const string file = io::JoinPath(testing::TmpDir(), "FlatHashmapPredict");
+    TF_ASSERT_OK(WriteFlatHashmap({{"a", "apple"}, {"b", "banana"}}, file));
+    TF_ASSERT_OK(FlatHashmap::Load(file, &hashmap_));
+  }
+
+  std::unique_ptr<FlatHashmap> hashmap_;
+};
+
+TEST_F(FlatHashmapPredictTest, LooksUpKeys) {
+  PredictRequest request;
+  test::AsTensor<tstring>({"a", "c", "b", "a"}, TensorShape({2, 2}))
+      .AsProtoField(&(*request.mutable_inputs())[kFlatHashmapKeysInput]);
+  PredictResponse response;
+  TF_ASSERT_OK(FlatHashmapPredict(*hashmap_, request, &response));
+
+  ASSERT_EQ(2, response.outputs().size());
+  Tensor values;
+  ASSERT_TRUE(
+      values.FromProto(response.outputs().at(kFlatHashmapValuesOutput)));
+  test::ExpectTensorEqual<tstring>(
+      values, test::AsTensor<tstring>({"apple", "", "banana", "apple"},
+                                      TensorShape({2, 2})));
+  Tensor found;
+  ASSERT_TRUE(found.FromProto(response.outputs().at(kFlatHashmapFoundOutput)));
+  test::ExpectTensorEqual<bool>(
+      found,
+      test::AsTensor<bool>({true, false, true, true}, TensorShape({2, 2})));
+}
+
+TEST_F(FlatHashmapPredictTest, FiltersOutputs) {
+  PredictRequest request;
+  test::AsTensor<tstring>({"a"}).AsProtoField(
+      &(*request.mutable_inputs())[kFlatHashmapKeysInput]);
+  request.add_output_filter(kFlatHashmapFoundOutput);
+  PredictResponse response;
+  TF_ASSERT_OK(FlatHashmapPredict(*hashmap_, request, &response));
+  ASSERT_EQ(1, response.outputs().size());
+  EXPECT_EQ(1, response.outputs().count(kFlatHashmapFoundOutput));
+
+  request.add_output_filter("unknown");
+  EXPECT_EQ(error::INVALID_ARGUMENT,
+            FlatHashmapPredict(*hashmap_, request, &response).code());
+}
+
+TEST_F(FlatHashmapPredictTest, RejectsInvalidInputs) {
+  PredictResponse response;
+  PredictRequest request;
+  EXPECT_EQ(error::INVALID_ARGUMENT,
+            FlatHashmapPredict(*hashmap_, request, &response).code());
+
+  test::AsTensor<int>({1}).AsProtoField(
+      &(*request.mutable_inputs())[kFlatHashmapKeysInput]);
+  EXPECT_EQ(error::INVALID_ARGUMENT,
+            FlatHashmapPredict(*hashmap_, request, &response).code());
+
+  test::AsTensor<tstring>({"a"}).AsProtoField(
+      &(*request.mutable_inputs())[kFlatHashmapKeysInput]);
+  test::AsTensor<tstring>({"a"}).AsProtoField(
+      &(*request.mutable_inputs())["other"]);
+  EXPECT_EQ(error::INVALID_ARGUMENT,
+            FlatHashmapPredict(*hashmap_, request, &response).code());
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,109 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/servables/hashmap/flat_hashmap_source_adapter.h"
+
+#include <memory>
+
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow_serving/resources/resource_values.h"
+
+namespace tensorflow {
+namespace serving {
+
+namespace {
+
+using Adapter = SimpleLoaderSourceAdapter<StoragePath, FlatHashmap>;
+
+string GetFilePath(const FlatHashmapSourceAdapterConfig& config,
+                   const StoragePath& path) {
+  return config.file_name().empty() ? path
+                                    : io::JoinPath(path, config.file_name());
+}
+
+void SetRamEstimate(const uint64 ram_bytes, ResourceAllocation* estimate) {
+  estimate->Clear();
+  auto* quantity = estimate->add_resource_quantities();
+  quantity->mutable_resource()->set_device(device_types::kMain);
+  quantity->mutable_resource()->set_kind(resource_kinds::kRamBytes);
+  quantity->set_quantity(ram_bytes);
+}
+
+Adapter::ResourceEstimator GetResourceEstimator(
+    const FlatHashmapSourceAdapterConfig& config) {
+  if (!config.read_to_heap()) {
+    // Decline to supply a resource footprint estimate: the mapped pages are
+    // backed by the file, and reclaimable.
+    return Adapter::EstimateNoResources();
+  }
+  return [config](const StoragePath& path, ResourceAllocation* estimate) {
+    uint64 file_size;
+    TF_RETURN_IF_ERROR(
+        Env::Default()->GetFileSize(GetFilePath(config, path), &file_size));
+    SetRamEstimate(file_size, estimate);
+    return Status::OK();
+  };
+}
+
+Adapter::PostLoadResourceEstimator GetPostLoadResourceEstimator(
+    const FlatHashmapSourceAdapterConfig& config) {
+  if (!config.read_to_heap()) {
+    return nullptr;
+  }
+  return [](const StoragePath& path, const FlatHashmap& hashmap,
+            ResourceAllocation* estimate) {
+    SetRamEstimate(hashmap.heap_bytes(), estimate);
+    return Status::OK();
+  };
+}
+
+}  // namespace
+
+FlatHashmapSourceAdapter::FlatHashmapSourceAdapter(
+    const FlatHashmapSourceAdapterConfig& config)
+    : SimpleLoaderSourceAdapter<StoragePath, FlatHashmap>(
+          [config](const StoragePath& path,
+                   std::unique_ptr<FlatHashmap>* hashmap) {
+            const string file_path = GetFilePath(config, path);
+            if (config.read_to_heap()) {
+              return FlatHashmap::Read(file_path, hashmap);
+            }
+            TF_RETURN_IF_ERROR(FlatHashmap::Load(file_path, hashmap));
+            if (config.prefault()) {
+              (*hashmap)->Prefault();
+            }
+            return Status::OK();
+          },
+          GetResourceEstimator(config), GetPostLoadResourceEstimator(config)) {
+}
+
+FlatHashmapSourceAdapter::~FlatHashmapSourceAdapter() { Detach(); }
+
+// Register the source adapter.
+class FlatHashmapSourceAdapterCreator {
+ public:
+  static Status Create(
+      const FlatHashmapSourceAdapterConfig& config,
+      std::unique_ptr<SourceAdapter<StoragePath, std::unique_ptr<Loader>>>*
+          adapter) {
+    adapter->reset(new FlatHashmapSourceAdapter(config));
+    return Status::OK();
+  }
+};
+REGISTER_STORAGE_PATH_SOURCE_ADAPTER(FlatHashmapSourceAdapterCreator,
+                                     FlatHashmapSourceAdapterConfig);
+
+}  // namespace serving
+}  // namespace tensorflow
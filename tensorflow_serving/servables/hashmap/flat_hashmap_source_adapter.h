@@ -0,0 +1,54 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_SERVABLES_HASHMAP_FLAT_HASHMAP_SOURCE_ADAPTER_H_
+#define TENSORFLOW_SERVING_SERVABLES_HASHMAP_FLAT_HASHMAP_SOURCE_ADAPTER_H_
+
+#include "tensorflow_serving/core/simple_loader.h"
+#include "tensorflow_serving/core/source_adapter.h"
+#include "tensorflow_serving/core/storage_path.h"
+#include "tensorflow_serving/servables/hashmap/flat_hashmap.h"
+#include "tensorflow_serving/servables/hashmap/hashmap_source_adapter.pb.h"
+
+namespace tensorflow {
+namespace serving {
+
+// A SourceAdapter for memory-mapped FlatHashmaps. It takes storage paths that
+// give the locations of flat hashmap files (see WriteFlatHashmap()) and
+// produces loaders for them.
+//
+// Unlike HashmapSourceAdapter, loading a version maps its file instead of
+// parsing it, and the entries are not copied to the heap, unless
+// 'read_to_heap' is set.
+//
+// Registered for the FlatHashmapSourceAdapterConfig platform configs, e.g. to
+// serve the hashmaps of a "hashmap" platform next to the models, through their
+// Predict API (see flat_hashmap_predict.h).
+class FlatHashmapSourceAdapter final
+    : public SimpleLoaderSourceAdapter<StoragePath, FlatHashmap> {
+ public:
+  explicit FlatHashmapSourceAdapter(
+      const FlatHashmapSourceAdapterConfig& config =
+          FlatHashmapSourceAdapterConfig());
+  ~FlatHashmapSourceAdapter() override;
+
+ private:
+  TF_DISALLOW_COPY_AND_ASSIGN(FlatHashmapSourceAdapter);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_SERVABLES_HASHMAP_FLAT_HASHMAP_SOURCE_ADAPTER_H_
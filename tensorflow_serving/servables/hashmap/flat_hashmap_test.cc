@@ -0,0 +1,235 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/servables/hashmap/flat_hashmap.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow_serving/core/loader.h"
+#include "tensorflow_serving/core/servable_data.h"
+#include "tensorflow_serving/servables/hashmap/flat_hashmap_source_adapter.h"
+#include "tensorflow_serving/util/any_ptr.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+TEST(FlatHashmapTest, FindsEntries) {
+  const string file = io::JoinPath(testing::TmpDir(), "FindsEntries");
+  std::vector<std::pair<string, string>> entries;
+  for (int i = 0; i < 1000; ++i) {
+    entries.push_back({strings::StrCat("key", i), strings::StrCat("value", i)});
+  }
+  entries.push_back({"", "empty key"});
+  entries.push_back({"empty value", ""});
+  TF_ASSERT_OK(WriteFlatHashmap(entries, file));
+
+  std::unique_ptr<FlatHashmap> map;
+  TF_ASSERT_OK(FlatHashmap::Load(file, &map));
+  EXPECT_EQ(entries.size(), map->size());
+  for (const auto& entry : entries) {
+    StringPiece value;
+    ASSERT_TRUE(map->Find(entry.first, &value)) << entry.first;
+    EXPECT_EQ(entry.second, value);
+  }
+  StringPiece value;
+  EXPECT_FALSE(map->Find("key1000", &value));
+  EXPECT_FALSE(map->Find("ke", &value));
+}
+
+TEST(FlatHashmapTest, FindsBatchesOfEntries) {
+  const string file = io::JoinPath(testing::TmpDir(), "FindsBatches");
+  std::vector<std::pair<string, string>> entries;
+  for (int i = 0; i < 100; ++i) {
+    entries.push_back({strings::StrCat("key", i), strings::StrCat("value", i)});
+  }
+  TF_ASSERT_OK(WriteFlatHashmap(entries, file));
+  std::unique_ptr<FlatHashmap> map;
+  TF_ASSERT_OK(FlatHashmap::Load(file, &map));
+
+  // More keys than a group of lookups, half of them missing.
+  std::vector<string> keys;
+  for (int i = 0; i < 50; ++i) {
+    keys.push_back(strings::StrCat("key", 2 * i));
+    keys.push_back(strings::StrCat("missing", i));
+  }
+  const std::vector<StringPiece> key_pieces(keys.begin(), keys.end());
+  std::vector<StringPiece> values(keys.size());
+  std::unique_ptr<bool[]> found(new bool[keys.size()]);
+  map->FindBatch(key_pieces, values.data(), found.get());
+  for (int i = 0; i < 50; ++i) {
+    EXPECT_TRUE(found[2 * i]);
+    EXPECT_EQ(strings::StrCat("value", 2 * i), values[2 * i]);
+    EXPECT_FALSE(found[2 * i + 1]);
+  }
+}
+
+TEST(FlatHashmapTest, KeepsFirstOfDuplicateKeys) {
+  const string file = io::JoinPath(testing::TmpDir(), "DuplicateKeys");
+  TF_ASSERT_OK(
+      WriteFlatHashmap({{"a", "apple"}, {"b", "banana"}, {"a", "avocado"}},
+                       file));
+
+  std::unique_ptr<FlatHashmap> map;
+  TF_ASSERT_OK(FlatHashmap::Load(file, &map));
+  EXPECT_EQ(2, map->size());
+  StringPiece value;
+  ASSERT_TRUE(map->Find("a", &value));
+  EXPECT_EQ("apple", value);
+}
+
+TEST(FlatHashmapTest, Empty) {
+  const string file = io::JoinPath(testing::TmpDir(), "Empty");
+  TF_ASSERT_OK(WriteFlatHashmap({}, file));
+
+  std::unique_ptr<FlatHashmap> map;
+  TF_ASSERT_OK(FlatHashmap::Load(file, &map));
+  EXPECT_EQ(0, map->size());
+  StringPiece value;
+  EXPECT_FALSE(map->Find("a", &value));
+}
+
+TEST(FlatHashmapTest, RejectsOtherFiles) {
+  const string file = io::JoinPath(testing::TmpDir(), "NotAFlatHashmap");
+  TF_ASSERT_OK(WriteStringToFile(Env::Default(), file, "a,apple\nb,banana\n"));
+
+  std::unique_ptr<FlatHashmap> map;
+  const Status status = FlatHashmap::Load(file, &map);
+  EXPECT_EQ(error::DATA_LOSS, status.code());
+}
+
+TEST(FlatHashmapTest, RejectsTruncatedFiles) {
+  const string file = io::JoinPath(testing::TmpDir(), "Truncated");
+  TF_ASSERT_OK(WriteFlatHashmap({{"a", "apple"}, {"b", "banana"}}, file));
+  string contents;
+  TF_ASSERT_OK(ReadFileToString(Env::Default(), file, &contents));
+  // Only the header is left.
+  TF_ASSERT_OK(WriteStringToFile(Env::Default(), file, contents.substr(0, 32)));
+
+  std::unique_ptr<FlatHashmap> map;
+  const Status status = FlatHashmap::Load(file, &map);
+  EXPECT_EQ(error::DATA_LOSS, status.code());
+}
+
+TEST(FlatHashmapTest, ReadsToHeap) {
+  const string file = io::JoinPath(testing::TmpDir(), "ReadsToHeap");
+  TF_ASSERT_OK(WriteFlatHashmap({{"a", "apple"}, {"b", "banana"}}, file));
+  uint64 file_size;
+  TF_ASSERT_OK(Env::Default()->GetFileSize(file, &file_size));
+
+  std::unique_ptr<FlatHashmap> map;
+  TF_ASSERT_OK(FlatHashmap::Read(file, &map));
+  EXPECT_EQ(2, map->size());
+  EXPECT_EQ(file_size, map->heap_bytes());
+  StringPiece value;
+  ASSERT_TRUE(map->Find("a", &value));
+  EXPECT_EQ("apple", value);
+  EXPECT_FALSE(map->Find("c", &value));
+
+  std::unique_ptr<FlatHashmap> mapped_map;
+  TF_ASSERT_OK(FlatHashmap::Load(file, &mapped_map));
+  EXPECT_EQ(0, mapped_map->heap_bytes());
+}
+
+TEST(FlatHashmapSourceAdapterTest, Basic) {
+  const string file = io::JoinPath(testing::TmpDir(), "Basic");
+  TF_ASSERT_OK(WriteFlatHashmap({{"a", "apple"}, {"b", "banana"}}, file));
+
+  auto adapter =
+      std::unique_ptr<FlatHashmapSourceAdapter>(new FlatHashmapSourceAdapter());
+  ServableData<std::unique_ptr<Loader>> loader_data =
+      adapter->AdaptOneVersion({{"", 0}, file});
+  TF_ASSERT_OK(loader_data.status());
+  std::unique_ptr<Loader> loader = loader_data.ConsumeDataOrDie();
+
+  TF_ASSERT_OK(loader->Load());
+
+  const FlatHashmap* map = loader->servable().get<FlatHashmap>();
+  StringPiece value;
+  ASSERT_TRUE(map->Find("b", &value));
+  EXPECT_EQ("banana", value);
+
+  loader->Unload();
+}
+
+TEST(FlatHashmapSourceAdapterTest, Prefault) {
+  const string file = io::JoinPath(testing::TmpDir(), "Prefault");
+  TF_ASSERT_OK(WriteFlatHashmap({{"a", "apple"}, {"b", "banana"}}, file));
+
+  FlatHashmapSourceAdapterConfig config;
+  config.set_prefault(true);
+  auto adapter = std::unique_ptr<FlatHashmapSourceAdapter>(
+      new FlatHashmapSourceAdapter(config));
+  ServableData<std::unique_ptr<Loader>> loader_data =
+      adapter->AdaptOneVersion({{"", 0}, file});
+  TF_ASSERT_OK(loader_data.status());
+  std::unique_ptr<Loader> loader = loader_data.ConsumeDataOrDie();
+
+  TF_ASSERT_OK(loader->Load());
+
+  const FlatHashmap* map = loader->servable().get<FlatHashmap>();
+  StringPiece value;
+  ASSERT_TRUE(map->Find("a", &value));
+  EXPECT_EQ("apple", value);
+
+  loader->Unload();
+}
+
+TEST(FlatHashmapSourceAdapterTest, ReadToHeap) {
+  const string file = io::JoinPath(testing::TmpDir(), "ReadToHeap");
+  TF_ASSERT_OK(WriteFlatHashmap({{"a", "apple"}, {"b", "banana"}}, file));
+  uint64 file_size;
+  TF_ASSERT_OK(Env::Default()->GetFileSize(file, &file_size));
+
+  FlatHashmapSourceAdapterConfig config;
+  config.set_read_to_heap(true);
+  auto adapter = std::unique_ptr<FlatHashmapSourceAdapter>(
+      new FlatHashmapSourceAdapter(config));
+  ServableData<std::unique_ptr<Loader>> loader_data =
+      adapter->AdaptOneVersion({{"", 0}, file});
+  TF_ASSERT_OK(loader_data.status());
+  std::unique_ptr<Loader> loader = loader_data.ConsumeDataOrDie();
+
+  // The version is accounted for the size of its file.
+  ResourceAllocation estimate;
+  TF_ASSERT_OK(loader->EstimateResources(&estimate));
+  ASSERT_EQ(1, estimate.resource_quantities_size());
+  EXPECT_EQ(file_size, estimate.resource_quantities(0).quantity());
+
+  TF_ASSERT_OK(loader->Load());
+
+  TF_ASSERT_OK(loader->EstimateResources(&estimate));
+  ASSERT_EQ(1, estimate.resource_quantities_size());
+  EXPECT_EQ(file_size, estimate.resource_quantities(0).quantity());
+  const FlatHashmap* map = loader->servable().get<FlatHashmap>();
+  StringPiece value;
+  ASSERT_TRUE(map->Find("b", &value));
+  EXPECT_EQ("banana", value);
+
+  loader->Unload();
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,291 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/servables/tensorflow/batching_autotuner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <utility>
+
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/env_time.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow_serving/servables/tensorflow/bundle_factory_util.h"
+#include "tensorflow_serving/servables/tensorflow/classifier.h"
+#include "tensorflow_serving/servables/tensorflow/multi_inference.h"
+#include "tensorflow_serving/servables/tensorflow/predict_util.h"
+#include "tensorflow_serving/servables/tensorflow/regressor.h"
+#include "tensorflow_serving/servables/tensorflow/serving_session.h"
+
+namespace tensorflow {
+namespace serving {
+
+namespace {
+
+// A session running the calls of a session it does not own, so that the
+// session of a bundle can be batched and unbatched again.
+class UnownedSession : public ServingSession {
+ public:
+  explicit UnownedSession(Session* const wrapped) : wrapped_(wrapped) {}
+
+  Status Run(const std::vector<std::pair<string, Tensor>>& inputs,
+             const std::vector<string>& output_tensor_names,
+             const std::vector<string>& target_node_names,
+             std::vector<Tensor>* outputs) override {
+    return wrapped_->Run(inputs, output_tensor_names, target_node_names,
+                         outputs);
+  }
+
+  Status Run(const RunOptions& run_options,
+             const std::vector<std::pair<string, Tensor>>& inputs,
+             const std::vector<string>& output_tensor_names,
+             const std::vector<string>& target_node_names,
+             std::vector<Tensor>* outputs, RunMetadata* run_metadata) override {
+    return wrapped_->Run(run_options, inputs, output_tensor_names,
+                         target_node_names, outputs, run_metadata);
+  }
+
+  Status Run(const RunOptions& run_options,
+             const std::vector<std::pair<string, Tensor>>& inputs,
+             const std::vector<string>& output_tensor_names,
+             const std::vector<string>& target_node_names,
+             std::vector<Tensor>* outputs, RunMetadata* run_metadata,
+             const thread::ThreadPoolOptions& thread_pool_options) override {
+    return wrapped_->Run(run_options, inputs, output_tensor_names,
+                         target_node_names, outputs, run_metadata,
+                         thread_pool_options);
+  }
+
+  Status ListDevices(std::vector<DeviceAttributes>* response) override {
+    return wrapped_->ListDevices(response);
+  }
+
+ private:
+  Session* const wrapped_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(UnownedSession);
+};
+
+// Runs the request of 'prediction_log' on 'session'.
+Status RunLoggedRequest(const PredictionLog& prediction_log,
+                        const MetaGraphDef& meta_graph_def,
+                        Session* const session) {
+  const RunOptions run_options;
+  switch (prediction_log.log_type_case()) {
+    case PredictionLog::kRegressLog: {
+      RegressionResponse response;
+      return RunRegress(run_options, meta_graph_def, {}, session,
+                        prediction_log.regress_log().request(), &response);
+    }
+    case PredictionLog::kClassifyLog: {
+      ClassificationResponse response;
+      return RunClassify(run_options, meta_graph_def, {}, session,
+                         prediction_log.classify_log().request(), &response);
+    }
+    case PredictionLog::kPredictLog: {
+      PredictResponse response;
+      return RunPredict(run_options, meta_graph_def, {}, session,
+                        prediction_log.predict_log().request(), &response);
+    }
+    case PredictionLog::kMultiInferenceLog: {
+      MultiInferenceResponse response;
+      return RunMultiInference(run_options, meta_graph_def, {}, session,
+                               prediction_log.multi_inference_log().request(),
+                               &response);
+    }
+    default:
+      return errors::Unimplemented("Unsupported log type: ",
+                                   prediction_log.log_type_case());
+  }
+}
+
+// Replays 'num_requests' of 'request_logs' on 'session' from 'num_clients'
+// clients, and returns the latency of each request in 'latencies_micros' and
+// the time the replay took in 'elapsed_micros'.
+Status ReplayRequests(const std::vector<PredictionLog>& request_logs,
+                      const int num_requests, const int num_clients,
+                      const MetaGraphDef& meta_graph_def,
+                      Session* const session,
+                      std::vector<int64>* const latencies_micros,
+                      int64* const elapsed_micros) {
+  latencies_micros->assign(num_requests, 0);
+  std::atomic<int> next_request{0};
+  mutex status_mu;
+  Status status;
+  const uint64 start_micros = EnvTime::NowMicros();
+  {
+    thread::ThreadPool clients(Env::Default(), "autotuner_clients",
+                               num_clients);
+    for (int i = 0; i < num_clients; ++i) {
+      clients.Schedule([&]() {
+        for (int request = next_request++; request < num_requests;
+             request = next_request++) {
+          const uint64 request_start_micros = EnvTime::NowMicros();
+          const Status request_status = RunLoggedRequest(
+              request_logs[request % request_logs.size()], meta_graph_def,
+              session);
+          (*latencies_micros)[request] =
+              EnvTime::NowMicros() - request_start_micros;
+          if (!request_status.ok()) {
+            mutex_lock l(status_mu);
+            status.Update(request_status);
+            // Stops all the clients.
+            next_request = num_requests;
+          }
+        }
+      });
+    }
+  }
+  *elapsed_micros = EnvTime::NowMicros() - start_micros;
+  return status;
+}
+
+}  // namespace
+
+std::vector<BatchingParameters> BatchingParameterGrid(
+    const BatchingAutotunerOptions& options) {
+  std::vector<BatchingParameters> grid;
+  for (const int64 max_batch_size : options.max_batch_sizes) {
+    for (const int64 batch_timeout_micros : options.batch_timeouts_micros) {
+      for (const int64 num_batch_threads : options.num_batch_threads) {
+        BatchingParameters parameters = options.base_parameters;
+        parameters.mutable_max_batch_size()->set_value(max_batch_size);
+        parameters.mutable_batch_timeout_micros()->set_value(
+            batch_timeout_micros);
+        parameters.mutable_num_batch_threads()->set_value(num_batch_threads);
+        parameters.mutable_max_enqueued_batches()->set_value(
+            options.max_enqueued_batches);
+        parameters.clear_allowed_batch_sizes();
+        grid.push_back(parameters);
+        if (options.sweep_allowed_batch_sizes && max_batch_size > 1) {
+          for (int64 size = 1; size < max_batch_size; size *= 2) {
+            parameters.add_allowed_batch_sizes(size);
+          }
+          parameters.add_allowed_batch_sizes(max_batch_size);
+          grid.push_back(parameters);
+        }
+      }
+    }
+  }
+  return grid;
+}
+
+Status RunBatchingTrial(const BatchingParameters& parameters,
+                        const BatchingAutotunerOptions& options,
+                        const SavedModelBundle& bundle,
+                        const std::vector<PredictionLog>& request_logs,
+                        BatchingTrial* const trial) {
+  if (request_logs.empty()) {
+    return errors::InvalidArgument("No request to replay");
+  }
+  if (options.num_requests <= 0 || options.num_clients <= 0) {
+    return errors::InvalidArgument(
+        "The number of requests and clients must be positive");
+  }
+
+  std::shared_ptr<SharedBatchScheduler<BatchingSessionTask>> batch_scheduler;
+  TF_RETURN_IF_ERROR(CreateBatchScheduler(parameters, &batch_scheduler));
+  std::vector<SignatureDef> signatures;
+  for (const auto& entry : bundle.meta_graph_def.signature_def()) {
+    signatures.push_back(entry.second);
+  }
+  std::unique_ptr<Session> session(new UnownedSession(bundle.session.get()));
+  TF_RETURN_IF_ERROR(WrapSessionForBatching(parameters, batch_scheduler,
+                                            signatures, &session));
+
+  std::vector<int64> latencies_micros;
+  int64 elapsed_micros;
+  if (options.num_warmup_requests > 0) {
+    TF_RETURN_IF_ERROR(ReplayRequests(
+        request_logs, options.num_warmup_requests, options.num_clients,
+        bundle.meta_graph_def, session.get(), &latencies_micros,
+        &elapsed_micros));
+  }
+  TF_RETURN_IF_ERROR(ReplayRequests(
+      request_logs, options.num_requests, options.num_clients,
+      bundle.meta_graph_def, session.get(), &latencies_micros,
+      &elapsed_micros));
+
+  std::sort(latencies_micros.begin(), latencies_micros.end());
+  const auto percentile = [&latencies_micros](const double fraction) {
+    const int index = std::max(
+        0, static_cast<int>(std::ceil(fraction * latencies_micros.size())) - 1);
+    return latencies_micros[index];
+  };
+  trial->parameters = parameters;
+  trial->throughput =
+      options.num_requests * 1e6 / std::max<int64>(elapsed_micros, 1);
+  trial->p50_latency_micros = percentile(0.5);
+  trial->p99_latency_micros = percentile(0.99);
+  return Status::OK();
+}
+
+std::vector<BatchingTrial> ParetoFront(
+    const std::vector<BatchingTrial>& trials) {
+  std::vector<const BatchingTrial*> sorted_trials;
+  for (const BatchingTrial& trial : trials) {
+    sorted_trials.push_back(&trial);
+  }
+  std::stable_sort(sorted_trials.begin(), sorted_trials.end(),
+                   [](const BatchingTrial* a, const BatchingTrial* b) {
+                     if (a->p99_latency_micros != b->p99_latency_micros) {
+                       return a->p99_latency_micros < b->p99_latency_micros;
+                     }
+                     return a->throughput > b->throughput;
+                   });
+  // Going up in latency, a trial is kept if it has a higher throughput than
+  // all the faster ones.
+  std::vector<BatchingTrial> front;
+  for (const BatchingTrial* trial : sorted_trials) {
+    if (front.empty() || trial->throughput > front.back().throughput) {
+      front.push_back(*trial);
+    }
+  }
+  return front;
+}
+
+Status RecommendedTrial(const std::vector<BatchingTrial>& front,
+                        const int64 target_p99_latency_micros,
+                        int* const index) {
+  if (front.empty()) {
+    return errors::InvalidArgument("No trials to recommend from");
+  }
+  if (target_p99_latency_micros <= 0) {
+    *index = front.size() - 1;
+    return Status::OK();
+  }
+  // The front is by increasing latency and throughput.
+  int recommended = -1;
+  for (int i = 0; i < static_cast<int>(front.size()); ++i) {
+    if (front[i].p99_latency_micros <= target_p99_latency_micros) {
+      recommended = i;
+    }
+  }
+  if (recommended < 0) {
+    return errors::NotFound("No trial is within the target p99 latency of ",
+                            target_p99_latency_micros,
+                            " microseconds; the lowest is ",
+                            front[0].p99_latency_micros, " microseconds");
+  }
+  *index = recommended;
+  return Status::OK();
+}
+
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,99 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_BATCHING_AUTOTUNER_H_
+#define TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_BATCHING_AUTOTUNER_H_
+
+#include <vector>
+
+#include "tensorflow/cc/saved_model/loader.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow_serving/apis/prediction_log.pb.h"
+#include "tensorflow_serving/servables/tensorflow/session_bundle_config.pb.h"
+
+namespace tensorflow {
+namespace serving {
+
+// Tunes the batching parameters of a model offline: the requests logged by
+// the ServerRequestLogger (e.g. with the "tfrecord" LogCollector) are replayed
+// against the model, batched with each point of a grid of parameters, and the
+// points with the best trade-offs of throughput against p99 latency are kept.
+
+// The grid of batching parameters to try, and how to replay the requests.
+struct BatchingAutotunerOptions {
+  // The parameters the tried ones start from, e.g. to pad the variable length
+  // inputs. The swept parameters are overwritten.
+  BatchingParameters base_parameters;
+  // The values of each parameter to try. Every combination is tried.
+  std::vector<int64> max_batch_sizes = {8, 16, 32, 64};
+  std::vector<int64> batch_timeouts_micros = {0, 1000, 5000};
+  std::vector<int64> num_batch_threads = {1, 4};
+  // If true, each combination is also tried with the allowed batch sizes set
+  // to the powers of two up to its max batch size.
+  bool sweep_allowed_batch_sizes = true;
+  // The max number of enqueued batches of the parameters tried.
+  int64 max_enqueued_batches = 1000;
+
+  // The number of clients replaying the requests concurrently, each sending
+  // its next request once the previous one returned.
+  int num_clients = 16;
+  // The number of requests replayed, and measured, for each combination. The
+  // logged requests are replayed in order, from the start once all sent.
+  int num_requests = 2000;
+  // The number of requests replayed before the measured ones, e.g. to let the
+  // batch threads and the model warm up.
+  int num_warmup_requests = 200;
+};
+
+// The measures of the replay with some batching parameters.
+struct BatchingTrial {
+  BatchingParameters parameters;
+  // Replayed requests per second.
+  double throughput = 0;
+  int64 p50_latency_micros = 0;
+  int64 p99_latency_micros = 0;
+};
+
+// Returns the combinations of batching parameters of 'options'.
+std::vector<BatchingParameters> BatchingParameterGrid(
+    const BatchingAutotunerOptions& options);
+
+// Replays 'request_logs' against the model of 'bundle' batched with
+// 'parameters', as described by 'options', and fills in 'trial'. The session
+// of 'bundle' is not batched anymore once this returns.
+Status RunBatchingTrial(const BatchingParameters& parameters,
+                        const BatchingAutotunerOptions& options,
+                        const SavedModelBundle& bundle,
+                        const std::vector<PredictionLog>& request_logs,
+                        BatchingTrial* trial);
+
+// Returns the trials of 'trials' that no other trial beats on both throughput
+// and p99 latency, by increasing p99 latency.
+std::vector<BatchingTrial> ParetoFront(
+    const std::vector<BatchingTrial>& trials);
+
+// Sets 'index' to the index in 'front' (as returned by ParetoFront()) of the
+// trial to recommend: the highest throughput within
+// 'target_p99_latency_micros', or if it is 0, the highest throughput. Returns
+// a NOT_FOUND error if no trial is within the target, and an INVALID_ARGUMENT
+// error if 'front' is empty.
+Status RecommendedTrial(const std::vector<BatchingTrial>& front,
+                        int64 target_p99_latency_micros, int* index);
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_BATCHING_AUTOTUNER_H_
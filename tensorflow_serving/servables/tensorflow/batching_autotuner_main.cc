@@ -0,0 +1,242 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Command line tool tuning the batching parameters of a SavedModel from the
+// requests logged by the model server: the requests are replayed against the
+// model with every combination of the swept parameters, and the tool prints
+// the Pareto front of throughput against p99 latency, and the recommended
+// BatchingParameters as a text proto, e.g. for --batching_parameters_file.
+//
+// Usage:
+//   batching_autotuner --export_dir=/models/my_model/3 \
+//     --request_log_file_pattern=/logs/my_model/requests-* \
+//     --max_batch_sizes=16,32,64 --batch_timeouts_micros=0,2000 \
+//     --target_p99_latency_micros=50000
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "tensorflow/cc/saved_model/loader.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/init_main.h"
+#include "tensorflow/core/platform/protobuf.h"
+#include "tensorflow/core/public/session_options.h"
+#include "tensorflow/core/util/command_line_flags.h"
+#include "tensorflow_serving/servables/tensorflow/batching_autotuner.h"
+#include "tensorflow_serving/servables/tensorflow/request_log_reader.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+// Parses 'flag', a comma separated list of integers, into 'values'.
+Status ParseIntList(const string& name, const string& flag,
+                    std::vector<int64>* values) {
+  values->clear();
+  for (const absl::string_view value :
+       absl::StrSplit(flag, ',', absl::SkipEmpty())) {
+    int64 parsed;
+    if (!absl::SimpleAtoi(value, &parsed) || parsed < 0) {
+      return errors::InvalidArgument("Invalid value of --", name, ": ", flag);
+    }
+    values->push_back(parsed);
+  }
+  if (values->empty()) {
+    return errors::InvalidArgument("--", name, " is empty");
+  }
+  return Status::OK();
+}
+
+// Prints 'trial' as a line of the Pareto front.
+void PrintTrial(const BatchingTrial& trial) {
+  const BatchingParameters& parameters = trial.parameters;
+  std::cout << "throughput: " << trial.throughput
+            << " p50_micros: " << trial.p50_latency_micros
+            << " p99_micros: " << trial.p99_latency_micros
+            << " max_batch_size: " << parameters.max_batch_size().value()
+            << " batch_timeout_micros: "
+            << parameters.batch_timeout_micros().value()
+            << " num_batch_threads: " << parameters.num_batch_threads().value()
+            << " allowed_batch_sizes: "
+            << (parameters.allowed_batch_sizes().empty() ? "-" : "");
+  for (int i = 0; i < parameters.allowed_batch_sizes_size(); ++i) {
+    std::cout << (i > 0 ? "," : "") << parameters.allowed_batch_sizes(i);
+  }
+  std::cout << "\n";
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
+
+int main(int argc, char** argv) {
+  tensorflow::string export_dir;
+  tensorflow::string saved_model_tags = "serve";
+  tensorflow::string request_log_file_pattern;
+  tensorflow::string request_log_compression_type;
+  tensorflow::string model_name;
+  int max_num_request_logs = 1000;
+  tensorflow::string base_batching_parameters_file;
+  tensorflow::string max_batch_sizes = "8,16,32,64";
+  tensorflow::string batch_timeouts_micros = "0,1000,5000";
+  tensorflow::string num_batch_threads = "1,4";
+  tensorflow::serving::BatchingAutotunerOptions options;
+  tensorflow::int64 target_p99_latency_micros = 0;
+  std::vector<tensorflow::Flag> flag_list = {
+      tensorflow::Flag("export_dir", &export_dir,
+                       "The directory of the SavedModel to tune."),
+      tensorflow::Flag("saved_model_tags", &saved_model_tags,
+                       "Comma-separated set of tags of the MetaGraphDef to "
+                       "load."),
+      tensorflow::Flag("request_log_file_pattern", &request_log_file_pattern,
+                       "Pattern of the TFRecord files of PredictionLogs to "
+                       "replay, e.g. as written by the \"tfrecord\" "
+                       "LogCollector."),
+      tensorflow::Flag("request_log_compression_type",
+                       &request_log_compression_type,
+                       "The compression of the request logs: \"\", \"ZLIB\" "
+                       "or \"GZIP\"."),
+      tensorflow::Flag("model_name", &model_name,
+                       "If non-empty, only the logged requests of this model "
+                       "are replayed."),
+      tensorflow::Flag("max_num_request_logs", &max_num_request_logs,
+                       "The max number of logged requests read."),
+      tensorflow::Flag("base_batching_parameters_file",
+                       &base_batching_parameters_file,
+                       "If non-empty, a text BatchingParameters proto the "
+                       "tried parameters start from, e.g. to pad the "
+                       "variable length inputs."),
+      tensorflow::Flag("max_batch_sizes", &max_batch_sizes,
+                       "Comma-separated max batch sizes to try."),
+      tensorflow::Flag("batch_timeouts_micros", &batch_timeouts_micros,
+                       "Comma-separated batch timeouts to try."),
+      tensorflow::Flag("num_batch_threads", &num_batch_threads,
+                       "Comma-separated numbers of batch threads to try."),
+      tensorflow::Flag("sweep_allowed_batch_sizes",
+                       &options.sweep_allowed_batch_sizes,
+                       "If true, each combination is also tried with the "
+                       "allowed batch sizes set to the powers of two up to "
+                       "its max batch size."),
+      tensorflow::Flag("num_clients", &options.num_clients,
+                       "The number of clients replaying the requests "
+                       "concurrently."),
+      tensorflow::Flag("num_requests", &options.num_requests,
+                       "The number of requests measured for each "
+                       "combination."),
+      tensorflow::Flag("num_warmup_requests", &options.num_warmup_requests,
+                       "The number of requests replayed before the measured "
+                       "ones for each combination."),
+      tensorflow::Flag("target_p99_latency_micros",
+                       &target_p99_latency_micros,
+                       "If more than 0, the recommended parameters are those "
+                       "of the highest throughput within this p99 latency, "
+                       "and the tool fails if no combination is within it. "
+                       "Otherwise, those of the highest throughput.")};
+
+  const auto& usage = tensorflow::Flags::Usage(argv[0], flag_list);
+  if (!tensorflow::Flags::Parse(&argc, argv, flag_list) ||
+      export_dir.empty() || request_log_file_pattern.empty()) {
+    std::cerr << usage;
+    return 1;
+  }
+  tensorflow::port::InitMain(argv[0], &argc, &argv);
+
+  tensorflow::Status status;
+  if (!base_batching_parameters_file.empty()) {
+    tensorflow::string text;
+    status = tensorflow::ReadFileToString(tensorflow::Env::Default(),
+                                          base_batching_parameters_file, &text);
+    if (status.ok() && !tensorflow::protobuf::TextFormat::ParseFromString(
+                           text, &options.base_parameters)) {
+      status = tensorflow::errors::InvalidArgument(
+          "Invalid BatchingParameters in ", base_batching_parameters_file);
+    }
+  }
+  if (status.ok()) {
+    status = tensorflow::serving::ParseIntList(
+        "max_batch_sizes", max_batch_sizes, &options.max_batch_sizes);
+  }
+  if (status.ok()) {
+    status = tensorflow::serving::ParseIntList("batch_timeouts_micros",
+                                               batch_timeouts_micros,
+                                               &options.batch_timeouts_micros);
+  }
+  if (status.ok()) {
+    status = tensorflow::serving::ParseIntList(
+        "num_batch_threads", num_batch_threads, &options.num_batch_threads);
+  }
+  std::vector<tensorflow::serving::PredictionLog> request_logs;
+  if (status.ok()) {
+    status = tensorflow::serving::ReadRequestLogs(
+        request_log_file_pattern, request_log_compression_type,
+        max_num_request_logs, model_name, &request_logs);
+  }
+  tensorflow::SavedModelBundle bundle;
+  if (status.ok()) {
+    const std::vector<tensorflow::string> tags =
+        absl::StrSplit(saved_model_tags, ',', absl::SkipEmpty());
+    status = tensorflow::LoadSavedModel(
+        tensorflow::SessionOptions(), tensorflow::RunOptions(), export_dir,
+        {tags.begin(), tags.end()}, &bundle);
+  }
+  if (!status.ok()) {
+    std::cerr << "ERROR: " << status << "\n";
+    return 1;
+  }
+  std::cerr << "Replaying " << request_logs.size() << " logged requests\n";
+
+  std::vector<tensorflow::serving::BatchingTrial> trials;
+  for (const tensorflow::serving::BatchingParameters& parameters :
+       tensorflow::serving::BatchingParameterGrid(options)) {
+    tensorflow::serving::BatchingTrial trial;
+    status = tensorflow::serving::RunBatchingTrial(parameters, options, bundle,
+                                                   request_logs, &trial);
+    if (!status.ok()) {
+      std::cerr << "Skipped the parameters " << parameters.ShortDebugString()
+                << ": " << status << "\n";
+      continue;
+    }
+    trials.push_back(trial);
+  }
+
+  const std::vector<tensorflow::serving::BatchingTrial> front =
+      tensorflow::serving::ParetoFront(trials);
+  if (front.empty()) {
+    std::cerr << "ERROR: No parameters could be tried\n";
+    return 1;
+  }
+  std::cout << "# Pareto front of throughput against p99 latency\n";
+  for (const tensorflow::serving::BatchingTrial& trial : front) {
+    std::cout << "# ";
+    tensorflow::serving::PrintTrial(trial);
+  }
+  int recommended;
+  status = tensorflow::serving::RecommendedTrial(
+      front, target_p99_latency_micros, &recommended);
+  if (!status.ok()) {
+    std::cerr << "ERROR: " << status << "\n";
+    return 1;
+  }
+  tensorflow::string text;
+  tensorflow::protobuf::TextFormat::PrintToString(
+      front[recommended].parameters, &text);
+  std::cout << "# Recommended BatchingParameters\n" << text;
+  return 0;
+}
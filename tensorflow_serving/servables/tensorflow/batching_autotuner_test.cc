@@ -0,0 +1,124 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/servables/tensorflow/batching_autotuner.h"
+
+#include <memory>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/public/session_options.h"
+#include "tensorflow_serving/servables/tensorflow/bundle_factory_test_util.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+PredictionLog PredictLog(const string& model_name) {
+  PredictionLog prediction_log;
+  PredictRequest* request =
+      prediction_log.mutable_predict_log()->mutable_request();
+  request->mutable_model_spec()->set_name(model_name);
+  TensorProto& x = (*request->mutable_inputs())["x"];
+  x.set_dtype(DT_FLOAT);
+  x.mutable_tensor_shape()->add_dim()->set_size(2);
+  x.add_float_val(1.0);
+  x.add_float_val(2.0);
+  return prediction_log;
+}
+
+BatchingTrial Trial(const int64 max_batch_size, const double throughput,
+                    const int64 p99_latency_micros) {
+  BatchingTrial trial;
+  trial.parameters.mutable_max_batch_size()->set_value(max_batch_size);
+  trial.throughput = throughput;
+  trial.p99_latency_micros = p99_latency_micros;
+  return trial;
+}
+
+TEST(BatchingAutotunerTest, BatchingParameterGrid) {
+  BatchingAutotunerOptions options;
+  options.base_parameters.set_pad_variable_length_inputs(true);
+  options.max_batch_sizes = {1, 6};
+  options.batch_timeouts_micros = {0, 1000};
+  options.num_batch_threads = {2};
+  const std::vector<BatchingParameters> grid = BatchingParameterGrid(options);
+  // A max batch size of 1 has no other allowed batch sizes to try.
+  ASSERT_EQ(6, grid.size());
+  for (const BatchingParameters& parameters : grid) {
+    EXPECT_TRUE(parameters.pad_variable_length_inputs());
+    EXPECT_EQ(2, parameters.num_batch_threads().value());
+  }
+  EXPECT_EQ(1, grid[0].max_batch_size().value());
+  EXPECT_EQ(1000, grid[1].batch_timeout_micros().value());
+  EXPECT_EQ(6, grid[2].max_batch_size().value());
+  EXPECT_TRUE(grid[2].allowed_batch_sizes().empty());
+  EXPECT_THAT(grid[3].allowed_batch_sizes(),
+              ::testing::ElementsAre(1, 2, 4, 6));
+
+  options.sweep_allowed_batch_sizes = false;
+  EXPECT_EQ(4, BatchingParameterGrid(options).size());
+}
+
+TEST(BatchingAutotunerTest, ParetoFront) {
+  const std::vector<BatchingTrial> front = ParetoFront(
+      {Trial(1, 100, 1000), Trial(2, 300, 3000), Trial(3, 200, 4000),
+       Trial(4, 150, 1000), Trial(5, 400, 8000)});
+  ASSERT_EQ(3, front.size());
+  EXPECT_EQ(4, front[0].parameters.max_batch_size().value());
+  EXPECT_EQ(2, front[1].parameters.max_batch_size().value());
+  EXPECT_EQ(5, front[2].parameters.max_batch_size().value());
+
+  int index;
+  TF_ASSERT_OK(RecommendedTrial(front, 5000, &index));
+  EXPECT_EQ(1, index);
+  TF_ASSERT_OK(RecommendedTrial(front, 1000, &index));
+  EXPECT_EQ(0, index);
+  TF_ASSERT_OK(RecommendedTrial(front, 0, &index));
+  EXPECT_EQ(2, index);
+  EXPECT_EQ(error::NOT_FOUND, RecommendedTrial(front, 500, &index).code());
+  EXPECT_EQ(error::INVALID_ARGUMENT, RecommendedTrial({}, 0, &index).code());
+}
+
+TEST(BatchingAutotunerTest, RunBatchingTrial) {
+  SavedModelBundle bundle;
+  TF_ASSERT_OK(LoadSavedModel(SessionOptions(), RunOptions(),
+                              test_util::GetTestSavedModelPath(), {"serve"},
+                              &bundle));
+  BatchingAutotunerOptions options;
+  options.num_clients = 4;
+  options.num_requests = 20;
+  options.num_warmup_requests = 4;
+  BatchingParameters parameters;
+  parameters.mutable_max_batch_size()->set_value(4);
+  parameters.mutable_batch_timeout_micros()->set_value(1000);
+  parameters.mutable_num_batch_threads()->set_value(1);
+
+  BatchingTrial trial;
+  TF_ASSERT_OK(RunBatchingTrial(parameters, options, bundle,
+                                {PredictLog("model")}, &trial));
+  EXPECT_EQ(4, trial.parameters.max_batch_size().value());
+  EXPECT_GT(trial.throughput, 0);
+  EXPECT_GE(trial.p99_latency_micros, trial.p50_latency_micros);
+
+  EXPECT_FALSE(
+      RunBatchingTrial(parameters, options, bundle, {}, &trial).ok());
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
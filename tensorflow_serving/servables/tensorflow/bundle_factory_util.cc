@@ -15,13 +15,29 @@ limitations under the License.
 
 #include "tensorflow_serving/servables/tensorflow/bundle_factory_util.h"
 
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <vector>
+
 #include "google/protobuf/wrappers.pb.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/types/optional.h"
+#include "tensorflow/cc/saved_model/constants.h"
 #include "tensorflow/core/kernels/batching_util/batch_scheduler.h"
 #include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/threadpool.h"
 #include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/strings/proto_serialization.h"
 #include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
 #include "tensorflow/core/platform/types.h"
 #include "tensorflow_serving/batching/batching_session.h"
+#include "tensorflow_serving/batching/latency_tuned_batch_scheduler.h"
 #include "tensorflow_serving/resources/resource_values.h"
 #include "tensorflow_serving/servables/tensorflow/serving_session.h"
 
@@ -32,6 +48,257 @@ namespace {
 
 using Batcher = SharedBatchScheduler<BatchingSessionTask>;
 
+// Size of the ranges of the variable files read by each stream.
+constexpr size_t kVariableReadRangeBytes = 16 << 20;
+
+// Copies the files and directories under 'src_dir', except 'excluded', to
+// 'dst_dir'.
+Status CopyDirectory(const string& src_dir, const string& dst_dir,
+                     const string& excluded) {
+  Env* const env = Env::Default();
+  TF_RETURN_IF_ERROR(env->RecursivelyCreateDir(dst_dir));
+  std::vector<string> children;
+  TF_RETURN_IF_ERROR(env->GetChildren(src_dir, &children));
+  for (const string& child : children) {
+    if (child == excluded) {
+      continue;
+    }
+    const string src = io::JoinPath(src_dir, child);
+    const string dst = io::JoinPath(dst_dir, child);
+    if (env->IsDirectory(src).ok()) {
+      TF_RETURN_IF_ERROR(CopyDirectory(src, dst, /*excluded=*/""));
+    } else {
+      TF_RETURN_IF_ERROR(env->CopyFile(src, dst));
+    }
+  }
+  return Status::OK();
+}
+
+// Copies the files under 'src_dir' missing from 'dst_dir', except 'excluded',
+// to 'dst_dir'.
+Status CopyMissingFiles(const string& src_dir, const string& dst_dir,
+                        const string& excluded) {
+  Env* const env = Env::Default();
+  std::vector<string> children;
+  TF_RETURN_IF_ERROR(env->GetChildren(src_dir, &children));
+  for (const string& child : children) {
+    if (child == excluded) {
+      continue;
+    }
+    const string src = io::JoinPath(src_dir, child);
+    const string dst = io::JoinPath(dst_dir, child);
+    if (env->IsDirectory(src).ok()) {
+      TF_RETURN_IF_ERROR(CopyMissingFiles(src, dst, /*excluded=*/""));
+    } else if (!env->FileExists(dst).ok()) {
+      TF_RETURN_IF_ERROR(env->RecursivelyCreateDir(dst_dir));
+      TF_RETURN_IF_ERROR(env->CopyFile(src, dst));
+      LOG(INFO) << "Copied " << src << ", written while loading the local "
+                << "copy of the model, to " << dst;
+    }
+  }
+  return Status::OK();
+}
+
+// Reads variable files in ranges of kVariableReadRangeBytes, with a number of
+// concurrent streams, and copies them if requested.
+//
+// The ranges of all the files are taken by the streams in order, so the
+// streams spread over several files when they are smaller than a range per
+// stream (e.g. the many shards of a large checkpoint), and no stream waits on
+// the slowest range of the others. The ranges of a copied file are appended
+// to the copy in order, by the stream that reads the range at the end of the
+// copy, and are kept in the meantime in a bounded number of buffers.
+class VariableFilesReader {
+ public:
+  VariableFilesReader(const int num_streams, const bool copy)
+      : num_streams_(std::max(num_streams, 1)),
+        max_num_buffers_(copy ? 2 * num_streams_ : num_streams_) {}
+
+  // Adds the file 'src' to the files to read, to be copied to 'dst' if set.
+  Status AddFile(const string& src, const string& dst) {
+    Env* const env = Env::Default();
+    std::unique_ptr<File> file(new File);
+    file->dst_path = dst;
+    TF_RETURN_IF_ERROR(env->NewRandomAccessFile(src, &file->src));
+    TF_RETURN_IF_ERROR(env->GetFileSize(src, &file->size));
+    if (file->size == 0) {
+      if (!dst.empty()) {
+        TF_RETURN_IF_ERROR(WriteStringToFile(env, dst, ""));
+      }
+      return Status::OK();
+    }
+    for (uint64 offset = 0; offset < file->size;
+         offset += kVariableReadRangeBytes) {
+      ranges_.push_back(
+          {file.get(), offset,
+           std::min<uint64>(kVariableReadRangeBytes, file->size - offset)});
+      ++file->num_unread_ranges;
+    }
+    files_.push_back(std::move(file));
+    return Status::OK();
+  }
+
+  // Reads (and copies) the files added so far. Returns the first error.
+  Status Read() {
+    {
+      thread::ThreadPool thread_pool(Env::Default(), "prefetch_variables",
+                                     num_streams_);
+      for (int i = 0; i < num_streams_; ++i) {
+        thread_pool.Schedule([this]() { ReadRanges(); });
+      }
+      // The destructor of the pool waits for the streams.
+    }
+    mutex_lock l(mu_);
+    return status_;
+  }
+
+  int num_streams() const { return num_streams_; }
+
+ private:
+  // A range read, and not yet appended to the copy of its file.
+  struct ReadRange {
+    std::unique_ptr<char[]> buffer;
+    StringPiece data;
+  };
+
+  struct File {
+    std::unique_ptr<RandomAccessFile> src;
+    uint64 size = 0;
+    // The ranges not read yet. 'src' is closed once they are all read.
+    int num_unread_ranges = 0;
+    // The copy, if any. Only accessed by the stream that set 'appending'.
+    string dst_path;
+    std::unique_ptr<WritableFile> dst;
+    // The number of bytes appended (or being appended) to the copy.
+    uint64 copied_bytes = 0;
+    // The ranges read past 'copied_bytes', by offset.
+    std::map<uint64, ReadRange> read_ranges;
+    // Whether a stream is appending ranges to the copy.
+    bool appending = false;
+  };
+
+  struct Range {
+    File* file;
+    uint64 offset;
+    size_t size;
+  };
+
+  // Reads the ranges until there is none left, or an error.
+  void ReadRanges() {
+    while (true) {
+      Range range;
+      std::unique_ptr<char[]> buffer;
+      {
+        mutex_lock l(mu_);
+        while (status_.ok() && next_range_ < ranges_.size() &&
+               free_buffers_.empty() && num_buffers_ == max_num_buffers_) {
+          buffer_released_.wait(l);
+        }
+        if (!status_.ok() || next_range_ == ranges_.size()) {
+          return;
+        }
+        range = ranges_[next_range_++];
+        if (free_buffers_.empty()) {
+          buffer.reset(new char[kVariableReadRangeBytes]);
+          ++num_buffers_;
+        } else {
+          buffer = std::move(free_buffers_.back());
+          free_buffers_.pop_back();
+        }
+      }
+      File* const file = range.file;
+      StringPiece data;
+      const Status status =
+          file->src->Read(range.offset, range.size, &data, buffer.get());
+      if (status.ok() && data.data() != buffer.get()) {
+        // The data is kept after the file is closed.
+        std::memmove(buffer.get(), data.data(), data.size());
+        data = StringPiece(buffer.get(), data.size());
+      }
+      // The file is closed outside of the lock.
+      std::unique_ptr<RandomAccessFile> read_file;
+      {
+        mutex_lock l(mu_);
+        if (--file->num_unread_ranges == 0) {
+          read_file = std::move(file->src);
+        }
+        if (!status.ok()) {
+          status_.Update(status);
+          buffer_released_.notify_all();
+          return;
+        }
+        if (file->dst_path.empty()) {
+          free_buffers_.push_back(std::move(buffer));
+          buffer_released_.notify_one();
+          continue;
+        }
+        file->read_ranges[range.offset] = {std::move(buffer), data};
+        if (file->appending) {
+          continue;
+        }
+        file->appending = true;
+      }
+      AppendRanges(file);
+    }
+  }
+
+  // Appends the ranges of 'file' read in order after its copy, until there is
+  // none. Only called by the stream that set 'file->appending'.
+  void AppendRanges(File* const file) {
+    while (true) {
+      std::vector<ReadRange> ranges;
+      bool last_ranges;
+      {
+        mutex_lock l(mu_);
+        auto it = file->read_ranges.begin();
+        while (status_.ok() && it != file->read_ranges.end() &&
+               it->first == file->copied_bytes) {
+          file->copied_bytes += it->second.data.size();
+          ranges.push_back(std::move(it->second));
+          it = file->read_ranges.erase(it);
+        }
+        if (ranges.empty()) {
+          file->appending = false;
+          return;
+        }
+        last_ranges = file->copied_bytes == file->size;
+      }
+      Status status;
+      if (file->dst == nullptr) {
+        status = Env::Default()->NewWritableFile(file->dst_path, &file->dst);
+      }
+      for (const ReadRange& range : ranges) {
+        if (status.ok()) {
+          status = file->dst->Append(range.data);
+        }
+      }
+      if (status.ok() && last_ranges) {
+        status = file->dst->Close();
+      }
+      mutex_lock l(mu_);
+      status_.Update(status);
+      for (ReadRange& range : ranges) {
+        free_buffers_.push_back(std::move(range.buffer));
+      }
+      buffer_released_.notify_all();
+    }
+  }
+
+  const int num_streams_;
+  // The maximum number of ranges read and not appended to their copy yet.
+  const int max_num_buffers_;
+
+  std::vector<std::unique_ptr<File>> files_;
+  std::vector<Range> ranges_;
+
+  mutex mu_;
+  Status status_ TF_GUARDED_BY(mu_);
+  size_t next_range_ TF_GUARDED_BY(mu_) = 0;
+  int num_buffers_ TF_GUARDED_BY(mu_) = 0;
+  std::vector<std::unique_ptr<char[]>> free_buffers_ TF_GUARDED_BY(mu_);
+  condition_variable buffer_released_;
+};
+
 }  // namespace
 
 SessionOptions GetSessionOptions(const SessionBundleConfig& config) {
@@ -57,11 +324,57 @@ Status EstimateResourceFromPath(const string& path, bool use_validation_result,
                                       estimate);
 }
 
+Status PrefetchSavedModelVariables(const string& path, const int num_streams,
+                                   const string& local_copy_dir) {
+  Env* const env = Env::Default();
+  if (!local_copy_dir.empty()) {
+    TF_RETURN_IF_ERROR(
+        CopyDirectory(path, local_copy_dir,
+                      /*excluded=*/kSavedModelVariablesDirectory));
+  }
+  const string variables_dir =
+      io::JoinPath(path, kSavedModelVariablesDirectory);
+  if (!env->IsDirectory(variables_dir).ok()) {
+    // The model has no variables.
+    return Status::OK();
+  }
+  string local_variables_dir;
+  if (!local_copy_dir.empty()) {
+    local_variables_dir =
+        io::JoinPath(local_copy_dir, kSavedModelVariablesDirectory);
+    TF_RETURN_IF_ERROR(env->RecursivelyCreateDir(local_variables_dir));
+  }
+
+  std::vector<string> files;
+  TF_RETURN_IF_ERROR(env->GetChildren(variables_dir, &files));
+  VariableFilesReader reader(num_streams, /*copy=*/!local_copy_dir.empty());
+  for (const string& file : files) {
+    TF_RETURN_IF_ERROR(reader.AddFile(
+        io::JoinPath(variables_dir, file),
+        local_copy_dir.empty() ? ""
+                               : io::JoinPath(local_variables_dir, file)));
+  }
+  const uint64 start_micros = env->NowMicros();
+  TF_RETURN_IF_ERROR(reader.Read());
+  LOG(INFO) << "Read the variables of " << path << " with "
+            << reader.num_streams() << " streams in "
+            << (env->NowMicros() - start_micros) / 1000 << " ms";
+  return Status::OK();
+}
+
+Status CopyBackFilesWrittenToLocalCopy(const string& local_copy_dir,
+                                       const string& path) {
+  return CopyMissingFiles(local_copy_dir, path,
+                          /*excluded=*/kSavedModelVariablesDirectory);
+}
+
 Status WrapSessionForBatching(const BatchingParameters& batching_config,
                               std::shared_ptr<Batcher> batch_scheduler,
                               const std::vector<SignatureDef>& signatures,
                               std::unique_ptr<Session>* session,
-                              bool enable_default_schedule_creator) {
+                              bool enable_default_schedule_creator,
+                              const string& model_name,
+                              CrossVersionBatchingQueues* shared_queues) {
   LOG(INFO) << "Wrapping session to perform batch processing";
 
   if (batch_scheduler == nullptr) {
@@ -89,22 +402,138 @@ Status WrapSessionForBatching(const BatchingParameters& batching_config,
 
   batching_session_options.pad_variable_length_inputs =
       batching_config.pad_variable_length_inputs();
+  batching_session_options.split_instead_of_padding =
+      batching_config.split_instead_of_padding();
+  batching_session_options.split_large_requests =
+      !batching_config.has_split_large_requests() ||
+      batching_config.split_large_requests().value();
+
+  if (batching_config.ragged_inputs_size() > 0 &&
+      batching_config.enable_large_batch_splitting().value()) {
+    return errors::InvalidArgument(
+        "ragged_inputs is not supported with enable_large_batch_splitting");
+  }
+  for (const auto& ragged_input : batching_config.ragged_inputs()) {
+    BatchingSessionOptions::RaggedInput ragged_input_options;
+    ragged_input_options.values = ragged_input.values();
+    ragged_input_options.nested_row_splits.assign(
+        ragged_input.nested_row_splits().begin(),
+        ragged_input.nested_row_splits().end());
+    batching_session_options.ragged_inputs.push_back(
+        std::move(ragged_input_options));
+  }
+
+  batching_session_options.length_bucket_boundaries.assign(
+      batching_config.length_bucket_boundaries().begin(),
+      batching_config.length_bucket_boundaries().end());
+  if (batching_config.has_length_bucket_dim()) {
+    batching_session_options.length_bucket_dim =
+        batching_config.length_bucket_dim().value();
+  }
+  if (batching_config.has_max_concurrent_batches()) {
+    batching_session_options.max_concurrent_batches =
+        batching_config.max_concurrent_batches().value();
+  }
+  batching_session_options.earliest_deadline_first =
+      batching_config.earliest_deadline_first();
+  batching_session_options.num_pooled_input_buffers =
+      batching_config.num_pooled_input_buffers();
+  batching_session_options.large_request_min_rows =
+      batching_config.large_request_min_rows();
+  batching_session_options.split_outputs_on_requesting_threads =
+      batching_config.split_outputs_on_requesting_threads();
+  batching_session_options.model_name = model_name;
+
+  absl::optional<LatencyTunedBatchScheduler<BatchingSessionTask>::Options>
+      tuning_options;
+  if (batching_config.has_target_p99_latency_micros()) {
+    tuning_options.emplace();
+    tuning_options->target_latency_micros =
+        batching_config.target_p99_latency_micros().value();
+    tuning_options->batch_sizes =
+        batching_session_options.allowed_batch_sizes;
+    tuning_options->num_batch_threads =
+        batching_config.has_num_batch_threads()
+            ? batching_config.num_batch_threads().value()
+            : Batcher::Options().num_batch_threads;
+  }
 
-  auto create_queue = [batch_scheduler, queue_options](
+  auto create_queue_with_options = [batch_scheduler, tuning_options](
+      const Batcher::QueueOptions& options,
       std::function<void(std::unique_ptr<Batch<BatchingSessionTask>>)>
           process_batch_callback,
       std::unique_ptr<BatchScheduler<BatchingSessionTask>>* queue) {
-    TF_RETURN_IF_ERROR(batch_scheduler->AddQueue(
-        queue_options, process_batch_callback, queue));
+    if (tuning_options.has_value()) {
+      std::unique_ptr<LatencyTunedBatchScheduler<BatchingSessionTask>>
+          tuned_queue;
+      TF_RETURN_IF_ERROR(
+          LatencyTunedBatchScheduler<BatchingSessionTask>::Create(
+              *tuning_options, batch_scheduler, options,
+              process_batch_callback, &tuned_queue));
+      *queue = std::move(tuned_queue);
+      return Status::OK();
+    }
+    TF_RETURN_IF_ERROR(
+        batch_scheduler->AddQueue(options, process_batch_callback, queue));
     return Status::OK();
   };
+  auto create_queue = [create_queue_with_options, queue_options](
+      std::function<void(std::unique_ptr<Batch<BatchingSessionTask>>)>
+          process_batch_callback,
+      std::unique_ptr<BatchScheduler<BatchingSessionTask>>* queue) {
+    return create_queue_with_options(queue_options,
+                                     std::move(process_batch_callback), queue);
+  };
+  // The large requests have queues of their own, in each version. The queues
+  // are added to the same batcher, and share its batch threads.
+  BatchingSessionSchedulerCreator create_large_request_queue;
+  if (batching_config.large_request_min_rows() > 0) {
+    auto large_request_queue_options = queue_options;
+    if (batching_config.has_large_request_batch_timeout_micros()) {
+      large_request_queue_options.batch_timeout_micros =
+          batching_config.large_request_batch_timeout_micros().value();
+    }
+    create_large_request_queue = [create_queue_with_options,
+                                  large_request_queue_options](
+        std::function<void(std::unique_ptr<Batch<BatchingSessionTask>>)>
+            process_batch_callback,
+        std::unique_ptr<BatchScheduler<BatchingSessionTask>>* queue) {
+      return create_queue_with_options(large_request_queue_options,
+                                       std::move(process_batch_callback),
+                                       queue);
+    };
+  }
+  const bool share_queues = shared_queues != nullptr &&
+                            batching_config.share_queue_across_versions();
   std::vector<SignatureWithBatchingSessionSchedulerCreator>
       signatures_with_scheduler_creators;
   for (const SignatureDef& signature : signatures) {
     const TensorSignature tensor_signature =
         TensorSignatureFromSignatureDef(signature);
+    if (!share_queues) {
+      signatures_with_scheduler_creators.push_back(
+          {tensor_signature, create_queue, create_large_request_queue});
+      continue;
+    }
+    // As many threads process the extra sub-batches as there are batch threads.
+    const int num_sub_batch_threads =
+        batching_config.has_num_batch_threads()
+            ? batching_config.num_batch_threads().value()
+            : Batcher::Options().num_batch_threads;
+    std::shared_ptr<CrossVersionBatchingQueues::Queue> shared_queue;
+    TF_RETURN_IF_ERROR(shared_queues->GetOrCreate(
+        model_name, tensor_signature, queue_options, create_queue_with_options,
+        num_sub_batch_threads, &shared_queue));
     signatures_with_scheduler_creators.push_back(
-        {tensor_signature, create_queue});
+        {tensor_signature,
+         [shared_queue](
+             std::function<void(std::unique_ptr<Batch<BatchingSessionTask>>)>
+                 process_batch_callback,
+             std::unique_ptr<BatchScheduler<BatchingSessionTask>>* queue) {
+           return CrossVersionBatchingQueues::Queue::AddMember(
+               shared_queue, std::move(process_batch_callback), queue);
+         },
+         create_large_request_queue});
   }
 
   // TODO(b/184973097): Remove enable_default_schedule_creator once TFLite is
@@ -120,10 +549,258 @@ Status WrapSessionForBatching(const BatchingParameters& batching_config,
   }
 }
 
-Status WrapSession(std::unique_ptr<Session>* session) {
-  session->reset(new ServingSessionWrapper(std::move(*session)));
+Status CrossVersionBatchingQueues::GetOrCreate(
+    const string& model_name, const TensorSignature& signature,
+    const Queue::QueueOptions& queue_options,
+    const Queue::QueueCreator& queue_creator, const int num_sub_batch_threads,
+    std::shared_ptr<Queue>* queue) {
+  // The tensor names cannot contain commas or semicolons.
+  const string key = absl::StrCat(
+      model_name, ";", absl::StrJoin(signature.input_tensors, ","), ";",
+      absl::StrJoin(signature.output_tensors, ","));
+  mutex_lock l(mu_);
+  for (auto it = queues_.begin(); it != queues_.end();) {
+    if (it->second.expired()) {
+      it = queues_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  *queue = queues_[key].lock();
+  if (*queue != nullptr) {
+    return Status::OK();
+  }
+  TF_RETURN_IF_ERROR(Queue::Create(queue_options, queue_creator,
+                                   num_sub_batch_threads, queue));
+  queues_[key] = *queue;
   return Status::OK();
 }
 
+namespace {
+
+// Forwards the calls to a session, which it hands to ReusableSessions instead
+// of deleting it.
+class KeptOnDeleteSession : public Session {
+ public:
+  KeptOnDeleteSession(std::weak_ptr<ReusableSessions> reusable_sessions,
+                      const string& model_name, const uint64 graph_fingerprint,
+                      std::unique_ptr<Session> wrapped)
+      : reusable_sessions_(std::move(reusable_sessions)),
+        model_name_(model_name),
+        graph_fingerprint_(graph_fingerprint),
+        wrapped_(std::move(wrapped)) {}
+
+  ~KeptOnDeleteSession() override {
+    std::shared_ptr<ReusableSessions> reusable_sessions =
+        reusable_sessions_.lock();
+    if (reusable_sessions != nullptr) {
+      reusable_sessions->Keep(model_name_, graph_fingerprint_,
+                              std::move(wrapped_));
+    }
+  }
+
+  Status Create(const GraphDef& graph) override {
+    return wrapped_->Create(graph);
+  }
+
+  Status Extend(const GraphDef& graph) override {
+    return wrapped_->Extend(graph);
+  }
+
+  Status Close() override { return wrapped_->Close(); }
+
+  Status Run(const std::vector<std::pair<string, Tensor>>& inputs,
+             const std::vector<string>& output_tensor_names,
+             const std::vector<string>& target_node_names,
+             std::vector<Tensor>* outputs) override {
+    return wrapped_->Run(inputs, output_tensor_names, target_node_names,
+                         outputs);
+  }
+
+  Status Run(const RunOptions& run_options,
+             const std::vector<std::pair<string, Tensor>>& inputs,
+             const std::vector<string>& output_tensor_names,
+             const std::vector<string>& target_node_names,
+             std::vector<Tensor>* outputs, RunMetadata* run_metadata) override {
+    return wrapped_->Run(run_options, inputs, output_tensor_names,
+                         target_node_names, outputs, run_metadata);
+  }
+
+  Status Run(const RunOptions& run_options,
+             const std::vector<std::pair<string, Tensor>>& inputs,
+             const std::vector<string>& output_tensor_names,
+             const std::vector<string>& target_node_names,
+             std::vector<Tensor>* outputs, RunMetadata* run_metadata,
+             const thread::ThreadPoolOptions& thread_pool_options) override {
+    return wrapped_->Run(run_options, inputs, output_tensor_names,
+                         target_node_names, outputs, run_metadata,
+                         thread_pool_options);
+  }
+
+  Status ListDevices(std::vector<DeviceAttributes>* response) override {
+    return wrapped_->ListDevices(response);
+  }
+
+  Status LocalDeviceManager(const DeviceMgr** output) override {
+    return wrapped_->LocalDeviceManager(output);
+  }
+
+  Status MakeCallable(const CallableOptions& callable_options,
+                      CallableHandle* out_handle) override {
+    return wrapped_->MakeCallable(callable_options, out_handle);
+  }
+
+  Status RunCallable(CallableHandle handle,
+                     const std::vector<Tensor>& feed_tensors,
+                     std::vector<Tensor>* fetch_tensors,
+                     RunMetadata* run_metadata) override {
+    return wrapped_->RunCallable(handle, feed_tensors, fetch_tensors,
+                                 run_metadata);
+  }
+
+  Status RunCallable(
+      CallableHandle handle, const std::vector<Tensor>& feed_tensors,
+      std::vector<Tensor>* fetch_tensors, RunMetadata* run_metadata,
+      const thread::ThreadPoolOptions& thread_pool_options) override {
+    return wrapped_->RunCallable(handle, feed_tensors, fetch_tensors,
+                                 run_metadata, thread_pool_options);
+  }
+
+  Status ReleaseCallable(CallableHandle handle) override {
+    return wrapped_->ReleaseCallable(handle);
+  }
+
+ private:
+  const std::weak_ptr<ReusableSessions> reusable_sessions_;
+  const string model_name_;
+  const uint64 graph_fingerprint_;
+  std::unique_ptr<Session> wrapped_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(KeptOnDeleteSession);
+};
+
+}  // namespace
+
+uint64 MetaGraphFingerprint(const MetaGraphDef& meta_graph_def) {
+  // The map fields, e.g. the signatures, are serialized in key order.
+  return DeterministicProtoHash64(meta_graph_def);
+}
+
+ReusableSessions::ReusableSessions(const int64 ttl_micros)
+    : ttl_micros_(ttl_micros) {
+  if (ttl_micros_ > 0) {
+    PeriodicFunction::Options options;
+    options.thread_name_prefix = "ReusableSessions_DropExpired";
+    drop_expired_thread_.reset(
+        new PeriodicFunction([this]() { DropExpired(); }, ttl_micros_ / 2 + 1,
+                             options));
+  }
+}
+
+bool ReusableSessions::Expired(const KeptSession& kept) const {
+  return ttl_micros_ > 0 &&
+         Env::Default()->NowMicros() - kept.kept_micros >
+             static_cast<uint64>(ttl_micros_);
+}
+
+std::unique_ptr<Session> ReusableSessions::Take(
+    const string& model_name, const uint64 graph_fingerprint) {
+  std::unique_ptr<Session> session;
+  {
+    mutex_lock l(mu_);
+    auto it = sessions_.find(model_name);
+    if (it == sessions_.end()) {
+      return nullptr;
+    }
+    session = std::move(it->second.session);
+    const bool matches = it->second.graph_fingerprint == graph_fingerprint &&
+                         !Expired(it->second);
+    sessions_.erase(it);
+    if (matches) {
+      return session;
+    }
+  }
+  // The session is deleted outside of the lock, since it can take a while.
+  return nullptr;
+}
+
+void ReusableSessions::KeepOnDelete(const string& model_name,
+                                    const uint64 graph_fingerprint,
+                                    std::unique_ptr<Session>* session) {
+  session->reset(new KeptOnDeleteSession(shared_from_this(), model_name,
+                                         graph_fingerprint,
+                                         std::move(*session)));
+}
+
+void ReusableSessions::Keep(const string& model_name,
+                            const uint64 graph_fingerprint,
+                            std::unique_ptr<Session> session) {
+  mutex_lock l(mu_);
+  if (unaspired_models_.count(model_name) > 0) {
+    // The session is deleted outside of the lock.
+    return;
+  }
+  KeptSession& kept = sessions_[model_name];
+  kept.graph_fingerprint = graph_fingerprint;
+  kept.kept_micros = Env::Default()->NowMicros();
+  // The previous session, if any, is deleted outside of the lock.
+  kept.session.swap(session);
+}
+
+void ReusableSessions::SetModelAspired(const string& model_name,
+                                       const bool aspired) {
+  std::unique_ptr<Session> dropped_session;
+  mutex_lock l(mu_);
+  if (aspired) {
+    unaspired_models_.erase(model_name);
+    return;
+  }
+  unaspired_models_.insert(model_name);
+  auto it = sessions_.find(model_name);
+  if (it != sessions_.end()) {
+    dropped_session = std::move(it->second.session);
+    sessions_.erase(it);
+  }
+  // 'dropped_session' is deleted after the lock is released, being declared
+  // before it.
+}
+
+void ReusableSessions::DropExpired() {
+  std::vector<std::unique_ptr<Session>> dropped_sessions;
+  mutex_lock l(mu_);
+  for (auto it = sessions_.begin(); it != sessions_.end();) {
+    if (Expired(it->second)) {
+      LOG(INFO) << "Dropping the session kept for the next version of "
+                << it->first;
+      dropped_sessions.push_back(std::move(it->second.session));
+      it = sessions_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+Status WrapSession(std::unique_ptr<Session>* session,
+                   const bool cache_callables) {
+  session->reset(
+      new ServingSessionWrapper(std::move(*session), cache_callables));
+  return Status::OK();
+}
+
+void TransientRamBudget::Reserve(const uint64 bytes) {
+  mutex_lock l(mu_);
+  while (reserved_bytes_ > 0 && reserved_bytes_ + bytes > max_bytes_) {
+    released_.wait(l);
+  }
+  reserved_bytes_ += bytes;
+}
+
+void TransientRamBudget::Release(const uint64 bytes) {
+  mutex_lock l(mu_);
+  DCHECK_GE(reserved_bytes_, bytes);
+  reserved_bytes_ -= bytes;
+  released_.notify_all();
+}
+
 }  // namespace serving
 }  // namespace tensorflow
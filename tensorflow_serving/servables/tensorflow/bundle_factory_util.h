@@ -16,16 +16,29 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_BUNDLE_FACTORY_UTIL_H_
 #define TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_BUNDLE_FACTORY_UTIL_H_
 
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
 #include "google/protobuf/wrappers.pb.h"
+#include "tensorflow/core/kernels/batching_util/periodic_function.h"
 #include "tensorflow/core/kernels/batching_util/shared_batch_scheduler.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
 #include "tensorflow/core/protobuf/config.pb.h"
+#include "tensorflow/core/protobuf/meta_graph.pb.h"
 #include "tensorflow/core/public/session.h"
 #include "tensorflow/core/public/session_options.h"
 #include "tensorflow_serving/batching/batching_session.h"
+#include "tensorflow_serving/batching/cross_version_batch_queue.h"
 #include "tensorflow_serving/resources/resources.pb.h"
 #include "tensorflow_serving/servables/tensorflow/resource_estimator.h"
 #include "tensorflow_serving/servables/tensorflow/session_bundle_config.pb.h"
+#include "tensorflow_serving/util/cpu_affinity.h"
 #include "tensorflow_serving/util/file_probing_env.h"
 
 namespace tensorflow {
@@ -70,6 +83,11 @@ Status CreateBatchScheduler(
   if (batching_config.has_thread_pool_name()) {
     options.thread_pool_name = batching_config.thread_pool_name().value();
   }
+  const std::vector<int> batch_thread_cpus(
+      batching_config.batch_thread_cpus().begin(),
+      batching_config.batch_thread_cpus().end());
+  TF_RETURN_IF_ERROR(ValidateCpus(batch_thread_cpus, "batch threads"));
+  options.env = GetPinnedThreadsEnv(batch_thread_cpus);
   return SharedBatchScheduler<TaskType>::Create(options, batch_scheduler);
 }
 
@@ -85,7 +103,118 @@ Status CreateBatchScheduler(
 Status EstimateResourceFromPath(const string& path, bool use_validation_result,
                                 ResourceAllocation* estimate);
 
+// Reads the variable files of the SavedModel at 'path' with 'num_streams'
+// concurrent streams, each reading ranges of any of the files, ahead of their
+// restore which reads them with a single stream. If 'local_copy_dir' is set,
+// the SavedModel is copied there, to be loaded from it. Otherwise the files
+// are only read, e.g. into the page cache of the local file system.
+Status PrefetchSavedModelVariables(const string& path, int num_streams,
+                                   const string& local_copy_dir = "");
+
+// Copies the files written in the local copy 'local_copy_dir' of the
+// SavedModel at 'path' (see PrefetchSavedModelVariables()) while it was
+// loaded, i.e. the files missing from 'path', to 'path'. The files that the
+// ops of a model save next to their assets (e.g. the engine chosen by the
+// "autotune" engine of a TF-DF model) then outlive the copy, as if the model
+// was loaded from 'path'.
+Status CopyBackFilesWrittenToLocalCopy(const string& local_copy_dir,
+                                       const string& path);
+
+// The batching queues shared by the versions of the models, by model name and
+// signature (see BatchingParameters.share_queue_across_versions). A queue is
+// kept while a version uses it. This class is thread-safe.
+class CrossVersionBatchingQueues {
+ public:
+  using Queue = CrossVersionBatchQueue<BatchingSessionTask>;
+
+  // Returns the queue of 'signature' for the versions of 'model_name'. If no
+  // version uses one, creates it with 'queue_options', 'queue_creator' and
+  // 'num_sub_batch_threads' (see CrossVersionBatchQueue::Create()).
+  Status GetOrCreate(const string& model_name,
+                     const TensorSignature& signature,
+                     const Queue::QueueOptions& queue_options,
+                     const Queue::QueueCreator& queue_creator,
+                     int num_sub_batch_threads,
+                     std::shared_ptr<Queue>* queue) TF_LOCKS_EXCLUDED(mu_);
+
+ private:
+  mutex mu_;
+  std::map<string, std::weak_ptr<Queue>> queues_ TF_GUARDED_BY(mu_);
+};
+
+// Returns the fingerprint of 'meta_graph_def', for ReusableSessions.
+uint64 MetaGraphFingerprint(const MetaGraphDef& meta_graph_def);
+
+// The sessions of the unloaded versions of the models, kept to load the next
+// version of a model with an identical MetaGraphDef into (see
+// SessionBundleConfig.reuse_sessions_across_identical_versions). At most one
+// session is kept per model, for at most a TTL, and none for the models
+// without aspired versions, e.g. removed from the config. This class is
+// thread-safe.
+class ReusableSessions
+    : public std::enable_shared_from_this<ReusableSessions> {
+ public:
+  // The sessions are kept for at most 'ttl_micros', if positive, after which a
+  // thread drops them.
+  explicit ReusableSessions(int64 ttl_micros = 0);
+
+  // Returns the session kept for 'model_name' if its MetaGraphDef has
+  // 'graph_fingerprint', or nullptr. In the latter case, drops the session
+  // kept for the model, if any.
+  std::unique_ptr<Session> Take(const string& model_name,
+                                uint64 graph_fingerprint)
+      TF_LOCKS_EXCLUDED(mu_);
+
+  // Wraps 'session', of a version of 'model_name' whose MetaGraphDef has
+  // 'graph_fingerprint', so that it is kept once the wrapper is deleted, i.e.
+  // once the version is unloaded. Must be called on an instance owned by a
+  // std::shared_ptr, which the wrapper does not extend the lifetime of.
+  void KeepOnDelete(const string& model_name, uint64 graph_fingerprint,
+                    std::unique_ptr<Session>* session);
+
+  // Keeps 'session', in place of the session kept for 'model_name' if any.
+  // Drops it instead if the model has no aspired versions.
+  void Keep(const string& model_name, uint64 graph_fingerprint,
+            std::unique_ptr<Session> session) TF_LOCKS_EXCLUDED(mu_);
+
+  // Sets whether 'model_name' has aspired versions, which it has until
+  // called. While it has none, e.g. once removed from the config, drops the
+  // session kept for it and keeps none.
+  void SetModelAspired(const string& model_name, bool aspired)
+      TF_LOCKS_EXCLUDED(mu_);
+
+  // Drops the sessions kept for longer than the TTL.
+  void DropExpired() TF_LOCKS_EXCLUDED(mu_);
+
+ private:
+  struct KeptSession {
+    uint64 graph_fingerprint;
+    // When the session was kept, in microseconds.
+    uint64 kept_micros;
+    std::unique_ptr<Session> session;
+  };
+
+  // Returns whether 'kept' has been kept for longer than the TTL.
+  bool Expired(const KeptSession& kept) const;
+
+  const int64 ttl_micros_;
+
+  mutex mu_;
+  std::map<string, KeptSession> sessions_ TF_GUARDED_BY(mu_);
+  std::set<string> unaspired_models_ TF_GUARDED_BY(mu_);
+
+  // Calls DropExpired(), if the TTL is positive. Declared last, so that it
+  // stops first.
+  std::unique_ptr<PeriodicFunction> drop_expired_thread_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ReusableSessions);
+};
+
 // Wraps a session in a new session that automatically batches Run() calls.
+// If 'model_name' is set, the batches are recorded in BatchingStats under it.
+// If 'shared_queues' is set and 'batching_config' shares the queues across
+// versions, the signatures are batched in the queues of 'shared_queues' for
+// 'model_name'.
 // TODO(b/184973097): Remove enable_default_schedule_creator once TFLite is
 // fixed.
 Status WrapSessionForBatching(
@@ -93,10 +222,38 @@ Status WrapSessionForBatching(
     std::shared_ptr<SharedBatchScheduler<BatchingSessionTask>> batch_scheduler,
     const std::vector<SignatureDef>& signatures,
     std::unique_ptr<Session>* session,
-    bool enable_default_schedule_creator = false);
+    bool enable_default_schedule_creator = false,
+    const string& model_name = "",
+    CrossVersionBatchingQueues* shared_queues = nullptr);
 
 // Wraps a session in a new session that only supports Run() without batching.
-Status WrapSession(std::unique_ptr<Session>* session);
+// If 'cache_callables' is true, Run() calls go through cached callables of the
+// session, see ServingSessionWrapper.
+Status WrapSession(std::unique_ptr<Session>* session,
+                   bool cache_callables = false);
+
+// Bounds the combined transient RAM of the model loads in progress, so that
+// the number of concurrent loads is limited by their peak memory rather than
+// by the number of load threads. This class is thread-safe.
+class TransientRamBudget {
+ public:
+  explicit TransientRamBudget(uint64 max_bytes) : max_bytes_(max_bytes) {}
+
+  // Blocks until 'bytes' fit in the budget, and reserves them. If 'bytes'
+  // exceeds the whole budget, blocks until nothing else is reserved.
+  void Reserve(uint64 bytes) TF_LOCKS_EXCLUDED(mu_);
+
+  // Releases bytes reserved by Reserve().
+  void Release(uint64 bytes) TF_LOCKS_EXCLUDED(mu_);
+
+ private:
+  const uint64 max_bytes_;
+  mutex mu_;
+  condition_variable released_;
+  uint64 reserved_bytes_ TF_GUARDED_BY(mu_) = 0;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(TransientRamBudget);
+};
 
 // Construct Queue Options from BatchingParameters.
 template <typename TaskType>
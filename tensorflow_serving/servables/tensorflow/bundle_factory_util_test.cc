@@ -15,6 +15,9 @@ limitations under the License.
 
 #include "tensorflow_serving/servables/tensorflow/bundle_factory_util.h"
 
+#include <atomic>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstring>
 #include <memory>
 #include <string>
 #include <utility>
@@ -23,11 +26,19 @@ limitations under the License.
 #include "google/protobuf/wrappers.pb.h"
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include "absl/strings/match.h"
 #include "tensorflow/core/framework/tensor_testutil.h"
 #include "tensorflow/core/kernels/batching_util/shared_batch_scheduler.h"
+#include "tensorflow/core/lib/core/blocking_counter.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/notification.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
 #include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/null_file_system.h"
+#include "tensorflow/core/platform/test.h"
 #include "tensorflow/core/platform/test_benchmark.h"
 #include "tensorflow/core/protobuf/config.pb.h"
 #include "tensorflow/core/public/session.h"
@@ -91,6 +102,37 @@ TEST_F(BundleFactoryUtilTest, WrapSession) {
   test_util::TestSingleRequest(bundle.session.get());
 }
 
+TEST_F(BundleFactoryUtilTest, WrapSessionCachingCallables) {
+  SavedModelBundle bundle;
+  TF_ASSERT_OK(LoadSavedModel(SessionOptions(), RunOptions(), export_dir_,
+                              {"serve"}, &bundle));
+  TF_ASSERT_OK(WrapSession(&bundle.session, /*cache_callables=*/true));
+  // The concurrent first requests race to make the callable, and the later
+  // ones go through it.
+  test_util::TestMultipleRequests(10, bundle.session.get());
+  test_util::TestSingleRequest(bundle.session.get());
+
+  // Calls with different timeouts run as well.
+  for (const int64 timeout_in_ms : {1000, 2000}) {
+    RunOptions run_options;
+    run_options.set_timeout_in_ms(timeout_in_ms);
+    std::vector<Tensor> outputs;
+    TF_ASSERT_OK(bundle.session->Run(
+        run_options, {{"x:0", test::AsTensor<float>({2.0f}, {1})}}, {"y:0"},
+        {}, &outputs, nullptr));
+    ASSERT_EQ(1, outputs.size());
+    test::ExpectTensorEqual<float>(test::AsTensor<float>({3.0f}, {1}),
+                                   outputs[0]);
+  }
+
+  // Unknown tensors are still reported.
+  std::vector<Tensor> outputs;
+  EXPECT_FALSE(bundle.session
+                   ->Run({{"x:0", test::AsTensor<float>({1.0f}, {1})}},
+                         {"unknown:0"}, {}, &outputs)
+                   .ok());
+}
+
 TEST_F(BundleFactoryUtilTest, WrapSessionForBatching) {
   SavedModelBundle bundle;
   TF_ASSERT_OK(LoadSavedModel(SessionOptions(), RunOptions(), export_dir_,
@@ -113,6 +155,183 @@ TEST_F(BundleFactoryUtilTest, WrapSessionForBatching) {
   test_util::TestMultipleRequests(10, bundle.session.get());
 }
 
+TEST_F(BundleFactoryUtilTest, WrapSessionForBatchingWithLargeRequestLane) {
+  SavedModelBundle bundle;
+  TF_ASSERT_OK(LoadSavedModel(SessionOptions(), RunOptions(), export_dir_,
+                              {"serve"}, &bundle));
+
+  // The batches of the small requests only close after a long timeout, and
+  // the ones of the large requests at once.
+  constexpr int64 kSmallRequestBatchTimeoutMicros = 30 * 1000 * 1000;
+  BatchingParameters batching_params;
+  batching_params.mutable_max_batch_size()->set_value(4);
+  batching_params.mutable_batch_timeout_micros()->set_value(
+      kSmallRequestBatchTimeoutMicros);
+  batching_params.mutable_max_enqueued_batches()->set_value(INT_MAX);
+  batching_params.set_large_request_min_rows(2);
+  batching_params.mutable_large_request_batch_timeout_micros()->set_value(0);
+
+  std::shared_ptr<Batcher> batcher;
+  TF_ASSERT_OK(CreateBatchScheduler(batching_params, &batcher));
+  TF_ASSERT_OK(WrapSessionForBatching(batching_params, batcher,
+                                      {test_util::GetTestSessionSignature()},
+                                      &bundle.session));
+
+  // The requests of the test have 2 rows, so they are batched in the queue
+  // of the large requests, without waiting for the timeout of the small ones.
+  const uint64 start_micros = Env::Default()->NowMicros();
+  test_util::TestSingleRequest(bundle.session.get());
+  test_util::TestMultipleRequests(10, bundle.session.get());
+  EXPECT_LT(Env::Default()->NowMicros() - start_micros,
+            kSmallRequestBatchTimeoutMicros / 2);
+}
+
+TEST_F(BundleFactoryUtilTest, WrapSessionForBatchingAcrossVersions) {
+  BatchingParameters batching_params;
+  batching_params.mutable_max_batch_size()->set_value(2);
+  batching_params.mutable_max_enqueued_batches()->set_value(INT_MAX);
+  batching_params.set_share_queue_across_versions(true);
+  std::shared_ptr<Batcher> batcher;
+  TF_ASSERT_OK(CreateBatchScheduler(batching_params, &batcher));
+
+  // Two versions of the model share the queue of their signature.
+  CrossVersionBatchingQueues shared_queues;
+  std::vector<SavedModelBundle> bundles(2);
+  for (SavedModelBundle& bundle : bundles) {
+    TF_ASSERT_OK(LoadSavedModel(SessionOptions(), RunOptions(), export_dir_,
+                                {"serve"}, &bundle));
+    TF_ASSERT_OK(WrapSessionForBatching(
+        batching_params, batcher, {test_util::GetTestSessionSignature()},
+        &bundle.session, /*enable_default_schedule_creator=*/false,
+        "half_plus_two", &shared_queues));
+  }
+
+  std::unique_ptr<Thread> thread(
+      Env::Default()->StartThread(ThreadOptions(), "Canary", [&]() {
+        test_util::TestMultipleRequests(10, bundles[1].session.get());
+      }));
+  test_util::TestMultipleRequests(10, bundles[0].session.get());
+  thread.reset();
+}
+
+TEST_F(BundleFactoryUtilTest, CrossVersionBatchingQueues) {
+  CrossVersionBatchingQueues shared_queues;
+  std::shared_ptr<Batcher> batcher;
+  TF_ASSERT_OK(CreateBatchScheduler(BatchingParameters(), &batcher));
+  const CrossVersionBatchingQueues::Queue::QueueCreator queue_creator =
+      [batcher](const Batcher::QueueOptions& options,
+                CrossVersionBatchingQueues::Queue::ProcessBatchCallback
+                    process_batch_callback,
+                std::unique_ptr<BatchScheduler<BatchingSessionTask>>* queue) {
+        return batcher->AddQueue(options, std::move(process_batch_callback),
+                                 queue);
+      };
+  const TensorSignature signature = {{"x"}, {"y"}};
+  const TensorSignature other_signature = {{"x"}, {"z"}};
+
+  std::shared_ptr<CrossVersionBatchingQueues::Queue> queue;
+  TF_ASSERT_OK(shared_queues.GetOrCreate("model", signature,
+                                         Batcher::QueueOptions(), queue_creator,
+                                         /*num_sub_batch_threads=*/1, &queue));
+  std::shared_ptr<CrossVersionBatchingQueues::Queue> same_queue;
+  TF_ASSERT_OK(shared_queues.GetOrCreate(
+      "model", signature, Batcher::QueueOptions(), queue_creator,
+      /*num_sub_batch_threads=*/1, &same_queue));
+  EXPECT_EQ(queue, same_queue);
+
+  // Other models and signatures have their own queue.
+  std::shared_ptr<CrossVersionBatchingQueues::Queue> other_queue;
+  TF_ASSERT_OK(shared_queues.GetOrCreate(
+      "other_model", signature, Batcher::QueueOptions(), queue_creator,
+      /*num_sub_batch_threads=*/1, &other_queue));
+  EXPECT_NE(queue, other_queue);
+  TF_ASSERT_OK(shared_queues.GetOrCreate(
+      "model", other_signature, Batcher::QueueOptions(), queue_creator,
+      /*num_sub_batch_threads=*/1, &other_queue));
+  EXPECT_NE(queue, other_queue);
+}
+
+TEST_F(BundleFactoryUtilTest, ReusableSessions) {
+  auto reusable_sessions = std::make_shared<ReusableSessions>();
+  SavedModelBundle bundle;
+  TF_ASSERT_OK(LoadSavedModel(SessionOptions(), RunOptions(), export_dir_,
+                              {"serve"}, &bundle));
+  const uint64 graph_fingerprint = MetaGraphFingerprint(bundle.meta_graph_def);
+  Session* const raw_session = bundle.session.get();
+  reusable_sessions->KeepOnDelete("half_plus_two", graph_fingerprint,
+                                  &bundle.session);
+
+  // The session is only kept once its version is unloaded.
+  EXPECT_EQ(nullptr,
+            reusable_sessions->Take("half_plus_two", graph_fingerprint));
+  test_util::TestSingleRequest(bundle.session.get());
+  bundle.session.reset();
+  EXPECT_EQ(nullptr, reusable_sessions->Take("other", graph_fingerprint));
+  std::unique_ptr<Session> session =
+      reusable_sessions->Take("half_plus_two", graph_fingerprint);
+  EXPECT_EQ(raw_session, session.get());
+  test_util::TestSingleRequest(session.get());
+  EXPECT_EQ(nullptr,
+            reusable_sessions->Take("half_plus_two", graph_fingerprint));
+
+  // A session of another graph is dropped.
+  reusable_sessions->Keep("half_plus_two", graph_fingerprint,
+                          std::move(session));
+  EXPECT_EQ(nullptr,
+            reusable_sessions->Take("half_plus_two", graph_fingerprint + 1));
+  EXPECT_EQ(nullptr,
+            reusable_sessions->Take("half_plus_two", graph_fingerprint));
+}
+
+TEST_F(BundleFactoryUtilTest, ReusableSessionsExpire) {
+  auto reusable_sessions =
+      std::make_shared<ReusableSessions>(/*ttl_micros=*/1000);
+  SavedModelBundle bundle;
+  TF_ASSERT_OK(LoadSavedModel(SessionOptions(), RunOptions(), export_dir_,
+                              {"serve"}, &bundle));
+  const uint64 graph_fingerprint = MetaGraphFingerprint(bundle.meta_graph_def);
+  reusable_sessions->Keep("half_plus_two", graph_fingerprint,
+                          std::move(bundle.session));
+  Env::Default()->SleepForMicroseconds(2000);
+  reusable_sessions->DropExpired();
+  EXPECT_EQ(nullptr,
+            reusable_sessions->Take("half_plus_two", graph_fingerprint));
+}
+
+TEST_F(BundleFactoryUtilTest, ReusableSessionsOfUnaspiredModels) {
+  auto reusable_sessions = std::make_shared<ReusableSessions>();
+  SavedModelBundle bundle;
+  TF_ASSERT_OK(LoadSavedModel(SessionOptions(), RunOptions(), export_dir_,
+                              {"serve"}, &bundle));
+  const uint64 graph_fingerprint = MetaGraphFingerprint(bundle.meta_graph_def);
+
+  // The session kept for a model is dropped once it has no aspired versions.
+  reusable_sessions->Keep("half_plus_two", graph_fingerprint,
+                          std::move(bundle.session));
+  reusable_sessions->SetModelAspired("half_plus_two", false);
+  EXPECT_EQ(nullptr,
+            reusable_sessions->Take("half_plus_two", graph_fingerprint));
+
+  // Nor is the session of its last version kept once unloaded.
+  TF_ASSERT_OK(LoadSavedModel(SessionOptions(), RunOptions(), export_dir_,
+                              {"serve"}, &bundle));
+  reusable_sessions->KeepOnDelete("half_plus_two", graph_fingerprint,
+                                  &bundle.session);
+  bundle.session.reset();
+  EXPECT_EQ(nullptr,
+            reusable_sessions->Take("half_plus_two", graph_fingerprint));
+
+  // Until it has aspired versions again.
+  TF_ASSERT_OK(LoadSavedModel(SessionOptions(), RunOptions(), export_dir_,
+                              {"serve"}, &bundle));
+  Session* const raw_session = bundle.session.get();
+  reusable_sessions->SetModelAspired("half_plus_two", true);
+  reusable_sessions->Keep("half_plus_two", graph_fingerprint,
+                          std::move(bundle.session));
+  EXPECT_EQ(raw_session,
+            reusable_sessions->Take("half_plus_two", graph_fingerprint).get());
+}
+
 TEST_F(BundleFactoryUtilTest, BatchingConfigError) {
   BatchingParameters batching_params;
   batching_params.mutable_max_batch_size()->set_value(2);
@@ -124,6 +343,13 @@ TEST_F(BundleFactoryUtilTest, BatchingConfigError) {
   EXPECT_FALSE(CreateBatchScheduler(batching_params, &batch_scheduler).ok());
 }
 
+TEST_F(BundleFactoryUtilTest, BatchThreadCpusError) {
+  BatchingParameters batching_params;
+  batching_params.add_batch_thread_cpus(-1);
+  std::shared_ptr<Batcher> batch_scheduler;
+  EXPECT_FALSE(CreateBatchScheduler(batching_params, &batch_scheduler).ok());
+}
+
 TEST_F(BundleFactoryUtilTest, EstimateResourceFromPathWithBadExport) {
   ResourceAllocation resource_requirement;
   const Status status = EstimateResourceFromPath(
@@ -144,6 +370,199 @@ TEST_F(BundleFactoryUtilTest, EstimateResourceFromPathWithGoodExport) {
   EXPECT_THAT(actual, EqualsProto(expected));
 }
 
+TEST_F(BundleFactoryUtilTest, PrefetchSavedModelVariables) {
+  TF_ASSERT_OK(PrefetchSavedModelVariables(export_dir_, /*num_streams=*/4));
+  EXPECT_FALSE(PrefetchSavedModelVariables("/a/bogus/export/dir",
+                                           /*num_streams=*/4,
+                                           io::JoinPath(testing::TmpDir(),
+                                                        "bogus_copy"))
+                   .ok());
+}
+
+TEST_F(BundleFactoryUtilTest, PrefetchSavedModelVariablesToLocalCopy) {
+  const string local_copy_dir =
+      io::JoinPath(testing::TmpDir(), "prefetched_half_plus_two");
+  TF_ASSERT_OK(PrefetchSavedModelVariables(export_dir_, /*num_streams=*/4,
+                                           local_copy_dir));
+
+  // The copy has the same files, e.g. the variables and the assets.
+  std::vector<string> files;
+  TF_ASSERT_OK(Env::Default()->GetMatchingPaths(
+      io::JoinPath(export_dir_, "*", "*"), &files));
+  ASSERT_FALSE(files.empty());
+  for (const string& file : files) {
+    string contents, copied_contents;
+    TF_ASSERT_OK(ReadFileToString(Env::Default(), file, &contents));
+    TF_ASSERT_OK(ReadFileToString(
+        Env::Default(),
+        io::JoinPath(local_copy_dir, file.substr(export_dir_.size())),
+        &copied_contents));
+    EXPECT_EQ(contents, copied_contents) << file;
+  }
+  SavedModelBundle bundle;
+  TF_ASSERT_OK(LoadSavedModel(SessionOptions(), RunOptions(), local_copy_dir,
+                              {"serve"}, &bundle));
+}
+
+// The number of variable files of the SavedModels of RendezvousFileSystem.
+constexpr int kNumRendezvousVariableFiles = 4;
+
+// A file system of SavedModels of kNumRendezvousVariableFiles small variable
+// files, whose reads wait for a read of each file to be in progress.
+class RendezvousFileSystem : public NullFileSystem {
+ public:
+  TF_USE_FILESYSTEM_METHODS_WITH_NO_TRANSACTION_SUPPORT;
+
+  static std::unique_ptr<BlockingCounter> rendezvous;
+  static std::atomic<int> num_missed_rendezvous;
+
+  Status NewRandomAccessFile(
+      const string& fname, TransactionToken* token,
+      std::unique_ptr<RandomAccessFile>* result) override {
+    result->reset(new File);
+    return Status::OK();
+  }
+
+  Status FileExists(const string& fname, TransactionToken* token) override {
+    return Status::OK();
+  }
+
+  Status GetChildren(const string& dir, TransactionToken* token,
+                     std::vector<string>* result) override {
+    result->clear();
+    if (!absl::EndsWith(dir, "/variables")) {
+      result->push_back("variables");
+      return Status::OK();
+    }
+    for (int i = 0; i < kNumRendezvousVariableFiles; ++i) {
+      result->push_back(strings::StrCat("variables.data-0000", i, "-of-0000",
+                                        kNumRendezvousVariableFiles));
+    }
+    return Status::OK();
+  }
+
+  Status GetFileSize(const string& fname, TransactionToken* token,
+                     uint64* file_size) override {
+    *file_size = 1024;
+    return Status::OK();
+  }
+
+  Status IsDirectory(const string& fname, TransactionToken* token) override {
+    if (absl::StrContains(fname, "/variables.data-")) {
+      return errors::FailedPrecondition(fname, " is not a directory");
+    }
+    return Status::OK();
+  }
+
+ private:
+  class File : public RandomAccessFile {
+   public:
+    Status Read(uint64 offset, size_t n, StringPiece* result,
+                char* scratch) const override {
+      rendezvous->DecrementCount();
+      if (!rendezvous->WaitFor(std::chrono::seconds(10))) {
+        ++num_missed_rendezvous;
+      }
+      std::memset(scratch, 0, n);
+      *result = StringPiece(scratch, n);
+      return Status::OK();
+    }
+  };
+};
+
+std::unique_ptr<BlockingCounter> RendezvousFileSystem::rendezvous;
+std::atomic<int> RendezvousFileSystem::num_missed_rendezvous;
+
+REGISTER_FILE_SYSTEM("rendezvous", RendezvousFileSystem);
+
+TEST_F(BundleFactoryUtilTest, PrefetchSavedModelVariablesReadsFilesInParallel) {
+  // The files fit in one range each, so the streams must read several files
+  // at once to meet.
+  RendezvousFileSystem::rendezvous.reset(
+      new BlockingCounter(kNumRendezvousVariableFiles));
+  RendezvousFileSystem::num_missed_rendezvous = 0;
+  TF_ASSERT_OK(PrefetchSavedModelVariables(
+      "rendezvous://model", /*num_streams=*/kNumRendezvousVariableFiles));
+  EXPECT_EQ(0, RendezvousFileSystem::num_missed_rendezvous);
+
+  // Likewise for the local copy.
+  RendezvousFileSystem::rendezvous.reset(
+      new BlockingCounter(kNumRendezvousVariableFiles));
+  const string local_copy_dir =
+      io::JoinPath(testing::TmpDir(), "prefetched_rendezvous");
+  TF_ASSERT_OK(Env::Default()->RecursivelyCreateDir(local_copy_dir));
+  TF_ASSERT_OK(PrefetchSavedModelVariables(
+      "rendezvous://model", /*num_streams=*/kNumRendezvousVariableFiles,
+      local_copy_dir));
+  EXPECT_EQ(0, RendezvousFileSystem::num_missed_rendezvous);
+  std::vector<string> copied_files;
+  TF_ASSERT_OK(Env::Default()->GetMatchingPaths(
+      io::JoinPath(local_copy_dir, "variables", "*"), &copied_files));
+  EXPECT_THAT(copied_files, ::testing::SizeIs(kNumRendezvousVariableFiles));
+  for (const string& file : copied_files) {
+    uint64 file_size;
+    TF_ASSERT_OK(Env::Default()->GetFileSize(file, &file_size));
+    EXPECT_EQ(1024u, file_size) << file;
+  }
+}
+
+TEST_F(BundleFactoryUtilTest, CopyBackFilesWrittenToLocalCopy) {
+  Env* const env = Env::Default();
+  const string model_dir = io::JoinPath(testing::TmpDir(), "copied_back_model");
+  TF_ASSERT_OK(env->RecursivelyCreateDir(io::JoinPath(model_dir, "assets")));
+  TF_ASSERT_OK(WriteStringToFile(
+      env, io::JoinPath(model_dir, "assets", "model.bin"), "model"));
+  const string local_copy_dir =
+      io::JoinPath(testing::TmpDir(), "copied_back_model_copy");
+  TF_ASSERT_OK(PrefetchSavedModelVariables(model_dir, /*num_streams=*/2,
+                                           local_copy_dir));
+
+  // The load writes a file next to the assets, and the variables.
+  TF_ASSERT_OK(WriteStringToFile(
+      env, io::JoinPath(local_copy_dir, "assets", "model.bin"), "modified"));
+  TF_ASSERT_OK(WriteStringToFile(
+      env, io::JoinPath(local_copy_dir, "assets", "model.bin.autotune"),
+      "flat"));
+  TF_ASSERT_OK(
+      env->RecursivelyCreateDir(io::JoinPath(local_copy_dir, "variables")));
+  TF_ASSERT_OK(WriteStringToFile(
+      env, io::JoinPath(local_copy_dir, "variables", "variables.index"), ""));
+  TF_ASSERT_OK(CopyBackFilesWrittenToLocalCopy(local_copy_dir, model_dir));
+
+  // Only the new file is copied back, and the variables are left alone.
+  string contents;
+  TF_ASSERT_OK(ReadFileToString(
+      env, io::JoinPath(model_dir, "assets", "model.bin.autotune"),
+      &contents));
+  EXPECT_EQ("flat", contents);
+  TF_ASSERT_OK(ReadFileToString(
+      env, io::JoinPath(model_dir, "assets", "model.bin"), &contents));
+  EXPECT_EQ("model", contents);
+  EXPECT_FALSE(env->FileExists(io::JoinPath(model_dir, "variables")).ok());
+}
+
+TEST_F(BundleFactoryUtilTest, TransientRamBudget) {
+  TransientRamBudget budget(/*max_bytes=*/100);
+  budget.Reserve(60);
+
+  // The second reservation does not fit until the first one is released.
+  Notification reserved;
+  std::unique_ptr<Thread> thread(
+      Env::Default()->StartThread(ThreadOptions(), "Reserve", [&]() {
+        budget.Reserve(50);
+        reserved.Notify();
+      }));
+  EXPECT_FALSE(reserved.WaitForNotificationWithTimeout(10 * 1000));
+  budget.Release(60);
+  reserved.WaitForNotification();
+  thread.reset();
+  budget.Release(50);
+
+  // A reservation over the whole budget is made once nothing else is.
+  budget.Reserve(200);
+  budget.Release(200);
+}
+
 #ifdef PLATFORM_GOOGLE
 // This benchmark relies on https://github.com/google/benchmark features,
 // not available in open-sourced TF codebase.
@@ -78,8 +78,9 @@ class SavedModelTensorFlowClassifier : public ClassifierInterface {
                          /*runtime=*/"TF1", runtime_latency);
 
     TRACELITERAL("ConvertToClassificationResult");
-    return PostProcessClassificationResult(
-        *signature_, num_examples, output_tensor_names, outputs, result);
+    return PostProcessClassificationResult(request, *signature_, num_examples,
+                                           output_tensor_names, outputs,
+                                           result);
   }
 
  private:
@@ -225,6 +226,15 @@ Status PostProcessClassificationResult(
     const SignatureDef& signature, int num_examples,
     const std::vector<string>& output_tensor_names,
     const std::vector<Tensor>& output_tensors, ClassificationResult* result) {
+  return PostProcessClassificationResult(
+      ClassificationRequest::default_instance(), signature, num_examples,
+      output_tensor_names, output_tensors, result);
+}
+
+Status PostProcessClassificationResult(
+    const ClassificationRequest& request, const SignatureDef& signature,
+    int num_examples, const std::vector<string>& output_tensor_names,
+    const std::vector<Tensor>& output_tensors, ClassificationResult* result) {
   if (output_tensors.size() != output_tensor_names.size()) {
     return errors::InvalidArgument(
         strings::StrCat("Expected ", output_tensor_names.size(),
@@ -305,17 +315,23 @@ Status PostProcessClassificationResult(
     num_classes = scores->dim_size(1);
   }
 
-  // Convert the output to ClassificationResult format.
+  // Convert the output to ClassificationResult format, only keeping the
+  // classes selected by the request.
+  std::vector<int> class_indices;
   for (int i = 0; i < num_examples; ++i) {
+    const float* example_scores =
+        scores ? &(scores->matrix<float>())(i, 0) : nullptr;
+    TF_RETURN_IF_ERROR(SelectClassificationClasses(
+        request, example_scores, num_classes, &class_indices));
     serving::Classifications* classifications = result->add_classifications();
-    for (int c = 0; c < num_classes; ++c) {
+    for (const int c : class_indices) {
       serving::Class* cl = classifications->add_classes();
       if (classes) {
         const tstring& class_tstr = (classes->matrix<tstring>())(i, c);
         cl->set_label(class_tstr.data(), class_tstr.size());
       }
       if (scores) {
-        cl->set_score((scores->matrix<float>())(i, c));
+        cl->set_score(example_scores[c]);
       }
     }
   }
@@ -76,6 +76,13 @@ Status PostProcessClassificationResult(
     const std::vector<string>& output_tensor_names,
     const std::vector<Tensor>& output_tensors, ClassificationResult* result);
 
+// Like above, but only populates the classes selected by the top_k and
+// min_score of 'request' (see SelectClassificationClasses()).
+Status PostProcessClassificationResult(
+    const ClassificationRequest& request, const SignatureDef& signature,
+    int num_examples, const std::vector<string>& output_tensor_names,
+    const std::vector<Tensor>& output_tensors, ClassificationResult* result);
+
 // Creates SavedModelTensorflowClassifier and runs Classification on it.
 Status RunClassify(const RunOptions& run_options,
                    const MetaGraphDef& meta_graph_def,
@@ -392,6 +392,46 @@ TEST_P(ClassifierTest, ExampleList) {
                                              " } "));
 }
 
+TEST_P(ClassifierTest, TopKAndMinScore) {
+  TF_ASSERT_OK(Create());
+  auto* examples =
+      request_.mutable_input()->mutable_example_list()->mutable_examples();
+  *examples->Add() = example({{"dos", 2}, {"uno", 1}});
+  *examples->Add() = example({{"cuatro", 4}, {"tres", 3}});
+  request_.set_top_k(1);
+  TF_ASSERT_OK(classifier_->Classify(request_, &result_));
+  EXPECT_THAT(result_, EqualsProto(" classifications { "
+                                   "   classes { "
+                                   "     label: 'dos' "
+                                   "     score: 2 "
+                                   "   } "
+                                   " } "
+                                   " classifications { "
+                                   "   classes { "
+                                   "     label: 'cuatro' "
+                                   "     score: 4 "
+                                   "   } "
+                                   " } "));
+
+  request_.set_top_k(0);
+  request_.mutable_min_score()->set_value(2.5);
+  ClassificationResponse response;
+  TF_ASSERT_OK(RunClassify(GetRunOptions(), saved_model_bundle_->meta_graph_def,
+                           {}, fake_session_, request_, &response));
+  EXPECT_THAT(response.result(), EqualsProto(" classifications { "
+                                             " } "
+                                             " classifications { "
+                                             "   classes { "
+                                             "     label: 'cuatro' "
+                                             "     score: 4 "
+                                             "   } "
+                                             "   classes { "
+                                             "     label: 'tres' "
+                                             "     score: 3 "
+                                             "   } "
+                                             " } "));
+}
+
 TEST_P(ClassifierTest, ExampleListWithContext) {
   TF_ASSERT_OK(Create());
   auto* list_and_context =
@@ -45,11 +45,8 @@ Status ValidateGetModelMetadataRequest(const GetModelMetadataRequest& request) {
   return tensorflow::Status::OK();
 }
 
-Status SavedModelGetSignatureDef(ServerCore* core, const ModelSpec& model_spec,
-                                 const GetModelMetadataRequest& request,
-                                 GetModelMetadataResponse* response) {
-  ServableHandle<SavedModelBundle> bundle;
-  TF_RETURN_IF_ERROR(core->GetServableHandle(model_spec, &bundle));
+void SavedModelGetSignatureDef(const ServableHandle<SavedModelBundle>& bundle,
+                               GetModelMetadataResponse* response) {
   SignatureDefMap signature_def_map;
   for (const auto& signature : bundle->meta_graph_def.signature_def()) {
     (*signature_def_map.mutable_signature_def())[signature.first] =
@@ -61,11 +58,53 @@ Status SavedModelGetSignatureDef(ServerCore* core, const ModelSpec& model_spec,
 
   (*response->mutable_metadata())[GetModelMetadataImpl::kSignatureDef].PackFrom(
       signature_def_map);
-  return tensorflow::Status::OK();
 }
 
 }  // namespace
 
+Status ModelMetadataCache::Entry::GetJson(const JsonConverter& to_json,
+                                          string* json) const {
+  mutex_lock l(mu_);
+  if (!has_json_) {
+    TF_RETURN_IF_ERROR(to_json(response_, &json_));
+    has_json_ = true;
+  }
+  *json = json_;
+  return Status::OK();
+}
+
+std::shared_ptr<ModelMetadataCache> ModelMetadataCache::Create(
+    ServerCore* core) {
+  auto cache = std::make_shared<ModelMetadataCache>();
+  std::weak_ptr<ModelMetadataCache> weak_cache = cache;
+  core->servable_state_monitor()->Notify(
+      [weak_cache](const ServableState& state) {
+        std::shared_ptr<ModelMetadataCache> cache = weak_cache.lock();
+        if (cache != nullptr) {
+          cache->Erase(state.id);
+        }
+      });
+  return cache;
+}
+
+std::shared_ptr<const ModelMetadataCache::Entry> ModelMetadataCache::Lookup(
+    const ServableId& id) const {
+  mutex_lock l(mu_);
+  auto it = entries_.find(id);
+  return it == entries_.end() ? nullptr : it->second;
+}
+
+void ModelMetadataCache::Insert(const ServableId& id,
+                                std::shared_ptr<const Entry> entry) {
+  mutex_lock l(mu_);
+  entries_[id] = std::move(entry);
+}
+
+void ModelMetadataCache::Erase(const ServableId& id) {
+  mutex_lock l(mu_);
+  entries_.erase(id);
+}
+
 constexpr const char GetModelMetadataImpl::kSignatureDef[];
 
 Status GetModelMetadataImpl::GetModelMetadata(
@@ -86,8 +125,9 @@ Status GetModelMetadataImpl::GetModelMetadataWithModelSpec(
   TF_RETURN_IF_ERROR(ValidateGetModelMetadataRequest(request));
   for (const auto& metadata_field : request.metadata_field()) {
     if (metadata_field == kSignatureDef) {
-      TF_RETURN_IF_ERROR(
-          SavedModelGetSignatureDef(core, model_spec, request, response));
+      ServableHandle<SavedModelBundle> bundle;
+      TF_RETURN_IF_ERROR(core->GetServableHandle(model_spec, &bundle));
+      SavedModelGetSignatureDef(bundle, response);
     } else {
       return tensorflow::errors::InvalidArgument(
           "MetadataField ", metadata_field, " is not supported");
@@ -96,5 +136,32 @@ Status GetModelMetadataImpl::GetModelMetadataWithModelSpec(
   return tensorflow::Status::OK();
 }
 
+Status GetModelMetadataImpl::GetCachedModelMetadata(
+    ServerCore* core, const GetModelMetadataRequest& request,
+    ModelMetadataCache* cache,
+    std::shared_ptr<const ModelMetadataCache::Entry>* metadata) {
+  if (!request.has_model_spec()) {
+    return tensorflow::Status(tensorflow::error::INVALID_ARGUMENT,
+                              "Missing ModelSpec");
+  }
+  // The only supported field is kSignatureDef, so the metadata of a version
+  // is the same for all the valid requests.
+  TF_RETURN_IF_ERROR(ValidateGetModelMetadataRequest(request));
+  ServableHandle<SavedModelBundle> bundle;
+  TF_RETURN_IF_ERROR(core->GetServableHandle(request.model_spec(), &bundle));
+  *metadata = cache->Lookup(bundle.id());
+  if (*metadata != nullptr) {
+    return Status::OK();
+  }
+  GetModelMetadataResponse response;
+  SavedModelGetSignatureDef(bundle, &response);
+  *metadata = std::make_shared<const ModelMetadataCache::Entry>(
+      std::move(response));
+  // The entry is inserted before the handle is released, so that the
+  // version cannot be unloaded yet.
+  cache->Insert(bundle.id(), *metadata);
+  return Status::OK();
+}
+
 }  // namespace serving
 }  // namespace tensorflow
@@ -16,13 +16,70 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_GET_MODEL_METADATA_IMPL_H_
 #define TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_GET_MODEL_METADATA_IMPL_H_
 
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
 #include "tensorflow_serving/apis/get_model_metadata.pb.h"
+#include "tensorflow_serving/core/servable_id.h"
 #include "tensorflow_serving/model_servers/server_core.h"
 
 namespace tensorflow {
 namespace serving {
 
+// Caches the metadata of servable versions, so that it is not rebuilt and
+// serialized again for each request. The entry of a version is dropped
+// whenever its state changes, e.g. once it is unloaded.
+//
+// This class is thread-safe.
+class ModelMetadataCache {
+ public:
+  // The metadata of a servable version, and its JSON once requested.
+  class Entry {
+   public:
+    using JsonConverter =
+        std::function<Status(const GetModelMetadataResponse&, string*)>;
+
+    explicit Entry(GetModelMetadataResponse response)
+        : response_(std::move(response)) {}
+
+    const GetModelMetadataResponse& response() const { return response_; }
+
+    // Sets 'json' to the JSON of response(), converted by 'to_json' on the
+    // first call only.
+    Status GetJson(const JsonConverter& to_json, string* json) const;
+
+   private:
+    const GetModelMetadataResponse response_;
+    mutable mutex mu_;
+    mutable bool has_json_ TF_GUARDED_BY(mu_) = false;
+    mutable string json_ TF_GUARDED_BY(mu_);
+  };
+
+  // Returns a cache whose entries are dropped as per the ServableStateMonitor
+  // of 'core'. The cache may outlive 'core'.
+  static std::shared_ptr<ModelMetadataCache> Create(ServerCore* core);
+
+  // Returns the entry of 'id', or nullptr.
+  std::shared_ptr<const Entry> Lookup(const ServableId& id) const;
+
+  // Inserts the entry of 'id'. Must be called while holding a handle to the
+  // version, so that the entry cannot outlive it.
+  void Insert(const ServableId& id, std::shared_ptr<const Entry> entry);
+
+  void Erase(const ServableId& id);
+
+ private:
+  mutable mutex mu_;
+  std::unordered_map<ServableId, std::shared_ptr<const Entry>, HashServableId>
+      entries_ TF_GUARDED_BY(mu_);
+};
+
 class GetModelMetadataImpl {
  public:
   static constexpr const char kSignatureDef[] = "signature_def";
@@ -37,6 +94,13 @@ class GetModelMetadataImpl {
       ServerCore* core, const ModelSpec& model_spec,
       const GetModelMetadataRequest& request,
       GetModelMetadataResponse* response);
+
+  // Like GetModelMetadata(), but sets 'metadata' to the entry of the servable
+  // version in 'cache', which is inserted on the first request.
+  static Status GetCachedModelMetadata(
+      ServerCore* core, const GetModelMetadataRequest& request,
+      ModelMetadataCache* cache,
+      std::shared_ptr<const ModelMetadataCache::Entry>* metadata);
 };
 
 }  // namespace serving
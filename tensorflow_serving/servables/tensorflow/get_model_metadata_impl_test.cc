@@ -230,6 +230,53 @@ TEST_P(GetModelMetadataImplTest, ModelSpecOverride) {
                 .code());
 }
 
+TEST_P(GetModelMetadataImplTest, CachedModelMetadata) {
+  auto request = test_util::CreateProto<GetModelMetadataRequest>(
+      "model_spec {"
+      "  name: \"test_model\""
+      "}");
+  std::shared_ptr<ModelMetadataCache> cache =
+      ModelMetadataCache::Create(GetServerCore());
+  std::shared_ptr<const ModelMetadataCache::Entry> metadata;
+  EXPECT_EQ(tensorflow::error::INVALID_ARGUMENT,
+            GetModelMetadataImpl::GetCachedModelMetadata(
+                GetServerCore(), request, cache.get(), &metadata)
+                .code());
+
+  request.add_metadata_field(GetModelMetadataImpl::kSignatureDef);
+  TF_ASSERT_OK(GetModelMetadataImpl::GetCachedModelMetadata(
+      GetServerCore(), request, cache.get(), &metadata));
+  GetModelMetadataResponse response;
+  TF_ASSERT_OK(GetModelMetadataImpl::GetModelMetadata(GetServerCore(), request,
+                                                      &response));
+  EXPECT_THAT(metadata->response(), test_util::EqualsProto(response));
+
+  // The entry, and its JSON, are reused by the next requests.
+  int num_conversions = 0;
+  auto to_json = [&num_conversions](const GetModelMetadataResponse& converted,
+                                    string* converted_json) {
+    ++num_conversions;
+    *converted_json = converted.model_spec().name();
+    return Status::OK();
+  };
+  std::shared_ptr<const ModelMetadataCache::Entry> cached_metadata;
+  TF_ASSERT_OK(GetModelMetadataImpl::GetCachedModelMetadata(
+      GetServerCore(), request, cache.get(), &cached_metadata));
+  EXPECT_EQ(cached_metadata, metadata);
+  string json;
+  TF_ASSERT_OK(cached_metadata->GetJson(to_json, &json));
+  TF_ASSERT_OK(cached_metadata->GetJson(to_json, &json));
+  EXPECT_EQ(json, "test_model");
+  EXPECT_EQ(num_conversions, 1);
+
+  // A version whose state changes, e.g. once unloaded, is dropped.
+  cache->Erase({kTestModelName, kTestModelVersion});
+  TF_ASSERT_OK(GetModelMetadataImpl::GetCachedModelMetadata(
+      GetServerCore(), request, cache.get(), &cached_metadata));
+  EXPECT_NE(cached_metadata, metadata);
+  EXPECT_THAT(cached_metadata->response(), test_util::EqualsProto(response));
+}
+
 // Test all ClassifierTest test cases with both SessionBundle and SavedModel.
 INSTANTIATE_TEST_CASE_P(UseSavedModel, GetModelMetadataImplTest,
                         IsTensorflowServingOSS() ? ::testing::Values(true)
@@ -15,8 +15,15 @@ limitations under the License.
 
 #include "tensorflow_serving/servables/tensorflow/multi_inference.h"
 
+#include <utility>
+#include <vector>
+
 #include "tensorflow/cc/saved_model/signature_constants.h"
+#include "tensorflow/core/framework/attr_value_util.h"
+#include "tensorflow/core/framework/node_def_util.h"
+#include "tensorflow/core/framework/op.h"
 #include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/graph/tensor_id.h"
 #include "tensorflow/core/platform/tracing.h"
 #include "tensorflow_serving/apis/input.pb.h"
 #include "tensorflow_serving/apis/model.pb.h"
@@ -26,6 +33,162 @@ limitations under the License.
 
 namespace tensorflow {
 namespace serving {
+namespace {
+
+// Returns the names of all the output tensors of `node`, or an empty list if
+// its op is not known.
+std::vector<string> GetOutputTensorNames(const NodeDef& node) {
+  const OpDef* op_def;
+  DataTypeVector output_types;
+  if (!OpRegistry::Global()->LookUpOpDef(node.op(), &op_def).ok() ||
+      !OutputTypesForNode(node, *op_def, &output_types).ok()) {
+    return {};
+  }
+  std::vector<string> names;
+  for (int i = 0; i < output_types.size(); ++i) {
+    names.push_back(strings::StrCat(node.name(), ":", i));
+  }
+  return names;
+}
+
+// Like PerformOneShotTensorComputation(), but when several of
+// `input_tensor_names` are parsed by equivalent example parsing ops, parses the
+// examples with only one of them in a first Session::Run(), and feeds its
+// outputs in place of those of the others in a second one.
+Status PerformOneShotTensorComputationWithSharedParsing(
+    const RunOptions& run_options, const Input& input,
+    const std::set<string>& input_tensor_names,
+    const std::vector<string>& output_tensor_names,
+    const ExampleParsingIndex& index, Session* session,
+    std::vector<Tensor>* outputs, int* num_input_examples,
+    const thread::ThreadPoolOptions& thread_pool_options) {
+  // Groups of equivalent parsing ops, the first of which does the parsing.
+  std::vector<std::vector<const NodeDef*>> parsing_groups;
+  for (const string& input_tensor_name : input_tensor_names) {
+    const NodeDef* parsing_node =
+        index.FindExampleParsingNode(input_tensor_name);
+    if (parsing_node == nullptr) {
+      continue;
+    }
+    bool grouped = false;
+    for (auto& group : parsing_groups) {
+      if (index.AreSameExampleParsing(*group.front(), *parsing_node)) {
+        group.push_back(parsing_node);
+        grouped = true;
+        break;
+      }
+    }
+    if (!grouped) {
+      parsing_groups.push_back({parsing_node});
+    }
+  }
+
+  std::vector<string> parsed_tensor_names;
+  for (const auto& group : parsing_groups) {
+    if (group.size() > 1) {
+      for (const string& name : GetOutputTensorNames(*group.front())) {
+        parsed_tensor_names.push_back(name);
+      }
+    }
+  }
+  if (parsed_tensor_names.empty()) {
+    return PerformOneShotTensorComputation(
+        run_options, input, input_tensor_names, output_tensor_names, session,
+        outputs, num_input_examples, thread_pool_options);
+  }
+
+  Tensor input_tensor;
+  TF_RETURN_IF_ERROR(InputToSerializedExampleTensor(input, &input_tensor));
+  *num_input_examples = input_tensor.dim_size(0);
+  std::vector<std::pair<string, Tensor>> inputs;
+  for (const auto& name : input_tensor_names) {
+    inputs.emplace_back(name, input_tensor);
+  }
+
+  RunMetadata run_metadata;
+  std::vector<Tensor> parsed_tensors;
+  TF_RETURN_IF_ERROR(session->Run(run_options, inputs, parsed_tensor_names,
+                                  {}, &parsed_tensors, &run_metadata,
+                                  thread_pool_options));
+  int parsed_index = 0;
+  for (const auto& group : parsing_groups) {
+    if (group.size() == 1) {
+      continue;
+    }
+    const int num_parsed_tensors = GetOutputTensorNames(*group.front()).size();
+    for (const NodeDef* parsing_node : group) {
+      const std::vector<string> names = GetOutputTensorNames(*parsing_node);
+      if (names.size() != num_parsed_tensors) {
+        return errors::Internal("Mismatched example parsing op outputs: ",
+                                parsing_node->name());
+      }
+      for (int i = 0; i < names.size(); ++i) {
+        inputs.emplace_back(names[i], parsed_tensors[parsed_index + i]);
+      }
+    }
+    parsed_index += num_parsed_tensors;
+  }
+  return session->Run(run_options, inputs, output_tensor_names, {}, outputs,
+                      &run_metadata, thread_pool_options);
+}
+
+}  // namespace
+
+ExampleParsingIndex::ExampleParsingIndex(const GraphDef& graph) {
+  for (const NodeDef& node : graph.node()) {
+    nodes_[node.name()] = &node;
+    if ((node.op() != "ParseExample" && node.op() != "ParseExampleV2") ||
+        node.input_size() == 0) {
+      continue;
+    }
+    const auto inserted = parsing_nodes_.emplace(
+        ParseTensorName(node.input(0)).ToString(), &node);
+    if (!inserted.second) {
+      inserted.first->second = nullptr;
+    }
+  }
+}
+
+const NodeDef* ExampleParsingIndex::FindExampleParsingNode(
+    const string& input_tensor_name) const {
+  const auto it =
+      parsing_nodes_.find(ParseTensorName(input_tensor_name).ToString());
+  return it == parsing_nodes_.end() ? nullptr : it->second;
+}
+
+bool ExampleParsingIndex::AreSameExampleParsing(const NodeDef& a,
+                                                const NodeDef& b) const {
+  if (a.op() != b.op() || a.input_size() != b.input_size() ||
+      a.attr_size() != b.attr_size()) {
+    return false;
+  }
+  for (const auto& attr : a.attr()) {
+    const auto b_attr = b.attr().find(attr.first);
+    if (b_attr == b.attr().end() ||
+        !AreAttrValuesEqual(attr.second, b_attr->second)) {
+      return false;
+    }
+  }
+  for (int i = 1; i < a.input_size(); ++i) {
+    if (a.input(i) == b.input(i)) {
+      continue;
+    }
+    const TensorId a_id = ParseTensorName(a.input(i));
+    const TensorId b_id = ParseTensorName(b.input(i));
+    const auto a_input = nodes_.find(string(a_id.node()));
+    const auto b_input = nodes_.find(string(b_id.node()));
+    if (a_id.index() != 0 || b_id.index() != 0 || a_input == nodes_.end() ||
+        b_input == nodes_.end() || a_input->second->op() != "Const" ||
+        b_input->second->op() != "Const" ||
+        a_input->second->attr().count("value") == 0 ||
+        b_input->second->attr().count("value") == 0 ||
+        !AreAttrValuesEqual(a_input->second->attr().at("value"),
+                            b_input->second->attr().at("value"))) {
+      return false;
+    }
+  }
+  return true;
+}
 
 Status TensorFlowMultiInferenceRunner::Infer(
     const RunOptions& run_options, const MultiInferenceRequest& request,
@@ -88,9 +251,24 @@ Status TensorFlowMultiInferenceRunner::Infer(
 
   std::vector<Tensor> outputs;
   int num_examples;
-  TF_RETURN_IF_ERROR(PerformOneShotTensorComputation(
-      run_options, request.input(), input_tensor_name_set, output_tensor_names,
-      session_, &outputs, &num_examples, thread_pool_options_));
+  if (GetMultiInferenceSharedExampleParsingFeature() &&
+      input_tensor_name_set.size() > 1) {
+    absl::optional<ExampleParsingIndex> request_index;
+    const ExampleParsingIndex* index = example_parsing_index_;
+    if (index == nullptr) {
+      request_index.emplace(meta_graph_def_->graph_def());
+      index = &*request_index;
+    }
+    TF_RETURN_IF_ERROR(PerformOneShotTensorComputationWithSharedParsing(
+        run_options, request.input(), input_tensor_name_set,
+        output_tensor_names, *index, session_, &outputs, &num_examples,
+        thread_pool_options_));
+  } else {
+    TF_RETURN_IF_ERROR(PerformOneShotTensorComputation(
+        run_options, request.input(), input_tensor_name_set,
+        output_tensor_names, session_, &outputs, &num_examples,
+        thread_pool_options_));
+  }
   RecordRequestExampleCount(model_name, num_examples);
 
   TRACELITERAL("PostProcessResults");
@@ -127,11 +305,13 @@ Status RunMultiInference(
     const RunOptions& run_options, const MetaGraphDef& meta_graph_def,
     const absl::optional<int64>& servable_version, Session* session,
     const MultiInferenceRequest& request, MultiInferenceResponse* response,
-    const tensorflow::thread::ThreadPoolOptions& thread_pool_options) {
+    const tensorflow::thread::ThreadPoolOptions& thread_pool_options,
+    const ExampleParsingIndex* example_parsing_index) {
   TRACELITERAL("RunMultiInference");
 
   TensorFlowMultiInferenceRunner inference_runner(
-      session, &meta_graph_def, servable_version, thread_pool_options);
+      session, &meta_graph_def, servable_version, thread_pool_options,
+      example_parsing_index);
   return inference_runner.Infer(run_options, request, response);
 }
 
@@ -16,7 +16,11 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_MULTI_INFERENCE_H_
 #define TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_MULTI_INFERENCE_H_
 
+#include <unordered_map>
+
 #include "absl/types/optional.h"
+#include "tensorflow/core/framework/graph.pb.h"
+#include "tensorflow/core/framework/node_def.pb.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/platform/threadpool_options.h"
 #include "tensorflow/core/protobuf/meta_graph.pb.h"
@@ -26,6 +30,32 @@ limitations under the License.
 namespace tensorflow {
 namespace serving {
 
+// The example parsing ops of a graph, by the serialized examples they parse,
+// for the shared example parsing of TensorFlowMultiInferenceRunner (see
+// SetMultiInferenceSharedExampleParsingFeature()). Building it scans the whole
+// graph, so it is built once per servable version rather than per request.
+class ExampleParsingIndex {
+ public:
+  // 'graph' must outlive the index.
+  explicit ExampleParsingIndex(const GraphDef& graph);
+
+  // Returns the example parsing op that 'input_tensor_name' is the serialized
+  // input of, or null if there is none, or more than one.
+  const NodeDef* FindExampleParsingNode(const string& input_tensor_name) const;
+
+  // Returns true if the example parsing ops 'a' and 'b' parse the same
+  // features the same way, i.e. have the same attrs and the same (or equal
+  // constant) inputs besides the serialized examples.
+  bool AreSameExampleParsing(const NodeDef& a, const NodeDef& b) const;
+
+ private:
+  // All the nodes, by name.
+  std::unordered_map<string, const NodeDef*> nodes_;
+  // The example parsing ops, by the tensor of their serialized examples. Null
+  // for the tensors parsed by several ops.
+  std::unordered_map<string, const NodeDef*> parsing_nodes_;
+};
+
 // TensorFlow implementation of the MultiInference.
 // Only supports Models in the SavedModel format.
 class TensorFlowMultiInferenceRunner {
@@ -39,11 +69,13 @@ class TensorFlowMultiInferenceRunner {
       Session* session, const MetaGraphDef* meta_graph_def,
       absl::optional<int64> servable_version,
       const thread::ThreadPoolOptions& thread_pool_options =
-          thread::ThreadPoolOptions())
+          thread::ThreadPoolOptions(),
+      const ExampleParsingIndex* example_parsing_index = nullptr)
       : session_(session),
         meta_graph_def_(meta_graph_def),
         servable_version_(servable_version),
-        thread_pool_options_(thread_pool_options) {}
+        thread_pool_options_(thread_pool_options),
+        example_parsing_index_(example_parsing_index) {}
 
   // Run inference and return the inference results in the same order as the
   // InferenceTasks in the request.
@@ -60,6 +92,9 @@ class TensorFlowMultiInferenceRunner {
   // InferenceResults of the MultiInferenceResponse.
   const absl::optional<int64> servable_version_;
   const tensorflow::thread::ThreadPoolOptions thread_pool_options_;
+  // The index of the graph of 'meta_graph_def_' for the shared example
+  // parsing. If null, it is built by the requests that need it.
+  const ExampleParsingIndex* const example_parsing_index_;
 };
 
 // Creates TensorFlowMultiInferenceRunner and calls Infer on it.
@@ -68,7 +103,8 @@ Status RunMultiInference(
     const absl::optional<int64>& servable_version, Session* session,
     const MultiInferenceRequest& request, MultiInferenceResponse* response,
     const tensorflow::thread::ThreadPoolOptions& thread_pool_options =
-        tensorflow::thread::ThreadPoolOptions());
+        tensorflow::thread::ThreadPoolOptions(),
+    const ExampleParsingIndex* example_parsing_index = nullptr);
 
 }  // namespace serving
 }  // namespace tensorflow
@@ -19,6 +19,7 @@ limitations under the License.
 #include "tensorflow_serving/apis/input.pb.h"
 #include "tensorflow_serving/apis/model.pb.h"
 #include "tensorflow_serving/servables/tensorflow/multi_inference.h"
+#include "tensorflow_serving/servables/tensorflow/util.h"
 
 namespace tensorflow {
 namespace serving {
@@ -34,26 +35,71 @@ const ModelSpec& GetModelSpecFromRequest(const MultiInferenceRequest& request) {
 
 }  // namespace
 
+std::shared_ptr<ExampleParsingIndexCache> ExampleParsingIndexCache::Create(
+    ServerCore* core) {
+  auto cache = std::make_shared<ExampleParsingIndexCache>();
+  std::weak_ptr<ExampleParsingIndexCache> weak_cache = cache;
+  core->servable_state_monitor()->Notify(
+      [weak_cache](const ServableState& state) {
+        std::shared_ptr<ExampleParsingIndexCache> cache = weak_cache.lock();
+        if (cache != nullptr) {
+          cache->Erase(state.id);
+        }
+      });
+  return cache;
+}
+
+std::shared_ptr<const ExampleParsingIndex> ExampleParsingIndexCache::Get(
+    const ServableId& id, const GraphDef& graph) {
+  {
+    mutex_lock l(mu_);
+    auto it = entries_.find(id);
+    if (it != entries_.end()) {
+      return it->second;
+    }
+  }
+  // Built outside of the lock, as it scans the whole graph. Concurrent first
+  // requests may build it more than once.
+  auto index = std::make_shared<const ExampleParsingIndex>(graph);
+  mutex_lock l(mu_);
+  return entries_.emplace(id, std::move(index)).first->second;
+}
+
+void ExampleParsingIndexCache::Erase(const ServableId& id) {
+  mutex_lock l(mu_);
+  entries_.erase(id);
+}
+
 Status RunMultiInferenceWithServerCore(
     const RunOptions& run_options, ServerCore* core,
     const tensorflow::thread::ThreadPoolOptions& thread_pool_options,
-    const MultiInferenceRequest& request, MultiInferenceResponse* response) {
+    const MultiInferenceRequest& request, MultiInferenceResponse* response,
+    ExampleParsingIndexCache* example_parsing_index_cache) {
   return RunMultiInferenceWithServerCoreWithModelSpec(
       run_options, core, thread_pool_options, GetModelSpecFromRequest(request),
-      request, response);
+      request, response, example_parsing_index_cache);
 }
 
 Status RunMultiInferenceWithServerCoreWithModelSpec(
     const RunOptions& run_options, ServerCore* core,
     const tensorflow::thread::ThreadPoolOptions& thread_pool_options,
     const ModelSpec& model_spec, const MultiInferenceRequest& request,
-    MultiInferenceResponse* response) {
+    MultiInferenceResponse* response,
+    ExampleParsingIndexCache* example_parsing_index_cache) {
   ServableHandle<SavedModelBundle> bundle;
   TF_RETURN_IF_ERROR(core->GetServableHandle(model_spec, &bundle));
 
+  std::shared_ptr<const ExampleParsingIndex> example_parsing_index;
+  if (example_parsing_index_cache != nullptr &&
+      GetMultiInferenceSharedExampleParsingFeature() &&
+      request.tasks_size() > 1) {
+    example_parsing_index = example_parsing_index_cache->Get(
+        bundle.id(), bundle->meta_graph_def.graph_def());
+  }
   return RunMultiInference(run_options, bundle->meta_graph_def,
                            bundle.id().version, bundle->session.get(), request,
-                           response, thread_pool_options);
+                           response, thread_pool_options,
+                           example_parsing_index.get());
 }
 
 }  // namespace serving
@@ -16,20 +16,58 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_MULTI_INFERENCE_HELPER_H_
 #define TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_MULTI_INFERENCE_HELPER_H_
 
+#include <memory>
+#include <unordered_map>
+
 #include "absl/types/optional.h"
+#include "tensorflow/core/framework/graph.pb.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
 #include "tensorflow/core/platform/threadpool_options.h"
 #include "tensorflow_serving/apis/inference.pb.h"
+#include "tensorflow_serving/core/servable_id.h"
 #include "tensorflow_serving/model_servers/server_core.h"
+#include "tensorflow_serving/servables/tensorflow/multi_inference.h"
 
 namespace tensorflow {
 namespace serving {
 
-// Runs MultiInference
+// Caches the ExampleParsingIndex of servable versions, so that it is built on
+// the first request that shares example parsing, not on each of them. The
+// entry of a version is dropped whenever its state changes, e.g. once it is
+// unloaded.
+//
+// This class is thread-safe.
+class ExampleParsingIndexCache {
+ public:
+  // Returns a cache whose entries are dropped as per the ServableStateMonitor
+  // of 'core'. The cache may outlive 'core'.
+  static std::shared_ptr<ExampleParsingIndexCache> Create(ServerCore* core);
+
+  // Returns the index of 'graph', the graph of version 'id', building it if it
+  // is not cached yet. Must be called while holding a handle to the version,
+  // so that the entry cannot outlive it.
+  std::shared_ptr<const ExampleParsingIndex> Get(const ServableId& id,
+                                                 const GraphDef& graph);
+
+  void Erase(const ServableId& id);
+
+ private:
+  mutex mu_;
+  std::unordered_map<ServableId, std::shared_ptr<const ExampleParsingIndex>,
+                     HashServableId>
+      entries_ TF_GUARDED_BY(mu_);
+};
+
+// Runs MultiInference. If 'example_parsing_index_cache' is set, it provides
+// the index used to share the example parsing (see
+// SetMultiInferenceSharedExampleParsingFeature()).
 Status RunMultiInferenceWithServerCore(
     const RunOptions& run_options, ServerCore* core,
     const thread::ThreadPoolOptions& thread_pool_options,
-    const MultiInferenceRequest& request, MultiInferenceResponse* response);
+    const MultiInferenceRequest& request, MultiInferenceResponse* response,
+    ExampleParsingIndexCache* example_parsing_index_cache = nullptr);
 
 // Like RunMultiInferenceWithServerCore(), but uses 'model_spec' instead of the
 // one(s) embedded in 'request'.
@@ -37,7 +75,8 @@ Status RunMultiInferenceWithServerCoreWithModelSpec(
     const RunOptions& run_options, ServerCore* core,
     const thread::ThreadPoolOptions& thread_pool_options,
     const ModelSpec& model_spec, const MultiInferenceRequest& request,
-    MultiInferenceResponse* response);
+    MultiInferenceResponse* response,
+    ExampleParsingIndexCache* example_parsing_index_cache = nullptr);
 
 }  // namespace serving
 }  // namespace tensorflow
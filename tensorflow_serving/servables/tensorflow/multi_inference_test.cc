@@ -17,11 +17,14 @@ limitations under the License.
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include "tensorflow/cc/framework/scope.h"
+#include "tensorflow/cc/ops/standard_ops.h"
 #include "tensorflow/cc/saved_model/loader.h"
 #include "tensorflow/cc/saved_model/signature_constants.h"
 #include "tensorflow/core/example/example.pb.h"
 #include "tensorflow/core/example/feature.pb.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/public/session.h"
 #include "tensorflow_serving/apis/classification.pb.h"
 #include "tensorflow_serving/apis/input.pb.h"
 #include "tensorflow_serving/apis/regression.pb.h"
@@ -427,6 +430,169 @@ REGISTER_TYPED_TEST_SUITE_P(
 typedef ::testing::Types<tf1_model_t, tf2_model_t> ModelTypes;
 INSTANTIATE_TYPED_TEST_SUITE_P(MultiInference, MultiInferenceTest, ModelTypes);
 
+// Session that records the feeds and fetches of the Run() calls it forwards.
+class RecordingSession : public Session {
+ public:
+  explicit RecordingSession(std::unique_ptr<Session> session)
+      : session_(std::move(session)) {}
+  Status Create(const GraphDef& graph) override {
+    return session_->Create(graph);
+  }
+  Status Extend(const GraphDef& graph) override {
+    return session_->Extend(graph);
+  }
+  Status Close() override { return session_->Close(); }
+  Status ListDevices(std::vector<DeviceAttributes>* response) override {
+    return session_->ListDevices(response);
+  }
+  Status Run(const std::vector<std::pair<string, Tensor>>& inputs,
+             const std::vector<string>& output_names,
+             const std::vector<string>& target_nodes,
+             std::vector<Tensor>* outputs) override {
+    RunMetadata run_metadata;
+    return Run(RunOptions(), inputs, output_names, target_nodes, outputs,
+               &run_metadata);
+  }
+  Status Run(const RunOptions& run_options,
+             const std::vector<std::pair<string, Tensor>>& inputs,
+             const std::vector<string>& output_names,
+             const std::vector<string>& target_nodes,
+             std::vector<Tensor>* outputs, RunMetadata* run_metadata) override {
+    return Run(run_options, inputs, output_names, target_nodes, outputs,
+               run_metadata, thread::ThreadPoolOptions());
+  }
+  Status Run(const RunOptions& run_options,
+             const std::vector<std::pair<string, Tensor>>& inputs,
+             const std::vector<string>& output_names,
+             const std::vector<string>& target_nodes,
+             std::vector<Tensor>* outputs, RunMetadata* run_metadata,
+             const thread::ThreadPoolOptions& thread_pool_options) override {
+    std::set<string> feeds;
+    for (const auto& input : inputs) {
+      feeds.insert(input.first);
+    }
+    feeds_.push_back(feeds);
+    fetches_.push_back(output_names);
+    return session_->Run(run_options, inputs, output_names, target_nodes,
+                         outputs, run_metadata, thread_pool_options);
+  }
+
+  const std::vector<std::set<string>>& feeds() const { return feeds_; }
+  const std::vector<std::vector<string>>& fetches() const { return fetches_; }
+
+ private:
+  std::unique_ptr<Session> session_;
+  std::vector<std::set<string>> feeds_;
+  std::vector<std::vector<string>> fetches_;
+};
+
+// Adds a regression head named `head`, with its own examples input and
+// ParseExampleV2 op parsing the float feature "x", to `scope`. Returns the
+// parsed feature.
+Output AddRegressionHead(const Scope& scope, const string& head,
+                         MetaGraphDef* meta_graph_def) {
+  auto examples =
+      ops::Placeholder(scope.WithOpName(head + "_examples"), DT_STRING);
+  auto parsed = ops::ParseExampleV2(
+      scope.WithOpName(head + "_parse"), examples,
+      /*names=*/ops::Const(scope, Tensor(DT_STRING, TensorShape({0}))),
+      /*sparse_keys=*/ops::Const(scope, Tensor(DT_STRING, TensorShape({0}))),
+      /*dense_keys=*/ops::Const(scope, {tstring("x")}),
+      /*ragged_keys=*/ops::Const(scope, Tensor(DT_STRING, TensorShape({0}))),
+      /*dense_defaults=*/
+      {ops::Const(scope, Tensor(DT_FLOAT, TensorShape({0})))},
+      /*num_sparse=*/0, /*sparse_types=*/{}, /*ragged_value_types=*/{},
+      /*ragged_split_types=*/{}, /*dense_shapes=*/{PartialTensorShape({1})});
+
+  SignatureDef& signature =
+      (*meta_graph_def->mutable_signature_def())["regress_" + head];
+  signature.set_method_name(kRegressMethodName);
+  (*signature.mutable_inputs())[kRegressInputs].set_name(head + "_examples:0");
+  (*signature.mutable_outputs())[kRegressOutputs].set_name(head + "_y:0");
+  return parsed.dense_values[0];
+}
+
+TEST(MultiInferenceSharedExampleParsingTest, ParsesExamplesOnce) {
+  Scope scope = Scope::NewRootScope();
+  MetaGraphDef meta_graph_def;
+  ops::Multiply(scope.WithOpName("a_y"),
+                AddRegressionHead(scope, "a", &meta_graph_def), 2.0f);
+  ops::Add(scope.WithOpName("b_y"),
+           AddRegressionHead(scope, "b", &meta_graph_def), 1.0f);
+  TF_ASSERT_OK(scope.ToGraphDef(meta_graph_def.mutable_graph_def()));
+  RecordingSession session(
+      std::unique_ptr<Session>(NewSession(SessionOptions())));
+  TF_ASSERT_OK(session.Create(meta_graph_def.graph_def()));
+
+  MultiInferenceRequest request;
+  AddInput({{"x", 3}}, &request);
+  AddInput({{"x", 5}}, &request);
+  PopulateTask("regress_a", kRegressMethodName, request.add_tasks());
+  PopulateTask("regress_b", kRegressMethodName, request.add_tasks());
+
+  MultiInferenceResponse expected_response;
+  for (const auto& head_and_values :
+       std::vector<std::pair<string, std::vector<float>>>{
+           {"regress_a", {6, 10}}, {"regress_b", {4, 6}}}) {
+    auto* result = expected_response.add_results();
+    auto* model_spec = result->mutable_model_spec();
+    model_spec->set_name(kTestModelName);
+    model_spec->set_signature_name(head_and_values.first);
+    for (const float value : head_and_values.second) {
+      result->mutable_regression_result()->add_regressions()->set_value(value);
+    }
+  }
+
+  const bool old_val = GetMultiInferenceSharedExampleParsingFeature();
+  SetMultiInferenceSharedExampleParsingFeature(false);
+  MultiInferenceResponse response;
+  TF_ASSERT_OK(RunMultiInference(RunOptions(), meta_graph_def, {}, &session,
+                                 request, &response));
+  EXPECT_THAT(response, test_util::EqualsProto(expected_response));
+  ASSERT_EQ(1, session.feeds().size());
+
+  // Only the parsing of head "a" runs, and its outputs are fed to both heads.
+  SetMultiInferenceSharedExampleParsingFeature(true);
+  response.Clear();
+  TF_ASSERT_OK(RunMultiInference(RunOptions(), meta_graph_def, {}, &session,
+                                 request, &response));
+  EXPECT_THAT(response, test_util::EqualsProto(expected_response));
+  ASSERT_EQ(3, session.feeds().size());
+  EXPECT_THAT(session.fetches()[1], ::testing::ElementsAre("a_parse:0"));
+  EXPECT_THAT(session.feeds()[2],
+              ::testing::IsSupersetOf({"a_parse:0", "b_parse:0"}));
+
+  // Same with the index of the servable built beforehand.
+  const ExampleParsingIndex index(meta_graph_def.graph_def());
+  response.Clear();
+  TF_ASSERT_OK(RunMultiInference(RunOptions(), meta_graph_def, {}, &session,
+                                 request, &response,
+                                 thread::ThreadPoolOptions(), &index));
+  EXPECT_THAT(response, test_util::EqualsProto(expected_response));
+  ASSERT_EQ(5, session.feeds().size());
+  EXPECT_THAT(session.fetches()[3], ::testing::ElementsAre("a_parse:0"));
+  SetMultiInferenceSharedExampleParsingFeature(old_val);
+}
+
+TEST(MultiInferenceSharedExampleParsingTest, ExampleParsingIndex) {
+  Scope scope = Scope::NewRootScope();
+  MetaGraphDef meta_graph_def;
+  AddRegressionHead(scope, "a", &meta_graph_def);
+  AddRegressionHead(scope, "b", &meta_graph_def);
+  ops::Placeholder(scope.WithOpName("c_examples"), DT_STRING);
+  TF_ASSERT_OK(scope.ToGraphDef(meta_graph_def.mutable_graph_def()));
+
+  const ExampleParsingIndex index(meta_graph_def.graph_def());
+  const NodeDef* a_parse = index.FindExampleParsingNode("a_examples:0");
+  ASSERT_NE(nullptr, a_parse);
+  EXPECT_EQ("a_parse", a_parse->name());
+  EXPECT_EQ(a_parse, index.FindExampleParsingNode("a_examples"));
+  const NodeDef* b_parse = index.FindExampleParsingNode("b_examples:0");
+  ASSERT_NE(nullptr, b_parse);
+  EXPECT_EQ(nullptr, index.FindExampleParsingNode("c_examples:0"));
+  EXPECT_TRUE(index.AreSameExampleParsing(*a_parse, *b_parse));
+}
+
 }  // namespace
 }  // namespace serving
 }  // namespace tensorflow
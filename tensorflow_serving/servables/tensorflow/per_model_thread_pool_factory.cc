@@ -0,0 +1,124 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/servables/tensorflow/per_model_thread_pool_factory.h"
+
+#include <utility>
+#include <vector>
+
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/cpu_info.h"
+#include "tensorflow_serving/util/cpu_affinity.h"
+
+namespace tensorflow {
+namespace serving {
+
+Status PerModelThreadPoolFactory::Create(
+    const PerModelThreadPoolFactoryConfig& config,
+    std::unique_ptr<ThreadPoolFactory>* result) {
+  std::unique_ptr<PerModelThreadPoolFactory> factory(
+      new PerModelThreadPoolFactory());
+  if (config.has_default_thread_pools()) {
+    TF_RETURN_IF_ERROR(CreateThreadPools("default",
+                                         config.default_thread_pools(),
+                                         &factory->default_thread_pools_));
+  }
+  for (const auto& model_thread_pools : config.model_thread_pools()) {
+    TF_RETURN_IF_ERROR(CreateThreadPools(
+        model_thread_pools.first, model_thread_pools.second,
+        &factory->model_thread_pools_[model_thread_pools.first]));
+  }
+  *result = std::move(factory);
+  return Status::OK();
+}
+
+Status PerModelThreadPoolFactory::CreateThreadPools(
+    const string& name, const ThreadPoolConfig& config,
+    std::unique_ptr<ThreadPools>* thread_pools) {
+  if (config.num_inter_op_threads() < 0 || config.num_intra_op_threads() < 0) {
+    return errors::InvalidArgument(
+        "Number of threads of the thread pools of ", name, " is negative");
+  }
+  const std::vector<int> cpus(config.cpus().begin(), config.cpus().end());
+  TF_RETURN_IF_ERROR(
+      ValidateCpus(cpus, strings::StrCat("thread pools of ", name)));
+
+  const int default_num_threads =
+      cpus.empty() ? port::MaxParallelism() : cpus.size();
+  const int num_inter_op_threads = config.num_inter_op_threads() > 0
+                                       ? config.num_inter_op_threads()
+                                       : default_num_threads;
+  const int num_intra_op_threads = config.num_intra_op_threads() > 0
+                                       ? config.num_intra_op_threads()
+                                       : default_num_threads;
+
+  thread_pools->reset(new ThreadPools());
+  ThreadPools* pools = thread_pools->get();
+  pools->env = cpus.empty() ? nullptr
+                            : std::unique_ptr<Env>(new PinnedThreadsEnv(
+                                  Env::Default(), cpus));
+  Env* env = pools->env != nullptr ? pools->env.get() : Env::Default();
+  pools->inter_op.reset(new thread::ThreadPool(
+      env, ThreadOptions(), strings::StrCat("inter_op_", name),
+      num_inter_op_threads));
+  pools->intra_op.reset(new thread::ThreadPool(
+      env, ThreadOptions(), strings::StrCat("intra_op_", name),
+      num_intra_op_threads));
+  return Status::OK();
+}
+
+const PerModelThreadPoolFactory::ThreadPools*
+PerModelThreadPoolFactory::FindThreadPools(const string& model_name) const {
+  auto it = model_thread_pools_.find(model_name);
+  if (it != model_thread_pools_.end()) {
+    return it->second.get();
+  }
+  return default_thread_pools_.get();
+}
+
+thread::ThreadPoolInterface* PerModelThreadPoolFactory::GetInterOpThreadPool() {
+  return default_thread_pools_ == nullptr
+             ? nullptr
+             : default_thread_pools_->inter_op->AsEigenThreadPool();
+}
+
+thread::ThreadPoolInterface* PerModelThreadPoolFactory::GetIntraOpThreadPool() {
+  return default_thread_pools_ == nullptr
+             ? nullptr
+             : default_thread_pools_->intra_op->AsEigenThreadPool();
+}
+
+thread::ThreadPoolInterface*
+PerModelThreadPoolFactory::GetInterOpThreadPoolForModel(
+    const string& model_name) {
+  const ThreadPools* thread_pools = FindThreadPools(model_name);
+  return thread_pools == nullptr ? nullptr
+                                 : thread_pools->inter_op->AsEigenThreadPool();
+}
+
+thread::ThreadPoolInterface*
+PerModelThreadPoolFactory::GetIntraOpThreadPoolForModel(
+    const string& model_name) {
+  const ThreadPools* thread_pools = FindThreadPools(model_name);
+  return thread_pools == nullptr ? nullptr
+                                 : thread_pools->intra_op->AsEigenThreadPool();
+}
+
+REGISTER_THREAD_POOL_FACTORY(PerModelThreadPoolFactory,
+                             PerModelThreadPoolFactoryConfig);
+
+}  // namespace serving
+}  // namespace tensorflow
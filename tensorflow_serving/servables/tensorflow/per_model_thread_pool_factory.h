@@ -0,0 +1,80 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_PER_MODEL_THREAD_POOL_FACTORY_H_
+#define TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_PER_MODEL_THREAD_POOL_FACTORY_H_
+
+#include <map>
+#include <memory>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/threadpool.h"
+#include "tensorflow_serving/servables/tensorflow/thread_pool_factory.h"
+#include "tensorflow_serving/servables/tensorflow/thread_pool_factory_config.pb.h"
+
+namespace tensorflow {
+namespace serving {
+
+// A ThreadPoolFactory that gives each configured model its own inter- and
+// intra-op thread pools, optionally pinned to a set of CPUs, so that requests
+// to a heavy model do not queue behind, or preempt, those to the other models.
+//
+// Registered for PerModelThreadPoolFactoryConfig, to be used through
+// ThreadPoolFactoryConfig.
+class PerModelThreadPoolFactory final : public ThreadPoolFactory {
+ public:
+  static Status Create(const PerModelThreadPoolFactoryConfig& config,
+                       std::unique_ptr<ThreadPoolFactory>* result);
+
+  ~PerModelThreadPoolFactory() override = default;
+
+  // The default thread pools, null if not configured.
+  thread::ThreadPoolInterface* GetInterOpThreadPool() override;
+  thread::ThreadPoolInterface* GetIntraOpThreadPool() override;
+
+  thread::ThreadPoolInterface* GetInterOpThreadPoolForModel(
+      const string& model_name) override;
+  thread::ThreadPoolInterface* GetIntraOpThreadPoolForModel(
+      const string& model_name) override;
+
+ private:
+  struct ThreadPools {
+    // Env starting the threads of the pools, which pins them if needed.
+    std::unique_ptr<Env> env;
+    std::unique_ptr<thread::ThreadPool> inter_op;
+    std::unique_ptr<thread::ThreadPool> intra_op;
+  };
+
+  PerModelThreadPoolFactory() = default;
+
+  static Status CreateThreadPools(const string& name,
+                                  const ThreadPoolConfig& config,
+                                  std::unique_ptr<ThreadPools>* thread_pools);
+
+  // Returns the thread pools of 'model_name', or the default ones.
+  const ThreadPools* FindThreadPools(const string& model_name) const;
+
+  std::unique_ptr<ThreadPools> default_thread_pools_;
+  std::map<string, std::unique_ptr<ThreadPools>> model_thread_pools_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(PerModelThreadPoolFactory);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_PER_MODEL_THREAD_POOL_FACTORY_H_
@@ -0,0 +1,119 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/servables/tensorflow/per_model_thread_pool_factory.h"
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#include <memory>
+
+#include "google/protobuf/any.pb.h"
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/notification.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow_serving/servables/tensorflow/thread_pool_factory_config.pb.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+TEST(PerModelThreadPoolFactoryTest, ModelThreadPools) {
+  PerModelThreadPoolFactoryConfig config;
+  (*config.mutable_model_thread_pools())["heavy"].set_num_inter_op_threads(2);
+  (*config.mutable_model_thread_pools())["light"].set_num_intra_op_threads(1);
+  ThreadPoolFactoryConfig factory_config;
+  factory_config.mutable_thread_pool_factory_config()->PackFrom(config);
+  std::unique_ptr<ThreadPoolFactory> factory;
+  TF_ASSERT_OK(ThreadPoolFactoryRegistry::CreateFromAny(
+      factory_config.thread_pool_factory_config(), &factory));
+
+  // Without default thread pools, other models use those of their session.
+  EXPECT_EQ(nullptr, factory->GetInterOpThreadPool());
+  EXPECT_EQ(nullptr, factory->GetIntraOpThreadPoolForModel("other"));
+
+  thread::ThreadPoolInterface* heavy_inter_op =
+      factory->GetInterOpThreadPoolForModel("heavy");
+  thread::ThreadPoolInterface* light_inter_op =
+      factory->GetInterOpThreadPoolForModel("light");
+  ASSERT_NE(nullptr, heavy_inter_op);
+  ASSERT_NE(nullptr, light_inter_op);
+  EXPECT_NE(heavy_inter_op, light_inter_op);
+  EXPECT_NE(heavy_inter_op, factory->GetIntraOpThreadPoolForModel("heavy"));
+  EXPECT_EQ(2, heavy_inter_op->NumThreads());
+  EXPECT_EQ(1, factory->GetIntraOpThreadPoolForModel("light")->NumThreads());
+}
+
+TEST(PerModelThreadPoolFactoryTest, DefaultThreadPools) {
+  PerModelThreadPoolFactoryConfig config;
+  config.mutable_default_thread_pools()->set_num_inter_op_threads(3);
+  (*config.mutable_model_thread_pools())["heavy"];
+  std::unique_ptr<ThreadPoolFactory> factory;
+  TF_ASSERT_OK(PerModelThreadPoolFactory::Create(config, &factory));
+
+  ASSERT_NE(nullptr, factory->GetInterOpThreadPool());
+  EXPECT_EQ(3, factory->GetInterOpThreadPool()->NumThreads());
+  EXPECT_EQ(factory->GetInterOpThreadPool(),
+            factory->GetInterOpThreadPoolForModel("other"));
+  EXPECT_NE(factory->GetInterOpThreadPool(),
+            factory->GetInterOpThreadPoolForModel("heavy"));
+}
+
+TEST(PerModelThreadPoolFactoryTest, InvalidConfig) {
+  PerModelThreadPoolFactoryConfig config;
+  (*config.mutable_model_thread_pools())["model"].set_num_inter_op_threads(-1);
+  std::unique_ptr<ThreadPoolFactory> factory;
+  EXPECT_FALSE(PerModelThreadPoolFactory::Create(config, &factory).ok());
+}
+
+#if defined(__linux__)
+
+TEST(PerModelThreadPoolFactoryTest, PinnedThreadPools) {
+  // Pins to a CPU the test is allowed to run on.
+  cpu_set_t allowed_cpus;
+  ASSERT_EQ(0, sched_getaffinity(0, sizeof(allowed_cpus), &allowed_cpus));
+  int pinned_cpu = 0;
+  while (!CPU_ISSET(pinned_cpu, &allowed_cpus)) {
+    ++pinned_cpu;
+  }
+  PerModelThreadPoolFactoryConfig config;
+  (*config.mutable_model_thread_pools())["model"].add_cpus(pinned_cpu);
+  std::unique_ptr<ThreadPoolFactory> factory;
+  TF_ASSERT_OK(PerModelThreadPoolFactory::Create(config, &factory));
+
+  thread::ThreadPoolInterface* inter_op =
+      factory->GetInterOpThreadPoolForModel("model");
+  ASSERT_NE(nullptr, inter_op);
+  // One thread for each pinned CPU.
+  EXPECT_EQ(1, inter_op->NumThreads());
+  Notification done;
+  int cpu = -1;
+  inter_op->Schedule([&]() {
+    cpu = sched_getcpu();
+    done.Notify();
+  });
+  done.WaitForNotification();
+  EXPECT_EQ(pinned_cpu, cpu);
+
+  (*config.mutable_model_thread_pools())["model"].add_cpus(-1);
+  EXPECT_FALSE(PerModelThreadPoolFactory::Create(config, &factory).ok());
+}
+
+#endif  // defined(__linux__)
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
@@ -29,6 +29,13 @@ limitations under the License.
 namespace tensorflow {
 namespace serving {
 
+namespace {
+
+auto* get_servable_handle_stage = new RequestStage("Predict",
+                                                   "get_servable_handle");
+
+}  // namespace
+
 Status TensorflowPredictor::Predict(const RunOptions& run_options,
                                     ServerCore* core,
                                     const PredictRequest& request,
@@ -47,18 +54,70 @@ Status TensorflowPredictor::PredictWithModelSpec(const RunOptions& run_options,
                                                  const PredictRequest& request,
                                                  PredictResponse* response) {
   ServableHandle<SavedModelBundle> bundle;
-  TF_RETURN_IF_ERROR(core->GetServableHandle(model_spec, &bundle));
+  {
+    ScopedRequestStageLatency stage_latency(get_servable_handle_stage,
+                                            model_spec.name());
+    TF_RETURN_IF_ERROR(core->GetServableHandle(model_spec, &bundle));
+  }
+  return internal::RunPredict(
+      run_options, bundle->meta_graph_def, bundle.id().version,
+      core->predict_response_tensor_serialization_option(),
+      bundle->session.get(), request, response,
+      GetThreadPoolOptions(request.model_spec().name()));
+}
+
+Status TensorflowPredictor::PredictWithInputTensors(
+    const RunOptions& run_options, ServerCore* core,
+    const PredictRequest& request,
+    const std::map<string, Tensor>& input_tensors, PredictResponse* response) {
+  if (!request.has_model_spec()) {
+    return tensorflow::Status(tensorflow::error::INVALID_ARGUMENT,
+                              "Missing ModelSpec");
+  }
+  ServableHandle<SavedModelBundle> bundle;
+  {
+    ScopedRequestStageLatency stage_latency(get_servable_handle_stage,
+                                            request.model_spec().name());
+    TF_RETURN_IF_ERROR(core->GetServableHandle(request.model_spec(), &bundle));
+  }
+  return internal::RunPredictWithInputTensors(
+      run_options, bundle->meta_graph_def, bundle.id().version,
+      core->predict_response_tensor_serialization_option(),
+      bundle->session.get(), request, input_tensors, response,
+      GetThreadPoolOptions(request.model_spec().name()));
+}
+
+Status TensorflowPredictor::PredictWithTensors(
+    const RunOptions& run_options, ServerCore* core,
+    const PredictRequest& request,
+    const std::map<string, Tensor>& input_tensors,
+    std::map<string, Tensor>* output_tensors, PredictResponse* response) {
+  if (!request.has_model_spec()) {
+    return tensorflow::Status(tensorflow::error::INVALID_ARGUMENT,
+                              "Missing ModelSpec");
+  }
+  ServableHandle<SavedModelBundle> bundle;
+  {
+    ScopedRequestStageLatency stage_latency(get_servable_handle_stage,
+                                            request.model_spec().name());
+    TF_RETURN_IF_ERROR(core->GetServableHandle(request.model_spec(), &bundle));
+  }
+  return internal::RunPredictWithTensors(
+      run_options, bundle->meta_graph_def, bundle.id().version,
+      bundle->session.get(), request, input_tensors, output_tensors, response,
+      GetThreadPoolOptions(request.model_spec().name()));
+}
+
+thread::ThreadPoolOptions TensorflowPredictor::GetThreadPoolOptions(
+    const string& model_name) const {
   thread::ThreadPoolOptions thread_pool_options;
   if (thread_pool_factory_ != nullptr) {
     thread_pool_options.inter_op_threadpool =
-        thread_pool_factory_->GetInterOpThreadPool();
+        thread_pool_factory_->GetInterOpThreadPoolForModel(model_name);
     thread_pool_options.intra_op_threadpool =
-        thread_pool_factory_->GetIntraOpThreadPool();
+        thread_pool_factory_->GetIntraOpThreadPoolForModel(model_name);
   }
-  return internal::RunPredict(
-      run_options, bundle->meta_graph_def, bundle.id().version,
-      core->predict_response_tensor_serialization_option(),
-      bundle->session.get(), request, response, thread_pool_options);
+  return thread_pool_options;
 }
 
 }  // namespace serving
@@ -16,8 +16,13 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_PREDICT_IMPL_H_
 #define TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_PREDICT_IMPL_H_
 
+#include <map>
+#include <string>
+
+#include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor.pb.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/threadpool_options.h"
 #include "tensorflow/core/protobuf/config.pb.h"
 #include "tensorflow_serving/apis/predict.pb.h"
 #include "tensorflow_serving/model_servers/server_core.h"
@@ -44,7 +49,27 @@ class TensorflowPredictor {
                               const PredictRequest& request,
                               PredictResponse* response);
 
+  // Like Predict(), but takes the input tensors, keyed by input alias, in
+  // 'input_tensors' instead of in 'request.inputs'.
+  Status PredictWithInputTensors(const RunOptions& run_options,
+                                 ServerCore* core,
+                                 const PredictRequest& request,
+                                 const std::map<string, Tensor>& input_tensors,
+                                 PredictResponse* response);
+
+  // Like PredictWithInputTensors(), but also returns the output tensors, keyed
+  // by output alias, in 'output_tensors' instead of in 'response.outputs'.
+  Status PredictWithTensors(const RunOptions& run_options, ServerCore* core,
+                            const PredictRequest& request,
+                            const std::map<string, Tensor>& input_tensors,
+                            std::map<string, Tensor>* output_tensors,
+                            PredictResponse* response);
+
  private:
+  // Returns the thread pools to run the predictions of 'model_name' with.
+  thread::ThreadPoolOptions GetThreadPoolOptions(
+      const string& model_name) const;
+
   ThreadPoolFactory* thread_pool_factory_ = nullptr;
 };
 
@@ -24,7 +24,9 @@ limitations under the License.
 #include "absl/strings/str_join.h"
 #include "absl/strings/substitute.h"
 #include "tensorflow/cc/saved_model/signature_constants.h"
+#include "tensorflow/core/framework/allocation_description.pb.h"
 #include "tensorflow/core/framework/tensor.pb.h"
+#include "tensorflow/core/framework/types.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/protobuf/named_tensor.pb.h"
 #include "tensorflow_serving/servables/tensorflow/util.h"
@@ -33,6 +35,32 @@ namespace tensorflow {
 namespace serving {
 namespace {
 
+auto* prepare_inputs_stage = new RequestStage("Predict", "prepare_inputs");
+auto* serialize_response_stage = new RequestStage("Predict",
+                                                  "serialize_response");
+
+// A TensorBuffer that points at the `tensor_content` bytes of a TensorProto,
+// which must outlive it, instead of owning a copy of them.
+class TensorContentBuffer : public TensorBuffer {
+ public:
+  explicit TensorContentBuffer(const TensorProto& proto)
+      : TensorBuffer(const_cast<char*>(proto.tensor_content().data())),
+        size_(proto.tensor_content().size()) {}
+
+  size_t size() const override { return size_; }
+  TensorBuffer* root_buffer() override { return this; }
+  void FillAllocationDescription(AllocationDescription* proto) const override {
+    proto->set_requested_bytes(size_);
+    proto->set_allocator_name("TensorContentBuffer");
+  }
+  // The bytes belong to the TensorProto, so they are never forwarded to, and
+  // overwritten by, the outputs of an op.
+  bool OwnsMemory() const override { return false; }
+
+ private:
+  const size_t size_;
+};
+
 Status VerifySignature(const SignatureDef& signature) {
   if (GetSignatureMethodNameCheckFeature() &&
       signature.method_name() != kPredictMethodName &&
@@ -46,10 +74,11 @@ Status VerifySignature(const SignatureDef& signature) {
   return Status::OK();
 }
 
+template <typename InputMap>
 Status VerifyRequestInputsSize(const SignatureDef& signature,
-                               const PredictRequest& request) {
-  if (request.inputs().size() != signature.inputs().size()) {
-    const std::set<string> request_inputs = GetMapKeys(request.inputs());
+                               const InputMap& request_input_map) {
+  if (request_input_map.size() != signature.inputs().size()) {
+    const std::set<string> request_inputs = GetMapKeys(request_input_map);
     const std::set<string> signature_inputs = GetMapKeys(signature.inputs());
     const std::set<string> sent_extra =
         SetDifference(request_inputs, signature_inputs);
@@ -58,7 +87,7 @@ Status VerifyRequestInputsSize(const SignatureDef& signature,
     return tensorflow::Status(
         tensorflow::error::INVALID_ARGUMENT,
         absl::StrCat(
-            "input size does not match signature: ", request.inputs().size(),
+            "input size does not match signature: ", request_input_map.size(),
             "!=", signature.inputs().size(), " len({",
             absl::StrJoin(request_inputs, ","), "}) != len({",
             absl::StrJoin(signature_inputs, ","), "}). Sent extra: {",
@@ -70,14 +99,21 @@ Status VerifyRequestInputsSize(const SignatureDef& signature,
 
 // Validate a SignatureDef to make sure it's compatible with prediction, and
 // if so, populate the input and output tensor names.
+//
+// `request_inputs` maps the input aliases to the values of the input tensors
+// (TensorProtos or Tensors), which are converted by `to_tensor`. The inputs of
+// `request` are not used.
+template <typename InputMap, typename ToTensorFunc>
 Status PreProcessPrediction(const SignatureDef& signature,
                             const PredictRequest& request,
+                            const InputMap& request_inputs,
+                            ToTensorFunc to_tensor,
                             std::vector<std::pair<string, Tensor>>* inputs,
                             std::vector<string>* output_tensor_names,
                             std::vector<string>* output_tensor_aliases) {
   TF_RETURN_IF_ERROR(VerifySignature(signature));
-  TF_RETURN_IF_ERROR(VerifyRequestInputsSize(signature, request));
-  for (auto& input : request.inputs()) {
+  TF_RETURN_IF_ERROR(VerifyRequestInputsSize(signature, request_inputs));
+  for (auto& input : request_inputs) {
     const string& alias = input.first;
     auto iter = signature.inputs().find(alias);
     if (iter == signature.inputs().end()) {
@@ -89,7 +125,7 @@ Status PreProcessPrediction(const SignatureDef& signature,
                           "}."));
     }
     Tensor tensor;
-    if (!tensor.FromProto(input.second)) {
+    if (!to_tensor(input.second, &tensor)) {
       return tensorflow::Status(tensorflow::error::INVALID_ARGUMENT,
                                 "tensor parsing error: " + alias);
     }
@@ -159,14 +195,17 @@ Status PostProcessPredictionResult(
   return Status::OK();
 }
 
-}  // namespace
-
-namespace internal {
-Status RunPredict(
+// Implementation of the RunPredict functions. See PreProcessPrediction() for
+// `request_inputs` and `to_tensor`. If `output_tensors` is not null, the
+// outputs are returned in it instead of in `response->outputs`.
+template <typename InputMap, typename ToTensorFunc>
+Status RunPredictImpl(
     const RunOptions& run_options, const MetaGraphDef& meta_graph_def,
     const absl::optional<int64>& servable_version,
     const internal::PredictResponseTensorSerializationOption option,
-    Session* session, const PredictRequest& request, PredictResponse* response,
+    Session* session, const PredictRequest& request,
+    const InputMap& request_inputs, ToTensorFunc to_tensor,
+    std::map<string, Tensor>* output_tensors, PredictResponse* response,
     const thread::ThreadPoolOptions& thread_pool_options) {
   // Validate signatures.
   const string signature_name = request.model_spec().signature_name().empty()
@@ -185,9 +224,13 @@ Status RunPredict(
   std::vector<std::pair<string, Tensor>> input_tensors;
   std::vector<string> output_tensor_names;
   std::vector<string> output_tensor_aliases;
-  TF_RETURN_IF_ERROR(PreProcessPrediction(signature, request, &input_tensors,
-                                          &output_tensor_names,
-                                          &output_tensor_aliases));
+  {
+    ScopedRequestStageLatency stage_latency(prepare_inputs_stage,
+                                            request.model_spec().name());
+    TF_RETURN_IF_ERROR(PreProcessPrediction(
+        signature, request, request_inputs, to_tensor, &input_tensors,
+        &output_tensor_names, &output_tensor_aliases));
+  }
   std::vector<Tensor> outputs;
   RunMetadata run_metadata;
   const uint64 start_microseconds = EnvTime::NowMicros();
@@ -199,9 +242,95 @@ Status RunPredict(
                        /*runtime=*/"TF1",
                        end_microseconds - start_microseconds);
 
+  if (output_tensors != nullptr) {
+    if (outputs.size() != output_tensor_aliases.size()) {
+      return tensorflow::Status(tensorflow::error::UNKNOWN,
+                                "Predict internal error");
+    }
+    for (int i = 0; i < outputs.size(); ++i) {
+      (*output_tensors)[output_tensor_aliases[i]] = std::move(outputs[i]);
+    }
+    return Status::OK();
+  }
+  ScopedRequestStageLatency stage_latency(serialize_response_stage,
+                                          request.model_spec().name());
   return PostProcessPredictionResult(output_tensor_aliases, outputs, option,
                                      response);
 }
+
+}  // namespace
+
+namespace internal {
+bool TensorFromProtoAliasingContent(const TensorProto& proto, Tensor* tensor) {
+  const string& content = proto.tensor_content();
+  // Eigen expects tensor data to be aligned, and only some types can be used
+  // from their raw bytes.
+  if (content.empty() || !DataTypeCanUseMemcpy(proto.dtype()) ||
+      reinterpret_cast<uintptr_t>(content.data()) % EIGEN_MAX_ALIGN_BYTES !=
+          0 ||
+      !TensorShape::IsValid(proto.tensor_shape())) {
+    return tensor->FromProto(proto);
+  }
+  const TensorShape shape(proto.tensor_shape());
+  if (shape.num_elements() * DataTypeSize(proto.dtype()) != content.size()) {
+    return tensor->FromProto(proto);
+  }
+  TensorContentBuffer* buffer = new TensorContentBuffer(proto);
+  *tensor = Tensor(proto.dtype(), shape, buffer);
+  buffer->Unref();
+  return true;
+}
+
+Status RunPredict(
+    const RunOptions& run_options, const MetaGraphDef& meta_graph_def,
+    const absl::optional<int64>& servable_version,
+    const internal::PredictResponseTensorSerializationOption option,
+    Session* session, const PredictRequest& request, PredictResponse* response,
+    const thread::ThreadPoolOptions& thread_pool_options) {
+  return RunPredictImpl(
+      run_options, meta_graph_def, servable_version, option, session, request,
+      request.inputs(),
+      // The request outlives the Session::Run() call, and so do the inputs.
+      [](const TensorProto& proto, Tensor* tensor) {
+        return TensorFromProtoAliasingContent(proto, tensor);
+      },
+      /*output_tensors=*/nullptr, response, thread_pool_options);
+}
+
+Status RunPredictWithInputTensors(
+    const RunOptions& run_options, const MetaGraphDef& meta_graph_def,
+    const absl::optional<int64>& servable_version,
+    const internal::PredictResponseTensorSerializationOption option,
+    Session* session, const PredictRequest& request,
+    const std::map<string, Tensor>& input_tensors, PredictResponse* response,
+    const thread::ThreadPoolOptions& thread_pool_options) {
+  return RunPredictImpl(
+      run_options, meta_graph_def, servable_version, option, session, request,
+      input_tensors,
+      [](const Tensor& input, Tensor* tensor) {
+        *tensor = input;
+        return true;
+      },
+      /*output_tensors=*/nullptr, response, thread_pool_options);
+}
+
+Status RunPredictWithTensors(
+    const RunOptions& run_options, const MetaGraphDef& meta_graph_def,
+    const absl::optional<int64>& servable_version, Session* session,
+    const PredictRequest& request,
+    const std::map<string, Tensor>& input_tensors,
+    std::map<string, Tensor>* output_tensors, PredictResponse* response,
+    const thread::ThreadPoolOptions& thread_pool_options) {
+  return RunPredictImpl(
+      run_options, meta_graph_def, servable_version,
+      internal::PredictResponseTensorSerializationOption::kAsProtoContent,
+      session, request, input_tensors,
+      [](const Tensor& input, Tensor* tensor) {
+        *tensor = input;
+        return true;
+      },
+      output_tensors, response, thread_pool_options);
+}
 }  // namespace internal
 
 Status RunPredict(const RunOptions& run_options,
@@ -16,7 +16,11 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_PREDICT_UTIL_H_
 #define TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_PREDICT_UTIL_H_
 
+#include <map>
+#include <string>
+
 #include "absl/types/optional.h"
+#include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/platform/threadpool_options.h"
 #include "tensorflow/core/protobuf/config.pb.h"
@@ -30,6 +34,12 @@ namespace serving {
 
 namespace internal {
 
+// Like Tensor::FromProto(), but when `proto` holds suitably aligned
+// `tensor_content` of a type that can be memcpy'd, makes `tensor` point at
+// those bytes instead of copying them. `proto` must then outlive `tensor`.
+// Otherwise falls back to Tensor::FromProto().
+bool TensorFromProtoAliasingContent(const TensorProto& proto, Tensor* tensor);
+
 // Similar to RunPredict below, but allows specification of a serialization
 // option for the TensorProtos in the response.
 Status RunPredict(
@@ -40,6 +50,32 @@ Status RunPredict(
     const thread::ThreadPoolOptions& thread_pool_options =
         thread::ThreadPoolOptions());
 
+// Similar to RunPredict above, but takes the input tensors, keyed by input
+// alias, in `input_tensors` instead of as TensorProtos in `request.inputs`
+// (which are ignored). Avoids converting inputs that are already decoded, e.g.
+// from JSON, to TensorProtos and back.
+Status RunPredictWithInputTensors(
+    const RunOptions& run_options, const MetaGraphDef& meta_graph_def,
+    const absl::optional<int64>& servable_version,
+    const PredictResponseTensorSerializationOption tensor_serialization_option,
+    Session* session, const PredictRequest& request,
+    const std::map<string, Tensor>& input_tensors, PredictResponse* response,
+    const thread::ThreadPoolOptions& thread_pool_options =
+        thread::ThreadPoolOptions());
+
+// Similar to RunPredictWithInputTensors above, but also returns the output
+// tensors, keyed by output alias, in `output_tensors` instead of as
+// TensorProtos in `response.outputs`, e.g. so that they can be written to
+// shared memory without being serialized. `response` only gets the model spec.
+Status RunPredictWithTensors(
+    const RunOptions& run_options, const MetaGraphDef& meta_graph_def,
+    const absl::optional<int64>& servable_version, Session* session,
+    const PredictRequest& request,
+    const std::map<string, Tensor>& input_tensors,
+    std::map<string, Tensor>* output_tensors, PredictResponse* response,
+    const thread::ThreadPoolOptions& thread_pool_options =
+        thread::ThreadPoolOptions());
+
 }  // namespace internal
 
 // Implementation of Predict using the SavedModel SignatureDef format.
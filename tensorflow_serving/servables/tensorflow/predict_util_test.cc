@@ -15,11 +15,14 @@ limitations under the License.
 
 #include "tensorflow_serving/servables/tensorflow/predict_util.h"
 
+#include <map>
+
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include "absl/strings/str_cat.h"
 #include "tensorflow/cc/saved_model/loader.h"
 #include "tensorflow/cc/saved_model/signature_constants.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
 #include "tensorflow/core/platform/threadpool_options.h"
 #include "tensorflow_serving/core/availability_preserving_policy.h"
@@ -363,6 +366,83 @@ TEST_F(PredictImplTest, PredictionSuccess) {
   EXPECT_THAT(response, test_util::EqualsProto(expected_response));
 }
 
+TEST_F(PredictImplTest, PredictionWithInputTensorsSuccess) {
+  PredictRequest request;
+  PredictResponse response;
+
+  ModelSpec* model_spec = request.mutable_model_spec();
+  model_spec->set_name(kTestModelName);
+  model_spec->mutable_version()->set_value(kTestModelVersion);
+
+  // The inputs of the request are ignored.
+  TensorProto ignored_tensor_proto;
+  ignored_tensor_proto.add_float_val(100.0);
+  ignored_tensor_proto.set_dtype(tensorflow::DT_FLOAT);
+  (*request.mutable_inputs())[kInputTensorKey] = ignored_tensor_proto;
+
+  Tensor input_tensor(DT_FLOAT, TensorShape({}));
+  input_tensor.scalar<float>()() = 2.0;
+  const std::map<string, Tensor> input_tensors = {
+      {kInputTensorKey, input_tensor}};
+
+  ServableHandle<SavedModelBundle> bundle;
+  TF_ASSERT_OK(GetSavedModelServableHandle(GetServerCore(), &bundle));
+  TF_EXPECT_OK(internal::RunPredictWithInputTensors(
+      GetRunOptions(), bundle->meta_graph_def, kTestModelVersion,
+      internal::PredictResponseTensorSerializationOption::kAsProtoField,
+      bundle->session.get(), request, input_tensors, &response));
+  TensorProto output_tensor_proto;
+  output_tensor_proto.add_float_val(3);
+  output_tensor_proto.set_dtype(tensorflow::DT_FLOAT);
+  output_tensor_proto.mutable_tensor_shape();
+  PredictResponse expected_response;
+  *expected_response.mutable_model_spec() = *model_spec;
+  expected_response.mutable_model_spec()->set_signature_name(
+      kDefaultServingSignatureDefKey);
+  (*expected_response.mutable_outputs())[kOutputTensorKey] =
+      output_tensor_proto;
+  EXPECT_THAT(response, test_util::EqualsProto(expected_response));
+
+  // Missing inputs are reported as for TensorProto inputs.
+  EXPECT_FALSE(internal::RunPredictWithInputTensors(
+                   GetRunOptions(), bundle->meta_graph_def, kTestModelVersion,
+                   internal::PredictResponseTensorSerializationOption::
+                       kAsProtoField,
+                   bundle->session.get(), request, {}, &response)
+                   .ok());
+}
+
+TEST_F(PredictImplTest, PredictionWithTensorsSuccess) {
+  PredictRequest request;
+  PredictResponse response;
+
+  ModelSpec* model_spec = request.mutable_model_spec();
+  model_spec->set_name(kTestModelName);
+  model_spec->mutable_version()->set_value(kTestModelVersion);
+
+  Tensor input_tensor(DT_FLOAT, TensorShape({}));
+  input_tensor.scalar<float>()() = 2.0;
+  const std::map<string, Tensor> input_tensors = {
+      {kInputTensorKey, input_tensor}};
+
+  ServableHandle<SavedModelBundle> bundle;
+  TF_ASSERT_OK(GetSavedModelServableHandle(GetServerCore(), &bundle));
+  std::map<string, Tensor> output_tensors;
+  TF_EXPECT_OK(internal::RunPredictWithTensors(
+      GetRunOptions(), bundle->meta_graph_def, kTestModelVersion,
+      bundle->session.get(), request, input_tensors, &output_tensors,
+      &response));
+  ASSERT_EQ(output_tensors.size(), 1);
+  EXPECT_EQ(output_tensors[kOutputTensorKey].scalar<float>()(), 3);
+
+  // The response only gets the model spec.
+  PredictResponse expected_response;
+  *expected_response.mutable_model_spec() = *model_spec;
+  expected_response.mutable_model_spec()->set_signature_name(
+      kDefaultServingSignatureDefKey);
+  EXPECT_THAT(response, test_util::EqualsProto(expected_response));
+}
+
 // Test querying a model with a named regression signature (not default). This
 TEST_F(PredictImplTest, PredictionWithNamedRegressionSignature) {
   PredictRequest request;
@@ -599,6 +679,52 @@ TEST_F(PredictImplTest, MethodNameCheck) {
   SetSignatureMethodNameCheckFeature(old_val);
 }
 
+TEST(TensorFromProtoAliasingContentTest, AliasesAlignedTensorContent) {
+  Tensor expected(DT_FLOAT, TensorShape({32, 32}));
+  for (int i = 0; i < expected.NumElements(); ++i) {
+    expected.flat<float>()(i) = i;
+  }
+  TensorProto proto;
+  expected.AsProtoTensorContent(&proto);
+
+  Tensor tensor;
+  ASSERT_TRUE(internal::TensorFromProtoAliasingContent(proto, &tensor));
+  test::ExpectTensorEqual<float>(expected, tensor);
+  // Whether the bytes of the proto are aligned depends on the allocator.
+  if (reinterpret_cast<uintptr_t>(proto.tensor_content().data()) %
+          EIGEN_MAX_ALIGN_BYTES ==
+      0) {
+    EXPECT_EQ(proto.tensor_content().data(), tensor.tensor_data().data());
+  } else {
+    EXPECT_NE(proto.tensor_content().data(), tensor.tensor_data().data());
+  }
+}
+
+TEST(TensorFromProtoAliasingContentTest, CopiesOtherTensors) {
+  // Values in the typed fields.
+  TensorProto float_proto;
+  float_proto.set_dtype(DT_FLOAT);
+  float_proto.mutable_tensor_shape()->add_dim()->set_size(2);
+  float_proto.add_float_val(1.0);
+  float_proto.add_float_val(2.0);
+  Tensor tensor;
+  ASSERT_TRUE(internal::TensorFromProtoAliasingContent(float_proto, &tensor));
+  test::ExpectTensorEqual<float>(test::AsTensor<float>({1.0, 2.0}), tensor);
+
+  // Types that cannot be used from their raw bytes.
+  TensorProto string_proto;
+  test::AsTensor<tstring>({"a", "b"}).AsProtoTensorContent(&string_proto);
+  ASSERT_TRUE(internal::TensorFromProtoAliasingContent(string_proto, &tensor));
+  test::ExpectTensorEqual<tstring>(test::AsTensor<tstring>({"a", "b"}),
+                                   tensor);
+
+  // Content that does not match the shape fails to parse.
+  TensorProto bad_proto;
+  test::AsTensor<float>({1.0, 2.0}).AsProtoTensorContent(&bad_proto);
+  bad_proto.mutable_tensor_shape()->mutable_dim(0)->set_size(3);
+  EXPECT_FALSE(internal::TensorFromProtoAliasingContent(bad_proto, &tensor));
+}
+
 }  // namespace
 }  // namespace serving
 }  // namespace tensorflow
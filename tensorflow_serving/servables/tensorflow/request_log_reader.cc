@@ -0,0 +1,102 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/servables/tensorflow/request_log_reader.h"
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/io/record_reader.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace tensorflow {
+namespace serving {
+
+namespace {
+
+// Returns the model name of the request of 'prediction_log', or "" if it
+// can't be replayed.
+string RequestModelName(const PredictionLog& prediction_log) {
+  switch (prediction_log.log_type_case()) {
+    case PredictionLog::kRegressLog:
+      return prediction_log.regress_log().request().model_spec().name();
+    case PredictionLog::kClassifyLog:
+      return prediction_log.classify_log().request().model_spec().name();
+    case PredictionLog::kPredictLog:
+      return prediction_log.predict_log().request().model_spec().name();
+    case PredictionLog::kMultiInferenceLog: {
+      const MultiInferenceRequest& request =
+          prediction_log.multi_inference_log().request();
+      return request.tasks().empty()
+                 ? ""
+                 : request.tasks(0).model_spec().name();
+    }
+    default:
+      return "";
+  }
+}
+
+}  // namespace
+
+Status ReadRequestLogs(const string& file_pattern,
+                       const string& compression_type,
+                       const int max_num_records, const string& model_name,
+                       std::vector<PredictionLog>* const request_logs) {
+  std::vector<string> paths;
+  TF_RETURN_IF_ERROR(Env::Default()->GetMatchingPaths(file_pattern, &paths));
+  if (paths.empty()) {
+    return errors::NotFound("No request log matches ", file_pattern);
+  }
+  std::sort(paths.begin(), paths.end());
+  for (const string& path : paths) {
+    std::unique_ptr<RandomAccessFile> file;
+    TF_RETURN_IF_ERROR(Env::Default()->NewRandomAccessFile(path, &file));
+    io::SequentialRecordReader reader(
+        file.get(),
+        io::RecordReaderOptions::CreateRecordReaderOptions(compression_type));
+    tstring record;
+    while (static_cast<int>(request_logs->size()) < max_num_records) {
+      const Status status = reader.ReadRecord(&record);
+      if (errors::IsOutOfRange(status)) {
+        break;
+      }
+      if (!status.ok()) {
+        // E.g. a truncated record at the end of a file being written.
+        LOG(WARNING) << "Stopped reading the request log " << path << ": "
+                     << status;
+        break;
+      }
+      PredictionLog prediction_log;
+      if (!prediction_log.ParseFromArray(record.data(), record.size())) {
+        LOG(WARNING) << "Skipped an unparsable record of " << path;
+        continue;
+      }
+      const string request_model_name = RequestModelName(prediction_log);
+      if (prediction_log.log_type_case() == PredictionLog::kSessionRunLog ||
+          prediction_log.log_type_case() == PredictionLog::kCompactLog ||
+          (!model_name.empty() && request_model_name != model_name)) {
+        continue;
+      }
+      request_logs->push_back(std::move(prediction_log));
+    }
+  }
+  return Status::OK();
+}
+
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,40 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_REQUEST_LOG_READER_H_
+#define TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_REQUEST_LOG_READER_H_
+
+#include <vector>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow_serving/apis/prediction_log.pb.h"
+
+namespace tensorflow {
+namespace serving {
+
+// Reads the PredictionLogs of the TFRecord files matching 'file_pattern',
+// compressed with 'compression_type' ("", "ZLIB" or "GZIP"), and appends
+// those that can be replayed to 'request_logs', until 'max_num_records' are
+// read. If 'model_name' is not empty, only its requests are kept.
+Status ReadRequestLogs(const string& file_pattern,
+                       const string& compression_type, int max_num_records,
+                       const string& model_name,
+                       std::vector<PredictionLog>* request_logs);
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_REQUEST_LOG_READER_H_
@@ -0,0 +1,67 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/servables/tensorflow/request_log_reader.h"
+
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/io/record_writer.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+PredictionLog PredictLog(const string& model_name) {
+  PredictionLog prediction_log;
+  prediction_log.mutable_predict_log()
+      ->mutable_request()
+      ->mutable_model_spec()
+      ->set_name(model_name);
+  return prediction_log;
+}
+
+TEST(RequestLogReaderTest, ReadRequestLogs) {
+  const string path = io::JoinPath(testing::TmpDir(), "requests");
+  {
+    std::unique_ptr<WritableFile> file;
+    TF_ASSERT_OK(Env::Default()->NewWritableFile(path, &file));
+    io::RecordWriter writer(file.get());
+    for (const string& model_name : {"model", "other_model", "model"}) {
+      TF_ASSERT_OK(
+          writer.WriteRecord(PredictLog(model_name).SerializeAsString()));
+    }
+    TF_ASSERT_OK(writer.Close());
+    TF_ASSERT_OK(file->Close());
+  }
+
+  std::vector<PredictionLog> request_logs;
+  TF_ASSERT_OK(ReadRequestLogs(path, "", 10, "model", &request_logs));
+  EXPECT_EQ(2, request_logs.size());
+  request_logs.clear();
+  TF_ASSERT_OK(ReadRequestLogs(path, "", 2, "", &request_logs));
+  EXPECT_EQ(2, request_logs.size());
+  EXPECT_TRUE(errors::IsNotFound(
+      ReadRequestLogs(path + "_missing", "", 10, "", &request_logs)));
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
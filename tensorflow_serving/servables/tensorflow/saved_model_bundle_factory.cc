@@ -16,14 +16,18 @@ limitations under the License.
 #include "tensorflow_serving/servables/tensorflow/saved_model_bundle_factory.h"
 
 #include "absl/strings/string_view.h"
+#include "tensorflow/cc/saved_model/loader.h"
+#include "tensorflow/cc/saved_model/reader.h"
 #include "tensorflow/cc/saved_model/tag_constants.h"
 #include "tensorflow/core/framework/tensor.pb.h"
 #include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/gtl/cleanup.h"
 #include "tensorflow/core/lib/io/path.h"
 #include "tensorflow/core/protobuf/config.pb.h"
 #include "tensorflow/core/protobuf/meta_graph.pb.h"
 #include "tensorflow/core/protobuf/named_tensor.pb.h"
 #include "tensorflow/core/public/session_options.h"
+#include "tensorflow_serving/resources/resource_values.h"
 #include "tensorflow_serving/servables/tensorflow/bundle_factory_util.h"
 #include "tensorflow_serving/servables/tensorflow/tflite_session.h"
 #include "tensorflow_serving/session_bundle/session_bundle_util.h"
@@ -48,7 +52,9 @@ const char kTfLiteModelFilename[] = "model.tflite";
 
 Status LoadTfLiteModel(const string& model_dir, SavedModelBundle* bundle,
                        const SessionOptions& options, int num_interpreter_pools,
-                       int num_interpreters_per_pool) {
+                       int num_interpreters_per_pool,
+                       const std::vector<int>& batch_sizes,
+                       const TfLiteInterpreterOptions& interpreter_options) {
   std::unique_ptr<TfLiteSession> session;
 
   const string& fname = io::JoinPath(model_dir, kTfLiteModelFilename);
@@ -67,16 +73,34 @@ Status LoadTfLiteModel(const string& model_dir, SavedModelBundle* bundle,
   TF_RETURN_IF_ERROR(TfLiteSession::Create(
       std::move(model_bytes), options, num_interpreter_pools,
       num_interpreters_per_pool, &tflite_session,
-      bundle->meta_graph_def.mutable_signature_def()));
+      bundle->meta_graph_def.mutable_signature_def(), batch_sizes,
+      interpreter_options));
   bundle->session = std::move(tflite_session);
   return Status::OK();
 }
 
+// Returns the RAM bytes of 'estimate'.
+uint64 GetRamBytes(const ResourceAllocation& estimate) {
+  uint64 bytes = 0;
+  for (const auto& entry : estimate.resource_quantities()) {
+    if (entry.resource().kind() == resource_kinds::kRamBytes) {
+      bytes += entry.quantity();
+    }
+  }
+  return bytes;
+}
+
 bool TfLiteModelFound(const string& model_dir) {
   const string& fname = io::JoinPath(model_dir, kTfLiteModelFilename);
   return Env::Default()->FilesExist({fname}, nullptr);
 }
 
+bool IsOnLocalFileSystem(const string& path) {
+  StringPiece scheme, host, unused_path;
+  io::ParseURI(path, &scheme, &host, &unused_path);
+  return scheme.empty() || scheme == "file";
+}
+
 }  // namespace
 
 Status SavedModelBundleFactory::Create(
@@ -93,8 +117,36 @@ Status SavedModelBundleFactory::Create(
 
 Status SavedModelBundleFactory::EstimateResourceRequirement(
     const string& path, ResourceAllocation* estimate) const {
-  return EstimateResourceFromPath(
-      path, config_.resource_estimation_uses_validation_result(), estimate);
+  TF_RETURN_IF_ERROR(EstimateResourceFromPath(
+      path, config_.resource_estimation_uses_validation_result(), estimate));
+  if (transient_ram_budget_ != nullptr &&
+      config_.experimental_transient_ram_bytes_during_load() == 0) {
+    mutex_lock l(ram_estimates_mu_);
+    ram_estimates_[path] = GetRamBytes(*estimate);
+  }
+  return Status::OK();
+}
+
+Status SavedModelBundleFactory::GetTransientRamBytes(const string& path,
+                                                     uint64* bytes) {
+  *bytes = config_.experimental_transient_ram_bytes_during_load();
+  if (*bytes > 0) {
+    return Status::OK();
+  }
+  {
+    mutex_lock l(ram_estimates_mu_);
+    const auto it = ram_estimates_.find(path);
+    if (it != ram_estimates_.end()) {
+      *bytes = it->second;
+      ram_estimates_.erase(it);
+      return Status::OK();
+    }
+  }
+  ResourceAllocation estimate;
+  TF_RETURN_IF_ERROR(EstimateResourceFromPath(
+      path, config_.resource_estimation_uses_validation_result(), &estimate));
+  *bytes = GetRamBytes(estimate);
+  return Status::OK();
 }
 
 Status SavedModelBundleFactory::CreateSavedModelBundleWithMetadata(
@@ -130,19 +182,107 @@ Status SavedModelBundleFactory::InternalCreateSavedModelBundle(
     return result;
   }();
 
+  // The transient RAM is reserved until the bundle is created.
+  uint64 transient_ram_bytes = 0;
+  if (transient_ram_budget_ != nullptr) {
+    TF_RETURN_IF_ERROR(GetTransientRamBytes(path, &transient_ram_bytes));
+    transient_ram_budget_->Reserve(transient_ram_bytes);
+  }
+  auto release_transient_ram = gtl::MakeCleanup([&]() {
+    if (transient_ram_budget_ != nullptr) {
+      transient_ram_budget_->Release(transient_ram_bytes);
+    }
+  });
+
   bool is_tflite = config_.prefer_tflite_model() && TfLiteModelFound(path);
   if (is_tflite) {
     int num_tflite_pools = config_.num_tflite_pools();
     if (num_tflite_pools == 0 && config_.num_tflite_interpreters() > 0) {
       num_tflite_pools = config_.num_tflite_interpreters();
     }
+    // Batches are padded to the allowed batch sizes, for which the
+    // interpreters can then be sized ahead of time.
+    std::vector<int> batch_sizes;
+    if (config_.has_batching_parameters()) {
+      batch_sizes.assign(
+          config_.batching_parameters().allowed_batch_sizes().begin(),
+          config_.batching_parameters().allowed_batch_sizes().end());
+    }
     TF_RETURN_IF_ERROR(LoadTfLiteModel(
         path, bundle->get(), session_options, num_tflite_pools,
-        config_.num_tflite_interpreters_per_pool()));
+        config_.num_tflite_interpreters_per_pool(), batch_sizes,
+        config_.tflite_interpreter_options()));
   } else {
-    TF_RETURN_IF_ERROR(session_bundle::LoadSessionBundleOrSavedModelBundle(
-        session_options, GetRunOptions(config_), path, saved_model_tags,
-        bundle->get()));
+    // The local copy of a remote model is only needed while it is loaded. The
+    // files written in it by the load are kept in the model directory.
+    string local_copy_dir;
+    auto delete_local_copy = gtl::MakeCleanup([&]() {
+      if (!local_copy_dir.empty() &&
+          Env::Default()->IsDirectory(local_copy_dir).ok()) {
+        const Status status =
+            CopyBackFilesWrittenToLocalCopy(local_copy_dir, path);
+        if (!status.ok()) {
+          LOG(WARNING) << "Failed to copy the files written while loading "
+                       << path << " back from its local copy: " << status;
+        }
+        int64 undeleted_files, undeleted_dirs;
+        Env::Default()
+            ->DeleteRecursively(local_copy_dir, &undeleted_files,
+                                &undeleted_dirs)
+            .IgnoreError();
+      }
+    });
+    if (config_.num_variable_read_streams() > 1) {
+      if (!IsOnLocalFileSystem(path) &&
+          !Env::Default()->LocalTempFilename(&local_copy_dir)) {
+        return errors::Internal("Failed to get a local directory to copy ",
+                                path, " to");
+      }
+      TF_RETURN_IF_ERROR(PrefetchSavedModelVariables(
+          path, config_.num_variable_read_streams(), local_copy_dir));
+    }
+    const string& export_dir = local_copy_dir.empty() ? path : local_copy_dir;
+    // The sessions are reused across the versions of the model, when it is
+    // known. Note: A reused session keeps the session metadata of the version
+    // it was created for.
+    const bool reuse_sessions = reusable_sessions_ != nullptr &&
+                                metadata.has_value() &&
+                                MaybeSavedModelDirectory(export_dir);
+    uint64 graph_fingerprint = 0;
+    bool restored = false;
+    if (reuse_sessions) {
+      TF_RETURN_IF_ERROR(ReadMetaGraphDefFromSavedModel(
+          export_dir, saved_model_tags, &(*bundle)->meta_graph_def));
+      graph_fingerprint = MetaGraphFingerprint((*bundle)->meta_graph_def);
+      std::unique_ptr<Session> session = reusable_sessions_->Take(
+          metadata->servable_id.name, graph_fingerprint);
+      if (session != nullptr) {
+        const Status status =
+            RestoreSession(GetRunOptions(config_), (*bundle)->meta_graph_def,
+                           export_dir, &session);
+        if (status.ok()) {
+          LOG(INFO) << "Restored " << path
+                    << " into the session of a previous version";
+          (*bundle)->session = std::move(session);
+          restored = true;
+        } else {
+          LOG(WARNING) << "Failed to restore " << path
+                       << " into the session of a previous version, loading "
+                          "it in a new session: "
+                       << status;
+        }
+      }
+    }
+    if (!restored) {
+      TF_RETURN_IF_ERROR(session_bundle::LoadSessionBundleOrSavedModelBundle(
+          session_options, GetRunOptions(config_), export_dir,
+          saved_model_tags, bundle->get()));
+    }
+    if (reuse_sessions) {
+      reusable_sessions_->KeepOnDelete(metadata->servable_id.name,
+                                       graph_fingerprint,
+                                       &(*bundle)->session);
+    }
   }
   if (config_.remove_unused_fields_from_bundle_metagraph()) {
     // Save memory by removing fields in MetaGraphDef proto message stored
@@ -167,17 +307,43 @@ Status SavedModelBundleFactory::InternalCreateSavedModelBundle(
     // TODO(b/184973097): Remove enable_default_schedule_creator once TFLite is
     // fixed.
     const std::vector<SignatureDef> signatures = GetSignatureDefs(**bundle);
+    // The queues are shared by the versions of the model, when it is known.
     return WrapSessionForBatching(
         config_.batching_parameters(), batch_scheduler_, signatures,
         &(*bundle)->session,
-        /*enable_default_schedule_creator=*/!is_tflite);
+        /*enable_default_schedule_creator=*/!is_tflite,
+        metadata.has_value() ? metadata->servable_id.name : "",
+        metadata.has_value() ? shared_batching_queues_.get() : nullptr);
   }
-  return WrapSession(&(*bundle)->session);
+  return WrapSession(&(*bundle)->session,
+                     config_.enable_session_callable_cache());
 }
 
 SavedModelBundleFactory::SavedModelBundleFactory(
     const SessionBundleConfig& config, std::shared_ptr<Batcher> batch_scheduler)
-    : config_(config), batch_scheduler_(batch_scheduler) {}
+    : config_(config), batch_scheduler_(batch_scheduler) {
+  if (config.max_transient_ram_bytes_during_concurrent_loads() > 0) {
+    transient_ram_budget_.reset(new TransientRamBudget(
+        config.max_transient_ram_bytes_during_concurrent_loads()));
+  }
+  if (config.batching_parameters().share_queue_across_versions()) {
+    shared_batching_queues_.reset(new CrossVersionBatchingQueues());
+  }
+  if (config.reuse_sessions_across_identical_versions()) {
+    const int64 ttl_seconds = config.reused_session_ttl_seconds() > 0
+                                  ? config.reused_session_ttl_seconds()
+                                  : 600;
+    reusable_sessions_ =
+        std::make_shared<ReusableSessions>(ttl_seconds * 1000 * 1000);
+  }
+}
+
+void SavedModelBundleFactory::SetModelAspired(const string& model_name,
+                                              const bool aspired) {
+  if (reusable_sessions_ != nullptr) {
+    reusable_sessions_->SetModelAspired(model_name, aspired);
+  }
+}
 
 }  // namespace serving
 }  // namespace tensorflow
@@ -16,14 +16,19 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_SAVED_MODEL_BUNDLE_FACTORY_H_
 #define TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_SAVED_MODEL_BUNDLE_FACTORY_H_
 
+#include <map>
+
 #include "absl/types/optional.h"
 #include "tensorflow/cc/saved_model/loader.h"
 #include "tensorflow/core/kernels/batching_util/shared_batch_scheduler.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
 #include "tensorflow_serving/batching/batching_session.h"
 #include "tensorflow_serving/core/loader.h"
 #include "tensorflow_serving/resources/resources.pb.h"
+#include "tensorflow_serving/servables/tensorflow/bundle_factory_util.h"
 #include "tensorflow_serving/servables/tensorflow/session_bundle_config.pb.h"
 
 namespace tensorflow {
@@ -38,6 +43,9 @@ namespace serving {
 /// use-case please contact the TensorFlow Serving team to discuss disabling
 /// it.)
 ///
+/// If the config calls for it, the sessions of the unloaded versions of a model
+/// are reused to load its next versions with the same graph.
+///
 /// If the config calls for batching, the emitted sessions automatically batch
 /// Run() calls behind the scenes, using a SharedBatchScheduler owned by the
 /// factory. The 'config.num_batch_threads' threads are shared across all
@@ -88,6 +96,14 @@ class SavedModelBundleFactory {
 
   const SessionBundleConfig& config() const { return config_; }
 
+  /// Sets whether a model has aspired versions. The session of an unloaded
+  /// version of a model without any is not kept for reuse (see
+  /// SessionBundleConfig.reuse_sessions_across_identical_versions).
+  ///
+  /// @param model_name  Name of the model.
+  /// @param aspired     Whether the model has aspired versions.
+  void SetModelAspired(const string& model_name, bool aspired);
+
  private:
   using Batcher = SharedBatchScheduler<BatchingSessionTask>;
 
@@ -98,12 +114,38 @@ class SavedModelBundleFactory {
       const absl::optional<Loader::Metadata>& metadata, const string& path,
       std::unique_ptr<SavedModelBundle>* bundle);
 
+  // Returns the RAM that loading the version at 'path' is expected to use
+  // temporarily: experimental_transient_ram_bytes_during_load if set, and the
+  // RAM estimate of the version otherwise.
+  Status GetTransientRamBytes(const string& path, uint64* bytes)
+      TF_LOCKS_EXCLUDED(ram_estimates_mu_);
+
   const SessionBundleConfig config_;
 
   // A shared batch scheduler. One queue is used for each session this factory
   // emits. If batching is not configured, this remains null.
   std::shared_ptr<Batcher> batch_scheduler_;
 
+  // Bounds the transient RAM of the concurrent loads, if
+  // max_transient_ram_bytes_during_concurrent_loads is set.
+  std::unique_ptr<TransientRamBudget> transient_ram_budget_;
+
+  // The RAM estimates of the versions not loaded yet, by path, if
+  // 'transient_ram_budget_' uses them. An estimate made by
+  // EstimateResourceRequirement() ahead of the load of a version is taken by
+  // the load, instead of estimating the version again.
+  mutable mutex ram_estimates_mu_;
+  mutable std::map<string, uint64> ram_estimates_
+      TF_GUARDED_BY(ram_estimates_mu_);
+
+  // The batching queues shared by the versions of each model, if
+  // share_queue_across_versions is set.
+  std::unique_ptr<CrossVersionBatchingQueues> shared_batching_queues_;
+
+  // The sessions of the unloaded versions of each model, if
+  // reuse_sessions_across_identical_versions is set.
+  std::shared_ptr<ReusableSessions> reusable_sessions_;
+
   TF_DISALLOW_COPY_AND_ASSIGN(SavedModelBundleFactory);
 };
 
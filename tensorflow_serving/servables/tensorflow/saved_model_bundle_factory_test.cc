@@ -232,6 +232,55 @@ TEST_P(SavedModelBundleFactoryTest, RemoveUnusedFieldsFromMetaGraphEnabled) {
   EXPECT_FALSE(bundle->meta_graph_def.signature_def().empty());
 }
 
+TEST_P(SavedModelBundleFactoryTest, ReadVariablesConcurrently) {
+  SessionBundleConfig config = GetSessionBundleConfig();
+  *config.add_saved_model_tags() = kSavedModelTagServe;
+  config.set_num_variable_read_streams(4);
+  std::unique_ptr<SavedModelBundle> bundle;
+  if (ExpectCreateBundleFailure()) {
+    EXPECT_FALSE(CreateBundleFromPath(GetParam().creation_type, config,
+                                      export_dir_, &bundle)
+                     .ok());
+    return;
+  }
+  TF_ASSERT_OK(CreateBundleFromPath(GetParam().creation_type, config,
+                                    export_dir_, &bundle));
+  EXPECT_FALSE(bundle->meta_graph_def.signature_def().empty());
+}
+
+TEST(SavedModelBundleFactoryReuseTest, ReusesSessionsAcrossIdenticalVersions) {
+  SessionBundleConfig config;
+  config.set_session_target(test_util::kNewSessionHookSessionTargetPrefix);
+  config.set_reuse_sessions_across_identical_versions(true);
+  int num_new_sessions = 0;
+  test_util::SetNewSessionHook([&](const SessionOptions& session_options) {
+    ++num_new_sessions;
+    return Status::OK();
+  });
+  std::unique_ptr<SavedModelBundleFactory> factory;
+  TF_ASSERT_OK(SavedModelBundleFactory::Create(config, &factory));
+
+  const string path = test_util::GetTestSavedModelPath();
+  std::unique_ptr<SavedModelBundle> bundle;
+  TF_ASSERT_OK(factory->CreateSavedModelBundleWithMetadata(
+      {ServableId{"name", 1}}, path, &bundle));
+  test_util::TestSingleRequest(bundle->session.get());
+  bundle.reset();
+
+  // The next version has the same graph, so its variables are restored into
+  // the session of the first one.
+  TF_ASSERT_OK(factory->CreateSavedModelBundleWithMetadata(
+      {ServableId{"name", 2}}, path, &bundle));
+  test_util::TestSingleRequest(bundle->session.get());
+  EXPECT_EQ(1, num_new_sessions);
+
+  // Unlike a version of another model.
+  std::unique_ptr<SavedModelBundle> other_bundle;
+  TF_ASSERT_OK(factory->CreateSavedModelBundleWithMetadata(
+      {ServableId{"other", 1}}, path, &other_bundle));
+  EXPECT_EQ(2, num_new_sessions);
+}
+
 TEST_P(SavedModelBundleFactoryTest, Batching) {
   // Most test cases don't cover batching session code path so call
   // 'TestBatching' twice with different options for batching test case, as
@@ -17,6 +17,8 @@ limitations under the License.
 
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/platform/types.h"
@@ -31,6 +33,22 @@ limitations under the License.
 namespace tensorflow {
 namespace serving {
 
+namespace {
+
+// Warms up 'bundle' loaded from 'path' as configured by 'config'.
+Status RunWarmup(const SessionBundleConfig& config, const string& path,
+                 SavedModelBundle* bundle) {
+  TF_RETURN_IF_ERROR(RunSavedModelWarmup(config.model_warmup_options(),
+                                         GetRunOptions(config), path, bundle));
+  if (config.model_warmup_options().synthesize_requests()) {
+    return RunSynthesizedSavedModelWarmup(config, GetRunOptions(config),
+                                          bundle);
+  }
+  return Status::OK();
+}
+
+}  // namespace
+
 Status SavedModelBundleSourceAdapter::Create(
     const SavedModelBundleSourceAdapterConfig& config,
     std::unique_ptr<SavedModelBundleSourceAdapter>* adapter) {
@@ -59,9 +77,7 @@ SavedModelBundleSourceAdapter::GetServableCreator(
       MaybePublishMLMDStreamz(path, metadata.servable_id.name,
                               metadata.servable_id.version);
       if (bundle_factory->config().enable_model_warmup()) {
-        return RunSavedModelWarmup(
-            bundle_factory->config().model_warmup_options(),
-            GetRunOptions(bundle_factory->config()), path, bundle->get());
+        return RunWarmup(bundle_factory->config(), path, bundle->get());
       }
       return Status::OK();
     };
@@ -69,14 +85,37 @@ SavedModelBundleSourceAdapter::GetServableCreator(
   return [bundle_factory, path](std::unique_ptr<SavedModelBundle>* bundle) {
     TF_RETURN_IF_ERROR(bundle_factory->CreateSavedModelBundle(path, bundle));
     if (bundle_factory->config().enable_model_warmup()) {
-      return RunSavedModelWarmup(
-          bundle_factory->config().model_warmup_options(),
-          GetRunOptions(bundle_factory->config()), path, bundle->get());
+      return RunWarmup(bundle_factory->config(), path, bundle->get());
     }
     return Status::OK();
   };
 }
 
+std::vector<ServableData<std::unique_ptr<Loader>>>
+SavedModelBundleSourceAdapter::Adapt(
+    const StringPiece servable_name,
+    std::vector<ServableData<StoragePath>> versions) {
+  bundle_factory_->SetModelAspired(string(servable_name), !versions.empty());
+  std::vector<ServableData<std::unique_ptr<Loader>>> adapted_versions;
+  for (const ServableData<StoragePath>& version : versions) {
+    if (!version.status().ok()) {
+      adapted_versions.emplace_back(ServableData<std::unique_ptr<Loader>>{
+          version.id(), version.status()});
+      continue;
+    }
+    std::unique_ptr<Loader> loader;
+    const Status convert_status = Convert(version.DataOrDie(), &loader);
+    if (convert_status.ok()) {
+      adapted_versions.emplace_back(ServableData<std::unique_ptr<Loader>>{
+          version.id(), std::move(loader)});
+    } else {
+      adapted_versions.emplace_back(ServableData<std::unique_ptr<Loader>>{
+          version.id(), convert_status});
+    }
+  }
+  return adapted_versions;
+}
+
 Status SavedModelBundleSourceAdapter::Convert(const StoragePath& path,
                                               std::unique_ptr<Loader>* loader) {
   std::shared_ptr<SavedModelBundleFactory> bundle_factory = bundle_factory_;
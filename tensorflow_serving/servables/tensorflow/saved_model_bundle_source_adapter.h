@@ -16,6 +16,8 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_SAVED_MODEL_BUNDLE_SOURCE_ADAPTER_H_
 #define TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_SAVED_MODEL_BUNDLE_SOURCE_ADAPTER_H_
 
+#include <vector>
+
 #include "tensorflow/cc/saved_model/loader.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/platform/macros.h"
@@ -32,8 +34,12 @@ namespace serving {
 // A SourceAdapter that creates SavedModelBundle Loaders from SavedModel paths.
 // It keeps a SavedModelBundleFactory as its state, which may house a batch
 // scheduler that is shared across all of the SavedModel bundles it emits.
+//
+// Converts each version as a UnarySourceAdapter would, and also tells the
+// factory which models have aspired versions, so that it does not keep the
+// sessions of the removed ones for reuse.
 class SavedModelBundleSourceAdapter final
-    : public UnarySourceAdapter<StoragePath, std::unique_ptr<Loader>> {
+    : public SourceAdapter<StoragePath, std::unique_ptr<Loader>> {
  public:
   static Status Create(const SavedModelBundleSourceAdapterConfig& config,
                        std::unique_ptr<SavedModelBundleSourceAdapter>* adapter);
@@ -50,8 +56,11 @@ class SavedModelBundleSourceAdapter final
       std::shared_ptr<SavedModelBundleFactory> bundle_factory,
       const StoragePath& path) const;
 
-  Status Convert(const StoragePath& path,
-                 std::unique_ptr<Loader>* loader) override;
+  std::vector<ServableData<std::unique_ptr<Loader>>> Adapt(
+      StringPiece servable_name,
+      std::vector<ServableData<StoragePath>> versions) override;
+
+  Status Convert(const StoragePath& path, std::unique_ptr<Loader>* loader);
 
   // We use a shared ptr to share ownership with Loaders we emit, in case they
   // outlive this object.
@@ -27,8 +27,13 @@ limitations under the License.
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
 #include "tensorflow/core/lib/monitoring/gauge.h"
+#include "tensorflow_serving/core/aspired_versions_manager.h"
+#include "tensorflow_serving/core/availability_preserving_policy.h"
 #include "tensorflow_serving/core/loader.h"
 #include "tensorflow_serving/core/servable_data.h"
+#include "tensorflow_serving/core/servable_handle.h"
+#include "tensorflow_serving/core/target.h"
+#include "tensorflow_serving/core/test_util/manager_test_util.h"
 #include "tensorflow_serving/core/test_util/session_test_util.h"
 #include "tensorflow_serving/resources/resource_util.h"
 #include "tensorflow_serving/resources/resource_values.h"
@@ -180,6 +185,68 @@ TEST_P(SavedModelBundleSourceAdapterTest, MLMetadata) {
   EXPECT_EQ("test_mlmd_uuid", lps.points[0]->string_value);
 }
 
+TEST(SavedModelBundleSourceAdapterReuseTest, ReusesSessionsThroughManager) {
+  AspiredVersionsManager::Options manager_options;
+  manager_options.manage_state_interval_micros = -1;
+  manager_options.aspired_version_policy.reset(
+      new AvailabilityPreservingPolicy());
+  std::unique_ptr<AspiredVersionsManager> manager;
+  TF_ASSERT_OK(
+      AspiredVersionsManager::Create(std::move(manager_options), &manager));
+
+  SavedModelBundleSourceAdapterConfig config;
+  config.mutable_legacy_config()->set_enable_session_metadata(true);
+  config.mutable_legacy_config()->set_reuse_sessions_across_identical_versions(
+      true);
+  config.mutable_legacy_config()->set_session_target(
+      test_util::kNewSessionHookSessionTargetPrefix);
+  int num_new_sessions = 0;
+  test_util::SetNewSessionHook([&](const SessionOptions& session_options) {
+    ++num_new_sessions;
+    return Status::OK();
+  });
+  std::unique_ptr<SavedModelBundleSourceAdapter> adapter;
+  TF_ASSERT_OK(SavedModelBundleSourceAdapter::Create(config, &adapter));
+  ConnectSourceToTarget(adapter.get(), manager.get());
+
+  // Aspires 'versions' of the model, all with the same graph, and runs the
+  // resulting transition to completion.
+  auto aspire = [&](const std::vector<int64>& versions) {
+    std::vector<ServableData<StoragePath>> paths;
+    for (const int64 version : versions) {
+      paths.emplace_back(ServableId{"name", version},
+                         test_util::GetTestSavedModelPath());
+    }
+    adapter->SetAspiredVersions("name", std::move(paths));
+    test_util::AspiredVersionsManagerTestAccess access(manager.get());
+    access.HandlePendingAspiredVersionsRequests();
+    for (int i = 0; i < 3; ++i) {
+      access.InvokePolicyAndExecuteAction();
+    }
+  };
+
+  aspire({1});
+  EXPECT_EQ(1, num_new_sessions);
+  // The availability-preserving policy loads version 2 before unloading
+  // version 1, so version 2 gets a new session...
+  aspire({2});
+  EXPECT_EQ(2, num_new_sessions);
+  // ... and version 3 the session of version 1.
+  aspire({3});
+  EXPECT_EQ(2, num_new_sessions);
+  ServableHandle<SavedModelBundle> handle;
+  TF_ASSERT_OK(
+      manager->GetServableHandle(ServableRequest::Specific("name", 3), &handle));
+  test_util::TestSingleRequest(handle->session.get());
+  handle = ServableHandle<SavedModelBundle>();
+
+  // No session is kept for the model once it has no aspired versions.
+  aspire({});
+  EXPECT_TRUE(manager->ListAvailableServableIds().empty());
+  aspire({4});
+  EXPECT_EQ(3, num_new_sessions);
+}
+
 // Test all SavedModelBundleSourceAdapterTest test cases with
 // warmup, num_request_iterations enabled/disabled and session-metadata
 // enabled/disabled.
@@ -15,6 +15,8 @@ limitations under the License.
 
 #include "tensorflow_serving/servables/tensorflow/saved_model_warmup.h"
 
+#include <set>
+
 #include "google/protobuf/wrappers.pb.h"
 #include "absl/strings/str_cat.h"
 #include "tensorflow/cc/saved_model/constants.h"
@@ -23,7 +25,11 @@ limitations under the License.
 #include "tensorflow/core/lib/io/record_reader.h"
 #include "tensorflow/core/lib/monitoring/sampler.h"
 #include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/framework/tensor.pb.h"
+#include "tensorflow/core/framework/tensor_shape.pb.h"
+#include "tensorflow/core/framework/types.h"
 #include "tensorflow/core/protobuf/config.pb.h"
+#include "tensorflow_serving/apis/predict.pb.h"
 #include "tensorflow_serving/apis/prediction_log.pb.h"
 #include "tensorflow_serving/servables/tensorflow/classifier.h"
 #include "tensorflow_serving/servables/tensorflow/multi_inference.h"
@@ -73,6 +79,69 @@ Status RunWarmupRequest(const PredictionLog& warmup_record,
   return Status::OK();
 }
 
+// Returns the batch sizes of the synthesized warmup requests: 1, and the
+// allowed batch sizes of the batching, or else its max batch size.
+std::set<int64> GetSynthesizedBatchSizes(const SessionBundleConfig& config) {
+  std::set<int64> batch_sizes = {1};
+  if (config.has_batching_parameters()) {
+    const BatchingParameters& batching_parameters =
+        config.batching_parameters();
+    batch_sizes.insert(batching_parameters.allowed_batch_sizes().begin(),
+                       batching_parameters.allowed_batch_sizes().end());
+    if (batching_parameters.allowed_batch_sizes().empty() &&
+        batching_parameters.has_max_batch_size()) {
+      batch_sizes.insert(batching_parameters.max_batch_size().value());
+    }
+  }
+  return batch_sizes;
+}
+
+// Fills 'request' with 'batch_size' examples of zeros, or empty strings, for
+// the inputs of 'signature'. The unknown first dimensions are the batch
+// dimension, and the other unknown dimensions are 1. Sets 'batched' to
+// whether some input has a batch dimension.
+Status SynthesizePredictRequest(const string& signature_name,
+                                const SignatureDef& signature,
+                                const int64 batch_size,
+                                PredictRequest* const request,
+                                bool* const batched) {
+  request->mutable_model_spec()->set_signature_name(signature_name);
+  *batched = false;
+  for (const auto& input : signature.inputs()) {
+    const TensorInfo& tensor_info = input.second;
+    if (tensor_info.encoding_case() != TensorInfo::kName) {
+      return errors::Unimplemented("The input ", input.first,
+                                   " is not a dense tensor");
+    }
+    if (!DataTypeCanUseMemcpy(tensor_info.dtype()) &&
+        tensor_info.dtype() != DT_STRING) {
+      return errors::Unimplemented("The input ", input.first, " is a ",
+                                   DataTypeString(tensor_info.dtype()));
+    }
+    // A TensorProto without values is filled with zeros.
+    TensorProto& tensor = (*request->mutable_inputs())[input.first];
+    tensor.set_dtype(tensor_info.dtype());
+    TensorShapeProto* const shape = tensor.mutable_tensor_shape();
+    if (tensor_info.tensor_shape().unknown_rank()) {
+      shape->add_dim()->set_size(batch_size);
+      *batched = true;
+      continue;
+    }
+    for (int i = 0; i < tensor_info.tensor_shape().dim_size(); ++i) {
+      const int64 size = tensor_info.tensor_shape().dim(i).size();
+      if (size >= 0) {
+        shape->add_dim()->set_size(size);
+      } else if (i == 0) {
+        shape->add_dim()->set_size(batch_size);
+        *batched = true;
+      } else {
+        shape->add_dim()->set_size(1);
+      }
+    }
+  }
+  return Status::OK();
+}
+
 }  // namespace
 
 Status RunSavedModelWarmup(const ModelWarmupOptions& model_warmup_options,
@@ -85,5 +154,39 @@ Status RunSavedModelWarmup(const ModelWarmupOptions& model_warmup_options,
       });
 }
 
+Status RunSynthesizedSavedModelWarmup(const SessionBundleConfig& config,
+                                      const RunOptions& run_options,
+                                      SavedModelBundle* bundle) {
+  const std::set<int64> batch_sizes = GetSynthesizedBatchSizes(config);
+  int num_requests = 0;
+  for (const auto& signature : bundle->meta_graph_def.signature_def()) {
+    if (signature.first == kSavedModelInitOpSignatureKey) {
+      continue;
+    }
+    for (const int64 batch_size : batch_sizes) {
+      PredictRequest request;
+      bool batched;
+      Status status = SynthesizePredictRequest(
+          signature.first, signature.second, batch_size, &request, &batched);
+      if (status.ok()) {
+        PredictResponse response;
+        status = RunPredict(run_options, bundle->meta_graph_def, {},
+                            bundle->GetSession(), request, &response);
+      }
+      if (!status.ok()) {
+        LOG(WARNING) << "Skipped the synthesized warmup of the signature "
+                     << signature.first << ": " << status;
+        break;
+      }
+      ++num_requests;
+      if (!batched) {
+        break;
+      }
+    }
+  }
+  LOG(INFO) << "Ran " << num_requests << " synthesized warmup requests";
+  return Status::OK();
+}
+
 }  // namespace serving
 }  // namespace tensorflow
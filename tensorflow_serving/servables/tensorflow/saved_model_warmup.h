@@ -35,6 +35,18 @@ Status RunSavedModelWarmup(const ModelWarmupOptions& model_warmup_options,
                            const RunOptions& run_options,
                            const string& export_dir, SavedModelBundle* bundle);
 
+// Runs Predict requests synthesized from the SignatureDefs of the bundle (see
+// ModelWarmupOptions.synthesize_requests), for models without warmup data:
+// for each signature, one request of zeros, or empty strings, per batch size
+// among 1 and the allowed batch sizes of config.batching_parameters (or its
+// max batch size). The executors, allocators and caches of the session are
+// then sized for all the batch sizes before the model is available. The
+// signatures whose inputs can't be synthesized, or which fail on them, are
+// skipped with a warning.
+Status RunSynthesizedSavedModelWarmup(const SessionBundleConfig& config,
+                                      const RunOptions& run_options,
+                                      SavedModelBundle* bundle);
+
 }  // namespace serving
 }  // namespace tensorflow
 
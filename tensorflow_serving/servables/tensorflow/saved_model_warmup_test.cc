@@ -49,6 +49,7 @@ namespace {
 using test_util::MockSession;
 using ::testing::_;
 using ::testing::DoAll;
+using ::testing::Invoke;
 using ::testing::Return;
 using ::testing::SetArgPointee;
 using ::testing::SizeIs;
@@ -141,6 +142,54 @@ TEST(SavedModelBundleWarmupTest, UnsupportedLogType) {
               ::testing::HasSubstr("Unsupported log_type for warmup"));
 }
 
+TEST(SavedModelBundleWarmupTest, SynthesizedRequestsCoverTheBatchSizes) {
+  SavedModelBundle saved_model_bundle;
+  SignatureDef signature_def;
+  signature_def.set_method_name(kPredictMethodName);
+  TensorInfo input;
+  input.set_name("x:0");
+  input.set_dtype(DT_FLOAT);
+  input.mutable_tensor_shape()->add_dim()->set_size(-1);
+  input.mutable_tensor_shape()->add_dim()->set_size(3);
+  (*signature_def.mutable_inputs())["x"] = input;
+  TensorInfo output;
+  output.set_name("y:0");
+  output.set_dtype(DT_FLOAT);
+  (*signature_def.mutable_outputs())["y"] = output;
+  (*saved_model_bundle.meta_graph_def.mutable_signature_def())["serving"] =
+      signature_def;
+  // Inputs which can't be synthesized are skipped.
+  SignatureDef resource_signature_def = signature_def;
+  (*resource_signature_def.mutable_inputs())["x"].set_dtype(DT_RESOURCE);
+  (*saved_model_bundle.meta_graph_def.mutable_signature_def())["resource"] =
+      resource_signature_def;
+  MockSession* mock = new MockSession;
+  saved_model_bundle.session.reset(mock);
+
+  std::vector<int64> batch_sizes;
+  EXPECT_CALL(*mock, Run(_, _, SizeIs(1), _, _, _, _))
+      .Times(3)
+      .WillRepeatedly(
+          Invoke([&](const RunOptions& run_options,
+                     const std::vector<std::pair<string, Tensor>>& inputs,
+                     const std::vector<string>& output_tensor_names,
+                     const std::vector<string>& target_node_names,
+                     std::vector<Tensor>* outputs, RunMetadata* run_metadata,
+                     const thread::ThreadPoolOptions& thread_pool_options) {
+            EXPECT_EQ(inputs.size(), 1);
+            EXPECT_EQ(inputs[0].second.dim_size(1), 3);
+            batch_sizes.push_back(inputs[0].second.dim_size(0));
+            *outputs = {Tensor(DT_FLOAT, TensorShape({1}))};
+            return Status::OK();
+          }));
+  SessionBundleConfig config;
+  config.mutable_batching_parameters()->add_allowed_batch_sizes(4);
+  config.mutable_batching_parameters()->add_allowed_batch_sizes(16);
+  TF_EXPECT_OK(RunSynthesizedSavedModelWarmup(config, RunOptions(),
+                                              &saved_model_bundle));
+  EXPECT_THAT(batch_sizes, ::testing::ElementsAre(1, 4, 16));
+}
+
 }  // namespace
 
 }  // namespace serving
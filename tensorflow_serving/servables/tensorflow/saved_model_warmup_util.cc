@@ -15,12 +15,28 @@ limitations under the License.
 
 #include "tensorflow_serving/servables/tensorflow/saved_model_warmup_util.h"
 
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
 #include "google/protobuf/wrappers.pb.h"
+#include "absl/strings/str_cat.h"
 #include "tensorflow/cc/saved_model/constants.h"
+#include "tensorflow/core/framework/tensor.pb.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/io/path.h"
 #include "tensorflow/core/lib/io/record_reader.h"
+#include "tensorflow/core/lib/core/threadpool.h"
 #include "tensorflow/core/lib/monitoring/sampler.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow_serving/apis/classification.pb.h"
+#include "tensorflow_serving/apis/inference.pb.h"
+#include "tensorflow_serving/apis/input.pb.h"
+#include "tensorflow_serving/apis/predict.pb.h"
+#include "tensorflow_serving/apis/regression.pb.h"
 
 namespace tensorflow {
 namespace serving {
@@ -36,6 +52,9 @@ auto* model_warm_up_latency = monitoring::Sampler<2>::New(
     },  // Scale of 10, power of 1.8 with bucket count 33 (~20 minutes).
     monitoring::Buckets::Exponential(10, 1.8, 33));
 
+// How many logged requests are read for each replayed one.
+constexpr int kNumReadRequestLogRecordsPerReplayedRecord = 10;
+
 uint64 GetLatencyMicroseconds(const uint64 start_microseconds) {
   const uint64 end_microseconds = EnvTime::NowMicros();
   // Avoid clock skew.
@@ -43,6 +62,232 @@ uint64 GetLatencyMicroseconds(const uint64 start_microseconds) {
   return end_microseconds - start_microseconds;
 }
 
+// Runs the warmup requests 'num_request_iterations' times each, concurrently
+// on 'num_threads' threads if more than 1.
+class WarmupRequestRunner {
+ public:
+  WarmupRequestRunner(
+      const int num_request_iterations, const int num_threads,
+      const std::function<Status(PredictionLog)>& warmup_request_executor)
+      : num_request_iterations_(num_request_iterations),
+        warmup_request_executor_(warmup_request_executor) {
+    if (num_threads > 1) {
+      executor_.reset(new thread::ThreadPool(
+          Env::Default(), "Warmup_ThreadPool", num_threads));
+    }
+  }
+
+  // Runs, or schedules, 'prediction_log'. Returns the first error of the
+  // requests run so far.
+  Status Run(std::shared_ptr<const PredictionLog> prediction_log) {
+    if (executor_ == nullptr) {
+      for (int i = 0; i < num_request_iterations_; ++i) {
+        TF_RETURN_IF_ERROR(warmup_request_executor_(*prediction_log));
+      }
+      return Status::OK();
+    }
+    {
+      mutex_lock l(status_mu_);
+      TF_RETURN_IF_ERROR(status_);
+    }
+    for (int i = 0; i < num_request_iterations_; ++i) {
+      executor_->Schedule([this, prediction_log]() {
+        const Status request_status =
+            warmup_request_executor_(*prediction_log);
+        if (!request_status.ok()) {
+          mutex_lock l(status_mu_);
+          status_.Update(request_status);
+        }
+      });
+    }
+    return Status::OK();
+  }
+
+  // Waits for the scheduled requests to finish, and returns the first error.
+  Status Wait() {
+    executor_.reset();
+    mutex_lock l(status_mu_);
+    return status_;
+  }
+
+ private:
+  const int num_request_iterations_;
+  const std::function<Status(PredictionLog)> warmup_request_executor_;
+  // The first error of the requests run by 'executor_'.
+  mutex status_mu_;
+  Status status_ TF_GUARDED_BY(status_mu_);
+  // Declared last, so that it is destroyed, i.e. waits for the scheduled
+  // requests, first.
+  std::unique_ptr<thread::ThreadPool> executor_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(WarmupRequestRunner);
+};
+
+// Returns the number of examples of 'input'.
+int NumExamples(const Input& input) {
+  return input.has_example_list()
+             ? input.example_list().examples_size()
+             : input.example_list_with_context().examples_size();
+}
+
+// Returns a key identifying the signature, input shapes and batch size of the
+// request of 'prediction_log', or "" if it can't be replayed.
+string RequestShapeKey(const PredictionLog& prediction_log) {
+  switch (prediction_log.log_type_case()) {
+    case PredictionLog::kRegressLog: {
+      const RegressionRequest& request = prediction_log.regress_log().request();
+      return absl::StrCat("regress/", request.model_spec().signature_name(),
+                          "/", NumExamples(request.input()));
+    }
+    case PredictionLog::kClassifyLog: {
+      const ClassificationRequest& request =
+          prediction_log.classify_log().request();
+      return absl::StrCat("classify/", request.model_spec().signature_name(),
+                          "/", NumExamples(request.input()));
+    }
+    case PredictionLog::kPredictLog: {
+      const PredictRequest& request = prediction_log.predict_log().request();
+      string key =
+          absl::StrCat("predict/", request.model_spec().signature_name());
+      // The inputs are sorted, as the iteration order of the map is not
+      // deterministic.
+      std::map<string, const TensorProto*> inputs;
+      for (const auto& input : request.inputs()) {
+        inputs[input.first] = &input.second;
+      }
+      for (const auto& input : inputs) {
+        absl::StrAppend(&key, "/", input.first, ":");
+        for (const auto& dim : input.second->tensor_shape().dim()) {
+          absl::StrAppend(&key, dim.size(), ",");
+        }
+      }
+      return key;
+    }
+    case PredictionLog::kMultiInferenceLog: {
+      const MultiInferenceRequest& request =
+          prediction_log.multi_inference_log().request();
+      string key = absl::StrCat("multi_inference/",
+                                NumExamples(request.input()));
+      for (const InferenceTask& task : request.tasks()) {
+        absl::StrAppend(&key, "/", task.model_spec().signature_name());
+      }
+      return key;
+    }
+    default:
+      return "";
+  }
+}
+
+// Appends to 'request_logs' the replayable PredictionLogs of the TFRecord
+// file at 'path', until 'max_num_records' are read. A truncated record, e.g.
+// at the end of a file being written, ends the file.
+Status ReadRequestLogFile(
+    const string& path, const string& compression_type,
+    const int max_num_records,
+    std::vector<std::shared_ptr<const PredictionLog>>* const request_logs) {
+  std::unique_ptr<RandomAccessFile> file;
+  TF_RETURN_IF_ERROR(Env::Default()->NewRandomAccessFile(path, &file));
+  io::SequentialRecordReader reader(
+      file.get(),
+      io::RecordReaderOptions::CreateRecordReaderOptions(compression_type));
+  tstring record;
+  while (static_cast<int>(request_logs->size()) < max_num_records) {
+    const Status status = reader.ReadRecord(&record);
+    if (errors::IsOutOfRange(status)) {
+      break;
+    }
+    if (!status.ok()) {
+      LOG(WARNING) << "Stopped reading the request log " << path << ": "
+                   << status;
+      break;
+    }
+    auto prediction_log = std::make_shared<PredictionLog>();
+    if (!prediction_log->ParseFromArray(record.data(), record.size())) {
+      LOG(WARNING) << "Skipped an unparsable record of " << path;
+      continue;
+    }
+    if (prediction_log->log_type_case() == PredictionLog::kSessionRunLog ||
+        prediction_log->log_type_case() == PredictionLog::kCompactLog) {
+      continue;
+    }
+    request_logs->push_back(std::move(prediction_log));
+  }
+  return Status::OK();
+}
+
+// Samples the requests of the logs matching the pattern of
+// 'model_warmup_options', so that every distinct request shape is replayed
+// (as long as there are fewer shapes than requests to replay).
+Status SampleRequestLogs(
+    const ModelWarmupOptions& model_warmup_options, const string& export_dir,
+    std::vector<std::shared_ptr<const PredictionLog>>* const request_logs) {
+  const string& pattern = model_warmup_options.request_log_file_pattern();
+  const string full_pattern =
+      io::IsAbsolutePath(pattern)
+          ? pattern
+          : io::JoinPath(io::Dirname(export_dir), pattern);
+  const int max_num_records =
+      model_warmup_options.has_max_num_request_log_records()
+          ? model_warmup_options.max_num_request_log_records().value()
+          : WarmupConsts::kMaxNumRecords;
+  std::vector<string> paths;
+  TF_RETURN_IF_ERROR(Env::Default()->GetMatchingPaths(full_pattern, &paths));
+
+  // The most recent files, i.e. the closest to the current traffic, first.
+  std::vector<std::pair<int64, string>> files;
+  for (string& path : paths) {
+    FileStatistics stats;
+    if (Env::Default()->Stat(path, &stats).ok() && !stats.is_directory) {
+      files.emplace_back(stats.mtime_nsec, std::move(path));
+    }
+  }
+  std::sort(files.begin(), files.end(),
+            [](const std::pair<int64, string>& a,
+               const std::pair<int64, string>& b) {
+              return a.first > b.first;
+            });
+
+  // Reads more records than replayed, so that the rare shapes are found.
+  const int max_num_read_records =
+      max_num_records * kNumReadRequestLogRecordsPerReplayedRecord;
+  std::vector<std::shared_ptr<const PredictionLog>> read_logs;
+  for (const auto& file : files) {
+    if (static_cast<int>(read_logs.size()) >= max_num_read_records) {
+      break;
+    }
+    TF_RETURN_IF_ERROR(ReadRequestLogFile(
+        file.second, model_warmup_options.request_log_compression_type(),
+        max_num_read_records, &read_logs));
+  }
+
+  // Picks the requests round robin over their shapes.
+  std::map<string, std::vector<std::shared_ptr<const PredictionLog>>>
+      logs_by_shape;
+  for (auto& read_log : read_logs) {
+    const string key = RequestShapeKey(*read_log);
+    if (!key.empty()) {
+      logs_by_shape[key].push_back(std::move(read_log));
+    }
+  }
+  request_logs->clear();
+  const auto num_picked = [&]() {
+    return static_cast<int>(request_logs->size());
+  };
+  for (int round = 0; num_picked() < max_num_records; ++round) {
+    bool picked = false;
+    for (const auto& shape_logs : logs_by_shape) {
+      if (round < static_cast<int>(shape_logs.second.size()) &&
+          num_picked() < max_num_records) {
+        request_logs->push_back(shape_logs.second[round]);
+        picked = true;
+      }
+    }
+    if (!picked) {
+      break;
+    }
+  }
+  return Status::OK();
+}
 }  // namespace
 
 constexpr char WarmupConsts::kRequestsFileName[];
@@ -52,6 +297,71 @@ Status RunSavedModelWarmup(
     const ModelWarmupOptions& model_warmup_options, const string export_dir,
     std::function<Status(PredictionLog)> warmup_request_executor) {
   const uint64 start_microseconds = EnvTime::NowMicros();
+  const int num_request_iterations = [&]() {
+    if (model_warmup_options.has_num_request_iterations()) {
+      return model_warmup_options.num_request_iterations().value();
+    }
+    // Default of 1.
+    return 1;
+  }();
+  const int num_model_warmup_threads = [&]() {
+    if (model_warmup_options.has_num_model_warmup_threads()) {
+      return std::max(model_warmup_options.num_model_warmup_threads().value(),
+                      1);
+    }
+    // Default of 1.
+    return 1;
+  }();
+
+  if (!model_warmup_options.request_log_file_pattern().empty()) {
+    std::vector<std::shared_ptr<const PredictionLog>> request_logs;
+    TF_RETURN_IF_ERROR(
+        SampleRequestLogs(model_warmup_options, export_dir, &request_logs));
+    if (!request_logs.empty()) {
+      LOG(INFO) << "Starting to replay " << request_logs.size()
+                << " logged requests to warm up the model at " << export_dir
+                << " with model-warmup-options "
+                << model_warmup_options.DebugString();
+      // The replay is best-effort: the requests logged for the previous
+      // versions may not fit this one (e.g. a removed signature or input), and
+      // their failures do not fail the load.
+      std::atomic<int> num_failed_requests(0);
+      WarmupRequestRunner runner(
+          num_request_iterations, num_model_warmup_threads,
+          [&](PredictionLog prediction_log) {
+            const Status request_status =
+                warmup_request_executor(std::move(prediction_log));
+            if (!request_status.ok()) {
+              if (num_failed_requests++ == 0) {
+                LOG(WARNING) << "Failed to replay a logged request to warm up "
+                                "the model at "
+                             << export_dir << ": " << request_status;
+              } else {
+                VLOG(1) << "Failed to replay a logged request to warm up the "
+                           "model at "
+                        << export_dir << ": " << request_status;
+              }
+            }
+            return Status::OK();
+          });
+      for (const auto& request_log : request_logs) {
+        TF_RETURN_IF_ERROR(runner.Run(request_log));
+      }
+      TF_RETURN_IF_ERROR(runner.Wait());
+      const auto warmup_latency = GetLatencyMicroseconds(start_microseconds);
+      model_warm_up_latency->GetCell(export_dir, Status::OK().ToString())
+          ->Add(warmup_latency);
+      LOG(INFO) << "Finished replaying logged requests for model at "
+                << export_dir << ". Failed requests: " << num_failed_requests
+                << " of " << request_logs.size() * num_request_iterations
+                << ". Elapsed time (microseconds): " << warmup_latency << ".";
+      return Status::OK();
+    }
+    LOG(INFO) << "No request logs found at "
+              << model_warmup_options.request_log_file_pattern()
+              << ", falling back to the warmup data of the model.";
+  }
+
   const string warmup_path =
       io::JoinPath(export_dir, kSavedModelAssetsExtraDirectory,
                    WarmupConsts::kRequestsFileName);
@@ -61,13 +371,6 @@ Status RunSavedModelWarmup(
     return Status::OK();
   }
 
-  const int num_request_iterations = [&]() {
-    if (model_warmup_options.has_num_request_iterations()) {
-      return model_warmup_options.num_request_iterations().value();
-    }
-    // Default of 1.
-    return 1;
-  }();
   LOG(INFO) << "Starting to read warmup data for model at " << warmup_path
             << " with model-warmup-options "
             << model_warmup_options.DebugString();
@@ -78,19 +381,21 @@ Status RunSavedModelWarmup(
   std::unique_ptr<tensorflow::io::SequentialRecordReader> tf_record_file_reader;
   tf_record_file_reader.reset(
       new tensorflow::io::SequentialRecordReader(tf_record_file.get()));
+
+  WarmupRequestRunner runner(num_request_iterations, num_model_warmup_threads,
+                             warmup_request_executor);
+
   int num_warmup_records = 0;
   tstring record;
   Status status = tf_record_file_reader->ReadRecord(&record);
-  tensorflow::serving::PredictionLog prediction_log;
   while (status.ok()) {
-    if (!prediction_log.ParseFromArray(record.data(), record.size())) {
+    auto prediction_log = std::make_shared<PredictionLog>();
+    if (!prediction_log->ParseFromArray(record.data(), record.size())) {
       return errors::InvalidArgument(strings::StrCat(
           "Failed to parse warmup record: ", record, " from ", warmup_path));
     }
 
-    for (int i = 0; i < num_request_iterations; ++i) {
-      TF_RETURN_IF_ERROR(warmup_request_executor(prediction_log));
-    }
+    TF_RETURN_IF_ERROR(runner.Run(std::move(prediction_log)));
     ++num_warmup_records;
     if (num_warmup_records > WarmupConsts::kMaxNumRecords) {
       return errors::InvalidArgument(
@@ -106,6 +411,7 @@ Status RunSavedModelWarmup(
   if (errors::IsOutOfRange(status)) {
     status = Status::OK();
   }
+  status.Update(runner.Wait());
 
   const auto warmup_latency = GetLatencyMicroseconds(start_microseconds);
   model_warm_up_latency->GetCell(export_dir, status.ToString())
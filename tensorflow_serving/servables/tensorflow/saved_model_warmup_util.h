@@ -35,6 +35,12 @@ struct WarmupConsts {
 // to trigger lazy initializations (such as TF optimizations, XLA compilations)
 // at load time, and consequently improve first request latency.
 // Warmup is skipped if no warmup file present.
+// If model_warmup_options.request_log_file_pattern matches some files, a sample
+// of the PredictionLogs they hold, covering each distinct request shape, is
+// replayed instead, e.g. the logged requests of the previous versions.
+// If model_warmup_options.num_model_warmup_threads is more than 1, the requests
+// are instead invoked concurrently on that many threads, and
+// 'warmup_request_executor' must be thread-safe.
 Status RunSavedModelWarmup(
     const ModelWarmupOptions& model_warmup_options, const string export_dir,
     std::function<Status(PredictionLog)> warmup_request_executor);
@@ -15,6 +15,9 @@ limitations under the License.
 
 #include "tensorflow_serving/servables/tensorflow/saved_model_warmup_util.h"
 
+#include <atomic>
+#include <map>
+
 #include "google/protobuf/wrappers.pb.h"
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -177,6 +180,132 @@ TEST_F(SavedModelBundleWarmupUtilTest, RunFailure) {
   EXPECT_THAT(status.ToString(), ::testing::HasSubstr("Run failed"));
 }
 
+TEST_F(SavedModelBundleWarmupUtilTest, MultipleWarmupThreads) {
+  string base_path = io::JoinPath(testing::TmpDir(), "MultipleWarmupThreads");
+  TF_ASSERT_OK(Env::Default()->RecursivelyCreateDir(
+      io::JoinPath(base_path, kSavedModelAssetsExtraDirectory)));
+  string fname = io::JoinPath(base_path, kSavedModelAssetsExtraDirectory,
+                              internal::WarmupConsts::kRequestsFileName);
+
+  int num_warmup_records = 10;
+  std::vector<string> warmup_records;
+  AddMixedWarmupData(&warmup_records);
+  TF_ASSERT_OK(WriteWarmupData(fname, warmup_records, num_warmup_records));
+  ModelWarmupOptions model_warmup_options;
+  model_warmup_options.mutable_num_request_iterations()->set_value(2);
+  model_warmup_options.mutable_num_model_warmup_threads()->set_value(4);
+  std::atomic<int> num_requests(0);
+  TF_EXPECT_OK(RunSavedModelWarmup(model_warmup_options, base_path,
+                                   [&](PredictionLog prediction_log) {
+                                     ++num_requests;
+                                     return Status::OK();
+                                   }));
+  EXPECT_EQ(2 * num_warmup_records, num_requests.load());
+
+  const Status status = RunSavedModelWarmup(
+      model_warmup_options, base_path, [](PredictionLog prediction_log) {
+        return errors::InvalidArgument("Run failed");
+      });
+  ASSERT_FALSE(status.ok());
+  EXPECT_EQ(::tensorflow::error::INVALID_ARGUMENT, status.code()) << status;
+  EXPECT_THAT(status.ToString(), ::testing::HasSubstr("Run failed"));
+}
+
+TEST_F(SavedModelBundleWarmupUtilTest, ReplaysSampledRequestLogs) {
+  const string model_path =
+      io::JoinPath(testing::TmpDir(), "ReplaysSampledRequestLogs");
+  const string export_dir = io::JoinPath(model_path, "1");
+  TF_ASSERT_OK(Env::Default()->RecursivelyCreateDir(
+      io::JoinPath(export_dir, kSavedModelAssetsExtraDirectory)));
+  TF_ASSERT_OK(Env::Default()->RecursivelyCreateDir(
+      io::JoinPath(model_path, "request_logs")));
+  // The bundled warmup data is ignored.
+  std::vector<string> bundled_records;
+  AddMixedWarmupData(&bundled_records, {PredictionLog::kRegressLog});
+  TF_ASSERT_OK(WriteWarmupData(
+      io::JoinPath(export_dir, kSavedModelAssetsExtraDirectory,
+                   internal::WarmupConsts::kRequestsFileName),
+      bundled_records, 1));
+  // Most logged requests are predict ones, one is a classify one.
+  std::vector<string> predict_records;
+  AddMixedWarmupData(&predict_records, {PredictionLog::kPredictLog});
+  TF_ASSERT_OK(WriteWarmupData(
+      io::JoinPath(model_path, "request_logs", "log-0.tfrecord"),
+      predict_records, 20));
+  std::vector<string> classify_records;
+  AddMixedWarmupData(&classify_records, {PredictionLog::kClassifyLog});
+  TF_ASSERT_OK(WriteWarmupData(
+      io::JoinPath(model_path, "request_logs", "log-1.tfrecord"),
+      classify_records, 1));
+
+  ModelWarmupOptions model_warmup_options;
+  model_warmup_options.set_request_log_file_pattern("request_logs/*");
+  model_warmup_options.mutable_max_num_request_log_records()->set_value(2);
+  std::map<PredictionLog::LogTypeCase, int> num_requests;
+  TF_EXPECT_OK(RunSavedModelWarmup(model_warmup_options, export_dir,
+                                   [&](PredictionLog prediction_log) {
+                                     ++num_requests[prediction_log
+                                                        .log_type_case()];
+                                     return Status::OK();
+                                   }));
+  // Each shape is replayed.
+  EXPECT_EQ(num_requests.size(), 2);
+  EXPECT_EQ(num_requests[PredictionLog::kPredictLog], 1);
+  EXPECT_EQ(num_requests[PredictionLog::kClassifyLog], 1);
+}
+
+TEST_F(SavedModelBundleWarmupUtilTest, FailedRequestLogReplaysAreIgnored) {
+  const string model_path =
+      io::JoinPath(testing::TmpDir(), "FailedRequestLogReplaysAreIgnored");
+  const string export_dir = io::JoinPath(model_path, "1");
+  TF_ASSERT_OK(Env::Default()->RecursivelyCreateDir(export_dir));
+  TF_ASSERT_OK(Env::Default()->RecursivelyCreateDir(
+      io::JoinPath(model_path, "request_logs")));
+  std::vector<string> request_log_records;
+  AddMixedWarmupData(&request_log_records, {PredictionLog::kPredictLog,
+                                            PredictionLog::kClassifyLog});
+  TF_ASSERT_OK(WriteWarmupData(
+      io::JoinPath(model_path, "request_logs", "log-0.tfrecord"),
+      request_log_records, 1));
+
+  ModelWarmupOptions model_warmup_options;
+  model_warmup_options.set_request_log_file_pattern("request_logs/*");
+  model_warmup_options.mutable_num_model_warmup_threads()->set_value(2);
+  std::atomic<int> num_requests(0);
+  // E.g. the classify signature of the previous versions was removed.
+  TF_EXPECT_OK(RunSavedModelWarmup(
+      model_warmup_options, export_dir, [&](PredictionLog prediction_log) {
+        ++num_requests;
+        if (prediction_log.log_type_case() == PredictionLog::kClassifyLog) {
+          return errors::InvalidArgument("Unknown signature");
+        }
+        return Status::OK();
+      }));
+  EXPECT_EQ(num_requests, 2);
+}
+
+TEST_F(SavedModelBundleWarmupUtilTest, NoRequestLogsFallsBackToWarmupData) {
+  const string export_dir = io::JoinPath(
+      testing::TmpDir(), "NoRequestLogsFallsBackToWarmupData", "1");
+  TF_ASSERT_OK(Env::Default()->RecursivelyCreateDir(
+      io::JoinPath(export_dir, kSavedModelAssetsExtraDirectory)));
+  std::vector<string> warmup_records;
+  AddMixedWarmupData(&warmup_records);
+  TF_ASSERT_OK(WriteWarmupData(
+      io::JoinPath(export_dir, kSavedModelAssetsExtraDirectory,
+                   internal::WarmupConsts::kRequestsFileName),
+      warmup_records, 1));
+
+  ModelWarmupOptions model_warmup_options;
+  model_warmup_options.set_request_log_file_pattern("request_logs/*");
+  TF_EXPECT_OK(RunSavedModelWarmup(model_warmup_options, export_dir,
+                                   [this](PredictionLog prediction_log) {
+                                     this->FakeRunWarmupRequest();
+                                     return Status::OK();
+                                   }));
+  EXPECT_EQ(warmup_request_counter_, warmup_records.size());
+}
+
 }  // namespace
 }  // namespace internal
 }  // namespace serving
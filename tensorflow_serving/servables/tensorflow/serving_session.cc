@@ -15,13 +15,24 @@ limitations under the License.
 
 #include "tensorflow_serving/servables/tensorflow/serving_session.h"
 
+#include <algorithm>
+#include <numeric>
+
 #include "tensorflow/core/framework/graph.pb.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/protobuf/config.pb.h"
 
 namespace tensorflow {
 namespace serving {
 
+namespace {
+
+// Bounds the callables of a session, as each holds on to its own executors.
+constexpr int kMaxCachedCallables = 64;
+
+}  // namespace
+
 Status ServingSession::Create(const GraphDef& graph) {
   return errors::PermissionDenied("State changes denied via ServingSession");
 }
@@ -34,5 +45,110 @@ Status ServingSession::Close() {
   return errors::PermissionDenied("State changes denied via ServingSession");
 }
 
+ServingSessionWrapper::~ServingSessionWrapper() {
+  mutex_lock l(mu_);
+  for (const auto& callable : callables_) {
+    wrapped_->ReleaseCallable(callable.second).IgnoreError();
+  }
+}
+
+Status ServingSessionWrapper::Run(
+    const RunOptions& run_options,
+    const std::vector<std::pair<string, Tensor>>& inputs,
+    const std::vector<string>& output_tensor_names,
+    const std::vector<string>& target_node_names,
+    std::vector<Tensor>* outputs, RunMetadata* run_metadata,
+    const thread::ThreadPoolOptions& thread_pool_options) {
+  if (!cache_callables_) {
+    return wrapped_->Run(run_options, inputs, output_tensor_names,
+                         target_node_names, outputs, run_metadata,
+                         thread_pool_options);
+  }
+
+  // Feeds are sorted by name, so that callers listing the same inputs in
+  // another order, e.g. from a proto map, share the callable.
+  std::vector<int> feed_order(inputs.size());
+  std::iota(feed_order.begin(), feed_order.end(), 0);
+  std::sort(feed_order.begin(), feed_order.end(), [&inputs](int a, int b) {
+    return inputs[a].first < inputs[b].first;
+  });
+  CallableOptions callable_options;
+  for (const int index : feed_order) {
+    callable_options.add_feed(inputs[index].first);
+  }
+  for (const string& output_tensor_name : output_tensor_names) {
+    callable_options.add_fetch(output_tensor_name);
+  }
+  for (const string& target_node_name : target_node_names) {
+    callable_options.add_target(target_node_name);
+  }
+  *callable_options.mutable_run_options() = run_options;
+  // The timeouts follow the deadlines of the requests, and would make a
+  // callable for almost every call.
+  callable_options.mutable_run_options()->clear_timeout_in_ms();
+
+  CallableHandle handle;
+  if (!GetCallable(callable_options, &handle)) {
+    return wrapped_->Run(run_options, inputs, output_tensor_names,
+                         target_node_names, outputs, run_metadata,
+                         thread_pool_options);
+  }
+  std::vector<Tensor> feed_tensors;
+  feed_tensors.reserve(inputs.size());
+  for (const int index : feed_order) {
+    feed_tensors.push_back(inputs[index].second);
+  }
+  return wrapped_->RunCallable(handle, feed_tensors, outputs, run_metadata,
+                               thread_pool_options);
+}
+
+bool ServingSessionWrapper::GetCallable(
+    const CallableOptions& callable_options, CallableHandle* handle) {
+  const string key = callable_options.SerializeAsString();
+  {
+    mutex_lock l(mu_);
+    if (callables_unsupported_) {
+      return false;
+    }
+    auto it = callables_.find(key);
+    if (it != callables_.end()) {
+      *handle = it->second;
+      return true;
+    }
+    if (callables_.size() >= kMaxCachedCallables) {
+      return false;
+    }
+  }
+
+  // Note: The callable is made outside the lock, as it may take long (e.g.
+  // graph pruning and optimization), and would hold up the calls with cached
+  // callables.
+  CallableHandle new_handle;
+  const Status status = wrapped_->MakeCallable(callable_options, &new_handle);
+  mutex_lock l(mu_);
+  if (!status.ok()) {
+    // Other errors, e.g. unknown tensor names, are reported by Run().
+    if (errors::IsUnimplemented(status)) {
+      VLOG(1) << "Not caching callables, the session does not support them: "
+              << status;
+      callables_unsupported_ = true;
+    }
+    return false;
+  }
+  auto it = callables_.find(key);
+  if (it != callables_.end() || callables_.size() >= kMaxCachedCallables) {
+    // Another call made the same callable, or filled the cache, meanwhile.
+    wrapped_->ReleaseCallable(new_handle).IgnoreError();
+    if (it == callables_.end()) {
+      return false;
+    }
+    *handle = it->second;
+    return true;
+  }
+  callables_.emplace(key, new_handle);
+  *handle = new_handle;
+  return true;
+}
+
 }  // namespace serving
 }  // namespace tensorflow
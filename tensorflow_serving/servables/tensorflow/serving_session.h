@@ -18,10 +18,13 @@ limitations under the License.
 
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
 #include "tensorflow/core/platform/threadpool_options.h"
 #include "tensorflow/core/public/session.h"
 
@@ -46,19 +49,31 @@ class ServingSession : public Session {
 
 /// A ServingSession that wraps a given Session, and blocks all calls other than
 /// Run().
+///
+/// If 'cache_callables' is true, Run() calls go through a callable of the
+/// wrapped session, made on the first call with the same feeds, fetches,
+/// targets and RunOptions, which saves resolving those on every call. The
+/// RunOptions timeout is ignored, so that calls with different deadlines share
+/// the callables, which run under the timeout of the session config. Sessions
+/// that do not support callables, e.g. batching sessions, are run as usual.
 class ServingSessionWrapper : public ServingSession {
  public:
-  explicit ServingSessionWrapper(std::unique_ptr<Session> wrapped)
-      : wrapped_(std::move(wrapped)) {
+  explicit ServingSessionWrapper(std::unique_ptr<Session> wrapped,
+                                 bool cache_callables = false)
+      : wrapped_(std::move(wrapped)), cache_callables_(cache_callables) {
     VLOG(2) << "Created the ServingSessionWrapper around the Session.";
   }
 
-  ~ServingSessionWrapper() override = default;
+  ~ServingSessionWrapper() override;
 
   Status Run(const std::vector<std::pair<string, Tensor>>& inputs,
              const std::vector<string>& output_tensor_names,
              const std::vector<string>& target_node_names,
              std::vector<Tensor>* outputs) override {
+    if (cache_callables_) {
+      return Run(RunOptions(), inputs, output_tensor_names, target_node_names,
+                 outputs, nullptr, thread::ThreadPoolOptions());
+    }
     return wrapped_->Run(inputs, output_tensor_names, target_node_names,
                          outputs);
   }
@@ -68,6 +83,10 @@ class ServingSessionWrapper : public ServingSession {
              const std::vector<string>& output_tensor_names,
              const std::vector<string>& target_node_names,
              std::vector<Tensor>* outputs, RunMetadata* run_metadata) override {
+    if (cache_callables_) {
+      return Run(run_options, inputs, output_tensor_names, target_node_names,
+                 outputs, run_metadata, thread::ThreadPoolOptions());
+    }
     return wrapped_->Run(run_options, inputs, output_tensor_names,
                          target_node_names, outputs, run_metadata);
   }
@@ -77,18 +96,26 @@ class ServingSessionWrapper : public ServingSession {
              const std::vector<string>& output_tensor_names,
              const std::vector<string>& target_node_names,
              std::vector<Tensor>* outputs, RunMetadata* run_metadata,
-             const thread::ThreadPoolOptions& thread_pool_options) override {
-    return wrapped_->Run(run_options, inputs, output_tensor_names,
-                         target_node_names, outputs, run_metadata,
-                         thread_pool_options);
-  }
+             const thread::ThreadPoolOptions& thread_pool_options) override;
 
   Status ListDevices(std::vector<DeviceAttributes>* response) override {
     return wrapped_->ListDevices(response);
   }
 
  private:
+  // Sets 'handle' to the callable made for 'callable_options', making it if
+  // needed. Returns false if no callable can be used.
+  bool GetCallable(const CallableOptions& callable_options,
+                   CallableHandle* handle) TF_LOCKS_EXCLUDED(mu_);
+
   std::unique_ptr<Session> wrapped_;
+  const bool cache_callables_;
+
+  mutex mu_;
+  // Set once the wrapped session turns out not to support callables.
+  bool callables_unsupported_ TF_GUARDED_BY(mu_) = false;
+  // Callables made so far, keyed by their serialized CallableOptions.
+  std::unordered_map<string, CallableHandle> callables_ TF_GUARDED_BY(mu_);
 
   TF_DISALLOW_COPY_AND_ASSIGN(ServingSessionWrapper);
 };
@@ -15,12 +15,15 @@ limitations under the License.
 
 #include "tensorflow_serving/servables/tensorflow/tflite_interpreter_pool.h"
 
+#include <algorithm>
 #include <limits>
 #include <memory>
+#include <utility>
 #include <vector>
 
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/platform/errors.h"
+#include "tensorflow/lite/delegates/xnnpack/xnnpack_delegate.h"
 #include "tensorflow/lite/external_cpu_backend_context.h"
 #include "tensorflow/lite/kernels/cpu_backend_context.h"
 #include "tensorflow/lite/kernels/parse_example/parse_example.h"
@@ -65,57 +68,87 @@ tensorflow::Status TfLiteInterpreterWrapper::SetStringData(
   //   [4] offset of each string (int32_t)
   //   [sizeof(int32_t) * (num_strings + 1)]] total size of strings
   //   [sizeof(int32_t) * (num_strings + 2)] batch.data()
-  int32_t num_strings = batch_size;
-  offset_.clear();
+  // The strings are sized first, then their offsets and contents are written
+  // directly in the buffer, which is reused while it is large enough.
+  size_t num_strings = 0;
   size_t total_size = 0;
-  offset_.push_back(static_cast<int32_t>(total_size));
   for (const auto& tensor : tensors) {
     const auto& flat = tensor->flat<tstring>();
     for (int i = 0; i < flat.size(); ++i) {
       total_size += flat(i).size();
-      offset_.push_back(static_cast<int32_t>(total_size));
     }
+    num_strings += flat.size();
   }
-  size_t required_bytes = total_size + sizeof(int32_t) * (num_strings + 2);
-  if (tensor_buffer_.find(tensor_index) == tensor_buffer_.end()) {
+  if (num_strings != static_cast<size_t>(batch_size)) {
+    return errors::Internal("Expected ", batch_size, " strings, got ",
+                            num_strings);
+  }
+  const size_t start = sizeof(int32_t) * (num_strings + 2);
+  const size_t required_bytes = start + total_size;
+  if (required_bytes > std::numeric_limits<int32_t>::max()) {
+    return errors::Internal("Invalid size, string input too large:",
+                            required_bytes);
+  }
+  const auto buffer_it = tensor_buffer_.find(tensor_index);
+  if (buffer_it == tensor_buffer_.end()) {
     return errors::Internal("Tensor input for index not found: ", tensor_index);
   }
-  if (required_bytes > tensor_buffer_max_bytes_[tensor_index]) {
+  // tflite_tensor owns the buffer.
+  buffer_it->second.release();
+  const auto max_bytes = tensor_buffer_max_bytes_.find(tensor_index);
+  if (required_bytes > max_bytes->second) {
     if (tflite_tensor->data.raw) {
       free(tflite_tensor->data.raw);
     }
     tflite_tensor->data.raw = reinterpret_cast<char*>(malloc(required_bytes));
-    tensor_buffer_max_bytes_[tensor_index] = required_bytes;
-  }
-  tensor_buffer_[tensor_index].reset(tflite_tensor->data.raw);
-  memcpy(tensor_buffer_[tensor_index].get(), &num_strings, sizeof(int32_t));
-  int32_t start = sizeof(int32_t) * (num_strings + 2);
-  for (size_t i = 0; i < offset_.size(); i++) {
-    size_t size_offset_i = start + offset_[i];
-    if (size_offset_i > std::numeric_limits<int32_t>::max()) {
-      return errors::Internal("Invalid size, string input too large:",
-                              size_offset_i);
-    }
-    int32_t offset_i = static_cast<int32_t>(size_offset_i);
-    memcpy(tensor_buffer_[tensor_index].get() + sizeof(int32_t) * (i + 1),
-           &offset_i, sizeof(int32_t));
+    max_bytes->second = required_bytes;
   }
+  char* const buffer = tflite_tensor->data.raw;
+  const int32_t num_strings_i = static_cast<int32_t>(num_strings);
+  memcpy(buffer, &num_strings_i, sizeof(int32_t));
+  char* offset = buffer + sizeof(int32_t);
+  int32_t data_offset = static_cast<int32_t>(start);
   for (const auto& tensor : tensors) {
     const auto& flat = tensor->flat<tstring>();
     for (int i = 0; i < flat.size(); ++i) {
-      memcpy(tensor_buffer_[tensor_index].get() + start, flat(i).data(),
-             flat(i).size());
-      start += flat(i).size();
+      memcpy(offset, &data_offset, sizeof(int32_t));
+      offset += sizeof(int32_t);
+      memcpy(buffer + data_offset, flat(i).data(), flat(i).size());
+      data_offset += flat(i).size();
     }
   }
+  memcpy(offset, &data_offset, sizeof(int32_t));
 
-  // tflite_tensor will take ownership of the pointer.
-  tflite_tensor->data.raw = tensor_buffer_[tensor_index].release();
   tflite_tensor->bytes = required_bytes;
   tflite_tensor->allocation_type = kTfLiteDynamic;
   return Status::OK();
 }
 
+tensorflow::Status TfLiteInterpreterWrapper::ResizeInputs(int batch_size) {
+  for (const int idx : interpreter_->inputs()) {
+    const auto* tflite_tensor = interpreter_->tensor(idx);
+    const TfLiteIntArray* tflite_dims = tflite_tensor->dims;
+    std::vector<int> dims(tflite_dims->data,
+                          tflite_dims->data + tflite_dims->size);
+    if (tflite_tensor->type == kTfLiteString) {
+      dims = {batch_size};
+    } else if (dims.empty()) {
+      continue;
+    } else {
+      dims[0] = batch_size;
+    }
+    if (interpreter_->ResizeInputTensor(idx, dims) != kTfLiteOk) {
+      return errors::Internal("Failed to resize input ", tflite_tensor->name,
+                              " to batch size ", batch_size);
+    }
+  }
+  if (interpreter_->AllocateTensors() != kTfLiteOk) {
+    return errors::Internal("Failed to allocate tensors");
+  }
+  batch_size_ = batch_size;
+  return Status::OK();
+}
+
 TfLiteStatus TfLiteInterpreterWrapper::Invoke() {
 #ifdef TFLITE_PROFILE
   if (invocation_count_ > 0) {
@@ -142,15 +175,16 @@ TfLiteStatus TfLiteInterpreterWrapper::Invoke() {
 tensorflow::Status TfLiteInterpreterWrapper::CreateTfLiteInterpreterWrapper(
     const tflite::FlatBufferModel& model,
     const tensorflow::SessionOptions& options,
-    std::unique_ptr<TfLiteInterpreterWrapper>& wrapper) {
+    std::unique_ptr<TfLiteInterpreterWrapper>& wrapper,
+    const TfLiteInterpreterOptions& interpreter_options) {
   tflite::ops::builtin::BuiltinOpResolver resolver;
   tflite::ops::custom::AddParseExampleOp(&resolver);
   std::unique_ptr<tflite::Interpreter> interpreter;
 
   // Use an initial batch_size of 1, will be resized later.
   const int batch_size = 1;
-  // Use a single thread to reduce contention across sessions.
-  const int num_threads = 1;
+  // By default, use a single thread to reduce contention across sessions.
+  const int num_threads = std::max(1, interpreter_options.num_threads());
 
   if (tflite::InterpreterBuilder(model, resolver)(&interpreter, num_threads) !=
       kTfLiteOk) {
@@ -167,6 +201,19 @@ tensorflow::Status TfLiteInterpreterWrapper::CreateTfLiteInterpreterWrapper(
       std::move(cpu_backend_context));
   interpreter->SetExternalContext(kTfLiteCpuBackendContext,
                                   external_context.get());
+  if (interpreter_options.use_xnnpack()) {
+    TfLiteXNNPackDelegateOptions xnnpack_options =
+        TfLiteXNNPackDelegateOptionsDefault();
+    xnnpack_options.num_threads = num_threads;
+    // The interpreter owns the delegate, and deletes it before itself.
+    tflite::Interpreter::TfLiteDelegatePtr delegate(
+        TfLiteXNNPackDelegateCreate(&xnnpack_options),
+        &TfLiteXNNPackDelegateDelete);
+    if (interpreter->ModifyGraphWithDelegate(std::move(delegate)) !=
+        kTfLiteOk) {
+      return errors::Internal("Failed to apply the XNNPACK delegate");
+    }
+  }
   const int idx = interpreter->inputs()[0];
   const auto* tensor = interpreter->tensor(idx);
   if (tensor->type == kTfLiteString) {
@@ -185,13 +232,19 @@ tensorflow::Status TfLiteInterpreterWrapper::CreateTfLiteInterpreterWrapper(
 tensorflow::Status TfLiteInterpreterPool::CreateTfLiteInterpreterPool(
     const tflite::FlatBufferModel* model,
     const tensorflow::SessionOptions& options, int pool_size,
-    std::unique_ptr<TfLiteInterpreterPool>& interpreter_pool) {
+    std::unique_ptr<TfLiteInterpreterPool>& interpreter_pool,
+    const std::vector<int>& batch_sizes,
+    const TfLiteInterpreterOptions& interpreter_options) {
   std::vector<std::unique_ptr<TfLiteInterpreterWrapper>> interpreters(
       pool_size);
   for (int i = 0; i < pool_size; i++) {
     auto& wrapper = interpreters[i];
     TF_RETURN_IF_ERROR(TfLiteInterpreterWrapper::CreateTfLiteInterpreterWrapper(
-        *model, options, wrapper));
+        *model, options, wrapper, interpreter_options));
+    if (!batch_sizes.empty()) {
+      TF_RETURN_IF_ERROR(
+          wrapper->ResizeInputs(batch_sizes[i % batch_sizes.size()]));
+    }
   }
   interpreter_pool.reset(new TfLiteInterpreterPool(std::move(interpreters)));
   return tensorflow::Status::OK();
@@ -38,6 +38,7 @@ limitations under the License.
 #include "tensorflow/lite/profiling/profile_summary_formatter.h"
 #endif
 #include "tensorflow/lite/string_util.h"
+#include "tensorflow_serving/servables/tensorflow/session_bundle_config.pb.h"
 
 namespace tensorflow {
 namespace serving {
@@ -54,7 +55,9 @@ class TfLiteInterpreterWrapper {
   static Status CreateTfLiteInterpreterWrapper(
       const tflite::FlatBufferModel& model,
       const tensorflow::SessionOptions& options,
-      std::unique_ptr<TfLiteInterpreterWrapper>& wrapper);
+      std::unique_ptr<TfLiteInterpreterWrapper>& wrapper,
+      const TfLiteInterpreterOptions& interpreter_options =
+          TfLiteInterpreterOptions());
 
   // Constructor for wrapper takes only an initialized interpreter.
   TfLiteInterpreterWrapper(
@@ -73,6 +76,11 @@ class TfLiteInterpreterWrapper {
   // Set the batch size.
   void SetBatchSize(int batch_size) { batch_size_ = batch_size; }
 
+  // Resizes the first dimension of all the inputs to `batch_size`, and
+  // reallocates the tensors, so that requests of that batch size are run
+  // without resizing.
+  tensorflow::Status ResizeInputs(int batch_size);
+
   // Invokes the interpreter.
   TfLiteStatus Invoke();
 #ifdef TFLITE_PROFILE
@@ -90,11 +98,10 @@ class TfLiteInterpreterWrapper {
   }
 #endif
 
-  // Sets the contents of the internal buffer _tensor_buffer_ to the tflite
-  // formatted string buffer equivalent stored in `batch` and sets
-  // raw pointer of `tflite_tensor` to the internal buffer. If the required
-  // size is larger than the current size, will allocate new memory and
-  // free the existing buffer.
+  // Writes the `batch_size` strings of `tensors` to the buffer of
+  // `tflite_tensor` in the tflite string format, in a single pass over the
+  // strings. The buffer is reused across calls, and only reallocated when the
+  // required size is larger than its current size.
   tensorflow::Status SetStringData(const std::vector<const Tensor*>& tensors,
                                    TfLiteTensor* tflite_tensor,
                                    int tensor_index, int batch_size);
@@ -106,7 +113,6 @@ class TfLiteInterpreterWrapper {
   int batch_size_ = 1;
   std::map<int, std::unique_ptr<char>> tensor_buffer_;
   std::map<int, size_t> tensor_buffer_max_bytes_;
-  std::vector<int32_t> offset_;
 #ifdef TFLITE_PROFILE
   int max_num_entries_;
   tflite::profiling::ProfileSummarizer run_summarizer_;
@@ -118,24 +124,44 @@ class TfLiteInterpreterWrapper {
 // Contains a vector of TfLiteInterpreterWrapper, which are protected by mutex.
 // When GetInterpreter is called, will either release a unique ptr to the
 // caller or block if the vector is empty.
+//
+// The mutex is only held to move an interpreter in or out of the vector, which
+// is short compared to an invocation, so callers do not contend on it.
 class TfLiteInterpreterPool {
  public:
   // Creates a TfLiteSessionPool with model, session options,
-  // pool_size number of interpreters.
+  // pool_size number of interpreters. If `batch_sizes` is not empty, the
+  // interpreters are spread over these batch sizes, and resized for them
+  // ahead of time. The interpreters are configured by `interpreter_options`.
   static tensorflow::Status CreateTfLiteInterpreterPool(
       const tflite::FlatBufferModel* model,
       const tensorflow::SessionOptions& options, int pool_size,
-      std::unique_ptr<TfLiteInterpreterPool>& interpreter_pool);
+      std::unique_ptr<TfLiteInterpreterPool>& interpreter_pool,
+      const std::vector<int>& batch_sizes = {},
+      const TfLiteInterpreterOptions& interpreter_options =
+          TfLiteInterpreterOptions());
 
   // Returns a TFLite interpreter wrapper object. Caller may *block* waiting for
-  // a free interpreter pool to be available.
-  std::unique_ptr<TfLiteInterpreterWrapper> GetInterpreter() {
+  // a free interpreter pool to be available. If `batch_size` is set, prefers
+  // an interpreter already sized for it, so that it need not be resized.
+  std::unique_ptr<TfLiteInterpreterWrapper> GetInterpreter(
+      int batch_size = -1) {
     auto interpreter_available = [this]() ABSL_SHARED_LOCKS_REQUIRED(mutex_) {
       return !this->available_.empty();
     };
     mutex_.LockWhen(absl::Condition(&interpreter_available));
-    auto pool = std::move(available_.back());
-    available_.pop_back();
+    auto it = available_.end() - 1;
+    if (batch_size != -1) {
+      for (auto candidate = available_.rbegin(); candidate != available_.rend();
+           ++candidate) {
+        if ((*candidate)->GetBatchSize() == batch_size) {
+          it = candidate.base() - 1;
+          break;
+        }
+      }
+    }
+    auto pool = std::move(*it);
+    available_.erase(it);
     mutex_.Unlock();
     return pool;
   }
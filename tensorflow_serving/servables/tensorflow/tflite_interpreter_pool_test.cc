@@ -70,6 +70,59 @@ TEST(TfLiteInterpreterPool, CreateTfLiteInterpreterPoolTest) {
   interpreter_pool.reset();
 }
 
+TEST(TfLiteInterpreterPool, PreallocatedBatchSizes) {
+  string model_bytes;
+  TF_ASSERT_OK(ReadFileToString(Env::Default(),
+                                test_util::TestSrcDirPath(kParseExampleModel),
+                                &model_bytes));
+  auto model = tflite::FlatBufferModel::BuildFromModel(
+      flatbuffers::GetRoot<tflite::Model>(model_bytes.data()));
+  const tensorflow::SessionOptions options;
+  std::unique_ptr<TfLiteInterpreterPool> interpreter_pool;
+  TF_ASSERT_OK(TfLiteInterpreterPool::CreateTfLiteInterpreterPool(
+      model.get(), options, /*pool_size=*/4, interpreter_pool, {2, 8}));
+
+  // Two interpreters are sized for each batch size.
+  std::vector<std::unique_ptr<TfLiteInterpreterWrapper>> interpreters;
+  for (const int batch_size : {8, 2, 8, 2}) {
+    interpreters.push_back(interpreter_pool->GetInterpreter(batch_size));
+    EXPECT_EQ(batch_size, interpreters.back()->GetBatchSize());
+    tflite::Interpreter* tflite_interpreter = interpreters.back()->Get();
+    const auto* input =
+        tflite_interpreter->tensor(tflite_interpreter->inputs()[0]);
+    EXPECT_EQ(batch_size, input->dims->data[0]);
+  }
+  for (auto& interpreter : interpreters) {
+    interpreter_pool->ReturnInterpreter(std::move(interpreter));
+  }
+
+  // Without an interpreter of the requested size, any is returned.
+  auto interpreter = interpreter_pool->GetInterpreter(4);
+  ASSERT_NE(nullptr, interpreter);
+  interpreter_pool->ReturnInterpreter(std::move(interpreter));
+}
+
+TEST(TfLiteInterpreterPool, InterpreterOptions) {
+  string model_bytes;
+  TF_ASSERT_OK(ReadFileToString(Env::Default(),
+                                test_util::TestSrcDirPath(kMobileNetModel),
+                                &model_bytes));
+  auto model = tflite::FlatBufferModel::BuildFromModel(
+      flatbuffers::GetRoot<tflite::Model>(model_bytes.data()));
+  const tensorflow::SessionOptions options;
+  TfLiteInterpreterOptions interpreter_options;
+  interpreter_options.set_num_threads(2);
+  interpreter_options.set_use_xnnpack(true);
+  std::unique_ptr<TfLiteInterpreterPool> interpreter_pool;
+  TF_ASSERT_OK(TfLiteInterpreterPool::CreateTfLiteInterpreterPool(
+      model.get(), options, /*pool_size=*/2, interpreter_pool,
+      /*batch_sizes=*/{}, interpreter_options));
+  auto interpreter = interpreter_pool->GetInterpreter();
+  ASSERT_NE(nullptr, interpreter);
+  EXPECT_EQ(kTfLiteOk, interpreter->Get()->AllocateTensors());
+  interpreter_pool->ReturnInterpreter(std::move(interpreter));
+}
+
 int GetTensorSize(const TfLiteTensor* tflite_tensor) {
   int size = 1;
   for (int i = 0; i < tflite_tensor->dims->size; ++i) {
@@ -146,6 +199,8 @@ TEST(TfLiteInterpreterWrapper, TfLiteInterpreterWrapperTest) {
   data.push_back(&t);
   ASSERT_FALSE(interpreter_wrapper->SetStringData(
                    data, tensor, -1, actual_batch_size) == Status::OK());
+  ASSERT_FALSE(interpreter_wrapper->SetStringData(
+                   data, tensor, idx, actual_batch_size + 1) == Status::OK());
   TF_ASSERT_OK(
       interpreter_wrapper->SetStringData(data, tensor, idx, actual_batch_size));
   auto wrapped = interpreter_wrapper->Get();
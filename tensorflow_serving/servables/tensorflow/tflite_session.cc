@@ -397,10 +397,13 @@ Status TfLiteSession::SetScheduler(
       &scheduler_);
 }
 
-Status TfLiteSession::Create(string&& buffer, const SessionOptions& options,
-                             int num_pools, int num_interpreters_per_pool,
-                             std::unique_ptr<TfLiteSession>* tflite_session,
-                             ::google::protobuf::Map<string, SignatureDef>* signatures) {
+Status TfLiteSession::Create(
+    string&& buffer, const SessionOptions& options, int num_pools,
+    int num_interpreters_per_pool,
+    std::unique_ptr<TfLiteSession>* tflite_session,
+    ::google::protobuf::Map<string, SignatureDef>* signatures,
+    const std::vector<int>& batch_sizes,
+    const TfLiteInterpreterOptions& interpreter_options) {
   auto model = tflite::FlatBufferModel::BuildFromModel(
       flatbuffers::GetRoot<tflite::Model>(buffer.data()));
   if (model == nullptr) {
@@ -486,7 +489,8 @@ Status TfLiteSession::Create(string&& buffer, const SessionOptions& options,
   std::unique_ptr<internal::TfLiteInterpreterPool> interpreter_pool;
   TF_RETURN_IF_ERROR(
       internal::TfLiteInterpreterPool::CreateTfLiteInterpreterPool(
-          model.get(), options, num_interpreters, interpreter_pool));
+          model.get(), options, num_interpreters, interpreter_pool,
+          batch_sizes, interpreter_options));
 
   tflite_session->reset(new TfLiteSession(
       std::move(input_tensor_to_index), std::move(output_tensor_to_index),
@@ -558,7 +562,7 @@ Status TfLiteSession::RunInternal(
       return _status;                                               \
     }                                                               \
   } while (0);
-  auto interpreter = interpreter_pool_->GetInterpreter();
+  auto interpreter = interpreter_pool_->GetInterpreter(batch_size);
   RETURN_POOL_IF_ERROR(
       SetInputAndInvokeMiniBatch(interpreter, tflite_input_indices,
                                  merged_inputs, batch_size, fixed_batch_size));
@@ -135,10 +135,24 @@ class TfLiteSession : public ServingSession {
   // run in caller thread allows a worker to run on the parent thread,
   // which may be desired to increase concurrency at the cost of additional
   // thread context overhead. Defaults to false.
+  //
+  // `num_pools` interpreters are created, in a single pool shared by all the
+  // callers: a caller only waits for an interpreter when all of them are busy,
+  // never while another one is idle. If `num_interpreters_per_pool` is greater
+  // than 1, large batches are also split over several interpreters by a batch
+  // scheduler with one thread per interpreter.
+  //
+  // If `batch_sizes` is not empty, e.g. the allowed batch sizes of a batching
+  // session wrapping this one, the interpreters are sized for them ahead of
+  // time, and each batch is run on an interpreter of its size when possible.
+  // The interpreters are configured by `interpreter_options`.
   static Status Create(string&& buffer, const SessionOptions& options,
                        int num_pools, int num_interpreters_per_pool,
                        std::unique_ptr<TfLiteSession>* tflite_session,
-                       ::google::protobuf::Map<string, SignatureDef>* signatures);
+                       ::google::protobuf::Map<string, SignatureDef>* signatures,
+                       const std::vector<int>& batch_sizes = {},
+                       const TfLiteInterpreterOptions& interpreter_options =
+                           TfLiteInterpreterOptions());
 
   static Status CreateDefaultBasicBatchScheduler(
       const BasicBatchScheduler<TfLiteBatchTask>::Options& options,
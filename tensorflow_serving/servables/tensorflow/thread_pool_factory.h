@@ -17,6 +17,7 @@ limitations under the License.
 #define TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_THREAD_POOL_FACTORY_H_
 
 #include "tensorflow/core/platform/threadpool.h"
+#include "tensorflow/core/platform/types.h"
 #include "tensorflow_serving/util/class_registration.h"
 
 namespace tensorflow {
@@ -29,6 +30,17 @@ class ThreadPoolFactory {
   virtual ~ThreadPoolFactory() = default;
   virtual thread::ThreadPoolInterface* GetInterOpThreadPool() = 0;
   virtual thread::ThreadPoolInterface* GetIntraOpThreadPool() = 0;
+
+  // Returns the thread pools for the requests to the model 'model_name'. By
+  // default, all models share the thread pools above.
+  virtual thread::ThreadPoolInterface* GetInterOpThreadPoolForModel(
+      const string& model_name) {
+    return GetInterOpThreadPool();
+  }
+  virtual thread::ThreadPoolInterface* GetIntraOpThreadPoolForModel(
+      const string& model_name) {
+    return GetIntraOpThreadPool();
+  }
 };
 
 DEFINE_CLASS_REGISTRY(ThreadPoolFactoryRegistry, ThreadPoolFactory);
@@ -15,25 +15,36 @@ limitations under the License.
 
 #include "tensorflow_serving/servables/tensorflow/util.h"
 
+#include <algorithm>
 #include <atomic>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <vector>
 
 #include "google/protobuf/wrappers.pb.h"
 #include "tensorflow/cc/saved_model/signature_constants.h"
 #include "tensorflow/core/example/example.pb.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/threadpool.h"
 #include "tensorflow/core/lib/monitoring/counter.h"
 #include "tensorflow/core/lib/monitoring/sampler.h"
+#include "tensorflow/core/lib/strings/numbers.h"
 #include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/blocking_counter.h"
 #include "tensorflow/core/platform/cord.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/errors.h"
 #include "tensorflow/core/platform/path.h"
 #include "tensorflow/core/platform/threadpool_options.h"
 #include "tensorflow/core/platform/types.h"
+#include "tensorflow_serving/apis/classification.pb.h"
 #include "tensorflow_serving/apis/input.pb.h"
 #include "tensorflow_serving/apis/internal/serialized_input.pb.h"
 #include "tensorflow_serving/apis/model.pb.h"
 #include "tensorflow_serving/resources/resource_values.h"
+#include "tensorflow_serving/util/flight_recorder.h"
 
 namespace tensorflow {
 namespace serving {
@@ -43,6 +54,17 @@ namespace {
 static constexpr double kResourceEstimateRAMMultiplier = 1.2;
 static constexpr int kResourceEstimateRAMPadBytes = 0;
 
+// Maximum number of concurrent calls to the FileProbingEnv when walking the
+// model directories, all of them together. On cloud file systems, each call
+// is a round trip.
+static constexpr int kNumFileProbingThreads = 16;
+
+// Whether 'resource' is the main memory, bound to an instance or not.
+bool IsRamResource(const Resource& resource) {
+  return resource.device() == device_types::kMain &&
+         resource.kind() == resource_kinds::kRamBytes;
+}
+
 auto* example_counts = monitoring::Sampler<1>::New(
     {"/tensorflow/serving/request_example_counts",
      "The number of tensorflow.Examples per request.", "model"},
@@ -80,6 +102,17 @@ auto* request_latency = monitoring::Sampler<3>::New(
     },  // Scale of 10, power of 1.8 with bucket count 33 (~20 minutes).
     monitoring::Buckets::Exponential(10, 1.8, 33));
 
+auto* request_stage_latency = monitoring::Sampler<3>::New(
+    {
+        "/tensorflow/serving/request_stage_latency",
+        "Distribution of wall time (in microseconds) for a stage of Tensorflow"
+        " Serving requests.",
+        "model_name",
+        "API",
+        "stage",
+    },  // Scale of 10, power of 1.8 with bucket count 33 (~20 minutes).
+    monitoring::Buckets::Exponential(10, 1.8, 33));
+
 // Returns the number of examples in the Input.
 int NumInputExamples(const internal::SerializedInput& input) {
   switch (input.kind_case()) {
@@ -93,31 +126,90 @@ int NumInputExamples(const internal::SerializedInput& input) {
   return 0;
 }
 
+#if !defined(PLATFORM_GOOGLE)
+// Serializes 'example' into 'output', after the first 'offset' bytes, which
+// are left for the caller to fill.
+void SerializeExampleInto(const Example& example, const size_t offset,
+                          tstring* output) {
+  const size_t size = example.ByteSizeLong();
+  output->resize_uninitialized(offset + size);
+  example.SerializeWithCachedSizesToArray(
+      reinterpret_cast<uint8*>(&(*output)[0]) + offset);
+}
+#endif
+
 std::atomic<bool> signature_method_check{true};
 
+std::atomic<bool> multi_inference_shared_example_parsing{false};
+
+// Calls 'fn(i)' for each i in [0, n), in parallel on 'threads', and returns
+// the first error, if any.
+Status RunInParallel(thread::ThreadPool* threads, const int n,
+                     const std::function<Status(int)>& fn) {
+  std::vector<Status> statuses(n);
+  BlockingCounter pending(n);
+  for (int i = 0; i < n; ++i) {
+    threads->Schedule([&, i]() {
+      statuses[i] = fn(i);
+      pending.DecrementCount();
+    });
+  }
+  pending.Wait();
+  for (const Status& status : statuses) {
+    TF_RETURN_IF_ERROR(status);
+  }
+  return Status::OK();
+}
+
+// The threads probing the files of the model directories, shared by all the
+// calls of GetModelDiskSize(). The tasks they run never wait for each other.
+thread::ThreadPool* GetFileProbingThreads() {
+  static thread::ThreadPool* const threads = new thread::ThreadPool(
+      Env::Default(), "model_disk_size", kNumFileProbingThreads);
+  return threads;
+}
+
+// A file or directory under a model directory.
+struct Descendant {
+  string path;
+  bool is_directory;
+};
+
 // Returns all the descendants, both directories and files, recursively under
-// 'dirname'. The paths returned are all prefixed with 'dirname'.
+// 'dirname'. The paths returned are all prefixed with 'dirname'. The
+// directories are walked breadth first, one level at a time: the directories
+// of a level are listed, and their children probed, in parallel on 'threads'.
 Status GetAllDescendants(const string& dirname, FileProbingEnv* env,
-                         std::vector<string>* const descendants) {
+                         thread::ThreadPool* threads,
+                         std::vector<Descendant>* const descendants) {
   descendants->clear();
   // Make sure that dirname exists;
   TF_RETURN_IF_ERROR(env->FileExists(dirname));
-  std::deque<string> dir_q;      // Queue for the BFS
-  std::vector<string> dir_list;  // List of all dirs discovered
-  dir_q.push_back(dirname);
-  // Do a BFS on the directory to discover all immediate children.
-  while (!dir_q.empty()) {
-    const string dir = dir_q.front();
-    dir_q.pop_front();
-    std::vector<string> children;
+  std::vector<string> dirs = {dirname};
+  while (!dirs.empty()) {
+    std::vector<std::vector<string>> children(dirs.size());
     // GetChildren might fail if we don't have appropriate permissions.
-    TF_RETURN_IF_ERROR(env->GetChildren(dir, &children));
-    for (const string& child : children) {
-      const string child_path = io::JoinPath(dir, child);
-      descendants->push_back(child_path);
-      // If the child is a directory add it to the queue.
-      if (env->IsDirectory(child_path).ok()) {
-        dir_q.push_back(child_path);
+    TF_RETURN_IF_ERROR(RunInParallel(threads, dirs.size(), [&](const int i) {
+      return env->GetChildren(dirs[i], &children[i]);
+    }));
+
+    const size_t level_begin = descendants->size();
+    for (size_t i = 0; i < dirs.size(); ++i) {
+      for (const string& child : children[i]) {
+        descendants->push_back({io::JoinPath(dirs[i], child), false});
+      }
+    }
+    TF_RETURN_IF_ERROR(RunInParallel(
+        threads, descendants->size() - level_begin, [&](const int i) {
+          Descendant& descendant = (*descendants)[level_begin + i];
+          descendant.is_directory = env->IsDirectory(descendant.path).ok();
+          return Status::OK();
+        }));
+
+    dirs.clear();
+    for (size_t i = level_begin; i < descendants->size(); ++i) {
+      if ((*descendants)[i].is_directory) {
+        dirs.push_back((*descendants)[i].path);
       }
     }
   }
@@ -132,6 +224,10 @@ monitoring::Sampler<1>* GetExampleCounts() { return example_counts; }
 
 monitoring::Counter<1>* GetExampleCountTotal() { return example_count_total; }
 
+monitoring::Sampler<3>* GetRequestStageLatency() {
+  return request_stage_latency;
+}
+
 }  // namespace internal
 
 // Metrics by model
@@ -145,35 +241,21 @@ void SetSignatureMethodNameCheckFeature(bool v) { signature_method_check = v; }
 
 bool GetSignatureMethodNameCheckFeature() { return signature_method_check; }
 
+void SetMultiInferenceSharedExampleParsingFeature(bool v) {
+  multi_inference_shared_example_parsing = v;
+}
+
+bool GetMultiInferenceSharedExampleParsingFeature() {
+  return multi_inference_shared_example_parsing;
+}
+
 void RecordRequestExampleCount(const string& model_name, size_t count) {
   example_counts->GetCell(model_name)->Add(count);
   example_count_total->GetCell(model_name)->IncrementBy(count);
 }
 
-Status InputToSerializedExampleTensor(const Input& input, Tensor* examples) {
-  internal::SerializedInput serialized_input;
-  // There's a reason we serialize and then parse 'input' in this way:
-  // 'example_list' and 'example_list_with_context' are lazily parsed
-  // fields, which means they are lazily deserialized the very first
-  // time they are accessed. So if we access them here for counting the
-  // num_examples, then we'll pay a heavy cost of deserialization.
-  //
-  // SerializedInput proto has been created to prevent this, but at the same
-  // time get the count of num_examples as well.
-  bool parse_serialized_input_ok = false;
-#if defined(PLATFORM_GOOGLE)
-  // Benchmark ('BM_InputToSerializedExample') can help measure the effect of
-  // changes in the future.
-  parse_serialized_input_ok =
-      serialized_input.ParseFromCord(input.SerializeAsCord());
-#else
-  parse_serialized_input_ok =
-      serialized_input.ParseFromString(input.SerializeAsString());
-#endif
-  if (!parse_serialized_input_ok) {
-    return errors::Internal("Error parsing serialized input.");
-  }
-
+Status SerializedInputToSerializedExampleTensor(
+    const internal::SerializedInput& serialized_input, Tensor* examples) {
   const int64 num_examples = NumInputExamples(serialized_input);
   if (num_examples == 0) {
     return errors::InvalidArgument("Input is empty.");
@@ -222,6 +304,68 @@ Status InputToSerializedExampleTensor(const Input& input, Tensor* examples) {
   return Status::OK();
 }
 
+Status InputToSerializedExampleTensor(const Input& input, Tensor* examples) {
+#if defined(PLATFORM_GOOGLE)
+  internal::SerializedInput serialized_input;
+  // There's a reason we serialize and then parse 'input' in this way:
+  // 'example_list' and 'example_list_with_context' are lazily parsed
+  // fields, which means they are lazily deserialized the very first
+  // time they are accessed. So if we access them here for counting the
+  // num_examples, then we'll pay a heavy cost of deserialization.
+  //
+  // SerializedInput proto has been created to prevent this, but at the same
+  // time get the count of num_examples as well.
+  //
+  // Benchmark ('BM_InputToSerializedExample') can help measure the effect of
+  // changes in the future.
+  if (!serialized_input.ParseFromCord(input.SerializeAsCord())) {
+    return errors::Internal("Error parsing serialized input.");
+  }
+  return SerializedInputToSerializedExampleTensor(serialized_input, examples);
+#else
+  // Open-source protobuf parses 'example_list' and 'example_list_with_context'
+  // eagerly, so there is nothing to gain from going through SerializedInput:
+  // each Example is serialized straight into its element of 'examples'
+  // instead, without serializing the whole 'input' and parsing it back.
+  switch (input.kind_case()) {
+    case Input::KindCase::kExampleList: {
+      const auto& entries = input.example_list().examples();
+      if (entries.empty()) {
+        break;
+      }
+      *examples = Tensor(DT_STRING, TensorShape({entries.size()}));
+      auto input_vec = examples->vec<tstring>();
+      for (int i = 0; i < entries.size(); ++i) {
+        SerializeExampleInto(entries.Get(i), /*offset=*/0, &input_vec(i));
+      }
+      return Status::OK();
+    }
+
+    case Input::KindCase::kExampleListWithContext: {
+      const auto& entries = input.example_list_with_context().examples();
+      if (entries.empty()) {
+        break;
+      }
+      // Like in SerializedInput, an unset context serializes to nothing.
+      const string context =
+          input.example_list_with_context().context().SerializeAsString();
+      *examples = Tensor(DT_STRING, TensorShape({entries.size()}));
+      auto input_vec = examples->vec<tstring>();
+      for (int i = 0; i < entries.size(); ++i) {
+        tstring& input_str = input_vec(i);
+        SerializeExampleInto(entries.Get(i), context.size(), &input_str);
+        memcpy(&input_str[0], context.data(), context.size());
+      }
+      return Status::OK();
+    }
+
+    default:
+      break;
+  }
+  return errors::InvalidArgument("Input is empty.");
+#endif
+}
+
 Status PerformOneShotTensorComputation(
     const RunOptions& run_options, const Input& input,
     const string& input_tensor_name,
@@ -286,21 +430,67 @@ void MakeModelSpec(const string& model_name,
   }
 }
 
+Status SelectClassificationClasses(const ClassificationRequest& request,
+                                   const float* scores, const int num_classes,
+                                   std::vector<int>* class_indices) {
+  const int top_k = request.top_k();
+  if (top_k < 0) {
+    return errors::InvalidArgument("top_k must be non-negative. Got: ", top_k);
+  }
+  const bool pruned = top_k > 0 || request.has_min_score();
+  if (pruned && scores == nullptr) {
+    return errors::InvalidArgument(
+        "top_k and min_score require the classification signature to output "
+        "scores");
+  }
+
+  class_indices->clear();
+  class_indices->reserve(num_classes);
+  for (int c = 0; c < num_classes; ++c) {
+    if (!request.has_min_score() ||
+        scores[c] >= request.min_score().value()) {
+      class_indices->push_back(c);
+    }
+  }
+  if (top_k == 0) return Status::OK();
+
+  // Orders by decreasing score, NaNs last, then by class index, so that the
+  // result does not depend on the sort.
+  auto higher_score = [scores](const int a, const int b) {
+    const bool a_is_nan = std::isnan(scores[a]);
+    const bool b_is_nan = std::isnan(scores[b]);
+    if (a_is_nan != b_is_nan) return b_is_nan;
+    if (!a_is_nan && scores[a] != scores[b]) return scores[a] > scores[b];
+    return a < b;
+  };
+  const int num_selected = std::min<int>(top_k, class_indices->size());
+  std::partial_sort(class_indices->begin(),
+                    class_indices->begin() + num_selected,
+                    class_indices->end(), higher_score);
+  class_indices->resize(num_selected);
+  return Status::OK();
+}
+
 Status GetModelDiskSize(const string& path, FileProbingEnv* env,
                         uint64* total_file_size) {
   if (env == nullptr) {
     return errors::Internal("FileProbingEnv not set");
   }
 
-  std::vector<string> descendants;
-  TF_RETURN_IF_ERROR(GetAllDescendants(path, env, &descendants));
+  thread::ThreadPool* const threads = GetFileProbingThreads();
+  std::vector<Descendant> descendants;
+  TF_RETURN_IF_ERROR(GetAllDescendants(path, env, threads, &descendants));
+  std::vector<uint64> file_sizes(descendants.size(), 0);
+  TF_RETURN_IF_ERROR(
+      RunInParallel(threads, descendants.size(), [&](const int i) {
+        if (descendants[i].is_directory) {
+          return Status::OK();
+        }
+        return env->GetFileSize(descendants[i].path, &file_sizes[i]);
+      }));
   *total_file_size = 0;
-  for (const string& descendant : descendants) {
-    if (!(env->IsDirectory(descendant).ok())) {
-      uint64 file_size;
-      TF_RETURN_IF_ERROR(env->GetFileSize(descendant, &file_size));
-      *total_file_size += file_size;
-    }
+  for (const uint64 file_size : file_sizes) {
+    *total_file_size += file_size;
   }
   return Status::OK();
 }
@@ -315,12 +505,67 @@ Status EstimateResourceFromPathUsingDiskState(const string& path,
       total_file_size * kResourceEstimateRAMMultiplier +
       kResourceEstimateRAMPadBytes;
 
+  SetRamResourceEstimate(ram_requirement, estimate);
+  return Status::OK();
+}
+
+void SetRamResourceEstimate(const uint64 ram_bytes,
+                            ResourceAllocation* estimate) {
+  for (ResourceAllocation::Entry& entry :
+       *estimate->mutable_resource_quantities()) {
+    if (IsRamResource(entry.resource())) {
+      entry.set_quantity(ram_bytes);
+      return;
+    }
+  }
   ResourceAllocation::Entry* ram_entry = estimate->add_resource_quantities();
   Resource* ram_resource = ram_entry->mutable_resource();
   ram_resource->set_device(device_types::kMain);
   ram_resource->set_kind(resource_kinds::kRamBytes);
-  ram_entry->set_quantity(ram_requirement);
+  ram_entry->set_quantity(ram_bytes);
+}
+
+uint64 GetRamResourceEstimate(const ResourceAllocation& estimate) {
+  for (const ResourceAllocation::Entry& entry :
+       estimate.resource_quantities()) {
+    if (IsRamResource(entry.resource())) {
+      return entry.quantity();
+    }
+  }
+  return 0;
+}
 
+void BindRamResourceEstimate(const uint32 device_instance,
+                             ResourceAllocation* estimate) {
+  for (ResourceAllocation::Entry& entry :
+       *estimate->mutable_resource_quantities()) {
+    if (IsRamResource(entry.resource())) {
+      entry.mutable_resource()->mutable_device_instance()->set_value(
+          device_instance);
+    }
+  }
+}
+
+Status GetProcessResidentMemory(uint64* resident_bytes) {
+  string status;
+  TF_RETURN_IF_ERROR(
+      ReadFileToString(Env::Default(), "/proc/self/status", &status));
+  // The line is e.g. "VmRSS:     1234 kB".
+  constexpr char kResidentMemoryField[] = "VmRSS:";
+  const size_t field = status.find(kResidentMemoryField);
+  if (field == string::npos) {
+    return errors::Unavailable("Resident memory size not reported");
+  }
+  const size_t begin =
+      status.find_first_not_of(" \t", field + strlen(kResidentMemoryField));
+  const size_t end = status.find_first_not_of("0123456789", begin);
+  uint64 resident_kilobytes;
+  if (begin == string::npos || end == string::npos ||
+      !strings::safe_strtou64(StringPiece(status).substr(begin, end - begin),
+                              &resident_kilobytes)) {
+    return errors::Unavailable("Cannot parse the resident memory size");
+  }
+  *resident_bytes = resident_kilobytes * 1024;
   return Status::OK();
 }
 
@@ -332,6 +577,35 @@ void RecordRuntimeLatency(const string& model_name, const string& api,
 void RecordRequestLatency(const string& model_name, const string& api,
                           const string& entrypoint, int64 latency_usec) {
   request_latency->GetCell(model_name, api, entrypoint)->Add(latency_usec);
+  GetRecentRequestLatencies()->Record(latency_usec);
+}
+
+RecentLatencies* GetRecentRequestLatencies() {
+  static RecentLatencies* latencies = new RecentLatencies({});
+  return latencies;
+}
+
+monitoring::SamplerCell* RequestStage::GetLatencyCell(
+    const absl::string_view model_name) {
+  {
+    tf_shared_lock l(mu_);
+    const auto it = latency_cells_.find(model_name);
+    if (it != latency_cells_.end()) {
+      return it->second;
+    }
+  }
+  const string name(model_name);
+  monitoring::SamplerCell* const cell =
+      request_stage_latency->GetCell(name, api_, stage_);
+  mutex_lock l(mu_);
+  latency_cells_.emplace(name, cell);
+  return cell;
+}
+
+ScopedRequestStageLatency::~ScopedRequestStageLatency() {
+  const int64 latency_usec = EnvTime::NowMicros() - start_micros_;
+  latency_cell_->Add(latency_usec);
+  RecordFlightStage(stage_->stage(), latency_usec);
 }
 
 std::set<string> SetDifference(std::set<string> set_a, std::set<string> set_b) {
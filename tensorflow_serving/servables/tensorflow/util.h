@@ -16,17 +16,26 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_UTIL_H_
 #define TENSORFLOW_SERVING_SERVABLES_TENSORFLOW_UTIL_H_
 
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/monitoring/counter.h"
 #include "tensorflow/core/lib/monitoring/sampler.h"
+#include "tensorflow/core/platform/env_time.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
 #include "tensorflow/core/platform/threadpool_options.h"
 #include "tensorflow/core/public/session.h"
+#include "tensorflow_serving/apis/classification.pb.h"
 #include "tensorflow_serving/apis/input.pb.h"
+#include "tensorflow_serving/apis/internal/serialized_input.pb.h"
 #include "tensorflow_serving/apis/model.pb.h"
 #include "tensorflow_serving/resources/resources.pb.h"
 #include "tensorflow_serving/util/file_probing_env.h"
+#include "tensorflow_serving/util/recent_latencies.h"
 
 namespace tensorflow {
 namespace serving {
@@ -38,6 +47,8 @@ monitoring::Sampler<1>* GetExampleCounts();
 
 monitoring::Counter<1>* GetExampleCountTotal();
 
+monitoring::Sampler<3>* GetRequestStageLatency();
+
 }  // namespace internal
 
 // Metrics by model
@@ -54,6 +65,16 @@ void SetSignatureMethodNameCheckFeature(bool v);
 // Get current state of `method_name` check (see above for details).
 bool GetSignatureMethodNameCheckFeature();
 
+// Enable/disable sharing of example parsing across the tasks of a
+// MultiInferenceRequest. When enabled, tasks whose signatures have distinct
+// input tensors, each parsed by an equivalent ParseExample op, get the
+// examples parsed once, and the parsed features fed to all of their heads.
+// This costs an extra Session::Run() per request. By default it is disabled.
+void SetMultiInferenceSharedExampleParsingFeature(bool v);
+
+// Get current state of shared example parsing (see above for details).
+bool GetMultiInferenceSharedExampleParsingFeature();
+
 // Records the example count of this request with the metric tracking the
 // histogram of number of examples per request.
 void RecordRequestExampleCount(const string& model_name, size_t count);
@@ -73,6 +94,12 @@ void RecordRequestExampleCount(const string& model_name, size_t count);
 // empty it will return a Tensor of shape {0}).
 Status InputToSerializedExampleTensor(const Input& input, Tensor* examples);
 
+// Same as InputToSerializedExampleTensor() above, but for an Input whose
+// examples are still serialized, e.g. parsed straight from the wire as a
+// SerializedInput, which skips parsing and re-serializing the Examples.
+Status SerializedInputToSerializedExampleTensor(
+    const internal::SerializedInput& serialized_input, Tensor* examples);
+
 // Issues a single Session::Run() call with 'input' to produce 'outputs'.
 // Equivalent to InputToSerializedExampleTensor() followed by Session::Run().
 Status PerformOneShotTensorComputation(
@@ -102,7 +129,22 @@ void MakeModelSpec(const string& model_name,
                    const absl::optional<string>& signature_name,
                    const absl::optional<int64>& version, ModelSpec* model_spec);
 
-// Gets the disk size of the model in the given path.
+// Selects the classes of an example to return for a classification
+// 'request', among the 'num_classes' classes of the model output, whose
+// scores are 'scores' (nullptr if the model does not output scores).
+// 'class_indices' is set to all the classes, in order, if the request has
+// neither top_k nor min_score. Otherwise it is set to the classes whose score
+// is at least min_score and, if top_k is set, to the top_k of them of highest
+// score, by decreasing score. These are found with a partial sort, so that
+// the classes which are not returned are not sorted.
+Status SelectClassificationClasses(const ClassificationRequest& request,
+                                   const float* scores, int num_classes,
+                                   std::vector<int>* class_indices);
+
+// Gets the disk size of the model in the given path. The directories are
+// listed, and the files probed, by up to 16 concurrent calls to 'env', which
+// must be thread-safe: on cloud file systems, the round trips overlap instead
+// of adding up.
 Status GetModelDiskSize(const string& path, FileProbingEnv* env,
                         uint64* total_file_size);
 
@@ -113,6 +155,24 @@ Status EstimateResourceFromPathUsingDiskState(const string& path,
                                               FileProbingEnv* env,
                                               ResourceAllocation* estimate);
 
+// Sets the quantity of main memory (RAM) of 'estimate' to 'ram_bytes'.
+void SetRamResourceEstimate(uint64 ram_bytes, ResourceAllocation* estimate);
+
+// Gets the quantity of main memory (RAM) of 'estimate', or 0 if it has none.
+uint64 GetRamResourceEstimate(const ResourceAllocation& estimate);
+
+// Binds the main memory (RAM) of 'estimate' to the instance 'device_instance'
+// of the main device, e.g. the NUMA node of the servable (see NumaPlacement).
+void BindRamResourceEstimate(uint32 device_instance,
+                             ResourceAllocation* estimate);
+
+// Gets the resident set size of the process, i.e. the RAM it actually uses.
+// The difference across the load of a servable measures its footprint, once
+// the transient memory of the load is released, or an upper bound of it if
+// the process allocates memory for other tasks meanwhile. Fails where the
+// resident set size is not known, e.g. outside of Linux.
+Status GetProcessResidentMemory(uint64* resident_bytes);
+
 // Update metrics for runtime latency.
 void RecordRuntimeLatency(const string& model_name, const string& api,
                           const string& runtime, int64 latency_usec);
@@ -121,6 +181,58 @@ void RecordRuntimeLatency(const string& model_name, const string& api,
 void RecordRequestLatency(const string& model_name, const string& api,
                           const string& entrypoint, int64 latency_usec);
 
+// Returns the latencies of the recent requests to the server, of all the
+// models and APIs, as recorded by RecordRequestLatency().
+RecentLatencies* GetRecentRequestLatencies();
+
+// A stage of the requests of an API, e.g. the "parse_request" stage of
+// "Predict", whose latency is recorded per model to tell where the request
+// latency goes (see ScopedRequestStageLatency). The cells of the latency
+// metric are cached by model name, so that recording a latency neither builds
+// the labels of the metric nor looks them up.
+//
+// This class is thread-safe. Its instances are meant to be static, e.g.
+//   static RequestStage* const stage = new RequestStage("Predict", "...");
+class RequestStage {
+ public:
+  RequestStage(const string& api, const string& stage)
+      : api_(api), stage_(stage) {}
+
+  const string& stage() const { return stage_; }
+
+  // Returns the cell of 'model_name' in the request stage latency metric.
+  monitoring::SamplerCell* GetLatencyCell(absl::string_view model_name);
+
+ private:
+  const string api_;
+  const string stage_;
+  mutex mu_;
+  absl::flat_hash_map<string, monitoring::SamplerCell*> latency_cells_
+      TF_GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(RequestStage);
+};
+
+// Records the wall time of its scope as the latency of 'stage' for
+// 'model_name'. Also adds the stage to the flight record of the current
+// thread, if any.
+class ScopedRequestStageLatency {
+ public:
+  ScopedRequestStageLatency(RequestStage* stage, absl::string_view model_name)
+      : stage_(stage),
+        latency_cell_(stage->GetLatencyCell(model_name)),
+        start_micros_(EnvTime::NowMicros()) {}
+
+  ~ScopedRequestStageLatency();
+
+ private:
+  RequestStage* const stage_;
+  monitoring::SamplerCell* const latency_cell_;
+  const uint64 start_micros_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ScopedRequestStageLatency);
+};
+
 // Get string keys of a map.
 template <typename T>
 std::set<string> GetMapKeys(const T& map) {
@@ -15,6 +15,9 @@ limitations under the License.
 
 #include "tensorflow_serving/servables/tensorflow/util.h"
 
+#include <cmath>
+#include <vector>
+
 #include "google/protobuf/wrappers.pb.h"
 #include "tensorflow/cc/saved_model/signature_constants.h"
 #include "tensorflow/core/example/example.pb.h"
@@ -199,6 +202,35 @@ TEST_F(InputUtilTest, ExampleListWithContext_OnlyContext) {
   EXPECT_THAT(status.error_message(), HasSubstr("Input is empty"));
 }
 
+TEST_F(InputUtilTest, SerializedInput) {
+  auto* examples =
+      input_.mutable_example_list_with_context()->mutable_examples();
+  *examples->Add() = example_A();
+  *examples->Add() = example_B();
+  *input_.mutable_example_list_with_context()->mutable_context() = example_C();
+  TF_ASSERT_OK(InputToSerializedExampleTensor(input_, &tensor_));
+
+  // The same Input, as it would be parsed from the wire without its Examples.
+  internal::SerializedInput serialized_input;
+  ASSERT_TRUE(serialized_input.ParseFromString(input_.SerializeAsString()));
+  Tensor serialized_tensor;
+  TF_ASSERT_OK(SerializedInputToSerializedExampleTensor(serialized_input,
+                                                        &serialized_tensor));
+  ASSERT_EQ(2, serialized_tensor.NumElements());
+  for (int i = 0; i < 2; ++i) {
+    Example expected_example, example;
+    ASSERT_TRUE(expected_example.ParseFromString(tensor_.flat<tstring>()(i)));
+    ASSERT_TRUE(example.ParseFromString(serialized_tensor.flat<tstring>()(i)));
+    EXPECT_THAT(example, EqualsProto(expected_example));
+  }
+
+  serialized_input.Clear();
+  const Status status =
+      SerializedInputToSerializedExampleTensor(serialized_input, &tensor_);
+  ASSERT_FALSE(status.ok());
+  EXPECT_THAT(status.error_message(), HasSubstr("Input is empty"));
+}
+
 TEST_F(InputUtilTest, RequestNumExamplesStreamz) {
   Input input_1;
   *input_1.mutable_example_list()->mutable_examples()->Add() = example_A();
@@ -233,6 +265,20 @@ TEST(ExampleCountsTest, Simple) {
   EXPECT_EQ(3, after_count - before_count);
 }
 
+TEST(RequestStageTest, RecordsLatenciesInCachedCells) {
+  RequestStage stage("Predict", "test_stage");
+  monitoring::SamplerCell* const cell = stage.GetLatencyCell("model-name");
+  EXPECT_EQ(cell, stage.GetLatencyCell("model-name"));
+  EXPECT_EQ(cell, internal::GetRequestStageLatency()->GetCell(
+                      "model-name", "Predict", "test_stage"));
+  EXPECT_NE(cell, stage.GetLatencyCell("other-model-name"));
+
+  const double before_count = cell->value().num();
+  { ScopedRequestStageLatency stage_latency(&stage, "model-name"); }
+  { ScopedRequestStageLatency stage_latency(&stage, "model-name"); }
+  EXPECT_EQ(2, cell->value().num() - before_count);
+}
+
 TEST(ModelSpecTest, NoOptional) {
   ModelSpec model_spec;
   MakeModelSpec("foo", /*signature_name=*/{}, /*version=*/{}, &model_spec);
@@ -275,6 +321,65 @@ TEST(ModelSpecTest, AllOptionalSet) {
   EXPECT_THAT(model_spec.version().value(), Eq(1));
 }
 
+TEST(SelectClassificationClassesTest, SelectsAllClassesByDefault) {
+  const std::vector<float> scores = {0.1, 0.7, 0.2};
+  std::vector<int> class_indices;
+  TF_ASSERT_OK(SelectClassificationClasses(ClassificationRequest(),
+                                           scores.data(), 3, &class_indices));
+  EXPECT_THAT(class_indices, ::testing::ElementsAre(0, 1, 2));
+
+  // Without scores too.
+  TF_ASSERT_OK(SelectClassificationClasses(ClassificationRequest(), nullptr,
+                                           3, &class_indices));
+  EXPECT_THAT(class_indices, ::testing::ElementsAre(0, 1, 2));
+}
+
+TEST(SelectClassificationClassesTest, TopKAndMinScore) {
+  const std::vector<float> scores = {0.1, 0.7, 0.2, NAN, 0.7, 0.05};
+  ClassificationRequest request;
+  std::vector<int> class_indices;
+
+  // Ties are ordered by class, and NaNs come last.
+  request.set_top_k(3);
+  TF_ASSERT_OK(SelectClassificationClasses(request, scores.data(), 6,
+                                           &class_indices));
+  EXPECT_THAT(class_indices, ::testing::ElementsAre(1, 4, 2));
+  request.set_top_k(10);
+  TF_ASSERT_OK(SelectClassificationClasses(request, scores.data(), 6,
+                                           &class_indices));
+  EXPECT_THAT(class_indices, ::testing::ElementsAre(1, 4, 2, 0, 5, 3));
+
+  // Without top_k, the classes keep their order.
+  request.set_top_k(0);
+  request.mutable_min_score()->set_value(0.1);
+  TF_ASSERT_OK(SelectClassificationClasses(request, scores.data(), 6,
+                                           &class_indices));
+  EXPECT_THAT(class_indices, ::testing::ElementsAre(0, 1, 2, 4));
+  request.set_top_k(3);
+  TF_ASSERT_OK(SelectClassificationClasses(request, scores.data(), 6,
+                                           &class_indices));
+  EXPECT_THAT(class_indices, ::testing::ElementsAre(1, 4, 2));
+  request.mutable_min_score()->set_value(1);
+  TF_ASSERT_OK(SelectClassificationClasses(request, scores.data(), 6,
+                                           &class_indices));
+  EXPECT_TRUE(class_indices.empty());
+}
+
+TEST(SelectClassificationClassesTest, Errors) {
+  ClassificationRequest request;
+  request.set_top_k(1);
+  std::vector<int> class_indices;
+  Status status =
+      SelectClassificationClasses(request, nullptr, 3, &class_indices);
+  EXPECT_THAT(status.error_message(), HasSubstr("require the classification"));
+
+  const std::vector<float> scores = {0.1, 0.7, 0.2};
+  request.set_top_k(-1);
+  status = SelectClassificationClasses(request, scores.data(), 3,
+                                       &class_indices);
+  EXPECT_THAT(status.error_message(), HasSubstr("must be non-negative"));
+}
+
 TEST(SignatureMethodNameCheckFeature, SetGet) {
   SetSignatureMethodNameCheckFeature(true);
   EXPECT_TRUE(GetSignatureMethodNameCheckFeature());
@@ -310,6 +415,79 @@ TEST(ResourceEstimatorTest, EstimateResourceFromPathUsingDiskState) {
   EXPECT_THAT(actual, EqualsProto(expected));
 }
 
+TEST(ResourceEstimatorTest, GetModelDiskSizeOfNestedDirectories) {
+  const string export_dir = "/foo/bar";
+  const string variables_dir = io::JoinPath(export_dir, "variables");
+  const string model_path = io::JoinPath(export_dir, "saved_model.pb");
+  const string index_path = io::JoinPath(variables_dir, "variables.index");
+  const string data_path =
+      io::JoinPath(variables_dir, "variables.data-00000-of-00001");
+
+  test_util::MockFileProbingEnv env;
+  EXPECT_CALL(env, FileExists(export_dir)).WillRepeatedly(Return(Status::OK()));
+  EXPECT_CALL(env, GetChildren(export_dir, _))
+      .WillOnce(DoAll(SetArgPointee<1>(std::vector<string>(
+                          {"saved_model.pb", "variables"})),
+                      Return(Status::OK())));
+  const std::vector<string> variables_children = {
+      "variables.index", "variables.data-00000-of-00001"};
+  EXPECT_CALL(env, GetChildren(variables_dir, _))
+      .WillOnce(DoAll(SetArgPointee<1>(variables_children),
+                      Return(Status::OK())));
+  EXPECT_CALL(env, IsDirectory(variables_dir))
+      .WillOnce(Return(Status::OK()));
+  for (const string& file_path : {model_path, index_path, data_path}) {
+    EXPECT_CALL(env, IsDirectory(file_path))
+        .WillOnce(Return(errors::FailedPrecondition("")));
+  }
+  EXPECT_CALL(env, GetFileSize(model_path, _))
+      .WillOnce(DoAll(SetArgPointee<1>(100), Return(Status::OK())));
+  EXPECT_CALL(env, GetFileSize(index_path, _))
+      .WillOnce(DoAll(SetArgPointee<1>(20), Return(Status::OK())));
+  EXPECT_CALL(env, GetFileSize(data_path, _))
+      .WillOnce(DoAll(SetArgPointee<1>(3000), Return(Status::OK())));
+
+  uint64 total_file_size = 0;
+  TF_ASSERT_OK(GetModelDiskSize(export_dir, &env, &total_file_size));
+  EXPECT_EQ(total_file_size, 3120);
+}
+
+TEST(ResourceEstimatorTest, GetModelDiskSizeFailsOnListingError) {
+  const string export_dir = "/foo/bar";
+  test_util::MockFileProbingEnv env;
+  EXPECT_CALL(env, FileExists(export_dir)).WillRepeatedly(Return(Status::OK()));
+  EXPECT_CALL(env, GetChildren(export_dir, _))
+      .WillOnce(Return(errors::PermissionDenied("")));
+
+  uint64 total_file_size = 0;
+  EXPECT_EQ(GetModelDiskSize(export_dir, &env, &total_file_size).code(),
+            error::PERMISSION_DENIED);
+}
+
+TEST(ResourceEstimatorTest, RamResourceEstimate) {
+  ResourceAllocation estimate;
+  EXPECT_EQ(GetRamResourceEstimate(estimate), 0);
+  SetRamResourceEstimate(100, &estimate);
+  EXPECT_THAT(estimate,
+              EqualsProto("resource_quantities { "
+                          "  resource { device: 'main' kind: 'ram_in_bytes' } "
+                          "  quantity: 100 "
+                          "}"));
+  EXPECT_EQ(GetRamResourceEstimate(estimate), 100);
+  // The entry is updated, not duplicated.
+  SetRamResourceEstimate(50, &estimate);
+  EXPECT_EQ(estimate.resource_quantities_size(), 1);
+  EXPECT_EQ(GetRamResourceEstimate(estimate), 50);
+}
+
+#if defined(__linux__)
+TEST(ResourceEstimatorTest, GetProcessResidentMemory) {
+  uint64 resident_bytes = 0;
+  TF_ASSERT_OK(GetProcessResidentMemory(&resident_bytes));
+  EXPECT_GT(resident_bytes, 0);
+}
+#endif
+
 TEST(GetMapKeysTest, GetKeys) {
   std::map<string, string> map = {std::pair<string, string>("key1", "value1"),
                                   std::pair<string, string>("key2", "value2")};
@@ -0,0 +1,211 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Benchmarks of SavedModel version transitions, i.e. of an
+// AspiredVersionsManager swapping the served version of a model loaded by a
+// SavedModelBundleSourceAdapter, under read load.
+//
+// Each iteration replaces the served version by the other version of
+// saved_model_half_plus_two_2_versions, with the availability preserving
+// policy, while reader threads acquire handles to the latest version as in
+// BM_GetServableHandle. Reported counters:
+//   time_to_available_ms: Time from aspiring a version to it being available.
+//   handle_p50_us, handle_p99_us, handle_max_us: Latency of the handle
+//     acquisitions of the readers, during the transitions.
+//   peak_rss_mb: Peak resident set size of the process (Linux only).
+//
+// Run with:
+// bazel run -c opt --dynamic_mode=off \
+// tensorflow_serving/servables/tensorflow:version_transition_benchmark --
+// --benchmarks=.
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/lib/histogram/histogram.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/env_time.h"
+#include "tensorflow/core/platform/init_main.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow_serving/core/aspired_versions_manager.h"
+#include "tensorflow_serving/core/availability_preserving_policy.h"
+#include "tensorflow_serving/core/loader.h"
+#include "tensorflow_serving/core/servable_data.h"
+#include "tensorflow_serving/core/servable_handle.h"
+#include "tensorflow_serving/core/test_util/manager_test_util.h"
+#include "tensorflow_serving/servables/tensorflow/saved_model_bundle_source_adapter.h"
+#include "tensorflow_serving/servables/tensorflow/saved_model_bundle_source_adapter.pb.h"
+#include "tensorflow_serving/test_util/test_util.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+constexpr char kServableName[] = "half_plus_two";
+constexpr int64 kVersions[] = {123, 124};
+
+string VersionPath(const int64 version) {
+  return test_util::TestSrcDirPath(strings::StrCat(
+      "servables/tensorflow/testdata/saved_model_half_plus_two_2_versions/",
+      "00000", version));
+}
+
+// Returns the peak resident set size of the process, in bytes, or 0 if
+// unknown.
+int64 PeakRssBytes() {
+  std::ifstream status("/proc/self/status");
+  string line;
+  while (std::getline(status, line)) {
+    int64 peak_kb;
+    if (sscanf(line.c_str(), "VmHWM: %lld kB", &peak_kb) == 1) {
+      return peak_kb * 1024;
+    }
+  }
+  return 0;
+}
+
+// Maintains the manager, the source adapter and the reader threads of a
+// benchmark.
+class TransitionBenchmarkState {
+ public:
+  TransitionBenchmarkState() {
+    AspiredVersionsManager::Options options;
+    // The policy is invoked by the benchmark, to time the transitions.
+    options.manage_state_interval_micros = -1;
+    options.aspired_version_policy.reset(new AvailabilityPreservingPolicy());
+    TF_CHECK_OK(AspiredVersionsManager::Create(std::move(options), &manager_));
+    TF_CHECK_OK(SavedModelBundleSourceAdapter::Create(
+        SavedModelBundleSourceAdapterConfig(), &adapter_));
+  }
+
+  // Aspires the version 'version' in place of the served one, and returns the
+  // time (in microseconds) until it is available. Returns once the previous
+  // version is unloaded.
+  uint64 Transition(const int64 version) {
+    const uint64 start_micros = EnvTime::NowMicros();
+    std::vector<ServableData<std::unique_ptr<Loader>>> versions;
+    versions.push_back(adapter_->AdaptOneVersion(
+        ServableData<StoragePath>({kServableName, version},
+                                  VersionPath(version))));
+    manager_->GetAspiredVersionsCallback()(kServableName, std::move(versions));
+    test_util::AspiredVersionsManagerTestAccess access(manager_.get());
+    access.HandlePendingAspiredVersionsRequests();
+    // Loads the new version.
+    access.InvokePolicyAndExecuteAction();
+    const uint64 available_micros = EnvTime::NowMicros();
+    // Quiesces and deletes the previous version, if any.
+    access.InvokePolicyAndExecuteAction();
+    access.InvokePolicyAndExecuteAction();
+    CHECK_EQ(1, manager_->ListAvailableServableIds().size());
+    return available_micros - start_micros;
+  }
+
+  // Starts 'num_threads' threads acquiring handles to the latest version.
+  void StartReaders(const int num_threads) {
+    if (num_threads == 0) {
+      return;
+    }
+    readers_.reset(new thread::ThreadPool(Env::Default(), "TransitionReaders",
+                                          num_threads));
+    for (int i = 0; i < num_threads; ++i) {
+      reader_latencies_.emplace_back(new histogram::Histogram());
+      histogram::Histogram* latencies = reader_latencies_.back().get();
+      readers_->Schedule([this, latencies]() {
+        while (!stop_readers_.load()) {
+          const uint64 start_micros = EnvTime::NowMicros();
+          ServableHandle<SavedModelBundle> handle;
+          TF_CHECK_OK(manager_->GetServableHandle(
+              ServableRequest::Latest(kServableName), &handle));
+          latencies->Add(EnvTime::NowMicros() - start_micros);
+        }
+      });
+    }
+  }
+
+  // Stops the readers, and adds the latencies of their handle acquisitions to
+  // 'latencies'.
+  void StopReaders(histogram::Histogram* latencies) {
+    stop_readers_.store(true);
+    readers_.reset();
+    for (const auto& thread_latencies : reader_latencies_) {
+      latencies->Merge(*thread_latencies);
+    }
+  }
+
+ private:
+  std::unique_ptr<AspiredVersionsManager> manager_;
+  std::unique_ptr<SavedModelBundleSourceAdapter> adapter_;
+
+  std::unique_ptr<thread::ThreadPool> readers_;
+  std::atomic<bool> stop_readers_{false};
+  // Latencies of the handle acquisitions, in microseconds, of each reader.
+  // Histograms keep the memory of the readers constant.
+  std::vector<std::unique_ptr<histogram::Histogram>> reader_latencies_;
+};
+
+void BM_VersionTransition(::testing::benchmark::State& state) {
+  const int num_threads = state.range(0);
+  TransitionBenchmarkState bm_state;
+  // The first version is loaded before the readers start.
+  bm_state.Transition(kVersions[0]);
+  bm_state.StartReaders(num_threads);
+
+  uint64 total_time_to_available_micros = 0;
+  int next_version_index = 1;
+  for (auto s : state) {
+    total_time_to_available_micros +=
+        bm_state.Transition(kVersions[next_version_index]);
+    next_version_index = 1 - next_version_index;
+  }
+  histogram::Histogram latencies;
+  bm_state.StopReaders(&latencies);
+
+  state.counters["time_to_available_ms"] =
+      total_time_to_available_micros / 1000.0 / state.iterations();
+  state.counters["handle_p50_us"] = latencies.Median();
+  state.counters["handle_p99_us"] = latencies.Percentile(99);
+  state.counters["handle_max_us"] =
+      latencies.num() > 0 ? latencies.Maximum() : 0;
+  state.counters["peak_rss_mb"] = PeakRssBytes() / (1024.0 * 1024.0);
+}
+
+// Transitions with 0 to 16 reader threads.
+void ReaderThreads(::testing::benchmark::internal::Benchmark* benchmark) {
+  for (const int num_threads : {0, 1, 4, 16}) {
+    benchmark->Arg(num_threads);
+  }
+}
+
+BENCHMARK(BM_VersionTransition)->Apply(ReaderThreads)->UseRealTime();
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
+
+int main(int argc, char** argv) {
+  tensorflow::port::InitMain(argv[0], &argc, &argv);
+  tensorflow::testing::RunBenchmarks();
+  return 0;
+}
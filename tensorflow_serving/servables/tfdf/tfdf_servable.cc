@@ -0,0 +1,833 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/servables/tfdf/tfdf_servable.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/str_cat.h"
+#include "tensorflow/core/example/example.pb.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_shape.pb.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/notification.h"
+#include "tensorflow_serving/resources/numa_placement.h"
+#include "tensorflow_serving/servables/tensorflow/util.h"
+#include "tensorflow_serving/util/file_probing_env.h"
+#include "yggdrasil_decision_forests/dataset/data_spec.h"
+#include "yggdrasil_decision_forests/model/decision_tree/decision_tree.h"
+#include "yggdrasil_decision_forests/model/gradient_boosted_trees/gradient_boosted_trees.h"
+#include "yggdrasil_decision_forests/model/model_library.h"
+#include "yggdrasil_decision_forests/model/random_forest/random_forest.h"
+#include "yggdrasil_decision_forests/utils/tensorflow.h"
+
+namespace tensorflow {
+namespace serving {
+
+constexpr char TfdfServable::kPredictionsOutput[];
+
+namespace {
+
+auto* set_examples_stage = new RequestStage("Predict", "set_examples");
+auto* run_engine_stage = new RequestStage("Predict", "run_engine");
+
+namespace ydf = ::yggdrasil_decision_forests;
+
+// A feature of a tf.Example. Note: TfdfServable::Feature is an input feature
+// of the model.
+using ExampleFeature = ::tensorflow::Feature;
+
+// Estimated RAM used by a node of a decision tree: the node of the model, with
+// its condition and output protos, and the node of the fast engine.
+constexpr uint64 kRamBytesPerTreeNode = 256;
+
+using DecisionTrees =
+    std::vector<std::unique_ptr<ydf::model::decision_tree::DecisionTree>>;
+
+// The trees of a decision forest model, or nullptr for other models.
+const DecisionTrees* GetDecisionTrees(const ydf::model::AbstractModel& model) {
+  if (const auto* gbt_model = dynamic_cast<
+          const ydf::model::gradient_boosted_trees::GradientBoostedTreesModel*>(
+          &model)) {
+    return &gbt_model->decision_trees();
+  }
+  if (const auto* rf_model = dynamic_cast<
+          const ydf::model::random_forest::RandomForestModel*>(&model)) {
+    return &rf_model->decision_trees();
+  }
+  return nullptr;
+}
+
+// Number of nodes of the trees of a decision forest model, or 0 for other
+// models.
+int64 NumTreeNodes(const ydf::model::AbstractModel& model) {
+  const DecisionTrees* trees = GetDecisionTrees(model);
+  if (trees == nullptr) {
+    return 0;
+  }
+  int64 num_nodes = 0;
+  for (const auto& tree : *trees) {
+    num_nodes += tree->NumNodes();
+  }
+  return num_nodes;
+}
+
+// Number of examples in a [batch] or [batch, 1] input tensor.
+Status GetNumExamples(const string& name, const Tensor& tensor,
+                      int* num_examples) {
+  if (tensor.dims() == 1 || (tensor.dims() == 2 && tensor.dim_size(1) == 1)) {
+    *num_examples = tensor.dim_size(0);
+    return Status::OK();
+  }
+  return errors::InvalidArgument("Input \"", name,
+                                 "\" should be of shape [batch] or [batch, 1]."
+                                 " Got shape ",
+                                 tensor.shape().DebugString());
+}
+
+// Converts the values of a numerical tensor into floats.
+Status GetNumericalValues(const string& name, const Tensor& tensor,
+                          std::vector<float>* values) {
+  const int64 num_values = tensor.NumElements();
+  values->resize(num_values);
+  switch (tensor.dtype()) {
+    case DT_FLOAT: {
+      const auto src = tensor.flat<float>();
+      std::copy(src.data(), src.data() + num_values, values->begin());
+    } break;
+    case DT_DOUBLE: {
+      const auto src = tensor.flat<double>();
+      std::copy(src.data(), src.data() + num_values, values->begin());
+    } break;
+    case DT_INT32: {
+      const auto src = tensor.flat<int32>();
+      std::copy(src.data(), src.data() + num_values, values->begin());
+    } break;
+    case DT_INT64: {
+      const auto src = tensor.flat<int64>();
+      std::copy(src.data(), src.data() + num_values, values->begin());
+    } break;
+    case DT_BOOL: {
+      const auto src = tensor.flat<bool>();
+      std::copy(src.data(), src.data() + num_values, values->begin());
+    } break;
+    default:
+      return errors::InvalidArgument("Non supported type ",
+                                     DataTypeString(tensor.dtype()),
+                                     " for the numerical input \"", name, "\"");
+  }
+  return Status::OK();
+}
+
+// Converts an integer categorical value into a dictionary index, or -1 if
+// missing.
+int IntegerCategoricalValue(const int64 value,
+                            const ydf::dataset::proto::Column& column_spec) {
+  if (!column_spec.categorical().is_already_integerized()) {
+    return ydf::dataset::CategoricalStringToValue(absl::StrCat(value),
+                                                  column_spec);
+  }
+  if (value < 0) {
+    return -1;
+  }
+  // Note: Out-of-vocabulary values are mapped to the index 0.
+  return value < column_spec.categorical().number_of_unique_values()
+             ? static_cast<int>(value)
+             : 0;
+}
+
+// Converts the values of a categorical tensor into dictionary indices. Missing
+// values are represented as -1.
+Status GetCategoricalValues(const string& name, const Tensor& tensor,
+                            const ydf::dataset::proto::Column& column_spec,
+                            std::vector<int>* values) {
+  const int64 num_values = tensor.NumElements();
+  values->resize(num_values);
+
+  const auto integer_value = [&](const int64 value) {
+    return IntegerCategoricalValue(value, column_spec);
+  };
+
+  switch (tensor.dtype()) {
+    case DT_STRING: {
+      const auto src = tensor.flat<tstring>();
+      for (int64 value_idx = 0; value_idx < num_values; value_idx++) {
+        const tstring& value = src(value_idx);
+        (*values)[value_idx] =
+            value.empty() ? -1
+                          : ydf::dataset::CategoricalStringToValue(
+                                string(value), column_spec);
+      }
+    } break;
+    case DT_INT32: {
+      const auto src = tensor.flat<int32>();
+      for (int64 value_idx = 0; value_idx < num_values; value_idx++) {
+        (*values)[value_idx] = integer_value(src(value_idx));
+      }
+    } break;
+    case DT_INT64: {
+      const auto src = tensor.flat<int64>();
+      for (int64 value_idx = 0; value_idx < num_values; value_idx++) {
+        (*values)[value_idx] = integer_value(src(value_idx));
+      }
+    } break;
+    default:
+      return errors::InvalidArgument(
+          "Non supported type ", DataTypeString(tensor.dtype()),
+          " for the categorical input \"", name, "\"");
+  }
+  return Status::OK();
+}
+
+// Whether "condition" routes the value "numerical_value" or
+// "categorical_value" of its attribute like a missing value, i.e. along its
+// "na_value". False for the conditions that cannot be checked.
+bool RoutesLikeMissingValue(
+    const ydf::model::decision_tree::proto::NodeCondition& condition,
+    const float numerical_value, const int categorical_value) {
+  using Condition = ydf::model::decision_tree::proto::Condition;
+  const Condition& test = condition.condition();
+  bool value = false;
+  switch (test.type_case()) {
+    case Condition::kHigherCondition:
+      value = numerical_value >= test.higher_condition().threshold();
+      break;
+    case Condition::kContainsCondition: {
+      const auto& elements = test.contains_condition().elements();
+      value = std::find(elements.begin(), elements.end(), categorical_value) !=
+              elements.end();
+    } break;
+    case Condition::kContainsBitmapCondition: {
+      const string& bitmap = test.contains_bitmap_condition().elements_bitmap();
+      const int byte_idx = categorical_value / 8;
+      value = byte_idx < bitmap.size() &&
+              ((bitmap[byte_idx] >> (categorical_value % 8)) & 1);
+    } break;
+    default:
+      return false;
+  }
+  return value == condition.na_value();
+}
+
+// Sets the replacement of the missing values of the features of "model", by
+// index of their column in the dataspec: the imputed value if every condition
+// of the trees on the feature routes it like a missing value, and NaN or -1
+// otherwise.
+void GetMissingValueReplacements(const ydf::model::AbstractModel& model,
+                                 std::vector<float>* numerical_replacements,
+                                 std::vector<int>* categorical_replacements) {
+  const auto& data_spec = model.data_spec();
+  numerical_replacements->assign(data_spec.columns_size(),
+                                 std::numeric_limits<float>::quiet_NaN());
+  categorical_replacements->assign(data_spec.columns_size(), -1);
+  const DecisionTrees* trees = GetDecisionTrees(model);
+  if (trees == nullptr) {
+    return;
+  }
+  std::vector<bool> replaceable(data_spec.columns_size(), true);
+  for (const auto& tree : *trees) {
+    tree->IterateOnNodes(
+        [&](const ydf::model::decision_tree::NodeWithChildren& node,
+            const int depth) {
+          if (node.IsLeaf()) {
+            return;
+          }
+          const auto& condition = node.node().condition();
+          // The oblique conditions test several attributes at once, and are
+          // never checked.
+          const auto& test = condition.condition();
+          if (test.has_oblique_condition()) {
+            replaceable[condition.attribute()] = false;
+            for (const int attribute : test.oblique_condition().attributes()) {
+              replaceable[attribute] = false;
+            }
+            return;
+          }
+          const auto& column_spec = data_spec.columns(condition.attribute());
+          if (!RoutesLikeMissingValue(
+                  condition, column_spec.numerical().mean(),
+                  column_spec.categorical().most_frequent_value())) {
+            replaceable[condition.attribute()] = false;
+          }
+        });
+  }
+  for (int spec_idx = 0; spec_idx < data_spec.columns_size(); spec_idx++) {
+    if (!replaceable[spec_idx]) {
+      continue;
+    }
+    const auto& column_spec = data_spec.columns(spec_idx);
+    (*numerical_replacements)[spec_idx] = column_spec.numerical().mean();
+    (*categorical_replacements)[spec_idx] =
+        column_spec.categorical().most_frequent_value();
+  }
+}
+
+void SetTensorInfo(const string& name, const DataType dtype,
+                   TensorInfo* info) {
+  info->set_name(name);
+  info->set_dtype(dtype);
+  info->mutable_tensor_shape()->add_dim()->set_size(-1);
+}
+
+}  // namespace
+
+Status TfdfServable::Create(const TfdfSourceAdapterConfig& config,
+                            const string& path,
+                            std::unique_ptr<TfdfServable>* servable) {
+  const string model_path =
+      config.model_subdirectory().empty()
+          ? path
+          : io::JoinPath(path, config.model_subdirectory());
+  std::unique_ptr<TfdfServable> result(new TfdfServable());
+  NumaPlacement* const numa_placement = NumaPlacement::Get();
+  if (numa_placement->enabled()) {
+    // Placed before it loads, so that the models loading meanwhile are placed
+    // on the other nodes.
+    TensorflowFileProbingEnv env(Env::Default());
+    TF_RETURN_IF_ERROR(
+        GetModelDiskSize(model_path, &env, &result->placed_ram_bytes_));
+    result->numa_node_ = numa_placement->Place(result->placed_ram_bytes_);
+  }
+  // The model is allocated on its NUMA node by this thread.
+  ScopedNumaNodeAffinity numa_node_affinity(result->numa_node_);
+  // Not available on all platforms, in which case only the footprint of the
+  // trees is estimated.
+  uint64 resident_bytes_before_load = 0;
+  const bool measure_load =
+      GetProcessResidentMemory(&resident_bytes_before_load).ok();
+  TF_RETURN_IF_ERROR(ydf::utils::FromUtilStatus(
+      ydf::model::LoadModel(model_path, &result->model_)));
+
+  auto engine_or = result->model_->BuildFastEngine();
+  if (!engine_or.ok()) {
+    return errors::FailedPrecondition(
+        "The model at ", model_path,
+        " is not compatible with a fast engine, and cannot be served natively:"
+        " ",
+        engine_or.status().message());
+  }
+  result->engine_ = std::move(engine_or).value();
+
+  const auto& data_spec = result->model_->data_spec();
+  const auto& features = result->engine_->features();
+  for (const int spec_idx : result->model_->input_features()) {
+    const auto& column_spec = data_spec.columns(spec_idx);
+    const string& name = column_spec.name();
+    switch (column_spec.type()) {
+      case ydf::dataset::proto::ColumnType::NUMERICAL: {
+        const auto id = features.GetNumericalFeatureId(spec_idx);
+        if (!id.ok()) {
+          // The feature is not used by the model.
+          continue;
+        }
+        result->features_by_name_[name] = {
+            true, static_cast<int>(result->numerical_features_.size())};
+        result->numerical_features_.push_back({name, spec_idx, id.value()});
+        SetTensorInfo(name, DT_FLOAT, &result->inputs_[name]);
+      } break;
+      case ydf::dataset::proto::ColumnType::CATEGORICAL: {
+        const auto id = features.GetCategoricalFeatureId(spec_idx);
+        if (!id.ok()) {
+          continue;
+        }
+        result->features_by_name_[name] = {
+            false, static_cast<int>(result->categorical_features_.size())};
+        result->categorical_features_.push_back({name, spec_idx, id.value()});
+        SetTensorInfo(
+            name,
+            column_spec.categorical().is_already_integerized() ? DT_INT64
+                                                               : DT_STRING,
+            &result->inputs_[name]);
+      } break;
+      default:
+        return errors::Unimplemented(
+            "Non supported type ",
+            ydf::dataset::proto::ColumnType_Name(column_spec.type()),
+            " for the feature \"", name, "\" of the model ", model_path);
+    }
+  }
+
+  result->numerical_replacements_.assign(
+      result->numerical_features_.size(),
+      std::numeric_limits<float>::quiet_NaN());
+  result->categorical_replacements_.assign(
+      result->categorical_features_.size(), -1);
+  if (config.replace_missing_values()) {
+    std::vector<float> numerical_replacements;
+    std::vector<int> categorical_replacements;
+    GetMissingValueReplacements(*result->model_, &numerical_replacements,
+                                &categorical_replacements);
+    int num_replaced = 0;
+    for (int i = 0; i < result->numerical_features_.size(); i++) {
+      const float replacement =
+          numerical_replacements[result->numerical_features_[i].spec_idx];
+      result->numerical_replacements_[i] = replacement;
+      num_replaced += !std::isnan(replacement);
+    }
+    for (int i = 0; i < result->categorical_features_.size(); i++) {
+      const int replacement =
+          categorical_replacements[result->categorical_features_[i].spec_idx];
+      result->categorical_replacements_[i] = replacement;
+      num_replaced += replacement != -1;
+    }
+    VLOG(1) << "The missing values of " << num_replaced << " of the "
+            << result->features_by_name_.size() << " features of the model at "
+            << model_path << " are replaced when staged";
+    result->num_replaced_features_ = num_replaced;
+  }
+
+  const int num_dims = result->engine_->NumPredictionDimension();
+  if (result->model_->task() == ydf::model::proto::Task::CLASSIFICATION) {
+    // Note: The out-of-vocabulary class is not reported.
+    const auto& label_spec = data_spec.columns(result->model_->label_col_idx());
+    const int num_classes =
+        label_spec.categorical().number_of_unique_values() - 1;
+    for (int class_idx = 1; class_idx <= num_classes; class_idx++) {
+      result->class_names_.push_back(
+          ydf::dataset::CategoricalIdxToRepresentation(label_spec, class_idx));
+    }
+    result->decompact_probability_ = num_dims == 1;
+    result->output_dim_ = result->decompact_probability_ ? 2 : num_dims;
+    if (result->output_dim_ != num_classes) {
+      return errors::Internal("Unexpected number of prediction dimensions: ",
+                              num_dims, " for ", num_classes, " classes");
+    }
+  } else {
+    result->output_dim_ = num_dims;
+  }
+
+  // Measured and model-based estimates of the footprint of the servable. The
+  // measure also counts the memory allocated meanwhile by the other servables
+  // loading, so the larger estimate is conservative.
+  uint64 resident_bytes_after_load = 0;
+  if (measure_load &&
+      GetProcessResidentMemory(&resident_bytes_after_load).ok() &&
+      resident_bytes_after_load > resident_bytes_before_load) {
+    result->ram_bytes_ = resident_bytes_after_load - resident_bytes_before_load;
+  }
+  const uint64 model_ram_bytes =
+      NumTreeNodes(*result->model_) * kRamBytesPerTreeNode +
+      data_spec.SpaceUsedLong();
+  VLOG(1) << "Loaded the model at " << model_path << ", using "
+          << result->ram_bytes_ << " bytes of resident memory for an estimate"
+          << " of " << model_ram_bytes << " bytes";
+  result->ram_bytes_ = std::max(result->ram_bytes_, model_ram_bytes);
+
+  if (config.num_inference_threads() > 0) {
+    ThreadOptions thread_options;
+    thread_options.numa_node = result->numa_node_;
+    result->inference_threads_.reset(new thread::ThreadPool(
+        Env::Default(), thread_options, "tfdf_inference",
+        config.num_inference_threads(), /*low_latency_hint=*/true));
+  }
+
+  if (!config.warmup_batch_sizes().empty()) {
+    result->WarmUp({config.warmup_batch_sizes().begin(),
+                    config.warmup_batch_sizes().end()});
+  }
+
+  *servable = std::move(result);
+  return Status::OK();
+}
+
+TfdfServable::~TfdfServable() {
+  // Waits for the engine to be done.
+  inference_threads_.reset();
+  NumaPlacement::Get()->Remove(numa_node_, placed_ram_bytes_);
+}
+
+Status TfdfServable::Predict(const PredictRequest& request,
+                             PredictResponse* response) const {
+  // Parse the input tensors.
+  absl::flat_hash_map<string, Tensor> inputs;
+  int num_examples = -1;
+  for (const auto& input : request.inputs()) {
+    if (inputs_.find(input.first) == inputs_.end()) {
+      return errors::InvalidArgument("Unknown input \"", input.first,
+                                     "\". The model inputs are the features",
+                                     " used by the model.");
+    }
+    Tensor& tensor = inputs[input.first];
+    if (!tensor.FromProto(input.second)) {
+      return errors::InvalidArgument("Cannot parse the input \"", input.first,
+                                     "\"");
+    }
+    int input_num_examples;
+    TF_RETURN_IF_ERROR(
+        GetNumExamples(input.first, tensor, &input_num_examples));
+    if (num_examples != -1 && input_num_examples != num_examples) {
+      return errors::InvalidArgument(
+          "All the inputs should have the same batch size. Input \"",
+          input.first, "\" has ", input_num_examples, " examples instead of ",
+          num_examples);
+    }
+    num_examples = input_num_examples;
+  }
+  if (num_examples == -1) {
+    return errors::InvalidArgument("The request does not contain any input");
+  }
+
+  const string& model_name = request.model_spec().name();
+  ExampleSet example_set = AcquireExamples(num_examples);
+  AbstractExampleSet* examples = example_set.examples.get();
+  const auto& features = engine_->features();
+  const auto& data_spec = model_->data_spec();
+
+  // Note: The example set is filled with missing values.
+  {
+    ScopedRequestStageLatency stage_latency(set_examples_stage, model_name);
+    std::vector<float> numerical_values;
+    for (int feature_idx = 0; feature_idx < numerical_features_.size();
+         feature_idx++) {
+      const auto& feature = numerical_features_[feature_idx];
+      const auto it = inputs.find(feature.name);
+      if (it == inputs.end()) {
+        continue;
+      }
+      TF_RETURN_IF_ERROR(
+          GetNumericalValues(feature.name, it->second, &numerical_values));
+      const float replacement = numerical_replacements_[feature_idx];
+      if (std::isnan(replacement)) {
+        for (int example_idx = 0; example_idx < num_examples; example_idx++) {
+          const float value = numerical_values[example_idx];
+          if (!std::isnan(value)) {
+            examples->SetNumerical(example_idx, feature.id, value, features);
+          }
+        }
+        continue;
+      }
+      // Every value is staged, the missing ones replaced with a select.
+      for (int example_idx = 0; example_idx < num_examples; example_idx++) {
+        const float value = numerical_values[example_idx];
+        examples->SetNumerical(example_idx, feature.id,
+                               std::isnan(value) ? replacement : value,
+                               features);
+      }
+    }
+
+    std::vector<int> categorical_values;
+    for (int feature_idx = 0; feature_idx < categorical_features_.size();
+         feature_idx++) {
+      const auto& feature = categorical_features_[feature_idx];
+      const auto it = inputs.find(feature.name);
+      if (it == inputs.end()) {
+        continue;
+      }
+      TF_RETURN_IF_ERROR(GetCategoricalValues(
+          feature.name, it->second, data_spec.columns(feature.spec_idx),
+          &categorical_values));
+      const int replacement = categorical_replacements_[feature_idx];
+      if (replacement == -1) {
+        for (int example_idx = 0; example_idx < num_examples; example_idx++) {
+          const int value = categorical_values[example_idx];
+          if (value != -1) {
+            examples->SetCategorical(example_idx, feature.id, value, features);
+          }
+        }
+        continue;
+      }
+      for (int example_idx = 0; example_idx < num_examples; example_idx++) {
+        const int value = categorical_values[example_idx];
+        examples->SetCategorical(example_idx, feature.id,
+                                 value == -1 ? replacement : value, features);
+      }
+    }
+  }
+
+  std::vector<float> predictions;
+  {
+    ScopedRequestStageLatency stage_latency(run_engine_stage, model_name);
+    RunEngine(*examples, num_examples, &predictions);
+  }
+  ReleaseExamples(std::move(example_set));
+
+  Tensor output(DT_FLOAT, TensorShape({num_examples, output_dim_}));
+  std::copy(predictions.begin(), predictions.end(),
+            output.flat<float>().data());
+  output.AsProtoTensorContent(
+      &(*response->mutable_outputs())[kPredictionsOutput]);
+  return Status::OK();
+}
+
+Status TfdfServable::Classify(const ClassificationRequest& request,
+                              ClassificationResponse* response) const {
+  if (class_names_.empty()) {
+    return errors::FailedPrecondition(
+        "Classify is only supported for classification models");
+  }
+  ExampleSet example_set;
+  int num_examples;
+  TF_RETURN_IF_ERROR(DecodeInput(request.input(), &example_set, &num_examples));
+  std::vector<float> predictions;
+  RunEngine(*example_set.examples, num_examples, &predictions);
+  ReleaseExamples(std::move(example_set));
+
+  ClassificationResult* result = response->mutable_result();
+  std::vector<int> class_indices;
+  for (int example_idx = 0; example_idx < num_examples; example_idx++) {
+    const float* scores = &predictions[example_idx * output_dim_];
+    TF_RETURN_IF_ERROR(SelectClassificationClasses(
+        request, scores, output_dim_, &class_indices));
+    Classifications* classifications = result->add_classifications();
+    for (const int class_idx : class_indices) {
+      Class* output_class = classifications->add_classes();
+      output_class->set_label(class_names_[class_idx]);
+      output_class->set_score(scores[class_idx]);
+    }
+  }
+  return Status::OK();
+}
+
+Status TfdfServable::Regress(const RegressionRequest& request,
+                             RegressionResponse* response) const {
+  if (!class_names_.empty() || output_dim_ != 1) {
+    return errors::FailedPrecondition(
+        "Regress is only supported for models with a single prediction "
+        "dimension, e.g. regression models");
+  }
+  ExampleSet example_set;
+  int num_examples;
+  TF_RETURN_IF_ERROR(DecodeInput(request.input(), &example_set, &num_examples));
+  std::vector<float> predictions;
+  RunEngine(*example_set.examples, num_examples, &predictions);
+  ReleaseExamples(std::move(example_set));
+
+  RegressionResult* result = response->mutable_result();
+  for (int example_idx = 0; example_idx < num_examples; example_idx++) {
+    result->add_regressions()->set_value(predictions[example_idx]);
+  }
+  return Status::OK();
+}
+
+Status TfdfServable::DecodeInput(const Input& input, ExampleSet* example_set,
+                                 int* num_examples) const {
+  const Features* context = nullptr;
+  const google::protobuf::RepeatedPtrField<Example>* entries;
+  switch (input.kind_case()) {
+    case Input::KindCase::kExampleList:
+      entries = &input.example_list().examples();
+      break;
+    case Input::KindCase::kExampleListWithContext:
+      entries = &input.example_list_with_context().examples();
+      context = &input.example_list_with_context().context().features();
+      break;
+    default:
+      return errors::InvalidArgument("Input is empty.");
+  }
+  if (entries->empty()) {
+    return errors::InvalidArgument("Input is empty.");
+  }
+  *num_examples = entries->size();
+
+  *example_set = AcquireExamples(*num_examples);
+  for (int example_idx = 0; example_idx < *num_examples; example_idx++) {
+    Status status;
+    // Note: The features of the example override those of the context.
+    if (context != nullptr) {
+      status = SetExampleFeatures(*context, example_idx,
+                                  example_set->examples.get());
+    }
+    if (status.ok()) {
+      status = SetExampleFeatures(entries->Get(example_idx).features(),
+                                  example_idx, example_set->examples.get());
+    }
+    if (!status.ok()) {
+      ReleaseExamples(std::move(*example_set));
+      return status;
+    }
+  }
+  return Status::OK();
+}
+
+Status TfdfServable::SetExampleFeatures(const Features& features,
+                                        const int example_idx,
+                                        AbstractExampleSet* examples) const {
+  const auto& engine_features = engine_->features();
+  for (const auto& entry : features.feature()) {
+    const auto ref = features_by_name_.find(entry.first);
+    if (ref == features_by_name_.end()) {
+      continue;
+    }
+    const ExampleFeature& value = entry.second;
+    int num_values = 0;
+    switch (value.kind_case()) {
+      case ExampleFeature::kFloatList:
+        num_values = value.float_list().value_size();
+        break;
+      case ExampleFeature::kInt64List:
+        num_values = value.int64_list().value_size();
+        break;
+      case ExampleFeature::kBytesList:
+        num_values = value.bytes_list().value_size();
+        break;
+      default:
+        break;
+    }
+    if (num_values > 1) {
+      return errors::InvalidArgument("The feature \"", entry.first,
+                                     "\" should have at most one value. Got ",
+                                     num_values);
+    }
+
+    if (ref->second.numerical) {
+      const auto& feature = numerical_features_[ref->second.index];
+      float numerical_value = std::numeric_limits<float>::quiet_NaN();
+      if (num_values == 1) {
+        if (value.kind_case() == ExampleFeature::kFloatList) {
+          numerical_value = value.float_list().value(0);
+        } else if (value.kind_case() == ExampleFeature::kInt64List) {
+          numerical_value = value.int64_list().value(0);
+        } else {
+          return errors::InvalidArgument(
+              "The numerical feature \"", entry.first,
+              "\" should be a float_list or an int64_list");
+        }
+      }
+      if (std::isnan(numerical_value)) {
+        numerical_value = numerical_replacements_[ref->second.index];
+      }
+      if (std::isnan(numerical_value)) {
+        examples->SetMissingNumerical(example_idx, feature.id,
+                                      engine_features);
+      } else {
+        examples->SetNumerical(example_idx, feature.id, numerical_value,
+                               engine_features);
+      }
+    } else {
+      const auto& feature = categorical_features_[ref->second.index];
+      const auto& column_spec = model_->data_spec().columns(feature.spec_idx);
+      int categorical_value = -1;
+      if (num_values == 1) {
+        if (value.kind_case() == ExampleFeature::kBytesList) {
+          const string& bytes = value.bytes_list().value(0);
+          if (!bytes.empty()) {
+            categorical_value =
+                ydf::dataset::CategoricalStringToValue(bytes, column_spec);
+          }
+        } else if (value.kind_case() == ExampleFeature::kInt64List) {
+          categorical_value =
+              IntegerCategoricalValue(value.int64_list().value(0), column_spec);
+        } else {
+          return errors::InvalidArgument(
+              "The categorical feature \"", entry.first,
+              "\" should be a bytes_list or an int64_list");
+        }
+      }
+      if (categorical_value == -1) {
+        categorical_value = categorical_replacements_[ref->second.index];
+      }
+      if (categorical_value == -1) {
+        examples->SetMissingCategorical(example_idx, feature.id,
+                                        engine_features);
+      } else {
+        examples->SetCategorical(example_idx, feature.id, categorical_value,
+                                 engine_features);
+      }
+    }
+  }
+  return Status::OK();
+}
+
+void TfdfServable::RunEngine(const AbstractExampleSet& examples,
+                             const int num_examples,
+                             std::vector<float>* predictions) const {
+  if (inference_threads_ != nullptr) {
+    Notification done;
+    inference_threads_->Schedule([&]() {
+      engine_->Predict(examples, num_examples, predictions);
+      done.Notify();
+    });
+    done.WaitForNotification();
+  } else {
+    engine_->Predict(examples, num_examples, predictions);
+  }
+  if (decompact_probability_) {
+    // The engine outputs the probability of the positive class only.
+    predictions->resize(num_examples * 2);
+    for (int example_idx = num_examples - 1; example_idx >= 0; example_idx--) {
+      const float proba =
+          std::min(std::max((*predictions)[example_idx], 0.f), 1.f);
+      (*predictions)[example_idx * 2] = 1.f - proba;
+      (*predictions)[example_idx * 2 + 1] = proba;
+    }
+  }
+}
+
+TfdfServable::ExampleSet TfdfServable::AcquireExamples(
+    const int num_examples) const {
+  ExampleSet example_set;
+  {
+    mutex_lock lock(examples_mutex_);
+    for (auto it = free_examples_.begin(); it != free_examples_.end(); ++it) {
+      if (it->capacity >= num_examples) {
+        example_set = std::move(*it);
+        free_examples_.erase(it);
+        break;
+      }
+    }
+  }
+  if (example_set.examples == nullptr) {
+    example_set.examples = engine_->AllocateExamples(num_examples);
+    example_set.capacity = num_examples;
+  }
+  example_set.examples->FillMissing(engine_->features());
+  return example_set;
+}
+
+void TfdfServable::ReleaseExamples(ExampleSet example_set) const {
+  mutex_lock lock(examples_mutex_);
+  if (free_examples_.size() < kMaxNumCachedExampleSets) {
+    free_examples_.push_back(std::move(example_set));
+  }
+}
+
+std::vector<int> TfdfServable::cached_example_set_capacities() const {
+  std::vector<int> capacities;
+  {
+    mutex_lock lock(examples_mutex_);
+    for (const ExampleSet& example_set : free_examples_) {
+      capacities.push_back(example_set.capacity);
+    }
+  }
+  std::sort(capacities.begin(), capacities.end());
+  return capacities;
+}
+
+void TfdfServable::WarmUp(const std::vector<int>& batch_sizes) const {
+  // All the example sets are acquired before any is released, so that each
+  // batch size gets its own.
+  std::vector<ExampleSet> example_sets;
+  std::vector<float> predictions;
+  for (const int batch_size : batch_sizes) {
+    if (batch_size <= 0) {
+      continue;
+    }
+    example_sets.push_back(AcquireExamples(batch_size));
+    RunEngine(*example_sets.back().examples, batch_size, &predictions);
+  }
+  for (ExampleSet& example_set : example_sets) {
+    ReleaseExamples(std::move(example_set));
+  }
+}
+
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,219 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_SERVABLES_TFDF_TFDF_SERVABLE_H_
+#define TENSORFLOW_SERVING_SERVABLES_TFDF_TFDF_SERVABLE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "tensorflow/core/example/feature.pb.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/numa.h"
+#include "tensorflow/core/protobuf/meta_graph.pb.h"
+#include "tensorflow_serving/apis/classification.pb.h"
+#include "tensorflow_serving/apis/input.pb.h"
+#include "tensorflow_serving/apis/predict.pb.h"
+#include "tensorflow_serving/apis/regression.pb.h"
+#include "tensorflow_serving/servables/tfdf/tfdf_source_adapter.pb.h"
+#include "yggdrasil_decision_forests/model/abstract_model.h"
+#include "yggdrasil_decision_forests/serving/example_set.h"
+#include "yggdrasil_decision_forests/serving/fast_engine.h"
+
+namespace tensorflow {
+namespace serving {
+
+// A TensorFlow Decision Forests (i.e. Yggdrasil) model served without
+// TensorFlow graph.
+//
+// The request inputs are mapped by name onto the input features of the model,
+// and the model is evaluated with the Yggdrasil fast engine. Each input tensor
+// contains the values of one feature, and is of shape [batch] or [batch, 1]:
+//   - Numerical features: Float, double, integer or boolean tensor.
+//   - Categorical features: String tensor. Integer tensors are also accepted,
+//     and converted to their string representation unless the feature is
+//     already integerized.
+// Features missing from the request, NaN numerical values and empty categorical
+// values are treated as missing values. They can be replaced by their imputed
+// values when staged, see TfdfSourceAdapterConfig::replace_missing_values.
+//
+// The predictions are returned in the "predictions" output tensor of shape
+// [batch, output_dim]. For classification models, the columns are the
+// probabilities of the classes (excluding the out-of-vocabulary class).
+// For other models, output_dim is 1.
+//
+// Classify and Regress requests are served by decoding the tf.Examples of the
+// request straight into the engine inputs, without ParseExample. Each feature
+// of an Example holds at most one value: a float_list or int64_list value for
+// numerical features, and a bytes_list or int64_list value for categorical
+// features. The features of the context apply to all the examples, unless
+// overridden by the example.
+//
+// This class is thread safe.
+class TfdfServable {
+ public:
+  // Name of the output tensor.
+  static constexpr char kPredictionsOutput[] = "predictions";
+
+  // Loads the Yggdrasil model located at "path" (or in the
+  // "config.model_subdirectory" directory of "path").
+  static Status Create(const TfdfSourceAdapterConfig& config,
+                       const string& path,
+                       std::unique_ptr<TfdfServable>* servable);
+
+  ~TfdfServable();
+
+  // Description of the inputs expected by "Predict", e.g. to parse JSON
+  // requests.
+  const google::protobuf::Map<string, TensorInfo>& inputs() const {
+    return inputs_;
+  }
+
+  Status Predict(const PredictRequest& request,
+                 PredictResponse* response) const;
+
+  // Only for classification models. The classes are labeled with the values
+  // of the label column, and scored with their probabilities.
+  Status Classify(const ClassificationRequest& request,
+                  ClassificationResponse* response) const;
+
+  // Only for models with a single prediction dimension, e.g. regression.
+  Status Regress(const RegressionRequest& request,
+                 RegressionResponse* response) const;
+
+  // Estimated RAM used by the loaded model: the larger of the growth of the
+  // resident memory of the process during the load, and of the number of
+  // nodes of the trees times an estimated node size.
+  uint64 ram_bytes() const { return ram_bytes_; }
+
+  // The NUMA node the model is placed on (see NumaPlacement), or
+  // port::kNUMANoAffinity.
+  int numa_node() const { return numa_node_; }
+
+  // The number of features whose missing values are replaced when staged (see
+  // TfdfSourceAdapterConfig::replace_missing_values).
+  int num_replaced_features() const { return num_replaced_features_; }
+
+  // The capacities of the example sets kept for re-use in between calls, in
+  // increasing order, e.g. the warmup batch sizes after the load (see
+  // TfdfSourceAdapterConfig::warmup_batch_sizes).
+  std::vector<int> cached_example_set_capacities() const;
+
+ private:
+  using AbstractExampleSet =
+      yggdrasil_decision_forests::serving::AbstractExampleSet;
+  using FeaturesDefinition =
+      yggdrasil_decision_forests::serving::FeaturesDefinition;
+
+  // Maximum number of example sets kept for re-use in between calls.
+  static constexpr int kMaxNumCachedExampleSets = 32;
+
+  TfdfServable() = default;
+
+  // An example set and its capacity.
+  struct ExampleSet {
+    std::unique_ptr<AbstractExampleSet> examples;
+    int capacity;
+  };
+
+  // Returns an example set with at least "num_examples" examples, with all the
+  // values missing.
+  ExampleSet AcquireExamples(int num_examples) const;
+
+  // Returns an example set obtained with "AcquireExamples" for re-use.
+  void ReleaseExamples(ExampleSet examples) const;
+
+  // Runs the engine on an example set of each of "batch_sizes", and keeps
+  // them for re-use.
+  void WarmUp(const std::vector<int>& batch_sizes) const;
+
+  // Decodes the examples of "input" into an example set obtained with
+  // "AcquireExamples".
+  Status DecodeInput(const Input& input, ExampleSet* example_set,
+                     int* num_examples) const;
+
+  // Sets the features of the "example_idx"-th example of "examples" from
+  // "features". The features not used by the model are ignored.
+  Status SetExampleFeatures(const Features& features, int example_idx,
+                            AbstractExampleSet* examples) const;
+
+  // Evaluates the first "num_examples" examples of "examples", and returns
+  // their predictions as a row-major [num_examples, output_dim_] matrix.
+  void RunEngine(const AbstractExampleSet& examples, int num_examples,
+                 std::vector<float>* predictions) const;
+
+  // An input feature of the model.
+  template <typename ExampleSetFeatureId>
+  struct Feature {
+    string name;
+    // Index of the column in the dataspec.
+    int spec_idx;
+    ExampleSetFeatureId id;
+  };
+
+  std::unique_ptr<yggdrasil_decision_forests::model::AbstractModel> model_;
+  std::unique_ptr<yggdrasil_decision_forests::serving::FastEngine> engine_;
+  // If set, the engine runs on these threads, bound to 'numa_node_'.
+  std::unique_ptr<thread::ThreadPool> inference_threads_;
+
+  std::vector<Feature<FeaturesDefinition::NumericalFeatureId>>
+      numerical_features_;
+  std::vector<Feature<FeaturesDefinition::CategoricalFeatureId>>
+      categorical_features_;
+
+  // Index of the input features in "numerical_features_" or
+  // "categorical_features_", by name.
+  struct FeatureRef {
+    bool numerical;
+    int index;
+  };
+  absl::flat_hash_map<string, FeatureRef> features_by_name_;
+
+  // The value staged in place of the missing values of each feature (see
+  // TfdfSourceAdapterConfig::replace_missing_values), aligned with
+  // "numerical_features_" and "categorical_features_". NaN, or -1, if the
+  // missing values of the feature are left to the engine.
+  std::vector<float> numerical_replacements_;
+  std::vector<int> categorical_replacements_;
+  int num_replaced_features_ = 0;
+
+  google::protobuf::Map<string, TensorInfo> inputs_;
+
+  // If true, the engine outputs the probability "p" of the positive class, and
+  // the servable returns [1-p, p].
+  bool decompact_probability_ = false;
+  int output_dim_ = 1;
+  uint64 ram_bytes_ = 0;
+  int numa_node_ = port::kNUMANoAffinity;
+  // The memory the model is placed with on 'numa_node_'.
+  uint64 placed_ram_bytes_ = 0;
+  // For classification models, the label of each class.
+  std::vector<string> class_names_;
+
+  mutable mutex examples_mutex_;
+  mutable std::vector<ExampleSet> free_examples_ TF_GUARDED_BY(examples_mutex_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(TfdfServable);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_SERVABLES_TFDF_TFDF_SERVABLE_H_
@@ -0,0 +1,305 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/servables/tfdf/tfdf_servable.h"
+
+#include <cmath>
+#include <memory>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "tensorflow/core/example/example.pb.h"
+#include "tensorflow/core/example/feature.pb.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/numa.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow_serving/core/loader.h"
+#include "tensorflow_serving/core/servable_data.h"
+#include "tensorflow_serving/resources/resources.pb.h"
+#include "tensorflow_serving/servables/tensorflow/util.h"
+#include "tensorflow_serving/servables/tfdf/tfdf_source_adapter.h"
+#include "tensorflow_serving/util/any_ptr.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+string TestModelPath() {
+  return io::JoinPath(getenv("TEST_SRCDIR"),
+                      "tf_serving/external/ydf/yggdrasil_decision_forests/"
+                      "test_data/model/adult_binary_class_gbdt");
+}
+
+void AddInput(const string& name, const Tensor& tensor,
+              PredictRequest* request) {
+  tensor.AsProtoTensorContent(&(*request->mutable_inputs())[name]);
+}
+
+TEST(TfdfServableTest, Inputs) {
+  std::unique_ptr<TfdfServable> servable;
+  TF_ASSERT_OK(TfdfServable::Create({}, TestModelPath(), &servable));
+  ASSERT_EQ(servable->inputs().count("age"), 1);
+  EXPECT_EQ(servable->inputs().at("age").dtype(), DT_FLOAT);
+  ASSERT_EQ(servable->inputs().count("workclass"), 1);
+  EXPECT_EQ(servable->inputs().at("workclass").dtype(), DT_STRING);
+}
+
+TEST(TfdfServableTest, Predict) {
+  std::unique_ptr<TfdfServable> servable;
+  TF_ASSERT_OK(TfdfServable::Create({}, TestModelPath(), &servable));
+
+  PredictRequest request;
+  AddInput("age", test::AsTensor<float>({39.f, 52.f}), &request);
+  AddInput("workclass", test::AsTensor<tstring>({"State-gov", "Self-emp-inc"}),
+           &request);
+  // Integer values are accepted for numerical features.
+  AddInput("hours_per_week", test::AsTensor<int64>({40, 60}), &request);
+
+  PredictResponse response;
+  TF_ASSERT_OK(servable->Predict(request, &response));
+  ASSERT_EQ(response.outputs().count(TfdfServable::kPredictionsOutput), 1);
+  Tensor predictions;
+  ASSERT_TRUE(predictions.FromProto(
+      response.outputs().at(TfdfServable::kPredictionsOutput)));
+  ASSERT_EQ(predictions.shape(), TensorShape({2, 2}));
+  const auto values = predictions.matrix<float>();
+  for (int example_idx = 0; example_idx < 2; example_idx++) {
+    EXPECT_NEAR(values(example_idx, 0) + values(example_idx, 1), 1.f, 1e-5f);
+  }
+
+  // The example sets are re-used in between calls.
+  PredictResponse second_response;
+  TF_ASSERT_OK(servable->Predict(request, &second_response));
+  Tensor second_predictions;
+  ASSERT_TRUE(second_predictions.FromProto(
+      second_response.outputs().at(TfdfServable::kPredictionsOutput)));
+  test::ExpectTensorEqual<float>(predictions, second_predictions);
+}
+
+TEST(TfdfServableTest, PredictOnInferenceThreads) {
+  std::unique_ptr<TfdfServable> servable;
+  TF_ASSERT_OK(TfdfServable::Create({}, TestModelPath(), &servable));
+  TfdfSourceAdapterConfig config;
+  config.set_num_inference_threads(2);
+  std::unique_ptr<TfdfServable> threaded_servable;
+  TF_ASSERT_OK(
+      TfdfServable::Create(config, TestModelPath(), &threaded_servable));
+  // Without NUMA-aware placement, the model is on no particular node.
+  EXPECT_EQ(threaded_servable->numa_node(), port::kNUMANoAffinity);
+
+  PredictRequest request;
+  AddInput("age", test::AsTensor<float>({39.f, 52.f}), &request);
+  AddInput("hours_per_week", test::AsTensor<float>({40.f, 60.f}), &request);
+  PredictResponse response;
+  TF_ASSERT_OK(servable->Predict(request, &response));
+  PredictResponse threaded_response;
+  TF_ASSERT_OK(threaded_servable->Predict(request, &threaded_response));
+  Tensor predictions;
+  ASSERT_TRUE(predictions.FromProto(
+      response.outputs().at(TfdfServable::kPredictionsOutput)));
+  Tensor threaded_predictions;
+  ASSERT_TRUE(threaded_predictions.FromProto(
+      threaded_response.outputs().at(TfdfServable::kPredictionsOutput)));
+  test::ExpectTensorEqual<float>(predictions, threaded_predictions);
+}
+
+TEST(TfdfServableTest, WarmUp) {
+  TfdfSourceAdapterConfig config;
+  config.add_warmup_batch_sizes(1);
+  config.add_warmup_batch_sizes(8);
+  std::unique_ptr<TfdfServable> servable;
+  TF_ASSERT_OK(TfdfServable::Create(config, TestModelPath(), &servable));
+  // The load allocated an example set of each size.
+  EXPECT_THAT(servable->cached_example_set_capacities(), ElementsAre(1, 8));
+
+  // The warmed up example sets serve the requests.
+  PredictRequest request;
+  AddInput("age", test::AsTensor<float>({39.f, 52.f}), &request);
+  PredictResponse response;
+  TF_ASSERT_OK(servable->Predict(request, &response));
+  Tensor predictions;
+  ASSERT_TRUE(predictions.FromProto(
+      response.outputs().at(TfdfServable::kPredictionsOutput)));
+  EXPECT_EQ(predictions.shape(), TensorShape({2, 2}));
+  EXPECT_THAT(servable->cached_example_set_capacities(), ElementsAre(1, 8));
+
+  // Without warmup, nothing is allocated at load.
+  TF_ASSERT_OK(TfdfServable::Create({}, TestModelPath(), &servable));
+  EXPECT_THAT(servable->cached_example_set_capacities(), IsEmpty());
+}
+
+TEST(TfdfServableTest, ReplaceMissingValues) {
+  std::unique_ptr<TfdfServable> servable;
+  TF_ASSERT_OK(TfdfServable::Create({}, TestModelPath(), &servable));
+  TfdfSourceAdapterConfig config;
+  config.set_replace_missing_values(true);
+  std::unique_ptr<TfdfServable> replacing_servable;
+  TF_ASSERT_OK(
+      TfdfServable::Create(config, TestModelPath(), &replacing_servable));
+  EXPECT_EQ(servable->num_replaced_features(), 0);
+  EXPECT_GT(replacing_servable->num_replaced_features(), 0);
+
+  // Missing numerical and categorical values, and missing features.
+  PredictRequest request;
+  AddInput("age", test::AsTensor<float>({39.f, NAN, NAN}), &request);
+  AddInput("workclass", test::AsTensor<tstring>({"", "State-gov", ""}),
+           &request);
+  PredictResponse response;
+  TF_ASSERT_OK(servable->Predict(request, &response));
+  PredictResponse replacing_response;
+  TF_ASSERT_OK(replacing_servable->Predict(request, &replacing_response));
+  Tensor predictions;
+  ASSERT_TRUE(predictions.FromProto(
+      response.outputs().at(TfdfServable::kPredictionsOutput)));
+  Tensor replacing_predictions;
+  ASSERT_TRUE(replacing_predictions.FromProto(
+      replacing_response.outputs().at(TfdfServable::kPredictionsOutput)));
+  test::ExpectTensorNear<float>(predictions, replacing_predictions, 1e-6);
+}
+
+void AddFeature(const string& name, const float value, Features* features) {
+  (*features->mutable_feature())[name].mutable_float_list()->add_value(value);
+}
+
+void AddFeature(const string& name, const string& value, Features* features) {
+  (*features->mutable_feature())[name].mutable_bytes_list()->add_value(value);
+}
+
+TEST(TfdfServableTest, Classify) {
+  std::unique_ptr<TfdfServable> servable;
+  TF_ASSERT_OK(TfdfServable::Create({}, TestModelPath(), &servable));
+
+  // Same examples as in the Predict test, the second one partly in the context.
+  ClassificationRequest request;
+  auto* input = request.mutable_input()->mutable_example_list_with_context();
+  Features* context = input->mutable_context()->mutable_features();
+  AddFeature("workclass", "Self-emp-inc", context);
+  AddFeature("hours_per_week", 60.f, context);
+  Features* first = input->add_examples()->mutable_features();
+  AddFeature("age", 39.f, first);
+  AddFeature("workclass", "State-gov", first);
+  (*first->mutable_feature())["hours_per_week"].mutable_int64_list()->add_value(
+      40);
+  AddFeature("age", 52.f, input->add_examples()->mutable_features());
+
+  ClassificationResponse response;
+  TF_ASSERT_OK(servable->Classify(request, &response));
+  ASSERT_EQ(response.result().classifications_size(), 2);
+
+  PredictRequest predict_request;
+  AddInput("age", test::AsTensor<float>({39.f, 52.f}), &predict_request);
+  AddInput("workclass", test::AsTensor<tstring>({"State-gov", "Self-emp-inc"}),
+           &predict_request);
+  AddInput("hours_per_week", test::AsTensor<int64>({40, 60}),
+           &predict_request);
+  PredictResponse predict_response;
+  TF_ASSERT_OK(servable->Predict(predict_request, &predict_response));
+  Tensor predictions;
+  ASSERT_TRUE(predictions.FromProto(
+      predict_response.outputs().at(TfdfServable::kPredictionsOutput)));
+  const auto values = predictions.matrix<float>();
+  for (int example_idx = 0; example_idx < 2; example_idx++) {
+    const auto& classes =
+        response.result().classifications(example_idx).classes();
+    ASSERT_EQ(classes.size(), 2);
+    EXPECT_EQ(classes[0].label(), "<=50K");
+    EXPECT_EQ(classes[1].label(), ">50K");
+    EXPECT_FLOAT_EQ(classes[0].score(), values(example_idx, 0));
+    EXPECT_FLOAT_EQ(classes[1].score(), values(example_idx, 1));
+  }
+
+  // Regress is not supported on classification models.
+  RegressionRequest regression_request;
+  *regression_request.mutable_input() = request.input();
+  RegressionResponse regression_response;
+  EXPECT_FALSE(
+      servable->Regress(regression_request, &regression_response).ok());
+}
+
+TEST(TfdfServableTest, ClassifyErrors) {
+  std::unique_ptr<TfdfServable> servable;
+  TF_ASSERT_OK(TfdfServable::Create({}, TestModelPath(), &servable));
+  ClassificationResponse response;
+
+  ClassificationRequest empty_request;
+  EXPECT_FALSE(servable->Classify(empty_request, &response).ok());
+
+  ClassificationRequest multi_value_request;
+  Features* features = multi_value_request.mutable_input()
+                           ->mutable_example_list()
+                           ->add_examples()
+                           ->mutable_features();
+  AddFeature("age", 39.f, features);
+  AddFeature("age", 52.f, features);
+  EXPECT_FALSE(servable->Classify(multi_value_request, &response).ok());
+
+  ClassificationRequest wrong_type_request;
+  AddFeature("age", "39", wrong_type_request.mutable_input()
+                              ->mutable_example_list()
+                              ->add_examples()
+                              ->mutable_features());
+  EXPECT_FALSE(servable->Classify(wrong_type_request, &response).ok());
+}
+
+TEST(TfdfServableTest, PredictErrors) {
+  std::unique_ptr<TfdfServable> servable;
+  TF_ASSERT_OK(TfdfServable::Create({}, TestModelPath(), &servable));
+  PredictResponse response;
+
+  PredictRequest empty_request;
+  EXPECT_FALSE(servable->Predict(empty_request, &response).ok());
+
+  PredictRequest unknown_input_request;
+  AddInput("unknown", test::AsTensor<float>({1.f}), &unknown_input_request);
+  EXPECT_FALSE(servable->Predict(unknown_input_request, &response).ok());
+
+  PredictRequest batch_size_mismatch_request;
+  AddInput("age", test::AsTensor<float>({39.f, 52.f}),
+           &batch_size_mismatch_request);
+  AddInput("hours_per_week", test::AsTensor<float>({40.f}),
+           &batch_size_mismatch_request);
+  EXPECT_FALSE(servable->Predict(batch_size_mismatch_request, &response).ok());
+}
+
+TEST(TfdfSourceAdapterTest, Basic) {
+  auto adapter = std::unique_ptr<TfdfSourceAdapter>(
+      new TfdfSourceAdapter(TfdfSourceAdapterConfig()));
+  ServableData<std::unique_ptr<Loader>> loader_data =
+      adapter->AdaptOneVersion({{"", 0}, TestModelPath()});
+  TF_ASSERT_OK(loader_data.status());
+  std::unique_ptr<Loader> loader = loader_data.ConsumeDataOrDie();
+
+  TF_ASSERT_OK(loader->Load());
+  const TfdfServable* servable = loader->servable().get<TfdfServable>();
+  ASSERT_NE(servable, nullptr);
+  EXPECT_GT(servable->inputs().size(), 0);
+
+  // Once loaded, the estimate is the measured footprint, lower or higher.
+  EXPECT_GT(servable->ram_bytes(), 0);
+  ResourceAllocation loaded_estimate;
+  TF_ASSERT_OK(loader->EstimateResources(&loaded_estimate));
+  EXPECT_EQ(GetRamResourceEstimate(loaded_estimate), servable->ram_bytes());
+  loader->Unload();
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
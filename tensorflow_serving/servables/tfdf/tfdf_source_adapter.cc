@@ -0,0 +1,70 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/servables/tfdf/tfdf_source_adapter.h"
+
+#include <memory>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/numa.h"
+#include "tensorflow_serving/servables/tensorflow/bundle_factory_util.h"
+#include "tensorflow_serving/servables/tensorflow/util.h"
+
+namespace tensorflow {
+namespace serving {
+
+TfdfSourceAdapter::TfdfSourceAdapter(const TfdfSourceAdapterConfig& config)
+    : SimpleLoaderSourceAdapter<StoragePath, TfdfServable>(
+          [config](const StoragePath& path,
+                   std::unique_ptr<TfdfServable>* servable) {
+            return TfdfServable::Create(config, path, servable);
+          },
+          [](const StoragePath& path, ResourceAllocation* estimate) {
+            return EstimateResourceFromPath(
+                path, /*use_validation_result=*/false, estimate);
+          },
+          [](const StoragePath& path, const TfdfServable& servable,
+             ResourceAllocation* estimate) {
+            // The measured footprint, even above the disk-based estimate: an
+            // under-estimate is corrected once the model is loaded.
+            TF_RETURN_IF_ERROR(EstimateResourceFromPath(
+                path, /*use_validation_result=*/false, estimate));
+            if (servable.ram_bytes() > 0) {
+              SetRamResourceEstimate(servable.ram_bytes(), estimate);
+            }
+            if (servable.numa_node() != port::kNUMANoAffinity) {
+              BindRamResourceEstimate(servable.numa_node(), estimate);
+            }
+            return Status::OK();
+          }) {}
+
+TfdfSourceAdapter::~TfdfSourceAdapter() { Detach(); }
+
+// Register the source adapter.
+class TfdfSourceAdapterCreator {
+ public:
+  static Status Create(
+      const TfdfSourceAdapterConfig& config,
+      std::unique_ptr<SourceAdapter<StoragePath, std::unique_ptr<Loader>>>*
+          adapter) {
+    adapter->reset(new TfdfSourceAdapter(config));
+    return Status::OK();
+  }
+};
+REGISTER_STORAGE_PATH_SOURCE_ADAPTER(TfdfSourceAdapterCreator,
+                                     TfdfSourceAdapterConfig);
+
+}  // namespace serving
+}  // namespace tensorflow
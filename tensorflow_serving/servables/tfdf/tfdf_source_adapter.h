@@ -0,0 +1,53 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_SERVABLES_TFDF_TFDF_SOURCE_ADAPTER_H_
+#define TENSORFLOW_SERVING_SERVABLES_TFDF_TFDF_SOURCE_ADAPTER_H_
+
+#include "tensorflow_serving/core/simple_loader.h"
+#include "tensorflow_serving/core/source_adapter.h"
+#include "tensorflow_serving/core/storage_path.h"
+#include "tensorflow_serving/servables/tfdf/tfdf_servable.h"
+#include "tensorflow_serving/servables/tfdf/tfdf_source_adapter.pb.h"
+
+namespace tensorflow {
+namespace serving {
+
+// A SourceAdapter for TensorFlow Decision Forests models served without
+// TensorFlow graph. It takes storage paths of Yggdrasil model directories and
+// produces loaders for TfdfServables.
+//
+// The adapter is registered for the TfdfSourceAdapterConfig config, and can be
+// used in the platform config map for the "tfdf" platform (see
+// kTfdfModelPlatform).
+//
+// The resources of the models are estimated from their size on disk until
+// they are loaded, and from their measured footprint (see
+// TfdfServable::ram_bytes()) once loaded, including when the latter is
+// larger.
+class TfdfSourceAdapter final
+    : public SimpleLoaderSourceAdapter<StoragePath, TfdfServable> {
+ public:
+  explicit TfdfSourceAdapter(const TfdfSourceAdapterConfig& config);
+  ~TfdfSourceAdapter() override;
+
+ private:
+  TF_DISALLOW_COPY_AND_ASSIGN(TfdfSourceAdapter);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_SERVABLES_TFDF_TFDF_SOURCE_ADAPTER_H_
@@ -16,6 +16,7 @@ limitations under the License.
 #include "tensorflow_serving/sources/storage_path/file_system_storage_path_source.h"
 
 #include <functional>
+#include <map>
 #include <string>
 #include <unordered_set>
 #include <vector>
@@ -23,6 +24,9 @@ limitations under the License.
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/io/path.h"
 #include "tensorflow/core/lib/strings/numbers.h"
+#include "tensorflow/core/platform/blocking_counter.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/protobuf.h"
 #include "tensorflow_serving/core/servable_data.h"
 #include "tensorflow_serving/core/servable_id.h"
 
@@ -30,6 +34,10 @@ namespace tensorflow {
 namespace serving {
 
 FileSystemStoragePathSource::~FileSystemStoragePathSource() {
+  if (watcher_ != nullptr) {
+    stopping_ = true;
+    watcher_->Wake();
+  }
   // Note: Deletion of 'fs_polling_thread_' will block until our underlying
   // thread closure stops. Hence, destruction of this object will not proceed
   // until the thread has terminated.
@@ -209,25 +217,62 @@ bool AspireSpecificVersions(
   return !aspired_versions.empty();
 }
 
+// The listers registered with RegisterChildrenLister(), by URI scheme.
+struct ChildrenListers {
+  mutex mu;
+  std::map<string, FileSystemStoragePathSource::ChildrenLister> by_scheme
+      TF_GUARDED_BY(mu);
+};
+
+ChildrenListers* GetChildrenListers() {
+  static ChildrenListers* const listers = new ChildrenListers;
+  return listers;
+}
+
+// Returns the lister registered for the scheme of 'base_path', or null.
+FileSystemStoragePathSource::ChildrenLister GetChildrenLister(
+    const string& base_path) {
+  StringPiece scheme, host, path;
+  io::ParseURI(base_path, &scheme, &host, &path);
+  ChildrenListers* const listers = GetChildrenListers();
+  mutex_lock l(listers->mu);
+  const auto it = listers->by_scheme.find(string(scheme));
+  if (it == listers->by_scheme.end()) {
+    return nullptr;
+  }
+  return it->second;
+}
+
 // Like PollFileSystemForConfig(), but for a single servable.
 Status PollFileSystemForServable(
     const FileSystemStoragePathSourceConfig::ServableToMonitor& servable,
     std::vector<ServableData<StoragePath>>* versions) {
-  // First, determine whether the base path exists. This check guarantees that
-  // we don't emit an empty aspired-versions list for a non-existent (or
-  // transiently unavailable) base-path. (On some platforms, GetChildren()
-  // returns an empty list instead of erring if the base path isn't found.)
-  Status status = Env::Default()->FileExists(servable.base_path());
-  if (!status.ok()) {
-    return errors::InvalidArgument(
-        "Could not find base path ", servable.base_path(), " for servable ",
-        servable.servable_name(), " with error ", status.ToString());
-  }
-
   // Retrieve a list of base-path children from the file system.
   std::vector<string> children;
-  TF_RETURN_IF_ERROR(
-      Env::Default()->GetChildren(servable.base_path(), &children));
+  const FileSystemStoragePathSource::ChildrenLister lister =
+      GetChildrenLister(servable.base_path());
+  if (lister) {
+    Status status = lister(servable.base_path(), &children);
+    if (!status.ok()) {
+      return errors::InvalidArgument(
+          "Could not list base path ", servable.base_path(), " for servable ",
+          servable.servable_name(), " with error ", status.ToString());
+    }
+  } else {
+    // First, determine whether the base path exists. This check guarantees
+    // that we don't emit an empty aspired-versions list for a non-existent (or
+    // transiently unavailable) base-path. (On some platforms, GetChildren()
+    // returns an empty list instead of erring if the base path isn't found.)
+    Status status = Env::Default()->FileExists(servable.base_path());
+    if (!status.ok()) {
+      return errors::InvalidArgument(
+          "Could not find base path ", servable.base_path(), " for servable ",
+          servable.servable_name(), " with error ", status.ToString());
+    }
+
+    TF_RETURN_IF_ERROR(
+        Env::Default()->GetChildren(servable.base_path(), &children));
+  }
 
   // GetChildren() returns all descendants instead for cloud storage like GCS.
   // In such case we should filter out all non-direct descendants.
@@ -276,28 +321,52 @@ Status PollFileSystemForServable(
 
 // Polls the file system, and populates 'versions_by_servable_name' with the
 // aspired-versions data FileSystemStoragePathSource should emit based on what
-// was found, indexed by servable name.
+// was found, indexed by servable name. The servables are polled in parallel on
+// 'polling_threads', if not null.
 Status PollFileSystemForConfig(
     const FileSystemStoragePathSourceConfig& config,
+    thread::ThreadPool* const polling_threads,
     std::map<string, std::vector<ServableData<StoragePath>>>*
         versions_by_servable_name) {
-  for (const FileSystemStoragePathSourceConfig::ServableToMonitor& servable :
-       config.servables()) {
-    std::vector<ServableData<StoragePath>> versions;
-    TF_RETURN_IF_ERROR(PollFileSystemForServable(servable, &versions));
+  const int num_servables = config.servables_size();
+  std::vector<std::vector<ServableData<StoragePath>>> versions(num_servables);
+  std::vector<Status> statuses(num_servables);
+  if (polling_threads != nullptr && num_servables > 1) {
+    BlockingCounter num_pending_polls(num_servables);
+    for (int i = 0; i < num_servables; ++i) {
+      polling_threads->Schedule([&, i]() {
+        statuses[i] =
+            PollFileSystemForServable(config.servables(i), &versions[i]);
+        num_pending_polls.DecrementCount();
+      });
+    }
+    num_pending_polls.Wait();
+  } else {
+    for (int i = 0; i < num_servables; ++i) {
+      statuses[i] =
+          PollFileSystemForServable(config.servables(i), &versions[i]);
+      if (!statuses[i].ok()) {
+        break;
+      }
+    }
+  }
+  // As when polling one by one, the first error is returned.
+  for (int i = 0; i < num_servables; ++i) {
+    TF_RETURN_IF_ERROR(statuses[i]);
     versions_by_servable_name->insert(
-        {servable.servable_name(), std::move(versions)});
+        {config.servables(i).servable_name(), std::move(versions[i])});
   }
   return Status::OK();
 }
 
 // Determines if, for any servables in 'config', the file system doesn't
 // currently contain at least one version under its base path.
-Status FailIfZeroVersions(const FileSystemStoragePathSourceConfig& config) {
+Status FailIfZeroVersions(const FileSystemStoragePathSourceConfig& config,
+                          thread::ThreadPool* const polling_threads) {
   std::map<string, std::vector<ServableData<StoragePath>>>
       versions_by_servable_name;
-  TF_RETURN_IF_ERROR(
-      PollFileSystemForConfig(config, &versions_by_servable_name));
+  TF_RETURN_IF_ERROR(PollFileSystemForConfig(config, polling_threads,
+                                             &versions_by_servable_name));
   for (const auto& entry : versions_by_servable_name) {
     const string& servable = entry.first;
     const std::vector<ServableData<StoragePath>>& versions = entry.second;
@@ -310,8 +379,39 @@ Status FailIfZeroVersions(const FileSystemStoragePathSourceConfig& config) {
   return Status::OK();
 }
 
+// Returns a copy of 'new_config' with only the servables that are not
+// identically configured in 'old_config'.
+FileSystemStoragePathSourceConfig GetChangedServables(
+    const FileSystemStoragePathSourceConfig& old_config,
+    const FileSystemStoragePathSourceConfig& new_config) {
+  std::set<string> old_servables;
+  for (const auto& servable : old_config.servables()) {
+    string serialized_servable;
+    if (SerializeToStringDeterministic(servable, &serialized_servable)) {
+      old_servables.insert(std::move(serialized_servable));
+    }
+  }
+  FileSystemStoragePathSourceConfig changed_config = new_config;
+  changed_config.clear_servables();
+  for (const auto& servable : new_config.servables()) {
+    string serialized_servable;
+    if (!SerializeToStringDeterministic(servable, &serialized_servable) ||
+        old_servables.count(serialized_servable) == 0) {
+      *changed_config.add_servables() = servable;
+    }
+  }
+  return changed_config;
+}
+
 }  // namespace
 
+void FileSystemStoragePathSource::RegisterChildrenLister(
+    const string& scheme, ChildrenLister lister) {
+  ChildrenListers* const listers = GetChildrenListers();
+  mutex_lock l(listers->mu);
+  listers->by_scheme[scheme] = std::move(lister);
+}
+
 Status FileSystemStoragePathSource::Create(
     const FileSystemStoragePathSourceConfig& config,
     std::unique_ptr<FileSystemStoragePathSource>* result) {
@@ -333,9 +433,23 @@ Status FileSystemStoragePathSource::UpdateConfig(
   const FileSystemStoragePathSourceConfig normalized_config =
       NormalizeConfig(config);
 
+  const int num_polling_threads = normalized_config.num_polling_threads();
+  if (num_polling_threads <= 1) {
+    polling_threads_.reset();
+  } else if (polling_threads_ == nullptr ||
+             polling_threads_->NumThreads() != num_polling_threads) {
+    polling_threads_.reset(new thread::ThreadPool(
+        Env::Default(), "FileSystemStoragePathSource_polling",
+        num_polling_threads));
+  }
+
   if (normalized_config.fail_if_zero_versions_at_startup() ||  // NOLINT
       normalized_config.servable_versions_always_present()) {
-    TF_RETURN_IF_ERROR(FailIfZeroVersions(normalized_config));
+    // Servables that are configured as before were checked already, so are not
+    // polled again each time another servable is added.
+    TF_RETURN_IF_ERROR(
+        FailIfZeroVersions(GetChangedServables(config_, normalized_config),
+                           polling_threads_.get()));
   }
 
   if (aspired_versions_callback_) {
@@ -368,6 +482,11 @@ void FileSystemStoragePathSource::SetAspiredVersionsCallback(
     }
   };
 
+  if (config_.file_system_poll_wait_seconds() > 0 &&
+      config_.watch_file_system()) {
+    watcher_ = FileSystemWatcher::Create();
+  }
+
   if (config_.file_system_poll_wait_seconds() == 0) {
     // Start a thread to poll filesystem once and call the callback.
     fs_polling_thread_.reset(new FileSystemStoragePathSource::ThreadType(
@@ -376,6 +495,15 @@ void FileSystemStoragePathSource::SetAspiredVersionsCallback(
             ThreadOptions(),
             "FileSystemStoragePathSource_filesystem_oneshot_thread",
             thread_fn)));
+  } else if (watcher_ != nullptr) {
+    // Start a thread to poll the filesystem on changes and periodically, and
+    // call the callback.
+    fs_polling_thread_.reset(new FileSystemStoragePathSource::ThreadType(
+        absl::in_place_type_t<std::unique_ptr<Thread>>(),
+        Env::Default()->StartThread(
+            ThreadOptions(),
+            "FileSystemStoragePathSource_filesystem_watching_thread",
+            [this, thread_fn]() { WatchFileSystem(thread_fn); })));
   } else if (config_.file_system_poll_wait_seconds() > 0) {
     // Start a thread to poll the filesystem periodically and call the callback.
     PeriodicFunction::Options pf_options;
@@ -391,8 +519,8 @@ Status FileSystemStoragePathSource::PollFileSystemAndInvokeCallback() {
   mutex_lock l(mu_);
   std::map<string, std::vector<ServableData<StoragePath>>>
       versions_by_servable_name;
-  TF_RETURN_IF_ERROR(
-      PollFileSystemForConfig(config_, &versions_by_servable_name));
+  TF_RETURN_IF_ERROR(PollFileSystemForConfig(config_, polling_threads_.get(),
+                                             &versions_by_servable_name));
   for (const auto& entry : versions_by_servable_name) {
     const string& servable = entry.first;
     const std::vector<ServableData<StoragePath>>& versions = entry.second;
@@ -414,6 +542,30 @@ Status FileSystemStoragePathSource::PollFileSystemAndInvokeCallback() {
   return Status::OK();
 }
 
+void FileSystemStoragePathSource::WatchFileSystem(
+    const std::function<void()>& poll_fn) {
+  // Lets a burst of changes settle before polling, e.g. a version directory
+  // being replaced.
+  constexpr int64 kSettleMicros = 100 * 1000;
+  const int64 poll_wait_micros =
+      config().file_system_poll_wait_seconds() * 1000 * 1000;
+  while (!stopping_) {
+    // Watching the base paths before polling them ensures that no change made
+    // after the poll is missed.
+    const FileSystemStoragePathSourceConfig current_config = config();
+    std::set<string> base_paths;
+    for (const auto& servable : current_config.servables()) {
+      base_paths.insert(servable.base_path());
+    }
+    watcher_->SetWatchedDirectories(base_paths);
+    poll_fn();
+    if (watcher_->WaitForChange(poll_wait_micros)) {
+      while (!stopping_ && watcher_->WaitForChange(kSettleMicros)) {
+      }
+    }
+  }
+}
+
 Status FileSystemStoragePathSource::UnaspireServables(
     const std::set<string>& servable_names) {
   for (const string& servable_name : servable_names) {
@@ -16,19 +16,23 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_SOURCES_STORAGE_PATH_FILE_SYSTEM_STORAGE_PATH_SOURCE_H_
 #define TENSORFLOW_SERVING_SOURCES_STORAGE_PATH_FILE_SYSTEM_STORAGE_PATH_SOURCE_H_
 
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <utility>
+#include <vector>
 
 #include "absl/types/variant.h"
 #include "tensorflow/core/kernels/batching_util/periodic_function.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/threadpool.h"
 #include "tensorflow/core/platform/types.h"
 #include "tensorflow_serving/config/file_system_storage_path_source.pb.h"
 #include "tensorflow_serving/core/source.h"
 #include "tensorflow_serving/core/storage_path.h"
+#include "tensorflow_serving/util/file_system_watcher.h"
 
 namespace tensorflow {
 namespace serving {
@@ -46,7 +50,8 @@ namespace serving {
 /// base-path children whose name is a number (e.g. 123) and emits the path
 /// corresponding to the largest number as the servable's single aspired
 /// version. (To do the file-system monitoring, it uses a background thread that
-/// polls the file system periodically.)
+/// polls the file system periodically, and, if configured, as soon as versions
+/// are moved into or out of local base paths.)
 ///
 /// For example, if a configured servable's base path is /foo/bar, and a file-
 /// system poll reveals child paths /foo/bar/baz, /foo/bar/123 and /foo/bar/456,
@@ -65,6 +70,19 @@ class FileSystemStoragePathSource : public Source<StoragePath> {
                        std::unique_ptr<FileSystemStoragePathSource>* result);
   ~FileSystemStoragePathSource() override;
 
+  /// Lists the names of the immediate children of 'directory', or returns an
+  /// error if it does not exist.
+  using ChildrenLister = std::function<Status(const string& directory,
+                                              std::vector<string>* children)>;
+
+  /// Makes base paths with the URI scheme 'scheme' (e.g. "gs") be listed with
+  /// 'lister' instead of Env::GetChildren(), e.g. to list only the version
+  /// directories with a delimiter-based listing on file systems whose
+  /// GetChildren() returns all descendants. Replaces any lister previously
+  /// registered for 'scheme'.
+  static void RegisterChildrenLister(const string& scheme,
+                                     ChildrenLister lister);
+
   /// Supplies a new config to use. The set of servables to monitor can be
   /// changed at any time (see class comment for more information), but it is
   /// illegal to change the file-system polling period once
@@ -90,6 +108,10 @@ class FileSystemStoragePathSource : public Source<StoragePath> {
   // such child.
   Status PollFileSystemAndInvokeCallback();
 
+  // Runs 'poll_fn' each time 'watcher_' sees a change of the base paths, and
+  // at least every file_system_poll_wait_seconds, until 'stopping_' is set.
+  void WatchFileSystem(const std::function<void()>& poll_fn);
+
   // Sends empty aspired-versions lists for each servable in 'servable_names'.
   Status UnaspireServables(const std::set<string>& servable_names)
       TF_EXCLUSIVE_LOCKS_REQUIRED(mu_);
@@ -114,6 +136,10 @@ class FileSystemStoragePathSource : public Source<StoragePath> {
 
   FileSystemStoragePathSourceConfig config_ TF_GUARDED_BY(mu_);
 
+  // The threads polling the base paths if 'num_polling_threads' is greater
+  // than 1, else null.
+  std::unique_ptr<thread::ThreadPool> polling_threads_ TF_GUARDED_BY(mu_);
+
   AspiredVersionsCallback aspired_versions_callback_ TF_GUARDED_BY(mu_);
 
   std::function<void()> aspired_versions_callback_notifier_ TF_GUARDED_BY(mu_);
@@ -123,6 +149,12 @@ class FileSystemStoragePathSource : public Source<StoragePath> {
       absl::variant<absl::monostate, PeriodicFunction, std::unique_ptr<Thread>>;
   std::unique_ptr<ThreadType> fs_polling_thread_ TF_GUARDED_BY(mu_);
 
+  // Set if file_system_poll_wait_seconds is positive, 'watch_file_system' is
+  // set, and watching is supported. Only used by 'fs_polling_thread_', except
+  // to wake it up once 'stopping_' is set.
+  std::unique_ptr<FileSystemWatcher> watcher_;
+  std::atomic<bool> stopping_{false};
+
   TF_DISALLOW_COPY_AND_ASSIGN(FileSystemStoragePathSource);
 };
 
@@ -20,6 +20,7 @@ limitations under the License.
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
 #include "tensorflow/core/lib/core/stringpiece.h"
 #include "tensorflow/core/lib/io/path.h"
@@ -116,6 +117,42 @@ TEST(FileSystemStoragePathSourceTest, NoVersionsAtStartup) {
   }
 }
 
+TEST(FileSystemStoragePathSourceTest, OnlyChangedServablesNeedVersions) {
+  const string base_path =
+      io::JoinPath(testing::TmpDir(), "OnlyChangedServablesNeedVersions");
+  for (const string& servable : {"a", "b", "c"}) {
+    TF_ASSERT_OK(Env::Default()->RecursivelyCreateDir(
+        io::JoinPath(base_path, servable)));
+  }
+  TF_ASSERT_OK(Env::Default()->CreateDir(io::JoinPath(base_path, "a", "1")));
+  TF_ASSERT_OK(Env::Default()->CreateDir(io::JoinPath(base_path, "b", "1")));
+  auto config = test_util::CreateProto<FileSystemStoragePathSourceConfig>(
+      strings::Printf("servables: { "
+                      "  servable_name: 'a' "
+                      "  base_path: '%s/a' "
+                      "} "
+                      "fail_if_zero_versions_at_startup: true "
+                      // Disable the polling thread.
+                      "file_system_poll_wait_seconds: -1 ",
+                      base_path.c_str()));
+  std::unique_ptr<FileSystemStoragePathSource> source;
+  TF_ASSERT_OK(FileSystemStoragePathSource::Create(config, &source));
+
+  // Servable 'a' is unchanged, so is not checked again.
+  TF_ASSERT_OK(Env::Default()->DeleteDir(io::JoinPath(base_path, "a", "1")));
+  FileSystemStoragePathSourceConfig::ServableToMonitor* servable =
+      config.add_servables();
+  servable->set_servable_name("b");
+  servable->set_base_path(io::JoinPath(base_path, "b"));
+  TF_EXPECT_OK(source->UpdateConfig(config));
+
+  // Servable 'c', which is new, has no versions.
+  servable = config.add_servables();
+  servable->set_servable_name("c");
+  servable->set_base_path(io::JoinPath(base_path, "c"));
+  EXPECT_FALSE(source->UpdateConfig(config).ok());
+}
+
 TEST(FileSystemStoragePathSourceTest, FilesAppearAfterStartup) {
   const string base_path =
       io::JoinPath(testing::TmpDir(), "FilesAppearAfterStartup");
@@ -433,6 +470,43 @@ TEST(FileSystemStoragePathSourceTest, MultipleServables) {
                    .PollFileSystemAndInvokeCallback());
 }
 
+TEST(FileSystemStoragePathSourceTest, ParallelPolling) {
+  FileSystemStoragePathSourceConfig config;
+  config.set_file_system_poll_wait_seconds(-1);  // Disable the polling thread.
+  config.set_num_polling_threads(4);
+  constexpr int kNumServables = 20;
+  for (int i = 0; i < kNumServables; ++i) {
+    const string base_path = io::JoinPath(
+        testing::TmpDir(), strings::StrCat("ParallelPolling_", i));
+    TF_ASSERT_OK(Env::Default()->CreateDir(base_path));
+    TF_ASSERT_OK(Env::Default()->CreateDir(
+        io::JoinPath(base_path, strings::StrCat(i + 1))));
+    auto* servable = config.add_servables();
+    servable->set_servable_name(strings::StrCat("servable_", i));
+    servable->set_base_path(base_path);
+  }
+
+  std::unique_ptr<FileSystemStoragePathSource> source;
+  TF_ASSERT_OK(FileSystemStoragePathSource::Create(config, &source));
+  std::unique_ptr<test_util::MockStoragePathTarget> target(
+      new StrictMock<test_util::MockStoragePathTarget>);
+  ConnectSourceToTarget(source.get(), target.get());
+
+  for (int i = 0; i < kNumServables; ++i) {
+    const string servable_name = strings::StrCat("servable_", i);
+    EXPECT_CALL(*target,
+                SetAspiredVersions(
+                    Eq(servable_name),
+                    ElementsAre(ServableData<StoragePath>(
+                        {servable_name, i + 1},
+                        io::JoinPath(testing::TmpDir(),
+                                     strings::StrCat("ParallelPolling_", i),
+                                     strings::StrCat(i + 1))))));
+  }
+  TF_ASSERT_OK(internal::FileSystemStoragePathSourceTestAccess(source.get())
+                   .PollFileSystemAndInvokeCallback());
+}
+
 TEST(FileSystemStoragePathSourceTest, ChangeSetOfServables) {
   FileSystemStoragePathSourceConfig config;
   config.set_fail_if_zero_versions_at_startup(false);
@@ -779,6 +853,56 @@ TEST(FileSystemStoragePathSourceTest, LastVersionNotRemoved) {
   }
 }
 
+TEST(FileSystemStoragePathSourceTest, RegisteredChildrenLister) {
+  std::vector<string> listed_directories;
+  FileSystemStoragePathSource::RegisterChildrenLister(
+      "listed", [&](const string& directory, std::vector<string>* children) {
+        listed_directories.push_back(directory);
+        if (directory != "listed://bucket/model") {
+          return errors::NotFound(directory);
+        }
+        *children = {"1", "3", "2", "foo"};
+        return Status::OK();
+      });
+  auto config = test_util::CreateProto<FileSystemStoragePathSourceConfig>(
+      "servables: { "
+      "  servable_version_policy { "
+      "    latest { "
+      "      num_versions: 2 "
+      "    } "
+      "  } "
+      "  servable_name: 'test_servable_name' "
+      "  base_path: 'listed://bucket/model' "
+      "} "
+      // Disable the polling thread.
+      "file_system_poll_wait_seconds: -1 ");
+  std::unique_ptr<FileSystemStoragePathSource> source;
+  TF_ASSERT_OK(FileSystemStoragePathSource::Create(config, &source));
+  std::unique_ptr<test_util::MockStoragePathTarget> target(
+      new StrictMock<test_util::MockStoragePathTarget>);
+  ConnectSourceToTarget(source.get(), target.get());
+
+  EXPECT_CALL(
+      *target,
+      SetAspiredVersions(
+          Eq("test_servable_name"),
+          ElementsAre(ServableData<StoragePath>({"test_servable_name", 3},
+                                                "listed://bucket/model/3"),
+                      ServableData<StoragePath>({"test_servable_name", 2},
+                                                "listed://bucket/model/2"))));
+  TF_ASSERT_OK(internal::FileSystemStoragePathSourceTestAccess(source.get())
+                   .PollFileSystemAndInvokeCallback());
+  EXPECT_THAT(listed_directories, ElementsAre("listed://bucket/model"));
+
+  // Listing errors are surfaced, without aspiring zero versions.
+  config.mutable_servables(0)->set_base_path("listed://bucket/missing");
+  TF_ASSERT_OK(source->UpdateConfig(config));
+  EXPECT_FALSE(internal::FileSystemStoragePathSourceTestAccess(source.get())
+                   .PollFileSystemAndInvokeCallback()
+                   .ok());
+  FileSystemStoragePathSource::RegisterChildrenLister("listed", nullptr);
+}
+
 TEST(FileSystemStoragePathSourceTest, PollFilesystemOnlyOnce) {
   const string base_path = io::JoinPath(testing::TmpDir(), "OneShot");
   auto config = test_util::CreateProto<FileSystemStoragePathSourceConfig>(
@@ -815,6 +939,52 @@ TEST(FileSystemStoragePathSourceTest, PollFilesystemOnlyOnce) {
   EXPECT_EQ(notify_count.load(), 1);
 }
 
+#if defined(__linux__)
+
+TEST(FileSystemStoragePathSourceTest, WatchFileSystem) {
+  const string base_path = io::JoinPath(testing::TmpDir(), "Watched");
+  auto config = test_util::CreateProto<FileSystemStoragePathSourceConfig>(
+      strings::Printf("servable_name: 'test_servable_name' "
+                      "base_path: '%s' "
+                      // Long enough for only the watcher to see version 4.
+                      "file_system_poll_wait_seconds: 600 "
+                      "watch_file_system: true ",
+                      base_path.c_str()));
+  TF_ASSERT_OK(Env::Default()->CreateDir(base_path));
+  TF_ASSERT_OK(Env::Default()->CreateDir(io::JoinPath(base_path, "3")));
+  std::unique_ptr<FileSystemStoragePathSource> source;
+  TF_ASSERT_OK(FileSystemStoragePathSource::Create(config, &source));
+  internal::FileSystemStoragePathSourceTestAccess source_test(source.get());
+  std::atomic<int> notify_count(0);
+  source_test.SetAspiredVersionsCallbackNotifier([&]() { notify_count++; });
+  std::unique_ptr<test_util::MockStoragePathTarget> target(
+      new StrictMock<test_util::MockStoragePathTarget>);
+  EXPECT_CALL(*target, SetAspiredVersions(Eq("test_servable_name"),
+                                          ElementsAre(ServableData<StoragePath>(
+                                              {"test_servable_name", 3},
+                                              io::JoinPath(base_path, "3")))));
+  ConnectSourceToTarget(source.get(), target.get());
+  while (notify_count == 0) {
+    Env::Default()->SleepForMicroseconds(1000 /* 1 ms */);
+  }
+
+  // Inject new version, moved into place once complete.
+  EXPECT_CALL(*target, SetAspiredVersions(Eq("test_servable_name"),
+                                          ElementsAre(ServableData<StoragePath>(
+                                              {"test_servable_name", 4},
+                                              io::JoinPath(base_path, "4")))));
+  const string staging_path = io::JoinPath(testing::TmpDir(), "WatchedStaging");
+  TF_ASSERT_OK(Env::Default()->CreateDir(staging_path));
+  TF_ASSERT_OK(Env::Default()->RenameFile(staging_path,
+                                          io::JoinPath(base_path, "4")));
+  while (notify_count == 1) {
+    Env::Default()->SleepForMicroseconds(1000 /* 1 ms */);
+  }
+  EXPECT_EQ(notify_count.load(), 2);
+}
+
+#endif  // defined(__linux__)
+
 }  // namespace
 }  // namespace serving
 }  // namespace tensorflow
@@ -0,0 +1,312 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/cpu_affinity.h"
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <utility>
+
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/string_view.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/mutex.h"
+
+namespace tensorflow {
+namespace serving {
+
+namespace {
+
+#if defined(__linux__)
+// Returns the CPUs the thread 'tid', 0 for the calling thread, is pinned to,
+// or an empty set on errors.
+std::vector<int> GetThreadCpus(const pid_t tid) {
+  std::vector<int> cpus;
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  if (sched_getaffinity(tid, sizeof(cpu_set), &cpu_set) != 0) {
+    if (errno != ESRCH) {
+      LOG(WARNING) << "Cannot get the CPU affinity of the thread: "
+                   << strerror(errno);
+    }
+    return cpus;
+  }
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &cpu_set)) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+// Pins the thread 'tid', 0 for the calling thread, to 'cpus'. Logs a warning
+// on errors, except if the thread has exited.
+void PinThread(const pid_t tid, const std::vector<int>& cpus) {
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (const int cpu : cpus) {
+    CPU_SET(cpu, &cpu_set);
+  }
+  if (sched_setaffinity(tid, sizeof(cpu_set), &cpu_set) != 0 &&
+      errno != ESRCH) {
+    LOG(WARNING) << "Cannot pin the thread: " << strerror(errno);
+  }
+}
+
+// Returns the ids of the threads of the process, sorted, or an empty vector on
+// errors.
+std::vector<int> GetProcessThreadIds() {
+  std::vector<int> tids;
+  DIR* const dir = opendir("/proc/self/task");
+  if (dir == nullptr) {
+    LOG(WARNING) << "Cannot list the threads of the process: "
+                 << strerror(errno);
+    return tids;
+  }
+  while (const struct dirent* const entry = readdir(dir)) {
+    int tid;
+    if (absl::SimpleAtoi(entry->d_name, &tid)) {
+      tids.push_back(tid);
+    }
+  }
+  closedir(dir);
+  std::sort(tids.begin(), tids.end());
+  return tids;
+}
+
+// The bit of CAP_SYS_NICE in the capability sets.
+constexpr int kCapSysNice = 23;
+
+// Returns whether the process has the capability 'capability' in its
+// effective set, per /proc/self/status.
+bool HasEffectiveCapability(const int capability) {
+  std::ifstream status("/proc/self/status");
+  string line;
+  while (std::getline(status, line)) {
+    absl::string_view value = line;
+    if (absl::ConsumePrefix(&value, "CapEff:")) {
+      const uint64 capabilities = std::strtoull(string(value).c_str(), nullptr, 16);
+      return (capabilities >> capability) & 1;
+    }
+  }
+  return false;
+}
+#endif
+
+}  // namespace
+
+Status ValidateCpus(const std::vector<int>& cpus, const string& what) {
+#if defined(__linux__)
+  for (const int cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+      return errors::InvalidArgument("Invalid CPU ", cpu, " for the ", what);
+    }
+  }
+#else
+  if (!cpus.empty()) {
+    return errors::Unimplemented("Pinning the ", what,
+                                 " to CPUs is only supported on Linux");
+  }
+#endif
+  return Status::OK();
+}
+
+void PinCurrentThread(const std::vector<int>& cpus) {
+#if defined(__linux__)
+  PinThread(0, cpus);
+#endif
+}
+
+std::vector<int> GetCurrentThreadCpus() {
+#if defined(__linux__)
+  return GetThreadCpus(0);
+#else
+  return {};
+#endif
+}
+
+PinnedThreadsEnv::PinnedThreadsEnv(Env* target, std::vector<int> cpus)
+    : EnvWrapper(target), cpus_(std::move(cpus)) {}
+
+Thread* PinnedThreadsEnv::StartThread(const ThreadOptions& thread_options,
+                                      const string& name,
+                                      std::function<void()> fn) {
+  const std::vector<int> cpus = cpus_;
+  return EnvWrapper::StartThread(thread_options, name,
+                                 [cpus, fn = std::move(fn)]() {
+                                   PinCurrentThread(cpus);
+                                   fn();
+                                 });
+}
+
+Env* GetPinnedThreadsEnv(const std::vector<int>& cpus) {
+  if (cpus.empty()) {
+    return Env::Default();
+  }
+  static mutex* mu = new mutex();
+  static auto* envs = new std::map<std::vector<int>, std::unique_ptr<Env>>();
+  mutex_lock l(*mu);
+  std::unique_ptr<Env>& env = (*envs)[cpus];
+  if (env == nullptr) {
+    env.reset(new PinnedThreadsEnv(Env::Default(), cpus));
+  }
+  return env.get();
+}
+
+void SetCurrentThreadNiceness(const int niceness) {
+#if defined(__linux__)
+  const id_t tid = static_cast<id_t>(syscall(SYS_gettid));
+  if (setpriority(PRIO_PROCESS, tid, niceness) != 0) {
+    LOG(WARNING) << "Cannot set the niceness of the thread: "
+                 << strerror(errno);
+  }
+#endif
+}
+
+bool CanLowerThreadNiceness(const int niceness) {
+#if defined(__linux__)
+  // RLIMIT_NICE is 20 - the lowest niceness allowed.
+  struct rlimit nice_limit;
+  if (getrlimit(RLIMIT_NICE, &nice_limit) == 0 &&
+      (nice_limit.rlim_cur == RLIM_INFINITY ||
+       20 - static_cast<int64>(nice_limit.rlim_cur) <= niceness)) {
+    return true;
+  }
+  return HasEffectiveCapability(kCapSysNice);
+#else
+  return false;
+#endif
+}
+
+ScopedThreadNiceness::ScopedThreadNiceness(const int niceness) {
+#if defined(__linux__)
+  if (niceness <= 0) {
+    return;
+  }
+  const id_t tid = static_cast<id_t>(syscall(SYS_gettid));
+  errno = 0;
+  const int previous_niceness = getpriority(PRIO_PROCESS, tid);
+  if (errno != 0) {
+    LOG(WARNING) << "Cannot get the niceness of the thread: "
+                 << strerror(errno);
+    return;
+  }
+  if (niceness == previous_niceness) {
+    return;
+  }
+  if (!CanLowerThreadNiceness(previous_niceness)) {
+    LOG_FIRST_N(WARNING, 1)
+        << "Not setting the niceness of the thread to " << niceness
+        << ", since the threads it starts could not get their niceness "
+        << "back without CAP_SYS_NICE or a higher RLIMIT_NICE";
+    return;
+  }
+  previous_thread_ids_ = GetProcessThreadIds();
+  previous_niceness_ = previous_niceness;
+  niceness_ = niceness;
+  SetCurrentThreadNiceness(niceness);
+#endif
+}
+
+ScopedThreadNiceness::~ScopedThreadNiceness() {
+#if defined(__linux__)
+  if (niceness_ == 0) {
+    return;
+  }
+  SetCurrentThreadNiceness(previous_niceness_);
+  // The threads started in the scope, which still have the niceness.
+  for (const int tid : GetProcessThreadIds()) {
+    if (std::binary_search(previous_thread_ids_.begin(),
+                           previous_thread_ids_.end(), tid)) {
+      continue;
+    }
+    errno = 0;
+    if (getpriority(PRIO_PROCESS, tid) == niceness_ && errno == 0 &&
+        setpriority(PRIO_PROCESS, tid, previous_niceness_) != 0 &&
+        errno != ESRCH) {
+      LOG(WARNING) << "Cannot set the niceness of thread " << tid << ": "
+                   << strerror(errno);
+    }
+  }
+#endif
+}
+
+ScopedCpuAffinity::ScopedCpuAffinity(const std::vector<int>& cpus) {
+#if defined(__linux__)
+  if (!cpus.empty()) {
+    previous_cpus_ = GetCurrentThreadCpus();
+    PinCurrentThread(cpus);
+  }
+#endif
+}
+
+ScopedCpuAffinity::~ScopedCpuAffinity() {
+  if (!previous_cpus_.empty()) {
+    PinCurrentThread(previous_cpus_);
+  }
+}
+
+ScopedThreadCpuAffinity::ScopedThreadCpuAffinity(
+    const std::vector<int>& cpus) {
+#if defined(__linux__)
+  if (cpus.empty()) {
+    return;
+  }
+  previous_cpus_ = GetCurrentThreadCpus();
+  if (previous_cpus_.empty()) {
+    return;
+  }
+  cpus_ = cpus;
+  std::sort(cpus_.begin(), cpus_.end());
+  cpus_.erase(std::unique(cpus_.begin(), cpus_.end()), cpus_.end());
+  previous_thread_ids_ = GetProcessThreadIds();
+  PinCurrentThread(cpus_);
+#endif
+}
+
+ScopedThreadCpuAffinity::~ScopedThreadCpuAffinity() {
+#if defined(__linux__)
+  if (previous_cpus_.empty()) {
+    return;
+  }
+  PinCurrentThread(previous_cpus_);
+  // The threads started in the scope, which are still pinned.
+  for (const int tid : GetProcessThreadIds()) {
+    if (!std::binary_search(previous_thread_ids_.begin(),
+                            previous_thread_ids_.end(), tid) &&
+        GetThreadCpus(tid) == cpus_) {
+      PinThread(tid, previous_cpus_);
+    }
+  }
+#endif
+}
+
+}  // namespace serving
+}  // namespace tensorflow
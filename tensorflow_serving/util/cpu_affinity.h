@@ -0,0 +1,140 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_UTIL_CPU_AFFINITY_H_
+#define TENSORFLOW_SERVING_UTIL_CPU_AFFINITY_H_
+
+#include <functional>
+#include <vector>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/macros.h"
+
+// Pinning of threads to sets of CPUs, and lowering of their priority, e.g. to
+// keep the threads loading the models off the CPUs serving the requests. Only
+// supported on Linux.
+
+namespace tensorflow {
+namespace serving {
+
+// Returns an error if 'cpus' are not valid CPUs, or if pinning is not
+// supported and 'cpus' is not empty. 'what' names the pinned threads in the
+// error.
+Status ValidateCpus(const std::vector<int>& cpus, const string& what);
+
+// Pins the calling thread to 'cpus', which must be valid. Logs a warning on
+// errors.
+void PinCurrentThread(const std::vector<int>& cpus);
+
+// Returns the CPUs the calling thread is pinned to, or an empty set on errors
+// and on the other platforms than Linux.
+std::vector<int> GetCurrentThreadCpus();
+
+// An Env whose threads are pinned to a set of CPUs.
+class PinnedThreadsEnv : public EnvWrapper {
+ public:
+  // 'cpus' must be valid.
+  PinnedThreadsEnv(Env* target, std::vector<int> cpus);
+
+  Thread* StartThread(const ThreadOptions& thread_options, const string& name,
+                      std::function<void()> fn) override;
+
+ private:
+  const std::vector<int> cpus_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(PinnedThreadsEnv);
+};
+
+// Returns Env::Default() if 'cpus' is empty, and otherwise a PinnedThreadsEnv
+// wrapping it, which lives as long as the process like Env::Default(). 'cpus'
+// must be valid.
+Env* GetPinnedThreadsEnv(const std::vector<int>& cpus);
+
+// Sets the niceness of the calling thread, e.g. 10 so that the other threads
+// of the process run first when the CPUs are busy. On Linux, the niceness of
+// each thread is its own, and an unprivileged thread cannot lower it back.
+// Does nothing on the other platforms. Logs a warning on errors.
+void SetCurrentThreadNiceness(int niceness);
+
+// Returns whether the calling thread may lower its niceness back to
+// 'niceness', i.e. whether it has CAP_SYS_NICE or a RLIMIT_NICE allowing it.
+// Always false on the other platforms than Linux.
+bool CanLowerThreadNiceness(int niceness);
+
+// Sets the niceness of the calling thread for its scope, e.g. while a load
+// thread loads a model. The threads started meanwhile inherit the niceness,
+// e.g. the thread pools of the model: they get the previous niceness back at
+// the end of the scope, so that they do not keep it afterwards, e.g. while
+// serving. Does nothing if 'niceness' is not positive, or if the niceness
+// cannot be lowered back, see CanLowerThreadNiceness().
+class ScopedThreadNiceness {
+ public:
+  explicit ScopedThreadNiceness(int niceness);
+  ~ScopedThreadNiceness();
+
+ private:
+  // The niceness set, 0 if not set.
+  int niceness_ = 0;
+  // The niceness restored by the destructor.
+  int previous_niceness_ = 0;
+  // The ids of the threads of the process when the niceness was set, sorted.
+  std::vector<int> previous_thread_ids_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ScopedThreadNiceness);
+};
+
+// Pins the calling thread to a set of CPUs for its scope, e.g. so that
+// libraries which start their own threads, which inherit the affinity of the
+// thread starting them, start them on those CPUs. Does nothing if 'cpus' is
+// empty.
+class ScopedCpuAffinity {
+ public:
+  // 'cpus' must be valid.
+  explicit ScopedCpuAffinity(const std::vector<int>& cpus);
+  ~ScopedCpuAffinity();
+
+ private:
+  // The affinity restored by the destructor, empty if not pinned.
+  std::vector<int> previous_cpus_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ScopedCpuAffinity);
+};
+
+// Like ScopedCpuAffinity, except that the threads started in the scope, e.g.
+// the thread pools of a model loaded by the calling thread, get the previous
+// affinity back at its end, so that they do not stay pinned afterwards, e.g.
+// while serving.
+class ScopedThreadCpuAffinity {
+ public:
+  // 'cpus' must be valid.
+  explicit ScopedThreadCpuAffinity(const std::vector<int>& cpus);
+  ~ScopedThreadCpuAffinity();
+
+ private:
+  // The affinity set, and the one restored by the destructor, empty if not
+  // pinned.
+  std::vector<int> cpus_;
+  std::vector<int> previous_cpus_;
+  // The ids of the threads of the process when pinned, sorted.
+  std::vector<int> previous_thread_ids_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ScopedThreadCpuAffinity);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_UTIL_CPU_AFFINITY_H_
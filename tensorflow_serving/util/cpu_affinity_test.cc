@@ -0,0 +1,169 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/cpu_affinity.h"
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <memory>
+
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/notification.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+#if defined(__linux__)
+// Returns whether the calling thread is pinned to CPU 0 only.
+bool PinnedToCpu0() {
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  EXPECT_EQ(sched_getaffinity(0, sizeof(cpu_set), &cpu_set), 0);
+  return CPU_COUNT(&cpu_set) == 1 && CPU_ISSET(0, &cpu_set);
+}
+#endif
+
+TEST(CpuAffinityTest, ValidateCpus) {
+  TF_EXPECT_OK(ValidateCpus({}, "threads"));
+#if defined(__linux__)
+  TF_EXPECT_OK(ValidateCpus({0}, "threads"));
+  EXPECT_FALSE(ValidateCpus({-1}, "threads").ok());
+  EXPECT_FALSE(ValidateCpus({CPU_SETSIZE}, "threads").ok());
+#else
+  EXPECT_FALSE(ValidateCpus({0}, "threads").ok());
+#endif
+}
+
+TEST(CpuAffinityTest, GetPinnedThreadsEnv) {
+  EXPECT_EQ(GetPinnedThreadsEnv({}), Env::Default());
+  Env* env = GetPinnedThreadsEnv({0});
+  EXPECT_NE(env, Env::Default());
+  EXPECT_EQ(GetPinnedThreadsEnv({0}), env);
+}
+
+#if defined(__linux__)
+TEST(CpuAffinityTest, PinnedThreadsEnvPinsItsThreads) {
+  bool pinned = false;
+  std::unique_ptr<Thread> thread(GetPinnedThreadsEnv({0})->StartThread(
+      {}, "pinned", [&pinned]() { pinned = PinnedToCpu0(); }));
+  thread.reset();
+  EXPECT_TRUE(pinned);
+}
+
+TEST(CpuAffinityTest, ScopedCpuAffinity) {
+  const bool initially_pinned = PinnedToCpu0();
+  bool started_thread_pinned = false;
+  {
+    ScopedCpuAffinity affinity({0});
+    EXPECT_TRUE(PinnedToCpu0());
+    // The threads started in the scope inherit the affinity.
+    auto check_pinned = [&started_thread_pinned]() {
+      started_thread_pinned = PinnedToCpu0();
+    };
+    std::unique_ptr<Thread> thread(
+        Env::Default()->StartThread({}, "inherited", check_pinned));
+  }
+  EXPECT_TRUE(started_thread_pinned);
+  EXPECT_EQ(PinnedToCpu0(), initially_pinned);
+}
+
+TEST(CpuAffinityTest, ScopedThreadCpuAffinity) {
+  if (PinnedToCpu0()) {
+    return;
+  }
+  cpu_set_t initial_cpu_set;
+  CPU_ZERO(&initial_cpu_set);
+  ASSERT_EQ(sched_getaffinity(0, sizeof(initial_cpu_set), &initial_cpu_set),
+            0);
+  bool started_thread_pinned = false;
+  pid_t started_thread_id = 0;
+  Notification started_thread_checked;
+  Notification stop_started_thread;
+  std::unique_ptr<Thread> started_thread;
+  {
+    ScopedThreadCpuAffinity affinity({0});
+    EXPECT_TRUE(PinnedToCpu0());
+    // The threads started in the scope inherit the affinity.
+    started_thread.reset(Env::Default()->StartThread({}, "inherited", [&]() {
+      started_thread_pinned = PinnedToCpu0();
+      started_thread_id = syscall(SYS_gettid);
+      started_thread_checked.Notify();
+      stop_started_thread.WaitForNotification();
+    }));
+    started_thread_checked.WaitForNotification();
+  }
+  EXPECT_TRUE(started_thread_pinned);
+  // And get the previous affinity back at the end of the scope.
+  EXPECT_FALSE(PinnedToCpu0());
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  ASSERT_EQ(sched_getaffinity(started_thread_id, sizeof(cpu_set), &cpu_set), 0);
+  EXPECT_TRUE(CPU_EQUAL(&cpu_set, &initial_cpu_set));
+  stop_started_thread.Notify();
+}
+
+int GetCurrentThreadNiceness() {
+  return getpriority(PRIO_PROCESS, syscall(SYS_gettid));
+}
+
+TEST(CpuAffinityTest, ScopedThreadNiceness) {
+  const int initial_niceness = GetCurrentThreadNiceness();
+  if (initial_niceness >= 19 || !CanLowerThreadNiceness(initial_niceness)) {
+    return;
+  }
+  int started_thread_niceness = 0;
+  pid_t started_thread_id = 0;
+  Notification started_thread_checked;
+  Notification stop_started_thread;
+  std::unique_ptr<Thread> started_thread;
+  {
+    ScopedThreadNiceness niceness(19);
+    EXPECT_EQ(GetCurrentThreadNiceness(), 19);
+    // The threads started in the scope inherit the niceness.
+    started_thread.reset(Env::Default()->StartThread({}, "inherited", [&]() {
+      started_thread_niceness = GetCurrentThreadNiceness();
+      started_thread_id = syscall(SYS_gettid);
+      started_thread_checked.Notify();
+      stop_started_thread.WaitForNotification();
+    }));
+    started_thread_checked.WaitForNotification();
+  }
+  EXPECT_EQ(started_thread_niceness, 19);
+  // And get the previous niceness back at the end of the scope.
+  EXPECT_EQ(GetCurrentThreadNiceness(), initial_niceness);
+  EXPECT_EQ(getpriority(PRIO_PROCESS, started_thread_id), initial_niceness);
+  stop_started_thread.Notify();
+}
+
+TEST(CpuAffinityTest, ScopedThreadNicenessNotPositive) {
+  const int initial_niceness = GetCurrentThreadNiceness();
+  {
+    ScopedThreadNiceness niceness(0);
+    EXPECT_EQ(GetCurrentThreadNiceness(), initial_niceness);
+  }
+  EXPECT_EQ(GetCurrentThreadNiceness(), initial_niceness);
+}
+#endif
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
@@ -13,17 +13,18 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
-// TODO(b/25725560): Consider having a thread pool for invoking callbacks.
-
 #ifndef TENSORFLOW_SERVING_UTIL_EVENT_BUS_H_
 #define TENSORFLOW_SERVING_UTIL_EVENT_BUS_H_
 
 #include <algorithm>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "tensorflow/core/lib/core/threadpool.h"
 #include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/macros.h"
 #include "tensorflow/core/platform/mutex.h"
@@ -50,9 +51,16 @@ namespace serving {
 ///
 /// Threading:
 /// EventBus is thread-safe. However, if any subscriber callback calls any
-/// method in the EventBus, it will deadlock. Subscribers are notified serially
-/// on the event publisher's thread. Thus, the amount of work done in a
-/// subscriber's callback should be very minimal.
+/// method in the EventBus, it will deadlock. By default, subscribers are
+/// notified serially on the event publisher's thread. Thus, the amount of work
+/// done in a subscriber's callback should be very minimal.
+///
+/// With Options::num_callback_threads > 0, Publish only queues the event, and
+/// the subscribers are notified on a pool of callback threads owned by the
+/// EventBus, so that a slow subscriber does not stall the publisher. Each
+/// subscriber still receives the events one at a time, in the order they were
+/// published, but different subscribers are notified concurrently and in no
+/// particular order relative to each other.
 ///
 /// This implementation is single-binary and does not communicate across tasks.
 ///
@@ -90,6 +98,11 @@ class EventBus : public std::enable_shared_from_this<EventBus<E>> {
   struct Options {
     // The environment to use for time.
     Env* env = Env::Default();
+
+    // The number of threads notifying the subscribers (see "Threading" above).
+    // If 0, the subscribers are notified synchronously on the publisher's
+    // thread.
+    int num_callback_threads = 0;
   };
 
   /// Creates an EventBus and returns a shared_ptr to it. This is the only
@@ -111,7 +124,9 @@ class EventBus : public std::enable_shared_from_this<EventBus<E>> {
   ///   including subscribing, publishing or unsubscribing. This will cause a
   ///   circular deadlock.
   /// * Callbacks must do very little work as they are invoked on the
-  ///   publisher's thread. Any costly work should be performed asynchronously.
+  ///   publisher's thread or, in the asynchronous mode, delay the next events
+  ///   of the same subscriber. Any costly work should be performed
+  ///   asynchronously.
   using Callback = std::function<void(const EventAndTime&)>;
 
   /// Subscribes to all events on the EventBus.
@@ -130,7 +145,8 @@ class EventBus : public std::enable_shared_from_this<EventBus<E>> {
   std::unique_ptr<Subscription> Subscribe(const Callback& callback)
       TF_LOCKS_EXCLUDED(mutex_) TF_MUST_USE_RESULT;
 
-  /// Publishes an event to all subscribers.
+  /// Publishes an event to all subscribers. In the asynchronous mode, the
+  /// event is copied, and Publish returns without waiting for the callbacks.
   void Publish(const E& event) TF_LOCKS_EXCLUDED(mutex_);
 
  private:
@@ -139,12 +155,34 @@ class EventBus : public std::enable_shared_from_this<EventBus<E>> {
   // Unsubscribes the specified subscriber. Called only by Subscription.
   void Unsubscribe(const Subscription* subscription) TF_LOCKS_EXCLUDED(mutex_);
 
+  // The events queued for a subscriber in the asynchronous mode. At most one
+  // callback thread drains the queue at a time, which keeps the events of the
+  // subscriber in order.
+  struct AsyncQueue {
+    explicit AsyncQueue(Callback callback) : callback(std::move(callback)) {}
+
+    const Callback callback;
+    mutex mu;
+    condition_variable drained;
+    std::deque<std::pair<std::shared_ptr<const E>, uint64>> events
+        TF_GUARDED_BY(mu);
+    // Whether a callback thread is draining the queue.
+    bool draining TF_GUARDED_BY(mu) = false;
+    // Set on unsubscription. No more callbacks are invoked.
+    bool unsubscribed TF_GUARDED_BY(mu) = false;
+  };
+
+  // Invokes the callback of 'queue' on its events, until the queue is empty.
+  static void DrainAsyncQueue(AsyncQueue* queue);
+
   // All of the information needed for a single subscription, both for
   // publishing events and unsubscribing.
   struct SubscriptionTuple {
     // Uniquely identifies the Subscription.
     Subscription* subscription;
     Callback callback;
+    // The event queue of the subscriber, in the asynchronous mode only.
+    std::shared_ptr<AsyncQueue> async_queue;
   };
 
   // Mutex held for all operations on an EventBus including all publishing and
@@ -157,6 +195,10 @@ class EventBus : public std::enable_shared_from_this<EventBus<E>> {
 
   const Options options_;
 
+  // The callback threads of the asynchronous mode. Null in the synchronous
+  // mode.
+  std::unique_ptr<thread::ThreadPool> callback_threads_;
+
   TF_DISALLOW_COPY_AND_ASSIGN(EventBus);
 };
 
@@ -180,12 +222,22 @@ std::unique_ptr<typename EventBus<E>::Subscription> EventBus<E>::Subscribe(
   mutex_lock lock(mutex_);
   std::unique_ptr<Subscription> subscription(
       new Subscription(this->shared_from_this()));
-  subscriptions_.push_back({subscription.get(), callback});
+  std::shared_ptr<AsyncQueue> async_queue;
+  if (callback_threads_ != nullptr) {
+    async_queue = std::make_shared<AsyncQueue>(callback);
+  }
+  subscriptions_.push_back(
+      {subscription.get(), callback, std::move(async_queue)});
   return subscription;
 }
 
 template <typename E>
-EventBus<E>::EventBus(const Options& options) : options_(options) {}
+EventBus<E>::EventBus(const Options& options) : options_(options) {
+  if (options_.num_callback_threads > 0) {
+    callback_threads_.reset(new thread::ThreadPool(
+        options_.env, "event_bus_callbacks", options_.num_callback_threads));
+  }
+}
 
 template <typename E>
 std::shared_ptr<EventBus<E>> EventBus<E>::CreateEventBus(
@@ -196,22 +248,74 @@ std::shared_ptr<EventBus<E>> EventBus<E>::CreateEventBus(
 template <typename E>
 void EventBus<E>::Unsubscribe(
     const typename EventBus<E>::Subscription* subscription) {
-  mutex_lock lock(mutex_);
-  subscriptions_.erase(
-      std::remove_if(subscriptions_.begin(), subscriptions_.end(),
-                     [subscription](SubscriptionTuple s) {
+  std::shared_ptr<AsyncQueue> async_queue;
+  {
+    mutex_lock lock(mutex_);
+    const auto it =
+        std::find_if(subscriptions_.begin(), subscriptions_.end(),
+                     [subscription](const SubscriptionTuple& s) {
                        return s.subscription == subscription;
-                     }),
-      subscriptions_.end());
+                     });
+    if (it == subscriptions_.end()) {
+      return;
+    }
+    async_queue = std::move(it->async_queue);
+    subscriptions_.erase(it);
+  }
+  if (async_queue != nullptr) {
+    // Drops the queued events, and waits for the callback being invoked, if
+    // any.
+    mutex_lock lock(async_queue->mu);
+    async_queue->unsubscribed = true;
+    async_queue->events.clear();
+    while (async_queue->draining) {
+      async_queue->drained.wait(lock);
+    }
+  }
+}
+
+template <typename E>
+void EventBus<E>::DrainAsyncQueue(AsyncQueue* const queue) {
+  while (true) {
+    std::pair<std::shared_ptr<const E>, uint64> event;
+    {
+      mutex_lock lock(queue->mu);
+      if (queue->events.empty() || queue->unsubscribed) {
+        queue->draining = false;
+        queue->drained.notify_all();
+        return;
+      }
+      event = std::move(queue->events.front());
+      queue->events.pop_front();
+    }
+    queue->callback({*event.first, event.second});
+  }
 }
 
 template <typename E>
 void EventBus<E>::Publish(const E& event) {
   mutex_lock lock(mutex_);
   const uint64 event_time = options_.env->NowMicros();
-  const EventAndTime event_and_time = {event, event_time};
+  if (callback_threads_ == nullptr) {
+    const EventAndTime event_and_time = {event, event_time};
+    for (const SubscriptionTuple& subscription : subscriptions_) {
+      subscription.callback(event_and_time);
+    }
+    return;
+  }
+
+  // Note: The event is shared by the queues of all the subscribers.
+  const auto shared_event = std::make_shared<const E>(event);
   for (const SubscriptionTuple& subscription : subscriptions_) {
-    subscription.callback(event_and_time);
+    std::shared_ptr<AsyncQueue> queue = subscription.async_queue;
+    mutex_lock queue_lock(queue->mu);
+    queue->events.emplace_back(shared_event, event_time);
+    if (!queue->draining) {
+      queue->draining = true;
+      // Note: The task keeps the queue alive, but not the EventBus.
+      callback_threads_->Schedule(
+          [queue]() { DrainAsyncQueue(queue.get()); });
+    }
   }
 }
 
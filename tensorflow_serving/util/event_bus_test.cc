@@ -15,8 +15,12 @@ limitations under the License.
 
 #include "tensorflow_serving/util/event_bus.h"
 
+#include <vector>
+
 #include <gtest/gtest.h>
 #include "tensorflow/core/kernels/batching_util/fake_clock_env.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/notification.h"
 
 namespace tensorflow {
 namespace serving {
@@ -125,6 +129,79 @@ TEST(EventBusTest, TestAutomaticUnsubscribing) {
   EXPECT_EQ(3, value_timestamp);
 }
 
+// Tests that each subscriber receives the events in order in the asynchronous
+// mode.
+TEST(EventBusTest, AsyncPublishKeepsTheOrderOfEachSubscriber) {
+  IntEventBus::Options bus_options;
+  bus_options.num_callback_threads = 4;
+  std::shared_ptr<IntEventBus> bus = IntEventBus::CreateEventBus(bus_options);
+
+  constexpr int kNumEvents = 1000;
+  constexpr int kNumSubscribers = 3;
+  mutex mu;
+  std::vector<std::vector<int>> received(kNumSubscribers);
+  Notification all_received[kNumSubscribers];
+  std::vector<std::unique_ptr<IntEventBus::Subscription>> subscriptions;
+  for (int i = 0; i < kNumSubscribers; ++i) {
+    subscriptions.push_back(bus->Subscribe(
+        [&, i](const IntEventBus::EventAndTime& event_and_time) {
+          mutex_lock lock(mu);
+          received[i].push_back(event_and_time.event);
+          if (received[i].size() == kNumEvents) {
+            all_received[i].Notify();
+          }
+        }));
+  }
+  for (int event = 0; event < kNumEvents; ++event) {
+    bus->Publish(event);
+  }
+  for (int i = 0; i < kNumSubscribers; ++i) {
+    all_received[i].WaitForNotification();
+    mutex_lock lock(mu);
+    for (int event = 0; event < kNumEvents; ++event) {
+      ASSERT_EQ(event, received[i][event]);
+    }
+  }
+}
+
+// Tests that a slow subscriber does not block the publisher in the
+// asynchronous mode, and that unsubscribing waits for its callback.
+TEST(EventBusTest, AsyncPublishDoesNotWaitForTheCallbacks) {
+  IntEventBus::Options bus_options;
+  bus_options.num_callback_threads = 1;
+  std::shared_ptr<IntEventBus> bus = IntEventBus::CreateEventBus(bus_options);
+
+  Notification callback_started;
+  Notification unblock_callback;
+  int value = 0;
+  std::unique_ptr<IntEventBus::Subscription> subscription =
+      bus->Subscribe([&](const IntEventBus::EventAndTime& event_and_time) {
+        if (!callback_started.HasBeenNotified()) {
+          callback_started.Notify();
+        }
+        unblock_callback.WaitForNotification();
+        value += event_and_time.event;
+      });
+
+  // Both events are published while the callback of the first one blocks.
+  bus->Publish(1);
+  callback_started.WaitForNotification();
+  bus->Publish(2);
+
+  std::unique_ptr<Thread> unsubscriber(Env::Default()->StartThread(
+      {}, "unsubscriber", [&]() { subscription.reset(); }));
+  unblock_callback.Notify();
+  unsubscriber.reset();
+  // The callback of the first event completed before the unsubscription
+  // returned. The second event was either delivered or dropped.
+  EXPECT_TRUE(value == 1 || value == 3);
+  const int value_after_unsubscription = value;
+
+  bus->Publish(10);
+  bus.reset();
+  EXPECT_EQ(value_after_unsubscription, value);
+}
+
 }  // namespace
 }  // namespace serving
 }  // namespace tensorflow
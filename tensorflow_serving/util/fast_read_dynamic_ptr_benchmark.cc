@@ -54,19 +54,25 @@ namespace tensorflow {
 namespace serving {
 namespace {
 
-using FastReadIntPtr = FastReadDynamicPtr<int>;
+// The read pointer holders to compare: the default per-CPU sharded one, and a
+// single mutex-guarded pointer, on which all the readers contend.
+using ShardedIntReadPtrs = internal_read_ptr_holder::ShardedReadPtrs<int>;
+using SingleIntReadPtr = internal_read_ptr_holder::SingleReadPtr<int>;
 
 // The amount of time to sleep for the cases where we simulate doing work.
 constexpr absl::Duration kWorkSleepTime = absl::Milliseconds(5);
 
 // This class maintains all state for a benchmark and handles the concurrency
-// concerns around the concurrent read and update threads.
+// concerns around the concurrent read and update threads. It is parameterized
+// with the ReadPtrHolder of the benchmarked FastReadDynamicPtr.
 //
 // Example:
-//    BenchmarkState state(0 /* no updates */, false /* Don't do any work */);
+//    BenchmarkState<ShardedIntReadPtrs> state(0 /* no updates */,
+//                                             false /* Don't do any work */);
 //    state.Setup();
 //    state.RunBenchmarkReadIterations(5 /* num_threads */, 42 /* iters */);
 //    state.Teardown();
+template <typename ReadPtrHolder>
 class BenchmarkState {
  public:
   BenchmarkState(const int update_micros, const bool do_work)
@@ -99,8 +105,8 @@ class BenchmarkState {
   // destruct state after it has exited.
   std::unique_ptr<PeriodicFunction> update_thread_;
 
-  // The FastReadIntPtr being benchmarked primarily for read performance.
-  FastReadIntPtr fast_ptr_;
+  // The FastReadDynamicPtr being benchmarked primarily for read performance.
+  FastReadDynamicPtr<int, ReadPtrHolder> fast_ptr_;
 
   // The update interval in microseconds.
   int64 update_micros_;
@@ -110,7 +116,8 @@ class BenchmarkState {
   bool do_work_;
 };
 
-void BenchmarkState::RunUpdateThread() {
+template <typename ReadPtrHolder>
+void BenchmarkState<ReadPtrHolder>::RunUpdateThread() {
   int current_value;
   {
     std::shared_ptr<const int> current = fast_ptr_.get();
@@ -120,7 +127,8 @@ void BenchmarkState::RunUpdateThread() {
   fast_ptr_.Update(std::move(tmp));
 }
 
-void BenchmarkState::Setup() {
+template <typename ReadPtrHolder>
+void BenchmarkState<ReadPtrHolder>::Setup() {
   // setup fast read int ptr:
   std::unique_ptr<int> i(new int(0));
   fast_ptr_.Update(std::move(i));
@@ -134,12 +142,14 @@ void BenchmarkState::Setup() {
   }
 }
 
-void BenchmarkState::Teardown() {
+template <typename ReadPtrHolder>
+void BenchmarkState<ReadPtrHolder>::Teardown() {
   // Destruct the update thread which blocks until it exits.
   update_thread_.reset();
 }
 
-void BenchmarkState::RunBenchmarkReads(int iters) {
+template <typename ReadPtrHolder>
+void BenchmarkState<ReadPtrHolder>::RunBenchmarkReads(int iters) {
   // Wait until all_read_threads_scheduled_ has been notified.
   all_read_threads_scheduled_.WaitForNotification();
 
@@ -153,7 +163,8 @@ void BenchmarkState::RunBenchmarkReads(int iters) {
   }
 }
 
-void BenchmarkState::RunBenchmarkReadIterations(
+template <typename ReadPtrHolder>
+void BenchmarkState<ReadPtrHolder>::RunBenchmarkReadIterations(
     int num_threads, ::testing::benchmark::State& state) {
   CHECK_GE(num_threads, 1) << " ****unexpected thread number";
   // To be compatible with the Google benchmark framework, the tensorflow new
@@ -193,41 +204,53 @@ void BenchmarkState::RunBenchmarkReadIterations(
   testing::ItemsProcessed(num_threads * kSubIters * state.iterations());
 }
 
+template <typename ReadPtrHolder>
 void BenchmarkReadsAndUpdates(int update_micros, bool do_work,
                               ::testing::benchmark::State& state,
                               int num_threads) {
-  BenchmarkState bm_state(update_micros, do_work);
+  BenchmarkState<ReadPtrHolder> bm_state(update_micros, do_work);
   bm_state.Setup();
   bm_state.RunBenchmarkReadIterations(num_threads, state);
   bm_state.Teardown();
 }
 
+template <typename ReadPtrHolder>
 void BM_Work_NoUpdates_Reads(::testing::benchmark::State& state) {
   const int num_threads = state.range(0);
   CHECK_GT(num_threads, 0);
   // No updates. 0 update_micros signals not to update at all.
-  BenchmarkReadsAndUpdates(0, true, state, num_threads);
+  BenchmarkReadsAndUpdates<ReadPtrHolder>(0, true, state, num_threads);
 }
 
+template <typename ReadPtrHolder>
 void BM_Work_FrequentUpdates_Reads(::testing::benchmark::State& state) {
   const int num_threads = state.range(0);
   CHECK_GT(num_threads, 0);
   // Frequent updates: 1000 micros == 1 millisecond or 1000qps of updates
-  BenchmarkReadsAndUpdates(1000, true, state, num_threads);
+  BenchmarkReadsAndUpdates<ReadPtrHolder>(1000, true, state, num_threads);
 }
 
+template <typename ReadPtrHolder>
 void BM_NoWork_NoUpdates_Reads(::testing::benchmark::State& state) {
   const int num_threads = state.range(0);
   CHECK_GT(num_threads, 0);
   // No updates. 0 update_micros signals not to update at all.
-  BenchmarkReadsAndUpdates(0, false, state, num_threads);
+  BenchmarkReadsAndUpdates<ReadPtrHolder>(0, false, state, num_threads);
 }
 
+template <typename ReadPtrHolder>
 void BM_NoWork_FrequentUpdates_Reads(::testing::benchmark::State& state) {
   const int num_threads = state.range(0);
   CHECK_GT(num_threads, 0);
   // Frequent updates: 1000 micros == 1 millisecond or 1000qps of updates
-  BenchmarkReadsAndUpdates(1000, false, state, num_threads);
+  BenchmarkReadsAndUpdates<ReadPtrHolder>(1000, false, state, num_threads);
+}
+
+// Reads from 1 to 64 threads, to show how each ReadPtrHolder scales.
+void ReadThreads(::testing::benchmark::internal::Benchmark* benchmark) {
+  for (int num_threads = 1; num_threads <= 64; num_threads *= 2) {
+    benchmark->Arg(num_threads);
+  }
 }
 
 // The benchmarking system by default uses cpu time to calculate items per
@@ -235,45 +258,37 @@ void BM_NoWork_FrequentUpdates_Reads(::testing::benchmark::State& state) {
 // Instead of that we use real-time here so that we can see items/s increasing
 // with increasing threads, which is easier to understand.
 
-BENCHMARK(BM_Work_NoUpdates_Reads)
+BENCHMARK_TEMPLATE(BM_Work_NoUpdates_Reads, ShardedIntReadPtrs)
+    ->UseRealTime()
+    ->Apply(ReadThreads);
+
+BENCHMARK_TEMPLATE(BM_Work_NoUpdates_Reads, SingleIntReadPtr)
+    ->UseRealTime()
+    ->Apply(ReadThreads);
+
+BENCHMARK_TEMPLATE(BM_Work_FrequentUpdates_Reads, ShardedIntReadPtrs)
     ->UseRealTime()
-    ->Arg(1)
-    ->Arg(2)
-    ->Arg(4)
-    ->Arg(8)
-    ->Arg(16)
-    ->Arg(32)
-    ->Arg(64);
-
-BENCHMARK(BM_Work_FrequentUpdates_Reads)
+    ->Apply(ReadThreads);
+
+BENCHMARK_TEMPLATE(BM_Work_FrequentUpdates_Reads, SingleIntReadPtr)
+    ->UseRealTime()
+    ->Apply(ReadThreads);
+
+BENCHMARK_TEMPLATE(BM_NoWork_NoUpdates_Reads, ShardedIntReadPtrs)
     ->UseRealTime()
-    ->Arg(1)
-    ->Arg(2)
-    ->Arg(4)
-    ->Arg(8)
-    ->Arg(16)
-    ->Arg(32)
-    ->Arg(64);
-
-BENCHMARK(BM_NoWork_NoUpdates_Reads)
+    ->Apply(ReadThreads);
+
+BENCHMARK_TEMPLATE(BM_NoWork_NoUpdates_Reads, SingleIntReadPtr)
     ->UseRealTime()
-    ->Arg(1)
-    ->Arg(2)
-    ->Arg(4)
-    ->Arg(8)
-    ->Arg(16)
-    ->Arg(32)
-    ->Arg(64);
-
-BENCHMARK(BM_NoWork_FrequentUpdates_Reads)
+    ->Apply(ReadThreads);
+
+BENCHMARK_TEMPLATE(BM_NoWork_FrequentUpdates_Reads, ShardedIntReadPtrs)
+    ->UseRealTime()
+    ->Apply(ReadThreads);
+
+BENCHMARK_TEMPLATE(BM_NoWork_FrequentUpdates_Reads, SingleIntReadPtr)
     ->UseRealTime()
-    ->Arg(1)
-    ->Arg(2)
-    ->Arg(4)
-    ->Arg(8)
-    ->Arg(16)
-    ->Arg(32)
-    ->Arg(64);
+    ->Apply(ReadThreads);
 
 }  // namespace
 }  // namespace serving
@@ -0,0 +1,191 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/file_system_watcher.h"
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace tensorflow {
+namespace serving {
+
+#if defined(__linux__)
+
+namespace {
+
+// Returns the path of 'directory' on the local file system, or an empty string
+// if it is on another file system.
+string GetLocalPath(const string& directory) {
+  StringPiece scheme, host, path;
+  io::ParseURI(directory, &scheme, &host, &path);
+  if (!scheme.empty() && scheme != "file") {
+    return "";
+  }
+  return string(path);
+}
+
+}  // namespace
+
+std::unique_ptr<FileSystemWatcher> FileSystemWatcher::Create() {
+  const int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd < 0) {
+    LOG(WARNING) << "Cannot watch the file system, inotify_init1() failed: "
+                 << strerror(errno);
+    return nullptr;
+  }
+  const int wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd < 0) {
+    LOG(WARNING) << "Cannot watch the file system, eventfd() failed: "
+                 << strerror(errno);
+    close(inotify_fd);
+    return nullptr;
+  }
+  return std::unique_ptr<FileSystemWatcher>(
+      new FileSystemWatcher(inotify_fd, wake_fd));
+}
+
+FileSystemWatcher::FileSystemWatcher(const int inotify_fd, const int wake_fd)
+    : inotify_fd_(inotify_fd), wake_fd_(wake_fd) {}
+
+FileSystemWatcher::~FileSystemWatcher() {
+  close(inotify_fd_);
+  close(wake_fd_);
+}
+
+void FileSystemWatcher::SetWatchedDirectories(
+    const std::set<string>& directories) {
+  for (auto it = watches_.begin(); it != watches_.end();) {
+    if (directories.count(it->first) > 0) {
+      ++it;
+      continue;
+    }
+    const int watch = it->second;
+    it = watches_.erase(it);
+    // Several paths may name the same directory, and thus share its watch.
+    if (std::none_of(watches_.begin(), watches_.end(),
+                     [watch](const std::pair<const string, int>& entry) {
+                       return entry.second == watch;
+                     })) {
+      inotify_rm_watch(inotify_fd_, watch);
+    }
+  }
+
+  for (const string& directory : directories) {
+    if (watches_.count(directory) > 0) {
+      continue;
+    }
+    const string path = GetLocalPath(directory);
+    if (path.empty()) {
+      continue;
+    }
+    const int watch = inotify_add_watch(
+        inotify_fd_, path.c_str(),
+        IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF |
+            IN_MOVE_SELF | IN_ONLYDIR);
+    if (watch >= 0) {
+      watches_[directory] = watch;
+    } else {
+      VLOG(1) << "Cannot watch " << directory << ": " << strerror(errno);
+    }
+  }
+}
+
+bool FileSystemWatcher::WaitForChange(const int64 timeout_micros) {
+  struct pollfd fds[2] = {{inotify_fd_, POLLIN, 0}, {wake_fd_, POLLIN, 0}};
+  const int timeout_millis = static_cast<int>(std::min<int64>(
+      std::max<int64>(timeout_micros, 0) / 1000,
+      std::numeric_limits<int>::max()));
+  if (poll(fds, 2, timeout_millis) <= 0) {
+    return false;
+  }
+
+  if (fds[1].revents & POLLIN) {
+    uint64_t count;
+    if (read(wake_fd_, &count, sizeof(count)) < 0) {
+      VLOG(1) << "Cannot read the wake event: " << strerror(errno);
+    }
+  }
+
+  bool changed = false;
+  if (fds[0].revents & POLLIN) {
+    alignas(struct inotify_event) char buffer[4096];
+    ssize_t size;
+    while ((size = read(inotify_fd_, buffer, sizeof(buffer))) > 0) {
+      for (const char* event_ptr = buffer; event_ptr < buffer + size;) {
+        const struct inotify_event* event =
+            reinterpret_cast<const struct inotify_event*>(event_ptr);
+        // The watch was removed, either by SetWatchedDirectories() or along
+        // with its directory, which is then watched again once re-created.
+        if (event->mask & IN_IGNORED) {
+          for (auto it = watches_.begin(); it != watches_.end();) {
+            if (it->second == event->wd) {
+              it = watches_.erase(it);
+            } else {
+              ++it;
+            }
+          }
+        } else {
+          changed = true;
+        }
+        event_ptr += sizeof(struct inotify_event) + event->len;
+      }
+    }
+  }
+  return changed;
+}
+
+void FileSystemWatcher::Wake() {
+  const uint64_t count = 1;
+  if (write(wake_fd_, &count, sizeof(count)) < 0) {
+    LOG(ERROR) << "Cannot wake the file system watcher: " << strerror(errno);
+  }
+}
+
+#else  // defined(__linux__)
+
+std::unique_ptr<FileSystemWatcher> FileSystemWatcher::Create() {
+  return nullptr;
+}
+
+FileSystemWatcher::FileSystemWatcher(const int inotify_fd, const int wake_fd)
+    : inotify_fd_(inotify_fd), wake_fd_(wake_fd) {}
+
+FileSystemWatcher::~FileSystemWatcher() = default;
+
+void FileSystemWatcher::SetWatchedDirectories(
+    const std::set<string>& directories) {}
+
+bool FileSystemWatcher::WaitForChange(const int64 timeout_micros) {
+  return false;
+}
+
+void FileSystemWatcher::Wake() {}
+
+#endif  // defined(__linux__)
+
+}  // namespace serving
+}  // namespace tensorflow
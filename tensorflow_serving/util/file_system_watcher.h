@@ -0,0 +1,72 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_UTIL_FILE_SYSTEM_WATCHER_H_
+#define TENSORFLOW_SERVING_UTIL_FILE_SYSTEM_WATCHER_H_
+
+#include <map>
+#include <memory>
+#include <set>
+
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace serving {
+
+// Watches local directories for children being deleted, or moved in or out,
+// so that pollers of the file system can react to changes without waiting for
+// their next poll. Children being created are not changes: a directory made in
+// place may still be written, while one moved in (e.g. renamed from a staging
+// directory) is complete. Uses inotify, and is only available on Linux.
+//
+// WaitForChange() and SetWatchedDirectories() must be called from a single
+// thread, while Wake() may be called from any thread.
+class FileSystemWatcher {
+ public:
+  // Returns null if watching is not supported on this platform, or if the
+  // watcher cannot be initialized.
+  static std::unique_ptr<FileSystemWatcher> Create();
+
+  ~FileSystemWatcher();
+
+  // Sets the directories to watch. Paths with a scheme other than file://,
+  // e.g. gs://, and directories that do not exist yet are skipped; the latter
+  // are tried again on the next call.
+  void SetWatchedDirectories(const std::set<string>& directories);
+
+  // Blocks until a child of a watched directory changes, Wake() is called, or
+  // 'timeout_micros' elapses. Returns true if a change was seen.
+  bool WaitForChange(int64 timeout_micros);
+
+  // Makes the pending call to WaitForChange(), or the next one, return.
+  void Wake();
+
+ private:
+  FileSystemWatcher(int inotify_fd, int wake_fd);
+
+  const int inotify_fd_;
+  const int wake_fd_;
+
+  // Watch descriptors of the watched directories.
+  std::map<string, int> watches_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(FileSystemWatcher);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_UTIL_FILE_SYSTEM_WATCHER_H_
@@ -0,0 +1,105 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/file_system_watcher.h"
+
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+#if defined(__linux__)
+
+// Timeout for changes that are expected, which are seen right away.
+constexpr int64 kChangeTimeoutMicros = 10 * 1000 * 1000;
+
+TEST(FileSystemWatcherTest, SeesChildrenChanges) {
+  const string base_path = io::JoinPath(testing::TmpDir(), "SeesChildren");
+  TF_ASSERT_OK(Env::Default()->RecursivelyCreateDir(base_path));
+  std::unique_ptr<FileSystemWatcher> watcher = FileSystemWatcher::Create();
+  ASSERT_NE(nullptr, watcher);
+  watcher->SetWatchedDirectories({base_path});
+  EXPECT_FALSE(watcher->WaitForChange(/*timeout_micros=*/1000));
+
+  // Versions created in place may not be complete yet, and changes inside the
+  // versions are not watched.
+  const string version_path = io::JoinPath(base_path, "123");
+  TF_ASSERT_OK(Env::Default()->CreateDir(version_path));
+  TF_ASSERT_OK(WriteStringToFile(
+      Env::Default(), io::JoinPath(version_path, "file"), "contents"));
+  EXPECT_FALSE(watcher->WaitForChange(/*timeout_micros=*/1000));
+
+  TF_ASSERT_OK(Env::Default()->DeleteFile(io::JoinPath(version_path, "file")));
+  TF_ASSERT_OK(Env::Default()->DeleteDir(version_path));
+  EXPECT_TRUE(watcher->WaitForChange(kChangeTimeoutMicros));
+
+  // Versions moved into place are complete.
+  const string staging_path =
+      io::JoinPath(testing::TmpDir(), "SeesChildrenStaging");
+  TF_ASSERT_OK(Env::Default()->CreateDir(staging_path));
+  TF_ASSERT_OK(Env::Default()->RenameFile(staging_path, version_path));
+  EXPECT_TRUE(watcher->WaitForChange(kChangeTimeoutMicros));
+  TF_ASSERT_OK(Env::Default()->DeleteDir(version_path));
+  EXPECT_TRUE(watcher->WaitForChange(kChangeTimeoutMicros));
+
+  // Directories that are no longer set are not watched anymore.
+  watcher->SetWatchedDirectories({});
+  TF_ASSERT_OK(Env::Default()->CreateDir(staging_path));
+  TF_ASSERT_OK(Env::Default()->RenameFile(staging_path, version_path));
+  EXPECT_FALSE(watcher->WaitForChange(/*timeout_micros=*/1000));
+}
+
+TEST(FileSystemWatcherTest, WatchesDirectoriesOnceCreated) {
+  const string base_path = io::JoinPath(testing::TmpDir(), "OnceCreated");
+  std::unique_ptr<FileSystemWatcher> watcher = FileSystemWatcher::Create();
+  ASSERT_NE(nullptr, watcher);
+  // Skipped as they do not exist yet, or are not local.
+  watcher->SetWatchedDirectories({base_path, "gs://bucket/model"});
+  EXPECT_FALSE(watcher->WaitForChange(/*timeout_micros=*/1000));
+
+  TF_ASSERT_OK(Env::Default()->RecursivelyCreateDir(base_path));
+  watcher->SetWatchedDirectories({base_path, "gs://bucket/model"});
+  const string staging_path =
+      io::JoinPath(testing::TmpDir(), "OnceCreatedStaging");
+  TF_ASSERT_OK(Env::Default()->CreateDir(staging_path));
+  TF_ASSERT_OK(Env::Default()->RenameFile(staging_path,
+                                          io::JoinPath(base_path, "1")));
+  EXPECT_TRUE(watcher->WaitForChange(kChangeTimeoutMicros));
+}
+
+TEST(FileSystemWatcherTest, Wake) {
+  std::unique_ptr<FileSystemWatcher> watcher = FileSystemWatcher::Create();
+  ASSERT_NE(nullptr, watcher);
+  watcher->Wake();
+  const uint64 start_micros = Env::Default()->NowMicros();
+  EXPECT_FALSE(watcher->WaitForChange(kChangeTimeoutMicros));
+  EXPECT_LT(Env::Default()->NowMicros() - start_micros, kChangeTimeoutMicros);
+}
+
+#else  // defined(__linux__)
+
+TEST(FileSystemWatcherTest, NotSupported) {
+  EXPECT_EQ(nullptr, FileSystemWatcher::Create());
+}
+
+#endif  // defined(__linux__)
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
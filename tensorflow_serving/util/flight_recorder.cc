@@ -0,0 +1,268 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/flight_recorder.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/escaping.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "tensorflow/core/lib/core/errors.h"
+
+namespace tensorflow {
+namespace serving {
+
+namespace {
+
+std::atomic<FlightRecorder*> process_flight_recorder{nullptr};
+
+std::atomic<uint64> next_flight_recorder_id{1};
+
+// The ring of the current thread in the recorder of 'recorder_id'.
+struct CachedThreadRecords {
+  uint64 recorder_id = 0;
+  void* records = nullptr;
+};
+thread_local CachedThreadRecords cached_thread_records;
+
+thread_local ScopedFlightRecord* current_flight_record = nullptr;
+
+// Returns 'value', or "-" if it is empty.
+absl::string_view OrDash(absl::string_view value) {
+  return value.empty() ? "-" : value;
+}
+
+}  // namespace
+
+const char* const FlightRecorder::kFlightRecorderPath =
+    "/monitoring/flight_recorder";
+
+FlightRecorder* FlightRecorder::Get() {
+  return process_flight_recorder.load(std::memory_order_acquire);
+}
+
+Status FlightRecorder::Start(const Options& options) {
+  auto recorder = absl::make_unique<FlightRecorder>(options);
+  FlightRecorder* expected = nullptr;
+  if (!process_flight_recorder.compare_exchange_strong(
+          expected, recorder.get(), std::memory_order_acq_rel)) {
+    return errors::FailedPrecondition("The flight recorder is already started");
+  }
+  recorder.release();
+  return Status::OK();
+}
+
+FlightRecorder::FlightRecorder(const Options& options)
+    : options_(options), id_(next_flight_recorder_id.fetch_add(1)) {}
+
+bool FlightRecorder::ShouldCapture(const int64 latency_micros) const {
+  return options_.latency_threshold_micros > 0 &&
+         options_.max_captured_requests > 0 &&
+         latency_micros >= options_.latency_threshold_micros;
+}
+
+FlightRecorder::ThreadRecords* FlightRecorder::GetThreadRecords() {
+  if (cached_thread_records.recorder_id == id_) {
+    return static_cast<ThreadRecords*>(cached_thread_records.records);
+  }
+  mutex_lock l(mu_);
+  std::unique_ptr<ThreadRecords>& thread_records =
+      thread_records_[std::this_thread::get_id()];
+  if (thread_records == nullptr) {
+    thread_records = absl::make_unique<ThreadRecords>();
+  }
+  cached_thread_records.recorder_id = id_;
+  cached_thread_records.records = thread_records.get();
+  return thread_records.get();
+}
+
+void FlightRecorder::Add(FlightRecord record) {
+  if (ShouldCapture(record.latency_micros)) {
+    mutex_lock l(mu_);
+    captured_records_.push_back(record);
+    while (captured_records_.size() >
+           static_cast<size_t>(options_.max_captured_requests)) {
+      captured_records_.pop_front();
+    }
+  }
+  if (options_.requests_per_thread <= 0) {
+    return;
+  }
+  // The payloads are only kept with the captured requests.
+  record.payload.clear();
+  ThreadRecords* const thread_records = GetThreadRecords();
+  mutex_lock l(thread_records->mu);
+  if (thread_records->records.size() <
+      static_cast<size_t>(options_.requests_per_thread)) {
+    thread_records->records.push_back(std::move(record));
+    return;
+  }
+  thread_records->records[thread_records->next] = std::move(record);
+  thread_records->next =
+      (thread_records->next + 1) % options_.requests_per_thread;
+}
+
+std::vector<FlightRecord> FlightRecorder::GetRecentRecords() const {
+  std::vector<const ThreadRecords*> all_thread_records;
+  {
+    mutex_lock l(mu_);
+    for (const auto& thread_records : thread_records_) {
+      all_thread_records.push_back(thread_records.second.get());
+    }
+  }
+  std::vector<FlightRecord> records;
+  for (const ThreadRecords* thread_records : all_thread_records) {
+    mutex_lock l(thread_records->mu);
+    records.insert(records.end(), thread_records->records.begin(),
+                   thread_records->records.end());
+  }
+  std::sort(records.begin(), records.end(),
+            [](const FlightRecord& a, const FlightRecord& b) {
+              return a.start_micros < b.start_micros;
+            });
+  return records;
+}
+
+std::vector<FlightRecord> FlightRecorder::GetCapturedRecords() const {
+  mutex_lock l(mu_);
+  return {captured_records_.begin(), captured_records_.end()};
+}
+
+string FlightRecorder::GeneratePage(const bool recent) const {
+  const std::vector<FlightRecord> records =
+      recent ? GetRecentRecords() : GetCapturedRecords();
+  string page;
+  for (auto record = records.rbegin(); record != records.rend(); ++record) {
+    absl::StrAppendFormat(&page, "%d %s %s %s %d %s\n", record->start_micros,
+                          OrDash(record->model_name), OrDash(record->api),
+                          OrDash(record->entrypoint), record->latency_micros,
+                          record->status.ToString());
+    for (const FlightRecord::Stage& stage : record->stages) {
+      absl::StrAppendFormat(&page, "  stage %s %d\n", stage.name,
+                            stage.latency_micros);
+    }
+    for (const FlightRecord::Batch& batch : record->batches) {
+      absl::StrAppendFormat(
+          &page,
+          "  batch size=%d padding=%d tasks=%d queue_micros=%d "
+          "merge_micros=%d run_micros=%d\n",
+          batch.batch_size, batch.padding_size, batch.num_tasks,
+          batch.queue_micros, batch.merge_micros, batch.run_micros);
+    }
+    if (!record->payload.empty()) {
+      absl::StrAppend(&page, "  payload ", absl::CEscape(record->payload),
+                      "\n");
+    }
+  }
+  return page;
+}
+
+ScopedFlightRecord::ScopedFlightRecord(const string& entrypoint,
+                                       FlightRecorder* recorder)
+    : recorder_(current_flight_record == nullptr ? recorder : nullptr) {
+  if (!recording()) {
+    return;
+  }
+  current_flight_record = this;
+  record_.entrypoint = entrypoint;
+  record_.start_micros = recorder_->options().env->NowMicros();
+}
+
+ScopedFlightRecord::~ScopedFlightRecord() {
+  if (!recording()) {
+    return;
+  }
+  current_flight_record = nullptr;
+  mutex_lock l(mu_);
+  record_.latency_micros =
+      recorder_->options().env->NowMicros() - record_.start_micros;
+  if (recorder_->options().capture_payloads &&
+      recorder_->ShouldCapture(record_.latency_micros)) {
+    record_.payload = request_ != nullptr ? request_->ShortDebugString()
+                                          : string(payload_);
+  }
+  recorder_->Add(std::move(record_));
+}
+
+void ScopedFlightRecord::set_request(const string& model_name,
+                                     const string& api) {
+  if (!recording()) {
+    return;
+  }
+  mutex_lock l(mu_);
+  record_.model_name = model_name;
+  record_.api = api;
+}
+
+void ScopedFlightRecord::set_status(const Status& status) {
+  if (!recording()) {
+    return;
+  }
+  mutex_lock l(mu_);
+  record_.status = status;
+}
+
+void ScopedFlightRecord::set_payload(const absl::string_view payload) {
+  payload_ = payload;
+}
+
+void ScopedFlightRecord::set_payload(const google::protobuf::Message* request) {
+  request_ = request;
+}
+
+void ScopedFlightRecord::AddStage(const string& name,
+                                  const int64 latency_micros) {
+  if (!recording()) {
+    return;
+  }
+  mutex_lock l(mu_);
+  record_.stages.push_back({name, latency_micros});
+}
+
+void ScopedFlightRecord::AddBatch(const FlightRecord::Batch& batch) {
+  if (!recording()) {
+    return;
+  }
+  mutex_lock l(mu_);
+  record_.batches.push_back(batch);
+}
+
+ScopedFlightRecord* CurrentFlightRecord() { return current_flight_record; }
+
+ScopedCurrentFlightRecord::ScopedCurrentFlightRecord(
+    ScopedFlightRecord* const record)
+    : set_(record != nullptr && current_flight_record == nullptr) {
+  if (set_) {
+    current_flight_record = record;
+  }
+}
+
+ScopedCurrentFlightRecord::~ScopedCurrentFlightRecord() {
+  if (set_) {
+    current_flight_record = nullptr;
+  }
+}
+
+void RecordFlightStage(const string& name, const int64 latency_micros) {
+  if (current_flight_record != nullptr) {
+    current_flight_record->AddStage(name, latency_micros);
+  }
+}
+
+}  // namespace serving
+}  // namespace tensorflow
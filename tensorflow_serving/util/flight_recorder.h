@@ -0,0 +1,234 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_UTIL_FLIGHT_RECORDER_H_
+#define TENSORFLOW_SERVING_UTIL_FLIGHT_RECORDER_H_
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "google/protobuf/message.h"
+#include "absl/strings/string_view.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace serving {
+
+// The timings of a request, recorded by the FlightRecorder.
+struct FlightRecord {
+  // A stage of the request, see RecordFlightStage().
+  struct Stage {
+    string name;
+    int64 latency_micros = 0;
+  };
+
+  // A batch a task of the request was processed in. The large requests split
+  // by the batching are processed in several batches.
+  struct Batch {
+    // The size of the calls in the batch, and the padding added to them.
+    int64 batch_size = 0;
+    int64 padding_size = 0;
+    // The number of tasks in the batch, the one of the request included.
+    int num_tasks = 0;
+    // The time the task waited for the batch to be processed.
+    int64 queue_micros = 0;
+    // The time the inputs of the batch took to merge, 0 if they were merged
+    // as the tasks were added.
+    int64 merge_micros = 0;
+    // The time the batch took to run.
+    int64 run_micros = 0;
+  };
+
+  string model_name;
+  string api;
+  // "GRPC" or "REST".
+  string entrypoint;
+  uint64 start_micros = 0;
+  int64 latency_micros = 0;
+  Status status;
+  // In the order they completed.
+  std::vector<Stage> stages;
+  std::vector<Batch> batches;
+  // The request, if it was captured with its payload.
+  string payload;
+};
+
+// Records the stage timings and the batches of the most recent requests, and
+// captures the slow ones, to tell what happened to the requests of the tail
+// latency after the fact.
+//
+// Each thread serving requests records them in its own ring, so that the
+// threads do not contend: the lock of a ring is only taken by its thread, and
+// by the readers of the records. The requests slower than the threshold are
+// also copied to a bounded list of captured requests.
+//
+// The requests are recorded by ScopedFlightRecord.
+//
+// This class is thread-safe.
+class FlightRecorder {
+ public:
+  struct Options {
+    // The number of requests kept by each thread, the oldest being
+    // overwritten.
+    int requests_per_thread = 64;
+
+    // The requests taking at least that long, in microseconds, are captured.
+    // 0 captures none.
+    int64 latency_threshold_micros = 0;
+
+    // The max number of captured requests kept, the oldest being dropped.
+    int max_captured_requests = 100;
+
+    // Whether to capture the requests with their payload.
+    bool capture_payloads = false;
+
+    // The environment to use for timing the requests.
+    Env* env = Env::Default();
+  };
+
+  // Default path to expose the records.
+  static const char* const kFlightRecorderPath;
+
+  // Returns the recorder of the process, or null if it has not been started.
+  static FlightRecorder* Get();
+
+  // Starts the recorder of the process. Returns an error if it is already
+  // started.
+  static Status Start(const Options& options);
+
+  explicit FlightRecorder(const Options& options);
+
+  const Options& options() const { return options_; }
+
+  // Returns the requests recorded by all the threads, by start time.
+  std::vector<FlightRecord> GetRecentRecords() const;
+
+  // Returns the captured requests, the oldest first.
+  std::vector<FlightRecord> GetCapturedRecords() const TF_LOCKS_EXCLUDED(mu_);
+
+  // Generates the text page of the captured requests, or of the recent ones
+  // if 'recent' is true, the latest first: a "<start micros> <model name>
+  // <api> <entrypoint> <latency micros> <status>" line per request, followed
+  // by a "  stage", "  batch" or "  payload" line per detail.
+  string GeneratePage(bool recent) const;
+
+ private:
+  friend class ScopedFlightRecord;
+
+  // The ring of the requests of a thread.
+  struct ThreadRecords {
+    mutable mutex mu;
+    std::vector<FlightRecord> records TF_GUARDED_BY(mu);
+    int next TF_GUARDED_BY(mu) = 0;
+  };
+
+  // Whether the requests taking 'latency_micros' are captured.
+  bool ShouldCapture(int64 latency_micros) const;
+
+  // Records a request of the current thread.
+  void Add(FlightRecord record) TF_LOCKS_EXCLUDED(mu_);
+
+  // Returns the ring of the current thread, created on first use.
+  ThreadRecords* GetThreadRecords() TF_LOCKS_EXCLUDED(mu_);
+
+  const Options options_;
+  // Tells the recorders apart in the per-thread cache of the rings.
+  const uint64 id_;
+
+  mutable mutex mu_;
+  // The rings of the threads are kept once they exit: the threads serving
+  // requests are long-lived.
+  std::map<std::thread::id, std::unique_ptr<ThreadRecords>> thread_records_
+      TF_GUARDED_BY(mu_);
+  std::deque<FlightRecord> captured_records_ TF_GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(FlightRecorder);
+};
+
+// Records a request served by the current thread for the lifetime of this
+// object, see CurrentFlightRecord(). Does nothing if there is no recorder, or
+// if the thread already records a request.
+class ScopedFlightRecord {
+ public:
+  explicit ScopedFlightRecord(const string& entrypoint,
+                              FlightRecorder* recorder = FlightRecorder::Get());
+  ~ScopedFlightRecord();
+
+  // Whether the request is recorded.
+  bool recording() const { return recorder_ != nullptr; }
+
+  // Sets the model and the API of the request, once known.
+  void set_request(const string& model_name, const string& api);
+
+  // Sets the status the request completed with.
+  void set_status(const Status& status);
+
+  // Sets the payload of the request, copied only if it is captured with its
+  // payload. 'payload' or 'request' must outlive this object.
+  void set_payload(absl::string_view payload);
+  void set_payload(const google::protobuf::Message* request);
+
+  // Adds a stage or a batch to the record. Can be called from any thread while
+  // this object lives.
+  void AddStage(const string& name, int64 latency_micros)
+      TF_LOCKS_EXCLUDED(mu_);
+  void AddBatch(const FlightRecord::Batch& batch) TF_LOCKS_EXCLUDED(mu_);
+
+ private:
+  FlightRecorder* const recorder_;
+  absl::string_view payload_;
+  const google::protobuf::Message* request_ = nullptr;
+
+  mutex mu_;
+  FlightRecord record_ TF_GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ScopedFlightRecord);
+};
+
+// Returns the request recorded by the current thread, or null if there is
+// none. See ScopedFlightRecord.
+ScopedFlightRecord* CurrentFlightRecord();
+
+// Sets the request recorded by the current thread for the lifetime of this
+// object, e.g. on a thread serving a part of a request recorded by another
+// thread. 'record' must outlive this object. Does nothing if 'record' is null,
+// or if the thread already records a request.
+class ScopedCurrentFlightRecord {
+ public:
+  explicit ScopedCurrentFlightRecord(ScopedFlightRecord* record);
+  ~ScopedCurrentFlightRecord();
+
+ private:
+  const bool set_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ScopedCurrentFlightRecord);
+};
+
+// Adds a stage to the request recorded by the current thread, if any.
+void RecordFlightStage(const string& name, int64 latency_micros);
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_UTIL_FLIGHT_RECORDER_H_
@@ -0,0 +1,224 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/flight_recorder.h"
+
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include "tensorflow/core/kernels/batching_util/fake_clock_env.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+class FlightRecorderTest : public ::testing::Test {
+ protected:
+  FlightRecorderTest() : env_(Env::Default()) {}
+
+  std::unique_ptr<FlightRecorder> CreateRecorder(
+      FlightRecorder::Options options) {
+    options.env = &env_;
+    return std::unique_ptr<FlightRecorder>(new FlightRecorder(options));
+  }
+
+  // Records a request of 'model_name' taking 'latency_micros'.
+  void RecordRequest(FlightRecorder* recorder, const string& model_name,
+                     const int64 latency_micros) {
+    ScopedFlightRecord record("GRPC", recorder);
+    record.set_request(model_name, "Predict");
+    record.set_payload(model_name);
+    env_.AdvanceByMicroseconds(latency_micros);
+  }
+
+  test_util::FakeClockEnv env_;
+};
+
+TEST_F(FlightRecorderTest, RecordsStagesAndBatches) {
+  auto recorder = CreateRecorder({});
+  env_.AdvanceByMicroseconds(1000);
+  {
+    ScopedFlightRecord record("REST", recorder.get());
+    EXPECT_TRUE(record.recording());
+    EXPECT_EQ(CurrentFlightRecord(), &record);
+    RecordFlightStage("parse_request", 10);
+    FlightRecord::Batch batch;
+    batch.batch_size = 6;
+    batch.padding_size = 2;
+    batch.num_tasks = 3;
+    batch.queue_micros = 40;
+    batch.run_micros = 50;
+    CurrentFlightRecord()->AddBatch(batch);
+    RecordFlightStage("serialize_response", 20);
+    record.set_request("model", "Predict");
+    record.set_status(errors::DeadlineExceeded("late"));
+    env_.AdvanceByMicroseconds(120);
+  }
+  EXPECT_EQ(CurrentFlightRecord(), nullptr);
+  // Without a record, the stages are dropped.
+  RecordFlightStage("parse_request", 10);
+
+  const std::vector<FlightRecord> records = recorder->GetRecentRecords();
+  ASSERT_EQ(records.size(), 1);
+  const FlightRecord& record = records[0];
+  EXPECT_EQ(record.model_name, "model");
+  EXPECT_EQ(record.api, "Predict");
+  EXPECT_EQ(record.entrypoint, "REST");
+  EXPECT_EQ(record.start_micros, 1000);
+  EXPECT_EQ(record.latency_micros, 120);
+  EXPECT_EQ(record.status.code(), error::DEADLINE_EXCEEDED);
+  ASSERT_EQ(record.stages.size(), 2);
+  EXPECT_EQ(record.stages[0].name, "parse_request");
+  EXPECT_EQ(record.stages[0].latency_micros, 10);
+  EXPECT_EQ(record.stages[1].name, "serialize_response");
+  ASSERT_EQ(record.batches.size(), 1);
+  EXPECT_EQ(record.batches[0].batch_size, 6);
+  EXPECT_EQ(record.batches[0].num_tasks, 3);
+  EXPECT_TRUE(record.payload.empty());
+  EXPECT_TRUE(recorder->GetCapturedRecords().empty());
+}
+
+TEST_F(FlightRecorderTest, NestedRecordsAreIgnored) {
+  auto recorder = CreateRecorder({});
+  {
+    ScopedFlightRecord record("REST", recorder.get());
+    {
+      ScopedFlightRecord nested_record("GRPC", recorder.get());
+      EXPECT_FALSE(nested_record.recording());
+      RecordFlightStage("run", 10);
+    }
+    EXPECT_EQ(CurrentFlightRecord(), &record);
+  }
+  const std::vector<FlightRecord> records = recorder->GetRecentRecords();
+  ASSERT_EQ(records.size(), 1);
+  EXPECT_EQ(records[0].entrypoint, "REST");
+  EXPECT_EQ(records[0].stages.size(), 1);
+}
+
+TEST_F(FlightRecorderTest, KeepsTheMostRecentRequestsOfEachThread) {
+  FlightRecorder::Options options;
+  options.requests_per_thread = 2;
+  auto recorder = CreateRecorder(options);
+  RecordRequest(recorder.get(), "a", 1);
+  RecordRequest(recorder.get(), "b", 1);
+  RecordRequest(recorder.get(), "c", 1);
+  std::unique_ptr<Thread> thread(Env::Default()->StartThread(
+      {}, "other", [&]() { RecordRequest(recorder.get(), "d", 1); }));
+  thread.reset();
+
+  const std::vector<FlightRecord> records = recorder->GetRecentRecords();
+  ASSERT_EQ(records.size(), 3);
+  EXPECT_EQ(records[0].model_name, "b");
+  EXPECT_EQ(records[1].model_name, "c");
+  EXPECT_EQ(records[2].model_name, "d");
+}
+
+TEST_F(FlightRecorderTest, CapturesTheSlowRequests) {
+  FlightRecorder::Options options;
+  options.latency_threshold_micros = 100;
+  options.max_captured_requests = 2;
+  options.capture_payloads = true;
+  auto recorder = CreateRecorder(options);
+  RecordRequest(recorder.get(), "slow1", 100);
+  RecordRequest(recorder.get(), "fast", 99);
+  RecordRequest(recorder.get(), "slow2", 200);
+  RecordRequest(recorder.get(), "slow3", 300);
+
+  const std::vector<FlightRecord> captured_records =
+      recorder->GetCapturedRecords();
+  ASSERT_EQ(captured_records.size(), 2);
+  EXPECT_EQ(captured_records[0].model_name, "slow2");
+  EXPECT_EQ(captured_records[0].payload, "slow2");
+  EXPECT_EQ(captured_records[1].model_name, "slow3");
+  // The recent requests are kept without their payload.
+  const std::vector<FlightRecord> records = recorder->GetRecentRecords();
+  ASSERT_EQ(records.size(), 4);
+  for (const FlightRecord& record : records) {
+    EXPECT_TRUE(record.payload.empty());
+  }
+}
+
+TEST_F(FlightRecorderTest, PayloadsAreOptional) {
+  FlightRecorder::Options options;
+  options.latency_threshold_micros = 100;
+  auto recorder = CreateRecorder(options);
+  RecordRequest(recorder.get(), "slow", 100);
+  const std::vector<FlightRecord> captured_records =
+      recorder->GetCapturedRecords();
+  ASSERT_EQ(captured_records.size(), 1);
+  EXPECT_TRUE(captured_records[0].payload.empty());
+}
+
+TEST_F(FlightRecorderTest, GeneratePage) {
+  FlightRecorder::Options options;
+  options.latency_threshold_micros = 100;
+  options.capture_payloads = true;
+  auto recorder = CreateRecorder(options);
+  {
+    ScopedFlightRecord record("GRPC", recorder.get());
+    record.set_request("model", "Classify");
+    record.set_payload("a\nb");
+    RecordFlightStage("run", 150);
+    FlightRecord::Batch batch;
+    batch.batch_size = 6;
+    batch.padding_size = 2;
+    batch.num_tasks = 3;
+    batch.queue_micros = 40;
+    batch.run_micros = 50;
+    CurrentFlightRecord()->AddBatch(batch);
+    env_.AdvanceByMicroseconds(150);
+  }
+  env_.AdvanceByMicroseconds(10);
+  {
+    ScopedFlightRecord record("REST", recorder.get());
+    env_.AdvanceByMicroseconds(5);
+  }
+
+  EXPECT_EQ(recorder->GeneratePage(/*recent=*/false),
+            "0 model Classify GRPC 150 OK\n"
+            "  stage run 150\n"
+            "  batch size=6 padding=2 tasks=3 queue_micros=40 merge_micros=0 "
+            "run_micros=50\n"
+            "  payload a\\nb\n");
+  EXPECT_EQ(recorder->GeneratePage(/*recent=*/true),
+            "160 - - REST 5 OK\n"
+            "0 model Classify GRPC 150 OK\n"
+            "  stage run 150\n"
+            "  batch size=6 padding=2 tasks=3 queue_micros=40 merge_micros=0 "
+            "run_micros=50\n");
+}
+
+TEST(FlightRecorderStartTest, StartsOnce) {
+  EXPECT_EQ(FlightRecorder::Get(), nullptr);
+  {
+    ScopedFlightRecord record("GRPC");
+    EXPECT_FALSE(record.recording());
+  }
+  TF_ASSERT_OK(FlightRecorder::Start({}));
+  ASSERT_NE(FlightRecorder::Get(), nullptr);
+  EXPECT_FALSE(FlightRecorder::Start({}).ok());
+  {
+    ScopedFlightRecord record("GRPC");
+    EXPECT_TRUE(record.recording());
+  }
+  EXPECT_EQ(FlightRecorder::Get()->GetRecentRecords().size(), 1);
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
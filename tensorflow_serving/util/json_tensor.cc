@@ -15,11 +15,16 @@ limitations under the License.
 
 #include "tensorflow_serving/util/json_tensor.h"
 
+#include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <limits>
+#include <map>
 #include <string>
 #include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "rapidjson/document.h"
 #include "rapidjson/error/en.h"
@@ -33,13 +38,16 @@ limitations under the License.
 #include "tensorflow/core/example/example.pb.h"
 #include "tensorflow/core/example/feature.pb.h"
 #include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/framework/tensor_shape.pb.h"
 #include "tensorflow/core/framework/types.h"
 #include "tensorflow/core/framework/types.pb.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/stringpiece.h"
+#include "tensorflow/core/platform/macros.h"
 #include "tensorflow_serving/apis/input.pb.h"
 #include "tensorflow_serving/apis/model.pb.h"
+#include "tensorflow_serving/util/reusable_memory_block.h"
 
 namespace tensorflow {
 namespace serving {
@@ -62,6 +70,11 @@ constexpr char kClassifyRegressRequestContextKey[] = "context";
 // All examples are keyed off this in the JSON request object.
 constexpr char kClassifyRegressRequestExamplesKey[] = "examples";
 
+// The max number of classes returned for each example, and their min score,
+// are keyed off these in the JSON classification request object.
+constexpr char kClassifyRequestTopKKey[] = "top_k";
+constexpr char kClassifyRequestMinScoreKey[] = "min_score";
+
 // All tensors are keyed off this in the JSON response object,
 // when request format is JsonPredictRequestFormat::kRow.
 constexpr char kPredictResponsePredictionsKey[] = "predictions";
@@ -83,7 +96,41 @@ constexpr char kBase64Key[] = "b64";
 // Suffix for name of tensors that represent bytes (as opposed to strings).
 constexpr char kBytesTensorNameSuffix[] = "_bytes";
 
-using RapidJsonWriter = rapidjson::PrettyWriter<rapidjson::StringBuffer>;
+// A rapidjson output stream that appends the JSON text to a string. If a
+// `write_chunk` callback is set, the text is passed to it (and dropped from the
+// string) each time `chunk_size` bytes are buffered.
+class ChunkedStringStream {
+ public:
+  typedef char Ch;
+
+  ChunkedStringStream() = default;
+  ChunkedStringStream(
+      size_t chunk_size,
+      const std::function<void(absl::string_view)>* write_chunk)
+      : chunk_size_(chunk_size), write_chunk_(write_chunk) {
+    buffer_.reserve(chunk_size);
+  }
+
+  void Put(char c) {
+    buffer_.push_back(c);
+    if (write_chunk_ != nullptr && buffer_.size() >= chunk_size_) {
+      (*write_chunk_)(buffer_);
+      buffer_.clear();
+    }
+  }
+
+  void Flush() {}
+
+  // The JSON text that was not passed to `write_chunk` yet.
+  string* buffer() { return &buffer_; }
+
+ private:
+  size_t chunk_size_ = 0;
+  const std::function<void(absl::string_view)>* write_chunk_ = nullptr;
+  string buffer_;
+};
+
+using RapidJsonWriter = rapidjson::PrettyWriter<ChunkedStringStream>;
 
 string JsonTypeString(const rapidjson::Value& val) {
   switch (val.GetType()) {
@@ -114,11 +161,151 @@ bool StringToDecimal(const absl::string_view s, double* out) {
   return absl::SimpleAtod(s, out);
 }
 
+// Powers of ten that are exactly representable as doubles.
+constexpr double kExactPowersOfTen[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+constexpr int kMaxExactPowerOfTen = 22;
+
+// Maximum number of significant digits needed to round-trip a float.
+constexpr int kMaxFloatDigits = 9;
+
+// Buffer size of FormatShortestFloat(), e.g. "-1.23456789e-10" or
+// "-0.000123456789".
+constexpr int kShortestFloatBufferSize = 24;
+
+// Returns `val * 10^scale`, correctly rounded, for |scale| at most
+// kMaxExactPowerOfTen.
+double ScaleByPowerOfTen(double val, int scale) {
+  return scale >= 0 ? val * kExactPowersOfTen[scale]
+                    : val / kExactPowersOfTen[-scale];
+}
+
+// Returns true if `digits * 10^-scale` parses back to the float `val`.
+//
+// The candidate is computed exactly rounded in double precision. Rounding it
+// again to float is only incorrect if the double lands exactly on the
+// midpoint of two floats, which is treated as not round-tripping.
+bool DecimalRoundTrips(uint64 digits, int scale, float val) {
+  const double candidate = ScaleByPowerOfTen(static_cast<double>(digits),
+                                             -scale);
+  const float rounded = static_cast<float>(candidate);
+  if (static_cast<double>(rounded) != candidate) {
+    const float other = std::nextafter(
+        rounded, candidate > rounded ? std::numeric_limits<float>::infinity()
+                                     : -std::numeric_limits<float>::infinity());
+    if (candidate - rounded == other - candidate) return false;
+  }
+  return rounded == val;
+}
+
+// Writes `val` with the fewest significant digits that round-trip, in the
+// printf "%g" style used by WriteDecimal() below (six-digit precision when
+// this is enough, nine-digit precision otherwise), e.g. "0.1", "1234567",
+// "1e-05". Whole numbers get a trailing ".0".
+//
+// Returns the length written in `buffer` (of kShortestFloatBufferSize
+// chars), or 0 if `val` is not finite or too large/small for the fast path
+// (the caller then falls back on the generic conversion).
+int FormatShortestFloat(float val, char* buffer) {
+  if (!std::isfinite(val)) return 0;
+  char* out = buffer;
+  if (std::signbit(val)) *out++ = '-';
+  const float abs_val = std::abs(val);
+  if (abs_val == 0) {
+    std::memcpy(out, "0.0", 3);
+    return out - buffer + 3;
+  }
+
+  // Decimal exponent of the value, estimated from log10 and corrected.
+  const double d = abs_val;
+  int exponent = static_cast<int>(std::floor(std::log10(d)));
+  if (std::abs(exponent) >= kMaxExactPowerOfTen) return 0;
+  const double normalized = ScaleByPowerOfTen(d, -exponent);
+  if (normalized < 1) {
+    exponent--;
+  } else if (normalized >= 10) {
+    exponent++;
+  }
+
+  // Shortest digits that round-trip.
+  uint64 digits = 0;
+  int num_digits = 1;
+  uint64 digits_limit = 10;
+  for (; num_digits <= kMaxFloatDigits; num_digits++, digits_limit *= 10) {
+    const int scale = num_digits - 1 - exponent;
+    if (scale < -kMaxExactPowerOfTen || scale > kMaxExactPowerOfTen) return 0;
+    digits = static_cast<uint64>(std::llround(ScaleByPowerOfTen(d, scale)));
+    if (digits < digits_limit / 10 || digits > digits_limit) return 0;
+    if (DecimalRoundTrips(digits, scale, abs_val)) break;
+  }
+  if (num_digits > kMaxFloatDigits) return 0;
+  if (digits == digits_limit) {
+    // Rounded up to the next power of ten, e.g. 9.96 -> 10 with two digits.
+    digits /= 10;
+    exponent++;
+  }
+
+  char digit_chars[kMaxFloatDigits];
+  for (int i = num_digits - 1; i >= 0; i--) {
+    digit_chars[i] = '0' + digits % 10;
+    digits /= 10;
+  }
+  while (num_digits > 1 && digit_chars[num_digits - 1] == '0') num_digits--;
+
+  const int precision = num_digits <= 6 ? 6 : kMaxFloatDigits;
+  if (exponent < -4 || exponent >= precision) {
+    // Scientific notation, e.g. "1.5e-05".
+    *out++ = digit_chars[0];
+    if (num_digits > 1) {
+      *out++ = '.';
+      std::memcpy(out, digit_chars + 1, num_digits - 1);
+      out += num_digits - 1;
+    }
+    *out++ = 'e';
+    *out++ = exponent < 0 ? '-' : '+';
+    const int abs_exponent = std::abs(exponent);
+    *out++ = '0' + abs_exponent / 10;
+    *out++ = '0' + abs_exponent % 10;
+  } else if (exponent < 0) {
+    // E.g. "0.0015".
+    *out++ = '0';
+    *out++ = '.';
+    for (int i = 0; i < -exponent - 1; i++) *out++ = '0';
+    std::memcpy(out, digit_chars, num_digits);
+    out += num_digits;
+  } else {
+    // E.g. "1500.0" or "15.25".
+    const int num_int_digits = exponent + 1;
+    for (int i = 0; i < num_int_digits; i++) {
+      *out++ = i < num_digits ? digit_chars[i] : '0';
+    }
+    *out++ = '.';
+    if (num_digits > num_int_digits) {
+      std::memcpy(out, digit_chars + num_int_digits,
+                  num_digits - num_int_digits);
+      out += num_digits - num_int_digits;
+    } else {
+      *out++ = '0';
+    }
+  }
+  return out - buffer;
+}
+
 template <typename dtype>
 bool WriteDecimal(RapidJsonWriter* writer, dtype val) {
   static_assert(
       std::is_same<dtype, float>::value || std::is_same<dtype, double>::value,
       "Only floating-point value types are supported.");
+  // Floats are formatted by the fast path of FormatShortestFloat() when
+  // possible, and by the generic conversions below otherwise.
+  if (std::is_same<dtype, float>::value) {
+    char buffer[kShortestFloatBufferSize];
+    const int length = FormatShortestFloat(static_cast<float>(val), buffer);
+    if (length > 0) {
+      return writer->RawValue(buffer, length, rapidjson::kNumberType);
+    }
+  }
   // We do not use native writer->Double() API as float -> double conversion
   // causes noise digits to be added (due to the way floating point numbers are
   // generally represented in binary, nothing to do with the API itself). So a
@@ -165,8 +352,8 @@ bool WriteDecimal(RapidJsonWriter* writer, dtype val) {
 // Stringify JSON value (only for use in error reporting or debugging).
 string JsonValueToString(const rapidjson::Value& val) {
   // TODO(b/67042542): Truncate large values.
-  rapidjson::StringBuffer buffer;
-  RapidJsonWriter writer(buffer);
+  ChunkedStringStream stream;
+  RapidJsonWriter writer(stream);
   // Write decimal numbers explicitly so inf/nan's get printed
   // correctly. RapidJsonWriter() does not write these correctly.
   if (val.IsFloat()) {
@@ -176,7 +363,7 @@ string JsonValueToString(const rapidjson::Value& val) {
   } else {
     val.Accept(writer);
   }
-  return buffer.GetString();
+  return *stream.buffer();
 }
 
 // Prints a shape array in [x, y, z] format.
@@ -288,16 +475,84 @@ Status AddValueToTensor(const rapidjson::Value& val, DataType dtype,
 //
 // `val` can be scalar or list or list of lists with arbitrary nesting. If a
 // scalar (non array) is passed, we do not add dimension info to shape (as
-// scalars do not have a dimension).
+// scalars do not have a dimension). The shape is read from the first element
+// of each list.
 void GetDenseTensorShape(const rapidjson::Value& val, TensorShapeProto* shape) {
-  if (!val.IsArray()) return;
-  const auto size = val.Size();
-  shape->add_dim()->set_size(size);
-  if (size > 0) {
-    GetDenseTensorShape(val[0], shape);
+  for (const rapidjson::Value* v = &val; v->IsArray(); v = &(*v)[0]) {
+    shape->add_dim()->set_size(v->Size());
+    if (v->Empty()) break;
   }
 }
 
+// Visits the values nested in the lists of `val` in row-major order, with an
+// explicit stack instead of recursion, so that deeply nested JSON cannot
+// overflow the thread stack. `on_list(list, level)` is called on each list
+// before its elements, and `on_value(value, level)` on each other value,
+// where `level` is the nesting depth (0 for `val`). Stops at the first error.
+//
+// Lists nested deeper than the max rank of a tensor are rejected, which also
+// bounds the stack.
+template <typename ListFn, typename ValueFn>
+Status VisitNestedLists(const rapidjson::Value& val, ListFn on_list,
+                        ValueFn on_value) {
+  // The next and end elements of each list being visited.
+  std::vector<std::pair<rapidjson::Value::ConstValueIterator,
+                        rapidjson::Value::ConstValueIterator>>
+      stack;
+  const rapidjson::Value* v = &val;
+  while (true) {
+    const int level = static_cast<int>(stack.size());
+    if (v->IsArray()) {
+      if (level >= TensorShape::MaxDimensions()) {
+        return errors::InvalidArgument(
+            "Encountered list nested deeper than the max tensor rank: ",
+            TensorShape::MaxDimensions());
+      }
+      TF_RETURN_IF_ERROR(on_list(*v, level));
+      stack.emplace_back(v->Begin(), v->End());
+    } else {
+      TF_RETURN_IF_ERROR(on_value(*v, level));
+    }
+    while (!stack.empty() && stack.back().first == stack.back().second) {
+      stack.pop_back();
+    }
+    if (stack.empty()) return Status::OK();
+    v = stack.back().first++;
+  }
+}
+
+// Checks that a JSON value found at `level` of a (dense) tensor of `shape` is
+// at the leaf level, as the DOM tree of a tensor always has all its values at
+// the same level, equal to the rank of the tensor.
+Status CheckValueLevel(const rapidjson::Value& val, int level,
+                       const TensorShapeProto& shape) {
+  if (level != shape.dim_size()) {
+    return errors::InvalidArgument(
+        "JSON Value: ", JsonValueToString(val),
+        " found at incorrect level: ", level + 1,
+        " in the JSON DOM. Expected at level: ", shape.dim_size());
+  }
+  return Status::OK();
+}
+
+// Checks that a JSON list found at `level` of a (dense) tensor of `shape`
+// matches the size of that dimension.
+Status CheckListLevel(const rapidjson::Value& list, int level,
+                      const TensorShapeProto& shape) {
+  // If list is nested deeper than rank, stop processing.
+  if (level >= shape.dim_size()) {
+    return errors::InvalidArgument("Encountered list at unexpected level: ",
+                                   level, " expected < ", shape.dim_size());
+  }
+  // Ensure list is of expected size for our level.
+  if (list.Size() != shape.dim(level).size()) {
+    return errors::InvalidArgument(
+        "Encountered list at unexpected size: ", list.Size(),
+        " at level: ", level, " expected size: ", shape.dim(level).size());
+  }
+  return Status::OK();
+}
+
 bool IsValBase64Object(const rapidjson::Value& val) {
   // Base64 encoded data is a JSON object formatted as:
   // { "b64" : "<base64 encoded string" }
@@ -331,51 +586,40 @@ Status JsonDecodeBase64Object(const rapidjson::Value& val,
   return Status::OK();
 }
 
-// Fills tensor values.
-Status FillTensorProto(const rapidjson::Value& val, int level, DataType dtype,
+// Fills tensor values, and the tensor shape, in a single pass over `val`.
+//
+// As in GetDenseTensorShape(), the shape is read from the first element of
+// each list, i.e. from the first lists visited: the rank is known once the
+// first value, or an empty list, is reached. The other lists and values are
+// checked against it.
+Status FillTensorProto(const rapidjson::Value& val, DataType dtype,
                        int* val_count, TensorProto* tensor) {
-  const auto rank = tensor->tensor_shape().dim_size();
-  if (!val.IsArray()) {
-    // DOM tree for a (dense) tensor will always have all values
-    // at same (leaf) level equal to the rank of the tensor.
-    if (level != rank) {
-      return errors::InvalidArgument(
-          "JSON Value: ", JsonValueToString(val),
-          " found at incorrect level: ", level + 1,
-          " in the JSON DOM. Expected at level: ", rank);
-    }
+  TensorShapeProto* shape = tensor->mutable_tensor_shape();
+  shape->Clear();
+  bool rank_known = false;
+  auto on_list = [shape, &rank_known](const rapidjson::Value& list,
+                                      int level) -> Status {
+    if (rank_known) return CheckListLevel(list, level, *shape);
+    shape->add_dim()->set_size(list.Size());
+    rank_known = list.Empty();
+    return Status::OK();
+  };
+  auto on_value = [shape, &rank_known, dtype, val_count, tensor](
+                      const rapidjson::Value& v, int level) -> Status {
+    rank_known = true;
+    TF_RETURN_IF_ERROR(CheckValueLevel(v, level, *shape));
     Status status;
-    if (val.IsObject()) {
+    if (v.IsObject()) {
       status = (dtype == DT_STRING)
-                   ? JsonDecodeBase64Object(val, tensor->add_string_val())
-                   : TypeError(val, dtype);
+                   ? JsonDecodeBase64Object(v, tensor->add_string_val())
+                   : TypeError(v, dtype);
     } else {
-      status = AddValueToTensor(val, dtype, tensor);
+      status = AddValueToTensor(v, dtype, tensor);
     }
     if (status.ok()) (*val_count)++;
     return status;
-  }
-
-  // If list is nested deeper than rank, stop processing.
-  if (level >= rank) {
-    return errors::InvalidArgument(
-        "Encountered list at unexpected level: ", level, " expected < ", rank);
-  }
-
-  // Ensure list is of expected size for our level.
-  if (val.Size() != tensor->tensor_shape().dim(level).size()) {
-    return errors::InvalidArgument(
-        "Encountered list at unexpected size: ", val.Size(),
-        " at level: ", level,
-        " expected size: ", tensor->tensor_shape().dim(level).size());
-  }
-
-  // All OK, recurse into elements of the list.
-  for (const auto& v : val.GetArray()) {
-    TF_RETURN_IF_ERROR(FillTensorProto(v, level + 1, dtype, val_count, tensor));
-  }
-
-  return Status::OK();
+  };
+  return VisitNestedLists(val, on_list, on_value);
 }
 
 // Converts a JSON value to tensor and add it to tensor_map.
@@ -395,10 +639,7 @@ Status AddInstanceItem(const rapidjson::Value& item, const string& name,
   int size = 0;
   const auto dtype = tensorinfo_map.at(name).dtype();
   auto* tensor = &(*tensor_map)[name];
-  tensor->mutable_tensor_shape()->Clear();
-  GetDenseTensorShape(item, tensor->mutable_tensor_shape());
-  TF_RETURN_IF_ERROR(
-      FillTensorProto(item, 0 /* level */, dtype, &size, tensor));
+  TF_RETURN_IF_ERROR(FillTensorProto(item, dtype, &size, tensor));
   if (!size_map->count(name)) {
     (*size_map)[name] = size;
     (*shape_map)[name] = tensor->tensor_shape();
@@ -413,6 +654,35 @@ Status AddInstanceItem(const rapidjson::Value& item, const string& name,
   return Status::OK();
 }
 
+// Returns the memory block the JSON DOMs of the calling thread are allocated
+// from.
+ReusableMemoryBlock* ThreadDocumentBlock() {
+  static thread_local ReusableMemoryBlock block;
+  return &block;
+}
+
+// A rapidjson DOM whose values are allocated from ThreadDocumentBlock(), so
+// that parsing requests of a usual size does not allocate heap memory for
+// them.
+class RequestDocument {
+ public:
+  RequestDocument()
+      : lease_(ThreadDocumentBlock()),
+        allocator_(lease_.data(), lease_.size()),
+        doc_(&allocator_) {}
+
+  ~RequestDocument() { lease_.set_used_size(allocator_.Size()); }
+
+  rapidjson::Document* get() { return &doc_; }
+
+ private:
+  ReusableMemoryBlock::Lease lease_;
+  rapidjson::MemoryPoolAllocator<> allocator_;
+  rapidjson::Document doc_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(RequestDocument);
+};
+
 Status ParseJson(const absl::string_view json, rapidjson::Document* doc) {
   if (json.empty()) {
     return errors::InvalidArgument("JSON Parse error: The document is empty");
@@ -423,9 +693,10 @@ Status ParseJson(const absl::string_view json, rapidjson::Document* doc) {
   rapidjson::MemoryStream ms(json.data(), json.size());
   rapidjson::EncodedInputStream<rapidjson::UTF8<>, rapidjson::MemoryStream>
       jsonstream(ms);
-  // TODO(b/67042542): Switch to using custom stack for parsing to protect
-  // against deep nested structures causing excessive recursion/SO.
-  if (doc->ParseStream<rapidjson::kParseNanAndInfFlag>(jsonstream)
+  // The iterative parser keeps its state on a heap allocated stack, so that
+  // deeply nested structures cannot cause excessive recursion/SO.
+  if (doc->ParseStream<rapidjson::kParseIterativeFlag |
+                       rapidjson::kParseNanAndInfFlag>(jsonstream)
           .HasParseError()) {
     return errors::InvalidArgument(
         "JSON Parse error: ", rapidjson::GetParseError_En(doc->GetParseError()),
@@ -566,10 +837,9 @@ Status FillTensorMapFromInputsMap(
 
     auto* tensor = &(*tensor_map)[tensorinfo_map.begin()->first];
     tensor->set_dtype(tensorinfo_map.begin()->second.dtype());
-    GetDenseTensorShape(val, tensor->mutable_tensor_shape());
     int unused_size = 0;
-    TF_RETURN_IF_ERROR(FillTensorProto(val, 0 /* level */, tensor->dtype(),
-                                       &unused_size, tensor));
+    TF_RETURN_IF_ERROR(
+        FillTensorProto(val, tensor->dtype(), &unused_size, tensor));
   } else {
     for (const auto& kv : tensorinfo_map) {
       const auto& name = kv.first;
@@ -581,72 +851,414 @@ Status FillTensorMapFromInputsMap(
       const auto dtype = kv.second.dtype();
       auto* tensor = &(*tensor_map)[name];
       tensor->set_dtype(dtype);
-      tensor->mutable_tensor_shape()->Clear();
-      GetDenseTensorShape(item->value, tensor->mutable_tensor_shape());
       int unused_size = 0;
-      TF_RETURN_IF_ERROR(FillTensorProto(item->value, 0 /* level */, dtype,
-                                         &unused_size, tensor));
+      TF_RETURN_IF_ERROR(
+          FillTensorProto(item->value, dtype, &unused_size, tensor));
     }
   }
   return Status::OK();
 }
 
-}  // namespace
+// Sets the value at flat `index` of `tensor` from a JSON value. Returns error
+// if value cannot be converted to the dtype of the tensor. In case of error
+// the tensor is not modified.
+Status SetTensorValue(const rapidjson::Value& val, int64 index,
+                      Tensor* tensor) {
+  const DataType dtype = tensor->dtype();
+  if (val.IsObject()) {
+    if (dtype != DT_STRING) return TypeError(val, dtype);
+    string decoded_val;
+    TF_RETURN_IF_ERROR(JsonDecodeBase64Object(val, &decoded_val));
+    tensor->flat<tstring>()(index) = std::move(decoded_val);
+    return Status::OK();
+  }
+  switch (dtype) {
+    case DT_FLOAT:
+      if (!val.IsNumber()) return TypeError(val, dtype);
+      tensor->flat<float>()(index) = val.GetFloat();
+      break;
 
-Status FillPredictRequestFromJson(
+    case DT_DOUBLE:
+      if (!val.IsNumber()) return TypeError(val, dtype);
+      tensor->flat<double>()(index) = val.GetDouble();
+      break;
+
+    case DT_INT32:
+      if (!val.IsInt()) return TypeError(val, dtype);
+      tensor->flat<int32>()(index) = val.GetInt();
+      break;
+
+    case DT_INT16:
+      if (!val.IsInt()) return TypeError(val, dtype);
+      tensor->flat<int16>()(index) = static_cast<int16>(val.GetInt());
+      break;
+
+    case DT_INT8:
+      if (!val.IsInt()) return TypeError(val, dtype);
+      tensor->flat<int8>()(index) = static_cast<int8>(val.GetInt());
+      break;
+
+    case DT_UINT8:
+      if (!val.IsInt()) return TypeError(val, dtype);
+      tensor->flat<uint8>()(index) = static_cast<uint8>(val.GetInt());
+      break;
+
+    case DT_STRING:
+      if (!val.IsString()) return TypeError(val, dtype);
+      tensor->flat<tstring>()(index).assign(val.GetString(),
+                                            val.GetStringLength());
+      break;
+
+    case DT_INT64:
+      if (!val.IsInt64()) return TypeError(val, dtype);
+      tensor->flat<int64>()(index) = val.GetInt64();
+      break;
+
+    case DT_BOOL:
+      if (!val.IsBool()) return TypeError(val, dtype);
+      tensor->flat<bool>()(index) = val.GetBool();
+      break;
+
+    case DT_UINT32:
+      if (!val.IsUint()) return TypeError(val, dtype);
+      tensor->flat<uint32>()(index) = val.GetUint();
+      break;
+
+    case DT_UINT64:
+      if (!val.IsUint64()) return TypeError(val, dtype);
+      tensor->flat<uint64>()(index) = val.GetUint64();
+      break;
+
+    default:
+      return errors::Unimplemented(
+          "Conversion of JSON Value: ", JsonValueToString(val),
+          " to type: ", DataTypeString(dtype));
+  }
+  return Status::OK();
+}
+
+// Fills tensor values, starting at flat `*index`, from a JSON value of
+// `shape`. The values are checked against `shape` as in FillTensorProto().
+Status FillTensor(const rapidjson::Value& val, const TensorShapeProto& shape,
+                  int64* index, Tensor* tensor) {
+  auto on_list = [&shape](const rapidjson::Value& list, int level) {
+    return CheckListLevel(list, level, shape);
+  };
+  auto on_value = [&shape, index, tensor](const rapidjson::Value& v,
+                                          int level) -> Status {
+    TF_RETURN_IF_ERROR(CheckValueLevel(v, level, shape));
+    TF_RETURN_IF_ERROR(SetTensorValue(v, *index, tensor));
+    (*index)++;
+    return Status::OK();
+  };
+  return VisitNestedLists(val, on_list, on_value);
+}
+
+// Allocates a tensor of `dtype`, whose shape is `batch_size` (if not negative)
+// followed by `item_shape`.
+//
+// The shape is only inferred from the first element of each list, and is not
+// validated yet. A dense tensor cannot have more values than the JSON has
+// bytes, so larger shapes are rejected before allocating the tensor.
+Status AllocateTensor(DataType dtype, int64 batch_size,
+                      const TensorShapeProto& item_shape, int64 max_num_values,
+                      Tensor* tensor) {
+  TensorShape shape;
+  if (batch_size >= 0) shape.AddDim(batch_size);
+  if (shape.dims() + item_shape.dim_size() > TensorShape::MaxDimensions()) {
+    return errors::InvalidArgument(
+        "Encountered list nested deeper than the max tensor rank: ",
+        TensorShape::MaxDimensions());
+  }
+  for (const auto& d : item_shape.dim()) {
+    if (d.size() > 0 && shape.num_elements() > max_num_values / d.size()) {
+      return errors::InvalidArgument(
+          "Encountered lists whose sizes do not match the number of values "
+          "in the JSON document");
+    }
+    shape.AddDim(d.size());
+  }
+  if (!DataTypeCanUseMemcpy(dtype) && dtype != DT_STRING) {
+    return errors::Unimplemented("Conversion of JSON values to type: ",
+                                 DataTypeString(dtype));
+  }
+  *tensor = Tensor(dtype, shape);
+  return Status::OK();
+}
+
+// Decodes the "instances" list into tensors. The shape of each tensor is
+// inferred from the first instance, and the tensor is allocated before the
+// values of all the instances are written into it. See
+// FillTensorMapFromInstancesList() for the format.
+Status DecodeTensorsFromInstancesList(
+    const rapidjson::Value::MemberIterator& itr,
+    const ::google::protobuf::Map<string, tensorflow::TensorInfo>& tensorinfo_map,
+    int64 max_num_values, std::map<string, Tensor>* tensors) {
+  if (!itr->value[0].IsObject() && tensorinfo_map.size() > 1) {
+    return errors::InvalidArgument(
+        "instances is a plain list, but expecting list of objects as multiple "
+        "input tensors required as per tensorinfo_map");
+  }
+
+  auto IsElementObject = [](const rapidjson::Value& val) {
+    return val.IsObject() && !IsValBase64Object(val);
+  };
+
+  const auto& instances = itr->value;
+  const bool elements_are_objects = IsElementObject(instances[0]);
+  const int64 num_instances = instances.Size();
+
+  std::set<string> input_names;
+  for (const auto& kv : tensorinfo_map) input_names.insert(kv.first);
+
+  // Shape of one instance, and next flat index, of each tensor.
+  struct DecodedTensor {
+    TensorShapeProto item_shape;
+    int64 index = 0;
+    Tensor* tensor;
+  };
+  std::map<string, DecodedTensor> decoded;
+  tensors->clear();
+
+  // Adds the value of an instance to the tensor `name`. The tensor is
+  // allocated on the first instance.
+  auto add_item = [&](const rapidjson::Value& item,
+                      const string& name) -> Status {
+    auto decoded_itr = decoded.find(name);
+    if (decoded_itr == decoded.end()) {
+      if (!tensorinfo_map.count(name)) {
+        return errors::InvalidArgument(
+            "JSON object: does not have named input: ", name);
+      }
+      DecodedTensor& decoded_tensor = decoded[name];
+      GetDenseTensorShape(item, &decoded_tensor.item_shape);
+      decoded_tensor.tensor = &(*tensors)[name];
+      TF_RETURN_IF_ERROR(AllocateTensor(tensorinfo_map.at(name).dtype(),
+                                        num_instances,
+                                        decoded_tensor.item_shape,
+                                        max_num_values, decoded_tensor.tensor));
+      decoded_itr = decoded.find(name);
+    }
+    DecodedTensor& decoded_tensor = decoded_itr->second;
+    return FillTensor(item, decoded_tensor.item_shape, &decoded_tensor.index,
+                      decoded_tensor.tensor);
+  };
+
+  int tensor_count = 0;
+  for (const auto& elem : instances.GetArray()) {
+    if (elements_are_objects) {
+      if (!IsElementObject(elem)) {
+        return errors::InvalidArgument("Expecting object but got list at item ",
+                                       tensor_count, " of input list");
+      }
+      std::set<string> object_keys;
+      for (const auto& kv : elem.GetObject()) {
+        const string& name = kv.name.GetString();
+        object_keys.insert(name);
+        const auto status = add_item(kv.value, name);
+        if (!status.ok()) {
+          return errors::InvalidArgument(
+              "Failed to process element: ", tensor_count, " key: ", name,
+              " of 'instances' list. Error: ", status.ToString());
+        }
+      }
+      if (input_names != object_keys) {
+        return errors::InvalidArgument(
+            "Failed to process element: ", tensor_count,
+            " of 'instances' list. JSON object: ", JsonValueToString(elem),
+            " keys must be equal to: ", absl::StrJoin(input_names, ","));
+      }
+    } else {
+      if (IsElementObject(elem)) {
+        return errors::InvalidArgument(
+            "Expecting value/list but got object at item ", tensor_count,
+            " of input list");
+      }
+      const auto status = add_item(elem, tensorinfo_map.begin()->first);
+      if (!status.ok()) {
+        return errors::InvalidArgument(
+            "Failed to process element: ", tensor_count,
+            " of 'instances' list. Error: ", status.ToString());
+      }
+    }
+    tensor_count++;
+  }
+  return Status::OK();
+}
+
+// Decodes the "inputs" value into tensors. See FillTensorMapFromInputsMap()
+// for the format.
+Status DecodeTensorsFromInputsMap(
+    const rapidjson::Value::MemberIterator& itr,
+    const ::google::protobuf::Map<string, tensorflow::TensorInfo>& tensorinfo_map,
+    int64 max_num_values, std::map<string, Tensor>* tensors) {
+  auto decode = [max_num_values, tensors](const rapidjson::Value& val,
+                                          const string& name,
+                                          DataType dtype) -> Status {
+    TensorShapeProto shape;
+    GetDenseTensorShape(val, &shape);
+    Tensor* tensor = &(*tensors)[name];
+    TF_RETURN_IF_ERROR(
+        AllocateTensor(dtype, -1, shape, max_num_values, tensor));
+    int64 index = 0;
+    return FillTensor(val, shape, &index, tensor);
+  };
+
+  const rapidjson::Value& val = itr->value;
+  tensors->clear();
+  if (!val.IsObject() || IsValBase64Object(val)) {
+    if (tensorinfo_map.size() > 1) {
+      return errors::InvalidArgument(
+          "inputs is a plain value/list, but expecting an object as multiple "
+          "input tensors required as per tensorinfo_map");
+    }
+    return decode(val, tensorinfo_map.begin()->first,
+                  tensorinfo_map.begin()->second.dtype());
+  }
+  for (const auto& kv : tensorinfo_map) {
+    const auto& name = kv.first;
+    auto item = val.FindMember(name.c_str());
+    if (item == val.MemberEnd()) {
+      return errors::InvalidArgument("Missing named input: ", name,
+                                     " in 'inputs' object.");
+    }
+    TF_RETURN_IF_ERROR(decode(item->value, name, kv.second.dtype()));
+  }
+  return Status::OK();
+}
+
+// Parses a predict request JSON, fills in the signature name of `request`
+// and the input map of its signature, and finds the "instances" or "inputs"
+// member holding the tensors (as per `format`).
+Status ParsePredictRequestJson(
     const absl::string_view json,
-    const std::function<tensorflow::Status(
-        const string&, ::google::protobuf::Map<string, tensorflow::TensorInfo>*)>&
-        get_tensorinfo_map,
-    PredictRequest* request, JsonPredictRequestFormat* format) {
-  rapidjson::Document doc;
+    const TensorInfoMapLookup& lookup_tensorinfo_map, PredictRequest* request,
+    rapidjson::Document* doc,
+    const ::google::protobuf::Map<string, tensorflow::TensorInfo>** tensorinfo_map,
+    rapidjson::Value::MemberIterator* tensors_itr,
+    JsonPredictRequestFormat* format) {
   *format = JsonPredictRequestFormat::kInvalid;
-  TF_RETURN_IF_ERROR(ParseJson(json, &doc));
-  TF_RETURN_IF_ERROR(FillSignature(doc, request));
+  TF_RETURN_IF_ERROR(ParseJson(json, doc));
+  TF_RETURN_IF_ERROR(FillSignature(*doc, request));
 
-  ::google::protobuf::Map<string, tensorflow::TensorInfo> tensorinfo_map;
   const string& signame = request->model_spec().signature_name();
-  TF_RETURN_IF_ERROR(get_tensorinfo_map(signame, &tensorinfo_map));
-  if (tensorinfo_map.empty()) {
+  TF_RETURN_IF_ERROR(lookup_tensorinfo_map(signame, tensorinfo_map));
+  if ((*tensorinfo_map)->empty()) {
     return errors::InvalidArgument("Failed to get input map for signature: ",
                                    signame.empty() ? "DEFAULT" : signame);
   }
 
   //
-  // Fill in tensors from either "instances" or "inputs" key.
+  // Find tensors in either "instances" or "inputs" key.
   //
-  auto itr_instances = doc.FindMember(kPredictRequestInstancesKey);
-  auto itr_inputs = doc.FindMember(kPredictRequestInputsKey);
-  if (itr_instances != doc.MemberEnd()) {
-    if (itr_inputs != doc.MemberEnd()) {
-      return FormatError(doc, "Not formatted correctly expecting only",
+  auto itr_instances = doc->FindMember(kPredictRequestInstancesKey);
+  auto itr_inputs = doc->FindMember(kPredictRequestInputsKey);
+  if (itr_instances != doc->MemberEnd()) {
+    if (itr_inputs != doc->MemberEnd()) {
+      return FormatError(*doc, "Not formatted correctly expecting only",
         " one of '", kPredictRequestInputsKey, "' or '",
         kPredictRequestInstancesKey, "' keys to exist ");
     }
     if (!itr_instances->value.IsArray()) {
-      return FormatError(doc, "Expecting '",
+      return FormatError(*doc, "Expecting '",
         kPredictRequestInstancesKey, "' to be an list/array");
     }
     if (!itr_instances->value.Capacity()) {
-      return FormatError(doc, "No values in '",
+      return FormatError(*doc, "No values in '",
         kPredictRequestInstancesKey, "' array");
     }
     *format = JsonPredictRequestFormat::kRow;
-    return FillTensorMapFromInstancesList(itr_instances, tensorinfo_map,
-                                          request->mutable_inputs());
-  } else if (itr_inputs != doc.MemberEnd()) {
-    if (itr_instances != doc.MemberEnd()) {
-      return FormatError(doc, "Not formatted correctly expecting only",
-        " one of '", kPredictRequestInputsKey, "' or '",
-        kPredictRequestInstancesKey, "' keys to exist ");
-    }
+    *tensors_itr = itr_instances;
+    return Status::OK();
+  } else if (itr_inputs != doc->MemberEnd()) {
     *format = JsonPredictRequestFormat::kColumnar;
-    return FillTensorMapFromInputsMap(itr_inputs, tensorinfo_map,
-                                      request->mutable_inputs());
+    *tensors_itr = itr_inputs;
+    return Status::OK();
   }
   return errors::InvalidArgument("Missing 'inputs' or 'instances' key");
 }
 
+// Adapts a lookup copying the input map into `storage` to a
+// TensorInfoMapLookup.
+TensorInfoMapLookup CopyingTensorInfoMapLookup(
+    const std::function<tensorflow::Status(
+        const string&, ::google::protobuf::Map<string, tensorflow::TensorInfo>*)>&
+        get_tensorinfo_map,
+    ::google::protobuf::Map<string, tensorflow::TensorInfo>* storage) {
+  return [&get_tensorinfo_map, storage](
+             const string& signame,
+             const ::google::protobuf::Map<string, tensorflow::TensorInfo>** map) {
+    TF_RETURN_IF_ERROR(get_tensorinfo_map(signame, storage));
+    *map = storage;
+    return Status::OK();
+  };
+}
+
+}  // namespace
+
+Status FillPredictRequestFromJson(
+    const absl::string_view json,
+    const std::function<tensorflow::Status(
+        const string&, ::google::protobuf::Map<string, tensorflow::TensorInfo>*)>&
+        get_tensorinfo_map,
+    PredictRequest* request, JsonPredictRequestFormat* format) {
+  ::google::protobuf::Map<string, tensorflow::TensorInfo> tensorinfo_map;
+  return FillPredictRequestFromJson(
+      json, CopyingTensorInfoMapLookup(get_tensorinfo_map, &tensorinfo_map),
+      request, format);
+}
+
+Status FillPredictRequestFromJson(
+    const absl::string_view json,
+    const TensorInfoMapLookup& lookup_tensorinfo_map, PredictRequest* request,
+    JsonPredictRequestFormat* format) {
+  RequestDocument doc;
+  const ::google::protobuf::Map<string, tensorflow::TensorInfo>* tensorinfo_map;
+  rapidjson::Value::MemberIterator tensors_itr;
+  TF_RETURN_IF_ERROR(ParsePredictRequestJson(json, lookup_tensorinfo_map,
+                                             request, doc.get(),
+                                             &tensorinfo_map, &tensors_itr,
+                                             format));
+  if (*format == JsonPredictRequestFormat::kRow) {
+    return FillTensorMapFromInstancesList(tensors_itr, *tensorinfo_map,
+                                          request->mutable_inputs());
+  }
+  return FillTensorMapFromInputsMap(tensors_itr, *tensorinfo_map,
+                                    request->mutable_inputs());
+}
+
+Status FillPredictInputTensorsFromJson(
+    const absl::string_view json,
+    const std::function<tensorflow::Status(
+        const string&, ::google::protobuf::Map<string, tensorflow::TensorInfo>*)>&
+        get_tensorinfo_map,
+    PredictRequest* request, std::map<string, Tensor>* input_tensors,
+    JsonPredictRequestFormat* format) {
+  ::google::protobuf::Map<string, tensorflow::TensorInfo> tensorinfo_map;
+  return FillPredictInputTensorsFromJson(
+      json, CopyingTensorInfoMapLookup(get_tensorinfo_map, &tensorinfo_map),
+      request, input_tensors, format);
+}
+
+Status FillPredictInputTensorsFromJson(
+    const absl::string_view json,
+    const TensorInfoMapLookup& lookup_tensorinfo_map, PredictRequest* request,
+    std::map<string, Tensor>* input_tensors, JsonPredictRequestFormat* format) {
+  RequestDocument doc;
+  const ::google::protobuf::Map<string, tensorflow::TensorInfo>* tensorinfo_map;
+  rapidjson::Value::MemberIterator tensors_itr;
+  TF_RETURN_IF_ERROR(ParsePredictRequestJson(json, lookup_tensorinfo_map,
+                                             request, doc.get(),
+                                             &tensorinfo_map, &tensors_itr,
+                                             format));
+  if (*format == JsonPredictRequestFormat::kRow) {
+    return DecodeTensorsFromInstancesList(tensors_itr, *tensorinfo_map,
+                                          json.size(), input_tensors);
+  }
+  return DecodeTensorsFromInputsMap(tensors_itr, *tensorinfo_map, json.size(),
+                                    input_tensors);
+}
+
 namespace {
 
 bool IsFeatureOfKind(const Feature& feature, Feature::KindCase kind) {
@@ -758,10 +1370,39 @@ Status MakeExampleFromJsonObject(const rapidjson::Value& val,
   return Status::OK();
 }
 
+// Fills in the (optional) top_k and min_score of a classification request.
+Status FillClassifyRegressRequestOptions(const rapidjson::Document& doc,
+                                         ClassificationRequest* request) {
+  auto itr = doc.FindMember(kClassifyRequestTopKKey);
+  if (itr != doc.MemberEnd()) {
+    if (!itr->value.IsInt() || itr->value.GetInt() < 0) {
+      return FormatError(doc, "'", kClassifyRequestTopKKey,
+                         "' value must be a non-negative integer");
+    }
+    request->set_top_k(itr->value.GetInt());
+  }
+  itr = doc.FindMember(kClassifyRequestMinScoreKey);
+  if (itr != doc.MemberEnd()) {
+    if (!itr->value.IsNumber()) {
+      return FormatError(doc, "'", kClassifyRequestMinScoreKey,
+                         "' value must be a number");
+    }
+    request->mutable_min_score()->set_value(itr->value.GetFloat());
+  }
+  return Status::OK();
+}
+
+// Regression requests have no options.
+Status FillClassifyRegressRequestOptions(const rapidjson::Document& doc,
+                                         RegressionRequest* request) {
+  return Status::OK();
+}
+
 template <typename RequestProto>
 Status FillClassifyRegressRequestFromJson(const absl::string_view json,
                                           RequestProto* request) {
-  rapidjson::Document doc;
+  RequestDocument request_doc;
+  rapidjson::Document& doc = *request_doc.get();
   TF_RETURN_IF_ERROR(ParseJson(json, &doc));
   TF_RETURN_IF_ERROR(FillSignature(doc, request));
 
@@ -799,7 +1440,7 @@ Status FillClassifyRegressRequestFromJson(const absl::string_view json,
                  : input->mutable_example_list()->add_examples()));
   }
 
-  return Status::OK();
+  return FillClassifyRegressRequestOptions(doc, request);
 }
 
 }  // namespace
@@ -916,7 +1557,8 @@ Status AddTensorValues(const TensorProto& tensor, bool string_as_bytes, int dim,
 }
 
 Status MakeRowFormatJsonFromTensors(
-    const ::google::protobuf::Map<string, TensorProto>& tensor_map, string* json) {
+    const ::google::protobuf::Map<string, TensorProto>& tensor_map,
+    ChunkedStringStream* stream) {
   // Verify if each named tensor has same first dimension. The first dimension
   // is the batchsize and for an output to be consistent, all named tensors must
   // be batched to the same size.
@@ -941,8 +1583,7 @@ Status MakeRowFormatJsonFromTensors(
     offset_map.insert({name, 0});
   }
 
-  rapidjson::StringBuffer buffer;
-  rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+  RapidJsonWriter writer(*stream);
   writer.StartObject();
   writer.Key(kPredictResponsePredictionsKey);
   writer.StartArray();
@@ -964,14 +1605,13 @@ Status MakeRowFormatJsonFromTensors(
   }
   writer.EndArray();
   writer.EndObject();
-  json->assign(buffer.GetString());
   return Status::OK();
 }
 
 Status MakeColumnarFormatJsonFromTensors(
-    const ::google::protobuf::Map<string, TensorProto>& tensor_map, string* json) {
-  rapidjson::StringBuffer buffer;
-  rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+    const ::google::protobuf::Map<string, TensorProto>& tensor_map,
+    ChunkedStringStream* stream) {
+  RapidJsonWriter writer(*stream);
   writer.StartObject();
   writer.Key(kPredictResponseOutputsKey);
   const bool elements_are_objects = tensor_map.size() > 1;
@@ -986,28 +1626,78 @@ Status MakeColumnarFormatJsonFromTensors(
   }
   if (elements_are_objects) writer.EndObject();
   writer.EndObject();
-  json->assign(buffer.GetString());
   return Status::OK();
 }
 
-}  // namespace
+// Sets 'field_tensor_map' to 'tensor_map' with the tensors serialized in
+// tensor_content, e.g. by predict responses, serialized in their typed fields,
+// which are what the JSON is written from. Sets 'converted' to false, leaving
+// 'field_tensor_map' empty, if there is none.
+Status ToFieldTensorMap(
+    const ::google::protobuf::Map<string, TensorProto>& tensor_map,
+    ::google::protobuf::Map<string, TensorProto>* field_tensor_map,
+    bool* converted) {
+  *converted = false;
+  for (const auto& kv : tensor_map) {
+    if (kv.second.tensor_content().empty()) {
+      continue;
+    }
+    if (!*converted) {
+      *field_tensor_map = tensor_map;
+      *converted = true;
+    }
+    Tensor tensor;
+    if (!tensor.FromProto(kv.second)) {
+      return errors::InvalidArgument("Tensor name: ", kv.first,
+                                     " has invalid tensor_content");
+    }
+    tensor.AsProtoField(&(*field_tensor_map)[kv.first]);
+  }
+  return Status::OK();
+}
 
-Status MakeJsonFromTensors(const ::google::protobuf::Map<string, TensorProto>& tensor_map,
-                           JsonPredictRequestFormat format, string* json) {
+Status MakeJsonFromTensorsToStream(
+    const ::google::protobuf::Map<string, TensorProto>& tensor_map,
+    JsonPredictRequestFormat format, ChunkedStringStream* stream) {
   if (tensor_map.empty()) {
     return errors::InvalidArgument("Cannot convert empty tensor map to JSON");
   }
+  ::google::protobuf::Map<string, TensorProto> field_tensor_map;
+  bool converted;
+  TF_RETURN_IF_ERROR(
+      ToFieldTensorMap(tensor_map, &field_tensor_map, &converted));
+  const auto& tensors = converted ? field_tensor_map : tensor_map;
 
   switch (format) {
     case JsonPredictRequestFormat::kInvalid:
       return errors::InvalidArgument("Invalid request format");
     case JsonPredictRequestFormat::kRow:
-      return MakeRowFormatJsonFromTensors(tensor_map, json);
+      return MakeRowFormatJsonFromTensors(tensors, stream);
     case JsonPredictRequestFormat::kColumnar:
-      return MakeColumnarFormatJsonFromTensors(tensor_map, json);
+      return MakeColumnarFormatJsonFromTensors(tensors, stream);
   }
 }
 
+}  // namespace
+
+Status MakeJsonFromTensors(const ::google::protobuf::Map<string, TensorProto>& tensor_map,
+                           JsonPredictRequestFormat format, string* json) {
+  ChunkedStringStream stream;
+  TF_RETURN_IF_ERROR(MakeJsonFromTensorsToStream(tensor_map, format, &stream));
+  json->swap(*stream.buffer());
+  return Status::OK();
+}
+
+Status MakeJsonFromTensors(
+    const ::google::protobuf::Map<string, TensorProto>& tensor_map,
+    JsonPredictRequestFormat format, const size_t chunk_size,
+    const std::function<void(absl::string_view)>& write_chunk, string* json) {
+  ChunkedStringStream stream(chunk_size, &write_chunk);
+  TF_RETURN_IF_ERROR(MakeJsonFromTensorsToStream(tensor_map, format, &stream));
+  json->swap(*stream.buffer());
+  return Status::OK();
+}
+
 Status MakeJsonFromClassificationResult(const ClassificationResult& result,
                                         string* json) {
   if (result.classifications_size() == 0) {
@@ -1015,8 +1705,8 @@ Status MakeJsonFromClassificationResult(const ClassificationResult& result,
         "Cannot convert empty ClassificationResults to JSON");
   }
 
-  rapidjson::StringBuffer buffer;
-  rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+  ChunkedStringStream stream;
+  RapidJsonWriter writer(stream);
   writer.StartObject();
   writer.Key(kClassifyRegressResponseKey);
   writer.StartArray();
@@ -1040,7 +1730,7 @@ Status MakeJsonFromClassificationResult(const ClassificationResult& result,
   }
   writer.EndArray();
   writer.EndObject();
-  json->assign(buffer.GetString());
+  json->swap(*stream.buffer());
   return Status::OK();
 }
 
@@ -1051,8 +1741,8 @@ Status MakeJsonFromRegressionResult(const RegressionResult& result,
         "Cannot convert empty RegressionResults to JSON");
   }
 
-  rapidjson::StringBuffer buffer;
-  rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+  ChunkedStringStream stream;
+  RapidJsonWriter writer(stream);
   writer.StartObject();
   writer.Key(kClassifyRegressResponseKey);
   writer.SetFormatOptions(rapidjson::kFormatSingleLineArray);
@@ -1065,7 +1755,7 @@ Status MakeJsonFromRegressionResult(const RegressionResult& result,
   }
   writer.EndArray();
   writer.EndObject();
-  json->assign(buffer.GetString());
+  json->swap(*stream.buffer());
   return Status::OK();
 }
 
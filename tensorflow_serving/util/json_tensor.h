@@ -17,9 +17,11 @@ limitations under the License.
 #define TENSORFLOW_SERVING_UTIL_JSON_TENSOR_H_
 
 #include <functional>
+#include <map>
 #include <string>
 
 #include "absl/strings/string_view.h"
+#include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor.pb.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/protobuf/meta_graph.pb.h"
@@ -149,6 +151,38 @@ tensorflow::Status FillPredictRequestFromJson(
         get_tensorinfo_map,
     PredictRequest* request, JsonPredictRequestFormat* format);
 
+// Like FillPredictRequestFromJson() above, but decodes the input tensors
+// directly into `input_tensors` (keyed by input name), without going through
+// the TensorProtos of `request.inputs`. The shape of each tensor is inferred
+// from the JSON values (for the row format, from the first instance), and the
+// values are then written in the preallocated tensor buffers.
+//
+// Only `model_spec.signature_name` of the request proto is filled in. The
+// JSON is validated as in FillPredictRequestFromJson().
+tensorflow::Status FillPredictInputTensorsFromJson(
+    const absl::string_view json,
+    const std::function<tensorflow::Status(
+        const string&, ::google::protobuf::Map<string, tensorflow::TensorInfo>*)>&
+        get_tensorinfo_map,
+    PredictRequest* request, std::map<string, Tensor>* input_tensors,
+    JsonPredictRequestFormat* format);
+
+// Looks up the input map of a signature (given by name) without copying it.
+// The map must stay alive until the function it is passed to returns.
+using TensorInfoMapLookup = std::function<tensorflow::Status(
+    const string&, const ::google::protobuf::Map<string, tensorflow::TensorInfo>**)>;
+
+// Same as the functions above, with the input map of the signature looked up
+// instead of copied, e.g. from a cache.
+tensorflow::Status FillPredictRequestFromJson(
+    const absl::string_view json,
+    const TensorInfoMapLookup& lookup_tensorinfo_map, PredictRequest* request,
+    JsonPredictRequestFormat* format);
+tensorflow::Status FillPredictInputTensorsFromJson(
+    const absl::string_view json,
+    const TensorInfoMapLookup& lookup_tensorinfo_map, PredictRequest* request,
+    std::map<string, Tensor>* input_tensors, JsonPredictRequestFormat* format);
+
 // Fills ClassificationRequest proto from a JSON object.
 //
 // `json` string is parsed to create `Example` protos and added to
@@ -260,6 +294,17 @@ tensorflow::Status MakeJsonFromTensors(
     const ::google::protobuf::Map<string, tensorflow::TensorProto>& tensor_map,
     JsonPredictRequestFormat format, string* json);
 
+// Same as above, but the JSON is not built as a single string: each time
+// `chunk_size` bytes of it are produced, they are passed to `write_chunk`.
+// On return, `json` holds the remaining (possibly empty) end of the JSON.
+//
+// If an error is returned after `write_chunk` was called, the JSON passed to
+// it is incomplete.
+tensorflow::Status MakeJsonFromTensors(
+    const ::google::protobuf::Map<string, tensorflow::TensorProto>& tensor_map,
+    JsonPredictRequestFormat format, size_t chunk_size,
+    const std::function<void(absl::string_view)>& write_chunk, string* json);
+
 // Make JSON object from ClassificationResult proto.
 //
 // The output JSON object is formatted as follows:
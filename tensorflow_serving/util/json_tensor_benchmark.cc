@@ -0,0 +1,295 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Benchmarks of the JSON codec of the REST API: the parsing of the Predict and
+// Classify requests, and the writing of the Predict and Classify responses.
+//
+// The payloads are the shapes served in practice, from 1 to 10k instances:
+//   wide_float: one float tensor of 256 values per instance.
+//   tfdf: 24 string and 8 float named features per instance, as sent to the
+//     TF-DF models.
+//   base64: one 1KB bytes tensor per instance, base64 encoded.
+// Reported counters, besides the time and the throughput (bytes/s, of JSON):
+//   allocs_per_mb, alloc_bytes_per_mb: Heap allocations of the benchmark
+//     thread, per MB of JSON.
+//
+// Run with:
+// bazel run -c opt --dynamic_mode=off \
+// tensorflow_serving/util:json_tensor_benchmark -- --benchmarks=.
+
+#include <functional>
+#include <string>
+
+#include "google/protobuf/map.h"
+#include "absl/strings/escaping.h"
+#include "absl/strings/str_cat.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/framework/types.pb.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/init_main.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow/core/protobuf/meta_graph.pb.h"
+#include "tensorflow_serving/apis/classification.pb.h"
+#include "tensorflow_serving/apis/predict.pb.h"
+#include "tensorflow_serving/util/json_tensor.h"
+#include "tensorflow_serving/util/request_memory.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+using TensorInfoMap = ::google::protobuf::Map<string, TensorInfo>;
+using TensorMap = ::google::protobuf::Map<string, TensorProto>;
+
+// The payload shapes, see the top of the file.
+enum class Payload { kWideFloat, kTfdf, kBase64 };
+
+constexpr int kWideFloatSize = 256;
+constexpr int kNumTfdfStringFeatures = 24;
+constexpr int kNumTfdfFloatFeatures = 8;
+constexpr int kBase64BytesSize = 1024;
+
+string StringFeatureName(const int i) { return absl::StrCat("s", i); }
+
+string FloatFeatureName(const int i) { return absl::StrCat("f", i); }
+
+// Returns the inputs of 'payload', by name.
+TensorInfoMap MakeTensorInfoMap(const Payload payload) {
+  TensorInfoMap infos;
+  switch (payload) {
+    case Payload::kWideFloat:
+      infos["x"].set_dtype(DT_FLOAT);
+      break;
+    case Payload::kTfdf:
+      for (int i = 0; i < kNumTfdfStringFeatures; ++i) {
+        infos[StringFeatureName(i)].set_dtype(DT_STRING);
+      }
+      for (int i = 0; i < kNumTfdfFloatFeatures; ++i) {
+        infos[FloatFeatureName(i)].set_dtype(DT_FLOAT);
+      }
+      break;
+    case Payload::kBase64:
+      infos["image_bytes"].set_dtype(DT_STRING);
+      break;
+  }
+  return infos;
+}
+
+// Returns the row format Predict request of 'num_instances' instances of
+// 'payload'.
+string MakePredictRequestJson(const Payload payload, const int num_instances) {
+  const string bytes = absl::Base64Escape(string(kBase64BytesSize, '\x7f'));
+  string json = "{\"instances\": [";
+  for (int i = 0; i < num_instances; ++i) {
+    if (i > 0) {
+      absl::StrAppend(&json, ",");
+    }
+    switch (payload) {
+      case Payload::kWideFloat:
+        absl::StrAppend(&json, "{\"x\": [");
+        for (int j = 0; j < kWideFloatSize; ++j) {
+          absl::StrAppend(&json, j > 0 ? "," : "", (i + j) * 0.125f);
+        }
+        absl::StrAppend(&json, "]}");
+        break;
+      case Payload::kTfdf:
+        absl::StrAppend(&json, "{");
+        for (int j = 0; j < kNumTfdfStringFeatures; ++j) {
+          absl::StrAppend(&json, j > 0 ? "," : "", "\"", StringFeatureName(j),
+                          "\": \"category_", (i + j) % 100, "\"");
+        }
+        for (int j = 0; j < kNumTfdfFloatFeatures; ++j) {
+          absl::StrAppend(&json, ",\"", FloatFeatureName(j),
+                          "\": ", (i + j) * 0.5f);
+        }
+        absl::StrAppend(&json, "}");
+        break;
+      case Payload::kBase64:
+        absl::StrAppend(&json, "{\"image_bytes\": {\"b64\": \"", bytes,
+                        "\"}}");
+        break;
+    }
+  }
+  absl::StrAppend(&json, "]}");
+  return json;
+}
+
+// Returns the Classify request of 'num_instances' examples with the TF-DF
+// features.
+string MakeClassifyRequestJson(const int num_instances) {
+  string json = "{\"examples\": [";
+  for (int i = 0; i < num_instances; ++i) {
+    absl::StrAppend(&json, i > 0 ? "," : "", "{");
+    for (int j = 0; j < kNumTfdfStringFeatures; ++j) {
+      absl::StrAppend(&json, j > 0 ? "," : "", "\"", StringFeatureName(j),
+                      "\": \"category_", (i + j) % 100, "\"");
+    }
+    for (int j = 0; j < kNumTfdfFloatFeatures; ++j) {
+      absl::StrAppend(&json, ",\"", FloatFeatureName(j), "\": ", (i + j) * 0.5f);
+    }
+    absl::StrAppend(&json, "}");
+  }
+  absl::StrAppend(&json, "]}");
+  return json;
+}
+
+// Returns the outputs of a classifier of 'num_instances' instances: the scores
+// of 16 classes and the top class.
+TensorMap MakePredictResponseTensors(const int num_instances) {
+  Tensor scores(DT_FLOAT, TensorShape({num_instances, 16}));
+  auto scores_flat = scores.flat<float>();
+  for (int i = 0; i < scores_flat.size(); ++i) {
+    scores_flat(i) = (i % 16) / 16.0f;
+  }
+  Tensor classes(DT_STRING, TensorShape({num_instances}));
+  auto classes_flat = classes.flat<tstring>();
+  for (int i = 0; i < num_instances; ++i) {
+    classes_flat(i) = absl::StrCat("class_", i % 16);
+  }
+  TensorMap tensors;
+  scores.AsProtoTensorContent(&tensors["scores"]);
+  classes.AsProtoField(&tensors["classes"]);
+  return tensors;
+}
+
+// Returns the Classify result of 'num_instances' instances of 3 classes.
+ClassificationResult MakeClassificationResult(const int num_instances) {
+  ClassificationResult result;
+  for (int i = 0; i < num_instances; ++i) {
+    Classifications* classifications = result.add_classifications();
+    for (int j = 0; j < 3; ++j) {
+      Class* c = classifications->add_classes();
+      c->set_label(absl::StrCat("class_", j));
+      c->set_score((i + j) % 10 / 10.0f);
+    }
+  }
+  return result;
+}
+
+// Runs 'codec' for each iteration of 'state', and reports the throughput and
+// the allocations per MB of the 'json_size' bytes of JSON it reads or writes.
+void RunCodec(::testing::benchmark::State& state, const size_t json_size,
+              const std::function<void()>& codec) {
+  RequestMemoryStats memory;
+  for (auto s : state) {
+    ScopedRequestMemory request_memory;
+    codec();
+    memory.allocated_bytes += request_memory.stats().allocated_bytes;
+    memory.num_allocations += request_memory.stats().num_allocations;
+  }
+  state.SetBytesProcessed(state.iterations() * json_size);
+  const double total_mb =
+      state.iterations() * json_size / (1024.0 * 1024.0);
+  if (RequestMemoryMetricsEnabled() && total_mb > 0) {
+    state.counters["allocs_per_mb"] = memory.num_allocations / total_mb;
+    state.counters["alloc_bytes_per_mb"] = memory.allocated_bytes / total_mb;
+  }
+}
+
+void BM_FillPredictRequestFromJson(::testing::benchmark::State& state) {
+  const Payload payload = static_cast<Payload>(state.range(0));
+  const string json = MakePredictRequestJson(payload, state.range(1));
+  const TensorInfoMap infos = MakeTensorInfoMap(payload);
+  const auto get_tensorinfo_map = [&infos](const string&, TensorInfoMap* map) {
+    *map = infos;
+    return Status::OK();
+  };
+  RunCodec(state, json.size(), [&]() {
+    PredictRequest request;
+    JsonPredictRequestFormat format;
+    TF_CHECK_OK(
+        FillPredictRequestFromJson(json, get_tensorinfo_map, &request, &format));
+  });
+}
+
+void BM_FillClassificationRequestFromJson(::testing::benchmark::State& state) {
+  const string json = MakeClassifyRequestJson(state.range(0));
+  RunCodec(state, json.size(), [&]() {
+    ClassificationRequest request;
+    TF_CHECK_OK(FillClassificationRequestFromJson(json, &request));
+  });
+}
+
+void BM_MakeJsonFromTensors(::testing::benchmark::State& state) {
+  const JsonPredictRequestFormat format =
+      state.range(0) == 0 ? JsonPredictRequestFormat::kRow
+                          : JsonPredictRequestFormat::kColumnar;
+  const TensorMap tensors = MakePredictResponseTensors(state.range(1));
+  string json;
+  TF_CHECK_OK(MakeJsonFromTensors(tensors, format, &json));
+  RunCodec(state, json.size(), [&]() {
+    string output;
+    TF_CHECK_OK(MakeJsonFromTensors(tensors, format, &output));
+  });
+}
+
+void BM_MakeJsonFromClassificationResult(::testing::benchmark::State& state) {
+  const ClassificationResult result = MakeClassificationResult(state.range(0));
+  string json;
+  TF_CHECK_OK(MakeJsonFromClassificationResult(result, &json));
+  RunCodec(state, json.size(), [&]() {
+    string output;
+    TF_CHECK_OK(MakeJsonFromClassificationResult(result, &output));
+  });
+}
+
+constexpr int kNumInstances[] = {1, 10, 100, 1000, 10000};
+
+// Every payload, with 1 to 10k instances.
+void PayloadsAndInstances(::testing::benchmark::internal::Benchmark* benchmark) {
+  for (const Payload payload :
+       {Payload::kWideFloat, Payload::kTfdf, Payload::kBase64}) {
+    for (const int num_instances : kNumInstances) {
+      benchmark->ArgPair(static_cast<int>(payload), num_instances);
+    }
+  }
+}
+
+// The row (0) and the columnar (1) formats, with 1 to 10k instances.
+void FormatsAndInstances(::testing::benchmark::internal::Benchmark* benchmark) {
+  for (const int format : {0, 1}) {
+    for (const int num_instances : kNumInstances) {
+      benchmark->ArgPair(format, num_instances);
+    }
+  }
+}
+
+// 1 to 10k instances.
+void Instances(::testing::benchmark::internal::Benchmark* benchmark) {
+  for (const int num_instances : kNumInstances) {
+    benchmark->Arg(num_instances);
+  }
+}
+
+BENCHMARK(BM_FillPredictRequestFromJson)->Apply(PayloadsAndInstances);
+BENCHMARK(BM_FillClassificationRequestFromJson)->Apply(Instances);
+BENCHMARK(BM_MakeJsonFromTensors)->Apply(FormatsAndInstances);
+BENCHMARK(BM_MakeJsonFromClassificationResult)->Apply(Instances);
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
+
+int main(int argc, char** argv) {
+  tensorflow::port::InitMain(argv[0], &argc, &argv);
+  // The allocator hooks are only linked on glibc, see request_memory.h.
+  tensorflow::serving::EnableRequestMemoryMetrics().IgnoreError();
+  tensorflow::testing::RunBenchmarks();
+  return 0;
+}
@@ -15,6 +15,13 @@ limitations under the License.
 
 #include "tensorflow_serving/util/json_tensor.h"
 
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
 #include "google/protobuf/message.h"
 #include "google/protobuf/text_format.h"
 #include "google/protobuf/util/message_differencer.h"
@@ -22,7 +29,10 @@ limitations under the License.
 #include "rapidjson/error/en.h"
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
 #include "absl/strings/substitute.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
 #include "tensorflow/core/platform/protobuf.h"
@@ -602,6 +612,162 @@ TEST(JsontensorTest, MultipleNamedTensorColumnarFormat) {
               )"));
 }
 
+// Checks that decoding `json` directly into tensors gives the same tensors as
+// decoding it into TensorProtos.
+void ExpectInputTensorsMatchProtos(const string& json,
+                                   const TensorInfoMap& infomap) {
+  PredictRequest req;
+  JsonPredictRequestFormat proto_format;
+  TF_ASSERT_OK(
+      FillPredictRequestFromJson(json, getmap(infomap), &req, &proto_format));
+
+  PredictRequest tensor_req;
+  std::map<string, Tensor> tensors;
+  JsonPredictRequestFormat tensor_format;
+  TF_ASSERT_OK(FillPredictInputTensorsFromJson(
+      json, getmap(infomap), &tensor_req, &tensors, &tensor_format));
+  EXPECT_EQ(tensor_format, proto_format);
+  EXPECT_EQ(tensor_req.model_spec().signature_name(),
+            req.model_spec().signature_name());
+  EXPECT_TRUE(tensor_req.inputs().empty());
+
+  ASSERT_EQ(tensors.size(), req.inputs().size());
+  for (const auto& kv : req.inputs()) {
+    Tensor expected;
+    ASSERT_TRUE(expected.FromProto(kv.second));
+    ASSERT_EQ(tensors.count(kv.first), 1);
+    test::ExpectEqual(tensors.at(kv.first), expected);
+  }
+}
+
+TEST(JsontensorTest, InputTensorsWithLookedUpMap) {
+  TensorInfoMap infomap;
+  ASSERT_TRUE(
+      TextFormat::ParseFromString("dtype: DT_INT32", &infomap["default"]));
+
+  string looked_up_signature;
+  const TensorInfoMapLookup lookup =
+      [&infomap, &looked_up_signature](const string& signame,
+                                       const TensorInfoMap** map) {
+        looked_up_signature = signame;
+        *map = &infomap;
+        return Status::OK();
+      };
+
+  PredictRequest req;
+  std::map<string, Tensor> tensors;
+  JsonPredictRequestFormat format;
+  TF_ASSERT_OK(FillPredictInputTensorsFromJson(
+      R"({"signature_name": "sig", "instances": [[1,2],[3,4]]})", lookup, &req,
+      &tensors, &format));
+  EXPECT_EQ(looked_up_signature, "sig");
+  EXPECT_EQ(format, JsonPredictRequestFormat::kRow);
+  test::ExpectTensorEqual<int32>(
+      tensors.at("default"),
+      test::AsTensor<int32>({1, 2, 3, 4}, TensorShape({2, 2})));
+
+  PredictRequest proto_req;
+  TF_ASSERT_OK(FillPredictRequestFromJson(R"({"inputs": [1, 2]})", lookup,
+                                          &proto_req, &format));
+  EXPECT_EQ(format, JsonPredictRequestFormat::kColumnar);
+  EXPECT_EQ(proto_req.inputs().size(), 1);
+}
+
+TEST(JsontensorTest, InputTensorsRowFormat) {
+  TensorInfoMap infomap;
+  ASSERT_TRUE(
+      TextFormat::ParseFromString("dtype: DT_INT32", &infomap["int_tensor"]));
+  ASSERT_TRUE(
+      TextFormat::ParseFromString("dtype: DT_STRING", &infomap["str_tensor"]));
+  ASSERT_TRUE(
+      TextFormat::ParseFromString("dtype: DT_FLOAT", &infomap["float_tensor"]));
+  ASSERT_TRUE(
+      TextFormat::ParseFromString("dtype: DT_BOOL", &infomap["bool_tensor"]));
+
+  ExpectInputTensorsMatchProtos(R"(
+    {
+      "signature_name": "serving_default",
+      "instances": [
+        {
+          "int_tensor": [[1,2],[3,4],[5,6]],
+          "str_tensor": ["foo", { "b64" : "aGVsbG8=" }],
+          "float_tensor": 1.5,
+          "bool_tensor": []
+        },
+        {
+          "int_tensor": [[7,8],[9,0],[1,2]],
+          "str_tensor": ["baz", "bat"],
+          "float_tensor": 2,
+          "bool_tensor": []
+        }
+      ]
+    })",
+                                infomap);
+
+  TensorInfoMap single_infomap;
+  ASSERT_TRUE(TextFormat::ParseFromString("dtype: DT_DOUBLE",
+                                          &single_infomap["default"]));
+  ExpectInputTensorsMatchProtos(R"({"instances": [[1, 2.5], [3, 4]]})",
+                                single_infomap);
+}
+
+TEST(JsontensorTest, InputTensorsColumnarFormat) {
+  TensorInfoMap infomap;
+  ASSERT_TRUE(
+      TextFormat::ParseFromString("dtype: DT_INT64", &infomap["int_tensor"]));
+  ASSERT_TRUE(
+      TextFormat::ParseFromString("dtype: DT_STRING", &infomap["bin_tensor"]));
+
+  ExpectInputTensorsMatchProtos(R"(
+    {
+      "inputs": {
+        "int_tensor": [[[1,2],[3,4],[5,6]]],
+        "bin_tensor": { "b64" : "aGVsbG8=" }
+      }
+    })",
+                                infomap);
+
+  TensorInfoMap single_infomap;
+  ASSERT_TRUE(TextFormat::ParseFromString("dtype: DT_UINT8",
+                                          &single_infomap["default"]));
+  ExpectInputTensorsMatchProtos(R"({"inputs": [[1, 2], [3, 4]]})",
+                                single_infomap);
+}
+
+TEST(JsontensorTest, InputTensorsErrors) {
+  TensorInfoMap infomap;
+  ASSERT_TRUE(
+      TextFormat::ParseFromString("dtype: DT_INT32", &infomap["default"]));
+
+  PredictRequest req;
+  std::map<string, Tensor> tensors;
+  JsonPredictRequestFormat format;
+  for (const char* json : {
+           R"({"instances": [[1,2],[3,4],[5,6,7]]})",
+           R"({"instances": [[1,2],[3,4],[[5,6]]]})",
+           R"({"instances": [1, [1]]})",
+           R"({"instances": [[1,2],["a", "b"]]})",
+           R"({"inputs": [[1,2],[3]]})",
+           R"({"inputs": {"other": [1]}})",
+           R"({"instances": [{"default": [1]}, {"other": [1]}]})",
+       }) {
+    const Status status = FillPredictInputTensorsFromJson(
+        json, getmap(infomap), &req, &tensors, &format);
+    EXPECT_TRUE(errors::IsInvalidArgument(status)) << json;
+  }
+
+  // The shape inferred from the first elements of the lists is larger than
+  // the number of values of the document. It is rejected before allocating
+  // the tensor.
+  const Status status = FillPredictInputTensorsFromJson(
+      R"({"inputs": [[[[[1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1],1,1,1,1,1,1,
+         1,1,1,1,1,1,1,1,1,1,1,1,1,1],1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
+         1],1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1]]})",
+      getmap(infomap), &req, &tensors, &format);
+  ASSERT_TRUE(errors::IsInvalidArgument(status));
+  EXPECT_THAT(status.error_message(), HasSubstr("do not match the number"));
+}
+
 TEST(JsontensorTest, SingleUnnamedTensorErrors) {
   TensorInfoMap infomap;
   ASSERT_TRUE(
@@ -665,6 +831,41 @@ TEST(JsontensorTest, SingleUnnamedTensorErrors) {
   EXPECT_THAT(status.error_message(), HasSubstr("not of expected type"));
 }
 
+TEST(JsontensorTest, DeeplyNestedListsErrors) {
+  TensorInfoMap infomap;
+  ASSERT_TRUE(
+      TextFormat::ParseFromString("dtype: DT_INT32", &infomap["default"]));
+
+  PredictRequest req;
+  std::map<string, Tensor> tensors;
+  JsonPredictRequestFormat format;
+
+  // Parsing does not recurse for each level of nesting.
+  const string unterminated = absl::StrCat(
+      R"({"instances": )", string(1000000, '['));
+  Status status = FillPredictRequestFromJson(unterminated, getmap(infomap),
+                                             &req, &format);
+  ASSERT_TRUE(errors::IsInvalidArgument(status));
+  EXPECT_THAT(status.error_message(), HasSubstr("JSON Parse error"));
+
+  // Neither does filling the tensors, which rejects lists nested deeper than
+  // the max rank of a tensor.
+  constexpr int kDepth = 100000;
+  for (const char* key : {"instances", "inputs"}) {
+    const string json =
+        absl::StrCat(R"({")", key, R"(": [)", string(kDepth, '['), "1",
+                     string(kDepth, ']'), "]}");
+    status = FillPredictRequestFromJson(json, getmap(infomap), &req, &format);
+    ASSERT_TRUE(errors::IsInvalidArgument(status)) << key;
+    EXPECT_THAT(status.error_message(), HasSubstr("max tensor rank")) << key;
+
+    status = FillPredictInputTensorsFromJson(json, getmap(infomap), &req,
+                                             &tensors, &format);
+    ASSERT_TRUE(errors::IsInvalidArgument(status)) << key;
+    EXPECT_THAT(status.error_message(), HasSubstr("max tensor rank")) << key;
+  }
+}
+
 TEST(JsontensorTest, MultipleNamedTensorErrors) {
   TensorInfoMap infomap;
 
@@ -831,6 +1032,28 @@ TEST(JsontensorTest, FromJsonSingleTensor) {
     ]})"));
 }
 
+TEST(JsontensorTest, FromTensorContent) {
+  TensorMap tensormap;
+  test::AsTensor<int32>({1, 2, 3, 4}, {2, 2})
+      .AsProtoTensorContent(&tensormap["int_tensor"]);
+  test::AsTensor<float>({0.5, 1.5}, {2})
+      .AsProtoField(&tensormap["float_tensor"]);
+
+  string json;
+  TF_EXPECT_OK(MakeJsonFromTensors(tensormap,
+                                   JsonPredictRequestFormat::kColumnar, &json));
+  TF_EXPECT_OK(CompareJson(json, R"({
+    "outputs": {
+      "int_tensor": [[1, 2], [3, 4]],
+      "float_tensor": [0.5, 1.5]
+    }})"));
+
+  tensormap["int_tensor"].set_tensor_content("12345");
+  EXPECT_FALSE(
+      MakeJsonFromTensors(tensormap, JsonPredictRequestFormat::kRow, &json)
+          .ok());
+}
+
 TEST(JsontensorTest, FromJsonSingleScalarTensor) {
   TensorMap tensormap;
   ASSERT_TRUE(TextFormat::ParseFromString(R"(
@@ -857,6 +1080,41 @@ TEST(JsontensorTest, FromJsonSingleScalarTensor) {
   TF_EXPECT_OK(CompareJson(json, R"({ "outputs": [1, 2, 3, 4, 5] })"));
 }
 
+TEST(JsontensorTest, FromJsonChunked) {
+  TensorMap tensormap;
+  ASSERT_TRUE(TextFormat::ParseFromString(R"(
+    dtype: DT_INT32
+    tensor_shape {
+      dim { size: 5 }
+    }
+    int_val: 1
+    int_val: 2
+    int_val: 3
+    int_val: 4
+    int_val: 5
+    )",
+                                          &tensormap["int_tensor"]));
+
+  for (const auto format :
+       {JsonPredictRequestFormat::kRow, JsonPredictRequestFormat::kColumnar}) {
+    string expected_json;
+    TF_ASSERT_OK(MakeJsonFromTensors(tensormap, format, &expected_json));
+
+    std::vector<string> chunks;
+    string json;
+    TF_EXPECT_OK(MakeJsonFromTensors(
+        tensormap, format, /*chunk_size=*/8,
+        [&chunks](absl::string_view chunk) { chunks.emplace_back(chunk); },
+        &json));
+    EXPECT_GT(chunks.size(), 1);
+    for (const string& chunk : chunks) {
+      EXPECT_EQ(chunk.size(), 8);
+    }
+    EXPECT_LT(json.size(), 8);
+    EXPECT_EQ(absl::StrCat(absl::StrJoin(chunks, ""), json), expected_json);
+  }
+}
+
 TEST(JsontensorTest, FromJsonSingleBytesTensor) {
   TensorMap tensormap;
   ASSERT_TRUE(TextFormat::ParseFromString(R"(
@@ -911,6 +1169,76 @@ TEST(JsontensorTest, FromJsonSingleFloatTensorSixDigitPrecision) {
     ]})"));
 }
 
+// Tests floats that need more than six digits are written with the fewest
+// digits that round-trip.
+TEST(JsontensorTest, FromJsonSingleFloatTensorShortestRoundTrip) {
+  TensorMap tensormap;
+  ASSERT_TRUE(TextFormat::ParseFromString(R"(
+    dtype: DT_FLOAT
+    tensor_shape {
+      dim { size: 2 }
+      dim { size: 4 }
+    }
+    float_val: 0.1234567
+    float_val: -0.0
+    float_val: 9.96
+    float_val: 16777216
+    float_val: 123456792
+    float_val: 1e-13
+    float_val: 1e+21
+    float_val: 1e-30
+    )",
+                                          &tensormap["float_tensor"]));
+
+  string json;
+  TF_EXPECT_OK(
+      MakeJsonFromTensors(tensormap, JsonPredictRequestFormat::kRow, &json));
+  TF_EXPECT_OK(CompareJsonAllValuesAsStrings(json, R"({
+    "predictions": [
+      [0.1234567, -0.0, 9.96, 16777216.0],
+      [123456790.0, 1e-13, 1e+21, 1e-30]
+    ]})"));
+}
+
+// Tests random floats, of all magnitudes, are written with digits that parse
+// back to the same floats, whether they are parsed as floats or as doubles
+// then rounded to floats.
+TEST(JsontensorTest, FromJsonSingleFloatTensorRandomRoundTrip) {
+  constexpr int kNumValues = 100000;
+  std::mt19937 random(1234);
+  std::uniform_int_distribution<uint32> random_bits;
+  std::vector<float> values;
+  TensorMap tensormap;
+  TensorProto& tensor = tensormap["float_tensor"];
+  tensor.set_dtype(DT_FLOAT);
+  while (values.size() < kNumValues) {
+    const uint32 bits = random_bits(random);
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    if (!std::isfinite(value)) continue;
+    values.push_back(value);
+    tensor.add_float_val(value);
+  }
+  tensor.mutable_tensor_shape()->add_dim()->set_size(kNumValues);
+
+  string json;
+  TF_ASSERT_OK(
+      MakeJsonFromTensors(tensormap, JsonPredictRequestFormat::kRow, &json));
+  rapidjson::Document doc;
+  doc.Parse<rapidjson::kParseNumbersAsStringsFlag>(json.c_str());
+  ASSERT_FALSE(doc.HasParseError())
+      << rapidjson::GetParseError_En(doc.GetParseError());
+  const auto& predictions = doc["predictions"];
+  ASSERT_EQ(predictions.Size(), kNumValues);
+  for (int i = 0; i < kNumValues; i++) {
+    const string written = predictions[i].GetString();
+    EXPECT_EQ(std::strtof(written.c_str(), nullptr), values[i]) << written;
+    EXPECT_EQ(static_cast<float>(std::strtod(written.c_str(), nullptr)),
+              values[i])
+        << written;
+  }
+}
+
 TEST(JsontensorTest, FromJsonSingleFloatTensorNonFinite) {
   TensorMap tensormap;
   ASSERT_TRUE(TextFormat::ParseFromString(R"(
@@ -1494,6 +1822,40 @@ TYPED_TEST(ClassifyRegressRequestTest, JsonErrors) {
   EXPECT_THAT(status.error_message(), HasSubstr("Only int64 is supported"));
 }
 
+TEST(ClassifyRequestTest, TopKAndMinScore) {
+  ClassificationRequest req;
+  TF_EXPECT_OK(FillClassificationRequestFromJson(R"(
+    {
+      "top_k": 5,
+      "min_score": 0.25,
+      "examples": [ { "age": 20 } ]
+    })",
+                                                 &req));
+  EXPECT_EQ(req.top_k(), 5);
+  ASSERT_TRUE(req.has_min_score());
+  EXPECT_FLOAT_EQ(req.min_score().value(), 0.25);
+
+  req.Clear();
+  auto status = FillClassificationRequestFromJson(R"(
+    {
+      "top_k": -1,
+      "examples": [ { "age": 20 } ]
+    })",
+                                                  &req);
+  ASSERT_TRUE(errors::IsInvalidArgument(status));
+  EXPECT_THAT(status.error_message(), HasSubstr("non-negative integer"));
+
+  req.Clear();
+  status = FillClassificationRequestFromJson(R"(
+    {
+      "min_score": "high",
+      "examples": [ { "age": 20 } ]
+    })",
+                                             &req);
+  ASSERT_TRUE(errors::IsInvalidArgument(status));
+  EXPECT_THAT(status.error_message(), HasSubstr("must be a number"));
+}
+
 TEST(ClassifyRegressnResultTest, JsonFromClassificationResult) {
   ClassificationResult result;
   ASSERT_TRUE(TextFormat::ParseFromString(R"(
@@ -0,0 +1,64 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/memory_release.h"
+
+#include <unistd.h>
+
+#include <limits>
+#include <vector>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/mem.h"
+#include "tensorflow/core/platform/numbers.h"
+#include "tensorflow/core/platform/str_util.h"
+
+namespace tensorflow {
+namespace serving {
+
+int64 GetResidentSetSizeBytes() {
+  // "/proc/self/statm" is "<size> <resident> ..." in pages.
+  string statm;
+  if (!ReadFileToString(Env::Default(), "/proc/self/statm", &statm).ok()) {
+    return 0;
+  }
+  const std::vector<string> fields = str_util::Split(statm, ' ');
+  int64 resident_pages;
+  if (fields.size() < 2 ||
+      !strings::safe_strto64(fields[1], &resident_pages)) {
+    return 0;
+  }
+  return resident_pages * sysconf(_SC_PAGESIZE);
+}
+
+int64 ReleaseFreeMemoryToSystem() {
+  const int64 rss_before = GetResidentSetSizeBytes();
+  port::MallocExtension_ReleaseToSystem(std::numeric_limits<size_t>::max());
+#if defined(__GLIBC__)
+  malloc_trim(0);
+#endif
+  const int64 rss_after = GetResidentSetSizeBytes();
+  if (rss_before == 0 || rss_after == 0 || rss_after >= rss_before) {
+    return 0;
+  }
+  return rss_before - rss_after;
+}
+
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,41 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_UTIL_MEMORY_RELEASE_H_
+#define TENSORFLOW_SERVING_UTIL_MEMORY_RELEASE_H_
+
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace serving {
+
+// Returns the free memory held by the allocator (e.g. the pages of a servable
+// that was just unloaded) to the OS: with tcmalloc, if TensorFlow is built with
+// it, and with "malloc_trim" on glibc. Without this, the allocator may keep the
+// pages, and the resident memory of the process stays high while the next
+// version of the servable loads.
+//
+// Returns the decrease of the resident set size of the process, in bytes, or 0
+// if it is not known or did not decrease. Allocations on other threads at the
+// same time make it approximate.
+int64 ReleaseFreeMemoryToSystem();
+
+// The resident set size of the process, in bytes, or 0 if it is not known.
+int64 GetResidentSetSizeBytes();
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_UTIL_MEMORY_RELEASE_H_
@@ -0,0 +1,55 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/memory_release.h"
+
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+TEST(MemoryReleaseTest, ReportsTheResidentSetSize) {
+#if defined(__linux__)
+  EXPECT_GT(GetResidentSetSizeBytes(), 0);
+#endif
+}
+
+TEST(MemoryReleaseTest, ReleasesTheFreedMemory) {
+  constexpr int64 kNumBlocks = 64 * 1024;
+  constexpr int64 kBlockSize = 512;
+  int64 rss_with_blocks;
+  {
+    // Many small blocks, which the allocator keeps in its free lists.
+    std::vector<std::unique_ptr<char[]>> blocks;
+    for (int i = 0; i < kNumBlocks; ++i) {
+      blocks.emplace_back(new char[kBlockSize]());
+    }
+    rss_with_blocks = GetResidentSetSizeBytes();
+  }
+  const int64 released_bytes = ReleaseFreeMemoryToSystem();
+  EXPECT_LE(released_bytes, rss_with_blocks);
+#if defined(__linux__) && defined(__GLIBC__)
+  // The blocks were zeroed, so their pages were resident until trimmed.
+  EXPECT_GT(released_bytes, kNumBlocks * kBlockSize / 4);
+#endif
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
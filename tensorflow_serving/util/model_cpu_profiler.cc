@@ -0,0 +1,262 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/model_cpu_profiler.h"
+
+#if defined(__linux__)
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "absl/strings/str_cat.h"
+#include "tensorflow/core/lib/core/errors.h"
+
+namespace tensorflow {
+namespace serving {
+
+// The tag of a thread. A thread holds a slot while it is tagged.
+struct ModelCpuThreadSlot {
+  // 0 if the slot is free.
+  std::atomic<int64> thread_id{0};
+  std::atomic<ModelCpuTag*> tag{nullptr};
+};
+
+namespace {
+
+// The slots of the tagged threads. The signal handler looks up the slot of the
+// sampled thread by thread id: unlike thread_local variables, whose storage
+// may be allocated on first use, this is async-signal-safe.
+constexpr int kNumThreadSlots = 4096;
+ModelCpuThreadSlot thread_slots[kNumThreadSlots];
+
+// The slot held by the current thread. Only read outside the signal handler.
+thread_local ModelCpuThreadSlot* current_thread_slot = nullptr;
+
+// Tag of the samples of the threads working for no model.
+std::atomic<ModelCpuTag*> untagged_samples{nullptr};
+
+#if defined(__linux__)
+int64 CurrentThreadId() { return syscall(SYS_gettid); }
+#else
+int64 CurrentThreadId() { return 0; }
+#endif
+
+// Returns the slot held by thread 'thread_id', or null. Async-signal-safe.
+ModelCpuThreadSlot* FindThreadSlot(const int64 thread_id) {
+  const int first = thread_id % kNumThreadSlots;
+  for (int i = 0; i < kNumThreadSlots; ++i) {
+    ModelCpuThreadSlot* slot = &thread_slots[(first + i) % kNumThreadSlots];
+    if (slot->thread_id.load(std::memory_order_relaxed) == thread_id) {
+      return slot;
+    }
+  }
+  return nullptr;
+}
+
+// Takes a free slot for thread 'thread_id', or returns null if there is none.
+ModelCpuThreadSlot* TakeThreadSlot(const int64 thread_id) {
+  const int first = thread_id % kNumThreadSlots;
+  for (int i = 0; i < kNumThreadSlots; ++i) {
+    ModelCpuThreadSlot* slot = &thread_slots[(first + i) % kNumThreadSlots];
+    int64 free_id = 0;
+    if (slot->thread_id.compare_exchange_strong(free_id, thread_id)) {
+      return slot;
+    }
+  }
+  return nullptr;
+}
+
+#if defined(__linux__)
+void HandleSigprof(int) {
+  const int saved_errno = errno;
+  ModelCpuThreadSlot* const slot = FindThreadSlot(CurrentThreadId());
+  ModelCpuTag* tag =
+      slot == nullptr ? nullptr : slot->tag.load(std::memory_order_relaxed);
+  if (tag == nullptr) {
+    tag = untagged_samples.load(std::memory_order_relaxed);
+  }
+  tag->num_samples.fetch_add(1, std::memory_order_relaxed);
+  errno = saved_errno;
+}
+#endif
+
+}  // namespace
+
+const char* const ModelCpuProfiler::kCpuProfilePath =
+    "/monitoring/cpu_profile";
+constexpr int ModelCpuProfiler::kMaxNumTags;
+const char* const ModelCpuProfiler::kOtherModels = "(other)";
+
+ModelCpuProfiler* ModelCpuProfiler::Get() {
+  static ModelCpuProfiler* const profiler = new ModelCpuProfiler();
+  return profiler;
+}
+
+Status ModelCpuProfiler::Start(const int sampling_hz) {
+  if (sampling_hz <= 0 || sampling_hz > 1000000) {
+    return errors::InvalidArgument("Invalid CPU sampling frequency: ",
+                                   sampling_hz);
+  }
+#if defined(__linux__)
+  mutex_lock l(mu_);
+  if (running()) {
+    return errors::FailedPrecondition("The CPU profiler is already running");
+  }
+  if (untagged_samples.load() == nullptr) {
+    auto tag = std::unique_ptr<ModelCpuTag>(new ModelCpuTag("", ""));
+    untagged_samples.store(tag.get());
+    tags_[{"", ""}] = std::move(tag);
+  }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = HandleSigprof;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, nullptr) != 0) {
+    return errors::Internal("Cannot install the SIGPROF handler: ",
+                            strerror(errno));
+  }
+  const int interval_usec = 1000000 / sampling_hz;
+  struct itimerval timer;
+  timer.it_interval.tv_sec = interval_usec / 1000000;
+  timer.it_interval.tv_usec = interval_usec % 1000000;
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    return errors::Internal("Cannot start the CPU profiling timer: ",
+                            strerror(errno));
+  }
+  sampling_hz_ = sampling_hz;
+  running_.store(true);
+  return Status::OK();
+#else
+  return errors::Unimplemented("CPU profiling is only supported on Linux");
+#endif
+}
+
+void ModelCpuProfiler::Stop() {
+#if defined(__linux__)
+  mutex_lock l(mu_);
+  if (!running()) {
+    return;
+  }
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, nullptr);
+  // The handler stays installed: a signal may still be pending.
+  running_.store(false);
+#endif
+}
+
+std::vector<ModelCpuProfiler::ModelSamples> ModelCpuProfiler::GetSamples()
+    const {
+  mutex_lock l(mu_);
+  std::vector<ModelSamples> samples;
+  samples.reserve(tags_.size());
+  for (const auto& tag : tags_) {
+    samples.push_back({tag.second->model_name, tag.second->version,
+                       tag.second->num_samples.load()});
+  }
+  return samples;
+}
+
+string ModelCpuProfiler::GeneratePage() const {
+  std::vector<ModelSamples> samples = GetSamples();
+  std::sort(samples.begin(), samples.end(),
+            [](const ModelSamples& a, const ModelSamples& b) {
+              return a.num_samples > b.num_samples;
+            });
+  int sampling_hz;
+  {
+    mutex_lock l(mu_);
+    sampling_hz = sampling_hz_;
+  }
+  string page = "# model_name version samples cpu_seconds\n";
+  for (const ModelSamples& model_samples : samples) {
+    absl::StrAppend(
+        &page,
+        model_samples.model_name.empty() ? "-" : model_samples.model_name, " ",
+        model_samples.version.empty() ? "-" : model_samples.version, " ",
+        model_samples.num_samples, " ",
+        sampling_hz > 0
+            ? static_cast<double>(model_samples.num_samples) / sampling_hz
+            : 0.0,
+        "\n");
+  }
+  return page;
+}
+
+ModelCpuTag* ModelCpuProfiler::GetTag(const string& model_name,
+                                      const string& version) {
+  std::pair<string, string> key(model_name, version);
+  {
+    tf_shared_lock l(mu_);
+    auto it = tags_.find(key);
+    if (it != tags_.end()) {
+      return it->second.get();
+    }
+  }
+  mutex_lock l(mu_);
+  auto it = tags_.find(key);
+  if (it != tags_.end()) {
+    return it->second.get();
+  }
+  // The last tag is the one of the other models.
+  if (tags_.size() >= kMaxNumTags - 1) {
+    key = {kOtherModels, ""};
+  }
+  std::unique_ptr<ModelCpuTag>& tag = tags_[key];
+  if (tag == nullptr) {
+    tag.reset(new ModelCpuTag(key.first, key.second));
+  }
+  return tag.get();
+}
+
+ScopedModelCpuTag::ScopedModelCpuTag(const string& model_name,
+                                     const string& version) {
+  if (!ModelCpuProfiler::Get()->running()) {
+    return;
+  }
+  ModelCpuTag* const tag = ModelCpuProfiler::Get()->GetTag(model_name, version);
+  if (current_thread_slot == nullptr) {
+    current_thread_slot = TakeThreadSlot(CurrentThreadId());
+    if (current_thread_slot == nullptr) {
+      return;
+    }
+  }
+  slot_ = current_thread_slot;
+  previous_tag_ = slot_->tag.load(std::memory_order_relaxed);
+  slot_->tag.store(tag, std::memory_order_relaxed);
+}
+
+ScopedModelCpuTag::~ScopedModelCpuTag() {
+  if (slot_ == nullptr) {
+    return;
+  }
+  slot_->tag.store(previous_tag_, std::memory_order_relaxed);
+  if (previous_tag_ == nullptr) {
+    slot_->thread_id.store(0);
+    current_thread_slot = nullptr;
+  }
+}
+
+}  // namespace serving
+}  // namespace tensorflow
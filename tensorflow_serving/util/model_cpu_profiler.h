@@ -0,0 +1,141 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_UTIL_MODEL_CPU_PROFILER_H_
+#define TENSORFLOW_SERVING_UTIL_MODEL_CPU_PROFILER_H_
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace serving {
+
+// The model a thread is working for, see ScopedModelCpuTag.
+struct ModelCpuTag {
+  ModelCpuTag(const string& model_name, const string& version)
+      : model_name(model_name), version(version) {}
+
+  const string model_name;
+  // Version or version label of the requests, empty for the latest version.
+  const string version;
+  // CPU samples attributed to the model.
+  std::atomic<int64> num_samples{0};
+};
+
+// An always-on sampling profiler attributing the CPU time of the process to
+// models.
+//
+// While running, the process receives SIGPROF every 1/sampling_hz seconds of
+// CPU time it consumes, on the thread consuming it. Each sample is attributed
+// to the model tagged on that thread (see ScopedModelCpuTag), or to no model.
+// Only the threads running the requests are tagged: the CPU time of the
+// TensorFlow inter-op and intra-op threads is not attributed to models.
+//
+// The profiler uses SIGPROF and ITIMER_PROF, and cannot run along another
+// profiler using them (e.g. gperftools' CPU profiler). It is only supported on
+// Linux.
+//
+// This class is thread-safe.
+class ModelCpuProfiler {
+ public:
+  // Default path to expose the profile.
+  static const char* const kCpuProfilePath;
+
+  // Maximum number of tags, including the one of the untagged samples. The
+  // samples of the models and versions tagged beyond it are attributed to
+  // model kOtherModels.
+  static constexpr int kMaxNumTags = 1000;
+  static const char* const kOtherModels;
+
+  // Returns the profiler of the process.
+  static ModelCpuProfiler* Get();
+
+  // Starts sampling the CPU time 'sampling_hz' times per CPU second. Returns an
+  // error if the profiler is already running.
+  Status Start(int sampling_hz);
+
+  // Stops sampling. The samples collected so far are kept.
+  void Stop();
+
+  // Whether the profiler is running. The models are only tagged while it runs.
+  bool running() const { return running_.load(std::memory_order_relaxed); }
+
+  struct ModelSamples {
+    // Empty for the samples without tagged model.
+    string model_name;
+    string version;
+    int64 num_samples;
+  };
+
+  // Returns the samples of each model since the process started.
+  std::vector<ModelSamples> GetSamples() const;
+
+  // Generates the text page of the samples: one "<model name> <version>
+  // <samples> <CPU seconds>" line per model (with "-" for empty values),
+  // sorted by decreasing number of samples.
+  string GeneratePage() const;
+
+  // Returns the tag of the model, created on first use, or the one of
+  // kOtherModels if there are kMaxNumTags already. The tags are never deleted,
+  // so that the signal handler can use them at any time.
+  ModelCpuTag* GetTag(const string& model_name, const string& version);
+
+ private:
+  ModelCpuProfiler() = default;
+
+  std::atomic<bool> running_{false};
+
+  mutable mutex mu_;
+  int sampling_hz_ TF_GUARDED_BY(mu_) = 0;
+  std::map<std::pair<string, string>, std::unique_ptr<ModelCpuTag>> tags_
+      TF_GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ModelCpuProfiler);
+};
+
+// The tag of a thread, see model_cpu_profiler.cc.
+struct ModelCpuThreadSlot;
+
+// Tags the current thread as working for a model, for the lifetime of this
+// object. 'version' should be the version the request is served with, rather
+// than a label, which may point to another version by the time the request is
+// served. Does nothing if the ModelCpuProfiler is not running, or if too many
+// threads are tagged already.
+class ScopedModelCpuTag {
+ public:
+  ScopedModelCpuTag(const string& model_name, const string& version);
+  ~ScopedModelCpuTag();
+
+ private:
+  // Null if the thread is not tagged.
+  ModelCpuThreadSlot* slot_ = nullptr;
+  ModelCpuTag* previous_tag_ = nullptr;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ScopedModelCpuTag);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_UTIL_MODEL_CPU_PROFILER_H_
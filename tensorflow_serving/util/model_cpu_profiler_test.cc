@@ -0,0 +1,125 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/model_cpu_profiler.h"
+
+#include <ctime>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include "absl/strings/str_cat.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+// Returns the CPU time consumed by the calling thread, in seconds.
+double ThreadCpuSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Consumes 'seconds' of CPU time on the calling thread.
+void BurnCpu(const double seconds) {
+  const double end = ThreadCpuSeconds() + seconds;
+  volatile double value = 1;
+  while (ThreadCpuSeconds() < end) {
+    for (int i = 0; i < 1000; ++i) {
+      value = value * 1.000001 + 1e-9;
+    }
+  }
+}
+
+int64 GetNumSamples(const string& model_name, const string& version) {
+  for (const auto& samples : ModelCpuProfiler::Get()->GetSamples()) {
+    if (samples.model_name == model_name && samples.version == version) {
+      return samples.num_samples;
+    }
+  }
+  return 0;
+}
+
+TEST(ModelCpuProfilerTest, AttributesSamplesToModels) {
+  ModelCpuProfiler* profiler = ModelCpuProfiler::Get();
+  {
+    // Not tagged, since the profiler is not running.
+    ScopedModelCpuTag tag("stopped", "");
+    EXPECT_EQ(0, profiler->GetSamples().size());
+  }
+
+  TF_ASSERT_OK(profiler->Start(/*sampling_hz=*/1000));
+  EXPECT_TRUE(profiler->running());
+  EXPECT_FALSE(profiler->Start(/*sampling_hz=*/1000).ok());
+  {
+    ScopedModelCpuTag tag("model", "1");
+    {
+      ScopedModelCpuTag nested_tag("other_model", "");
+      BurnCpu(0.2);
+    }
+    BurnCpu(0.2);
+  }
+  profiler->Stop();
+  EXPECT_FALSE(profiler->running());
+
+  EXPECT_GT(GetNumSamples("model", "1"), 0);
+  EXPECT_GT(GetNumSamples("other_model", ""), 0);
+  EXPECT_EQ(0, GetNumSamples("stopped", ""));
+  const string page = profiler->GeneratePage();
+  EXPECT_NE(string::npos, page.find("\nmodel 1 "));
+  EXPECT_NE(string::npos, page.find("\nother_model - "));
+}
+
+TEST(ModelCpuProfilerTest, AttributesSamplesOfConcurrentThreads) {
+  ModelCpuProfiler* profiler = ModelCpuProfiler::Get();
+  TF_ASSERT_OK(profiler->Start(/*sampling_hz=*/1000));
+  {
+    std::vector<std::unique_ptr<Thread>> threads;
+    for (int i = 0; i < 4; ++i) {
+      threads.emplace_back(Env::Default()->StartThread({}, "burn_cpu", [i] {
+        ScopedModelCpuTag tag("concurrent_model", absl::StrCat(i));
+        BurnCpu(0.2);
+      }));
+    }
+  }
+  profiler->Stop();
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_GT(GetNumSamples("concurrent_model", absl::StrCat(i)), 0);
+  }
+}
+
+TEST(ModelCpuProfilerTest, NumberOfTagsIsBounded) {
+  ModelCpuProfiler* profiler = ModelCpuProfiler::Get();
+  ModelCpuTag* const first_tag = profiler->GetTag("bounded_model", "0");
+  for (int i = 1; i < ModelCpuProfiler::kMaxNumTags; ++i) {
+    profiler->GetTag("bounded_model", absl::StrCat(i));
+  }
+  EXPECT_EQ(first_tag, profiler->GetTag("bounded_model", "0"));
+  ModelCpuTag* const other_tag = profiler->GetTag(
+      "bounded_model", absl::StrCat(ModelCpuProfiler::kMaxNumTags));
+  EXPECT_EQ(ModelCpuProfiler::kOtherModels, other_tag->model_name);
+  EXPECT_EQ(ModelCpuProfiler::kMaxNumTags, profiler->GetSamples().size());
+}
+
+TEST(ModelCpuProfilerTest, InvalidSamplingFrequency) {
+  EXPECT_FALSE(ModelCpuProfiler::Get()->Start(/*sampling_hz=*/0).ok());
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
@@ -100,8 +100,6 @@ std::unique_ptr<EvHTTPConnection> EvHTTPConnection::Connect(
   return result;
 }
 
-namespace {
-
 // Copy ev response data to ClientResponse.
 void PopulateResponse(evhttp_request* req, ClientResponse* response) {
   response->status =
@@ -151,6 +149,8 @@ evhttp_cmd_type GetMethodEnum(absl::string_view method, bool with_body) {
   }
 }
 
+namespace {
+
 void ResponseDone(evhttp_request* req, void* ctx) {
   ClientResponse* response = reinterpret_cast<ClientResponse*>(ctx);
 
@@ -169,13 +169,34 @@ void ResponseDone(evhttp_request* req, void* ctx) {
   }
 }
 
-// Returns false if there is any error.
-bool GenerateEvRequest(evhttp_connection* evcon, const ClientRequest& request,
-                       ClientResponse* response) {
-  evhttp_request* evreq = evhttp_request_new(ResponseDone, response);
+// A blocking request with a timeout.
+struct BlockingRequest {
+  ClientResponse* response;
+  // Ends the event loop at the end of the timeout.
+  event* deadline;
+};
+
+void BlockingResponseDone(evhttp_request* req, void* ctx) {
+  BlockingRequest* blocking_request = reinterpret_cast<BlockingRequest*>(ctx);
+  // Lets the event loop end with the request, successful or not.
+  evtimer_del(blocking_request->deadline);
+  ResponseDone(req, blocking_request->response);
+}
+
+void DeadlineExceeded(evutil_socket_t, short, void* ctx) {
+  event_base_loopbreak(reinterpret_cast<event_base*>(ctx));
+}
+
+// Sends a request whose completion calls 'callback' with 'ctx'. Returns
+// nullptr if there is any error.
+evhttp_request* GenerateEvRequest(evhttp_connection* evcon,
+                                  const ClientRequest& request,
+                                  void (*callback)(evhttp_request*, void*),
+                                  void* ctx) {
+  evhttp_request* evreq = evhttp_request_new(callback, ctx);
   if (evreq == nullptr) {
     NET_LOG(ERROR, "Failed to send request : evhttp_request_new()");
-    return false;
+    return nullptr;
   }
 
   evkeyvalq* output_headers = evhttp_request_get_output_headers(evreq);
@@ -205,10 +226,10 @@ bool GenerateEvRequest(evhttp_connection* evcon, const ClientRequest& request,
       uri.c_str());
   if (r != 0) {
     NET_LOG(ERROR, "evhttp_make_request() failed");
-    return false;
+    return nullptr;
   }
 
-  return true;
+  return evreq;
 }
 
 }  // namespace
@@ -216,13 +237,41 @@ bool GenerateEvRequest(evhttp_connection* evcon, const ClientRequest& request,
 // Sends the request and has the connection closed
 bool EvHTTPConnection::BlockingSendRequest(const ClientRequest& request,
                                            ClientResponse* response) {
-  if (!GenerateEvRequest(evcon_, request, response)) {
+  if (timeout_ <= absl::ZeroDuration()) {
+    if (!GenerateEvRequest(evcon_, request, ResponseDone, response)) {
+      NET_LOG(ERROR, "Failed to generate the ev_request");
+      return false;
+    }
+
+    // inline loop blocking
+    event_base_dispatch(ev_base_);
+    return true;
+  }
+
+  BlockingRequest blocking_request = {
+      response, evtimer_new(ev_base_, DeadlineExceeded, ev_base_)};
+  evhttp_request* evreq = GenerateEvRequest(evcon_, request,
+                                            BlockingResponseDone,
+                                            &blocking_request);
+  if (evreq == nullptr) {
     NET_LOG(ERROR, "Failed to generate the ev_request");
+    event_free(blocking_request.deadline);
     return false;
   }
+  const timeval timeout = absl::ToTimeval(timeout_);
+  evtimer_add(blocking_request.deadline, &timeout);
 
-  // inline loop blocking
+  // inline loop blocking, until the response or the deadline
   event_base_dispatch(ev_base_);
+  const bool deadline_exceeded = event_base_got_break(ev_base_);
+  event_free(blocking_request.deadline);
+  if (deadline_exceeded) {
+    NET_LOG(ERROR, "The request timed out");
+    // The callback of the request, which refers to 'blocking_request', is not
+    // called anymore.
+    evhttp_cancel_request(evreq);
+    return false;
+  }
   return true;
 }
 
@@ -233,7 +282,7 @@ bool EvHTTPConnection::SendRequest(const ClientRequest& request,
     return false;
   }
 
-  if (!GenerateEvRequest(evcon_, request, response)) {
+  if (!GenerateEvRequest(evcon_, request, ResponseDone, response)) {
     NET_LOG(ERROR, "Failed to generate the ev_request");
     return false;
   }
@@ -247,6 +296,12 @@ bool EvHTTPConnection::SendRequest(const ClientRequest& request,
   return true;
 }
 
+void EvHTTPConnection::SetTimeout(const absl::Duration timeout) {
+  timeout_ = timeout;
+  const timeval inactivity_timeout = absl::ToTimeval(timeout);
+  evhttp_connection_set_timeout_tv(evcon_, &inactivity_timeout);
+}
+
 void EvHTTPConnection::SetExecutor(std::unique_ptr<EventExecutor> executor) {
   this->executor_ = std::move(executor);
 }
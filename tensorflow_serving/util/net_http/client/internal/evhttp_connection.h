@@ -24,6 +24,7 @@ limitations under the License.
 
 #include "absl/strings/string_view.h"
 #include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
 
 #include "libevent/include/event2/buffer.h"
 #include "libevent/include/event2/bufferevent.h"
@@ -40,6 +41,14 @@ namespace tensorflow {
 namespace serving {
 namespace net_http {
 
+// Copies the response data of 'req' to 'response'.
+// Shared with EvHTTPConnectionPool.
+void PopulateResponse(evhttp_request* req, ClientResponse* response);
+
+// Returns the libevent method of 'method' (in upper-case), or POST if unknown
+// and 'with_body', else GET.
+evhttp_cmd_type GetMethodEnum(absl::string_view method, bool with_body);
+
 // The following types may be moved to an API interface in future.
 
 class EvHTTPConnection final : public HTTPClientInterface {
@@ -86,6 +95,12 @@ class EvHTTPConnection final : public HTTPClientInterface {
   // Sets the executor for processing requests asynchronously.
   void SetExecutor(std::unique_ptr<EventExecutor> executor) override;
 
+  // Sets the timeout of the requests. BlockingSendRequest() returns false if
+  // the response is not received within 'timeout', and the connection is
+  // closed after 'timeout' without activity. By default, only the latter
+  // applies, after 5 seconds.
+  void SetTimeout(absl::Duration timeout);
+
  private:
   struct event_base* ev_base_;
   struct evhttp_uri* http_uri_;
@@ -94,6 +109,8 @@ class EvHTTPConnection final : public HTTPClientInterface {
   std::unique_ptr<EventExecutor> executor_;
 
   std::unique_ptr<absl::Notification> loop_exit_;
+
+  absl::Duration timeout_ = absl::ZeroDuration();
 };
 
 }  // namespace net_http
@@ -0,0 +1,293 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// libevent based pool of keep-alive client connections
+
+#include "tensorflow_serving/util/net_http/client/internal/evhttp_connection_pool.h"
+
+#include <algorithm>
+#include <functional>
+#include <unordered_set>
+#include <string>
+#include <utility>
+
+#include "absl/base/call_once.h"
+#include "libevent/include/event2/buffer.h"
+#include "libevent/include/event2/keyvalq_struct.h"
+#include "libevent/include/event2/thread.h"
+#include "libevent/include/event2/util.h"
+#include "tensorflow_serving/util/net_http/client/internal/evhttp_connection.h"
+#include "tensorflow_serving/util/net_http/internal/net_logging.h"
+
+namespace tensorflow {
+namespace serving {
+namespace net_http {
+
+namespace {
+
+absl::once_flag libevent_init_once;
+
+// The requests are sent from the event loop while SendRequest() is called
+// from other threads.
+void InitLibEvent() {
+  if (evthread_use_pthreads() != 0) {
+    NET_LOG(FATAL, "The connection pool requires pthread support.");
+  }
+}
+
+}  // namespace
+
+struct EvHTTPConnectionPool::PendingRequest {
+  EvHTTPConnectionPool* pool;
+  std::string uri_path;
+  evhttp_cmd_type method;
+  std::vector<std::pair<std::string, std::string>> headers;
+  std::string body;
+  ClientResponse* response;
+  // The connection the request is sent on, once sent.
+  Connection* connection = nullptr;
+};
+
+EvHTTPConnectionPool::~EvHTTPConnectionPool() {
+  Terminate();
+
+  // Frees the requests of the connections, which Terminate() has failed.
+  for (const Connection& connection : connections_) {
+    evhttp_connection_free(connection.evcon);
+  }
+  if (ev_base_ != nullptr) {
+    event_base_free(ev_base_);
+  }
+}
+
+std::unique_ptr<EvHTTPConnectionPool> EvHTTPConnectionPool::Connect(
+    absl::string_view host, int port, const Options& options) {
+  absl::call_once(libevent_init_once, &InitLibEvent);
+
+  std::unique_ptr<EvHTTPConnectionPool> result(new EvHTTPConnectionPool());
+
+  result->ev_base_ = event_base_new();
+  if (result->ev_base_ == nullptr) {
+    NET_LOG(ERROR, "Failed to connect : event_base_new()");
+    return nullptr;
+  }
+
+  // blocking call (DNS resolution)
+  std::string host_str(host.data(), host.size());
+  const int num_connections = std::max(options.num_connections, 1);
+  for (int i = 0; i < num_connections; ++i) {
+    Connection connection;
+    connection.evcon = evhttp_connection_base_bufferevent_new(
+        result->ev_base_, nullptr, nullptr, host_str.c_str(),
+        static_cast<uint16_t>(port));
+    if (connection.evcon == nullptr) {
+      NET_LOG(ERROR,
+              "Failed to connect : evhttp_connection_base_bufferevent_new()");
+      return nullptr;
+    }
+    evhttp_connection_set_retries(connection.evcon, 0);
+    evhttp_connection_set_timeout(connection.evcon, options.timeout_secs);
+    result->connections_.push_back(connection);
+  }
+
+  return result;
+}
+
+void EvHTTPConnectionPool::Terminate() {
+  {
+    absl::MutexLock l(&loop_mu_);
+    if (terminated_ || executor_ == nullptr) {
+      terminated_ = true;
+      return;
+    }
+    terminated_ = true;
+  }
+  // Waits without the lock, which the done callbacks may take to send other
+  // requests.
+  event_base_loopexit(ev_base_, nullptr);
+  loop_exit_.WaitForNotification();
+
+  // No request is scheduled once terminated_ is set, and the event loop has
+  // exited: fails the requests it did not complete, so that their callers
+  // (e.g. BlockingSendRequest()) do not wait forever.
+  std::unordered_set<PendingRequest*> requests;
+  {
+    absl::MutexLock l(&requests_mu_);
+    requests.swap(requests_);
+  }
+  for (PendingRequest* request : requests) {
+    ClientResponse* response = request->response;
+    delete request;
+    response->status = HTTPStatusCode::UNDEFINED;
+    const std::function<void()> done = response->done;
+    if (done != nullptr) {
+      done();
+    }
+  }
+}
+
+bool EvHTTPConnectionPool::BlockingSendRequest(const ClientRequest& request,
+                                               ClientResponse* response) {
+  absl::Notification response_received;
+  std::function<void()> done = std::move(response->done);
+  response->done = [&response_received, &done]() {
+    if (done != nullptr) {
+      done();
+    }
+    response_received.Notify();
+  };
+
+  if (!SendRequest(request, response)) {
+    response->done = std::move(done);
+    return false;
+  }
+  response_received.WaitForNotification();
+  response->done = std::move(done);
+  return response->status != HTTPStatusCode::UNDEFINED;
+}
+
+bool EvHTTPConnectionPool::SendRequest(const ClientRequest& request,
+                                       ClientResponse* response) {
+  // The request is copied, as it is sent from the event loop.
+  auto* pending_request = new PendingRequest();
+  pending_request->pool = this;
+  pending_request->uri_path.assign(request.uri_path.data(),
+                                   request.uri_path.size());
+  pending_request->method =
+      GetMethodEnum(request.method, !request.body.empty());
+  for (const auto& header : request.headers) {
+    pending_request->headers.emplace_back(
+        std::string(header.first.data(), header.first.size()),
+        std::string(header.second.data(), header.second.size()));
+  }
+  pending_request->body.assign(request.body.data(), request.body.size());
+  pending_request->response = response;
+
+  // Schedules the request under the lock, so that Terminate() fails it if it
+  // is not completed by the event loop.
+  absl::MutexLock l(&loop_mu_);
+  if (executor_ == nullptr || terminated_) {
+    NET_LOG(ERROR, "EventExecutor is not configured.");
+    delete pending_request;
+    return false;
+  }
+  {
+    absl::MutexLock requests_lock(&requests_mu_);
+    requests_.insert(pending_request);
+  }
+  if (event_base_once(ev_base_, -1, EV_TIMEOUT, EvStartRequest,
+                      static_cast<void*>(pending_request), nullptr) != 0) {
+    NET_LOG(ERROR, "Failed to schedule the request : event_base_once()");
+    absl::MutexLock requests_lock(&requests_mu_);
+    requests_.erase(pending_request);
+    delete pending_request;
+    return false;
+  }
+  return true;
+}
+
+void EvHTTPConnectionPool::SetExecutor(
+    std::unique_ptr<EventExecutor> executor) {
+  absl::MutexLock l(&loop_mu_);
+  if (executor_ != nullptr || terminated_) {
+    return;
+  }
+  executor_ = std::move(executor);
+  executor_->Schedule([this]() {
+    // Keeps running while there are no requests, until Terminate().
+    event_base_loop(ev_base_, EVLOOP_NO_EXIT_ON_EMPTY);
+    loop_exit_.Notify();
+  });
+}
+
+void EvHTTPConnectionPool::StartRequest(PendingRequest* request) {
+  Connection* connection = &*std::min_element(
+      connections_.begin(), connections_.end(),
+      [](const Connection& a, const Connection& b) {
+        return a.num_requests_in_flight < b.num_requests_in_flight;
+      });
+
+  evhttp_request* evreq = evhttp_request_new(EvResponseDone, request);
+  if (evreq == nullptr) {
+    NET_LOG(ERROR, "Failed to send request : evhttp_request_new()");
+    FinishRequest(request, nullptr);
+    return;
+  }
+
+  // The connection is kept alive, i.e. there is no "Connection: close".
+  evkeyvalq* output_headers = evhttp_request_get_output_headers(evreq);
+  for (const auto& header : request->headers) {
+    evhttp_add_header(output_headers, header.first.c_str(),
+                      header.second.c_str());
+  }
+  if (!request->body.empty()) {
+    evbuffer_add(evhttp_request_get_output_buffer(evreq),
+                 request->body.data(), request->body.size());
+    evhttp_add_header(output_headers, "Content-Length",
+                      std::to_string(request->body.size()).c_str());
+  }
+
+  request->connection = connection;
+  ++connection->num_requests_in_flight;
+  // On errors, evreq is freed and EvResponseDone() is not called.
+  if (evhttp_make_request(connection->evcon, evreq, request->method,
+                          request->uri_path.c_str()) != 0) {
+    NET_LOG(ERROR, "evhttp_make_request() failed");
+    FinishRequest(request, nullptr);
+  }
+}
+
+void EvHTTPConnectionPool::EvStartRequest(evutil_socket_t socket,
+                                          int16_t flags, void* arg) {
+  auto* request = static_cast<PendingRequest*>(arg);
+  request->pool->StartRequest(request);
+}
+
+void EvHTTPConnectionPool::EvResponseDone(evhttp_request* evreq, void* arg) {
+  auto* request = static_cast<PendingRequest*>(arg);
+  request->pool->FinishRequest(request, evreq);
+}
+
+void EvHTTPConnectionPool::FinishRequest(PendingRequest* request,
+                                         evhttp_request* evreq) {
+  if (request->connection != nullptr) {
+    --request->connection->num_requests_in_flight;
+  }
+
+  ClientResponse* response = request->response;
+  if (evreq != nullptr) {
+    PopulateResponse(evreq, response);
+  } else {
+    int errcode = EVUTIL_SOCKET_ERROR();
+    NET_LOG(ERROR, "request failed: socket error = %s (%d)",
+            evutil_socket_error_to_string(errcode), errcode);
+  }
+
+  {
+    absl::MutexLock l(&requests_mu_);
+    requests_.erase(request);
+  }
+  delete request;
+
+  // Calls a copy, as the caller may reset response->done once called.
+  const std::function<void()> done = response->done;
+  if (done != nullptr) {
+    done();
+  }
+}
+
+}  // namespace net_http
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,134 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_UTIL_NET_HTTP_CLIENT_INTERNAL_EVHTTP_CONNECTION_POOL_H_
+#define TENSORFLOW_SERVING_UTIL_NET_HTTP_CLIENT_INTERNAL_EVHTTP_CONNECTION_POOL_H_
+
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+
+#include "libevent/include/event2/event.h"
+#include "libevent/include/event2/http.h"
+
+#include "tensorflow_serving/util/net_http/client/public/httpclient_interface.h"
+#include "tensorflow_serving/util/net_http/server/public/httpserver_interface.h"
+
+namespace tensorflow {
+namespace serving {
+namespace net_http {
+
+// An asynchronous client keeping a pool of keep-alive connections to a
+// host:port, e.g. for the internal calls of the server (health probes, log
+// shipping, model prefetching) which should not take a thread per call.
+//
+// The requests are sent from a single event loop, run on the executor set
+// with SetExecutor(), on the connection with the fewest requests in flight.
+// The requests queued on a connection are sent back-to-back on it, without
+// reconnecting. libevent does not pipeline the requests of a connection, so
+// its requests are sent as the previous responses are received.
+//
+// This class is thread-safe.
+class EvHTTPConnectionPool final : public HTTPClientInterface {
+ public:
+  struct Options {
+    // The number of connections to the host.
+    int num_connections = 4;
+    // The timeout of the requests, in seconds.
+    int timeout_secs = 5;
+  };
+
+  ~EvHTTPConnectionPool() override;
+
+  EvHTTPConnectionPool(const EvHTTPConnectionPool& other) = delete;
+  EvHTTPConnectionPool& operator=(const EvHTTPConnectionPool& other) = delete;
+
+  // Returns a new pool of connections to the specified host:port. The
+  // connections are opened by their first requests.
+  // Returns nullptr if any error
+  static std::unique_ptr<EvHTTPConnectionPool> Connect(absl::string_view host,
+                                                       int port,
+                                                       const Options& options);
+
+  // Exits the event loop. The requests not completed yet are failed, i.e.
+  // their done callback is called with a status of UNDEFINED, from the
+  // calling thread.
+  void Terminate() override;
+
+  // Sends a request and blocks the caller till a response is received
+  // or any error has happened. Must not be called from the event loop.
+  // Returns false if any error.
+  bool BlockingSendRequest(const ClientRequest& request,
+                           ClientResponse* response) override;
+
+  // Sends a request and returns immediately. The request is copied. The
+  // response->done callback is called from the event loop once the response
+  // is received, or with a status of UNDEFINED if the request failed.
+  // Returns false if the request could not be scheduled, or if the executor
+  // has not been configured.
+  bool SendRequest(const ClientRequest& request,
+                   ClientResponse* response) override;
+
+  // Sets the executor running the event loop, and starts it. Only the first
+  // call is effective.
+  void SetExecutor(std::unique_ptr<EventExecutor> executor) override;
+
+ private:
+  // A request scheduled on the event loop, and its connection once sent.
+  struct PendingRequest;
+
+  // A connection of the pool, only used from the event loop.
+  struct Connection {
+    struct evhttp_connection* evcon = nullptr;
+    int num_requests_in_flight = 0;
+  };
+
+  EvHTTPConnectionPool() = default;
+
+  // Sends 'request' on the least loaded connection. Runs on the event loop.
+  void StartRequest(PendingRequest* request);
+
+  // Completes 'request', whose response is 'evreq' (nullptr on errors). Runs
+  // on the event loop.
+  void FinishRequest(PendingRequest* request, struct evhttp_request* evreq);
+
+  static void EvStartRequest(evutil_socket_t socket, int16_t flags, void* arg);
+  static void EvResponseDone(struct evhttp_request* evreq, void* arg);
+
+  struct event_base* ev_base_ = nullptr;
+  std::vector<Connection> connections_;
+
+  // The requests scheduled or in flight, failed by Terminate() if the event
+  // loop did not complete them.
+  absl::Mutex requests_mu_;
+  std::unordered_set<PendingRequest*> requests_
+      ABSL_GUARDED_BY(requests_mu_);
+
+  absl::Mutex loop_mu_;
+  std::unique_ptr<EventExecutor> executor_ ABSL_GUARDED_BY(loop_mu_);
+  bool terminated_ ABSL_GUARDED_BY(loop_mu_) = false;
+  absl::Notification loop_exit_;
+};
+
+}  // namespace net_http
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_UTIL_NET_HTTP_CLIENT_INTERNAL_EVHTTP_CONNECTION_POOL_H_
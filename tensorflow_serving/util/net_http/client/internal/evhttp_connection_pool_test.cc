@@ -0,0 +1,217 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/net_http/client/internal/evhttp_connection_pool.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include "absl/memory/memory.h"
+#include "absl/synchronization/blocking_counter.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "tensorflow_serving/util/net_http/internal/fixed_thread_pool.h"
+#include "tensorflow_serving/util/net_http/server/public/httpserver.h"
+#include "tensorflow_serving/util/net_http/server/public/httpserver_interface.h"
+#include "tensorflow_serving/util/net_http/server/public/server_request_interface.h"
+
+namespace tensorflow {
+namespace serving {
+namespace net_http {
+namespace {
+
+class MyExecutor final : public EventExecutor {
+ public:
+  explicit MyExecutor(int num_threads) : thread_pool_(num_threads) {}
+
+  void Schedule(std::function<void()> fn) override {
+    thread_pool_.Schedule(fn);
+  }
+
+ private:
+  FixedThreadPool thread_pool_;
+};
+
+class CountingObserver final : public ConnectionObserver {
+ public:
+  explicit CountingObserver(std::atomic<int>* opened) : opened_(opened) {}
+
+  void OnConnectionOpened() override { ++*opened_; }
+  void OnConnectionClosed() override {}
+
+ private:
+  std::atomic<int>* const opened_;
+};
+
+class EvHTTPConnectionPoolTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    auto options = absl::make_unique<ServerOptions>();
+    options->AddPort(0);
+    options->SetExecutor(absl::make_unique<MyExecutor>(4));
+    options->SetConnectionObserver(
+        absl::make_unique<CountingObserver>(&num_connections_opened_));
+    server_ = CreateEvHTTPServer(std::move(options));
+    ASSERT_TRUE(server_ != nullptr);
+
+    auto handler = [](ServerRequestInterface* request) {
+      request->WriteResponseString(request->uri_path());
+      request->Reply();
+    };
+    server_->RegisterRequestHandler("/echo", std::move(handler),
+                                    RequestHandlerOptions());
+    // Replies once the test releases it.
+    auto blocking_handler = [this](ServerRequestInterface* request) {
+      release_.WaitForNotification();
+      request->Reply();
+    };
+    server_->RegisterRequestHandler("/block", std::move(blocking_handler),
+                                    RequestHandlerOptions());
+    ASSERT_TRUE(server_->StartAcceptingRequests());
+  }
+
+  void TearDown() override {
+    if (!release_.HasBeenNotified()) {
+      release_.Notify();
+    }
+    server_->Terminate();
+    server_->WaitForTermination();
+  }
+
+ protected:
+  std::unique_ptr<EvHTTPConnectionPool> CreatePool(int num_connections) {
+    EvHTTPConnectionPool::Options options;
+    options.num_connections = num_connections;
+    auto pool = EvHTTPConnectionPool::Connect("localhost",
+                                              server_->listen_port(), options);
+    if (pool != nullptr) {
+      pool->SetExecutor(absl::make_unique<MyExecutor>(1));
+    }
+    return pool;
+  }
+
+  std::atomic<int> num_connections_opened_{0};
+  absl::Notification release_;
+  std::unique_ptr<HTTPServerInterface> server_;
+};
+
+TEST_F(EvHTTPConnectionPoolTest, RequestsReuseTheConnection) {
+  auto pool = CreatePool(1);
+  ASSERT_TRUE(pool != nullptr);
+
+  for (int i = 0; i < 5; ++i) {
+    ClientRequest request = {"/echo", "GET", {}, ""};
+    ClientResponse response = {};
+    EXPECT_TRUE(pool->BlockingSendRequest(request, &response));
+    EXPECT_EQ(response.status, HTTPStatusCode::OK);
+    EXPECT_EQ(response.body, "/echo");
+  }
+  EXPECT_EQ(num_connections_opened_, 1);
+
+  pool->Terminate();
+}
+
+TEST_F(EvHTTPConnectionPoolTest, AsyncRequests) {
+  auto pool = CreatePool(2);
+  ASSERT_TRUE(pool != nullptr);
+
+  constexpr int kNumRequests = 20;
+  std::vector<std::string> uris;
+  for (int i = 0; i < kNumRequests; ++i) {
+    uris.push_back("/echo?i=" + std::to_string(i));
+  }
+  std::vector<ClientResponse> responses(kNumRequests);
+  absl::BlockingCounter responses_received(kNumRequests);
+  for (int i = 0; i < kNumRequests; ++i) {
+    ClientRequest request = {uris[i], "GET", {}, ""};
+    responses[i].done = [&responses_received]() {
+      responses_received.DecrementCount();
+    };
+    ASSERT_TRUE(pool->SendRequest(request, &responses[i]));
+  }
+  responses_received.Wait();
+
+  for (int i = 0; i < kNumRequests; ++i) {
+    EXPECT_EQ(responses[i].status, HTTPStatusCode::OK);
+    EXPECT_EQ(responses[i].body, uris[i]);
+  }
+  EXPECT_LE(num_connections_opened_, 2);
+
+  pool->Terminate();
+}
+
+TEST_F(EvHTTPConnectionPoolTest, TerminateFailsTheRequestsInFlight) {
+  auto pool = CreatePool(1);
+  ASSERT_TRUE(pool != nullptr);
+
+  // The second request waits for the first one on the connection.
+  constexpr int kNumRequests = 2;
+  std::vector<ClientResponse> responses(kNumRequests);
+  std::atomic<int> num_done{0};
+  for (int i = 0; i < kNumRequests; ++i) {
+    ClientRequest request = {"/block", "GET", {}, ""};
+    responses[i].done = [&num_done]() { ++num_done; };
+    ASSERT_TRUE(pool->SendRequest(request, &responses[i]));
+  }
+
+  bool blocking_result = true;
+  absl::Notification blocking_done;
+  FixedThreadPool blocking_thread(1);
+  blocking_thread.Schedule([&]() {
+    ClientRequest request = {"/block", "GET", {}, ""};
+    ClientResponse response = {};
+    blocking_result = pool->BlockingSendRequest(request, &response);
+    blocking_done.Notify();
+  });
+
+  // All the requests are still in flight.
+  absl::SleepFor(absl::Milliseconds(100));
+  EXPECT_EQ(num_done, 0);
+  EXPECT_FALSE(blocking_done.HasBeenNotified());
+
+  pool->Terminate();
+  EXPECT_EQ(num_done, kNumRequests);
+  for (const ClientResponse& response : responses) {
+    EXPECT_EQ(response.status, HTTPStatusCode::UNDEFINED);
+  }
+  blocking_done.WaitForNotification();
+  EXPECT_FALSE(blocking_result);
+
+  // No more requests are sent.
+  ClientRequest request = {"/echo", "GET", {}, ""};
+  ClientResponse response = {};
+  EXPECT_FALSE(pool->SendRequest(request, &response));
+}
+
+TEST_F(EvHTTPConnectionPoolTest, RequiresAnExecutor) {
+  EvHTTPConnectionPool::Options options;
+  auto pool = EvHTTPConnectionPool::Connect("localhost",
+                                            server_->listen_port(), options);
+  ASSERT_TRUE(pool != nullptr);
+
+  ClientRequest request = {"/echo", "GET", {}, ""};
+  ClientResponse response = {};
+  EXPECT_FALSE(pool->SendRequest(request, &response));
+  EXPECT_FALSE(pool->BlockingSendRequest(request, &response));
+}
+
+}  // namespace
+}  // namespace net_http
+}  // namespace serving
+}  // namespace tensorflow
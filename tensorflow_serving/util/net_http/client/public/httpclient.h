@@ -17,7 +17,9 @@ limitations under the License.
 #define THIRD_PARTY_TENSORFLOW_SERVING_UTIL_NET_HTTP_CLIENT_PUBLIC_HTTPCLIENT_H_
 
 #include "absl/memory/memory.h"
+#include "absl/time/time.h"
 #include "tensorflow_serving/util/net_http/client/internal/evhttp_connection.h"
+#include "tensorflow_serving/util/net_http/client/internal/evhttp_connection_pool.h"
 #include "tensorflow_serving/util/net_http/client/public/httpclient_interface.h"
 
 // Factory to manage internal dependency
@@ -41,6 +43,35 @@ inline std::unique_ptr<HTTPClientInterface> CreateEvHTTPConnection(
   return std::move(connection);
 }
 
+// Same as above, with requests that time out after 'timeout' (see
+// EvHTTPConnection::SetTimeout()).
+inline std::unique_ptr<HTTPClientInterface> CreateEvHTTPConnection(
+    absl::string_view host, int port, absl::Duration timeout) {
+  auto connection = EvHTTPConnection::Connect(host, port);
+  if (!connection) {
+    return nullptr;
+  }
+  connection->SetTimeout(timeout);
+
+  return std::move(connection);
+}
+
+// Creates a pool of keep-alive connections to a server implemented based on
+// the libevents library, whose event loop runs on 'executor'. Returns nullptr
+// if there is any error.
+inline std::unique_ptr<HTTPClientInterface> CreateEvHTTPConnectionPool(
+    absl::string_view host, int port,
+    const EvHTTPConnectionPool::Options& options,
+    std::unique_ptr<EventExecutor> executor) {
+  auto pool = EvHTTPConnectionPool::Connect(host, port, options);
+  if (!pool) {
+    return nullptr;
+  }
+  pool->SetExecutor(std::move(executor));
+
+  return std::move(pool);
+}
+
 }  // namespace net_http
 }  // namespace serving
 }  // namespace tensorflow
@@ -19,6 +19,7 @@ limitations under the License.
 
 #include <zlib.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
@@ -26,7 +27,10 @@ limitations under the License.
 #include <string>
 #include <vector>
 
+#include "absl/strings/ascii.h"
 #include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/span.h"
 #include "libevent/include/event2/buffer.h"
@@ -41,6 +45,38 @@ namespace tensorflow {
 namespace serving {
 namespace net_http {
 
+namespace {
+
+// Initial size of the buffer a gzipped request body is uncompressed into.
+constexpr size_t kMinUncompressBufferSize = 4 << 10;
+
+}  // namespace
+
+bool AcceptsGzipEncoding(absl::string_view accept_encoding) {
+  for (absl::string_view coding : absl::StrSplit(accept_encoding, ',')) {
+    absl::string_view params;
+    const size_t semicolon = coding.find(';');
+    if (semicolon != absl::string_view::npos) {
+      params = coding.substr(semicolon + 1);
+      coding = coding.substr(0, semicolon);
+    }
+    coding = absl::StripAsciiWhitespace(coding);
+    if (!absl::EqualsIgnoreCase(coding, "gzip") &&
+        !absl::EqualsIgnoreCase(coding, "x-gzip") && coding != "*") {
+      continue;
+    }
+    // "q=0" means "not acceptable".
+    params = absl::StripAsciiWhitespace(params);
+    double q;
+    if (absl::ConsumePrefix(&params, "q=") && absl::SimpleAtod(params, &q) &&
+        q <= 0) {
+      continue;
+    }
+    return true;
+  }
+  return false;
+}
+
 ParsedEvRequest::~ParsedEvRequest() {
   if (decoded_uri) {
     evhttp_uri_free(decoded_uri);
@@ -143,6 +179,12 @@ bool EvHTTPRequest::Initialize() {
   return output_buf != nullptr;
 }
 
+ServerRequestInterface::BodyStatus EvHTTPRequest::response_body_status() {
+  return connection_status_ != nullptr && connection_status_->closed
+             ? BodyStatus::FAILED
+             : BodyStatus::PENDING;
+}
+
 void EvHTTPRequest::WriteResponseBytes(const char* data, int64_t size) {
   assert(size >= 0);
   if (output_buf == nullptr) {
@@ -200,59 +242,115 @@ std::unique_ptr<char[], BlockDeleter> EvHTTPRequest::ReadRequestBytes(
   return std::unique_ptr<char[], BlockDeleter>(block, BlockDeleter(*buf_size));
 }
 
+bool EvHTTPRequest::GetRequestBody(absl::string_view* body) {
+  if (!request_body_read_) {
+    request_body_read_ = true;
+    evbuffer* input_buf =
+        evhttp_request_get_input_buffer(parsed_request_->request);
+    if (input_buf != nullptr && evbuffer_get_length(input_buf) > 0) {
+      if (NeedUncompressGzipContent()) {
+        int64_t size = 0;
+        uncompressed_body_ = ReadRequestGzipBytes(input_buf, &size);
+        if (uncompressed_body_ != nullptr) {
+          request_body_ = absl::string_view(uncompressed_body_.get(), size);
+        }
+      } else {
+        const size_t size = evbuffer_get_length(input_buf);
+        request_body_ = absl::string_view(
+            reinterpret_cast<const char*>(evbuffer_pullup(input_buf, -1)),
+            size);
+      }
+    }
+  }
+  *body = request_body_;
+  return true;
+}
+
+// The body is uncompressed incrementally from the segments of the input
+// buffer, without first copying the compressed body into one contiguous
+// block. The uncompressed size announced by the gzip footer is only used as a
+// hint for the initial allocation.
 std::unique_ptr<char[], BlockDeleter> EvHTTPRequest::ReadRequestGzipBytes(
     evbuffer* input_buf, int64_t* size) {
-  std::vector<absl::Span<char>> buf_list;
+  const size_t max_size =
+      handler_options_->auto_uncompress_max_size() > 0
+          ? static_cast<size_t>(handler_options_->auto_uncompress_max_size())
+          : static_cast<size_t>(ZLib::kMaxUncompressedBytes);
+  const size_t body_length = evbuffer_get_length(input_buf);
+
+  // One more byte than announced, so that a correct body is uncompressed
+  // without filling the buffer before the end of the gzip stream.
+  size_t capacity = kMinUncompressBufferSize;
+  unsigned char footer[4];
+  evbuffer_ptr footer_pos;
+  if (body_length > sizeof(footer) &&
+      evbuffer_ptr_set(input_buf, &footer_pos, body_length - sizeof(footer),
+                       EVBUFFER_PTR_SET) == 0 &&
+      evbuffer_copyout_from(input_buf, &footer_pos, footer, sizeof(footer)) ==
+          sizeof(footer)) {
+    const size_t announced_size =
+        (static_cast<size_t>(footer[3]) << 24) |
+        (static_cast<size_t>(footer[2]) << 16) |
+        (static_cast<size_t>(footer[1]) << 8) | static_cast<size_t>(footer[0]);
+    capacity = std::max(capacity, announced_size + 1);
+  }
+  capacity = std::min(capacity, max_size);
 
-  size_t body_length = 0;
-  while (true) {
-    auto buf_size = evbuffer_get_contiguous_space(input_buf);
+  const int num_segments = evbuffer_peek(input_buf, -1, nullptr, nullptr, 0);
+  std::vector<evbuffer_iovec> segments(std::max(num_segments, 0));
+  evbuffer_peek(input_buf, -1, nullptr, segments.data(), segments.size());
 
-    if (buf_size == 0) {
-      break;  // EOF
-    }
-
-    char* block = std::allocator<char>().allocate(buf_size);
-    int ret = evbuffer_remove(input_buf, block, buf_size);
-    if (ret != buf_size) {
-      NET_LOG(ERROR, "Unexpected: read less than specified num_bytes : %zu",
-              buf_size);
-      std::allocator<char>().deallocate(block, buf_size);
-      for (auto buf : buf_list) {
-        std::allocator<char>().deallocate(buf.data(), buf.size());
+  ZLib zlib;
+  char* uncomp_body = std::allocator<char>().allocate(capacity);
+  size_t uncomp_size = 0;
+  bool ok = true;
+  for (const evbuffer_iovec& segment : segments) {
+    const Bytef* source = static_cast<const Bytef*>(segment.iov_base);
+    uLong source_length = segment.iov_len;
+    while (ok && source_length > 0) {
+      if (uncomp_size == capacity) {
+        if (capacity == max_size) {
+          NET_LOG(ERROR, "Uncompressed body exceeds %zu bytes", max_size);
+          ok = false;
+          break;
+        }
+        const size_t new_capacity = std::min(2 * capacity, max_size);
+        char* new_body = std::allocator<char>().allocate(new_capacity);
+        memcpy(new_body, uncomp_body, uncomp_size);
+        std::allocator<char>().deallocate(uncomp_body, capacity);
+        uncomp_body = new_body;
+        capacity = new_capacity;
+      }
+      uLongf dest_length = capacity - uncomp_size;
+      const uLong remaining_before = source_length;
+      const int err = zlib.UncompressAtMost(
+          reinterpret_cast<Bytef*>(uncomp_body + uncomp_size), &dest_length,
+          source, &source_length);
+      if (err != Z_OK && err != Z_BUF_ERROR) {
+        NET_LOG(ERROR, "Got zlib error: %d", err);
+        ok = false;
+        break;
       }
-      *size = 0;
-      return nullptr;  // don't return corrupted buffer
+      source += remaining_before - source_length;
+      uncomp_size += dest_length;
     }
-
-    body_length += buf_size;
-    buf_list.emplace_back(block, buf_size);
+    if (!ok) break;
   }
-
-  char* comp_body = std::allocator<char>().allocate(body_length);
-
-  size_t pos = 0;
-  for (auto buf : buf_list) {
-    memcpy(comp_body + pos, buf.data(), buf.size());
-    pos += buf.size();
-    std::allocator<char>().deallocate(buf.data(), buf.size());
+  if (ok && !zlib.UncompressChunkDone()) {
+    NET_LOG(ERROR, "Invalid end of the gzipped body");
+    ok = false;
   }
+  evbuffer_drain(input_buf, body_length);
 
-  char* uncomp_body;
-  auto uncomp_size = reinterpret_cast<size_t*>(size);
-  UncompressGzipBody(comp_body, body_length,
-                     reinterpret_cast<void**>(&uncomp_body), uncomp_size);
-
-  std::allocator<char>().deallocate(comp_body, body_length);
-
-  if (uncomp_body != nullptr) {
-    return std::unique_ptr<char[], BlockDeleter>(uncomp_body,
-                                                 BlockDeleter(*uncomp_size));
-  } else {
+  if (!ok) {
     NET_LOG(ERROR, "Failed to uncompress the gzipped body");
-    *uncomp_size = 0;
+    std::allocator<char>().deallocate(uncomp_body, capacity);
+    *size = 0;
     return nullptr;
   }
+  *size = static_cast<int64_t>(uncomp_size);
+  return std::unique_ptr<char[], BlockDeleter>(uncomp_body,
+                                               BlockDeleter(capacity));
 }
 
 bool EvHTTPRequest::NeedUncompressGzipContent() {
@@ -265,33 +363,18 @@ bool EvHTTPRequest::NeedUncompressGzipContent() {
   return false;
 }
 
-void EvHTTPRequest::UncompressGzipBody(void* input, size_t input_size,
-                                       void** uncompressed_input,
-                                       size_t* uncompressed_input_size) {
-  int64_t max = handler_options_->auto_uncompress_max_size() > 0
-                    ? handler_options_->auto_uncompress_max_size()
-                    : ZLib::kMaxUncompressedBytes;
-
-  // our APIs don't need expose the actual content-length
-  *uncompressed_input_size = static_cast<size_t>(max);
-
-  ZLib zlib;
-  int err = zlib.UncompressGzipAndAllocate(
-      reinterpret_cast<Bytef**>(uncompressed_input),
-      reinterpret_cast<uLongf*>(uncompressed_input_size),
-      static_cast<Bytef*>(input), static_cast<uLong>(input_size));
-  if (err != Z_OK) {
-    NET_LOG(ERROR, "Got zlib error: %d", err);
-  }
-}
-
 // Note: passing string_view incurs a copy of underlying std::string data
 // (stack)
 absl::string_view EvHTTPRequest::GetRequestHeader(
     absl::string_view header) const {
-  std::string header_str(header.data(), header.size());
-  return absl::NullSafeStringView(
-      evhttp_find_header(parsed_request_->headers, header_str.c_str()));
+  // Same as evhttp_find_header(), without copying 'header' to terminate it.
+  for (const evkeyval* ev_header = parsed_request_->headers->tqh_first;
+       ev_header != nullptr; ev_header = ev_header->next.tqe_next) {
+    if (absl::EqualsIgnoreCase(ev_header->key, header)) {
+      return ev_header->value;
+    }
+  }
+  return absl::string_view();
 }
 
 std::vector<absl::string_view> EvHTTPRequest::request_headers() const {
@@ -337,21 +420,109 @@ void EvHTTPRequest::AppendResponseHeader(absl::string_view header,
   }
 }
 
+// The response is sent with chunked transfer encoding: each call hands the
+// body written so far to the event-loop as one chunk, and a new buffer
+// collects the rest of the body.
 void EvHTTPRequest::PartialReplyWithStatus(HTTPStatusCode status) {
-  NET_LOG(FATAL, "PartialReplyWithStatus not implemented.");
+  if (!SchedulePartialReply(status, /*on_flush=*/nullptr)) {
+    NET_LOG(ERROR, "Failed to EventLoopSchedule PartialReplyWithStatus()");
+  }
+}
+
+bool EvHTTPRequest::SchedulePartialReply(HTTPStatusCode status,
+                                         std::function<void()> on_flush) {
+  const bool start_reply = !reply_started_;
+  if (start_reply) {
+    MaybeStartResponseCompression(/*streamed=*/true);
+  }
+  if (response_compressor_ != nullptr) {
+    CompressResponseBody(/*last=*/false);
+  }
+  evbuffer* chunk = output_buf;
+  output_buf = evbuffer_new();
+  reply_started_ = true;
+
+  bool result = server_->EventLoopSchedule(
+      [this, status, start_reply, chunk,
+       on_flush = std::move(on_flush)]() mutable {
+        EvSendPartialReply(status, start_reply, chunk, std::move(on_flush));
+      });
+
+  if (!result) {
+    evbuffer_free(chunk);
+  }
+  return result;
+}
+
+void EvHTTPRequest::EvSendPartialReply(HTTPStatusCode status, bool start_reply,
+                                       evbuffer* chunk,
+                                       std::function<void()> on_flush) {
+  // Nothing can be sent once the connection is closed.
+  if (connection_status_ != nullptr && connection_status_->closed) {
+    evbuffer_free(chunk);
+    if (on_flush) {
+      on_flush();
+    }
+    return;
+  }
+  if (start_reply) {
+    evhttp_send_reply_start(parsed_request_->request, static_cast<int>(status),
+                            nullptr);
+  }
+  // libevent does not send empty chunks, which would end the chunked encoding,
+  // nor calls their callback: there is nothing to flush.
+  if (evbuffer_get_length(chunk) == 0 || connection_status_ == nullptr) {
+    evbuffer_free(chunk);
+    if (on_flush) {
+      on_flush();
+    }
+    return;
+  }
+  if (on_flush) {
+    connection_status_->on_flush = std::move(on_flush);
+    evhttp_send_reply_chunk_with_cb(parsed_request_->request, chunk,
+                                    &EvChunkFlushedFn, this);
+  } else {
+    evhttp_send_reply_chunk(parsed_request_->request, chunk);
+  }
+  evbuffer_free(chunk);
+}
+
+// static function pointer
+void EvHTTPRequest::EvChunkFlushedFn(evhttp_connection* evcon, void* request) {
+  std::function<void()> on_flush;
+  on_flush.swap(static_cast<EvHTTPRequest*>(request)->connection_status_
+                    ->on_flush);
+  if (on_flush) {
+    on_flush();
+  }
 }
 
 void EvHTTPRequest::PartialReply() {
-  NET_LOG(FATAL, "PartialReplyWithStatus not implemented.");
+  PartialReplyWithStatus(HTTPStatusCode::OK);
 }
 
 ServerRequestInterface::CallbackStatus
 EvHTTPRequest::PartialReplyWithFlushCallback(std::function<void()> callback) {
-  NET_LOG(FATAL, "PartialReplyWithStatus not implemented.");
-  return CallbackStatus::NOT_SCHEDULED;
+  if (response_body_status() == BodyStatus::FAILED) {
+    return CallbackStatus::NOT_SCHEDULED;
+  }
+  if (!SchedulePartialReply(HTTPStatusCode::OK, std::move(callback))) {
+    NET_LOG(ERROR,
+            "Failed to EventLoopSchedule PartialReplyWithFlushCallback()");
+    return CallbackStatus::NOT_SCHEDULED;
+  }
+  return CallbackStatus::SCHEDULED;
 }
 
 void EvHTTPRequest::ReplyWithStatus(HTTPStatusCode status) {
+  if (!reply_started_) {
+    MaybeStartResponseCompression(/*streamed=*/false);
+  }
+  if (response_compressor_ != nullptr) {
+    CompressResponseBody(/*last=*/true);
+  }
+
   bool result =
       server_->EventLoopSchedule([this, status]() { EvSendReply(status); });
 
@@ -364,22 +535,120 @@ void EvHTTPRequest::ReplyWithStatus(HTTPStatusCode status) {
 }
 
 void EvHTTPRequest::EvSendReply(HTTPStatusCode status) {
-  evhttp_send_reply(parsed_request_->request, static_cast<int>(status), nullptr,
-                    output_buf);
+  if (reply_started_) {
+    // The status has been sent with the first chunk.
+    if (evbuffer_get_length(output_buf) > 0) {
+      evhttp_send_reply_chunk(parsed_request_->request, output_buf);
+    }
+    evhttp_send_reply_end(parsed_request_->request);
+  } else {
+    evhttp_send_reply(parsed_request_->request, static_cast<int>(status),
+                      nullptr, output_buf);
+  }
   server_->DecOps();
   delete this;
 }
 
 void EvHTTPRequest::Reply() { ReplyWithStatus(HTTPStatusCode::OK); }
 
+void EvHTTPRequest::MaybeStartResponseCompression(bool streamed) {
+  if (handler_options_ == nullptr ||
+      !handler_options_->auto_compress_output() ||
+      !AcceptsGzipEncoding(GetRequestHeader(HTTPHeaders::ACCEPT_ENCODING))) {
+    return;
+  }
+  evkeyvalq* ev_headers =
+      evhttp_request_get_output_headers(parsed_request_->request);
+  if (evhttp_find_header(ev_headers, HTTPHeaders::CONTENT_ENCODING) !=
+      nullptr) {
+    return;  // Already encoded by the handler.
+  }
+  const size_t body_size = evbuffer_get_length(output_buf);
+  if (!streamed && (body_size == 0 ||
+                    static_cast<int64_t>(body_size) <
+                        handler_options_->auto_compress_min_size())) {
+    return;
+  }
+
+  response_compressor_.reset(new ZLib());
+  OverwriteResponseHeader(HTTPHeaders::CONTENT_ENCODING, "gzip");
+  AppendResponseHeader(HTTPHeaders::VARY, HTTPHeaders::ACCEPT_ENCODING);
+}
+
+// Each piece of the body is compressed with a sync flush, so that the client
+// can uncompress every chunk as soon as it receives it.
+void EvHTTPRequest::CompressResponseBody(bool last) {
+  const size_t body_size = evbuffer_get_length(output_buf);
+  const size_t capacity = ZLib::MinCompressbufSize(body_size) +
+                          response_compressor_->MinFooterSize();
+  evbuffer* compressed = evbuffer_new();
+  evbuffer_iovec vec;
+  if (compressed == nullptr ||
+      evbuffer_reserve_space(compressed, capacity, &vec, 1) != 1) {
+    NET_LOG(ERROR, "Failed to allocate %zu bytes to compress the response",
+            capacity);
+    if (compressed != nullptr) evbuffer_free(compressed);
+    return;
+  }
+
+  // zlib needs a non-null source, even when it is empty.
+  static const Bytef kEmptySource[1] = {0};
+  const Bytef* source =
+      body_size > 0 ? evbuffer_pullup(output_buf, -1) : kEmptySource;
+  uLong source_length = body_size;
+  Bytef* dest = static_cast<Bytef*>(vec.iov_base);
+  uLongf compressed_size = capacity;
+  int err = Z_OK;
+  if (body_size > 0 || response_compressor_->first_chunk()) {
+    err = response_compressor_->CompressAtMost(dest, &compressed_size, source,
+                                               &source_length);
+  } else {
+    compressed_size = 0;
+  }
+  if (err == Z_OK && last) {
+    uLongf footer_size = capacity - compressed_size;
+    err = response_compressor_->CompressChunkDone(dest + compressed_size,
+                                                  &footer_size);
+    compressed_size += footer_size;
+  }
+  if (err != Z_OK || source_length != 0) {
+    NET_LOG(ERROR, "Got zlib error: %d", err);
+    // The stream cannot be continued: the rest of the response is dropped.
+    compressed_size = 0;
+  }
+
+  vec.iov_len = compressed_size;
+  evbuffer_commit_space(compressed, &vec, 1);
+  evbuffer_free(output_buf);
+  output_buf = compressed;
+}
+
 // Treats this as 500 for now and let libevent decide what to do
 // with the connection.
 void EvHTTPRequest::Abort() {
+  if (reply_started_) {
+    // The status has been sent already: the connection is closed so that the
+    // client does not take the partial response for a complete one.
+    bool result = server_->EventLoopSchedule([this]() { EvAbortReply(); });
+    if (!result) {
+      NET_LOG(ERROR, "Failed to EventLoopSchedule Abort()");
+    }
+    return;
+  }
   evhttp_send_error(parsed_request_->request, HTTP_INTERNAL, nullptr);
   server_->DecOps();
   delete this;
 }
 
+void EvHTTPRequest::EvAbortReply() {
+  // Freeing the connection frees the request too.
+  evhttp_connection_free(
+      evhttp_request_get_connection(parsed_request_->request));
+  parsed_request_->request = nullptr;
+  server_->DecOps();
+  delete this;
+}
+
 }  // namespace net_http
 }  // namespace serving
 }  // namespace tensorflow
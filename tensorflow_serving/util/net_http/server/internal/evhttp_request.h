@@ -18,7 +18,9 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_UTIL_NET_HTTP_SERVER_INTERNAL_EVHTTP_REQUEST_H_
 #define TENSORFLOW_SERVING_UTIL_NET_HTTP_SERVER_INTERNAL_EVHTTP_REQUEST_H_
 
+#include <atomic>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
 
@@ -27,6 +29,7 @@ limitations under the License.
 #include "tensorflow_serving/util/net_http/server/public/server_request_interface.h"
 
 struct evbuffer;
+struct evhttp_connection;
 struct evhttp_request;
 struct evhttp_uri;
 struct evkeyvalq;
@@ -35,6 +38,24 @@ namespace tensorflow {
 namespace serving {
 namespace net_http {
 
+class ZLib;
+
+// Returns true if an Accept-Encoding header value (e.g. "gzip, br;q=0.5")
+// allows a gzip-encoded response.
+bool AcceptsGzipEncoding(absl::string_view accept_encoding);
+
+// The state of the connection of a request, shared with the event loop that
+// tracks the connection.
+struct EvConnectionStatus {
+  // Set from the event loop once the connection is closed.
+  std::atomic<bool> closed{false};
+
+  // The callback of the chunk being written by PartialReplyWithFlushCallback(),
+  // if any. Only accessed from the event loop, which calls it once the chunk
+  // is written or the connection closed.
+  std::function<void()> on_flush;
+};
+
 // Headers only
 struct ParsedEvRequest {
  public:
@@ -84,6 +105,10 @@ class EvHTTPRequest final : public ServerRequestInterface {
   std::unique_ptr<char[], BlockDeleter> ReadRequestBytes(
       int64_t* size) override;
 
+  // The body is linearized in the input buffer, which only copies it if it
+  // spans several chains, or uncompressed into a block owned by the request.
+  bool GetRequestBody(absl::string_view* body) override;
+
   absl::string_view GetRequestHeader(absl::string_view header) const override;
 
   std::vector<absl::string_view> request_headers() const override;
@@ -104,7 +129,12 @@ class EvHTTPRequest final : public ServerRequestInterface {
 
   void Abort() override;
 
+  // FAILED once the client has closed the connection, so that the handler
+  // may give up on a response nobody will read.
+  BodyStatus response_body_status() override;
+
   // Initializes the resource and returns false if any error.
+  // Called from the event loop.
   bool Initialize();
 
   // Keeps a reference to the registered RequestHandlerOptions
@@ -112,17 +142,44 @@ class EvHTTPRequest final : public ServerRequestInterface {
     this->handler_options_ = &handler_options;
   }
 
+  // Shares the state of the connection of the request with the event loop.
+  void SetConnectionStatus(std::shared_ptr<EvConnectionStatus> status) {
+    connection_status_ = std::move(status);
+  }
+
  private:
   void EvSendReply(HTTPStatusCode status);
 
+  // Hands the body written so far to EvSendPartialReply() in the event loop.
+  // Returns false if it could not be scheduled.
+  bool SchedulePartialReply(HTTPStatusCode status,
+                            std::function<void()> on_flush);
+
+  // Sends `chunk` (owned) as part of the response body, preceded by the
+  // status and headers if `start_reply` is true. Calls `on_flush`, if set,
+  // once the chunk is written.
+  void EvSendPartialReply(HTTPStatusCode status, bool start_reply,
+                          evbuffer* chunk, std::function<void()> on_flush);
+
+  // Called by libevent once the chunk of PartialReplyWithFlushCallback() is
+  // written.
+  static void EvChunkFlushedFn(evhttp_connection* evcon, void* request);
+
+  // Closes the connection of a request whose reply has been started.
+  void EvAbortReply();
+
+  // Sets up the gzip compression of the response body (before any of it is
+  // sent), if enabled by the handler options and accepted by the client.
+  // `streamed` is true if the body is sent with PartialReply().
+  void MaybeStartResponseCompression(bool streamed);
+
+  // Replaces output_buf by its compressed content. If `last`, the gzip stream
+  // is ended.
+  void CompressResponseBody(bool last);
+
   // Returns true if the data needs be uncompressed
   bool NeedUncompressGzipContent();
 
-  // Must set uncompressed_input to nullptr if uncompression is failed
-  void UncompressGzipBody(void* input, size_t input_size,
-                          void** uncompressed_input,
-                          size_t* uncompressed_input_size);
-
   std::unique_ptr<char[], BlockDeleter> ReadRequestGzipBytes(
       evbuffer* input_buf, int64_t* size);
 
@@ -132,7 +189,23 @@ class EvHTTPRequest final : public ServerRequestInterface {
 
   std::unique_ptr<ParsedEvRequest> parsed_request_;
 
+  // Set by the first GetRequestBody() call. The uncompressed body is owned by
+  // 'uncompressed_body_'.
+  bool request_body_read_ = false;
+  absl::string_view request_body_;
+  std::unique_ptr<char[], BlockDeleter> uncompressed_body_;
+
   evbuffer* output_buf;  // owned by this
+
+  // Closed from the event loop, before the reply if the client went away.
+  // Null if not tracked.
+  std::shared_ptr<EvConnectionStatus> connection_status_;
+
+  // True once PartialReply() has been called.
+  bool reply_started_ = false;
+
+  // Set if the response body is gzip-compressed.
+  std::unique_ptr<ZLib> response_compressor_;
 };
 
 }  // namespace net_http
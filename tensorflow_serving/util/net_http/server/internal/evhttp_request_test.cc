@@ -145,6 +145,103 @@ TEST_F(EvHTTPRequestTest, SimplePOST) {
   server->WaitForTermination();
 }
 
+TEST_F(EvHTTPRequestTest, GetRequestBody) {
+  const std::string large_body(1 << 20, 'a');
+  auto handler = [](ServerRequestInterface* request) {
+    absl::string_view body;
+    ASSERT_TRUE(request->GetRequestBody(&body));
+    absl::string_view same_body;
+    ASSERT_TRUE(request->GetRequestBody(&same_body));
+    EXPECT_EQ(body.data(), same_body.data());
+    request->WriteResponseString(body);
+    request->Reply();
+  };
+  server->RegisterRequestHandler("/ok", std::move(handler),
+                                 RequestHandlerOptions());
+  server->StartAcceptingRequests();
+
+  auto connection =
+      EvHTTPConnection::Connect("localhost", server->listen_port());
+  ASSERT_TRUE(connection != nullptr);
+
+  for (const std::string& body : {std::string(), large_body}) {
+    ClientRequest request = {"/ok", "POST", {}, body};
+    ClientResponse response = {};
+    EXPECT_TRUE(connection->BlockingSendRequest(request, &response));
+    EXPECT_EQ(response.status, HTTPStatusCode::OK);
+    EXPECT_EQ(response.body, body);
+  }
+
+  server->Terminate();
+  server->WaitForTermination();
+}
+
+// Test a response sent in several chunks with PartialReply()
+TEST_F(EvHTTPRequestTest, PartialReply) {
+  auto handler = [](ServerRequestInterface* request) {
+    request->OverwriteResponseHeader("Content-Type", "text/plain");
+    request->WriteResponseString("abc");
+    request->PartialReply();
+    // An empty chunk does not end the response.
+    request->PartialReply();
+    request->WriteResponseString("de");
+    request->PartialReply();
+    request->WriteResponseString("f");
+    request->Reply();
+  };
+  server->RegisterRequestHandler("/ok", std::move(handler),
+                                 RequestHandlerOptions());
+  server->StartAcceptingRequests();
+
+  auto connection =
+      EvHTTPConnection::Connect("localhost", server->listen_port());
+  ASSERT_TRUE(connection != nullptr);
+
+  ClientRequest request = {"/ok", "GET", {}, ""};
+  ClientResponse response = {};
+
+  EXPECT_TRUE(connection->BlockingSendRequest(request, &response));
+  EXPECT_EQ(response.status, HTTPStatusCode::OK);
+  EXPECT_EQ(response.body, "abcdef");
+
+  server->Terminate();
+  server->WaitForTermination();
+}
+
+// Test a response whose chunks are written once the previous one is flushed
+TEST_F(EvHTTPRequestTest, PartialReplyWithFlushCallback) {
+  auto handler = [](ServerRequestInterface* request) {
+    request->OverwriteResponseHeader("Content-Type", "text/plain");
+    request->WriteResponseString("abc");
+    EXPECT_EQ(ServerRequestInterface::CallbackStatus::SCHEDULED,
+              request->PartialReplyWithFlushCallback([request]() {
+                // An empty chunk is flushed right away.
+                EXPECT_EQ(ServerRequestInterface::CallbackStatus::SCHEDULED,
+                          request->PartialReplyWithFlushCallback([request]() {
+                            request->WriteResponseString("def");
+                            request->Reply();
+                          }));
+              }));
+  };
+  server->RegisterRequestHandler("/ok", std::move(handler),
+                                 RequestHandlerOptions());
+  server->StartAcceptingRequests();
+
+  auto connection =
+      EvHTTPConnection::Connect("localhost", server->listen_port());
+  ASSERT_TRUE(connection != nullptr);
+
+  ClientRequest request = {"/ok", "GET", {}, ""};
+  ClientResponse response = {};
+
+  EXPECT_TRUE(connection->BlockingSendRequest(request, &response));
+  EXPECT_EQ(response.status, HTTPStatusCode::OK);
+  EXPECT_EQ(response.body, "abcdef");
+
+  server->Terminate();
+  server->WaitForTermination();
+}
+
 // Test request's uri_path() method.
 TEST_F(EvHTTPRequestTest, RequestUri) {
   static const char* const kUriPath[] = {
@@ -347,6 +444,14 @@ TEST_F(EvHTTPRequestTest, ValidGzipPost) {
 
     request->Reply();
   };
+  auto view_handler = [&](ServerRequestInterface* request) {
+    absl::string_view body;
+    EXPECT_TRUE(request->GetRequestBody(&body));
+    EXPECT_EQ(body, kBody);
+    request->Reply();
+  };
+  server->RegisterRequestHandler("/view", std::move(view_handler),
+                                 RequestHandlerOptions());
   server->RegisterRequestHandler("/ok", std::move(handler),
                                  RequestHandlerOptions());
   server->StartAcceptingRequests();
@@ -362,6 +467,13 @@ TEST_F(EvHTTPRequestTest, ValidGzipPost) {
   EXPECT_TRUE(connection->BlockingSendRequest(request, &response));
   EXPECT_EQ(response.status, HTTPStatusCode::OK);
 
+  // The same body, read in place.
+  request.uri_path = "/view";
+  response = {};
+
+  EXPECT_TRUE(connection->BlockingSendRequest(request, &response));
+  EXPECT_EQ(response.status, HTTPStatusCode::OK);
+
   server->Terminate();
   server->WaitForTermination();
 }
@@ -453,6 +565,95 @@ TEST_F(EvHTTPRequestTest, LargeGzipPost) {
   server->WaitForTermination();
 }
 
+std::string UncompressString(const std::string& compressed) {
+  ZLib zlib;
+  Bytef* data;
+  uLongf size = ZLib::kMaxUncompressedBytes;
+  if (zlib.UncompressGzipAndAllocate(&data, &size, (Bytef*)compressed.data(),
+                                     compressed.size()) != Z_OK) {
+    return "<invalid gzip>";
+  }
+  std::string uncompressed(reinterpret_cast<char*>(data), size);
+  std::allocator<Bytef>().deallocate(data, size);
+  return uncompressed;
+}
+
+std::string GetResponseHeader(const ClientResponse& response,
+                              const std::string& header) {
+  for (const auto& keyvalue : response.headers) {
+    if (keyvalue.first == header) return keyvalue.second;
+  }
+  return "";
+}
+
+// Test gzip response body
+TEST_F(EvHTTPRequestTest, GzipResponse) {
+  const std::string body = MakeRandomString(100 * 1024);
+  auto handler = [&](ServerRequestInterface* request) {
+    request->WriteResponseString(body);
+    request->Reply();
+  };
+  RequestHandlerOptions options;
+  options.set_auto_compress_output(true);
+  server->RegisterRequestHandler("/ok", std::move(handler), options);
+  server->StartAcceptingRequests();
+
+  auto connection =
+      EvHTTPConnection::Connect("localhost", server->listen_port());
+  ASSERT_TRUE(connection != nullptr);
+
+  ClientRequest request = {"/ok", "GET", {}, ""};
+  request.headers.emplace_back("Accept-Encoding", "deflate, gzip;q=0.8");
+  ClientResponse response = {};
+
+  EXPECT_TRUE(connection->BlockingSendRequest(request, &response));
+  EXPECT_EQ(response.status, HTTPStatusCode::OK);
+  EXPECT_EQ(GetResponseHeader(response, "Content-Encoding"), "gzip");
+  EXPECT_LT(response.body.size(), body.size());
+  EXPECT_EQ(UncompressString(response.body), body);
+
+  // Not compressed if the client does not accept it.
+  request.headers = {{"Accept-Encoding", "gzip;q=0"}};
+  response = {};
+  EXPECT_TRUE(connection->BlockingSendRequest(request, &response));
+  EXPECT_EQ(GetResponseHeader(response, "Content-Encoding"), "");
+  EXPECT_EQ(response.body, body);
+
+  server->Terminate();
+  server->WaitForTermination();
+}
+
+// Test gzip response body sent with PartialReply()
+TEST_F(EvHTTPRequestTest, GzipPartialReply) {
+  auto handler = [](ServerRequestInterface* request) {
+    request->WriteResponseString("abc");
+    request->PartialReply();
+    request->WriteResponseString("de");
+    request->PartialReply();
+    request->WriteResponseString("f");
+    request->Reply();
+  };
+  RequestHandlerOptions options;
+  options.set_auto_compress_output(true);
+  server->RegisterRequestHandler("/ok", std::move(handler), options);
+  server->StartAcceptingRequests();
+
+  auto connection =
+      EvHTTPConnection::Connect("localhost", server->listen_port());
+  ASSERT_TRUE(connection != nullptr);
+
+  ClientRequest request = {"/ok", "GET", {{"Accept-Encoding", "gzip"}}, ""};
+  ClientResponse response = {};
+
+  EXPECT_TRUE(connection->BlockingSendRequest(request, &response));
+  EXPECT_EQ(response.status, HTTPStatusCode::OK);
+  EXPECT_EQ(GetResponseHeader(response, "Content-Encoding"), "gzip");
+  EXPECT_EQ(UncompressString(response.body), "abcdef");
+
+  server->Terminate();
+  server->WaitForTermination();
+}
+
 }  // namespace
 }  // namespace net_http
 }  // namespace serving
@@ -18,17 +18,24 @@ limitations under the License.
 #include "tensorflow_serving/util/net_http/server/internal/evhttp_server.h"
 
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <signal.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 #include <cstdint>
+#include <cstring>
 #include <memory>
 #include <utility>
 
 #include "absl/base/call_once.h"
 #include "absl/memory/memory.h"
+#include "absl/time/time.h"
 #include "libevent/include/event2/event.h"
 #include "libevent/include/event2/http.h"
+#include "libevent/include/event2/listener.h"
 #include "libevent/include/event2/thread.h"
 #include "libevent/include/event2/util.h"
 #include "tensorflow_serving/util/net_http/internal/net_logging.h"
@@ -63,6 +70,14 @@ EvHTTPServer::~EvHTTPServer() {
     NET_LOG(ERROR, "Server has not been terminated. Force termination now.");
     Terminate();
   }
+}
+
+EvHTTPServer::EventLoop::~EventLoop() {
+  // This frees their bufferevents, unless requests are still pending.
+  http2_connections_.clear();
+  if (http2_listener_ != nullptr) {
+    evconnlistener_free(http2_listener_);
+  }
 
   if (ev_http_ != nullptr) {
     // this frees the socket handlers too
@@ -82,14 +97,27 @@ bool EvHTTPServer::Initialize() {
     return false;
   }
 
-  if (server_options_->ports().empty()) {
-    NET_LOG(FATAL, "Server port is not specified.");
+  if (server_options_->ports().empty() &&
+      server_options_->unix_socket_path().empty() &&
+      server_options_->http2_port() < 0) {
+    NET_LOG(FATAL, "Server port or Unix socket is not specified.");
     return false;
   }
 
   GlobalInitialize();
 
-  // This ev_base_ created per-server v.s. global
+  for (int i = 0; i < server_options_->num_event_loops(); i++) {
+    event_loops_.push_back(absl::make_unique<EventLoop>(this));
+    if (!event_loops_.back()->Initialize()) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool EvHTTPServer::EventLoop::Initialize() {
+  // This ev_base_ created per-loop v.s. global
   ev_base_ = event_base_new();
   if (ev_base_ == nullptr) {
     NET_LOG(FATAL, "Failed to create an event_base.");
@@ -114,88 +142,141 @@ bool EvHTTPServer::Initialize() {
                     EVHTTP_REQ_PATCH);
   evhttp_set_gencb(ev_http_, &DispatchEvRequestFn, this);
 
+  const ServerOptions& options = *server_->server_options_;
+  if (options.connection_timeout() != absl::InfiniteDuration()) {
+    const timeval timeout = absl::ToTimeval(options.connection_timeout());
+    evhttp_set_timeout_tv(ev_http_, &timeout);
+  }
+
+  if (options.max_connections() > 0) {
+    // Rounded up, so that each loop accepts at least one connection.
+    max_connections_ = (options.max_connections() + options.num_event_loops() -
+                        1) / options.num_event_loops();
+  }
+
+  http2_options_.max_concurrent_streams =
+      options.http2_max_concurrent_streams();
+  http2_options_.max_requests = options.max_requests_per_connection();
+
   return true;
 }
 
 // static function pointer
-void EvHTTPServer::DispatchEvRequestFn(evhttp_request* req, void* server) {
-  EvHTTPServer* http_server = static_cast<EvHTTPServer*>(server);
-  http_server->DispatchEvRequest(req);
+void EvHTTPServer::DispatchEvRequestFn(evhttp_request* req, void* loop) {
+  EventLoop* event_loop = static_cast<EventLoop*>(loop);
+  event_loop->server()->DispatchEvRequest(req, event_loop);
 }
 
-void EvHTTPServer::DispatchEvRequest(evhttp_request* req) {
-  auto parsed_request = absl::make_unique<ParsedEvRequest>(req);
-
-  if (!parsed_request->decode()) {
-    evhttp_send_error(req, HTTP_BADREQUEST, nullptr);
-    return;
-  }
-
-  std::string path(parsed_request->path);
-
+template <typename Request>
+bool EvHTTPServer::DispatchRequest(const std::string& path,
+                                   std::unique_ptr<Request>* request) {
   bool dispatched = false;
-  std::unique_ptr<EvHTTPRequest> ev_request(
-      new EvHTTPRequest(std::move(parsed_request), this));
 
-  if (!ev_request->Initialize()) {
-    evhttp_send_error(req, HTTP_SERVUNAVAIL, nullptr);
-    return;
-  }
+  // Set for handlers that run inline, which is done once request_mu_ is
+  // released so that they may register handlers too.
+  RequestHandler inline_handler;
 
   {
     absl::MutexLock l(&request_mu_);
 
     auto handler_map_it = uri_handlers_.find(path);
     if (handler_map_it != uri_handlers_.end()) {
-      ev_request->SetHandlerOptions(handler_map_it->second.options);
+      (*request)->SetHandlerOptions(handler_map_it->second.options);
       IncOps();
       dispatched = true;
-      ScheduleHandlerReference(handler_map_it->second.handler,
-                               ev_request.release());
+      if (handler_map_it->second.options.run_inline()) {
+        inline_handler = handler_map_it->second.handler;
+      } else {
+        ScheduleHandlerReference(handler_map_it->second.handler,
+                                 request->release(),
+                                 handler_map_it->second.options.priority());
+      }
     }
 
     if (!dispatched) {
       for (const auto& dispatcher : dispatchers_) {
-        auto handler = dispatcher.dispatcher(ev_request.get());
+        auto handler = dispatcher.dispatcher(request->get());
         if (handler == nullptr) {
           continue;
         }
-        ev_request->SetHandlerOptions(dispatcher.options);
+        (*request)->SetHandlerOptions(dispatcher.options);
         IncOps();
         dispatched = true;
-        ScheduleHandler(std::move(handler), ev_request.release());
+        if (dispatcher.options.run_inline()) {
+          inline_handler = std::move(handler);
+        } else {
+          ScheduleHandler(std::move(handler), request->release(),
+                          dispatcher.options.priority());
+        }
         break;
       }
     }
   }
 
-  if (!dispatched) {
-    evhttp_send_error(req, HTTP_NOTFOUND, nullptr);
+  if (inline_handler != nullptr) {
+    // The reply is sent from the next iteration of this loop.
+    inline_handler(request->release());
+  }
+  return dispatched;
+}
+
+void EvHTTPServer::DispatchEvRequest(evhttp_request* req, EventLoop* loop) {
+  std::shared_ptr<EvConnectionStatus> connection_status =
+      loop->TrackRequest(req);
+
+  auto parsed_request = absl::make_unique<ParsedEvRequest>(req);
+
+  if (!parsed_request->decode()) {
+    evhttp_send_error(req, HTTP_BADREQUEST, nullptr);
     return;
   }
+
+  std::string path(parsed_request->path);
+
+  std::unique_ptr<EvHTTPRequest> ev_request(
+      new EvHTTPRequest(std::move(parsed_request), loop));
+
+  if (!ev_request->Initialize()) {
+    evhttp_send_error(req, HTTP_SERVUNAVAIL, nullptr);
+    return;
+  }
+  ev_request->SetConnectionStatus(std::move(connection_status));
+
+  if (!DispatchRequest(path, &ev_request)) {
+    evhttp_send_error(req, HTTP_NOTFOUND, nullptr);
+  }
+}
+
+void EvHTTPServer::DispatchHttp2Request(std::unique_ptr<Http2Request> request) {
+  if (!DispatchRequest(std::string(request->path()), &request)) {
+    // Replied to from the next iteration of the loop.
+    IncOps();
+    request.release()->ReplyWithStatus(HTTPStatusCode::NOT_FOUND);
+  }
 }
 
 void EvHTTPServer::ScheduleHandlerReference(const RequestHandler& handler,
-                                            EvHTTPRequest* ev_request) {
-  server_options_->executor()->Schedule(
-      [&handler, ev_request]() { handler(ev_request); });
+                                            ServerRequestInterface* request,
+                                            int priority) {
+  server_options_->executor()->ScheduleWithPriority(
+      [&handler, request]() { handler(request); }, priority);
 }
 
 // Exactly one copy of the handler argument
 // with the lambda passed by value to Schedule()
 void EvHTTPServer::ScheduleHandler(RequestHandler&& handler,
-                                   EvHTTPRequest* ev_request) {
-  server_options_->executor()->Schedule(
-      [handler, ev_request]() { handler(ev_request); });
+                                   ServerRequestInterface* request,
+                                   int priority) {
+  server_options_->executor()->ScheduleWithPriority(
+      [handler, request]() { handler(request); }, priority);
 }
 
 namespace {
 
-void ResolveEphemeralPort(evhttp_bound_socket* listener, int* port) {
+void ResolveEphemeralPort(evutil_socket_t fd, int* port) {
   sockaddr_storage ss = {};
   ev_socklen_t socklen = sizeof(ss);
 
-  evutil_socket_t fd = evhttp_bound_socket_get_fd(listener);
   if (getsockname(fd, reinterpret_cast<sockaddr*>(&ss), &socklen)) {
     NET_LOG(ERROR, "getsockname() failed");
     return;
@@ -210,44 +291,364 @@ void ResolveEphemeralPort(evhttp_bound_socket* listener, int* port) {
   }
 }
 
+// Same as evhttp_bind_socket_with_handle(), but with SO_REUSEPORT set if
+// `reuse_port` so that several listeners can share the port. New connections
+// are passed to `cb` if any.
+evconnlistener* BindListener(event_base* ev_base, int port, bool reuse_port,
+                             evconnlistener_cb cb, void* arg) {
+  const unsigned kListenerFlags =
+      LEV_OPT_REUSEABLE | (reuse_port ? LEV_OPT_REUSEABLE_PORT : 0) |
+      LEV_OPT_CLOSE_ON_EXEC | LEV_OPT_CLOSE_ON_FREE;
+  sockaddr_in6 addr6 = {};
+  addr6.sin6_family = AF_INET6;
+  addr6.sin6_addr = in6addr_any;
+  addr6.sin6_port = htons(static_cast<uint16_t>(port));
+  evconnlistener* listener = evconnlistener_new_bind(
+      ev_base, cb, arg, kListenerFlags, /*backlog=*/-1,
+      reinterpret_cast<sockaddr*>(&addr6), sizeof(addr6));
+  if (listener == nullptr) {
+    // in case ipv6 is not supported, fallback to inaddr_any
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    listener = evconnlistener_new_bind(
+        ev_base, cb, arg, kListenerFlags, /*backlog=*/-1,
+        reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+  }
+  return listener;
+}
+
+// Enables or disables `listener`, if any.
+void EnableListener(evconnlistener* listener, bool enabled) {
+  if (listener == nullptr) {
+    return;
+  }
+  if (enabled) {
+    evconnlistener_enable(listener);
+  } else {
+    evconnlistener_disable(listener);
+  }
+}
+
+// Enables or disables the listener of `bound_socket`, if any.
+void EnableListener(evhttp_bound_socket* bound_socket, bool enabled) {
+  if (bound_socket != nullptr) {
+    EnableListener(evhttp_bound_socket_get_listener(bound_socket), enabled);
+  }
+}
+
 }  // namespace
 
-bool EvHTTPServer::StartAcceptingRequests() {
-  if (ev_http_ == nullptr) {
-    NET_LOG(FATAL, "Server has not been successfully initialized");
+bool EvHTTPServer::EventLoop::Listen(int port, bool reuse_port) {
+  if (!reuse_port) {
+    // "::"  =>  in6addr_any
+    ev_uint16_t ev_port = static_cast<ev_uint16_t>(port);
+    ev_listener_ = evhttp_bind_socket_with_handle(ev_http_, "::", ev_port);
+    if (ev_listener_ == nullptr) {
+      // in case ipv6 is not supported, fallback to inaddr_any
+      ev_listener_ =
+          evhttp_bind_socket_with_handle(ev_http_, nullptr, ev_port);
+    }
+  } else {
+    evconnlistener* listener =
+        BindListener(ev_base_, port, /*reuse_port=*/true, nullptr, nullptr);
+    if (listener != nullptr) {
+      ev_listener_ = evhttp_bind_listener(ev_http_, listener);
+      if (ev_listener_ == nullptr) {
+        evconnlistener_free(listener);
+      }
+    }
+  }
+
+  if (ev_listener_ == nullptr) {
+    NET_LOG(ERROR, "Couldn't bind to port %d", port);
     return false;
   }
+  return true;
+}
 
-  const int port = server_options_->ports().front();
+bool EvHTTPServer::EventLoop::ListenHttp2(int port, bool reuse_port) {
+  http2_listener_ =
+      BindListener(ev_base_, port, reuse_port, &AcceptHttp2Fn, this);
+  if (http2_listener_ == nullptr) {
+    NET_LOG(ERROR, "Couldn't bind to HTTP/2 port %d", port);
+    return false;
+  }
+  return true;
+}
 
-  // "::"  =>  in6addr_any
-  ev_uint16_t ev_port = static_cast<ev_uint16_t>(port);
-  ev_listener_ = evhttp_bind_socket_with_handle(ev_http_, "::", ev_port);
-  if (ev_listener_ == nullptr) {
-    // in case ipv6 is not supported, fallback to inaddr_any
-    ev_listener_ = evhttp_bind_socket_with_handle(ev_http_, nullptr, ev_port);
-    if (ev_listener_ == nullptr) {
-      NET_LOG(ERROR, "Couldn't bind to port %d", port);
-      return false;
+bool EvHTTPServer::EventLoop::ListenOnUnixSocket(const std::string& path) {
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+    NET_LOG(ERROR, "Invalid Unix socket path %s", path.c_str());
+    return false;
+  }
+  memcpy(addr.sun_path, path.data(), path.size());
+
+  // Replaces the socket of a previous server, but no other file.
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(path.c_str());
+  }
+
+  constexpr unsigned kListenerFlags =
+      LEV_OPT_CLOSE_ON_EXEC | LEV_OPT_CLOSE_ON_FREE;
+  evconnlistener* listener = evconnlistener_new_bind(
+      ev_base_, nullptr, nullptr, kListenerFlags, /*backlog=*/-1,
+      reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+  if (listener != nullptr) {
+    ev_unix_listener_ = evhttp_bind_listener(ev_http_, listener);
+    if (ev_unix_listener_ == nullptr) {
+      evconnlistener_free(listener);
     }
   }
 
-  // Listener counts as an active operation
-  IncOps();
+  if (ev_unix_listener_ == nullptr) {
+    NET_LOG(ERROR, "Couldn't bind to Unix socket %s", path.c_str());
+    return false;
+  }
+  unix_socket_path_ = path;
+  return true;
+}
+
+namespace {
+
+void EvImmediateCallback(evutil_socket_t socket, int16_t flags, void* arg) {
+  auto fn = static_cast<std::function<void()>*>(arg);
+  (*fn)();
+  delete fn;
+}
+
+// The longest the listeners keep accepting the connections queued on them
+// once the server terminates.
+constexpr absl::Duration kAcceptQueueDrainTime = absl::Seconds(1);
+// How often the accept queues are checked until then.
+constexpr timeval kAcceptQueueCheckInterval = {0, 1000};
+
+// Returns the number of connections queued on the listening socket `fd`, i.e.
+// established but not accepted yet, or 0 if unknown.
+int AcceptQueueLength(evutil_socket_t fd) {
+#if defined(__linux__)
+  tcp_info info;
+  socklen_t size = sizeof(info);
+  // For a listening socket, tcpi_unacked is the length of its accept queue.
+  if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &size) == 0) {
+    return info.tcpi_unacked;
+  }
+#endif
+  return 0;
+}
+
+}  // namespace
+
+void EvHTTPServer::EventLoop::StopListening(absl::Time deadline,
+                                            std::function<void()> done) {
+  // The connections queued on a listening socket are reset when it is closed,
+  // instead of going to the other listeners of its port (e.g. those of a
+  // replacement server with SO_REUSEPORT). They are accepted first.
+  int queue_length = 0;
+  if (ev_listener_ != nullptr) {
+    queue_length += AcceptQueueLength(evhttp_bound_socket_get_fd(ev_listener_));
+  }
+  if (http2_listener_ != nullptr) {
+    queue_length += AcceptQueueLength(evconnlistener_get_fd(http2_listener_));
+  }
+  if (queue_length > 0 && absl::Now() < deadline) {
+    auto scheduled_fn = new std::function<void()>(
+        [this, deadline, done]() { StopListening(deadline, done); });
+    if (event_base_once(ev_base_, -1, EV_TIMEOUT, EvImmediateCallback,
+                        static_cast<void*>(scheduled_fn),
+                        &kAcceptQueueCheckInterval) == 0) {
+      return;
+    }
+    delete scheduled_fn;
+  }
+
+  // This deletes the listeners
+  if (ev_listener_ != nullptr) {
+    evhttp_del_accept_socket(ev_http_, ev_listener_);
+    ev_listener_ = nullptr;
+  }
+  if (ev_unix_listener_ != nullptr) {
+    evhttp_del_accept_socket(ev_http_, ev_unix_listener_);
+    ev_unix_listener_ = nullptr;
+    unlink(unix_socket_path_.c_str());
+  }
+  if (http2_listener_ != nullptr) {
+    evconnlistener_free(http2_listener_);
+    http2_listener_ = nullptr;
+  }
+  done();
+}
+
+std::shared_ptr<EvConnectionStatus> EvHTTPServer::EventLoop::TrackRequest(
+    evhttp_request* req) {
+  const ServerOptions& options = *server_->server_options_;
+  evhttp_connection* evcon = evhttp_request_get_connection(req);
+  auto result = connections_.emplace(evcon, ConnectionState());
+  ConnectionState& state = result.first->second;
+  if (result.second) {
+    state.status = std::make_shared<EvConnectionStatus>();
+    evhttp_connection_set_closecb(evcon, &ConnectionClosedFn, this);
+    OnConnectionOpened();
+  }
+
+  if (++state.num_requests == options.max_requests_per_connection()) {
+    // libevent closes the connection once this reply is sent.
+    evhttp_add_header(evhttp_request_get_output_headers(req), "Connection",
+                      "close");
+  }
+  return state.status;
+}
+
+// static function pointer
+void EvHTTPServer::EventLoop::ConnectionClosedFn(evhttp_connection* evcon,
+                                                 void* loop) {
+  static_cast<EventLoop*>(loop)->ConnectionClosed(evcon);
+}
+
+void EvHTTPServer::EventLoop::ConnectionClosed(evhttp_connection* evcon) {
+  auto it = connections_.find(evcon);
+  if (it != connections_.end()) {
+    const std::shared_ptr<EvConnectionStatus> status =
+        std::move(it->second.status);
+    connections_.erase(it);
+    status->closed = true;
+    // The chunk being written, if any, is dropped.
+    std::function<void()> on_flush;
+    on_flush.swap(status->on_flush);
+    if (on_flush) {
+      on_flush();
+    }
+  }
+  OnConnectionClosed();
+}
+
+// static function pointer
+void EvHTTPServer::EventLoop::AcceptHttp2Fn(evconnlistener* listener,
+                                            evutil_socket_t fd,
+                                            sockaddr* address, int socklen,
+                                            void* loop) {
+  static_cast<EventLoop*>(loop)->AcceptHttp2(fd);
+}
+
+void EvHTTPServer::EventLoop::AcceptHttp2(evutil_socket_t fd) {
+  const ServerOptions& options = *server_->server_options_;
+  auto connection = std::make_shared<Http2Connection>(
+      ev_base_, fd, http2_options_, options.connection_timeout(), this,
+      [this](std::unique_ptr<Http2Request> request) {
+        server_->DispatchHttp2Request(std::move(request));
+      },
+      [this](Http2Connection* connection) {
+        Http2ConnectionClosed(connection);
+      });
+  if (!connection->Start()) {
+    return;
+  }
+  http2_connections_.emplace(connection.get(), connection);
+  OnConnectionOpened();
+}
+
+void EvHTTPServer::EventLoop::Http2ConnectionClosed(
+    Http2Connection* connection) {
+  if (http2_connections_.erase(connection) > 0) {
+    OnConnectionClosed();
+  }
+}
+
+void EvHTTPServer::EventLoop::OnConnectionOpened() {
+  ConnectionObserver* observer =
+      server_->server_options_->connection_observer();
+  if (observer != nullptr) {
+    observer->OnConnectionOpened();
+  }
+  if (max_connections_ > 0 &&
+      num_connections() >= static_cast<size_t>(max_connections_)) {
+    PauseListening(true);
+  }
+}
 
-  port_ = port;
-  if (port_ == 0) {
-    ResolveEphemeralPort(ev_listener_, &port_);
+void EvHTTPServer::EventLoop::OnConnectionClosed() {
+  ConnectionObserver* observer =
+      server_->server_options_->connection_observer();
+  if (observer != nullptr) {
+    observer->OnConnectionClosed();
   }
+  if (listening_paused_ &&
+      num_connections() < static_cast<size_t>(max_connections_)) {
+    PauseListening(false);
+  }
+}
+
+void EvHTTPServer::EventLoop::PauseListening(bool paused) {
+  listening_paused_ = paused;
+  // Nothing to do once the listeners are deleted by StopListening().
+  EnableListener(ev_listener_, !paused);
+  EnableListener(ev_unix_listener_, !paused);
+  EnableListener(http2_listener_, !paused);
+}
 
-  IncOps();
-  server_options_->executor()->Schedule([this]() {
-    NET_LOG(INFO, "Entering the event loop ...");
-    int result = event_base_dispatch(ev_base_);
-    NET_LOG(INFO, "event_base_dispatch() exits with value %d", result);
+bool EvHTTPServer::StartAcceptingRequests() {
+  if (event_loops_.empty()) {
+    NET_LOG(FATAL, "Server has not been successfully initialized");
+    return false;
+  }
 
-    DecOps();
-  });
+  // With several event loops, the first listener resolves an ephemeral port
+  // and the others then share it.
+  if (!server_options_->ports().empty()) {
+    const bool reuse_port =
+        event_loops_.size() > 1 || server_options_->reuse_port();
+    port_ = server_options_->ports().front();
+    for (const auto& loop : event_loops_) {
+      if (!loop->Listen(port_, reuse_port)) {
+        return false;
+      }
+      if (port_ == 0) {
+        ResolveEphemeralPort(evhttp_bound_socket_get_fd(loop->ev_listener()),
+                             &port_);
+      }
+    }
+  }
+  if (server_options_->http2_port() >= 0) {
+    const bool reuse_port =
+        event_loops_.size() > 1 || server_options_->reuse_port();
+    http2_port_ = server_options_->http2_port();
+    for (const auto& loop : event_loops_) {
+      if (!loop->ListenHttp2(http2_port_, reuse_port)) {
+        return false;
+      }
+      if (http2_port_ == 0) {
+        ResolveEphemeralPort(evconnlistener_get_fd(loop->http2_listener()),
+                             &http2_port_);
+      }
+    }
+  }
+  if (!server_options_->unix_socket_path().empty() &&
+      !event_loops_.front()->ListenOnUnixSocket(
+          server_options_->unix_socket_path())) {
+    return false;
+  }
+
+  for (const auto& loop : event_loops_) {
+    // Listener counts as an active operation
+    IncOps();
+
+    IncOps();
+    event_base* ev_base = loop->ev_base();
+    server_options_->executor()->Schedule([this, ev_base]() {
+      NET_LOG(INFO, "Entering the event loop ...");
+      // Keeps running while there are no events, e.g. when the listener is
+      // paused or stopped while pending replies are yet to be scheduled, and
+      // until WaitForTermination() exits the loop.
+      int result = event_base_loop(ev_base, EVLOOP_NO_EXIT_ON_EMPTY);
+      NET_LOG(INFO, "event_base_loop() exits with value %d", result);
+
+      DecOps();
+    });
+  }
 
   accepting_requests_.Notify();
 
@@ -256,6 +657,8 @@ bool EvHTTPServer::StartAcceptingRequests() {
 
 int EvHTTPServer::listen_port() const { return port_; }
 
+int EvHTTPServer::http2_listen_port() const { return http2_port_; }
+
 bool EvHTTPServer::is_accepting_requests() const {
   return accepting_requests_.HasBeenNotified();
 }
@@ -274,12 +677,15 @@ void EvHTTPServer::Terminate() {
   terminating_.Notify();
 
   // call exit-loop from the event loop
-  this->EventLoopSchedule([this]() {
-    // Stop the listener first, which will delete ev_listener_
-    // This may cause the loop to exit, so need be scheduled from within
-    evhttp_del_accept_socket(ev_http_, ev_listener_);
-    DecOps();
-  });
+  const absl::Time deadline = absl::Now() + kAcceptQueueDrainTime;
+  for (const auto& loop : event_loops_) {
+    EventLoop* event_loop = loop.get();
+    event_loop->EventLoopSchedule([this, event_loop, deadline]() {
+      // Stop the listener first
+      // This may cause the loop to exit, so need be scheduled from within
+      event_loop->StopListening(deadline, [this]() { DecOps(); });
+    });
+  }
 
   // Current shut-down behavior:
   // - we don't proactively delete/close any HTTP connections as part of
@@ -303,15 +709,24 @@ void EvHTTPServer::DecOps() {
   num_pending_ops_--;
 }
 
+bool EvHTTPServer::OnlyEventLoopsPending() const {
+  return num_pending_ops_ <= static_cast<int64_t>(event_loops_.size());
+}
+
+void EvHTTPServer::ExitEventLoops() {
+  for (const auto& loop : event_loops_) {
+    int result = event_base_loopexit(loop->ev_base(), nullptr);
+    NET_LOG(INFO, "event_base_loopexit() exits with value %d", result);
+  }
+}
+
 void EvHTTPServer::WaitForTermination() {
   {
     absl::MutexLock l(&ops_mu_);
-    ops_mu_.Await(absl::Condition(
-        +[](int64_t* count) { return *count <= 1; }, &num_pending_ops_));
+    ops_mu_.Await(absl::Condition(this, &EvHTTPServer::OnlyEventLoopsPending));
   }
 
-  int result = event_base_loopexit(ev_base_, nullptr);
-  NET_LOG(INFO, "event_base_loopexit() exits with value %d", result);
+  ExitEventLoops();
 
   {
     absl::MutexLock l(&ops_mu_);
@@ -326,14 +741,11 @@ bool EvHTTPServer::WaitForTerminationWithTimeout(absl::Duration timeout) {
   {
     absl::MutexLock l(&ops_mu_);
     wait_result = ops_mu_.AwaitWithTimeout(
-        absl::Condition(
-            +[](int64_t* count) { return *count <= 1; }, &num_pending_ops_),
-        timeout);
+        absl::Condition(this, &EvHTTPServer::OnlyEventLoopsPending), timeout);
   }
 
   if (wait_result) {
-    int result = event_base_loopexit(ev_base_, nullptr);
-    NET_LOG(INFO, "event_base_loopexit() exits with value %d", result);
+    ExitEventLoops();
 
     // This should pass immediately
     {
@@ -390,17 +802,7 @@ void EvHTTPServer::RegisterRequestDispatcher(
   dispatchers_.emplace_back(dispatcher, options);
 }
 
-namespace {
-
-void EvImmediateCallback(evutil_socket_t socket, int16_t flags, void* arg) {
-  auto fn = static_cast<std::function<void()>*>(arg);
-  (*fn)();
-  delete fn;
-}
-
-}  // namespace
-
-bool EvHTTPServer::EventLoopSchedule(std::function<void()> fn) {
+bool EvHTTPServer::EventLoop::EventLoopSchedule(std::function<void()> fn) {
   auto scheduled_fn = new std::function<void()>(std::move(fn));
   int result = event_base_once(ev_base_, -1, EV_TIMEOUT, EvImmediateCallback,
                                static_cast<void*>(scheduled_fn), immediate_);
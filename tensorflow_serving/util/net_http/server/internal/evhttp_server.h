@@ -18,9 +18,12 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_UTIL_NET_HTTP_SERVER_INTERNAL_EVHTTP_SERVER_H_
 #define TENSORFLOW_SERVING_UTIL_NET_HTTP_SERVER_INTERNAL_EVHTTP_SERVER_H_
 
+#include <atomic>
 #include <cstdint>
 #include <ctime>
+#include <functional>
 #include <memory>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
@@ -28,21 +31,27 @@ limitations under the License.
 #include "absl/synchronization/mutex.h"
 
 #include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
 
 #include "tensorflow_serving/util/net_http/server/internal/evhttp_request.h"
+#include "tensorflow_serving/util/net_http/server/internal/http2_connection.h"
+#include "tensorflow_serving/util/net_http/server/internal/http2_request.h"
 #include "tensorflow_serving/util/net_http/server/internal/server_support.h"
 #include "tensorflow_serving/util/net_http/server/public/httpserver_interface.h"
 
 struct event_base;
+struct evconnlistener;
 struct evhttp;
 struct evhttp_bound_socket;
+struct evhttp_connection;
 struct evhttp_request;
+struct sockaddr;
 
 namespace tensorflow {
 namespace serving {
 namespace net_http {
 
-class EvHTTPServer final : public HTTPServerInterface, ServerSupport {
+class EvHTTPServer final : public HTTPServerInterface {
  public:
   virtual ~EvHTTPServer();
 
@@ -59,6 +68,8 @@ class EvHTTPServer final : public HTTPServerInterface, ServerSupport {
 
   int listen_port() const override;
 
+  int http2_listen_port() const override;
+
   void Terminate() override;
 
   bool is_terminating() const override;
@@ -73,20 +84,132 @@ class EvHTTPServer final : public HTTPServerInterface, ServerSupport {
   void RegisterRequestDispatcher(RequestDispatcher dispatcher,
                                  const RequestHandlerOptions& options) override;
 
-  void IncOps() override;
-  void DecOps() override;
+ private:
+  // An event loop with its own evhttp instance and listening socket. The
+  // requests accepted by a loop use it as their ServerSupport, so that their
+  // replies are sent from the loop that owns their connection.
+  class EventLoop final : public ServerSupport {
+   public:
+    explicit EventLoop(EvHTTPServer* server) : server_(server) {}
+    ~EventLoop() override;
+
+    bool Initialize();
+
+    // Binds the listening socket to `port` (0 for an ephemeral port), with
+    // SO_REUSEPORT if `reuse_port`.
+    bool Listen(int port, bool reuse_port);
+
+    // Binds a listening Unix domain socket at `path`.
+    bool ListenOnUnixSocket(const std::string& path);
+
+    // Binds the listening socket of the HTTP/2 connections to `port`, see
+    // Listen().
+    bool ListenHttp2(int port, bool reuse_port);
+
+    // Stops accepting connections, once the connections queued on the TCP
+    // listeners are accepted or at `deadline`, then calls `done`. Must be
+    // called from the event loop.
+    void StopListening(absl::Time deadline, std::function<void()> done);
+
+    // Tracks the connection of a new request, to enforce the connection
+    // limits of the server options. Returns the status of the connection.
+    std::shared_ptr<EvConnectionStatus> TrackRequest(evhttp_request* req);
+
+    void IncOps() override { server_->IncOps(); }
+    void DecOps() override { server_->DecOps(); }
+
+    bool EventLoopSchedule(std::function<void()> fn) override;
+
+    EvHTTPServer* server() const { return server_; }
+    event_base* ev_base() const { return ev_base_; }
+    evhttp_bound_socket* ev_listener() const { return ev_listener_; }
+    evconnlistener* http2_listener() const { return http2_listener_; }
+
+   private:
+    static void ConnectionClosedFn(evhttp_connection* evcon, void* loop);
+
+    void ConnectionClosed(evhttp_connection* evcon);
+
+    static void AcceptHttp2Fn(evconnlistener* listener, evutil_socket_t fd,
+                              sockaddr* address, int socklen, void* loop);
+
+    void AcceptHttp2(evutil_socket_t fd);
+
+    void Http2ConnectionClosed(Http2Connection* connection);
+
+    // A new connection has been opened.
+    void OnConnectionOpened();
+    // Called once a connection reported by OnConnectionOpened() is closed.
+    void OnConnectionClosed();
+
+    // The open connections of both protocols.
+    size_t num_connections() const {
+      return connections_.size() + http2_connections_.size();
+    }
+
+    // Stops or resumes accepting connections, to stay within the limit.
+    void PauseListening(bool paused);
+
+    EvHTTPServer* const server_;
+
+    event_base* ev_base_ = nullptr;
+    evhttp* ev_http_ = nullptr;
+    evhttp_bound_socket* ev_listener_ = nullptr;
+    // The listener of the Unix socket, if any, and its path.
+    evhttp_bound_socket* ev_unix_listener_ = nullptr;
+    std::string unix_socket_path_;
+    // The listener of the HTTP/2 connections, if any.
+    evconnlistener* http2_listener_ = nullptr;
+
+    // Timeval used to register immediate callbacks, which are called
+    // in the order that they are registered.
+    const timeval* immediate_ = nullptr;
+
+    struct ConnectionState {
+      // The number of requests sent.
+      int num_requests = 0;
+      std::shared_ptr<EvConnectionStatus> status;
+    };
+    // The open connections that sent requests. Only accessed from the event
+    // loop.
+    std::unordered_map<evhttp_connection*, ConnectionState> connections_;
+    // The open HTTP/2 connections, which are released once closed.
+    std::unordered_map<Http2Connection*, std::shared_ptr<Http2Connection>>
+        http2_connections_;
+    Http2Session::Options http2_options_;
+    // The max number of connections, or 0 if unlimited.
+    int max_connections_ = 0;
+    bool listening_paused_ = false;
+  };
 
-  bool EventLoopSchedule(std::function<void()> fn) override;
+  void IncOps();
+  void DecOps();
 
- private:
-  static void DispatchEvRequestFn(struct evhttp_request* req, void* server);
+  // Whether the only pending operations are the running event loops.
+  bool OnlyEventLoopsPending() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(ops_mu_);
 
-  void DispatchEvRequest(struct evhttp_request* req);
+  // Exits all the event loops.
+  void ExitEventLoops();
 
+  static void DispatchEvRequestFn(struct evhttp_request* req, void* loop);
+
+  void DispatchEvRequest(struct evhttp_request* req, EventLoop* loop);
+
+  void DispatchHttp2Request(std::unique_ptr<Http2Request> request);
+
+  // Runs or schedules the handler registered for `path`, or else the one of
+  // the first dispatcher that handles the request, which is then released.
+  // Returns false if there is none.
+  template <typename Request>
+  bool DispatchRequest(const std::string& path,
+                       std::unique_ptr<Request>* request);
+
+  // Both schedule the handler with the priority of its handler options.
   void ScheduleHandlerReference(const RequestHandler& handler,
-                                EvHTTPRequest* ev_request)
+                                ServerRequestInterface* request, int priority)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(request_mu_);
-  void ScheduleHandler(RequestHandler&& handler, EvHTTPRequest* ev_request)
+  void ScheduleHandler(RequestHandler&& handler,
+                       ServerRequestInterface* request, int priority)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(request_mu_);
 
   struct UriHandlerInfo {
@@ -113,6 +236,7 @@ class EvHTTPServer final : public HTTPServerInterface, ServerSupport {
   absl::Notification accepting_requests_;
   // Listener port
   int port_ = 0;
+  int http2_port_ = 0;
 
   // Started terminating the server, i.e. Terminate() has been called
   absl::Notification terminating_;
@@ -126,14 +250,8 @@ class EvHTTPServer final : public HTTPServerInterface, ServerSupport {
       ABSL_GUARDED_BY(request_mu_);
   std::vector<DispatcherInfo> dispatchers_ ABSL_GUARDED_BY(request_mu_);
 
-  // ev instances
-  event_base* ev_base_ = nullptr;
-  evhttp* ev_http_ = nullptr;
-  evhttp_bound_socket* ev_listener_ = nullptr;
-
-  // Timeval used to register immediate callbacks, which are called
-  // in the order that they are registered.
-  const timeval* immediate_;
+  // One per ServerOptions::num_event_loops().
+  std::vector<std::unique_ptr<EventLoop>> event_loops_;
 };
 
 }  // namespace net_http
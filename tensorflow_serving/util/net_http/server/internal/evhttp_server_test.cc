@@ -15,13 +15,26 @@ limitations under the License.
 
 #include "tensorflow_serving/util/net_http/server/internal/evhttp_server.h"
 
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include <gtest/gtest.h>
 #include "absl/memory/memory.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
 #include "absl/synchronization/notification.h"
 #include "tensorflow_serving/util/net_http/client/internal/evhttp_connection.h"
 #include "tensorflow_serving/util/net_http/internal/fixed_thread_pool.h"
+#include "tensorflow_serving/util/net_http/server/internal/hpack.h"
 #include "tensorflow_serving/util/net_http/server/public/httpserver.h"
 #include "tensorflow_serving/util/net_http/server/public/httpserver_interface.h"
 #include "tensorflow_serving/util/net_http/server/public/server_request_interface.h"
@@ -43,6 +56,19 @@ class MyExecutor final : public EventExecutor {
   FixedThreadPool thread_pool_;
 };
 
+class CountingObserver final : public ConnectionObserver {
+ public:
+  CountingObserver(std::atomic<int>* opened, std::atomic<int>* closed)
+      : opened_(opened), closed_(closed) {}
+
+  void OnConnectionOpened() override { ++*opened_; }
+  void OnConnectionClosed() override { ++*closed_; }
+
+ private:
+  std::atomic<int>* const opened_;
+  std::atomic<int>* const closed_;
+};
+
 class EvHTTPServerTest : public ::testing::Test {
  public:
   void SetUp() override { InitServer(); }
@@ -337,6 +363,372 @@ TEST_F(EvHTTPServerTest, ActiveRequestCountInShutdown) {
   // response.status etc are undefined as the server is terminated
 }
 
+// Test serving connections from several event loops
+TEST(EvHTTPServerMultiLoopTest, MultipleEventLoops) {
+  auto options = absl::make_unique<ServerOptions>();
+  options->AddPort(0);
+  options->SetNumEventLoops(3);
+  options->SetExecutor(absl::make_unique<MyExecutor>(3 + 4));
+  auto server = CreateEvHTTPServer(std::move(options));
+  ASSERT_TRUE(server != nullptr);
+
+  auto handler = [](ServerRequestInterface* request) {
+    request->WriteResponseString("OK");
+    request->Reply();
+  };
+  server->RegisterRequestHandler("/ok", std::move(handler),
+                                 RequestHandlerOptions());
+  ASSERT_TRUE(server->StartAcceptingRequests());
+  EXPECT_NE(server->listen_port(), 0);
+
+  // Connections are balanced across the loops by the kernel.
+  for (int i = 0; i < 20; i++) {
+    auto connection =
+        EvHTTPConnection::Connect("localhost", server->listen_port());
+    ASSERT_TRUE(connection != nullptr);
+
+    ClientRequest request = {"/ok", "GET", {}, ""};
+    ClientResponse response = {};
+    EXPECT_TRUE(connection->BlockingSendRequest(request, &response));
+    EXPECT_EQ(response.status, HTTPStatusCode::OK);
+    EXPECT_EQ(response.body, "OK");
+  }
+
+  server->Terminate();
+  server->WaitForTermination();
+}
+
+// Test running a handler on the event loop thread
+TEST(EvHTTPServerInlineTest, RunInline) {
+  // The event loop takes the only thread of the executor, so requests are
+  // only served if their handler runs inline.
+  auto options = absl::make_unique<ServerOptions>();
+  options->AddPort(0);
+  options->SetExecutor(absl::make_unique<MyExecutor>(1));
+  auto server = CreateEvHTTPServer(std::move(options));
+  ASSERT_TRUE(server != nullptr);
+
+  auto handler = [](ServerRequestInterface* request) {
+    request->WriteResponseString("OK1");
+    request->Reply();
+  };
+  server->RegisterRequestHandler("/ok", std::move(handler),
+                                 RequestHandlerOptions().set_run_inline(true));
+
+  auto dispatched_handler = [](ServerRequestInterface* request) {
+    request->WriteResponseString("OK2");
+    request->Reply();
+  };
+  auto dispatcher = [&dispatched_handler](ServerRequestInterface* request) {
+    return dispatched_handler;
+  };
+  server->RegisterRequestDispatcher(
+      std::move(dispatcher), RequestHandlerOptions().set_run_inline(true));
+  ASSERT_TRUE(server->StartAcceptingRequests());
+
+  auto connection =
+      EvHTTPConnection::Connect("localhost", server->listen_port());
+  ASSERT_TRUE(connection != nullptr);
+
+  ClientRequest request = {"/ok", "GET", {}, ""};
+  ClientResponse response = {};
+  EXPECT_TRUE(connection->BlockingSendRequest(request, &response));
+  EXPECT_EQ(response.status, HTTPStatusCode::OK);
+  EXPECT_EQ(response.body, "OK1");
+
+  request = {"/other", "GET", {}, ""};
+  response = {};
+  EXPECT_TRUE(connection->BlockingSendRequest(request, &response));
+  EXPECT_EQ(response.status, HTTPStatusCode::OK);
+  EXPECT_EQ(response.body, "OK2");
+
+  server->Terminate();
+  server->WaitForTermination();
+}
+
+// Sends `raw_request` on a new connection to `addr`, and returns all the data
+// received until the server closes the connection.
+std::string SendRawRequestToAddress(const sockaddr* addr, socklen_t addr_len,
+                                    const std::string& raw_request) {
+  int fd = socket(addr->sa_family, SOCK_STREAM, 0);
+  EXPECT_GE(fd, 0);
+  timeval timeout = {5, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  EXPECT_EQ(connect(fd, addr, addr_len), 0);
+  EXPECT_EQ(write(fd, raw_request.data(), raw_request.size()),
+            raw_request.size());
+
+  std::string received;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    received.append(buf, n);
+  }
+  close(fd);
+  return received;
+}
+
+// Sends `raw_request` on a new connection to localhost:port.
+std::string SendRawRequest(int port, const std::string& raw_request) {
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  return SendRawRequestToAddress(reinterpret_cast<sockaddr*>(&addr),
+                                 sizeof(addr), raw_request);
+}
+
+// Sends `raw_request` on a new connection to the Unix socket at `path`.
+std::string SendRawRequestToUnixSocket(const std::string& path,
+                                       const std::string& raw_request) {
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+  return SendRawRequestToAddress(reinterpret_cast<sockaddr*>(&addr),
+                                 sizeof(addr), raw_request);
+}
+
+int CountOccurrences(const std::string& str, const std::string& pattern) {
+  int count = 0;
+  for (size_t pos = str.find(pattern); pos != std::string::npos;
+       pos = str.find(pattern, pos + 1)) {
+    count++;
+  }
+  return count;
+}
+
+// Test that the last request allowed on a connection closes it
+TEST(EvHTTPServerLimitsTest, MaxRequestsPerConnection) {
+  auto options = absl::make_unique<ServerOptions>();
+  options->AddPort(0);
+  options->SetMaxRequestsPerConnection(2);
+  options->SetExecutor(absl::make_unique<MyExecutor>(4));
+  auto server = CreateEvHTTPServer(std::move(options));
+  ASSERT_TRUE(server != nullptr);
+
+  auto handler = [](ServerRequestInterface* request) {
+    request->WriteResponseString("OK");
+    request->Reply();
+  };
+  server->RegisterRequestHandler("/ok", std::move(handler),
+                                 RequestHandlerOptions());
+  ASSERT_TRUE(server->StartAcceptingRequests());
+
+  // Three pipelined keep-alive requests, of which only two are served.
+  const std::string kRequest = "GET /ok HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  const std::string received =
+      SendRawRequest(server->listen_port(), kRequest + kRequest + kRequest);
+  EXPECT_EQ(CountOccurrences(received, "HTTP/1.1 200"), 2);
+  EXPECT_EQ(CountOccurrences(received, "Connection: close"), 1);
+
+  server->Terminate();
+  server->WaitForTermination();
+}
+
+// Test that connections beyond the limit wait for open ones to be closed
+TEST(EvHTTPServerLimitsTest, MaxConnections) {
+  std::atomic<int> opened(0);
+  std::atomic<int> closed(0);
+
+  auto options = absl::make_unique<ServerOptions>();
+  options->AddPort(0);
+  options->SetMaxConnections(1);
+  options->SetConnectionObserver(
+      absl::make_unique<CountingObserver>(&opened, &closed));
+  options->SetExecutor(absl::make_unique<MyExecutor>(4));
+  auto server = CreateEvHTTPServer(std::move(options));
+  ASSERT_TRUE(server != nullptr);
+
+  // Holds the first connection open until handler_start is notified.
+  absl::Notification handler_enter;
+  absl::Notification handler_start;
+  auto handler = [&handler_enter,
+                  &handler_start](ServerRequestInterface* request) {
+    if (!handler_enter.HasBeenNotified()) {
+      handler_enter.Notify();
+      handler_start.WaitForNotification();
+    }
+    request->WriteResponseString("OK");
+    request->Reply();
+  };
+  server->RegisterRequestHandler("/ok", std::move(handler),
+                                 RequestHandlerOptions());
+  ASSERT_TRUE(server->StartAcceptingRequests());
+
+  ClientRequest request = {"/ok", "GET", {}, ""};
+
+  auto connection1 =
+      EvHTTPConnection::Connect("localhost", server->listen_port());
+  ASSERT_TRUE(connection1 != nullptr);
+  connection1->SetExecutor(absl::make_unique<MyExecutor>(4));
+  absl::Notification response1_done;
+  ClientResponse response1 = {};
+  response1.done = [&response1_done]() { response1_done.Notify(); };
+  EXPECT_TRUE(connection1->SendRequest(request, &response1));
+  handler_enter.WaitForNotification();
+  EXPECT_EQ(opened, 1);
+
+  auto connection2 =
+      EvHTTPConnection::Connect("localhost", server->listen_port());
+  ASSERT_TRUE(connection2 != nullptr);
+  connection2->SetExecutor(absl::make_unique<MyExecutor>(4));
+  absl::Notification response2_done;
+  ClientResponse response2 = {};
+  response2.done = [&response2_done]() { response2_done.Notify(); };
+  EXPECT_TRUE(connection2->SendRequest(request, &response2));
+  EXPECT_FALSE(
+      response2_done.WaitForNotificationWithTimeout(absl::Milliseconds(100)));
+  EXPECT_EQ(opened, 1);
+
+  // Closing the first connection lets the second one in.
+  handler_start.Notify();
+  response1_done.WaitForNotification();
+  EXPECT_EQ(response1.status, HTTPStatusCode::OK);
+  EXPECT_TRUE(response2_done.WaitForNotificationWithTimeout(absl::Seconds(5)));
+  EXPECT_EQ(response2.status, HTTPStatusCode::OK);
+  EXPECT_EQ(response2.body, "OK");
+  EXPECT_EQ(opened, 2);
+  EXPECT_GE(closed, 1);
+
+  connection1->Terminate();
+  connection2->Terminate();
+
+  server->Terminate();
+  server->WaitForTermination();
+}
+
+// Test serving the requests of a Unix socket, with or without a port
+TEST(EvHTTPServerUnixSocketTest, UnixSocket) {
+  // Not in the test directory, whose path may not fit in a sockaddr_un.
+  const std::string path =
+      absl::StrCat("/tmp/evhttp_server_test_", getpid(), ".sock");
+  const std::string kRequest =
+      "GET /ok HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+  for (const bool add_port : {false, true}) {
+    auto options = absl::make_unique<ServerOptions>();
+    if (add_port) {
+      options->AddPort(0);
+    }
+    options->SetUnixSocketPath(path);
+    options->SetExecutor(absl::make_unique<MyExecutor>(4));
+    auto server = CreateEvHTTPServer(std::move(options));
+    ASSERT_TRUE(server != nullptr);
+
+    auto handler = [](ServerRequestInterface* request) {
+      request->WriteResponseString("OK");
+      request->Reply();
+    };
+    server->RegisterRequestHandler("/ok", std::move(handler),
+                                   RequestHandlerOptions());
+    ASSERT_TRUE(server->StartAcceptingRequests());
+
+    const std::string received = SendRawRequestToUnixSocket(path, kRequest);
+    EXPECT_EQ(CountOccurrences(received, "HTTP/1.1 200"), 1);
+    EXPECT_TRUE(absl::EndsWith(received, "\r\n\r\nOK"));
+    if (add_port) {
+      EXPECT_EQ(CountOccurrences(
+                    SendRawRequest(server->listen_port(), kRequest), "200"),
+                1);
+    }
+
+    server->Terminate();
+    server->WaitForTermination();
+  }
+  // The socket is removed once the server is terminated.
+  EXPECT_NE(access(path.c_str(), F_OK), 0);
+}
+
+std::string Http2Frame(uint8_t type, uint8_t flags, uint32_t stream_id,
+                       absl::string_view payload) {
+  const uint32_t length = payload.size();
+  std::string frame = {static_cast<char>(length >> 16),
+                       static_cast<char>(length >> 8),
+                       static_cast<char>(length),
+                       static_cast<char>(type),
+                       static_cast<char>(flags),
+                       static_cast<char>(stream_id >> 24),
+                       static_cast<char>(stream_id >> 16),
+                       static_cast<char>(stream_id >> 8),
+                       static_cast<char>(stream_id)};
+  frame.append(payload.data(), payload.size());
+  return frame;
+}
+
+// Test serving the requests of an HTTP/2 connection with prior knowledge
+TEST(EvHTTPServerHttp2Test, Http2Requests) {
+  auto options = absl::make_unique<ServerOptions>();
+  options->SetHttp2Port(0);
+  // So that the connection is closed once both requests are replied to.
+  options->SetMaxRequestsPerConnection(2);
+  options->SetExecutor(absl::make_unique<MyExecutor>(4));
+  auto server = CreateEvHTTPServer(std::move(options));
+  ASSERT_TRUE(server != nullptr);
+
+  auto handler = [](ServerRequestInterface* request) {
+    absl::string_view body;
+    ASSERT_TRUE(request->GetRequestBody(&body));
+    request->WriteResponseString(
+        absl::StrCat(request->http_method(), " ", request->uri_path(), " ",
+                     request->GetRequestHeader("Host"), " ", body));
+    request->Reply();
+  };
+  server->RegisterRequestHandler("/ok", std::move(handler),
+                                 RequestHandlerOptions());
+  ASSERT_TRUE(server->StartAcceptingRequests());
+  EXPECT_EQ(server->listen_port(), 0);
+  ASSERT_GT(server->http2_listen_port(), 0);
+
+  std::string get_block;
+  HpackEncodeHeader(":method", "GET", &get_block);
+  HpackEncodeHeader(":scheme", "http", &get_block);
+  HpackEncodeHeader(":authority", "localhost", &get_block);
+  HpackEncodeHeader(":path", "/ok?a=b", &get_block);
+  std::string post_block;
+  HpackEncodeHeader(":method", "POST", &post_block);
+  HpackEncodeHeader(":scheme", "http", &post_block);
+  HpackEncodeHeader(":path", "/ok", &post_block);
+  const std::string raw_request =
+      absl::StrCat("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n",
+                   Http2Frame(0x4, 0, 0, ""),
+                   Http2Frame(0x1, 0x4, 1, post_block),
+                   Http2Frame(0x1, 0x5, 3, get_block),
+                   Http2Frame(0x0, 0x1, 1, "abc"));
+
+  const std::string received =
+      SendRawRequest(server->http2_listen_port(), raw_request);
+  HpackDecoder decoder;
+  int num_statuses = 0;
+  std::vector<std::string> bodies;
+  for (absl::string_view frames = received; frames.size() >= 9;) {
+    const size_t length = (static_cast<uint8_t>(frames[0]) << 16) |
+                          (static_cast<uint8_t>(frames[1]) << 8) |
+                          static_cast<uint8_t>(frames[2]);
+    ASSERT_GE(frames.size(), 9 + length);
+    const absl::string_view payload = frames.substr(9, length);
+    if (frames[3] == 0x1) {
+      HpackHeaders headers;
+      ASSERT_TRUE(decoder.Decode(payload, 1 << 20, &headers));
+      ASSERT_FALSE(headers.empty());
+      EXPECT_EQ(headers[0], std::make_pair(std::string(":status"),
+                                           std::string("200")));
+      num_statuses++;
+    } else if (frames[3] == 0x0) {
+      bodies.emplace_back(payload);
+    }
+    frames.remove_prefix(9 + length);
+  }
+  EXPECT_EQ(num_statuses, 2);
+  ASSERT_EQ(bodies.size(), 2);
+  // Either one may be replied to first.
+  std::sort(bodies.begin(), bodies.end());
+  EXPECT_EQ(bodies[0], "GET /ok?a=b localhost ");
+  EXPECT_EQ(bodies[1], "POST /ok  abc");
+
+  server->Terminate();
+  server->WaitForTermination();
+}
+
 }  // namespace
 }  // namespace net_http
 }  // namespace serving
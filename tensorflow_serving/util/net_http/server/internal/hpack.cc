@@ -0,0 +1,467 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/net_http/server/internal/hpack.h"
+
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+
+namespace tensorflow {
+namespace serving {
+namespace net_http {
+
+namespace {
+
+// The static table (RFC 7541 appendix A), whose indices start at 1.
+constexpr int kStaticTableSize = 61;
+const char* const kStaticTable[kStaticTableSize][2] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+// The Huffman code (RFC 7541 appendix B) of each octet: the code, in its
+// low bits, and its number of bits. The end-of-string code is all ones.
+struct HuffmanCode {
+  uint32_t code;
+  int num_bits;
+};
+const HuffmanCode kHuffmanCodes[256] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12}, {0x1ff9, 13}, {0x15, 6},
+    {0xf8, 8}, {0x7fa, 11}, {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6}, {0x0, 5}, {0x1, 5}, {0x2, 5},
+    {0x19, 6}, {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6}, {0x1e, 6}, {0x1f, 6},
+    {0x5c, 7}, {0xfb, 8}, {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7}, {0x5f, 7}, {0x60, 7},
+    {0x61, 7}, {0x62, 7}, {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7}, {0x67, 7},
+    {0x68, 7}, {0x69, 7}, {0x6a, 7}, {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7}, {0xfc, 8}, {0x73, 7}, {0xfd, 8},
+    {0x1ffb, 13}, {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5}, {0x24, 6}, {0x5, 5}, {0x25, 6},
+    {0x26, 6}, {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7}, {0x28, 6}, {0x29, 6},
+    {0x2a, 6}, {0x7, 5}, {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5}, {0x9, 5},
+    {0x2d, 6}, {0x77, 7}, {0x78, 7}, {0x79, 7}, {0x7a, 7}, {0x7b, 7},
+    {0x7ffe, 15}, {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20}, {0x3fffd3, 22},
+    {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23}, {0x3fffd6, 22},
+    {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23}, {0x7fffdd, 23},
+    {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23}, {0xffffec, 24},
+    {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23}, {0xffffee, 24},
+    {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23}, {0x7fffe4, 23},
+    {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23}, {0x3fffd9, 22},
+    {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24}, {0x3fffda, 22},
+    {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22}, {0x3fffdc, 22},
+    {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21}, {0x7fffea, 23},
+    {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24}, {0x1fffdf, 21},
+    {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23}, {0x1fffe0, 21},
+    {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21}, {0x7fffed, 23},
+    {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23}, {0xfffea, 20},
+    {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22}, {0x7ffff0, 23},
+    {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23}, {0x3ffffe0, 26},
+    {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19}, {0x3fffe7, 22},
+    {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25}, {0x3ffffe2, 26},
+    {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27}, {0x7ffffdf, 27},
+    {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25}, {0x7fff2, 19},
+    {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27}, {0x7ffffe1, 27},
+    {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24}, {0x1fffe4, 21},
+    {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26}, {0xffffffd, 28},
+    {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27}, {0xfffec, 20},
+    {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21}, {0x3fffe9, 22},
+    {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23}, {0x3fffea, 22},
+    {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25}, {0xfffff4, 24},
+    {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23}, {0x3ffffeb, 26},
+    {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26}, {0x7ffffe7, 27},
+    {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27}, {0x7ffffeb, 27},
+    {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27}, {0x7ffffee, 27},
+    {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+};
+
+// The size of an entry of the dynamic table (RFC 7541 section 4.1).
+size_t EntrySize(absl::string_view name, absl::string_view value) {
+  return name.size() + value.size() + 32;
+}
+
+// The binary tree of the Huffman code, whose leaves are the octets.
+class HuffmanTree {
+ public:
+  static const HuffmanTree& Get() {
+    static const HuffmanTree* const tree = new HuffmanTree();
+    return *tree;
+  }
+
+  // The child of `node` along `bit`, or 0 if none.
+  int Child(int node, int bit) const { return nodes_[node].children[bit]; }
+
+  // The octet of a leaf, or -1 for an inner node.
+  int Symbol(int node) const { return nodes_[node].symbol; }
+
+ private:
+  struct Node {
+    int children[2] = {0, 0};
+    int symbol = -1;
+  };
+
+  HuffmanTree() : nodes_(1) {
+    for (int symbol = 0; symbol < 256; ++symbol) {
+      const HuffmanCode& code = kHuffmanCodes[symbol];
+      int node = 0;
+      for (int bit_idx = code.num_bits - 1; bit_idx >= 0; --bit_idx) {
+        const int bit = (code.code >> bit_idx) & 1;
+        if (nodes_[node].children[bit] == 0) {
+          nodes_[node].children[bit] = nodes_.size();
+          nodes_.emplace_back();
+        }
+        node = nodes_[node].children[bit];
+      }
+      nodes_[node].symbol = symbol;
+    }
+  }
+
+  std::vector<Node> nodes_;
+};
+
+// Decodes an integer with an N-bit prefix (RFC 7541 section 5.1) from the
+// front of `input`, whose first octet holds the prefix.
+bool DecodeInteger(const int prefix_bits, absl::string_view* input,
+                   uint64_t* value) {
+  if (input->empty()) {
+    return false;
+  }
+  const uint64_t mask = (1 << prefix_bits) - 1;
+  *value = static_cast<uint8_t>((*input)[0]) & mask;
+  input->remove_prefix(1);
+  if (*value < mask) {
+    return true;
+  }
+  // Values above 2^32 are rejected, as no length or index gets that large.
+  for (int shift = 0; shift <= 28; shift += 7) {
+    if (input->empty()) {
+      return false;
+    }
+    const uint8_t octet = (*input)[0];
+    input->remove_prefix(1);
+    *value += static_cast<uint64_t>(octet & 0x7f) << shift;
+    if ((octet & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Decodes a string literal (RFC 7541 section 5.2) from the front of `input`.
+// `value` points into `input`, unless the literal is Huffman-coded, in which
+// case it is decoded into `buffer`.
+bool DecodeString(absl::string_view* input, std::string* buffer,
+                  absl::string_view* value) {
+  if (input->empty()) {
+    return false;
+  }
+  const bool huffman_coded = ((*input)[0] & 0x80) != 0;
+  uint64_t length;
+  if (!DecodeInteger(7, input, &length) || length > input->size()) {
+    return false;
+  }
+  const absl::string_view literal = input->substr(0, length);
+  input->remove_prefix(length);
+  if (!huffman_coded) {
+    *value = literal;
+    return true;
+  }
+  buffer->clear();
+  if (!HpackHuffmanDecode(literal, buffer)) {
+    return false;
+  }
+  *value = *buffer;
+  return true;
+}
+
+void EncodeInteger(const int prefix_bits, const uint8_t first_octet,
+                   uint64_t value, std::string* output) {
+  const uint64_t mask = (1 << prefix_bits) - 1;
+  if (value < mask) {
+    output->push_back(static_cast<char>(first_octet | value));
+    return;
+  }
+  output->push_back(static_cast<char>(first_octet | mask));
+  value -= mask;
+  while (value >= 0x80) {
+    output->push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  output->push_back(static_cast<char>(value));
+}
+
+void EncodeString(absl::string_view value, std::string* output) {
+  EncodeInteger(7, 0, value.size(), output);
+  output->append(value.data(), value.size());
+}
+
+}  // namespace
+
+HpackDecoder::HpackDecoder(const size_t max_table_size)
+    : max_table_size_(max_table_size), table_size_limit_(max_table_size) {}
+
+bool HpackDecoder::Decode(absl::string_view block,
+                          const size_t max_header_list_size,
+                          HpackHeaders* headers) {
+  size_t header_list_size = 0;
+  bool fields_started = false;
+  std::string name_buffer;
+  std::string value_buffer;
+  while (!block.empty()) {
+    const uint8_t octet = block[0];
+    absl::string_view name;
+    absl::string_view value;
+    bool indexed = false;
+    if ((octet & 0x80) != 0) {
+      // Indexed header field.
+      uint64_t index;
+      if (!DecodeInteger(7, &block, &index) || !Lookup(index, &name, &value)) {
+        return false;
+      }
+    } else if ((octet & 0xe0) == 0x20) {
+      // Dynamic table size update, only allowed before the fields.
+      uint64_t size;
+      if (fields_started || !DecodeInteger(5, &block, &size) ||
+          size > max_table_size_) {
+        return false;
+      }
+      table_size_limit_ = size;
+      Evict(size);
+      continue;
+    } else {
+      // Literal header field, with incremental indexing (01), without
+      // indexing (0000) or never indexed (0001).
+      indexed = (octet & 0xc0) == 0x40;
+      uint64_t name_index;
+      if (!DecodeInteger(indexed ? 6 : 4, &block, &name_index)) {
+        return false;
+      }
+      if (name_index == 0) {
+        if (!DecodeString(&block, &name_buffer, &name)) {
+          return false;
+        }
+      } else if (!Lookup(name_index, &name, &value)) {
+        return false;
+      }
+      if (!DecodeString(&block, &value_buffer, &value)) {
+        return false;
+      }
+    }
+    fields_started = true;
+    header_list_size += EntrySize(name, value);
+    if (header_list_size > max_header_list_size) {
+      return false;
+    }
+    headers->emplace_back(std::string(name), std::string(value));
+    if (indexed) {
+      Insert(name, value);
+    }
+  }
+  return true;
+}
+
+bool HpackDecoder::Lookup(uint64_t index, absl::string_view* name,
+                          absl::string_view* value) const {
+  if (index == 0) {
+    return false;
+  }
+  if (index <= kStaticTableSize) {
+    *name = kStaticTable[index - 1][0];
+    *value = kStaticTable[index - 1][1];
+    return true;
+  }
+  index -= kStaticTableSize + 1;
+  if (index >= table_.size()) {
+    return false;
+  }
+  *name = table_[index].first;
+  *value = table_[index].second;
+  return true;
+}
+
+void HpackDecoder::Insert(absl::string_view name, absl::string_view value) {
+  // Copied first, as `name` may point to an entry that is evicted.
+  std::pair<std::string, std::string> entry{std::string(name),
+                                            std::string(value)};
+  const size_t size = EntrySize(name, value);
+  if (size > table_size_limit_) {
+    // An entry larger than the table empties it.
+    Evict(0);
+    return;
+  }
+  Evict(table_size_limit_ - size);
+  table_size_ += size;
+  table_.push_front(std::move(entry));
+}
+
+void HpackDecoder::Evict(const size_t limit) {
+  while (table_size_ > limit) {
+    table_size_ -= EntrySize(table_.back().first, table_.back().second);
+    table_.pop_back();
+  }
+}
+
+void HpackEncodeHeader(absl::string_view name, absl::string_view value,
+                       std::string* block) {
+  int name_index = 0;
+  for (int i = 0; i < kStaticTableSize; ++i) {
+    if (name == kStaticTable[i][0]) {
+      name_index = i + 1;
+      break;
+    }
+  }
+  // Literal header field without indexing.
+  EncodeInteger(4, 0, name_index, block);
+  if (name_index == 0) {
+    EncodeString(name, block);
+  }
+  EncodeString(value, block);
+}
+
+void HpackEncodeStatus(const int status, std::string* block) {
+  int index = 0;
+  switch (status) {
+    case 200:
+      index = 8;
+      break;
+    case 204:
+      index = 9;
+      break;
+    case 206:
+      index = 10;
+      break;
+    case 304:
+      index = 11;
+      break;
+    case 400:
+      index = 12;
+      break;
+    case 404:
+      index = 13;
+      break;
+    case 500:
+      index = 14;
+      break;
+  }
+  if (index != 0) {
+    // Indexed header field.
+    EncodeInteger(7, 0x80, index, block);
+    return;
+  }
+  // Literal header field without indexing, with the name of ":status 200".
+  EncodeInteger(4, 0, 8, block);
+  EncodeString(absl::StrCat(status), block);
+}
+
+bool HpackHuffmanDecode(absl::string_view input, std::string* output) {
+  const HuffmanTree& tree = HuffmanTree::Get();
+  int node = 0;
+  // The bits read since the last octet, and whether they are all ones.
+  int num_pending_bits = 0;
+  bool pending_ones = true;
+  for (const char c : input) {
+    for (int bit_idx = 7; bit_idx >= 0; --bit_idx) {
+      const int bit = (static_cast<uint8_t>(c) >> bit_idx) & 1;
+      node = tree.Child(node, bit);
+      if (node == 0) {
+        // Only the end-of-string code leads nowhere.
+        return false;
+      }
+      ++num_pending_bits;
+      pending_ones = pending_ones && bit == 1;
+      const int symbol = tree.Symbol(node);
+      if (symbol >= 0) {
+        output->push_back(static_cast<char>(symbol));
+        node = 0;
+        num_pending_bits = 0;
+        pending_ones = true;
+      }
+    }
+  }
+  // The padding is a prefix of the end-of-string code, shorter than an octet.
+  return num_pending_bits < 8 && pending_ones;
+}
+
+}  // namespace net_http
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,99 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// HPACK (RFC 7541), the header compression of HTTP/2.
+
+#ifndef TENSORFLOW_SERVING_UTIL_NET_HTTP_SERVER_INTERNAL_HPACK_H_
+#define TENSORFLOW_SERVING_UTIL_NET_HTTP_SERVER_INTERNAL_HPACK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+namespace tensorflow {
+namespace serving {
+namespace net_http {
+
+// Header fields, in the order of the header block.
+using HpackHeaders = std::vector<std::pair<std::string, std::string>>;
+
+// Decodes the header blocks received on a connection, whose dynamic table
+// spans the blocks. Thread-compatible.
+class HpackDecoder {
+ public:
+  // The default SETTINGS_HEADER_TABLE_SIZE.
+  static constexpr size_t kDefaultTableSize = 4096;
+
+  // `max_table_size` is the SETTINGS_HEADER_TABLE_SIZE sent to the peer.
+  explicit HpackDecoder(size_t max_table_size = kDefaultTableSize);
+
+  HpackDecoder(const HpackDecoder& other) = delete;
+  HpackDecoder& operator=(const HpackDecoder& other) = delete;
+
+  // Appends the fields of the complete header block `block` to `headers`.
+  // Returns false on a compression error, after which the dynamic table is
+  // out of sync with the peer and the connection must be closed, or if the
+  // fields exceed `max_header_list_size` (as in SETTINGS_MAX_HEADER_LIST_SIZE).
+  bool Decode(absl::string_view block, size_t max_header_list_size,
+              HpackHeaders* headers);
+
+  // The size of the dynamic table, as defined by RFC 7541 section 4.1.
+  size_t table_size() const { return table_size_; }
+
+ private:
+  // Sets `name` and `value` to the entry of the static or dynamic table at
+  // `index`. Returns false if there is none.
+  bool Lookup(uint64_t index, absl::string_view* name,
+              absl::string_view* value) const;
+
+  // Adds an entry to the dynamic table, evicting the oldest ones to make
+  // room.
+  void Insert(absl::string_view name, absl::string_view value);
+
+  // Evicts the oldest entries until the table fits in `limit`.
+  void Evict(size_t limit);
+
+  const size_t max_table_size_;
+  // The current limit, set by the dynamic table size updates of the peer.
+  size_t table_size_limit_;
+  size_t table_size_ = 0;
+  // Newest first.
+  std::deque<std::pair<std::string, std::string>> table_;
+};
+
+// Appends a header field to the header block `block`, as a literal that is
+// neither indexed nor Huffman-coded, so that the encoder keeps no state.
+// `name` must be lowercase.
+void HpackEncodeHeader(absl::string_view name, absl::string_view value,
+                       std::string* block);
+
+// Same for the ":status" pseudo-header, which is indexed for the statuses of
+// the static table.
+void HpackEncodeStatus(int status, std::string* block);
+
+// Decodes a Huffman-coded string literal, appending it to `output`. Returns
+// false if the code or its padding is invalid.
+bool HpackHuffmanDecode(absl::string_view input, std::string* output);
+
+}  // namespace net_http
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_UTIL_NET_HTTP_SERVER_INTERNAL_HPACK_H_
@@ -0,0 +1,191 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/net_http/server/internal/hpack.h"
+
+#include <string>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "absl/strings/escaping.h"
+
+namespace tensorflow {
+namespace serving {
+namespace net_http {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Pair;
+
+constexpr size_t kMaxHeaderListSize = 16 << 10;
+
+HpackHeaders Decode(HpackDecoder* decoder, const std::string& hex_block) {
+  HpackHeaders headers;
+  EXPECT_TRUE(decoder->Decode(absl::HexStringToBytes(hex_block),
+                              kMaxHeaderListSize, &headers));
+  return headers;
+}
+
+// The examples of RFC 7541 appendix C.3.
+TEST(HpackDecoderTest, RequestsWithoutHuffmanCoding) {
+  HpackDecoder decoder;
+  EXPECT_THAT(Decode(&decoder, "828684410f7777772e6578616d706c652e636f6d"),
+              ElementsAre(Pair(":method", "GET"), Pair(":scheme", "http"),
+                          Pair(":path", "/"),
+                          Pair(":authority", "www.example.com")));
+  EXPECT_EQ(decoder.table_size(), 57);
+
+  EXPECT_THAT(Decode(&decoder, "828684be58086e6f2d6361636865"),
+              ElementsAre(Pair(":method", "GET"), Pair(":scheme", "http"),
+                          Pair(":path", "/"),
+                          Pair(":authority", "www.example.com"),
+                          Pair("cache-control", "no-cache")));
+  EXPECT_EQ(decoder.table_size(), 110);
+
+  EXPECT_THAT(
+      Decode(&decoder,
+             "828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565"),
+      ElementsAre(Pair(":method", "GET"), Pair(":scheme", "https"),
+                  Pair(":path", "/index.html"),
+                  Pair(":authority", "www.example.com"),
+                  Pair("custom-key", "custom-value")));
+  EXPECT_EQ(decoder.table_size(), 164);
+}
+
+// The examples of RFC 7541 appendix C.4.
+TEST(HpackDecoderTest, RequestsWithHuffmanCoding) {
+  HpackDecoder decoder;
+  EXPECT_THAT(Decode(&decoder, "828684418cf1e3c2e5f23a6ba0ab90f4ff"),
+              ElementsAre(Pair(":method", "GET"), Pair(":scheme", "http"),
+                          Pair(":path", "/"),
+                          Pair(":authority", "www.example.com")));
+  EXPECT_THAT(Decode(&decoder, "828684be5886a8eb10649cbf"),
+              ElementsAre(Pair(":method", "GET"), Pair(":scheme", "http"),
+                          Pair(":path", "/"),
+                          Pair(":authority", "www.example.com"),
+                          Pair("cache-control", "no-cache")));
+  EXPECT_THAT(Decode(&decoder,
+                     "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf"),
+              ElementsAre(Pair(":method", "GET"), Pair(":scheme", "https"),
+                          Pair(":path", "/index.html"),
+                          Pair(":authority", "www.example.com"),
+                          Pair("custom-key", "custom-value")));
+  EXPECT_EQ(decoder.table_size(), 164);
+}
+
+TEST(HpackDecoderTest, EvictsTheOldestEntries) {
+  // Room for one "custom-key: custom-value" entry (54 bytes) only.
+  HpackDecoder decoder(100);
+  const std::string kLiteral =
+      "400a637573746f6d2d6b65790c637573746f6d2d76616c7565";
+  Decode(&decoder, kLiteral);
+  EXPECT_EQ(decoder.table_size(), 54);
+  Decode(&decoder, kLiteral);
+  EXPECT_EQ(decoder.table_size(), 54);
+  EXPECT_THAT(Decode(&decoder, "be"),
+              ElementsAre(Pair("custom-key", "custom-value")));
+
+  HpackHeaders headers;
+  EXPECT_FALSE(
+      decoder.Decode(absl::HexStringToBytes("bf"), kMaxHeaderListSize,
+                     &headers));
+}
+
+TEST(HpackDecoderTest, DynamicTableSizeUpdate) {
+  HpackDecoder decoder;
+  Decode(&decoder, "400a637573746f6d2d6b65790c637573746f6d2d76616c7565");
+  EXPECT_EQ(decoder.table_size(), 54);
+  // Updated to 0, which empties the table.
+  EXPECT_THAT(Decode(&decoder, "2082"), ElementsAre(Pair(":method", "GET")));
+  EXPECT_EQ(decoder.table_size(), 0);
+
+  HpackHeaders headers;
+  // Above the max size.
+  EXPECT_FALSE(decoder.Decode(absl::HexStringToBytes("3fe21f"),
+                              kMaxHeaderListSize, &headers));
+  // After a field.
+  EXPECT_FALSE(decoder.Decode(absl::HexStringToBytes("8220"),
+                              kMaxHeaderListSize, &headers));
+}
+
+TEST(HpackDecoderTest, InvalidBlocks) {
+  for (const char* hex_block : {
+           "80",              // Index 0.
+           "c0",              // Beyond the tables.
+           "410f7777",        // Truncated literal.
+           "0f",              // Truncated index.
+           "ffffffffffff01",  // Oversized integer.
+       }) {
+    HpackDecoder decoder;
+    HpackHeaders headers;
+    EXPECT_FALSE(decoder.Decode(absl::HexStringToBytes(hex_block),
+                                kMaxHeaderListSize, &headers))
+        << hex_block;
+  }
+}
+
+TEST(HpackDecoderTest, MaxHeaderListSize) {
+  HpackDecoder decoder;
+  HpackHeaders headers;
+  // ":method: GET" is 42 bytes.
+  EXPECT_TRUE(decoder.Decode(absl::HexStringToBytes("82"), 42, &headers));
+  EXPECT_FALSE(decoder.Decode(absl::HexStringToBytes("8282"), 42, &headers));
+}
+
+TEST(HpackHuffmanTest, Decode) {
+  std::string output;
+  EXPECT_TRUE(HpackHuffmanDecode(
+      absl::HexStringToBytes("f1e3c2e5f23a6ba0ab90f4ff"), &output));
+  EXPECT_EQ(output, "www.example.com");
+
+  output.clear();
+  EXPECT_TRUE(HpackHuffmanDecode("", &output));
+  EXPECT_EQ(output, "");
+
+  // The padding is longer than 7 bits.
+  EXPECT_FALSE(HpackHuffmanDecode(
+      absl::HexStringToBytes("f1e3c2e5f23a6ba0ab90f4ffff"), &output));
+  // The padding is not ones.
+  EXPECT_FALSE(HpackHuffmanDecode(absl::HexStringToBytes("a8"), &output));
+  // The end-of-string code.
+  EXPECT_FALSE(
+      HpackHuffmanDecode(absl::HexStringToBytes("ffffffff"), &output));
+}
+
+TEST(HpackEncoderTest, RoundTrip) {
+  std::string block;
+  HpackEncodeStatus(200, &block);
+  HpackEncodeStatus(503, &block);
+  HpackEncodeHeader("content-type", "application/json", &block);
+  HpackEncodeHeader("x-custom", std::string(200, 'a'), &block);
+  // Indexed, then with the indexed names of ":status" and "content-type".
+  EXPECT_EQ(block.substr(0, 6), absl::HexStringToBytes("880803353033"));
+  EXPECT_EQ(block.substr(6, 2), absl::HexStringToBytes("0f10"));
+
+  HpackDecoder decoder;
+  HpackHeaders headers;
+  ASSERT_TRUE(decoder.Decode(block, kMaxHeaderListSize, &headers));
+  EXPECT_THAT(headers, ElementsAre(Pair(":status", "200"),
+                                   Pair(":status", "503"),
+                                   Pair("content-type", "application/json"),
+                                   Pair("x-custom", std::string(200, 'a'))));
+  // Nothing is indexed.
+  EXPECT_EQ(decoder.table_size(), 0);
+}
+
+}  // namespace
+}  // namespace net_http
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,216 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// libevent based HTTP/2 connection implementation
+
+#include "tensorflow_serving/util/net_http/server/internal/http2_connection.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <string>
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "libevent/include/event2/buffer.h"
+#include "libevent/include/event2/bufferevent.h"
+#include "libevent/include/event2/event.h"
+#include "tensorflow_serving/util/net_http/internal/net_logging.h"
+
+namespace tensorflow {
+namespace serving {
+namespace net_http {
+
+namespace {
+
+// The timeout of evhttp connections, when none is set by the server options.
+constexpr absl::Duration kDefaultTimeout = absl::Seconds(50);
+
+}  // namespace
+
+Http2Connection::Http2Connection(event_base* ev_base, evutil_socket_t fd,
+                                 const Http2Session::Options& options,
+                                 absl::Duration timeout, ServerSupport* server,
+                                 Dispatcher dispatcher,
+                                 ClosedCallback closed_callback)
+    : ev_base_(ev_base),
+      fd_(fd),
+      timeout_(timeout == absl::InfiniteDuration() ? kDefaultTimeout
+                                                   : timeout),
+      server_(server),
+      dispatcher_(std::move(dispatcher)),
+      closed_callback_(std::move(closed_callback)),
+      session_(options, this) {}
+
+Http2Connection::~Http2Connection() {
+  if (bev_ != nullptr) {
+    bufferevent_free(bev_);
+  }
+}
+
+bool Http2Connection::Start() {
+  // The frames of a response are written as soon as they are submitted.
+  int nodelay = 1;
+  setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+  bev_ = bufferevent_socket_new(ev_base_, fd_, BEV_OPT_CLOSE_ON_FREE);
+  if (bev_ == nullptr) {
+    NET_LOG(ERROR, "Failed to create a bufferevent.");
+    evutil_closesocket(fd_);
+    closed_ = true;
+    return false;
+  }
+  bufferevent_setcb(bev_, &ReadCallback, &WriteCallback, &EventCallback, this);
+  const timeval timeout = absl::ToTimeval(timeout_);
+  bufferevent_set_timeouts(bev_, &timeout, &timeout);
+  if (bufferevent_enable(bev_, EV_READ | EV_WRITE) != 0) {
+    NET_LOG(ERROR, "Failed to enable a bufferevent.");
+    bufferevent_free(bev_);
+    bev_ = nullptr;
+    closed_ = true;
+    return false;
+  }
+
+  Flush();
+  return true;
+}
+
+void Http2Connection::Close() {
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+  bufferevent_free(bev_);
+  bev_ = nullptr;
+  for (const auto& request : requests_) {
+    request.second->SetStreamClosed();
+  }
+
+  // Called from the next iteration of the loop, so that the callback may
+  // release the connection.
+  std::shared_ptr<Http2Connection> self = shared_from_this();
+  server_->EventLoopSchedule([self]() { self->closed_callback_(self.get()); });
+}
+
+// static function pointer
+void Http2Connection::ReadCallback(bufferevent* bev, void* connection) {
+  Http2Connection* self = static_cast<Http2Connection*>(connection);
+  evbuffer* input = bufferevent_get_input(bev);
+  size_t length;
+  while ((length = evbuffer_get_contiguous_space(input)) > 0) {
+    const char* data =
+        reinterpret_cast<const char*>(evbuffer_pullup(input, length));
+    const bool received =
+        self->session_.Receive(absl::string_view(data, length));
+    evbuffer_drain(input, length);
+    if (!received) {
+      break;
+    }
+  }
+  self->Flush();
+}
+
+// static function pointer
+void Http2Connection::WriteCallback(bufferevent* bev, void* connection) {
+  Http2Connection* self = static_cast<Http2Connection*>(connection);
+  // The output has been sent.
+  if (self->session_.done()) {
+    self->Close();
+  }
+}
+
+// static function pointer
+void Http2Connection::EventCallback(bufferevent* bev, int16_t events,
+                                    void* connection) {
+  Http2Connection* self = static_cast<Http2Connection*>(connection);
+  if ((events & BEV_EVENT_TIMEOUT) && (events & BEV_EVENT_READING)) {
+    if (!self->requests_.empty()) {
+      // Waiting for the handlers, not for the client.
+      bufferevent_enable(bev, EV_READ);
+      return;
+    }
+    if (self->session_.num_open_streams() == 0) {
+      // Idle: closed gracefully once the GOAWAY is sent.
+      self->session_.SubmitGoAway();
+      self->Flush();
+      return;
+    }
+  }
+  // Closed by the client, an error, or a request or reply timing out.
+  self->Close();
+}
+
+void Http2Connection::Flush() {
+  if (closed_) {
+    return;
+  }
+  std::string* output = session_.output();
+  if (!output->empty()) {
+    bufferevent_write(bev_, output->data(), output->size());
+    output->clear();
+  }
+  if (session_.done()) {
+    bufferevent_disable(bev_, EV_READ);
+    if (evbuffer_get_length(bufferevent_get_output(bev_)) == 0) {
+      Close();
+    }
+  }
+}
+
+void Http2Connection::SendHeaders(uint32_t stream_id, int status,
+                                  const HpackHeaders& headers,
+                                  bool end_stream) {
+  if (!closed_) {
+    session_.SubmitHeaders(stream_id, status, headers, end_stream);
+    Flush();
+  }
+}
+
+void Http2Connection::SendData(uint32_t stream_id, absl::string_view data,
+                               bool end_stream) {
+  if (!closed_) {
+    session_.SubmitData(stream_id, data, end_stream);
+    Flush();
+  }
+}
+
+void Http2Connection::ResetStream(uint32_t stream_id) {
+  if (!closed_) {
+    session_.SubmitReset(stream_id, Http2Session::kInternalError);
+    Flush();
+  }
+}
+
+void Http2Connection::OnRequest(
+    std::unique_ptr<Http2Session::Request> request) {
+  auto http2_request = absl::make_unique<Http2Request>(
+      std::move(request), shared_from_this(), server_);
+  requests_[http2_request->stream_id()] = http2_request.get();
+  dispatcher_(std::move(http2_request));
+}
+
+bool Http2Connection::OnStreamReset(uint32_t stream_id) {
+  auto it = requests_.find(stream_id);
+  if (it == requests_.end()) {
+    return false;
+  }
+  it->second->SetStreamClosed();
+  return true;
+}
+
+}  // namespace net_http
+}  // namespace serving
+}  // namespace tensorflow
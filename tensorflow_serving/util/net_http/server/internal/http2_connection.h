@@ -0,0 +1,116 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// libevent based HTTP/2 connection implementation
+
+#ifndef TENSORFLOW_SERVING_UTIL_NET_HTTP_SERVER_INTERNAL_HTTP2_CONNECTION_H_
+#define TENSORFLOW_SERVING_UTIL_NET_HTTP_SERVER_INTERNAL_HTTP2_CONNECTION_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+#include "absl/time/time.h"
+#include "libevent/include/event2/util.h"
+#include "tensorflow_serving/util/net_http/server/internal/hpack.h"
+#include "tensorflow_serving/util/net_http/server/internal/http2_request.h"
+#include "tensorflow_serving/util/net_http/server/internal/http2_session.h"
+#include "tensorflow_serving/util/net_http/server/internal/server_support.h"
+
+struct bufferevent;
+struct event_base;
+
+namespace tensorflow {
+namespace serving {
+namespace net_http {
+
+// The I/O of an HTTP/2 session on an accepted socket, from the event loop
+// that owns it. The connection is kept alive by the event loop while it is
+// open, and by its requests until they are replied to; the requests and the
+// replies of its streams are only accessed from that loop.
+class Http2Connection final
+    : public Http2Session::Visitor,
+      public std::enable_shared_from_this<Http2Connection> {
+ public:
+  // Receives the requests of the connection, from the event loop.
+  using Dispatcher = std::function<void(std::unique_ptr<Http2Request>)>;
+  // Called from the event loop once the connection is closed.
+  using ClosedCallback = std::function<void(Http2Connection*)>;
+
+  // Takes the ownership of `fd`. Doesn't own the server.
+  Http2Connection(event_base* ev_base, evutil_socket_t fd,
+                  const Http2Session::Options& options,
+                  absl::Duration timeout, ServerSupport* server,
+                  Dispatcher dispatcher, ClosedCallback closed_callback);
+  ~Http2Connection() override;
+
+  Http2Connection(const Http2Connection& other) = delete;
+  Http2Connection& operator=(const Http2Connection& other) = delete;
+
+  // Sends the SETTINGS of the server, and starts reading. Returns false if
+  // any error, in which case the socket is closed.
+  bool Start();
+
+  // The replies of the requests, see Http2Session. Ignored once the
+  // connection is closed.
+  void SendHeaders(uint32_t stream_id, int status, const HpackHeaders& headers,
+                   bool end_stream);
+  void SendData(uint32_t stream_id, absl::string_view data, bool end_stream);
+  void ResetStream(uint32_t stream_id);
+
+  // Forgets a request that is deleted.
+  void RemoveRequest(uint32_t stream_id) {
+    requests_.erase(stream_id);
+    session_.ReleaseRequest(stream_id);
+  }
+
+  // Http2Session::Visitor
+  void OnRequest(std::unique_ptr<Http2Session::Request> request) override;
+  bool OnStreamReset(uint32_t stream_id) override;
+
+ private:
+  static void ReadCallback(bufferevent* bev, void* connection);
+  static void WriteCallback(bufferevent* bev, void* connection);
+  static void EventCallback(bufferevent* bev, int16_t events,
+                            void* connection);
+
+  // Moves the output of the session to the socket, and closes the connection
+  // once the session is done and its output sent.
+  void Flush();
+
+  // Closes the socket, and calls the closed callback.
+  void Close();
+
+  event_base* const ev_base_;
+  const evutil_socket_t fd_;
+  const absl::Duration timeout_;
+  ServerSupport* const server_;
+  const Dispatcher dispatcher_;
+  const ClosedCallback closed_callback_;
+
+  Http2Session session_;
+  bufferevent* bev_ = nullptr;
+  bool closed_ = false;
+
+  // The dispatched requests, by stream id.
+  std::unordered_map<uint32_t, Http2Request*> requests_;
+};
+
+}  // namespace net_http
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_UTIL_NET_HTTP_SERVER_INTERNAL_HTTP2_CONNECTION_H_
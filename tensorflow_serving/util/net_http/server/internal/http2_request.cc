@@ -0,0 +1,413 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// The requests of HTTP/2 connections
+
+#include "tensorflow_serving/util/net_http/server/internal/http2_request.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <utility>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "tensorflow_serving/util/net_http/compression/gzip_zlib.h"
+#include "tensorflow_serving/util/net_http/internal/net_logging.h"
+#include "tensorflow_serving/util/net_http/server/internal/evhttp_request.h"
+#include "tensorflow_serving/util/net_http/server/internal/http2_connection.h"
+#include "tensorflow_serving/util/net_http/server/public/header_names.h"
+
+namespace tensorflow {
+namespace serving {
+namespace net_http {
+
+namespace {
+
+// Initial size of the buffer a gzipped request body is uncompressed into.
+constexpr size_t kMinUncompressBufferSize = 4 << 10;
+
+}  // namespace
+
+Http2Request::Http2Request(std::unique_ptr<Http2Session::Request> request,
+                           std::shared_ptr<Http2Connection> connection,
+                           ServerSupport* server)
+    : request_(std::move(request)),
+      connection_(std::move(connection)),
+      server_(server) {
+  path_ = request_->path;
+  path_ = path_.substr(0, path_.find_first_of("?#"));
+}
+
+Http2Request::~Http2Request() { connection_->RemoveRequest(stream_id()); }
+
+ServerRequestInterface::BodyStatus Http2Request::response_body_status() {
+  return stream_closed_ ? BodyStatus::FAILED : BodyStatus::PENDING;
+}
+
+void Http2Request::WriteResponseBytes(const char* data, int64_t size) {
+  assert(size >= 0);
+  output_.append(data, static_cast<size_t>(size));
+}
+
+void Http2Request::WriteResponseString(absl::string_view data) {
+  output_.append(data.data(), data.size());
+}
+
+std::unique_ptr<char[], BlockDeleter> Http2Request::ReadRequestBytes(
+    int64_t* size) {
+  *size = 0;
+  if (request_body_read_ || request_->body.empty()) {
+    return nullptr;  // EOF
+  }
+  request_body_read_ = true;
+
+  if (NeedUncompressGzipContent()) {
+    return UncompressRequestBody(size);
+  }
+
+  const size_t body_size = request_->body.size();
+  char* block = std::allocator<char>().allocate(body_size);
+  memcpy(block, request_->body.data(), body_size);
+  *size = static_cast<int64_t>(body_size);
+  return std::unique_ptr<char[], BlockDeleter>(block, BlockDeleter(body_size));
+}
+
+bool Http2Request::GetRequestBody(absl::string_view* body) {
+  if (!request_body_read_) {
+    request_body_read_ = true;
+    if (NeedUncompressGzipContent() && !request_->body.empty()) {
+      int64_t size = 0;
+      uncompressed_body_ = UncompressRequestBody(&size);
+      if (uncompressed_body_ != nullptr) {
+        request_body_ = absl::string_view(uncompressed_body_.get(), size);
+      }
+    } else {
+      request_body_ = request_->body;
+    }
+  }
+  *body = request_body_;
+  return true;
+}
+
+std::unique_ptr<char[], BlockDeleter> Http2Request::UncompressRequestBody(
+    int64_t* size) {
+  const size_t max_size =
+      handler_options_->auto_uncompress_max_size() > 0
+          ? static_cast<size_t>(handler_options_->auto_uncompress_max_size())
+          : static_cast<size_t>(ZLib::kMaxUncompressedBytes);
+  const std::string& body = request_->body;
+
+  // The uncompressed size announced by the gzip footer is only a hint, see
+  // EvHTTPRequest::ReadRequestGzipBytes().
+  size_t capacity = kMinUncompressBufferSize;
+  if (body.size() > 4) {
+    const unsigned char* footer =
+        reinterpret_cast<const unsigned char*>(body.data() + body.size() - 4);
+    const size_t announced_size = (static_cast<size_t>(footer[3]) << 24) |
+                                  (static_cast<size_t>(footer[2]) << 16) |
+                                  (static_cast<size_t>(footer[1]) << 8) |
+                                  static_cast<size_t>(footer[0]);
+    capacity = std::max(capacity, announced_size + 1);
+  }
+  capacity = std::min(capacity, max_size);
+
+  ZLib zlib;
+  char* uncomp_body = std::allocator<char>().allocate(capacity);
+  size_t uncomp_size = 0;
+  const Bytef* source = reinterpret_cast<const Bytef*>(body.data());
+  uLong source_length = body.size();
+  bool ok = true;
+  while (source_length > 0) {
+    if (uncomp_size == capacity) {
+      if (capacity == max_size) {
+        NET_LOG(ERROR, "Uncompressed body exceeds %zu bytes", max_size);
+        ok = false;
+        break;
+      }
+      const size_t new_capacity = std::min(2 * capacity, max_size);
+      char* new_body = std::allocator<char>().allocate(new_capacity);
+      memcpy(new_body, uncomp_body, uncomp_size);
+      std::allocator<char>().deallocate(uncomp_body, capacity);
+      uncomp_body = new_body;
+      capacity = new_capacity;
+    }
+    uLongf dest_length = capacity - uncomp_size;
+    const uLong remaining_before = source_length;
+    const int err = zlib.UncompressAtMost(
+        reinterpret_cast<Bytef*>(uncomp_body + uncomp_size), &dest_length,
+        source, &source_length);
+    if (err != Z_OK && err != Z_BUF_ERROR) {
+      NET_LOG(ERROR, "Got zlib error: %d", err);
+      ok = false;
+      break;
+    }
+    source += remaining_before - source_length;
+    uncomp_size += dest_length;
+  }
+  if (ok && !zlib.UncompressChunkDone()) {
+    NET_LOG(ERROR, "Invalid end of the gzipped body");
+    ok = false;
+  }
+
+  if (!ok) {
+    NET_LOG(ERROR, "Failed to uncompress the gzipped body");
+    std::allocator<char>().deallocate(uncomp_body, capacity);
+    *size = 0;
+    return nullptr;
+  }
+  *size = static_cast<int64_t>(uncomp_size);
+  return std::unique_ptr<char[], BlockDeleter>(uncomp_body,
+                                               BlockDeleter(capacity));
+}
+
+bool Http2Request::NeedUncompressGzipContent() const {
+  if (handler_options_ != nullptr &&
+      handler_options_->auto_uncompress_input()) {
+    auto content_encoding = GetRequestHeader(HTTPHeaders::CONTENT_ENCODING);
+    return absl::StrContains(content_encoding, "gzip");
+  }
+
+  return false;
+}
+
+absl::string_view Http2Request::GetRequestHeader(
+    absl::string_view header) const {
+  for (const auto& request_header : request_->headers) {
+    if (absl::EqualsIgnoreCase(request_header.first, header)) {
+      return request_header.second;
+    }
+  }
+  if (absl::EqualsIgnoreCase(header, HTTPHeaders::HOST)) {
+    return request_->authority;
+  }
+  return absl::string_view();
+}
+
+std::vector<absl::string_view> Http2Request::request_headers() const {
+  std::vector<absl::string_view> result;
+  for (const auto& header : request_->headers) {
+    result.emplace_back(header.first);
+  }
+  return result;
+}
+
+void Http2Request::OverwriteResponseHeader(absl::string_view header,
+                                           absl::string_view value) {
+  response_headers_.erase(
+      std::remove_if(response_headers_.begin(), response_headers_.end(),
+                     [header](const std::pair<std::string, std::string>& h) {
+                       return absl::EqualsIgnoreCase(h.first, header);
+                     }),
+      response_headers_.end());
+  AppendResponseHeader(header, value);
+}
+
+void Http2Request::AppendResponseHeader(absl::string_view header,
+                                        absl::string_view value) {
+  response_headers_.emplace_back(std::string(header), std::string(value));
+}
+
+// Each call sends the body written so far in DATA frames, the first one
+// preceded by the HEADERS of the response.
+void Http2Request::PartialReplyWithStatus(HTTPStatusCode status) {
+  if (!SchedulePartialReply(status, /*on_flush=*/nullptr)) {
+    NET_LOG(ERROR, "Failed to EventLoopSchedule PartialReplyWithStatus()");
+  }
+}
+
+// The body is handed to the HTTP/2 session, which applies the flow control of
+// the stream: the flush callback is called once it is.
+bool Http2Request::SchedulePartialReply(HTTPStatusCode status,
+                                        std::function<void()> on_flush) {
+  const bool start_reply = !reply_started_;
+  if (start_reply) {
+    MaybeStartResponseCompression(/*streamed=*/true);
+  }
+  if (response_compressor_ != nullptr) {
+    CompressResponseBody(/*last=*/false);
+  }
+  reply_started_ = true;
+
+  std::string chunk;
+  chunk.swap(output_);
+  HpackHeaders headers;
+  if (start_reply) {
+    headers.swap(response_headers_);
+  }
+  return server_->EventLoopSchedule(
+      [this, status, start_reply, headers = std::move(headers),
+       chunk = std::move(chunk), on_flush = std::move(on_flush)]() {
+        SendReply(status, start_reply, headers, chunk, /*last=*/false);
+        if (on_flush) {
+          on_flush();
+        }
+      });
+}
+
+void Http2Request::PartialReply() {
+  PartialReplyWithStatus(HTTPStatusCode::OK);
+}
+
+ServerRequestInterface::CallbackStatus
+Http2Request::PartialReplyWithFlushCallback(std::function<void()> callback) {
+  if (response_body_status() == BodyStatus::FAILED) {
+    return CallbackStatus::NOT_SCHEDULED;
+  }
+  if (!SchedulePartialReply(HTTPStatusCode::OK, std::move(callback))) {
+    NET_LOG(ERROR,
+            "Failed to EventLoopSchedule PartialReplyWithFlushCallback()");
+    return CallbackStatus::NOT_SCHEDULED;
+  }
+  return CallbackStatus::SCHEDULED;
+}
+
+void Http2Request::ReplyWithStatus(HTTPStatusCode status) {
+  const bool start_reply = !reply_started_;
+  if (start_reply) {
+    MaybeStartResponseCompression(/*streamed=*/false);
+  }
+  if (response_compressor_ != nullptr) {
+    CompressResponseBody(/*last=*/true);
+  }
+
+  std::string body;
+  body.swap(output_);
+  HpackHeaders headers;
+  if (start_reply) {
+    headers.swap(response_headers_);
+    // As sent by evhttp for the replies that are not streamed.
+    headers.emplace_back(HTTPHeaders::CONTENT_LENGTH,
+                         absl::StrCat(body.size()));
+  }
+  bool result = server_->EventLoopSchedule(
+      [this, status, start_reply, headers = std::move(headers),
+       body = std::move(body)]() {
+        SendReply(status, start_reply, headers, body, /*last=*/true);
+      });
+
+  if (!result) {
+    NET_LOG(ERROR, "Failed to EventLoopSchedule ReplyWithStatus()");
+  }
+}
+
+void Http2Request::SendReply(HTTPStatusCode status, bool start_reply,
+                             const HpackHeaders& headers,
+                             const std::string& body, bool last) {
+  // No body is sent in reply to HEAD requests.
+  const bool send_body = !body.empty() && request_->method != "HEAD";
+  if (start_reply) {
+    connection_->SendHeaders(stream_id(), static_cast<int>(status), headers,
+                             last && !send_body);
+  }
+  if (send_body || (last && !start_reply)) {
+    connection_->SendData(stream_id(), send_body ? body : "", last);
+  }
+  if (last) {
+    server_->DecOps();
+    delete this;
+  }
+}
+
+void Http2Request::Reply() { ReplyWithStatus(HTTPStatusCode::OK); }
+
+void Http2Request::MaybeStartResponseCompression(bool streamed) {
+  if (handler_options_ == nullptr ||
+      !handler_options_->auto_compress_output() ||
+      !AcceptsGzipEncoding(GetRequestHeader(HTTPHeaders::ACCEPT_ENCODING))) {
+    return;
+  }
+  for (const auto& header : response_headers_) {
+    if (absl::EqualsIgnoreCase(header.first, HTTPHeaders::CONTENT_ENCODING)) {
+      return;  // Already encoded by the handler.
+    }
+  }
+  if (!streamed && (output_.empty() ||
+                    static_cast<int64_t>(output_.size()) <
+                        handler_options_->auto_compress_min_size())) {
+    return;
+  }
+
+  response_compressor_.reset(new ZLib());
+  OverwriteResponseHeader(HTTPHeaders::CONTENT_ENCODING, "gzip");
+  AppendResponseHeader(HTTPHeaders::VARY, HTTPHeaders::ACCEPT_ENCODING);
+}
+
+// Same as EvHTTPRequest::CompressResponseBody(): each piece of the body is
+// compressed with a sync flush.
+void Http2Request::CompressResponseBody(bool last) {
+  const size_t capacity = ZLib::MinCompressbufSize(output_.size()) +
+                          response_compressor_->MinFooterSize();
+  std::string compressed(capacity, '\0');
+
+  // zlib needs a non-null source, even when it is empty.
+  static const Bytef kEmptySource[1] = {0};
+  const Bytef* source = output_.empty()
+                            ? kEmptySource
+                            : reinterpret_cast<const Bytef*>(output_.data());
+  uLong source_length = output_.size();
+  Bytef* dest = reinterpret_cast<Bytef*>(&compressed[0]);
+  uLongf compressed_size = capacity;
+  int err = Z_OK;
+  if (!output_.empty() || response_compressor_->first_chunk()) {
+    err = response_compressor_->CompressAtMost(dest, &compressed_size, source,
+                                               &source_length);
+  } else {
+    compressed_size = 0;
+  }
+  if (err == Z_OK && last) {
+    uLongf footer_size = capacity - compressed_size;
+    err = response_compressor_->CompressChunkDone(dest + compressed_size,
+                                                  &footer_size);
+    compressed_size += footer_size;
+  }
+  if (err != Z_OK || source_length != 0) {
+    NET_LOG(ERROR, "Got zlib error: %d", err);
+    // The stream cannot be continued: the rest of the response is dropped.
+    compressed_size = 0;
+  }
+
+  compressed.resize(compressed_size);
+  output_.swap(compressed);
+}
+
+void Http2Request::Abort() {
+  const bool reply_started = reply_started_;
+  bool result = server_->EventLoopSchedule(
+      [this, reply_started]() { SendAbort(reply_started); });
+  if (!result) {
+    NET_LOG(ERROR, "Failed to EventLoopSchedule Abort()");
+  }
+}
+
+void Http2Request::SendAbort(bool reply_started) {
+  if (reply_started) {
+    // The client must not take the partial response for a complete one.
+    connection_->ResetStream(stream_id());
+  } else {
+    connection_->SendHeaders(
+        stream_id(), static_cast<int>(HTTPStatusCode::ERROR), {}, true);
+  }
+  server_->DecOps();
+  delete this;
+}
+
+}  // namespace net_http
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,164 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// The requests of HTTP/2 connections
+
+#ifndef TENSORFLOW_SERVING_UTIL_NET_HTTP_SERVER_INTERNAL_HTTP2_REQUEST_H_
+#define TENSORFLOW_SERVING_UTIL_NET_HTTP_SERVER_INTERNAL_HTTP2_REQUEST_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "tensorflow_serving/util/net_http/server/internal/hpack.h"
+#include "tensorflow_serving/util/net_http/server/internal/http2_session.h"
+#include "tensorflow_serving/util/net_http/server/internal/server_support.h"
+#include "tensorflow_serving/util/net_http/server/public/httpserver_interface.h"
+#include "tensorflow_serving/util/net_http/server/public/server_request_interface.h"
+
+namespace tensorflow {
+namespace serving {
+namespace net_http {
+
+class Http2Connection;
+class ZLib;
+
+// A request received on a stream of an HTTP/2 connection, which is replied
+// to on the same stream. Thread-compatible, with the same contract as
+// EvHTTPRequest: the replies are sent from the event loop of the connection,
+// which then deletes the request.
+class Http2Request final : public ServerRequestInterface {
+ public:
+  // Doesn't own the server, and keeps the connection alive until the reply is
+  // sent.
+  Http2Request(std::unique_ptr<Http2Session::Request> request,
+               std::shared_ptr<Http2Connection> connection,
+               ServerSupport* server);
+  ~Http2Request() override;
+
+  Http2Request(const Http2Request& other) = delete;
+  Http2Request& operator=(const Http2Request& other) = delete;
+
+  absl::string_view uri_path() const override { return request_->path; }
+
+  absl::string_view http_method() const override { return request_->method; }
+
+  void WriteResponseBytes(const char* data, int64_t size) override;
+
+  void WriteResponseString(absl::string_view data) override;
+
+  // Returns the whole body in one block.
+  std::unique_ptr<char[], BlockDeleter> ReadRequestBytes(
+      int64_t* size) override;
+
+  // The body is received in full before the request is dispatched, so it is
+  // read in place unless uncompressed.
+  bool GetRequestBody(absl::string_view* body) override;
+
+  // ":authority" is returned as the "Host" header.
+  absl::string_view GetRequestHeader(absl::string_view header) const override;
+
+  std::vector<absl::string_view> request_headers() const override;
+
+  void OverwriteResponseHeader(absl::string_view header,
+                               absl::string_view value) override;
+  void AppendResponseHeader(absl::string_view header,
+                            absl::string_view value) override;
+
+  void PartialReplyWithStatus(HTTPStatusCode status) override;
+  void PartialReply() override;
+
+  CallbackStatus PartialReplyWithFlushCallback(
+      std::function<void()> callback) override;
+
+  void ReplyWithStatus(HTTPStatusCode status) override;
+  void Reply() override;
+
+  // Resets the stream if the reply has been started, or else replies with
+  // 500.
+  void Abort() override;
+
+  // FAILED once the client has reset the stream or closed the connection.
+  BodyStatus response_body_status() override;
+
+  // The URI path without the query and fragment, to dispatch the request.
+  absl::string_view path() const { return path_; }
+
+  uint32_t stream_id() const { return request_->stream_id; }
+
+  // Keeps a reference to the registered RequestHandlerOptions
+  void SetHandlerOptions(const RequestHandlerOptions& handler_options) {
+    handler_options_ = &handler_options;
+  }
+
+  // Called from the event loop once the response can't be sent anymore.
+  void SetStreamClosed() { stream_closed_ = true; }
+
+ private:
+  // Hands the body written so far to SendReply() in the event loop, then calls
+  // `on_flush` if set. Returns false if it could not be scheduled.
+  bool SchedulePartialReply(HTTPStatusCode status,
+                            std::function<void()> on_flush);
+
+  // Sends the status and headers if `start_reply`, then `body` (if any). If
+  // `last`, the stream is ended and the request deleted. Runs on the loop.
+  void SendReply(HTTPStatusCode status, bool start_reply,
+                 const HpackHeaders& headers, const std::string& body,
+                 bool last);
+
+  // Ends the stream with an error, then deletes the request. Runs on the
+  // loop.
+  void SendAbort(bool reply_started);
+
+  // Same as for EvHTTPRequest.
+  void MaybeStartResponseCompression(bool streamed);
+  void CompressResponseBody(bool last);
+  bool NeedUncompressGzipContent() const;
+
+  // Uncompresses the request body into a block owned by the caller.
+  std::unique_ptr<char[], BlockDeleter> UncompressRequestBody(int64_t* size);
+
+  const std::unique_ptr<Http2Session::Request> request_;
+  const std::shared_ptr<Http2Connection> connection_;
+  ServerSupport* const server_;
+
+  const RequestHandlerOptions* handler_options_ = nullptr;
+
+  absl::string_view path_;
+
+  // Set by the first ReadRequestBytes() or GetRequestBody() call.
+  bool request_body_read_ = false;
+  absl::string_view request_body_;
+  std::unique_ptr<char[], BlockDeleter> uncompressed_body_;
+
+  HpackHeaders response_headers_;
+  // The response body that is not sent yet.
+  std::string output_;
+  bool reply_started_ = false;
+
+  // Set if the response body is gzip-compressed.
+  std::unique_ptr<ZLib> response_compressor_;
+
+  std::atomic<bool> stream_closed_{false};
+};
+
+}  // namespace net_http
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_UTIL_NET_HTTP_SERVER_INTERNAL_HTTP2_REQUEST_H_
@@ -0,0 +1,813 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/net_http/server/internal/http2_session.h"
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+
+namespace tensorflow {
+namespace serving {
+namespace net_http {
+
+namespace {
+
+constexpr absl::string_view kClientPreface =
+    absl::string_view("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+
+constexpr size_t kFrameHeaderSize = 9;
+// The SETTINGS_MAX_FRAME_SIZE of the server, which is the default one.
+constexpr uint32_t kMaxFrameSize = 16384;
+constexpr int64_t kMaxWindowSize = (int64_t{1} << 31) - 1;
+constexpr uint32_t kDefaultWindowSize = 65535;
+
+enum FrameType : uint8_t {
+  kData = 0x0,
+  kHeaders = 0x1,
+  kPriority = 0x2,
+  kRstStream = 0x3,
+  kSettings = 0x4,
+  kPushPromise = 0x5,
+  kPing = 0x6,
+  kGoAway = 0x7,
+  kWindowUpdate = 0x8,
+  kContinuation = 0x9,
+};
+
+enum FrameFlags : uint8_t {
+  kEndStream = 0x1,
+  kAck = 0x1,
+  kEndHeaders = 0x4,
+  kPadded = 0x8,
+  kPriorityFlag = 0x20,
+};
+
+enum SettingsId : uint16_t {
+  kHeaderTableSize = 0x1,
+  kEnablePush = 0x2,
+  kMaxConcurrentStreams = 0x3,
+  kInitialWindowSize = 0x4,
+  kMaxFrameSizeId = 0x5,
+  kMaxHeaderListSize = 0x6,
+};
+
+uint32_t ReadUint32(absl::string_view data) {
+  return (static_cast<uint32_t>(static_cast<uint8_t>(data[0])) << 24) |
+         (static_cast<uint32_t>(static_cast<uint8_t>(data[1])) << 16) |
+         (static_cast<uint32_t>(static_cast<uint8_t>(data[2])) << 8) |
+         static_cast<uint32_t>(static_cast<uint8_t>(data[3]));
+}
+
+void AppendUint32(uint32_t value, std::string* output) {
+  output->push_back(static_cast<char>(value >> 24));
+  output->push_back(static_cast<char>(value >> 16));
+  output->push_back(static_cast<char>(value >> 8));
+  output->push_back(static_cast<char>(value));
+}
+
+void AppendSetting(uint16_t id, uint32_t value, std::string* output) {
+  output->push_back(static_cast<char>(id >> 8));
+  output->push_back(static_cast<char>(id));
+  AppendUint32(value, output);
+}
+
+// Removes the padding of a DATA or HEADERS frame. Returns false if the pad
+// length is invalid.
+bool RemovePadding(uint8_t flags, absl::string_view* payload) {
+  if ((flags & kPadded) == 0) {
+    return true;
+  }
+  if (payload->empty()) {
+    return false;
+  }
+  const size_t pad_length = static_cast<uint8_t>((*payload)[0]);
+  if (pad_length >= payload->size()) {
+    return false;
+  }
+  payload->remove_prefix(1);
+  payload->remove_suffix(pad_length);
+  return true;
+}
+
+// The header fields that only make sense for HTTP/1 connections.
+bool IsConnectionSpecificHeader(absl::string_view name) {
+  return name == "connection" || name == "keep-alive" ||
+         name == "proxy-connection" || name == "transfer-encoding" ||
+         name == "upgrade";
+}
+
+}  // namespace
+
+Http2Session::Http2Session(const Options& options, Visitor* visitor)
+    : options_(options), visitor_(visitor) {
+  std::string settings;
+  AppendSetting(kMaxConcurrentStreams, options_.max_concurrent_streams,
+                &settings);
+  AppendSetting(kInitialWindowSize, options_.initial_window_size, &settings);
+  AppendSetting(kMaxHeaderListSize, options_.max_header_list_size, &settings);
+  WriteFrameHeader(settings.size(), kSettings, 0, 0);
+  output_.append(settings);
+
+  if (options_.initial_window_size > kDefaultWindowSize) {
+    WriteWindowUpdate(0, options_.initial_window_size - kDefaultWindowSize);
+  }
+}
+
+bool Http2Session::Receive(absl::string_view data) {
+  if (failed_) {
+    return false;
+  }
+
+  if (!preface_received_) {
+    const size_t size =
+        std::min(kClientPreface.size() - input_.size(), data.size());
+    input_.append(data.data(), size);
+    data.remove_prefix(size);
+    if (!absl::StartsWith(kClientPreface, input_)) {
+      ConnectionError(kProtocolError);
+      return false;
+    }
+    if (input_.size() < kClientPreface.size()) {
+      return true;
+    }
+    input_.clear();
+    preface_received_ = true;
+  }
+
+  input_.append(data.data(), data.size());
+  const size_t consumed = ProcessFrames();
+  input_.erase(0, consumed);
+  return !failed_;
+}
+
+size_t Http2Session::ProcessFrames() {
+  absl::string_view input = input_;
+  size_t consumed = 0;
+  while (!failed_ && input.size() >= kFrameHeaderSize) {
+    const uint32_t length = ReadUint32(input) >> 8;
+    if (length > kMaxFrameSize) {
+      ConnectionError(kFrameSizeError);
+      break;
+    }
+    if (input.size() < kFrameHeaderSize + length) {
+      break;
+    }
+    const uint8_t type = static_cast<uint8_t>(input[3]);
+    const uint8_t flags = static_cast<uint8_t>(input[4]);
+    const uint32_t stream_id = ReadUint32(input.substr(5)) & 0x7fffffff;
+    ProcessFrame(type, flags, stream_id,
+                 input.substr(kFrameHeaderSize, length));
+    input.remove_prefix(kFrameHeaderSize + length);
+    consumed += kFrameHeaderSize + length;
+  }
+  return consumed;
+}
+
+void Http2Session::ProcessFrame(uint8_t type, uint8_t flags,
+                                uint32_t stream_id,
+                                absl::string_view payload) {
+  // A header block is received without interleaved frames.
+  if (header_block_stream_id_ != 0 && type != kContinuation) {
+    ConnectionError(kProtocolError);
+    return;
+  }
+
+  switch (type) {
+    case kData:
+      ProcessData(flags, stream_id, payload);
+      break;
+    case kHeaders:
+      ProcessHeaders(flags, stream_id, payload);
+      break;
+    case kPriority:
+      // The responses are sent in the order they are completed.
+      if (stream_id == 0) {
+        ConnectionError(kProtocolError);
+      } else if (payload.size() != 5) {
+        StreamError(stream_id, kFrameSizeError);
+      }
+      break;
+    case kRstStream:
+      ProcessRstStream(stream_id, payload);
+      break;
+    case kSettings:
+      ProcessSettings(flags, stream_id, payload);
+      break;
+    case kPushPromise:
+      // Only servers push.
+      ConnectionError(kProtocolError);
+      break;
+    case kPing:
+      ProcessPing(flags, stream_id, payload);
+      break;
+    case kGoAway:
+      ProcessGoAway(stream_id);
+      break;
+    case kWindowUpdate:
+      ProcessWindowUpdate(stream_id, payload);
+      break;
+    case kContinuation:
+      ProcessContinuation(flags, stream_id, payload);
+      break;
+    default:
+      // Unknown frame types are ignored.
+      break;
+  }
+}
+
+void Http2Session::ProcessData(uint8_t flags, uint32_t stream_id,
+                               absl::string_view payload) {
+  if (stream_id == 0 || stream_id > last_stream_id_) {
+    ConnectionError(kProtocolError);
+    return;
+  }
+
+  // The padding counts toward the flow control too. SETTINGS don't change
+  // the window of the connection, which is at least the default one.
+  const size_t frame_size = payload.size();
+  const int64_t connection_window =
+      std::max(options_.initial_window_size, kDefaultWindowSize);
+  received_bytes_ += frame_size;
+  if (received_bytes_ > connection_window) {
+    ConnectionError(kFlowControlError);
+    return;
+  }
+  if (received_bytes_ >= connection_window / 2) {
+    WriteWindowUpdate(0, received_bytes_);
+    received_bytes_ = 0;
+  }
+
+  if (!RemovePadding(flags, &payload)) {
+    ConnectionError(kProtocolError);
+    return;
+  }
+
+  auto it = streams_.find(stream_id);
+  if (it == streams_.end()) {
+    // A stream reset by either side, whose frames in flight are ignored.
+    return;
+  }
+  Stream& stream = it->second;
+  if (stream.remote_closed) {
+    StreamError(stream_id, kStreamClosed);
+    return;
+  }
+
+  stream.received_bytes += frame_size;
+  if (stream.received_bytes > options_.initial_window_size) {
+    StreamError(stream_id, kFlowControlError);
+    return;
+  }
+  stream.request->body.append(payload.data(), payload.size());
+
+  if (flags & kEndStream) {
+    OnRemoteClosed(stream_id, &stream);
+    return;
+  }
+  if (stream.received_bytes >= options_.initial_window_size / 2) {
+    WriteWindowUpdate(stream_id, stream.received_bytes);
+    stream.received_bytes = 0;
+  }
+}
+
+void Http2Session::ProcessHeaders(uint8_t flags, uint32_t stream_id,
+                                  absl::string_view payload) {
+  if (stream_id == 0 || !RemovePadding(flags, &payload)) {
+    ConnectionError(kProtocolError);
+    return;
+  }
+  if (flags & kPriorityFlag) {
+    if (payload.size() < 5) {
+      ConnectionError(kFrameSizeError);
+      return;
+    }
+    payload.remove_prefix(5);
+  }
+
+  header_block_stream_id_ = stream_id;
+  header_block_end_stream_ = (flags & kEndStream) != 0;
+  header_block_.assign(payload.data(), payload.size());
+  if (flags & kEndHeaders) {
+    ProcessHeaderBlock();
+  }
+}
+
+void Http2Session::ProcessContinuation(uint8_t flags, uint32_t stream_id,
+                                       absl::string_view payload) {
+  if (header_block_stream_id_ == 0 || stream_id != header_block_stream_id_) {
+    ConnectionError(kProtocolError);
+    return;
+  }
+  // A header list never compresses to more than its size.
+  if (header_block_.size() + payload.size() >
+      options_.max_header_list_size) {
+    ConnectionError(kEnhanceYourCalm);
+    return;
+  }
+  header_block_.append(payload.data(), payload.size());
+  if (flags & kEndHeaders) {
+    ProcessHeaderBlock();
+  }
+}
+
+void Http2Session::ProcessHeaderBlock() {
+  const uint32_t stream_id = header_block_stream_id_;
+  const bool end_stream = header_block_end_stream_;
+  header_block_stream_id_ = 0;
+
+  // Decoded in any case, to keep the dynamic table in sync.
+  HpackHeaders fields;
+  const bool decoded = hpack_decoder_.Decode(
+      header_block_, options_.max_header_list_size, &fields);
+  header_block_.clear();
+  if (!decoded) {
+    ConnectionError(kCompressionError);
+    return;
+  }
+
+  auto it = streams_.find(stream_id);
+  if (it != streams_.end()) {
+    // Trailers, which are ignored.
+    if (it->second.remote_closed) {
+      StreamError(stream_id, kStreamClosed);
+    } else if (!end_stream) {
+      StreamError(stream_id, kProtocolError);
+    } else {
+      OnRemoteClosed(stream_id, &it->second);
+    }
+    return;
+  }
+
+  if (stream_id % 2 == 0) {
+    ConnectionError(kProtocolError);
+    return;
+  }
+  if (stream_id <= last_stream_id_) {
+    ConnectionError(kStreamClosed);
+    return;
+  }
+  last_stream_id_ = stream_id;
+  if (goaway_sent_) {
+    // Beyond the last stream id of the GOAWAY.
+    return;
+  }
+  // The handlers of the reset requests are still running.
+  if (streams_.size() + reset_requests_.size() >=
+      options_.max_concurrent_streams) {
+    StreamError(stream_id, kRefusedStream);
+    return;
+  }
+
+  auto request = absl::make_unique<Request>();
+  request->stream_id = stream_id;
+  if (!ParseRequestHeaders(&fields, request.get())) {
+    StreamError(stream_id, kProtocolError);
+    return;
+  }
+
+  it = streams_.emplace(stream_id, Stream(peer_initial_window_size_)).first;
+  it->second.request = std::move(request);
+
+  if (options_.max_requests > 0 && ++num_requests_ >= options_.max_requests) {
+    SubmitGoAway();
+  }
+  if (end_stream) {
+    OnRemoteClosed(stream_id, &it->second);
+  }
+}
+
+bool Http2Session::ParseRequestHeaders(HpackHeaders* fields,
+                                       Request* request) {
+  bool regular_header_seen = false;
+  for (auto& field : *fields) {
+    const std::string& name = field.first;
+    if (name.empty() ||
+        std::any_of(name.begin(), name.end(), absl::ascii_isupper)) {
+      return false;
+    }
+
+    if (name[0] == ':') {
+      if (regular_header_seen) {
+        return false;
+      }
+      std::string* pseudo_header;
+      if (name == ":method") {
+        pseudo_header = &request->method;
+      } else if (name == ":scheme") {
+        pseudo_header = &request->scheme;
+      } else if (name == ":authority") {
+        pseudo_header = &request->authority;
+      } else if (name == ":path") {
+        pseudo_header = &request->path;
+      } else {
+        return false;
+      }
+      if (!pseudo_header->empty() || field.second.empty()) {
+        return false;
+      }
+      *pseudo_header = std::move(field.second);
+      continue;
+    }
+
+    regular_header_seen = true;
+    if (IsConnectionSpecificHeader(name) ||
+        (name == "te" && field.second != "trailers")) {
+      return false;
+    }
+    request->headers.push_back(std::move(field));
+  }
+
+  // CONNECT is not supported, so that all the requests have these.
+  return !request->method.empty() && !request->scheme.empty() &&
+         !request->path.empty();
+}
+
+void Http2Session::OnRemoteClosed(uint32_t stream_id, Stream* stream) {
+  stream->remote_closed = true;
+  std::unique_ptr<Request> request = std::move(stream->request);
+
+  for (const auto& header : request->headers) {
+    if (header.first != "content-length") {
+      continue;
+    }
+    size_t content_length;
+    if (!absl::SimpleAtoi(header.second, &content_length) ||
+        content_length != request->body.size()) {
+      // Reset before the request is reported.
+      stream->request = std::move(request);
+      StreamError(stream_id, kProtocolError);
+      return;
+    }
+  }
+
+  // Last, as the visitor may submit the response at once.
+  visitor_->OnRequest(std::move(request));
+}
+
+void Http2Session::ProcessRstStream(uint32_t stream_id,
+                                    absl::string_view payload) {
+  if (stream_id == 0 || stream_id > last_stream_id_) {
+    ConnectionError(kProtocolError);
+    return;
+  }
+  if (payload.size() != 4) {
+    ConnectionError(kFrameSizeError);
+    return;
+  }
+
+  auto it = streams_.find(stream_id);
+  if (it == streams_.end()) {
+    return;
+  }
+  if (it->second.request == nullptr &&
+      ++reset_score_ > options_.max_reset_requests) {
+    ConnectionError(kEnhanceYourCalm);
+  }
+  ResetStream(it);
+}
+
+void Http2Session::ProcessSettings(uint8_t flags, uint32_t stream_id,
+                                   absl::string_view payload) {
+  if (stream_id != 0) {
+    ConnectionError(kProtocolError);
+    return;
+  }
+  if (flags & kAck) {
+    if (!payload.empty()) {
+      ConnectionError(kFrameSizeError);
+    }
+    return;
+  }
+  if (payload.size() % 6 != 0) {
+    ConnectionError(kFrameSizeError);
+    return;
+  }
+
+  for (; !payload.empty(); payload.remove_prefix(6)) {
+    const uint16_t id = (static_cast<uint8_t>(payload[0]) << 8) |
+                        static_cast<uint8_t>(payload[1]);
+    const uint32_t value = ReadUint32(payload.substr(2));
+    switch (id) {
+      case kEnablePush:
+        // Nothing is pushed in any case.
+        if (value > 1) {
+          ConnectionError(kProtocolError);
+          return;
+        }
+        break;
+      case kInitialWindowSize: {
+        if (value > kMaxWindowSize) {
+          ConnectionError(kFlowControlError);
+          return;
+        }
+        // Applies to the open streams too.
+        const int64_t delta =
+            static_cast<int64_t>(value) - peer_initial_window_size_;
+        for (auto& stream : streams_) {
+          stream.second.send_window += delta;
+          if (stream.second.send_window > kMaxWindowSize) {
+            ConnectionError(kFlowControlError);
+            return;
+          }
+        }
+        peer_initial_window_size_ = value;
+        break;
+      }
+      case kMaxFrameSizeId:
+        if (value < kMaxFrameSize || value > (1 << 24) - 1) {
+          ConnectionError(kProtocolError);
+          return;
+        }
+        peer_max_frame_size_ = value;
+        break;
+      default:
+        // The encoder has no dynamic table, and the responses are not limited
+        // by SETTINGS_MAX_HEADER_LIST_SIZE.
+        break;
+    }
+  }
+
+  WriteFrameHeader(0, kSettings, kAck, 0);
+  SendPendingData();
+}
+
+void Http2Session::ProcessPing(uint8_t flags, uint32_t stream_id,
+                               absl::string_view payload) {
+  if (stream_id != 0) {
+    ConnectionError(kProtocolError);
+    return;
+  }
+  if (payload.size() != 8) {
+    ConnectionError(kFrameSizeError);
+    return;
+  }
+  if ((flags & kAck) == 0) {
+    WriteFrameHeader(payload.size(), kPing, kAck, 0);
+    output_.append(payload.data(), payload.size());
+  }
+}
+
+void Http2Session::ProcessGoAway(uint32_t stream_id) {
+  if (stream_id != 0) {
+    ConnectionError(kProtocolError);
+    return;
+  }
+  // The open streams are completed.
+  goaway_received_ = true;
+}
+
+void Http2Session::ProcessWindowUpdate(uint32_t stream_id,
+                                       absl::string_view payload) {
+  if (payload.size() != 4) {
+    ConnectionError(kFrameSizeError);
+    return;
+  }
+  const uint32_t increment = ReadUint32(payload) & 0x7fffffff;
+
+  if (stream_id == 0) {
+    if (increment == 0) {
+      ConnectionError(kProtocolError);
+      return;
+    }
+    send_window_ += increment;
+    if (send_window_ > kMaxWindowSize) {
+      ConnectionError(kFlowControlError);
+      return;
+    }
+    SendPendingData();
+    return;
+  }
+
+  if (stream_id > last_stream_id_) {
+    ConnectionError(kProtocolError);
+    return;
+  }
+  auto it = streams_.find(stream_id);
+  if (it == streams_.end()) {
+    return;
+  }
+  if (increment == 0) {
+    StreamError(stream_id, kProtocolError);
+    return;
+  }
+  it->second.send_window += increment;
+  if (it->second.send_window > kMaxWindowSize) {
+    StreamError(stream_id, kFlowControlError);
+    return;
+  }
+  SendPendingStreamData(it);
+}
+
+void Http2Session::SubmitHeaders(uint32_t stream_id, int status,
+                                 const HpackHeaders& headers,
+                                 bool end_stream) {
+  auto it = streams_.find(stream_id);
+  if (it == streams_.end() || it->second.local_closed) {
+    return;
+  }
+
+  std::string block;
+  HpackEncodeStatus(status, &block);
+  for (const auto& header : headers) {
+    const std::string name = absl::AsciiStrToLower(header.first);
+    if (!IsConnectionSpecificHeader(name)) {
+      HpackEncodeHeader(name, header.second, &block);
+    }
+  }
+
+  // The block is split into CONTINUATION frames if needed, which can't be
+  // interleaved with the frames of other streams.
+  absl::string_view remaining = block;
+  uint8_t type = kHeaders;
+  uint8_t flags = end_stream ? kEndStream : 0;
+  do {
+    const absl::string_view fragment =
+        remaining.substr(0, peer_max_frame_size_);
+    remaining.remove_prefix(fragment.size());
+    if (remaining.empty()) {
+      flags |= kEndHeaders;
+    }
+    WriteFrameHeader(fragment.size(), type, flags, stream_id);
+    output_.append(fragment.data(), fragment.size());
+    type = kContinuation;
+    flags = 0;
+  } while (!remaining.empty());
+
+  if (end_stream) {
+    it->second.local_closed = true;
+    MaybeCloseStream(it);
+  }
+}
+
+void Http2Session::SubmitData(uint32_t stream_id, absl::string_view data,
+                              bool end_stream) {
+  auto it = streams_.find(stream_id);
+  if (it == streams_.end() || it->second.local_closed ||
+      it->second.pending_end_stream) {
+    return;
+  }
+  it->second.pending_data.append(data.data(), data.size());
+  it->second.pending_end_stream = end_stream;
+  pending_bytes_ += data.size();
+  SendPendingStreamData(it);
+
+  if (pending_bytes_ > options_.max_pending_bytes) {
+    // The client does not open its windows: the stream is reset rather than
+    // the responses buffered.
+    it = streams_.find(stream_id);
+    if (it != streams_.end()) {
+      WriteFrameHeader(4, kRstStream, 0, stream_id);
+      AppendUint32(kInternalError, &output_);
+      ResetStream(it);
+    }
+  }
+}
+
+void Http2Session::SubmitReset(uint32_t stream_id, ErrorCode error_code) {
+  auto it = streams_.find(stream_id);
+  if (it == streams_.end()) {
+    return;
+  }
+  EraseStream(it);
+  WriteFrameHeader(4, kRstStream, 0, stream_id);
+  AppendUint32(error_code, &output_);
+}
+
+void Http2Session::SubmitGoAway() {
+  if (!goaway_sent_) {
+    WriteGoAway(kNoError);
+  }
+}
+
+bool Http2Session::done() const {
+  return failed_ || ((goaway_sent_ || goaway_received_) && streams_.empty());
+}
+
+void Http2Session::SendPendingData() {
+  for (auto it = streams_.begin(); it != streams_.end() && send_window_ > 0;) {
+    // The stream may be closed.
+    auto next = std::next(it);
+    SendPendingStreamData(it);
+    it = next;
+  }
+}
+
+void Http2Session::SendPendingStreamData(
+    std::map<uint32_t, Stream>::iterator it) {
+  const uint32_t stream_id = it->first;
+  Stream& stream = it->second;
+
+  while (true) {
+    const size_t remaining = stream.pending_data.size() - stream.pending_offset;
+    const int64_t window = std::min(send_window_, stream.send_window);
+    if (remaining > 0 && window <= 0) {
+      return;
+    }
+    const size_t size = std::min<size_t>(
+        {remaining, peer_max_frame_size_, static_cast<size_t>(window)});
+    const bool end_stream = stream.pending_end_stream && size == remaining;
+    if (size == 0 && !end_stream) {
+      break;
+    }
+
+    WriteFrameHeader(size, kData, end_stream ? kEndStream : 0, stream_id);
+    output_.append(stream.pending_data, stream.pending_offset, size);
+    stream.pending_offset += size;
+    pending_bytes_ -= size;
+    send_window_ -= size;
+    stream.send_window -= size;
+
+    if (end_stream) {
+      stream.local_closed = true;
+      MaybeCloseStream(it);
+      return;
+    }
+  }
+
+  stream.pending_data.clear();
+  stream.pending_offset = 0;
+}
+
+void Http2Session::MaybeCloseStream(std::map<uint32_t, Stream>::iterator it) {
+  if (it->second.remote_closed && it->second.local_closed) {
+    EraseStream(it);
+    if (reset_score_ > 0) {
+      --reset_score_;
+    }
+  }
+}
+
+void Http2Session::ResetStream(std::map<uint32_t, Stream>::iterator it) {
+  const uint32_t stream_id = it->first;
+  const bool reported = it->second.request == nullptr;
+  EraseStream(it);
+  if (reported && visitor_->OnStreamReset(stream_id)) {
+    reset_requests_.insert(stream_id);
+  }
+}
+
+void Http2Session::EraseStream(std::map<uint32_t, Stream>::iterator it) {
+  pending_bytes_ -= it->second.pending_data.size() - it->second.pending_offset;
+  streams_.erase(it);
+}
+
+void Http2Session::ConnectionError(ErrorCode error_code) {
+  if (!failed_) {
+    WriteGoAway(error_code);
+    failed_ = true;
+  }
+}
+
+void Http2Session::StreamError(uint32_t stream_id, ErrorCode error_code) {
+  WriteFrameHeader(4, kRstStream, 0, stream_id);
+  AppendUint32(error_code, &output_);
+
+  auto it = streams_.find(stream_id);
+  if (it != streams_.end()) {
+    ResetStream(it);
+  }
+}
+
+void Http2Session::WriteFrameHeader(uint32_t length, uint8_t type,
+                                    uint8_t flags, uint32_t stream_id) {
+  output_.push_back(static_cast<char>(length >> 16));
+  output_.push_back(static_cast<char>(length >> 8));
+  output_.push_back(static_cast<char>(length));
+  output_.push_back(static_cast<char>(type));
+  output_.push_back(static_cast<char>(flags));
+  AppendUint32(stream_id, &output_);
+}
+
+void Http2Session::WriteWindowUpdate(uint32_t stream_id, uint32_t increment) {
+  WriteFrameHeader(4, kWindowUpdate, 0, stream_id);
+  AppendUint32(increment, &output_);
+}
+
+void Http2Session::WriteGoAway(ErrorCode error_code) {
+  WriteFrameHeader(8, kGoAway, 0, 0);
+  AppendUint32(last_stream_id_, &output_);
+  AppendUint32(error_code, &output_);
+  goaway_sent_ = true;
+}
+
+}  // namespace net_http
+}  // namespace serving
+}  // namespace tensorflow
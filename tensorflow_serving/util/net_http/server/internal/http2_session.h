@@ -0,0 +1,275 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// The server side of the HTTP/2 framing layer (RFC 7540), without the I/O.
+
+#ifndef TENSORFLOW_SERVING_UTIL_NET_HTTP_SERVER_INTERNAL_HTTP2_SESSION_H_
+#define TENSORFLOW_SERVING_UTIL_NET_HTTP_SERVER_INTERNAL_HTTP2_SESSION_H_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "tensorflow_serving/util/net_http/server/internal/hpack.h"
+
+namespace tensorflow {
+namespace serving {
+namespace net_http {
+
+// An HTTP/2 connection with prior knowledge (h2c), as seen by the server:
+// the bytes received from the client are fed to Receive(), and the bytes to
+// send are appended to output(). The session multiplexes the requests on
+// streams, enforces the flow control of both directions, and answers the
+// SETTINGS and PING frames itself.
+//
+// Requests are reported once received in full, i.e. with their body, and
+// the responses are submitted by stream id. A stream is closed once its
+// response is completely sent, or once it is reset by either side.
+//
+// Thread-compatible: a connection is only accessed from its event loop.
+class Http2Session {
+ public:
+  // The error codes of RST_STREAM and GOAWAY frames.
+  enum ErrorCode : uint32_t {
+    kNoError = 0x0,
+    kProtocolError = 0x1,
+    kInternalError = 0x2,
+    kFlowControlError = 0x3,
+    kStreamClosed = 0x5,
+    kFrameSizeError = 0x6,
+    kRefusedStream = 0x7,
+    kCancel = 0x8,
+    kCompressionError = 0x9,
+    kEnhanceYourCalm = 0xb,
+  };
+
+  struct Options {
+    // SETTINGS_MAX_CONCURRENT_STREAMS: the client may not open more streams
+    // at the same time.
+    uint32_t max_concurrent_streams = 100;
+    // SETTINGS_INITIAL_WINDOW_SIZE, and the window of the connection: how
+    // many bytes of request bodies the client may send ahead.
+    uint32_t initial_window_size = 1 << 20;
+    // SETTINGS_MAX_HEADER_LIST_SIZE.
+    uint32_t max_header_list_size = 64 << 10;
+    // The max number of requests of the connection, after which it is closed
+    // once their responses are sent. 0 means no limit.
+    int max_requests = 0;
+    // The max number of reported requests the client may reset before their
+    // response is sent, less one per response sent, after which the
+    // connection is closed with ENHANCE_YOUR_CALM. This stops the clients
+    // opening and resetting streams in a loop ("rapid reset"), for which the
+    // server would keep starting handlers.
+    int max_reset_requests = 100;
+    // The max number of bytes of the response bodies waiting for the client
+    // to open its flow-control windows. A stream submitting more is reset.
+    size_t max_pending_bytes = 64 << 20;
+  };
+
+  // A request received in full.
+  struct Request {
+    uint32_t stream_id = 0;
+    // The pseudo-header fields.
+    std::string method;
+    std::string scheme;
+    std::string authority;
+    std::string path;
+    // The regular header fields, with lowercase names.
+    HpackHeaders headers;
+    std::string body;
+  };
+
+  // Receives the requests of a session.
+  class Visitor {
+   public:
+    virtual ~Visitor() = default;
+
+    // A request has been received in full. Its response is to be submitted
+    // on `request->stream_id`.
+    virtual void OnRequest(std::unique_ptr<Request> request) = 0;
+
+    // The stream of a reported request has been reset by the client, which
+    // will not read its response. Returns whether the request is still
+    // handled, in which case the visitor is to call ReleaseRequest() once it
+    // is done with it.
+    virtual bool OnStreamReset(uint32_t stream_id) = 0;
+  };
+
+  // The SETTINGS of the server, i.e. its connection preface, are output at
+  // once.
+  Http2Session(const Options& options, Visitor* visitor);
+
+  Http2Session(const Http2Session& other) = delete;
+  Http2Session& operator=(const Http2Session& other) = delete;
+
+  // Processes the bytes received from the client, starting with its
+  // connection preface. Returns false after a connection error, in which case
+  // the output ends with a GOAWAY and nothing more is received.
+  bool Receive(absl::string_view data);
+
+  // Submits the HEADERS of a response. The names of `headers` are lowercased,
+  // and the connection-specific ones are dropped. Does nothing if the stream
+  // is closed.
+  void SubmitHeaders(uint32_t stream_id, int status,
+                     const HpackHeaders& headers, bool end_stream);
+
+  // Submits the body of a response, or a part of it, which is sent as the
+  // flow-control windows allow.
+  void SubmitData(uint32_t stream_id, absl::string_view data,
+                  bool end_stream);
+
+  // Resets a stream, e.g. to abort a response that has been started.
+  void SubmitReset(uint32_t stream_id, ErrorCode error_code);
+
+  // Stops accepting streams, the open ones being completed. Done once they
+  // are.
+  void SubmitGoAway();
+
+  // The visitor is done with the request of `stream_id`, e.g. its handler
+  // replied. The reported requests whose stream was reset count toward
+  // SETTINGS_MAX_CONCURRENT_STREAMS until then, as their handlers still run.
+  void ReleaseRequest(uint32_t stream_id) { reset_requests_.erase(stream_id); }
+
+  // The bytes to send, which the caller drains.
+  std::string* output() { return &output_; }
+
+  // Whether the connection is to be closed once the output is sent: after a
+  // connection error, or once the streams are completed after a GOAWAY.
+  bool done() const;
+
+  // The number of streams that are open.
+  int num_open_streams() const { return streams_.size(); }
+
+ private:
+  struct Stream {
+    explicit Stream(int64_t send_window_in) : send_window(send_window_in) {}
+
+    // The request, until reported to the visitor.
+    std::unique_ptr<Request> request;
+    // Whether END_STREAM has been received or sent.
+    bool remote_closed = false;
+    bool local_closed = false;
+    // The bytes the stream may send, and the bytes received since the last
+    // WINDOW_UPDATE.
+    int64_t send_window;
+    int64_t received_bytes = 0;
+    // The body submitted but not sent yet, from `pending_offset`.
+    std::string pending_data;
+    size_t pending_offset = 0;
+    bool pending_end_stream = false;
+  };
+
+  // Processes the frames of `input_`, and returns the number of bytes
+  // consumed. Sets `failed_` on a connection error.
+  size_t ProcessFrames();
+
+  void ProcessFrame(uint8_t type, uint8_t flags, uint32_t stream_id,
+                    absl::string_view payload);
+  void ProcessData(uint8_t flags, uint32_t stream_id,
+                   absl::string_view payload);
+  void ProcessHeaders(uint8_t flags, uint32_t stream_id,
+                      absl::string_view payload);
+  void ProcessContinuation(uint8_t flags, uint32_t stream_id,
+                           absl::string_view payload);
+  void ProcessHeaderBlock();
+  void ProcessRstStream(uint32_t stream_id, absl::string_view payload);
+  void ProcessSettings(uint8_t flags, uint32_t stream_id,
+                       absl::string_view payload);
+  void ProcessPing(uint8_t flags, uint32_t stream_id,
+                   absl::string_view payload);
+  void ProcessGoAway(uint32_t stream_id);
+  void ProcessWindowUpdate(uint32_t stream_id, absl::string_view payload);
+
+  // Fills the request of a new stream from its header fields. Returns false
+  // if the request is malformed.
+  bool ParseRequestHeaders(HpackHeaders* fields, Request* request);
+
+  // Reports the request of a stream whose END_STREAM has been received.
+  void OnRemoteClosed(uint32_t stream_id, Stream* stream);
+
+  // Sends what the flow control allows of the pending bodies.
+  void SendPendingData();
+  // Same for one stream, which is closed once its body is sent.
+  void SendPendingStreamData(std::map<uint32_t, Stream>::iterator it);
+
+  // Closes the stream if both of its sides are.
+  void MaybeCloseStream(std::map<uint32_t, Stream>::iterator it);
+  // Closes the stream before its response is sent, telling the visitor if
+  // the request has been reported.
+  void ResetStream(std::map<uint32_t, Stream>::iterator it);
+  // Forgets the stream, and the bytes of its body that are still pending.
+  void EraseStream(std::map<uint32_t, Stream>::iterator it);
+
+  // Sends a GOAWAY with `error_code`, after which nothing is received.
+  void ConnectionError(ErrorCode error_code);
+  // Resets a stream after an error of the client, telling the visitor if
+  // the request has been reported.
+  void StreamError(uint32_t stream_id, ErrorCode error_code);
+
+  void WriteFrameHeader(uint32_t length, uint8_t type, uint8_t flags,
+                        uint32_t stream_id);
+  void WriteWindowUpdate(uint32_t stream_id, uint32_t increment);
+  void WriteGoAway(ErrorCode error_code);
+
+  const Options options_;
+  Visitor* const visitor_;
+
+  HpackDecoder hpack_decoder_;
+
+  // The received bytes that are not processed yet.
+  std::string input_;
+  bool preface_received_ = false;
+  // Set after a connection error.
+  bool failed_ = false;
+  std::string output_;
+
+  // The open streams, by id.
+  std::map<uint32_t, Stream> streams_;
+  // The reported requests whose stream was reset, until released by the
+  // visitor.
+  std::set<uint32_t> reset_requests_;
+  // The reported requests reset by the client, less the responses sent.
+  int reset_score_ = 0;
+  // The bytes of `pending_data` of the streams which are not sent yet.
+  size_t pending_bytes_ = 0;
+  // The highest stream id opened by the client.
+  uint32_t last_stream_id_ = 0;
+  int num_requests_ = 0;
+  bool goaway_sent_ = false;
+  bool goaway_received_ = false;
+
+  // The header block being received in CONTINUATION frames, if any.
+  uint32_t header_block_stream_id_ = 0;
+  bool header_block_end_stream_ = false;
+  std::string header_block_;
+
+  // The settings of the client.
+  uint32_t peer_initial_window_size_ = 65535;
+  uint32_t peer_max_frame_size_ = 16384;
+
+  // The bytes the connection may send, and the bytes it received since the
+  // last WINDOW_UPDATE.
+  int64_t send_window_ = 65535;
+  int64_t received_bytes_ = 0;
+};
+
+}  // namespace net_http
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_UTIL_NET_HTTP_SERVER_INTERNAL_HTTP2_SESSION_H_
@@ -0,0 +1,568 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/net_http/server/internal/http2_session.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "absl/memory/memory.h"
+
+namespace tensorflow {
+namespace serving {
+namespace net_http {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Pair;
+
+constexpr char kPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+enum FrameType : uint8_t {
+  kData = 0x0,
+  kHeaders = 0x1,
+  kRstStream = 0x3,
+  kSettings = 0x4,
+  kPing = 0x6,
+  kGoAway = 0x7,
+  kWindowUpdate = 0x8,
+  kContinuation = 0x9,
+};
+
+struct Frame {
+  uint8_t type;
+  uint8_t flags;
+  uint32_t stream_id;
+  std::string payload;
+};
+
+uint32_t ReadUint32(absl::string_view data) {
+  return (static_cast<uint8_t>(data[0]) << 24) |
+         (static_cast<uint8_t>(data[1]) << 16) |
+         (static_cast<uint8_t>(data[2]) << 8) | static_cast<uint8_t>(data[3]);
+}
+
+std::string Uint32(uint32_t value) {
+  return std::string({static_cast<char>(value >> 24),
+                      static_cast<char>(value >> 16),
+                      static_cast<char>(value >> 8), static_cast<char>(value)});
+}
+
+std::string MakeFrame(uint8_t type, uint8_t flags, uint32_t stream_id,
+                      absl::string_view payload) {
+  std::string frame = Uint32(payload.size() << 8).substr(0, 3);
+  frame.push_back(static_cast<char>(type));
+  frame.push_back(static_cast<char>(flags));
+  frame += Uint32(stream_id);
+  frame.append(payload.data(), payload.size());
+  return frame;
+}
+
+std::string MakeHeaderBlock(const HpackHeaders& headers) {
+  std::string block;
+  for (const auto& header : headers) {
+    HpackEncodeHeader(header.first, header.second, &block);
+  }
+  return block;
+}
+
+std::string GetRequestBlock(absl::string_view method, absl::string_view path) {
+  return MakeHeaderBlock({{":method", std::string(method)},
+                          {":scheme", "http"},
+                          {":authority", "localhost"},
+                          {":path", std::string(path)}});
+}
+
+class Http2SessionTest : public ::testing::Test,
+                         public Http2Session::Visitor {
+ protected:
+  void SetUp() override { CreateSession(Http2Session::Options()); }
+
+  void CreateSession(const Http2Session::Options& options) {
+    session_ = absl::make_unique<Http2Session>(options, this);
+    std::vector<Frame> frames = TakeFrames();
+    // The SETTINGS, then the WINDOW_UPDATE of the connection.
+    ASSERT_EQ(frames.size(), 2);
+    EXPECT_EQ(frames[0].type, kSettings);
+    EXPECT_EQ(frames[1].type, kWindowUpdate);
+
+    ASSERT_TRUE(session_->Receive(kPreface));
+    ASSERT_TRUE(session_->Receive(MakeFrame(kSettings, 0, 0, "")));
+    frames = TakeFrames();
+    ASSERT_EQ(frames.size(), 1);
+    EXPECT_EQ(frames[0].type, kSettings);
+    EXPECT_EQ(frames[0].flags, 0x1);
+  }
+
+  void OnRequest(std::unique_ptr<Http2Session::Request> request) override {
+    requests_.push_back(std::move(request));
+  }
+
+  bool OnStreamReset(uint32_t stream_id) override {
+    reset_streams_.push_back(stream_id);
+    return true;
+  }
+
+  // Parses the output of the session, which is then cleared.
+  std::vector<Frame> TakeFrames() {
+    std::vector<Frame> frames;
+    absl::string_view output = *session_->output();
+    while (output.size() >= 9) {
+      const uint32_t length = ReadUint32(output) >> 8;
+      frames.push_back({static_cast<uint8_t>(output[3]),
+                        static_cast<uint8_t>(output[4]),
+                        ReadUint32(output.substr(5)),
+                        std::string(output.substr(9, length))});
+      output.remove_prefix(9 + length);
+    }
+    EXPECT_TRUE(output.empty());
+    session_->output()->clear();
+    return frames;
+  }
+
+  std::unique_ptr<Http2Session> session_;
+  std::vector<std::unique_ptr<Http2Session::Request>> requests_;
+  std::vector<uint32_t> reset_streams_;
+};
+
+TEST_F(Http2SessionTest, Get) {
+  std::string block = MakeHeaderBlock({{":method", "GET"},
+                                       {":scheme", "http"},
+                                       {":authority", "localhost:8080"},
+                                       {":path", "/v1/models/m?a=b"},
+                                       {"accept", "*/*"}});
+  ASSERT_TRUE(session_->Receive(MakeFrame(kHeaders, 0x5, 1, block)));
+  ASSERT_EQ(requests_.size(), 1);
+  const Http2Session::Request& request = *requests_[0];
+  EXPECT_EQ(request.stream_id, 1);
+  EXPECT_EQ(request.method, "GET");
+  EXPECT_EQ(request.scheme, "http");
+  EXPECT_EQ(request.authority, "localhost:8080");
+  EXPECT_EQ(request.path, "/v1/models/m?a=b");
+  EXPECT_THAT(request.headers, ElementsAre(Pair("accept", "*/*")));
+  EXPECT_EQ(request.body, "");
+  EXPECT_EQ(session_->num_open_streams(), 1);
+
+  session_->SubmitHeaders(1, 200,
+                          {{"Content-Type", "application/json"},
+                           {"Connection", "close"}},
+                          false);
+  session_->SubmitData(1, "{}", true);
+  std::vector<Frame> frames = TakeFrames();
+  ASSERT_EQ(frames.size(), 2);
+  EXPECT_EQ(frames[0].type, kHeaders);
+  EXPECT_EQ(frames[0].flags, 0x4);
+  EXPECT_EQ(frames[0].stream_id, 1);
+  HpackDecoder decoder;
+  HpackHeaders headers;
+  ASSERT_TRUE(decoder.Decode(frames[0].payload, 1 << 20, &headers));
+  // The connection-specific headers are dropped.
+  EXPECT_THAT(headers, ElementsAre(Pair(":status", "200"),
+                                   Pair("content-type", "application/json")));
+  EXPECT_EQ(frames[1].type, kData);
+  EXPECT_EQ(frames[1].flags, 0x1);
+  EXPECT_EQ(frames[1].payload, "{}");
+  EXPECT_EQ(session_->num_open_streams(), 0);
+  EXPECT_FALSE(session_->done());
+}
+
+TEST_F(Http2SessionTest, PostWithBody) {
+  ASSERT_TRUE(session_->Receive(
+      MakeFrame(kHeaders, 0x4, 1, GetRequestBlock("POST", "/predict"))));
+  // Padded, with a pad length of 3.
+  ASSERT_TRUE(
+      session_->Receive(MakeFrame(kData, 0x8, 1, std::string("\x03", 1) +
+                                                     "abc" +
+                                                     std::string(3, '\0'))));
+  EXPECT_TRUE(requests_.empty());
+  // Received in pieces.
+  const std::string frame = MakeFrame(kData, 0x1, 1, "def");
+  ASSERT_TRUE(session_->Receive(frame.substr(0, 5)));
+  ASSERT_TRUE(session_->Receive(frame.substr(5)));
+  ASSERT_EQ(requests_.size(), 1);
+  EXPECT_EQ(requests_[0]->method, "POST");
+  EXPECT_EQ(requests_[0]->body, "abcdef");
+}
+
+TEST_F(Http2SessionTest, Continuation) {
+  const std::string block = GetRequestBlock("GET", "/a");
+  ASSERT_TRUE(
+      session_->Receive(MakeFrame(kHeaders, 0x1, 1, block.substr(0, 10))));
+  ASSERT_TRUE(
+      session_->Receive(MakeFrame(kContinuation, 0x4, 1, block.substr(10))));
+  ASSERT_EQ(requests_.size(), 1);
+  EXPECT_EQ(requests_[0]->path, "/a");
+}
+
+TEST_F(Http2SessionTest, InterleavedContinuation) {
+  const std::string block = GetRequestBlock("GET", "/a");
+  ASSERT_TRUE(
+      session_->Receive(MakeFrame(kHeaders, 0x1, 1, block.substr(0, 10))));
+  EXPECT_FALSE(session_->Receive(MakeFrame(kPing, 0, 0, std::string(8, 'a'))));
+  std::vector<Frame> frames = TakeFrames();
+  ASSERT_EQ(frames.size(), 1);
+  EXPECT_EQ(frames[0].type, kGoAway);
+  EXPECT_EQ(ReadUint32(frames[0].payload.substr(4)),
+            Http2Session::kProtocolError);
+  EXPECT_TRUE(session_->done());
+}
+
+TEST_F(Http2SessionTest, InvalidPreface) {
+  session_ = absl::make_unique<Http2Session>(Http2Session::Options(), this);
+  TakeFrames();
+  EXPECT_FALSE(session_->Receive("GET / HTTP/1.1\r\n\r\n"));
+  std::vector<Frame> frames = TakeFrames();
+  ASSERT_EQ(frames.size(), 1);
+  EXPECT_EQ(frames[0].type, kGoAway);
+  EXPECT_TRUE(session_->done());
+}
+
+TEST_F(Http2SessionTest, MalformedRequests) {
+  const std::vector<HpackHeaders> kHeaderLists = {
+      // No :path.
+      {{":method", "GET"}, {":scheme", "http"}},
+      // An uppercase name.
+      {{":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {"A", "b"}},
+      // A connection-specific header.
+      {{":method", "GET"},
+       {":scheme", "http"},
+       {":path", "/"},
+       {"connection", "keep-alive"}},
+      // A pseudo-header after a regular one.
+      {{":method", "GET"}, {":scheme", "http"}, {"a", "b"}, {":path", "/"}},
+      // A duplicated pseudo-header.
+      {{":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":path", "/"}},
+  };
+  uint32_t stream_id = 1;
+  for (const auto& headers : kHeaderLists) {
+    ASSERT_TRUE(session_->Receive(
+        MakeFrame(kHeaders, 0x5, stream_id, MakeHeaderBlock(headers))));
+    std::vector<Frame> frames = TakeFrames();
+    ASSERT_EQ(frames.size(), 1);
+    EXPECT_EQ(frames[0].type, kRstStream);
+    EXPECT_EQ(frames[0].stream_id, stream_id);
+    EXPECT_EQ(ReadUint32(frames[0].payload), Http2Session::kProtocolError);
+    stream_id += 2;
+  }
+  EXPECT_TRUE(requests_.empty());
+  EXPECT_TRUE(reset_streams_.empty());
+}
+
+TEST_F(Http2SessionTest, ContentLengthMismatch) {
+  const std::string block = GetRequestBlock("POST", "/") +
+                            MakeHeaderBlock({{"content-length", "4"}});
+  ASSERT_TRUE(session_->Receive(MakeFrame(kHeaders, 0x4, 1, block)));
+  ASSERT_TRUE(session_->Receive(MakeFrame(kData, 0x1, 1, "abc")));
+  EXPECT_TRUE(requests_.empty());
+  std::vector<Frame> frames = TakeFrames();
+  ASSERT_EQ(frames.size(), 1);
+  EXPECT_EQ(frames[0].type, kRstStream);
+}
+
+TEST_F(Http2SessionTest, MaxConcurrentStreams) {
+  Http2Session::Options options;
+  options.max_concurrent_streams = 1;
+  CreateSession(options);
+
+  ASSERT_TRUE(session_->Receive(
+      MakeFrame(kHeaders, 0x5, 1, GetRequestBlock("GET", "/"))));
+  ASSERT_TRUE(session_->Receive(
+      MakeFrame(kHeaders, 0x5, 3, GetRequestBlock("GET", "/"))));
+  std::vector<Frame> frames = TakeFrames();
+  ASSERT_EQ(frames.size(), 1);
+  EXPECT_EQ(frames[0].type, kRstStream);
+  EXPECT_EQ(frames[0].stream_id, 3);
+  EXPECT_EQ(ReadUint32(frames[0].payload), Http2Session::kRefusedStream);
+
+  // Accepted once the first one is closed.
+  session_->SubmitHeaders(1, 204, {}, true);
+  ASSERT_TRUE(session_->Receive(
+      MakeFrame(kHeaders, 0x5, 5, GetRequestBlock("GET", "/"))));
+  EXPECT_EQ(requests_.size(), 2);
+}
+
+TEST_F(Http2SessionTest, MaxConcurrentStreamsCountsResetRequests) {
+  Http2Session::Options options;
+  options.max_concurrent_streams = 1;
+  CreateSession(options);
+
+  ASSERT_TRUE(session_->Receive(
+      MakeFrame(kHeaders, 0x5, 1, GetRequestBlock("GET", "/"))));
+  ASSERT_TRUE(session_->Receive(MakeFrame(kRstStream, 0, 1, Uint32(0x8))));
+  EXPECT_EQ(session_->num_open_streams(), 0);
+  // The handler of the first one still runs.
+  ASSERT_TRUE(session_->Receive(
+      MakeFrame(kHeaders, 0x5, 3, GetRequestBlock("GET", "/"))));
+  std::vector<Frame> frames = TakeFrames();
+  ASSERT_EQ(frames.size(), 1);
+  EXPECT_EQ(frames[0].type, kRstStream);
+  EXPECT_EQ(frames[0].stream_id, 3);
+  EXPECT_EQ(ReadUint32(frames[0].payload), Http2Session::kRefusedStream);
+  EXPECT_EQ(requests_.size(), 1);
+
+  session_->ReleaseRequest(1);
+  ASSERT_TRUE(session_->Receive(
+      MakeFrame(kHeaders, 0x5, 5, GetRequestBlock("GET", "/"))));
+  EXPECT_EQ(requests_.size(), 2);
+}
+
+TEST_F(Http2SessionTest, RapidReset) {
+  Http2Session::Options options;
+  options.max_reset_requests = 2;
+  CreateSession(options);
+
+  uint32_t stream_id = 1;
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_TRUE(session_->Receive(
+        MakeFrame(kHeaders, 0x5, stream_id, GetRequestBlock("GET", "/"))));
+    ASSERT_TRUE(
+        session_->Receive(MakeFrame(kRstStream, 0, stream_id, Uint32(0x8))));
+    session_->ReleaseRequest(stream_id);
+    stream_id += 2;
+  }
+  // A response sent makes up for a reset.
+  ASSERT_TRUE(session_->Receive(
+      MakeFrame(kHeaders, 0x5, stream_id, GetRequestBlock("GET", "/"))));
+  session_->SubmitHeaders(stream_id, 204, {}, true);
+  stream_id += 2;
+  ASSERT_TRUE(session_->Receive(
+      MakeFrame(kHeaders, 0x5, stream_id, GetRequestBlock("GET", "/"))));
+  ASSERT_TRUE(
+      session_->Receive(MakeFrame(kRstStream, 0, stream_id, Uint32(0x8))));
+  TakeFrames();
+
+  stream_id += 2;
+  ASSERT_TRUE(session_->Receive(
+      MakeFrame(kHeaders, 0x5, stream_id, GetRequestBlock("GET", "/"))));
+  EXPECT_FALSE(
+      session_->Receive(MakeFrame(kRstStream, 0, stream_id, Uint32(0x8))));
+  std::vector<Frame> frames = TakeFrames();
+  ASSERT_EQ(frames.size(), 1);
+  EXPECT_EQ(frames[0].type, kGoAway);
+  EXPECT_EQ(ReadUint32(frames[0].payload.substr(4)),
+            Http2Session::kEnhanceYourCalm);
+}
+
+TEST_F(Http2SessionTest, StreamIds) {
+  ASSERT_TRUE(session_->Receive(
+      MakeFrame(kHeaders, 0x5, 3, GetRequestBlock("GET", "/"))));
+  // Lower than the last one.
+  EXPECT_FALSE(session_->Receive(
+      MakeFrame(kHeaders, 0x5, 1, GetRequestBlock("GET", "/"))));
+  EXPECT_TRUE(session_->done());
+}
+
+TEST_F(Http2SessionTest, StreamResetByClient) {
+  ASSERT_TRUE(session_->Receive(
+      MakeFrame(kHeaders, 0x5, 1, GetRequestBlock("GET", "/"))));
+  ASSERT_TRUE(
+      session_->Receive(MakeFrame(kRstStream, 0, 1, Uint32(0x8))));
+  EXPECT_THAT(reset_streams_, ElementsAre(1));
+  EXPECT_EQ(session_->num_open_streams(), 0);
+
+  // The response is dropped.
+  session_->SubmitHeaders(1, 200, {}, false);
+  session_->SubmitData(1, "abc", true);
+  EXPECT_TRUE(TakeFrames().empty());
+}
+
+TEST_F(Http2SessionTest, ResponseFlowControl) {
+  ASSERT_TRUE(session_->Receive(
+      MakeFrame(kHeaders, 0x5, 1, GetRequestBlock("GET", "/"))));
+  session_->SubmitHeaders(1, 200, {}, false);
+  session_->SubmitData(1, std::string(100000, 'a'), true);
+
+  // Up to the default window, in frames of the default max size.
+  std::vector<Frame> frames = TakeFrames();
+  ASSERT_EQ(frames.size(), 5);
+  size_t sent = 0;
+  for (int i = 1; i < frames.size(); ++i) {
+    EXPECT_EQ(frames[i].type, kData);
+    EXPECT_EQ(frames[i].flags, 0);
+    EXPECT_LE(frames[i].payload.size(), 16384);
+    sent += frames[i].payload.size();
+  }
+  EXPECT_EQ(sent, 65535);
+
+  // The window of the stream, then of the connection.
+  ASSERT_TRUE(
+      session_->Receive(MakeFrame(kWindowUpdate, 0, 1, Uint32(1 << 20))));
+  EXPECT_TRUE(TakeFrames().empty());
+  ASSERT_TRUE(
+      session_->Receive(MakeFrame(kWindowUpdate, 0, 0, Uint32(10000))));
+  frames = TakeFrames();
+  ASSERT_EQ(frames.size(), 1);
+  EXPECT_EQ(frames[0].payload.size(), 10000);
+  EXPECT_EQ(frames[0].flags, 0);
+
+  ASSERT_TRUE(
+      session_->Receive(MakeFrame(kWindowUpdate, 0, 0, Uint32(1 << 20))));
+  frames = TakeFrames();
+  ASSERT_EQ(frames.size(), 2);
+  EXPECT_EQ(frames[0].payload.size() + frames[1].payload.size(),
+            100000 - 65535 - 10000);
+  EXPECT_EQ(frames[1].flags, 0x1);
+  EXPECT_EQ(session_->num_open_streams(), 0);
+}
+
+TEST_F(Http2SessionTest, MaxPendingBytes) {
+  Http2Session::Options options;
+  options.max_pending_bytes = 100000;
+  CreateSession(options);
+
+  ASSERT_TRUE(session_->Receive(
+      MakeFrame(kHeaders, 0x5, 1, GetRequestBlock("GET", "/"))));
+  session_->SubmitHeaders(1, 200, {}, false);
+  // Up to the default window of 65535 bytes is sent at once.
+  session_->SubmitData(1, std::string(65535 + 100000, 'a'), false);
+  TakeFrames();
+  // The client does not open its window.
+  session_->SubmitData(1, "a", true);
+  std::vector<Frame> frames = TakeFrames();
+  ASSERT_EQ(frames.size(), 1);
+  EXPECT_EQ(frames[0].type, kRstStream);
+  EXPECT_EQ(frames[0].stream_id, 1);
+  EXPECT_EQ(ReadUint32(frames[0].payload), Http2Session::kInternalError);
+  EXPECT_THAT(reset_streams_, ElementsAre(1));
+  EXPECT_EQ(session_->num_open_streams(), 0);
+
+  // The bytes of the reset stream are not pending anymore.
+  session_->ReleaseRequest(1);
+  ASSERT_TRUE(session_->Receive(
+      MakeFrame(kHeaders, 0x5, 3, GetRequestBlock("GET", "/"))));
+  session_->SubmitHeaders(3, 200, {}, false);
+  // The window of the connection is used up.
+  session_->SubmitData(3, std::string(100000, 'a'), false);
+  frames = TakeFrames();
+  ASSERT_EQ(frames.size(), 1);
+  EXPECT_EQ(frames[0].type, kHeaders);
+  EXPECT_EQ(session_->num_open_streams(), 1);
+}
+
+TEST_F(Http2SessionTest, InitialWindowSizeSetting) {
+  ASSERT_TRUE(session_->Receive(
+      MakeFrame(kHeaders, 0x5, 1, GetRequestBlock("GET", "/"))));
+  session_->SubmitHeaders(1, 200, {}, false);
+  // The client starts with closed stream windows.
+  ASSERT_TRUE(session_->Receive(MakeFrame(
+      kSettings, 0, 0, std::string("\x00\x04", 2) + Uint32(0))));
+  TakeFrames();
+  session_->SubmitData(1, "abc", true);
+  EXPECT_TRUE(TakeFrames().empty());
+
+  ASSERT_TRUE(session_->Receive(MakeFrame(
+      kSettings, 0, 0, std::string("\x00\x04", 2) + Uint32(100))));
+  std::vector<Frame> frames = TakeFrames();
+  ASSERT_EQ(frames.size(), 2);
+  EXPECT_EQ(frames[0].type, kSettings);
+  EXPECT_EQ(frames[1].type, kData);
+  EXPECT_EQ(frames[1].payload, "abc");
+}
+
+TEST_F(Http2SessionTest, RequestFlowControl) {
+  Http2Session::Options options;
+  options.initial_window_size = 100;
+  session_ = absl::make_unique<Http2Session>(options, this);
+  ASSERT_TRUE(session_->Receive(kPreface));
+  ASSERT_TRUE(session_->Receive(
+      MakeFrame(kHeaders, 0x4, 1, GetRequestBlock("POST", "/"))));
+  TakeFrames();
+
+  // Replenished at half the window of the stream, that of the connection
+  // being the default one.
+  ASSERT_TRUE(session_->Receive(MakeFrame(kData, 0, 1, std::string(60, 'a'))));
+  std::vector<Frame> frames = TakeFrames();
+  ASSERT_EQ(frames.size(), 1);
+  EXPECT_EQ(frames[0].type, kWindowUpdate);
+  EXPECT_EQ(frames[0].stream_id, 1);
+  EXPECT_EQ(ReadUint32(frames[0].payload), 60);
+
+  // Beyond the window of the stream.
+  ASSERT_TRUE(
+      session_->Receive(MakeFrame(kData, 0, 1, std::string(101, 'a'))));
+  frames = TakeFrames();
+  ASSERT_EQ(frames.size(), 1);
+  EXPECT_EQ(frames[0].type, kRstStream);
+  EXPECT_EQ(ReadUint32(frames[0].payload), Http2Session::kFlowControlError);
+
+  // The frames in flight of the reset stream are ignored.
+  ASSERT_TRUE(session_->Receive(MakeFrame(kData, 0x1, 1, "abc")));
+  EXPECT_TRUE(TakeFrames().empty());
+  EXPECT_TRUE(requests_.empty());
+}
+
+TEST_F(Http2SessionTest, Ping) {
+  ASSERT_TRUE(session_->Receive(MakeFrame(kPing, 0, 0, "abcdefgh")));
+  std::vector<Frame> frames = TakeFrames();
+  ASSERT_EQ(frames.size(), 1);
+  EXPECT_EQ(frames[0].type, kPing);
+  EXPECT_EQ(frames[0].flags, 0x1);
+  EXPECT_EQ(frames[0].payload, "abcdefgh");
+
+  // Acks are not answered.
+  ASSERT_TRUE(session_->Receive(MakeFrame(kPing, 0x1, 0, "abcdefgh")));
+  EXPECT_TRUE(TakeFrames().empty());
+}
+
+TEST_F(Http2SessionTest, MaxRequests) {
+  Http2Session::Options options;
+  options.max_requests = 1;
+  CreateSession(options);
+
+  ASSERT_TRUE(session_->Receive(
+      MakeFrame(kHeaders, 0x5, 1, GetRequestBlock("GET", "/"))));
+  std::vector<Frame> frames = TakeFrames();
+  ASSERT_EQ(frames.size(), 1);
+  EXPECT_EQ(frames[0].type, kGoAway);
+  EXPECT_EQ(ReadUint32(frames[0].payload), 1);
+  EXPECT_EQ(ReadUint32(frames[0].payload.substr(4)), Http2Session::kNoError);
+  EXPECT_FALSE(session_->done());
+
+  // Streams beyond the GOAWAY are ignored.
+  ASSERT_TRUE(session_->Receive(
+      MakeFrame(kHeaders, 0x5, 3, GetRequestBlock("GET", "/"))));
+  EXPECT_EQ(requests_.size(), 1);
+
+  session_->SubmitHeaders(1, 200, {}, true);
+  EXPECT_TRUE(session_->done());
+}
+
+TEST_F(Http2SessionTest, LargeResponseHeaders) {
+  ASSERT_TRUE(session_->Receive(
+      MakeFrame(kHeaders, 0x5, 1, GetRequestBlock("GET", "/"))));
+  session_->SubmitHeaders(1, 200, {{"x-large", std::string(20000, 'a')}},
+                          true);
+  std::vector<Frame> frames = TakeFrames();
+  ASSERT_EQ(frames.size(), 2);
+  EXPECT_EQ(frames[0].type, kHeaders);
+  EXPECT_EQ(frames[0].flags, 0x1);
+  EXPECT_EQ(frames[1].type, kContinuation);
+  EXPECT_EQ(frames[1].flags, 0x4);
+
+  HpackDecoder decoder;
+  HpackHeaders headers;
+  ASSERT_TRUE(decoder.Decode(frames[0].payload + frames[1].payload, 1 << 20,
+                             &headers));
+  EXPECT_THAT(headers, ElementsAre(Pair(":status", "200"),
+                                   Pair("x-large", std::string(20000, 'a'))));
+}
+
+}  // namespace
+}  // namespace net_http
+}  // namespace serving
+}  // namespace tensorflow
@@ -22,6 +22,8 @@ limitations under the License.
 
 #include <functional>
 #include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "absl/strings/string_view.h"
@@ -45,10 +47,38 @@ class EventExecutor {
   // Must be non-blocking
   virtual void Schedule(std::function<void()> fn) = 0;
 
+  // Schedules a request handler with the priority of its handler options, see
+  // RequestHandlerOptions::set_priority(). Must be non-blocking. By default
+  // the priority is ignored.
+  virtual void ScheduleWithPriority(std::function<void()> fn, int priority) {
+    Schedule(std::move(fn));
+  }
+
  protected:
   EventExecutor() = default;
 };
 
+// Receives the connection events of a server, e.g. to export metrics.
+// The methods are called from the event loops, so they must be cheap and
+// thread-safe.
+class ConnectionObserver {
+ public:
+  virtual ~ConnectionObserver() = default;
+
+  ConnectionObserver(const ConnectionObserver& other) = delete;
+  ConnectionObserver& operator=(const ConnectionObserver& other) = delete;
+
+  // A connection sent its first request, or an HTTP/2 connection was
+  // accepted.
+  virtual void OnConnectionOpened() = 0;
+
+  // A connection reported by OnConnectionOpened() was closed.
+  virtual void OnConnectionClosed() = 0;
+
+ protected:
+  ConnectionObserver() = default;
+};
+
 // Options to specify when a server instance is created.
 class ServerOptions {
  public:
@@ -61,19 +91,127 @@ class ServerOptions {
     ports_.emplace_back(port);
   }
 
+  // A Unix domain socket to listen on, in addition to the ports (if any), so
+  // that the clients on the same host skip the TCP/IP stack. A socket left at
+  // `path` by a previous server is replaced. The connections of the socket
+  // are handled by the first event loop.
+  void SetUnixSocketPath(absl::string_view path) {
+    unix_socket_path_ = std::string(path);
+  }
+
+  // A port that accepts HTTP/2 connections with prior knowledge (h2c, RFC
+  // 7540 section 3.4), which multiplex concurrent requests on one connection
+  // instead of pipelining them. Its requests are served by the same handlers,
+  // under the same connection limits and timeouts. Port 0 will use an
+  // ephemeral port. Unset by default.
+  void SetHttp2Port(int port) {
+    assert(port >= 0);
+    http2_port_ = port;
+  }
+
+  // The SETTINGS_MAX_CONCURRENT_STREAMS of the HTTP/2 connections: the max
+  // number of requests a client may have in flight on one connection.
+  // Defaults to 100.
+  void SetHttp2MaxConcurrentStreams(int max_streams) {
+    assert(max_streams > 0);
+    http2_max_concurrent_streams_ = max_streams;
+  }
+
   // The default executor for running I/O event polling.
   // This is a mandatory option.
   void SetExecutor(std::unique_ptr<EventExecutor> executor) {
     executor_ = std::move(executor);
   }
 
+  // The number of event loops that accept connections and do the I/O of
+  // requests, each running in a thread of the executor. With more than one
+  // loop, each listens on its own socket bound with SO_REUSEPORT, and the
+  // kernel balances new connections across them. Defaults to 1.
+  void SetNumEventLoops(int num_event_loops) {
+    assert(num_event_loops > 0);
+    num_event_loops_ = num_event_loops;
+  }
+
+  // Binds the port with SO_REUSEPORT even with a single event loop, so that
+  // a replacement server can listen on the port before this one terminates.
+  // Defaults to false.
+  void SetReusePort(bool reuse_port) { reuse_port_ = reuse_port; }
+
+  // How long an idle (keep-alive) connection is kept open, which is also the
+  // timeout for reading a request or writing a reply. Defaults to libevent's
+  // default of 50 seconds.
+  void SetConnectionTimeout(absl::Duration timeout) {
+    assert(timeout > absl::ZeroDuration());
+    connection_timeout_ = timeout;
+  }
+
+  // The max number of connections open at the same time, with connections
+  // counted from their first request (HTTP/2 ones once accepted). Once it is
+  // reached, new connections are left in the listen backlog until open ones
+  // are closed. With several event loops, the limit is split evenly across
+  // them. 0 (the default) means no limit.
+  void SetMaxConnections(int max_connections) {
+    assert(max_connections >= 0);
+    max_connections_ = max_connections;
+  }
+
+  // The max number of requests served on a connection, including pipelined
+  // ones, which are processed in order. The reply to the last one carries
+  // "Connection: close", so that clients reconnect (and get balanced across
+  // servers again); HTTP/2 connections are sent a GOAWAY instead. 0 (the
+  // default) means no limit.
+  void SetMaxRequestsPerConnection(int max_requests) {
+    assert(max_requests >= 0);
+    max_requests_per_connection_ = max_requests;
+  }
+
+  // An optional observer of the connections of the server.
+  void SetConnectionObserver(std::unique_ptr<ConnectionObserver> observer) {
+    connection_observer_ = std::move(observer);
+  }
+
   const std::vector<int>& ports() const { return ports_; }
 
+  const std::string& unix_socket_path() const { return unix_socket_path_; }
+
+  // Returns -1 if not set.
+  int http2_port() const { return http2_port_; }
+
+  int http2_max_concurrent_streams() const {
+    return http2_max_concurrent_streams_;
+  }
+
   EventExecutor* executor() const { return executor_.get(); }
 
+  int num_event_loops() const { return num_event_loops_; }
+
+  bool reuse_port() const { return reuse_port_; }
+
+  // Returns absl::InfiniteDuration() if not set.
+  absl::Duration connection_timeout() const { return connection_timeout_; }
+
+  int max_connections() const { return max_connections_; }
+
+  int max_requests_per_connection() const {
+    return max_requests_per_connection_;
+  }
+
+  ConnectionObserver* connection_observer() const {
+    return connection_observer_.get();
+  }
+
  private:
   std::vector<int> ports_;
+  std::string unix_socket_path_;
+  int http2_port_ = -1;
+  int http2_max_concurrent_streams_ = 100;
   std::unique_ptr<EventExecutor> executor_;
+  int num_event_loops_ = 1;
+  bool reuse_port_ = false;
+  absl::Duration connection_timeout_ = absl::InfiniteDuration();
+  int max_connections_ = 0;
+  int max_requests_per_connection_ = 0;
+  std::unique_ptr<ConnectionObserver> connection_observer_;
 };
 
 // Options to specify when registering a handler (given a uri pattern).
@@ -108,13 +246,66 @@ class RequestHandlerOptions {
 
   inline bool auto_uncompress_input() const { return auto_uncompress_input_; }
 
+  // The auto_compress_output option specifies whether the response body
+  // should be gzip-compressed if the request has an Accept-Encoding header
+  // that allows it. The option defaults to false.
+  inline RequestHandlerOptions& set_auto_compress_output(bool should_compress) {
+    auto_compress_output_ = should_compress;
+    return *this;
+  }
+
+  inline bool auto_compress_output() const { return auto_compress_output_; }
+
+  // Sets the min length of a response body to be compressed. Smaller bodies
+  // are sent as is, unless they are streamed with PartialReply().
+  inline RequestHandlerOptions& set_auto_compress_min_size(int64_t size) {
+    auto_compress_min_size_ = size;
+    return *this;
+  }
+
+  inline int64_t auto_compress_min_size() const {
+    return auto_compress_min_size_;
+  }
+
+  // The run_inline option specifies whether the handler runs on the event
+  // loop thread that received the request, instead of being scheduled on the
+  // executor. This saves a thread hop for handlers that are quick and never
+  // block, e.g. to report a status, but delays the I/O of all the other
+  // connections of the loop while the handler runs. The option defaults to
+  // false.
+  inline RequestHandlerOptions& set_run_inline(bool run_inline) {
+    run_inline_ = run_inline;
+    return *this;
+  }
+
+  inline bool run_inline() const { return run_inline_; }
+
+  // The priority of the handler on executors that run the handlers of higher
+  // priorities first, e.g. so that the health checks do not queue behind the
+  // heavy requests in bursts. Ignored by run_inline handlers. The priority
+  // defaults to 0.
+  inline RequestHandlerOptions& set_priority(int priority) {
+    priority_ = priority;
+    return *this;
+  }
+
+  inline int priority() const { return priority_; }
+
  private:
-  // To be added: compression, CORS rules, streaming control
-  // thread executor, admission control, limits ...
+  // To be added: CORS rules, streaming control
+  // admission control, limits ...
 
   bool auto_uncompress_input_ = true;
 
   int64_t auto_uncompress_max_size_ = 0;
+
+  bool auto_compress_output_ = false;
+
+  int64_t auto_compress_min_size_ = 1024;
+
+  bool run_inline_ = false;
+
+  int priority_ = 0;
 };
 
 // A request handler is registered by the application to handle a request
@@ -155,6 +346,10 @@ class HTTPServerInterface {
   // Returns the server listener port if any, or else returns 0.
   virtual int listen_port() const = 0;
 
+  // Returns the listener port of the HTTP/2 connections if any, see
+  // ServerOptions::SetHttp2Port(), or else returns 0.
+  virtual int http2_listen_port() const { return 0; }
+
   // Starts the server termination, and returns immediately.
   virtual void Terminate() = 0;
 
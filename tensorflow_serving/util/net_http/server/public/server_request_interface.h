@@ -101,6 +101,17 @@ class ServerRequestInterface {
   virtual std::unique_ptr<char[], BlockDeleter> ReadRequestBytes(
       int64_t* size) = 0;
 
+  // Sets `body` to a view of the entire request body, "" if there is none,
+  // for reading it in place instead of copying its chunks out with
+  // ReadRequestBytes(). A gzipped body is uncompressed as with
+  // ReadRequestBytes(). The view remains valid until the reply is sent, and
+  // the same view is returned by later calls. Do not mix with
+  // ReadRequestBytes().
+  //
+  // Returns false if not supported, in which case the body is to be read with
+  // ReadRequestBytes().
+  virtual bool GetRequestBody(absl::string_view* body) { return false; }
+
   // Returns the first value, including "", associated with a request
   // header name. The header name argument is case-insensitive.
   // Returns nullptr if the specified header doesn't exist.
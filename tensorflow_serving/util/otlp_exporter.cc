@@ -0,0 +1,416 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/otlp_exporter.h"
+
+#include <cmath>
+#include <utility>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow_serving/util/net_http/client/public/httpclient.h"
+
+namespace tensorflow {
+namespace serving {
+
+namespace {
+
+constexpr uint64 kNanosPerMilli = 1000 * 1000;
+
+// The OTLP AggregationTemporality values.
+constexpr int kDeltaTemporality = 1;
+constexpr int kCumulativeTemporality = 2;
+
+// Appends 'value' to 'json' as a JSON string.
+void AppendJsonString(const absl::string_view value, string* json) {
+  json->push_back('"');
+  for (const char c : value) {
+    switch (c) {
+      case '"':
+        json->append("\\\"");
+        break;
+      case '\\':
+        json->append("\\\\");
+        break;
+      case '\n':
+        json->append("\\n");
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          absl::StrAppend(json, "\\u00",
+                          absl::Hex(static_cast<unsigned char>(c),
+                                    absl::kZeroPad2));
+        } else {
+          json->push_back(c);
+        }
+    }
+  }
+  json->push_back('"');
+}
+
+// Appends 'value' to 'json' as a JSON number. JSON has no infinities.
+void AppendJsonDouble(const double value, string* json) {
+  absl::StrAppend(json, std::isfinite(value) ? value : 0);
+}
+
+// Appends '"attributes":[...]' of 'attributes' to 'json'.
+template <typename Attributes>
+void AppendAttributes(const Attributes& attributes, string* json) {
+  json->append("\"attributes\":[");
+  bool first = true;
+  for (const auto& attribute : attributes) {
+    if (!first) {
+      json->push_back(',');
+    }
+    first = false;
+    json->append("{\"key\":");
+    AppendJsonString(attribute.first, json);
+    json->append(",\"value\":{\"stringValue\":");
+    AppendJsonString(attribute.second, json);
+    json->append("}}");
+  }
+  json->push_back(']');
+}
+
+// Returns the key of 'point' of metric 'name' among the pushed values.
+string PointKey(const string& name, const monitoring::Point& point) {
+  string key = name;
+  for (const auto& label : point.labels) {
+    absl::StrAppend(&key, "\x1f", label.name, "=", label.value);
+  }
+  return key;
+}
+
+// Appends the start of the JSON Metric of 'descriptor' to 'metric', up to its
+// data points.
+void AppendMetricStart(const monitoring::MetricDescriptor& descriptor,
+                       const char* type, const int temporality,
+                       string* metric) {
+  metric->append("{\"name\":");
+  AppendJsonString(descriptor.name, metric);
+  metric->append(",\"description\":");
+  AppendJsonString(descriptor.description, metric);
+  absl::StrAppend(metric, ",\"", type, "\":{");
+  if (temporality != 0) {
+    absl::StrAppend(metric, "\"aggregationTemporality\":", temporality, ",");
+  }
+  if (temporality == kDeltaTemporality && absl::string_view(type) == "sum") {
+    metric->append("\"isMonotonic\":true,");
+  }
+  metric->append("\"dataPoints\":[");
+}
+
+// Appends the start of a JSON data point of 'point' to 'metric', up to its
+// value.
+void AppendPointStart(const monitoring::Point& point, const uint64 start_nanos,
+                      const uint64 time_nanos, string* metric) {
+  std::vector<std::pair<string, string>> attributes;
+  attributes.reserve(point.labels.size());
+  for (const auto& label : point.labels) {
+    attributes.emplace_back(label.name, label.value);
+  }
+  metric->push_back('{');
+  AppendAttributes(attributes, metric);
+  absl::StrAppend(metric, ",\"startTimeUnixNano\":\"", start_nanos,
+                  "\",\"timeUnixNano\":\"", time_nanos, "\"");
+}
+
+}  // namespace
+
+const char* const OtlpExporter::kOtlpMetricsPath = "/v1/metrics";
+
+OtlpExporter::OtlpExporter(const Options& options)
+    : options_(options),
+      collection_registry_(monitoring::CollectionRegistry::Default()) {}
+
+OtlpExporter::~OtlpExporter() {
+  if (push_thread_ != nullptr) {
+    // Joins the thread before the last push.
+    push_thread_.reset();
+    Push();
+  }
+}
+
+Status OtlpExporter::Start() {
+  const size_t colon = options_.endpoint.rfind(':');
+  if (colon == string::npos ||
+      !absl::SimpleAtoi(absl::string_view(options_.endpoint).substr(colon + 1),
+                        &port_)) {
+    return errors::InvalidArgument("Invalid OTLP endpoint: ",
+                                   options_.endpoint, ". Expected host:port.");
+  }
+  if (options_.push_interval_micros <= 0) {
+    return errors::InvalidArgument(
+        "The OTLP push interval must be positive");
+  }
+  if (options_.push_timeout_micros <= 0) {
+    return errors::InvalidArgument("The OTLP push timeout must be positive");
+  }
+  host_ = options_.endpoint.substr(0, colon);
+  PeriodicFunction::Options push_options;
+  push_options.thread_name_prefix = "otlp_exporter";
+  push_options.startup_delay_micros = options_.push_interval_micros;
+  push_thread_.reset(new PeriodicFunction([this] { Push(); },
+                                          options_.push_interval_micros,
+                                          push_options));
+  LOG(INFO) << "Pushing the metrics to the OTLP collector at "
+            << options_.endpoint << options_.path;
+  return Status::OK();
+}
+
+Status OtlpExporter::GenerateExportRequest(string* request) {
+  mutex_lock l(mu_);
+  PointValues values;
+  TF_RETURN_IF_ERROR(EncodeRequest(request, &values));
+  pushed_values_ = std::move(values);
+  return Status::OK();
+}
+
+void OtlpExporter::Push() {
+  mutex_lock push_lock(push_mu_);
+  string request;
+  PointValues values;
+  {
+    mutex_lock l(mu_);
+    const Status status = EncodeRequest(&request, &values);
+    if (!status.ok()) {
+      LOG(WARNING) << "Cannot generate the OTLP export request: " << status;
+      return;
+    }
+  }
+  if (client_ == nullptr) {
+    client_ = net_http::CreateEvHTTPConnection(
+        host_, port_, absl::Microseconds(options_.push_timeout_micros));
+    if (client_ == nullptr) {
+      LOG(WARNING) << "Cannot connect to the OTLP collector at "
+                   << options_.endpoint;
+      return;
+    }
+  }
+  net_http::ClientRequest http_request = {
+      options_.path, "POST", {{"Content-Type", "application/json"}}, request};
+  net_http::ClientResponse http_response;
+  // Note: The status is not set if the connection failed.
+  if (!client_->BlockingSendRequest(http_request, &http_response) ||
+      http_response.status == net_http::HTTPStatusCode::UNDEFINED) {
+    LOG(WARNING) << "Cannot push the metrics to the OTLP collector at "
+                 << options_.endpoint;
+    client_.reset();
+    return;
+  }
+  const int http_status = static_cast<int>(http_response.status);
+  if (http_status != 200) {
+    LOG(WARNING) << "The OTLP collector at " << options_.endpoint
+                 << " rejected the metrics with HTTP status " << http_status
+                 << ": " << http_response.body;
+    // Only the throttled and unavailable pushes are retried, as the OTLP
+    // specification recommends, and the rejected changes are dropped.
+    if (http_status == 429 || http_status == 502 || http_status == 503 ||
+        http_status == 504) {
+      return;
+    }
+  }
+  mutex_lock l(mu_);
+  pushed_values_ = std::move(values);
+}
+
+Status OtlpExporter::EncodeRequest(string* request, PointValues* values) {
+  monitoring::CollectionRegistry::CollectMetricsOptions collect_options;
+  collect_options.collect_metric_descriptors = true;
+  const std::unique_ptr<monitoring::CollectedMetrics> collected_metrics =
+      collection_registry_->CollectMetrics(collect_options);
+
+  const auto& descriptor_map = collected_metrics->metric_descriptor_map;
+  const auto& metric_map = collected_metrics->point_set_map;
+
+  string json;
+  json.reserve(last_request_size_ + last_request_size_ / 8);
+  json.append("{\"resourceMetrics\":[{\"resource\":{");
+  AppendAttributes(options_.resource_attributes, &json);
+  json.append(
+      "},\"scopeMetrics\":[{\"scope\":{\"name\":\"tensorflow_serving\"},"
+      "\"metrics\":[");
+  string metric;
+  bool first = true;
+  for (const auto& name_and_metric_descriptor : descriptor_map) {
+    auto metric_iterator = metric_map.find(name_and_metric_descriptor.first);
+    if (metric_iterator == metric_map.end()) {
+      continue;
+    }
+    const monitoring::MetricDescriptor& metric_descriptor =
+        *name_and_metric_descriptor.second;
+    metric.clear();
+    int num_points = 0;
+    if (metric_descriptor.value_type == monitoring::ValueType::kHistogram) {
+      num_points = AppendHistogramPoints(
+          metric_descriptor, *metric_iterator->second, values, &metric);
+    } else if (metric_descriptor.value_type ==
+                   monitoring::ValueType::kInt64 ||
+               metric_descriptor.value_type ==
+                   monitoring::ValueType::kDouble ||
+               metric_descriptor.value_type == monitoring::ValueType::kBool) {
+      num_points = AppendScalarPoints(
+          metric_descriptor, *metric_iterator->second, values, &metric);
+    }
+    // The unchanged metrics, and the string and percentiles metrics, are not
+    // pushed.
+    if (num_points == 0) {
+      continue;
+    }
+    if (!first) {
+      json.push_back(',');
+    }
+    first = false;
+    json.append(metric);
+  }
+  json.append("]}]}]}");
+  last_request_size_ = json.size();
+  *request = std::move(json);
+  return Status::OK();
+}
+
+int OtlpExporter::AppendScalarPoints(
+    const monitoring::MetricDescriptor& descriptor,
+    const monitoring::PointSet& point_set, PointValues* values,
+    string* metric) {
+  const monitoring::ValueType value_type = descriptor.value_type;
+  // Note: Only the counters, of int64 values, are cumulative.
+  const bool is_delta =
+      value_type == monitoring::ValueType::kInt64 &&
+      descriptor.metric_kind == monitoring::MetricKind::kCumulative;
+  if (is_delta) {
+    AppendMetricStart(descriptor, "sum", kDeltaTemporality, metric);
+  } else {
+    AppendMetricStart(descriptor, "gauge", 0, metric);
+  }
+  int num_points = 0;
+  for (const auto& point : point_set.points) {
+    uint64 start_nanos = point->start_timestamp_millis * kNanosPerMilli;
+    const uint64 time_nanos = point->end_timestamp_millis * kNanosPerMilli;
+    int64 value = value_type == monitoring::ValueType::kBool
+                      ? static_cast<int64>(point->bool_value)
+                      : point->int64_value;
+    if (is_delta) {
+      const string key = PointKey(descriptor.name, *point);
+      PointValue& point_value = (*values)[key];
+      point_value.int64_value = value;
+      point_value.time_nanos = time_nanos;
+      // A smaller value means the counter was reset.
+      auto pushed_it = pushed_values_.find(key);
+      if (pushed_it != pushed_values_.end() &&
+          pushed_it->second.int64_value <= value) {
+        value -= pushed_it->second.int64_value;
+        start_nanos = pushed_it->second.time_nanos;
+      }
+      if (value == 0) {
+        continue;
+      }
+    }
+    if (num_points++ > 0) {
+      metric->push_back(',');
+    }
+    AppendPointStart(*point, start_nanos, time_nanos, metric);
+    if (value_type == monitoring::ValueType::kDouble) {
+      metric->append(",\"asDouble\":");
+      AppendJsonDouble(point->double_value, metric);
+      metric->push_back('}');
+    } else {
+      absl::StrAppend(metric, ",\"asInt\":\"", value, "\"}");
+    }
+  }
+  metric->append("]}}");
+  return num_points;
+}
+
+int OtlpExporter::AppendHistogramPoints(
+    const monitoring::MetricDescriptor& descriptor,
+    const monitoring::PointSet& point_set, PointValues* values,
+    string* metric) {
+  const bool is_delta =
+      descriptor.metric_kind == monitoring::MetricKind::kCumulative;
+  AppendMetricStart(descriptor, "histogram",
+                    is_delta ? kDeltaTemporality : kCumulativeTemporality,
+                    metric);
+  int num_points = 0;
+  for (const auto& point : point_set.points) {
+    uint64 start_nanos = point->start_timestamp_millis * kNanosPerMilli;
+    const uint64 time_nanos = point->end_timestamp_millis * kNanosPerMilli;
+    const HistogramProto& histogram = point->histogram_value;
+    std::vector<double> bucket_counts(histogram.bucket().begin(),
+                                      histogram.bucket().end());
+    double sum = histogram.sum();
+    if (is_delta) {
+      const string key = PointKey(descriptor.name, *point);
+      PointValue& point_value = (*values)[key];
+      point_value.bucket_counts = bucket_counts;
+      point_value.sum = sum;
+      point_value.time_nanos = time_nanos;
+      // Smaller bucket counts mean the histogram was reset.
+      auto pushed_it = pushed_values_.find(key);
+      if (pushed_it != pushed_values_.end() &&
+          pushed_it->second.bucket_counts.size() == bucket_counts.size()) {
+        const PointValue& pushed = pushed_it->second;
+        const int num_buckets = bucket_counts.size();
+        bool reset = false;
+        for (int i = 0; i < num_buckets; ++i) {
+          reset |= bucket_counts[i] < pushed.bucket_counts[i];
+        }
+        if (!reset) {
+          for (int i = 0; i < num_buckets; ++i) {
+            bucket_counts[i] -= pushed.bucket_counts[i];
+          }
+          sum -= pushed.sum;
+          start_nanos = pushed.time_nanos;
+        }
+      }
+    }
+    uint64 count = 0;
+    for (const double bucket_count : bucket_counts) {
+      count += static_cast<uint64>(bucket_count);
+    }
+    if (is_delta && count == 0) {
+      continue;
+    }
+    if (num_points++ > 0) {
+      metric->push_back(',');
+    }
+    AppendPointStart(*point, start_nanos, time_nanos, metric);
+    absl::StrAppend(metric, ",\"count\":\"", count, "\",\"sum\":");
+    AppendJsonDouble(sum, metric);
+    metric->append(",\"bucketCounts\":[");
+    for (size_t i = 0; i < bucket_counts.size(); ++i) {
+      absl::StrAppend(metric, i > 0 ? "," : "", "\"",
+                      static_cast<uint64>(bucket_counts[i]), "\"");
+    }
+    // The last bucket of the registry is unbounded.
+    metric->append("],\"explicitBounds\":[");
+    for (int i = 0; i + 1 < histogram.bucket_limit_size(); ++i) {
+      if (i > 0) {
+        metric->push_back(',');
+      }
+      AppendJsonDouble(histogram.bucket_limit(i), metric);
+    }
+    metric->append("]}");
+  }
+  metric->append("]}}");
+  return num_points;
+}
+
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,136 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_UTIL_OTLP_EXPORTER_H_
+#define TENSORFLOW_SERVING_UTIL_OTLP_EXPORTER_H_
+
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "tensorflow/core/kernels/batching_util/periodic_function.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/monitoring/collected_metrics.h"
+#include "tensorflow/core/lib/monitoring/collection_registry.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow_serving/util/net_http/client/public/httpclient_interface.h"
+
+namespace tensorflow {
+namespace serving {
+
+// Pushes the metrics of the monitoring registry to an OpenTelemetry
+// collector from a background thread, as OTLP/HTTP export requests in the
+// JSON encoding.
+//
+// The cumulative metrics are pushed as their changes since the previous push
+// (the delta aggregation temporality), so the unchanged points are not sent
+// and the collector keeps no state per server. The gauges (int64, double or
+// bool) are pushed as is. The histograms are pushed with the buckets
+// aggregated by the server.
+//
+// This class is thread-safe.
+class OtlpExporter {
+ public:
+  // Default path of the OTLP/HTTP metrics receiver.
+  static const char* const kOtlpMetricsPath;
+
+  struct Options {
+    // host:port of the OTLP/HTTP receiver of the collector.
+    string endpoint = "localhost:4318";
+    string path = kOtlpMetricsPath;
+    int64 push_interval_micros = 60 * 1000 * 1000;
+    // The timeout of a push. A push that times out is retried with the next
+    // one. Also bounds the last push, by the destructor.
+    int64 push_timeout_micros = 10 * 1000 * 1000;
+    // The attributes of the resource of the metrics, e.g. service.name.
+    std::vector<std::pair<string, string>> resource_attributes;
+  };
+
+  explicit OtlpExporter(const Options& options);
+
+  // Stops pushing, and pushes the metrics changed since the last push.
+  ~OtlpExporter();
+
+  // Starts pushing the metrics every 'push_interval_micros'.
+  Status Start();
+
+  // Generates the JSON ExportMetricsServiceRequest of the metrics changed
+  // since the previous call, which are then considered pushed.
+  Status GenerateExportRequest(string* request) TF_LOCKS_EXCLUDED(mu_);
+
+ private:
+  // The last pushed value of a point of a cumulative metric.
+  struct PointValue {
+    int64 int64_value = 0;
+    std::vector<double> bucket_counts;
+    double sum = 0;
+    // When the value was collected.
+    uint64 time_nanos = 0;
+  };
+  // The points by metric name and label values.
+  using PointValues = std::unordered_map<string, PointValue>;
+
+  // Generates the export request of the changes since 'pushed_values_', and
+  // the values they are relative to in 'values'.
+  Status EncodeRequest(string* request, PointValues* values)
+      TF_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Appends the data points of an int64, double or bool metric to 'metric',
+  // and returns their number.
+  int AppendScalarPoints(const monitoring::MetricDescriptor& descriptor,
+                         const monitoring::PointSet& point_set,
+                         PointValues* values, string* metric)
+      TF_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  // Same for a histogram metric.
+  int AppendHistogramPoints(const monitoring::MetricDescriptor& descriptor,
+                            const monitoring::PointSet& point_set,
+                            PointValues* values, string* metric)
+      TF_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Sends the export request of the changes since the last push, which are
+  // pushed again with the next one if it fails. The request is sent without
+  // holding 'mu_'.
+  void Push() TF_LOCKS_EXCLUDED(push_mu_, mu_);
+
+  const Options options_;
+  // The metrics registry.
+  monitoring::CollectionRegistry* const collection_registry_;
+
+  // The collector, parsed from 'endpoint' by Start().
+  string host_;
+  int port_ = 0;
+
+  // Serializes the pushes, so that each one is relative to the previous one.
+  mutex push_mu_ TF_ACQUIRED_BEFORE(mu_);
+  // Connection to the collector, reopened after a failed push.
+  std::unique_ptr<net_http::HTTPClientInterface> client_
+      TF_GUARDED_BY(push_mu_);
+
+  mutex mu_;
+  // The values of the points reported by the last push.
+  PointValues pushed_values_ TF_GUARDED_BY(mu_);
+  // Size of the last request, to allocate the next one at once.
+  size_t last_request_size_ TF_GUARDED_BY(mu_) = 0;
+
+  std::unique_ptr<PeriodicFunction> push_thread_;
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_UTIL_OTLP_EXPORTER_H_
@@ -0,0 +1,190 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/otlp_exporter.h"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/monitoring/counter.h"
+#include "tensorflow/core/lib/monitoring/gauge.h"
+#include "tensorflow/core/lib/monitoring/sampler.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+using ::testing::HasSubstr;
+using ::testing::Not;
+
+TEST(OtlpExporterTest, Resource) {
+  OtlpExporter::Options options;
+  options.resource_attributes = {{"service.name", "my \"server\""}};
+  OtlpExporter exporter(options);
+
+  string request;
+  TF_ASSERT_OK(exporter.GenerateExportRequest(&request));
+  EXPECT_THAT(request,
+              HasSubstr("{\"resourceMetrics\":[{\"resource\":{\"attributes\":"
+                        "[{\"key\":\"service.name\",\"value\":{\"stringValue\":"
+                        "\"my \\\"server\\\"\"}}]},\"scopeMetrics\":"));
+}
+
+TEST(OtlpExporterTest, CounterDeltas) {
+  OtlpExporter exporter{OtlpExporter::Options()};
+  auto counter = absl::WrapUnique(
+      monitoring::Counter<1>::New("/test/otlp/total", "A counter.", "name"));
+  counter->GetCell("abc")->IncrementBy(2);
+
+  string request;
+  TF_ASSERT_OK(exporter.GenerateExportRequest(&request));
+  EXPECT_THAT(request,
+              HasSubstr("{\"name\":\"/test/otlp/total\",\"description\":"
+                        "\"A counter.\",\"sum\":{\"aggregationTemporality\":1,"
+                        "\"isMonotonic\":true,\"dataPoints\":[{\"attributes\":"
+                        "[{\"key\":\"name\",\"value\":{\"stringValue\":"
+                        "\"abc\"}}],\"startTimeUnixNano\":"));
+  EXPECT_THAT(request, HasSubstr(",\"asInt\":\"2\"}"));
+
+  // The unchanged counter is not pushed again.
+  TF_ASSERT_OK(exporter.GenerateExportRequest(&request));
+  EXPECT_THAT(request, Not(HasSubstr("/test/otlp/total")));
+
+  counter->GetCell("abc")->IncrementBy(3);
+  TF_ASSERT_OK(exporter.GenerateExportRequest(&request));
+  EXPECT_THAT(request, HasSubstr("/test/otlp/total"));
+  EXPECT_THAT(request, HasSubstr(",\"asInt\":\"3\"}"));
+}
+
+TEST(OtlpExporterTest, Gauge) {
+  OtlpExporter exporter{OtlpExporter::Options()};
+  auto gauge = absl::WrapUnique(monitoring::Gauge<int64, 2>::New(
+      "/test/otlp/gauge", "A gauge.", "x", "y"));
+  gauge->GetCell("abc", "def")->Set(5);
+
+  // The gauges are pushed as is, changed or not.
+  for (int i = 0; i < 2; ++i) {
+    string request;
+    TF_ASSERT_OK(exporter.GenerateExportRequest(&request));
+    EXPECT_THAT(request,
+                HasSubstr("{\"name\":\"/test/otlp/gauge\",\"description\":"
+                          "\"A gauge.\",\"gauge\":{\"dataPoints\":[{"
+                          "\"attributes\":[{\"key\":\"x\",\"value\":{"
+                          "\"stringValue\":\"abc\"}},{\"key\":\"y\","
+                          "\"value\":{\"stringValue\":\"def\"}}],"));
+    EXPECT_THAT(request, HasSubstr(",\"asInt\":\"5\"}"));
+  }
+}
+
+TEST(OtlpExporterTest, DoubleAndBoolGauges) {
+  OtlpExporter exporter{OtlpExporter::Options()};
+  auto double_gauge = absl::WrapUnique(monitoring::Gauge<double, 0>::New(
+      "/test/otlp/double_gauge", "A double gauge."));
+  double_gauge->GetCell()->Set(0.5);
+  auto bool_gauge = absl::WrapUnique(monitoring::Gauge<bool, 0>::New(
+      "/test/otlp/bool_gauge", "A bool gauge."));
+  bool_gauge->GetCell()->Set(true);
+
+  string request;
+  TF_ASSERT_OK(exporter.GenerateExportRequest(&request));
+  EXPECT_THAT(request,
+              HasSubstr("{\"name\":\"/test/otlp/double_gauge\",\"description\":"
+                        "\"A double gauge.\",\"gauge\":{\"dataPoints\":[{"
+                        "\"attributes\":[],\"startTimeUnixNano\":"));
+  EXPECT_THAT(request, HasSubstr(",\"asDouble\":0.5}"));
+  EXPECT_THAT(request,
+              HasSubstr("{\"name\":\"/test/otlp/bool_gauge\",\"description\":"
+                        "\"A bool gauge.\",\"gauge\":{\"dataPoints\":[{"
+                        "\"attributes\":[],\"startTimeUnixNano\":"));
+  EXPECT_THAT(request, HasSubstr(",\"asInt\":\"1\"}"));
+}
+
+TEST(OtlpExporterTest, HistogramDeltas) {
+  OtlpExporter exporter{OtlpExporter::Options()};
+  auto histogram = absl::WrapUnique(monitoring::Sampler<0>::New(
+      {"/test/otlp/histogram", "A histogram."},
+      monitoring::Buckets::Explicit({10, 100})));
+  histogram->GetCell()->Add(5);
+  histogram->GetCell()->Add(50);
+
+  string request;
+  TF_ASSERT_OK(exporter.GenerateExportRequest(&request));
+  EXPECT_THAT(request,
+              HasSubstr("{\"name\":\"/test/otlp/histogram\",\"description\":"
+                        "\"A histogram.\",\"histogram\":{"
+                        "\"aggregationTemporality\":1,\"dataPoints\":[{"
+                        "\"attributes\":[],\"startTimeUnixNano\":"));
+  EXPECT_THAT(request,
+              HasSubstr(",\"count\":\"2\",\"sum\":55,\"bucketCounts\":[\"1\","
+                        "\"1\",\"0\"],\"explicitBounds\":[10,100]}"));
+
+  histogram->GetCell()->Add(500);
+  TF_ASSERT_OK(exporter.GenerateExportRequest(&request));
+  EXPECT_THAT(request,
+              HasSubstr(",\"count\":\"1\",\"sum\":500,\"bucketCounts\":[\"0\","
+                        "\"0\",\"1\"],\"explicitBounds\":[10,100]}"));
+
+  TF_ASSERT_OK(exporter.GenerateExportRequest(&request));
+  EXPECT_THAT(request, Not(HasSubstr("/test/otlp/histogram")));
+}
+
+TEST(OtlpExporterTest, PushTimesOut) {
+  // A collector that never answers: the connections wait in the backlog of
+  // its socket.
+  const int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_GE(socket_fd, 0);
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t address_size = sizeof(address);
+  ASSERT_EQ(bind(socket_fd, reinterpret_cast<struct sockaddr*>(&address),
+                 sizeof(address)),
+            0);
+  ASSERT_EQ(listen(socket_fd, 16), 0);
+  ASSERT_EQ(getsockname(socket_fd, reinterpret_cast<struct sockaddr*>(&address),
+                        &address_size),
+            0);
+
+  OtlpExporter::Options options;
+  options.endpoint = absl::StrCat("127.0.0.1:", ntohs(address.sin_port));
+  options.push_interval_micros = 3600LL * 1000 * 1000;
+  options.push_timeout_micros = 100 * 1000;
+  auto exporter = absl::make_unique<OtlpExporter>(options);
+  TF_ASSERT_OK(exporter->Start());
+
+  // The last push, by the destructor, gives up after the timeout.
+  const uint64 start_micros = Env::Default()->NowMicros();
+  exporter.reset();
+  EXPECT_LT(Env::Default()->NowMicros() - start_micros, 2 * 1000 * 1000);
+  close(socket_fd);
+}
+
+TEST(OtlpExporterTest, InvalidEndpoint) {
+  OtlpExporter::Options options;
+  options.endpoint = "localhost";
+  OtlpExporter exporter(options);
+  EXPECT_FALSE(exporter.Start().ok());
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
@@ -15,10 +15,9 @@ limitations under the License.
 
 #include "tensorflow_serving/util/prometheus_exporter.h"
 
-#include "absl/strings/match.h"
+#include <utility>
+
 #include "absl/strings/str_cat.h"
-#include "absl/strings/str_format.h"
-#include "absl/strings/str_join.h"
 #include "re2/re2.h"
 
 namespace tensorflow {
@@ -26,14 +25,18 @@ namespace serving {
 
 namespace {
 
-string SanitizeLabelValue(const string& value) {
-  // Backslash and double quote have to be escaped.
-  string new_value = value;
-  // Replace \ with \\.
-  RE2::GlobalReplace(&new_value, "\\\\", "\\\\\\\\");
-  // Replace " with \".
-  RE2::GlobalReplace(&new_value, "\"", "\\\\\"");
-  return new_value;
+// Appends 'value' to 'page' with backslashes and double quotes escaped.
+void AppendLabelValue(const string& value, string* page) {
+  if (value.find_first_of("\\\"") == string::npos) {
+    page->append(value);
+    return;
+  }
+  for (const char c : value) {
+    if (c == '\\' || c == '"') {
+      page->push_back('\\');
+    }
+    page->push_back(c);
+  }
 }
 
 string SanatizeLabelName(const string& name) {
@@ -47,10 +50,9 @@ string SanatizeLabelName(const string& name) {
   return new_name;
 }
 
-string GetPrometheusMetricName(
-    const monitoring::MetricDescriptor& metric_descriptor) {
+string SanitizeMetricName(const string& name) {
   // Valid format: [a-zA-Z_:][a-zA-Z0-9_:]*
-  string new_name = metric_descriptor.name;
+  string new_name = name;
   RE2::GlobalReplace(&new_name, "[^a-zA-Z0-9_]", ":");
   if (RE2::FullMatch(new_name, "^[0-9].*")) {
     // Start with 0-9, prepend a underscore.
@@ -59,103 +61,106 @@ string GetPrometheusMetricName(
   return new_name;
 }
 
-void SerializeHistogram(const monitoring::MetricDescriptor& metric_descriptor,
-                        const monitoring::PointSet& point_set,
-                        std::vector<string>* lines) {
+}  // namespace
+
+const char* const PrometheusExporter::kPrometheusPath =
+    "/monitoring/prometheus/metrics";
+
+PrometheusExporter::PrometheusExporter()
+    : collection_registry_(monitoring::CollectionRegistry::Default()) {}
+
+const string& PrometheusExporter::GetMetricName(const string& name) {
+  auto it = metric_names_.find(name);
+  if (it == metric_names_.end()) {
+    it = metric_names_.emplace(name, SanitizeMetricName(name)).first;
+  }
+  return it->second;
+}
+
+const string& PrometheusExporter::GetLabelName(const string& name) {
+  auto it = label_names_.find(name);
+  if (it == label_names_.end()) {
+    it = label_names_.emplace(name, SanatizeLabelName(name)).first;
+  }
+  return it->second;
+}
+
+void PrometheusExporter::AppendLabels(const monitoring::Point& point,
+                                      string* page) {
+  page->push_back('{');
+  for (int i = 0; i < point.labels.size(); ++i) {
+    if (i > 0) {
+      page->push_back(',');
+    }
+    absl::StrAppend(page, GetLabelName(point.labels[i].name), "=\"");
+    AppendLabelValue(point.labels[i].value, page);
+    page->push_back('"');
+  }
+}
+
+void PrometheusExporter::SerializeHistogram(
+    const monitoring::MetricDescriptor& metric_descriptor,
+    const monitoring::PointSet& point_set, string* page) {
   // For a metric name NAME, we should output:
   //   NAME_bucket{le=b1} x1
   //   NAME_bucket{le=b2} x2
   //   NAME_bucket{le=b3} x3 ...
   //   NAME_sum xsum
   //   NAME_count xcount
-  string prom_metric_name = GetPrometheusMetricName(metric_descriptor);
+  const string& prom_metric_name = GetMetricName(metric_descriptor.name);
   // Type definition line.
-  lines->push_back(absl::StrFormat("# TYPE %s histogram", prom_metric_name));
+  absl::StrAppend(page, "# TYPE ", prom_metric_name, " histogram\n");
+  string labels;
   for (const auto& point : point_set.points) {
     // Each points has differnet label values.
-    std::vector<string> labels = {};
-    labels.reserve(point->labels.size());
-    for (const auto& label : point->labels) {
-      labels.push_back(absl::StrFormat("%s=\"%s\"",
-                                       SanatizeLabelName(label.name),
-                                       SanitizeLabelValue(label.value)));
-    }
+    labels.clear();
+    AppendLabels(*point, &labels);
     int64 cumulative_count = 0;
-    string bucket_prefix =
-        absl::StrCat(prom_metric_name, "_bucket{", absl::StrJoin(labels, ","));
-    if (!labels.empty()) {
-      absl::StrAppend(&bucket_prefix, ",");
-    }
     // One bucket per line, last one should be le="Inf".
-    for (int i = 0; i < point->histogram_value.bucket_size(); i++) {
-      cumulative_count += point->histogram_value.bucket(i);
-      string bucket_limit =
-          (i < point->histogram_value.bucket_size() - 1)
-              ? absl::StrCat(point->histogram_value.bucket_limit(i))
-              : "+Inf";
-      lines->push_back(absl::StrCat(
-          bucket_prefix, absl::StrFormat("le=\"%s\"} ", bucket_limit),
-          cumulative_count));
+    const HistogramProto& histogram = point->histogram_value;
+    for (int i = 0; i < histogram.bucket_size(); i++) {
+      cumulative_count += histogram.bucket(i);
+      absl::StrAppend(page, prom_metric_name, "_bucket", labels,
+                      point->labels.empty() ? "" : ",", "le=\"");
+      if (i < histogram.bucket_size() - 1) {
+        absl::StrAppend(page, histogram.bucket_limit(i));
+      } else {
+        page->append("+Inf");
+      }
+      absl::StrAppend(page, "\"} ", cumulative_count, "\n");
     }
     // _sum and _count.
-    lines->push_back(absl::StrCat(prom_metric_name, "_sum{",
-                                  absl::StrJoin(labels, ","), "} ",
-                                  point->histogram_value.sum()));
-    lines->push_back(absl::StrCat(prom_metric_name, "_count{",
-                                  absl::StrJoin(labels, ","), "} ",
-                                  cumulative_count));
+    absl::StrAppend(page, prom_metric_name, "_sum", labels, "} ",
+                    histogram.sum(), "\n");
+    absl::StrAppend(page, prom_metric_name, "_count", labels, "} ",
+                    cumulative_count, "\n");
   }
 }
 
-void SerializeScalar(const monitoring::MetricDescriptor& metric_descriptor,
-                     const monitoring::PointSet& point_set,
-                     std::vector<string>* lines) {
+void PrometheusExporter::SerializeScalar(
+    const monitoring::MetricDescriptor& metric_descriptor,
+    const monitoring::PointSet& point_set, string* page) {
   // A counter or gauge metric.
   // The format should be:
   //   NAME{label=value,label=value} x time
-  string prom_metric_name = GetPrometheusMetricName(metric_descriptor);
-  string metric_type_str = "untyped";
+  const string& prom_metric_name = GetMetricName(metric_descriptor.name);
+  const char* metric_type_str = "untyped";
   if (metric_descriptor.metric_kind == monitoring::MetricKind::kCumulative) {
     metric_type_str = "counter";
   } else if (metric_descriptor.metric_kind == monitoring::MetricKind::kGauge) {
     metric_type_str = "gauge";
   }
   // Type definition line.
-  lines->push_back(
-      absl::StrFormat("# TYPE %s %s", prom_metric_name, metric_type_str));
+  absl::StrAppend(page, "# TYPE ", prom_metric_name, " ", metric_type_str,
+                  "\n");
   for (const auto& point : point_set.points) {
     // Each points has differnet label values.
-    string name_bracket = absl::StrCat(prom_metric_name, "{");
-    std::vector<string> labels = {};
-    labels.reserve(point->labels.size());
-    for (const auto& label : point->labels) {
-      labels.push_back(absl::StrFormat("%s=\"%s\"",
-                                       SanatizeLabelName(label.name),
-                                       SanitizeLabelValue(label.value)));
-    }
-    lines->push_back(absl::StrCat(name_bracket, absl::StrJoin(labels, ","),
-                                  absl::StrFormat("} %d", point->int64_value)));
+    page->append(prom_metric_name);
+    AppendLabels(*point, page);
+    absl::StrAppend(page, "} ", point->int64_value, "\n");
   }
 }
 
-void SerializeMetric(const monitoring::MetricDescriptor& metric_descriptor,
-                     const monitoring::PointSet& point_set,
-                     std::vector<string>* lines) {
-  if (metric_descriptor.value_type == monitoring::ValueType::kHistogram) {
-    SerializeHistogram(metric_descriptor, point_set, lines);
-  } else {
-    SerializeScalar(metric_descriptor, point_set, lines);
-  }
-}
-
-}  // namespace
-
-const char* const PrometheusExporter::kPrometheusPath =
-    "/monitoring/prometheus/metrics";
-
-PrometheusExporter::PrometheusExporter()
-    : collection_registry_(monitoring::CollectionRegistry::Default()) {}
-
 Status PrometheusExporter::GeneratePage(string* http_page) {
   if (http_page == nullptr) {
     return Status(error::Code::INVALID_ARGUMENT, "Http page pointer is null");
@@ -168,7 +173,10 @@ Status PrometheusExporter::GeneratePage(string* http_page) {
   const auto& descriptor_map = collected_metrics->metric_descriptor_map;
   const auto& metric_map = collected_metrics->point_set_map;
 
-  std::vector<string> lines;
+  // The page is rendered in place, in a buffer sized after the last page.
+  mutex_lock l(mu_);
+  string page;
+  page.reserve(last_page_size_ + last_page_size_ / 8);
   for (const auto& name_and_metric_descriptor : descriptor_map) {
     const string& metric_name = name_and_metric_descriptor.first;
     auto metric_iterator = metric_map.find(metric_name);
@@ -176,11 +184,19 @@ Status PrometheusExporter::GeneratePage(string* http_page) {
       // Not found.
       continue;
     }
-    SerializeMetric(*name_and_metric_descriptor.second,
-                    *(metric_iterator->second), &lines);
+    const monitoring::MetricDescriptor& metric_descriptor =
+        *name_and_metric_descriptor.second;
+    if (metric_descriptor.value_type == monitoring::ValueType::kHistogram) {
+      SerializeHistogram(metric_descriptor, *(metric_iterator->second), &page);
+    } else {
+      SerializeScalar(metric_descriptor, *(metric_iterator->second), &page);
+    }
+  }
+  if (page.empty()) {
+    page.push_back('\n');
   }
-  *http_page = absl::StrJoin(lines, "\n");
-  absl::StrAppend(http_page, "\n");
+  last_page_size_ = page.size();
+  *http_page = std::move(page);
   return Status::OK();
 }
 
@@ -16,16 +16,20 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_UTIL_PROMETHEUS_EXPORTER_H_
 #define TENSORFLOW_SERVING_UTIL_PROMETHEUS_EXPORTER_H_
 
-#include <vector>
+#include <unordered_map>
 
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/monitoring/collected_metrics.h"
 #include "tensorflow/core/lib/monitoring/collection_registry.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
 
 namespace tensorflow {
 namespace serving {
 
 // Exports metrics in Prometheus monitoring format.
+//
+// This class is thread-safe.
 class PrometheusExporter {
  public:
   // Default path to expose the metrics.
@@ -39,8 +43,35 @@ class PrometheusExporter {
   Status GeneratePage(string* http_page);
 
  private:
+  // Returns the sanitized Prometheus name of the metric or label 'name'. The
+  // names are only sanitized the first time they are seen.
+  const string& GetMetricName(const string& name)
+      TF_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  const string& GetLabelName(const string& name)
+      TF_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  void SerializeHistogram(const monitoring::MetricDescriptor& metric_descriptor,
+                          const monitoring::PointSet& point_set, string* page)
+      TF_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void SerializeScalar(const monitoring::MetricDescriptor& metric_descriptor,
+                       const monitoring::PointSet& point_set, string* page)
+      TF_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Appends '{label="value",...' of 'point' to 'page', without the closing
+  // bracket.
+  void AppendLabels(const monitoring::Point& point, string* page)
+      TF_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
   // The metrics registry.
   monitoring::CollectionRegistry* collection_registry_;
+
+  mutex mu_;
+  // Sanitized names of the metrics and labels seen so far. Metrics and labels
+  // are static, so the caches stay small.
+  std::unordered_map<string, string> metric_names_ TF_GUARDED_BY(mu_);
+  std::unordered_map<string, string> label_names_ TF_GUARDED_BY(mu_);
+  // Size of the last generated page, to allocate the next one at once.
+  size_t last_page_size_ TF_GUARDED_BY(mu_) = 0;
 };
 
 }  // namespace serving
@@ -19,6 +19,7 @@ limitations under the License.
 #include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_join.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
 #include "tensorflow/core/lib/monitoring/counter.h"
 #include "tensorflow/core/lib/monitoring/gauge.h"
 #include "tensorflow/core/lib/monitoring/sampler.h"
@@ -90,6 +91,46 @@ TEST(PrometheusExporterTest, Histogram) {
   EXPECT_PRED_FORMAT2(testing::IsSubstring, expected_result, http_page);
 }
 
+TEST(PrometheusExporterTest, HistogramWithoutLabels) {
+  auto exporter = absl::make_unique<PrometheusExporter>();
+  auto histogram = absl::WrapUnique(monitoring::Sampler<0>::New(
+      {"/test/path/unlabeled_histogram", "A histogram."},
+      monitoring::Buckets::Explicit({10})));
+  histogram->GetCell()->Add(5);
+
+  string http_page;
+  TF_ASSERT_OK(exporter->GeneratePage(&http_page));
+  string expected_result = absl::StrJoin(
+      {"# TYPE :test:path:unlabeled_histogram histogram",
+       ":test:path:unlabeled_histogram_bucket{le=\"10\"} 1",
+       ":test:path:unlabeled_histogram_bucket{le=\"+Inf\"} 1",
+       ":test:path:unlabeled_histogram_sum{} 5",
+       ":test:path:unlabeled_histogram_count{} 1"},
+      "\n");
+  absl::StrAppend(&expected_result, "\n");
+  EXPECT_PRED_FORMAT2(testing::IsSubstring, expected_result, http_page);
+}
+
+TEST(PrometheusExporterTest, RepeatedPages) {
+  auto exporter = absl::make_unique<PrometheusExporter>();
+  auto counter = absl::WrapUnique(monitoring::Counter<1>::New(
+      "/test/path/repeated", "A counter.", "my-name"));
+  counter->GetCell("abc")->IncrementBy(2);
+
+  // The names sanitized for the first page are reused by the next ones.
+  string first_page;
+  TF_ASSERT_OK(exporter->GeneratePage(&first_page));
+  counter->GetCell("abc")->IncrementBy(1);
+  string second_page;
+  TF_ASSERT_OK(exporter->GeneratePage(&second_page));
+
+  EXPECT_PRED_FORMAT2(testing::IsSubstring,
+                      ":test:path:repeated{my_name=\"abc\"} 2\n", first_page);
+  EXPECT_PRED_FORMAT2(testing::IsSubstring,
+                      ":test:path:repeated{my_name=\"abc\"} 3\n",
+                      second_page);
+}
+
 TEST(PrometheusExporterTest, SanitizeLabelValue) {
   auto exporter = absl::make_unique<PrometheusExporter>();
   auto counter = absl::WrapUnique(
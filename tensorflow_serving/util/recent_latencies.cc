@@ -0,0 +1,70 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/recent_latencies.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "tensorflow/core/platform/logging.h"
+
+namespace tensorflow {
+namespace serving {
+
+RecentLatencies::RecentLatencies(const Options& options)
+    : options_(options), samples_(new Sample[options.capacity]) {
+  CHECK_GT(options.capacity, 0);
+}
+
+void RecentLatencies::Record(const int64 latency_micros) {
+  const uint64 index =
+      num_recorded_.fetch_add(1, std::memory_order_relaxed) %
+      options_.capacity;
+  Sample& sample = samples_[index];
+  sample.latency_micros.store(latency_micros, std::memory_order_relaxed);
+  sample.record_micros.store(options_.env->NowMicros(),
+                             std::memory_order_release);
+}
+
+int64 RecentLatencies::Percentile(const double percentile) const {
+  const uint64 now_micros = options_.env->NowMicros();
+  const uint64 num_samples = std::min<uint64>(
+      num_recorded_.load(std::memory_order_relaxed), options_.capacity);
+  std::vector<int64> latencies;
+  latencies.reserve(num_samples);
+  for (uint64 i = 0; i < num_samples; ++i) {
+    const Sample& sample = samples_[i];
+    const uint64 record_micros =
+        sample.record_micros.load(std::memory_order_acquire);
+    if (record_micros + options_.window_micros >= now_micros) {
+      latencies.push_back(
+          sample.latency_micros.load(std::memory_order_relaxed));
+    }
+  }
+  if (latencies.empty()) {
+    return 0;
+  }
+  // The nearest rank.
+  const double rank = std::ceil(percentile / 100 * latencies.size());
+  const size_t index = std::min<size_t>(
+      latencies.size() - 1, rank > 1 ? static_cast<size_t>(rank) - 1 : 0);
+  std::nth_element(latencies.begin(), latencies.begin() + index,
+                   latencies.end());
+  return latencies[index];
+}
+
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,75 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_UTIL_RECENT_LATENCIES_H_
+#define TENSORFLOW_SERVING_UTIL_RECENT_LATENCIES_H_
+
+#include <atomic>
+#include <memory>
+
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace serving {
+
+// Keeps the most recent latencies of a stream of requests, to compute their
+// percentiles, e.g. to back off background work while the requests are slow.
+//
+// Record() is lock-free, so that it can be called by every request. The
+// latencies recorded concurrently with Percentile() may or may not be
+// counted.
+//
+// This class is thread-safe.
+class RecentLatencies {
+ public:
+  struct Options {
+    // The max number of latencies kept, the oldest being overwritten.
+    int capacity = 1024;
+
+    // The age, in microseconds, after which a latency is no longer counted.
+    int64 window_micros = 10 * 1000 * 1000;
+
+    // The environment to use for timing the latencies.
+    Env* env = Env::Default();
+  };
+
+  explicit RecentLatencies(const Options& options);
+
+  // Records the latency, in microseconds, of a request completing now.
+  void Record(int64 latency_micros);
+
+  // Returns the 'percentile', in [0, 100], of the latencies recorded in the
+  // last 'window_micros', or 0 if there are none.
+  int64 Percentile(double percentile) const;
+
+ private:
+  struct Sample {
+    std::atomic<int64> latency_micros{0};
+    std::atomic<uint64> record_micros{0};
+  };
+
+  const Options options_;
+  std::unique_ptr<Sample[]> samples_;
+  std::atomic<uint64> num_recorded_{0};
+
+  TF_DISALLOW_COPY_AND_ASSIGN(RecentLatencies);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_UTIL_RECENT_LATENCIES_H_
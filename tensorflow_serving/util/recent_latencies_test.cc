@@ -0,0 +1,68 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/recent_latencies.h"
+
+#include <gtest/gtest.h>
+#include "tensorflow/core/kernels/batching_util/fake_clock_env.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+TEST(RecentLatenciesTest, Percentiles) {
+  RecentLatencies latencies({});
+  EXPECT_EQ(latencies.Percentile(99), 0);
+  for (int i = 1; i <= 100; ++i) {
+    latencies.Record(i);
+  }
+  EXPECT_EQ(latencies.Percentile(0), 1);
+  EXPECT_EQ(latencies.Percentile(50), 50);
+  EXPECT_EQ(latencies.Percentile(99), 99);
+  EXPECT_EQ(latencies.Percentile(100), 100);
+}
+
+TEST(RecentLatenciesTest, KeepsTheMostRecentLatencies) {
+  RecentLatencies::Options options;
+  options.capacity = 10;
+  RecentLatencies latencies(options);
+  for (int i = 0; i < 10; ++i) {
+    latencies.Record(1000);
+  }
+  for (int i = 0; i < 10; ++i) {
+    latencies.Record(10);
+  }
+  EXPECT_EQ(latencies.Percentile(100), 10);
+}
+
+TEST(RecentLatenciesTest, LatenciesExpire) {
+  test_util::FakeClockEnv env(Env::Default());
+  RecentLatencies::Options options;
+  options.window_micros = 100;
+  options.env = &env;
+  RecentLatencies latencies(options);
+  latencies.Record(1000);
+  env.AdvanceByMicroseconds(50);
+  latencies.Record(10);
+  EXPECT_EQ(latencies.Percentile(100), 1000);
+  env.AdvanceByMicroseconds(51);
+  EXPECT_EQ(latencies.Percentile(100), 10);
+  env.AdvanceByMicroseconds(50);
+  EXPECT_EQ(latencies.Percentile(100), 0);
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,62 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/request_cancellation.h"
+
+#include <utility>
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+thread_local const RequestCancellation* current_request_cancellation = nullptr;
+
+}  // namespace
+
+RequestCancellation::RequestCancellation(std::function<bool()> is_cancelled)
+    : is_cancelled_(std::move(is_cancelled)) {}
+
+bool RequestCancellation::IsCancelled() const {
+  if (cancelled_.load(std::memory_order_relaxed)) {
+    return true;
+  }
+  if (!is_cancelled_()) {
+    return false;
+  }
+  cancelled_.store(true, std::memory_order_relaxed);
+  return true;
+}
+
+const RequestCancellation* CurrentRequestCancellation() {
+  return current_request_cancellation;
+}
+
+ScopedRequestCancellation::ScopedRequestCancellation(
+    const RequestCancellation* cancellation)
+    : set_(cancellation != nullptr) {
+  if (set_) {
+    previous_ = current_request_cancellation;
+    current_request_cancellation = cancellation;
+  }
+}
+
+ScopedRequestCancellation::~ScopedRequestCancellation() {
+  if (set_) {
+    current_request_cancellation = previous_;
+  }
+}
+
+}  // namespace serving
+}  // namespace tensorflow
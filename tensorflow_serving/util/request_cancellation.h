@@ -0,0 +1,71 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_UTIL_REQUEST_CANCELLATION_H_
+#define TENSORFLOW_SERVING_UTIL_REQUEST_CANCELLATION_H_
+
+#include <atomic>
+#include <functional>
+
+#include "tensorflow/core/platform/macros.h"
+
+namespace tensorflow {
+namespace serving {
+
+// Whether the client of a request has given up on it, e.g. a gRPC call
+// cancelled by its client, or an HTTP request whose connection the client has
+// closed. The work done for a cancelled request is wasted, so e.g. the batching
+// sessions drop its tasks before they are run.
+//
+// This class is thread-safe.
+class RequestCancellation {
+ public:
+  // 'is_cancelled' polls the transport of the request, e.g.
+  // grpc::ServerContext::IsCancelled(). It is called from the threads working
+  // for the request, and so must be thread-safe.
+  explicit RequestCancellation(std::function<bool()> is_cancelled);
+
+  // Whether the request is cancelled. Once true, stays true.
+  bool IsCancelled() const;
+
+ private:
+  const std::function<bool()> is_cancelled_;
+  mutable std::atomic<bool> cancelled_{false};
+
+  TF_DISALLOW_COPY_AND_ASSIGN(RequestCancellation);
+};
+
+// Returns the cancellation of the request the current thread works for, or
+// null if there is none. See ScopedRequestCancellation.
+const RequestCancellation* CurrentRequestCancellation();
+
+// Sets the cancellation of the request of the current thread for the lifetime
+// of this object. Does nothing if 'cancellation' is null.
+class ScopedRequestCancellation {
+ public:
+  explicit ScopedRequestCancellation(const RequestCancellation* cancellation);
+  ~ScopedRequestCancellation();
+
+ private:
+  const bool set_;
+  const RequestCancellation* previous_ = nullptr;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ScopedRequestCancellation);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_UTIL_REQUEST_CANCELLATION_H_
@@ -0,0 +1,60 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/request_cancellation.h"
+
+#include <gtest/gtest.h>
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+TEST(RequestCancellationTest, StaysCancelled) {
+  bool transport_cancelled = false;
+  int num_polls = 0;
+  RequestCancellation cancellation([&]() {
+    ++num_polls;
+    return transport_cancelled;
+  });
+  EXPECT_FALSE(cancellation.IsCancelled());
+  transport_cancelled = true;
+  EXPECT_TRUE(cancellation.IsCancelled());
+  transport_cancelled = false;
+  EXPECT_TRUE(cancellation.IsCancelled());
+  // The transport is not polled anymore once cancelled.
+  EXPECT_EQ(num_polls, 2);
+}
+
+TEST(RequestCancellationTest, Scoped) {
+  RequestCancellation cancellation([]() { return false; });
+  RequestCancellation other_cancellation([]() { return true; });
+  EXPECT_EQ(CurrentRequestCancellation(), nullptr);
+  {
+    ScopedRequestCancellation scoped(&cancellation);
+    EXPECT_EQ(CurrentRequestCancellation(), &cancellation);
+    {
+      ScopedRequestCancellation nested(&other_cancellation);
+      EXPECT_EQ(CurrentRequestCancellation(), &other_cancellation);
+      ScopedRequestCancellation unset(nullptr);
+      EXPECT_EQ(CurrentRequestCancellation(), &other_cancellation);
+    }
+    EXPECT_EQ(CurrentRequestCancellation(), &cancellation);
+  }
+  EXPECT_EQ(CurrentRequestCancellation(), nullptr);
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,154 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/request_memory.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/monitoring/sampler.h"
+
+namespace tensorflow {
+namespace serving {
+
+namespace {
+
+std::atomic<bool> hooks_linked{false};
+std::atomic<bool> metrics_enabled{false};
+
+// The stats of the request accounted by the current thread, if any.
+thread_local RequestMemoryStats* current_request_memory = nullptr;
+
+auto* request_allocated_bytes = monitoring::Sampler<2>::New(
+    {"/tensorflow/serving/request_allocated_bytes",
+     "Distribution of the heap bytes allocated by the thread serving a "
+     "request.",
+     "model_name", "API"},
+    // 1KB to 4GB.
+    monitoring::Buckets::Exponential(1024, 2, 23));
+
+auto* request_allocation_counts = monitoring::Sampler<2>::New(
+    {"/tensorflow/serving/request_allocation_counts",
+     "Distribution of the number of heap allocations of the thread serving a "
+     "request.",
+     "model_name", "API"},
+    monitoring::Buckets::Exponential(1, 2, 25));
+
+auto* request_peak_memory_bytes = monitoring::Sampler<2>::New(
+    {"/tensorflow/serving/request_peak_memory_bytes",
+     "Distribution of the peak heap bytes held by the thread serving a "
+     "request.",
+     "model_name", "API"},
+    monitoring::Buckets::Exponential(1024, 2, 23));
+
+}  // namespace
+
+Status EnableRequestMemoryMetrics() {
+  if (!hooks_linked.load(std::memory_order_relaxed)) {
+    return errors::FailedPrecondition(
+        "The request memory metrics need the allocator hooks of "
+        "request_memory_hooks");
+  }
+  metrics_enabled.store(true, std::memory_order_relaxed);
+  return Status::OK();
+}
+
+bool RequestMemoryMetricsEnabled() {
+  return metrics_enabled.load(std::memory_order_relaxed);
+}
+
+ScopedRequestMemory::ScopedRequestMemory()
+    : accounting_(RequestMemoryMetricsEnabled() &&
+                  current_request_memory == nullptr) {
+  if (accounting_) {
+    current_request_memory = &stats_;
+  }
+}
+
+ScopedRequestMemory::~ScopedRequestMemory() {
+  if (!accounting_) {
+    return;
+  }
+  current_request_memory = nullptr;
+  if (model_name_.empty()) {
+    return;
+  }
+  request_allocated_bytes->GetCell(model_name_, api_)
+      ->Add(stats_.allocated_bytes);
+  request_allocation_counts->GetCell(model_name_, api_)
+      ->Add(stats_.num_allocations);
+  request_peak_memory_bytes->GetCell(model_name_, api_)->Add(stats_.peak_bytes);
+}
+
+void ScopedRequestMemory::set_request(const string& model_name,
+                                      const string& api) {
+  if (!accounting_) {
+    return;
+  }
+  // Not accounted: the strings are allocated for the metrics.
+  current_request_memory = nullptr;
+  model_name_ = model_name;
+  api_ = api;
+  current_request_memory = &stats_;
+}
+
+void AddRequestMemory(const RequestMemoryStats& stats) {
+  RequestMemoryStats* const current = current_request_memory;
+  if (current == nullptr) {
+    return;
+  }
+  current->allocated_bytes += stats.allocated_bytes;
+  current->num_allocations += stats.num_allocations;
+  // The memory of the other thread peaked on top of the live one of this
+  // thread, at most.
+  current->peak_bytes =
+      std::max(current->peak_bytes, current->live_bytes + stats.peak_bytes);
+  current->live_bytes =
+      std::max<int64>(0, current->live_bytes + stats.live_bytes);
+}
+
+namespace internal {
+
+void MarkRequestMemoryHooksLinked() {
+  hooks_linked.store(true, std::memory_order_relaxed);
+}
+
+bool AccountingRequestMemory() { return current_request_memory != nullptr; }
+
+void RecordRequestAllocation(const size_t bytes) {
+  RequestMemoryStats* const stats = current_request_memory;
+  if (stats == nullptr) {
+    return;
+  }
+  stats->allocated_bytes += bytes;
+  ++stats->num_allocations;
+  stats->live_bytes += bytes;
+  stats->peak_bytes = std::max(stats->peak_bytes, stats->live_bytes);
+}
+
+void RecordRequestDeallocation(const size_t bytes) {
+  RequestMemoryStats* const stats = current_request_memory;
+  if (stats == nullptr) {
+    return;
+  }
+  stats->live_bytes =
+      std::max<int64>(0, stats->live_bytes - static_cast<int64>(bytes));
+}
+
+}  // namespace internal
+
+}  // namespace serving
+}  // namespace tensorflow
@@ -0,0 +1,100 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_UTIL_REQUEST_MEMORY_H_
+#define TENSORFLOW_SERVING_UTIL_REQUEST_MEMORY_H_
+
+#include <cstddef>
+
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace serving {
+
+// The heap memory allocated by the thread serving a request.
+struct RequestMemoryStats {
+  // The bytes and the number of the allocations.
+  int64 allocated_bytes = 0;
+  int64 num_allocations = 0;
+  // The bytes allocated and not freed yet, and their max. The memory allocated
+  // before the request and freed during it makes them lower, down to 0.
+  int64 live_bytes = 0;
+  int64 peak_bytes = 0;
+};
+
+// Enables the accounting of the memory of the requests, see
+// ScopedRequestMemory. Fails if the allocator hooks are not linked in the
+// binary, see request_memory_hooks.cc.
+Status EnableRequestMemoryMetrics();
+
+// Whether the accounting is enabled.
+bool RequestMemoryMetricsEnabled();
+
+// Accounts the heap memory allocated by the current thread for the lifetime of
+// this object, and records it in the per-model metrics on destruction:
+// "/tensorflow/serving/request_allocated_bytes", "request_allocation_counts"
+// and "request_peak_memory_bytes". The memory allocated for the request by
+// other threads, e.g. by the batch threads or the TensorFlow runtime, is not
+// accounted, but that of the protobuf arenas of the request is, as their
+// blocks are allocated by the thread.
+//
+// Does nothing if the accounting is not enabled, or if the thread already
+// accounts a request.
+class ScopedRequestMemory {
+ public:
+  ScopedRequestMemory();
+  ~ScopedRequestMemory();
+
+  // Whether the memory is accounted.
+  bool accounting() const { return accounting_; }
+
+  // Sets the model and the API of the request, once known. The memory is not
+  // recorded in the metrics without a model.
+  void set_request(const string& model_name, const string& api);
+
+  const RequestMemoryStats& stats() const { return stats_; }
+
+ private:
+  const bool accounting_;
+  string model_name_;
+  string api_;
+  RequestMemoryStats stats_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ScopedRequestMemory);
+};
+
+// Adds 'stats', the memory allocated for the request of the current thread by
+// another thread, e.g. a thread serving a part of it with its own
+// ScopedRequestMemory, to that request. Does nothing if the thread accounts no
+// request.
+void AddRequestMemory(const RequestMemoryStats& stats);
+
+namespace internal {
+
+// Called by the allocator hooks, without allocating. The allocations are only
+// recorded while AccountingRequestMemory().
+void MarkRequestMemoryHooksLinked();
+bool AccountingRequestMemory();
+void RecordRequestAllocation(size_t bytes);
+void RecordRequestDeallocation(size_t bytes);
+
+}  // namespace internal
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_UTIL_REQUEST_MEMORY_H_
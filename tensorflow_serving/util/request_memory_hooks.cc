@@ -0,0 +1,106 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Replaces the global operator new and delete of the binary to account the
+// memory of the requests, see ScopedRequestMemory. The allocations go to
+// malloc() as before, so that they still use tcmalloc if TensorFlow is built
+// with it. Outside of an accounted request, e.g. when the accounting is not
+// enabled, a hook only costs a thread-local load: the size of the block is
+// only read while accounting.
+//
+// The sizes are those of the blocks returned by malloc(), which are only known
+// on glibc: elsewhere, the operators are not replaced.
+
+#include <cstdlib>
+#include <new>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+
+#include "tensorflow_serving/util/request_memory.h"
+
+namespace {
+
+using tensorflow::serving::internal::AccountingRequestMemory;
+using tensorflow::serving::internal::RecordRequestAllocation;
+using tensorflow::serving::internal::RecordRequestDeallocation;
+
+void* Allocate(const std::size_t size) noexcept {
+  void* const ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr != nullptr && AccountingRequestMemory()) {
+    RecordRequestAllocation(malloc_usable_size(ptr));
+  }
+  return ptr;
+}
+
+void* AllocateOrThrow(const std::size_t size) {
+  void* ptr = Allocate(size);
+  while (ptr == nullptr) {
+    const std::new_handler handler = std::get_new_handler();
+    if (handler == nullptr) {
+      throw std::bad_alloc();
+    }
+    handler();
+    ptr = Allocate(size);
+  }
+  return ptr;
+}
+
+void Deallocate(void* const ptr) noexcept {
+  if (ptr == nullptr) {
+    return;
+  }
+  if (AccountingRequestMemory()) {
+    RecordRequestDeallocation(malloc_usable_size(ptr));
+  }
+  std::free(ptr);
+}
+
+const bool hooks_linked = []() {
+  tensorflow::serving::internal::MarkRequestMemoryHooksLinked();
+  return true;
+}();
+
+}  // namespace
+
+void* operator new(std::size_t size) { return AllocateOrThrow(size); }
+
+void* operator new[](std::size_t size) { return AllocateOrThrow(size); }
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return Allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return Allocate(size);
+}
+
+void operator delete(void* ptr) noexcept { Deallocate(ptr); }
+
+void operator delete[](void* ptr) noexcept { Deallocate(ptr); }
+
+void operator delete(void* ptr, std::size_t) noexcept { Deallocate(ptr); }
+
+void operator delete[](void* ptr, std::size_t) noexcept { Deallocate(ptr); }
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+  Deallocate(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+  Deallocate(ptr);
+}
+
+#endif  // defined(__GLIBC__)
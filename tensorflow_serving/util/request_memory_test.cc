@@ -0,0 +1,110 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/request_memory.h"
+
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/monitoring/collection_registry.h"
+#include "tensorflow/core/lib/monitoring/collected_metrics.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+// The allocator hooks are only linked on glibc.
+#if defined(__GLIBC__)
+
+class RequestMemoryTest : public ::testing::Test {
+ protected:
+  void SetUp() override { TF_ASSERT_OK(EnableRequestMemoryMetrics()); }
+};
+
+TEST_F(RequestMemoryTest, AccountsTheAllocationsOfTheThread) {
+  ScopedRequestMemory request_memory;
+  ASSERT_TRUE(request_memory.accounting());
+  {
+    std::vector<std::unique_ptr<char[]>> blocks;
+    for (int i = 0; i < 10; ++i) {
+      blocks.emplace_back(new char[1000]);
+    }
+  }
+  const RequestMemoryStats& stats = request_memory.stats();
+  EXPECT_GE(stats.num_allocations, 10);
+  EXPECT_GE(stats.allocated_bytes, 10 * 1000);
+  EXPECT_GE(stats.peak_bytes, 10 * 1000);
+  EXPECT_LT(stats.live_bytes, stats.peak_bytes);
+}
+
+TEST_F(RequestMemoryTest, LiveBytesDoNotGoNegative) {
+  std::unique_ptr<char[]> block(new char[100000]);
+  ScopedRequestMemory request_memory;
+  block.reset();
+  EXPECT_EQ(0, request_memory.stats().live_bytes);
+}
+
+TEST_F(RequestMemoryTest, NestedRequestsAreIgnored) {
+  ScopedRequestMemory request_memory;
+  {
+    ScopedRequestMemory nested_request_memory;
+    EXPECT_FALSE(nested_request_memory.accounting());
+    std::unique_ptr<char[]> block(new char[1000]);
+  }
+  EXPECT_GE(request_memory.stats().allocated_bytes, 1000);
+}
+
+TEST_F(RequestMemoryTest, IgnoresTheOtherThreads) {
+  ScopedRequestMemory request_memory;
+  const int64 allocated_bytes = request_memory.stats().allocated_bytes;
+  std::unique_ptr<Thread> thread(Env::Default()->StartThread(
+      {}, "other", []() { std::unique_ptr<char[]> block(new char[100000]); }));
+  thread.reset();
+  const int64 thread_bytes =
+      request_memory.stats().allocated_bytes - allocated_bytes;
+  // Starting the thread allocates a little.
+  EXPECT_LT(thread_bytes, 100000);
+}
+
+TEST_F(RequestMemoryTest, RecordsTheMetricsOfTheModel) {
+  {
+    ScopedRequestMemory request_memory;
+    request_memory.set_request("memory_model", "Predict");
+    std::unique_ptr<char[]> block(new char[5000]);
+  }
+  monitoring::CollectionRegistry::CollectMetricsOptions options;
+  const std::unique_ptr<monitoring::CollectedMetrics> collected_metrics =
+      monitoring::CollectionRegistry::Default()->CollectMetrics(options);
+  const auto& point_set = collected_metrics->point_set_map.at(
+      "/tensorflow/serving/request_allocated_bytes");
+  bool found = false;
+  for (const auto& point : point_set->points) {
+    if (point->labels[0].value == "memory_model") {
+      found = true;
+      EXPECT_EQ(point->histogram_value.num(), 1);
+      EXPECT_GE(point->histogram_value.sum(), 5000);
+    }
+  }
+  EXPECT_TRUE(found);
+}
+
+#endif  // defined(__GLIBC__)
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
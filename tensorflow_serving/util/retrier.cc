@@ -15,21 +15,63 @@ limitations under the License.
 
 #include "tensorflow_serving/util/retrier.h"
 
+#include <algorithm>
+
 #include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/random.h"
 
 namespace tensorflow {
 namespace serving {
 
-Status Retry(const string& description, const uint32 max_num_retries,
-             const int64 retry_interval_micros,
+namespace {
+
+// The max time slept before polling the cancellation of the retries.
+constexpr int64 kCancellationPollIntervalMicros = 100 * 1000;
+
+// The max delay between two tries when none is set.
+constexpr int64 kDefaultMaxRetryIntervalMicros = 24LL * 60 * 60 * 1000 * 1000;
+
+}  // namespace
+
+int64 RetryDelayMicros(const RetryOptions& options,
+                       const uint32 num_retries) {
+  if (options.retry_interval_micros <= 0) {
+    return 0;
+  }
+  const double max_delay_micros = options.max_retry_interval_micros > 0
+                                      ? options.max_retry_interval_micros
+                                      : kDefaultMaxRetryIntervalMicros;
+  double delay_micros = options.retry_interval_micros;
+  for (uint32 i = 1; i < num_retries && delay_micros < max_delay_micros; ++i) {
+    delay_micros *= options.backoff_multiplier;
+  }
+  if (options.jitter > 0) {
+    const double uniform =
+        static_cast<double>(random::New64() >> 11) / (uint64{1} << 53);
+    delay_micros *= 1 + options.jitter * (2 * uniform - 1);
+  }
+  delay_micros = std::min(delay_micros, max_delay_micros);
+  return static_cast<int64>(delay_micros);
+}
+
+Status Retry(const string& description, const RetryOptions& options,
              const std::function<Status()>& retried_fn,
              const std::function<bool()>& is_cancelled) {
   Status status;
-  int num_tries = 0;
+  uint32 num_tries = 0;
   do {
     if (num_tries > 0) {
-      Env::Default()->SleepForMicroseconds(retry_interval_micros);
+      int64 delay_micros = RetryDelayMicros(options, num_tries);
+      while (delay_micros > 0 && !is_cancelled()) {
+        const int64 sleep_micros =
+            std::min(delay_micros, kCancellationPollIntervalMicros);
+        Env::Default()->SleepForMicroseconds(sleep_micros);
+        delay_micros -= sleep_micros;
+      }
+      if (is_cancelled()) {
+        break;
+      }
       LOG(INFO) << "Retrying of " << description << " retry: " << num_tries;
     }
     status = retried_fn();
@@ -37,17 +79,28 @@ Status Retry(const string& description, const uint32 max_num_retries,
       LOG(ERROR) << description << " failed: " << status;
     }
     ++num_tries;
-  } while (!is_cancelled() && !status.ok() && num_tries < max_num_retries + 1);
+  } while (!is_cancelled() && !status.ok() &&
+           num_tries < options.max_num_retries + 1);
 
   if (is_cancelled()) {
     LOG(INFO) << "Retrying of " << description << " was cancelled.";
   }
-  if (num_tries == max_num_retries + 1) {
+  if (num_tries == options.max_num_retries + 1) {
     LOG(INFO) << "Retrying of " << description
-              << " exhausted max_num_retries: " << max_num_retries;
+              << " exhausted max_num_retries: " << options.max_num_retries;
   }
   return status;
 }
 
+Status Retry(const string& description, const uint32 max_num_retries,
+             const int64 retry_interval_micros,
+             const std::function<Status()>& retried_fn,
+             const std::function<bool()>& is_cancelled) {
+  RetryOptions options;
+  options.max_num_retries = max_num_retries;
+  options.retry_interval_micros = retry_interval_micros;
+  return Retry(description, options, retried_fn, is_cancelled);
+}
+
 }  // namespace serving
 }  // namespace tensorflow
@@ -24,12 +24,46 @@ limitations under the License.
 namespace tensorflow {
 namespace serving {
 
+// Options of Retry().
+struct RetryOptions {
+  // Max number of retries after the first try.
+  uint32 max_num_retries = 0;
+
+  // The interval, in microseconds, before the first retry. If not positive,
+  // the retries are not delayed.
+  int64 retry_interval_micros = 0;
+
+  // The factor the interval is multiplied by after each retry. 1 keeps a
+  // fixed interval.
+  double backoff_multiplier = 1;
+
+  // The max interval, in microseconds, between two tries. 0 means a day.
+  int64 max_retry_interval_micros = 0;
+
+  // The fraction, in [0, 1], of each interval that is randomized: an interval
+  // of 'i' becomes uniform in [i * (1 - jitter), i * (1 + jitter)], so that
+  // the retries of concurrent failures do not all happen at once.
+  double jitter = 0;
+};
+
+// Returns the delay, in microseconds, before the retry number 'num_retries'
+// (counted from 1) of 'options'.
+int64 RetryDelayMicros(const RetryOptions& options, uint32 num_retries);
+
 // Tries running 'retried_fn' once, and if it doesn't succeed, retries running
 // the 'retried_fn' till it returns an ok status or max_num_retries are
-// exhausted or cancelled() returns true. Each retry is attempted after an
-// interval of 'retry_interval_micros'. The 'description' is useful for logging.
+// exhausted or cancelled() returns true. Each retry is attempted after a delay
+// given by RetryDelayMicros(), during which is_cancelled() is polled so that a
+// cancellation does not wait for the end of the delay. The 'description' is
+// useful for logging.
 //
 // Returns the status returned by the last call to 'retried_fn'.
+Status Retry(const string& description, const RetryOptions& options,
+             const std::function<Status()>& retried_fn,
+             const std::function<bool()>& is_cancelled = [] { return false; });
+
+// Same as above, with a fixed interval of 'retry_interval_micros' between the
+// tries.
 Status Retry(const string& description, uint32 max_num_retries,
              int64 retry_interval_micros,
              const std::function<Status()>& retried_fn,
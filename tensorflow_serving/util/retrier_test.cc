@@ -68,6 +68,53 @@ TEST(RetrierTest, RetryCancelled) {
   EXPECT_EQ(1, call_count);
 }
 
+TEST(RetrierTest, RetryDelaysBackOff) {
+  RetryOptions options;
+  options.retry_interval_micros = 100;
+  EXPECT_EQ(100, RetryDelayMicros(options, 1));
+  EXPECT_EQ(100, RetryDelayMicros(options, 5));
+
+  options.backoff_multiplier = 2;
+  EXPECT_EQ(100, RetryDelayMicros(options, 1));
+  EXPECT_EQ(200, RetryDelayMicros(options, 2));
+  EXPECT_EQ(800, RetryDelayMicros(options, 4));
+
+  options.max_retry_interval_micros = 500;
+  EXPECT_EQ(500, RetryDelayMicros(options, 4));
+  EXPECT_EQ(500, RetryDelayMicros(options, 1000));
+
+  options.retry_interval_micros = -1;
+  EXPECT_EQ(0, RetryDelayMicros(options, 2));
+}
+
+TEST(RetrierTest, RetryDelaysAreJittered) {
+  RetryOptions options;
+  options.retry_interval_micros = 1000;
+  options.jitter = 0.5;
+  for (int i = 0; i < 100; ++i) {
+    const int64 delay_micros = RetryDelayMicros(options, 1);
+    EXPECT_GE(delay_micros, 500);
+    EXPECT_LE(delay_micros, 1500);
+  }
+}
+
+TEST(RetrierTest, RetryCancelledDuringTheDelay) {
+  RetryOptions options;
+  options.max_num_retries = 10;
+  options.retry_interval_micros = 60LL * 60 * 1000 * 1000;
+  int call_count = 0;
+  auto retried_fn = [&]() {
+    ++call_count;
+    return errors::Unknown("Error");
+  };
+  int num_cancellation_polls = 0;
+  const auto status =
+      Retry("RetryCancelledDuringTheDelay", options, retried_fn,
+            [&]() { return ++num_cancellation_polls > 2; } /* cancelled */);
+  EXPECT_THAT(status.error_message(), HasSubstr("Error"));
+  EXPECT_EQ(1, call_count);
+}
+
 }  // namespace
 }  // namespace serving
 }  // namespace tensorflow
@@ -0,0 +1,81 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/reusable_memory_block.h"
+
+#include <algorithm>
+
+namespace tensorflow {
+namespace serving {
+
+namespace {
+
+// Fraction of the recent use that is forgotten on each release.
+constexpr size_t kRecentUseDecayDivisor = 16;
+
+// Returns the smallest power of two that is >= `size` and >= kMinSize.
+size_t RoundUpBlockSize(size_t size) {
+  size_t block_size = ReusableMemoryBlock::kMinSize;
+  while (block_size < size) {
+    block_size *= 2;
+  }
+  return block_size;
+}
+
+}  // namespace
+
+constexpr size_t ReusableMemoryBlock::kMinSize;
+constexpr size_t ReusableMemoryBlock::kDefaultMaxSize;
+
+ReusableMemoryBlock::Lease::Lease(ReusableMemoryBlock* block) : block_(block) {
+  if (block_->leased_) {
+    temporary_buffer_.reset(new char[block_->size_]);
+    data_ = temporary_buffer_.get();
+  } else {
+    block_->leased_ = true;
+    data_ = block_->data_.get();
+  }
+  size_ = block_->size_;
+}
+
+ReusableMemoryBlock::Lease::~Lease() {
+  if (temporary_buffer_ == nullptr) {
+    block_->Release(used_size_);
+  }
+}
+
+ReusableMemoryBlock::ReusableMemoryBlock(const size_t max_size)
+    : max_size_(std::max(max_size, kMinSize)),
+      data_(new char[kMinSize]),
+      size_(kMinSize) {}
+
+void ReusableMemoryBlock::Release(const size_t used_size) {
+  leased_ = false;
+  recent_used_size_ =
+      std::max(used_size,
+               recent_used_size_ - recent_used_size_ / kRecentUseDecayDivisor);
+
+  // Grow to the recent use, and shrink once it fits in a quarter of the block,
+  // so that uses of varying sizes do not resize the block each time.
+  const size_t target_size =
+      std::min(RoundUpBlockSize(recent_used_size_), max_size_);
+  if (target_size > size_ || target_size * 4 <= size_) {
+    data_.reset(new char[target_size]);
+    size_ = target_size;
+  }
+}
+
+}  // namespace serving
+}  // namespace tensorflow
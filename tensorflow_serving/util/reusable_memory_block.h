@@ -0,0 +1,97 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_UTIL_REUSABLE_MEMORY_BLOCK_H_
+#define TENSORFLOW_SERVING_UTIL_REUSABLE_MEMORY_BLOCK_H_
+
+#include <cstddef>
+#include <memory>
+
+#include "tensorflow/core/platform/macros.h"
+
+namespace tensorflow {
+namespace serving {
+
+// A memory block that is reused by successive short-lived allocators (e.g. the
+// rapidjson DOM or protobuf arena of each request processed by a thread), so
+// that they can serve most of their allocations without going to the heap.
+//
+// The block is sized from the memory used by recent users: it grows to the
+// largest recent use (up to `max_size`), and shrinks back when the uses have
+// been much smaller for a while.
+//
+// Typical use, with one block per thread:
+//
+//   static thread_local ReusableMemoryBlock block;
+//   ReusableMemoryBlock::Lease lease(&block);
+//   ... allocate from lease.data() and lease.size() ...
+//   lease.set_used_size(<bytes the allocator needed>);
+//
+// This class is thread-compatible.
+class ReusableMemoryBlock {
+ public:
+  static constexpr size_t kMinSize = 4 << 10;
+  static constexpr size_t kDefaultMaxSize = 16 << 20;
+
+  // Gives exclusive access to the block while it is alive. If the block is
+  // already leased (e.g. by an enclosing user on the same thread), the lease
+  // gets a temporary buffer of the block's size instead.
+  class Lease {
+   public:
+    explicit Lease(ReusableMemoryBlock* block);
+    ~Lease();
+
+    // The memory of the lease, at least kMinSize bytes, with the alignment of
+    // operator new.
+    char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+    // Records how many bytes the user needed (which can exceed size()), to
+    // size the block for the next users.
+    void set_used_size(size_t used_size) { used_size_ = used_size; }
+
+   private:
+    ReusableMemoryBlock* const block_;
+    // Set if the block was already leased.
+    std::unique_ptr<char[]> temporary_buffer_;
+    char* data_;
+    size_t size_;
+    size_t used_size_ = 0;
+
+    TF_DISALLOW_COPY_AND_ASSIGN(Lease);
+  };
+
+  explicit ReusableMemoryBlock(size_t max_size = kDefaultMaxSize);
+
+  size_t size() const { return size_; }
+
+ private:
+  // Updates the recent use with `used_size` and resizes the block if needed.
+  void Release(size_t used_size);
+
+  const size_t max_size_;
+  std::unique_ptr<char[]> data_;
+  size_t size_;
+  // Largest recent use, decayed on each release.
+  size_t recent_used_size_ = 0;
+  bool leased_ = false;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ReusableMemoryBlock);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_UTIL_REUSABLE_MEMORY_BLOCK_H_
@@ -0,0 +1,82 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/reusable_memory_block.h"
+
+#include <gtest/gtest.h>
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+TEST(ReusableMemoryBlockTest, ReusesMemory) {
+  ReusableMemoryBlock block;
+  char* data;
+  {
+    ReusableMemoryBlock::Lease lease(&block);
+    EXPECT_EQ(ReusableMemoryBlock::kMinSize, lease.size());
+    data = lease.data();
+    lease.set_used_size(100);
+  }
+  ReusableMemoryBlock::Lease lease(&block);
+  EXPECT_EQ(data, lease.data());
+}
+
+TEST(ReusableMemoryBlockTest, NestedLeases) {
+  ReusableMemoryBlock block;
+  ReusableMemoryBlock::Lease lease(&block);
+  {
+    ReusableMemoryBlock::Lease nested_lease(&block);
+    EXPECT_NE(lease.data(), nested_lease.data());
+    EXPECT_EQ(lease.size(), nested_lease.size());
+    // Not used to size the block.
+    nested_lease.set_used_size(1 << 20);
+  }
+  EXPECT_EQ(ReusableMemoryBlock::kMinSize, block.size());
+}
+
+TEST(ReusableMemoryBlockTest, GrowsAndShrinks) {
+  ReusableMemoryBlock block(/*max_size=*/1 << 20);
+  {
+    ReusableMemoryBlock::Lease lease(&block);
+    lease.set_used_size(100000);
+  }
+  EXPECT_EQ(128 << 10, block.size());
+
+  // Not resized by smaller uses while they are recent.
+  {
+    ReusableMemoryBlock::Lease lease(&block);
+    lease.set_used_size(64 << 10);
+  }
+  EXPECT_EQ(128 << 10, block.size());
+
+  // Shrinks once the small uses are all that is recent.
+  for (int i = 0; i < 100; ++i) {
+    ReusableMemoryBlock::Lease lease(&block);
+    lease.set_used_size(1000);
+  }
+  EXPECT_LE(block.size(), 8 << 10);
+
+  // Capped to the maximum size.
+  {
+    ReusableMemoryBlock::Lease lease(&block);
+    lease.set_used_size(10 << 20);
+  }
+  EXPECT_EQ(1 << 20, block.size());
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
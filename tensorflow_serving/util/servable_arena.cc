@@ -0,0 +1,74 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/servable_arena.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/mem.h"
+
+namespace tensorflow {
+namespace serving {
+
+constexpr size_t ServableArena::kDefaultBlockSize;
+constexpr size_t ServableArena::kAlignment;
+
+ServableArena::ServableArena(const size_t block_size)
+    : block_size_(block_size) {}
+
+ServableArena::~ServableArena() {
+  for (char* block : blocks_) {
+    port::AlignedFree(block);
+  }
+}
+
+void* ServableArena::Allocate(const size_t size, const size_t alignment) {
+  DCHECK_LE(alignment, kAlignment);
+  DCHECK_EQ(alignment & (alignment - 1), 0);
+  if (size > block_size_ / 4) {
+    return AllocateBlock(size);
+  }
+  const size_t padding =
+      -reinterpret_cast<uintptr_t>(head_) & (alignment - 1);
+  if (head_ == nullptr || padding + size > head_size_) {
+    head_ = AllocateBlock(block_size_);
+    if (head_ == nullptr) {
+      head_size_ = 0;
+      return nullptr;
+    }
+    head_size_ = block_size_;
+    return Allocate(size, alignment);
+  }
+  char* const result = head_ + padding;
+  head_ += padding + size;
+  head_size_ -= padding + size;
+  return result;
+}
+
+char* ServableArena::AllocateBlock(const size_t size) {
+  char* const block = static_cast<char*>(
+      port::AlignedMalloc(std::max<size_t>(size, 1), kAlignment));
+  if (block == nullptr) {
+    return nullptr;
+  }
+  blocks_.push_back(block);
+  allocated_bytes_ += size;
+  return block;
+}
+
+}  // namespace serving
+}  // namespace tensorflow
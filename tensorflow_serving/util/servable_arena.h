@@ -0,0 +1,72 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_UTIL_SERVABLE_ARENA_H_
+#define TENSORFLOW_SERVING_UTIL_SERVABLE_ARENA_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace serving {
+
+// The memory of one loaded servable: its allocations are carved out of large
+// blocks, which are all freed at once when the arena is destroyed, e.g. when
+// the servable is unloaded. The blocks are not shared with other servables,
+// so unloading one leaves no fragmentation behind, and the RAM used by the
+// servable is exactly allocated_bytes(), e.g. to report it to the resource
+// tracker.
+//
+// This class is thread-compatible.
+class ServableArena {
+ public:
+  static constexpr size_t kDefaultBlockSize = 1 << 20;
+  // Alignment of the blocks, and of the allocations by default.
+  static constexpr size_t kAlignment = 64;
+
+  explicit ServableArena(size_t block_size = kDefaultBlockSize);
+
+  // Frees all the allocations.
+  ~ServableArena();
+
+  // Returns 'size' bytes aligned on 'alignment', a power of two of at most
+  // kAlignment. Allocations larger than a quarter of a block get a block of
+  // their own. Returns null if the memory cannot be allocated.
+  void* Allocate(size_t size, size_t alignment = kAlignment);
+
+  // Combined size of the blocks.
+  uint64 allocated_bytes() const { return allocated_bytes_; }
+
+ private:
+  // Allocates a block of 'size' bytes and returns it, or null.
+  char* AllocateBlock(size_t size);
+
+  const size_t block_size_;
+  std::vector<char*> blocks_;
+  // The free space of the last block allocated for small allocations.
+  char* head_ = nullptr;
+  size_t head_size_ = 0;
+  uint64 allocated_bytes_ = 0;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ServableArena);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_UTIL_SERVABLE_ARENA_H_
@@ -0,0 +1,65 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/servable_arena.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include <gtest/gtest.h>
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+TEST(ServableArenaTest, SmallAllocationsShareBlocks) {
+  ServableArena arena(/*block_size=*/1024);
+  EXPECT_EQ(arena.allocated_bytes(), 0);
+  char* const first = static_cast<char*>(arena.Allocate(100));
+  char* const second = static_cast<char*>(arena.Allocate(10, /*alignment=*/1));
+  char* const third = static_cast<char*>(arena.Allocate(8, /*alignment=*/8));
+  ASSERT_NE(first, nullptr);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(first) % ServableArena::kAlignment, 0);
+  EXPECT_EQ(second, first + 100);
+  EXPECT_EQ(third, first + 112);
+  memset(first, 1, 120);
+  EXPECT_EQ(arena.allocated_bytes(), 1024);
+
+  // The next block is allocated once the first one is full.
+  EXPECT_EQ(arena.Allocate(256), first + 128);
+  EXPECT_EQ(arena.Allocate(256), first + 384);
+  EXPECT_EQ(arena.Allocate(256), first + 640);
+  EXPECT_EQ(arena.allocated_bytes(), 1024);
+  EXPECT_NE(arena.Allocate(256), nullptr);
+  EXPECT_EQ(arena.allocated_bytes(), 2048);
+}
+
+TEST(ServableArenaTest, LargeAllocationsHaveTheirOwnBlock) {
+  ServableArena arena(/*block_size=*/1024);
+  char* const small = static_cast<char*>(arena.Allocate(16));
+  char* const large = static_cast<char*>(arena.Allocate(5000));
+  ASSERT_NE(large, nullptr);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(large) % ServableArena::kAlignment, 0);
+  memset(large, 1, 5000);
+  EXPECT_EQ(arena.allocated_bytes(), 1024 + 5000);
+
+  // The small allocations carry on in the first block.
+  EXPECT_EQ(arena.Allocate(16), small + ServableArena::kAlignment);
+  EXPECT_EQ(arena.allocated_bytes(), 1024 + 5000);
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow
@@ -15,6 +15,12 @@ limitations under the License.
 
 #include "tensorflow_serving/util/threadpool_executor.h"
 
+#include <algorithm>
+#include <utility>
+
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/logging.h"
+
 namespace tensorflow {
 namespace serving {
 
@@ -28,5 +34,106 @@ void ThreadPoolExecutor::Schedule(std::function<void()> fn) {
   thread_pool_.Schedule(fn);
 }
 
+namespace {
+
+auto* executor_queue_depth = monitoring::Gauge<int64, 2>::New(
+    "/tensorflow/serving/executor/queue_depth",
+    "The number of closures waiting in the queue of each priority of an "
+    "executor.",
+    "executor", "priority");
+
+}  // namespace
+
+PriorityThreadPoolExecutor::PriorityThreadPoolExecutor(
+    Env* const env, const string& name, int num_threads,
+    const Options& options)
+    : env_(env), options_(options), queues_(options.num_priorities) {
+  CHECK_GT(num_threads, 0);
+  CHECK_GT(options.num_priorities, 0);
+  for (int priority = 0; priority < options.num_priorities; ++priority) {
+    queue_depth_cells_.push_back(
+        executor_queue_depth->GetCell(name, std::to_string(priority)));
+  }
+  for (int i = 0; i < num_threads; ++i) {
+    threads_.emplace_back(env->StartThread(
+        {}, strings::StrCat(name, "_", i), [this]() { WorkerLoop(); }));
+  }
+}
+
+PriorityThreadPoolExecutor::~PriorityThreadPoolExecutor() {
+  {
+    mutex_lock l(mu_);
+    shutting_down_ = true;
+  }
+  task_available_.notify_all();
+  // Joins the threads, once they have run the queued closures.
+  threads_.clear();
+}
+
+void PriorityThreadPoolExecutor::Schedule(std::function<void()> fn) {
+  Schedule(std::move(fn), 0);
+}
+
+void PriorityThreadPoolExecutor::Schedule(std::function<void()> fn,
+                                          int priority) {
+  priority = std::min(std::max(priority, 0), options_.num_priorities - 1);
+  {
+    mutex_lock l(mu_);
+    queues_[priority].push_back({std::move(fn), env_->NowMicros()});
+    ++num_queued_tasks_;
+    queue_depth_cells_[priority]->Set(queues_[priority].size());
+  }
+  task_available_.notify_one();
+}
+
+void PriorityThreadPoolExecutor::WorkerLoop() {
+  while (true) {
+    Task task;
+    {
+      mutex_lock l(mu_);
+      while (num_queued_tasks_ == 0 && !shutting_down_) {
+        task_available_.wait(l);
+      }
+      if (num_queued_tasks_ == 0) {
+        return;
+      }
+      task = PopTask();
+    }
+    task.fn();
+  }
+}
+
+PriorityThreadPoolExecutor::Task PriorityThreadPoolExecutor::PopTask() {
+  // The highest priority with queued closures, unless a closure of a lower
+  // priority waited 'max_queue_delay_micros' longer per priority level than
+  // the oldest closure of that priority. The queues are FIFO, so only their
+  // oldest closures are compared.
+  int priority = options_.num_priorities - 1;
+  while (queues_[priority].empty()) {
+    --priority;
+  }
+  if (options_.max_queue_delay_micros > 0) {
+    int64 best_key =
+        static_cast<int64>(queues_[priority].front().enqueue_micros) -
+        priority * options_.max_queue_delay_micros;
+    for (int i = priority - 1; i >= 0; --i) {
+      if (queues_[i].empty()) continue;
+      const int64 key =
+          static_cast<int64>(queues_[i].front().enqueue_micros) -
+          i * options_.max_queue_delay_micros;
+      if (key < best_key) {
+        priority = i;
+        best_key = key;
+      }
+    }
+  }
+
+  Task task = std::move(queues_[priority].front());
+  queues_[priority].pop_front();
+  --num_queued_tasks_;
+  queue_depth_cells_[priority]->Set(queues_[priority].size());
+  return task;
+}
+
 }  // namespace serving
 }  // namespace tensorflow
@@ -16,10 +16,16 @@ limitations under the License.
 #ifndef TENSORFLOW_SERVING_UTIL_THREADPOOL_EXECUTOR_H_
 #define TENSORFLOW_SERVING_UTIL_THREADPOOL_EXECUTOR_H_
 
+#include <deque>
 #include <functional>
+#include <memory>
+#include <vector>
 
 #include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/lib/monitoring/gauge.h"
 #include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
 #include "tensorflow_serving/util/executor.h"
 
 namespace tensorflow {
@@ -46,6 +52,79 @@ class ThreadPoolExecutor : public Executor {
   TF_DISALLOW_COPY_AND_ASSIGN(ThreadPoolExecutor);
 };
 
+// An executor which uses a pool of threads to execute the scheduled closures,
+// the closures of higher priorities first. Each priority has a FIFO queue,
+// whose depth is exported as the "/tensorflow/serving/executor/queue_depth"
+// gauge.
+//
+// With 'max_queue_delay_micros', a closure runs before the closures of the
+// next higher priority once it waited that much longer than them, so that they
+// cannot starve it. Each priority level is thus worth a fixed delay, and the
+// higher priorities keep their advantage when all the queues are long.
+class PriorityThreadPoolExecutor : public Executor {
+ public:
+  struct Options {
+    // The number of priorities, from 0 (the lowest, that of Schedule(fn)) to
+    // num_priorities - 1.
+    int num_priorities = 2;
+
+    // If positive, how much longer than a closure of the next higher priority
+    // a queued closure waits before it runs first (twice as long for two
+    // levels higher, and so on). If 0, a closure only runs once the queues of
+    // higher priorities are empty.
+    int64 max_queue_delay_micros = 0;
+  };
+
+  // Constructs a threadpool that has 'num_threads' threads with specified
+  // 'thread_pool_name'. Env is used to start the threads and to time the
+  // queued closures.
+  //
+  // REQUIRES: num_threads > 0, options.num_priorities > 0.
+  PriorityThreadPoolExecutor(Env* env, const string& thread_pool_name,
+                             int num_threads, const Options& options);
+
+  // Waits until all scheduled work has finished and then destroy the set of
+  // threads.
+  ~PriorityThreadPoolExecutor() override;
+
+  // Schedules 'fn' at the lowest priority.
+  void Schedule(std::function<void()> fn) override;
+
+  // Schedules 'fn' at 'priority', clamped to [0, options.num_priorities).
+  void Schedule(std::function<void()> fn, int priority);
+
+ private:
+  struct Task {
+    std::function<void()> fn;
+    uint64 enqueue_micros;
+  };
+
+  // Runs the queued closures until the executor is destroyed.
+  void WorkerLoop();
+
+  // Removes and returns the next closure to run.
+  //
+  // REQUIRES: At least one queue is not empty.
+  Task PopTask() TF_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  Env* const env_;
+  const Options options_;
+
+  mutex mu_;
+  condition_variable task_available_;
+  // The queues, indexed by priority.
+  std::vector<std::deque<Task>> queues_ TF_GUARDED_BY(mu_);
+  int64 num_queued_tasks_ TF_GUARDED_BY(mu_) = 0;
+  bool shutting_down_ TF_GUARDED_BY(mu_) = false;
+
+  // The queue depth gauge cells, indexed by priority.
+  std::vector<monitoring::GaugeCell<int64>*> queue_depth_cells_;
+
+  std::vector<std::unique_ptr<Thread>> threads_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(PriorityThreadPoolExecutor);
+};
+
 }  // namespace serving
 }  // namespace tensorflow
 
@@ -15,7 +15,12 @@ limitations under the License.
 
 #include "tensorflow_serving/util/threadpool_executor.h"
 
+#include <vector>
+
 #include <gtest/gtest.h>
+#include "tensorflow/core/kernels/batching_util/fake_clock_env.h"
+#include "tensorflow/core/lib/core/notification.h"
+#include "tensorflow/core/platform/mutex.h"
 
 namespace tensorflow {
 namespace serving {
@@ -55,6 +60,80 @@ TEST(ThreadPoolExecutor, DoWork) {
   }
 }
 
+// Schedules the closures of 'priorities' on a single thread executor, once
+// its thread runs a blocking closure, and returns their order of execution.
+// 'advance_clock' is called after each one is scheduled.
+std::vector<int> ExecutionOrder(
+    Env* env, const PriorityThreadPoolExecutor::Options& options,
+    const std::vector<int>& priorities,
+    const std::function<void()>& advance_clock) {
+  mutex mu;
+  std::vector<int> order;
+  {
+    PriorityThreadPoolExecutor executor(env, "test", 1, options);
+    Notification started, unblock;
+    executor.Schedule([&]() {
+      started.Notify();
+      unblock.WaitForNotification();
+    });
+    started.WaitForNotification();
+    for (int i = 0; i < static_cast<int>(priorities.size()); ++i) {
+      executor.Schedule(
+          [&mu, &order, i]() {
+            mutex_lock l(mu);
+            order.push_back(i);
+          },
+          priorities[i]);
+      advance_clock();
+    }
+    unblock.Notify();
+  }
+  return order;
+}
+
+TEST(PriorityThreadPoolExecutor, DoWork) {
+  const int kWorkItems = 15;
+  bool work[kWorkItems];
+  for (int i = 0; i < kWorkItems; ++i) {
+    work[i] = false;
+  }
+  {
+    PriorityThreadPoolExecutor executor(Env::Default(), "test", 4, {});
+    for (int i = 0; i < kWorkItems; i++) {
+      executor.Schedule(
+          [&work, i]() {
+            ASSERT_FALSE(work[i]);
+            work[i] = true;
+          },
+          i % 3);
+    }
+  }
+  for (int i = 0; i < kWorkItems; i++) {
+    ASSERT_TRUE(work[i]);
+  }
+}
+
+TEST(PriorityThreadPoolExecutor, RunsHigherPrioritiesFirst) {
+  PriorityThreadPoolExecutor::Options options;
+  options.num_priorities = 3;
+  // The out of range priorities are clamped.
+  EXPECT_EQ(ExecutionOrder(Env::Default(), options, {0, 1, 0, 2, 1, 5, -1},
+                           []() {}),
+            std::vector<int>({3, 5, 1, 4, 0, 2, 6}));
+}
+
+TEST(PriorityThreadPoolExecutor, AgedClosuresRunFirst) {
+  test_util::FakeClockEnv env(Env::Default());
+  PriorityThreadPoolExecutor::Options options;
+  options.max_queue_delay_micros = 100;
+  // The closures are scheduled 60us apart. Closure 0 waited 120us longer than
+  // closure 2 and runs before it, but not before closure 1, and closure 3 only
+  // waited 60us longer than closure 4, even though it waited more than 100us.
+  EXPECT_EQ(ExecutionOrder(&env, options, {0, 1, 1, 0, 1},
+                           [&env]() { env.AdvanceByMicroseconds(60); }),
+            std::vector<int>({1, 0, 2, 4, 3}));
+}
+
 }  // namespace
 }  // namespace serving
 }  // namespace tensorflow
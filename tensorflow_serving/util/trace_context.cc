@@ -0,0 +1,176 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/trace_context.h"
+
+#include "absl/strings/str_cat.h"
+#include "tensorflow/core/platform/random.h"
+#include "tensorflow/core/profiler/lib/traceme.h"
+#include "tensorflow/core/profiler/lib/traceme_encode.h"
+
+namespace tensorflow {
+namespace serving {
+
+namespace {
+
+thread_local const TraceContext* current_trace_context = nullptr;
+
+// Parses the 'text.size() * 4' bits hexadecimal number 'text'.
+bool ParseHex(const absl::string_view text, uint64* value) {
+  *value = 0;
+  for (const char c : text) {
+    int digit;
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else {
+      // Upper case digits are invalid in trace contexts.
+      return false;
+    }
+    *value = (*value << 4) | digit;
+  }
+  return true;
+}
+
+uint64 NewId() {
+  uint64 id;
+  do {
+    id = random::New64();
+  } while (id == 0);
+  return id;
+}
+
+}  // namespace
+
+string TraceContext::TraceIdHex() const {
+  return absl::StrCat(absl::Hex(trace_id_high, absl::kZeroPad16),
+                      absl::Hex(trace_id_low, absl::kZeroPad16));
+}
+
+string TraceContext::SpanIdHex() const {
+  return absl::StrCat(absl::Hex(span_id, absl::kZeroPad16));
+}
+
+string TraceContext::ToTraceparent() const {
+  return absl::StrCat("00-", TraceIdHex(), "-", SpanIdHex(),
+                      sampled ? "-01" : "-00");
+}
+
+absl::optional<TraceContext> TraceContext::FromTraceparent(
+    const absl::string_view traceparent) {
+  // "vv-<32>-<16>-ff", possibly followed by fields of future versions.
+  constexpr int kSize = 55;
+  if (traceparent.size() < kSize || traceparent[2] != '-' ||
+      traceparent[35] != '-' || traceparent[52] != '-') {
+    return absl::nullopt;
+  }
+  uint64 version;
+  uint64 flags;
+  TraceContext context;
+  if (!ParseHex(traceparent.substr(0, 2), &version) || version == 0xff ||
+      (version == 0 && traceparent.size() != kSize) ||
+      (traceparent.size() > kSize && traceparent[kSize] != '-') ||
+      !ParseHex(traceparent.substr(3, 16), &context.trace_id_high) ||
+      !ParseHex(traceparent.substr(19, 16), &context.trace_id_low) ||
+      !ParseHex(traceparent.substr(36, 16), &context.span_id) ||
+      !ParseHex(traceparent.substr(53, 2), &flags) || !context.valid()) {
+    return absl::nullopt;
+  }
+  context.sampled = (flags & 1) != 0;
+  return context;
+}
+
+const TraceContext* CurrentTraceContext() { return current_trace_context; }
+
+ScopedTraceContext::ScopedTraceContext(const TraceContext* context)
+    : set_(context != nullptr) {
+  if (set_) {
+    previous_ = current_trace_context;
+    current_trace_context = context;
+  }
+}
+
+ScopedTraceContext::~ScopedTraceContext() {
+  if (set_) {
+    current_trace_context = previous_;
+  }
+}
+
+TraceSpan::TraceSpan(const absl::string_view name,
+                     const TraceContext* parent) {
+  if (parent == nullptr) {
+    return;
+  }
+  parent_ = *parent;
+  if (!parent->sampled) {
+    return;
+  }
+  context_.trace_id_high = parent->trace_id_high;
+  context_.trace_id_low = parent->trace_id_low;
+  Start(name, {});
+}
+
+TraceSpan::TraceSpan(const absl::string_view name,
+                     const std::vector<TraceContext>& links) {
+  bool sampled_link = false;
+  for (const TraceContext& link : links) {
+    sampled_link |= link.sampled;
+  }
+  if (!sampled_link) {
+    return;
+  }
+  context_.trace_id_high = NewId();
+  context_.trace_id_low = NewId();
+  Start(name, links);
+}
+
+void TraceSpan::Start(const absl::string_view name,
+                      const std::vector<TraceContext>& links) {
+  recording_ = true;
+  context_.span_id = NewId();
+  context_.sampled = true;
+  activity_id_ = profiler::TraceMe::ActivityStart([&]() {
+    string encoded_links;
+    for (const TraceContext& link : links) {
+      absl::StrAppend(&encoded_links, encoded_links.empty() ? "" : ",",
+                      link.TraceIdHex(), "-", link.SpanIdHex());
+    }
+    return profiler::TraceMeEncode(
+        name, {{"trace_id", context_.TraceIdHex()},
+               {"span_id", context_.SpanIdHex()},
+               {"parent_span_id", parent_ ? parent_->SpanIdHex() : ""},
+               {"links", encoded_links}});
+  });
+}
+
+TraceSpan::~TraceSpan() { End(); }
+
+void TraceSpan::End() {
+  if (recording_) {
+    profiler::TraceMe::ActivityEnd(activity_id_);
+    recording_ = false;
+  }
+}
+
+const TraceContext* TraceSpan::context() const {
+  if (context_.valid()) {
+    return &context_;
+  }
+  return parent_ ? &*parent_ : nullptr;
+}
+
+}  // namespace serving
+}  // namespace tensorflow
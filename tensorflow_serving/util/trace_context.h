@@ -0,0 +1,125 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_SERVING_UTIL_TRACE_CONTEXT_H_
+#define TENSORFLOW_SERVING_UTIL_TRACE_CONTEXT_H_
+
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace serving {
+
+// Name of the header (HTTP) and metadata key (gRPC) propagating the trace
+// context of the requests.
+constexpr char kTraceparentHeader[] = "traceparent";
+
+// The trace context of a request, as propagated by the W3C "traceparent"
+// header (https://www.w3.org/TR/trace-context/), e.g. by OpenTelemetry:
+// "00-<32 hex digits trace id>-<16 hex digits parent span id>-<2 hex digits
+// flags>".
+struct TraceContext {
+  // 128 bits id of the trace.
+  uint64 trace_id_high = 0;
+  uint64 trace_id_low = 0;
+  // Id of the span the request belongs to.
+  uint64 span_id = 0;
+  // Whether the caller records the trace. Only sampled traces are recorded.
+  bool sampled = false;
+
+  // Whether the ids are set, as all zeros ids are invalid.
+  bool valid() const {
+    return (trace_id_high != 0 || trace_id_low != 0) && span_id != 0;
+  }
+
+  string TraceIdHex() const;
+  string SpanIdHex() const;
+
+  // Returns the "traceparent" value of the context.
+  string ToTraceparent() const;
+
+  // Parses a "traceparent" value. Returns nullopt if it is malformed or
+  // invalid, in which case the request is not traced.
+  static absl::optional<TraceContext> FromTraceparent(
+      absl::string_view traceparent);
+};
+
+// Returns the trace context of the request the current thread works for, or
+// null if the request is not traced. See ScopedTraceContext.
+const TraceContext* CurrentTraceContext();
+
+// Sets the trace context of the current thread for the lifetime of this
+// object. Does nothing if 'context' is null.
+class ScopedTraceContext {
+ public:
+  explicit ScopedTraceContext(const TraceContext* context);
+  ~ScopedTraceContext();
+
+ private:
+  const bool set_;
+  const TraceContext* previous_ = nullptr;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ScopedTraceContext);
+};
+
+// A span of a traced request, recorded as a TraceMe activity annotated with
+// the "trace_id", "span_id" and "parent_span_id" of the span. The activities
+// are collected by the TensorFlow profiler along the TensorFlow ones.
+//
+// A span is recorded if its parent is sampled, or, for the spans without
+// parent, if one of its links is. The span ends when End() is called or when
+// destroyed, possibly on another thread than the one starting it.
+class TraceSpan {
+ public:
+  // Starts a child span of 'parent'. Does nothing if 'parent' is null or not
+  // sampled.
+  TraceSpan(absl::string_view name, const TraceContext* parent);
+
+  // Starts the root span of a new trace, linked to the spans 'links', e.g. the
+  // batch processing the requests 'links'. The links are recorded as a
+  // "links" annotation: comma separated "<trace id>-<span id>" values.
+  TraceSpan(absl::string_view name, const std::vector<TraceContext>& links);
+
+  ~TraceSpan();
+
+  // Ends the span. Does nothing if it has already ended.
+  void End();
+
+  // Whether the span is being recorded, i.e. is sampled and has not ended.
+  bool recording() const { return recording_; }
+
+  // Returns the context to propagate to the children of the span: the context
+  // of the span if recorded, else the parent's (null if none).
+  const TraceContext* context() const;
+
+ private:
+  void Start(absl::string_view name, const std::vector<TraceContext>& links);
+
+  bool recording_ = false;
+  absl::optional<TraceContext> parent_;
+  TraceContext context_;
+  uint64 activity_id_ = 0;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(TraceSpan);
+};
+
+}  // namespace serving
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_SERVING_UTIL_TRACE_CONTEXT_H_
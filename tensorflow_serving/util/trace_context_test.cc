@@ -0,0 +1,133 @@
+/* Copyright 2021 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow_serving/util/trace_context.h"
+
+#include <gtest/gtest.h>
+
+namespace tensorflow {
+namespace serving {
+namespace {
+
+constexpr char kTraceparent[] =
+    "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01";
+
+TEST(TraceContextTest, ParseAndFormat) {
+  const absl::optional<TraceContext> context =
+      TraceContext::FromTraceparent(kTraceparent);
+  ASSERT_TRUE(context.has_value());
+  EXPECT_EQ(0x4bf92f3577b34da6, context->trace_id_high);
+  EXPECT_EQ(0xa3ce929d0e0e4736, context->trace_id_low);
+  EXPECT_EQ(0x00f067aa0ba902b7, context->span_id);
+  EXPECT_TRUE(context->sampled);
+  EXPECT_EQ("4bf92f3577b34da6a3ce929d0e0e4736", context->TraceIdHex());
+  EXPECT_EQ("00f067aa0ba902b7", context->SpanIdHex());
+  EXPECT_EQ(kTraceparent, context->ToTraceparent());
+
+  const absl::optional<TraceContext> not_sampled =
+      TraceContext::FromTraceparent(
+          "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-00");
+  ASSERT_TRUE(not_sampled.has_value());
+  EXPECT_FALSE(not_sampled->sampled);
+
+  // Future versions may append fields.
+  EXPECT_TRUE(TraceContext::FromTraceparent(
+                  "01-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01-xyz")
+                  .has_value());
+}
+
+TEST(TraceContextTest, ParseInvalid) {
+  for (const char* traceparent : {
+           "",
+           "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7",
+           "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01-",
+           "00-4BF92F3577B34DA6A3CE929D0E0E4736-00f067aa0ba902b7-01",
+           "00-00000000000000000000000000000000-00f067aa0ba902b7-01",
+           "00-4bf92f3577b34da6a3ce929d0e0e4736-0000000000000000-01",
+           "ff-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01",
+           "00_4bf92f3577b34da6a3ce929d0e0e4736_00f067aa0ba902b7_01",
+       }) {
+    EXPECT_FALSE(TraceContext::FromTraceparent(traceparent).has_value())
+        << traceparent;
+  }
+}
+
+TEST(TraceContextTest, ScopedTraceContext) {
+  EXPECT_EQ(nullptr, CurrentTraceContext());
+  const TraceContext context =
+      TraceContext::FromTraceparent(kTraceparent).value();
+  {
+    ScopedTraceContext scoped_context(&context);
+    EXPECT_EQ(&context, CurrentTraceContext());
+    {
+      ScopedTraceContext no_context(nullptr);
+      EXPECT_EQ(&context, CurrentTraceContext());
+      TraceContext nested_context = context;
+      ScopedTraceContext scoped_nested_context(&nested_context);
+      EXPECT_EQ(&nested_context, CurrentTraceContext());
+    }
+    EXPECT_EQ(&context, CurrentTraceContext());
+  }
+  EXPECT_EQ(nullptr, CurrentTraceContext());
+}
+
+TEST(TraceSpanTest, ChildSpan) {
+  const TraceContext parent =
+      TraceContext::FromTraceparent(kTraceparent).value();
+  TraceSpan span("span", &parent);
+  EXPECT_TRUE(span.recording());
+  ASSERT_NE(nullptr, span.context());
+  EXPECT_EQ(parent.TraceIdHex(), span.context()->TraceIdHex());
+  EXPECT_NE(parent.span_id, span.context()->span_id);
+  EXPECT_TRUE(span.context()->sampled);
+
+  span.End();
+  EXPECT_FALSE(span.recording());
+  EXPECT_EQ(parent.TraceIdHex(), span.context()->TraceIdHex());
+}
+
+TEST(TraceSpanTest, NotSampledParent) {
+  TraceContext parent = TraceContext::FromTraceparent(kTraceparent).value();
+  parent.sampled = false;
+  TraceSpan span("span", &parent);
+  EXPECT_FALSE(span.recording());
+  // The context of the parent is propagated.
+  ASSERT_NE(nullptr, span.context());
+  EXPECT_EQ(parent.ToTraceparent(), span.context()->ToTraceparent());
+
+  TraceSpan no_parent_span("span", /*parent=*/nullptr);
+  EXPECT_FALSE(no_parent_span.recording());
+  EXPECT_EQ(nullptr, no_parent_span.context());
+}
+
+TEST(TraceSpanTest, LinkedSpan) {
+  const TraceContext link = TraceContext::FromTraceparent(kTraceparent).value();
+  TraceContext not_sampled_link = link;
+  not_sampled_link.sampled = false;
+
+  TraceSpan span("batch", {not_sampled_link, link});
+  EXPECT_TRUE(span.recording());
+  ASSERT_NE(nullptr, span.context());
+  EXPECT_TRUE(span.context()->valid());
+  EXPECT_NE(link.TraceIdHex(), span.context()->TraceIdHex());
+
+  TraceSpan not_sampled_span("batch", {not_sampled_link});
+  EXPECT_FALSE(not_sampled_span.recording());
+  EXPECT_EQ(nullptr, not_sampled_span.context());
+}
+
+}  // namespace
+}  // namespace serving
+}  // namespace tensorflow